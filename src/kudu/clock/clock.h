@@ -52,6 +52,12 @@ class Clock : public RefCountedThreadSafe<Clock> {
   // plus the max_error.
   virtual Timestamp NowLatest() = 0;
 
+  // Reserves 'count' consecutive timestamps, as many calls to Now() would, but
+  // reads the time only once. Returns the first one: the others follow it
+  // one by one, and any later call to Now() returns a higher value than the
+  // last of them. Requires 'count' > 0.
+  virtual Timestamp NowRange(int count) = 0;
+
   // Obtain a timestamp which is guaranteed to be later than the current time
   // on any machine in the cluster.
   //
@@ -27,6 +27,7 @@
 
 #include "kudu/clock/hybrid_clock.h"
 #include "kudu/clock/mock_ntp.h"
+#include "kudu/clock/system_ntp.h"
 #include "kudu/clock/time_service.h"
 #include "kudu/common/timestamp.h"
 #include "kudu/gutil/casts.h"
@@ -43,6 +44,7 @@
 #include "kudu/util/thread.h"
 
 DECLARE_bool(inject_unsync_time_errors);
+DECLARE_int32(ntp_max_error_refresh_interval_ms);
 DECLARE_string(time_source);
 
 using std::string;
@@ -184,6 +186,23 @@ TEST_F(HybridClockTest, TestUpdate_LogicalValueIncreasesByAmount) {
       HybridClock::GetPhysicalValueMicros(now2));
 }
 
+// Tests that NowRange() reserves logical values for the whole range.
+TEST_F(HybridClockTest, TestNowRange_ReservesConsecutiveValues) {
+  Timestamp now = clock_->Now();
+  // Move the clock ahead so that the next readings only have logical values
+  // added to them.
+  Timestamp now_increased =
+      HybridClock::TimestampFromMicrosecondsAndLogicalValue(
+          HybridClock::GetPhysicalValueMicros(now) + 200000, 0);
+  ASSERT_OK(clock_->Update(now_increased));
+
+  const int kCount = 10;
+  Timestamp first = clock_->NowRange(kCount);
+  ASSERT_EQ(now_increased.value() + 1, first.value());
+  Timestamp next = clock_->Now();
+  ASSERT_EQ(first.value() + kCount, next.value());
+}
+
 // Test that the incoming event is in the past, i.e. less than now - max_error
 TEST_F(HybridClockTest, TestWaitUntilAfter_TestCase1) {
   MonoTime no_deadline;
@@ -368,6 +387,44 @@ TEST_F(HybridClockTest, TestNtpDiagnostics) {
   ASSERT_STR_CONTAINS(s, "ntpq");
   ASSERT_STR_CONTAINS(s, "ntp_gettime");
 }
+
+TEST(SystemNtpTest, TestExtrapolateMaxError) {
+  ASSERT_EQ(1000U, SystemNtp::ExtrapolateMaxError(1000, 0, 500));
+  ASSERT_EQ(1500U, SystemNtp::ExtrapolateMaxError(1000, 1000000, 500));
+  // Any time at all widens the bound.
+  ASSERT_EQ(1001U, SystemNtp::ExtrapolateMaxError(1000, 1, 500));
+  ASSERT_EQ(1001U, SystemNtp::ExtrapolateMaxError(1000, 1999, 500));
+  ASSERT_EQ(1002U, SystemNtp::ExtrapolateMaxError(1000, 2001, 500));
+  ASSERT_EQ(1000U, SystemNtp::ExtrapolateMaxError(1000, 1000000, 0));
+}
+
+// In between the reads from the kernel, the error bound grows from the last
+// one at the skew rate.
+TEST_F(HybridClockTest, TestNtpErrorBoundBetweenRefreshes) {
+  FLAGS_ntp_max_error_refresh_interval_ms = 60000;
+  SystemNtp ntp;
+  ASSERT_OK(ntp.Init());
+
+  MonoTime before = MonoTime::Now();
+  uint64_t now_usec;
+  uint64_t error_usec;
+  ASSERT_OK(ntp.WalltimeWithError(&now_usec, &error_usec));
+  SleepFor(MonoDelta::FromMilliseconds(20));
+  uint64_t next_now_usec;
+  uint64_t next_error_usec;
+  ASSERT_OK(ntp.WalltimeWithError(&next_now_usec, &next_error_usec));
+  MonoTime after = MonoTime::Now();
+
+  ASSERT_GE(next_now_usec, now_usec + 20000);
+  ASSERT_GE(next_error_usec, error_usec);
+  if (ntp.skew_ppm() > 0) {
+    ASSERT_GT(next_error_usec, error_usec);
+  }
+  ASSERT_LE(
+      next_error_usec,
+      SystemNtp::ExtrapolateMaxError(
+          error_usec, (after - before).ToMicroseconds(), ntp.skew_ppm()));
+}
 #endif
 
 } // namespace clock
@@ -152,6 +152,18 @@ Timestamp HybridClock::Now() {
   return now;
 }
 
+Timestamp HybridClock::NowRange(int count) {
+  DCHECK_GT(count, 0);
+  Timestamp first;
+  uint64_t error;
+
+  std::lock_guard<simple_spinlock> lock(lock_);
+  NowWithError(&first, &error);
+  // NowWithError() only handed out 'first'; skip past the rest of the range.
+  next_timestamp_ += count - 1;
+  return first;
+}
+
 Timestamp HybridClock::NowLatest() {
   Timestamp now;
   uint64_t error;
@@ -51,6 +51,10 @@ class HybridClock : public Clock {
   // time.
   virtual Timestamp NowLatest() override;
 
+  // Obtains 'count' consecutive timestamps from a single time reading, the
+  // ones after the first being logical increments of it.
+  virtual Timestamp NowRange(int count) override;
+
   // Obtain a timestamp which is guaranteed to be later than the current time
   // on any machine in the cluster.
   //
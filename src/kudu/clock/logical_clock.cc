@@ -48,6 +48,11 @@ Timestamp LogicalClock::Now() {
   return Timestamp(Barrier_AtomicIncrement(&now_, 1));
 }
 
+Timestamp LogicalClock::NowRange(int count) {
+  DCHECK_GT(count, 0);
+  return Timestamp(Barrier_AtomicIncrement(&now_, count) - (count - 1));
+}
+
 Timestamp LogicalClock::NowLatest() {
   return Now();
 }
@@ -56,6 +56,8 @@ class LogicalClock : public Clock {
   // In the logical clock this call is equivalent to Now();
   virtual Timestamp NowLatest() override;
 
+  virtual Timestamp NowRange(int count) override;
+
   virtual Status Update(const Timestamp& to_update) override;
 
   // The Wait*() functions are not available for this clock.
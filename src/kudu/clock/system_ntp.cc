@@ -21,6 +21,7 @@
 #include <sys/timex.h>
 
 #include <cerrno>
+#include <mutex>
 #include <ostream>
 #include <string>
 #include <vector>
@@ -32,6 +33,7 @@
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/strings/join.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/walltime.h"
 #include "kudu/util/errno.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
@@ -51,6 +53,25 @@ DEFINE_int32(
 TAG_FLAG(ntp_initial_sync_wait_secs, evolving);
 TAG_FLAG(ntp_initial_sync_wait_secs, advanced);
 
+DEFINE_int32(
+    ntp_max_error_refresh_interval_ms,
+    100,
+    "How often, in milliseconds, to read the clock's maximum error from the "
+    "kernel with ntp_adjtime(). In between, clock reads do not make a syscall "
+    "and the error is extrapolated from the last one at the maximum skew "
+    "rate. A value of zero reads the error on every clock read.");
+TAG_FLAG(ntp_max_error_refresh_interval_ms, advanced);
+TAG_FLAG(ntp_max_error_refresh_interval_ms, runtime);
+
+static bool ValidateRefreshInterval(const char* flagname, int32_t value) {
+  if (value < 0) {
+    LOG(ERROR) << "--" << flagname << " must not be negative, got " << value;
+    return false;
+  }
+  return true;
+}
+DEFINE_validator(ntp_max_error_refresh_interval_ms, &ValidateRefreshInterval);
+
 using std::string;
 using std::vector;
 using strings::Substitute;
@@ -226,9 +247,51 @@ Status SystemNtp::Init() {
 }
 
 Status SystemNtp::WalltimeWithError(uint64_t* now_usec, uint64_t* error_usec) {
+  MonoTime now = MonoTime::Now();
+  MonoTime refreshed_at;
+  uint64_t refreshed_error_usec;
+  {
+    std::lock_guard<simple_spinlock> l(refresh_lock_);
+    refreshed_at = refreshed_at_;
+    refreshed_error_usec = refreshed_error_usec_;
+  }
+  if (PREDICT_FALSE(
+          !refreshed_at.Initialized() || FLAGS_inject_unsync_time_errors ||
+          now - refreshed_at >= MonoDelta::FromMilliseconds(
+                                    FLAGS_ntp_max_error_refresh_interval_ms))) {
+    return RefreshWalltimeWithError(now, now_usec, error_usec);
+  }
+
+  // The kernel grows its own max error at the tolerance rate between NTP
+  // updates, so extrapolating at the same rate (rounded up) keeps the bound.
+  uint64_t micros_since_refresh = (now - refreshed_at).ToMicroseconds();
+  *now_usec = GetCurrentTimeMicros();
+  *error_usec = ExtrapolateMaxError(
+      refreshed_error_usec, micros_since_refresh, skew_ppm_);
+  return Status::OK();
+}
+
+uint64_t SystemNtp::ExtrapolateMaxError(
+    uint64_t error_usec,
+    uint64_t micros_since_refresh,
+    uint64_t skew_ppm) {
+  return error_usec +
+      (micros_since_refresh * skew_ppm + kMicrosPerSec - 1) / kMicrosPerSec;
+}
+
+Status SystemNtp::RefreshWalltimeWithError(
+    MonoTime now,
+    uint64_t* now_usec,
+    uint64_t* error_usec) {
   // Read the time. This will return an error if the clock is not synchronized.
   timex tx;
-  RETURN_NOT_OK(CallAdjTime(&tx));
+  Status s = CallAdjTime(&tx);
+  if (PREDICT_FALSE(!s.ok())) {
+    // Go back to the kernel on the next read as well, until it recovers.
+    std::lock_guard<simple_spinlock> l(refresh_lock_);
+    refreshed_at_ = MonoTime();
+    return s;
+  }
 
   if (tx.status & STA_NANO) {
     tx.time.tv_usec /= 1000;
@@ -237,6 +300,14 @@ Status SystemNtp::WalltimeWithError(uint64_t* now_usec, uint64_t* error_usec) {
 
   *now_usec = tx.time.tv_sec * kMicrosPerSec + tx.time.tv_usec;
   *error_usec = tx.maxerror;
+
+  // Extrapolating from when the call started rather than when it returned
+  // only makes the following error bounds larger.
+  std::lock_guard<simple_spinlock> l(refresh_lock_);
+  if (!refreshed_at_.Initialized() || refreshed_at_ < now) {
+    refreshed_at_ = now;
+    refreshed_error_usec_ = tx.maxerror;
+  }
   return Status::OK();
 }
 
@@ -22,6 +22,8 @@
 
 #include "kudu/clock/time_service.h"
 #include "kudu/gutil/macros.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/status.h"
 
 namespace kudu {
@@ -33,6 +35,12 @@ namespace clock {
 //
 // This implementation relies on the ntpd service running on the local host
 // to keep the kernel's timekeeping up to date and in sync.
+//
+// Since 'ntp_adjtime' is a real syscall, the error bound it returns is only
+// refreshed every --ntp_max_error_refresh_interval_ms. In between, the time
+// is read with clock_gettime(), which the vDSO serves without entering the
+// kernel, and the error bound is grown from the last one at the maximum skew
+// rate, as the kernel itself does.
 class SystemNtp : public TimeService {
  public:
   SystemNtp() = default;
@@ -50,6 +58,13 @@ class SystemNtp : public TimeService {
 
   virtual void DumpDiagnostics(std::vector<std::string>* log) const override;
 
+  // Returns the error bound 'micros_since_refresh' after the kernel reported
+  // 'error_usec', for a clock which drifts by at most 'skew_ppm'. Rounds up.
+  static uint64_t ExtrapolateMaxError(
+      uint64_t error_usec,
+      uint64_t micros_since_refresh,
+      uint64_t skew_ppm);
+
  private:
   // The scaling factor used to obtain ppms. From the adjtimex source:
   // "scale factor used by adjtimex freq param.  1 ppm = 65536"
@@ -57,9 +72,26 @@ class SystemNtp : public TimeService {
 
   static const uint64_t kMicrosPerSec;
 
+  // Calls 'ntp_adjtime' for the current time and error bound, which become
+  // the base of the following reads. 'now' is when the call was started.
+  Status RefreshWalltimeWithError(
+      MonoTime now,
+      uint64_t* now_usec,
+      uint64_t* error_usec);
+
   // The skew rate in PPM reported by the kernel.
   uint64_t skew_ppm_ = 0;
 
+  // Protects the two fields below.
+  simple_spinlock refresh_lock_;
+
+  // When the error bound was last read from the kernel, uninitialized if the
+  // last read failed.
+  MonoTime refreshed_at_;
+
+  // The error bound read from the kernel at 'refreshed_at_'.
+  uint64_t refreshed_error_usec_ = 0;
+
   DISALLOW_COPY_AND_ASSIGN(SystemNtp);
 };
 
@@ -0,0 +1,225 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/apply_pipeline.h"
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/raft_consensus.h"
+#include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/gutil/gscoped_ptr.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/countdown_latch.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+#include "kudu/util/threadpool.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace kudu {
+namespace consensus {
+
+METRIC_DECLARE_histogram(raft_apply_pipeline_batch_size);
+
+class ApplyPipelineTest : public KuduTest {
+ public:
+  ApplyPipelineTest()
+      : entity_(METRIC_ENTITY_server.Instantiate(&registry_, "test")) {}
+
+  void SetUp() override {
+    KuduTest::SetUp();
+    ASSERT_OK(ThreadPoolBuilder("apply")
+                  .set_min_threads(0)
+                  .set_max_threads(kNumPartitions)
+                  .Build(&pool_));
+  }
+
+ protected:
+  static const int kNumPartitions = 4;
+
+  static scoped_refptr<ConsensusRound> MakeRound(int64_t index) {
+    ReplicateMsg* msg = new ReplicateMsg();
+    msg->set_op_type(WRITE_OP_EXT);
+    *msg->mutable_id() = MakeOpId(1, index);
+    return scoped_refptr<ConsensusRound>(
+        new ConsensusRound(nullptr, make_scoped_refptr_replicate(msg)));
+  }
+
+  // Returns a key which doesn't hash onto the partition of 'key'.
+  static string OtherPartitionKey(const string& key) {
+    std::hash<string> hasher;
+    for (int i = 0;; i++) {
+      string other = key + std::to_string(i);
+      if (hasher(other) % kNumPartitions != hasher(key) % kNumPartitions) {
+        return other;
+      }
+    }
+  }
+
+  MetricRegistry registry_;
+  scoped_refptr<MetricEntity> entity_;
+  gscoped_ptr<ThreadPool> pool_;
+};
+
+// The rounds of each key are applied in order, in batches no larger than the
+// limit.
+TEST_F(ApplyPipelineTest, TestOrderPerKey) {
+  const int kMaxBatchSize = 3;
+  simple_spinlock lock;
+  map<string, vector<int64_t>> applied;
+  map<int64_t, string> keys;
+  ApplyPipeline pipeline(
+      pool_.get(),
+      kNumPartitions,
+      kMaxBatchSize,
+      [&](const vector<scoped_refptr<ConsensusRound>>& rounds) {
+        ASSERT_LE(static_cast<int>(rounds.size()), kMaxBatchSize);
+        std::lock_guard<simple_spinlock> l(lock);
+        for (const auto& round : rounds) {
+          applied[keys[round->id().index()]].push_back(round->id().index());
+        }
+      },
+      entity_);
+
+  const int kNumRounds = 200;
+  for (int64_t index = 1; index <= kNumRounds; index++) {
+    string key = std::to_string(index % 7);
+    {
+      std::lock_guard<simple_spinlock> l(lock);
+      keys[index] = key;
+    }
+    pipeline.Submit(key, MakeRound(index));
+  }
+  pipeline.WaitForIdle();
+
+  int num_applied = 0;
+  for (const auto& entry : applied) {
+    const vector<int64_t>& indexes = entry.second;
+    for (size_t i = 1; i < indexes.size(); i++) {
+      ASSERT_LT(indexes[i - 1], indexes[i]) << "key " << entry.first;
+    }
+    num_applied += indexes.size();
+  }
+  ASSERT_EQ(kNumRounds, num_applied);
+  ASSERT_LE(
+      kNumRounds / kMaxBatchSize,
+      METRIC_raft_apply_pipeline_batch_size.Instantiate(entity_)
+          ->TotalCount());
+}
+
+// A partition held up by a slow apply doesn't hold up the others.
+TEST_F(ApplyPipelineTest, TestPartitionsApplyConcurrently) {
+  const string kSlowKey = "slow";
+  const string kFastKey = OtherPartitionKey(kSlowKey);
+  CountDownLatch fast_applied(1);
+  ApplyPipeline pipeline(
+      pool_.get(),
+      kNumPartitions,
+      64,
+      [&](const vector<scoped_refptr<ConsensusRound>>& rounds) {
+        if (rounds[0]->id().index() == 1) {
+          // The slow round waits for the fast one, submitted after it.
+          fast_applied.Wait();
+        } else {
+          fast_applied.CountDown();
+        }
+      },
+      entity_);
+  pipeline.Submit(kSlowKey, MakeRound(1));
+  pipeline.Submit(kFastKey, MakeRound(2));
+  pipeline.WaitForIdle();
+  ASSERT_EQ(0, fast_applied.count());
+}
+
+// The rounds queued or being applied count as unapplied until their apply
+// returns.
+TEST_F(ApplyPipelineTest, TestNumUnapplied) {
+  CountDownLatch applying(1);
+  CountDownLatch release(1);
+  ApplyPipeline pipeline(
+      pool_.get(),
+      kNumPartitions,
+      1,
+      [&](const vector<scoped_refptr<ConsensusRound>>& rounds) {
+        if (rounds[0]->id().index() == 1) {
+          applying.CountDown();
+          release.Wait();
+        }
+      },
+      entity_);
+  ASSERT_EQ(0, pipeline.num_unapplied());
+  for (int64_t index = 1; index <= 3; index++) {
+    pipeline.Submit("", MakeRound(index));
+  }
+  applying.Wait();
+  ASSERT_EQ(3, pipeline.num_unapplied());
+  release.CountDown();
+  pipeline.WaitForIdle();
+  ASSERT_EQ(0, pipeline.num_unapplied());
+}
+
+// Rounds given an apply pipeline are queued on it once replicated, while
+// their failures are notified right away.
+TEST_F(ApplyPipelineTest, TestRoundsGoThroughPipeline) {
+  int num_batches = 0;
+  ApplyPipeline pipeline(
+      pool_.get(),
+      kNumPartitions,
+      64,
+      [&](const vector<scoped_refptr<ConsensusRound>>& rounds) {
+        num_batches++;
+        for (const auto& round : rounds) {
+          round->RunReplicatedCallback(Status::OK());
+        }
+      },
+      entity_);
+
+  vector<Status> statuses(2, Status::Incomplete(""));
+  for (int i = 0; i < 2; i++) {
+    scoped_refptr<ConsensusRound> round = MakeRound(i + 1);
+    Status* status = &statuses[i];
+    round->SetConsensusReplicatedCallback(
+        [status](const Status& s) { *status = s; });
+    round->SetApplyPipeline(&pipeline, "");
+    if (i == 0) {
+      round->NotifyReplicationFinished(Status::OK());
+    } else {
+      round->NotifyReplicationFinished(Status::Aborted("aborted"));
+      ASSERT_TRUE(statuses[i].IsAborted()) << statuses[i].ToString();
+    }
+  }
+  pipeline.WaitForIdle();
+  ASSERT_OK(statuses[0]);
+  ASSERT_EQ(1, num_batches);
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,155 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/apply_pipeline.h"
+
+#include <functional>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "kudu/consensus/raft_consensus.h"
+#include "kudu/gutil/port.h"
+#include "kudu/util/status.h"
+#include "kudu/util/threadpool.h"
+
+METRIC_DEFINE_gauge_int64(
+    server,
+    raft_apply_pipeline_queued_rounds,
+    "Rounds Queued For Apply",
+    kudu::MetricUnit::kOperations,
+    "Number of committed rounds waiting in the apply pipeline.");
+METRIC_DEFINE_histogram(
+    server,
+    raft_apply_pipeline_lag,
+    "Apply Lag",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds committed rounds waited in the apply pipeline before being "
+    "applied.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    raft_apply_pipeline_batch_size,
+    "Apply Batch Size",
+    kudu::MetricUnit::kOperations,
+    "Number of committed rounds applied at once by the apply pipeline.",
+    10000LU,
+    2);
+
+using std::vector;
+
+namespace kudu {
+namespace consensus {
+
+ApplyPipeline::ApplyPipeline(
+    ThreadPool* pool,
+    int num_partitions,
+    int max_batch_size,
+    ApplyFunc apply,
+    const scoped_refptr<MetricEntity>& metric_entity)
+    : pool_(DCHECK_NOTNULL(pool)),
+      max_batch_size_(max_batch_size),
+      apply_(std::move(apply)),
+      idle_cond_(&lock_),
+      queued_rounds_(metric_entity->FindOrCreateGauge(
+          &METRIC_raft_apply_pipeline_queued_rounds,
+          static_cast<int64_t>(0))),
+      apply_lag_(METRIC_raft_apply_pipeline_lag.Instantiate(metric_entity)),
+      batch_size_(
+          METRIC_raft_apply_pipeline_batch_size.Instantiate(metric_entity)) {
+  CHECK_GT(num_partitions, 0);
+  CHECK_GT(max_batch_size, 0);
+  for (int i = 0; i < num_partitions; i++) {
+    partitions_.emplace_back(new Partition());
+  }
+}
+
+ApplyPipeline::~ApplyPipeline() {
+  WaitForIdle();
+}
+
+void ApplyPipeline::Submit(
+    const std::string& key,
+    scoped_refptr<ConsensusRound> round) {
+  Partition* partition =
+      partitions_[std::hash<std::string>()(key) % partitions_.size()].get();
+  {
+    MutexLock l(lock_);
+    partition->queue.push_back({std::move(round), MonoTime::Now()});
+    queued_rounds_->Increment();
+    num_unapplied_.fetch_add(1, std::memory_order_relaxed);
+    if (partition->scheduled) {
+      return;
+    }
+    partition->scheduled = true;
+  }
+  Status s = pool_->SubmitFunc(
+      std::bind(&ApplyPipeline::ApplyPartition, this, partition));
+  if (PREDICT_FALSE(!s.ok())) {
+    LOG(WARNING) << "Could not submit rounds to the apply pipeline, applying "
+                 << "them inline: " << s.ToString();
+    ApplyPartition(partition);
+  }
+}
+
+void ApplyPipeline::ApplyPartition(Partition* partition) {
+  vector<scoped_refptr<ConsensusRound>> batch;
+  while (true) {
+    batch.clear();
+    MonoTime now = MonoTime::Now();
+    {
+      MutexLock l(lock_);
+      if (partition->queue.empty()) {
+        partition->scheduled = false;
+        idle_cond_.Broadcast();
+        return;
+      }
+      while (!partition->queue.empty() &&
+             static_cast<int>(batch.size()) < max_batch_size_) {
+        QueuedRound& queued = partition->queue.front();
+        apply_lag_->Increment((now - queued.submitted).ToMicroseconds());
+        batch.emplace_back(std::move(queued.round));
+        partition->queue.pop_front();
+      }
+      queued_rounds_->IncrementBy(-static_cast<int64_t>(batch.size()));
+    }
+    batch_size_->Increment(batch.size());
+    apply_(batch);
+    num_unapplied_.fetch_sub(batch.size(), std::memory_order_relaxed);
+  }
+}
+
+void ApplyPipeline::WaitForIdle() {
+  MutexLock l(lock_);
+  while (true) {
+    bool idle = true;
+    for (const auto& partition : partitions_) {
+      if (partition->scheduled) {
+        idle = false;
+        break;
+      }
+    }
+    if (idle) {
+      return;
+    }
+    idle_cond_.Wait();
+  }
+}
+
+} // namespace consensus
+} // namespace kudu
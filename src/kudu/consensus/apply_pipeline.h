@@ -0,0 +1,113 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/condition_variable.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/mutex.h"
+
+namespace kudu {
+class ThreadPool;
+
+namespace consensus {
+class ConsensusRound;
+
+// Applies committed rounds off the thread which committed them, in batches,
+// on a thread pool. Each round is submitted with a partition key: the rounds
+// with the same key are applied in the order they were submitted, one batch
+// at a time, while those with keys of different partitions may be applied
+// concurrently. Keys are hashed onto a fixed number of partitions, so rounds
+// with different keys may still be serialized.
+//
+// Thread-safe.
+class ApplyPipeline {
+ public:
+  // Applies a batch of rounds of one partition, in order.
+  typedef std::function<void(
+      const std::vector<scoped_refptr<ConsensusRound>>& rounds)>
+      ApplyFunc;
+
+  // 'pool' must outlive the pipeline. At most 'max_batch_size' rounds are
+  // given to 'apply' at once.
+  ApplyPipeline(
+      ThreadPool* pool,
+      int num_partitions,
+      int max_batch_size,
+      ApplyFunc apply,
+      const scoped_refptr<MetricEntity>& metric_entity);
+  ~ApplyPipeline();
+
+  // Queues 'round' for the partition of 'key'. Should the pool not take the
+  // batch, it is applied right away on the calling thread.
+  void Submit(const std::string& key, scoped_refptr<ConsensusRound> round);
+
+  // Waits until all the rounds submitted so far have been applied.
+  void WaitForIdle();
+
+  // The rounds submitted which aren't applied yet, queued or being applied.
+  int64_t num_unapplied() const {
+    return num_unapplied_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct QueuedRound {
+    scoped_refptr<ConsensusRound> round;
+    MonoTime submitted;
+  };
+
+  struct Partition {
+    std::deque<QueuedRound> queue;
+    // Whether a task applying the queue is submitted to the pool, or
+    // running. Keeps the batches of the partition in order.
+    bool scheduled = false;
+  };
+
+  // Applies the queued rounds of 'partition' until there are none left.
+  void ApplyPartition(Partition* partition);
+
+  ThreadPool* const pool_;
+  const int max_batch_size_;
+  const ApplyFunc apply_;
+
+  mutable Mutex lock_;
+  // Signaled when a partition runs out of queued rounds.
+  ConditionVariable idle_cond_;
+  std::vector<std::unique_ptr<Partition>> partitions_;
+
+  std::atomic<int64_t> num_unapplied_{0};
+
+  scoped_refptr<AtomicGauge<int64_t>> queued_rounds_;
+  scoped_refptr<Histogram> apply_lag_;
+  scoped_refptr<Histogram> batch_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(ApplyPipeline);
+};
+
+} // namespace consensus
+} // namespace kudu
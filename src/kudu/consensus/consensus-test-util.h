@@ -21,6 +21,7 @@
 // out of Kudu into a fork known as kuduraft.
 // ********************************************************************
 
+#include <atomic>
 #include <functional>
 #include <map>
 #include <memory>
@@ -46,6 +47,7 @@
 #include "kudu/rpc/messenger.h"
 #include "kudu/util/countdown_latch.h"
 #include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/threadpool.h"
@@ -445,6 +447,55 @@ class NoOpTestPeerProxyFactory : public PeerProxyFactory {
 typedef std::unordered_map<std::string, std::shared_ptr<RaftConsensus>>
     TestPeerMap;
 
+// Collects the response to a request handed to
+// RaftConsensus::HandleProxyRequest().
+class TestProxyResponder : public ProxyResponder {
+ public:
+  explicit TestProxyResponder(MonoTime deadline)
+      : deadline_(deadline), latch_(1) {}
+
+  MonoTime GetClientDeadline() const override {
+    return deadline_;
+  }
+
+  std::string requestor_string() const override {
+    return "test";
+  }
+
+  void RespondSuccess() override {
+    Respond(Status::OK());
+  }
+
+  void RespondNoCache() override {
+    Respond(Status::OK());
+  }
+
+  void RespondFailure(const Status& status) override {
+    Respond(status);
+  }
+
+  void RespondTooBusy(const Status& status) override {
+    Respond(status);
+  }
+
+  // Waits for the response. Returns why the request failed without one, if
+  // it did.
+  Status Wait() {
+    latch_.Wait();
+    return status_;
+  }
+
+ private:
+  void Respond(const Status& status) {
+    status_ = status;
+    latch_.CountDown();
+  }
+
+  const MonoTime deadline_;
+  CountDownLatch latch_;
+  Status status_;
+};
+
 // Thread-safe manager for list of peers being used in tests.
 class TestPeerMapManager {
  public:
@@ -513,7 +564,8 @@ class LocalTestPeerProxy : public TestPeerProxy {
       : TestPeerProxy(pool),
         peer_uuid_(std::move(peer_uuid)),
         peers_(peers),
-        miss_comm_(false) {}
+        miss_comm_(false),
+        pings_(0) {}
 
   virtual void UpdateAsync(
       const ConsensusRequestPB* request,
@@ -521,8 +573,17 @@ class LocalTestPeerProxy : public TestPeerProxy {
       rpc::RpcController* controller,
       const rpc::ResponseCallback& callback) override {
     RegisterCallback(kUpdate, callback);
+    // An uninitialized timeout means the call doesn't time out.
+    const MonoDelta timeout = controller->timeout();
+    const MonoTime deadline = timeout.Initialized()
+        ? MonoTime::Now() + timeout
+        : MonoTime::Max();
     CHECK_OK(pool_->SubmitFunc(boost::bind(
-        &LocalTestPeerProxy::SendUpdateRequest, this, request, response)));
+        &LocalTestPeerProxy::SendUpdateRequest,
+        this,
+        request,
+        response,
+        deadline)));
   }
 
   Status StartElection(
@@ -542,6 +603,19 @@ class LocalTestPeerProxy : public TestPeerProxy {
         &LocalTestPeerProxy::SendVoteRequest, this, request, response)));
   }
 
+  void PingAsync(
+      GetNodeInstanceResponsePB* /*response*/,
+      rpc::RpcController* /*controller*/,
+      const rpc::ResponseCallback& callback) override {
+    pings_++;
+    callback();
+  }
+
+  // The number of PingAsync() calls made through this proxy.
+  int pings() const {
+    return pings_;
+  }
+
   template <class Response>
   void SetResponseError(const Status& status, Response* response) {
     ServerErrorPB* error = response->mutable_error();
@@ -576,7 +650,8 @@ class LocalTestPeerProxy : public TestPeerProxy {
 
   void SendUpdateRequest(
       const ConsensusRequestPB* request,
-      ConsensusResponsePB* response) {
+      ConsensusResponsePB* response,
+      MonoTime deadline) {
     // Copy the request and the response for the other peer so that ownership
     // remains as close to the dist. impl. as possible.
     ConsensusRequestPB other_peer_req;
@@ -588,7 +663,15 @@ class LocalTestPeerProxy : public TestPeerProxy {
     Status s = peers_->GetPeerByUuid(peer_uuid_, &peer);
 
     if (s.ok()) {
-      s = peer->Update(&other_peer_req, &other_peer_resp);
+      if (peer->IsProxyRequest(&other_peer_req)) {
+        // As the consensus service does, hand proxied requests to the proxy
+        // path, whose caller waits on it until the call's deadline.
+        auto responder = std::make_shared<TestProxyResponder>(deadline);
+        peer->HandleProxyRequest(&other_peer_req, &other_peer_resp, responder);
+        s = responder->Wait();
+      } else {
+        s = peer->Update(&other_peer_req, &other_peer_resp);
+      }
       if (s.ok() && !other_peer_resp.has_error()) {
         CHECK(other_peer_resp.has_status());
         CHECK(other_peer_resp.status().IsInitialized());
@@ -649,6 +732,7 @@ class LocalTestPeerProxy : public TestPeerProxy {
   const std::string peer_uuid_;
   TestPeerMapManager* const peers_;
   bool miss_comm_;
+  std::atomic<int> pings_;
 };
 
 class LocalTestPeerProxyFactory : public PeerProxyFactory {
@@ -666,11 +750,13 @@ class LocalTestPeerProxyFactory : public PeerProxyFactory {
     LocalTestPeerProxy* new_proxy =
         new LocalTestPeerProxy(peer_pb.permanent_uuid(), pool_.get(), peers_);
     proxy->reset(new_proxy);
+    std::lock_guard<simple_spinlock> l(lock_);
     proxies_.push_back(new_proxy);
     return Status::OK();
   }
 
-  const std::vector<LocalTestPeerProxy*>& GetProxies() {
+  std::vector<LocalTestPeerProxy*> GetProxies() const {
+    std::lock_guard<simple_spinlock> l(lock_);
     return proxies_;
   }
 
@@ -684,7 +770,8 @@ class LocalTestPeerProxyFactory : public PeerProxyFactory {
   TestPeerMapManager* const peers_;
   // NOTE: There is no need to delete this on the dctor because proxies are
   // externally managed
-  std::vector<LocalTestPeerProxy*> proxies_;
+  std::vector<LocalTestPeerProxy*> proxies_; // Protected by lock_.
+  mutable simple_spinlock lock_;
 };
 
 // A simple implementation of the transaction driver.
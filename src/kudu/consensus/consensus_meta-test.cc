@@ -22,6 +22,7 @@
 #include <string>
 #include <vector>
 
+#include <gflags/gflags_declare.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
@@ -33,12 +34,15 @@
 #include "kudu/fs/fs_manager.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/net/net_util.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/status.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
 
+DECLARE_bool(cmeta_term_vote_log);
+
 namespace kudu {
 namespace consensus {
 
@@ -138,6 +142,48 @@ TEST_F(ConsensusMetadataTest, TestDeferredCreateLoad) {
       reader, kInvalidOpIdIndex, fs_manager_.uuid(), kInitialTerm));
 }
 
+// Lookups in the list of removed peers, through its bloom filter.
+TEST_F(ConsensusMetadataTest, TestRemovedPeers) {
+  scoped_refptr<ConsensusMetadata> cmeta;
+  ASSERT_OK(ConsensusMetadata::Create(
+      &fs_manager_,
+      kTabletId,
+      fs_manager_.uuid(),
+      config_,
+      kInitialTerm,
+      ConsensusMetadataCreateMode::FLUSH_ON_CREATE,
+      &cmeta));
+
+  bool answered_by_filter = false;
+  ASSERT_FALSE(cmeta->IsPeerRemoved("a", &answered_by_filter));
+  ASSERT_TRUE(answered_by_filter);
+
+  // Members of the active config are never tracked as removed.
+  cmeta->InsertIntoRemovedPeersList({"a", "b", fs_manager_.uuid()});
+  ASSERT_TRUE(cmeta->IsPeerRemoved("a", &answered_by_filter));
+  ASSERT_FALSE(answered_by_filter);
+  ASSERT_TRUE(cmeta->IsPeerRemoved("b"));
+  ASSERT_FALSE(cmeta->IsPeerRemoved(fs_manager_.uuid()));
+  ASSERT_EQ(2, cmeta->RemovedPeersList().size());
+
+  // Peers that were never removed are mostly answered by the filter alone.
+  int answered = 0;
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_FALSE(cmeta->IsPeerRemoved(
+        strings::Substitute("peer-$0", i), &answered_by_filter));
+    answered += answered_by_filter;
+  }
+  ASSERT_GT(answered, 900);
+
+  cmeta->DeleteFromRemovedPeersList(vector<string>{"a"});
+  ASSERT_FALSE(cmeta->IsPeerRemoved("a"));
+  ASSERT_TRUE(cmeta->IsPeerRemoved("b"));
+
+  cmeta->ClearRemovedPeersList();
+  ASSERT_FALSE(cmeta->IsPeerRemoved("b", &answered_by_filter));
+  ASSERT_TRUE(answered_by_filter);
+}
+
 // Ensure that Create() will not overwrite an existing file.
 TEST_F(ConsensusMetadataTest, TestCreateNoOverwrite) {
   // Create the consensus metadata file.
@@ -198,6 +244,106 @@ TEST_F(ConsensusMetadataTest, TestFlush) {
   }
 }
 
+// Test that the latest prepared snapshot gets written out, and that flushing
+// an older one afterwards is a no-op.
+TEST_F(ConsensusMetadataTest, TestFlushPrepared) {
+  scoped_refptr<ConsensusMetadata> cmeta;
+  ASSERT_OK(ConsensusMetadata::Create(
+      &fs_manager_,
+      kTabletId,
+      fs_manager_.uuid(),
+      config_,
+      kInitialTerm,
+      ConsensusMetadataCreateMode::FLUSH_ON_CREATE,
+      &cmeta));
+  int64_t flush_count = cmeta->flush_count_for_tests();
+
+  cmeta->set_current_term(kInitialTerm + 1);
+  uint64_t first_version = cmeta->PrepareFlush();
+  cmeta->set_current_term(kInitialTerm + 2);
+  uint64_t second_version = cmeta->PrepareFlush();
+  ASSERT_GT(second_version, first_version);
+  // Not flushed yet.
+  cmeta->set_current_term(kInitialTerm + 3);
+
+  ASSERT_OK(cmeta->FlushPrepared(second_version));
+  ASSERT_OK(cmeta->FlushPrepared(first_version));
+  ASSERT_EQ(flush_count + 1, cmeta->flush_count_for_tests());
+
+  scoped_refptr<ConsensusMetadata> cmeta_read;
+  ASSERT_OK(ConsensusMetadata::Load(
+      &fs_manager_, kTabletId, fs_manager_.uuid(), &cmeta_read));
+  NO_FATALS(AssertValuesEqual(
+      cmeta_read, kInvalidOpIdIndex, fs_manager_.uuid(), kInitialTerm + 2));
+}
+
+// Test that term and vote changes go to the term/vote log, and that they are
+// folded into the metadata file once the committed config changes.
+TEST_F(ConsensusMetadataTest, TestTermVoteLog) {
+  FLAGS_cmeta_term_vote_log = true;
+  const string cmeta_path = fs_manager_.GetConsensusMetadataPath(kTabletId);
+  scoped_refptr<ConsensusMetadata> cmeta;
+  ASSERT_OK(ConsensusMetadata::Create(
+      &fs_manager_,
+      kTabletId,
+      fs_manager_.uuid(),
+      config_,
+      kInitialTerm,
+      ConsensusMetadataCreateMode::FLUSH_ON_CREATE,
+      &cmeta));
+  uint64_t cmeta_size;
+  ASSERT_OK(env_->GetFileSize(cmeta_path, &cmeta_size));
+
+  for (int64_t term = kInitialTerm + 1; term <= kInitialTerm + 5; term++) {
+    cmeta->set_current_term(term);
+    cmeta->clear_voted_for();
+    ASSERT_OK(cmeta->Flush());
+    cmeta->set_voted_for(fs_manager_.uuid());
+    ASSERT_OK(cmeta->Flush());
+  }
+  // Only the log was written to.
+  uint64_t new_cmeta_size;
+  ASSERT_OK(env_->GetFileSize(cmeta_path, &new_cmeta_size));
+  ASSERT_EQ(cmeta_size, new_cmeta_size);
+  ASSERT_TRUE(env_->FileExists(cmeta_path + ".votes.1"));
+
+  {
+    scoped_refptr<ConsensusMetadata> cmeta_read;
+    ASSERT_OK(ConsensusMetadata::Load(
+        &fs_manager_, kTabletId, fs_manager_.uuid(), &cmeta_read));
+    NO_FATALS(AssertValuesEqual(
+        cmeta_read, kInvalidOpIdIndex, fs_manager_.uuid(), kInitialTerm + 5));
+    ASSERT_TRUE(cmeta_read->has_voted_for());
+    ASSERT_EQ(fs_manager_.uuid(), cmeta_read->voted_for());
+    ASSERT_EQ(
+        cmeta->previous_vote_history().size(),
+        cmeta_read->previous_vote_history().size());
+    ASSERT_EQ(cmeta->on_disk_size(), cmeta_read->on_disk_size());
+  }
+
+  // A config change rewrites the file and starts a new log.
+  RaftConfigPB config = config_;
+  config.set_opid_index(1);
+  cmeta->set_committed_config(config);
+  ASSERT_OK(cmeta->Flush());
+  ASSERT_FALSE(env_->FileExists(cmeta_path + ".votes.1"));
+  cmeta->set_current_term(kInitialTerm + 6);
+  ASSERT_OK(cmeta->Flush());
+  ASSERT_TRUE(env_->FileExists(cmeta_path + ".votes.2"));
+
+  {
+    scoped_refptr<ConsensusMetadata> cmeta_read;
+    ASSERT_OK(ConsensusMetadata::Load(
+        &fs_manager_, kTabletId, fs_manager_.uuid(), &cmeta_read));
+    NO_FATALS(AssertValuesEqual(
+        cmeta_read, 1, fs_manager_.uuid(), kInitialTerm + 6));
+  }
+
+  ASSERT_OK(ConsensusMetadata::DeleteOnDiskData(&fs_manager_, kTabletId));
+  ASSERT_FALSE(env_->FileExists(cmeta_path));
+  ASSERT_FALSE(env_->FileExists(cmeta_path + ".votes.2"));
+}
+
 // Builds a distributed configuration of voters with the given uuids.
 RaftConfigPB BuildConfig(const vector<string>& uuids) {
   RaftConfigPB config;
@@ -282,6 +428,55 @@ TEST_F(ConsensusMetadataTest, TestActiveRole) {
   ASSERT_EQ(RaftPeerPB::NON_PARTICIPANT, cmeta->active_role());
 }
 
+// The state version moves with everything ToConsensusStatePB() and
+// active_role() return, and only with that.
+TEST_F(ConsensusMetadataTest, TestStateVersion) {
+  vector<string> uuids = {"a", "b", "c"};
+  RaftConfigPB config1 = BuildConfig(uuids);
+  config1.set_opid_index(0);
+  scoped_refptr<ConsensusMetadata> cmeta;
+  ASSERT_OK(ConsensusMetadata::Create(
+      &fs_manager_,
+      kTabletId,
+      "a",
+      config1,
+      kInitialTerm,
+      ConsensusMetadataCreateMode::FLUSH_ON_CREATE,
+      &cmeta));
+  uint64_t version = cmeta->state_version();
+
+  // Asserts that the state version moved since the last call.
+  auto assert_bumped = [&]() {
+    ASSERT_GT(cmeta->state_version(), version);
+    version = cmeta->state_version();
+  };
+
+  cmeta->set_current_term(kInitialTerm + 1);
+  NO_FATALS(assert_bumped());
+  cmeta->set_leader_uuid("b");
+  NO_FATALS(assert_bumped());
+
+  uuids.push_back("d");
+  RaftConfigPB config2 = BuildConfig(uuids);
+  config2.set_opid_index(1);
+  cmeta->set_pending_config(config2);
+  NO_FATALS(assert_bumped());
+  // A committed config masked by the pending one still shows in the
+  // consensus state.
+  cmeta->set_committed_config(config2);
+  NO_FATALS(assert_bumped());
+  cmeta->clear_pending_config();
+  NO_FATALS(assert_bumped());
+  cmeta->set_committed_config_raw(config1);
+  NO_FATALS(assert_bumped());
+
+  // Neither the vote nor flushes are part of the consensus state.
+  cmeta->set_voted_for("b");
+  cmeta->clear_voted_for();
+  ASSERT_OK(cmeta->Flush());
+  ASSERT_EQ(version, cmeta->state_version());
+}
+
 // Ensure that invocations of ToConsensusStatePB() return the expected state
 // in the returned object.
 TEST_F(ConsensusMetadataTest, TestToConsensusStatePB) {
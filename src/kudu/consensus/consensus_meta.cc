@@ -16,6 +16,7 @@
 // under the License.
 #include "kudu/consensus/consensus_meta.h"
 
+#include <memory>
 #include <mutex>
 #include <ostream>
 #include <utility>
@@ -34,7 +35,9 @@
 #include "kudu/util/env_util.h"
 #include "kudu/util/fault_injection.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/locks.h"
 #include "kudu/util/logging.h"
+#include "kudu/util/mutex.h"
 #include "kudu/util/path_util.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/status.h"
@@ -46,15 +49,105 @@ DEFINE_double(
     "Fraction of the time when the server will crash just before flushing "
     "consensus metadata. (For testing only!)");
 TAG_FLAG(fault_crash_before_cmeta_flush, unsafe);
+
+DEFINE_bool(
+    cmeta_term_vote_log,
+    false,
+    "Whether to persist term and vote changes by appending them to a small "
+    "log next to the consensus metadata file, instead of rewriting the whole "
+    "file, which includes the committed config. The file is still rewritten, "
+    "and the log discarded, when the committed config changes or the log gets "
+    "too long.");
+TAG_FLAG(cmeta_term_vote_log, experimental);
+TAG_FLAG(cmeta_term_vote_log, runtime);
+
+DEFINE_int32(
+    cmeta_term_vote_log_max_records,
+    1024,
+    "Number of records of the consensus metadata term/vote log after which "
+    "the consensus metadata file is rewritten and the log discarded.");
+TAG_FLAG(cmeta_term_vote_log_max_records, advanced);
+TAG_FLAG(cmeta_term_vote_log_max_records, runtime);
 DECLARE_bool(enable_flexi_raft);
 
 namespace kudu {
 namespace consensus {
 
+using pb_util::ReadablePBContainerFile;
+using pb_util::WritablePBContainerFile;
 using std::lock_guard;
+using std::shared_ptr;
 using std::string;
+using std::unique_ptr;
 using strings::Substitute;
 
+namespace {
+
+string TermVoteLogPath(const string& cmeta_path, uint64_t generation) {
+  return Substitute("$0.votes.$1", cmeta_path, generation);
+}
+
+// Fills 'delta' with the changes of the term and voting state from 'from' to
+// 'to'.
+void ComputeTermVoteRecord(
+    const ConsensusMetadataPB& from,
+    const ConsensusMetadataPB& to,
+    ConsensusMetadataDeltaPB* delta) {
+  delta->set_current_term(to.current_term());
+  if (to.has_voted_for()) {
+    delta->set_voted_for(to.voted_for());
+  }
+  if (to.has_last_known_leader() &&
+      (!from.has_last_known_leader() ||
+       from.last_known_leader().uuid() != to.last_known_leader().uuid() ||
+       from.last_known_leader().election_term() !=
+           to.last_known_leader().election_term())) {
+    *delta->mutable_last_known_leader() = to.last_known_leader();
+  }
+  if (to.has_last_pruned_term() &&
+      (!from.has_last_pruned_term() ||
+       from.last_pruned_term() != to.last_pruned_term())) {
+    delta->set_last_pruned_term(to.last_pruned_term());
+  }
+  // Entries of the vote history are never modified, only added and pruned.
+  for (const auto& entry : to.previous_vote_history()) {
+    if (from.previous_vote_history().count(entry.first) == 0) {
+      *delta->add_added_votes() = entry.second;
+    }
+  }
+  for (const auto& entry : from.previous_vote_history()) {
+    if (to.previous_vote_history().count(entry.first) == 0) {
+      delta->add_removed_vote_terms(entry.first);
+    }
+  }
+}
+
+void ApplyTermVoteRecord(
+    const ConsensusMetadataDeltaPB& delta,
+    ConsensusMetadataPB* pb) {
+  pb->set_current_term(delta.current_term());
+  if (delta.has_voted_for()) {
+    pb->set_voted_for(delta.voted_for());
+  } else {
+    pb->clear_voted_for();
+  }
+  if (delta.has_last_known_leader()) {
+    *pb->mutable_last_known_leader() = delta.last_known_leader();
+  }
+  if (delta.has_last_pruned_term()) {
+    pb->set_last_pruned_term(delta.last_pruned_term());
+  }
+  auto* history = pb->mutable_previous_vote_history();
+  for (int64_t term : delta.removed_vote_terms()) {
+    history->erase(term);
+  }
+  for (const PreviousVotePB& vote : delta.added_votes()) {
+    (*history)[vote.election_term()] = vote;
+  }
+}
+
+} // anonymous namespace
+
 int64_t ConsensusMetadata::current_term() const {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   DCHECK(pb_.has_current_term());
@@ -65,6 +158,7 @@ void ConsensusMetadata::set_current_term(int64_t term) {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   DCHECK_GE(term, kMinimumTerm);
   pb_.set_current_term(term);
+  BumpStateVersion();
 }
 
 bool ConsensusMetadata::has_voted_for() const {
@@ -136,14 +230,14 @@ bool ConsensusMetadata::IsVoterInConfig(
     const string& uuid,
     RaftConfigState type) {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
-  return IsRaftConfigVoter(uuid, GetConfig(type));
+  return GetConfigIndex(type).IsVoter(uuid);
 }
 
 bool ConsensusMetadata::IsMemberInConfig(
     const string& uuid,
     RaftConfigState type) {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
-  return IsRaftConfigMember(uuid, GetConfig(type));
+  return GetConfigIndex(type).IsMember(uuid);
 }
 
 bool ConsensusMetadata::IsMemberInConfigWithDetail(
@@ -153,13 +247,17 @@ bool ConsensusMetadata::IsMemberInConfigWithDetail(
     bool* is_voter,
     std::string* region) {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
-  return IsRaftConfigMemberWithDetail(
-      uuid, GetConfig(type), hostname_port, is_voter, region);
+  const RaftPeerPB* peer = GetConfigIndex(type).FindMember(uuid);
+  if (peer == nullptr) {
+    return false;
+  }
+  GetRaftPeerDetail(*peer, hostname_port, is_voter, region);
+  return true;
 }
 
 int ConsensusMetadata::CountVotersInConfig(RaftConfigState type) {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
-  return CountVoters(GetConfig(type));
+  return GetConfigIndex(type).num_voters();
 }
 
 int64_t ConsensusMetadata::GetConfigOpIdIndex(RaftConfigState type) {
@@ -191,17 +289,46 @@ const RaftConfigPB& ConsensusMetadata::GetConfig(RaftConfigState type) const {
   }
 }
 
+const RaftConfigIndex& ConsensusMetadata::GetConfigIndex(
+    RaftConfigState type) const {
+  const bool pending = type == PENDING_CONFIG ||
+      (type == ACTIVE_CONFIG && has_pending_config_);
+  std::unique_ptr<RaftConfigIndex>& index =
+      pending ? pending_config_index_ : committed_config_index_;
+  if (!index) {
+    index.reset(new RaftConfigIndex(GetConfig(type)));
+  }
+  return *index;
+}
+
+const RaftConfigIndex& ConsensusMetadata::CommittedConfigIndex() const {
+  DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
+  return GetConfigIndex(COMMITTED_CONFIG);
+}
+
+const RaftConfigIndex& ConsensusMetadata::ActiveConfigIndex() const {
+  DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
+  return GetConfigIndex(ACTIVE_CONFIG);
+}
+
 void ConsensusMetadata::set_committed_config(const RaftConfigPB& config) {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   *pb_.mutable_committed_config() = config;
+  committed_config_index_.reset();
+  rewrite_needed_ = true;
   if (!has_pending_config_) {
     UpdateActiveRole();
+  } else {
+    BumpStateVersion();
   }
 }
 
 void ConsensusMetadata::set_committed_config_raw(const RaftConfigPB& config) {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   *pb_.mutable_committed_config() = config;
+  committed_config_index_.reset();
+  rewrite_needed_ = true;
+  BumpStateVersion();
 }
 
 kudu::Status ConsensusMetadata::voter_distribution(
@@ -232,6 +359,7 @@ void ConsensusMetadata::clear_pending_config() {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   has_pending_config_ = false;
   pending_config_.Clear();
+  pending_config_index_.reset();
   UpdateActiveRole();
 }
 
@@ -239,6 +367,7 @@ void ConsensusMetadata::set_pending_config(const RaftConfigPB& config) {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   has_pending_config_ = true;
   pending_config_ = config;
+  pending_config_index_.reset();
   UpdateActiveRole();
 }
 
@@ -251,6 +380,21 @@ void ConsensusMetadata::set_active_config(const RaftConfigPB& config) {
   }
 }
 
+void ConsensusMetadata::set_active_voter_distribution(
+    const google::protobuf::Map<string, int32>& voter_distribution) {
+  DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
+  if (has_pending_config_) {
+    *pending_config_.mutable_voter_distribution() = voter_distribution;
+    pending_config_index_.reset();
+  } else {
+    *pb_.mutable_committed_config()->mutable_voter_distribution() =
+        voter_distribution;
+    committed_config_index_.reset();
+    rewrite_needed_ = true;
+  }
+  BumpStateVersion();
+}
+
 const RaftConfigPB& ConsensusMetadata::ActiveConfig() const {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   return GetConfig(ACTIVE_CONFIG);
@@ -325,11 +469,10 @@ Status ConsensusMetadata::GetConfigMemberCopy(
     const std::string& uuid,
     RaftPeerPB* member) {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
-  for (const RaftPeerPB& peer : ActiveConfig().peers()) {
-    if (peer.permanent_uuid() == uuid) {
-      *member = peer;
-      return Status::OK();
-    }
+  const RaftPeerPB* peer = ActiveConfigIndex().FindMember(uuid);
+  if (peer != nullptr) {
+    *member = *peer;
+    return Status::OK();
   }
   return Status::NotFound(
       Substitute("Peer with uuid $0 not found in consensus config", uuid));
@@ -369,14 +512,87 @@ void ConsensusMetadata::MergeCommittedConsensusStatePB(
 
 Status ConsensusMetadata::Flush(FlushMode flush_mode) {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
+  return DoFlushPrepared(PrepareFlush(), flush_mode);
+}
+
+uint64_t ConsensusMetadata::PrepareFlush() {
+  DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
+  shared_ptr<const ConsensusMetadataPB> snapshot(new ConsensusMetadataPB(pb_));
+  lock_guard<simple_spinlock> l(snapshot_lock_);
+  snapshot_.swap(snapshot);
+  snapshot_rewrite_needed_ |= rewrite_needed_;
+  rewrite_needed_ = false;
+  return ++snapshot_version_;
+}
+
+Status ConsensusMetadata::FlushPrepared(uint64_t version) {
+  return DoFlushPrepared(version, OVERWRITE);
+}
+
+Status ConsensusMetadata::DoFlushPrepared(
+    uint64_t version,
+    FlushMode flush_mode) {
+  MutexLock flush_guard(flush_lock_);
+  if (flushed_version_ >= version) {
+    // Somebody else wrote out this snapshot, or a later one, while we were
+    // waiting.
+    return Status::OK();
+  }
+  shared_ptr<const ConsensusMetadataPB> snapshot;
+  uint64_t snapshot_version;
+  bool rewrite_needed;
+  {
+    lock_guard<simple_spinlock> l(snapshot_lock_);
+    snapshot = snapshot_;
+    snapshot_version = snapshot_version_;
+    rewrite_needed = snapshot_rewrite_needed_;
+    snapshot_rewrite_needed_ = false;
+  }
+  DCHECK_GE(snapshot_version, version);
+
   MAYBE_FAULT(FLAGS_fault_crash_before_cmeta_flush);
   SCOPED_LOG_SLOW_EXECUTION_PREFIX(
       WARNING, 500, LogPrefix(), "flushing consensus metadata");
 
   flush_count_for_tests_++;
+  if (FLAGS_cmeta_term_vote_log && !rewrite_needed &&
+      flush_mode == OVERWRITE && logged_pb_ &&
+      term_vote_log_generation_ > 0 &&
+      term_vote_log_records_ < FLAGS_cmeta_term_vote_log_max_records) {
+    Status s = AppendTermVoteRecordUnlocked(*snapshot);
+    if (s.ok()) {
+      flushed_version_ = snapshot_version;
+      logged_pb_ = std::move(snapshot);
+      return UpdateOnDiskSize();
+    }
+    // The tail of the log is in an unknown state, so it must not be appended
+    // to anymore: a rewrite starts a new one.
+    LOG_WITH_PREFIX(WARNING)
+        << "Unable to append to the consensus metadata term/vote log, "
+        << "rewriting the consensus metadata file: " << s.ToString();
+    logged_pb_.reset();
+    term_vote_log_.reset();
+  }
+
+  Status s = RewriteUnlocked(*snapshot, flush_mode);
+  if (PREDICT_FALSE(!s.ok())) {
+    lock_guard<simple_spinlock> l(snapshot_lock_);
+    snapshot_rewrite_needed_ |= rewrite_needed;
+    return s;
+  }
+  flushed_version_ = snapshot_version;
+  logged_pb_ = std::move(snapshot);
+  RETURN_NOT_OK(UpdateOnDiskSize());
+  return Status::OK();
+}
+
+Status ConsensusMetadata::RewriteUnlocked(
+    const ConsensusMetadataPB& snapshot,
+    FlushMode flush_mode) {
+  flush_lock_.AssertAcquired();
   // Sanity test to ensure we never write out a bad configuration.
   RETURN_NOT_OK_PREPEND(
-      VerifyRaftConfig(pb_.committed_config()),
+      VerifyRaftConfig(snapshot.committed_config()),
       "Invalid config in ConsensusMetadata, cannot flush to disk");
 
   // Create directories if needed.
@@ -393,12 +609,23 @@ Status ConsensusMetadata::Flush(FlushMode flush_mode) {
         "Unable to fsync consensus parent dir " + parent_dir);
   }
 
+  // Records of the current term/vote log are already reflected in 'snapshot',
+  // so the rewritten file starts a new (empty) one.
+  const ConsensusMetadataPB* pb = &snapshot;
+  ConsensusMetadataPB pb_with_generation;
+  uint64_t generation = term_vote_log_generation_;
+  if (FLAGS_cmeta_term_vote_log || generation > 0) {
+    pb_with_generation = snapshot;
+    pb_with_generation.set_term_vote_log_generation(++generation);
+    pb = &pb_with_generation;
+  }
+
   string meta_file_path = fs_manager_->GetConsensusMetadataPath(tablet_id_);
   RETURN_NOT_OK_PREPEND(
       pb_util::WritePBContainerToPath(
           fs_manager_->env(),
           meta_file_path,
-          pb_,
+          *pb,
           flush_mode == OVERWRITE ? pb_util::OVERWRITE : pb_util::NO_OVERWRITE,
           // We use FLAGS_log_force_fsync_all here because the consensus
           // metadata is essentially an extension of the primary durability
@@ -410,7 +637,120 @@ Status ConsensusMetadata::Flush(FlushMode flush_mode) {
           "Unable to write consensus meta file for tablet $0 to path $1",
           tablet_id_,
           meta_file_path));
-  RETURN_NOT_OK(UpdateOnDiskSize());
+
+  if (generation != term_vote_log_generation_) {
+    term_vote_log_.reset();
+    if (term_vote_log_generation_ > 0) {
+      string log_path =
+          TermVoteLogPath(meta_file_path, term_vote_log_generation_);
+      Status s = fs_manager_->env()->DeleteFile(log_path);
+      if (!s.ok() && !s.IsNotFound()) {
+        // Harmless: the stale log is never replayed.
+        WARN_NOT_OK(s, "Unable to delete stale term/vote log " + log_path);
+      }
+    }
+    term_vote_log_generation_ = generation;
+    term_vote_log_records_ = 0;
+  }
+  return Status::OK();
+}
+
+Status ConsensusMetadata::AppendTermVoteRecordUnlocked(
+    const ConsensusMetadataPB& snapshot) {
+  flush_lock_.AssertAcquired();
+  DCHECK(logged_pb_);
+  ConsensusMetadataDeltaPB delta;
+  ComputeTermVoteRecord(*logged_pb_, snapshot, &delta);
+  if (!term_vote_log_) {
+    RETURN_NOT_OK(OpenTermVoteLogUnlocked());
+  }
+  RETURN_NOT_OK(term_vote_log_->Append(delta));
+  if (FLAGS_log_force_fsync_all) {
+    RETURN_NOT_OK(term_vote_log_->Sync());
+  }
+  term_vote_log_records_++;
+  return Status::OK();
+}
+
+Status ConsensusMetadata::OpenTermVoteLogUnlocked() {
+  flush_lock_.AssertAcquired();
+  Env* env = fs_manager_->env();
+  string path = TermVoteLogPath(
+      fs_manager_->GetConsensusMetadataPath(tablet_id_),
+      term_vote_log_generation_);
+  bool exists = term_vote_log_records_ > 0;
+  RWFileOptions opts;
+  opts.mode =
+      exists ? Env::OPEN_EXISTING : Env::CREATE_IF_NON_EXISTING_TRUNCATE;
+  unique_ptr<RWFile> file;
+  RETURN_NOT_OK_PREPEND(
+      env->NewRWFile(opts, path, &file),
+      "Unable to open consensus metadata term/vote log");
+  unique_ptr<WritablePBContainerFile> log(
+      new WritablePBContainerFile(shared_ptr<RWFile>(file.release())));
+  if (exists) {
+    RETURN_NOT_OK(log->OpenExisting());
+  } else {
+    RETURN_NOT_OK(log->CreateNew(ConsensusMetadataDeltaPB()));
+    if (FLAGS_log_force_fsync_all) {
+      RETURN_NOT_OK(log->Sync());
+      RETURN_NOT_OK(env->SyncDir(fs_manager_->GetConsensusMetadataDir()));
+    }
+  }
+  term_vote_log_ = std::move(log);
+  return Status::OK();
+}
+
+Status ConsensusMetadata::ReplayTermVoteLog() {
+  DCHECK_GT(term_vote_log_generation_, 0);
+  string path = TermVoteLogPath(
+      fs_manager_->GetConsensusMetadataPath(tablet_id_),
+      term_vote_log_generation_);
+  unique_ptr<RandomAccessFile> file;
+  Status s = fs_manager_->env()->NewRandomAccessFile(path, &file);
+  if (s.IsNotFound()) {
+    // Nothing was ever appended to it.
+    logged_pb_.reset(new ConsensusMetadataPB(pb_));
+    return Status::OK();
+  }
+  RETURN_NOT_OK_PREPEND(s, "Unable to open consensus metadata term/vote log");
+
+  // Records are appended (and synced) before the changes they contain are
+  // acted upon, so a torn record at the tail may be ignored. The log can't be
+  // appended to after it though: the next flush rewrites the file.
+  bool torn = false;
+  int64_t records = 0;
+  ReadablePBContainerFile reader(std::move(file));
+  s = reader.Open();
+  if (s.ok()) {
+    ConsensusMetadataDeltaPB delta;
+    while (true) {
+      s = reader.ReadNextPB(&delta);
+      if (s.IsEndOfFile()) {
+        break;
+      }
+      if (s.IsIncomplete()) {
+        torn = true;
+        break;
+      }
+      RETURN_NOT_OK_PREPEND(
+          s, "Unable to read consensus metadata term/vote log " + path);
+      ApplyTermVoteRecord(delta, &pb_);
+      records++;
+    }
+  } else if (s.IsIncomplete()) {
+    torn = true;
+  } else {
+    return s.CloneAndPrepend(
+        "Unable to read consensus metadata term/vote log " + path);
+  }
+  WARN_NOT_OK(reader.Close(), "Unable to close " + path);
+  if (torn) {
+    LOG_WITH_PREFIX(WARNING) << "Ignoring the torn tail of " << path;
+  } else {
+    logged_pb_.reset(new ConsensusMetadataPB(pb_));
+  }
+  term_vote_log_records_ = records;
   return Status::OK();
 }
 
@@ -422,8 +762,17 @@ ConsensusMetadata::ConsensusMetadata(
       tablet_id_(std::move(tablet_id)),
       peer_uuid_(std::move(peer_uuid)),
       has_pending_config_(false),
+      state_version_(0),
       flush_count_for_tests_(0),
-      on_disk_size_(0) {
+      snapshot_version_(0),
+      snapshot_rewrite_needed_(false),
+      flushed_version_(0),
+      term_vote_log_generation_(0),
+      term_vote_log_records_(0),
+      rewrite_needed_(false),
+      on_disk_size_(0),
+      removed_peers_filter_(
+          BloomFilterSizing::ByCountAndFPRate(max_removed_peers, 0.01)) {
   // This is not really required as default values but specifying explicitly
   // since correctness is dependent on it.
   pb_.mutable_last_known_leader()->set_uuid("");
@@ -431,6 +780,8 @@ ConsensusMetadata::ConsensusMetadata(
   pb_.set_last_pruned_term(-1);
 }
 
+ConsensusMetadata::~ConsensusMetadata() {}
+
 Status ConsensusMetadata::Create(
     FsManager* fs_manager,
     const string& tablet_id,
@@ -469,6 +820,10 @@ Status ConsensusMetadata::Load(
       fs_manager->env(),
       fs_manager->GetConsensusMetadataPath(tablet_id),
       &cmeta->pb_));
+  cmeta->term_vote_log_generation_ = cmeta->pb_.term_vote_log_generation();
+  if (cmeta->term_vote_log_generation_ > 0) {
+    RETURN_NOT_OK(cmeta->ReplayTermVoteLog());
+  }
   cmeta->UpdateActiveRole(); // Needs to happen here as we sidestep the accessor
                              // APIs.
 
@@ -482,6 +837,19 @@ Status ConsensusMetadata::DeleteOnDiskData(
     FsManager* fs_manager,
     const string& tablet_id) {
   string cmeta_path = fs_manager->GetConsensusMetadataPath(tablet_id);
+  // Delete the term/vote log first, so that it is never left behind.
+  ConsensusMetadataPB pb;
+  if (pb_util::ReadPBContainerFromPath(fs_manager->env(), cmeta_path, &pb)
+          .ok() &&
+      pb.term_vote_log_generation() > 0) {
+    Status s = fs_manager->env()->DeleteFile(
+        TermVoteLogPath(cmeta_path, pb.term_vote_log_generation()));
+    if (!s.ok() && !s.IsNotFound()) {
+      return s.CloneAndPrepend(Substitute(
+          "Unable to delete consensus metadata term/vote log for tablet $0",
+          tablet_id));
+    }
+  }
   RETURN_NOT_OK_PREPEND(
       fs_manager->env()->DeleteFile(cmeta_path),
       Substitute(
@@ -497,16 +865,27 @@ std::string ConsensusMetadata::LogPrefix() const {
 void ConsensusMetadata::UpdateActiveRole() {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   active_role_ = GetConsensusRole(peer_uuid_, leader_uuid_, ActiveConfig());
+  BumpStateVersion();
   VLOG_WITH_PREFIX(1) << "Updating active role to "
                       << RaftPeerPB::Role_Name(active_role_)
                       << ". Consensus state: "
                       << pb_util::SecureShortDebugString(ToConsensusStatePB());
 }
 
+void ConsensusMetadata::BumpStateVersion() {
+  state_version_.fetch_add(1, std::memory_order_release);
+}
+
 Status ConsensusMetadata::UpdateOnDiskSize() {
   string path = fs_manager_->GetConsensusMetadataPath(tablet_id_);
   uint64_t on_disk_size;
   RETURN_NOT_OK(fs_manager_->env()->GetFileSize(path, &on_disk_size));
+  if (term_vote_log_records_ > 0) {
+    uint64_t log_size;
+    RETURN_NOT_OK(fs_manager_->env()->GetFileSize(
+        TermVoteLogPath(path, term_vote_log_generation_), &log_size));
+    on_disk_size += log_size;
+  }
   on_disk_size_ = on_disk_size;
   return Status::OK();
 }
@@ -524,11 +903,33 @@ void ConsensusMetadata::InsertIntoRemovedPeersList(
       removed_peers_.push_back(peer_uuid);
     }
   }
+  RebuildRemovedPeersFilter();
 }
 
-bool ConsensusMetadata::IsPeerRemoved(const std::string& peer_uuid) {
+void ConsensusMetadata::RebuildRemovedPeersFilter() {
+  // Bloom filters can't remove keys, so rebuild it: it's only ever as large
+  // as 'max_removed_peers'.
+  removed_peers_filter_.Clear();
+  for (const auto& peer_uuid : removed_peers_) {
+    removed_peers_filter_.AddKey(BloomKeyProbe(Slice(peer_uuid)));
+  }
+}
+
+bool ConsensusMetadata::IsPeerRemoved(
+    const std::string& peer_uuid,
+    bool* answered_by_filter) {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
 
+  BloomFilter filter(
+      removed_peers_filter_.slice(), removed_peers_filter_.n_hashes());
+  bool maybe_removed = filter.MayContainKey(BloomKeyProbe(Slice(peer_uuid)));
+  if (answered_by_filter) {
+    *answered_by_filter = !maybe_removed;
+  }
+  if (!maybe_removed) {
+    return false;
+  }
+
   // Sanity check in active config too
   if (IsMemberInConfig(peer_uuid, ACTIVE_CONFIG)) {
     return false;
@@ -546,11 +947,12 @@ void ConsensusMetadata::DeleteFromRemovedPeersList(
 
   for (auto it = removed_peers_.begin(); it != removed_peers_.end();) {
     if (peer_uuid == *it) {
-      removed_peers_.erase(it);
+      it = removed_peers_.erase(it);
     } else {
       it++;
     }
   }
+  RebuildRemovedPeersFilter();
 }
 
 void ConsensusMetadata::DeleteFromRemovedPeersList(
@@ -565,6 +967,7 @@ void ConsensusMetadata::DeleteFromRemovedPeersList(
 void ConsensusMetadata::ClearRemovedPeersList() {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   removed_peers_.clear();
+  removed_peers_filter_.Clear();
 }
 
 std::vector<std::string> ConsensusMetadata::RemovedPeersList() {
@@ -19,21 +19,30 @@
 #include <atomic>
 #include <cstdint>
 #include <deque>
+#include <memory>
 #include <string>
 
 #include <gtest/gtest_prod.h>
 
 #include "kudu/consensus/metadata.pb.h"
 #include "kudu/consensus/quorum_util.h"
+#include "kudu/consensus/raft_config_index.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/threading/thread_collision_warner.h"
+#include "kudu/util/bloom_filter.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/mutex.h"
 
 namespace kudu {
 
 class FsManager;
 class Status;
 
+namespace pb_util {
+class WritablePBContainerFile;
+} // namespace pb_util
+
 namespace consensus {
 
 class ConsensusMetadataManager; // IWYU pragma: keep
@@ -132,6 +141,15 @@ class ConsensusMetadata : public RefCountedThreadSafe<ConsensusMetadata> {
   // Otherwise, return the committed configuration.
   const RaftConfigPB& ActiveConfig() const;
 
+  // Indexes of the committed and the active configurations, built on first
+  // use after the configuration changed. Invalidated by any change to it.
+  const RaftConfigIndex& CommittedConfigIndex() const;
+  const RaftConfigIndex& ActiveConfigIndex() const;
+
+  // Replaces the voter distribution of the active configuration in place.
+  void set_active_voter_distribution(
+      const google::protobuf::Map<std::string, int32>& voter_distribution);
+
   // Accessors for setting the active leader.
   const std::string& leader_uuid() const;
   void set_leader_uuid(std::string uuid);
@@ -181,10 +199,30 @@ class ConsensusMetadata : public RefCountedThreadSafe<ConsensusMetadata> {
   // Persist current state of the protobuf to disk.
   Status Flush(FlushMode flush_mode = OVERWRITE);
 
+  // Flush(), split in two so that the disk write does not have to happen
+  // under the lock which externally synchronizes this object.
+  //
+  // PrepareFlush() takes a snapshot of the current state and returns its
+  // version. Like the mutators, it requires external synchronization.
+  uint64_t PrepareFlush();
+
+  // Makes the snapshot of 'version' durable, unless a flush of it (or of a
+  // later snapshot) already completed; the latest snapshot is written, so
+  // that concurrent callers share a single write and fsync. This method is
+  // thread-safe and does not require external synchronization.
+  Status FlushPrepared(uint64_t version);
+
   int64_t flush_count_for_tests() const {
     return flush_count_for_tests_;
   }
 
+  // Bumped whenever the term, the leader or the configs change, i.e. whenever
+  // ToConsensusStatePB() or active_role() may return something new. This
+  // method is thread-safe.
+  uint64_t state_version() const {
+    return state_version_.load(std::memory_order_acquire);
+  }
+
   // The on-disk size of the consensus metadata, as of the last call to
   // Load() or Flush(). This method is thread-safe.
   int64_t on_disk_size() const {
@@ -198,8 +236,14 @@ class ConsensusMetadata : public RefCountedThreadSafe<ConsensusMetadata> {
   void InsertIntoRemovedPeersList(
       const std::vector<std::string>& removed_peers);
 
-  // Returns true if 'peer_uuid' is present in 'removed_peers_' list
-  bool IsPeerRemoved(const std::string& peer_uuid);
+  // Returns true if 'peer_uuid' is present in 'removed_peers_' list.
+  //
+  // Most lookups are for peers that were never removed, which a bloom filter
+  // of 'removed_peers_' answers without scanning it. If not null,
+  // 'answered_by_filter' is set to whether the filter answered alone.
+  bool IsPeerRemoved(
+      const std::string& peer_uuid,
+      bool* answered_by_filter = nullptr);
 
   // Deletes all the uuids in 'peer_uuids' from 'removed_peers_' list
   void DeleteFromRemovedPeersList(const std::vector<std::string>& peer_uuids);
@@ -222,9 +266,13 @@ class ConsensusMetadata : public RefCountedThreadSafe<ConsensusMetadata> {
   FRIEND_TEST(ConsensusMetadataTest, TestCreateNoOverwrite);
   FRIEND_TEST(ConsensusMetadataTest, TestFailedLoad);
   FRIEND_TEST(ConsensusMetadataTest, TestFlush);
+  FRIEND_TEST(ConsensusMetadataTest, TestFlushPrepared);
+  FRIEND_TEST(ConsensusMetadataTest, TestTermVoteLog);
   FRIEND_TEST(ConsensusMetadataTest, TestActiveRole);
+  FRIEND_TEST(ConsensusMetadataTest, TestStateVersion);
   FRIEND_TEST(ConsensusMetadataTest, TestToConsensusStatePB);
   FRIEND_TEST(ConsensusMetadataTest, TestMergeCommittedConsensusStatePB);
+  FRIEND_TEST(ConsensusMetadataTest, TestRemovedPeers);
 
   static const int32_t VOTE_HISTORY_MAX_SIZE = 100;
 
@@ -233,6 +281,8 @@ class ConsensusMetadata : public RefCountedThreadSafe<ConsensusMetadata> {
       std::string tablet_id,
       std::string peer_uuid);
 
+  ~ConsensusMetadata();
+
   // Create a ConsensusMetadata object with provided initial state.
   // If 'create_mode' is set to FLUSH_ON_CREATE, the encoded PB is flushed to
   // disk before returning. Otherwise, if 'create_mode' is set to
@@ -266,6 +316,9 @@ class ConsensusMetadata : public RefCountedThreadSafe<ConsensusMetadata> {
   // Return the specified config.
   const RaftConfigPB& GetConfig(RaftConfigState type) const;
 
+  // Return the index of the specified config, building it if needed.
+  const RaftConfigIndex& GetConfigIndex(RaftConfigState type) const;
+
   // Helper function to extend previous_vote_history_
   void populate_previous_vote_history(const PreviousVotePB& prev_vote);
 
@@ -274,9 +327,32 @@ class ConsensusMetadata : public RefCountedThreadSafe<ConsensusMetadata> {
   // Updates the cached active role.
   void UpdateActiveRole();
 
+  // Bumps 'state_version_'.
+  void BumpStateVersion();
+
   // Updates the cached on-disk size of the consensus metadata.
   Status UpdateOnDiskSize();
 
+  // Writes out the snapshot of 'version' or a later one, see FlushPrepared().
+  Status DoFlushPrepared(uint64_t version, FlushMode flush_mode);
+
+  // Rewrites the whole metadata file with 'snapshot', starting a new term/vote
+  // log if it is enabled. Requires 'flush_lock_' to be held.
+  Status RewriteUnlocked(
+      const ConsensusMetadataPB& snapshot,
+      FlushMode flush_mode);
+
+  // Appends the changes from 'logged_pb_' to 'snapshot' to the term/vote log.
+  // Requires 'flush_lock_' to be held.
+  Status AppendTermVoteRecordUnlocked(const ConsensusMetadataPB& snapshot);
+
+  // Opens the term/vote log of the current generation for appending.
+  // Requires 'flush_lock_' to be held.
+  Status OpenTermVoteLogUnlocked();
+
+  // Applies the records of the term/vote log to 'pb_'. Only called by Load().
+  Status ReplayTermVoteLog();
+
   FsManager* const fs_manager_;
   const std::string tablet_id_;
   const std::string peer_uuid_;
@@ -294,15 +370,48 @@ class ConsensusMetadata : public RefCountedThreadSafe<ConsensusMetadata> {
   // operation.
   RaftConfigPB pending_config_;
 
+  // See GetConfigIndex(). Reset whenever the config they index changes.
+  mutable std::unique_ptr<RaftConfigIndex> committed_config_index_;
+  mutable std::unique_ptr<RaftConfigIndex> pending_config_index_;
+
   // Cached role of the peer_uuid_ within the active configuration.
   RaftPeerPB::Role active_role_;
 
-  // The number of times the metadata has been flushed to disk.
+  // See state_version().
+  std::atomic<uint64_t> state_version_;
+
+  // The number of times the metadata has been flushed to disk. Protected by
+  // 'flush_lock_'.
   int64_t flush_count_for_tests_;
 
+  // The latest snapshot taken by PrepareFlush() and its version. Protected by
+  // 'snapshot_lock_'.
+  simple_spinlock snapshot_lock_;
+  std::shared_ptr<const ConsensusMetadataPB> snapshot_;
+  uint64_t snapshot_version_;
+  bool snapshot_rewrite_needed_;
+
+  // Serializes the disk writes. The version of the last snapshot written out
+  // is protected by it.
+  Mutex flush_lock_;
+  uint64_t flushed_version_;
+
+  // The durable state, or null if it is not known to match a snapshot (in
+  // which case the next flush has to rewrite the file), and the term/vote log
+  // holding the changes applied to the metadata file to obtain it. Protected
+  // by 'flush_lock_'.
+  std::shared_ptr<const ConsensusMetadataPB> logged_pb_;
+  uint64_t term_vote_log_generation_;
+  int64_t term_vote_log_records_;
+  std::unique_ptr<pb_util::WritablePBContainerFile> term_vote_log_;
+
   // Durable fields.
   ConsensusMetadataPB pb_;
 
+  // Whether 'pb_' changed in a way which can't be recorded in the term/vote
+  // log since the last PrepareFlush().
+  bool rewrite_needed_;
+
   // The on-disk size of the consensus metadata, as of the last call to
   // Load() or Flush().
   // The type is int64_t for consistency with other on-disk size metrics,
@@ -315,6 +424,12 @@ class ConsensusMetadata : public RefCountedThreadSafe<ConsensusMetadata> {
   static const int max_removed_peers = 30;
   std::deque<std::string> removed_peers_;
 
+  // Bloom filter of 'removed_peers_', rebuilt whenever it changes.
+  BloomFilterBuilder removed_peers_filter_;
+
+  // Rebuilds 'removed_peers_filter_' from 'removed_peers_'.
+  void RebuildRemovedPeersFilter();
+
   DISALLOW_COPY_AND_ASSIGN(ConsensusMetadata);
 };
 
@@ -22,11 +22,15 @@
 // ********************************************************************
 
 #include <cstddef>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
+#include <gflags/gflags_declare.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
@@ -53,15 +57,28 @@
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/rpc/messenger.h"
 //#include "kudu/tserver/tserver.pb.h"
+#include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/compression/compression_codec.h"
+#include "kudu/util/faststring.h"
 #include "kudu/util/metrics.h"
 // METRIC_DEFINE_entity(tablet);
 #include "kudu/util/monotime.h"
+#include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
 #include "kudu/util/threadpool.h"
 
+DECLARE_bool(consensus_lightweight_peers);
+DECLARE_int32(consensus_max_batch_size_bytes);
+DECLARE_int32(consensus_max_inflight_requests_per_peer);
+DECLARE_int32(consensus_payload_sidecar_min_bytes);
+DECLARE_int32(raft_heartbeat_interval_ms);
+DECLARE_int32(raft_lightweight_peer_heartbeat_interval_ms);
+DECLARE_int32(raft_peer_retry_initial_backoff_ms);
+
 METRIC_DECLARE_entity(tablet);
+METRIC_DECLARE_gauge_int64(inflight_peer_requests);
 
 namespace kudu {
 namespace consensus {
@@ -74,11 +91,59 @@ using std::make_shared;
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
+using std::vector;
 
 const char* kTabletId = "test-peers-tablet";
 const char* kLeaderUuid = "peer-0";
 const char* kFollowerUuid = "peer-1";
 
+// Records the ops it is sent and counts the requests, and says whether write
+// payloads may be sent to it as sidecars.
+class RecordingPeerProxy : public NoOpTestPeerProxy {
+ public:
+  RecordingPeerProxy(
+      ThreadPool* pool,
+      RaftPeerPB peer_pb,
+      bool supports_sidecars)
+      : NoOpTestPeerProxy(pool, std::move(peer_pb)),
+        supports_sidecars_(supports_sidecars) {}
+
+  void UpdateAsync(
+      const ConsensusRequestPB* request,
+      ConsensusResponsePB* response,
+      rpc::RpcController* controller,
+      const rpc::ResponseCallback& callback) override {
+    {
+      std::lock_guard<simple_spinlock> l(ops_lock_);
+      updates_++;
+      for (const ReplicateMsg& op : request->ops()) {
+        ops_.push_back(op);
+      }
+    }
+    NoOpTestPeerProxy::UpdateAsync(request, response, controller, callback);
+  }
+
+  bool SupportsPayloadSidecars() const override {
+    return supports_sidecars_;
+  }
+
+  vector<ReplicateMsg> ops() const {
+    std::lock_guard<simple_spinlock> l(ops_lock_);
+    return ops_;
+  }
+
+  int updates() const {
+    std::lock_guard<simple_spinlock> l(ops_lock_);
+    return updates_;
+  }
+
+ private:
+  const bool supports_sidecars_;
+  mutable simple_spinlock ops_lock_;
+  vector<ReplicateMsg> ops_; // Protected by ops_lock_.
+  int updates_ = 0; // Protected by ops_lock_.
+};
+
 class ConsensusPeersTest : public KuduTest {
  public:
   ConsensusPeersTest()
@@ -121,22 +186,9 @@ class ConsensusPeersTest : public KuduTest {
         raft_config,
         routing_table_);
 
-    scoped_refptr<TimeManager> time_manager(
-        new TimeManager(clock_, Timestamp::kMin));
-
     persistent_vars_manager_ = new PersistentVarsManager(fs_manager_.get());
 
-    message_queue_.reset(new PeerMessageQueue(
-        metric_entity_,
-        log_.get(),
-        time_manager,
-        persistent_vars_manager_,
-        FakeRaftPeerPB(kLeaderUuid),
-        routing_table_container_,
-        kTabletId,
-        raft_pool_->NewToken(ThreadPool::ExecutionMode::SERIAL),
-        MinimumOpId(),
-        MinimumOpId()));
+    NewQueue(FakeRaftPeerPB(kLeaderUuid));
 
     MessengerBuilder bld("test");
     ASSERT_OK(bld.Build(&messenger_));
@@ -152,6 +204,23 @@ class ConsensusPeersTest : public KuduTest {
     }
   }
 
+  // Replaces the queue with a new one, whose local peer is 'local_peer_pb'.
+  void NewQueue(const RaftPeerPB& local_peer_pb) {
+    scoped_refptr<TimeManager> time_manager(
+        new TimeManager(clock_, Timestamp::kMin));
+    message_queue_.reset(new PeerMessageQueue(
+        metric_entity_,
+        log_.get(),
+        time_manager,
+        persistent_vars_manager_,
+        local_peer_pb,
+        routing_table_container_,
+        kTabletId,
+        raft_pool_->NewToken(ThreadPool::ExecutionMode::SERIAL),
+        MinimumOpId(),
+        MinimumOpId()));
+  }
+
   DelayablePeerProxy<NoOpTestPeerProxy>* NewRemotePeer(
       const string& peer_name,
       shared_ptr<Peer>* peer) {
@@ -175,6 +244,37 @@ class ConsensusPeersTest : public KuduTest {
     return proxy_ptr;
   }
 
+  RecordingPeerProxy* NewRecordingPeer(
+      const string& peer_name,
+      bool supports_sidecars,
+      shared_ptr<Peer>* peer) {
+    RaftPeerPB peer_pb;
+    peer_pb.set_permanent_uuid(peer_name);
+    peer_pb.set_member_type(RaftPeerPB::VOTER);
+    return NewRecordingPeer(std::move(peer_pb), supports_sidecars, peer);
+  }
+
+  RecordingPeerProxy* NewRecordingPeer(
+      RaftPeerPB peer_pb,
+      bool supports_sidecars,
+      shared_ptr<Peer>* peer) {
+    auto proxy_ptr =
+        new RecordingPeerProxy(raft_pool_.get(), peer_pb, supports_sidecars);
+    shared_ptr<PeerProxy> proxy(proxy_ptr);
+    peer_proxy_pool_.Put(peer_pb.permanent_uuid(), proxy);
+    CHECK_OK(Peer::NewRemotePeer(
+        std::move(peer_pb),
+        kTabletId,
+        kLeaderUuid,
+        message_queue_.get(),
+        &peer_proxy_pool_,
+        raft_pool_token_.get(),
+        std::move(proxy),
+        messenger_,
+        peer));
+    return proxy_ptr;
+  }
+
   void CheckLastRemoteEntry(
       DelayablePeerProxy<NoOpTestPeerProxy>* proxy,
       int term,
@@ -297,6 +397,135 @@ TEST_F(ConsensusPeersTest, TestRemotePeers) {
   WaitForCommitIndex(2);
 }
 
+// A proxy which holds on to every UpdateConsensus() call until told to
+// answer them, so that several requests to the same peer can be in flight.
+// Answers like NoOpTestPeerProxy, in the order the requests were sent.
+class HoldingPeerProxy : public NoOpTestPeerProxy {
+ public:
+  HoldingPeerProxy(ThreadPool* pool, RaftPeerPB peer_pb)
+      : NoOpTestPeerProxy(pool, peer_pb),
+        pool_(pool),
+        peer_pb_(std::move(peer_pb)) {
+    last_received_.CopyFrom(MinimumOpId());
+  }
+
+  void UpdateAsync(
+      const ConsensusRequestPB* request,
+      ConsensusResponsePB* response,
+      rpc::RpcController* /*controller*/,
+      const rpc::ResponseCallback& callback) override {
+    std::lock_guard<simple_spinlock> l(held_lock_);
+    held_.push_back({request, response, callback});
+  }
+
+  int num_held() {
+    std::lock_guard<simple_spinlock> l(held_lock_);
+    return held_.size();
+  }
+
+  // Answers every request held so far.
+  void RespondAll() {
+    std::deque<HeldUpdate> held;
+    {
+      std::lock_guard<simple_spinlock> l(held_lock_);
+      held.swap(held_);
+    }
+    for (const HeldUpdate& u : held) {
+      ConsensusResponsePB* response = u.response;
+      response->Clear();
+      if (OpIdLessThan(last_received_, u.request->preceding_id())) {
+        ConsensusErrorPB* error = response->mutable_status()->mutable_error();
+        error->set_code(ConsensusErrorPB::PRECEDING_ENTRY_DIDNT_MATCH);
+        StatusToPB(Status::IllegalState(""), error->mutable_status());
+      } else if (u.request->ops_size() > 0) {
+        last_received_.CopyFrom(
+            u.request->ops(u.request->ops_size() - 1).id());
+      }
+      response->set_responder_uuid(peer_pb_.permanent_uuid());
+      response->set_responder_term(u.request->caller_term());
+      response->mutable_status()->mutable_last_received()->CopyFrom(
+          last_received_);
+      response->mutable_status()
+          ->mutable_last_received_current_leader()
+          ->CopyFrom(last_received_);
+      response->mutable_status()->set_last_committed_idx(
+          last_received_.index());
+      CHECK_OK(pool_->SubmitFunc(u.callback));
+    }
+  }
+
+ private:
+  struct HeldUpdate {
+    const ConsensusRequestPB* request;
+    ConsensusResponsePB* response;
+    rpc::ResponseCallback callback;
+  };
+
+  ThreadPool* const pool_;
+  const RaftPeerPB peer_pb_;
+  // Only touched by the thread calling RespondAll().
+  OpId last_received_;
+  simple_spinlock held_lock_;
+  std::deque<HeldUpdate> held_; // Protected by held_lock_.
+};
+
+// Tests that with --consensus_max_inflight_requests_per_peer > 1 the peer
+// keeps sending batches without waiting for the previous ones to be
+// answered, and that the pipelined requests replicate everything in order.
+TEST_F(ConsensusPeersTest, TestPipelinedRequests) {
+  FLAGS_consensus_max_inflight_requests_per_peer = 4;
+  // Fit a single of the ops below in each batch.
+  FLAGS_consensus_max_batch_size_bytes = 2048;
+  // Keep heartbeats out of the way.
+  FLAGS_raft_heartbeat_interval_ms = 60 * 1000;
+
+  message_queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
+
+  auto proxy = make_shared<HoldingPeerProxy>(
+      raft_pool_.get(), FakeRaftPeerPB(kFollowerUuid));
+  peer_proxy_pool_.Put(kFollowerUuid, proxy);
+  shared_ptr<Peer> peer;
+  ASSERT_OK(Peer::NewRemotePeer(
+      FakeRaftPeerPB(kFollowerUuid),
+      kTabletId,
+      kLeaderUuid,
+      message_queue_.get(),
+      &peer_proxy_pool_,
+      raft_pool_token_.get(),
+      proxy,
+      messenger_,
+      &peer));
+
+  AppendReplicateMessagesToQueue(message_queue_.get(), clock_, 1, 10, 1024);
+
+  // The peer is new, so the first request is a status-only one and is not
+  // pipelined.
+  ASSERT_OK(peer->SignalRequest(true));
+  ASSERT_EVENTUALLY([&]() { ASSERT_EQ(1, proxy->num_held()); });
+  ASSERT_EQ(1, peer->num_inflight_requests());
+
+  // Once the peer answers, the leader fills the whole window.
+  proxy->RespondAll();
+  ASSERT_EVENTUALLY([&]() {
+    ASSERT_EQ(FLAGS_consensus_max_inflight_requests_per_peer,
+              proxy->num_held());
+  });
+  ASSERT_EQ(FLAGS_consensus_max_inflight_requests_per_peer,
+            peer->num_inflight_requests());
+  scoped_refptr<AtomicGauge<int64_t>> gauge =
+      METRIC_inflight_peer_requests.Instantiate(metric_entity_, 0);
+  ASSERT_EQ(FLAGS_consensus_max_inflight_requests_per_peer, gauge->value());
+
+  ASSERT_EVENTUALLY([&]() {
+    proxy->RespondAll();
+    ASSERT_GE(message_queue_->GetCommittedIndex(), 10);
+    ASSERT_EQ(0, peer->num_inflight_requests());
+  });
+  ASSERT_EQ(0, gauge->value());
+  peer->Close();
+}
+
 // Regression test for KUDU-699: even if a peer isn't making progress,
 // and thus always has data pending, we should be able to close the peer.
 TEST_F(ConsensusPeersTest, TestCloseWhenRemotePeerDoesntMakeProgress) {
@@ -339,6 +568,9 @@ TEST_F(ConsensusPeersTest, TestCloseWhenRemotePeerDoesntMakeProgress) {
 }
 
 TEST_F(ConsensusPeersTest, TestDontSendOneRpcPerWriteWhenPeerIsDown) {
+  // Only retry the failed peer on its heartbeats.
+  FLAGS_raft_peer_retry_initial_backoff_ms = 0;
+
   message_queue_->SetLeaderMode(
       kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
 
@@ -401,5 +633,401 @@ TEST_F(ConsensusPeersTest, TestDontSendOneRpcPerWriteWhenPeerIsDown) {
   ASSERT_LT(mock_proxy->update_count(), 5);
 }
 
+// Tests that a failed request is retried after a short backoff rather than
+// on the peer's next heartbeat.
+TEST_F(ConsensusPeersTest, TestExpeditedRetryAfterError) {
+  // Make sure any retry we see is not a regular heartbeat.
+  FLAGS_raft_heartbeat_interval_ms = 60 * 1000;
+
+  message_queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
+
+  auto mock_proxy = make_shared<MockedPeerProxy>(raft_pool_.get());
+  peer_proxy_pool_.Put(kFollowerUuid, mock_proxy);
+  shared_ptr<Peer> peer;
+  ASSERT_OK(Peer::NewRemotePeer(
+      FakeRaftPeerPB(kFollowerUuid),
+      kTabletId,
+      kLeaderUuid,
+      message_queue_.get(),
+      &peer_proxy_pool_,
+      raft_pool_token_.get(),
+      mock_proxy,
+      messenger_,
+      &peer));
+
+  ConsensusResponsePB initial_resp;
+  initial_resp.set_responder_uuid(kFollowerUuid);
+  initial_resp.set_responder_term(0);
+  initial_resp.mutable_status()->mutable_last_received()->CopyFrom(
+      MakeOpId(1, 1));
+  initial_resp.mutable_status()
+      ->mutable_last_received_current_leader()
+      ->CopyFrom(MakeOpId(1, 1));
+  initial_resp.mutable_status()->set_last_committed_idx(1);
+  mock_proxy->set_update_response(initial_resp);
+
+  AppendReplicateMessagesToQueue(message_queue_.get(), clock_, 1, 1);
+  peer->SignalRequest(true);
+  WaitForCommitIndex(1);
+
+  ConsensusResponsePB error_resp;
+  error_resp.mutable_error()->set_code(ServerErrorPB::UNKNOWN_ERROR);
+  StatusToPB(
+      Status::NotFound("fake error"),
+      error_resp.mutable_error()->mutable_status());
+  mock_proxy->set_update_response(error_resp);
+
+  // The request carrying the new op fails, and is followed by retries well
+  // before the next heartbeat is due.
+  int count_before = mock_proxy->update_count();
+  AppendReplicateMessagesToQueue(message_queue_.get(), clock_, 2, 1);
+  peer->SignalRequest(false);
+  ASSERT_EVENTUALLY(
+      [&]() { ASSERT_GE(mock_proxy->update_count(), count_before + 3); });
+  peer->Close();
+}
+
+// Tests that ops compressed as a whole come back as they were.
+TEST_F(ConsensusPeersTest, TestCompressedOpsRoundTrip) {
+  ConsensusRequestPB request;
+  for (int i = 1; i <= 10; i++) {
+    ReplicateMsg* op = request.add_ops();
+    *op->mutable_id() = MakeOpId(1, i);
+    op->set_timestamp(i);
+    op->set_op_type(WRITE_OP_EXT);
+    op->mutable_write_payload()->set_payload(string(1000, 'a' + i % 3));
+  }
+
+  shared_ptr<CompressionCodec> codec;
+  ASSERT_OK(CompressionCodecManager::GetCodecForType(LZ4, &codec));
+  faststring compressed;
+  int64_t uncompressed_size;
+  ASSERT_OK(CompressOps(
+      request.ops(), codec.get(), &compressed, &uncompressed_size));
+  ASSERT_LT(static_cast<int64_t>(compressed.size()), uncompressed_size);
+
+  ConsensusRequestPB restored;
+  ASSERT_OK(UncompressOps(
+      LZ4, Slice(compressed), uncompressed_size, &restored));
+  ASSERT_EQ(request.ops_size(), restored.ops_size());
+  for (int i = 0; i < request.ops_size(); i++) {
+    ASSERT_EQ(
+        request.ops(i).SerializeAsString(),
+        restored.ops(i).SerializeAsString());
+  }
+
+  // A batch cut short is rejected rather than yielding fewer ops.
+  ASSERT_FALSE(UncompressOps(
+                   LZ4,
+                   Slice(compressed.data(), compressed.size() / 2),
+                   uncompressed_size,
+                   &restored)
+                   .ok());
+  ASSERT_FALSE(UncompressOps(
+                   NO_COMPRESSION, Slice(compressed), uncompressed_size,
+                   &restored)
+                   .ok());
+}
+
+// Tests that ops parsed on an arena outlive their request, as long as
+// references to them are held.
+TEST_F(ConsensusPeersTest, TestCompressedOpsOnArena) {
+  ConsensusRequestPB request;
+  for (int i = 1; i <= 10; i++) {
+    ReplicateMsg* op = request.add_ops();
+    *op->mutable_id() = MakeOpId(1, i);
+    op->set_op_type(WRITE_OP_EXT);
+    op->mutable_write_payload()->set_payload(string(1000, 'a' + i % 3));
+  }
+  shared_ptr<CompressionCodec> codec;
+  ASSERT_OK(CompressionCodecManager::GetCodecForType(LZ4, &codec));
+  faststring compressed;
+  int64_t uncompressed_size;
+  ASSERT_OK(CompressOps(
+      request.ops(), codec.get(), &compressed, &uncompressed_size));
+
+  vector<ReplicateRefPtr> refs;
+  {
+    scoped_refptr<RefCountedArena> arena;
+    ConsensusRequestPB restored;
+    ASSERT_OK(UncompressOps(
+        LZ4, Slice(compressed), uncompressed_size, &restored, &arena));
+    ASSERT_TRUE(arena);
+    ASSERT_EQ(request.ops_size(), restored.ops_size());
+    for (int i = 0; i < restored.ops_size(); i++) {
+      ASSERT_EQ(arena->get(), restored.ops(i).GetArena());
+    }
+    // Take the second half of the ops, like a follower does with the ones it
+    // doesn't have yet, and leave the rest to ReleaseArenaOps().
+    const int half = restored.ops_size() / 2;
+    for (int i = half; i < restored.ops_size(); i++) {
+      refs.push_back(
+          make_scoped_refptr_replicate(restored.mutable_ops(i), arena));
+    }
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+    restored.mutable_ops()->UnsafeArenaExtractSubrange(
+        half, restored.ops_size() - half, nullptr);
+#else
+    restored.mutable_ops()->ExtractSubrange(
+        half, restored.ops_size() - half, nullptr);
+#endif
+    ReleaseArenaOps(&restored);
+    ASSERT_EQ(0, restored.ops_size());
+  }
+  ASSERT_EQ(5, refs.size());
+  for (int i = 0; i < 5; i++) {
+    ASSERT_EQ(
+        request.ops(i + 5).SerializeAsString(),
+        refs[i]->get()->SerializeAsString());
+  }
+}
+
+// Tests that the leading ops a follower already committed are dropped before
+// they are parsed or have their payloads copied.
+TEST_F(ConsensusPeersTest, TestSkipCommittedOps) {
+  ConsensusRequestPB request;
+  *request.mutable_preceding_id() = MakeOpId(1, 0);
+  for (int i = 1; i <= 10; i++) {
+    ReplicateMsg* op = request.add_ops();
+    *op->mutable_id() = MakeOpId(1, i);
+    op->set_timestamp(i);
+    op->set_op_type(WRITE_OP_EXT);
+    op->mutable_write_payload()->set_payload(string(1000, 'a' + i % 3));
+  }
+  shared_ptr<CompressionCodec> codec;
+  ASSERT_OK(CompressionCodecManager::GetCodecForType(LZ4, &codec));
+  faststring compressed;
+  int64_t uncompressed_size;
+  ASSERT_OK(CompressOps(
+      request.ops(), codec.get(), &compressed, &uncompressed_size));
+
+  // Nothing is skipped below the first op.
+  ConsensusRequestPB unskipped;
+  *unskipped.mutable_preceding_id() = request.preceding_id();
+  ASSERT_OK(UncompressOps(
+      LZ4, Slice(compressed), uncompressed_size, &unskipped, nullptr, 0));
+  ASSERT_EQ(10, unskipped.ops_size());
+  ASSERT_OPID_EQ(MakeOpId(1, 0), unskipped.preceding_id());
+
+  for (bool on_arena : {false, true}) {
+    SCOPED_TRACE(on_arena);
+    scoped_refptr<RefCountedArena> arena;
+    ConsensusRequestPB restored;
+    ASSERT_OK(UncompressOps(
+        LZ4,
+        Slice(compressed),
+        uncompressed_size,
+        &restored,
+        on_arena ? &arena : nullptr,
+        4));
+    ASSERT_EQ(6, restored.ops_size());
+    ASSERT_OPID_EQ(MakeOpId(1, 4), restored.preceding_id());
+    for (int i = 0; i < restored.ops_size(); i++) {
+      ASSERT_EQ(
+          request.ops(i + 4).SerializeAsString(),
+          restored.ops(i).SerializeAsString());
+    }
+    if (arena) {
+      ReleaseArenaOps(&restored);
+    }
+  }
+
+  // Uncompressed ops are dropped the same way.
+  ConsensusRequestPB uncompressed = request;
+  SkipCommittedOps(3, &uncompressed);
+  ASSERT_EQ(7, uncompressed.ops_size());
+  ASSERT_OPID_EQ(MakeOpId(1, 3), uncompressed.preceding_id());
+  ASSERT_OPID_EQ(MakeOpId(1, 4), uncompressed.ops(0).id());
+  SkipCommittedOps(3, &uncompressed);
+  ASSERT_EQ(7, uncompressed.ops_size());
+  // The request becomes a heartbeat if every op was committed.
+  SkipCommittedOps(20, &uncompressed);
+  ASSERT_EQ(0, uncompressed.ops_size());
+  ASSERT_OPID_EQ(MakeOpId(1, 10), uncompressed.preceding_id());
+}
+
+// Tests that ops sent with their write payloads as sidecars come back as they
+// were, along with all the other fields of the payloads.
+TEST_F(ConsensusPeersTest, TestPayloadSidecarsRoundTrip) {
+  ConsensusRequestPB request;
+  for (int i = 1; i <= 4; i++) {
+    ReplicateMsg* op = request.add_ops();
+    *op->mutable_id() = MakeOpId(1, i);
+    op->set_timestamp(i);
+    op->set_op_type(WRITE_OP_EXT);
+    WritePayloadPB* payload = op->mutable_write_payload();
+    payload->set_payload(string(1000, 'a' + i));
+    payload->set_crc32(i);
+    if (i % 2 == 0) {
+      payload->set_compression_codec(LZ4);
+      payload->set_uncompressed_size(2000);
+    }
+    if (i == 3) {
+      payload->set_stripped_size(3000);
+    }
+  }
+
+  ConsensusRequestPB wire_request;
+  vector<string> sidecars;
+  for (const ReplicateMsg& op : request.ops()) {
+    ReplicateMsg* wire_op = wire_request.add_ops();
+    const int sidecar_idx = sidecars.size();
+    CopyReplicateWithoutPayload(op, sidecar_idx, wire_op);
+    ASSERT_FALSE(wire_op->write_payload().has_payload());
+    ASSERT_EQ(sidecar_idx, wire_op->write_payload().payload_sidecar_idx());
+    sidecars.push_back(op.write_payload().payload());
+  }
+
+  auto get_sidecar = [&sidecars](int idx, Slice* sidecar) {
+    if (idx < 0 || idx >= static_cast<int>(sidecars.size())) {
+      return Status::NotFound("no such sidecar");
+    }
+    *sidecar = Slice(sidecars[idx]);
+    return Status::OK();
+  };
+  ConsensusRequestPB restored = wire_request;
+  ASSERT_OK(RestorePayloadSidecars(get_sidecar, &restored));
+  ASSERT_EQ(request.ops_size(), restored.ops_size());
+  for (int i = 0; i < request.ops_size(); i++) {
+    ASSERT_EQ(
+        request.ops(i).SerializeAsString(),
+        restored.ops(i).SerializeAsString());
+  }
+
+  // A payload whose sidecar is missing fails the request.
+  sidecars.pop_back();
+  restored = wire_request;
+  ASSERT_TRUE(RestorePayloadSidecars(get_sidecar, &restored).IsNotFound());
+}
+
+// Tests that the large write payloads are sent as sidecars to a peer which
+// supports them, and inline to one which doesn't.
+TEST_F(ConsensusPeersTest, TestPayloadSidecarsOnlyWhenSupported) {
+  FLAGS_consensus_payload_sidecar_min_bytes = 100;
+  message_queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
+
+  shared_ptr<Peer> peer1;
+  RecordingPeerProxy* proxy1 = NewRecordingPeer("peer-1", true, &peer1);
+  shared_ptr<Peer> peer2;
+  RecordingPeerProxy* proxy2 = NewRecordingPeer("peer-2", false, &peer2);
+
+  // Every other payload is too small to be sent as a sidecar.
+  for (int i = 1; i <= 4; i++) {
+    unique_ptr<ReplicateMsg> msg(new ReplicateMsg);
+    *msg->mutable_id() = MakeOpId(0, i);
+    msg->set_timestamp(clock_->Now().ToUint64());
+    msg->set_op_type(WRITE_OP_EXT);
+    msg->mutable_write_payload()->set_payload(string(i % 2 ? 1000 : 10, 'x'));
+    ASSERT_OK(message_queue_->AppendOperation(
+        make_scoped_refptr_replicate(msg.release())));
+  }
+  ASSERT_OK(peer1->SignalRequest());
+  ASSERT_OK(peer2->SignalRequest());
+  NO_FATALS(WaitForCommitIndex(4));
+  ASSERT_EVENTUALLY([&]() {
+    ASSERT_EQ(4, proxy1->last_received().index());
+    ASSERT_EQ(4, proxy2->last_received().index());
+  });
+
+  for (const ReplicateMsg& op : proxy1->ops()) {
+    const bool large = op.id().index() % 2;
+    ASSERT_EQ(large, op.write_payload().has_payload_sidecar_idx());
+    ASSERT_EQ(!large, op.write_payload().has_payload());
+  }
+  const vector<ReplicateMsg> inline_ops = proxy2->ops();
+  ASSERT_FALSE(inline_ops.empty());
+  for (const ReplicateMsg& op : inline_ops) {
+    ASSERT_FALSE(op.write_payload().has_payload_sidecar_idx());
+    ASSERT_EQ(
+        op.id().index() % 2 ? 1000 : 10,
+        static_cast<int>(op.write_payload().payload().size()));
+  }
+  peer1->Close();
+  peer2->Close();
+}
+
+// Tells the peers in another region than the leader which only need to
+// retain the log from the others.
+TEST_F(ConsensusPeersTest, TestLightweightPeerClassification) {
+  RaftPeerPB local_peer_pb = FakeRaftPeerPB(kLeaderUuid);
+  local_peer_pb.mutable_attrs()->set_region("local");
+  NewQueue(local_peer_pb);
+  message_queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(6));
+
+  // A learner and a witness in another region.
+  RaftPeerPB learner = FakeRaftPeerPB("peer-1");
+  learner.set_member_type(RaftPeerPB::NON_VOTER);
+  learner.mutable_attrs()->set_region("remote");
+  RaftPeerPB witness = FakeRaftPeerPB("peer-2");
+  witness.mutable_attrs()->set_region("remote");
+  witness.mutable_attrs()->set_backing_db_present(false);
+  // A voter with a backing database in another region, a learner in the
+  // local region and a learner whose region is unknown.
+  RaftPeerPB voter = FakeRaftPeerPB("peer-3");
+  voter.mutable_attrs()->set_region("remote");
+  RaftPeerPB local_learner = FakeRaftPeerPB("peer-4");
+  local_learner.set_member_type(RaftPeerPB::NON_VOTER);
+  local_learner.mutable_attrs()->set_region("local");
+  RaftPeerPB unknown_learner = FakeRaftPeerPB("peer-5");
+  unknown_learner.set_member_type(RaftPeerPB::NON_VOTER);
+  for (const RaftPeerPB* peer_pb :
+       {&learner, &witness, &voter, &local_learner, &unknown_learner}) {
+    message_queue_->TrackPeer(*peer_pb);
+  }
+
+  bool is_voter = true;
+  ASSERT_TRUE(message_queue_->IsLightweightPeer("peer-1", &is_voter));
+  ASSERT_FALSE(is_voter);
+  ASSERT_TRUE(message_queue_->IsLightweightPeer("peer-2", &is_voter));
+  ASSERT_TRUE(is_voter);
+  // Nor is a peer which isn't tracked.
+  for (const char* uuid : {"peer-3", "peer-4", "peer-5", "peer-6"}) {
+    ASSERT_FALSE(message_queue_->IsLightweightPeer(uuid, nullptr)) << uuid;
+  }
+}
+
+// With --consensus_lightweight_peers, a learner in another region is
+// heartbeated every --raft_lightweight_peer_heartbeat_interval_ms while it
+// has nothing to receive. A witness, which watches for a failed leader, keeps
+// the regular heartbeats.
+TEST_F(ConsensusPeersTest, TestLightweightPeerHeartbeats) {
+  FLAGS_consensus_lightweight_peers = true;
+  FLAGS_raft_heartbeat_interval_ms = 20;
+  FLAGS_raft_lightweight_peer_heartbeat_interval_ms = 60 * 1000;
+  RaftPeerPB local_peer_pb = FakeRaftPeerPB(kLeaderUuid);
+  local_peer_pb.mutable_attrs()->set_region("local");
+  NewQueue(local_peer_pb);
+  message_queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
+
+  RaftPeerPB learner_pb = FakeRaftPeerPB("peer-1");
+  learner_pb.set_member_type(RaftPeerPB::NON_VOTER);
+  learner_pb.mutable_attrs()->set_region("remote");
+  shared_ptr<Peer> learner;
+  RecordingPeerProxy* learner_proxy =
+      NewRecordingPeer(learner_pb, false, &learner);
+  RaftPeerPB witness_pb = FakeRaftPeerPB("peer-2");
+  witness_pb.mutable_attrs()->set_region("remote");
+  witness_pb.mutable_attrs()->set_backing_db_present(false);
+  shared_ptr<Peer> witness;
+  RecordingPeerProxy* witness_proxy =
+      NewRecordingPeer(witness_pb, false, &witness);
+
+  // The leader finds out the learner is lightweight as it sends it its first
+  // request.
+  ASSERT_EVENTUALLY([&]() { ASSERT_GE(learner_proxy->updates(), 1); });
+  SleepFor(MonoDelta::FromMilliseconds(100));
+  const int learner_updates = learner_proxy->updates();
+  const int witness_updates = witness_proxy->updates();
+  SleepFor(MonoDelta::FromMilliseconds(500));
+  ASSERT_EQ(learner_updates, learner_proxy->updates());
+  ASSERT_GE(witness_proxy->updates(), witness_updates + 5);
+  learner->Close();
+  witness->Close();
+}
+
 } // namespace consensus
 } // namespace kudu
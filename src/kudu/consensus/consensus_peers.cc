@@ -25,6 +25,8 @@
 
 #include <algorithm>
 #include <cstdlib>
+#include <functional>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <ostream>
@@ -35,6 +37,11 @@
 #include <gflags/gflags.h>
 #include <gflags/gflags_declare.h>
 #include <glog/logging.h>
+#include <google/protobuf/arena.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <google/protobuf/repeated_field.h>
+#include <google/protobuf/wire_format_lite.h>
 
 #include "kudu/common/common.pb.h"
 #include "kudu/common/wire_protocol.h"
@@ -43,6 +50,7 @@
 #include "kudu/consensus/consensus.proxy.h"
 #include "kudu/consensus/consensus_queue.h"
 #include "kudu/consensus/metadata.pb.h"
+#include "kudu/consensus/multi_raft_batcher.h"
 #include "kudu/consensus/opid_util.h"
 #include "kudu/consensus/routing.h"
 #include "kudu/gutil/macros.h"
@@ -50,11 +58,18 @@
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/rpc/periodic.h"
+#include "kudu/rpc/proxy.h"
 #include "kudu/rpc/response_callback.h"
+#include "kudu/rpc/rpc_context.h"
 #include "kudu/rpc/rpc_controller.h"
+#include "kudu/rpc/rpc_sidecar.h"
+#include "kudu/rpc/transfer.h"
 #ifdef FB_DO_NOT_REMOVE
 #include "kudu/tserver/tserver.pb.h" // @manual
 #endif
+#include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/compression/compression_codec.h"
+#include "kudu/util/faststring.h"
 #include "kudu/util/fault_injection.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
@@ -63,7 +78,9 @@
 #include "kudu/util/net/net_util.h"
 #include "kudu/util/net/sockaddr.h"
 #include "kudu/util/pb_util.h"
+#include "kudu/util/slice.h"
 #include "kudu/util/status.h"
+#include "kudu/util/stopwatch.h"
 #include "kudu/util/threadpool.h"
 
 DEFINE_int32(
@@ -109,6 +126,7 @@ DEFINE_int32(
 TAG_FLAG(raft_proxy_max_hops, advanced);
 
 DECLARE_int32(raft_heartbeat_interval_ms);
+DECLARE_int32(raft_quiesced_heartbeat_interval_ms);
 
 DEFINE_int32(
     proxy_batch_duration_ms,
@@ -116,6 +134,127 @@ DEFINE_int32(
     "Time (in ms) to wait before reading ops for proxy requests");
 
 DECLARE_bool(raft_enforce_rpc_token);
+DECLARE_bool(consensus_batch_heartbeats);
+DECLARE_bool(raft_proxy_fanout);
+
+DEFINE_int32(
+    consensus_max_inflight_requests_per_peer,
+    1,
+    "Maximum number of UpdateConsensus requests the leader keeps in flight to "
+    "each peer. Above 1, batches of new ops are sent to a peer without waiting "
+    "for the previous one to be acknowledged, so that the replication "
+    "throughput to a far away peer is not capped at one batch per round trip.");
+TAG_FLAG(consensus_max_inflight_requests_per_peer, advanced);
+TAG_FLAG(consensus_max_inflight_requests_per_peer, runtime);
+
+DEFINE_int32(
+    raft_peer_retry_initial_backoff_ms,
+    20,
+    "After a failed UpdateConsensus request, how long (in ms) the leader waits "
+    "before retrying the peer, doubling with every consecutive failure up to "
+    "--raft_heartbeat_interval_ms. If 0, a failed peer is only retried on "
+    "its next heartbeat.");
+TAG_FLAG(raft_peer_retry_initial_backoff_ms, advanced);
+TAG_FLAG(raft_peer_retry_initial_backoff_ms, runtime);
+
+DEFINE_int32(
+    consensus_payload_sidecar_min_bytes,
+    0,
+    "Write payloads of at least this many bytes are sent to peers as RPC "
+    "sidecars, which saves copying them into the serialized request. "
+    "Requires every peer to support it, so only set this once all servers "
+    "run a version that does. 0 disables it.");
+TAG_FLAG(consensus_payload_sidecar_min_bytes, advanced);
+TAG_FLAG(consensus_payload_sidecar_min_bytes, runtime);
+
+DEFINE_int32(
+    consensus_peer_rpc_streams,
+    1,
+    "Number of connections to open to each peer for consensus RPCs. With "
+    "more than one, heartbeats and votes keep a connection of their own "
+    "while batches of operations are spread over the others, so they do not "
+    "wait behind large transfers to the same peer.");
+TAG_FLAG(consensus_peer_rpc_streams, advanced);
+
+DEFINE_bool(
+    consensus_peer_reuse_calls,
+    false,
+    "Whether requests to peers reuse the RPC call objects of their previous "
+    "requests, instead of allocating new ones for every heartbeat and batch.");
+TAG_FLAG(consensus_peer_reuse_calls, experimental);
+TAG_FLAG(consensus_peer_reuse_calls, runtime);
+
+DEFINE_string(
+    consensus_compressed_ops_codec,
+    "NO_COMPRESSION",
+    "Codec the leader compresses the ops of a request to a peer with, as a "
+    "whole rather than one payload at a time, which finds the redundancy "
+    "between the ops of a batch. Only used with peers which said they accept "
+    "it, and only for the ops a request carries directly to its "
+    "destination. One of SNAPPY, LZ4, ZLIB or ZSTD, or NO_COMPRESSION to "
+    "disable it.");
+static bool ValidateCompressedOpsCodec(
+    const char* /*flagname*/,
+    const std::string& value) {
+  kudu::CompressionType type;
+  return kudu::CompressionType_Parse(value, &type) &&
+      (type == kudu::NO_COMPRESSION || type == kudu::SNAPPY ||
+       type == kudu::LZ4 || type == kudu::ZLIB || type == kudu::ZSTD);
+}
+DEFINE_validator(consensus_compressed_ops_codec, &ValidateCompressedOpsCodec);
+TAG_FLAG(consensus_compressed_ops_codec, experimental);
+TAG_FLAG(consensus_compressed_ops_codec, runtime);
+
+DEFINE_bool(
+    consensus_compressed_ops_remote_regions_only,
+    true,
+    "Whether the ops are only compressed as a whole for peers known to be in "
+    "another region than the leader, where bandwidth is scarcer than CPU. "
+    "See --consensus_compressed_ops_codec.");
+TAG_FLAG(consensus_compressed_ops_remote_regions_only, experimental);
+TAG_FLAG(consensus_compressed_ops_remote_regions_only, runtime);
+
+DEFINE_bool(
+    consensus_lightweight_peers,
+    false,
+    "Whether the peers in another region than the leader which only need to "
+    "retain the log, i.e. non-voters and voters without a backing database, "
+    "are replicated to in a lightweight mode: their ops are always compressed "
+    "as a whole with --consensus_lightweight_peer_codec, and the non-voters "
+    "among them are heartbeated at --raft_lightweight_peer_heartbeat_"
+    "interval_ms, without the priority heartbeats otherwise get.");
+TAG_FLAG(consensus_lightweight_peers, experimental);
+TAG_FLAG(consensus_lightweight_peers, runtime);
+
+DEFINE_string(
+    consensus_lightweight_peer_codec,
+    "LZ4",
+    "Codec the ops sent to lightweight peers are compressed with, see "
+    "--consensus_lightweight_peers. Takes the same values as "
+    "--consensus_compressed_ops_codec.");
+DEFINE_validator(consensus_lightweight_peer_codec, &ValidateCompressedOpsCodec);
+TAG_FLAG(consensus_lightweight_peer_codec, experimental);
+TAG_FLAG(consensus_lightweight_peer_codec, runtime);
+
+DEFINE_int32(
+    raft_lightweight_peer_heartbeat_interval_ms,
+    5000,
+    "How often (in ms) the leader heartbeats the lightweight non-voters which "
+    "have no ops to receive, see --consensus_lightweight_peers. Non-voters "
+    "never start elections, so they only need heartbeats to learn of the "
+    "committed index. Never shorter than --raft_heartbeat_interval_ms.");
+TAG_FLAG(raft_lightweight_peer_heartbeat_interval_ms, experimental);
+TAG_FLAG(raft_lightweight_peer_heartbeat_interval_ms, runtime);
+
+DEFINE_bool(
+    consensus_ops_arena_use_slab_allocator,
+    false,
+    "Whether the arenas which a follower parses compressed ops on, and which "
+    "then hold the ops in its log cache, allocate their blocks from the "
+    "slab allocator, whose large buffers may be backed by huge pages. See "
+    "--slab_allocator_huge_pages.");
+TAG_FLAG(consensus_ops_arena_use_slab_allocator, experimental);
+TAG_FLAG(consensus_ops_arena_use_slab_allocator, runtime);
 
 METRIC_DEFINE_counter(
     server,
@@ -125,6 +264,7 @@ METRIC_DEFINE_counter(
     "Number of RPC responses that did not have a token "
     "that matches this instance's");
 
+using google::protobuf::internal::WireFormatLite;
 using kudu::pb_util::SecureShortDebugString;
 using kudu::rpc::Messenger;
 using kudu::rpc::PeriodicTimer;
@@ -139,6 +279,93 @@ using strings::Substitute;
 namespace kudu {
 namespace consensus {
 
+namespace {
+int MaxInflightRequests() {
+  return std::max(1, FLAGS_consensus_max_inflight_requests_per_peer);
+}
+
+// Returns how long to wait before retrying a peer which failed
+// 'failed_attempts' times in a row, capped at the heartbeat period.
+MonoDelta RetryBackoff(uint64_t failed_attempts) {
+  int64_t max_ms = FLAGS_raft_heartbeat_interval_ms;
+  int64_t backoff_ms = FLAGS_raft_peer_retry_initial_backoff_ms;
+  if (backoff_ms <= 0) {
+    return MonoDelta::FromMilliseconds(max_ms);
+  }
+  for (uint64_t i = 1; i < failed_attempts && backoff_ms < max_ms; i++) {
+    backoff_ms *= 2;
+  }
+  return MonoDelta::FromMilliseconds(std::min(backoff_ms, max_ms));
+}
+
+// A sidecar for the write payload of a ReplicateMsg. It holds a reference to
+// the batch of the message, which could otherwise be evicted from the LogCache
+// while a timed out request is still being sent. The sidecars of a request all
+// reference the batch from the same thread, which unlike referencing each
+// message doesn't contend with the other users of the messages.
+class PayloadSidecar : public rpc::RpcSidecar {
+ public:
+  PayloadSidecar(ReplicateBatchRefPtr batch, int index)
+      : batch_(std::move(batch)), index_(index) {}
+
+  Slice AsSlice() const override {
+    return Slice(batch_->msgs()[index_]->get()->write_payload().payload());
+  }
+
+ private:
+  const ReplicateBatchRefPtr batch_;
+  const int index_;
+};
+
+// Whether all the ops of 'request' are to be looked up by the proxy.
+bool AllProxyOps(const ConsensusRequestPB& request) {
+  for (const ReplicateMsg& op : request.ops()) {
+    if (op.op_type() != PROXY_OP) {
+      return false;
+    }
+  }
+  return true;
+}
+} // anonymous namespace
+
+void CopyReplicateWithoutPayload(
+    const ReplicateMsg& src,
+    int sidecar_idx,
+    ReplicateMsg* dst) {
+  // Catch fields being added to ReplicateMsg without being handled here.
+  DCHECK_EQ(8, ReplicateMsg::descriptor()->field_count());
+  DCHECK_EQ(6, WritePayloadPB::descriptor()->field_count());
+
+  *dst->mutable_id() = src.id();
+  dst->set_timestamp(src.timestamp());
+  dst->set_op_type(src.op_type());
+  if (src.has_change_config_record()) {
+    *dst->mutable_change_config_record() = src.change_config_record();
+  }
+  if (src.has_proxy_record()) {
+    *dst->mutable_proxy_record() = src.proxy_record();
+  }
+  if (src.has_request_id()) {
+    *dst->mutable_request_id() = src.request_id();
+  }
+  if (src.has_noop_request()) {
+    *dst->mutable_noop_request() = src.noop_request();
+  }
+  const WritePayloadPB& src_payload = src.write_payload();
+  WritePayloadPB* dst_payload = dst->mutable_write_payload();
+  dst_payload->set_compression_codec(src_payload.compression_codec());
+  if (src_payload.has_uncompressed_size()) {
+    dst_payload->set_uncompressed_size(src_payload.uncompressed_size());
+  }
+  if (src_payload.has_crc32()) {
+    dst_payload->set_crc32(src_payload.crc32());
+  }
+  if (src_payload.has_stripped_size()) {
+    dst_payload->set_stripped_size(src_payload.stripped_size());
+  }
+  dst_payload->set_payload_sidecar_idx(sidecar_idx);
+}
+
 Status Peer::NewRemotePeer(
     RaftPeerPB peer_pb,
     string tablet_id,
@@ -175,14 +402,22 @@ Peer::Peer(
     : tablet_id_(std::move(tablet_id)),
       leader_uuid_(std::move(leader_uuid)),
       peer_pb_(std::move(peer_pb)),
+      log_prefix_(Substitute(
+          "T $0 P $1 -> Peer $2 ($3:$4): ",
+          tablet_id_,
+          leader_uuid_,
+          peer_pb_.permanent_uuid(),
+          peer_pb_.last_known_addr().host(),
+          peer_pb_.last_known_addr().port())),
       proxy_(std::move(proxy)),
       queue_(queue),
       peer_proxy_pool_(peer_proxy_pool),
       failed_attempts_(0),
       last_request_time_(MonoTime::Now()),
+      last_sent_committed_index_(kMinimumOpIdIndex),
       messenger_(std::move(messenger)),
       raft_pool_token_(raft_pool_token) {
-  request_pending_ = false;
+  num_inflight_requests_ = 0;
 }
 
 Status Peer::Init() {
@@ -207,14 +442,14 @@ Status Peer::Init() {
 }
 
 Status Peer::SignalRequest(bool even_if_queue_empty, bool from_heartbeater) {
-  // Only allow one request at a time. No sense waking up the
+  // Only allow a bounded number of requests at a time. No sense waking up the
   // raft thread pool if the task will just abort anyway.
   //
-  // "request_pending_" is an atomic, hence no need to take peer_lock_ here.
-  // This allows to return early without blocking on "peer_lock_". Note that
-  // "peer_lock_" is also held during Peer::SendNextRequest(...) which could
-  // take some time for a lagging peer as it involves multiple disk IO
-  if (request_pending_) {
+  // "num_inflight_requests_" is an atomic, hence no need to take peer_lock_
+  // here. This allows to return early without blocking on "peer_lock_". Note
+  // that "peer_lock_" is also held during Peer::SendNextRequest(...) which
+  // could take some time for a lagging peer as it involves multiple disk IO
+  if (num_inflight_requests_ >= MaxInflightRequests()) {
     return Status::OK();
   }
 
@@ -232,13 +467,18 @@ Status Peer::SignalRequest(bool even_if_queue_empty, bool from_heartbeater) {
 
   // Capture a weak_ptr reference into the submitted functor so that we can
   // safely handle the functor outliving its peer.
+  //
+  // Heartbeats are submitted with a high priority so that the work of busier
+  // groups sharing the Raft thread pool doesn't delay them into elections.
   weak_ptr<Peer> w_this = shared_from_this();
   RETURN_NOT_OK(raft_pool_token_->SubmitFunc(
       [even_if_queue_empty, from_heartbeater, w_this]() {
         if (auto p = w_this.lock()) {
           p->SendNextRequest(even_if_queue_empty, from_heartbeater);
         }
-      }));
+      },
+      from_heartbeater && !relaxed_heartbeats_ ? ThreadPool::Priority::HIGH
+                                               : ThreadPool::Priority::NORMAL));
   return Status::OK();
 }
 
@@ -272,8 +512,19 @@ void Peer::SendNextRequest(bool even_if_queue_empty, bool from_heartbeater) {
     return;
   }
 
-  // Only allow one request at a time.
-  if (request_pending_) {
+  // Nothing else is sent while a chunk of a snapshot is in flight.
+  if (snapshot_in_flight_) {
+    return;
+  }
+
+  // Only allow a bounded number of requests at a time.
+  if (num_inflight_requests_ >= MaxInflightRequests()) {
+    return;
+  }
+
+  // Only pipeline requests to a healthy peer: while a request to a peer that
+  // has been failing is in flight, wait for its outcome.
+  if (num_inflight_requests_ > 0 && failed_attempts_ > 0) {
     return;
   }
 
@@ -287,14 +538,8 @@ void Peer::SendNextRequest(bool even_if_queue_empty, bool from_heartbeater) {
 
   // If our last request generated an error, and this is not a normal
   // heartbeat request, then don't send the "per-op" request. Instead,
-  // we'll wait for the heartbeat.
-  //
-  // TODO(todd): we could consider looking at the number of consecutive failed
-  // attempts, and instead of ignoring the signal, ask the heartbeater
-  // to "expedite" the next heartbeat in order to achieve something like
-  // exponential backoff after an error. As it is implemented today, any
-  // transient error will result in a latency blip as long as the heartbeat
-  // period.
+  // we'll wait for the heartbeat, which ProcessResponseError() expedited
+  // with an exponential backoff.
   if (failed_attempts_ > 0 && !even_if_queue_empty) {
     return;
   }
@@ -314,28 +559,34 @@ void Peer::SendNextRequest(bool even_if_queue_empty, bool from_heartbeater) {
   // reachable.
   bool read_ops = (failed_attempts_ <= 0);
 
-  request_pending_ = true;
+  shared_ptr<UpdateRequest> req = AcquireRequestUnlocked();
+  ConsensusRequestPB& request = req->request;
 
   last_request_time_ = MonoTime::Now();
 
   // The next hop to route to to ship messages to this peer. This could be
   // different than the peer_uuid when proxy is enabled
   string next_hop_uuid;
-  int64_t commit_index_before = request_.has_committed_index()
-      ? request_.committed_index()
-      : kMinimumOpIdIndex;
+  int64_t commit_index_before = last_sent_committed_index_;
   Status s = queue_->RequestForPeer(
       peer_pb_.permanent_uuid(),
       read_ops,
-      &request_,
-      &replicate_msg_refs_,
+      &request,
+      &req->replicate_msg_refs,
       &needs_tablet_copy,
       &next_hop_uuid);
-  int64_t commit_index_after = request_.has_committed_index()
-      ? request_.committed_index()
+  int64_t commit_index_after = request.has_committed_index()
+      ? request.committed_index()
       : kMinimumOpIdIndex;
+  last_sent_committed_index_ = commit_index_after;
 
   if (PREDICT_FALSE(!s.ok())) {
+    ReleaseRequestUnlocked(std::move(req));
+    // The ops the peer needs may be gone from the log, in which case it is
+    // caught up with the latest snapshot, if there is one.
+    if (s.IsNotFound() && read_ops && SendSnapshotChunk(&l)) {
+      return;
+    }
     // Incrementing failed_attempts_ prevents a RequestForPeer error to
     // continually trigger an error on every actual write. The next attempt to
     // RequestForPeer will now be restricted to Heartbeats, but because this is
@@ -347,16 +598,17 @@ void Peer::SendNextRequest(bool even_if_queue_empty, bool from_heartbeater) {
     // cluster.
     failed_attempts_++;
     VLOG_WITH_PREFIX_UNLOCKED(1) << s.ToString();
-    request_pending_ = false;
     return;
   }
+  UpdateLightweightModeUnlocked();
 
 #ifdef FB_DO_NOT_REMOVE
   if (PREDICT_FALSE(needs_tablet_copy)) {
+    ReleaseRequestUnlocked(std::move(req));
     Status s = PrepareTabletCopyRequest();
     if (s.ok()) {
       controller_.Reset();
-      request_pending_ = true;
+      num_inflight_requests_++;
       l.unlock();
       // Capture a shared_ptr reference into the RPC callback so that we're
       // guaranteed that this object outlives the RPC.
@@ -369,48 +621,66 @@ void Peer::SendNextRequest(bool even_if_queue_empty, bool from_heartbeater) {
       LOG_WITH_PREFIX_UNLOCKED(WARNING)
           << "Unable to generate Tablet Copy request for peer: "
           << s.ToString();
-      request_pending_ = false;
     }
     return;
   }
 #endif
 
-  request_.set_tablet_id(tablet_id_);
-  request_.set_caller_uuid(leader_uuid_);
-  request_.set_dest_uuid(peer_pb_.permanent_uuid());
+  request.set_tablet_id(tablet_id_);
+  request.set_caller_uuid(leader_uuid_);
+  request.set_dest_uuid(peer_pb_.permanent_uuid());
 
   bool req_has_ops =
-      request_.ops_size() > 0 || (commit_index_after > commit_index_before);
+      request.ops_size() > 0 || (commit_index_after > commit_index_before);
   // If the queue is empty, check if we were told to send a status-only
   // message, if not just return.
   if (PREDICT_FALSE(!req_has_ops && !even_if_queue_empty)) {
-    request_pending_ = false;
+    ReleaseRequestUnlocked(std::move(req));
     return;
   }
 
   if (req_has_ops) {
+    // Traffic resumed: heartbeat at the regular interval again.
+    if (quiesced_) {
+      VLOG_WITH_PREFIX_UNLOCKED(1) << "Unquiescing heartbeats";
+      quiesced_ = false;
+      heartbeater_->Start();
+    }
     // If we're actually sending ops there's no need to heartbeat for a while.
     heartbeater_->Snooze();
+  } else if (relaxed_heartbeats_ && !quiesced_) {
+    heartbeater_->Snooze(MonoDelta::FromMilliseconds(std::max(
+        FLAGS_raft_lightweight_peer_heartbeat_interval_ms,
+        FLAGS_raft_heartbeat_interval_ms)));
   }
+  // Heartbeats are only quiesced once the peer has acknowledged one that
+  // says so, and only if nothing was sent in the meantime.
+  quiesce_pending_ = request.quiesce() && !req_has_ops;
 
   MAYBE_FAULT(FLAGS_fault_crash_on_leader_request_fraction);
 
   VLOG_WITH_PREFIX_UNLOCKED(2)
       << "Sending to peer " << peer_pb().permanent_uuid() << ": "
-      << SecureShortDebugString(request_);
-  controller_.Reset();
+      << SecureShortDebugString(request);
+  req->controller.set_reuse_outbound_call(FLAGS_consensus_peer_reuse_calls);
+  req->controller.Reset();
+
+  // If the window allows, follow up with the next batch right away rather
+  // than waiting for this one to be acknowledged.
+  bool pipeline_next =
+      request.ops_size() > 0 && num_inflight_requests_ < MaxInflightRequests();
 
   l.unlock();
   // Capture a shared_ptr reference into the RPC callback so that we're
   // guaranteed that this object outlives the RPC.
   shared_ptr<Peer> s_this = shared_from_this();
 
-  // TODO: Refactor this code. Ideally all fields in 'request_' related to
+  // TODO: Refactor this code. Ideally all fields in 'request' related to
   // proxying should be set inside PeerMessageQueue::RequestForPeer(). Move the
   // setting of 'proxy_hops_remaining' to PeerMessageQueue::RequestForPeer()
   if (next_hop_uuid != peer_pb().permanent_uuid()) {
     // If this is a proxy request, set the hops remaining value.
-    request_.set_proxy_hops_remaining(FLAGS_raft_proxy_max_hops);
+    request.set_proxy_hops_remaining(FLAGS_raft_proxy_max_hops);
   }
 
   shared_ptr<PeerProxy> next_hop_proxy = peer_proxy_pool_->Get(next_hop_uuid);
@@ -419,9 +689,27 @@ void Peer::SendNextRequest(bool even_if_queue_empty, bool from_heartbeater) {
                                     << " not found in peer proxy pool";
   }
 
-  next_hop_proxy->UpdateAsync(&request_, &response_, &controller_, [s_this]() {
-    s_this->ProcessResponse();
-  });
+  // Proxies forward the ops they get as is, so only the ops sent straight to
+  // their destination are compressed.
+  const ConsensusRequestPB* wire_request = &request;
+  if (next_hop_proxy->SupportsPayloadSidecars() &&
+      ((next_hop_uuid == peer_pb().permanent_uuid() &&
+        PrepareCompressedOps(req.get())) ||
+       PreparePayloadSidecars(req.get()))) {
+    wire_request = &req->wire_request;
+  }
+
+  req->send_time = MonoTime::Now();
+  req->in_flight_peer = std::move(s_this);
+  next_hop_proxy->UpdateAsync(
+      wire_request, &req->response, &req->controller, [req]() {
+        shared_ptr<Peer> peer = std::move(req->in_flight_peer);
+        peer->ProcessResponse(req);
+      });
+
+  if (pipeline_next) {
+    WARN_NOT_OK(SignalRequest(), "Unable to pipeline the next request");
+  }
 }
 
 Status Peer::StartElection(
@@ -438,47 +726,53 @@ Status Peer::StartElection(
   return Status::OK();
 }
 
-void Peer::ProcessResponse() {
+void Peer::ProcessResponse(const shared_ptr<UpdateRequest>& req) {
   // Note: This method runs on the reactor thread.
+  req->round_trip = MonoTime::Now() - req->send_time;
   std::unique_lock<simple_spinlock> lock(peer_lock_);
   if (closed_) {
     return;
   }
-  CHECK(request_pending_);
+  CHECK_GT(num_inflight_requests_.load(), 0);
 
   MAYBE_FAULT(FLAGS_fault_crash_after_leader_request_fraction);
 
+  const ConsensusResponsePB& response = req->response;
+
   // Process RpcController errors.
-  const auto controller_status = controller_.status();
+  const auto controller_status = req->controller.status();
   if (!controller_status.ok()) {
+    // The peer may have restarted with a version which does not accept
+    // compressed ops; wait for it to say it does again.
+    peer_supports_compressed_ops_ = false;
     auto ps = controller_status.IsRemoteError() ? PeerStatus::REMOTE_ERROR
                                                 : PeerStatus::RPC_LAYER_ERROR;
     queue_->UpdatePeerStatus(peer_pb_.permanent_uuid(), ps, controller_status);
-    ProcessResponseError(controller_status);
+    ProcessResponseError(req, controller_status);
     return;
   }
 
   // Process CANNOT_PREPARE.
   // TODO(todd): there is no integration test coverage of this code path. Likely
   // a bug in this path is responsible for KUDU-1779.
-  if (response_.status().has_error() &&
-      response_.status().error().code() ==
+  if (response.status().has_error() &&
+      response.status().error().code() ==
           consensus::ConsensusErrorPB::CANNOT_PREPARE) {
-    Status response_status = StatusFromPB(response_.status().error().status());
+    Status response_status = StatusFromPB(response.status().error().status());
     queue_->UpdatePeerStatus(
         peer_pb_.permanent_uuid(), PeerStatus::CANNOT_PREPARE, response_status);
-    ProcessResponseError(response_status);
+    ProcessResponseError(req, response_status);
     return;
   }
 
   // Process tserver-level errors.
-  if (response_.has_error()) {
-    Status response_status = StatusFromPB(response_.error().status());
+  if (response.has_error()) {
+    Status response_status = StatusFromPB(response.error().status());
     PeerStatus ps;
     ps = PeerStatus::REMOTE_ERROR;
 
-    ServerErrorPB resp_error = response_.error();
-    switch (response_.error().code()) {
+    ServerErrorPB resp_error = response.error();
+    switch (response.error().code()) {
       // We treat WRONG_SERVER_UUID as failed.
       case ServerErrorPB::WRONG_SERVER_UUID:
         FALLTHROUGH_INTENDED;
@@ -495,7 +789,7 @@ void Peer::ProcessResponse() {
         ps = PeerStatus::REMOTE_ERROR;
     }
     queue_->UpdatePeerStatus(peer_pb_.permanent_uuid(), ps, response_status);
-    ProcessResponseError(response_status);
+    ProcessResponseError(req, response_status);
     return;
   }
 
@@ -507,32 +801,56 @@ void Peer::ProcessResponse() {
   // Capture a weak_ptr reference into the submitted functor so that we can
   // safely handle the functor outliving its peer.
   weak_ptr<Peer> w_this = shared_from_this();
-  Status s = raft_pool_token_->SubmitFunc([w_this]() {
+  Status s = raft_pool_token_->SubmitFunc([w_this, req]() {
     if (auto p = w_this.lock()) {
-      p->DoProcessResponse();
+      p->DoProcessResponse(req);
     }
   });
   if (PREDICT_FALSE(!s.ok())) {
-    LOG_WITH_PREFIX_UNLOCKED(WARNING)
-        << "Unable to process peer response: " << s.ToString() << ": "
-        << SecureShortDebugString(response_);
-    request_pending_ = false;
+    KLOG_EVERY_N_SECS(WARNING, 1)
+        << LogPrefixUnlocked() << "Unable to process peer response: "
+        << s.ToString() << ": " << SecureShortDebugString(response)
+        << THROTTLE_MSG;
+    ReleaseRequestUnlocked(req);
   }
 }
 
-void Peer::DoProcessResponse() {
+void Peer::DoProcessResponse(const shared_ptr<UpdateRequest>& req) {
   VLOG_WITH_PREFIX_UNLOCKED(2)
       << "Response from peer " << peer_pb().permanent_uuid() << ": "
-      << SecureShortDebugString(response_);
+      << SecureShortDebugString(req->response);
 
-  bool send_more_immediately =
-      queue_->ResponseFromPeer(peer_pb_.permanent_uuid(), response_);
+  if (req->response.supports_compressed_ops()) {
+    peer_supports_compressed_ops_ = true;
+  }
+
+  bool send_more_immediately = queue_->ResponseFromPeer(
+      peer_pb_.permanent_uuid(),
+      req->response,
+      req->round_trip,
+      req->send_time);
 
   {
     std::unique_lock<simple_spinlock> lock(peer_lock_);
-    CHECK(request_pending_);
+    CHECK_GT(num_inflight_requests_.load(), 0);
     failed_attempts_ = 0;
-    request_pending_ = false;
+    if (req->request.quiesce() && quiesce_pending_ &&
+        !req->response.status().has_error()) {
+      // The peer has caught up, and has stretched its failure detector to
+      // the quiesced heartbeat interval.
+      quiesce_pending_ = false;
+      if (!quiesced_) {
+        VLOG_WITH_PREFIX_UNLOCKED(1) << "Quiescing heartbeats";
+        quiesced_ = true;
+      }
+      if (FLAGS_raft_quiesced_heartbeat_interval_ms > 0) {
+        heartbeater_->Snooze(MonoDelta::FromMilliseconds(
+            FLAGS_raft_quiesced_heartbeat_interval_ms));
+      } else {
+        heartbeater_->Stop();
+      }
+    }
+    ReleaseRequestUnlocked(req);
   }
   // We're OK to read the state_ without a lock here -- if we get a race,
   // the worst thing that could happen is that we'll make one more request
@@ -561,8 +879,8 @@ void Peer::ProcessTabletCopyResponse() {
   if (closed_) {
     return;
   }
-  CHECK(request_pending_);
-  request_pending_ = false;
+  CHECK_GT(num_inflight_requests_.load(), 0);
+  num_inflight_requests_--;
 
   // If the response is OK, or ALREADY_INPROGRESS, then consider the RPC
   // successful.
@@ -590,19 +908,21 @@ void Peer::ProcessTabletCopyResponse() {
 }
 #endif
 
-void Peer::ProcessResponseError(const Status& status) {
+void Peer::ProcessResponseError(
+    const shared_ptr<UpdateRequest>& req,
+    const Status& status) {
   string resp_err_info;
 
 #ifdef FB_DO_NOT_REMOVE
-  if (response_.has_error()) {
+  if (req->response.has_error()) {
     resp_err_info = Substitute(
         " Error code: $0 ($1).",
-        TabletServerErrorPB::Code_Name(response_.error().code()),
-        response_.error().code());
+        TabletServerErrorPB::Code_Name(req->response.error().code()),
+        req->response.error().code());
   }
 #endif
 
-  request_pending_ = false;
+  ReleaseRequestUnlocked(req);
 
   if (status.IsIllegalState() &&
       status.ToString().find("Previous Rotate Event with") !=
@@ -614,22 +934,103 @@ void Peer::ProcessResponseError(const Status& status) {
   // Increment failed attempts only when this is not an expected rejection by a
   // peer due to file rotation
   failed_attempts_++;
+
+  // Rather than waiting a whole heartbeat period, bring the next heartbeat
+  // forward so that a transient error only costs a short backoff.
+  MonoDelta backoff = RetryBackoff(failed_attempts_);
+  if (backoff.ToMilliseconds() < FLAGS_raft_heartbeat_interval_ms) {
+    heartbeater_->Expedite(backoff);
+  }
   KLOG_EVERY_N_SECS(WARNING, 300)
       << LogPrefixUnlocked() << "Couldn't send request to peer "
       << peer_pb_.permanent_uuid() << " for tablet " << tablet_id_ << "."
       << resp_err_info << " Status: " << status.ToString() << "."
-      << " Retrying in the next heartbeat period."
+      << " Retrying in " << backoff.ToMilliseconds() << "ms."
       << " Already tried " << failed_attempts_ << " times.";
 }
 
-string Peer::LogPrefixUnlocked() const {
-  return Substitute(
-      "T $0 P $1 -> Peer $2 ($3:$4): ",
-      tablet_id_,
-      leader_uuid_,
-      peer_pb_.permanent_uuid(),
-      peer_pb_.last_known_addr().host(),
-      peer_pb_.last_known_addr().port());
+bool Peer::SendSnapshotChunk(std::unique_lock<simple_spinlock>* l) {
+  DCHECK(l->owns_lock());
+  const string& uuid = peer_pb_.permanent_uuid();
+  Status s = queue_->RequestSnapshotChunkForPeer(
+      uuid, snapshot_offset_, &snapshot_request_);
+  if (!s.ok()) {
+    VLOG_WITH_PREFIX_UNLOCKED(1)
+        << "Not sending a snapshot chunk: " << s.ToString();
+    return false;
+  }
+  snapshot_offset_ = snapshot_request_.offset();
+  snapshot_request_.set_tablet_id(tablet_id_);
+  snapshot_request_.set_caller_uuid(leader_uuid_);
+  snapshot_request_.set_dest_uuid(uuid);
+  snapshot_response_.Clear();
+  snapshot_controller_.Reset();
+  snapshot_in_flight_ = true;
+  l->unlock();
+
+  VLOG_WITH_PREFIX_UNLOCKED(2)
+      << "Sending " << snapshot_request_.data().size() << " bytes at offset "
+      << snapshot_request_.offset() << " of snapshot "
+      << snapshot_request_.snapshot().id();
+  // Capture a shared_ptr reference into the RPC callback so that we're
+  // guaranteed that this object outlives the RPC.
+  shared_ptr<Peer> s_this = shared_from_this();
+  proxy_->InstallSnapshotAsync(
+      &snapshot_request_,
+      &snapshot_response_,
+      &snapshot_controller_,
+      [s_this]() { s_this->ProcessSnapshotResponse(); });
+  return true;
+}
+
+void Peer::ProcessSnapshotResponse() {
+  // Note: This method runs on the reactor thread.
+  {
+    std::lock_guard<simple_spinlock> lock(peer_lock_);
+    snapshot_in_flight_ = false;
+    if (closed_) {
+      return;
+    }
+
+    Status s = snapshot_controller_.status();
+    if (s.ok() && snapshot_response_.has_error()) {
+      s = StatusFromPB(snapshot_response_.error().status());
+    }
+    if (s.ok() &&
+        snapshot_response_.responder_term() > snapshot_request_.caller_term()) {
+      s = Status::IllegalState(Substitute(
+          "peer is at term $0", snapshot_response_.responder_term()));
+    }
+    if (!s.ok()) {
+      // The install is resumed from 'snapshot_offset_' once the peer is
+      // heard from again.
+      failed_attempts_++;
+      MonoDelta backoff = RetryBackoff(failed_attempts_);
+      if (backoff.ToMilliseconds() < FLAGS_raft_heartbeat_interval_ms) {
+        heartbeater_->Expedite(backoff);
+      }
+      KLOG_EVERY_N_SECS(WARNING, 60)
+          << LogPrefixUnlocked() << "Couldn't send a chunk of snapshot "
+          << snapshot_request_.snapshot().id() << " to peer "
+          << peer_pb_.permanent_uuid() << ": " << s.ToString();
+      return;
+    }
+
+    if (snapshot_response_.installed()) {
+      queue_->SnapshotInstalledOnPeer(
+          peer_pb_.permanent_uuid(),
+          snapshot_request_.snapshot().last_included());
+      snapshot_request_.Clear();
+      snapshot_offset_ = 0;
+    } else {
+      snapshot_offset_ = snapshot_response_.next_offset();
+    }
+  }
+
+  // Send the next chunk, or the ops following the snapshot, right away.
+  WARN_NOT_OK(
+      SignalRequest(true),
+      LogPrefixUnlocked() + "Could not signal the next request");
 }
 
 void Peer::Close() {
@@ -639,6 +1040,7 @@ void Peer::Close() {
     if (closed_)
       return;
     closed_ = true;
+    queue_->AddInflightPeerRequests(-num_inflight_requests_);
   }
   KLOG_EVERY_N(INFO, 5) << LogPrefixUnlocked() << "Closing peer [EVERY 5]: "
                         << peer_pb_.permanent_uuid();
@@ -651,16 +1053,197 @@ Peer::~Peer() {
   if (heartbeater_) {
     heartbeater_->Stop();
   }
+}
 
+Peer::UpdateRequest::~UpdateRequest() {
   // We don't own the ops (the queue does).
 #if GOOGLE_PROTOBUF_VERSION >= 3017003
-  request_.mutable_ops()->UnsafeArenaExtractSubrange(
-      0, request_.ops_size(), nullptr);
+  request.mutable_ops()->UnsafeArenaExtractSubrange(
+      0, request.ops_size(), nullptr);
 #else
-  request_.mutable_ops()->ExtractSubrange(0, request_.ops_size(), nullptr);
+  request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
 #endif
 }
 
+bool Peer::PreparePayloadSidecars(UpdateRequest* req) {
+  const int64_t min_bytes = FLAGS_consensus_payload_sidecar_min_bytes;
+  if (min_bytes <= 0) {
+    return false;
+  }
+  ConsensusRequestPB& request = req->request;
+  if (!req->replicate_msg_refs) {
+    return false;
+  }
+  const vector<ReplicateRefPtr>& msg_refs = req->replicate_msg_refs->msgs();
+
+  // Pick the payloads to send as sidecars. The ops are normally the messages
+  // in 'msg_refs', in the same order.
+  vector<bool> use_sidecar(request.ops_size(), false);
+  int num_sidecars = 0;
+  for (int i = 0; i < request.ops_size() &&
+       num_sidecars < rpc::TransferLimits::kMaxSidecars;
+       i++) {
+    const ReplicateMsg& op = request.ops(i);
+    if (i < static_cast<int>(msg_refs.size()) && msg_refs[i]->get() == &op &&
+        static_cast<int64_t>(op.write_payload().payload().size()) >=
+            min_bytes) {
+      use_sidecar[i] = true;
+      num_sidecars++;
+    }
+  }
+  if (num_sidecars == 0) {
+    return false;
+  }
+
+  // Copy everything but the ops, which are shared with the LogCache and other
+  // peers and must not be touched.
+  ConsensusRequestPB& wire_request = req->wire_request;
+  google::protobuf::RepeatedPtrField<ReplicateMsg> ops;
+  ops.Swap(request.mutable_ops());
+  wire_request.CopyFrom(request);
+  ops.Swap(request.mutable_ops());
+
+  for (int i = 0; i < request.ops_size(); i++) {
+    const ReplicateMsg& op = request.ops(i);
+    int sidecar_idx;
+    if (use_sidecar[i] &&
+        req->controller
+            .AddOutboundSidecar(
+                std::unique_ptr<rpc::RpcSidecar>(
+                    new PayloadSidecar(req->replicate_msg_refs, i)),
+                &sidecar_idx)
+            .ok()) {
+      CopyReplicateWithoutPayload(op, sidecar_idx, wire_request.add_ops());
+    } else {
+      *wire_request.add_ops() = op;
+    }
+  }
+  req->controller.RequireServerFeature(CONSENSUS_PAYLOAD_SIDECARS);
+  return true;
+}
+
+void Peer::UpdateLightweightModeUnlocked() {
+  DCHECK(peer_lock_.is_locked());
+  bool is_voter = true;
+  const bool lightweight = FLAGS_consensus_lightweight_peers &&
+      queue_->IsLightweightPeer(peer_pb_.permanent_uuid(), &is_voter);
+  if (lightweight != lightweight_) {
+    LOG_WITH_PREFIX_UNLOCKED(INFO)
+        << (lightweight ? "Replicating" : "No longer replicating")
+        << " in the lightweight mode";
+  }
+  lightweight_ = lightweight;
+  relaxed_heartbeats_ = lightweight && !is_voter;
+}
+
+bool Peer::PrepareCompressedOps(UpdateRequest* req) {
+  ConsensusRequestPB& request = req->request;
+  if (request.ops_size() == 0 || !peer_supports_compressed_ops_) {
+    return false;
+  }
+  // Lightweight peers are in a remote region by definition.
+  CompressionType type;
+  if (lightweight_) {
+    type = CompressionCodecManager::GetCodecType(
+        FLAGS_consensus_lightweight_peer_codec);
+  } else {
+    type = CompressionCodecManager::GetCodecType(
+        FLAGS_consensus_compressed_ops_codec);
+    if (FLAGS_consensus_compressed_ops_remote_regions_only &&
+        !queue_->IsPeerInRemoteRegion(peer_pb_.permanent_uuid())) {
+      return false;
+    }
+  }
+  if (type == NO_COMPRESSION) {
+    return false;
+  }
+
+  shared_ptr<CompressionCodec> codec;
+  std::unique_ptr<faststring> compressed(new faststring());
+  int64_t uncompressed_size;
+  Stopwatch sw(Stopwatch::THIS_THREAD);
+  sw.start();
+  Status s = CompressionCodecManager::GetCodecForType(type, &codec);
+  if (s.ok()) {
+    s = CompressOps(
+        request.ops(), codec.get(), compressed.get(), &uncompressed_size);
+  }
+  sw.stop();
+  if (PREDICT_FALSE(!s.ok())) {
+    KLOG_EVERY_N_SECS(WARNING, 60)
+        << LogPrefixUnlocked() << "Unable to compress ops: " << s.ToString();
+    return false;
+  }
+  if (static_cast<int64_t>(compressed->size()) >= uncompressed_size) {
+    return false;
+  }
+  const int64_t compressed_size = compressed->size();
+  int sidecar_idx;
+  if (!req->controller
+           .AddOutboundSidecar(
+               rpc::RpcSidecar::FromFaststring(std::move(compressed)),
+               &sidecar_idx)
+           .ok()) {
+    return false;
+  }
+
+  // Copy everything but the ops, see PreparePayloadSidecars().
+  ConsensusRequestPB& wire_request = req->wire_request;
+  google::protobuf::RepeatedPtrField<ReplicateMsg> ops;
+  ops.Swap(request.mutable_ops());
+  wire_request.CopyFrom(request);
+  ops.Swap(request.mutable_ops());
+  wire_request.set_compressed_ops_codec(type);
+  wire_request.set_compressed_ops_uncompressed_size(uncompressed_size);
+  wire_request.set_compressed_ops_sidecar_idx(sidecar_idx);
+  req->controller.RequireServerFeature(CONSENSUS_COMPRESSED_OPS);
+
+  const CpuTimes& elapsed = sw.elapsed();
+  compressed_ops_batches_++;
+  compressed_ops_uncompressed_bytes_ += uncompressed_size;
+  compressed_ops_compressed_bytes_ += compressed_size;
+  compressed_ops_cpu_micros_ += (elapsed.user + elapsed.system) / 1000;
+  KLOG_EVERY_N_SECS(INFO, 300)
+      << LogPrefixUnlocked() << "Compressing ops with "
+      << CompressionType_Name(type) << ": ratio "
+      << compressed_ops_stats().Ratio() << " so far";
+  return true;
+}
+
+Peer::CompressedOpsStats Peer::compressed_ops_stats() const {
+  CompressedOpsStats stats;
+  stats.batches = compressed_ops_batches_;
+  stats.uncompressed_bytes = compressed_ops_uncompressed_bytes_;
+  stats.compressed_bytes = compressed_ops_compressed_bytes_;
+  stats.cpu_micros = compressed_ops_cpu_micros_;
+  return stats;
+}
+
+shared_ptr<Peer::UpdateRequest> Peer::AcquireRequestUnlocked() {
+  DCHECK(peer_lock_.is_locked());
+  shared_ptr<UpdateRequest> req;
+  if (free_requests_.empty()) {
+    req = std::make_shared<UpdateRequest>();
+  } else {
+    req = std::move(free_requests_.back());
+    free_requests_.pop_back();
+  }
+  num_inflight_requests_++;
+  queue_->AddInflightPeerRequests(1);
+  return req;
+}
+
+void Peer::ReleaseRequestUnlocked(shared_ptr<UpdateRequest> req) {
+  DCHECK(peer_lock_.is_locked());
+  DCHECK_GT(num_inflight_requests_.load(), 0);
+  num_inflight_requests_--;
+  // Close() already dropped our requests from the queue's count.
+  if (!closed_) {
+    queue_->AddInflightPeerRequests(-1);
+  }
+  free_requests_.emplace_back(std::move(req));
+}
+
 shared_ptr<PeerProxy> PeerProxyPool::Get(const string& uuid) const {
   shared_lock<rw_spinlock> l(lock_.get_lock());
   return FindWithDefault(peer_proxy_map_, uuid, std::shared_ptr<PeerProxy>());
@@ -680,7 +1263,7 @@ template <class RespType>
 void CheckAndEnforceResponseToken(
     const std::string& method_name,
     RespType* response,
-    boost::optional<std::string> rpc_token,
+    const boost::optional<std::string>& rpc_token,
     const scoped_refptr<Counter>& mismatch_counter) {
   if (!rpc_token && !response->has_raft_rpc_token()) {
     // Empty on both, nothing to enforce
@@ -720,13 +1303,51 @@ void CheckAndEnforceResponseToken(
   error->set_code(ServerErrorPB::RING_TOKEN_MISMATCH);
 }
 
+struct RpcPeerProxy::UpdateCall {
+  // Keeps the pool alive while the call is in flight.
+  shared_ptr<UpdateCallPool> pool;
+
+  rpc::ResponseCallback callback;
+  ConsensusResponsePB* response = nullptr;
+  rpc::RpcController* controller = nullptr;
+  boost::optional<std::string> request_token;
+};
+
+struct RpcPeerProxy::UpdateCallPool {
+  explicit UpdateCallPool(scoped_refptr<Counter> mismatch_counter)
+      : num_rpc_token_mismatches(std::move(mismatch_counter)) {}
+
+  const scoped_refptr<Counter> num_rpc_token_mismatches;
+
+  simple_spinlock lock;
+  vector<shared_ptr<UpdateCall>> free_calls;
+};
+
+void PeerProxy::InstallSnapshotAsync(
+    const InstallSnapshotRequestPB* /*request*/,
+    InstallSnapshotResponsePB* response,
+    rpc::RpcController* /*controller*/,
+    const rpc::ResponseCallback& callback) {
+  response->mutable_error()->set_code(ServerErrorPB::UNKNOWN_ERROR);
+  StatusToPB(
+      Status::NotSupported("InstallSnapshot is not implemented"),
+      response->mutable_error()->mutable_status());
+  callback();
+}
+
 RpcPeerProxy::RpcPeerProxy(
     gscoped_ptr<HostPort> hostport,
     shared_ptr<ConsensusServiceProxy> consensus_proxy,
-    scoped_refptr<Counter> num_rpc_token_mismatches)
+    scoped_refptr<Counter> num_rpc_token_mismatches,
+    shared_ptr<MultiRaftHeartbeatBatcher> heartbeat_batcher,
+    shared_ptr<ProxyFanoutBatcher> fanout_batcher)
     : hostport_(std::move(hostport)),
       consensus_proxy_(std::move(consensus_proxy)),
-      num_rpc_token_mismatches_(std::move(num_rpc_token_mismatches)) {
+      num_rpc_token_mismatches_(std::move(num_rpc_token_mismatches)),
+      update_call_pool_(
+          std::make_shared<UpdateCallPool>(num_rpc_token_mismatches_)),
+      heartbeat_batcher_(std::move(heartbeat_batcher)),
+      fanout_batcher_(std::move(fanout_batcher)) {
   DCHECK(hostport_ != NULL);
   DCHECK(consensus_proxy_ != NULL);
   DCHECK(num_rpc_token_mismatches_ != nullptr);
@@ -739,27 +1360,77 @@ void RpcPeerProxy::UpdateAsync(
     const rpc::ResponseCallback& callback) {
   controller->set_timeout(
       MonoDelta::FromMilliseconds(FLAGS_consensus_rpc_timeout_ms));
+  controller->set_bulk(request->ops_size() > 0);
 
-  boost::optional<std::string> rpc_token = request->has_raft_rpc_token()
-      ? request->raft_rpc_token()
-      : boost::optional<std::string>();
+  shared_ptr<UpdateCall> call;
+  {
+    std::lock_guard<simple_spinlock> l(update_call_pool_->lock);
+    if (!update_call_pool_->free_calls.empty()) {
+      call = std::move(update_call_pool_->free_calls.back());
+      update_call_pool_->free_calls.pop_back();
+    }
+  }
+  if (!call) {
+    call = std::make_shared<UpdateCall>();
+  }
+  call->pool = update_call_pool_;
+  call->callback = callback;
+  call->response = response;
+  call->controller = controller;
+  if (request->has_raft_rpc_token()) {
+    // Assigning to an engaged optional reuses the storage of the string.
+    call->request_token = request->raft_rpc_token();
+  } else {
+    call->request_token = boost::none;
+  }
+
+  // Heartbeats of many Raft groups to this server can share one RPC. Proxied
+  // requests are left alone, since they are not for the next hop itself.
+  if (heartbeat_batcher_ && FLAGS_consensus_batch_heartbeats &&
+      request->ops_size() == 0 && !request->has_proxy_dest_uuid() &&
+      heartbeat_batcher_->supported()) {
+    heartbeat_batcher_->AddRequest(
+        request, response, controller, [call]() { FinishUpdateCall(call); });
+    return;
+  }
+
+  // Proxy requests to the destinations behind this proxy can share one RPC,
+  // as long as their ops are looked up by the proxy rather than carried.
+  if (fanout_batcher_ && FLAGS_raft_proxy_fanout &&
+      request->has_proxy_dest_uuid() && !request->has_compressed_ops_codec() &&
+      fanout_batcher_->supported() && AllProxyOps(*request)) {
+    fanout_batcher_->AddRequest(
+        request, response, controller, [call]() { FinishUpdateCall(call); });
+    return;
+  }
+
+  // Capturing nothing but 'call' keeps the callback small enough to be
+  // stored without an allocation.
   consensus_proxy_->UpdateConsensusAsync(
-      *request,
-      response,
-      controller,
-      [callback,
-       response,
-       controller,
-       request_token = std::move(rpc_token),
-       mismatch_counter = num_rpc_token_mismatches_]() {
-        // Should not need to lock here since only one request can happen at any
-        // time
-        if (controller->status().ok()) {
-          CheckAndEnforceResponseToken(
-              "UpdateAsync", response, request_token, mismatch_counter);
-        }
-        callback();
-      });
+      *request, response, controller, [call]() { FinishUpdateCall(call); });
+}
+
+void RpcPeerProxy::FinishUpdateCall(const shared_ptr<UpdateCall>& call) {
+  // Should not need to lock here since only one request can happen at any
+  // time
+  shared_ptr<UpdateCallPool> pool = std::move(call->pool);
+  if (call->controller->status().ok()) {
+    CheckAndEnforceResponseToken(
+        "UpdateAsync",
+        call->response,
+        call->request_token,
+        pool->num_rpc_token_mismatches);
+  }
+
+  // Recycle the call before running the callback, which may well send the
+  // next request.
+  rpc::ResponseCallback callback;
+  callback.swap(call->callback);
+  {
+    std::lock_guard<simple_spinlock> l(pool->lock);
+    pool->free_calls.emplace_back(call);
+  }
+  callback();
 }
 
 Status RpcPeerProxy::StartElection(
@@ -771,6 +1442,39 @@ Status RpcPeerProxy::StartElection(
   return consensus_proxy_->RunLeaderElection(*request, response, controller);
 }
 
+Status RpcPeerProxy::ReadIndex(
+    const ReadIndexRequestPB* request,
+    ReadIndexResponsePB* response,
+    rpc::RpcController* controller) {
+  return consensus_proxy_->ReadIndex(*request, response, controller);
+}
+
+void RpcPeerProxy::CancelAsync(rpc::RpcController* controller) {
+  controller->Cancel();
+}
+
+void RpcPeerProxy::InstallSnapshotAsync(
+    const InstallSnapshotRequestPB* request,
+    InstallSnapshotResponsePB* response,
+    rpc::RpcController* controller,
+    const rpc::ResponseCallback& callback) {
+  controller->set_timeout(
+      MonoDelta::FromMilliseconds(FLAGS_consensus_rpc_timeout_ms));
+  controller->set_bulk(true);
+  consensus_proxy_->InstallSnapshotAsync(
+      *request, response, controller, callback);
+}
+
+void RpcPeerProxy::PingAsync(
+    GetNodeInstanceResponsePB* response,
+    rpc::RpcController* controller,
+    const rpc::ResponseCallback& callback) {
+  // The proxy serializes the request right away, so it need not outlive us.
+  GetNodeInstanceRequestPB request;
+  consensus_proxy_->GetNodeInstanceAsync(
+      request, response, controller, callback);
+}
+
 void RpcPeerProxy::RequestConsensusVoteAsync(
     const VoteRequestPB* request,
     VoteResponsePB* response,
@@ -838,10 +1542,12 @@ Status CreateConsensusServiceProxyForHost(
 
 RpcPeerProxyFactory::RpcPeerProxyFactory(
     shared_ptr<Messenger> messenger,
-    const scoped_refptr<MetricEntity>& metric_entity)
+    const scoped_refptr<MetricEntity>& metric_entity,
+    shared_ptr<MultiRaftManager> multi_raft_manager)
     : messenger_(std::move(messenger)),
       num_rpc_token_mismatches_(metric_entity->FindOrCreateCounter(
-          &METRIC_raft_rpc_token_num_response_mismatches)) {}
+          &METRIC_raft_rpc_token_num_response_mismatches)),
+      multi_raft_manager_(std::move(multi_raft_manager)) {}
 
 Status RpcPeerProxyFactory::NewProxy(
     const RaftPeerPB& peer_pb,
@@ -851,8 +1557,23 @@ Status RpcPeerProxyFactory::NewProxy(
   shared_ptr<ConsensusServiceProxy> new_proxy;
   RETURN_NOT_OK(
       CreateConsensusServiceProxyForHost(messenger_, *hostport, &new_proxy));
+  if (FLAGS_consensus_peer_rpc_streams > 1) {
+    new_proxy->set_num_streams(
+        FLAGS_consensus_peer_rpc_streams, rpc::StreamPolicy::SEPARATE_BULK);
+  }
+  shared_ptr<MultiRaftHeartbeatBatcher> heartbeat_batcher;
+  if (multi_raft_manager_ && peer_pb.has_permanent_uuid()) {
+    heartbeat_batcher =
+        multi_raft_manager_->GetBatcher(peer_pb.permanent_uuid(), new_proxy);
+  }
+  auto fanout_batcher =
+      std::make_shared<ProxyFanoutBatcher>(messenger_, new_proxy);
   proxy->reset(new RpcPeerProxy(
-      std::move(hostport), std::move(new_proxy), num_rpc_token_mismatches_));
+      std::move(hostport),
+      std::move(new_proxy),
+      num_rpc_token_mismatches_,
+      std::move(heartbeat_batcher),
+      std::move(fanout_batcher)));
   return Status::OK();
 }
 
@@ -921,5 +1642,250 @@ Status SetPermanentUuidForRemotePeer(
   return Status::OK();
 }
 
+Status RestorePayloadSidecars(
+    const rpc::RpcContext& context,
+    ConsensusRequestPB* request) {
+  return RestorePayloadSidecars(
+      [&context](int idx, Slice* sidecar) {
+        return context.GetInboundSidecar(idx, sidecar);
+      },
+      request);
+}
+
+Status RestorePayloadSidecars(
+    const std::function<Status(int, Slice*)>& get_sidecar,
+    ConsensusRequestPB* request) {
+  for (int i = 0; i < request->ops_size(); i++) {
+    ReplicateMsg* op = request->mutable_ops(i);
+    if (!op->has_write_payload() ||
+        !op->write_payload().has_payload_sidecar_idx()) {
+      continue;
+    }
+    WritePayloadPB* payload = op->mutable_write_payload();
+    Slice sidecar;
+    RETURN_NOT_OK_PREPEND(
+        get_sidecar(payload->payload_sidecar_idx(), &sidecar),
+        Substitute("missing payload of op $0", OpIdToString(op->id())));
+    payload->set_payload(sidecar.data(), sidecar.size());
+    payload->clear_payload_sidecar_idx();
+  }
+  return Status::OK();
+}
+
+Status CompressOps(
+    const google::protobuf::RepeatedPtrField<ReplicateMsg>& ops,
+    CompressionCodec* codec,
+    faststring* compressed,
+    int64_t* uncompressed_size) {
+  string serialized;
+  {
+    google::protobuf::io::StringOutputStream stream(&serialized);
+    google::protobuf::io::CodedOutputStream out(&stream);
+    for (const ReplicateMsg& op : ops) {
+      // WriteMessage() writes the size cached by the last ByteSizeLong().
+      op.ByteSizeLong();
+      WireFormatLite::WriteMessage(OpsBatchPB::kOpsFieldNumber, op, &out);
+    }
+    if (PREDICT_FALSE(out.HadError())) {
+      return Status::IOError("unable to serialize ops");
+    }
+  }
+  compressed->resize(codec->MaxCompressedLength(serialized.size()));
+  size_t compressed_length;
+  RETURN_NOT_OK(codec->CompressWithStats(
+      Slice(serialized), compressed->data(), &compressed_length));
+  compressed->resize(compressed_length);
+  *uncompressed_size = serialized.size();
+  return Status::OK();
+}
+
+namespace {
+
+// Parses the id of the serialized op in 'data' into 'id', without parsing the
+// rest of the op.
+bool PeekOpId(const uint8_t* data, int size, OpId* id) {
+  google::protobuf::io::CodedInputStream in(data, size);
+  uint32_t tag;
+  while ((tag = in.ReadTag()) != 0) {
+    if (WireFormatLite::GetTagFieldNumber(tag) ==
+            ReplicateMsg::kIdFieldNumber &&
+        WireFormatLite::GetTagWireType(tag) ==
+            WireFormatLite::WIRETYPE_LENGTH_DELIMITED) {
+      uint32_t length;
+      if (!in.ReadVarint32(&length) ||
+          length > static_cast<uint32_t>(size - in.CurrentPosition())) {
+        return false;
+      }
+      return id->ParseFromArray(data + in.CurrentPosition(), length);
+    }
+    if (!WireFormatLite::SkipField(&in, tag)) {
+      return false;
+    }
+  }
+  return false;
+}
+
+} // anonymous namespace
+
+Status UncompressOps(
+    CompressionType codec_type,
+    const Slice& compressed,
+    int64_t uncompressed_size,
+    ConsensusRequestPB* request,
+    scoped_refptr<RefCountedArena>* arena,
+    int64_t skip_through_index) {
+  if (PREDICT_FALSE(
+          uncompressed_size < 0 ||
+          uncompressed_size > std::numeric_limits<int32_t>::max())) {
+    return Status::Corruption(
+        Substitute("invalid size of the compressed ops: $0",
+                   uncompressed_size));
+  }
+  shared_ptr<CompressionCodec> codec;
+  RETURN_NOT_OK(CompressionCodecManager::GetCodecForType(codec_type, &codec));
+  if (PREDICT_FALSE(!codec)) {
+    return Status::InvalidArgument(
+        "ops are not compressed", CompressionType_Name(codec_type));
+  }
+  faststring uncompressed;
+  uncompressed.resize(uncompressed_size);
+  RETURN_NOT_OK_PREPEND(
+      codec->UncompressWithStats(
+          compressed, uncompressed.data(), uncompressed_size),
+      "unable to uncompress ops");
+
+  scoped_refptr<RefCountedArena> ops_arena;
+  OpsBatchPB local_batch;
+  OpsBatchPB* batch = &local_batch;
+  if (arena) {
+    // The parsed ops take about as much memory as their serialized form, plus
+    // the overhead of the message objects.
+    ops_arena = new RefCountedArena(
+        uncompressed_size + uncompressed_size / 2,
+        FLAGS_consensus_ops_arena_use_slab_allocator);
+    batch =
+        google::protobuf::Arena::CreateMessage<OpsBatchPB>(ops_arena->get());
+  }
+
+  // Walk the batch one op at a time, so that the leading ops the caller
+  // already has are dropped without being parsed. After a leader change, a
+  // follower may be sent a lot of those again.
+  google::protobuf::io::CodedInputStream in(
+      uncompressed.data(), uncompressed_size);
+#if GOOGLE_PROTOBUF_VERSION >= 3011000
+  in.SetTotalBytesLimit(uncompressed_size);
+#else
+  in.SetTotalBytesLimit(uncompressed_size, -1);
+#endif
+  OpId last_skipped_id;
+  int num_skipped = 0;
+  bool skipping = skip_through_index >= 0;
+  uint32_t tag;
+  while ((tag = in.ReadTag()) != 0) {
+    if (PREDICT_FALSE(
+            WireFormatLite::GetTagFieldNumber(tag) !=
+                OpsBatchPB::kOpsFieldNumber ||
+            WireFormatLite::GetTagWireType(tag) !=
+                WireFormatLite::WIRETYPE_LENGTH_DELIMITED)) {
+      if (!WireFormatLite::SkipField(&in, tag)) {
+        return Status::Corruption("unable to parse the uncompressed ops");
+      }
+      continue;
+    }
+    uint32_t length;
+    if (PREDICT_FALSE(
+            !in.ReadVarint32(&length) ||
+            length > uncompressed_size - in.CurrentPosition())) {
+      return Status::Corruption("unable to parse the uncompressed ops");
+    }
+    const uint8_t* op_data = uncompressed.data() + in.CurrentPosition();
+    in.Skip(length);
+    if (skipping) {
+      OpId id;
+      if (PREDICT_FALSE(!PeekOpId(op_data, length, &id))) {
+        return Status::Corruption("unable to parse the id of an op");
+      }
+      if (id.index() <= skip_through_index) {
+        last_skipped_id = id;
+        num_skipped++;
+        continue;
+      }
+      skipping = false;
+    }
+    if (PREDICT_FALSE(!batch->add_ops()->ParseFromArray(op_data, length))) {
+      return Status::Corruption("unable to parse the uncompressed ops");
+    }
+  }
+  if (PREDICT_FALSE(!in.ConsumedEntireMessage())) {
+    return Status::Corruption("unable to parse the uncompressed ops");
+  }
+  if (num_skipped > 0) {
+    // Like RaftConsensus::Update() does when it drops duplicate ops, start the
+    // request from the last op dropped.
+    VLOG(2) << "Skipped " << num_skipped << " ops through "
+            << OpIdToString(last_skipped_id) << " without parsing them";
+    *request->mutable_preceding_id() = last_skipped_id;
+  }
+
+  if (ops_arena) {
+    request->mutable_ops()->Clear();
+    request->mutable_ops()->Reserve(batch->ops_size());
+    for (ReplicateMsg& op : *batch->mutable_ops()) {
+      request->mutable_ops()->UnsafeArenaAddAllocated(&op);
+    }
+    *arena = std::move(ops_arena);
+    return Status::OK();
+  }
+  request->mutable_ops()->Swap(batch->mutable_ops());
+  return Status::OK();
+}
+
+Status RestoreCompressedOps(
+    const rpc::RpcContext& context,
+    ConsensusRequestPB* request,
+    scoped_refptr<RefCountedArena>* arena,
+    int64_t skip_through_index) {
+  if (!request->has_compressed_ops_codec()) {
+    return Status::OK();
+  }
+  Slice sidecar;
+  RETURN_NOT_OK_PREPEND(
+      context.GetInboundSidecar(request->compressed_ops_sidecar_idx(), &sidecar),
+      "missing compressed ops");
+  RETURN_NOT_OK(UncompressOps(
+      request->compressed_ops_codec(),
+      sidecar,
+      request->compressed_ops_uncompressed_size(),
+      request,
+      arena,
+      skip_through_index));
+  request->clear_compressed_ops_codec();
+  request->clear_compressed_ops_uncompressed_size();
+  request->clear_compressed_ops_sidecar_idx();
+  return Status::OK();
+}
+
+void SkipCommittedOps(int64_t committed_index, ConsensusRequestPB* request) {
+  int num_skipped = 0;
+  while (num_skipped < request->ops_size() &&
+         request->ops(num_skipped).id().index() <= committed_index) {
+    num_skipped++;
+  }
+  if (num_skipped == 0) {
+    return;
+  }
+  *request->mutable_preceding_id() = request->ops(num_skipped - 1).id();
+  request->mutable_ops()->DeleteSubrange(0, num_skipped);
+}
+
+void ReleaseArenaOps(ConsensusRequestPB* request) {
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  request->mutable_ops()->UnsafeArenaExtractSubrange(
+      0, request->ops_size(), nullptr);
+#else
+  request->mutable_ops()->ExtractSubrange(0, request->ops_size(), nullptr);
+#endif
+}
+
 } // namespace consensus
 } // namespace kudu
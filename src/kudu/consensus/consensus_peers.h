@@ -26,7 +26,9 @@
 
 #include <atomic>
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
 #include <vector>
@@ -41,21 +43,29 @@
 #include "kudu/rpc/rpc_controller.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/net/net_util.h"
 #include "kudu/util/status.h"
 
 namespace kudu {
+class CompressionCodec;
+class Slice;
 class ThreadPoolToken;
+class faststring;
 
 namespace rpc {
 class Messenger;
 class PeriodicTimer;
+class RpcContext;
 } // namespace rpc
 
 namespace consensus {
+class MultiRaftHeartbeatBatcher;
+class MultiRaftManager;
 class PeerMessageQueue;
 class PeerProxy;
 class PeerProxyPool;
+class ProxyFanoutBatcher;
 
 // A remote peer in consensus.
 //
@@ -70,6 +80,11 @@ class PeerProxyPool;
 // Peers are also responsible for sending periodic heartbeats
 // to assert liveness of the leader. The peer constructs a heartbeater
 // thread to trigger these heartbeats.
+// With --raft_enable_quiescence, once the peer has acknowledged a heartbeat
+// saying that the whole group is caught up, heartbeats slow down to
+// --raft_quiesced_heartbeat_interval_ms (or stop) until there are ops to send.
+// With --consensus_lightweight_peers, learners and witnesses in other regions
+// get their ops compressed and, for the non-voters, fewer heartbeats.
 //
 // The actual request construction is delegated to a PeerMessageQueue
 // object, and performed on a thread pool (since it may do IO). When a
@@ -101,6 +116,30 @@ class Peer : public std::enable_shared_from_this<Peer> {
     return peer_pb_;
   }
 
+  // Returns the number of UpdateConsensus requests in flight to this peer.
+  int num_inflight_requests() const {
+    return num_inflight_requests_;
+  }
+
+  // What sending the ops to this peer compressed as a whole has saved and
+  // cost so far, see --consensus_compressed_ops_codec and
+  // --consensus_lightweight_peers.
+  struct CompressedOpsStats {
+    int64_t batches = 0;
+    int64_t uncompressed_bytes = 0;
+    int64_t compressed_bytes = 0;
+    // CPU time spent serializing and compressing the batches.
+    int64_t cpu_micros = 0;
+
+    // Uncompressed over compressed bytes, or 0 if nothing was compressed.
+    double Ratio() const {
+      return compressed_bytes == 0
+          ? 0
+          : static_cast<double>(uncompressed_bytes) / compressed_bytes;
+    }
+  };
+  CompressedOpsStats compressed_ops_stats() const;
+
   // Stop sending requests and periodic heartbeats.
   //
   // This does not block waiting on any current outstanding requests to finish.
@@ -142,18 +181,72 @@ class Peer : public std::enable_shared_from_this<Peer> {
       std::shared_ptr<PeerProxy> proxy,
       std::shared_ptr<rpc::Messenger> messenger);
 
+  // An UpdateConsensus request to the peer and its response. Up to
+  // --consensus_max_inflight_requests_per_peer of them may be in flight.
+  struct UpdateRequest {
+    ~UpdateRequest();
+
+    ConsensusRequestPB request;
+    ConsensusResponsePB response;
+    rpc::RpcController controller;
+
+    // What is actually sent when some of the ops' write payloads, or all the
+    // ops compressed, go as sidecars of 'controller': a copy of 'request'
+    // without them.
+    ConsensusRequestPB wire_request;
+
+    // When the request was sent, and how long its response took to come back.
+    MonoTime send_time;
+    MonoDelta round_trip;
+
+    // Reference-counted pointer to the batch of ReplicateMsgs which are
+    // in-flight to the peer. We may have loaded these messages from the
+    // LogCache, in which case we are potentially sharing the same objects, or
+    // the very same batch, as other peers. Since the PB request itself can't
+    // hold reference counts, this holds them.
+    ReplicateBatchRefPtr replicate_msg_refs;
+
+    // Keeps the peer alive while the request is in flight. Holding it here
+    // rather than in the response callback keeps the callback small enough
+    // to be stored without an allocation.
+    std::shared_ptr<Peer> in_flight_peer;
+  };
+
   void SendNextRequest(bool even_if_queue_empty, bool from_heartbeater = false);
 
+  // Moves the large write payloads of 'req' into sidecars of its controller
+  // and fills in 'req->wire_request'. Returns false if no payload is large
+  // enough, in which case 'req->request' should be sent as is.
+  static bool PreparePayloadSidecars(UpdateRequest* req);
+
+  // Moves the ops of 'req' compressed as a whole into a sidecar of its
+  // controller and fills in 'req->wire_request', if the peer supports it and
+  // --consensus_compressed_ops_codec says so. Returns false if the ops are
+  // not compressed, or do not get any smaller.
+  bool PrepareCompressedOps(UpdateRequest* req);
+
+  // Refreshes whether the peer is replicated to in the lightweight mode, see
+  // --consensus_lightweight_peers. Requires 'peer_lock_' to be held.
+  void UpdateLightweightModeUnlocked();
+
   // Signals that a response was received from the peer.
   //
   // This method is called from the reactor thread and calls
   // DoProcessResponse() on raft_pool_token_ to do any work that requires IO or
   // lock-taking.
-  void ProcessResponse();
+  void ProcessResponse(const std::shared_ptr<UpdateRequest>& req);
 
   // Run on 'raft_pool_token'. Does response handling that requires IO or may
   // block.
-  void DoProcessResponse();
+  void DoProcessResponse(const std::shared_ptr<UpdateRequest>& req);
+
+  // Returns a request which is not in flight, for reuse.
+  // Requires 'peer_lock_' to be held.
+  std::shared_ptr<UpdateRequest> AcquireRequestUnlocked();
+
+  // Puts 'req', which is no longer in flight, back for reuse.
+  // Requires 'peer_lock_' to be held.
+  void ReleaseRequestUnlocked(std::shared_ptr<UpdateRequest> req);
 
 #ifndef FB_DO_NOT_REMOVE
   // Fetch the desired tablet copy request from the queue and set up
@@ -167,15 +260,31 @@ class Peer : public std::enable_shared_from_this<Peer> {
   void ProcessTabletCopyResponse();
 #endif
 
-  // Signals there was an error sending the request to the peer.
-  void ProcessResponseError(const Status& status);
+  // Sends the peer, which is behind the leader's log, the next chunk of the
+  // latest snapshot, see SnapshotProvider. Only one chunk is in flight at a
+  // time. Requires 'peer_lock_' to be held by 'l', which is released.
+  // Returns false if the peer does not need a snapshot.
+  bool SendSnapshotChunk(std::unique_lock<simple_spinlock>* l);
+
+  // Handles the response to a chunk of the snapshot, and moves on to the
+  // next chunk, or to the ops following the snapshot.
+  void ProcessSnapshotResponse();
+
+  // Signals there was an error sending 'req' to the peer, and brings the
+  // next heartbeat forward by an exponential backoff so the peer is retried
+  // without waiting for a whole heartbeat period.
+  void ProcessResponseError(
+      const std::shared_ptr<UpdateRequest>& req,
+      const Status& status);
 
   // Has FLAGS_proxy_batch_duration_ms passed since the last request was sent?
   // Only relavant for proxied peers
   // We don't send requests to proxied peers until the batch duration has passed
   bool ProxyBatchDurationHasPassed();
 
-  std::string LogPrefixUnlocked() const;
+  const std::string& LogPrefixUnlocked() const {
+    return log_prefix_;
+  }
 
   const std::string& tablet_id() const {
     return tablet_id_;
@@ -186,6 +295,9 @@ class Peer : public std::enable_shared_from_this<Peer> {
 
   RaftPeerPB peer_pb_;
 
+  // Formatted once, since none of what it shows changes.
+  const std::string log_prefix_;
+
   std::shared_ptr<PeerProxy> proxy_;
 
   PeerMessageQueue* queue_;
@@ -195,23 +307,29 @@ class Peer : public std::enable_shared_from_this<Peer> {
   // Time when the last request was sent
   MonoTime last_request_time_;
 
-  // The latest consensus update request and response.
-  ConsensusRequestPB request_;
-  ConsensusResponsePB response_;
+  // Requests which are not in flight, kept for reuse. Protected by
+  // 'peer_lock_'.
+  std::vector<std::shared_ptr<UpdateRequest>> free_requests_;
+
+  // The committed index sent with the latest request, or kMinimumOpIdIndex.
+  int64_t last_sent_committed_index_;
 
 #ifdef FB_DO_NOT_REMOVE
   // The latest tablet copy request and response.
   StartTabletCopyRequestPB tc_request_;
   StartTabletCopyResponsePB tc_response_;
+  rpc::RpcController controller_;
 #endif
 
-  // Reference-counted pointers to any ReplicateMsgs which are in-flight to the
-  // peer. We may have loaded these messages from the LogCache, in which case we
-  // are potentially sharing the same object as other peers. Since the PB
-  // request_ itself can't hold reference counts, this holds them.
-  std::vector<ReplicateRefPtr> replicate_msg_refs_;
-
-  rpc::RpcController controller_;
+  // The latest snapshot chunk sent, and its response. While a chunk is in
+  // flight, no other request is sent. 'snapshot_offset_' is where the next
+  // chunk starts, which the response may move, so that an install that
+  // was cut short is resumed. Protected by 'peer_lock_'.
+  InstallSnapshotRequestPB snapshot_request_;
+  InstallSnapshotResponsePB snapshot_response_;
+  rpc::RpcController snapshot_controller_;
+  int64_t snapshot_offset_ = 0;
+  bool snapshot_in_flight_ = false;
 
   std::shared_ptr<rpc::Messenger> messenger_;
 
@@ -225,13 +343,34 @@ class Peer : public std::enable_shared_from_this<Peer> {
 
   // lock that protects Peer state changes, initialization, etc.
   mutable simple_spinlock peer_lock_;
-  std::atomic<bool> request_pending_;
+  // Written with 'peer_lock_' held, may be read without.
+  std::atomic<int> num_inflight_requests_;
   bool closed_ = false;
   bool has_sent_first_request_ = false;
+  // Whether the latest request sent was a quiesced heartbeat, and whether
+  // heartbeats are quiesced, i.e. sent at --raft_quiesced_heartbeat_interval_ms
+  // or not at all. Protected by 'peer_lock_'.
+  bool quiesce_pending_ = false;
+  bool quiesced_ = false;
   // Cached state of whether this peer is proxied thru another peer. This info
   // can be stale, consult the PeerMessageQueue to get the upto date info
   // -1 means we've not inited the variable, 0 means false, 1 means true
   std::atomic<int> cached_is_peer_proxied_{-1};
+
+  // Whether the peer said it accepts compressed ops in a response.
+  std::atomic<bool> peer_supports_compressed_ops_{false};
+
+  // Whether the peer is replicated to in the lightweight mode, and whether
+  // its heartbeats are relaxed for it being a non-voter. Written with
+  // 'peer_lock_' held, may be read without.
+  std::atomic<bool> lightweight_{false};
+  std::atomic<bool> relaxed_heartbeats_{false};
+
+  // Backs compressed_ops_stats().
+  std::atomic<int64_t> compressed_ops_batches_{0};
+  std::atomic<int64_t> compressed_ops_uncompressed_bytes_{0};
+  std::atomic<int64_t> compressed_ops_compressed_bytes_{0};
+  std::atomic<int64_t> compressed_ops_cpu_micros_{0};
 };
 
 // A proxy to another peer. Usually a thin wrapper around an rpc proxy but can
@@ -259,6 +398,43 @@ class PeerProxy {
       RunLeaderElectionResponsePB* response,
       rpc::RpcController* controller) = 0;
 
+  // Synchronously asks a remote leader for its read index. The caller sets
+  // the timeout of 'controller'.
+  virtual Status ReadIndex(
+      const ReadIndexRequestPB* /*request*/,
+      ReadIndexResponsePB* /*response*/,
+      rpc::RpcController* /*controller*/) {
+    return Status::NotSupported("ReadIndex is not implemented");
+  }
+
+  // Sends a trivial call to the remote peer, so that a negotiated connection
+  // to it exists before the peer is needed. The callback runs when the call
+  // completes.
+  virtual void PingAsync(
+      GetNodeInstanceResponsePB* /*response*/,
+      rpc::RpcController* /*controller*/,
+      const rpc::ResponseCallback& callback) {
+    callback();
+  }
+
+  // Best-effort cancellation of an outstanding asynchronous call made with
+  // 'controller'. The call's callback still runs, possibly with an Aborted
+  // status.
+  virtual void CancelAsync(rpc::RpcController* /*controller*/) {}
+
+  // Whether UpdateAsync() can send write payloads as RPC sidecars.
+  virtual bool SupportsPayloadSidecars() const {
+    return false;
+  }
+
+  // Sends a chunk of a snapshot to a peer which is behind the leader's log.
+  // Unless overridden, responds with a NotSupported error.
+  virtual void InstallSnapshotAsync(
+      const InstallSnapshotRequestPB* request,
+      InstallSnapshotResponsePB* response,
+      rpc::RpcController* controller,
+      const rpc::ResponseCallback& callback);
+
 #ifdef FB_DO_NOT_REMOVE
   // Instructs a peer to begin a tablet copy session.
   virtual void StartTabletCopyAsync(
@@ -310,10 +486,15 @@ class PeerProxyPool {
 // PeerProxy implementation that does RPC calls
 class RpcPeerProxy : public PeerProxy {
  public:
+  // Heartbeats go through 'heartbeat_batcher', if there is one and
+  // --consensus_batch_heartbeats is set. Likewise, proxy requests go through
+  // 'fanout_batcher' with --raft_proxy_fanout.
   RpcPeerProxy(
       gscoped_ptr<HostPort> hostport,
       std::shared_ptr<ConsensusServiceProxy> consensus_proxy,
-      scoped_refptr<Counter> num_rpc_token_mismatches);
+      scoped_refptr<Counter> num_rpc_token_mismatches,
+      std::shared_ptr<MultiRaftHeartbeatBatcher> heartbeat_batcher = nullptr,
+      std::shared_ptr<ProxyFanoutBatcher> fanout_batcher = nullptr);
 
   void UpdateAsync(
       const ConsensusRequestPB* request,
@@ -332,6 +513,28 @@ class RpcPeerProxy : public PeerProxy {
       RunLeaderElectionResponsePB* response,
       rpc::RpcController* controller) override;
 
+  Status ReadIndex(
+      const ReadIndexRequestPB* request,
+      ReadIndexResponsePB* response,
+      rpc::RpcController* controller) override;
+
+  void PingAsync(
+      GetNodeInstanceResponsePB* response,
+      rpc::RpcController* controller,
+      const rpc::ResponseCallback& callback) override;
+
+  void CancelAsync(rpc::RpcController* controller) override;
+
+  bool SupportsPayloadSidecars() const override {
+    return true;
+  }
+
+  void InstallSnapshotAsync(
+      const InstallSnapshotRequestPB* request,
+      InstallSnapshotResponsePB* response,
+      rpc::RpcController* controller,
+      const rpc::ResponseCallback& callback) override;
+
 #ifdef FB_DO_NOT_REMOVE
   void StartTabletCopyAsync(
       const StartTabletCopyRequestPB* request,
@@ -343,18 +546,36 @@ class RpcPeerProxy : public PeerProxy {
   std::string PeerName() const override;
 
  private:
+  // What the response callback of an UpdateAsync() call needs. These are
+  // recycled through a pool, so that heartbeating doesn't allocate them.
+  struct UpdateCall;
+  struct UpdateCallPool;
+
+  // Checks the response token of 'call', puts 'call' back into its pool and
+  // runs the callback of the caller.
+  static void FinishUpdateCall(const std::shared_ptr<UpdateCall>& call);
+
   gscoped_ptr<HostPort> hostport_;
   std::shared_ptr<ConsensusServiceProxy> consensus_proxy_;
 
   scoped_refptr<Counter> num_rpc_token_mismatches_;
+
+  // Shared with the calls in flight, which may outlive this proxy.
+  std::shared_ptr<UpdateCallPool> update_call_pool_;
+
+  const std::shared_ptr<MultiRaftHeartbeatBatcher> heartbeat_batcher_;
+  const std::shared_ptr<ProxyFanoutBatcher> fanout_batcher_;
 };
 
 // PeerProxyFactory implementation that generates RPCPeerProxies
 class RpcPeerProxyFactory : public PeerProxyFactory {
  public:
+  // The proxies batch their heartbeats through 'multi_raft_manager', if it
+  // is set. Factories of all Raft groups in a process should share it.
   explicit RpcPeerProxyFactory(
       std::shared_ptr<rpc::Messenger> messenger,
-      const scoped_refptr<MetricEntity>& metric_entity);
+      const scoped_refptr<MetricEntity>& metric_entity,
+      std::shared_ptr<MultiRaftManager> multi_raft_manager = nullptr);
 
   Status NewProxy(const RaftPeerPB& peer_pb, std::shared_ptr<PeerProxy>* proxy)
       override;
@@ -369,6 +590,8 @@ class RpcPeerProxyFactory : public PeerProxyFactory {
   std::shared_ptr<rpc::Messenger> messenger_;
 
   scoped_refptr<Counter> num_rpc_token_mismatches_;
+
+  const std::shared_ptr<MultiRaftManager> multi_raft_manager_;
 };
 
 // Query the consensus service at last known host/port that is
@@ -378,6 +601,70 @@ Status SetPermanentUuidForRemotePeer(
     const std::shared_ptr<rpc::Messenger>& messenger,
     RaftPeerPB* remote_peer);
 
+// Copies 'src' into 'dst', except for its write payload which is replaced by
+// a reference to the sidecar with index 'sidecar_idx'.
+void CopyReplicateWithoutPayload(
+    const ReplicateMsg& src,
+    int sidecar_idx,
+    ReplicateMsg* dst);
+
+// Puts the write payloads which the leader sent as sidecars of 'context' back
+// into the ops of 'request'.
+Status RestorePayloadSidecars(
+    const rpc::RpcContext& context,
+    ConsensusRequestPB* request);
+
+// As above, with the sidecars looked up by index with 'get_sidecar'.
+Status RestorePayloadSidecars(
+    const std::function<Status(int, Slice*)>& get_sidecar,
+    ConsensusRequestPB* request);
+
+// Serializes 'ops' as an OpsBatchPB into 'compressed', compressed with
+// 'codec'. Sets 'uncompressed_size' to the size of the serialized batch.
+Status CompressOps(
+    const google::protobuf::RepeatedPtrField<ReplicateMsg>& ops,
+    CompressionCodec* codec,
+    faststring* compressed,
+    int64_t* uncompressed_size);
+
+// Replaces the ops of 'request' with the ones in 'compressed', which was
+// produced by CompressOps() with a codec of type 'codec_type'.
+//
+// If 'arena' is not null, the ops are parsed on a new arena returned there,
+// instead of being allocated one by one. 'request' then doesn't own them and
+// ReleaseArenaOps() must be called before it is destroyed.
+//
+// If 'skip_through_index' is not negative, the leading ops with an index up
+// to it are dropped without being parsed, and the preceding id of 'request'
+// becomes the id of the last of them.
+Status UncompressOps(
+    CompressionType codec_type,
+    const Slice& compressed,
+    int64_t uncompressed_size,
+    ConsensusRequestPB* request,
+    scoped_refptr<RefCountedArena>* arena = nullptr,
+    int64_t skip_through_index = -1);
+
+// Puts the ops which the leader sent compressed as a sidecar of 'context'
+// back into 'request'. Does nothing if they were not compressed. 'arena' and
+// 'skip_through_index' are as with UncompressOps(), and 'arena' is left null
+// if the ops were not compressed.
+Status RestoreCompressedOps(
+    const rpc::RpcContext& context,
+    ConsensusRequestPB* request,
+    scoped_refptr<RefCountedArena>* arena = nullptr,
+    int64_t skip_through_index = -1);
+
+// Drops the leading ops of 'request' with an index up to 'committed_index',
+// which a follower already has, and makes the id of the last of them the
+// preceding id of 'request'. Done before RestorePayloadSidecars(), this
+// avoids copying their payloads.
+void SkipCommittedOps(int64_t committed_index, ConsensusRequestPB* request);
+
+// Removes the remaining ops of 'request' which UncompressOps() parsed on an
+// arena, without freeing them.
+void ReleaseArenaOps(ConsensusRequestPB* request);
+
 } // namespace consensus
 } // namespace kudu
 
@@ -24,6 +24,7 @@
 #include <cstdint>
 #include <ostream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <gflags/gflags.h>
@@ -38,8 +39,8 @@
 #ifdef FB_DO_NOT_REMOVE
 #include "kudu/common/schema.h"
 #include "kudu/common/wire_protocol-test-util.h"
-#include "kudu/consensus/log-test-base.h"
 #endif
+#include "kudu/consensus/log-test-base.h"
 #include "kudu/common/wire_protocol.h"
 #include "kudu/consensus/consensus-test-util.h"
 #include "kudu/consensus/consensus.pb.h"
@@ -52,25 +53,38 @@
 #include "kudu/consensus/opid_util.h"
 #include "kudu/consensus/ref_counted_replicate.h"
 #include "kudu/consensus/routing.h"
+#include "kudu/consensus/snapshot_provider.h"
 #include "kudu/consensus/time_manager.h"
 #include "kudu/fs/fs_manager.h"
 #include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/async_util.h"
+#include "kudu/util/countdown_latch.h"
+#include "kudu/util/crc.h"
 #include "kudu/util/metrics.h"
 // METRIC_DEFINE_entity(tablet);
 #include "kudu/util/monotime.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/status.h"
+#include "kudu/util/stopwatch.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
 #include "kudu/util/threadpool.h"
 
+DECLARE_bool(consensus_adaptive_batch_sizing);
+DECLARE_int32(consensus_adaptive_batch_max_bytes);
+DECLARE_int32(consensus_adaptive_batch_min_bytes);
 DECLARE_int32(consensus_max_batch_size_bytes);
+DECLARE_bool(consensus_share_peer_batches);
+DECLARE_int64(consensus_health_summary_lagging_ops);
 DECLARE_int32(follower_unavailable_considered_failed_sec);
+DECLARE_bool(enable_flexi_raft);
+DECLARE_int64(raft_snapshot_chunk_bytes);
 
 using kudu::consensus::HealthReportPB;
+using strings::Substitute;
 using std::atomic;
 using std::deque;
 using std::shared_ptr;
@@ -115,6 +129,12 @@ class ConsensusQueueTest : public KuduTest {
 
     ASSERT_OK(DurableRoutingTable::Create(
         fs_manager_.get(), kTestTablet, {}, {}, &routing_table_));
+    routing_table_container_ = std::make_shared<RoutingTableContainer>(
+        ProxyPolicy::DURABLE_ROUTING_POLICY,
+        FakeRaftPeerPB(kLeaderUuid),
+        RaftConfigPB(),
+        routing_table_);
+    persistent_vars_manager_ = new PersistentVarsManager(fs_manager_.get());
     clock_.reset(new clock::HybridClock());
     ASSERT_OK(clock_->Init());
 
@@ -133,8 +153,9 @@ class ConsensusQueueTest : public KuduTest {
         metric_entity_,
         log_.get(),
         time_manager,
+        persistent_vars_manager_,
         FakeRaftPeerPB(kLeaderUuid),
-        routing_table_,
+        routing_table_container_,
         kTestTablet,
         raft_pool_->NewToken(ThreadPool::ExecutionMode::SERIAL),
         replicated_opid,
@@ -186,7 +207,6 @@ class ConsensusQueueTest : public KuduTest {
         request,
         &refs,
         &needs_tablet_copy,
-        &next_hop_uuid,
         &next_hop_uuid));
     ASSERT_FALSE(needs_tablet_copy);
     ASSERT_EQ(request->ops_size(), 0);
@@ -272,6 +292,50 @@ class ConsensusQueueTest : public KuduTest {
         response, last_received, last_received.index());
   }
 
+  // Returns a FlexiRaft config of 'num_regions' regions of
+  // 'voters_per_region' voters each, named region-<r> and peer-<i>, the
+  // leader being peer-0 in region-0. The commit rule requires a majority in
+  // every region.
+  RaftConfigPB BuildFlexiRaftConfig(int num_regions, int voters_per_region) {
+    RaftConfigPB config =
+        BuildRaftConfigPBForTests(num_regions * voters_per_region);
+    for (int i = 0; i < config.peers_size(); i++) {
+      config.mutable_peers(i)->mutable_attrs()->set_region(
+          Substitute("region-$0", i / voters_per_region));
+    }
+    CommitRulePB* commit_rule = config.mutable_commit_rule();
+    commit_rule->set_mode(QuorumMode::STATIC_CONJUNCTION);
+    for (int r = 0; r < num_regions; r++) {
+      const string region = Substitute("region-$0", r);
+      (*config.mutable_voter_distribution())[region] = voters_per_region;
+      CommitRulePredicatePB* predicate = commit_rule->add_rule_predicates();
+      predicate->add_regions(region);
+      predicate->set_regions_subset_size(1);
+    }
+    return config;
+  }
+
+  // Starts leading 'config', tracking its other peers.
+  void LeadFlexiRaftConfig(const RaftConfigPB& config) {
+    queue_->SetLeaderMode(kMinimumOpIdIndex, kMinimumTerm, config);
+    for (const RaftPeerPB& peer : config.peers()) {
+      if (peer.permanent_uuid() != kLeaderUuid) {
+        queue_->TrackPeer(peer);
+      }
+    }
+  }
+
+  // Has 'uuid' acknowledge the ops up to 'index', as appended by
+  // AppendReplicateMessagesToQueue().
+  void AckUpTo(const string& uuid, int64_t index) {
+    ConsensusResponsePB response;
+    response.set_responder_uuid(uuid);
+    response.set_responder_term(1);
+    SetLastReceivedAndLastCommitted(
+        &response, MakeOpId(index / 7, index), MinimumOpId().index());
+    queue_->ResponseFromPeer(uuid, response);
+  }
+
  protected:
 #ifdef FB_DO_NOT_REMOVE
   const Schema schema_;
@@ -283,6 +347,8 @@ class ConsensusQueueTest : public KuduTest {
   gscoped_ptr<ThreadPool> raft_pool_;
   unique_ptr<TimeManager> time_manager_;
   shared_ptr<DurableRoutingTable> routing_table_;
+  shared_ptr<RoutingTableContainer> routing_table_container_;
+  scoped_refptr<PersistentVarsManager> persistent_vars_manager_;
   gscoped_ptr<PeerMessageQueue> queue_;
   scoped_refptr<log::LogAnchorRegistry> registry_;
   scoped_refptr<clock::Clock> clock_;
@@ -407,7 +473,7 @@ TEST_F(ConsensusQueueTest, TestGetPagedMessages) {
     vector<ReplicateRefPtr> refs;
     bool needs_tablet_copy;
     std::string next_hop_uuid;
-    iASSERT_OK(queue_->RequestForPeer(
+    ASSERT_OK(queue_->RequestForPeer(
         kPeerUuid,
         /*read_ops=*/true,
         &request,
@@ -624,6 +690,57 @@ TEST_F(ConsensusQueueTest, TestQueueAdvancesCommittedIndex) {
   ASSERT_EQ(queue_->GetAllReplicatedIndex(), 5);
 }
 
+// Tests that the leader only counts the ops its peers synced towards the
+// commit quorum in DURABLE mode, and all those they received in QUORUM_MEMORY
+// mode.
+TEST_F(ConsensusQueueTest, TestDurabilityModes) {
+  queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
+  queue_->TrackPeer(MakePeer("peer-1", RaftPeerPB::VOTER));
+  queue_->TrackPeer(MakePeer("peer-2", RaftPeerPB::VOTER));
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 10);
+  WaitForLocalPeerToAckIndex(10);
+  ASSERT_EQ(10, queue_->GetLocalDurableIndex());
+
+  // 'peer-1' has all the ops, but only the first nine synced.
+  ConsensusResponsePB response;
+  response.set_responder_term(1);
+  response.set_responder_uuid("peer-1");
+  SetLastReceivedAndLastCommitted(&response, MakeOpId(1, 10), 0);
+  response.mutable_status()->set_last_durable_idx(9);
+  queue_->ResponseFromPeer(response.responder_uuid(), response);
+  ASSERT_EQ(9, queue_->GetMajorityReplicatedIndexForTests());
+  ASSERT_EQ(9, queue_->GetCommittedIndex());
+  ASSERT_EQ(0, queue_->metrics_.num_committed_not_durable_ops->value());
+
+  // A durable index past what the peer received doesn't count.
+  SetLastReceivedAndLastCommitted(&response, MakeOpId(1, 10), 9);
+  response.mutable_status()->set_last_durable_idx(12);
+  queue_->ResponseFromPeer(response.responder_uuid(), response);
+  ASSERT_EQ(10, queue_->GetCommittedIndex());
+  ASSERT_EQ(
+      10, queue_->GetTrackedPeerForTests("peer-1").last_durable_index);
+
+  // The peers' acks of ops they have yet to sync commit them.
+  queue_->SetDurabilityMode(DurabilityMode::QUORUM_MEMORY);
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 11, 10);
+  WaitForLocalPeerToAckIndex(20);
+  response.set_responder_uuid("peer-2");
+  SetLastReceivedAndLastCommitted(&response, MakeOpId(2, 20), 10);
+  response.mutable_status()->set_last_durable_idx(10);
+  queue_->ResponseFromPeer(response.responder_uuid(), response);
+  ASSERT_EQ(20, queue_->GetMajorityReplicatedIndexForTests());
+  ASSERT_EQ(20, queue_->GetCommittedIndex());
+  // The local peer synced them, but neither of the others has.
+  ASSERT_EQ(10, queue_->queue_state_.majority_durable_index);
+  ASSERT_EQ(10, queue_->metrics_.num_committed_not_durable_ops->value());
+
+  response.mutable_status()->set_last_durable_idx(20);
+  queue_->ResponseFromPeer(response.responder_uuid(), response);
+  ASSERT_EQ(20, queue_->queue_state_.majority_durable_index);
+  ASSERT_EQ(0, queue_->metrics_.num_committed_not_durable_ops->value());
+}
+
 // Ensure that the acks for a non-voter don't count toward the majority.
 TEST_F(ConsensusQueueTest, TestNonVoterAcksDontCountTowardMajority) {
   const auto kOtherVoterPeer = "peer-1";
@@ -768,7 +885,7 @@ TEST_F(ConsensusQueueTest, TestQueueLoadsOperationsForPeer) {
       0, request.ops().size(), nullptr);
 #else
   request.mutable_ops()->ExtractSubrange(0, request.ops().size(), nullptr);
-#end
+#endif
 }
 
 // This tests that the queue is able to handle operation overwriting, i.e. when
@@ -905,6 +1022,47 @@ TEST_F(ConsensusQueueTest, TestQueueHandlesOperationOverwriting) {
 // Test for a bug where we wouldn't move any watermark back, when overwriting
 // operations, which would cause a check failure on the write immediately
 // following the overwriting write.
+// Tests that a peer whose log diverged is resumed past the ops of the
+// conflicting term it reported that we have too, in a single round trip.
+TEST_F(ConsensusQueueTest, TestResumeFromConflictingTerm) {
+  queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
+  // Ops 1-6 are in term 0, 7-13 in term 1 and 14-20 in term 2.
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 20);
+  WaitForLocalPeerToAckIndex(20);
+  queue_->TrackPeer(MakePeer(kPeerUuid, RaftPeerPB::VOTER));
+
+  // The peer has more ops of term 1 than we do, and none of ours since.
+  ConsensusResponsePB response;
+  response.set_responder_uuid(kPeerUuid);
+  response.set_responder_term(2);
+  RefuseWithLogPropertyMismatch(&response, MakeOpId(1, 30), MinimumOpId());
+  response.mutable_status()->set_last_committed_idx(5);
+  response.mutable_status()->set_conflict_term(1);
+  response.mutable_status()->set_conflict_term_first_index(6);
+  ASSERT_TRUE(queue_->ResponseFromPeer(kPeerUuid, response));
+  ASSERT_EQ(14, queue_->GetTrackedPeerForTests(kPeerUuid).next_index);
+
+  // Had it diverged in term 0, it would resume after our ops of that term.
+  response.mutable_status()->set_conflict_term(0);
+  response.mutable_status()->set_conflict_term_first_index(1);
+  ASSERT_TRUE(queue_->ResponseFromPeer(kPeerUuid, response));
+  ASSERT_EQ(7, queue_->GetTrackedPeerForTests(kPeerUuid).next_index);
+  ASSERT_EQ(
+      2, queue_->GetTrackedPeerForTests(kPeerUuid).lmp_mismatch_round_trips);
+
+  // The round trips it took are recorded once the peer accepts a request.
+  response.mutable_status()->Clear();
+  SetLastReceivedAndLastCommitted(&response, MakeOpId(2, 20), 5);
+  queue_->ResponseFromPeer(kPeerUuid, response);
+  ASSERT_EQ(
+      0, queue_->GetTrackedPeerForTests(kPeerUuid).lmp_mismatch_round_trips);
+  const HdrHistogram* round_trips =
+      queue_->metrics_.lmp_mismatch_round_trips->histogram();
+  ASSERT_EQ(1, round_trips->TotalCount());
+  ASSERT_EQ(2, round_trips->MaxValue());
+}
+
 TEST_F(ConsensusQueueTest, TestQueueMovesWatermarksBackward) {
   queue_->SetNonLeaderMode(BuildRaftConfigPBForTests(3));
   // Append a bunch of messages and update as if they were also appeneded to the
@@ -1095,7 +1253,7 @@ TEST_F(
       /*read_ops=*/true,
       &request,
       &refs,
-      &needs_tablet_copyi,
+      &needs_tablet_copy,
       &next_hop_uuid));
   ASSERT_FALSE(needs_tablet_copy);
   ASSERT_EQ(request.ops_size(), 4);
@@ -1163,6 +1321,7 @@ TEST_F(ConsensusQueueTest, TestTriggerTabletCopyIfTabletNotFound) {
       &next_hop_uuid));
   ASSERT_TRUE(needs_tablet_copy);
 
+#ifdef FB_DO_NOT_REMOVE
   StartTabletCopyRequestPB tc_req;
   ASSERT_OK(queue_->GetTabletCopyRequestForPeer(kPeerUuid, &tc_req));
 
@@ -1174,6 +1333,7 @@ TEST_F(ConsensusQueueTest, TestTriggerTabletCopyIfTabletNotFound) {
       pb_util::SecureShortDebugString(
           FakeRaftPeerPB(kLeaderUuid).last_known_addr()),
       pb_util::SecureShortDebugString(tc_req.copy_peer_addr()));
+#endif
 }
 
 TEST_F(ConsensusQueueTest, TestFollowerCommittedIndexAndMetrics) {
@@ -1209,6 +1369,788 @@ TEST_F(ConsensusQueueTest, TestFollowerCommittedIndexAndMetrics) {
   ASSERT_EQ(5, queue_->metrics_.num_ops_behind_leader->value());
 }
 
+// Serves a single snapshot held in memory, for leaders only.
+class FakeSnapshotProvider : public SnapshotProvider {
+ public:
+  FakeSnapshotProvider(string id, const OpId& last_included, string data)
+      : data_(std::move(data)) {
+    snapshot_.set_id(std::move(id));
+    *snapshot_.mutable_last_included() = last_included;
+    snapshot_.set_size_bytes(data_.size());
+  }
+
+  Status GetLatestSnapshot(SnapshotInfoPB* snapshot) override {
+    *snapshot = snapshot_;
+    return Status::OK();
+  }
+
+  Status ReadSnapshotChunk(
+      const string& id,
+      int64_t offset,
+      int64_t max_bytes,
+      string* data) override {
+    if (id != snapshot_.id()) {
+      return Status::NotFound(id);
+    }
+    *data = data_.substr(offset, max_bytes);
+    return Status::OK();
+  }
+
+  Status BeginSnapshotInstall(
+      const SnapshotInfoPB& /*snapshot*/,
+      int64_t* /*next_offset*/) override {
+    return Status::NotSupported("");
+  }
+  Status WriteSnapshotChunk(
+      const string& /*id*/,
+      int64_t /*offset*/,
+      const Slice& /*data*/) override {
+    return Status::NotSupported("");
+  }
+  Status FinishSnapshotInstall(const SnapshotInfoPB& /*snapshot*/) override {
+    return Status::NotSupported("");
+  }
+
+ private:
+  SnapshotInfoPB snapshot_;
+  const string data_;
+};
+
+// Tests that a peer which needs ops the log no longer has is sent the latest
+// snapshot in chunks, and then the ops following it.
+TEST_F(ConsensusQueueTest, TestSendSnapshotToPeerBehindLog) {
+  FLAGS_raft_snapshot_chunk_bytes = 4;
+  const string kData = "0123456789";
+  // The log starts after op 100, as if all the ops through it were GCed.
+  const OpId kLastIncluded = MakeOpId(1, 100);
+  CloseAndReopenQueue(kLastIncluded, kLastIncluded);
+  FakeSnapshotProvider provider("snap-1", kLastIncluded, kData);
+  queue_->SetSnapshotProvider(&provider);
+  queue_->SetLeaderMode(100, 1, BuildRaftConfigPBForTests(3));
+
+  ConsensusRequestPB request;
+  ConsensusResponsePB response;
+  response.set_responder_uuid(kPeerUuid);
+  response.set_responder_term(1);
+  queue_->TrackPeer(MakePeer(kPeerUuid, RaftPeerPB::VOTER));
+  vector<ReplicateRefPtr> refs;
+  bool needs_tablet_copy;
+  string next_hop_uuid;
+  ASSERT_OK(queue_->RequestForPeer(
+      kPeerUuid,
+      /*read_ops=*/true,
+      &request,
+      &refs,
+      &needs_tablet_copy,
+      &next_hop_uuid));
+  ASSERT_FALSE(queue_->PeerNeedsSnapshot(kPeerUuid));
+
+  // The peer only has the ops through 5.
+  RefuseWithLogPropertyMismatch(&response, MakeOpId(1, 5), MakeOpId(1, 5));
+  queue_->ResponseFromPeer(kPeerUuid, response);
+  request.Clear();
+  Status s = queue_->RequestForPeer(
+      kPeerUuid,
+      /*read_ops=*/true,
+      &request,
+      &refs,
+      &needs_tablet_copy,
+      &next_hop_uuid);
+  ASSERT_TRUE(s.IsNotFound()) << s.ToString();
+  ASSERT_TRUE(queue_->PeerNeedsSnapshot(kPeerUuid));
+
+  // The snapshot comes in chunks of 4 bytes.
+  InstallSnapshotRequestPB snapshot_request;
+  string received;
+  int64_t offset = 0;
+  do {
+    ASSERT_OK(queue_->RequestSnapshotChunkForPeer(
+        kPeerUuid, offset, &snapshot_request));
+    ASSERT_EQ("snap-1", snapshot_request.snapshot().id());
+    ASSERT_EQ(offset, snapshot_request.offset());
+    ASSERT_EQ(1, snapshot_request.caller_term());
+    const string& data = snapshot_request.data();
+    ASSERT_EQ(
+        crc::Crc32c(data.data(), data.size()), snapshot_request.data_crc32());
+    received += data;
+    offset += data.size();
+  } while (!snapshot_request.done());
+  ASSERT_EQ(kData, received);
+  ASSERT_EQ(
+      kData.size(), queue_->metrics_.num_snapshot_bytes_sent->value());
+
+  // Should the latest snapshot change, the chunks start over.
+  snapshot_request.mutable_snapshot()->set_id("snap-0");
+  ASSERT_OK(
+      queue_->RequestSnapshotChunkForPeer(kPeerUuid, 8, &snapshot_request));
+  ASSERT_EQ(0, snapshot_request.offset());
+  ASSERT_EQ("0123", snapshot_request.data());
+
+  // Once the peer installed the snapshot it is sent the ops after it.
+  queue_->SnapshotInstalledOnPeer(kPeerUuid, kLastIncluded);
+  ASSERT_FALSE(queue_->PeerNeedsSnapshot(kPeerUuid));
+  ASSERT_TRUE(queue_->RequestSnapshotChunkForPeer(
+                        kPeerUuid, 0, &snapshot_request)
+                  .IsNotFound());
+  AppendReplicateMsg(1, 101, 10);
+  request.Clear();
+  ASSERT_OK(queue_->RequestForPeer(
+      kPeerUuid,
+      /*read_ops=*/true,
+      &request,
+      &refs,
+      &needs_tablet_copy,
+      &next_hop_uuid));
+  ASSERT_EQ(1, request.ops_size());
+  ASSERT_EQ(101, request.ops(0).id().index());
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  request.mutable_ops()->UnsafeArenaExtractSubrange(
+      0, request.ops().size(), nullptr);
+#else
+  request.mutable_ops()->ExtractSubrange(0, request.ops().size(), nullptr);
+#endif
+}
+
+// Tests that a follower goes on from the op through which a snapshot was
+// installed.
+TEST_F(ConsensusQueueTest, TestResetToSnapshot) {
+  queue_->SetNonLeaderMode(BuildRaftConfigPBForTests(3));
+  queue_->UpdateLastIndexAppendedToLeader(10);
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 10);
+  WaitForLocalPeerToAckIndex(10);
+
+  const OpId kLastIncluded = MakeOpId(2, 50);
+  ASSERT_OK(queue_->ResetToSnapshot(kLastIncluded));
+  ASSERT_TRUE(OpIdEquals(kLastIncluded, queue_->GetLastOpIdInLog()));
+  ASSERT_EQ(50, queue_->GetCommittedIndex());
+  ASSERT_FALSE(queue_->log_cache()->HasOpBeenWritten(51));
+
+  ASSERT_OK(AppendReplicateMsg(2, 51, 10));
+  ASSERT_TRUE(queue_->log_cache()->HasOpBeenWritten(51));
+  ASSERT_EQ(51, queue_->GetLastOpIdInLog().index());
+}
+
+// Tests that peers at the same position in the log share a single batch.
+TEST_F(ConsensusQueueTest, TestPeersShareBatches) {
+  queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 10);
+  WaitForLocalPeerToAckIndex(10);
+
+  const char* kPeers[] = {"peer-1", "peer-2"};
+  ConsensusRequestPB requests[2];
+  vector<ReplicateRefPtr> refs[2];
+  bool needs_tablet_copy;
+  string next_hop_uuid;
+  for (int i = 0; i < 2; i++) {
+    queue_->TrackPeer(MakePeer(kPeers[i], RaftPeerPB::VOTER));
+    // Negotiate both peers to the same position: op 5.
+    ASSERT_OK(queue_->RequestForPeer(
+        kPeers[i],
+        /*read_ops=*/true,
+        &requests[i],
+        &refs[i],
+        &needs_tablet_copy,
+        &next_hop_uuid));
+    ASSERT_EQ(0, requests[i].ops_size());
+    ConsensusResponsePB response;
+    response.set_responder_uuid(kPeers[i]);
+    RefuseWithLogPropertyMismatch(&response, MakeOpId(0, 5), MakeOpId(0, 5));
+    response.mutable_status()->set_last_committed_idx(5);
+    queue_->ResponseFromPeer(kPeers[i], response);
+  }
+
+  int64_t shared_before = queue_->metrics_.num_shared_peer_batches->value();
+  for (int i = 0; i < 2; i++) {
+    ASSERT_OK(queue_->RequestForPeer(
+        kPeers[i],
+        /*read_ops=*/true,
+        &requests[i],
+        &refs[i],
+        &needs_tablet_copy,
+        &next_hop_uuid));
+    ASSERT_EQ(5, requests[i].ops_size());
+  }
+  ASSERT_EQ(
+      shared_before + 1, queue_->metrics_.num_shared_peer_batches->value());
+  ASSERT_OPID_EQ(requests[0].preceding_id(), requests[1].preceding_id());
+  for (int j = 0; j < 5; j++) {
+    ASSERT_EQ(&requests[0].ops(j), &requests[1].ops(j));
+  }
+
+  // The messages still belong to the queue so we have to release them.
+  for (auto& request : requests) {
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+    request.mutable_ops()->UnsafeArenaExtractSubrange(
+        0, request.ops_size(), nullptr);
+#else
+    request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
+#endif
+  }
+}
+
+// Tests that a peer's batch size limit grows while it acknowledges full
+// batches in good time, and shrinks when requests to it fail.
+TEST_F(ConsensusQueueTest, TestAdaptiveBatchSizing) {
+  FLAGS_consensus_adaptive_batch_sizing = true;
+  FLAGS_consensus_adaptive_batch_min_bytes = 1024;
+  FLAGS_consensus_adaptive_batch_max_bytes = 1024 * 1024;
+  FLAGS_consensus_max_batch_size_bytes = 8 * 1024;
+
+  queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 100, 1024);
+  WaitForLocalPeerToAckIndex(100);
+
+  ConsensusRequestPB request;
+  ConsensusResponsePB response;
+  bool send_more_immediately;
+  ASSERT_NO_FATAL_FAILURE(UpdatePeerWatermarkToOp(
+      &request,
+      &response,
+      MakeOpId(0, 1),
+      MinimumOpId(),
+      &send_more_immediately));
+  ASSERT_TRUE(send_more_immediately);
+  ASSERT_EQ(
+      8 * 1024, queue_->GetTrackedPeerForTests(kPeerUuid).batch_size_limit);
+
+  // Send two full batches, acking each right away.
+  int batch_sizes[2];
+  for (int& batch_size : batch_sizes) {
+    vector<ReplicateRefPtr> refs;
+    bool needs_tablet_copy;
+    string next_hop_uuid;
+    ASSERT_OK(queue_->RequestForPeer(
+        kPeerUuid,
+        /*read_ops=*/true,
+        &request,
+        &refs,
+        &needs_tablet_copy,
+        &next_hop_uuid));
+    batch_size = request.ops_size();
+    ASSERT_GT(batch_size, 0);
+    response.set_responder_term(request.caller_term());
+    SetLastReceivedAndLastCommitted(
+        &response, request.ops(batch_size - 1).id(), 0);
+    queue_->ResponseFromPeer(kPeerUuid, response);
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+    request.mutable_ops()->UnsafeArenaExtractSubrange(
+        0, request.ops_size(), nullptr);
+#else
+    request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
+#endif
+  }
+  ASSERT_GT(batch_sizes[1], batch_sizes[0]);
+  ASSERT_EQ(2, queue_->metrics_.num_batch_size_increases->value());
+  ASSERT_EQ(
+      10 * 1024, queue_->GetTrackedPeerForTests(kPeerUuid).batch_size_limit);
+
+  // A failed RPC halves the limit.
+  queue_->UpdatePeerStatus(
+      kPeerUuid, PeerStatus::RPC_LAYER_ERROR, Status::TimedOut("timed out"));
+  ASSERT_EQ(1, queue_->metrics_.num_batch_size_decreases->value());
+  ASSERT_EQ(
+      5 * 1024, queue_->GetTrackedPeerForTests(kPeerUuid).batch_size_limit);
+}
+
+// Peers at the same point of the log are handed the very same batch of ops,
+// rather than references of their own to each op.
+TEST_F(ConsensusQueueTest, TestPeersShareBatch) {
+  FLAGS_consensus_share_peer_batches = true;
+  queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 100);
+  WaitForLocalPeerToAckIndex(100);
+
+  const vector<string> uuids = {"peer-1", "peer-2"};
+  vector<ReplicateBatchRefPtr> batches(uuids.size());
+  vector<ConsensusRequestPB> requests(uuids.size());
+  for (int i = 0; i < uuids.size(); i++) {
+    queue_->TrackPeer(MakePeer(uuids[i], RaftPeerPB::VOTER));
+    bool needs_tablet_copy;
+    string next_hop_uuid;
+    // The first exchange with a peer finds out where its log ends.
+    ASSERT_OK(queue_->RequestForPeer(
+        uuids[i],
+        /*read_ops=*/true,
+        &requests[i],
+        &batches[i],
+        &needs_tablet_copy,
+        &next_hop_uuid));
+    ASSERT_EQ(0, requests[i].ops_size());
+    ConsensusResponsePB response;
+    response.set_responder_uuid(uuids[i]);
+    response.set_responder_term(requests[i].caller_term());
+    SetLastReceivedAndLastCommitted(&response, MinimumOpId(), 0);
+    queue_->ResponseFromPeer(uuids[i], response);
+
+    ASSERT_OK(queue_->RequestForPeer(
+        uuids[i],
+        /*read_ops=*/true,
+        &requests[i],
+        &batches[i],
+        &needs_tablet_copy,
+        &next_hop_uuid));
+    ASSERT_GT(requests[i].ops_size(), 0);
+    ASSERT_EQ(requests[i].ops_size(), batches[i]->msgs().size());
+  }
+  ASSERT_EQ(batches[0].get(), batches[1].get());
+  ASSERT_EQ(&requests[0].ops(0), &requests[1].ops(0));
+  ASSERT_EQ(1, queue_->metrics_.num_shared_peer_batches->value());
+
+  for (auto& request : requests) {
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+    request.mutable_ops()->UnsafeArenaExtractSubrange(
+        0, request.ops_size(), nullptr);
+#else
+    request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
+#endif
+  }
+}
+
+// The latencies of the exchanges with a peer, those it reports included, and
+// the time of the ops to a majority are recorded.
+TEST_F(ConsensusQueueTest, TestReplicationLatencyBreakdown) {
+  queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 10);
+  WaitForLocalPeerToAckIndex(10);
+  // The local peer alone is no majority.
+  ASSERT_EQ(0, queue_->metrics_.op_time_to_majority->TotalCount());
+
+  ConsensusRequestPB request;
+  ConsensusResponsePB response;
+  bool send_more_immediately;
+  ASSERT_NO_FATAL_FAILURE(UpdatePeerWatermarkToOp(
+      &request,
+      &response,
+      MakeOpId(0, 0),
+      MinimumOpId(),
+      &send_more_immediately));
+
+  vector<ReplicateRefPtr> refs;
+  bool needs_tablet_copy;
+  string next_hop_uuid;
+  ASSERT_OK(queue_->RequestForPeer(
+      kPeerUuid,
+      /*read_ops=*/true,
+      &request,
+      &refs,
+      &needs_tablet_copy,
+      &next_hop_uuid));
+  ASSERT_EQ(10, request.ops_size());
+  response.set_responder_term(request.caller_term());
+  response.set_update_lock_wait_us(100);
+  response.set_log_append_us(2000);
+  SetLastReceivedAndLastCommitted(&response, request.ops(9).id(), 0);
+  queue_->ResponseFromPeer(
+      kPeerUuid, response, MonoDelta::FromMilliseconds(5));
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  request.mutable_ops()->UnsafeArenaExtractSubrange(
+      0, request.ops_size(), nullptr);
+#else
+  request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
+#endif
+
+  auto latencies = queue_->GetTrackedPeerForTests(kPeerUuid).latencies;
+  EXPECT_GE(latencies->request_build.TotalCount(), 2);
+  EXPECT_EQ(1, latencies->rpc_round_trip.TotalCount());
+  EXPECT_EQ(1, latencies->update_lock_wait.TotalCount());
+  EXPECT_EQ(2000, latencies->log_append.MaxValue());
+  EXPECT_EQ(1, queue_->metrics_.peer_rpc_round_trip_time->TotalCount());
+  EXPECT_EQ(10, queue_->metrics_.op_time_to_majority->TotalCount());
+}
+
+// The leader lease is held from when a majority accepted a request until
+// the lease duration later.
+TEST_F(ConsensusQueueTest, TestLeaderLease) {
+  const MonoDelta kLeaseDuration = MonoDelta::FromSeconds(10);
+  queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 1);
+  WaitForLocalPeerToAckIndex(1);
+  // The local peer alone is no majority.
+  ASSERT_FALSE(queue_->LeaderLeaseExpiry(kLeaseDuration).Initialized());
+
+  ConsensusRequestPB request;
+  ConsensusResponsePB response;
+  bool send_more_immediately;
+  ASSERT_NO_FATAL_FAILURE(UpdatePeerWatermarkToOp(
+      &request,
+      &response,
+      MakeOpId(0, 0),
+      MinimumOpId(),
+      &send_more_immediately));
+  // A rejected request grants nothing.
+  ASSERT_FALSE(queue_->LeaderLeaseExpiry(kLeaseDuration).Initialized());
+
+  vector<ReplicateRefPtr> refs;
+  bool needs_tablet_copy;
+  string next_hop_uuid;
+  ASSERT_OK(queue_->RequestForPeer(
+      kPeerUuid,
+      /*read_ops=*/true,
+      &request,
+      &refs,
+      &needs_tablet_copy,
+      &next_hop_uuid));
+  ASSERT_EQ(1, request.ops_size());
+  response.set_responder_term(request.caller_term());
+  SetLastReceivedAndLastCommitted(&response, request.ops(0).id(), 0);
+  const MonoTime send_time = MonoTime::Now();
+  queue_->ResponseFromPeer(kPeerUuid, response, MonoDelta(), send_time);
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  request.mutable_ops()->UnsafeArenaExtractSubrange(
+      0, request.ops_size(), nullptr);
+#else
+  request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
+#endif
+  ASSERT_EQ(
+      send_time + kLeaseDuration, queue_->LeaderLeaseExpiry(kLeaseDuration));
+
+  // The response to an earlier request doesn't shorten the lease.
+  queue_->ResponseFromPeer(
+      kPeerUuid,
+      response,
+      MonoDelta(),
+      send_time - MonoDelta::FromSeconds(1));
+  ASSERT_EQ(
+      send_time + kLeaseDuration, queue_->LeaderLeaseExpiry(kLeaseDuration));
+
+  // Once revoked, only later requests count.
+  queue_->RevokeLeaderLease(MonoDelta::FromSeconds(1));
+  ASSERT_FALSE(queue_->LeaderLeaseExpiry(kLeaseDuration).Initialized());
+
+  // There is no lease in a new term until it is earned again.
+  queue_->RevokeLeaderLease(MonoDelta());
+  queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm + 1, BuildRaftConfigPBForTests(3));
+  ASSERT_FALSE(queue_->LeaderLeaseExpiry(kLeaseDuration).Initialized());
+}
+
+// The health summary classifies the peers by how far behind the leader's
+// log they are, and only the leader reports on them.
+TEST_F(ConsensusQueueTest, TestFillHealthSummary) {
+  gflags::FlagSaver saver;
+  FLAGS_consensus_health_summary_lagging_ops = 3;
+  queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 10);
+  WaitForLocalPeerToAckIndex(10);
+
+  ConsensusRequestPB request;
+  ConsensusResponsePB response;
+  bool send_more_immediately;
+  ASSERT_NO_FATAL_FAILURE(UpdatePeerWatermarkToOp(
+      &request,
+      &response,
+      MakeOpId(0, 0),
+      MinimumOpId(),
+      &send_more_immediately));
+  vector<ReplicateRefPtr> refs;
+  bool needs_tablet_copy;
+  string next_hop_uuid;
+  ASSERT_OK(queue_->RequestForPeer(
+      kPeerUuid,
+      /*read_ops=*/true,
+      &request,
+      &refs,
+      &needs_tablet_copy,
+      &next_hop_uuid));
+  ASSERT_GE(request.ops_size(), 5);
+  response.set_responder_term(request.caller_term());
+  SetLastReceivedAndLastCommitted(&response, request.ops(4).id(), 0);
+  queue_->ResponseFromPeer(kPeerUuid, response);
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  request.mutable_ops()->UnsafeArenaExtractSubrange(
+      0, request.ops_size(), nullptr);
+#else
+  request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
+#endif
+
+  ConsensusHealthSummaryPB summary;
+  queue_->FillHealthSummary(&summary);
+  ASSERT_EQ(10, summary.last_index());
+  ASSERT_EQ(1, summary.peers_size());
+  ASSERT_EQ(kPeerUuid, summary.peers(0).permanent_uuid());
+  ASSERT_EQ(ConsensusHealthSummaryPB::LAGGING, summary.peers(0).lag_class());
+  ASSERT_EQ(5, summary.peers(0).lag_ops());
+
+  FLAGS_consensus_health_summary_lagging_ops = 5;
+  summary.Clear();
+  queue_->FillHealthSummary(&summary);
+  ASSERT_EQ(ConsensusHealthSummaryPB::CAUGHT_UP, summary.peers(0).lag_class());
+
+  FLAGS_follower_unavailable_considered_failed_sec = 0;
+  SleepFor(MonoDelta::FromMilliseconds(1));
+  summary.Clear();
+  queue_->FillHealthSummary(&summary);
+  ASSERT_EQ(
+      ConsensusHealthSummaryPB::UNREACHABLE, summary.peers(0).lag_class());
+
+  // A follower has no say on the health of the other peers.
+  queue_->SetNonLeaderMode(BuildRaftConfigPBForTests(3));
+  summary.Clear();
+  queue_->FillHealthSummary(&summary);
+  ASSERT_EQ(10, summary.last_index());
+  ASSERT_EQ(0, summary.peers_size());
+}
+
+// Leadership confirmations wait for a majority to accept a request sent
+// after they were asked for.
+TEST_F(ConsensusQueueTest, TestConfirmLeadership) {
+  queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 1);
+  WaitForLocalPeerToAckIndex(1);
+
+  ConsensusRequestPB request;
+  ConsensusResponsePB response;
+  bool send_more_immediately;
+  ASSERT_NO_FATAL_FAILURE(UpdatePeerWatermarkToOp(
+      &request,
+      &response,
+      MakeOpId(0, 0),
+      MinimumOpId(),
+      &send_more_immediately));
+  vector<ReplicateRefPtr> refs;
+  bool needs_tablet_copy;
+  string next_hop_uuid;
+  ASSERT_OK(queue_->RequestForPeer(
+      kPeerUuid,
+      /*read_ops=*/true,
+      &request,
+      &refs,
+      &needs_tablet_copy,
+      &next_hop_uuid));
+  response.set_responder_term(request.caller_term());
+  SetLastReceivedAndLastCommitted(&response, request.ops(0).id(), 0);
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  request.mutable_ops()->UnsafeArenaExtractSubrange(
+      0, request.ops_size(), nullptr);
+#else
+  request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
+#endif
+
+  const MonoTime since = MonoTime::Now();
+  vector<Status> results;
+  ASSERT_TRUE(queue_->ConfirmLeadershipAsync(
+      since, [&](const Status& s) { results.push_back(s); }));
+  // Both wait for the same request.
+  ASSERT_FALSE(queue_->ConfirmLeadershipAsync(
+      since, [&](const Status& s) { results.push_back(s); }));
+
+  // A request sent earlier confirms nothing.
+  queue_->ResponseFromPeer(
+      kPeerUuid, response, MonoDelta(), since - MonoDelta::FromMilliseconds(1));
+  ASSERT_TRUE(results.empty());
+
+  queue_->ResponseFromPeer(kPeerUuid, response, MonoDelta(), MonoTime::Now());
+  ASSERT_EQ(2, results.size());
+  ASSERT_OK(results[0]);
+  ASSERT_OK(results[1]);
+
+  // Those still waiting are aborted once the queue is no longer the leader's.
+  ASSERT_TRUE(queue_->ConfirmLeadershipAsync(
+      MonoTime::Now() + MonoDelta::FromSeconds(10),
+      [&](const Status& s) { results.push_back(s); }));
+  queue_->SetNonLeaderMode(BuildRaftConfigPBForTests(3));
+  ASSERT_EQ(3, results.size());
+  ASSERT_TRUE(results[2].IsAborted()) << results[2].ToString();
+}
+
+// Records the commit indexes it is notified of, holding up the first
+// notification until released.
+class BlockingCommitObserver : public PeerMessageQueueObserver {
+ public:
+  BlockingCommitObserver() : entered(1), release(1) {}
+
+  void NotifyCommitIndex(int64_t committed_index, bool /*need_lock*/) override {
+    if (indexes.empty()) {
+      entered.CountDown();
+      release.Wait();
+    }
+    indexes.push_back(committed_index);
+  }
+  void NotifyTermChange(int64_t /*term*/) override {}
+  void NotifyFailedFollower(
+      const string& /*peer_uuid*/,
+      int64_t /*term*/,
+      const string& /*reason*/) override {}
+  void NotifyPeerToPromote(const string& /*peer_uuid*/) override {}
+  void NotifyPeerToStartElection(
+      const string& /*peer_uuid*/,
+      boost::optional<PeerMessageQueue::TransferContext> /*transfer_context*/,
+      shared_ptr<Promise<RunLeaderElectionResponsePB>> /*promise*/,
+      std::optional<OpId> /*mock_election_snapshot_op_id*/) override {}
+  void NotifyPeerHealthChange() override {}
+
+  CountDownLatch entered;
+  CountDownLatch release;
+  vector<int64_t> indexes;
+};
+
+// The commit index changes made while the observers are being notified are
+// delivered at once, as the latest of them.
+TEST_F(ConsensusQueueTest, TestCoalescedCommitNotifications) {
+  BlockingCommitObserver observer;
+  queue_->RegisterObserver(&observer);
+  queue_->NotifyObserversOfCommitIndexChange(1);
+  observer.entered.Wait();
+  for (int64_t i = 2; i <= 4; i++) {
+    queue_->NotifyObserversOfCommitIndexChange(i);
+  }
+  observer.release.CountDown();
+  queue_->raft_pool_observers_token_->Wait();
+
+  EXPECT_EQ((vector<int64_t>{1, 4}), observer.indexes);
+  EXPECT_EQ(2, queue_->metrics_.num_coalesced_commit_notifications->value());
+  ASSERT_OK(queue_->UnRegisterObserver(&observer));
+}
+
+// The FlexiRaft majority replicated watermark follows the acknowledgements
+// of each region, and drops the peers whose last exchange failed.
+TEST_F(ConsensusQueueTest, TestFlexiRaftWatermarksByRegion) {
+  FLAGS_enable_flexi_raft = true;
+  LeadFlexiRaftConfig(BuildFlexiRaftConfig(3, 3));
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 10);
+  WaitForLocalPeerToAckIndex(10);
+
+  // region-0 has the leader and peer-1 at 10, region-1 two peers at 5 and 7,
+  // region-2 two peers at 8 and 9, so a majority of every region has 5.
+  AckUpTo("peer-1", 10);
+  AckUpTo("peer-3", 5);
+  AckUpTo("peer-4", 7);
+  AckUpTo("peer-6", 8);
+  ASSERT_EQ(0, queue_->GetMajorityReplicatedIndexForTests());
+  AckUpTo("peer-7", 9);
+  ASSERT_EQ(5, queue_->GetMajorityReplicatedIndexForTests());
+
+  // Without peer-3, region-1 has no majority until peer-5 acknowledges.
+  queue_->UpdatePeerStatus(
+      "peer-3", PeerStatus::RPC_LAYER_ERROR, Status::NetworkError("test"));
+  ASSERT_EQ(5, queue_->GetMajorityReplicatedIndexForTests());
+  AckUpTo("peer-5", 9);
+  ASSERT_EQ(7, queue_->GetMajorityReplicatedIndexForTests());
+
+  // Once back, peer-3 counts again.
+  AckUpTo("peer-3", 10);
+  ASSERT_EQ(8, queue_->GetMajorityReplicatedIndexForTests());
+}
+
+// Benchmark of advancing the FlexiRaft majority replicated watermark with
+// many peers: every peer acknowledges every op.
+TEST_F(ConsensusQueueTest, BenchmarkFlexiRaftWatermarks) {
+  FLAGS_enable_flexi_raft = true;
+  const int kNumRegions = 6;
+  const int kVotersPerRegion = 7;
+  const int num_ops = AllowSlowTests() ? 5000 : 500;
+  LeadFlexiRaftConfig(BuildFlexiRaftConfig(kNumRegions, kVotersPerRegion));
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, num_ops);
+  WaitForLocalPeerToAckIndex(num_ops);
+
+  const int num_peers = kNumRegions * kVotersPerRegion;
+  LOG_TIMING(
+      INFO,
+      Substitute(
+          "processing $0 responses from $1 peers",
+          num_ops * (num_peers - 1),
+          num_peers)) {
+    for (int index = 1; index <= num_ops; index++) {
+      for (int i = 1; i < num_peers; i++) {
+        AckUpTo(Substitute("peer-$0", i), index);
+      }
+    }
+  }
+  ASSERT_EQ(num_ops, queue_->GetMajorityReplicatedIndexForTests());
+}
+
+// Benchmark of the queue under contention: several peers build requests and
+// process their responses concurrently while the leader keeps appending ops.
+class ConsensusQueueContentionTest
+    : public ConsensusQueueTest,
+      public ::testing::WithParamInterface<int> {};
+
+INSTANTIATE_TEST_CASE_P(
+    NumPeers,
+    ConsensusQueueContentionTest,
+    ::testing::Values(5, 7, 9));
+
+TEST_P(ConsensusQueueContentionTest, TestRequestForPeerThroughput) {
+  const int num_peers = GetParam();
+  const int num_ops = AllowSlowTests() ? 100000 : 5000;
+  queue_->SetLeaderMode(
+      kMinimumOpIdIndex,
+      kMinimumTerm,
+      BuildRaftConfigPBForTests(num_peers + 1));
+  for (int i = 1; i <= num_peers; i++) {
+    queue_->TrackPeer(MakePeer(Substitute("peer-$0", i), RaftPeerPB::VOTER));
+  }
+
+  atomic<int64_t> num_requests(0);
+  vector<std::thread> threads;
+  MonoTime start = MonoTime::Now();
+  threads.emplace_back([&]() {
+    AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, num_ops, 128);
+  });
+  for (int i = 1; i <= num_peers; i++) {
+    threads.emplace_back([&, i]() {
+      const string uuid = Substitute("peer-$0", i);
+      ConsensusRequestPB request;
+      ConsensusResponsePB response;
+      response.set_responder_uuid(uuid);
+      int64_t last_received = 0;
+      while (last_received < num_ops) {
+        vector<ReplicateRefPtr> refs;
+        bool needs_tablet_copy;
+        string next_hop_uuid;
+        CHECK_OK(queue_->RequestForPeer(
+            uuid,
+            /*read_ops=*/true,
+            &request,
+            &refs,
+            &needs_tablet_copy,
+            &next_hop_uuid));
+        num_requests++;
+
+        // Act as a follower which accepts everything it's sent.
+        OpId last = request.ops_size() > 0
+            ? request.ops(request.ops_size() - 1).id()
+            : request.preceding_id();
+        last_received = last.index();
+        response.set_responder_term(request.caller_term());
+        SetLastReceivedAndLastCommitted(
+            &response, last, request.committed_index());
+        queue_->ResponseFromPeer(uuid, response);
+
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+        request.mutable_ops()->UnsafeArenaExtractSubrange(
+            0, request.ops_size(), nullptr);
+#else
+        request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
+#endif
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  MonoDelta elapsed = MonoTime::Now() - start;
+
+  WaitForLocalPeerToAckIndex(num_ops);
+  ASSERT_EVENTUALLY([&]() { ASSERT_EQ(num_ops, queue_->GetCommittedIndex()); });
+  LOG(INFO) << Substitute(
+      "Replicated $0 ops to $1 peers in $2 using $3 requests: "
+      "$4 ops/sec, $5 requests/sec",
+      num_ops,
+      num_peers,
+      elapsed.ToString(),
+      num_requests.load(),
+      num_ops / elapsed.ToSeconds(),
+      num_requests.load() / elapsed.ToSeconds());
+}
+
 // Unit test for the PeerMessageQueue::PeerHealthStatus() method.
 TEST(ConsensusQueueUnitTest, PeerHealthStatus) {
   static constexpr PeerStatus kPeerStatusesForUnknown[] = {
@@ -1221,8 +2163,11 @@ TEST(ConsensusQueueUnitTest, PeerHealthStatus) {
       PeerStatus::LMP_MISMATCH,
   };
 
-  RaftPeerPB peer_pb;
-  PeerMessageQueue::TrackedPeer peer(peer_pb);
+  // What TrackedPeer's constructor sets up, without a queue.
+  PeerMessageQueue::TrackedPeer peer;
+  peer.last_exchange_status = PeerStatus::NEW;
+  peer.last_communication_time = MonoTime::Now();
+  peer.wal_catchup_possible = true;
   EXPECT_EQ(HealthReportPB::UNKNOWN, PeerMessageQueue::PeerHealthStatus(peer));
   for (auto status : kPeerStatusesForUnknown) {
     peer.last_exchange_status = status;
@@ -1233,7 +2178,7 @@ TEST(ConsensusQueueUnitTest, PeerHealthStatus) {
   peer.last_exchange_status = PeerStatus::TABLET_FAILED;
   EXPECT_EQ(
       HealthReportPB::FAILED_UNRECOVERABLE,
-      PeerMessageQueue::PeerHealthStatus(pee));
+      PeerMessageQueue::PeerHealthStatus(peer));
 
   peer.last_exchange_status = PeerStatus::OK;
   EXPECT_EQ(HealthReportPB::HEALTHY, PeerMessageQueue::PeerHealthStatus(peer));
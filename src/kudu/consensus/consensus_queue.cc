@@ -48,6 +48,7 @@
 #include "kudu/consensus/quorum_util.h"
 #include "kudu/consensus/replicate_msg_wrapper.h"
 #include "kudu/consensus/routing.h"
+#include "kudu/consensus/snapshot_provider.h"
 #include "kudu/consensus/time_manager.h"
 #include "kudu/gutil/bind.h"
 #include "kudu/gutil/bind_helpers.h"
@@ -56,7 +57,9 @@
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/stl_util.h"
+#include "kudu/gutil/strings/human_readable.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/crc.h"
 #include "kudu/util/fault_injection.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
@@ -64,6 +67,7 @@
 #include "kudu/util/pb_util.h"
 #include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/threadpool.h"
+#include "kudu/util/throttler.h"
 #include "kudu/util/url-coding.h"
 
 DEFINE_int32(
@@ -72,6 +76,146 @@ DEFINE_int32(
     "The maximum per-tablet RPC batch size when updating peers.");
 TAG_FLAG(consensus_max_batch_size_bytes, advanced);
 
+DEFINE_bool(
+    consensus_share_peer_batches,
+    true,
+    "Whether peers which need the same batch of ops, e.g. followers which are "
+    "all caught up, share a single read of it rather than each reading it "
+    "from the log cache and building it on its own.");
+TAG_FLAG(consensus_share_peer_batches, advanced);
+TAG_FLAG(consensus_share_peer_batches, runtime);
+
+DEFINE_bool(
+    consensus_adaptive_batch_sizing,
+    false,
+    "Whether the size of the batches sent to each peer adapts to how fast the "
+    "peer acknowledges them, instead of always being bounded by "
+    "--consensus_max_batch_size_bytes. A peer's limit grows additively while "
+    "its round trip time stays within --consensus_adaptive_batch_rtt_tolerance "
+    "times the lowest one seen, and is halved when it doesn't or when the RPC "
+    "fails.");
+TAG_FLAG(consensus_adaptive_batch_sizing, advanced);
+TAG_FLAG(consensus_adaptive_batch_sizing, experimental);
+TAG_FLAG(consensus_adaptive_batch_sizing, runtime);
+
+DEFINE_int32(
+    consensus_adaptive_batch_min_bytes,
+    64 * 1024,
+    "The lowest batch size limit, and the step by which it grows, under "
+    "--consensus_adaptive_batch_sizing.");
+TAG_FLAG(consensus_adaptive_batch_min_bytes, advanced);
+TAG_FLAG(consensus_adaptive_batch_min_bytes, runtime);
+
+DEFINE_int32(
+    consensus_adaptive_batch_max_bytes,
+    8 * 1024 * 1024,
+    "The highest batch size limit under --consensus_adaptive_batch_sizing.");
+TAG_FLAG(consensus_adaptive_batch_max_bytes, advanced);
+TAG_FLAG(consensus_adaptive_batch_max_bytes, runtime);
+
+DEFINE_double(
+    consensus_adaptive_batch_rtt_tolerance,
+    2.0,
+    "Under --consensus_adaptive_batch_sizing, how many times the lowest "
+    "recent round trip time to a peer a full batch may take before the "
+    "peer's batch size limit is lowered.");
+TAG_FLAG(consensus_adaptive_batch_rtt_tolerance, advanced);
+TAG_FLAG(consensus_adaptive_batch_rtt_tolerance, runtime);
+
+DEFINE_int64(
+    consensus_catchup_min_lag_ops,
+    100000,
+    "How many ops behind the leader a peer must be, with the ops it needs no "
+    "longer in the log cache, for it to be caught up by reading the closed "
+    "log segments sequentially, in batches of up to "
+    "--consensus_catchup_batch_size_bytes, rather than looking up each op in "
+    "the log index. The peer goes back to normal replication once it reaches "
+    "the ops in the log cache. 0 disables this.");
+TAG_FLAG(consensus_catchup_min_lag_ops, advanced);
+TAG_FLAG(consensus_catchup_min_lag_ops, runtime);
+
+DEFINE_int32(
+    consensus_catchup_batch_size_bytes,
+    8 * 1024 * 1024,
+    "The maximum RPC batch size when catching up a peer which is far behind. "
+    "See --consensus_catchup_min_lag_ops. Must be below "
+    "--rpc_max_message_size.");
+TAG_FLAG(consensus_catchup_batch_size_bytes, advanced);
+TAG_FLAG(consensus_catchup_batch_size_bytes, runtime);
+
+DEFINE_int64(
+    consensus_catchup_peer_bytes_per_sec,
+    0,
+    "The bandwidth budget, in bytes per second, of each peer which is sent "
+    "ops that are no longer in the log cache, and have to be read from the "
+    "log, so that catching up a peer after downtime doesn't saturate its "
+    "link and the leader's disk. A request which is over the budget is sent "
+    "without ops. Each request takes what it may read, up to a second of the "
+    "budget. 0 for no limit.");
+DEFINE_validator(
+    consensus_catchup_peer_bytes_per_sec,
+    [](const char* /*n*/, int64_t v) { return v >= 0; });
+TAG_FLAG(consensus_catchup_peer_bytes_per_sec, advanced);
+
+DEFINE_int64(
+    consensus_catchup_peer_requests_per_sec,
+    0,
+    "Like --consensus_catchup_peer_bytes_per_sec, for the requests with ops "
+    "from beyond the log cache. At least 10, as the budget refills every "
+    "100ms, or 0 for no limit.");
+DEFINE_validator(
+    consensus_catchup_peer_requests_per_sec,
+    [](const char* /*n*/, int64_t v) { return v == 0 || v >= 10; });
+TAG_FLAG(consensus_catchup_peer_requests_per_sec, advanced);
+
+DEFINE_int64(
+    consensus_catchup_global_bytes_per_sec,
+    0,
+    "Like --consensus_catchup_peer_bytes_per_sec, for all the peers of all "
+    "the tablets of the server together. 0 for no limit.");
+DEFINE_validator(
+    consensus_catchup_global_bytes_per_sec,
+    [](const char* /*n*/, int64_t v) { return v >= 0; });
+TAG_FLAG(consensus_catchup_global_bytes_per_sec, advanced);
+
+DEFINE_int64(
+    consensus_catchup_global_requests_per_sec,
+    0,
+    "Like --consensus_catchup_peer_requests_per_sec, for all the peers of "
+    "all the tablets of the server together. At least 10, or 0 for no "
+    "limit.");
+DEFINE_validator(
+    consensus_catchup_global_requests_per_sec,
+    [](const char* /*n*/, int64_t v) { return v == 0 || v >= 10; });
+TAG_FLAG(consensus_catchup_global_requests_per_sec, advanced);
+
+DEFINE_int64(
+    consensus_max_peer_apply_backlog_ops,
+    0,
+    "How many committed ops a follower may report it has yet to apply before "
+    "the leader only sends it status-only requests, until it catches up, and "
+    "no longer transfers leadership to it. Past half as many, the batches "
+    "sent to it are halved. Bounds the memory of followers whose state "
+    "machine is slower than the quorum. 0 ignores the backlogs.");
+DEFINE_validator(
+    consensus_max_peer_apply_backlog_ops,
+    [](const char* /*n*/, int64_t v) { return v >= 0; });
+TAG_FLAG(consensus_max_peer_apply_backlog_ops, experimental);
+TAG_FLAG(consensus_max_peer_apply_backlog_ops, runtime);
+
+DEFINE_int32(
+    consensus_catchup_commit_latency_target_ms,
+    0,
+    "When the recent time from appending ops until their replication to a "
+    "majority is over this, the catch-up budgets shrink in proportion, down "
+    "to a sixteenth, so that catching up peers gives way to the healthy "
+    "quorum. 0 keeps the budgets fixed.");
+DEFINE_validator(
+    consensus_catchup_commit_latency_target_ms,
+    [](const char* /*n*/, int32_t v) { return v >= 0; });
+TAG_FLAG(consensus_catchup_commit_latency_target_ms, advanced);
+TAG_FLAG(consensus_catchup_commit_latency_target_ms, runtime);
+
 DEFINE_int32(
     follower_unavailable_considered_failed_sec,
     300,
@@ -120,9 +264,30 @@ DEFINE_bool(
     true,
     "Should the commit index notification be done async?");
 
+DEFINE_int64(
+    consensus_health_summary_lagging_ops,
+    1000,
+    "A healthy peer missing more than this many of the leader's ops is "
+    "reported as LAGGING by the GetHealthSummary() RPC.");
+TAG_FLAG(consensus_health_summary_lagging_ops, runtime);
+
+DEFINE_int64(
+    raft_snapshot_chunk_bytes,
+    4 * 1024 * 1024,
+    "The size of the chunks in which the leader sends its latest snapshot to "
+    "a peer which is behind its log, one chunk in flight at a time. See "
+    "SnapshotProvider.");
+DEFINE_validator(
+    raft_snapshot_chunk_bytes,
+    [](const char* /*n*/, int64_t v) { return v > 0; });
+TAG_FLAG(raft_snapshot_chunk_bytes, advanced);
+TAG_FLAG(raft_snapshot_chunk_bytes, runtime);
+
 TAG_FLAG(synchronous_transfer_leadership, advanced);
 DECLARE_bool(enable_flexi_raft);
 DECLARE_int32(default_quorum_size);
+DECLARE_int32(consensus_max_inflight_requests_per_peer);
+DECLARE_bool(raft_enable_quiescence);
 
 using kudu::log::Log;
 using kudu::pb_util::SecureDebugString;
@@ -156,6 +321,226 @@ METRIC_DEFINE_gauge_int64(
     "Operations Behind Leader",
     MetricUnit::kOperations,
     "Number of operations this server believes it is behind the leader.");
+METRIC_DEFINE_gauge_int64(
+    server,
+    inflight_peer_requests,
+    "Peer Requests in Flight",
+    MetricUnit::kRequests,
+    "Number of UpdateConsensus requests this leader has in flight to its "
+    "peers. See --consensus_max_inflight_requests_per_peer.");
+METRIC_DEFINE_gauge_int64(
+    server,
+    local_region_durable_lead_ops,
+    "Local Region Durable Lead",
+    MetricUnit::kOperations,
+    "Number of operations durable on a majority of the voters in the leader's "
+    "region but not yet committed. This metric is always zero for "
+    "followers.");
+METRIC_DEFINE_counter(
+    server,
+    shared_peer_batches,
+    "Shared Peer Batches",
+    MetricUnit::kRequests,
+    "Number of UpdateConsensus requests whose batch of ops was shared with "
+    "another peer's request rather than read again. See "
+    "--consensus_share_peer_batches.");
+METRIC_DEFINE_counter(
+    server,
+    peer_batch_size_increases,
+    "Peer Batch Size Increases",
+    MetricUnit::kRequests,
+    "Number of times the batch size limit of a peer was raised. See "
+    "--consensus_adaptive_batch_sizing.");
+METRIC_DEFINE_counter(
+    server,
+    peer_batch_size_decreases,
+    "Peer Batch Size Decreases",
+    MetricUnit::kRequests,
+    "Number of times the batch size limit of a peer was lowered. See "
+    "--consensus_adaptive_batch_sizing.");
+METRIC_DEFINE_counter(
+    server,
+    peer_catchup_ops,
+    "Peer Catch-up Ops",
+    MetricUnit::kOperations,
+    "Number of ops read sequentially from the closed log segments to catch up "
+    "peers which are far behind. See --consensus_catchup_min_lag_ops.");
+METRIC_DEFINE_counter(
+    server,
+    peer_catchup_throttled_requests,
+    "Peer Catch-up Throttled Requests",
+    MetricUnit::kRequests,
+    "Number of requests to peers behind the log cache which were sent "
+    "without ops, as the catch-up was over its bandwidth budget. See "
+    "--consensus_catchup_peer_bytes_per_sec.");
+METRIC_DEFINE_counter(
+    server,
+    peer_apply_backlog_throttled_requests,
+    "Peer Apply Backlog Throttled Requests",
+    MetricUnit::kRequests,
+    "Number of requests to peers sent without ops, as they had too many "
+    "committed ops left to apply. See "
+    "--consensus_max_peer_apply_backlog_ops.");
+METRIC_DEFINE_counter(
+    server,
+    coalesced_commit_notifications,
+    "Coalesced Commit Notifications",
+    MetricUnit::kUnits,
+    "Number of commit index changes whose notification was folded into that "
+    "of a later change, rather than delivered on its own. See "
+    "--async_notify_commit_index.");
+METRIC_DEFINE_counter(
+    server,
+    raft_snapshot_bytes_sent,
+    "Snapshot Bytes Sent",
+    MetricUnit::kBytes,
+    "Number of snapshot bytes sent to peers which were behind the leader's "
+    "log. See --raft_snapshot_chunk_bytes.");
+METRIC_DEFINE_gauge_int64(
+    server,
+    committed_not_durable_ops,
+    "Committed Ops Not Durable",
+    MetricUnit::kOperations,
+    "Number of committed operations not yet durable on a majority of the "
+    "voters, which the leader commits before then in the QUORUM_MEMORY and "
+    "LEADER_DURABLE durability modes. This metric is always zero for "
+    "followers.");
+METRIC_DEFINE_histogram(
+    server,
+    peer_request_build_time,
+    "Peer Request Build Time",
+    MetricUnit::kMicroseconds,
+    "Microseconds spent building the UpdateConsensus requests to the peers.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    peer_rpc_round_trip_time,
+    "Peer RPC Round Trip Time",
+    MetricUnit::kMicroseconds,
+    "Microseconds from sending an UpdateConsensus request to a peer until its "
+    "response came back.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    follower_update_lock_wait_time,
+    "Follower Update Lock Wait Time",
+    MetricUnit::kMicroseconds,
+    "Microseconds the peers reported waiting for their previous "
+    "UpdateConsensus request to be done with before handling one with ops.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    follower_log_append_time,
+    "Follower Log Append Time",
+    MetricUnit::kMicroseconds,
+    "Microseconds the peers reported taking to append the ops of an "
+    "UpdateConsensus request to their log until they were durable.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    op_time_to_majority,
+    "Op Time To Majority",
+    MetricUnit::kMicroseconds,
+    "Microseconds from appending an op to the leader's queue until it was "
+    "replicated to a majority.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    local_region_durable_lead,
+    "Local Region Durable Lead Histogram",
+    MetricUnit::kOperations,
+    "Number of operations the leader's local region durable index was ahead "
+    "of its committed index each time the former advanced.",
+    1000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    lmp_mismatch_round_trips,
+    "LMP Mismatch Round Trips",
+    MetricUnit::kRequests,
+    "Number of requests a peer whose log diverged from the leader's refused "
+    "with a log matching property mismatch before accepting one.",
+    10000LU,
+    2);
+
+namespace {
+// How many batches are kept around for other peers to share.
+const size_t kMaxSharedBatches = 8;
+
+// The bounds of the per-peer latency histograms, as for the metrics.
+const uint64_t kLatencyHistogramMaxUs = 60000000LU;
+const int kLatencyHistogramDigits = 2;
+
+// How many appended batches are timed at most until they reach a majority.
+const size_t kMaxTimedAppendedBatches = 10000;
+
+// Whether a peer with 'backlog_ops' committed ops left to apply is past
+// --consensus_max_peer_apply_backlog_ops divided by 'divisor'.
+bool ApplyBacklogExceeded(int64_t backlog_ops, int64_t divisor = 1) {
+  const int64_t limit = FLAGS_consensus_max_peer_apply_backlog_ops;
+  return limit > 0 && backlog_ops >= limit / divisor;
+}
+
+// Summarizes 'h', in microseconds, for the status page.
+string LatencySummary(const HdrHistogram& h) {
+  if (h.TotalCount() == 0) {
+    return "-";
+  }
+  return Substitute(
+      "$0 / $1 / $2 us",
+      h.ValueAtPercentile(50),
+      h.ValueAtPercentile(99),
+      h.MaxValue());
+}
+
+// How long the lowest round trip time to a peer is trusted for, so that it
+// follows changes of the link.
+const int kMinBatchRttWindowSecs = 10;
+
+int64_t ClampBatchSizeLimit(int64_t limit) {
+  return std::max<int64_t>(
+      FLAGS_consensus_adaptive_batch_min_bytes,
+      std::min<int64_t>(limit, FLAGS_consensus_adaptive_batch_max_bytes));
+}
+
+// A catch-up budget, which bursts up to a second's worth.
+std::shared_ptr<Throttler> NewCatchupThrottler(
+    int64_t requests_per_sec,
+    int64_t bytes_per_sec) {
+  return std::make_shared<Throttler>(
+      MonoTime::Now(),
+      requests_per_sec,
+      bytes_per_sec,
+      MonoTime::kMicrosecondsPerSecond / Throttler::kRefillPeriodMicros);
+}
+
+// The budget all the peers catching up share, or null if there is none.
+Throttler* GlobalCatchupThrottler() {
+  static Throttler* throttler =
+      FLAGS_consensus_catchup_global_bytes_per_sec > 0 ||
+          FLAGS_consensus_catchup_global_requests_per_sec > 0
+      ? new Throttler(
+            MonoTime::Now(),
+            FLAGS_consensus_catchup_global_requests_per_sec,
+            FLAGS_consensus_catchup_global_bytes_per_sec,
+            MonoTime::kMicrosecondsPerSecond / Throttler::kRefillPeriodMicros)
+      : nullptr;
+  return throttler;
+}
+
+// What a request is charged of a budget holding at most 'max_tokens': no more
+// than that, so that a request larger than the budget still goes through
+// once it has refilled. The Throttler refills in steps rounded down, so this
+// may be a little less than a second's worth.
+uint64_t CapToBudget(int64_t charge, uint64_t max_tokens) {
+  return max_tokens > 0 ? std::min<uint64_t>(charge, max_tokens) : charge;
+}
+} // anonymous namespace
 
 const char* PeerStatusToString(PeerStatus p) {
   switch (p) {
@@ -182,19 +567,35 @@ const char* PeerStatusToString(PeerStatus p) {
   return "<unknown>";
 }
 
+PeerMessageQueue::PeerLatencies::PeerLatencies()
+    : request_build(kLatencyHistogramMaxUs, kLatencyHistogramDigits),
+      rpc_round_trip(kLatencyHistogramMaxUs, kLatencyHistogramDigits),
+      update_lock_wait(kLatencyHistogramMaxUs, kLatencyHistogramDigits),
+      log_append(kLatencyHistogramMaxUs, kLatencyHistogramDigits) {}
+
 PeerMessageQueue::TrackedPeer::TrackedPeer(
     RaftPeerPB peer_pb,
     const PeerMessageQueue* queue)
-    : peer_pb(std::move(peer_pb)),
-      next_index(kInvalidOpIdIndex),
+    : next_index(kInvalidOpIdIndex),
       last_received(MinimumOpId()),
       last_known_committed_index(MinimumOpId().index()),
       last_exchange_status(PeerStatus::NEW),
       last_successful_exchange(MonoTime::Now()),
       last_communication_time(MonoTime::Now()),
       wal_catchup_possible(true),
+      peer_pb(std::move(peer_pb)),
+      batch_size_limit(
+          ClampBatchSizeLimit(FLAGS_consensus_max_batch_size_bytes)),
       last_overall_health_status(HealthReportPB::UNKNOWN),
       status_log_throttler(std::make_shared<logging::LogThrottler>()),
+      catchup_throttler(
+          FLAGS_consensus_catchup_peer_bytes_per_sec > 0 ||
+                  FLAGS_consensus_catchup_peer_requests_per_sec > 0
+              ? NewCatchupThrottler(
+                    FLAGS_consensus_catchup_peer_requests_per_sec,
+                    FLAGS_consensus_catchup_peer_bytes_per_sec)
+              : nullptr),
+      latencies(std::make_shared<PeerLatencies>()),
       last_seen_term_(0),
       queue(queue) {
   PopulateIsPeerInLocalQuorum();
@@ -248,13 +649,16 @@ void PeerMessageQueue::TrackedPeer::PopulateIsPeerInLocalRegion() {
 std::string PeerMessageQueue::TrackedPeer::ToString() const {
   return Substitute(
       "Peer: $0, Status: $1, Last received: $2, Next index: $3, "
-      "Last known committed idx: $4, Time since last communication: $5",
+      "Last known committed idx: $4, Time since last communication: $5, "
+      "LMP mismatches: $6, Apply backlog: $7",
       SecureShortDebugString(peer_pb),
       PeerStatusToString(last_exchange_status),
       OpIdToString(last_received),
       next_index,
       last_known_committed_index,
-      (MonoTime::Now() - last_communication_time).ToString());
+      (MonoTime::Now() - last_communication_time).ToString(),
+      lmp_mismatch_round_trips,
+      apply_backlog_ops);
 }
 
 #define INSTANTIATE_METRIC(x) x.Instantiate(metric_entity, 0)
@@ -262,7 +666,43 @@ PeerMessageQueue::Metrics::Metrics(
     const scoped_refptr<MetricEntity>& metric_entity)
     : num_majority_done_ops(INSTANTIATE_METRIC(METRIC_majority_done_ops)),
       num_in_progress_ops(INSTANTIATE_METRIC(METRIC_in_progress_ops)),
-      num_ops_behind_leader(INSTANTIATE_METRIC(METRIC_ops_behind_leader)) {}
+      num_ops_behind_leader(INSTANTIATE_METRIC(METRIC_ops_behind_leader)),
+      num_inflight_peer_requests(
+          INSTANTIATE_METRIC(METRIC_inflight_peer_requests)),
+      num_local_region_durable_lead_ops(
+          INSTANTIATE_METRIC(METRIC_local_region_durable_lead_ops)),
+      num_shared_peer_batches(
+          metric_entity->FindOrCreateCounter(&METRIC_shared_peer_batches)),
+      num_batch_size_increases(metric_entity->FindOrCreateCounter(
+          &METRIC_peer_batch_size_increases)),
+      num_batch_size_decreases(metric_entity->FindOrCreateCounter(
+          &METRIC_peer_batch_size_decreases)),
+      num_catchup_ops(
+          metric_entity->FindOrCreateCounter(&METRIC_peer_catchup_ops)),
+      num_catchup_throttled_requests(metric_entity->FindOrCreateCounter(
+          &METRIC_peer_catchup_throttled_requests)),
+      num_apply_backlog_throttled_requests(metric_entity->FindOrCreateCounter(
+          &METRIC_peer_apply_backlog_throttled_requests)),
+      num_coalesced_commit_notifications(metric_entity->FindOrCreateCounter(
+          &METRIC_coalesced_commit_notifications)),
+      num_snapshot_bytes_sent(
+          metric_entity->FindOrCreateCounter(&METRIC_raft_snapshot_bytes_sent)),
+      num_committed_not_durable_ops(
+          INSTANTIATE_METRIC(METRIC_committed_not_durable_ops)),
+      lmp_mismatch_round_trips(
+          METRIC_lmp_mismatch_round_trips.Instantiate(metric_entity)),
+      peer_request_build_time(
+          METRIC_peer_request_build_time.Instantiate(metric_entity)),
+      peer_rpc_round_trip_time(
+          METRIC_peer_rpc_round_trip_time.Instantiate(metric_entity)),
+      follower_update_lock_wait_time(
+          METRIC_follower_update_lock_wait_time.Instantiate(metric_entity)),
+      follower_log_append_time(
+          METRIC_follower_log_append_time.Instantiate(metric_entity)),
+      op_time_to_majority(
+          METRIC_op_time_to_majority.Instantiate(metric_entity)),
+      local_region_durable_lead(
+          METRIC_local_region_durable_lead.Instantiate(metric_entity)) {}
 #undef INSTANTIATE_METRIC
 
 PeerMessageQueue::PeerMessageQueue(
@@ -288,22 +728,29 @@ PeerMessageQueue::PeerMessageQueue(
           local_peer_pb_.permanent_uuid(),
           tablet_id_),
       metrics_(metric_entity),
+      op_tracer_(metric_entity),
       time_manager_(std::move(time_manager)) {
   DCHECK(local_peer_pb_.has_permanent_uuid());
   DCHECK(local_peer_pb_.has_last_known_addr());
   DCHECK(last_locally_replicated.IsInitialized());
   DCHECK(last_locally_committed.IsInitialized());
+  leader_log_prefix_ = Substitute(
+      "T $0 P $1 [LEADER]: ", tablet_id_, local_peer_pb_.permanent_uuid());
+  non_leader_log_prefix_ = Substitute(
+      "T $0 P $1 [NON_LEADER]: ", tablet_id_, local_peer_pb_.permanent_uuid());
   queue_state_.current_term = 0;
   queue_state_.first_index_in_current_term = boost::none;
   queue_state_.committed_index = 0;
   queue_state_.all_replicated_index = 0;
   queue_state_.majority_replicated_index = 0;
   queue_state_.region_durable_index = 0;
+  queue_state_.local_region_durable_index = 0;
   queue_state_.last_idx_appended_to_leader = 0;
   queue_state_.mode = NON_LEADER;
   queue_state_.majority_size_ = -1;
   queue_state_.last_appended = std::move(last_locally_replicated);
   queue_state_.committed_index = last_locally_committed.index();
+  local_durable_index_ = queue_state_.last_appended.index();
   queue_state_.state = kQueueOpen;
   // TODO(mpercy): Merge LogCache::Init() with its constructor.
   log_cache_.Init(queue_state_.last_appended);
@@ -324,6 +771,25 @@ void PeerMessageQueue::SetProxyFailureThresholdLag(
   proxy_failure_threshold_lag_ = proxy_failure_threshold_lag;
 }
 
+bool PeerMessageQueue::IsQuiescentUnlocked() const {
+  DCHECK(queue_lock_.is_locked());
+  if (queue_state_.committed_index != queue_state_.last_appended.index()) {
+    return false;
+  }
+  for (const auto& entry : peers_map_) {
+    const TrackedPeer* peer = entry.second;
+    if (peer->uuid() == local_peer_pb_.permanent_uuid()) {
+      continue;
+    }
+    if (peer->last_exchange_status != PeerStatus::OK ||
+        !OpIdEquals(peer->last_received, queue_state_.last_appended) ||
+        peer->last_known_committed_index != queue_state_.committed_index) {
+      return false;
+    }
+  }
+  return true;
+}
+
 bool PeerMessageQueue::HasProxyPeerFailedUnlocked(
     const TrackedPeer* proxy_peer,
     const TrackedPeer* dest_peer) {
@@ -380,10 +846,15 @@ void PeerMessageQueue::SetLeaderMode(
 
   queue_state_.committed_index = committed_index;
   queue_state_.majority_replicated_index = committed_index;
+  queue_state_.majority_durable_index = committed_index;
+  queue_state_.local_region_durable_index = committed_index;
   queue_state_.active_config.reset(new RaftConfigPB(active_config));
+  region_voter_distribution_.reset();
+  leader_quorum_voters_.reset();
   queue_state_.majority_size_ =
       MajoritySize(CountVoters(*queue_state_.active_config));
   queue_state_.mode = LEADER;
+  ClearSharedBatches();
 
   TrackLocalPeerUnlocked();
   CheckPeersInActiveConfigIfLeaderUnlocked();
@@ -392,20 +863,33 @@ void PeerMessageQueue::SetLeaderMode(
       << "Queue going to LEADER mode. State: " << queue_state_.ToString();
 
   // Reset last communication time with all peers to reset the clock on the
-  // failure timeout.
+  // failure timeout. The lease has to be earned anew in the new term.
   const auto now = MonoTime::Now();
   for (const PeersMap::value_type& entry : peers_map_) {
     entry.second->last_communication_time = now;
     entry.second->last_successful_exchange = now;
+    entry.second->lease_granted_at = MonoTime();
   }
   time_manager_->SetLeaderMode();
 }
 
 void PeerMessageQueue::SetNonLeaderMode(const RaftConfigPB& active_config) {
+  std::vector<StdStatusCallback> aborted;
+  SCOPED_CLEANUP({
+    for (const StdStatusCallback& callback : aborted) {
+      callback(Status::Aborted("not the leader any more"));
+    }
+  });
   std::lock_guard<simple_mutexlock> lock(queue_lock_);
+  AbortLeadershipConfirmationsUnlocked(&aborted);
   queue_state_.active_config.reset(new RaftConfigPB(active_config));
+  region_voter_distribution_.reset();
+  leader_quorum_voters_.reset();
   queue_state_.mode = NON_LEADER;
   queue_state_.majority_size_ = -1;
+  ClearSharedBatches();
+  appended_batches_.clear();
+  op_tracer_.Clear();
 
   // Update this when stepping down, since it doesn't get tracked as LEADER.
   queue_state_.last_idx_appended_to_leader = queue_state_.last_appended.index();
@@ -457,6 +941,9 @@ void PeerMessageQueue::UntrackPeerUnlocked(const string& uuid) {
   DCHECK(queue_lock_.is_locked());
   TrackedPeer* peer = EraseKeyReturnValuePtr(&peers_map_, uuid);
   delete peer; // Deleting a nullptr is safe.
+  replicated_by_region_.Erase(uuid);
+  replicated_in_leader_quorum_.Erase(uuid);
+  peer_health_history_.ForgetPeer(uuid);
 }
 
 void PeerMessageQueue::TrackLocalPeerUnlocked() {
@@ -507,6 +994,46 @@ unordered_map<string, HealthReportPB> PeerMessageQueue::ReportHealthOfPeers()
   return reports;
 }
 
+void PeerMessageQueue::FillHealthSummary(
+    ConsensusHealthSummaryPB* summary) const {
+  const int64_t lagging_ops = FLAGS_consensus_health_summary_lagging_ops;
+  std::lock_guard<simple_mutexlock> lock(queue_lock_);
+  const int64_t last_index = queue_state_.last_appended.index();
+  summary->set_committed_index(queue_state_.committed_index);
+  summary->set_last_index(last_index);
+  if (queue_state_.mode != LEADER) {
+    return;
+  }
+  for (const auto& entry : peers_map_) {
+    if (entry.first == local_peer_pb_.permanent_uuid()) {
+      continue;
+    }
+    const TrackedPeer* peer = entry.second;
+    const int64_t lag_ops =
+        std::max<int64_t>(0, last_index - peer->last_received.index());
+    ConsensusHealthSummaryPB::LagClass lag_class;
+    switch (PeerHealthStatus(*peer)) {
+      case HealthReportPB::HEALTHY:
+        lag_class = lag_ops > lagging_ops ? ConsensusHealthSummaryPB::LAGGING
+                                          : ConsensusHealthSummaryPB::CAUGHT_UP;
+        break;
+      case HealthReportPB::FAILED:
+        lag_class = ConsensusHealthSummaryPB::UNREACHABLE;
+        break;
+      case HealthReportPB::FAILED_UNRECOVERABLE:
+        lag_class = ConsensusHealthSummaryPB::UNRECOVERABLE;
+        break;
+      default:
+        lag_class = ConsensusHealthSummaryPB::UNKNOWN_LAG;
+        break;
+    }
+    ConsensusHealthSummaryPB::PeerLagPB* peer_lag = summary->add_peers();
+    peer_lag->set_permanent_uuid(entry.first);
+    peer_lag->set_lag_class(lag_class);
+    peer_lag->set_lag_ops(lag_ops);
+  }
+}
+
 void PeerMessageQueue::CheckPeersInActiveConfigIfLeaderUnlocked() const {
   DCHECK(queue_lock_.is_locked());
   if (queue_state_.mode != LEADER)
@@ -544,8 +1071,15 @@ void PeerMessageQueue::DoLocalPeerAppendFinished(
   }
 
   boost::optional<int64_t> updated_commit_index;
+  std::vector<StdStatusCallback> confirmed_leadership;
   DoResponseFromPeer(
-      local_peer_pb_.permanent_uuid(), fake_response, updated_commit_index);
+      local_peer_pb_.permanent_uuid(),
+      fake_response,
+      MonoDelta(),
+      MonoTime(),
+      updated_commit_index,
+      confirmed_leadership);
+  DCHECK(confirmed_leadership.empty());
 
   if (updated_commit_index != boost::none) {
     NotifyObserversOfCommitIndexChange(*updated_commit_index, need_lock);
@@ -554,9 +1088,17 @@ void PeerMessageQueue::DoLocalPeerAppendFinished(
 
 void PeerMessageQueue::LocalPeerAppendFinished(
     const OpId& id,
+    int64_t truncation_epoch,
     const StatusCallback& callback,
     const Status& status) {
   CHECK_OK(status);
+  op_tracer_.RecordStage(0, id.index(), OpTracer::kLocalDurable);
+  {
+    std::lock_guard<simple_spinlock> l(local_durable_lock_);
+    if (truncation_epoch == truncation_epoch_) {
+      local_durable_index_ = std::max(local_durable_index_, id.index());
+    }
+  }
 
   // Schedule the function to gather local response and count local vote to run
   // asynchronously (so as not to block the thread writing to local log from
@@ -589,6 +1131,7 @@ Status PeerMessageQueue::AppendOperations(
     const vector<ReplicateRefPtr>& msgs,
     const StatusCallback& log_append_callback) {
   DFAKE_SCOPED_LOCK(append_fake_lock_);
+  MonoTime append_time = MonoTime::Now();
   std::unique_lock<simple_mutexlock> lock(queue_lock_);
 
   OpId last_id = msgs.back()->get()->id();
@@ -600,8 +1143,10 @@ Status PeerMessageQueue::AppendOperations(
   // leader term as part of SetLeaderMode(). However, we are currently also
   // using that method to handle refreshing the peer list during configuration
   // changes, so the refactor isn't trivial.
+  int64_t payload_bytes = 0;
   for (const auto& msg : msgs) {
     const auto& id = msg->get()->id();
+    payload_bytes += msg->get()->write_payload().payload().size();
     if (id.term() > queue_state_.current_term) {
       queue_state_.current_term = id.term();
       queue_state_.first_index_in_current_term = id.index();
@@ -631,10 +1176,16 @@ Status PeerMessageQueue::AppendOperations(
           &PeerMessageQueue::LocalPeerAppendFinished,
           Unretained(this),
           last_id,
+          TruncationEpoch(),
           log_append_callback)));
+  op_tracer_.RecordStage(
+      msgs.front()->get()->id().index(), last_id.index(), OpTracer::kQueued);
   lock.lock();
   DCHECK(last_id.IsInitialized());
   queue_state_.last_appended = last_id;
+  TimeAppendedBatchUnlocked(last_id.index(), msgs.size(), append_time);
+  peer_health_history_.RecordAppend(last_id.index(), payload_bytes);
+  CountLocalAppendTowardsCommitUnlocked();
   UpdateMetricsUnlocked();
 
   return Status::OK();
@@ -653,6 +1204,7 @@ Status PeerMessageQueue::AppendOperations(
     const vector<ReplicateMsgWrapper>& msg_wrappers,
     const StatusCallback& log_append_callback) {
   DFAKE_SCOPED_LOCK(append_fake_lock_);
+  MonoTime append_time = MonoTime::Now();
   std::unique_lock<simple_mutexlock> lock(queue_lock_);
 
   OpId last_id = msg_wrappers.back().GetOrigMsg()->get()->id();
@@ -664,8 +1216,11 @@ Status PeerMessageQueue::AppendOperations(
   // leader term as part of SetLeaderMode(). However, we are currently also
   // using that method to handle refreshing the peer list during configuration
   // changes, so the refactor isn't trivial.
+  int64_t payload_bytes = 0;
   for (const auto& msg_wrapper : msg_wrappers) {
     const auto& id = msg_wrapper.GetOrigMsg()->get()->id();
+    payload_bytes +=
+        msg_wrapper.GetOrigMsg()->get()->write_payload().payload().size();
     if (id.term() > queue_state_.current_term) {
       queue_state_.current_term = id.term();
       queue_state_.first_index_in_current_term = id.index();
@@ -696,15 +1251,44 @@ Status PeerMessageQueue::AppendOperations(
           &PeerMessageQueue::LocalPeerAppendFinished,
           Unretained(this),
           last_id,
+          TruncationEpoch(),
           log_append_callback)));
+  op_tracer_.RecordStage(
+      msg_wrappers.front().GetOrigMsg()->get()->id().index(),
+      last_id.index(),
+      OpTracer::kQueued);
   lock.lock();
   DCHECK(last_id.IsInitialized());
   queue_state_.last_appended = last_id;
+  TimeAppendedBatchUnlocked(last_id.index(), msg_wrappers.size(), append_time);
+  peer_health_history_.RecordAppend(last_id.index(), payload_bytes);
+  CountLocalAppendTowardsCommitUnlocked();
   UpdateMetricsUnlocked();
 
   return Status::OK();
 }
 
+int64_t PeerMessageQueue::TruncationEpoch() const {
+  std::lock_guard<simple_spinlock> l(local_durable_lock_);
+  return truncation_epoch_;
+}
+
+void PeerMessageQueue::CountLocalAppendTowardsCommitUnlocked() {
+  DCHECK(queue_lock_.is_locked());
+  if (queue_state_.mode != LEADER ||
+      durability_mode_ != DurabilityMode::QUORUM_MEMORY) {
+    return;
+  }
+  // The commit index moves once the peers ack the ops too, by which time
+  // AdvanceQueueWatermark() counts the local peer in. The flexi-raft
+  // watermarks are only updated as each peer responds, though.
+  const TrackedPeer* local_peer =
+      FindPtrOrNull(peers_map_, local_peer_pb_.permanent_uuid());
+  if (local_peer != nullptr) {
+    UpdateReplicatedWatermarksUnlocked(*local_peer);
+  }
+}
+
 void PeerMessageQueue::TruncateOpsAfter(int64_t index) {
   DFAKE_SCOPED_LOCK(append_fake_lock_); // should not race with append.
   OpId op;
@@ -718,16 +1302,144 @@ void PeerMessageQueue::TruncateOpsAfter(int64_t index) {
     std::unique_lock<simple_mutexlock> lock(queue_lock_);
     DCHECK(op.IsInitialized());
     queue_state_.last_appended = op;
+    ClearSharedBatches();
+    appended_batches_.clear();
+  }
+  {
+    // The appends of the truncated ops may still be in flight.
+    std::lock_guard<simple_spinlock> l(local_durable_lock_);
+    truncation_epoch_++;
+    local_durable_index_ = std::min(local_durable_index_, op.index());
   }
+  op_tracer_.AbortOpsAfter(op.index());
+  peer_health_history_.TruncateAfter(op.index());
   log_cache_.TruncateOpsAfter(op.index());
 }
 
+Status PeerMessageQueue::ResetToSnapshot(const OpId& last_included) {
+  DFAKE_SCOPED_LOCK(append_fake_lock_); // should not race with append.
+  RETURN_NOT_OK(log_cache_.ResetTo(last_included));
+  {
+    std::lock_guard<simple_spinlock> l(local_durable_lock_);
+    truncation_epoch_++;
+    local_durable_index_ = last_included.index();
+  }
+  {
+    std::lock_guard<simple_mutexlock> lock(queue_lock_);
+    DCHECK_EQ(queue_state_.mode, NON_LEADER);
+    queue_state_.last_appended = last_included;
+    queue_state_.committed_index =
+        std::max(queue_state_.committed_index, last_included.index());
+    ClearSharedBatches();
+    appended_batches_.clear();
+    UpdateMetricsUnlocked();
+  }
+  return Status::OK();
+}
+
+bool PeerMessageQueue::SnapshotCanCatchUp(int64_t index) {
+  SnapshotProvider* provider = snapshot_provider_;
+  if (provider == nullptr) {
+    return false;
+  }
+  SnapshotInfoPB snapshot;
+  if (!provider->GetLatestSnapshot(&snapshot).ok() ||
+      snapshot.last_included().index() <= index) {
+    return false;
+  }
+  // The peer then goes on from the op after the snapshot, unless that one is
+  // gone too.
+  OpId next;
+  Status s = log_cache_.LookupOpId(snapshot.last_included().index() + 1, &next);
+  return s.ok() || s.IsIncomplete();
+}
+
+bool PeerMessageQueue::PeerNeedsSnapshot(const string& uuid) const {
+  std::lock_guard<simple_mutexlock> lock(queue_lock_);
+  TrackedPeer* peer = FindPtrOrNull(peers_map_, uuid);
+  return peer != nullptr && queue_state_.mode == LEADER &&
+      peer->needs_snapshot;
+}
+
+Status PeerMessageQueue::RequestSnapshotChunkForPeer(
+    const string& uuid,
+    int64_t offset,
+    InstallSnapshotRequestPB* request) {
+  int64_t current_term;
+  {
+    std::lock_guard<simple_mutexlock> lock(queue_lock_);
+    TrackedPeer* peer = FindPtrOrNull(peers_map_, uuid);
+    if (PREDICT_FALSE(
+            peer == nullptr || queue_state_.mode == NON_LEADER ||
+            !peer->needs_snapshot)) {
+      return Status::NotFound(
+          Substitute("peer $0 does not need a snapshot", uuid));
+    }
+    current_term = queue_state_.current_term;
+  }
+  SnapshotProvider* provider = snapshot_provider_;
+  if (PREDICT_FALSE(provider == nullptr)) {
+    return Status::NotFound("no snapshot provider");
+  }
+
+  SnapshotInfoPB snapshot;
+  RETURN_NOT_OK_PREPEND(
+      provider->GetLatestSnapshot(&snapshot),
+      "could not get the latest snapshot");
+  if (snapshot.id() != request->snapshot().id()) {
+    offset = 0;
+  }
+  string* data = request->mutable_data();
+  data->clear();
+  RETURN_NOT_OK_PREPEND(
+      provider->ReadSnapshotChunk(
+          snapshot.id(), offset, FLAGS_raft_snapshot_chunk_bytes, data),
+      Substitute("could not read the snapshot at offset $0", offset));
+  bool done = offset + static_cast<int64_t>(data->size()) >=
+      snapshot.size_bytes();
+  if (PREDICT_FALSE(data->empty() && !done)) {
+    return Status::IllegalState(Substitute(
+        "no snapshot data at offset $0 of $1 bytes",
+        offset,
+        snapshot.size_bytes()));
+  }
+
+  request->set_caller_term(current_term);
+  *request->mutable_snapshot() = std::move(snapshot);
+  request->set_offset(offset);
+  request->set_data_crc32(crc::Crc32c(data->data(), data->size()));
+  request->set_done(done);
+  metrics_.num_snapshot_bytes_sent->IncrementBy(data->size());
+  return Status::OK();
+}
+
+void PeerMessageQueue::SnapshotInstalledOnPeer(
+    const string& uuid,
+    const OpId& last_included) {
+  std::lock_guard<simple_mutexlock> lock(queue_lock_);
+  TrackedPeer* peer = FindPtrOrNull(peers_map_, uuid);
+  if (peer == nullptr || queue_state_.mode == NON_LEADER) {
+    return;
+  }
+  LOG_WITH_PREFIX_UNLOCKED(INFO)
+      << "Peer " << uuid << " installed the snapshot through "
+      << OpIdToString(last_included);
+  peer->needs_snapshot = false;
+  peer->wal_catchup_possible = true;
+  peer->next_index = last_included.index() + 1;
+}
+
 OpId PeerMessageQueue::GetLastOpIdInLog() const {
   std::unique_lock<simple_mutexlock> lock(queue_lock_);
   DCHECK(queue_state_.last_appended.IsInitialized());
   return queue_state_.last_appended;
 }
 
+int64_t PeerMessageQueue::GetLocalDurableIndex() const {
+  std::lock_guard<simple_spinlock> l(local_durable_lock_);
+  return local_durable_index_;
+}
+
 OpId PeerMessageQueue::GetNextOpId() const {
   std::unique_lock<simple_mutexlock> lock(queue_lock_);
   DCHECK(queue_state_.last_appended.IsInitialized());
@@ -917,14 +1629,19 @@ HealthReportPB::HealthStatus PeerMessageQueue::PeerHealthStatus(
   return HealthReportPB::UNKNOWN;
 }
 
-Status PeerMessageQueue::FindPeer(const std::string& uuid, TrackedPeer* peer) {
-  std::lock_guard<simple_mutexlock> lock(queue_lock_);
-  TrackedPeer* peer_copy = FindPtrOrNull(peers_map_, uuid);
-
-  if (peer_copy == nullptr)
-    return Status::NotFound(Substitute("peer $0 is no longer tracked", uuid));
-
-  *peer = *peer_copy;
+Status PeerMessageQueue::RequestForPeer(
+    const string& uuid,
+    bool read_ops,
+    ConsensusRequestPB* request,
+    vector<ReplicateRefPtr>* msg_refs,
+    bool* needs_tablet_copy,
+    std::string* next_hop_uuid) {
+  ReplicateBatchRefPtr batch;
+  RETURN_NOT_OK(RequestForPeer(
+      uuid, read_ops, request, &batch, needs_tablet_copy, next_hop_uuid));
+  if (batch) {
+    *msg_refs = batch->msgs();
+  }
   return Status::OK();
 }
 
@@ -932,14 +1649,28 @@ Status PeerMessageQueue::RequestForPeer(
     const string& uuid,
     bool read_ops,
     ConsensusRequestPB* request,
-    vector<ReplicateRefPtr>* msg_refs,
+    ReplicateBatchRefPtr* msg_refs,
     bool* needs_tablet_copy,
     std::string* next_hop_uuid) {
-  // Maintain a thread-safe copy of necessary members.
+  MonoTime build_start = MonoTime::Now();
+
+  // The routing table does its own locking, so resolve the next hop before
+  // taking 'queue_lock_'.
+  RETURN_NOT_OK(routing_table_container_->NextHop(
+      local_peer_pb_.permanent_uuid(), uuid, next_hop_uuid));
+
+  // Only snapshot the state the request is built from under 'queue_lock_'.
+  // The request itself is assembled below without the lock, so that peers
+  // don't serialize on it (and on each other) while their batches are built.
   OpId preceding_id;
+  int64_t last_appended_index;
   int64_t current_term;
+  int64_t committed_index;
+  int64_t all_replicated_index;
+  int64_t region_durable_index;
+  bool quiescent;
+  bool prioritized;
   TrackedPeer peer_copy;
-  MonoDelta unreachable_time;
   {
     std::lock_guard<simple_mutexlock> lock(queue_lock_);
     DCHECK_EQ(queue_state_.state, kQueueOpen);
@@ -954,41 +1685,18 @@ Status PeerMessageQueue::RequestForPeer(
     }
     peer_copy = *peer;
 
-    // Clear the requests without deleting the entries, as they may be in use by
-    // other peers.
-#if GOOGLE_PROTOBUF_VERSION >= 3017003
-    request->mutable_ops()->UnsafeArenaExtractSubrange(
-        0, request->ops_size(), nullptr);
-#else
-    request->mutable_ops()->ExtractSubrange(0, request->ops_size(), nullptr);
-#endif
-
     // This is initialized to the queue's last appended op but gets set to the
     // id of the log entry preceding the first one in 'messages' if messages are
     // found for the peer.
     preceding_id = queue_state_.last_appended;
+    last_appended_index = preceding_id.index();
     current_term = queue_state_.current_term;
-
-    request->set_committed_index(queue_state_.committed_index);
-    request->set_all_replicated_index(queue_state_.all_replicated_index);
-    request->set_last_idx_appended_to_leader(
-        queue_state_.last_appended.index());
-    request->set_caller_term(current_term);
-    request->set_region_durable_index(queue_state_.region_durable_index);
-    if (auto rpc_token = persistent_vars_->raft_rpc_token()) {
-      request->set_raft_rpc_token(*rpc_token);
-    }
-    request->clear_compression_dictionary();
-    if (peer->should_send_compression_dict) {
-      LOG_WITH_PREFIX_UNLOCKED(INFO)
-          << "Setting compression dictionary in request";
-      request->set_compression_dictionary(
-          CompressionCodecManager::GetDictionary());
-    }
-    unreachable_time = MonoTime::Now() - peer_copy.last_communication_time;
-
-    RETURN_NOT_OK(routing_table_container_->NextHop(
-        local_peer_pb_.permanent_uuid(), uuid, next_hop_uuid));
+    committed_index = queue_state_.committed_index;
+    all_replicated_index = queue_state_.all_replicated_index;
+    region_durable_index = queue_state_.region_durable_index;
+    quiescent = FLAGS_raft_enable_quiescence && IsQuiescentUnlocked();
+    prioritized = prioritize_successor_ && successor_watch_in_progress_ &&
+        uuid == *designated_successor_uuid_;
 
     if (*next_hop_uuid != uuid) {
       // If proxy_peer is not healthy, then route directly to the destination
@@ -1005,6 +1713,36 @@ Status PeerMessageQueue::RequestForPeer(
     }
   }
 
+  // Clear the requests without deleting the entries, as they may be in use by
+  // other peers.
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  request->mutable_ops()->UnsafeArenaExtractSubrange(
+      0, request->ops_size(), nullptr);
+#else
+  request->mutable_ops()->ExtractSubrange(0, request->ops_size(), nullptr);
+#endif
+
+  request->set_committed_index(committed_index);
+  request->set_all_replicated_index(all_replicated_index);
+  request->set_last_idx_appended_to_leader(last_appended_index);
+  request->set_caller_term(current_term);
+  request->set_region_durable_index(region_durable_index);
+  if (quiescent) {
+    request->set_quiesce(true);
+  } else {
+    request->clear_quiesce();
+  }
+  if (auto rpc_token = persistent_vars_->raft_rpc_token()) {
+    request->set_raft_rpc_token(*rpc_token);
+  }
+  request->clear_compression_dictionary();
+  if (peer_copy.should_send_compression_dict) {
+    LOG_WITH_PREFIX_UNLOCKED(INFO)
+        << "Setting compression dictionary in request";
+    request->set_compression_dictionary(
+        CompressionCodecManager::GetDictionary());
+  }
+
   // Always trigger a health status update check at the end of this function.
   bool wal_catchup_progress = false;
   bool wal_catchup_failure = false;
@@ -1021,8 +1759,10 @@ Status PeerMessageQueue::RequestForPeer(
               << " is no longer tracked or queue is not in leader mode";
       return;
     }
-    if (wal_catchup_progress)
+    if (wal_catchup_progress) {
       peer->wal_catchup_possible = true;
+      peer->needs_snapshot = false;
+    }
     if (wal_catchup_failure)
       peer->wal_catchup_possible = false;
     UpdatePeerHealthUnlocked(peer);
@@ -1055,82 +1795,256 @@ Status PeerMessageQueue::RequestForPeer(
   // 'read_ops'), then we skip reading ops from log-cache/log. The caller
   // ususally does this when the leader detects that a peer is unhealthy and
   // hence needs to be degraded to a 'status-only' request
+  if (peer_copy.last_exchange_status != PeerStatus::NEW && read_ops &&
+      PREDICT_FALSE(!TakeCatchupBudget(peer_copy, last_appended_index))) {
+    metrics_.num_catchup_throttled_requests->Increment();
+    KLOG_EVERY_N_SECS_THROTTLER(
+        INFO, 60, *peer_copy.status_log_throttler, "catchup_throttled")
+        << LogPrefixUnlocked() << "Catch-up of peer " << uuid
+        << " is over its bandwidth budget, sending it a status-only request";
+    read_ops = false;
+  }
+  if (peer_copy.last_exchange_status != PeerStatus::NEW && read_ops &&
+      PREDICT_FALSE(ApplyBacklogExceeded(peer_copy.apply_backlog_ops))) {
+    // The status-only requests still bring back the peer's backlog, which
+    // resumes the ops once it shrinks.
+    metrics_.num_apply_backlog_throttled_requests->Increment();
+    KLOG_EVERY_N_SECS_THROTTLER(
+        INFO, 60, *peer_copy.status_log_throttler, "apply_backlog")
+        << LogPrefixUnlocked() << "Peer " << uuid << " has "
+        << peer_copy.apply_backlog_ops
+        << " committed ops left to apply, sending it a status-only request";
+    read_ops = false;
+  }
   if (peer_copy.last_exchange_status != PeerStatus::NEW && read_ops) {
-    // The batch of messages to send to the peer.
+    // The batch of messages to send to the peer, as read, then as shared with
+    // other peers.
     vector<ReplicateRefPtr> messages;
-    int max_batch_size =
-        FLAGS_consensus_max_batch_size_bytes - request->ByteSize();
+    ReplicateBatchRefPtr batch;
+    // A successor being caught up for a leadership transfer gets full
+    // batches, see BeginWatchForSuccessor().
+    int64_t batch_size_limit =
+        FLAGS_consensus_adaptive_batch_sizing && !prioritized
+        ? peer_copy.batch_size_limit
+        : FLAGS_consensus_max_batch_size_bytes;
+    if (ApplyBacklogExceeded(peer_copy.apply_backlog_ops, 2)) {
+      batch_size_limit /= 2;
+    }
+    int max_batch_size = batch_size_limit - request->ByteSize();
 
+    int64_t after_op_index = peer_copy.next_index - 1;
     ReadContext read_context;
     read_context.for_peer_uuid = &uuid;
     read_context.for_peer_host = &peer_copy.peer_pb.last_known_addr().host();
     read_context.for_peer_port = peer_copy.peer_pb.last_known_addr().port();
     read_context.route_via_proxy = route_via_proxy;
 
-    // We try to get the follower's next_index from our log.
-    Status s = log_cache_.ReadOps(
-        peer_copy.next_index - 1,
-        max_batch_size,
-        read_context,
-        &messages,
-        &preceding_id);
-    if (PREDICT_FALSE(!s.ok())) {
-      // It's normal to have a NotFound() here if a follower falls behind where
-      // the leader has GCed its logs. The follower replica will hang around
-      // for a while until it's evicted.
-      if (PREDICT_TRUE(s.IsNotFound())) {
-        KLOG_EVERY_N_SECS_THROTTLER(
-            INFO, 60, *peer_copy.status_log_throttler, "logs_gced")
-            << LogPrefixUnlocked()
-            << Substitute(
-                   "The logs necessary to catch up peer $0 have been "
-                   "garbage collected. The follower will never be able "
-                   "to catch up ($1)",
-                   uuid,
-                   s.ToString());
-        wal_catchup_failure = true;
-        return s;
+    // A peer which is too far behind for the ops it needs to be in the log
+    // cache is caught up with large sequential reads of the closed log
+    // segments. Pipelining keeps several of its batches in flight, so that it
+    // is limited by its bandwidth rather than by the round trip time.
+    std::shared_ptr<log::SequentialReplicateReader> catchup_reader;
+    bool catchup = FLAGS_consensus_catchup_min_lag_ops > 0 &&
+        last_appended_index - after_op_index >=
+            FLAGS_consensus_catchup_min_lag_ops &&
+        !log_cache_.HasOpBeenCached(after_op_index + 1);
+    if (catchup) {
+      catchup_reader = peer_copy.catchup_reader;
+      Status s = log_cache_.ReadOpsSequentially(
+          after_op_index,
+          FLAGS_consensus_catchup_batch_size_bytes - request->ByteSize(),
+          read_context,
+          &catchup_reader,
+          &messages,
+          &preceding_id);
+      if (PREDICT_FALSE(!s.ok())) {
+        // Whatever went wrong, the read below reports it.
+        VLOG_WITH_PREFIX_UNLOCKED(1)
+            << "Error reading the closed log segments to catch up peer "
+            << uuid << ": " << s.ToString();
+        messages.clear();
       }
-      if (s.IsIncomplete()) {
-        // IsIncomplete() means that we tried to read beyond the head of the log
-        // (in the future). See KUDU-1078.
-        LOG_WITH_PREFIX_UNLOCKED(ERROR)
-            << "Error trying to read ahead of the log "
-            << "while preparing peer request: " << s.ToString()
-            << ". Destination peer: " << peer_copy.ToString();
-        return s;
+      if (messages.empty()) {
+        catchup = false;
+        catchup_reader.reset();
+      } else {
+        metrics_.num_catchup_ops->IncrementBy(messages.size());
+        if (!peer_copy.catchup_reader) {
+          KLOG_EVERY_N_SECS_THROTTLER(
+              INFO, 60, *peer_copy.status_log_throttler, "catchup")
+              << LogPrefixUnlocked() << "Peer " << uuid << " is "
+              << (last_appended_index - after_op_index)
+              << " ops behind, catching it up from the closed log segments";
+        }
+      }
+    }
+
+    bool shared = !catchup && FLAGS_consensus_share_peer_batches &&
+        LookupSharedBatch(
+            after_op_index,
+            route_via_proxy,
+            current_term,
+            last_appended_index,
+            max_batch_size,
+            &batch,
+            &preceding_id);
+    if (shared) {
+      metrics_.num_shared_peer_batches->Increment();
+    } else {
+      if (!catchup) {
+        // We try to get the follower's next_index from our log.
+        Status s = log_cache_.ReadOps(
+            after_op_index,
+            max_batch_size,
+            read_context,
+            &messages,
+            &preceding_id);
+        if (PREDICT_FALSE(!s.ok())) {
+          // It's normal to have a NotFound() here if a follower falls behind
+          // where the leader has GCed its logs. The follower replica will hang
+          // around for a while until it's evicted.
+          if (PREDICT_TRUE(s.IsNotFound())) {
+            if (SnapshotCanCatchUp(after_op_index)) {
+              std::lock_guard<simple_mutexlock> lock(queue_lock_);
+              TrackedPeer* peer = FindPtrOrNull(peers_map_, uuid);
+              if (peer != nullptr && !peer->needs_snapshot) {
+                LOG_WITH_PREFIX_UNLOCKED(INFO)
+                    << "The logs necessary to catch up peer " << uuid
+                    << " have been garbage collected, sending it the latest "
+                    << "snapshot";
+                peer->needs_snapshot = true;
+              }
+              return s;
+            }
+            KLOG_EVERY_N_SECS_THROTTLER(
+                INFO, 60, *peer_copy.status_log_throttler, "logs_gced")
+                << LogPrefixUnlocked()
+                << Substitute(
+                       "The logs necessary to catch up peer $0 have been "
+                       "garbage collected. The follower will never be able "
+                       "to catch up ($1)",
+                       uuid,
+                       s.ToString());
+            wal_catchup_failure = true;
+            return s;
+          }
+          if (s.IsIncomplete()) {
+            // IsIncomplete() means that we tried to read beyond the head of the
+            // log (in the future). See KUDU-1078.
+            LOG_WITH_PREFIX_UNLOCKED(ERROR)
+                << "Error trying to read ahead of the log "
+                << "while preparing peer request: " << s.ToString()
+                << ". Destination peer: " << peer_copy.ToString();
+            return s;
+          }
+          LOG_WITH_PREFIX_UNLOCKED(FATAL)
+              << "Error reading the log while preparing peer request: "
+              << s.ToString() << ". Destination peer: " << peer_copy.ToString();
+        }
+      }
+
+      if (!route_via_proxy) {
+        // A witness which stored the ops without their payloads, see
+        // --raft_witness_strip_payloads, can't send them to the peer itself.
+        auto stripped = std::find_if(
+            messages.begin(),
+            messages.end(),
+            [](const ReplicateRefPtr& msg) {
+              return ReplicateMsgWrapper::IsPayloadStripped(*msg->get());
+            });
+        if (PREDICT_FALSE(stripped != messages.end())) {
+          KLOG_EVERY_N_SECS_THROTTLER(
+              INFO, 60, *peer_copy.status_log_throttler, "stripped_payloads")
+              << LogPrefixUnlocked() << "The payload of op "
+              << OpIdToString((*stripped)->get()->id())
+              << " was left out of the log, peer " << uuid
+              << " needs a leader with it to catch up";
+          messages.erase(stripped, messages.end());
+          catchup = false;
+          catchup_reader.reset();
+        }
+      }
+
+      if (route_via_proxy) {
+        // The peer is sent the ids of the ops only, which the proxy fills in
+        // from its own log.
+        for (ReplicateRefPtr& msg : messages) {
+          ReplicateRefPtr proxy_op =
+              make_scoped_refptr_replicate(new ReplicateMsg);
+          *proxy_op->get()->mutable_id() = msg->get()->id();
+          proxy_op->get()->set_timestamp(msg->get()->timestamp());
+          proxy_op->get()->set_op_type(PROXY_OP);
+          msg = std::move(proxy_op);
+        }
+      }
+
+      batch = new RefCountedReplicateBatch(std::move(messages));
+      if (!catchup && FLAGS_consensus_share_peer_batches &&
+          !batch->msgs().empty()) {
+        SharedBatch shared_batch;
+        shared_batch.term = current_term;
+        shared_batch.last_appended_index = last_appended_index;
+        shared_batch.max_batch_size = max_batch_size;
+        shared_batch.preceding_id = preceding_id;
+        shared_batch.messages = batch;
+        InsertSharedBatch(
+            after_op_index, route_via_proxy, std::move(shared_batch));
       }
-      LOG_WITH_PREFIX_UNLOCKED(FATAL)
-          << "Error reading the log while preparing peer request: "
-          << s.ToString() << ". Destination peer: " << peer_copy.ToString();
     }
+    const vector<ReplicateRefPtr>& batch_msgs = batch->msgs();
 
     // Since we were able to read ops through the log cache, we know that
     // catchup is possible.
     wal_catchup_progress = true;
 
-    // We use AddAllocated rather than copy, because we pin the log cache at the
-    // "all replicated" point. At some point we may want to allow partially
-    // loading (and not pinning) earlier messages. At that point we'll need to
-    // do something smarter here, like copy or ref-count.
-    if (!route_via_proxy) {
-      for (const ReplicateRefPtr& msg : messages) {
-        request->mutable_ops()->AddAllocated(msg->get());
-      }
-      msg_refs->swap(messages);
-    } else {
-      vector<ReplicateRefPtr> proxy_ops;
-      for (const ReplicateRefPtr& msg : messages) {
-        ReplicateRefPtr proxy_op =
-            make_scoped_refptr_replicate(new ReplicateMsg);
-        *proxy_op->get()->mutable_id() = msg->get()->id();
-        proxy_op->get()->set_timestamp(msg->get()->timestamp());
-        proxy_op->get()->set_op_type(PROXY_OP);
-        request->mutable_ops()->AddAllocated(proxy_op->get());
-        proxy_ops.emplace_back(std::move(proxy_op));
+    // When pipelining, the next request to this peer follows this one rather
+    // than waiting for it to be acknowledged. Only do so for a peer whose
+    // position we know, and whose position did not change in the meantime.
+    bool advance_next_index =
+        FLAGS_consensus_max_inflight_requests_per_peer > 1 &&
+        !batch_msgs.empty() &&
+        peer_copy.last_exchange_status == PeerStatus::OK;
+    // Only a batch which was cut short by its size limit tells anything about
+    // whether the limit is right.
+    bool time_batch = FLAGS_consensus_adaptive_batch_sizing && !catchup &&
+        !batch_msgs.empty() &&
+        batch_msgs.back()->get()->id().index() < last_appended_index &&
+        peer_copy.timed_batch_last_index < 0;
+    bool update_catchup_reader = catchup_reader != peer_copy.catchup_reader;
+    if (advance_next_index || time_batch || update_catchup_reader) {
+      std::lock_guard<simple_mutexlock> lock(queue_lock_);
+      TrackedPeer* peer = FindPtrOrNull(peers_map_, uuid);
+      if (peer != nullptr) {
+        if (update_catchup_reader) {
+          if (!catchup_reader) {
+            VLOG_WITH_PREFIX_UNLOCKED(1)
+                << "Peer " << uuid << " is done catching up from the closed "
+                << "log segments";
+          }
+          peer->catchup_reader = std::move(catchup_reader);
+        }
+        if (advance_next_index && peer->next_index == peer_copy.next_index) {
+          peer->next_index = batch_msgs.back()->get()->id().index() + 1;
+        }
+        if (time_batch && peer->timed_batch_last_index < 0) {
+          peer->timed_batch_last_index =
+              batch_msgs.back()->get()->id().index();
+          peer->timed_batch_send_time = MonoTime::Now();
+        }
       }
-      msg_refs->swap(proxy_ops);
     }
+
+    // We use UnsafeArenaAddAllocated rather than copy, because we pin the log
+    // cache at the "all replicated" point. At some point we may want to allow
+    // partially loading (and not pinning) earlier messages. At that point
+    // we'll need to do something smarter here, like copy or ref-count.
+    // The same goes for the ops of a shared batch, which are pinned by every
+    // request sharing it. The ops received by a follower may live on the arena
+    // of their request, which AddAllocated() would copy.
+    for (const ReplicateRefPtr& msg : batch_msgs) {
+      request->mutable_ops()->UnsafeArenaAddAllocated(msg->get());
+    }
+    *msg_refs = std::move(batch);
   }
 
   DCHECK(preceding_id.IsInitialized());
@@ -1179,48 +2093,266 @@ Status PeerMessageQueue::RequestForPeer(
     }
   }
 
+  if (request->ops_size() > 0) {
+    op_tracer_.RecordSent(
+        uuid,
+        request->ops(0).id().index(),
+        request->ops(request->ops_size() - 1).id().index());
+  }
+
+  int64_t build_us = (MonoTime::Now() - build_start).ToMicroseconds();
+  metrics_.peer_request_build_time->Increment(build_us);
+  if (peer_copy.latencies) {
+    peer_copy.latencies->request_build.Increment(build_us);
+  }
   return Status::OK();
 }
 
-#ifdef FB_DO_NOT_REMOVE
-
-Status PeerMessageQueue::GetTabletCopyRequestForPeer(
-    const string& uuid,
-    StartTabletCopyRequestPB* req) {
-  TrackedPeer* peer = nullptr;
-  int64_t current_term;
-  {
-    std::lock_guard<simple_mutexlock> lock(queue_lock_);
-    DCHECK_EQ(queue_state_.state, kQueueOpen);
-    DCHECK_NE(uuid, local_peer_pb_.permanent_uuid());
-    peer = FindPtrOrNull(peers_map_, uuid);
-    current_term = queue_state_.current_term;
-    if (PREDICT_FALSE(peer == nullptr || queue_state_.mode == NON_LEADER)) {
-      return Status::NotFound("Peer not tracked or queue not in leader mode.");
-    }
-    if (PREDICT_FALSE(
-            peer->last_exchange_status != PeerStatus::TABLET_NOT_FOUND)) {
-      return Status::IllegalState(
-          "Peer does not need to initiate Tablet Copy", uuid);
-    }
+bool PeerMessageQueue::LookupSharedBatch(
+    int64_t after_op_index,
+    bool proxy_ops,
+    int64_t term,
+    int64_t last_appended_index,
+    int max_batch_size,
+    ReplicateBatchRefPtr* messages,
+    OpId* preceding_id) {
+  std::lock_guard<simple_spinlock> l(shared_batches_lock_);
+  const SharedBatch* batch =
+      FindOrNull(shared_batches_, std::make_pair(after_op_index, proxy_ops));
+  if (batch == nullptr || batch->term != term ||
+      batch->max_batch_size != max_batch_size) {
+    return false;
   }
-  req->Clear();
-  req->set_dest_uuid(uuid);
-  req->set_tablet_id(tablet_id_);
-  req->set_copy_peer_uuid(local_peer_pb_.permanent_uuid());
-  *req->mutable_copy_peer_addr() = local_peer_pb_.last_known_addr();
-  req->set_caller_term(current_term);
-  return Status::OK();
+  // A batch which reached the end of the log is missing whatever was appended
+  // since.
+  if (batch->messages->msgs().back()->get()->id().index() >=
+          batch->last_appended_index &&
+      batch->last_appended_index != last_appended_index) {
+    return false;
+  }
+  *messages = batch->messages;
+  *preceding_id = batch->preceding_id;
+  return true;
 }
-#endif
 
-void PeerMessageQueue::AdvanceQueueRegionDurableIndex() {
-  int64_t max_region_durable_index = -1;
+void PeerMessageQueue::InsertSharedBatch(
+    int64_t after_op_index,
+    bool proxy_ops,
+    SharedBatch batch) {
+  std::lock_guard<simple_spinlock> l(shared_batches_lock_);
+  shared_batches_[std::make_pair(after_op_index, proxy_ops)] = std::move(batch);
+  // The batches the furthest behind are the least likely to be needed again.
+  while (shared_batches_.size() > kMaxSharedBatches) {
+    shared_batches_.erase(shared_batches_.begin());
+  }
+}
 
-  if (!local_peer_pb_.attrs().has_region()) {
+void PeerMessageQueue::AdaptBatchSizeUnlocked(TrackedPeer* peer) {
+  DCHECK(queue_lock_.is_locked());
+  if (peer->last_exchange_status != PeerStatus::OK) {
+    peer->timed_batch_last_index = -1;
+    // A timeout may well be down to a batch too large for the link.
+    if (peer->last_exchange_status == PeerStatus::RPC_LAYER_ERROR) {
+      peer->batch_size_limit = ClampBatchSizeLimit(peer->batch_size_limit / 2);
+      metrics_.num_batch_size_decreases->Increment();
+    }
     return;
   }
-
+  if (peer->timed_batch_last_index < 0 ||
+      peer->last_received.index() < peer->timed_batch_last_index) {
+    return;
+  }
+
+  MonoTime now = MonoTime::Now();
+  MonoDelta rtt = now - peer->timed_batch_send_time;
+  peer->timed_batch_last_index = -1;
+  peer->last_batch_rtt = rtt;
+  if (!peer->min_batch_rtt.Initialized() || rtt < peer->min_batch_rtt ||
+      now - peer->min_batch_rtt_time >
+          MonoDelta::FromSeconds(kMinBatchRttWindowSecs)) {
+    peer->min_batch_rtt = rtt;
+    peer->min_batch_rtt_time = now;
+  }
+
+  // AIMD: a round trip close to the lowest one means the link keeps up with
+  // the batches, one much higher means they queue up somewhere.
+  if (rtt.ToMicroseconds() <= peer->min_batch_rtt.ToMicroseconds() *
+          FLAGS_consensus_adaptive_batch_rtt_tolerance) {
+    peer->batch_size_limit = ClampBatchSizeLimit(
+        peer->batch_size_limit + FLAGS_consensus_adaptive_batch_min_bytes);
+    metrics_.num_batch_size_increases->Increment();
+  } else {
+    peer->batch_size_limit = ClampBatchSizeLimit(peer->batch_size_limit / 2);
+    metrics_.num_batch_size_decreases->Increment();
+  }
+}
+
+void PeerMessageQueue::RecordPeerLatenciesUnlocked(
+    const TrackedPeer& peer,
+    const ConsensusResponsePB& response,
+    const MonoDelta& rpc_round_trip) {
+  DCHECK(queue_lock_.is_locked());
+  PeerLatencies* latencies = peer.latencies.get();
+  if (rpc_round_trip.Initialized()) {
+    int64_t us = rpc_round_trip.ToMicroseconds();
+    metrics_.peer_rpc_round_trip_time->Increment(us);
+    if (latencies) {
+      latencies->rpc_round_trip.Increment(us);
+    }
+  }
+  if (response.has_update_lock_wait_us()) {
+    metrics_.follower_update_lock_wait_time->Increment(
+        response.update_lock_wait_us());
+    if (latencies) {
+      latencies->update_lock_wait.Increment(response.update_lock_wait_us());
+    }
+  }
+  if (response.has_log_append_us()) {
+    metrics_.follower_log_append_time->Increment(response.log_append_us());
+    if (latencies) {
+      latencies->log_append.Increment(response.log_append_us());
+    }
+  }
+}
+
+void PeerMessageQueue::TimeAppendedBatchUnlocked(
+    int64_t last_index,
+    int64_t num_ops,
+    MonoTime append_time) {
+  DCHECK(queue_lock_.is_locked());
+  if (queue_state_.mode != LEADER) {
+    return;
+  }
+  if (appended_batches_.size() >= kMaxTimedAppendedBatches) {
+    appended_batches_.pop_front();
+  }
+  appended_batches_.push_back({last_index, num_ops, append_time});
+}
+
+void PeerMessageQueue::RecordTimeToMajorityUnlocked() {
+  DCHECK(queue_lock_.is_locked());
+  if (appended_batches_.empty() ||
+      appended_batches_.front().last_index >
+          queue_state_.majority_replicated_index) {
+    return;
+  }
+  MonoTime now = MonoTime::Now();
+  while (!appended_batches_.empty() &&
+         appended_batches_.front().last_index <=
+             queue_state_.majority_replicated_index) {
+    const AppendedBatch& batch = appended_batches_.front();
+    const int64_t time_us = (now - batch.append_time).ToMicroseconds();
+    metrics_.op_time_to_majority->IncrementBy(time_us, batch.num_ops);
+    // Weighs the latest batches by 1/8.
+    const int64_t avg_us = time_to_majority_avg_us_;
+    time_to_majority_avg_us_ = avg_us + (time_us - avg_us) / 8;
+    appended_batches_.pop_front();
+  }
+}
+
+bool PeerMessageQueue::TakeCatchupBudget(
+    const TrackedPeer& peer,
+    int64_t last_appended_index) {
+  Throttler* global = GlobalCatchupThrottler();
+  if (!peer.catchup_throttler && !global) {
+    return true;
+  }
+  const int64_t after_op_index = peer.next_index - 1;
+  if (after_op_index >= last_appended_index ||
+      log_cache_.HasOpBeenCached(after_op_index + 1)) {
+    return true;
+  }
+  // What the request may read, as RequestForPeer() does.
+  int64_t bytes = FLAGS_consensus_catchup_min_lag_ops > 0 &&
+          last_appended_index - after_op_index >=
+              FLAGS_consensus_catchup_min_lag_ops
+      ? FLAGS_consensus_catchup_batch_size_bytes
+      : FLAGS_consensus_max_batch_size_bytes;
+  int64_t requests = 1;
+  const int64_t target_us =
+      FLAGS_consensus_catchup_commit_latency_target_ms * 1000LL;
+  if (target_us > 0) {
+    const int64_t factor = std::min<int64_t>(
+        std::max<int64_t>(time_to_majority_avg_us_ / target_us, 1), 16);
+    bytes *= factor;
+    requests *= factor;
+  }
+  const MonoTime now = MonoTime::Now();
+  Throttler* peer_throttler = peer.catchup_throttler.get();
+  uint64_t peer_requests = 0;
+  uint64_t peer_bytes = 0;
+  if (peer_throttler) {
+    peer_requests = CapToBudget(requests, peer_throttler->max_op_tokens());
+    peer_bytes = CapToBudget(bytes, peer_throttler->max_byte_tokens());
+    if (!peer_throttler->Take(now, peer_requests, peer_bytes)) {
+      return false;
+    }
+  }
+  if (global &&
+      !global->Take(
+          now,
+          CapToBudget(requests, global->max_op_tokens()),
+          CapToBudget(bytes, global->max_byte_tokens()))) {
+    // The request is sent without ops, so it doesn't use the peer's budget.
+    if (peer_throttler) {
+      peer_throttler->Refund(peer_requests, peer_bytes);
+    }
+    return false;
+  }
+  return true;
+}
+
+void PeerMessageQueue::DropSharedBatchesBefore(int64_t index) {
+  std::lock_guard<simple_spinlock> l(shared_batches_lock_);
+  shared_batches_.erase(
+      shared_batches_.begin(),
+      shared_batches_.lower_bound(std::make_pair(index, false)));
+}
+
+void PeerMessageQueue::ClearSharedBatches() {
+  std::lock_guard<simple_spinlock> l(shared_batches_lock_);
+  shared_batches_.clear();
+}
+
+#ifdef FB_DO_NOT_REMOVE
+
+Status PeerMessageQueue::GetTabletCopyRequestForPeer(
+    const string& uuid,
+    StartTabletCopyRequestPB* req) {
+  TrackedPeer* peer = nullptr;
+  int64_t current_term;
+  {
+    std::lock_guard<simple_mutexlock> lock(queue_lock_);
+    DCHECK_EQ(queue_state_.state, kQueueOpen);
+    DCHECK_NE(uuid, local_peer_pb_.permanent_uuid());
+    peer = FindPtrOrNull(peers_map_, uuid);
+    current_term = queue_state_.current_term;
+    if (PREDICT_FALSE(peer == nullptr || queue_state_.mode == NON_LEADER)) {
+      return Status::NotFound("Peer not tracked or queue not in leader mode.");
+    }
+    if (PREDICT_FALSE(
+            peer->last_exchange_status != PeerStatus::TABLET_NOT_FOUND)) {
+      return Status::IllegalState(
+          "Peer does not need to initiate Tablet Copy", uuid);
+    }
+  }
+  req->Clear();
+  req->set_dest_uuid(uuid);
+  req->set_tablet_id(tablet_id_);
+  req->set_copy_peer_uuid(local_peer_pb_.permanent_uuid());
+  *req->mutable_copy_peer_addr() = local_peer_pb_.last_known_addr();
+  req->set_caller_term(current_term);
+  return Status::OK();
+}
+#endif
+
+void PeerMessageQueue::AdvanceQueueRegionDurableIndex() {
+  int64_t max_region_durable_index = -1;
+
+  if (!local_peer_pb_.attrs().has_region()) {
+    return;
+  }
+
   // region_durable_index is updated only if following constraints are satisfied
   // 1. region_durable_index <= committed_index
   // 2. Atleast one non-leader region has received this index
@@ -1228,13 +2360,13 @@ void PeerMessageQueue::AdvanceQueueRegionDurableIndex() {
     if (!peer.second->is_peer_in_local_region.has_value()) {
       continue;
     }
+    const int64_t index = CommitQuorumIndexUnlocked(*peer.second);
     if (!peer.second->is_peer_in_local_region.value() &&
-        peer.second->last_received.index() <= queue_state_.committed_index) {
+        index <= queue_state_.committed_index) {
       // This peer is outside our region and the last received index is
       // lower than the current committed_index. Include this in the
       // calculation of region_durable_index
-      max_region_durable_index = std::max(
-          max_region_durable_index, peer.second->last_received.index());
+      max_region_durable_index = std::max(max_region_durable_index, index);
     }
   }
 
@@ -1242,6 +2374,64 @@ void PeerMessageQueue::AdvanceQueueRegionDurableIndex() {
       std::max(queue_state_.region_durable_index, max_region_durable_index);
 }
 
+void PeerMessageQueue::AdvanceLocalRegionDurableIndexUnlocked() {
+  DCHECK(queue_lock_.is_locked());
+  const string& region = local_peer_pb_.attrs().region();
+  if (region.empty() || !queue_state_.active_config) {
+    return;
+  }
+
+  // As with the voter distribution of the commit rule, a region may be
+  // expected to have more voters than the config currently has.
+  int num_voters = 0;
+  for (const RaftPeerPB& peer_pb : queue_state_.active_config->peers()) {
+    if (peer_pb.member_type() == RaftPeerPB::VOTER &&
+        peer_pb.attrs().region() == region) {
+      ++num_voters;
+    }
+  }
+  num_voters = std::max(
+      num_voters,
+      FindWithDefault(
+          queue_state_.active_config->voter_distribution(), region, 0));
+  if (num_voters == 0) {
+    return;
+  }
+
+  std::optional<int64_t> index =
+      replicated_by_region_.KthHighest(region, MajoritySize(num_voters));
+  if (!index.has_value() ||
+      *index <= queue_state_.local_region_durable_index) {
+    return;
+  }
+  queue_state_.local_region_durable_index = *index;
+  metrics_.local_region_durable_lead->Increment(
+      std::max<int64_t>(0, *index - queue_state_.committed_index));
+  NotifyObserversOfLocalRegionDurableIndex(*index);
+}
+
+int64_t PeerMessageQueue::CommitQuorumIndexUnlocked(
+    const TrackedPeer& peer) const {
+  DCHECK(queue_lock_.is_locked());
+  switch (durability_mode_.load()) {
+    case DurabilityMode::DURABLE:
+      // Even if the peer acks the ops it has yet to sync.
+      return peer.last_durable_index;
+    case DurabilityMode::QUORUM_MEMORY:
+      if (queue_state_.mode == LEADER &&
+          peer.uuid() == local_peer_pb_.permanent_uuid()) {
+        return std::max(
+            peer.last_received.index(), queue_state_.last_appended.index());
+      }
+      return peer.last_received.index();
+    case DurabilityMode::LEADER_DURABLE:
+      // The local peer only acks its durable ops.
+      return peer.last_received.index();
+  }
+  LOG(FATAL) << "Unknown durability mode";
+  return peer.last_durable_index;
+}
+
 void PeerMessageQueue::AdvanceQueueWatermark(
     const char* type,
     int64_t* watermark,
@@ -1249,6 +2439,7 @@ void PeerMessageQueue::AdvanceQueueWatermark(
     const OpId& replicated_after,
     int num_peers_required,
     ReplicaTypes replica_types,
+    AckedOps acked_ops,
     const TrackedPeer* who_caused) {
   if (VLOG_IS_ON(2)) {
     VLOG_WITH_PREFIX_UNLOCKED(2)
@@ -1294,8 +2485,19 @@ void PeerMessageQueue::AdvanceQueueWatermark(
     // 'last_received' is _not_ usable for watermark calculation. This could be
     // fixed by separately storing the 'match_index' on a per-peer basis and
     // using that for watermark calculation.
-    if (peer.second->last_exchange_status == PeerStatus::OK) {
-      watermarks.push_back(peer.second->last_received.index());
+    if (peer.second->last_exchange_status != PeerStatus::OK) {
+      continue;
+    }
+    switch (acked_ops) {
+      case RECEIVED_OPS:
+        watermarks.push_back(peer.second->last_received.index());
+        break;
+      case COMMIT_QUORUM_OPS:
+        watermarks.push_back(CommitQuorumIndexUnlocked(*peer.second));
+        break;
+      case DURABLE_OPS:
+        watermarks.push_back(peer.second->last_durable_index);
+        break;
     }
   }
 
@@ -1330,7 +2532,7 @@ void PeerMessageQueue::AdvanceQueueWatermark(
 
 int64_t PeerMessageQueue::DoComputeNewWatermarkStaticMode(
     const std::map<std::string, int>& voter_distribution,
-    const std::map<std::string, std::vector<int64_t>>& watermarks_by_region,
+    const RegionalWatermarkFn& regional_watermark,
     int64_t* watermark) {
   CHECK(watermark);
   CHECK(queue_state_.active_config->has_commit_rule());
@@ -1378,37 +2580,27 @@ int64_t PeerMessageQueue::DoComputeNewWatermarkStaticMode(
       int total_voters = FindOrDie(voter_distribution, region);
       DCHECK(total_voters >= 1 || !adjust_voter_distribution_);
       int commit_req = MajoritySize(total_voters);
-      std::map<std::string, std::vector<int64_t>>::const_iterator it =
-          watermarks_by_region.find(region);
 
-      // If we haven't got responses from enough number of servers in region,
-      // we simply move on.
-      if (it == watermarks_by_region.end() || it->second.size() < commit_req) {
+      // Computing the commit index in each region. If we haven't got
+      // responses from enough number of servers in region, we simply move on.
+      std::optional<int64_t> regional_commit_index =
+          regional_watermark(region, commit_req);
+      if (!regional_commit_index.has_value()) {
         if (VLOG_IS_ON(3)) {
           VLOG_WITH_PREFIX_UNLOCKED(3)
               << "Skipping region: " << region
-              << ", Majority size: " << commit_req << ", Servers responded: "
-              << ((it == watermarks_by_region.end()) ? 0 : it->second.size());
+              << ", Majority size: " << commit_req;
         }
         continue;
       }
 
-      const std::vector<int64_t>& watermarks_in_region = it->second;
-
-      // Computing the commit index in each region.
-      int64_t regional_commit_index =
-          watermarks_in_region[watermarks_in_region.size() - commit_req];
-
       if (VLOG_IS_ON(3)) {
-        VLOG_WITH_PREFIX_UNLOCKED(3) << "Watermarks in region: " << region;
-        for (int64_t watermark_it : watermarks_in_region) {
-          VLOG_WITH_PREFIX_UNLOCKED(3) << "Watermark: " << watermark_it;
-        }
         VLOG_WITH_PREFIX_UNLOCKED(3)
-            << "Regional commit index: " << regional_commit_index;
+            << "Regional commit index of " << region << ": "
+            << *regional_commit_index;
       }
 
-      regional_commit_indexes.push_back(regional_commit_index);
+      regional_commit_indexes.push_back(*regional_commit_index);
     }
 
     // If we haven't got enough majorities in regions listed in the predicate,
@@ -1479,16 +2671,15 @@ int64_t PeerMessageQueue::DoComputeNewWatermarkStaticMode(
   return old_watermark;
 }
 
-int64_t PeerMessageQueue::ComputeNewWatermarkDynamicMode(int64_t* watermark) {
+int64_t PeerMessageQueue::ComputeNewWatermarkDynamicMode(
+    int64_t* watermark,
+    const PeerWatermarkFn& peer_watermark) {
   CHECK(watermark);
   CHECK(queue_state_.active_config->has_commit_rule());
   CHECK(
       queue_state_.active_config->commit_rule().mode() ==
       QuorumMode::SINGLE_REGION_DYNAMIC);
 
-  const std::string& leader_quorum_id =
-      getQuorumIdUsingCommitRule(local_peer_pb_);
-
   // Compute the watermarks in leader quorum. As an example, at the end of this
   // loop, watermarks_in_leader_quorum might have entries (3, 7, 5) which
   // indicates that the leader quorum has 3 peers that have responded to OpId
@@ -1506,54 +2697,12 @@ int64_t PeerMessageQueue::ComputeNewWatermarkDynamicMode(int64_t* watermark) {
     if (peer.second->last_exchange_status == PeerStatus::OK) {
       if (peer.second->is_peer_in_local_quorum.has_value() &&
           peer.second->is_peer_in_local_quorum.value()) {
-        watermarks_in_leader_quorum.push_back(
-            peer.second->last_received.index());
+        watermarks_in_leader_quorum.push_back(peer_watermark(*peer.second));
       }
     }
   }
 
-  // Compute total number of voters in each region.
-  std::optional<int> total_from_vd = GetTotalVotersFromVoterDistribution(
-      *(queue_state_.active_config), leader_quorum_id);
-
-  CHECK(total_from_vd.has_value());
-
-  int total_voters_from_voter_distribution = total_from_vd.value();
-
-  // Compute number of voters in each region in the active config.
-  // As voter distribution provided in topology config can lag,
-  // we need to take into account the active voters as well due to
-  // membership changes.
-  // Check for more comments in AdjustVoterDistributionWithCurrentVoters() which
-  // does the same for static mode watermark calculation
-  int total_voters_from_active_config = 0;
-  for (const RaftPeerPB& peer_pb : queue_state_.active_config->peers()) {
-    if (!peer_pb.has_member_type() ||
-        peer_pb.member_type() != RaftPeerPB::VOTER) {
-      continue;
-    }
-
-    CHECK(peer_pb.has_permanent_uuid());
-    const std::string& peer_pb_quorum_id = getQuorumIdUsingCommitRule(peer_pb);
-    if (peer_pb_quorum_id != leader_quorum_id) {
-      // In dynamic mode, only the leader region matters
-      continue;
-    }
-
-    total_voters_from_active_config++;
-  }
-
-  int total_voters = std::max(
-      total_voters_from_voter_distribution, total_voters_from_active_config);
-
-  // adjust_voter_distribution_ is set to false on in cases where we want to
-  // perform an election forcefully i.e. unsafe config change
-  if (PREDICT_FALSE(!adjust_voter_distribution_)) {
-    total_voters = total_voters_from_voter_distribution;
-  }
-
-  DCHECK(total_voters >= 1 || !adjust_voter_distribution_);
-  int commit_req = MajoritySize(total_voters);
+  int commit_req = MajoritySize(LeaderQuorumVotersUnlocked());
 
   VLOG_WITH_PREFIX_UNLOCKED(1) << "Computing new commit index in single "
                                << "region dynamic mode.";
@@ -1565,8 +2714,7 @@ int64_t PeerMessageQueue::ComputeNewWatermarkDynamicMode(int64_t* watermark) {
     if (VLOG_IS_ON(3)) {
       VLOG_WITH_PREFIX_UNLOCKED(3)
           << "Watermarks size: " << watermarks_in_leader_quorum.size()
-          << ", Num peers required: " << commit_req
-          << ", Quorum: " << leader_quorum_id;
+          << ", Num peers required: " << commit_req;
     }
     return *watermark;
   }
@@ -1581,7 +2729,9 @@ int64_t PeerMessageQueue::ComputeNewWatermarkDynamicMode(int64_t* watermark) {
   return old_watermark;
 }
 
-int64_t PeerMessageQueue::ComputeNewWatermarkStaticMode(int64_t* watermark) {
+int64_t PeerMessageQueue::ComputeNewWatermarkStaticMode(
+    int64_t* watermark,
+    const PeerWatermarkFn& peer_watermark) {
   CHECK(watermark);
   CHECK(queue_state_.active_config->has_commit_rule());
 
@@ -1609,7 +2759,7 @@ int64_t PeerMessageQueue::ComputeNewWatermarkStaticMode(int64_t* watermark) {
       const string& peer_region = peer.second->peer_pb.attrs().region();
       std::vector<int64_t>& regional_watermarks = LookupOrInsert(
           &watermarks_by_region, peer_region, std::vector<int64_t>());
-      regional_watermarks.push_back(peer.second->last_received.index());
+      regional_watermarks.push_back(peer_watermark(*peer.second));
     }
   }
 
@@ -1621,6 +2771,25 @@ int64_t PeerMessageQueue::ComputeNewWatermarkStaticMode(int64_t* watermark) {
     std::sort(it->second.begin(), it->second.end());
   }
 
+  const RegionalWatermarkFn regional_watermark =
+      [&](const std::string& region,
+          int num_required) -> std::optional<int64_t> {
+    auto it = watermarks_by_region.find(region);
+    if (it == watermarks_by_region.end() ||
+        it->second.size() < static_cast<size_t>(num_required)) {
+      return std::nullopt;
+    }
+    return it->second[it->second.size() - num_required];
+  };
+  return DoComputeNewWatermarkStaticMode(
+      RegionVoterDistributionUnlocked(), regional_watermark, watermark);
+}
+
+const std::map<std::string, int>&
+PeerMessageQueue::RegionVoterDistributionUnlocked() {
+  if (region_voter_distribution_.has_value()) {
+    return *region_voter_distribution_;
+  }
   // Map to store the number of voters in each region from the active config.
   std::map<std::string, int> voter_distribution;
 
@@ -1639,9 +2808,82 @@ int64_t PeerMessageQueue::ComputeNewWatermarkStaticMode(int64_t* watermark) {
     AdjustVoterDistributionWithCurrentVoters(
         *(queue_state_.active_config), &voter_distribution);
   }
+  region_voter_distribution_ = std::move(voter_distribution);
+  return *region_voter_distribution_;
+}
 
-  return DoComputeNewWatermarkStaticMode(
-      voter_distribution, watermarks_by_region, watermark);
+int PeerMessageQueue::LeaderQuorumVotersUnlocked() {
+  if (leader_quorum_voters_.has_value()) {
+    return *leader_quorum_voters_;
+  }
+  const std::string& leader_quorum_id =
+      getQuorumIdUsingCommitRule(local_peer_pb_);
+
+  // Compute total number of voters in each region.
+  std::optional<int> total_from_vd = GetTotalVotersFromVoterDistribution(
+      *(queue_state_.active_config), leader_quorum_id);
+
+  CHECK(total_from_vd.has_value());
+
+  int total_voters_from_voter_distribution = total_from_vd.value();
+
+  // Compute number of voters in each region in the active config.
+  // As voter distribution provided in topology config can lag,
+  // we need to take into account the active voters as well due to
+  // membership changes.
+  // Check for more comments in AdjustVoterDistributionWithCurrentVoters() which
+  // does the same for static mode watermark calculation
+  int total_voters_from_active_config = 0;
+  for (const RaftPeerPB& peer_pb : queue_state_.active_config->peers()) {
+    if (!peer_pb.has_member_type() ||
+        peer_pb.member_type() != RaftPeerPB::VOTER) {
+      continue;
+    }
+
+    CHECK(peer_pb.has_permanent_uuid());
+    const std::string& peer_pb_quorum_id = getQuorumIdUsingCommitRule(peer_pb);
+    if (peer_pb_quorum_id != leader_quorum_id) {
+      // In dynamic mode, only the leader region matters
+      continue;
+    }
+
+    total_voters_from_active_config++;
+  }
+
+  int total_voters = std::max(
+      total_voters_from_voter_distribution, total_voters_from_active_config);
+
+  // adjust_voter_distribution_ is set to false on in cases where we want to
+  // perform an election forcefully i.e. unsafe config change
+  if (PREDICT_FALSE(!adjust_voter_distribution_)) {
+    total_voters = total_voters_from_voter_distribution;
+  }
+
+  DCHECK(total_voters >= 1 || !adjust_voter_distribution_);
+  leader_quorum_voters_ = total_voters;
+  return total_voters;
+}
+
+void PeerMessageQueue::UpdateReplicatedWatermarksUnlocked(
+    const TrackedPeer& peer) {
+  DCHECK(queue_lock_.is_locked());
+  const string& uuid = peer.uuid();
+  // Refer to the comment in AdvanceQueueWatermark method for why only
+  // successful last exchanges are considered.
+  if (peer.peer_pb.member_type() != RaftPeerPB::VOTER ||
+      peer.last_exchange_status != PeerStatus::OK) {
+    replicated_by_region_.Erase(uuid);
+    replicated_in_leader_quorum_.Erase(uuid);
+    return;
+  }
+  const int64_t index = CommitQuorumIndexUnlocked(peer);
+  replicated_by_region_.Set(uuid, peer.peer_pb.attrs().region(), index);
+  if (peer.is_peer_in_local_quorum.has_value() &&
+      peer.is_peer_in_local_quorum.value()) {
+    replicated_in_leader_quorum_.Set(uuid, "", index);
+  } else {
+    replicated_in_leader_quorum_.Erase(uuid);
+  }
 }
 
 void PeerMessageQueue::AdvanceMajorityReplicatedWatermarkFlexiRaft(
@@ -1660,22 +2902,43 @@ void PeerMessageQueue::AdvanceMajorityReplicatedWatermarkFlexiRaft(
         << "Current value: " << *watermark;
   }
 
-  // Update the watermark based on the acknowledgements so far.
+  // Update the watermark based on the acknowledgements so far. The last
+  // received indexes are kept sorted by quorum as the peers respond, so this
+  // is the work of ComputeNewWatermarkStaticMode() and
+  // ComputeNewWatermarkDynamicMode() without visiting every peer.
   int64_t old_watermark = -1;
-  if (queue_state_.active_config->commit_rule().mode() ==
-      QuorumMode::SINGLE_REGION_DYNAMIC) {
+  const QuorumMode mode = queue_state_.active_config->commit_rule().mode();
+  if (mode == QuorumMode::SINGLE_REGION_DYNAMIC) {
     const std::string& leader_quorum =
         getQuorumIdUsingCommitRule(local_peer_pb_);
     const std::string& peer_quorum =
         getQuorumIdUsingCommitRule(who_caused->peer_pb);
 
     // In SINGLE_REGION_DYNAMIC mode, only an ack from the leader region can
-    // advance the watermark. Skip this expensive operation otherwise
+    // advance the watermark.
     if (leader_quorum == peer_quorum) {
-      old_watermark = ComputeNewWatermarkDynamicMode(watermark);
+      old_watermark = *watermark;
+      const int commit_req = MajoritySize(LeaderQuorumVotersUnlocked());
+      std::optional<int64_t> new_watermark =
+          replicated_in_leader_quorum_.KthHighest("", commit_req);
+      if (new_watermark.has_value()) {
+        *watermark = *new_watermark;
+      } else if (VLOG_IS_ON(3)) {
+        VLOG_WITH_PREFIX_UNLOCKED(3)
+            << "Watermarks size: " << replicated_in_leader_quorum_.NumPeers("")
+            << ", Num peers required: " << commit_req
+            << ", Quorum: " << leader_quorum;
+      }
     }
+  } else if (IsStaticQuorumMode(mode)) {
+    const RegionalWatermarkFn regional_watermark =
+        [this](const std::string& region, int num_required) {
+          return replicated_by_region_.KthHighest(region, num_required);
+        };
+    old_watermark = DoComputeNewWatermarkStaticMode(
+        RegionVoterDistributionUnlocked(), regional_watermark, watermark);
   } else {
-    old_watermark = ComputeNewWatermarkStaticMode(watermark);
+    old_watermark = *watermark;
   }
 
   VLOG_WITH_PREFIX_UNLOCKED(1)
@@ -1683,10 +2946,115 @@ void PeerMessageQueue::AdvanceMajorityReplicatedWatermarkFlexiRaft(
       << "from " << old_watermark << " to " << (*watermark);
 }
 
+MonoTime PeerMessageQueue::LeaderLeaseExpiry(const MonoDelta& lease_duration) {
+  std::lock_guard<simple_mutexlock> lock(queue_lock_);
+  if (queue_state_.mode != LEADER) {
+    return MonoTime();
+  }
+  int64_t granted_at = ComputeLeaseGrantedAtUnlocked();
+  if (granted_at < 0) {
+    return MonoTime();
+  }
+  return MonoTime::Min() + MonoDelta::FromNanoseconds(granted_at) +
+      lease_duration;
+}
+
+void PeerMessageQueue::RevokeLeaderLease(const MonoDelta& delay) {
+  std::lock_guard<simple_mutexlock> lock(queue_lock_);
+  lease_not_before_ = MonoTime::Now() + delay;
+}
+
+bool PeerMessageQueue::ConfirmLeadershipAsync(
+    const MonoTime& since,
+    StdStatusCallback callback) {
+  std::unique_lock<simple_mutexlock> lock(queue_lock_);
+  if (queue_state_.mode != LEADER) {
+    lock.unlock();
+    callback(Status::Aborted("not the leader any more"));
+    return false;
+  }
+  const bool first = leadership_confirmations_.empty();
+  leadership_confirmations_.emplace(since, std::move(callback));
+  // With a single voter there is nobody else to hear from.
+  std::vector<StdStatusCallback> confirmed;
+  TakeConfirmedLeadershipUnlocked(&confirmed);
+  const bool signal_peers = first && !leadership_confirmations_.empty();
+  lock.unlock();
+
+  for (const StdStatusCallback& cb : confirmed) {
+    cb(Status::OK());
+  }
+  return signal_peers;
+}
+
+void PeerMessageQueue::TakeConfirmedLeadershipUnlocked(
+    std::vector<StdStatusCallback>* confirmed) {
+  DCHECK(queue_lock_.is_locked());
+  int64_t granted_at = ComputeLeaseGrantedAtUnlocked();
+  if (granted_at < 0) {
+    return;
+  }
+  const MonoTime confirmed_until =
+      MonoTime::Min() + MonoDelta::FromNanoseconds(granted_at);
+  auto end = leadership_confirmations_.upper_bound(confirmed_until);
+  for (auto it = leadership_confirmations_.begin(); it != end; ++it) {
+    confirmed->emplace_back(std::move(it->second));
+  }
+  leadership_confirmations_.erase(leadership_confirmations_.begin(), end);
+}
+
+void PeerMessageQueue::AbortLeadershipConfirmationsUnlocked(
+    std::vector<StdStatusCallback>* aborted) {
+  DCHECK(queue_lock_.is_locked());
+  for (auto& entry : leadership_confirmations_) {
+    aborted->emplace_back(std::move(entry.second));
+  }
+  leadership_confirmations_.clear();
+}
+
+int64_t PeerMessageQueue::ComputeLeaseGrantedAtUnlocked() {
+  DCHECK(queue_lock_.is_locked());
+  // The local peer doesn't vote for anyone else while it is leader.
+  const MonoTime now = MonoTime::Now();
+  const std::string& local_uuid = local_peer_pb_.permanent_uuid();
+  const MonoTime& not_before = lease_not_before_;
+  const PeerWatermarkFn granted_at = [&](const TrackedPeer& peer) {
+    const MonoTime& t = peer.uuid() == local_uuid ? now : peer.lease_granted_at;
+    if (!t.Initialized() || (not_before.Initialized() && t < not_before)) {
+      return static_cast<int64_t>(-1);
+    }
+    return (t - MonoTime::Min()).ToNanoseconds();
+  };
+
+  int64_t lease_watermark = -1;
+  if (!FLAGS_enable_flexi_raft) {
+    std::vector<int64_t> grants;
+    for (const PeersMap::value_type& peer : peers_map_) {
+      if (peer.second->peer_pb.member_type() == RaftPeerPB::VOTER &&
+          peer.second->last_exchange_status == PeerStatus::OK) {
+        grants.push_back(granted_at(*peer.second));
+      }
+    }
+    const int required = queue_state_.majority_size_;
+    if (required > 0 && grants.size() >= static_cast<size_t>(required)) {
+      std::sort(grants.begin(), grants.end());
+      lease_watermark = grants[grants.size() - required];
+    }
+  } else if (
+      queue_state_.active_config->commit_rule().mode() ==
+      QuorumMode::SINGLE_REGION_DYNAMIC) {
+    ComputeNewWatermarkDynamicMode(&lease_watermark, granted_at);
+  } else {
+    ComputeNewWatermarkStaticMode(&lease_watermark, granted_at);
+  }
+  return lease_watermark;
+}
+
 void PeerMessageQueue::BeginWatchForSuccessor(
     const boost::optional<string>& successor_uuid,
     const std::function<bool(const kudu::consensus::RaftPeerPB&)>& filter_fn,
-    PeerMessageQueue::TransferContext transfer_context) {
+    PeerMessageQueue::TransferContext transfer_context,
+    bool prioritize_successor) {
   std::lock_guard<simple_mutexlock> l(queue_lock_);
 
   transfer_context_ = std::move(transfer_context);
@@ -1705,16 +3073,51 @@ void PeerMessageQueue::BeginWatchForSuccessor(
 
   successor_watch_in_progress_ = true;
   designated_successor_uuid_ = successor_uuid;
+  prioritize_successor_ = prioritize_successor && successor_uuid;
   tl_filter_fn_ = filter_fn;
 }
 
 void PeerMessageQueue::EndWatchForSuccessor() {
   std::lock_guard<simple_mutexlock> l(queue_lock_);
   successor_watch_in_progress_ = false;
+  prioritize_successor_ = false;
   transfer_context_ = boost::none;
   tl_filter_fn_ = nullptr;
 }
 
+bool PeerMessageQueue::SuccessorWithinLag(int64_t max_lag_ops) {
+  std::lock_guard<simple_mutexlock> l(queue_lock_);
+  if (!successor_watch_in_progress_) {
+    return true;
+  }
+  if (queue_state_.mode != LEADER || !queue_state_.active_config) {
+    return false;
+  }
+
+  int64_t max_received_index = -1;
+  for (const PeersMap::value_type& entry : peers_map_) {
+    const TrackedPeer& peer = *entry.second;
+    if (peer.uuid() == local_peer_pb_.permanent_uuid() ||
+        peer.last_exchange_status != PeerStatus::OK ||
+        (designated_successor_uuid_ &&
+         peer.uuid() != *designated_successor_uuid_) ||
+        !IsRaftConfigVoter(peer.uuid(), *queue_state_.active_config)) {
+      continue;
+    }
+    if (!designated_successor_uuid_ && tl_filter_fn_ &&
+        tl_filter_fn_(peer.peer_pb)) {
+      continue;
+    }
+    if (ApplyBacklogExceeded(peer.apply_backlog_ops)) {
+      continue;
+    }
+    max_received_index =
+        std::max(max_received_index, peer.last_received.index());
+  }
+  return max_received_index >= 0 &&
+      queue_state_.last_appended.index() - max_received_index <= max_lag_ops;
+}
+
 bool PeerMessageQueue::WatchForSuccessorPeerNotified() {
   std::lock_guard<simple_mutexlock> l(queue_lock_);
   return successor_watch_peer_notified_;
@@ -1727,6 +3130,33 @@ Status PeerMessageQueue::GetNextRoutingHopFromLeader(
       local_peer_pb_.permanent_uuid(), dest_uuid, next_hop);
 }
 
+bool PeerMessageQueue::IsPeerInRemoteRegion(const string& uuid) const {
+  std::lock_guard<simple_mutexlock> l(queue_lock_);
+  const TrackedPeer* peer = FindPtrOrNull(peers_map_, uuid);
+  return peer != nullptr && peer->is_peer_in_local_region.has_value() &&
+      !peer->is_peer_in_local_region.value();
+}
+
+bool PeerMessageQueue::IsLightweightPeer(const string& uuid, bool* is_voter)
+    const {
+  std::lock_guard<simple_mutexlock> l(queue_lock_);
+  const TrackedPeer* peer = FindPtrOrNull(peers_map_, uuid);
+  if (peer == nullptr || !peer->is_peer_in_local_region.has_value() ||
+      peer->is_peer_in_local_region.value()) {
+    return false;
+  }
+  const RaftPeerPB& peer_pb = peer->peer_pb;
+  const bool voter = peer_pb.member_type() == RaftPeerPB::VOTER;
+  if (voter && !(peer_pb.attrs().has_backing_db_present() &&
+                 !peer_pb.attrs().backing_db_present())) {
+    return false;
+  }
+  if (is_voter != nullptr) {
+    *is_voter = voter;
+  }
+  return true;
+}
+
 void PeerMessageQueue::UpdateFollowerWatermarks(
     int64_t committed_index,
     int64_t all_replicated_index,
@@ -1761,7 +3191,31 @@ void PeerMessageQueue::UpdatePeerStatus(
             << " is no longer tracked or queue is not in leader mode";
     return;
   }
+  // Requests pipelined after a failed one are unlikely to be accepted: resume
+  // from what the peer is known to have. Only requests to a peer in good
+  // standing are pipelined.
+  if (ps != PeerStatus::OK && peer->last_exchange_status == PeerStatus::OK &&
+      FLAGS_consensus_max_inflight_requests_per_peer > 1) {
+    peer->next_index = peer->last_received.index() + 1;
+  }
   peer->last_exchange_status = ps;
+  UpdateReplicatedWatermarksUnlocked(*peer);
+  if (FLAGS_consensus_adaptive_batch_sizing && ps != PeerStatus::OK) {
+    AdaptBatchSizeUnlocked(peer);
+  }
+  if (ps != PeerStatus::OK &&
+      peer_uuid != local_peer_pb_.permanent_uuid()) {
+    peer_health_history_.RecordError(
+        peer_uuid,
+        peer->last_received.index(),
+        queue_state_.last_appended.index(),
+        MonoTime::Now());
+  }
+  if (ps == PeerStatus::RPC_LAYER_ERROR &&
+      peer_uuid != local_peer_pb_.permanent_uuid()) {
+    // Stop proxying through a peer that can't be reached.
+    routing_table_container_->SetPeerReachable(peer_uuid, false);
+  }
 
   if (ps != PeerStatus::RPC_LAYER_ERROR) {
     // So long as we got _any_ response from the follower, we consider it a
@@ -1816,7 +3270,7 @@ void PeerMessageQueue::UpdatePeerStatus(
 
 void PeerMessageQueue::UpdateExchangeStatus(
     TrackedPeer* peer,
-    const TrackedPeer& prev_peer_state,
+    const TrackedPeer::Progress& prev_peer_state,
     const ConsensusResponsePB& response,
     bool* lmp_mismatch) {
   DCHECK(queue_lock_.is_locked());
@@ -1830,6 +3284,11 @@ void PeerMessageQueue::UpdateExchangeStatus(
     peer->last_exchange_status = PeerStatus::OK;
     peer->last_successful_exchange = now;
     *lmp_mismatch = false;
+    if (PREDICT_FALSE(peer->lmp_mismatch_round_trips > 0)) {
+      metrics_.lmp_mismatch_round_trips->Increment(
+          peer->lmp_mismatch_round_trips);
+      peer->lmp_mismatch_round_trips = 0;
+    }
     if (peer->should_send_compression_dict) {
       LOG_WITH_PREFIX_UNLOCKED(INFO)
           << "Resetting compression dict flag for peer: " << peer->ToString();
@@ -1841,6 +3300,7 @@ void PeerMessageQueue::UpdateExchangeStatus(
   switch (status.error().code()) {
     case ConsensusErrorPB::PRECEDING_ENTRY_DIDNT_MATCH:
       peer->last_exchange_status = PeerStatus::LMP_MISMATCH;
+      peer->lmp_mismatch_round_trips++;
       DCHECK(status.has_last_received());
       if (prev_peer_state.last_exchange_status == PeerStatus::NEW) {
         LOG_WITH_PREFIX_UNLOCKED(INFO)
@@ -1873,7 +3333,7 @@ void PeerMessageQueue::UpdateExchangeStatus(
 
 void PeerMessageQueue::PromoteIfNeeded(
     TrackedPeer* peer,
-    const TrackedPeer& prev_peer_state,
+    const TrackedPeer::Progress& prev_peer_state,
     const ConsensusStatusPB& status) {
   DCHECK(queue_lock_.is_locked());
   if (queue_state_.mode != PeerMessageQueue::LEADER ||
@@ -1954,6 +3414,15 @@ bool PeerMessageQueue::BasicChecksOKToTransferAndGetPeerUnlocked(
     return false;
   }
 
+  // It would have to apply its backlog before serving as the leader.
+  if (ApplyBacklogExceeded(peer.apply_backlog_ops)) {
+    KLOG_EVERY_N_SECS_THROTTLER(
+        WARNING, 60, *peer.status_log_throttler, "apply_backlog_transfer")
+        << LogPrefixUnlocked() << "Target peer " << peer.uuid() << " has "
+        << peer.apply_backlog_ops << " committed ops left to apply";
+    return false;
+  }
+
   return true;
 }
 
@@ -2021,14 +3490,25 @@ void PeerMessageQueue::TransferLeadershipIfNeeded(
 
 bool PeerMessageQueue::ResponseFromPeer(
     const std::string& peer_uuid,
-    const ConsensusResponsePB& response) {
+    const ConsensusResponsePB& response,
+    const MonoDelta& rpc_round_trip,
+    const MonoTime& request_send_time) {
   boost::optional<int64_t> updated_commit_index;
-  const bool ret =
-      DoResponseFromPeer(peer_uuid, response, updated_commit_index);
+  std::vector<StdStatusCallback> confirmed_leadership;
+  const bool ret = DoResponseFromPeer(
+      peer_uuid,
+      response,
+      rpc_round_trip,
+      request_send_time,
+      updated_commit_index,
+      confirmed_leadership);
 
   if (updated_commit_index != boost::none) {
     NotifyObserversOfCommitIndexChange(*updated_commit_index);
   }
+  for (const StdStatusCallback& callback : confirmed_leadership) {
+    callback(Status::OK());
+  }
 
   return ret;
 }
@@ -2036,7 +3516,10 @@ bool PeerMessageQueue::ResponseFromPeer(
 bool PeerMessageQueue::DoResponseFromPeer(
     const std::string& peer_uuid,
     const ConsensusResponsePB& response,
-    boost::optional<int64_t>& updated_commit_index) {
+    const MonoDelta& rpc_round_trip,
+    const MonoTime& request_send_time,
+    boost::optional<int64_t>& updated_commit_index,
+    std::vector<StdStatusCallback>& confirmed_leadership) {
   DCHECK(response.IsInitialized())
       << "Error: Uninitialized: " << response.InitializationErrorString()
       << ". Response: " << SecureShortDebugString(response);
@@ -2055,10 +3538,11 @@ bool PeerMessageQueue::DoResponseFromPeer(
 
     TrackedPeer* peer = FindPtrOrNull(peers_map_, peer_uuid);
     if (PREDICT_FALSE(queue_state_.state != kQueueOpen || peer == nullptr)) {
-      LOG_WITH_PREFIX_UNLOCKED(WARNING)
+      KLOG_EVERY_N_SECS(WARNING, 1)
+          << LogPrefixUnlocked()
           << "Queue is closed or peer was untracked, disregarding "
              "peer response. Response: "
-          << SecureShortDebugString(response);
+          << SecureShortDebugString(response) << THROTTLE_MSG;
       return send_more_immediately;
     }
 
@@ -2084,8 +3568,10 @@ bool PeerMessageQueue::DoResponseFromPeer(
     DCHECK(status.has_last_received_current_leader());
     DCHECK(status.has_last_committed_idx());
 
+    RecordPeerLatenciesUnlocked(*peer, response, rpc_round_trip);
+
     // Take a snapshot of the previously-recorded peer state.
-    const TrackedPeer prev_peer_state = *peer;
+    const TrackedPeer::Progress prev_peer_state = peer->progress();
 
     // Update the peer's last exchange status based on the response.
     // In this case, if there is a log matching property (LMP) mismatch, we
@@ -2104,7 +3590,14 @@ bool PeerMessageQueue::DoResponseFromPeer(
     if (peer_has_prefix_of_log) {
       // If the latest thing in their log is in our log, we are in sync.
       peer->last_received = status.last_received();
-      peer->next_index = peer->last_received.index() + 1;
+      if (FLAGS_consensus_max_inflight_requests_per_peer > 1 &&
+          peer->last_exchange_status == PeerStatus::OK) {
+        // Don't step back over the ops of requests still in flight.
+        peer->next_index =
+            std::max(peer->next_index, peer->last_received.index() + 1);
+      } else {
+        peer->next_index = peer->last_received.index() + 1;
+      }
 
       // Check if the peer is a NON_VOTER candidate ready for promotion.
       PromoteIfNeeded(peer, prev_peer_state, status);
@@ -2118,6 +3611,17 @@ bool PeerMessageQueue::DoResponseFromPeer(
       peer->last_received = status.last_received_current_leader();
       peer->next_index = peer->last_received.index() + 1;
 
+    } else if (
+        status.has_conflict_term() &&
+        NextIndexFromConflictUnlocked(*peer, status, &peer->next_index)) {
+      // The peer told where the term of its divergent op starts, so the
+      // ops of that term it doesn't share with us are skipped at once rather
+      // than stepped back over, or sent again from its committed index.
+      LOG_WITH_PREFIX_UNLOCKED(INFO)
+          << "Peer " << peer_uuid << " log diverges from this leader's "
+          << "in term " << status.conflict_term() << " from index "
+          << status.conflict_term_first_index() << " on, "
+          << "resuming from index " << peer->next_index;
     } else {
       // The peer is divergent and they have not (successfully) received
       // anything from us yet. Start sending from their last committed index.
@@ -2136,6 +3640,37 @@ bool PeerMessageQueue::DoResponseFromPeer(
           << peer->last_known_committed_index;
     }
 
+    // Past 'last_received' the peer's log may not match ours, durable or not.
+    peer->last_durable_index = status.has_last_durable_idx()
+        ? std::min(status.last_durable_idx(), peer->last_received.index())
+        : peer->last_received.index();
+    peer->apply_backlog_ops = status.apply_backlog_ops();
+
+    UpdateReplicatedWatermarksUnlocked(*peer);
+
+    if (FLAGS_consensus_adaptive_batch_sizing) {
+      AdaptBatchSizeUnlocked(peer);
+    }
+
+    if (peer_uuid != local_peer_pb_.permanent_uuid()) {
+      routing_table_container_->SetPeerReachable(peer_uuid, true);
+      if (peer->last_exchange_status == PeerStatus::OK) {
+        peer_health_history_.RecordExchange(
+            peer_uuid,
+            prev_peer_state.last_received.index(),
+            peer->last_received.index(),
+            queue_state_.last_appended.index(),
+            rpc_round_trip,
+            MonoTime::Now());
+      } else {
+        peer_health_history_.RecordError(
+            peer_uuid,
+            peer->last_received.index(),
+            queue_state_.last_appended.index(),
+            MonoTime::Now());
+      }
+    }
+
     if (peer->last_exchange_status != PeerStatus::OK) {
       // In this case, 'send_more_immediately' has already been set by
       // UpdateExchangeStatus() to true in the case of an LMP mismatch, false
@@ -2143,6 +3678,22 @@ bool PeerMessageQueue::DoResponseFromPeer(
       return send_more_immediately;
     }
 
+    if (peer_uuid != local_peer_pb_.permanent_uuid()) {
+      op_tracer_.RecordAcked(
+          peer_uuid,
+          peer->last_received.index(),
+          response.has_update_lock_wait_us() ? response.update_lock_wait_us()
+                                             : -1,
+          response.has_log_append_us() ? response.log_append_us() : -1);
+      if (queue_state_.mode == LEADER && rpc_round_trip.Initialized()) {
+        routing_table_container_->RecordRoundTrip(
+            peer_uuid,
+            response.has_proxy_uuid() ? response.proxy_uuid() : "",
+            rpc_round_trip,
+            MonoDelta::FromMicroseconds(response.proxy_downstream_rtt_us()));
+      }
+    }
+
     if (response.has_responder_term()) {
       // The peer must have responded with a term that is greater than or equal
       // to the last known term for that peer.
@@ -2151,6 +3702,17 @@ bool PeerMessageQueue::DoResponseFromPeer(
       // If the responder didn't send an error back that must mean that it has
       // a term that is the same or lower than ours.
       CHECK_LE(response.responder_term(), queue_state_.current_term);
+
+      // The peer now withholds its vote until a while after it got the
+      // request.
+      if (request_send_time.Initialized() &&
+          response.responder_term() == queue_state_.current_term &&
+          request_send_time > peer->lease_granted_at) {
+        peer->lease_granted_at = request_send_time;
+        if (!leadership_confirmations_.empty()) {
+          TakeConfirmedLeadershipUnlocked(&confirmed_leadership);
+        }
+      }
     }
 
     if (PREDICT_FALSE(VLOG_IS_ON(2))) {
@@ -2179,13 +3741,14 @@ bool PeerMessageQueue::DoResponseFromPeer(
             /*replicated_after=*/peer->last_received,
             /*num_peers_required=*/queue_state_.majority_size_,
             VOTER_REPLICAS,
+            COMMIT_QUORUM_OPS,
             peer);
       } else if (
-          peer->last_received.index() >
+          CommitQuorumIndexUnlocked(*peer) >
               queue_state_.majority_replicated_index ||
           peer->last_exchange_status != PeerStatus::OK) {
-        // This method is expensive. The 'watermark' can change only if this
-        // peer's last received index is higer than the current
+        // The 'watermark' can change only if this
+        // peer's commit quorum index is higer than the current
         // majority_replicated_index. We also call this method when the
         // last_exhange_status of the peer indicates an error. This is because
         // 'majority_replicated_index' can go down. It sould be safe to
@@ -2198,6 +3761,22 @@ bool PeerMessageQueue::DoResponseFromPeer(
             /*replicated_after=*/peer->last_received,
             peer);
       }
+      if (durability_mode_ != DurabilityMode::DURABLE) {
+        AdvanceQueueWatermark(
+            "majority_durable",
+            &queue_state_.majority_durable_index,
+            /*replicated_before=*/prev_peer_state.last_received,
+            /*replicated_after=*/peer->last_received,
+            /*num_peers_required=*/queue_state_.majority_size_,
+            VOTER_REPLICAS,
+            DURABLE_OPS,
+            peer);
+      }
+      RecordTimeToMajorityUnlocked();
+      op_tracer_.RecordStage(
+          0,
+          queue_state_.majority_replicated_index,
+          OpTracer::kMajorityReplicated);
 
       old_all_replicated_index = queue_state_.all_replicated_index;
 
@@ -2209,6 +3788,7 @@ bool PeerMessageQueue::DoResponseFromPeer(
           /*replicated_after=*/peer->last_received,
           /*num_peers_required=*/peers_map_.size(),
           ALL_REPLICAS,
+          RECEIVED_OPS,
           peer);
 
       new_all_replicated_index = queue_state_.all_replicated_index;
@@ -2222,13 +3802,21 @@ bool PeerMessageQueue::DoResponseFromPeer(
       // majority-replicated index can currently go down, since we don't
       // consider peers whose last contact was an error in the watermark
       // calculation. See the TODO in AdvanceQueueWatermark() for more details.
+      //
+      // In LEADER_DURABLE mode, the ops must be durable here too.
+      int64_t commit_quorum_index = queue_state_.majority_replicated_index;
+      if (durability_mode_ == DurabilityMode::LEADER_DURABLE) {
+        const TrackedPeer* local_peer =
+            FindPtrOrNull(peers_map_, local_peer_pb_.permanent_uuid());
+        commit_quorum_index = local_peer == nullptr
+            ? queue_state_.committed_index
+            : std::min(commit_quorum_index, local_peer->last_received.index());
+      }
       int64_t commit_index_before = queue_state_.committed_index;
       if (queue_state_.first_index_in_current_term != boost::none &&
-          queue_state_.majority_replicated_index >=
-              queue_state_.first_index_in_current_term &&
-          queue_state_.majority_replicated_index >
-              queue_state_.committed_index) {
-        queue_state_.committed_index = queue_state_.majority_replicated_index;
+          commit_quorum_index >= queue_state_.first_index_in_current_term &&
+          commit_quorum_index > queue_state_.committed_index) {
+        queue_state_.committed_index = commit_quorum_index;
       } else {
         VLOG_WITH_PREFIX_UNLOCKED(2)
             << "Cannot advance commit index, waiting for > "
@@ -2242,6 +3830,7 @@ bool PeerMessageQueue::DoResponseFromPeer(
       // Once the commit index has been updated, go ahead and update the
       // region_durable_index
       AdvanceQueueRegionDurableIndex();
+      AdvanceLocalRegionDurableIndexUnlocked();
 
       // Only notify observers if the commit index actually changed.
       if (mode_copy == LEADER &&
@@ -2260,12 +3849,34 @@ bool PeerMessageQueue::DoResponseFromPeer(
         peer->last_known_committed_index < queue_state_.committed_index ||
         log_cache_.HasOpBeenWritten(peer->next_index);
 
+    // Lets the log cache tell the ops that only slow peers still need, and
+    // those no peer needs, from the rest.
+    int64_t slowest_next_index = queue_state_.all_replicated_index + 1;
+    int64_t fastest_next_index = slowest_next_index;
+    if (mode_copy == LEADER) {
+      bool first = true;
+      for (const auto& entry : peers_map_) {
+        const TrackedPeer* tracked = entry.second;
+        if (tracked->uuid() == local_peer_pb_.permanent_uuid()) {
+          continue;
+        }
+        if (first) {
+          slowest_next_index = fastest_next_index = tracked->next_index;
+          first = false;
+        }
+        slowest_next_index = std::min(slowest_next_index, tracked->next_index);
+        fastest_next_index = std::max(fastest_next_index, tracked->next_index);
+      }
+    }
+    log_cache_.SetPeerNextIndexes(slowest_next_index, fastest_next_index);
+
     // Evict ops from log_cache only if:
     // 1. This is not a leader node OR
     // 2. 'all_replicated_index' has changed after processing this response
     if (mode_copy != LEADER ||
         (old_all_replicated_index != new_all_replicated_index)) {
       log_cache_.EvictThroughOp(queue_state_.all_replicated_index);
+      DropSharedBatchesBefore(queue_state_.all_replicated_index);
     }
 
     UpdateMetricsUnlocked();
@@ -2286,6 +3897,26 @@ int64_t PeerMessageQueue::GetAllReplicatedIndex() const {
   return queue_state_.all_replicated_index;
 }
 
+void PeerMessageQueue::GetPeerLag(vector<PeerLag>* peers) const {
+  peers->clear();
+  MonoTime now = MonoTime::Now();
+  std::lock_guard<simple_mutexlock> lock(queue_lock_);
+  if (queue_state_.mode != LEADER) {
+    return;
+  }
+  for (const auto& entry : peers_map_) {
+    const TrackedPeer* peer = entry.second;
+    if (peer->uuid() == local_peer_pb_.permanent_uuid()) {
+      continue;
+    }
+    PeerLag lag;
+    lag.uuid = peer->uuid();
+    lag.last_received_index = peer->last_received.index();
+    lag.time_since_last_exchange = now - peer->last_successful_exchange;
+    peers->push_back(std::move(lag));
+  }
+}
+
 int64_t PeerMessageQueue::GetCommittedIndex() const {
   std::lock_guard<simple_mutexlock> lock(queue_lock_);
   return queue_state_.committed_index;
@@ -2296,6 +3927,11 @@ int64_t PeerMessageQueue::GetRegionDurableIndex() const {
   return queue_state_.region_durable_index;
 }
 
+int64_t PeerMessageQueue::GetLocalRegionDurableIndex() const {
+  std::lock_guard<simple_mutexlock> lock(queue_lock_);
+  return queue_state_.local_region_durable_index;
+}
+
 bool PeerMessageQueue::IsCommittedIndexInCurrentTerm() const {
   std::lock_guard<simple_mutexlock> lock(queue_lock_);
   return queue_state_.first_index_in_current_term != boost::none &&
@@ -2324,6 +3960,21 @@ void PeerMessageQueue::UpdateMetricsUnlocked() {
           : 0);
   metrics_.num_in_progress_ops->set_value(
       queue_state_.last_appended.index() - queue_state_.committed_index);
+  metrics_.num_local_region_durable_lead_ops->set_value(
+      queue_state_.mode == LEADER
+          ? std::max<int64_t>(
+                0,
+                queue_state_.local_region_durable_index -
+                    queue_state_.committed_index)
+          : 0);
+  metrics_.num_committed_not_durable_ops->set_value(
+      queue_state_.mode == LEADER &&
+              durability_mode_ != DurabilityMode::DURABLE
+          ? std::max<int64_t>(
+                0,
+                queue_state_.committed_index -
+                    queue_state_.majority_durable_index)
+          : 0);
 
   UpdateLagMetricsUnlocked();
 }
@@ -2370,20 +4021,84 @@ void PeerMessageQueue::DumpToHtml(std::ostream& out) const {
   out << "</table>" << endl;
   out << "<p>" << queue_state_.ToString() << "</p>" << endl;
 
+  out << "<h3>Batch sizing</h3>" << endl;
+  out << "<p>Adaptive batch sizing is "
+      << (FLAGS_consensus_adaptive_batch_sizing ? "enabled" : "disabled")
+      << ".</p>" << endl;
+  out << "<table>" << endl;
+  out << "  <tr><th>Peer</th><th>Batch size limit</th>"
+      << "<th>Last round trip</th><th>Lowest round trip</th></tr>" << endl;
+  for (const PeersMap::value_type& entry : peers_map_) {
+    const TrackedPeer* peer = entry.second;
+    out << Substitute(
+               "  <tr><td>$0</td><td>$1</td><td>$2</td><td>$3</td></tr>",
+               EscapeForHtmlToString(entry.first),
+               HumanReadableNumBytes::ToString(peer->batch_size_limit),
+               peer->last_batch_rtt.Initialized()
+                   ? peer->last_batch_rtt.ToString()
+                   : "-",
+               peer->min_batch_rtt.Initialized()
+                   ? peer->min_batch_rtt.ToString()
+                   : "-")
+        << endl;
+  }
+  out << "</table>" << endl;
+
+  out << "<h3>Replication latency</h3>" << endl;
+  out << "<p>p50 / p99 / max. Time to majority: "
+      << LatencySummary(*metrics_.op_time_to_majority->histogram())
+      << ".</p>" << endl;
+  out << "<table>" << endl;
+  out << "  <tr><th>Peer</th><th>Request build</th><th>RPC round trip</th>"
+      << "<th>Follower update lock wait</th><th>Follower log append</th></tr>"
+      << endl;
+  for (const PeersMap::value_type& entry : peers_map_) {
+    const PeerLatencies* latencies = entry.second->latencies.get();
+    if (latencies == nullptr) {
+      continue;
+    }
+    out << Substitute(
+               "  <tr><td>$0</td><td>$1</td><td>$2</td><td>$3</td><td>$4</td>"
+               "</tr>",
+               EscapeForHtmlToString(entry.first),
+               LatencySummary(latencies->request_build),
+               LatencySummary(latencies->rpc_round_trip),
+               LatencySummary(latencies->update_lock_wait),
+               LatencySummary(latencies->log_append))
+        << endl;
+  }
+  out << "</table>" << endl;
+
+  peer_health_history_.DumpToHtml(out);
+  op_tracer_.DumpToHtml(out);
   log_cache_.DumpToHtml(out);
 }
 
 void PeerMessageQueue::ClearUnlocked() {
   DCHECK(queue_lock_.is_locked());
   STLDeleteValues(&peers_map_);
+  replicated_by_region_.Clear();
+  replicated_in_leader_quorum_.Clear();
   queue_state_.state = kQueueClosed;
 }
 
 void PeerMessageQueue::Close() {
   raft_pool_observers_token_->Shutdown();
+  log_cache_.ShutdownPrefetch();
 
-  std::lock_guard<simple_mutexlock> lock(queue_lock_);
-  ClearUnlocked();
+  std::vector<StdStatusCallback> aborted;
+  {
+    std::lock_guard<simple_mutexlock> lock(queue_lock_);
+    AbortLeadershipConfirmationsUnlocked(&aborted);
+    ClearUnlocked();
+  }
+  for (const StdStatusCallback& callback : aborted) {
+    callback(Status::Aborted("queue closed"));
+  }
+}
+
+string PeerMessageQueue::PeerHealthHistoryJson() const {
+  return peer_health_history_.ToJson();
 }
 
 int64_t PeerMessageQueue::GetQueuedOperationsSizeBytesForTests() const {
@@ -2426,6 +4141,54 @@ Status PeerMessageQueue::UnRegisterObserver(
   return Status::OK();
 }
 
+bool PeerMessageQueue::NextIndexFromConflictUnlocked(
+    const TrackedPeer& peer,
+    const ConsensusStatusPB& status,
+    int64_t* next_index) const {
+  DCHECK(queue_lock_.is_locked());
+  const int64_t conflict_term = status.conflict_term();
+  // The peer's committed ops are in our log, and its ops of the conflicting
+  // term all come after them, so our op at 'lo' has a term no higher. The
+  // terms only go up along the log: find our last op of a term no higher
+  // than the conflicting one.
+  int64_t lo = std::max<int64_t>(peer.last_known_committed_index, 0);
+  int64_t hi = queue_state_.last_appended.index();
+  OpId op;
+  while (lo < hi) {
+    const int64_t mid = lo + (hi - lo + 1) / 2;
+    Status s = log_cache_.LookupOpId(mid, &op);
+    if (PREDICT_FALSE(!s.ok())) {
+      VLOG_WITH_PREFIX_UNLOCKED(1)
+          << "Couldn't look up op " << mid << " to resume peer "
+          << peer.uuid() << " from its conflicting term: " << s.ToString();
+      return false;
+    }
+    if (op.term() <= conflict_term) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  // If we have ops of the conflicting term, they and the peer's came from
+  // the leader of that term, so one run is a prefix of the other: resume
+  // after ours, and if the peer's is the shorter one its next response tells
+  // where it ends. Otherwise none of the peer's ops of the term are ours.
+  int64_t next = status.conflict_term_first_index();
+  if (lo > 0) {
+    Status s = log_cache_.LookupOpId(lo, &op);
+    if (PREDICT_FALSE(!s.ok())) {
+      return false;
+    }
+    if (op.term() == conflict_term) {
+      next = lo + 1;
+    }
+  }
+  *next_index = std::min(
+      std::max(next, peer.last_known_committed_index + 1),
+      queue_state_.last_appended.index() + 1);
+  return true;
+}
+
 bool PeerMessageQueue::IsOpInLog(const OpId& desired_op) const {
   OpId log_op;
   Status s = log_cache_.LookupOpId(desired_op.index(), &log_op);
@@ -2451,15 +4214,49 @@ void PeerMessageQueue::NotifyObserversOfCommitIndexChange(
   }
   // NOTE: if we're scheduling this to run async we always need to lock, so we
   // ignore the needs_lock param
-  WARN_NOT_OK(
-      raft_pool_observers_token_->SubmitClosure(Bind(
-          &PeerMessageQueue::NotifyObserversTask,
-          Unretained(this),
-          [=](PeerMessageQueueObserver* observer) {
-            observer->NotifyCommitIndex(new_commit_index, true);
-          })),
-      LogPrefixUnlocked() +
-          "Unable to notify RaftConsensus of commit index change.");
+  {
+    std::lock_guard<simple_spinlock> l(commit_notification_lock_);
+    pending_commit_index_ = has_pending_commit_index_
+        ? std::max(pending_commit_index_, new_commit_index)
+        : new_commit_index;
+    if (has_pending_commit_index_) {
+      metrics_.num_coalesced_commit_notifications->Increment();
+    }
+    has_pending_commit_index_ = true;
+    if (commit_notifier_running_) {
+      return;
+    }
+    commit_notifier_running_ = true;
+  }
+  Status s = raft_pool_observers_token_->SubmitClosure(Bind(
+      &PeerMessageQueue::NotifyPendingCommitIndexTask, Unretained(this)));
+  if (PREDICT_FALSE(!s.ok())) {
+    WARN_NOT_OK(
+        s,
+        LogPrefixUnlocked() +
+            "Unable to notify RaftConsensus of commit index change.");
+    std::lock_guard<simple_spinlock> l(commit_notification_lock_);
+    commit_notifier_running_ = false;
+    has_pending_commit_index_ = false;
+  }
+}
+
+void PeerMessageQueue::NotifyPendingCommitIndexTask() {
+  while (true) {
+    int64_t commit_index;
+    {
+      std::lock_guard<simple_spinlock> l(commit_notification_lock_);
+      if (!has_pending_commit_index_) {
+        commit_notifier_running_ = false;
+        return;
+      }
+      commit_index = pending_commit_index_;
+      has_pending_commit_index_ = false;
+    }
+    NotifyObserversTask([=](PeerMessageQueueObserver* observer) {
+      observer->NotifyCommitIndex(commit_index, true);
+    });
+  }
 }
 
 void PeerMessageQueue::NotifyObserversOfTermChange(int64_t term) {
@@ -2552,6 +4349,19 @@ void PeerMessageQueue::NotifyObserversOfPeerHealthChange() {
           "Unable to notify RaftConsensus peer health change.");
 }
 
+void PeerMessageQueue::NotifyObserversOfLocalRegionDurableIndex(
+    int64_t index) {
+  WARN_NOT_OK(
+      raft_pool_observers_token_->SubmitClosure(Bind(
+          &PeerMessageQueue::NotifyObserversTask,
+          Unretained(this),
+          [=](PeerMessageQueueObserver* observer) {
+            observer->NotifyLocalRegionDurableIndex(index);
+          })),
+      LogPrefixUnlocked() +
+          "Unable to notify RaftConsensus of local region durable index.");
+}
+
 void PeerMessageQueue::NotifyObserversTask(
     const std::function<void(PeerMessageQueueObserver*)>& func) {
   MAYBE_INJECT_RANDOM_LATENCY(
@@ -2570,16 +4380,12 @@ PeerMessageQueue::~PeerMessageQueue() {
   Close();
 }
 
-string PeerMessageQueue::LogPrefixUnlocked() const {
+const string& PeerMessageQueue::LogPrefixUnlocked() const {
   // TODO: we should probably use an atomic here. We'll just annotate
   // away the TSAN error for now, since the worst case is a slightly out-of-date
   // log message, and not very likely.
   Mode mode = ANNOTATE_UNPROTECTED_READ(queue_state_.mode);
-  return Substitute(
-      "T $0 P $1 [$2]: ",
-      tablet_id_,
-      local_peer_pb_.permanent_uuid(),
-      mode == LEADER ? "LEADER" : "NON_LEADER");
+  return mode == LEADER ? leader_log_prefix_ : non_leader_log_prefix_;
 }
 
 string PeerMessageQueue::QueueState::ToString() const {
@@ -2620,7 +4426,9 @@ void PeerMessageQueue::UpdatePeerQuorumIdUnlocked(
       entry.second->peer_pb.mutable_attrs()->set_quorum_id(it->second);
     }
     entry.second->PopulateIsPeerInLocalQuorum();
+    UpdateReplicatedWatermarksUnlocked(*entry.second);
   }
+  leader_quorum_voters_.reset();
 }
 
 } // namespace consensus
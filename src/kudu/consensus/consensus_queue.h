@@ -24,9 +24,12 @@
 #ifndef KUDU_CONSENSUS_CONSENSUS_QUEUE_H_
 #define KUDU_CONSENSUS_CONSENSUS_QUEUE_H_
 
+#include <atomic>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <iosfwd>
+#include <map>
 #include <memory>
 #include <optional>
 #include <string>
@@ -37,17 +40,24 @@
 #include <glog/logging.h>
 #include <gtest/gtest_prod.h>
 
+#include "kudu/consensus/durability_mode.h"
 #include "kudu/consensus/log_cache.h"
+#include "kudu/consensus/log_retention_policy.h"
 #include "kudu/consensus/metadata.pb.h"
+#include "kudu/consensus/op_tracer.h"
+#include "kudu/consensus/peer_health_history.h"
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/consensus/persistent_vars.h"
 #include "kudu/consensus/persistent_vars_manager.h"
+#include "kudu/consensus/quorum_watermarks.h"
 #include "kudu/consensus/ref_counted_replicate.h"
 #include "kudu/consensus/routing.h"
 #include "kudu/consensus/time_manager.h"
 #include "kudu/gutil/gscoped_ptr.h"
+#include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/threading/thread_collision_warner.h"
+#include "kudu/util/hdr_histogram.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
@@ -56,10 +66,12 @@
 #include "kudu/util/status_callback.h"
 
 namespace kudu {
+class Throttler;
 class ThreadPoolToken;
 
 namespace log {
 class Log;
+class SequentialReplicateReader;
 }
 
 namespace logging {
@@ -67,11 +79,14 @@ class LogThrottler;
 }
 
 namespace consensus {
+class ConsensusHealthSummaryPB;
 class ConsensusRequestPB;
 class ConsensusResponsePB;
 class ConsensusStatusPB;
+class InstallSnapshotRequestPB;
 class PeerMessageQueueObserver;
 class ReplicateMsgWrapper;
+class SnapshotProvider;
 #ifdef FB_DO_NOT_REMOVE
 class StartTabletCopyRequestPB;
 #endif
@@ -132,7 +147,26 @@ const char* PeerStatusToString(PeerStatus p);
 // modify it.
 class PeerMessageQueue {
  public:
-  struct TrackedPeer {
+  // Where the time to replicate to a peer goes, in microseconds, as shown by
+  // DumpToHtml(). Thread-safe, so recorded without 'queue_lock_' held.
+  struct PeerLatencies {
+    PeerLatencies();
+
+    // Building the requests to the peer.
+    HdrHistogram request_build;
+    // From sending a request to the peer until its response came back.
+    HdrHistogram rpc_round_trip;
+    // As reported by the peer for the requests with ops: the wait for the
+    // previous request to be done with, and appending the ops to its log
+    // until they were durable.
+    HdrHistogram update_lock_wait;
+    HdrHistogram log_append;
+  };
+
+  // Aligned to a cache line, and with the fields that responses update and
+  // that watermark computations scan over all the peers first, so that those
+  // don't share lines with other allocations or with the config fields.
+  struct alignas(CACHELINE_SIZE) TrackedPeer {
     explicit TrackedPeer(RaftPeerPB peer_pb, const PeerMessageQueue* queue);
 
     TrackedPeer() = default;
@@ -153,16 +187,41 @@ class PeerMessageQueue {
 
     std::string ToString() const;
 
-    RaftPeerPB peer_pb;
+    // What ResponseFromPeer() compares before and after handling a response.
+    // Taken instead of a copy of the whole TrackedPeer, which would copy
+    // 'peer_pb' and bump the reference counts of the shared_ptrs below.
+    struct Progress {
+      OpId last_received;
+      PeerStatus last_exchange_status;
+    };
+    Progress progress() const {
+      return Progress{last_received, last_exchange_status};
+    }
 
     // Next index to send to the peer.
     // This corresponds to "nextIndex" as specified in Raft.
+    //
+    // When requests are pipelined (see
+    // --consensus_max_inflight_requests_per_peer) this is optimistically moved
+    // past the ops of each request as it is built, and rolled back to follow
+    // 'last_received' when the peer reports an error.
     int64_t next_index;
 
     // The last operation that we've sent to this peer and that
     // it acked. Used for watermark movement.
     OpId last_received;
 
+    // The index through which the ops the peer acked are durable in its log,
+    // at most 'last_received'. See DurabilityMode.
+    int64_t last_durable_index = 0;
+
+    // The requests the peer refused in a row with an LMP mismatch.
+    int64_t lmp_mismatch_round_trips = 0;
+
+    // The committed ops the peer last reported it had yet to apply. See
+    // --consensus_max_peer_apply_backlog_ops.
+    int64_t apply_backlog_ops = 0;
+
     // The last committed index this peer knows about.
     int64_t last_known_committed_index;
 
@@ -187,13 +246,47 @@ class PeerMessageQueue {
     // successful communication ever took place.
     MonoTime last_communication_time;
 
+    // When the latest request the peer accepted from us in the current term
+    // was sent, see LeaderLeaseExpiry(). Uninitialized if there is none.
+    MonoTime lease_granted_at;
+
     // Set to false if it is determined that the remote peer has fallen behind
     // the local peer's WAL.
     bool wal_catchup_possible;
 
+    // Set when the remote peer has fallen behind the local peer's WAL but can
+    // be caught up by sending it the latest snapshot, see SnapshotProvider.
+    bool needs_snapshot = false;
+
+    RaftPeerPB peer_pb;
+
     // Should we send compression dictionary in the next request to this peer?
     bool should_send_compression_dict = false;
 
+    // Adaptive batch sizing, see --consensus_adaptive_batch_sizing.
+    //
+    // The current bound on the size of the batches sent to this peer.
+    int64_t batch_size_limit;
+
+    // The batch whose round trip is being timed: the index of its last op, or
+    // -1 if there is none, and when it was sent.
+    int64_t timed_batch_last_index = -1;
+    MonoTime timed_batch_send_time;
+
+    // The last round trip time measured, and the lowest one seen lately.
+    MonoDelta last_batch_rtt;
+    MonoDelta min_batch_rtt;
+    MonoTime min_batch_rtt_time;
+
+    // Set while the peer is too far behind to be served from the log cache and
+    // is being caught up from the closed log segments instead, see
+    // --consensus_catchup_min_lag_ops. Only used by the (single) thread
+    // building the requests to the peer.
+    std::shared_ptr<log::SequentialReplicateReader> catchup_reader;
+
+    // Shared by the copies of the peer.
+    std::shared_ptr<PeerLatencies> latencies;
+
     // The peer's latest overall health status.
     HealthReportPB::HealthStatus last_overall_health_status;
 
@@ -201,6 +294,12 @@ class PeerMessageQueue {
     // peer (eg when it is lagging, etc).
     std::shared_ptr<logging::LogThrottler> status_log_throttler;
 
+    // The peer's budget for the ops it is sent from beyond the log cache,
+    // shared by its copies. Null without
+    // --consensus_catchup_peer_bytes_per_sec or
+    // --consensus_catchup_peer_requests_per_sec.
+    std::shared_ptr<Throttler> catchup_throttler;
+
     std::optional<bool> is_peer_in_local_quorum;
     std::optional<bool> is_peer_in_local_region;
 
@@ -266,6 +365,10 @@ class PeerMessageQueue {
   // Returns IllegalState if the local peer is not the leader of the config.
   std::unordered_map<std::string, HealthReportPB> ReportHealthOfPeers() const;
 
+  // Fills in the committed and last indexes of 'summary' and, in leader mode,
+  // how far behind the other tracked peers are. Takes 'queue_lock_' once.
+  void FillHealthSummary(ConsensusHealthSummaryPB* summary) const;
+
   // Appends a single message to be replicated to the peers.
   // Returns OK unless the message could not be added to the queue for some
   // reason (e.g. the queue reached max size).
@@ -304,17 +407,13 @@ class PeerMessageQueue {
   // Note that this can move backwards after a truncation (TruncateOpsAfter).
   OpId GetLastOpIdInLog() const;
 
+  // Returns the index through which the ops in the local log are durable.
+  // Like GetLastOpIdInLog(), this can move backwards after a truncation.
+  int64_t GetLocalDurableIndex() const;
+
   // Return the next OpId to be appended to the queue in the current term.
   OpId GetNextOpId() const;
 
-  // Get the TrackedPeer corresponding to uuid. The tracked-peer is returned in
-  // 'peer'
-  //
-  // Returns Status::OK() if peer exists.
-  // Returns Status::NotFound() if peer does not exist (and peer is set to
-  // nullptr)
-  Status FindPeer(const std::string& uuid, TrackedPeer* peer);
-
   // Assembles a request for a peer, adding entries past 'op_id' up to
   // 'consensus_max_batch_size_bytes'.
   // Returns OK if the request was assembled, or Status::NotFound() if the
@@ -330,6 +429,18 @@ class PeerMessageQueue {
   // instance of ConsensusRequestPB to RequestForPeer(): the buffer will
   // replace the old entries with new ones without de-allocating the old
   // ones if they are still required.
+  //
+  // The ops added to 'request' are kept alive by '*msg_refs', which is only
+  // set if 'read_ops'.
+  Status RequestForPeer(
+      const std::string& uuid,
+      bool read_ops,
+      ConsensusRequestPB* request,
+      ReplicateBatchRefPtr* msg_refs,
+      bool* needs_tablet_copy,
+      std::string* next_hop_uuid);
+
+  // Like the above, but with a reference of its own to each op.
   Status RequestForPeer(
       const std::string& uuid,
       bool read_ops,
@@ -338,6 +449,46 @@ class PeerMessageQueue {
       bool* needs_tablet_copy,
       std::string* next_hop_uuid);
 
+  // Registers the snapshots which can catch up the peers that fell behind
+  // the log. 'provider' must outlive the queue.
+  void SetSnapshotProvider(SnapshotProvider* provider) {
+    snapshot_provider_ = provider;
+  }
+
+  // Sets which of the ops the peers acked count towards the commit quorum,
+  // see DurabilityMode. DURABLE by default.
+  void SetDurabilityMode(DurabilityMode mode) {
+    durability_mode_ = mode;
+  }
+  DurabilityMode durability_mode() const {
+    return durability_mode_;
+  }
+
+  // Whether the peer 'uuid' is tracked and needs the latest snapshot, which
+  // RequestForPeer() finds out when the ops the peer needs are gone.
+  bool PeerNeedsSnapshot(const std::string& uuid) const;
+
+  // Fills in 'request' with the chunk of the latest snapshot at 'offset' for
+  // the peer 'uuid', up to --raft_snapshot_chunk_bytes. If the latest
+  // snapshot is not the one named in 'request', the chunk is read from the
+  // start of the latest one instead. Returns NotFound if the peer does not
+  // need a snapshot.
+  Status RequestSnapshotChunkForPeer(
+      const std::string& uuid,
+      int64_t offset,
+      InstallSnapshotRequestPB* request);
+
+  // Informs the queue that the peer 'uuid' installed the snapshot through
+  // 'last_included', so requests to it go on from the op after it.
+  void SnapshotInstalledOnPeer(
+      const std::string& uuid,
+      const OpId& last_included);
+
+  // On a non-leader, makes the op through which a snapshot was just
+  // installed the last op in the log, and committed. The ops after the
+  // committed index must have been aborted.
+  Status ResetToSnapshot(const OpId& last_included);
+
 #ifdef FB_DO_NOT_REMOVE
   // Fill in a StartTabletCopyRequest for the specified peer.
   // If that peer should not initiate Tablet Copy, returns a non-OK status.
@@ -356,20 +507,61 @@ class PeerMessageQueue {
       PeerStatus ps,
       const Status& status);
 
+  // Adds 'delta' to the number of UpdateConsensus requests in flight to the
+  // peers, as reported by the peers themselves. Only feeds a metric.
+  void AddInflightPeerRequests(int64_t delta) {
+    metrics_.num_inflight_peer_requests->IncrementBy(delta);
+  }
+
   // Updates the request queue with the latest response from a request to a
   // consensus peer.
   // Returns true iff there are more requests pending in the queue for this
   // peer and another request should be sent immediately, with no intervening
   // delay.
+  //
+  // 'rpc_round_trip', if initialized, is how long the response took to come
+  // back, for the peer's latency breakdown. 'request_send_time', if
+  // initialized, is when the request was sent, for the leader lease.
   bool ResponseFromPeer(
       const std::string& peer_uuid,
-      const ConsensusResponsePB& response);
+      const ConsensusResponsePB& response,
+      const MonoDelta& rpc_round_trip = MonoDelta(),
+      const MonoTime& request_send_time = MonoTime());
 
   // The method that does most of the heavy lifting of ResponseFromPeer
   bool DoResponseFromPeer(
       const std::string& peer_uuid,
       const ConsensusResponsePB& response,
-      boost::optional<int64_t>& updated_commit_index);
+      const MonoDelta& rpc_round_trip,
+      const MonoTime& request_send_time,
+      boost::optional<int64_t>& updated_commit_index,
+      std::vector<StdStatusCallback>& confirmed_leadership);
+
+  // Returns when the lease of this leader expires, or an uninitialized
+  // MonoTime if the queue is not in leader mode or holds no lease.
+  //
+  // Each replica withholds its vote for the minimum election timeout after
+  // accepting a request from the leader, so no other leader can be elected
+  // until 'lease_duration' after the send time of the latest request a quorum
+  // of the voters accepted in this term. The quorum is a majority of the
+  // voters, or the one the commit rule asks for with FlexiRaft, which every
+  // election quorum intersects. 'lease_duration' must already make up for
+  // the clock drift between the replicas.
+  MonoTime LeaderLeaseExpiry(const MonoDelta& lease_duration);
+
+  // Drops the lease: only requests sent at least 'delay' from now on count
+  // toward getting it back.
+  void RevokeLeaderLease(const MonoDelta& delay);
+
+  // Calls 'callback' once a quorum of the voters, as for LeaderLeaseExpiry(),
+  // accepted a request sent at 'since' or later in the current term, which
+  // confirms that this replica was still the leader at 'since'. The reads
+  // waiting for a confirmation all ride on the same (heartbeat) requests.
+  // 'callback' gets Aborted if the queue leaves leader mode first.
+  //
+  // Returns true if the caller should signal the peers to send a request
+  // right away, i.e. if no other confirmation is waiting already.
+  bool ConfirmLeadershipAsync(const MonoTime& since, StdStatusCallback callback);
 
   // Called by the consensus implementation to update the queue's watermarks
   // based on information provided by the leader. This is used for metrics and
@@ -401,6 +593,14 @@ class PeerMessageQueue {
   // Check region_durable_index
   int64_t GetRegionDurableIndex() const;
 
+  // Returns the index through which the ops are durable on a majority of the
+  // voters of the leader's region. See local_region_durable_index.
+  int64_t GetLocalRegionDurableIndex() const;
+
+  // Sets 'peers' to how far behind each remote peer is. Empty unless the queue
+  // is in LEADER mode, as only the leader tracks remote peers.
+  void GetPeerLag(std::vector<PeerLag>* peers) const;
+
   // Return true if the committed index falls within the current term.
   bool IsCommittedIndexInCurrentTerm() const;
 
@@ -421,6 +621,10 @@ class PeerMessageQueue {
 
   void DumpToHtml(std::ostream& out) const;
 
+  // Returns the rolling replication history of each remote peer, as JSON.
+  // See PeerHealthHistory.
+  std::string PeerHealthHistoryJson() const;
+
   void RegisterObserver(PeerMessageQueueObserver* observer);
 
   Status UnRegisterObserver(PeerMessageQueueObserver* observer);
@@ -437,6 +641,50 @@ class PeerMessageQueue {
     // as the difference between the latest appended op index on this peer
     // versus on the leader (0 if leader).
     scoped_refptr<AtomicGauge<int64_t>> num_ops_behind_leader;
+    // Keeps track of the number of UpdateConsensus requests in flight to the
+    // peers. See --consensus_max_inflight_requests_per_peer.
+    scoped_refptr<AtomicGauge<int64_t>> num_inflight_peer_requests;
+    // How many ops the local region durable index is ahead of the committed
+    // index: now, and whenever the former advanced.
+    scoped_refptr<AtomicGauge<int64_t>> num_local_region_durable_lead_ops;
+    scoped_refptr<Histogram> local_region_durable_lead;
+    // Counts the peer requests whose batch of ops was shared with another
+    // peer's request rather than read again.
+    scoped_refptr<Counter> num_shared_peer_batches;
+    // Count the times a peer's batch size limit was raised or lowered. See
+    // --consensus_adaptive_batch_sizing.
+    scoped_refptr<Counter> num_batch_size_increases;
+    scoped_refptr<Counter> num_batch_size_decreases;
+    // Counts the ops read from the closed log segments to catch up peers
+    // which are far behind. See --consensus_catchup_min_lag_ops.
+    scoped_refptr<Counter> num_catchup_ops;
+    // Counts the requests to peers behind the log cache sent without ops, as
+    // their catch-up was over its bandwidth budget.
+    scoped_refptr<Counter> num_catchup_throttled_requests;
+    // Counts the requests to peers sent without ops, as they were too far
+    // behind applying the committed ops. See
+    // --consensus_max_peer_apply_backlog_ops.
+    scoped_refptr<Counter> num_apply_backlog_throttled_requests;
+    // Counts the commit index changes whose notification was folded into that
+    // of a later one.
+    scoped_refptr<Counter> num_coalesced_commit_notifications;
+    // Counts the snapshot bytes read for peers behind the log, see
+    // SnapshotProvider.
+    scoped_refptr<Counter> num_snapshot_bytes_sent;
+    // How many committed ops are not yet durable on a majority of the voters,
+    // when the leader commits the ops before then. See DurabilityMode.
+    scoped_refptr<AtomicGauge<int64_t>> num_committed_not_durable_ops;
+    // How many requests the peers refused with an LMP mismatch before
+    // accepting one, each time their log diverged from the leader's.
+    scoped_refptr<Histogram> lmp_mismatch_round_trips;
+    // The replication latency breakdown of all the peers, see PeerLatencies,
+    // and the time from appending ops to the queue until they were replicated
+    // to a majority.
+    scoped_refptr<Histogram> peer_request_build_time;
+    scoped_refptr<Histogram> peer_rpc_round_trip_time;
+    scoped_refptr<Histogram> follower_update_lock_wait_time;
+    scoped_refptr<Histogram> follower_log_append_time;
+    scoped_refptr<Histogram> op_time_to_majority;
 
     explicit Metrics(const scoped_refptr<MetricEntity>& metric_entity);
   };
@@ -446,13 +694,23 @@ class PeerMessageQueue {
   // Begin or end the watch for an eligible successor. If 'successor_uuid' is
   // not boost::none, the queue will notify its observers when 'successor_uuid'
   // is caught up to the leader. Otherwise, it will notify its observers with
-  // the UUID of the first voter that is caught up.
+  // the UUID of the first voter that is caught up. With
+  // 'prioritize_successor', the requests to 'successor_uuid' are built with
+  // full batches, regardless of its adaptive batch size limit, until the
+  // watch ends.
   void BeginWatchForSuccessor(
       const boost::optional<std::string>& successor_uuid,
       const std::function<bool(const kudu::consensus::RaftPeerPB&)>& filter_fn,
-      TransferContext transfer_context);
+      TransferContext transfer_context,
+      bool prioritize_successor = false);
   void EndWatchForSuccessor();
 
+  // Whether an eligible successor is at most 'max_lag_ops' behind the last
+  // appended op, or the watch for a successor is over. An eligible successor
+  // is the designated one if any, else any voter the filter passes, whose
+  // last exchange succeeded.
+  bool SuccessorWithinLag(int64_t max_lag_ops);
+
   Status GetSnapshotForMockElection(
       const std::string& new_leader_uuid,
       OpId* snapshot_op_id);
@@ -467,6 +725,16 @@ class PeerMessageQueue {
       const std::string& dest_uuid,
       std::string* next_hop) const;
 
+  // Whether the peer 'uuid' is tracked and known to be in another region than
+  // the local node. False if the region of either is not set.
+  bool IsPeerInRemoteRegion(const std::string& uuid) const;
+
+  // Whether the peer 'uuid' is tracked, in another region than the local
+  // node, and only needs to retain the log: a non-voter, or a voter which is
+  // known to have no backing database. If so and 'is_voter' is not null, sets
+  // it to whether the peer is a voter.
+  bool IsLightweightPeer(const std::string& uuid, bool* is_voter) const;
+
   // TODO(mpercy): It's probably not safe in general to access a queue's log
   // cache via bare pointer, since (IIRC) a queue will be reconstructed
   // transitioning to/from leader. Check this.
@@ -474,6 +742,11 @@ class PeerMessageQueue {
     return &log_cache_;
   }
 
+  // Traces a sample of the ops replicated as leader, see OpTracer.
+  OpTracer* op_tracer() {
+    return &op_tracer_;
+  }
+
   Status SetCompressionDictionary(const std::string& dict);
 
   // Set the threshold (in milliseconds) that is used to determine the health of
@@ -494,9 +767,16 @@ class PeerMessageQueue {
       const TrackedPeer* proxy_peer,
       const TrackedPeer* dest_peer);
 
+  // Returns true if every peer has acknowledged the last appended op and the
+  // committed index, and everything appended is committed, i.e. heartbeats
+  // have nothing to tell the peers.
+  bool IsQuiescentUnlocked() const;
+
   void SetAdjustVoterDistribution(bool val) {
     std::lock_guard<simple_mutexlock> lock(queue_lock_);
     adjust_voter_distribution_ = val;
+    region_voter_distribution_.reset();
+    leader_quorum_voters_.reset();
   }
 
   // Update quorum id in peers_map
@@ -505,8 +785,16 @@ class PeerMessageQueue {
 
  private:
   FRIEND_TEST(ConsensusQueueTest, TestQueueAdvancesCommittedIndex);
+  FRIEND_TEST(ConsensusQueueTest, TestDurabilityModes);
   FRIEND_TEST(ConsensusQueueTest, TestQueueMovesWatermarksBackward);
+  FRIEND_TEST(ConsensusQueueTest, TestResumeFromConflictingTerm);
   FRIEND_TEST(ConsensusQueueTest, TestFollowerCommittedIndexAndMetrics);
+  FRIEND_TEST(ConsensusQueueTest, TestPeersShareBatch);
+  FRIEND_TEST(ConsensusQueueTest, TestPeersShareBatches);
+  FRIEND_TEST(ConsensusQueueTest, TestAdaptiveBatchSizing);
+  FRIEND_TEST(ConsensusQueueTest, TestReplicationLatencyBreakdown);
+  FRIEND_TEST(ConsensusQueueTest, TestCoalescedCommitNotifications);
+  FRIEND_TEST(ConsensusQueueTest, TestSendSnapshotToPeerBehindLog);
   FRIEND_TEST(ConsensusQueueUnitTest, PeerHealthStatus);
   FRIEND_TEST(
       RaftConsensusQuorumTest,
@@ -529,6 +817,15 @@ class PeerMessageQueue {
     VOTER_REPLICAS,
   };
 
+  // Which of the ops a peer acked a watermark follows: all of them, those
+  // which count towards the commit quorum in the durability mode, or only
+  // the durable ones.
+  enum AckedOps {
+    RECEIVED_OPS,
+    COMMIT_QUORUM_OPS,
+    DURABLE_OPS,
+  };
+
   struct QueueState {
     // The first operation that has been replicated to all currently
     // tracked peers.
@@ -537,8 +834,15 @@ class PeerMessageQueue {
     // The index of the last operation replicated to a majority.
     // This is usually the same as 'committed_index' but might not
     // be if the terms changed.
+    // Only the ops that count towards the commit quorum in the durability
+    // mode are considered replicated, see DurabilityMode.
     int64_t majority_replicated_index;
 
+    // The index of the last operation durable on a majority of the voters.
+    // Only tracked by the leader when it isn't in DURABLE mode, in which it
+    // is 'majority_replicated_index'.
+    int64_t majority_durable_index = 0;
+
     // The index of the last operation to be considered committed.
     int64_t committed_index;
 
@@ -549,6 +853,13 @@ class PeerMessageQueue {
     // defined in RaftPeerAttrsPB
     int64_t region_durable_index;
 
+    // Only tracked by the leader, and only when it has a region: the highest
+    // index which a majority of the voters in the leader's region (the leader
+    // included) have durably received. Unlike 'region_durable_index' this
+    // is not bounded by 'committed_index', so it can run ahead of it when
+    // the commit rule needs acknowledgements from other regions.
+    int64_t local_region_durable_index;
+
     // The index of the last operation appended to the leader. A follower will
     // use this to determine how many ops behind the leader it is, as a soft
     // metric for follower lag.
@@ -596,13 +907,18 @@ class PeerMessageQueue {
   // notifications.
   void UpdatePeerHealthUnlocked(TrackedPeer* peer);
 
+  // Updates what 'peer' contributes to the majority replicated watermark in
+  // FlexiRaft: its last received index if it is a voter whose last exchange
+  // succeeded, nothing otherwise. Must be called whenever either changes.
+  void UpdateReplicatedWatermarksUnlocked(const TrackedPeer& peer);
+
   // Update the peer's last exchange status, and other fields, based on the
   // response. Sets 'lmp_mismatch' to true if the given response indicates
   // there was a log-matching property mismatch on the remote, otherwise sets
   // it to false.
   void UpdateExchangeStatus(
       TrackedPeer* peer,
-      const TrackedPeer& prev_peer_state,
+      const TrackedPeer::Progress& prev_peer_state,
       const ConsensusResponsePB& response,
       bool* lmp_mismatch);
 
@@ -610,7 +926,7 @@ class PeerMessageQueue {
   // trigger promotion.
   void PromoteIfNeeded(
       TrackedPeer* peer,
-      const TrackedPeer& prev_peer_state,
+      const TrackedPeer::Progress& prev_peer_state,
       const ConsensusStatusPB& status);
 
   // If there is a graceful leadership change underway, notify queue observers
@@ -649,16 +965,21 @@ class PeerMessageQueue {
   void NotifyObserversOfPeerToPromote(const std::string& peer_uuid);
   void NotifyObserversOfSuccessor(const std::string& peer_uuid);
   void NotifyObserversOfPeerHealthChange();
+  void NotifyObserversOfLocalRegionDurableIndex(int64_t index);
 
   // Notify all PeerMessageQueueObservers using the given callback function.
   void NotifyObserversTask(
       const std::function<void(PeerMessageQueueObserver*)>& func);
 
+  // Run on 'raft_pool_observers_token_': notifies the observers of
+  // 'pending_commit_index_' until no newer commit index is pending.
+  void NotifyPendingCommitIndexTask();
+
   typedef std::unordered_map<std::string, TrackedPeer*> PeersMap;
 
   std::string ToStringUnlocked() const;
 
-  std::string LogPrefixUnlocked() const;
+  const std::string& LogPrefixUnlocked() const;
 
   void DumpToStringsUnlocked(std::vector<std::string>* lines) const;
 
@@ -671,6 +992,79 @@ class PeerMessageQueue {
 
   void ClearUnlocked();
 
+  // A batch of ops read for a peer, kept around so that other peers needing
+  // the very same batch can share it. See --consensus_share_peer_batches.
+  struct SharedBatch {
+    // The term, and the queue's last appended index, when it was read.
+    int64_t term;
+    int64_t last_appended_index;
+
+    // The space the batch was allowed to take up.
+    int max_batch_size;
+
+    OpId preceding_id;
+    ReplicateBatchRefPtr messages;
+  };
+
+  // Keyed by the index the batch follows, and by whether its ops were
+  // converted to PROXY_OPs.
+  typedef std::map<std::pair<int64_t, bool>, SharedBatch> SharedBatchMap;
+
+  // Looks up a batch read for another peer after 'after_op_index' which a
+  // fresh read would yield too. Returns false if there's none.
+  bool LookupSharedBatch(
+      int64_t after_op_index,
+      bool proxy_ops,
+      int64_t term,
+      int64_t last_appended_index,
+      int max_batch_size,
+      ReplicateBatchRefPtr* messages,
+      OpId* preceding_id);
+
+  // Makes 'batch', read after 'after_op_index', available to other peers.
+  void InsertSharedBatch(
+      int64_t after_op_index,
+      bool proxy_ops,
+      SharedBatch batch);
+
+  // Adjusts 'peer->batch_size_limit' once the peer acknowledged the batch
+  // being timed, or stops timing it if the peer reported an error.
+  void AdaptBatchSizeUnlocked(TrackedPeer* peer);
+
+  // Records the latencies of an exchange with 'peer': the round trip, if
+  // initialized, and those the peer reported in 'response'.
+  void RecordPeerLatenciesUnlocked(
+      const TrackedPeer& peer,
+      const ConsensusResponsePB& response,
+      const MonoDelta& rpc_round_trip);
+
+  // As leader, starts timing the batch of 'num_ops' ops up to 'last_index',
+  // appended at 'append_time', until it reaches a majority.
+  void TimeAppendedBatchUnlocked(
+      int64_t last_index,
+      int64_t num_ops,
+      MonoTime append_time);
+
+  // Records the time to majority of the ops appended as leader up to the
+  // majority replicated index.
+  void RecordTimeToMajorityUnlocked();
+
+  // Whether 'peer', with ops to be sent from beyond the log cache, is within
+  // its catch-up budget and the global one, taking from them what its next
+  // request may read. Always true for a peer within the log cache.
+  bool TakeCatchupBudget(const TrackedPeer& peer, int64_t last_appended_index);
+
+  // Drops the shared batches following an op before 'index', which no peer
+  // needs anymore once every peer has received 'index'.
+  void DropSharedBatchesBefore(int64_t index);
+
+  // Drops all shared batches, e.g. once they may no longer match the log.
+  void ClearSharedBatches();
+
+  // Whether the latest snapshot holds the op after 'index', which a peer
+  // needs but is gone from the log, and can catch up the peer.
+  bool SnapshotCanCatchUp(int64_t index);
+
   // Returns the last operation in the message queue, or
   // 'preceding_first_op_in_queue_' if the queue is empty.
   const OpId& GetLastOp() const;
@@ -693,19 +1087,33 @@ class PeerMessageQueue {
   void DoLocalPeerAppendFinished(const OpId& id, bool need_lock);
 
   // Callback when a REPLICATE message has finished appending to the local log.
+  // 'truncation_epoch' is the TruncationEpoch() the append started in.
   void LocalPeerAppendFinished(
       const OpId& id,
+      int64_t truncation_epoch,
       const StatusCallback& callback,
       const Status& status);
 
+  // Returns how many times the local log was truncated or reset, see
+  // 'truncation_epoch_'.
+  int64_t TruncationEpoch() const;
+
+  // In QUORUM_MEMORY mode, counts the ops just appended to the leader's log
+  // buffer towards the commit quorum. Requires 'queue_lock_'.
+  void CountLocalAppendTowardsCommitUnlocked();
+
   // Advances the 'region_durable_index' maintained by the queue
   void AdvanceQueueRegionDurableIndex();
 
+  // Advances 'local_region_durable_index' from 'replicated_by_region_' and
+  // notifies the observers if it moved.
+  void AdvanceLocalRegionDurableIndexUnlocked();
+
   // Advances 'watermark' to the smallest op that 'num_peers_required' have.
   // If 'replica_types' is set to VOTER_REPLICAS, the 'num_peers_required' is
   // interpreted as "number of voters required". If 'replica_types' is set to
   // ALL_REPLICAS, 'num_peers_required' counts any peer, regardless of its
-  // voting status.
+  // voting status. 'acked_ops' tells which of the ops a peer acked it has.
   void AdvanceQueueWatermark(
       const char* type,
       int64_t* watermark,
@@ -713,23 +1121,72 @@ class PeerMessageQueue {
       const OpId& replicated_after,
       int num_peers_required,
       ReplicaTypes replica_types,
+      AckedOps acked_ops,
       const TrackedPeer* who_caused);
 
+  // Sets 'next_index' from the conflicting term the peer reported along an
+  // LMP mismatch, see ConsensusStatusPB.conflict_term. Returns false if the
+  // ops of our log it needs to look up are gone.
+  bool NextIndexFromConflictUnlocked(
+      const TrackedPeer& peer,
+      const ConsensusStatusPB& status,
+      int64_t* next_index) const;
+
+  // Returns the index through which the ops acked by 'peer' count towards
+  // the commit quorum in the durability mode. In QUORUM_MEMORY mode, the
+  // leader counts the ops it appended to its own log buffer.
+  int64_t CommitQuorumIndexUnlocked(const TrackedPeer& peer) const;
+
+  // The highest watermark which 'num_required' of the voters of 'region'
+  // reached, or none if fewer of them responded.
+  typedef std::function<std::optional<int64_t>(
+      const std::string& region,
+      int num_required)>
+      RegionalWatermarkFn;
+
   // Function to compute the new `watermark` in one of the static modes
   // given a pointer to it, the voter distribution and the watermarks
   // classified by region.
   // This function returns the old watermark.
   int64_t DoComputeNewWatermarkStaticMode(
       const std::map<std::string, int>& voter_distribution,
-      const std::map<std::string, std::vector<int64_t>>& watermarks_by_region,
+      const RegionalWatermarkFn& regional_watermark,
       int64_t* watermark);
-  int64_t ComputeNewWatermarkStaticMode(int64_t* watermark);
+
+  // The number of voters in each region which the static modes require a
+  // majority of, and in the leader's quorum in SINGLE_REGION_DYNAMIC mode.
+  // Both are cached until the active config or the quorums change.
+  const std::map<std::string, int>& RegionVoterDistributionUnlocked();
+  int LeaderQuorumVotersUnlocked();
+
+  // What a peer contributes to a watermark. For the replication watermarks
+  // that is the index of the last op it received.
+  typedef std::function<int64_t(const TrackedPeer&)> PeerWatermarkFn;
+
+  int64_t ComputeNewWatermarkStaticMode(
+      int64_t* watermark,
+      const PeerWatermarkFn& peer_watermark);
 
   // Function to compute the new `watermark` in the single region dynamic
   // mode given a pointer to it, the voter distribution and the watermarks
   // classified by region.
   // This function returns the old watermark.
-  int64_t ComputeNewWatermarkDynamicMode(int64_t* watermark);
+  int64_t ComputeNewWatermarkDynamicMode(
+      int64_t* watermark,
+      const PeerWatermarkFn& peer_watermark);
+
+  // Returns the time, as nanoseconds since MonoTime::Min(), by which the
+  // lease quorum of LeaderLeaseExpiry() had accepted a request, or -1 if it
+  // has not yet.
+  int64_t ComputeLeaseGrantedAtUnlocked();
+
+  // Moves the callbacks of the leadership confirmations that a quorum now
+  // confirmed into 'confirmed'.
+  void TakeConfirmedLeadershipUnlocked(std::vector<StdStatusCallback>* confirmed);
+
+  // Aborts all the leadership confirmations waiting.
+  void AbortLeadershipConfirmationsUnlocked(
+      std::vector<StdStatusCallback>* aborted);
 
   // Function to compute the commit index in FlexiRaft. Same as
   // `AdvanceQueueWatermark` except that its only used for commit index
@@ -759,6 +1216,10 @@ class PeerMessageQueue {
   // The id of the tablet.
   const std::string tablet_id_;
 
+  // The log prefixes for either mode of the queue, formatted once.
+  std::string leader_log_prefix_;
+  std::string non_leader_log_prefix_;
+
   QueueState queue_state_;
 
   // Should we adjust voter distribution based on current config?
@@ -766,10 +1227,23 @@ class PeerMessageQueue {
 
   // The currently tracked peers.
   PeersMap peers_map_;
-  mutable simple_mutexlock queue_lock_; // TODO(todd): rename
+
+  // The last received indexes of the voters whose last exchange succeeded,
+  // by region, and of the ones in the leader's quorum under the empty quorum
+  // id. Advancing the FlexiRaft majority replicated watermark reads them
+  // instead of visiting every peer.
+  QuorumWatermarks replicated_by_region_;
+  QuorumWatermarks replicated_in_leader_quorum_;
+
+  // See RegionVoterDistributionUnlocked() and LeaderQuorumVotersUnlocked().
+  std::optional<std::map<std::string, int>> region_voter_distribution_;
+  std::optional<int> leader_quorum_voters_;
+  // TODO(todd): rename
+  mutable simple_mutexlock queue_lock_{"PeerMessageQueue::queue_lock_"};
 
   bool successor_watch_in_progress_;
   boost::optional<std::string> designated_successor_uuid_;
+  bool prioritize_successor_ = false;
   boost::optional<TransferContext> transfer_context_;
   bool successor_watch_peer_notified_ = false;
 
@@ -781,8 +1255,64 @@ class PeerMessageQueue {
 
   LogCache log_cache_;
 
+  // See SetSnapshotProvider(). May be read without 'queue_lock_'.
+  std::atomic<SnapshotProvider*> snapshot_provider_{nullptr};
+
+  // See SetDurabilityMode(). May be read without 'queue_lock_'.
+  std::atomic<DurabilityMode> durability_mode_{DurabilityMode::DURABLE};
+
+  // See GetLocalDurableIndex(). The appends whose ops may have been
+  // truncated since, those from before the latest truncation, don't count.
+  mutable simple_spinlock local_durable_lock_;
+  int64_t local_durable_index_; // Protected by local_durable_lock_.
+  int64_t truncation_epoch_ = 0; // Protected by local_durable_lock_.
+
+  // Batches of ops recently read for peers. 'shared_batches_lock_' may be
+  // taken while holding 'queue_lock_', but not the other way around.
+  simple_spinlock shared_batches_lock_;
+  SharedBatchMap shared_batches_; // Protected by shared_batches_lock_.
+
   Metrics metrics_;
 
+  OpTracer op_tracer_;
+
+  // Rolling history of the replication to each remote peer.
+  PeerHealthHistory peer_health_history_;
+
+  // For the time to majority: the last index of each batch of ops appended
+  // as leader and not yet majority replicated, with the number of ops in the
+  // batch and when it was appended. Protected by 'queue_lock_'.
+  struct AppendedBatch {
+    int64_t last_index;
+    int64_t num_ops;
+    MonoTime append_time;
+  };
+  std::deque<AppendedBatch> appended_batches_;
+
+  // A moving average of the microseconds from appending ops until they were
+  // replicated to a majority, which shrinks the catch-up budgets, see
+  // --consensus_catchup_commit_latency_target_ms. Written under
+  // 'queue_lock_'.
+  std::atomic<int64_t> time_to_majority_avg_us_{0};
+
+  // Requests sent before this don't count toward the leader lease, see
+  // RevokeLeaderLease(). Protected by 'queue_lock_'.
+  MonoTime lease_not_before_;
+
+  // The callbacks of ConfirmLeadershipAsync(), by the time from which the
+  // requests count. Protected by 'queue_lock_'.
+  std::multimap<MonoTime, StdStatusCallback> leadership_confirmations_;
+
+  // With --async_notify_commit_index, at most one task notifying the
+  // observers of commit index changes is in flight, while
+  // 'commit_notifier_running_'. It delivers the latest commit index pending,
+  // so the changes made while it runs are coalesced. Protected by
+  // 'commit_notification_lock_'.
+  simple_spinlock commit_notification_lock_;
+  bool commit_notifier_running_ = false;
+  bool has_pending_commit_index_ = false;
+  int64_t pending_commit_index_ = 0;
+
   scoped_refptr<ITimeManager> time_manager_;
 
   // Duration in milliseconds before a peer is marked as 'failed' to being a
@@ -833,6 +1363,10 @@ class PeerMessageQueueObserver {
   // Notify the observer that the health of one of the peers has changed.
   virtual void NotifyPeerHealthChange() = 0;
 
+  // Notify the observer that the ops through 'index' are durable on a
+  // majority of the voters in the leader's region. Only leaders notify.
+  virtual void NotifyLocalRegionDurableIndex(int64_t index) {}
+
   virtual ~PeerMessageQueueObserver() {}
 };
 
@@ -0,0 +1,51 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+namespace kudu {
+namespace consensus {
+
+// When a replica acknowledges the ops it received, and so when the leader can
+// commit them. Every replica reports both the last op it received and, of
+// those, the last one durable in its log, and the leader counts one or the
+// other towards the commit quorum according to its mode. All the replicas of
+// a group should be given the same mode: a leader always counts the durable
+// ops of a replica in DURABLE mode, so it is safe, if slower, for them to
+// differ.
+enum class DurabilityMode {
+  // Replicas acknowledge ops once they are durable in their log, and the
+  // leader commits them when they are durable on a commit quorum, the leader
+  // included or not. Committed ops survive any crash of a minority.
+  DURABLE = 1,
+  // Replicas acknowledge ops as soon as they are appended to the log buffer,
+  // before they are synced, and the leader commits them when they are in the
+  // memory of a commit quorum. This takes the log sync out of the commit
+  // latency, but committed ops are only as safe as the memory of the quorum:
+  // they may be lost if a quorum of replicas crash (not just restart their
+  // process with the OS up, which keeps the data written) before syncing
+  // them. The region durable indexes count the ops in memory as well.
+  QUORUM_MEMORY = 2,
+  // Like QUORUM_MEMORY, but the leader only commits the ops durable in its
+  // own log. Committed ops are only lost if the replicas which acknowledged
+  // them all crash before syncing them, and another leader is elected while
+  // the old one is down.
+  LEADER_DURABLE = 3,
+};
+
+} // namespace consensus
+} // namespace kudu
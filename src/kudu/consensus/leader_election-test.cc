@@ -519,6 +519,67 @@ TEST_F(LeaderElectionTest, TestFailToCreateProxy) {
   ASSERT_EQ("could not achieve majority", result_->message);
 }
 
+// Test that an election records the round-trip times of the votes it got and
+// reports how long it took to be decided.
+TEST_F(LeaderElectionTest, TestRecordsVoterRtts) {
+  const ConsensusTerm kElectionTerm = 2;
+  const int kNumVoters = 5;
+  const int kMajoritySize = 3;
+
+  InitUUIDs(kNumVoters);
+  InitNoOpPeerProxies();
+  gscoped_ptr<VoteCounter> counter = InitVoteCounter(kNumVoters, kMajoritySize);
+
+  VoteRequestPB request;
+  request.set_candidate_uuid(candidate_uuid_);
+  request.set_candidate_term(kElectionTerm);
+  request.set_tablet_id(tablet_id_);
+
+  auto rtt_tracker = std::make_shared<VoterRttTracker>();
+  scoped_refptr<LeaderElection> election(new LeaderElection(
+      config_,
+      proxy_factory_.get(),
+      std::move(request),
+      std::move(counter),
+      MonoDelta::FromSeconds(kLeaderElectionTimeoutSecs),
+      std::bind(
+          &LeaderElectionTest::ElectionCallback, this, std::placeholders::_1),
+      std::make_shared<VoteLoggerImplTest>(),
+      rtt_tracker));
+  election->Run();
+  latch_.Wait();
+  ASSERT_EQ(VOTE_GRANTED, result_->decision);
+  ASSERT_TRUE(result_->duration.Initialized());
+  pool_->Wait();
+
+  // Voters that were not asked, or answered after the decision, may be
+  // missing, but the ones which decided the election are there.
+  int num_rtts = 0;
+  for (const string& uuid : voter_uuids_) {
+    MonoDelta rtt;
+    if (rtt_tracker->GetRtt(uuid, &rtt)) {
+      num_rtts++;
+    }
+  }
+  ASSERT_GE(num_rtts, kMajoritySize - 1);
+}
+
+TEST(VoterRttTrackerTest, TestSmoothing) {
+  VoterRttTracker tracker;
+  MonoDelta rtt;
+  ASSERT_FALSE(tracker.GetRtt("peer-0", &rtt));
+
+  tracker.RecordRtt("peer-0", MonoDelta::FromMicroseconds(800));
+  ASSERT_TRUE(tracker.GetRtt("peer-0", &rtt));
+  ASSERT_EQ(800, rtt.ToMicroseconds());
+
+  // A single outlier only moves the estimate by an eighth of the difference.
+  tracker.RecordRtt("peer-0", MonoDelta::FromMicroseconds(8800));
+  ASSERT_TRUE(tracker.GetRtt("peer-0", &rtt));
+  ASSERT_EQ(1800, rtt.ToMicroseconds());
+  ASSERT_FALSE(tracker.GetRtt("peer-1", &rtt));
+}
+
 ////////////////////////////////////////
 // VoteCounterTest
 ////////////////////////////////////////
@@ -32,6 +32,7 @@
 #include <vector>
 
 #include <boost/bind.hpp> // IWYU pragma: keep
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "kudu/common/wire_protocol.h"
@@ -47,6 +48,7 @@
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/rpc/rpc_controller.h"
 //#include "kudu/tserver/tserver.pb.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/status.h"
@@ -89,6 +91,22 @@ DEFINE_bool(
     true,
     "Whether to fallback on using Voting History mechanism to find potential leader regions");
 
+DEFINE_bool(
+    leader_election_prioritize_fast_voters,
+    true,
+    "Whether to send vote requests to the voters with the lowest round-trip "
+    "times seen in previous elections first.");
+TAG_FLAG(leader_election_prioritize_fast_voters, advanced);
+TAG_FLAG(leader_election_prioritize_fast_voters, runtime);
+
+DEFINE_bool(
+    leader_election_cancel_outstanding_votes,
+    true,
+    "Whether to cancel the vote requests still in flight once an election is "
+    "decided, and to skip sending the ones not sent yet.");
+TAG_FLAG(leader_election_cancel_outstanding_votes, advanced);
+TAG_FLAG(leader_election_cancel_outstanding_votes, runtime);
+
 namespace kudu {
 namespace consensus {
 
@@ -1310,6 +1328,35 @@ ElectionResult::ElectionResult(
   DCHECK(!message.empty());
 }
 
+///////////////////////////////////////////////////
+// VoterRttTracker
+///////////////////////////////////////////////////
+
+void VoterRttTracker::RecordRtt(
+    const std::string& peer_uuid,
+    const MonoDelta& rtt) {
+  int64_t rtt_us = rtt.ToMicroseconds();
+  std::lock_guard<simple_spinlock> l(lock_);
+  auto iter = srtt_us_.find(peer_uuid);
+  if (iter == srtt_us_.end()) {
+    srtt_us_.emplace(peer_uuid, rtt_us);
+    return;
+  }
+  // The same 1/8 gain as TCP's smoothed RTT.
+  iter->second += (rtt_us - iter->second) / 8;
+}
+
+bool VoterRttTracker::GetRtt(const std::string& peer_uuid, MonoDelta* rtt)
+    const {
+  std::lock_guard<simple_spinlock> l(lock_);
+  auto iter = srtt_us_.find(peer_uuid);
+  if (iter == srtt_us_.end()) {
+    return false;
+  }
+  *rtt = MonoDelta::FromMicroseconds(iter->second);
+  return true;
+}
+
 ///////////////////////////////////////////////////
 // LeaderElection::VoterState
 ///////////////////////////////////////////////////
@@ -1333,7 +1380,8 @@ LeaderElection::LeaderElection(
     gscoped_ptr<VoteCounter> vote_counter,
     MonoDelta timeout,
     ElectionDecisionCallback decision_callback,
-    std::shared_ptr<VoteLoggerInterface> vote_logger)
+    std::shared_ptr<VoteLoggerInterface> vote_logger,
+    std::shared_ptr<VoterRttTracker> rtt_tracker)
     : has_responded_(false),
       config_(std::move(config)),
       proxy_factory_(proxy_factory),
@@ -1343,7 +1391,8 @@ LeaderElection::LeaderElection(
       decision_callback_(std::move(decision_callback)),
       highest_voter_term_(0),
       start_time_(MonoTime::Now()),
-      vote_logger_(std::move(vote_logger)) {}
+      vote_logger_(std::move(vote_logger)),
+      rtt_tracker_(std::move(rtt_tracker)) {}
 
 LeaderElection::~LeaderElection() {
   std::lock_guard<Lock> guard(lock_);
@@ -1389,6 +1438,26 @@ void LeaderElection::Run() {
              other_voter_uuids.begin(), other_voter_uuids.end(), ", ")
       << "]; RaftConfig: {" << pb_util::SecureShortDebugString(config_) << "}";
 
+  // Ask the voters that answered fastest in previous elections first: with
+  // a large cross-region config this lets the election be decided by the
+  // nearby voters rather than waiting on the sending loop. Voters without a
+  // recorded round-trip time keep their config order, after the others.
+  if (rtt_tracker_ && FLAGS_leader_election_prioritize_fast_voters) {
+    std::unordered_map<std::string, int64_t> rtt_us;
+    for (const auto& voter_uuid : other_voter_uuids) {
+      MonoDelta rtt;
+      rtt_us[voter_uuid] = rtt_tracker_->GetRtt(voter_uuid, &rtt)
+          ? rtt.ToMicroseconds()
+          : std::numeric_limits<int64_t>::max();
+    }
+    std::stable_sort(
+        other_voter_uuids.begin(),
+        other_voter_uuids.end(),
+        [&rtt_us](const std::string& a, const std::string& b) {
+          return rtt_us[a] < rtt_us[b];
+        });
+  }
+
   // Check if we have already won the election (relevant if this is a
   // single-node configuration, since we always pre-vote for ourselves).
   CheckForDecision();
@@ -1396,6 +1465,7 @@ void LeaderElection::Run() {
   std::string msg;
   msg.reserve(100 * other_voter_uuids.size());
   size_t pnum = 0;
+  size_t num_skipped = 0;
   // The rest of the code below is for a typical multi-node configuration.
   for (const auto& voter_uuid : other_voter_uuids) {
     VoterState* state = nullptr;
@@ -1404,6 +1474,12 @@ void LeaderElection::Run() {
       state = FindOrDie(voter_state_, voter_uuid);
       // Safe to drop the lock because voter_state_ is not mutated outside of
       // the constructor / destructor. We do this to avoid deadlocks below.
+
+      // The voters asked so far already decided the election.
+      if (result_ && FLAGS_leader_election_cancel_outstanding_votes) {
+        num_skipped++;
+        continue;
+      }
     }
 
     // If we failed to construct the proxy, just record a 'NO' vote with the
@@ -1433,6 +1509,7 @@ void LeaderElection::Run() {
     state->request = request_;
     state->request.set_dest_uuid(voter_uuid);
 
+    state->send_time = MonoTime::Now();
     state->proxy->RequestConsensusVoteAsync(
         &state->request,
         &state->response,
@@ -1442,10 +1519,19 @@ void LeaderElection::Run() {
         boost::bind(
             &Closure::Run,
             Bind(&LeaderElection::VoteResponseRpcCallback, this, voter_uuid)));
+    {
+      // Only now may the call be cancelled.
+      std::lock_guard<Lock> guard(lock_);
+      state->sent = true;
+    }
   }
   // Send the RPC request.
   LOG_WITH_PREFIX(INFO) << "Requesting " << ElectionMode_Name(request_.mode())
                         << "-vote from peers: " << msg;
+  if (num_skipped > 0) {
+    LOG_WITH_PREFIX(INFO) << "Election decided before asking " << num_skipped
+                          << " of the voters";
+  }
   if (vote_logger_)
     vote_logger_->logElectionStarted(request_, config_);
 }
@@ -1484,6 +1570,7 @@ void LeaderElection::CheckForDecision() {
     if (result_ && !has_responded_) {
       has_responded_ = true;
       to_respond = true;
+      result_->duration = MonoTime::Now().GetDeltaSince(start_time_);
     }
   }
 
@@ -1491,6 +1578,25 @@ void LeaderElection::CheckForDecision() {
   if (to_respond) {
     // This is thread-safe since result_ is write-once.
     decision_callback_(*result_);
+    if (FLAGS_leader_election_cancel_outstanding_votes) {
+      CancelOutstandingRpcs();
+    }
+  }
+}
+
+void LeaderElection::CancelOutstandingRpcs() {
+  vector<VoterState*> outstanding;
+  {
+    std::lock_guard<Lock> guard(lock_);
+    for (const auto& entry : voter_state_) {
+      if (entry.second->sent && !entry.second->responded) {
+        outstanding.push_back(entry.second);
+      }
+    }
+  }
+  // The states are only freed by the destructor, and we hold a ref.
+  for (VoterState* state : outstanding) {
+    state->proxy->CancelAsync(&state->rpc);
   }
 }
 
@@ -1498,9 +1604,20 @@ void LeaderElection::VoteResponseRpcCallback(const std::string& voter_uuid) {
   {
     std::lock_guard<Lock> guard(lock_);
     VoterState* state = FindOrDie(voter_state_, voter_uuid);
+    state->responded = true;
+
+    if (state->rpc.status().ok() && rtt_tracker_) {
+      rtt_tracker_->RecordRtt(
+          voter_uuid, MonoTime::Now().GetDeltaSince(state->send_time));
+    }
 
     // Check for RPC errors.
-    if (!state->rpc.status().ok()) {
+    if (result_ && state->rpc.status().IsAborted()) {
+      // Cancelled by CancelOutstandingRpcs() after the decision.
+      VLOG_WITH_PREFIX(1) << "Vote request to peer " << state->PeerInfo()
+                          << " cancelled after the election was decided";
+      return;
+    } else if (!state->rpc.status().ok()) {
       LOG_WITH_PREFIX(WARNING)
           << "RPC error from VoteRequest() call to peer " << state->PeerInfo()
           << ": " << state->rpc.status().ToString();
@@ -405,6 +405,32 @@ struct ElectionResult {
   // responded with a 'no' vote and indicated that the candidate has been
   // removed from the voter's committed config
   const bool is_candidate_removed;
+
+  // Time from the start of the election until it was decided. Set before the
+  // decision callback is invoked.
+  MonoDelta duration;
+};
+
+// Keeps a smoothed round-trip time of the vote requests sent to each peer, so
+// that later elections can ask the fastest voters first.
+//
+// This class is thread-safe.
+class VoterRttTracker {
+ public:
+  VoterRttTracker() {}
+
+  // Folds 'rtt' into the smoothed round-trip time of 'peer_uuid'.
+  void RecordRtt(const std::string& peer_uuid, const MonoDelta& rtt);
+
+  // Sets 'rtt' to the smoothed round-trip time of 'peer_uuid'. Returns false
+  // if no round trip to it has been recorded yet.
+  bool GetRtt(const std::string& peer_uuid, MonoDelta* rtt) const;
+
+ private:
+  mutable simple_spinlock lock_;
+  std::unordered_map<std::string, int64_t> srtt_us_;
+
+  DISALLOW_COPY_AND_ASSIGN(VoterRttTracker);
 };
 
 // Driver class to run a leader election.
@@ -439,6 +465,10 @@ class LeaderElection : public RefCountedThreadSafe<LeaderElection> {
   // 'proxy_factory' must not go out of scope while LeaderElection is alive.
   //
   // The 'vote_counter' must be initialized with the candidate's own yes vote.
+  //
+  // If 'rtt_tracker' is set, vote requests go out to the voters with the
+  // lowest recorded round-trip times first, and the round-trip times seen in
+  // this election are recorded into it.
   LeaderElection(
       RaftConfigPB config,
       PeerProxyFactory* proxy_factory,
@@ -446,7 +476,8 @@ class LeaderElection : public RefCountedThreadSafe<LeaderElection> {
       gscoped_ptr<VoteCounter> vote_counter,
       MonoDelta timeout,
       ElectionDecisionCallback decision_callback,
-      std::shared_ptr<VoteLoggerInterface> vote_logger);
+      std::shared_ptr<VoteLoggerInterface> vote_logger,
+      std::shared_ptr<VoterRttTracker> rtt_tracker = nullptr);
 
   // Run the election: send the vote request to followers.
   void Run();
@@ -466,6 +497,14 @@ class LeaderElection : public RefCountedThreadSafe<LeaderElection> {
     VoteRequestPB request;
     VoteResponsePB response;
 
+    // When the vote request was sent.
+    MonoTime send_time;
+
+    // Whether the vote request has been sent, and whether its response (or
+    // error) has come back. Protected by LeaderElection::lock_.
+    bool sent = false;
+    bool responded = false;
+
     std::string PeerInfo() const;
   };
 
@@ -482,6 +521,10 @@ class LeaderElection : public RefCountedThreadSafe<LeaderElection> {
   // Callback called when the RPC responds.
   void VoteResponseRpcCallback(const std::string& voter_uuid);
 
+  // Cancels the vote requests whose responses have not come back yet. Called
+  // once the election is decided.
+  void CancelOutstandingRpcs();
+
   // Record vote from specified peer.
   void RecordVoteUnlocked(const VoterState& state, ElectionVote vote);
 
@@ -541,6 +584,9 @@ class LeaderElection : public RefCountedThreadSafe<LeaderElection> {
   MonoTime start_time_;
 
   std::shared_ptr<VoteLoggerInterface> vote_logger_;
+
+  // Round-trip times of the vote requests, or nullptr.
+  const std::shared_ptr<VoterRttTracker> rtt_tracker_;
 };
 
 class VoteLoggerInterface {
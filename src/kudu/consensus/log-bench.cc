@@ -0,0 +1,392 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// WAL append benchmark. Runs concurrent appenders against a single Log, each
+// appending batches of replicate entries whose sizes are drawn from a
+// weighted mix, and reports the entry and byte rates, the batch append
+// latency and the group commit latency and group sizes recorded by the log.
+//
+// The codec, fsync and I/O policies are those of the log itself
+// (--log_compression_codec, --log_force_fsync_all, --log_use_io_uring,
+// --log_use_direct_io, --log_group_commit_*...), and --log_bench_wal_dir
+// picks the device. Example, synced 4KB-heavy mix on an NVMe device:
+//   log-bench --log_bench_wal_dir=/mnt/nvme/bench --log_force_fsync_all \
+//       --log_bench_entry_sizes=512:50,4096:40,65536:10 \
+//       --log_bench_appenders=16 --log_compression_codec=LZ4
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/log.h"
+#include "kudu/consensus/log_util.h"
+#include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/fs/fs_manager.h"
+#include "kudu/gutil/gscoped_ptr.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/strings/numbers.h"
+#include "kudu/gutil/strings/split.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/async_util.h"
+#include "kudu/util/hdr_histogram.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/path_util.h"
+#include "kudu/util/random.h"
+#include "kudu/util/random_util.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DEFINE_string(
+    log_bench_wal_dir,
+    "",
+    "Directory under which the benchmarked WAL is created, to pick the "
+    "device. Defaults to the test directory.");
+DEFINE_string(
+    log_bench_entry_sizes,
+    "256:60,2048:30,32768:10",
+    "Mix of entry payload sizes, as size_bytes[:weight],... Each entry "
+    "picks a size with a probability proportional to its weight.");
+DEFINE_double(
+    log_bench_random_payload_fraction,
+    0.5,
+    "Fraction of each payload filled with random bytes, the rest being "
+    "compressible filler.");
+DEFINE_int32(
+    log_bench_entries_per_batch,
+    4,
+    "Number of entries in each batch handed to the log.");
+DEFINE_int32(
+    log_bench_appenders,
+    8,
+    "Number of appender threads, each with one outstanding batch.");
+DEFINE_int32(
+    log_bench_batches_per_sec,
+    0,
+    "Target rate of batches across all appenders. 0 means as fast as the "
+    "log accepts them.");
+DEFINE_int32(
+    log_bench_runtime_secs,
+    5,
+    "Duration of the benchmark.");
+
+DECLARE_bool(log_force_fsync_all);
+DECLARE_string(log_compression_codec);
+
+METRIC_DECLARE_counter(log_bytes_logged);
+METRIC_DECLARE_histogram(log_group_commit_latency);
+METRIC_DECLARE_histogram(log_entry_batches_per_group);
+
+using kudu::consensus::NO_OP;
+using kudu::consensus::ReplicateMsg;
+using kudu::consensus::ReplicateRefPtr;
+using kudu::consensus::make_scoped_refptr_replicate;
+using std::pair;
+using std::string;
+using std::thread;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace log {
+
+namespace {
+
+const char* kBenchTablet = "BenchTablet";
+
+// Batch latencies above this are clamped, in microseconds.
+constexpr uint64_t kMaxLatencyUs = 60 * 1000 * 1000;
+
+// A weighted mix of entry sizes.
+class EntrySizeMix {
+ public:
+  // Parses 'spec' as size_bytes[:weight],...
+  Status Parse(const string& spec) {
+    vector<string> items = strings::Split(spec, ",", strings::SkipEmpty());
+    for (const string& item : items) {
+      vector<string> parts = strings::Split(item, ":");
+      int32_t size;
+      int32_t weight = 1;
+      if (parts.size() > 2 || !safe_strto32(parts[0], &size) || size < 0 ||
+          (parts.size() == 2 &&
+           (!safe_strto32(parts[1], &weight) || weight <= 0))) {
+        return Status::InvalidArgument("bad entry size", item);
+      }
+      total_weight_ += weight;
+      sizes_.emplace_back(total_weight_, size);
+    }
+    if (sizes_.empty()) {
+      return Status::InvalidArgument("no entry sizes", spec);
+    }
+    return Status::OK();
+  }
+
+  // Returns the index of a size picked according to the weights.
+  int Pick(Random* rng) const {
+    int64_t r = rng->Uniform64(total_weight_);
+    for (int i = 0; i < sizes_.size(); i++) {
+      if (r < sizes_[i].first) {
+        return i;
+      }
+    }
+    return sizes_.size() - 1;
+  }
+
+  int size(int i) const {
+    return sizes_[i].second;
+  }
+
+  int num_sizes() const {
+    return sizes_.size();
+  }
+
+ private:
+  int64_t total_weight_ = 0;
+
+  // (cumulative weight, size) pairs.
+  vector<pair<int64_t, int>> sizes_;
+};
+
+} // anonymous namespace
+
+class LogBench : public KuduTest {
+ public:
+  LogBench()
+      : metric_entity_(
+            METRIC_ENTITY_server.Instantiate(&metric_registry_, "log-bench")),
+        latency_hist_(kMaxLatencyUs, 3) {}
+
+  void SetUp() override {
+    KuduTest::SetUp();
+    ASSERT_OK(mix_.Parse(FLAGS_log_bench_entry_sizes));
+    string root = FLAGS_log_bench_wal_dir.empty()
+        ? GetTestPath("log-bench-root")
+        : JoinPathSegments(
+              FLAGS_log_bench_wal_dir,
+              Substitute("log-bench-$0", getpid()));
+    if (!FLAGS_log_bench_wal_dir.empty()) {
+      custom_root_ = root;
+    }
+    FsManagerOpts opts;
+    opts.wal_root = root;
+    opts.data_roots = {root};
+    fs_manager_.reset(new FsManager(env_, opts));
+    ASSERT_OK(fs_manager_->CreateInitialFileSystemLayout());
+    ASSERT_OK(fs_manager_->Open());
+    ASSERT_OK(Log::Open(
+        LogOptions(), fs_manager_.get(), kBenchTablet, metric_entity_, &log_));
+  }
+
+  void TearDown() override {
+    if (log_) {
+      WARN_NOT_OK(log_->Close(), "could not close the log");
+      log_.reset();
+    }
+    fs_manager_.reset();
+    if (!custom_root_.empty()) {
+      WARN_NOT_OK(
+          env_->DeleteRecursively(custom_root_),
+          "could not delete the benchmark directory");
+    }
+    KuduTest::TearDown();
+  }
+
+ protected:
+  // Appends one batch with an entry per payload and waits for it to be
+  // durable. Indexes are assigned under 'append_lock_' so that batches reach
+  // the log in index order, like they do from the consensus queue.
+  Status AppendBatch(const vector<const string*>& payloads) {
+    vector<ReplicateRefPtr> replicates;
+    replicates.reserve(payloads.size());
+    for (const string* payload : payloads) {
+      ReplicateRefPtr replicate =
+          make_scoped_refptr_replicate(new ReplicateMsg());
+      replicate->get()->set_op_type(NO_OP);
+      replicate->get()->mutable_noop_request()->set_payload_for_tests(
+          *payload);
+      replicates.push_back(std::move(replicate));
+    }
+    Synchronizer sync;
+    {
+      std::lock_guard<std::mutex> l(append_lock_);
+      for (const ReplicateRefPtr& replicate : replicates) {
+        ReplicateMsg* msg = replicate->get();
+        msg->mutable_id()->set_term(1);
+        msg->mutable_id()->set_index(next_index_);
+        msg->set_timestamp(next_index_);
+        next_index_++;
+      }
+      RETURN_NOT_OK(
+          log_->AsyncAppendReplicates(replicates, sync.AsStatusCallback()));
+    }
+    return sync.Wait();
+  }
+
+  // Runs the appenders for 'runtime', each paced so that all of them
+  // together append at most 'batches_per_sec'.
+  void RunLoad(int appenders, int batches_per_sec, MonoDelta runtime) {
+    std::atomic<bool> stop(false);
+    std::atomic<int64_t> errors(0);
+    const MonoDelta interval = batches_per_sec > 0
+        ? MonoDelta::FromNanoseconds(
+              appenders * MonoTime::kNanosecondsPerSecond / batches_per_sec)
+        : MonoDelta::FromNanoseconds(0);
+
+    vector<thread> threads;
+    for (int t = 0; t < appenders; t++) {
+      threads.emplace_back([&, t]() {
+        Random rng(SeedRandom() + t);
+        // One payload per size, random up to the requested fraction so that
+        // the codec sees data about as compressible as the mix asks for.
+        vector<string> payloads;
+        for (int i = 0; i < mix_.num_sizes(); i++) {
+          int size = mix_.size(i);
+          int random_bytes = static_cast<int>(
+              size * FLAGS_log_bench_random_payload_fraction);
+          payloads.push_back(
+              RandomString(random_bytes, &rng) +
+              string(size - random_bytes, 'x'));
+        }
+        vector<const string*> batch(FLAGS_log_bench_entries_per_batch);
+        MonoTime next = MonoTime::Now();
+        while (!stop) {
+          if (interval.ToNanoseconds() > 0) {
+            MonoTime now = MonoTime::Now();
+            if (now < next) {
+              SleepFor(next - now);
+            }
+            next += interval;
+          }
+          int64_t bytes = 0;
+          for (auto& entry : batch) {
+            entry = &payloads[mix_.Pick(&rng)];
+            bytes += entry->size();
+          }
+          MonoTime start = MonoTime::Now();
+          Status s = AppendBatch(batch);
+          if (PREDICT_FALSE(!s.ok())) {
+            LOG(WARNING) << "Append failed: " << s.ToString();
+            errors++;
+            continue;
+          }
+          int64_t us = (MonoTime::Now() - start).ToMicroseconds();
+          latency_hist_.Increment(std::min<int64_t>(us, kMaxLatencyUs));
+          payload_bytes_ += bytes;
+        }
+      });
+    }
+    SleepFor(runtime);
+    stop = true;
+    for (auto& t : threads) {
+      t.join();
+    }
+    ASSERT_EQ(0, errors.load());
+  }
+
+  MetricRegistry metric_registry_;
+  scoped_refptr<MetricEntity> metric_entity_;
+  gscoped_ptr<FsManager> fs_manager_;
+  scoped_refptr<Log> log_;
+  string custom_root_;
+  EntrySizeMix mix_;
+
+  std::mutex append_lock_;
+  int64_t next_index_ = 1;
+
+  HdrHistogram latency_hist_;
+  std::atomic<int64_t> payload_bytes_{0};
+};
+
+TEST_F(LogBench, Append) {
+  MonoTime start = MonoTime::Now();
+  NO_FATALS(RunLoad(
+      FLAGS_log_bench_appenders,
+      FLAGS_log_bench_batches_per_sec,
+      MonoDelta::FromSeconds(FLAGS_log_bench_runtime_secs)));
+  double elapsed_secs = (MonoTime::Now() - start).ToSeconds();
+
+  const int64_t batches = latency_hist_.TotalCount();
+  ASSERT_GT(batches, 0);
+  const int64_t entries = batches * FLAGS_log_bench_entries_per_batch;
+  const int64_t logged_bytes =
+      METRIC_log_bytes_logged.Instantiate(metric_entity_)->value();
+  const HdrHistogram* group_latency =
+      METRIC_log_group_commit_latency.Instantiate(metric_entity_)
+          ->histogram();
+  const HdrHistogram* group_size =
+      METRIC_log_entry_batches_per_group.Instantiate(metric_entity_)
+          ->histogram();
+
+  LOG(INFO) << Substitute(
+      "$0 appenders, $1 entries/batch, sizes $2, $3 random, codec '$4', "
+      "fsync $5",
+      FLAGS_log_bench_appenders,
+      FLAGS_log_bench_entries_per_batch,
+      FLAGS_log_bench_entry_sizes,
+      FLAGS_log_bench_random_payload_fraction,
+      FLAGS_log_compression_codec,
+      FLAGS_log_force_fsync_all);
+  LOG(INFO) << Substitute(
+      "throughput: $0 entries/sec, $1 batches/sec ($2 entries in $3 s)",
+      entries / elapsed_secs,
+      batches / elapsed_secs,
+      entries,
+      elapsed_secs);
+  LOG(INFO) << Substitute(
+      "bandwidth: $0 MB/s of payload, $1 MB/s written to the log",
+      payload_bytes_.load() / elapsed_secs / (1 << 20),
+      logged_bytes / elapsed_secs / (1 << 20));
+  LOG(INFO) << Substitute(
+      "batch append latency us: mean $0 p50 $1 p99 $2 p99.9 $3 max $4",
+      latency_hist_.MeanValue(),
+      latency_hist_.ValueAtPercentile(50),
+      latency_hist_.ValueAtPercentile(99),
+      latency_hist_.ValueAtPercentile(99.9),
+      latency_hist_.MaxValue());
+  LOG(INFO) << Substitute(
+      "group commit latency us: mean $0 p50 $1 p99 $2 p99.9 $3 max $4",
+      group_latency->MeanValue(),
+      group_latency->ValueAtPercentile(50),
+      group_latency->ValueAtPercentile(99),
+      group_latency->ValueAtPercentile(99.9),
+      group_latency->MaxValue());
+  LOG(INFO) << Substitute(
+      "group size: $0 groups, batches/group mean $1 p50 $2 p99 $3, "
+      "entries/group mean $4",
+      group_size->TotalCount(),
+      group_size->MeanValue(),
+      group_size->ValueAtPercentile(50),
+      group_size->ValueAtPercentile(99),
+      group_size->MeanValue() * FLAGS_log_bench_entries_per_batch);
+}
+
+} // namespace log
+} // namespace kudu
@@ -155,8 +155,12 @@ class LogTestBase : public KuduTest {
   typedef std::pair<int, int> DeltaId;
 
   LogTestBase()
-      : schema_(GetSimpleTestSchema()),
-        log_anchor_registry_(new LogAnchorRegistry) {}
+      :
+#ifdef FB_DO_NOT_REMOVE
+        schema_(GetSimpleTestSchema()),
+#endif
+        log_anchor_registry_(new LogAnchorRegistry) {
+  }
 
   void SetUp() override {
     KuduTest::SetUp();
@@ -177,13 +181,17 @@ class LogTestBase : public KuduTest {
   }
 
   Status BuildLog() {
+#ifdef FB_DO_NOT_REMOVE
     Schema schema_with_ids = SchemaBuilder(schema_).Build();
+#endif
     return Log::Open(
         options_,
         fs_manager_.get(),
         kTestTablet,
+#ifdef FB_DO_NOT_REMOVE
         schema_with_ids,
         0, // schema_version
+#endif
         metric_entity_.get(),
         &log_);
   }
@@ -224,9 +232,10 @@ class LogTestBase : public KuduTest {
       bool sync = APPEND_SYNC) {
     consensus::ReplicateRefPtr replicate =
         make_scoped_refptr_replicate(new consensus::ReplicateMsg());
-    replicate->get()->set_op_type(consensus::WRITE_OP);
     replicate->get()->mutable_id()->CopyFrom(opid);
     replicate->get()->set_timestamp(clock_->Now().ToUint64());
+#ifdef FB_DO_NOT_REMOVE
+    replicate->get()->set_op_type(consensus::WRITE_OP);
     tserver::WriteRequestPB* batch_request =
         replicate->get()->mutable_write_request();
     RETURN_NOT_OK(SchemaToPB(schema_, batch_request->mutable_schema()));
@@ -245,6 +254,11 @@ class LogTestBase : public KuduTest {
         "this is a test mutate",
         batch_request->mutable_row_operations());
     batch_request->set_tablet_id(kTestTablet);
+#else
+    replicate->get()->set_op_type(consensus::WRITE_OP_EXT);
+    replicate->get()->mutable_write_payload()->set_payload(
+        "this is a test insert, this is a test mutate");
+#endif
     return AppendReplicateBatch(replicate, sync);
   }
 
@@ -291,9 +305,9 @@ class LogTestBase : public KuduTest {
       int dms_id,
       bool sync = APPEND_SYNC) {
     gscoped_ptr<consensus::CommitMsg> commit(new consensus::CommitMsg);
-    commit->set_op_type(consensus::WRITE_OP);
-
     commit->mutable_commited_op_id()->CopyFrom(original_opid);
+#ifdef FB_DO_NOT_REMOVE
+    commit->set_op_type(consensus::WRITE_OP);
 
     tablet::TxResultPB* result = commit->mutable_result();
 
@@ -304,9 +318,13 @@ class LogTestBase : public KuduTest {
     tablet::MemStoreTargetPB* target = mutate->add_mutated_stores();
     target->set_dms_id(dms_id);
     target->set_rs_id(rs_id);
+#else
+    commit->set_op_type(consensus::WRITE_OP_EXT);
+#endif
     return AppendCommit(std::move(commit), sync);
   }
 
+#ifdef FB_DO_NOT_REMOVE
   // Append a COMMIT message for 'original_opid', but with results
   // indicating that the associated writes failed due to
   // "NotFound" errors.
@@ -327,6 +345,7 @@ class LogTestBase : public KuduTest {
 
     return AppendCommit(std::move(commit));
   }
+#endif
 
   Status AppendCommit(
       gscoped_ptr<consensus::CommitMsg> commit,
@@ -405,7 +424,9 @@ class LogTestBase : public KuduTest {
  protected:
   enum { kStartIndex = 1 };
 
+#ifdef FB_DO_NOT_REMOVE
   const Schema schema_;
+#endif
   gscoped_ptr<FsManager> fs_manager_;
   gscoped_ptr<MetricRegistry> metric_registry_;
   scoped_refptr<MetricEntity> metric_entity_;
@@ -55,9 +55,11 @@
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/stl_util.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/path_util.h"
 #include "kudu/util/async_util.h"
 #include "kudu/util/compression/compression.pb.h"
 #include "kudu/util/env.h"
+#include "kudu/util/env_util.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/random.h"
 #include "kudu/util/status.h"
@@ -72,10 +74,31 @@ DEFINE_int32(
 
 DECLARE_int32(log_min_segments_to_retain);
 DECLARE_int32(log_max_segments_to_retain);
+DECLARE_int32(log_max_recycled_segments);
+DECLARE_string(log_archive_dir);
+DECLARE_int32(log_archive_max_segments);
+DECLARE_string(log_recompression_codec);
+DECLARE_int32(log_recompression_min_segment_age_s);
+DECLARE_bool(log_index_durable);
+DECLARE_bool(log_reader_lazy_open);
+DECLARE_int32(log_reader_lazy_open_tail_segments);
+DECLARE_int32(log_sequential_read_buffer_bytes);
+DECLARE_bool(log_mmap_sealed_segments);
+DECLARE_int32(log_mmap_cache_segments);
+DECLARE_int32(log_reader_async_read_depth);
+DECLARE_bool(log_use_io_uring);
 DECLARE_double(log_inject_io_error_on_preallocate_fraction);
 DECLARE_int64(fs_wal_dir_reserved_bytes);
 DECLARE_int64(disk_reserved_bytes_free_for_testing);
 DECLARE_string(log_compression_codec);
+DECLARE_bool(log_pipelined_append);
+DECLARE_bool(log_prezero_segments);
+DECLARE_int32(log_sync_marker_interval_bytes);
+DECLARE_int32(log_append_thread_spin_us);
+DECLARE_int32(log_append_thread_spin_cpu_budget_pct);
+
+METRIC_DECLARE_histogram(log_post_roll_append_latency);
+METRIC_DECLARE_histogram(log_segment_prezero_latency);
 
 namespace kudu {
 namespace log {
@@ -85,7 +108,7 @@ using consensus::MakeOpId;
 using consensus::NO_OP;
 using consensus::OpId;
 using consensus::ReplicateMsg;
-using consensus::WRITE_OP;
+using consensus::WRITE_OP_EXT;
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
@@ -407,6 +430,53 @@ TEST_P(LogTestOptionalCompression, TestCorruptLogInHeader) {
   DoCorruptionTest(FLIP_BYTE, IN_HEADER, Status::Corruption(""), 3);
 }
 
+// A segment left without a footer is recovered from its last sync marker,
+// which records the entries before it.
+TEST_P(LogTestOptionalCompression, TestRebuildFooterFromSyncMarker) {
+  const int kInterval = 4096;
+  const int kNumEntries = 500;
+  FLAGS_log_sync_marker_interval_bytes = kInterval;
+  ASSERT_OK(BuildLog());
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendNoOps(&op_id, kNumEntries));
+  const int64_t written = log_->active_segment_->written_offset();
+  ASSERT_GT(written, 2 * kInterval);
+
+  // Copy the segment being written, which has no footer yet, as a crash
+  // would leave it.
+  faststring data;
+  ASSERT_OK(ReadFileToString(env_, log_->ActiveSegmentPathForTests(), &data));
+  const string path = GetTestPath("crashed-segment");
+  ASSERT_OK(WriteStringToFile(env_, Slice(data), path));
+  scoped_refptr<ReadableLogSegment> segment;
+  ASSERT_OK(ReadableLogSegment::Open(env_, path, &segment));
+  ASSERT_FALSE(segment->HasFooter());
+
+  int64_t marker_offset;
+  LogSegmentFooterPB marker_footer;
+  ASSERT_OK(segment->FindLastSyncMarker(&marker_offset, &marker_footer));
+  ASSERT_GT(marker_offset, written - 2 * kInterval);
+  ASSERT_LT(marker_offset, written);
+  ASSERT_GT(marker_footer.num_entries(), 0);
+  ASSERT_LT(marker_footer.num_entries(), kNumEntries);
+
+  ASSERT_OK(segment->RebuildFooterByScanning());
+  ASSERT_EQ(kNumEntries, segment->footer().num_entries());
+  ASSERT_EQ(1, segment->footer().min_replicate_index());
+  ASSERT_EQ(kNumEntries, segment->footer().max_replicate_index());
+  ASSERT_EQ(written, segment->readable_up_to());
+  // The markers are not read as entries.
+  ASSERT_OK(segment->ReadEntries(&entries_));
+  ASSERT_EQ(kNumEntries, entries_.size());
+
+  // If the last marker is torn, the footer is rebuilt from the one before.
+  ASSERT_OK(CorruptLogFile(env_, path, TRUNCATE_FILE, marker_offset + 1));
+  ASSERT_OK(ReadableLogSegment::Open(env_, path, &segment));
+  ASSERT_OK(segment->RebuildFooterByScanning());
+  ASSERT_EQ(marker_footer.num_entries(), segment->footer().num_entries());
+  ASSERT_EQ(marker_offset, segment->readable_up_to());
+}
+
 // Tests that segments roll over when max segment size is reached
 // and that the player plays all entries in the correct order.
 TEST_P(LogTestOptionalCompression, TestSegmentRollover) {
@@ -614,7 +684,7 @@ TEST_P(LogTestOptionalCompression, TestGCWithLogRunning) {
     vector<ReplicateMsg*> repls;
     ElementDeleter d(&repls);
     Status s = log_->reader()->ReadReplicatesInRange(
-        1, 2, LogReader::kNoSizeLimit, ReadContext(), &repls);
+        1, 2, LogReader::kNoSizeLimit, &repls);
     ASSERT_TRUE(s.IsNotFound()) << s.ToString();
   }
 
@@ -690,7 +760,7 @@ TEST_P(LogTestOptionalCompression, TestWaitUntilAllFlushed) {
       ASSERT_TRUE(entries_[i]->has_replicate());
     } else {
       ASSERT_TRUE(entries_[i]->has_commit());
-      ASSERT_EQ(WRITE_OP, entries_[i]->commit().op_type());
+      ASSERT_EQ(WRITE_OP_EXT, entries_[i]->commit().op_type());
     }
   }
 }
@@ -878,6 +948,15 @@ std::ostream& operator<<(std::ostream& os, const TestLogSequenceElem& elem) {
   return os;
 }
 
+std::ostream& operator<<(
+    std::ostream& os,
+    const vector<TestLogSequenceElem>& seq) {
+  for (const TestLogSequenceElem& elem : seq) {
+    os << elem << " ";
+  }
+  return os;
+}
+
 // Generates a plausible sequence of items in the log, including term changes,
 // moving the index backwards, log rolls, etc.
 //
@@ -1013,7 +1092,6 @@ TEST_P(LogTestOptionalCompression, TestReadLogWithReplacedReplicates) {
             start_index,
             end_index,
             LogReader::kNoSizeLimit,
-            ReadContext(),
             &repls));
         ASSERT_EQ(end_index - start_index + 1, repls.size());
         int expected_index = start_index;
@@ -1042,7 +1120,7 @@ TEST_P(LogTestOptionalCompression, TestReadLogWithReplacedReplicates) {
         vector<ReplicateMsg*> repls;
         ElementDeleter d(&repls);
         ASSERT_OK(reader->ReadReplicatesInRange(
-            start_index, end_index, size_limit, ReadContext(), &repls));
+            start_index, end_index, size_limit, &repls));
         ASSERT_LE(repls.size(), end_index - start_index + 1);
         int total_size = 0;
         int expected_index = start_index;
@@ -1070,6 +1148,265 @@ TEST_P(LogTestOptionalCompression, TestReadLogWithReplacedReplicates) {
   }
 }
 
+// Test that SequentialReplicateReader reads back the latest copy of each
+// REPLICATE message, like ReadReplicatesInRange(), across successive calls,
+// with and without a read-ahead buffer.
+TEST_P(LogTestOptionalCompression, TestSequentialReplicateReader) {
+  const int kSequenceLength = AllowSlowTests() ? 1000 : 50;
+
+  Random rng(SeedRandom());
+  vector<int64_t> terms_by_index;
+  vector<TestLogSequenceElem> seq;
+  GenerateTestSequence(&rng, kSequenceLength, &seq, &terms_by_index);
+  const int64_t max_repl_index = terms_by_index.size() - 1;
+
+  ASSERT_OK(BuildLog());
+  AppendTestSequence(seq);
+  // Only closed segments are read.
+  ASSERT_OK(RollLog());
+
+  // A buffer smaller than the segments has to be refilled in the middle of
+  // entry batches.
+  const int kBufferSizes[] = {0, 4096, 1024 * 1024};
+  for (int i = 0; i < 12; i++) {
+    FLAGS_log_sequential_read_buffer_bytes = kBufferSizes[i % 3];
+    int64_t next_index = RandInRange(&rng, 1, max_repl_index);
+    int size_limit = RandInRange(&rng, 1, 1000);
+    SCOPED_TRACE(Substitute(
+        "Reading from $0 with size limit $1 and read buffer of $2 bytes",
+        next_index,
+        size_limit,
+        FLAGS_log_sequential_read_buffer_bytes));
+    SequentialReplicateReader seq_reader(log_->reader());
+    while (next_index <= max_repl_index) {
+      vector<ReplicateMsg*> repls;
+      ElementDeleter d(&repls);
+      ASSERT_OK(seq_reader.ReadReplicates(
+          next_index, max_repl_index, size_limit, &repls));
+      ASSERT_FALSE(repls.empty());
+      for (const ReplicateMsg* repl : repls) {
+        ASSERT_EQ(next_index, repl->id().index());
+        ASSERT_EQ(terms_by_index[next_index], repl->id().term());
+        next_index++;
+      }
+    }
+  }
+}
+
+// Test that ops are read back the same from mapped sealed segments, also once
+// there are more segments than mappings kept.
+TEST_P(LogTestOptionalCompression, TestReadMappedSegments) {
+  FLAGS_log_mmap_sealed_segments = true;
+  FLAGS_log_mmap_cache_segments = 2;
+  const int kSequenceLength = AllowSlowTests() ? 1000 : 50;
+
+  Random rng(SeedRandom());
+  vector<int64_t> terms_by_index;
+  vector<TestLogSequenceElem> seq;
+  GenerateTestSequence(&rng, kSequenceLength, &seq, &terms_by_index);
+  const int64_t max_repl_index = terms_by_index.size() - 1;
+
+  ASSERT_OK(BuildLog());
+  AppendTestSequence(seq);
+  ASSERT_OK(RollLog());
+
+  SegmentSequence segments;
+  ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+    ASSERT_EQ(segment->HasFooter(), segment->GetMapping() != nullptr);
+  }
+
+  for (int i = 0; i < 10; i++) {
+    int64_t start_index = RandInRange(&rng, 1, max_repl_index);
+    SCOPED_TRACE(Substitute("Reading from $0", start_index));
+    vector<ReplicateMsg*> repls;
+    ElementDeleter d(&repls);
+    ASSERT_OK(log_->reader()->ReadReplicatesInRange(
+        start_index,
+        max_repl_index,
+        LogReader::kNoSizeLimit,
+        &repls));
+    ASSERT_EQ(max_repl_index - start_index + 1, repls.size());
+    int64_t expected_index = start_index;
+    for (const ReplicateMsg* repl : repls) {
+      ASSERT_EQ(expected_index, repl->id().index());
+      ASSERT_EQ(terms_by_index[expected_index], repl->id().term());
+      expected_index++;
+    }
+
+    // The sequential reader stops early at ops which were replaced later in
+    // the log.
+    SequentialReplicateReader seq_reader(log_->reader());
+    vector<ReplicateMsg*> seq_repls;
+    ElementDeleter seq_d(&seq_repls);
+    ASSERT_OK(seq_reader.ReadReplicates(
+        start_index, max_repl_index, LogReader::kNoSizeLimit, &seq_repls));
+    ASSERT_LE(seq_repls.size(), repls.size());
+    for (int j = 0; j < seq_repls.size(); j++) {
+      ASSERT_EQ(
+          repls[j]->SerializeAsString(), seq_repls[j]->SerializeAsString());
+    }
+  }
+}
+
+// Test that reading batches ahead, through io_uring where supported, reads
+// the same ops as reading them one at a time.
+TEST_P(LogTestOptionalCompression, TestReadBatchesAhead) {
+  FLAGS_log_use_io_uring = true;
+  const int kSequenceLength = AllowSlowTests() ? 1000 : 50;
+
+  Random rng(SeedRandom());
+  vector<int64_t> terms_by_index;
+  vector<TestLogSequenceElem> seq;
+  GenerateTestSequence(&rng, kSequenceLength, &seq, &terms_by_index);
+  const int64_t max_repl_index = terms_by_index.size() - 1;
+
+  ASSERT_OK(BuildLog());
+  AppendTestSequence(seq);
+  ASSERT_OK(RollLog());
+
+  for (int i = 0; i < 10; i++) {
+    int64_t start_index = RandInRange(&rng, 1, max_repl_index);
+    int64_t max_bytes =
+        i % 2 == 0 ? LogReader::kNoSizeLimit : RandInRange(&rng, 1, 4096);
+    SCOPED_TRACE(
+        Substitute("Reading $0 bytes from $1", max_bytes, start_index));
+    vector<ReplicateMsg*> expected;
+    ElementDeleter expected_d(&expected);
+    FLAGS_log_reader_async_read_depth = 0;
+    ASSERT_OK(log_->reader()->ReadReplicatesInRange(
+        start_index, max_repl_index, max_bytes, &expected));
+
+    vector<ReplicateMsg*> repls;
+    ElementDeleter d(&repls);
+    FLAGS_log_reader_async_read_depth = 4;
+    ASSERT_OK(log_->reader()->ReadReplicatesInRange(
+        start_index, max_repl_index, max_bytes, &repls));
+    ASSERT_EQ(expected.size(), repls.size());
+    int64_t expected_index = start_index;
+    for (int j = 0; j < repls.size(); j++) {
+      ASSERT_EQ(expected_index, repls[j]->id().index());
+      ASSERT_EQ(terms_by_index[expected_index], repls[j]->id().term());
+      ASSERT_EQ(
+          expected[j]->SerializeAsString(), repls[j]->SerializeAsString());
+      expected_index++;
+    }
+  }
+
+  // A corrupt batch fails the read either way.
+  LogIndexEntry entry;
+  ASSERT_OK(log_->log_index_->GetEntry(max_repl_index / 2 + 1, &entry));
+  SegmentSequence segments;
+  ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  ASSERT_OK(log_->Close());
+  for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+    if (segment->header().sequence_number() ==
+        entry.segment_sequence_number) {
+      ASSERT_OK(CorruptLogFile(
+          env_,
+          segment->path(),
+          FLIP_BYTE,
+          entry.offset_in_segment + segment->entry_header_size() + 1));
+    }
+  }
+  // The reader of the log has the segments open from before.
+  shared_ptr<LogReader> reader;
+  ASSERT_OK(LogReader::Open(
+      fs_manager_.get(),
+      make_scoped_refptr(new LogIndex(log_->log_dir_)),
+      kTestTablet,
+      nullptr,
+      &reader));
+  for (int depth : {0, 4}) {
+    FLAGS_log_reader_async_read_depth = depth;
+    vector<ReplicateMsg*> repls;
+    ElementDeleter d(&repls);
+    Status s = reader->ReadReplicatesInRange(
+        1, max_repl_index, LogReader::kNoSizeLimit, &repls);
+    ASSERT_TRUE(s.IsCorruption()) << depth << ": " << s.ToString();
+  }
+}
+
+// Test that the index of segments copied from another log can be rebuilt, so
+// that they can be read like the ones of a local log.
+TEST_P(LogTestOptionalCompression, TestIndexCopiedSegments) {
+  const int kNumOpsPerSegment = 10;
+  ASSERT_OK(BuildLog());
+  OpId op_id = MakeOpId(1, 1);
+  for (int i = 0; i < 3; i++) {
+    ASSERT_OK(AppendNoOps(&op_id, kNumOpsPerSegment));
+    ASSERT_OK(RollLog());
+  }
+  const int64_t last_index = op_id.index() - 1;
+
+  const string copy_dir = GetTestPath("copied-wal");
+  ASSERT_OK(env_->CreateDir(copy_dir));
+  scoped_refptr<LogIndex> index(new LogIndex(copy_dir));
+  SegmentSequence segments;
+  ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+    if (!segment->HasFooter()) {
+      continue;
+    }
+    const string copy_path =
+        JoinPathSegments(copy_dir, BaseName(segment->path()));
+    ASSERT_OK(env_util::CopyFile(
+        env_, segment->path(), copy_path, WritableFileOptions()));
+    scoped_refptr<ReadableLogSegment> copy;
+    ASSERT_OK(ReadableLogSegment::Open(env_, copy_path, &copy));
+    ASSERT_OK(LogReader::IndexSegment(copy.get(), index.get()));
+  }
+
+  shared_ptr<LogReader> reader;
+  ASSERT_OK(
+      LogReader::Open(env_, copy_dir, index, kTestTablet, nullptr, &reader));
+  vector<ReplicateMsg*> replicates;
+  ElementDeleter deleter(&replicates);
+  ASSERT_OK(reader->ReadReplicatesInRange(
+      1, last_index, LogReader::kNoSizeLimit, &replicates));
+  ASSERT_EQ(last_index, replicates.size());
+  for (int i = 0; i < replicates.size(); i++) {
+    ASSERT_EQ(i + 1, replicates[i]->id().index());
+  }
+}
+
+// Test that a lazily opened reader serves the most recent segments right away
+// and the older ones once they are open.
+TEST_P(LogTestOptionalCompression, TestLazyOpenReader) {
+  const int kNumOpsPerSegment = 10;
+  const int kNumSegments = 5;
+  ASSERT_OK(BuildLog());
+  OpId op_id = MakeOpId(1, 1);
+  for (int i = 0; i < kNumSegments; i++) {
+    ASSERT_OK(AppendNoOps(&op_id, kNumOpsPerSegment));
+    ASSERT_OK(RollLog());
+  }
+  const int64_t last_index = op_id.index() - 1;
+  const int64_t last_seqno = log_->reader()->GetLastSegmentSequenceNumber();
+  const int num_segments = log_->reader()->num_segments();
+  ASSERT_OK(log_->Close());
+
+  FLAGS_log_reader_lazy_open = true;
+  FLAGS_log_reader_lazy_open_tail_segments = 2;
+  const string wal_dir = fs_manager_->GetTabletWalDir(kTestTablet);
+  scoped_refptr<LogIndex> index(new LogIndex(wal_dir));
+  shared_ptr<LogReader> reader;
+  ASSERT_OK(
+      LogReader::Open(env_, wal_dir, index, kTestTablet, nullptr, &reader));
+  ASSERT_EQ(last_seqno, reader->GetLastSegmentSequenceNumber());
+
+  // Reading from the start needs the older segments.
+  vector<ReplicateMsg*> replicates;
+  ElementDeleter deleter(&replicates);
+  ASSERT_OK(reader->ReadReplicatesInRange(
+      1, last_index, LogReader::kNoSizeLimit, &replicates));
+  ASSERT_EQ(last_index, replicates.size());
+  for (int i = 0; i < replicates.size(); i++) {
+    ASSERT_EQ(i + 1, replicates[i]->id().index());
+  }
+  ASSERT_EQ(num_segments, reader->num_segments());
+}
+
 // Ensure that we can read replicate messages from the LogReader with a very
 // high (> 32 bit) log index and term. Regression test for KUDU-1933.
 TEST_P(LogTestOptionalCompression, TestReadReplicatesHighIndex) {
@@ -1089,7 +1426,6 @@ TEST_P(LogTestOptionalCompression, TestReadReplicatesHighIndex) {
       first_log_index,
       first_log_index + kSequenceLength - 1,
       LogReader::kNoSizeLimit,
-      ReadContext(),
       &replicates));
   ASSERT_EQ(kSequenceLength, replicates.size());
   ASSERT_GT(op_id.index(), std::numeric_limits<int32_t>::max());
@@ -1195,6 +1531,279 @@ TEST_F(LogTest, TestAutoStopIdleAppendThread) {
       [&]() { ASSERT_FALSE(log_->append_thread_active_for_tests()); });
 }
 
+// Test that a spinning append thread still appends every entry, and still
+// shuts itself down once the log is idle.
+TEST_P(LogTestOptionalCompression, TestSpinningAppendThread) {
+  FLAGS_log_append_thread_spin_us = 10000;
+  FLAGS_log_append_thread_spin_cpu_budget_pct = 100;
+  ASSERT_OK(BuildLog());
+
+  const int kNumPairs = 100;
+  ASSERT_OK(AppendReplicateBatchAndCommitEntryPairsToLog(
+      kNumPairs, APPEND_ASYNC));
+  ASSERT_OK(log_->WaitUntilAllFlushed());
+  ASSERT_EVENTUALLY(
+      [&]() { ASSERT_FALSE(log_->append_thread_active_for_tests()); });
+  ASSERT_OK(log_->Close());
+
+  shared_ptr<LogReader> reader;
+  ASSERT_OK(LogReader::Open(
+      fs_manager_.get(), nullptr, kTestTablet, nullptr, &reader));
+  SegmentSequence segments;
+  ASSERT_OK(reader->GetSegmentsSnapshot(&segments));
+  int num_entries = 0;
+  for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+    entries_.clear();
+    ASSERT_OK(segment->ReadEntries(&entries_));
+    num_entries += entries_.size();
+  }
+  ASSERT_EQ(kNumPairs * 2, num_entries);
+}
+
+// Test that with pipelined appends, asynchronously appended entries are all
+// written and synced across segment roll-overs, and that their callbacks run.
+TEST_P(LogTestOptionalCompression, TestPipelinedAppend) {
+  FLAGS_log_pipelined_append = true;
+  FLAGS_log_force_fsync_all = true;
+  ASSERT_OK(BuildLog());
+  log_->SetMaxSegmentSizeForTests(4096);
+
+  const int kNumPairs = 200;
+  ASSERT_OK(AppendReplicateBatchAndCommitEntryPairsToLog(
+      kNumPairs, APPEND_ASYNC));
+  ASSERT_OK(log_->WaitUntilAllFlushed());
+  ASSERT_OK(log_->Close());
+
+  shared_ptr<LogReader> reader;
+  ASSERT_OK(LogReader::Open(
+      fs_manager_.get(), nullptr, kTestTablet, nullptr, &reader));
+  SegmentSequence segments;
+  ASSERT_OK(reader->GetSegmentsSnapshot(&segments));
+  ASSERT_GT(segments.size(), 1);
+  int num_entries = 0;
+  for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+    entries_.clear();
+    ASSERT_OK(segment->ReadEntries(&entries_));
+    num_entries += entries_.size();
+  }
+  ASSERT_EQ(kNumPairs * 2, num_entries);
+}
+
+// Test that GCed segments are recycled into new segments, and that nothing
+// of their previous contents can be read back.
+TEST_P(LogTestOptionalCompression, TestRecycleSegments) {
+  FLAGS_log_min_segments_to_retain = 1;
+  FLAGS_log_max_recycled_segments = 2;
+  ASSERT_OK(BuildLog());
+
+  vector<LogAnchor*> anchors;
+  ElementDeleter deleter(&anchors);
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(4, 5, &op_id, &anchors));
+
+  auto count_recycled = [&]() {
+    vector<string> files;
+    CHECK_OK(env_->GetChildren(
+        JoinPathSegments(fs_manager_->GetWalsRootDir(), kTestTablet), &files));
+    return std::count_if(files.begin(), files.end(), [](const string& f) {
+      return f.find(".recycled-") != string::npos;
+    });
+  };
+
+  // Free all but the last segment.
+  for (int i = 0; i < 3; i++) {
+    ASSERT_OK(log_anchor_registry_->Unregister(anchors[i]));
+  }
+  RetentionIndexes retention;
+  ASSERT_OK(log_anchor_registry_->GetEarliestRegisteredLogIndex(
+      &retention.for_durability));
+  int num_gced_segments;
+  ASSERT_OK(log_->GC(retention, &num_gced_segments));
+  ASSERT_EQ(3, num_gced_segments);
+  // Only two fit in the pool, the third one was deleted. One may already
+  // have been picked up as the next segment.
+  ASSERT_LE(count_recycled(), 2);
+
+  // Rolling over consumes the recycled segments.
+  ASSERT_OK(RollLog());
+  ASSERT_OK(AppendMultiSegmentSequence(3, 5, &op_id, nullptr));
+  ASSERT_EQ(0, count_recycled());
+  ASSERT_OK(log_->Close());
+
+  shared_ptr<LogReader> reader;
+  ASSERT_OK(LogReader::Open(
+      fs_manager_.get(), nullptr, kTestTablet, nullptr, &reader));
+  SegmentSequence segments;
+  ASSERT_OK(reader->GetSegmentsSnapshot(&segments));
+  ASSERT_EQ(4, segments.size()) << DumpSegmentsToString(segments);
+  int num_entries = 0;
+  for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+    entries_.clear();
+    ASSERT_OK(segment->ReadEntries(&entries_));
+    num_entries += entries_.size();
+  }
+  ASSERT_EQ(4 * 5, num_entries);
+}
+
+// Test that pre-zeroed segments, both new and recycled ones, are rolled over
+// to and read back like any others.
+TEST_P(LogTestOptionalCompression, TestPrezeroSegments) {
+  FLAGS_log_prezero_segments = true;
+  FLAGS_log_min_segments_to_retain = 1;
+  FLAGS_log_max_recycled_segments = 2;
+  ASSERT_OK(BuildLog());
+
+  vector<LogAnchor*> anchors;
+  ElementDeleter deleter(&anchors);
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(3, 5, &op_id, &anchors));
+  for (LogAnchor* anchor : anchors) {
+    ASSERT_OK(log_anchor_registry_->Unregister(anchor));
+  }
+  int num_gced_segments;
+  ASSERT_OK(log_->GC(RetentionIndexes(op_id.index()), &num_gced_segments));
+  ASSERT_GT(num_gced_segments, 0);
+  ASSERT_OK(RollLog());
+  ASSERT_OK(AppendMultiSegmentSequence(2, 5, &op_id, nullptr));
+  ASSERT_OK(log_->Close());
+
+  // The segments were zeroed, and the first append into each of them was
+  // recorded separately.
+  ASSERT_GT(METRIC_log_segment_prezero_latency.Instantiate(metric_entity_)
+                ->TotalCount(),
+            0);
+  ASSERT_GT(METRIC_log_post_roll_append_latency.Instantiate(metric_entity_)
+                ->TotalCount(),
+            0);
+
+  shared_ptr<LogReader> reader;
+  ASSERT_OK(LogReader::Open(
+      fs_manager_.get(), nullptr, kTestTablet, nullptr, &reader));
+  SegmentSequence segments;
+  ASSERT_OK(reader->GetSegmentsSnapshot(&segments));
+  int num_entries = 0;
+  for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+    entries_.clear();
+    ASSERT_OK(segment->ReadEntries(&entries_));
+    num_entries += entries_.size();
+  }
+  // The retained segment plus the two written after the GC.
+  ASSERT_GE(num_entries, 2 * 5);
+}
+
+// Test that GCed segments are moved to the archive, from which their ops can
+// still be read, also after the log is reopened, and that only the most
+// recent archived segments are kept.
+TEST_P(LogTestOptionalCompression, TestArchiveSegments) {
+  const int kNumOpsPerSegment = 10;
+  FLAGS_log_archive_dir = GetTestPath("wal-archive");
+  FLAGS_log_archive_max_segments = 2;
+  ASSERT_OK(BuildLog());
+  OpId op_id = MakeOpId(1, 1);
+  for (int i = 0; i < 5; i++) {
+    ASSERT_OK(AppendNoOps(&op_id, kNumOpsPerSegment));
+    ASSERT_OK(RollLog());
+  }
+  const int64_t last_index = op_id.index() - 1;
+
+  int num_gced_segments;
+  ASSERT_OK(log_->GC(RetentionIndexes(last_index + 1), &num_gced_segments));
+  ASSERT_GT(num_gced_segments, 2);
+  ASSERT_EQ(2, log_->reader()->num_archived_segments());
+  const string archive_dir =
+      JoinPathSegments(FLAGS_log_archive_dir, kTestTablet);
+  vector<string> files;
+  ASSERT_OK(env_util::ListFilesInDir(env_, archive_dir, &files));
+  ASSERT_EQ(2, files.size());
+
+  // The ops of the evicted segments are gone, those of the archived ones can
+  // still be read.
+  const int64_t first_archived_index =
+      (num_gced_segments - 2) * kNumOpsPerSegment + 1;
+  auto check_reads = [&]() {
+    vector<ReplicateMsg*> replicates;
+    ElementDeleter deleter(&replicates);
+    ASSERT_OK(log_->reader()->ReadReplicatesInRange(
+        first_archived_index,
+        last_index,
+        LogReader::kNoSizeLimit,
+        &replicates));
+    ASSERT_EQ(last_index - first_archived_index + 1, replicates.size());
+    for (int i = 0; i < replicates.size(); i++) {
+      ASSERT_EQ(first_archived_index + i, replicates[i]->id().index());
+    }
+    ASSERT_FALSE(log_->reader()
+                     ->ReadReplicatesInRange(
+                         first_archived_index - 1,
+                         first_archived_index - 1,
+                         LogReader::kNoSizeLimit,
+                         &replicates)
+                     .ok());
+  };
+  NO_FATALS(check_reads());
+
+  // The archive is picked up again when the log is reopened.
+  ASSERT_OK(log_->Close());
+  ASSERT_OK(BuildLog());
+  ASSERT_EQ(2, log_->reader()->num_archived_segments());
+  NO_FATALS(check_reads());
+}
+
+// Test that sealed segments are recompressed in place, that the reads which
+// held the segments before keep working, and that all ops can be read back
+// through the index, also after the log is reopened.
+TEST_P(LogTestOptionalCompression, TestRecompressSegments) {
+  const int kNumOpsPerSegment = 10;
+  FLAGS_log_index_durable = true;
+  FLAGS_log_recompression_codec = "ZSTD";
+  FLAGS_log_recompression_min_segment_age_s = 0;
+  ASSERT_OK(BuildLog());
+  OpId op_id = MakeOpId(1, 1);
+  for (int i = 0; i < 3; i++) {
+    ASSERT_OK(AppendNoOps(&op_id, kNumOpsPerSegment));
+    ASSERT_OK(RollLog());
+  }
+  const int64_t last_index = op_id.index() - 1;
+
+  SegmentSequence old_segments;
+  ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&old_segments));
+  ASSERT_GT(log_->GetRecompressibleDataSize(), 0);
+  int64_t bytes_saved;
+  ASSERT_OK(log_->RecompressSegments(1, &bytes_saved));
+  ASSERT_OK(log_->RecompressSegments(100, &bytes_saved));
+  ASSERT_EQ(0, log_->GetRecompressibleDataSize());
+
+  SegmentSequence segments;
+  ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  ASSERT_EQ(old_segments.size(), segments.size());
+  for (int i = 0; i + 1 < segments.size(); i++) {
+    ASSERT_NE(old_segments[i], segments[i]);
+    ASSERT_EQ(ZSTD, segments[i]->header().compression_codec());
+    ASSERT_EQ(
+        old_segments[i]->footer().num_entries(),
+        segments[i]->footer().num_entries());
+    entries_.clear();
+    ASSERT_OK(old_segments[i]->ReadEntries(&entries_));
+    ASSERT_EQ(segments[i]->footer().num_entries(), entries_.size());
+  }
+
+  auto check_reads = [&]() {
+    vector<ReplicateMsg*> replicates;
+    ElementDeleter deleter(&replicates);
+    ASSERT_OK(log_->reader()->ReadReplicatesInRange(
+        1, last_index, LogReader::kNoSizeLimit, &replicates));
+    ASSERT_EQ(last_index, replicates.size());
+    for (int i = 0; i < replicates.size(); i++) {
+      ASSERT_EQ(i + 1, replicates[i]->id().index());
+    }
+  };
+  NO_FATALS(check_reads());
+
+  ASSERT_OK(log_->Close());
+  ASSERT_OK(BuildLog());
+  NO_FATALS(check_reads());
+}
+
 // Test that Log::TotalSize() captures creation, addition, and deletion of log
 // segments.
 TEST_P(LogTestOptionalCompression, TestTotalSize) {
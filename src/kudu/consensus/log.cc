@@ -23,6 +23,8 @@
 
 #include "kudu/consensus/log.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cstdint>
 #include <memory>
@@ -40,7 +42,10 @@
 #include "kudu/consensus/log_reader.h"
 #include "kudu/consensus/log_util.h"
 #include "kudu/consensus/opid.pb.h"
+#include "kudu/fs/error_manager.h"
 #include "kudu/fs/fs_manager.h"
+#include "kudu/fs/io_scheduler.h"
+#include "kudu/fs/wal_dirs.h"
 #include "kudu/gutil/atomicops.h"
 #include "kudu/gutil/bind.h"
 #include "kudu/gutil/bind_helpers.h"
@@ -48,8 +53,10 @@
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/strings/util.h"
 #include "kudu/gutil/walltime.h"
 #include "kudu/util/async_util.h"
+#include "kudu/util/coding.h"
 #include "kudu/util/compression/compression.pb.h"
 #include "kudu/util/compression/compression_codec.h"
 #include "kudu/util/debug/trace_event.h"
@@ -61,6 +68,8 @@
 #include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
+#include "kudu/util/mutex.h"
+#include "kudu/util/os-util.h"
 #include "kudu/util/path_util.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/random.h"
@@ -89,6 +98,59 @@ TAG_FLAG(log_max_segments_to_retain, runtime);
 TAG_FLAG(log_max_segments_to_retain, advanced);
 TAG_FLAG(log_max_segments_to_retain, experimental);
 
+DEFINE_int32(
+    log_max_recycled_segments,
+    0,
+    "The maximum number of garbage collected log segments to keep around to "
+    "be reused as new segments, instead of deleting them. Reusing a segment "
+    "avoids allocating its blocks again. 0 disables segment recycling.");
+TAG_FLAG(log_max_recycled_segments, runtime);
+TAG_FLAG(log_max_recycled_segments, experimental);
+
+DEFINE_bool(
+    log_prezero_segments,
+    false,
+    "If true, the next log segment is filled with zeros in the background "
+    "before it is rolled over to, so appends into a freshly rolled segment "
+    "never write to unwritten extents, which some filesystems must convert "
+    "on the write path. Applies to newly created and recycled segments "
+    "alike, and only if segments are preallocated.");
+TAG_FLAG(log_prezero_segments, runtime);
+TAG_FLAG(log_prezero_segments, experimental);
+
+DEFINE_string(
+    log_archive_dir,
+    "",
+    "Directory, typically on cheaper storage, to which garbage collected log "
+    "segments are moved instead of being deleted, in a subdirectory per "
+    "tablet. Archived segments remain indexed, so that a peer which was down "
+    "for longer than the WAL retention can still be caught up from them. "
+    "Empty disables archiving.");
+TAG_FLAG(log_archive_dir, experimental);
+
+DEFINE_int32(
+    log_sync_marker_interval_bytes,
+    0,
+    "If positive, a sync marker is written to new WAL segments after every "
+    "this many bytes, once the entries before it are synced. When a segment "
+    "is left without a footer by a crash, its footer is then rebuilt from the "
+    "last marker, found with a binary search, and the entries after it, "
+    "rather than by reading the whole segment. Segments with markers can't be "
+    "read by versions which don't support them. 0 disables the markers.");
+DEFINE_validator(
+    log_sync_marker_interval_bytes,
+    [](const char* /*n*/, int32_t v) { return v >= 0; });
+TAG_FLAG(log_sync_marker_interval_bytes, experimental);
+TAG_FLAG(log_sync_marker_interval_bytes, runtime);
+
+DEFINE_int32(
+    log_archive_max_segments,
+    100,
+    "The maximum number of archived log segments to keep per tablet, see "
+    "--log_archive_dir. The oldest ones are deleted first. 0 keeps them all.");
+TAG_FLAG(log_archive_max_segments, runtime);
+TAG_FLAG(log_archive_max_segments, experimental);
+
 // Group commit configuration.
 // -----------------------------
 DEFINE_int32(
@@ -105,6 +167,36 @@ DEFINE_int32(
 TAG_FLAG(log_thread_idle_threshold_ms, experimental);
 TAG_FLAG(log_thread_idle_threshold_ms, hidden);
 
+DEFINE_bool(
+    log_pipelined_append,
+    false,
+    "If true, the WAL append thread writes the next group of entry batches "
+    "into the active segment while the previous group is being fsynced on a "
+    "separate thread. Callbacks are still run in append order, and a group's "
+    "callbacks only run once the group has been synced.");
+TAG_FLAG(log_pipelined_append, experimental);
+
+DEFINE_int32(
+    log_group_commit_max_delay_us,
+    0,
+    "Upper bound on how long the WAL append thread may wait, after draining "
+    "the first entry batches of a group, for more batches to arrive before "
+    "appending and syncing the group. The actual delay adapts to the observed "
+    "sync latency and batch arrival rate, and is zero when no further batch "
+    "is expected in time. 0 disables adaptive group commit.");
+TAG_FLAG(log_group_commit_max_delay_us, experimental);
+TAG_FLAG(log_group_commit_max_delay_us, runtime);
+
+DEFINE_int32(
+    log_group_commit_target_latency_us,
+    2000,
+    "Target group commit latency for adaptive group commit. The append thread "
+    "never delays a group for longer than this target minus the observed "
+    "sync latency. Only has an effect if --log_group_commit_max_delay_us "
+    "is positive.");
+TAG_FLAG(log_group_commit_target_latency_us, experimental);
+TAG_FLAG(log_group_commit_target_latency_us, runtime);
+
 // Compression configuration.
 // -----------------------------
 DEFINE_string(
@@ -113,6 +205,42 @@ DEFINE_string(
     "Codec to use for compressing WAL segments.");
 TAG_FLAG(log_compression_codec, experimental);
 
+DEFINE_string(
+    log_recompression_codec,
+    "",
+    "Codec with which the log recompression maintenance op rewrites sealed "
+    "WAL segments which were written with another codec, e.g. ZSTD, to cut "
+    "the disk footprint of the retained history and the bandwidth needed to "
+    "read it. Requires --log_index_durable. Empty disables recompression.");
+DEFINE_validator(
+    log_recompression_codec,
+    [](const char* /*n*/, const std::string& v) {
+      // Log segments are read without a dictionary.
+      kudu::CompressionType type;
+      return v.empty() ||
+          (kudu::CompressionType_Parse(v, &type) &&
+           (type == kudu::SNAPPY || type == kudu::LZ4 ||
+            type == kudu::ZLIB || type == kudu::ZSTD));
+    });
+TAG_FLAG(log_recompression_codec, experimental);
+TAG_FLAG(log_recompression_codec, runtime);
+
+DEFINE_int32(
+    log_recompression_level,
+    19,
+    "Compression level of --log_recompression_codec, if it supports levels.");
+TAG_FLAG(log_recompression_level, experimental);
+TAG_FLAG(log_recompression_level, runtime);
+
+DEFINE_int32(
+    log_recompression_min_segment_age_s,
+    600,
+    "Minimum time since a WAL segment was closed before it is recompressed, "
+    "so that the most recent segments, which most catch-up reads are served "
+    "from, stay in the faster codec.");
+TAG_FLAG(log_recompression_min_segment_age_s, experimental);
+TAG_FLAG(log_recompression_min_segment_age_s, runtime);
+
 // Fault/latency injection flags.
 // -----------------------------
 DEFINE_bool(
@@ -194,6 +322,44 @@ DEFINE_validator(fs_wal_dir_reserved_bytes, [](const char* /*n*/, int64_t v) {
 TAG_FLAG(fs_wal_dir_reserved_bytes, runtime);
 TAG_FLAG(fs_wal_dir_reserved_bytes, evolving);
 
+DEFINE_string(
+    log_append_thread_cpus,
+    "",
+    "CPUs to pin the WAL append threads to, in the format of taskset(1), "
+    "e.g. '4-5'. If empty, the append threads may run on any CPU.");
+TAG_FLAG(log_append_thread_cpus, experimental);
+
+DEFINE_int32(
+    log_append_thread_spin_us,
+    0,
+    "How long (in microseconds) the WAL append thread busy-polls its queue "
+    "for the next entry batch before parking, which saves the wakeup latency "
+    "of the batch. It only spins while batches have recently been arriving "
+    "within that time, and within --log_append_thread_spin_cpu_budget_pct. "
+    "Best combined with dedicated CPUs, see --log_append_thread_cpus. "
+    "0 disables spinning.");
+TAG_FLAG(log_append_thread_spin_us, experimental);
+TAG_FLAG(log_append_thread_spin_us, runtime);
+
+static bool ValidatePercentage(const char* flagname, int32_t value) {
+  if (value >= 0 && value <= 100) {
+    return true;
+  }
+  LOG(ERROR) << strings::Substitute(
+      "$0 must be between 0 and 100, value $1 is invalid", flagname, value);
+  return false;
+}
+
+DEFINE_int32(
+    log_append_thread_spin_cpu_budget_pct,
+    10,
+    "Maximum percentage of the wall time each WAL append thread may spend "
+    "spinning for entry batches, see --log_append_thread_spin_us.");
+DEFINE_validator(log_append_thread_spin_cpu_budget_pct, &ValidatePercentage);
+TAG_FLAG(log_append_thread_spin_cpu_budget_pct, experimental);
+TAG_FLAG(log_append_thread_spin_cpu_budget_pct, runtime);
+
+DECLARE_bool(log_index_durable);
 DECLARE_bool(raft_derived_log_mode);
 
 // Validate that log_min_segments_to_retain >= 1
@@ -245,6 +411,15 @@ using strings::Substitute;
 //    GoIdle().
 //
 // See the implementation comments in Wake() and GoIdle() for details.
+//
+// When --log_pipelined_append is set, appending a group is split into two
+// stages. The write stage runs on the append thread and writes every batch of
+// the group into the active segment. The sync stage runs on a second
+// single-threaded pool and fsyncs the segment, then runs the group's
+// callbacks. At most one group is in the sync stage at a time, so the write of
+// group N+1 overlaps with the sync of group N while callbacks are still run in
+// append order. Anything that needs the active segment to be quiescent (e.g.
+// a roll-over) must call WaitForPendingSync() first.
 class Log::AppendThread {
  public:
   explicit AppendThread(Log* log);
@@ -267,11 +442,26 @@ class Log::AppendThread {
     return base::subtle::NoBarrier_Load(&worker_state_) == WORKER_ACTIVE;
   }
 
+  // Blocks until the group currently in the sync stage, if any, has been
+  // synced and its callbacks have run. No-op if pipelining is disabled.
+  void WaitForPendingSync();
+
  private:
   // The task submitted to the threadpool which collects batches from the queue
   // and appends them, until it determines that the queue is idle.
   void DoWork();
 
+  // Returns how long to keep collecting batches for the group which was just
+  // started with 'num_batches' batches, according to the adaptive group commit
+  // policy. Also updates the arrival rate estimate.
+  MonoDelta ComputeGroupCommitDelay(size_t num_batches);
+
+  // Busy-polls the queue for up to --log_append_thread_spin_us if batches
+  // have been arriving within that time and the CPU budget allows it, so
+  // that the next BlockingDrainTo() finds a batch without parking. Returns
+  // whether a batch showed up.
+  bool SpinForNextBatch();
+
   // Tries to transition back to WORKER_STOPPED state. If successful, returns
   // true.
   //
@@ -283,6 +473,15 @@ class Log::AppendThread {
   // the LogEntryBatch* pointers.
   void HandleGroup(vector<LogEntryBatch*> entry_batches);
 
+  // Syncs the log if required and runs the callbacks of 'entry_batches', in
+  // order. Responsible for deleting the LogEntryBatch* pointers. In pipelined
+  // mode this runs on 'sync_pool_', otherwise inline on the append thread.
+  // 'group_start' is the time at which the write stage of the group started.
+  void SyncGroup(
+      const vector<LogEntryBatch*>& entry_batches,
+      bool needs_sync,
+      MonoTime group_start);
+
   string LogPrefix() const;
 
   Log* const log_;
@@ -301,6 +500,26 @@ class Log::AppendThread {
   // Pool with a single thread, which handles shutting down the thread
   // when idle.
   gscoped_ptr<ThreadPool> append_pool_;
+
+  // Pool with a single thread running the sync stage. Only created if
+  // --log_pipelined_append is set when the log is opened.
+  gscoped_ptr<ThreadPool> sync_pool_;
+
+  // Set while a group is queued or running in the sync stage. Used to count
+  // the groups whose write stage overlapped with a sync.
+  std::atomic<bool> sync_in_flight_{false};
+
+  // Adaptive group commit state. Exponentially weighted moving averages of
+  // the sync latency (updated by whichever thread runs the sync stage) and of
+  // the interval between batch arrivals (only used by the append thread).
+  std::atomic<int64_t> ewma_sync_us_{0};
+  double ewma_arrival_interval_us_ = 0;
+  MonoTime last_group_start_;
+
+  // Spinning CPU budget state, only used by the append thread: when the
+  // current budget window started, and how long the thread spun in it.
+  MonoTime spin_window_start_;
+  int64_t spin_window_us_ = 0;
 };
 
 Log::AppendThread::AppendThread(Log* log) : log_(log) {}
@@ -308,6 +527,10 @@ Log::AppendThread::AppendThread(Log* log) : log_(log) {}
 Status Log::AppendThread::Init() {
   DCHECK(!append_pool_) << "Already initialized";
   VLOG_WITH_PREFIX(1) << "Starting log append thread";
+  vector<int> cpus;
+  RETURN_NOT_OK_PREPEND(
+      ParseCpuList(FLAGS_log_append_thread_cpus, &cpus),
+      "could not parse --log_append_thread_cpus flag");
   RETURN_NOT_OK(ThreadPoolBuilder("wal-append")
                     .set_min_threads(0)
                     // Only need one thread since we'll only schedule one
@@ -316,10 +539,25 @@ Status Log::AppendThread::Init() {
                     // No need for keeping idle threads, since the task itself
                     // handles waiting for work while idle.
                     .set_idle_timeout(MonoDelta::FromSeconds(0))
+                    .set_cpu_affinity(std::move(cpus))
                     .Build(&append_pool_));
+  if (FLAGS_log_pipelined_append) {
+    RETURN_NOT_OK(ThreadPoolBuilder("wal-sync")
+                      .set_min_threads(0)
+                      // A single thread keeps syncs, and therefore callbacks,
+                      // in append order.
+                      .set_max_threads(1)
+                      .Build(&sync_pool_));
+  }
   return Status::OK();
 }
 
+void Log::AppendThread::WaitForPendingSync() {
+  if (sync_pool_) {
+    sync_pool_->Wait();
+  }
+}
+
 void Log::AppendThread::Wake() {
   DCHECK(append_pool_);
   auto old_status = base::subtle::NoBarrier_CompareAndSwap(
@@ -380,6 +618,7 @@ void Log::AppendThread::DoWork() {
     MonoTime deadline = MonoTime::Now() +
         MonoDelta::FromMilliseconds(FLAGS_log_thread_idle_threshold_ms);
     vector<LogEntryBatch*> entry_batches;
+    SpinForNextBatch();
     Status s = log_->entry_queue()->BlockingDrainTo(&entry_batches, deadline);
     if (PREDICT_FALSE(s.IsAborted())) {
       break;
@@ -388,11 +627,108 @@ void Log::AppendThread::DoWork() {
         break;
       continue;
     }
+    if (log_->metrics_) {
+      log_->metrics_->append_wakeup_latency->Increment(
+          (MonoTime::Now() - entry_batches.front()->enqueue_time_)
+              .ToMicroseconds());
+    }
+
+    // Give more batches a chance to join this group, so that they share its
+    // sync. Anything drained here is appended in the same order as if it had
+    // been drained with the first batches.
+    MonoDelta delay = ComputeGroupCommitDelay(entry_batches.size());
+    if (delay.ToMicroseconds() > 0) {
+      MonoTime coalesce_start = MonoTime::Now();
+      MonoTime coalesce_deadline = coalesce_start + delay;
+      while (MonoTime::Now() < coalesce_deadline) {
+        Status cs = log_->entry_queue()->BlockingDrainTo(
+            &entry_batches, coalesce_deadline);
+        if (!cs.ok()) {
+          // Either we timed out or the queue is shutting down. In the latter
+          // case the next BlockingDrainTo() above returns Aborted.
+          break;
+        }
+      }
+      if (log_->metrics_) {
+        log_->metrics_->group_commit_delay->Increment(
+            (MonoTime::Now() - coalesce_start).ToMicroseconds());
+      }
+    }
     HandleGroup(std::move(entry_batches));
   }
   VLOG_WITH_PREFIX(2) << "WAL Appender going idle";
 }
 
+bool Log::AppendThread::SpinForNextBatch() {
+  // How often the spinning CPU budget is replenished.
+  static const MonoDelta kSpinBudgetWindow = MonoDelta::FromSeconds(1);
+
+  const int32_t spin_us = FLAGS_log_append_thread_spin_us;
+  if (spin_us <= 0 || ewma_arrival_interval_us_ == 0 ||
+      ewma_arrival_interval_us_ > spin_us) {
+    return false;
+  }
+  const MonoTime start = MonoTime::Now();
+  if (!spin_window_start_.Initialized() ||
+      start - spin_window_start_ >= kSpinBudgetWindow) {
+    spin_window_start_ = start;
+    spin_window_us_ = 0;
+  }
+  const int64_t budget_us = kSpinBudgetWindow.ToMicroseconds() *
+      FLAGS_log_append_thread_spin_cpu_budget_pct / 100;
+  if (spin_window_us_ >= budget_us) {
+    return false;
+  }
+  const MonoTime deadline = start +
+      MonoDelta::FromMicroseconds(
+          std::min<int64_t>(spin_us, budget_us - spin_window_us_));
+
+  bool found = false;
+  MonoTime now = start;
+  while (now < deadline) {
+    if (!log_->entry_queue()->empty()) {
+      found = true;
+      break;
+    }
+    base::subtle::PauseCPU();
+    now = MonoTime::Now();
+  }
+  const int64_t spun_us = (now - start).ToMicroseconds();
+  spin_window_us_ += spun_us;
+  if (log_->metrics_) {
+    log_->metrics_->append_thread_spin_time->IncrementBy(spun_us);
+    if (found) {
+      log_->metrics_->append_thread_spin_hits->Increment();
+    }
+  }
+  return found;
+}
+
+MonoDelta Log::AppendThread::ComputeGroupCommitDelay(size_t num_batches) {
+  // Weight given to the newest sample in the moving averages.
+  static const double kEwmaAlpha = 0.2;
+
+  MonoTime now = MonoTime::Now();
+  if (last_group_start_.Initialized()) {
+    double interval_us = (now - last_group_start_).ToMicroseconds() /
+        static_cast<double>(std::max<size_t>(num_batches, 1));
+    ewma_arrival_interval_us_ = ewma_arrival_interval_us_ == 0
+        ? interval_us
+        : kEwmaAlpha * interval_us +
+            (1 - kEwmaAlpha) * ewma_arrival_interval_us_;
+  }
+  last_group_start_ = now;
+
+  if (!log_->force_sync_all_ || log_->sync_disabled_) {
+    return MonoDelta::FromMicroseconds(0);
+  }
+  return MonoDelta::FromMicroseconds(GroupCommitDelayUs(
+      FLAGS_log_group_commit_max_delay_us,
+      FLAGS_log_group_commit_target_latency_us,
+      ewma_sync_us_.load(std::memory_order_relaxed),
+      ewma_arrival_interval_us_));
+}
+
 void Log::AppendThread::HandleGroup(vector<LogEntryBatch*> entry_batches) {
   CHECK(!FLAGS_raft_derived_log_mode);
   if (log_->metrics_) {
@@ -400,31 +736,80 @@ void Log::AppendThread::HandleGroup(vector<LogEntryBatch*> entry_batches) {
   }
   TRACE_EVENT1("log", "batch", "batch_size", entry_batches.size());
 
-  SCOPED_LATENCY_METRIC(log_->metrics_, group_commit_latency);
+  const MonoTime group_start = MonoTime::Now();
+  if (sync_pool_ && sync_in_flight_.load(std::memory_order_acquire) &&
+      log_->metrics_) {
+    log_->metrics_->pipelined_groups_overlapped->Increment();
+  }
 
   bool is_all_commits = true;
-  for (LogEntryBatch* entry_batch : entry_batches) {
-    TRACE_EVENT_FLOW_END0("log", "Batch", entry_batch);
-    Status s = log_->DoAppend(entry_batch);
-    if (PREDICT_FALSE(!s.ok())) {
-      LOG_WITH_PREFIX(ERROR) << "Error appending to the log: " << s.ToString();
-      // TODO(af): If a single transaction fails to append, should we
-      // abort all subsequent transactions in this batch or allow
-      // them to be appended? What about transactions in future
-      // batches?
-      if (!entry_batch->callback().is_null()) {
-        entry_batch->callback().Run(s);
-        entry_batch->callback_.Reset();
-      }
-    }
-    if (is_all_commits && entry_batch->type_ != COMMIT) {
+  for (const LogEntryBatch* entry_batch : entry_batches) {
+    if (entry_batch->type_ != COMMIT) {
       is_all_commits = false;
+      break;
     }
   }
+  // With io_uring, the write of the last batch and the sync of the whole group
+  // are submitted together. The Log::Sync() that follows then finds nothing
+  // left to sync, but still runs the sync hooks. This isn't done in pipelined
+  // mode, where syncing is the job of the sync stage.
+  bool sync_with_last_write = !is_all_commits && !sync_pool_ &&
+      log_->options_.use_io_uring && log_->force_sync_all_ &&
+      !log_->sync_disabled_;
+  {
+    SCOPED_LATENCY_METRIC(log_->metrics_, group_write_stage_latency);
+    for (LogEntryBatch* entry_batch : entry_batches) {
+      TRACE_EVENT_FLOW_END0("log", "Batch", entry_batch);
+      Status s = log_->DoAppend(
+          entry_batch,
+          sync_with_last_write && entry_batch == entry_batches.back());
+      if (PREDICT_FALSE(!s.ok())) {
+        LOG_WITH_PREFIX(ERROR)
+            << "Error appending to the log: " << s.ToString();
+        // TODO(af): If a single transaction fails to append, should we
+        // abort all subsequent transactions in this batch or allow
+        // them to be appended? What about transactions in future
+        // batches?
+        if (!entry_batch->callback().is_null()) {
+          entry_batch->callback().Run(s);
+          entry_batch->callback_.Reset();
+        }
+      }
+    }
+  }
+
+  if (!sync_pool_) {
+    SyncGroup(entry_batches, !is_all_commits, group_start);
+    return;
+  }
 
+  // Only one group may be in the sync stage at a time. Waiting here (rather
+  // than before the write stage) is what lets the write of this group overlap
+  // with the sync of the previous one.
+  WaitForPendingSync();
+  sync_in_flight_.store(true, std::memory_order_release);
+  bool needs_sync = !is_all_commits;
+  CHECK_OK(sync_pool_->SubmitFunc([this, entry_batches, needs_sync,
+                                   group_start]() {
+    SyncGroup(entry_batches, needs_sync, group_start);
+    sync_in_flight_.store(false, std::memory_order_release);
+  }));
+}
+
+void Log::AppendThread::SyncGroup(
+    const vector<LogEntryBatch*>& entry_batches,
+    bool needs_sync,
+    MonoTime group_start) {
   Status s;
-  if (!is_all_commits) {
+  if (needs_sync) {
+    SCOPED_LATENCY_METRIC(log_->metrics_, group_sync_stage_latency);
+    MonoTime sync_start = MonoTime::Now();
     s = log_->Sync();
+    int64_t sync_us = (MonoTime::Now() - sync_start).ToMicroseconds();
+    int64_t old_ewma = ewma_sync_us_.load(std::memory_order_relaxed);
+    ewma_sync_us_.store(
+        old_ewma == 0 ? sync_us : (sync_us + 4 * old_ewma) / 5,
+        std::memory_order_relaxed);
   }
   if (PREDICT_FALSE(!s.ok())) {
     LOG_WITH_PREFIX(ERROR) << "Error syncing log: " << s.ToString();
@@ -449,6 +834,10 @@ void Log::AppendThread::HandleGroup(vector<LogEntryBatch*> entry_batches) {
       delete entry_batch;
     }
   }
+  if (log_->metrics_) {
+    log_->metrics_->group_commit_latency->Increment(
+        (MonoTime::Now() - group_start).ToMicroseconds());
+  }
 }
 
 void Log::AppendThread::Shutdown() {
@@ -457,6 +846,12 @@ void Log::AppendThread::Shutdown() {
     append_pool_->Wait();
     append_pool_->Shutdown();
   }
+  // The append thread is done by now, so any group left in the sync stage is
+  // the last one.
+  if (sync_pool_) {
+    sync_pool_->Wait();
+    sync_pool_->Shutdown();
+  }
 }
 
 string Log::AppendThread::LogPrefix() const {
@@ -535,6 +930,10 @@ Log::Log(
       fs_manager_(fs_manager),
       log_dir_(std::move(log_path)),
       tablet_id_(std::move(tablet_id)),
+      wal_dir_(
+          fs_manager && fs_manager->wal_dir_manager()
+              ? fs_manager->wal_dir_manager()->GetOrPlaceTablet(tablet_id_)
+              : nullptr),
 #ifdef FB_DO_NOT_REMOVE
       schema_(schema),
       schema_version_(schema_version),
@@ -588,23 +987,40 @@ Status Log::Init() {
 
   // Init the index
   log_index_.reset(new LogIndex(log_dir_));
+  int64_t indexed_segment_seqno = -1;
+  if (FLAGS_log_index_durable) {
+    RETURN_NOT_OK_PREPEND(
+        log_index_->OpenDurable(
+            fs_manager_->env(), metric_entity_, &indexed_segment_seqno),
+        "Unable to open log index");
+  }
 
   // Reader for previous segments.
   RETURN_NOT_OK(LogReader::Open(
       fs_manager_, log_index_, tablet_id_, metric_entity_.get(), &reader_));
+  reader_->set_io_scheduler(io_scheduler());
+
+  if (!FLAGS_log_archive_dir.empty()) {
+    RETURN_NOT_OK_PREPEND(
+        OpenArchivedSegments(indexed_segment_seqno),
+        "Unable to open archived log segments");
+  }
+
+  if (FLAGS_log_index_durable) {
+    RETURN_NOT_OK(IndexSegmentsAfter(indexed_segment_seqno));
+  }
 
   // The case where we are continuing an existing log.
   // We must pick up where the previous WAL left off in terms of
   // sequence numbers.
-  if (reader_->num_segments() != 0) {
-    VLOG_WITH_PREFIX(1) << "Using existing " << reader_->num_segments()
-                        << " segments from path: "
-                        << fs_manager_->GetWalsRootDir();
-
-    vector<scoped_refptr<ReadableLogSegment>> segments;
-    RETURN_NOT_OK(reader_->GetSegmentsSnapshot(&segments));
-    active_segment_sequence_number_ =
-        segments.back()->header().sequence_number();
+  // Only the last segment is needed to continue the log, so this doesn't
+  // wait for the older segments of a lazily opened log.
+  const int64_t last_segment_seqno = reader_->GetLastSegmentSequenceNumber();
+  if (last_segment_seqno != -1) {
+    VLOG_WITH_PREFIX(1) << "Continuing existing log after segment "
+                        << last_segment_seqno
+                        << " from path: " << fs_manager_->GetWalsRootDir();
+    active_segment_sequence_number_ = last_segment_seqno;
   }
 
   if (force_sync_all_) {
@@ -654,6 +1070,35 @@ Status Log::CloseCurrentSegment() {
   return Status::OK();
 }
 
+Status Log::IndexSegmentsAfter(int64_t indexed_segment_seqno) {
+  const int64_t last_segment_seqno = reader_->GetLastSegmentSequenceNumber();
+  if (last_segment_seqno == -1 || last_segment_seqno <= indexed_segment_seqno) {
+    return Status::OK();
+  }
+  SegmentSequence segments;
+  if (indexed_segment_seqno == -1) {
+    RETURN_NOT_OK(reader_->GetSegmentsSnapshot(&segments));
+  } else {
+    // Doesn't wait for the older segments of a lazily opened log.
+    for (int64_t seqno = indexed_segment_seqno + 1;
+         seqno <= last_segment_seqno;
+         seqno++) {
+      scoped_refptr<ReadableLogSegment> segment =
+          reader_->GetSegmentBySequenceNumber(seqno);
+      if (segment) {
+        segments.push_back(std::move(segment));
+      }
+    }
+  }
+  LOG_WITH_PREFIX(INFO) << "Indexing " << segments.size()
+                        << " log segments after segment "
+                        << indexed_segment_seqno;
+  for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+    RETURN_NOT_OK(LogReader::IndexSegment(segment.get(), log_index_.get()));
+  }
+  return log_index_->Flush(last_segment_seqno);
+}
+
 Status Log::RollOver() {
   CHECK(!FLAGS_raft_derived_log_mode);
   SCOPED_LATENCY_METRIC(metrics_, roll_latency);
@@ -663,8 +1108,14 @@ Status Log::RollOver() {
 
   DCHECK_EQ(allocation_state(), kAllocationFinished);
 
+  // The sync stage may still be syncing the segment we're about to close.
+  append_thread_->WaitForPendingSync();
   RETURN_NOT_OK(Sync());
   RETURN_NOT_OK(CloseCurrentSegment());
+  if (FLAGS_log_index_durable) {
+    std::lock_guard<Mutex> index_flush_lock(index_flush_lock_);
+    RETURN_NOT_OK(log_index_->Flush(active_segment_sequence_number_));
+  }
 
   RETURN_NOT_OK(SwitchToAllocatedSegment());
 
@@ -676,11 +1127,15 @@ Status Log::RollOver() {
 Status Log::CreateBatchFromPB(
     LogEntryTypePB type,
     unique_ptr<LogEntryBatchPB> entry_batch_pb,
-    unique_ptr<LogEntryBatch>* entry_batch) {
+    unique_ptr<LogEntryBatch>* entry_batch,
+    const vector<ReplicateRefPtr>* replicates) {
   CHECK(!FLAGS_raft_derived_log_mode);
   int num_ops = entry_batch_pb->entry_size();
   unique_ptr<LogEntryBatch> new_entry_batch(
       new LogEntryBatch(type, std::move(entry_batch_pb), num_ops));
+  if (replicates) {
+    new_entry_batch->SetReplicates(*replicates);
+  }
   new_entry_batch->Serialize();
   TRACE("Serialized $0 byte log entry", new_entry_batch->total_size_bytes());
 
@@ -695,6 +1150,7 @@ Status Log::AsyncAppend(
   TRACE_EVENT0("log", "Log::AsyncAppend");
 
   entry_batch->set_callback(callback);
+  entry_batch->enqueue_time_ = MonoTime::Now();
   TRACE_EVENT_FLOW_BEGIN0("log", "Batch", entry_batch.get());
   if (PREDICT_FALSE(!entry_batch_queue_.BlockingPut(entry_batch.get()))) {
     TRACE_EVENT_FLOW_END0("log", "Batch", entry_batch.get());
@@ -713,8 +1169,8 @@ Status Log::AsyncAppendReplicates(
       CreateBatchFromAllocatedOperations(replicates);
 
   unique_ptr<LogEntryBatch> batch;
-  RETURN_NOT_OK(CreateBatchFromPB(REPLICATE, std::move(batch_pb), &batch));
-  batch->SetReplicates(replicates);
+  RETURN_NOT_OK(CreateBatchFromPB(
+      REPLICATE, std::move(batch_pb), &batch, &replicates));
   return AsyncAppend(std::move(batch), callback);
 }
 
@@ -738,7 +1194,7 @@ Status Log::AsyncAppendCommit(
   return Status::OK();
 }
 
-Status Log::DoAppend(LogEntryBatch* entry_batch) {
+Status Log::DoAppend(LogEntryBatch* entry_batch, bool sync) {
   CHECK(!FLAGS_raft_derived_log_mode);
   size_t num_entries = entry_batch->count();
   DCHECK_GT(num_entries, 0)
@@ -748,7 +1204,7 @@ Status Log::DoAppend(LogEntryBatch* entry_batch) {
       FLAGS_log_inject_io_error_on_append_fraction,
       Status::IOError("Injected IOError in Log::DoAppend()"));
 
-  Slice entry_batch_data = entry_batch->data();
+  const vector<Slice>& entry_batch_data = entry_batch->data();
   uint32_t entry_batch_bytes = entry_batch->total_size_bytes();
   // If there is no data to write return OK.
   if (PREDICT_FALSE(entry_batch_bytes == 0)) {
@@ -788,7 +1244,18 @@ Status Log::DoAppend(LogEntryBatch* entry_batch) {
     SCOPED_LATENCY_METRIC(metrics_, append_latency);
     SCOPED_WATCH_STACK(0);
 
-    RETURN_NOT_OK(active_segment_->WriteEntryBatch(entry_batch_data, codec_));
+    fs::ScopedIO io(io_scheduler(), fs::IOScheduler::WAL);
+    MonoTime write_start = MonoTime::Now();
+    RETURN_NOT_OK_HANDLE_DISK_FAILURE(
+        active_segment_->WriteEntryBatch(entry_batch_data, codec_, sync),
+        HandleDiskFailure());
+    if (first_append_in_segment_) {
+      first_append_in_segment_ = false;
+      if (metrics_) {
+        metrics_->post_roll_append_latency->Increment(
+            (MonoTime::Now() - write_start).ToMicroseconds());
+      }
+    }
 
     // Update the reader on how far it can read the active segment.
     reader_->UpdateLastSegmentOffset(active_segment_->written_offset());
@@ -805,6 +1272,14 @@ Status Log::DoAppend(LogEntryBatch* entry_batch) {
   CHECK_OK(UpdateIndexForBatch(*entry_batch, start_offset));
   UpdateFooterForBatch(entry_batch);
 
+  if (active_segment_->NeedsSyncMarker()) {
+    fs::ScopedIO io(io_scheduler(), fs::IOScheduler::WAL);
+    RETURN_NOT_OK_HANDLE_DISK_FAILURE(
+        active_segment_->WriteSyncMarker(footer_builder_, codec_, sync),
+        HandleDiskFailure());
+    reader_->UpdateLastSegmentOffset(active_segment_->written_offset());
+  }
+
   return Status::OK();
 }
 
@@ -873,7 +1348,13 @@ Status Log::Sync() {
   if (force_sync_all_ && !sync_disabled_) {
     LOG_SLOW_EXECUTION(
         WARNING, 50, Substitute("$0Fsync log took a long time", LogPrefix())) {
-      RETURN_NOT_OK(active_segment_->Sync());
+      const MonoTime start = MonoTime::Now();
+      fs::ScopedIO io(io_scheduler(), fs::IOScheduler::WAL);
+      RETURN_NOT_OK_HANDLE_DISK_FAILURE(
+          active_segment_->Sync(), HandleDiskFailure());
+      if (wal_dir_) {
+        wal_dir_->RecordSync(MonoTime::Now() - start);
+      }
 
       if (log_hooks_) {
         RETURN_NOT_OK_PREPEND(
@@ -889,6 +1370,21 @@ Status Log::Sync() {
   return Status::OK();
 }
 
+// Fills 'replay_size' from 'segments', see Log::GetReplaySizeMap().
+static void BuildReplaySizeMap(
+    const SegmentSequence& segments,
+    std::map<int64_t, int64_t>* replay_size) {
+  replay_size->clear();
+  int64_t cumulative_size = 0;
+  for (const auto& segment : boost::adaptors::reverse(segments)) {
+    if (!segment->HasFooter())
+      continue;
+    cumulative_size += segment->file_size();
+    int64_t max_repl_idx = segment->footer().max_replicate_index();
+    (*replay_size)[max_repl_idx] = cumulative_size;
+  }
+}
+
 int GetPrefixSizeToGC(
     RetentionIndexes retention_indexes,
     const SegmentSequence& segments) {
@@ -1009,6 +1505,9 @@ Status Log::GC(RetentionIndexes retention_indexes, int32_t* num_gced) {
     }
 
     // Now that they are no longer referenced by the Log, delete the files.
+    // A segment may be in the middle of being rewritten, in which case the
+    // rewritten file is the one to delete.
+    std::lock_guard<Mutex> rewrite_lock(rewrite_lock_);
     *num_gced = 0;
     for (const scoped_refptr<ReadableLogSegment>& segment :
          segments_to_delete) {
@@ -1020,14 +1519,24 @@ Status Log::GC(RetentionIndexes retention_indexes, int32_t* num_gced) {
             segment->footer().min_replicate_index(),
             segment->footer().max_replicate_index());
       }
-      LOG_WITH_PREFIX(INFO)
-          << "Deleting log segment in path: " << segment->path() << ops_str;
-      RETURN_NOT_OK(fs_manager_->env()->DeleteFile(segment->path()));
+      // Only recycle segments which nobody is reading from anymore, since the
+      // contents are discarded on reuse.
+      if (!FLAGS_log_archive_dir.empty() && ArchiveSegment(segment)) {
+        LOG_WITH_PREFIX(INFO)
+            << "Archived log segment in path: " << segment->path() << ops_str;
+      } else if (segment->HasOneRef() && RecycleSegment(segment->path())) {
+        LOG_WITH_PREFIX(INFO)
+            << "Recycled log segment in path: " << segment->path() << ops_str;
+      } else {
+        LOG_WITH_PREFIX(INFO)
+            << "Deleting log segment in path: " << segment->path() << ops_str;
+        RETURN_NOT_OK(fs_manager_->env()->DeleteFile(segment->path()));
+      }
       (*num_gced)++;
     }
 
     // Determine the minimum remaining replicate index in order to properly GC
-    // the index chunks.
+    // the index chunks. This includes the archived segments.
     int64_t min_remaining_op_idx = reader_->GetMinReplicateIndex();
     if (min_remaining_op_idx > 0) {
       log_index_->GC(min_remaining_op_idx);
@@ -1036,6 +1545,217 @@ Status Log::GC(RetentionIndexes retention_indexes, int32_t* num_gced) {
   return Status::OK();
 }
 
+Status Log::GetSegmentsToRecompress(
+    int max_segments,
+    SegmentSequence* segments) const {
+  segments->clear();
+  const string codec_name = FLAGS_log_recompression_codec;
+  if (codec_name.empty()) {
+    return Status::OK();
+  }
+  const CompressionType type =
+      CompressionCodecManager::GetCodecType(codec_name);
+  const int64_t closed_before = GetCurrentTimeMicros() -
+      FLAGS_log_recompression_min_segment_age_s * 1000000LL;
+  SegmentSequence all_segments;
+  RETURN_NOT_OK(reader_->GetSegmentsSnapshot(&all_segments));
+  // The last segment is the one being written to.
+  for (int i = 0; i + 1 < static_cast<int>(all_segments.size()) &&
+       static_cast<int>(segments->size()) < max_segments;
+       i++) {
+    const scoped_refptr<ReadableLogSegment>& segment = all_segments[i];
+    if (!segment->HasFooter() ||
+        segment->header().compression_codec() == type) {
+      continue;
+    }
+    if (segment->footer().has_close_timestamp_micros() &&
+        segment->footer().close_timestamp_micros() > closed_before) {
+      break;
+    }
+    segments->push_back(segment);
+  }
+  return Status::OK();
+}
+
+int64_t Log::GetRecompressibleDataSize() const {
+  CHECK(!FLAGS_raft_derived_log_mode);
+  SegmentSequence segments;
+  {
+    shared_lock<rw_spinlock> l(state_lock_.get_lock());
+    if (log_state_ != kLogWriting) {
+      return 0;
+    }
+  }
+  if (!FLAGS_log_index_durable ||
+      !GetSegmentsToRecompress(std::numeric_limits<int>::max(), &segments)
+           .ok()) {
+    return 0;
+  }
+  int64_t total_size = 0;
+  for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+    total_size += segment->file_size();
+  }
+  return total_size;
+}
+
+Status Log::RecompressSegments(int max_segments, int64_t* bytes_saved) {
+  CHECK(!FLAGS_raft_derived_log_mode);
+  *bytes_saved = 0;
+  const string codec_name = FLAGS_log_recompression_codec;
+  if (codec_name.empty()) {
+    return Status::OK();
+  }
+  // The index must be durable for a crash in the middle of replacing a
+  // segment to be detected, see RecompressSegment().
+  if (!FLAGS_log_index_durable) {
+    return Status::IllegalState(
+        "recompressing log segments requires --log_index_durable");
+  }
+  shared_ptr<CompressionCodec> codec;
+  RETURN_NOT_OK(CompressionCodecManager::GetCodec(codec_name, &codec));
+  WARN_NOT_OK(
+      codec->SetCompressionLevel(FLAGS_log_recompression_level),
+      "Could not set the log recompression level");
+
+  SegmentSequence segments;
+  RETURN_NOT_OK(GetSegmentsToRecompress(max_segments, &segments));
+  for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+    int64_t saved;
+    Status s = RecompressSegment(segment, codec, &saved);
+    if (s.IsNotFound()) {
+      // GCed in the meantime.
+      continue;
+    }
+    RETURN_NOT_OK_PREPEND(
+        s, Substitute("Unable to recompress log segment $0", segment->path()));
+    LOG_WITH_PREFIX(INFO) << "Recompressed log segment " << segment->path()
+                          << " with " << codec_name << ", saving " << saved
+                          << " bytes";
+    *bytes_saved += saved;
+    if (metrics_ && saved > 0) {
+      metrics_->bytes_saved_by_recompression->IncrementBy(saved);
+    }
+  }
+  return Status::OK();
+}
+
+Status Log::RecompressSegment(
+    const scoped_refptr<ReadableLogSegment>& segment,
+    const shared_ptr<CompressionCodec>& codec,
+    int64_t* bytes_saved) {
+  Env* env = fs_manager_->env();
+  const int64_t seqno = segment->header().sequence_number();
+  // The temp infix makes sure a segment left half rewritten by a crash is
+  // deleted on startup.
+  const string tmp_path = JoinPathSegments(
+      log_dir_, Substitute("$0.recompressed-$1", kTmpInfix, seqno));
+  WritableFileOptions opts;
+  opts.sync_on_close = true;
+  unique_ptr<WritableFile> file;
+  RETURN_NOT_OK(env->NewWritableFile(opts, tmp_path, &file));
+  auto delete_tmp = MakeScopedCleanup([&]() {
+    WARN_NOT_OK(
+        env->DeleteFile(tmp_path),
+        "Could not delete partially recompressed log segment");
+  });
+  WritableLogSegment rewritten(
+      tmp_path, shared_ptr<WritableFile>(file.release()));
+  LogSegmentHeaderPB header = segment->header();
+  header.set_compression_codec(codec->type());
+  // The rewritten segment has a footer, so its sync markers are dropped.
+  header.clear_sync_marker_interval_bytes();
+  RETURN_NOT_OK(rewritten.WriteHeaderAndOpen(header));
+
+  // Every batch is rewritten on its own, so that the ops which the index
+  // points to are still at the start of a batch. 'moved_entries' are the
+  // index entries of the ops of the segment in the rewritten segment, and
+  // 'old_entries' the ones they replace.
+  vector<LogIndexEntry> moved_entries;
+  vector<LogIndexEntry> old_entries;
+  const int64_t read_up_to = LogEntryReader(segment.get()).read_up_to_offset();
+  int64_t offset = segment->first_entry_offset();
+  faststring tmp_buf;
+  string serialized;
+  while (offset < read_up_to) {
+    const int64_t batch_offset = offset;
+    unique_ptr<LogEntryBatchPB> batch;
+    EntryHeaderStatus status_detail;
+    RETURN_NOT_OK(segment->ReadEntryHeaderAndBatch(
+        &offset, &tmp_buf, &batch, &status_detail));
+    if (IsSyncMarkerBatch(*batch)) {
+      continue;
+    }
+    serialized.clear();
+    if (!batch->SerializeToString(&serialized)) {
+      return Status::Corruption(Substitute(
+          "Could not serialize the entry batch at offset $0", batch_offset));
+    }
+    const int64_t new_offset = rewritten.written_offset();
+    RETURN_NOT_OK(rewritten.WriteEntryBatch({Slice(serialized)}, codec));
+    for (const LogEntryPB& entry : batch->entry()) {
+      if (!entry.has_replicate()) {
+        continue;
+      }
+      LogIndexEntry index_entry;
+      index_entry.op_id = entry.replicate().id();
+      index_entry.segment_sequence_number = seqno;
+      index_entry.offset_in_segment = batch_offset;
+      old_entries.push_back(index_entry);
+      index_entry.offset_in_segment = new_offset;
+      moved_entries.push_back(index_entry);
+    }
+  }
+  RETURN_NOT_OK(rewritten.WriteFooterAndClose(segment->footer()));
+
+  // GC, index flushes and readers are kept out while the index and the
+  // segment are replaced.
+  std::lock_guard<Mutex> rewrite_lock(rewrite_lock_);
+  std::lock_guard<Mutex> index_flush_lock(index_flush_lock_);
+  std::lock_guard<RWMutex> reader_lock(reader_->rewrite_lock_);
+  if (reader_->GetSegmentBySequenceNumber(seqno) != segment) {
+    return Status::NotFound("log segment was GCed");
+  }
+
+  // Ops which were replaced further down the log are indexed in a later
+  // segment.
+  vector<LogIndexEntry> updated_entries;
+  vector<LogIndexEntry> reverted_entries;
+  for (int i = 0; i < moved_entries.size(); i++) {
+    LogIndexEntry current;
+    if (log_index_->GetEntry(old_entries[i].op_id.index(), &current).ok() &&
+        current.segment_sequence_number == seqno &&
+        current.offset_in_segment == old_entries[i].offset_in_segment) {
+      updated_entries.push_back(moved_entries[i]);
+      reverted_entries.push_back(current);
+    }
+  }
+  auto revert_index = MakeScopedCleanup([&]() {
+    WARN_NOT_OK(
+        log_index_->UpdateEntries(reverted_entries),
+        "Could not revert the log index entries of a recompressed segment");
+  });
+  // The index entries are synced before the segment is replaced, but the
+  // checksums of the index only cover them from its next flush, which
+  // 'index_flush_lock_' holds off until then. A crash in between is thus detected
+  // on startup, and the index is rebuilt from the segments.
+  RETURN_NOT_OK(log_index_->UpdateEntries(updated_entries));
+  segment->MarkRewritten();
+  RETURN_NOT_OK(env->RenameFile(tmp_path, segment->path()));
+  delete_tmp.cancel();
+  revert_index.cancel();
+  RETURN_NOT_OK(env->SyncDir(log_dir_));
+
+  // The reads which still hold 'segment' keep reading its file, which they
+  // have open, at the offsets they found before.
+  scoped_refptr<ReadableLogSegment> replacement;
+  CHECK_OK_PREPEND(
+      ReadableLogSegment::Open(env, segment->path(), &replacement),
+      "Unable to reopen a recompressed log segment");
+  CHECK_OK(reader_->ReplaceRewrittenSegment(replacement));
+  *bytes_saved = segment->file_size() - replacement->file_size();
+  return Status::OK();
+}
+
 int64_t Log::GetGCableDataSize(RetentionIndexes retention_indexes) const {
   CHECK(!FLAGS_raft_derived_log_mode);
   CHECK_GE(retention_indexes.for_durability, 0);
@@ -1058,22 +1778,29 @@ int64_t Log::GetGCableDataSize(RetentionIndexes retention_indexes) const {
 
 void Log::GetReplaySizeMap(std::map<int64_t, int64_t>* replay_size) const {
   CHECK(!FLAGS_raft_derived_log_mode);
-  replay_size->clear();
   SegmentSequence segments;
   {
     shared_lock<rw_spinlock> l(state_lock_.get_lock());
     CHECK_EQ(kLogWriting, log_state_);
     CHECK_OK(reader_->GetSegmentsSnapshot(&segments));
   }
+  BuildReplaySizeMap(segments, replay_size);
+}
 
-  int64_t cumulative_size = 0;
-  for (const auto& segment : boost::adaptors::reverse(segments)) {
-    if (!segment->HasFooter())
-      continue;
-    cumulative_size += segment->file_size();
-    int64_t max_repl_idx = segment->footer().max_replicate_index();
-    (*replay_size)[max_repl_idx] = cumulative_size;
+Status Log::GetReplaySizeAndSpaceInfo(
+    std::map<int64_t, int64_t>* replay_size,
+    SpaceInfo* space) const {
+  CHECK(!FLAGS_raft_derived_log_mode);
+  SegmentSequence segments;
+  {
+    shared_lock<rw_spinlock> l(state_lock_.get_lock());
+    if (log_state_ != kLogWriting) {
+      return Status::IllegalState("log is not open for writing");
+    }
+    RETURN_NOT_OK(reader_->GetSegmentsSnapshot(&segments));
   }
+  BuildReplaySizeMap(segments, replay_size);
+  return fs_manager_->env()->GetSpaceInfo(log_dir_, space);
 }
 
 int64_t Log::OnDiskSize() {
@@ -1134,6 +1861,10 @@ Status Log::Close() {
       RETURN_NOT_OK(Sync());
       RETURN_NOT_OK(CloseCurrentSegment());
       RETURN_NOT_OK(ReplaceSegmentInReaderUnlocked());
+      if (FLAGS_log_index_durable) {
+        std::lock_guard<Mutex> index_flush_lock(index_flush_lock_);
+        RETURN_NOT_OK(log_index_->Flush(active_segment_sequence_number_));
+      }
       log_state_ = kLogClosed;
       VLOG_WITH_PREFIX(1) << "Log closed";
 
@@ -1176,6 +1907,9 @@ Status Log::DeleteOnDiskData(FsManager* fs_manager, const string& tablet_id) {
   RETURN_NOT_OK_PREPEND(
       env->DeleteRecursively(wal_dir),
       "Unable to recursively delete WAL dir for tablet " + tablet_id);
+  if (fs_manager->wal_dir_manager()) {
+    fs_manager->wal_dir_manager()->RemoveTablet(tablet_id);
+  }
   return Status::OK();
 }
 
@@ -1237,26 +1971,57 @@ Status Log::PreAllocateNewSegment() {
 
   WritableFileOptions opts;
   opts.sync_on_close = force_sync_all_;
-  RETURN_NOT_OK(
-      CreatePlaceholderSegment(opts, &next_segment_path_, &next_segment_file_));
+  opts.use_io_uring = options_.use_io_uring;
+  opts.use_direct_io = options_.use_direct_io;
+
+  bool prezero = FLAGS_log_prezero_segments && options_.preallocate_segments;
+
+  // Space already owned by the segment file, if it's a recycled one.
+  uint64_t reused_size = 0;
+  string recycled_path;
+  {
+    std::lock_guard<simple_spinlock> l(recycled_segments_lock_);
+    if (!recycled_segments_.empty()) {
+      recycled_path = std::move(recycled_segments_.front());
+      recycled_segments_.pop_front();
+    }
+  }
+  if (!recycled_path.empty()) {
+    Status s = prezero ? PrezeroSegment(opts, recycled_path, &reused_size)
+                       : OpenRecycledSegment(opts, recycled_path, &reused_size);
+    if (!s.ok()) {
+      LOG_WITH_PREFIX(WARNING) << "Could not reuse recycled log segment "
+                               << recycled_path << ": " << s.ToString();
+      WARN_NOT_OK(
+          fs_manager_->env()->DeleteFile(recycled_path),
+          "Could not delete recycled log segment");
+      recycled_path.clear();
+      reused_size = 0;
+    }
+  }
+  if (recycled_path.empty()) {
+    RETURN_NOT_OK(CreatePlaceholderSegment(
+        opts, &next_segment_path_, &next_segment_file_));
+    if (prezero) {
+      // Zero the empty placeholder through a separate handle and reopen it.
+      next_segment_file_.reset();
+      RETURN_NOT_OK(PrezeroSegment(opts, next_segment_path_, &reused_size));
+    }
+  }
 
   MAYBE_RETURN_FAILURE(
       FLAGS_log_inject_io_error_on_preallocate_fraction,
       Status::IOError("Injected IOError in Log::PreAllocateNewSegment()"));
 
-  if (options_.preallocate_segments) {
+  if (options_.preallocate_segments && reused_size < max_segment_size_) {
+    uint64_t to_allocate = max_segment_size_ - reused_size;
     TRACE(
         "Preallocating $0 byte segment in $1",
-        max_segment_size_,
+        to_allocate,
         next_segment_path_);
-    RETURN_NOT_OK(env_util::VerifySufficientDiskSpace(
-        fs_manager_->env(),
-        next_segment_path_,
-        max_segment_size_,
-        FLAGS_fs_wal_dir_reserved_bytes));
-    // TODO (perf) zero the new segments -- this could result in
-    // additional performance improvements.
-    RETURN_NOT_OK(next_segment_file_->PreAllocate(max_segment_size_));
+    RETURN_NOT_OK(VerifySufficientDiskSpace(next_segment_path_, to_allocate));
+    fs::ScopedIO io(io_scheduler(), fs::IOScheduler::NORMAL);
+    RETURN_NOT_OK(next_segment_file_->PreAllocate(to_allocate));
   }
 
   return Status::OK();
@@ -1290,6 +2055,11 @@ Status Log::SwitchToAllocatedSegment() {
   if (codec_) {
     header.set_compression_codec(codec_->type());
   }
+  if (FLAGS_log_sync_marker_interval_bytes > 0) {
+    header.add_incompatible_features(LogSegmentHeaderPB::SYNC_MARKERS);
+    header.set_sync_marker_interval_bytes(
+        FLAGS_log_sync_marker_interval_bytes);
+  }
 
   // Set up the new footer. This will be maintained as the segment is written.
   footer_builder_.Clear();
@@ -1331,6 +2101,7 @@ Status Log::SwitchToAllocatedSegment() {
 
   // Now set 'active_segment_' to the new segment.
   active_segment_.reset(new_segment.release());
+  first_append_in_segment_ = true;
 
   allocation_state_ = kAllocationNotStarted;
 
@@ -1376,10 +2147,233 @@ Status Log::CreatePlaceholderSegment(
   return Status::OK();
 }
 
+bool Log::RecycleSegment(const string& path) {
+  CHECK(!FLAGS_raft_derived_log_mode);
+  int32_t max_recycled = FLAGS_log_max_recycled_segments;
+  if (max_recycled <= 0) {
+    return false;
+  }
+  std::lock_guard<simple_spinlock> l(recycled_segments_lock_);
+  if (recycled_segments_.size() >= static_cast<size_t>(max_recycled)) {
+    return false;
+  }
+  // The temp infix makes sure a recycled segment left behind by a crash
+  // is deleted on startup.
+  string recycled_path = JoinPathSegments(
+      log_dir_,
+      Substitute("$0.recycled-$1", kTmpInfix, ++num_recycled_segments_));
+  Status s = fs_manager_->env()->RenameFile(path, recycled_path);
+  if (!s.ok()) {
+    LOG_WITH_PREFIX(WARNING) << "Could not recycle log segment " << path
+                             << ": " << s.ToString();
+    return false;
+  }
+  recycled_segments_.emplace_back(std::move(recycled_path));
+  return true;
+}
+
+string Log::ArchiveDir() const {
+  return JoinPathSegments(FLAGS_log_archive_dir, tablet_id_);
+}
+
+bool Log::ArchiveSegment(const scoped_refptr<ReadableLogSegment>& segment) {
+  CHECK(!FLAGS_raft_derived_log_mode);
+  Env* env = fs_manager_->env();
+  const string archive_dir = ArchiveDir();
+  const string archived_path =
+      JoinPathSegments(archive_dir, BaseName(segment->path()));
+  Status s = env_util::CreateDirsRecursively(env, archive_dir);
+  if (s.ok()) {
+    s = env->RenameFile(segment->path(), archived_path);
+    if (s.posix_code() == EXDEV) {
+      // The archive is on another file system.
+      s = env_util::CopyFile(
+          env, segment->path(), archived_path, WritableFileOptions());
+      if (s.ok()) {
+        s = env->DeleteFile(segment->path());
+      }
+    }
+  }
+  // Open it again by its new path, which is where it is deleted from once
+  // evicted from the archive.
+  scoped_refptr<ReadableLogSegment> archived;
+  if (s.ok()) {
+    s = OpenArchivedSegment(archived_path, &archived);
+  }
+  if (!s.ok()) {
+    LOG_WITH_PREFIX(WARNING) << "Could not archive log segment "
+                             << segment->path() << ": " << s.ToString();
+    if (env->FileExists(archived_path)) {
+      WARN_NOT_OK(
+          env->DeleteFile(archived_path),
+          "Could not delete partially archived log segment");
+    }
+    return !env->FileExists(segment->path());
+  }
+
+  SegmentSequence evicted;
+  reader_->AddArchivedSegment(
+      archived, FLAGS_log_archive_max_segments, &evicted);
+  for (const scoped_refptr<ReadableLogSegment>& old : evicted) {
+    LOG_WITH_PREFIX(INFO) << "Deleting archived log segment in path: "
+                          << old->path();
+    WARN_NOT_OK(
+        env->DeleteFile(old->path()),
+        "Could not delete archived log segment");
+  }
+  return true;
+}
+
+Status Log::OpenArchivedSegment(
+    const string& path,
+    scoped_refptr<ReadableLogSegment>* segment) {
+  scoped_refptr<ReadableLogSegment> s;
+  RETURN_NOT_OK(ReadableLogSegment::Open(fs_manager_->env(), path, &s));
+  // A segment whose footer was rebuilt when the log was opened was never
+  // given one on disk.
+  if (!s->HasFooter()) {
+    RETURN_NOT_OK(s->RebuildFooterByScanning());
+  }
+  *segment = std::move(s);
+  return Status::OK();
+}
+
+Status Log::OpenArchivedSegments(int64_t indexed_segment_seqno) {
+  Env* env = fs_manager_->env();
+  const string archive_dir = ArchiveDir();
+  if (!env->FileExists(archive_dir)) {
+    return Status::OK();
+  }
+  vector<string> children;
+  RETURN_NOT_OK(env->GetChildren(archive_dir, &children));
+  // Segment file names end with their zero-padded sequence number.
+  std::sort(children.begin(), children.end());
+
+  SegmentSequence segments;
+  RETURN_NOT_OK(reader_->GetSegmentsSnapshot(&segments));
+  const int64_t first_seqno =
+      segments.empty() ? -1 : segments[0]->header().sequence_number();
+  for (const string& child : children) {
+    if (!HasPrefixString(child, FsManager::kWalFileNamePrefix)) {
+      continue;
+    }
+    const string path = JoinPathSegments(archive_dir, child);
+    scoped_refptr<ReadableLogSegment> segment;
+    Status s = OpenArchivedSegment(path, &segment);
+    if (s.ok() && first_seqno != -1 &&
+        segment->header().sequence_number() >= first_seqno) {
+      s = Status::AlreadyPresent("segment is still in the WAL directory");
+    }
+    if (!s.ok()) {
+      // E.g. left partially copied to the archive by a crash.
+      LOG_WITH_PREFIX(WARNING) << "Deleting unusable archived log segment "
+                               << path << ": " << s.ToString();
+      WARN_NOT_OK(
+          env->DeleteFile(path), "Could not delete archived log segment");
+      continue;
+    }
+    // Entries of segments which were archived after the durable log index
+    // was last flushed, or of all of them without a durable log index, may be
+    // missing from the index.
+    if (segment->header().sequence_number() > indexed_segment_seqno) {
+      RETURN_NOT_OK(LogReader::IndexSegment(segment.get(), log_index_.get()));
+    }
+
+    SegmentSequence evicted;
+    reader_->AddArchivedSegment(
+        segment, FLAGS_log_archive_max_segments, &evicted);
+    for (const scoped_refptr<ReadableLogSegment>& old : evicted) {
+      WARN_NOT_OK(
+          env->DeleteFile(old->path()),
+          "Could not delete archived log segment");
+    }
+  }
+  return Status::OK();
+}
+
+Status Log::PrezeroSegment(
+    const WritableFileOptions& base_opts,
+    const string& path,
+    uint64_t* reused_size) {
+  CHECK(!FLAGS_raft_derived_log_mode);
+  static const size_t kZeroChunkSize = 1024 * 1024;
+  Env* env = fs_manager_->env();
+  uint64_t file_size;
+  RETURN_NOT_OK(env->GetFileSize(path, &file_size));
+  uint64_t zeroed_size = std::max(file_size, max_segment_size_);
+  if (zeroed_size > file_size) {
+    RETURN_NOT_OK(VerifySufficientDiskSpace(path, zeroed_size - file_size));
+  }
+  TRACE("Zeroing $0 bytes of segment $1", zeroed_size, path);
+
+  MonoTime start = MonoTime::Now();
+  RWFileOptions rw_opts;
+  rw_opts.mode = Env::OPEN_EXISTING;
+  unique_ptr<RWFile> file;
+  RETURN_NOT_OK(env->NewRWFile(rw_opts, path, &file));
+  const string zeros(kZeroChunkSize, '\0');
+  for (uint64_t offset = 0; offset < zeroed_size; offset += kZeroChunkSize) {
+    size_t len = std::min<uint64_t>(kZeroChunkSize, zeroed_size - offset);
+    // One chunk at a time, so appends to this WAL directory can get ahead.
+    fs::ScopedIO io(io_scheduler(), fs::IOScheduler::NORMAL);
+    io.AddBytes(len);
+    RETURN_NOT_OK(file->Write(offset, Slice(zeros.data(), len)));
+  }
+  RETURN_NOT_OK(file->Sync());
+  RETURN_NOT_OK(file->Close());
+  if (metrics_) {
+    metrics_->segment_prezero_latency->Increment(
+        (MonoTime::Now() - start).ToMicroseconds());
+  }
+
+  WritableFileOptions opts = base_opts;
+  opts.existing_blocks_zeroed = true;
+  return OpenRecycledSegment(opts, path, reused_size);
+}
+
+Status Log::OpenRecycledSegment(
+    const WritableFileOptions& base_opts,
+    const string& path,
+    uint64_t* reused_size) {
+  CHECK(!FLAGS_raft_derived_log_mode);
+  RETURN_NOT_OK(fs_manager_->env()->GetFileSize(path, reused_size));
+  WritableFileOptions opts = base_opts;
+  opts.mode = Env::OPEN_EXISTING;
+  opts.reuse_existing_blocks = true;
+  unique_ptr<WritableFile> segment_file;
+  RETURN_NOT_OK(
+      fs_manager_->env()->NewWritableFile(opts, path, &segment_file));
+  VLOG_WITH_PREFIX(1) << "Reusing recycled WAL segment, placeholder path: "
+                      << path;
+  next_segment_path_ = path;
+  next_segment_file_.reset(segment_file.release());
+  return Status::OK();
+}
+
 std::string Log::LogPrefix() const {
   return Substitute("T $0 P $1: ", tablet_id_, fs_manager_->uuid());
 }
 
+void Log::HandleDiskFailure() {
+  if (wal_dir_) {
+    fs_manager_->error_manager()->RunErrorNotificationCb(
+        fs::ErrorHandlerType::WAL_DISK_ERROR, wal_dir_->root());
+  }
+}
+
+Status Log::VerifySufficientDiskSpace(const string& path, int64_t bytes) {
+  if (wal_dir_) {
+    return wal_dir_->VerifySufficientSpace(
+        bytes, FLAGS_fs_wal_dir_reserved_bytes);
+  }
+  return env_util::VerifySufficientDiskSpace(
+      fs_manager_->env(), path, bytes, FLAGS_fs_wal_dir_reserved_bytes);
+}
+
+fs::IOScheduler* Log::io_scheduler() const {
+  return wal_dir_ ? wal_dir_->io_scheduler() : nullptr;
+}
+
 Log::~Log() {
   // Close() of log is now called from simple_tablet_manager
 }
@@ -1402,7 +2396,14 @@ LogEntryBatch::~LogEntryBatch() {
     for (LogEntryPB& entry : *entry_batch_pb_->mutable_entry()) {
       // ReplicateMsg elements are owned by and must be freed by the caller
       // (e.g. the LogCache).
-      std::ignore = entry.release_replicate();
+      std::ignore = entry.unsafe_arena_release_replicate();
+    }
+  }
+  // The ops are in the WAL, or won't be: their serialized form is no longer
+  // needed, and is freed along with this batch.
+  if (!serialized_replicates_.empty()) {
+    for (const auto& replicate : replicates_) {
+      replicate->ReleaseSerialized();
     }
   }
 }
@@ -1414,8 +2415,51 @@ void LogEntryBatch::Serialize() {
           count() == 1 && entry_batch_pb_->entry(0).type() == FLUSH_MARKER)) {
     return;
   }
-  buffer_.reserve(total_size_bytes_);
-  pb_util::AppendToString(*entry_batch_pb_, &buffer_);
+  if (type_ != REPLICATE || replicates_.size() != count_) {
+    buffer_.reserve(total_size_bytes_);
+    pb_util::AppendToString(*entry_batch_pb_, &buffer_);
+    slices_.emplace_back(buffer_);
+    return;
+  }
+
+  // Hand-roll the LogEntryBatchPB wire format, so that each replicate's
+  // shared serialized buffer (see RefCountedReplicate::Serialized()) can be
+  // written without copying it. This must match what protobuf would produce:
+  // for each entry, the LogEntryPB tag and length, then its 'type' and its
+  // length-prefixed 'replicate'.
+  static const uint8_t kEntryTag = (1 << 3) | 2; // field 1, length-delimited
+  static const uint8_t kTypeTag = (1 << 3) | 0; // field 1, varint
+  static const uint8_t kReplicateTag = (2 << 3) | 2; // field 2, length-delim.
+  vector<size_t> framing_ends;
+  serialized_replicates_.reserve(count_);
+  framing_ends.reserve(count_);
+  buffer_.reserve(count_ * 16);
+  for (const auto& replicate : replicates_) {
+    serialized_replicates_.push_back(replicate->Serialized());
+    Slice data(*serialized_replicates_.back());
+    uint32_t entry_size = 1 + VarintLength(REPLICATE) + 1 +
+        VarintLength(data.size()) + data.size();
+    buffer_.push_back(kEntryTag);
+    PutVarint32(&buffer_, entry_size);
+    buffer_.push_back(kTypeTag);
+    PutVarint32(&buffer_, REPLICATE);
+    buffer_.push_back(kReplicateTag);
+    PutVarint32(&buffer_, data.size());
+    framing_ends.push_back(buffer_.size());
+  }
+
+  // 'buffer_' is not resized anymore, so it's safe to point into it.
+  slices_.reserve(count_ * 2);
+  size_t framing_start = 0;
+  size_t total_size = 0;
+  for (size_t i = 0; i < count_; i++) {
+    slices_.emplace_back(
+        buffer_.data() + framing_start, framing_ends[i] - framing_start);
+    slices_.emplace_back(*serialized_replicates_[i]);
+    total_size += slices_[slices_.size() - 2].size() + slices_.back().size();
+    framing_start = framing_ends[i];
+  }
+  DCHECK_EQ(total_size_bytes_, total_size);
 }
 
 } // namespace log
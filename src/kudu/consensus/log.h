@@ -27,6 +27,7 @@
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <limits>
 #include <map>
 #include <memory>
@@ -49,9 +50,11 @@
 #include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/ref_counted.h"
-#include "kudu/util/blocking_queue.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/mpsc_blocking_queue.h"
+#include "kudu/util/mutex.h"
 #include "kudu/util/promise.h"
 #include "kudu/util/rw_mutex.h"
 #include "kudu/util/slice.h"
@@ -65,8 +68,14 @@ class FsManager;
 class MetricEntity;
 class ThreadPool;
 class WritableFile;
+struct SpaceInfo;
 struct WritableFileOptions;
 
+namespace fs {
+class IOScheduler;
+class WalDir;
+} // namespace fs
+
 namespace consensus {
 class OpId;
 class ReplicateMsg;
@@ -115,7 +124,9 @@ class LogEntryBatch;
 class LogIndex;
 class LogReader;
 
-typedef BlockingQueue<LogEntryBatch*, LogEntryBatchLogicalSize>
+// Many raft threads append to the queue while only the append thread drains
+// it, so it does not take a lock on the append path.
+typedef MpscBlockingQueue<LogEntryBatch*, LogEntryBatchLogicalSize>
     LogEntryBatchQueue;
 
 // Log interface, inspired by Raft's (logcabin) Log. Provides durability to
@@ -183,7 +194,7 @@ class Log : public RefCountedThreadSafe<Log> {
   // Append the given commit message, asynchronously.
   //
   // Returns a bad status if the log is already shut down.
-  Status AsyncAppendCommit(
+  virtual Status AsyncAppendCommit(
       gscoped_ptr<consensus::CommitMsg> commit_msg,
       const StatusCallback& callback);
 
@@ -264,12 +275,26 @@ class Log : public RefCountedThreadSafe<Log> {
   // If successful, num_gced is set to the number of deleted log segments.
   //
   // This method is thread-safe.
-  Status GC(RetentionIndexes retention_indexes, int* num_gced);
+  virtual Status GC(RetentionIndexes retention_indexes, int* num_gced);
 
   // Computes the amount of bytes that would have been GC'd if Log::GC had been
   // called.
   int64_t GetGCableDataSize(RetentionIndexes retention_indexes) const;
 
+  // Rewrites up to 'max_segments' of the oldest sealed segments which were
+  // not written with --log_recompression_codec with it, and sets
+  // 'bytes_saved' to how much smaller they got. The segments are replaced
+  // atomically: reads which already hold a segment keep reading the old
+  // version, and the log index is updated along with the reader.
+  //
+  // This method is thread-safe, but is not meant to be run concurrently with
+  // itself. See LogRecompressionOp.
+  Status RecompressSegments(int max_segments, int64_t* bytes_saved);
+
+  // Returns the total size of the segments which RecompressSegments() would
+  // rewrite, or 0 if recompression is disabled.
+  int64_t GetRecompressibleDataSize() const;
+
   // Returns a map which can be used to determine the cumulative size of log
   // segments containing entries at or above any given log index.
   //
@@ -294,6 +319,13 @@ class Log : public RefCountedThreadSafe<Log> {
   // Note that the returned values are in units of bytes, not MB.
   void GetReplaySizeMap(std::map<int64_t, int64_t>* replay_size) const;
 
+  // Like GetReplaySizeMap(), also setting 'space' to the space of the
+  // filesystem of the log directory. Returns IllegalState if the log isn't
+  // open for writing, instead of crashing.
+  Status GetReplaySizeAndSpaceInfo(
+      std::map<int64_t, int64_t>* replay_size,
+      SpaceInfo* space) const;
+
   // Returns the total size of the current segments, in bytes.
   // Returns 0 if the log is shut down.
   int64_t OnDiskSize();
@@ -342,6 +374,8 @@ class Log : public RefCountedThreadSafe<Log> {
   FRIEND_TEST(LogTestOptionalCompression, TestMultipleEntriesInABatch);
   FRIEND_TEST(LogTestOptionalCompression, TestReadLogWithReplacedReplicates);
   FRIEND_TEST(LogTest, TestWriteAndReadToAndFromInProgressSegment);
+  FRIEND_TEST(LogTestOptionalCompression, TestRebuildFooterFromSyncMarker);
+  FRIEND_TEST(LogTestOptionalCompression, TestReadBatchesAhead);
 
   class AppendThread;
 
@@ -368,10 +402,18 @@ class Log : public RefCountedThreadSafe<Log> {
   // Make segments roll over.
   Status RollOver();
 
+  // Adds the entries of the segments after 'indexed_segment_seqno', all of
+  // them if -1, to the durable log index, then flushes it.
+  Status IndexSegmentsAfter(int64_t indexed_segment_seqno);
+
+  // Creates and serializes a batch out of 'entry_batch_pb'. For REPLICATE
+  // batches, 'replicates' are the ops whose messages 'entry_batch_pb' points
+  // to, and their serialized buffers are written out as they are.
   static Status CreateBatchFromPB(
       LogEntryTypePB type,
       std::unique_ptr<LogEntryBatchPB> entry_batch_pb,
-      std::unique_ptr<LogEntryBatch>* entry_batch);
+      std::unique_ptr<LogEntryBatch>* entry_batch,
+      const std::vector<consensus::ReplicateRefPtr>* replicates = nullptr);
 
   // Asynchronously appends 'entry_batch' to the log. Once the append
   // completes and is synced, 'callback' will be invoked.
@@ -395,12 +437,72 @@ class Log : public RefCountedThreadSafe<Log> {
   // disk as the header, and sets active_segment_ to point to this new segment.
   Status SwitchToAllocatedSegment();
 
-  // Preallocates the space for a new segment.
+  // Preallocates the space for a new segment, reusing a recycled segment
+  // if there is one.
   Status PreAllocateNewSegment();
 
+  // Moves the garbage collected segment at 'path' to the pool of recycled
+  // segments. Returns false if the pool is full or the segment could not be
+  // moved, in which case the caller should delete it.
+  bool RecycleSegment(const std::string& path);
+
+  // Sets 'segments' to the up to 'max_segments' oldest segments which
+  // RecompressSegments() should rewrite.
+  Status GetSegmentsToRecompress(
+      int max_segments,
+      SegmentSequence* segments) const;
+
+  // Rewrites 'segment' with 'codec' next to it, then replaces it in the
+  // reader, in the log index and on disk. Sets 'bytes_saved' to the
+  // difference in size. Returns NotFound if the segment was GCed meanwhile.
+  Status RecompressSegment(
+      const scoped_refptr<ReadableLogSegment>& segment,
+      const std::shared_ptr<CompressionCodec>& codec,
+      int64_t* bytes_saved);
+
+  // Returns the directory of the archived segments of this tablet, see
+  // --log_archive_dir.
+  std::string ArchiveDir() const;
+
+  // Moves the garbage collected 'segment' to the archive, where it stays
+  // readable through the reader. Returns false if the segment is still in the
+  // WAL directory, in which case the caller should delete or recycle it.
+  bool ArchiveSegment(const scoped_refptr<ReadableLogSegment>& segment);
+
+  // Opens the archived segment at 'path', rebuilding its footer if it has
+  // none.
+  Status OpenArchivedSegment(
+      const std::string& path,
+      scoped_refptr<ReadableLogSegment>* segment);
+
+  // Adds the segments left in the archive by a previous run to the reader,
+  // indexing those after 'indexed_segment_seqno', and deletes the ones which
+  // can't be used.
+  Status OpenArchivedSegments(int64_t indexed_segment_seqno);
+
+  // Opens the recycled segment at 'path' as the next segment, discarding its
+  // contents (unless 'base_opts' says they are already zeroed). Sets
+  // 'reused_size' to the number of bytes of the file which don't need to be
+  // preallocated again.
+  Status OpenRecycledSegment(
+      const WritableFileOptions& base_opts,
+      const std::string& path,
+      uint64_t* reused_size);
+
+  // Writes zeros over the segment file at 'path', up to at least the maximum
+  // segment size, and opens it as the next segment, keeping the zeroed blocks
+  // (see --log_prezero_segments). Sets 'reused_size' like
+  // OpenRecycledSegment().
+  Status PrezeroSegment(
+      const WritableFileOptions& base_opts,
+      const std::string& path,
+      uint64_t* reused_size);
+
   // Writes serialized contents of 'entry' to the log. Called inside
-  // AppenderThread.
-  Status DoAppend(LogEntryBatch* entry_batch);
+  // AppenderThread. If 'sync' is true, the active segment is also synced,
+  // possibly in the same system call as the write (see
+  // LogOptions::use_io_uring).
+  Status DoAppend(LogEntryBatch* entry_batch, bool sync = false);
 
   // Update footer_builder_ to reflect the log indexes seen in 'batch'.
   void UpdateFooterForBatch(LogEntryBatch* batch);
@@ -433,6 +535,18 @@ class Log : public RefCountedThreadSafe<Log> {
 
   std::string LogPrefix() const;
 
+  // Marks the WAL directory of this log failed, after a disk failure.
+  void HandleDiskFailure();
+
+  // Returns an IOError with ENOSPC if allocating 'bytes' more for the file at
+  // 'path' would eat into --fs_wal_dir_reserved_bytes. Checks against the
+  // cached free space of the WAL directory of the log, if there is one.
+  Status VerifySufficientDiskSpace(const std::string& path, int64_t bytes);
+
+  // Returns the scheduler of the I/O to the WAL directory of the log, or null
+  // if there is none.
+  fs::IOScheduler* io_scheduler() const;
+
   LogOptions options_;
   FsManager* fs_manager_;
   std::string log_dir_;
@@ -440,6 +554,10 @@ class Log : public RefCountedThreadSafe<Log> {
   // The ID of the tablet this log is dedicated to.
   std::string tablet_id_;
 
+  // The WAL directory 'log_dir_' is in. Null if the FsManager has no WAL
+  // directory manager.
+  fs::WalDir* wal_dir_;
+
   // Lock to protect modifications to schema_ and schema_version_.
   mutable rw_spinlock schema_lock_;
 
@@ -453,6 +571,11 @@ class Log : public RefCountedThreadSafe<Log> {
   // The currently active segment being written.
   gscoped_ptr<WritableLogSegment> active_segment_;
 
+  // Whether nothing has been written to 'active_segment_' yet, in which case
+  // the next append's latency is recorded as a post-roll append. Only
+  // accessed by the append thread.
+  bool first_append_in_segment_ = false;
+
   // The current (active) segment sequence number.
   uint64_t active_segment_sequence_number_;
 
@@ -462,6 +585,12 @@ class Log : public RefCountedThreadSafe<Log> {
   // The path for the next allocated segment.
   std::string next_segment_path_;
 
+  // Paths of garbage collected segments waiting to be reused by
+  // PreAllocateNewSegment(), oldest first. See --log_max_recycled_segments.
+  std::deque<std::string> recycled_segments_;
+  uint64_t num_recycled_segments_ = 0;
+  simple_spinlock recycled_segments_lock_;
+
   // Lock to protect mutations to log_state_ and other shared state variables.
   mutable percpu_rwlock state_lock_;
 
@@ -509,6 +638,14 @@ class Log : public RefCountedThreadSafe<Log> {
   // The codec used to compress entries, or nullptr if not configured.
   std::shared_ptr<CompressionCodec> codec_;
 
+  // Held while a recompressed segment replaces the original one, and by GC
+  // while it deletes or moves the segments it collected.
+  Mutex rewrite_lock_;
+
+  // Held while a recompressed segment replaces the original one, and while
+  // the log index is flushed.
+  Mutex index_flush_lock_;
+
   scoped_refptr<MetricEntity> metric_entity_;
   gscoped_ptr<LogMetrics> metrics_;
 
@@ -594,7 +731,9 @@ class LogEntryBatch {
       std::unique_ptr<LogEntryBatchPB> entry_batch_pb,
       size_t count);
 
-  // Serializes contents of the entry to an internal buffer.
+  // Serializes contents of the entry. The LogEntryPB framing goes to an
+  // internal buffer, but replicates set by SetReplicates() are not copied;
+  // their shared serialized buffers are referenced by data() instead.
   void Serialize();
 
   // Sets the callback that will be invoked after the entry is
@@ -609,10 +748,10 @@ class LogEntryBatch {
     return callback_;
   }
 
-  // Returns a Slice representing the serialized contents of the
-  // entry.
-  Slice data() const {
-    return Slice(buffer_);
+  // Returns the Slices which, concatenated, make up the serialized
+  // contents of the entry.
+  const std::vector<Slice>& data() const {
+    return slices_;
   }
 
   size_t count() const {
@@ -660,10 +799,21 @@ class LogEntryBatch {
   // synced to disk.
   StatusCallback callback_;
 
+  // When the batch was put in the append queue.
+  MonoTime enqueue_time_;
+
   // Buffer to which 'phys_entries_' are serialized by call to
-  // 'Serialize()'
+  // 'Serialize()', except for the replicates themselves.
   faststring buffer_;
 
+  // The serialized 'replicates_', shared with their other users if any until
+  // the batch is destroyed.
+  std::vector<std::shared_ptr<const faststring>> serialized_replicates_;
+
+  // The serialized entry: pieces of 'buffer_' interleaved with
+  // 'serialized_replicates_'.
+  std::vector<Slice> slices_;
+
   DISALLOW_COPY_AND_ASSIGN(LogEntryBatch);
 };
 
@@ -122,5 +122,45 @@ TEST_F(LogAnchorRegistryTest, TestOrderedEarliestOpId) {
   ASSERT_TRUE(s.IsNotFound()) << s.ToString();
 }
 
+// Anchors sharing an index are unregistered by position, in any order, and
+// the earliest index follows re-registrations.
+TEST_F(LogAnchorRegistryTest, TestEarliestIndexTracksUpdates) {
+  scoped_refptr<LogAnchorRegistry> reg(new LogAnchorRegistry());
+  const int kNumAnchors = 8;
+  const string test_name = CURRENT_TEST_NAME();
+
+  LogAnchor anchors[kNumAnchors];
+  for (int i = 0; i < kNumAnchors; i++) {
+    reg->Register(10 + (i % 2), test_name, &anchors[i]);
+  }
+
+  int64_t anchor_idx = -1;
+  ASSERT_OK(reg->GetEarliestRegisteredLogIndex(&anchor_idx));
+  ASSERT_EQ(10, anchor_idx);
+
+  // Move every anchor at index 10 past those at index 11, from the back.
+  for (int i = kNumAnchors - 2; i >= 0; i -= 2) {
+    ASSERT_OK(reg->UpdateRegistration(20, test_name, &anchors[i]));
+  }
+  ASSERT_OK(reg->GetEarliestRegisteredLogIndex(&anchor_idx));
+  ASSERT_EQ(11, anchor_idx);
+  ASSERT_EQ(kNumAnchors, reg->GetAnchorCountForTests());
+
+  // Pull one anchor back before all the others.
+  ASSERT_OK(reg->UpdateRegistration(5, test_name, &anchors[3]));
+  ASSERT_OK(reg->GetEarliestRegisteredLogIndex(&anchor_idx));
+  ASSERT_EQ(5, anchor_idx);
+  ASSERT_OK(reg->Unregister(&anchors[3]));
+  ASSERT_OK(reg->GetEarliestRegisteredLogIndex(&anchor_idx));
+  ASSERT_EQ(11, anchor_idx);
+
+  for (int i = 0; i < kNumAnchors; i++) {
+    ASSERT_OK(reg->UnregisterIfAnchored(&anchors[i]));
+  }
+  Status s = reg->GetEarliestRegisteredLogIndex(&anchor_idx);
+  ASSERT_TRUE(s.IsNotFound()) << s.ToString();
+  ASSERT_EQ(0, reg->GetAnchorCountForTests());
+}
+
 } // namespace log
 } // namespace kudu
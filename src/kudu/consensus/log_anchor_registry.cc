@@ -36,7 +36,7 @@ using std::string;
 using strings::Substitute;
 using strings::SubstituteAndAppend;
 
-LogAnchorRegistry::LogAnchorRegistry() {}
+LogAnchorRegistry::LogAnchorRegistry() : earliest_index_(kInvalidOpIdIndex) {}
 
 LogAnchorRegistry::~LogAnchorRegistry() {
   CHECK(anchors_.empty());
@@ -75,14 +75,11 @@ Status LogAnchorRegistry::UnregisterIfAnchored(LogAnchor* anchor) {
 }
 
 Status LogAnchorRegistry::GetEarliestRegisteredLogIndex(int64_t* log_index) {
-  std::lock_guard<simple_spinlock> l(lock_);
-  auto iter = anchors_.begin();
-  if (iter == anchors_.end()) {
+  int64_t earliest = earliest_index_.load(std::memory_order_acquire);
+  if (earliest == kInvalidOpIdIndex) {
     return Status::NotFound("No anchors in registry");
   }
-
-  // Since this is a sorted map, the first element is the one we want.
-  *log_index = iter->first;
+  *log_index = earliest;
   return Status::OK();
 }
 
@@ -122,27 +119,33 @@ void LogAnchorRegistry::RegisterUnlocked(
   anchor->is_registered = true;
   anchor->when_registered = MonoTime::Now();
   AnchorMultiMap::value_type value(log_index, anchor);
-  anchors_.insert(value);
+  anchor->position = anchors_.insert(value);
+  UpdateEarliestUnlocked();
 }
 
 Status LogAnchorRegistry::UnregisterUnlocked(LogAnchor* anchor) {
   DCHECK(anchor != nullptr);
   DCHECK(anchor->is_registered);
 
-  auto iter = anchors_.find(anchor->log_index);
-  while (iter != anchors_.end()) {
-    if (iter->second == anchor) {
-      anchor->is_registered = false;
-      anchors_.erase(iter);
-      // No need for the iterator to remain valid since we return here.
-      return Status::OK();
-    }
-    ++iter;
+  if (PREDICT_FALSE(!anchor->is_registered)) {
+    return Status::NotFound(Substitute(
+        "Anchor with index $0 and owner $1 not found",
+        anchor->log_index,
+        anchor->owner));
   }
-  return Status::NotFound(Substitute(
-      "Anchor with index $0 and owner $1 not found",
-      anchor->log_index,
-      anchor->owner));
+  DCHECK(anchor->position->second == anchor);
+  anchors_.erase(anchor->position);
+  anchor->position = anchors_.end();
+  anchor->is_registered = false;
+  UpdateEarliestUnlocked();
+  return Status::OK();
+}
+
+void LogAnchorRegistry::UpdateEarliestUnlocked() {
+  DCHECK(lock_.is_locked());
+  earliest_index_.store(
+      anchors_.empty() ? kInvalidOpIdIndex : anchors_.begin()->first,
+      std::memory_order_release);
 }
 
 LogAnchor::LogAnchor() : is_registered(false), log_index(kInvalidOpIdIndex) {}
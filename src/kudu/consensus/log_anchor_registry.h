@@ -17,6 +17,7 @@
 #ifndef KUDU_CONSENSUS_LOG_ANCHOR_REGISTRY_
 #define KUDU_CONSENSUS_LOG_ANCHOR_REGISTRY_
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <map>
@@ -71,6 +72,9 @@ class LogAnchorRegistry : public RefCountedThreadSafe<LogAnchorRegistry> {
 
   // Query the registry to find the earliest anchored log index in the registry.
   // Returns Status::NotFound if no anchors are currently active.
+  //
+  // This does not take the registry lock: the earliest index is maintained on
+  // every registration change, so log GC can poll it cheaply.
   Status GetEarliestRegisteredLogIndex(int64_t* log_index);
 
   // Simply returns the number of active anchors for use in debugging / tests.
@@ -95,7 +99,15 @@ class LogAnchorRegistry : public RefCountedThreadSafe<LogAnchorRegistry> {
   // Unregister an anchor after taking the lock. See Unregister().
   Status UnregisterUnlocked(LogAnchor* anchor);
 
+  // Recompute 'earliest_index_' after 'anchors_' changed. Requires 'lock_'.
+  void UpdateEarliestUnlocked();
+
   AnchorMultiMap anchors_;
+
+  // The smallest key of 'anchors_', or kInvalidOpIdIndex if it is empty.
+  // Written under 'lock_', read without it.
+  std::atomic<int64_t> earliest_index_;
+
   mutable simple_spinlock lock_;
 
   DISALLOW_COPY_AND_ASSIGN(LogAnchorRegistry);
@@ -122,6 +134,10 @@ struct LogAnchor {
   // The index of the log entry we are anchoring on.
   int64_t log_index;
 
+  // Where this anchor sits in the registry's map while it is registered, so
+  // that unregistering does not have to scan anchors sharing 'log_index'.
+  std::multimap<int64_t, LogAnchor*>::iterator position;
+
   // An arbitrary string containing details of the subsystem holding the
   // anchor, and any relevant information about it that should be displayed in
   // the log or the web UI.
@@ -30,8 +30,8 @@
 
 #include "kudu/clock/clock.h"
 #include "kudu/clock/hybrid_clock.h"
-#include "kudu/common/schema.h"
-#include "kudu/common/wire_protocol-test-util.h"
+//#include "kudu/common/schema.h"
+//#include "kudu/common/wire_protocol-test-util.h"
 #include "kudu/consensus/consensus-test-util.h"
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/log.h"
@@ -40,28 +40,37 @@
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/consensus/opid_util.h"
 #include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/consensus/replicate_msg_wrapper.h"
 #include "kudu/fs/fs_manager.h"
 #include "kudu/gutil/bind.h"
 #include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/crc.h"
 #include "kudu/util/mem_tracker.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
+#include "kudu/util/random.h"
 #include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/status.h"
+#include "kudu/util/stopwatch.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
+#include "kudu/util/threadpool.h"
 
 using std::atomic;
 using std::shared_ptr;
+using std::string;
 using std::thread;
+using std::unique_ptr;
 using std::vector;
 using strings::Substitute;
 
 DECLARE_int32(log_cache_size_limit_mb);
 DECLARE_int32(global_log_cache_size_limit_mb);
+DECLARE_int32(log_cache_second_tier_size_mb);
+DECLARE_int32(log_cache_throttle_threshold_percentage);
 
 // METRIC_DECLARE_entity(tablet);
 
@@ -74,7 +83,10 @@ static const char* kTestTablet = "test-tablet";
 class LogCacheTest : public KuduTest {
  public:
   LogCacheTest()
-      : schema_(GetSimpleTestSchema()),
+      :
+#ifdef FB_DO_NOT_REMOVE
+        schema_(GetSimpleTestSchema()),
+#endif
         metric_entity_(METRIC_ENTITY_server.Instantiate(
             &metric_registry_,
             "LogCacheTest")) {}
@@ -88,8 +100,10 @@ class LogCacheTest : public KuduTest {
         log::LogOptions(),
         fs_manager_.get(),
         kTestTablet,
+#ifdef FB_DO_NOT_REMOVE
         schema_,
         0, // schema_version
+#endif
         nullptr,
         &log_));
 
@@ -129,7 +143,9 @@ class LogCacheTest : public KuduTest {
     return Status::OK();
   }
 
+#ifdef FB_DO_NOT_REMOVE
   const Schema schema_;
+#endif
   MetricRegistry metric_registry_;
   scoped_refptr<MetricEntity> metric_entity_;
   gscoped_ptr<FsManager> fs_manager_;
@@ -181,6 +197,95 @@ TEST_F(LogCacheTest, TestAppendAndGetMessages) {
   EXPECT_EQ("3.21", OpIdToString(messages[0]->get()->id()));
 }
 
+// Ops read back from the log for one peer are served to the next one from
+// their cached wire form.
+TEST_F(LogCacheTest, TestWireFormCache) {
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 100));
+  log_->WaitUntilAllFlushed();
+  cache_->EvictThroughOp(50);
+
+  for (int i = 0; i < 2; i++) {
+    vector<ReplicateRefPtr> messages;
+    OpId preceding;
+    ASSERT_OK(cache_->ReadOps(
+        20, 8 * 1024 * 1024, ReadContext(), &messages, &preceding));
+    ASSERT_EQ(80, messages.size());
+    EXPECT_EQ("3.21", OpIdToString(messages[0]->get()->id()));
+    EXPECT_EQ("7.50", OpIdToString(messages[29]->get()->id()));
+  }
+  EXPECT_EQ(30, cache_->metrics_.log_cache_wire_form_misses->value());
+  EXPECT_EQ(30, cache_->metrics_.log_cache_wire_form_hits->value());
+
+  // Overwritten ops drop their wire form.
+  cache_->TruncateOpsAfter(40);
+  vector<ReplicateRefPtr> messages;
+  OpId preceding;
+  ASSERT_OK(cache_->ReadOps(
+      20, 8 * 1024 * 1024, ReadContext(), &messages, &preceding));
+  EXPECT_EQ(20, messages.size());
+  EXPECT_EQ(50, cache_->metrics_.log_cache_wire_form_hits->value());
+}
+
+// A read which misses the cache reads the ops following it ahead, so that
+// the next read for the same peer does not go to the log.
+TEST_F(LogCacheTest, TestPrefetch) {
+  gscoped_ptr<ThreadPool> pool;
+  ASSERT_OK(ThreadPoolBuilder("prefetch").Build(&pool));
+  cache_->SetPrefetchToken(pool->NewToken(ThreadPool::ExecutionMode::SERIAL));
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 100));
+  log_->WaitUntilAllFlushed();
+  cache_->EvictThroughOp(50);
+
+  // Only a single op fits in the first read.
+  vector<ReplicateRefPtr> messages;
+  OpId preceding;
+  ASSERT_OK(cache_->ReadOps(20, 1, ReadContext(), &messages, &preceding));
+  ASSERT_EQ(1, messages.size());
+  cache_->prefetch_token_->Wait();
+  EXPECT_EQ(29, cache_->metrics_.log_cache_prefetched_ops->value());
+
+  // The rest of the evicted ops come from the read-ahead.
+  messages.clear();
+  ASSERT_OK(cache_->ReadOps(
+      21, 8 * 1024 * 1024, ReadContext(), &messages, &preceding));
+  ASSERT_EQ(79, messages.size());
+  EXPECT_EQ("3.22", OpIdToString(messages[0]->get()->id()));
+  EXPECT_EQ(1, cache_->metrics_.log_cache_wire_form_misses->value());
+  EXPECT_EQ(29, cache_->metrics_.log_cache_wire_form_hits->value());
+
+  // The token must go before the pool.
+  cache_.reset();
+}
+
+// Evicted ops are demoted to the second tier, from which they are read back
+// without going to the log, until they are overwritten.
+TEST_F(LogCacheTest, TestSecondTier) {
+  FLAGS_log_cache_second_tier_size_mb = 16;
+  CloseAndReopenCache(MinimumOpId());
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 100));
+  log_->WaitUntilAllFlushed();
+  cache_->EvictThroughOp(50);
+  EXPECT_EQ(50, cache_->metrics_.log_cache_second_tier_demotions->value());
+
+  vector<ReplicateRefPtr> messages;
+  OpId preceding;
+  ASSERT_OK(cache_->ReadOps(
+      20, 8 * 1024 * 1024, ReadContext(), &messages, &preceding));
+  ASSERT_EQ(80, messages.size());
+  EXPECT_EQ("3.21", OpIdToString(messages[0]->get()->id()));
+  EXPECT_EQ("7.50", OpIdToString(messages[29]->get()->id()));
+  EXPECT_EQ(30, cache_->metrics_.log_cache_second_tier_hits->value());
+  EXPECT_EQ(0, cache_->metrics_.log_cache_wire_form_misses->value());
+
+  // Overwritten ops are dropped from the second tier.
+  messages.clear();
+  cache_->TruncateOpsAfter(40);
+  ASSERT_OK(cache_->ReadOps(
+      20, 8 * 1024 * 1024, ReadContext(), &messages, &preceding));
+  EXPECT_EQ(20, messages.size());
+  EXPECT_EQ(50, cache_->metrics_.log_cache_second_tier_hits->value());
+}
+
 // Ensure that the cache always yields at least one message,
 // even if that message is larger than the batch size. This ensures
 // that we don't get "stuck" in the case that a large message enters
@@ -254,17 +359,17 @@ TEST_F(LogCacheTest, TestMemoryLimit) {
   FLAGS_log_cache_size_limit_mb = 1;
   CloseAndReopenCache(MinimumOpId());
 
-  const int kPayloadSize = 400 * 1024;
+  const int kPayloadSize = 200 * 1024;
   // Limit should not be violated.
   ASSERT_OK(AppendReplicateMessagesToCache(1, 1, kPayloadSize));
   log_->WaitUntilAllFlushed();
   ASSERT_EQ(1, cache_->num_cached_ops());
 
-  // Verify the size is right. It's not exactly kPayloadSize because of
-  // in-memory overhead, etc.
+  // Verify the size is right. It's twice kPayloadSize, as the serialized form
+  // written to the log is kept along with the msg, plus in-memory overhead.
   int size_with_one_msg = cache_->BytesUsed();
-  ASSERT_GT(size_with_one_msg, 300 * 1024);
-  ASSERT_LT(size_with_one_msg, 500 * 1024);
+  ASSERT_GT(size_with_one_msg, 2 * kPayloadSize);
+  ASSERT_LT(size_with_one_msg, 2 * kPayloadSize + 4 * 1024);
 
   // Add another operation which fits under the 1MB limit.
   ASSERT_OK(AppendReplicateMessagesToCache(2, 1, kPayloadSize));
@@ -272,8 +377,7 @@ TEST_F(LogCacheTest, TestMemoryLimit) {
   ASSERT_EQ(2, cache_->num_cached_ops());
 
   int size_with_two_msgs = cache_->BytesUsed();
-  ASSERT_GT(size_with_two_msgs, 2 * 300 * 1024);
-  ASSERT_LT(size_with_two_msgs, 2 * 500 * 1024);
+  ASSERT_EQ(2 * size_with_one_msg, size_with_two_msgs);
 
   // Append a third operation, which will push the cache size above the 1MB
   // limit and cause eviction of the first operation.
@@ -309,7 +413,7 @@ TEST_F(LogCacheTest, TestGlobalMemoryLimit) {
   ScopedTrackedConsumption consumption(
       cache_->parent_tracker_, 3 * 1024 * 1024);
 
-  const int kPayloadSize = 768 * 1024;
+  const int kPayloadSize = 384 * 1024;
 
   // Should succeed, but only end up caching one of the two ops because of the
   // global limit.
@@ -320,6 +424,86 @@ TEST_F(LogCacheTest, TestGlobalMemoryLimit) {
   ASSERT_LE(cache_->BytesUsed(), 1024 * 1024);
 }
 
+// A tablet which needs memory under the global limit evicts the ops of an
+// idle tablet which no peer needs anymore, rather than its own.
+TEST_F(LogCacheTest, TestGlobalEviction) {
+  cache_.reset();
+  FLAGS_global_log_cache_size_limit_mb = 4;
+  CloseAndReopenCache(MinimumOpId());
+  const int kPayloadSize = 384 * 1024;
+
+  const char* kIdleTablet = "idle-tablet";
+  scoped_refptr<log::Log> idle_log;
+  ASSERT_OK(log::Log::Open(
+      log::LogOptions(),
+      fs_manager_.get(),
+      kIdleTablet,
+      nullptr,
+      &idle_log));
+  scoped_refptr<MetricEntity> idle_entity =
+      METRIC_ENTITY_server.Instantiate(&metric_registry_, "idle");
+  LogCache idle(idle_entity, idle_log.get(), kPeerUuid, kIdleTablet);
+  idle.Init(MinimumOpId());
+  for (int64_t index = 1; index <= 4; index++) {
+    vector<ReplicateRefPtr> msgs;
+    msgs.push_back(make_scoped_refptr_replicate(
+        CreateDummyReplicate(1, index, clock_->Now(), kPayloadSize)
+            .release()));
+    ASSERT_OK(idle.AppendOperations(msgs, Bind(&FatalOnError)));
+  }
+  idle_log->WaitUntilAllFlushed();
+  ASSERT_EQ(4, idle.num_cached_ops());
+
+  // Only ops some peer has received, but not all, are pinned by slow peers.
+  idle.SetPeerNextIndexes(3, 5);
+  EXPECT_EQ(idle.BytesUsed() / 2, idle.GetBytesPinnedByPeers());
+  idle.SetPeerNextIndexes(5, 5);
+  EXPECT_EQ(0, idle.GetBytesPinnedByPeers());
+
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 2, kPayloadSize));
+  log_->WaitUntilAllFlushed();
+  EXPECT_EQ(2, cache_->num_cached_ops());
+  EXPECT_EQ(3, idle.num_cached_ops());
+  EXPECT_GT(idle.metrics_.log_cache_evicted_for_other_tablets->value(), 0);
+  EXPECT_EQ(0, cache_->metrics_.log_cache_evicted_for_other_tablets->value());
+  ASSERT_OK(idle_log->Close());
+}
+
+// Test that the cache reports memory pressure past the throttle threshold of
+// the global limit only once the ops replicated to all peers are evicted.
+TEST_F(LogCacheTest, TestMemoryPressure) {
+  cache_.reset();
+  FLAGS_global_log_cache_size_limit_mb = 4;
+  FLAGS_log_cache_throttle_threshold_percentage = 50;
+  CloseAndReopenCache(MinimumOpId());
+  const int kPayloadSize = 384 * 1024;
+  double usage_pct;
+
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 4, kPayloadSize));
+  log_->WaitUntilAllFlushed();
+  ASSERT_FALSE(cache_->IsUnderMemoryPressure(&usage_pct));
+  ASSERT_LT(usage_pct, 50);
+
+  // Every op is still needed by some peer.
+  cache_->SetPeerNextIndexes(1, 7);
+  ASSERT_OK(AppendReplicateMessagesToCache(5, 2, kPayloadSize));
+  log_->WaitUntilAllFlushed();
+  ASSERT_TRUE(cache_->IsUnderMemoryPressure(&usage_pct));
+  ASSERT_GT(usage_pct, 50);
+  ASSERT_EQ(6, cache_->num_cached_ops());
+
+  // Once the peers have the first ops, these are evicted instead.
+  cache_->SetPeerNextIndexes(4, 7);
+  ASSERT_FALSE(cache_->IsUnderMemoryPressure(&usage_pct));
+  ASSERT_LT(usage_pct, 50);
+  ASSERT_LT(cache_->num_cached_ops(), 6);
+  ASSERT_TRUE(cache_->HasOpBeenCached(6));
+
+  FLAGS_log_cache_throttle_threshold_percentage = 0;
+  ASSERT_OK(AppendReplicateMessagesToCache(7, 4, kPayloadSize));
+  ASSERT_FALSE(cache_->IsUnderMemoryPressure(&usage_pct));
+}
+
 // Test that the log cache properly replaces messages when an index
 // is reused. This is a regression test for a bug where the memtracker's
 // consumption wasn't properly managed when messages were replaced.
@@ -345,6 +529,35 @@ TEST_F(LogCacheTest, TestReplaceMessages) {
       cache_->ToString());
 }
 
+// Test that msgs removed from the cache while still referenced are accounted
+// as in flight until freed.
+TEST_F(LogCacheTest, TestInFlightMemory) {
+  const int kPayloadSize = 64 * 1024;
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 3, kPayloadSize));
+  log_->WaitUntilAllFlushed();
+  const int64_t size_with_three_msgs = cache_->BytesUsed();
+  ASSERT_EQ(0, cache_->in_flight_tracker_->consumption());
+
+  // Hold refs to ops 2 and 3, like a request in flight to a peer would.
+  vector<ReplicateRefPtr> messages;
+  OpId preceding;
+  ASSERT_OK(cache_->ReadOps(
+      1, 8 * 1024 * 1024, ReadContext(), &messages, &preceding));
+  ASSERT_EQ(2, messages.size());
+
+  cache_->TruncateOpsAfter(1);
+  const int64_t in_flight = size_with_three_msgs - cache_->BytesUsed();
+  ASSERT_GT(in_flight, 2 * kPayloadSize);
+  ASSERT_EQ(in_flight, cache_->in_flight_tracker_->consumption());
+  // The in-flight msgs still count towards the global limit.
+  ASSERT_EQ(
+      size_with_three_msgs, cache_->parent_tracker_->consumption());
+
+  messages.clear();
+  ASSERT_EQ(0, cache_->in_flight_tracker_->consumption());
+  ASSERT_EQ(cache_->BytesUsed(), cache_->parent_tracker_->consumption());
+}
+
 // Test that the cache truncates any future messages when either explicitly
 // truncated or replacing any earlier message.
 TEST_F(LogCacheTest, TestTruncation) {
@@ -383,6 +596,110 @@ TEST_F(LogCacheTest, TestTruncation) {
   }
 }
 
+TEST_F(LogCacheTest, TestAsyncWaitForOp) {
+  vector<Status> fired;
+  auto record = [&fired](const Status& s) { fired.push_back(s); };
+  MonoTime far_deadline = MonoTime::Now() + MonoDelta::FromSeconds(60);
+
+  // Wait for op 3, which has not been appended yet.
+  cache_->AsyncWaitForOp(2, far_deadline, record);
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 2));
+  ASSERT_TRUE(fired.empty());
+  ASSERT_OK(AppendReplicateMessagesToCache(3, 1));
+  ASSERT_EQ(1, fired.size());
+  ASSERT_OK(fired[0]);
+
+  // An op which is already in the log fires inline.
+  cache_->AsyncWaitForOp(1, far_deadline, record);
+  ASSERT_EQ(2, fired.size());
+  ASSERT_OK(fired[1]);
+
+  // Waiters are only expired once their deadline has passed.
+  MonoTime deadline = MonoTime::Now() + MonoDelta::FromMilliseconds(10);
+  cache_->AsyncWaitForOp(10, deadline, record);
+  cache_->ExpireOpWaiters(deadline - MonoDelta::FromMilliseconds(1));
+  ASSERT_EQ(2, fired.size());
+  cache_->ExpireOpWaiters(deadline);
+  ASSERT_EQ(3, fired.size());
+  ASSERT_TRUE(fired[2].IsTimedOut()) << fired[2].ToString();
+
+  // An expired waiter is not fired again once its op shows up.
+  ASSERT_OK(AppendReplicateMessagesToCache(4, 10));
+  ASSERT_EQ(3, fired.size());
+}
+
+// Only the payloads of write ops are sampled, within the byte budget, and
+// taking the samples clears them.
+TEST_F(LogCacheTest, TestPayloadSampling) {
+  const int kPayloadSize = 100;
+  cache_->SetPayloadSampling(kPayloadSize * 2 + kPayloadSize / 2);
+
+  for (int index = 1; index <= 6; index++) {
+    gscoped_ptr<ReplicateMsg> msg =
+        CreateDummyReplicate(1, index, clock_->Now(), 0);
+    if (index != 6) {
+      msg->clear_noop_request();
+      msg->set_op_type(WRITE_OP_EXT);
+      msg->mutable_write_payload()->set_payload(
+          string(kPayloadSize, 'a' + index));
+    }
+    vector<ReplicateMsgWrapper> msg_wrappers;
+    msg_wrappers.emplace_back(
+        make_scoped_refptr_replicate(msg.release()), false);
+    ASSERT_OK(msg_wrappers.back().Init(nullptr));
+    ASSERT_OK(cache_->AppendOperations(msg_wrappers, Bind(&FatalOnError)));
+  }
+
+  // Only the two most recent write ops fit.
+  vector<ReplicateRefPtr> samples;
+  cache_->TakePayloadSamples(&samples);
+  ASSERT_EQ(2, samples.size());
+  ASSERT_EQ(4, samples[0]->get()->id().index());
+  ASSERT_EQ(5, samples[1]->get()->id().index());
+
+  cache_->TakePayloadSamples(&samples);
+  ASSERT_TRUE(samples.empty());
+}
+
+// The ops a witness stores without their payloads are read back as stored,
+// from the cache and from the log, with the checksums of their payloads.
+TEST_F(LogCacheTest, TestStrippedPayloads) {
+  const std::string kPayload(1000, 'x');
+  const uint32_t kCrc32 = crc::Crc32c(kPayload.c_str(), kPayload.size());
+  for (int index = 1; index <= 5; index++) {
+    gscoped_ptr<ReplicateMsg> msg =
+        CreateDummyReplicate(1, index, clock_->Now(), 0);
+    msg->clear_noop_request();
+    msg->set_op_type(WRITE_OP_EXT);
+    msg->mutable_write_payload()->set_payload(kPayload);
+    ReplicateMsgWrapper msg_wrapper(
+        make_scoped_refptr_replicate(msg.release()), false);
+    ASSERT_OK(msg_wrapper.Init(nullptr));
+
+    vector<ReplicateMsgWrapper> msg_wrappers;
+    msg_wrappers.emplace_back(msg_wrapper.GetStrippedMsg(), false);
+    ASSERT_OK(msg_wrappers.back().Init(nullptr));
+    ASSERT_OK(cache_->AppendOperations(msg_wrappers, Bind(&FatalOnError)));
+  }
+  log_->WaitUntilAllFlushed();
+
+  for (int i = 0; i < 2; i++) {
+    vector<ReplicateRefPtr> messages;
+    OpId preceding;
+    ASSERT_OK(cache_->ReadOps(
+        0, 8 * 1024 * 1024, ReadContext(), &messages, &preceding));
+    ASSERT_EQ(5, messages.size());
+    for (const auto& msg : messages) {
+      ASSERT_TRUE(ReplicateMsgWrapper::IsPayloadStripped(*msg->get()));
+      const WritePayloadPB& payload = msg->get()->write_payload();
+      ASSERT_TRUE(payload.payload().empty());
+      ASSERT_EQ(kPayload.size(), payload.stripped_size());
+      ASSERT_EQ(kCrc32, payload.crc32());
+    }
+    cache_->EvictThroughOp(5);
+  }
+}
+
 TEST_F(LogCacheTest, TestMTReadAndWrite) {
   atomic<bool> stop{false};
   vector<thread> threads;
@@ -412,7 +729,6 @@ TEST_F(LogCacheTest, TestMTReadAndWrite) {
           index,
           1024 * 1024,
           ReadContext(),
-          /*for_peer_uuid=*/boost::none,
           &messages,
           &preceding));
       index += messages.size();
@@ -422,5 +738,50 @@ TEST_F(LogCacheTest, TestMTReadAndWrite) {
   SleepFor(MonoDelta::FromSeconds(AllowSlowTests() ? 10 : 2));
 }
 
+// Microbenchmark of ReadOps() and eviction with a large number of cached ops.
+TEST_F(LogCacheTest, BenchmarkReadOpsWithManyCachedOps) {
+  FLAGS_log_cache_size_limit_mb = 1024;
+  FLAGS_global_log_cache_size_limit_mb = 1024;
+  CloseAndReopenCache(MinimumOpId());
+
+  const int64_t kNumOps = AllowSlowTests() ? 1000000 : 100000;
+  const int kBatchSize = 100;
+  const int kNumReads = AllowSlowTests() ? 100000 : 10000;
+  LOG_TIMING(INFO, Substitute("appending $0 ops", kNumOps)) {
+    for (int64_t index = 1; index <= kNumOps; index += kBatchSize) {
+      vector<ReplicateRefPtr> msgs;
+      for (int64_t i = index; i < index + kBatchSize; i++) {
+        msgs.push_back(make_scoped_refptr_replicate(
+            CreateDummyReplicate(i / 7, i, clock_->Now(), 64).release()));
+      }
+      ASSERT_OK(cache_->AppendOperations(msgs, Bind(&FatalOnError)));
+    }
+    log_->WaitUntilAllFlushed();
+  }
+  ASSERT_EQ(kNumOps, cache_->num_cached_ops());
+
+  Random rng(SeedRandom());
+  int64_t num_read = 0;
+  LOG_TIMING(INFO, Substitute("$0 reads of up to 64KB", kNumReads)) {
+    for (int i = 0; i < kNumReads; i++) {
+      vector<ReplicateRefPtr> messages;
+      OpId preceding;
+      int64_t after = rng.Uniform64(kNumOps - 1);
+      ASSERT_OK(cache_->ReadOps(
+          after, 64 * 1024, ReadContext(), &messages, &preceding));
+      ASSERT_EQ(after, preceding.index());
+      ASSERT_FALSE(messages.empty());
+      ASSERT_EQ(after + 1, messages.front()->get()->id().index());
+      num_read += messages.size();
+    }
+  }
+  LOG(INFO) << "Read " << num_read << " ops";
+
+  LOG_TIMING(INFO, "evicting all ops") {
+    cache_->EvictThroughOp(kNumOps);
+  }
+  ASSERT_EQ(0, cache_->num_cached_ops());
+}
+
 } // namespace consensus
 } // namespace kudu
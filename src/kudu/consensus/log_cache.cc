@@ -17,7 +17,13 @@
 
 #include "kudu/consensus/log_cache.h"
 
-#include <map>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory>
 #include <mutex>
 #include <ostream>
 #include <string>
@@ -31,6 +37,7 @@
 
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/log.h"
+#include "kudu/consensus/log_cache_manager.h"
 #include "kudu/consensus/log_reader.h"
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/consensus/opid_util.h"
@@ -38,10 +45,12 @@
 #include "kudu/consensus/replicate_msg_wrapper.h"
 #include "kudu/gutil/bind.h"
 #include "kudu/gutil/bind_helpers.h"
-#include "kudu/gutil/map-util.h"
+#include "kudu/gutil/endian.h"
 #include "kudu/gutil/mathlimits.h"
 #include "kudu/gutil/strings/human_readable.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/walltime.h"
+#include "kudu/util/cache.h"
 #include "kudu/util/compression/compression.pb.h"
 #include "kudu/util/crc.h"
 #include "kudu/util/faststring.h"
@@ -52,6 +61,7 @@
 #include "kudu/util/mutex.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/slice.h"
+#include "kudu/util/threadpool.h"
 
 DEFINE_int32(
     log_cache_size_limit_mb,
@@ -69,8 +79,102 @@ DEFINE_int32(
     "caching log entries across all tablets is kept under this threshold.");
 TAG_FLAG(global_log_cache_size_limit_mb, advanced);
 
+DEFINE_bool(
+    log_cache_global_eviction,
+    true,
+    "Whether a log cache which exceeds --global_log_cache_size_limit_mb "
+    "evicts the ops of any tablet, those no peer needs and those of the least "
+    "recently used tablets first, rather than only its own.");
+TAG_FLAG(log_cache_global_eviction, advanced);
+TAG_FLAG(log_cache_global_eviction, runtime);
+
+DEFINE_int32(
+    log_cache_throttle_threshold_percentage,
+    90,
+    "The percentage of --global_log_cache_size_limit_mb which, once used by "
+    "the log caches and their ops in flight to peers, makes leaders reject "
+    "new ops, after evicting those replicated to all peers. This keeps a "
+    "follower outage from growing the memory of the leaders past their "
+    "limits. 0 disables it.");
+TAG_FLAG(log_cache_throttle_threshold_percentage, advanced);
+TAG_FLAG(log_cache_throttle_threshold_percentage, runtime);
+DEFINE_validator(
+    log_cache_throttle_threshold_percentage,
+    [](const char* /*flagname*/, int32_t value) {
+      return value >= 0 && value <= 100;
+    });
+
+DEFINE_int32(
+    log_cache_wire_form_size_limit_mb,
+    32,
+    "The per-tablet size of the wire form (compressed, checksummed) of evicted "
+    "entries which are kept in memory after being read back from the log for a "
+    "lagging peer, so that other peers reading the same range do not read and "
+    "compress it again. 0 disables it.");
+TAG_FLAG(log_cache_wire_form_size_limit_mb, advanced);
+TAG_FLAG(log_cache_wire_form_size_limit_mb, runtime);
+
+DEFINE_int32(
+    log_cache_prefetch_size_mb,
+    8,
+    "When an op missing from the log cache is read back from the log for a "
+    "lagging peer, the ops following it are read ahead, up to this size, into "
+    "the wire form cache in the background, so that the next request to the "
+    "peer does not wait on the disk. Capped at half of "
+    "--log_cache_wire_form_size_limit_mb. 0 disables it.");
+TAG_FLAG(log_cache_prefetch_size_mb, advanced);
+TAG_FLAG(log_cache_prefetch_size_mb, runtime);
+
+DEFINE_int32(
+    log_cache_second_tier_size_mb,
+    0,
+    "The server-wide size of a second log cache tier which ops evicted from "
+    "the log cache are demoted to, so that lagging peers can be caught up "
+    "from it instead of from the log. Log caches created while this is 0 do "
+    "not use it, and it is not resized once created. 0 disables it.");
+TAG_FLAG(log_cache_second_tier_size_mb, experimental);
+
+DEFINE_string(
+    log_cache_second_tier_type,
+    "DRAM",
+    "The type of the second log cache tier, see "
+    "--log_cache_second_tier_size_mb. Either DRAM or NVM. NVM is only "
+    "available in builds with libvmem and is backed by --nvm_cache_path.");
+DEFINE_validator(
+    log_cache_second_tier_type,
+    [](const char* /*n*/, const std::string& v) {
+#if defined(HAVE_LIB_VMEM)
+      return v == "DRAM" || v == "NVM";
+#else
+      return v == "DRAM";
+#endif
+    });
+TAG_FLAG(log_cache_second_tier_type, experimental);
+
+DEFINE_bool(
+    log_cache_compress_at_rest,
+    false,
+    "Whether the log cache compresses the write ops appended to it without a "
+    "compressed form, and those read back from the log, with the current "
+    "codec, so that it only holds their compressed payloads. The local users "
+    "of the cache which need the raw payloads uncompress them as they read "
+    "them, see --log_cache_uncompressed_hot_set_mb.");
+TAG_FLAG(log_cache_compress_at_rest, advanced);
+TAG_FLAG(log_cache_compress_at_rest, runtime);
+
+DEFINE_int32(
+    log_cache_uncompressed_hot_set_mb,
+    4,
+    "The per-tablet size of the payloads of the ops last uncompressed for the "
+    "local users of the log cache which need the raw payloads, which are kept "
+    "so that the users reading the same ops uncompress them once. 0 disables "
+    "it.");
+TAG_FLAG(log_cache_uncompressed_hot_set_mb, advanced);
+TAG_FLAG(log_cache_uncompressed_hot_set_mb, runtime);
+
 using kudu::pb_util::SecureShortDebugString;
 using std::string;
+using std::unique_ptr;
 using std::vector;
 using strings::Substitute;
 
@@ -109,8 +213,111 @@ METRIC_DEFINE_counter(
     MetricUnit::kBytes,
     "Size of the msg payload that is written to the log");
 
+METRIC_DEFINE_counter(
+    server,
+    log_cache_wire_form_hits,
+    "Log Cache Wire Form Hits",
+    MetricUnit::kOperations,
+    "Number of operations missing from the log cache which were served from "
+    "the wire form cache instead of being read from the log.");
+METRIC_DEFINE_counter(
+    server,
+    log_cache_wire_form_misses,
+    "Log Cache Wire Form Misses",
+    MetricUnit::kOperations,
+    "Number of operations missing from the log cache which were read from the "
+    "log.");
+METRIC_DEFINE_gauge_int64(
+    server,
+    log_cache_wire_form_size,
+    "Log Cache Wire Form Size",
+    MetricUnit::kBytes,
+    "Payload bytes of the wire forms of operations read back from the log "
+    "which are kept in memory.");
+METRIC_DEFINE_counter(
+    server,
+    log_cache_prefetched_ops,
+    "Log Cache Prefetched Ops",
+    MetricUnit::kOperations,
+    "Number of operations missing from the log cache which were read from the "
+    "log ahead of the lagging peers needing them.");
+METRIC_DEFINE_counter(
+    server,
+    log_cache_second_tier_demotions,
+    "Log Cache Second Tier Demotions",
+    MetricUnit::kOperations,
+    "Number of operations evicted from the log cache which were copied to the "
+    "second log cache tier.");
+METRIC_DEFINE_counter(
+    server,
+    log_cache_second_tier_hits,
+    "Log Cache Second Tier Hits",
+    MetricUnit::kOperations,
+    "Number of operations missing from the log cache which were served from "
+    "the second log cache tier instead of being read from the log.");
+
+METRIC_DEFINE_counter(
+    server,
+    log_cache_uncompressed_hot_set_hits,
+    "Log Cache Uncompressed Hot Set Hits",
+    MetricUnit::kOperations,
+    "Number of compressed operations a local user of the log cache needed "
+    "the raw payload of which were served from the ops last uncompressed.");
+METRIC_DEFINE_counter(
+    server,
+    log_cache_uncompressed_hot_set_misses,
+    "Log Cache Uncompressed Hot Set Misses",
+    MetricUnit::kOperations,
+    "Number of compressed operations a local user of the log cache needed "
+    "the raw payload of which had to be uncompressed.");
+
+METRIC_DEFINE_gauge_int64(
+    server,
+    log_cache_bytes_pinned_by_peers,
+    "Log Cache Bytes Pinned By Slow Peers",
+    MetricUnit::kBytes,
+    "Memory used by operations in the log cache which the fastest peer has "
+    "already received but slower peers still need.");
+METRIC_DEFINE_counter(
+    server,
+    log_cache_evicted_for_other_tablets,
+    "Log Cache Evicted For Other Tablets",
+    MetricUnit::kBytes,
+    "Memory freed by evicting operations from the log cache so that other "
+    "tablets stay under the global log cache limit.");
+
 static const char kParentMemTrackerId[] = "log_cache";
 
+namespace {
+
+// Returns the second tier shared by the log caches of the process, or null
+// if --log_cache_second_tier_size_mb is 0. It's created, and never resized,
+// the first time the flag is found to be positive.
+Cache* GetSecondTier() {
+  static simple_spinlock lock;
+  static Cache* second_tier = nullptr;
+  if (FLAGS_log_cache_second_tier_size_mb <= 0) {
+    return nullptr;
+  }
+  std::lock_guard<simple_spinlock> l(lock);
+  if (!second_tier) {
+    CacheType type = FLAGS_log_cache_second_tier_type == "NVM"
+        ? NVM_CACHE
+        : DRAM_CACHE;
+    second_tier = NewLRUCache(
+        type,
+        FLAGS_log_cache_second_tier_size_mb * 1024L * 1024L,
+        "log_cache_second_tier");
+  }
+  return second_tier;
+}
+
+// Tells apart the entries of different log caches, including those of
+// earlier incarnations of the same tablet, in the second tier.
+std::atomic<int64_t> next_second_tier_id(0);
+
+} // anonymous namespace
+
 typedef vector<const ReplicateMsg*>::const_iterator MsgIter;
 
 LogCache::LogCache(
@@ -121,10 +328,17 @@ LogCache::LogCache(
     : log_(std::move(log)),
       local_uuid_(std::move(local_uuid)),
       tablet_id_(std::move(tablet_id)),
+      log_prefix_(Substitute("T $0 P $1: ", tablet_id_, local_uuid_)),
       next_index_cond_(&lock_),
       next_sequential_op_index_(0),
       min_pinned_op_index_(0),
+      second_tier_(GetSecondTier()),
+      second_tier_id_(next_second_tier_id++),
+      prefetch_in_flight_(false),
       metrics_(metric_entity),
+      slowest_peer_next_index_(0),
+      fastest_peer_next_index_(0),
+      last_access_micros_(GetMonoTimeMicros()),
       enable_compression_on_cache_miss_(false) {
   const int64_t max_ops_size_bytes =
       FLAGS_log_cache_size_limit_mb * 1024L * 1024L;
@@ -142,24 +356,59 @@ LogCache::LogCache(
       Substitute("$0:$1:$2", kParentMemTrackerId, local_uuid, tablet_id),
       parent_tracker_);
 
-  // Put a fake message at index 0, since this simplifies a lot of our
-  // code paths elsewhere.
+  // Ops removed from the cache while still referenced elsewhere, e.g. by
+  // in-flight requests to peers, are accounted here until freed, so that they
+  // still count towards the global limit.
+  in_flight_tracker_ = MemTracker::CreateTracker(
+      -1,
+      Substitute(
+          "$0:$1:$2:in_flight", kParentMemTrackerId, local_uuid_, tablet_id_),
+      parent_tracker_);
+
   auto zero_op = new ReplicateMsg();
   *zero_op->mutable_id() = MinimumOpId();
-  InsertOrDie(
-      &cache_,
-      0,
-      {make_scoped_refptr_replicate(zero_op), zero_op->SpaceUsed()});
+  ReplicateRefPtr zero_op_ref = make_scoped_refptr_replicate(zero_op);
+  int64_t zero_op_size = zero_op_ref->MemoryFootprint();
+  zero_op_ = {std::move(zero_op_ref), zero_op_size, zero_op_size};
+
+  METRIC_log_cache_bytes_pinned_by_peers
+      .InstantiateFunctionGauge(
+          metric_entity,
+          Bind(&LogCache::GetBytesPinnedByPeers, Unretained(this)))
+      ->AutoDetach(&metric_detacher_);
+
+  LogCacheManager::Get()->Register(this);
 }
 
 LogCache::~LogCache() {
+  LogCacheManager::Get()->Unregister(this);
+  ShutdownPrefetch();
+  for (const auto& e : op_waiters_) {
+    e.second.callback(Status::Aborted("log cache is being destroyed"));
+  }
+  metrics_.log_cache_wire_form_size->IncrementBy(-wire_forms_size_);
+  {
+    std::lock_guard<Mutex> l(lock_);
+    TruncateSecondTierAfterUnlocked(-1);
+  }
   tracker_->Release(tracker_->consumption());
-  cache_.clear();
+  cache_.Clear();
+}
+
+void LogCache::SetPrefetchToken(unique_ptr<ThreadPoolToken> token) {
+  prefetch_token_ = std::move(token);
+}
+
+void LogCache::ShutdownPrefetch() {
+  if (prefetch_token_) {
+    prefetch_token_->Shutdown();
+  }
 }
 
 void LogCache::Init(const OpId& preceding_op) {
   std::lock_guard<Mutex> l(lock_);
-  CHECK_EQ(cache_.size(), 1) << "Cache should have only our special '0' op";
+  std::lock_guard<percpu_rwlock> ring_l(ring_lock_);
+  CHECK(cache_.empty()) << "Cache should have only our special '0' op";
   next_sequential_op_index_ = preceding_op.index() + 1;
   min_pinned_op_index_ = next_sequential_op_index_;
 }
@@ -170,6 +419,52 @@ Status LogCache::EnableCompressionOnCacheMiss(bool enable) {
   return Status::OK();
 }
 
+void LogCache::SetPayloadSampling(int64_t max_bytes) {
+  std::lock_guard<simple_spinlock> l(payload_samples_lock_);
+  max_payload_sample_bytes_ = max_bytes;
+  if (max_bytes <= 0) {
+    payload_samples_.clear();
+    payload_sample_bytes_ = 0;
+  }
+}
+
+void LogCache::TakePayloadSamples(vector<ReplicateRefPtr>* samples) {
+  std::deque<ReplicateRefPtr> taken;
+  {
+    std::lock_guard<simple_spinlock> l(payload_samples_lock_);
+    taken.swap(payload_samples_);
+    payload_sample_bytes_ = 0;
+  }
+  samples->assign(
+      std::make_move_iterator(taken.begin()),
+      std::make_move_iterator(taken.end()));
+}
+
+void LogCache::SamplePayloads(const vector<ReplicateMsgWrapper>& msg_wrappers) {
+  std::lock_guard<simple_spinlock> l(payload_samples_lock_);
+  if (max_payload_sample_bytes_ <= 0) {
+    return;
+  }
+  for (const auto& msg_wrapper : msg_wrappers) {
+    const ReplicateRefPtr& msg = msg_wrapper.GetUncompressedMsg();
+    if (!msg || msg->get()->op_type() != WRITE_OP_EXT ||
+        msg->get()->write_payload().compression_codec() != NO_COMPRESSION) {
+      continue;
+    }
+    int64_t size = msg->get()->write_payload().payload().size();
+    if (size == 0 || size > max_payload_sample_bytes_) {
+      continue;
+    }
+    payload_samples_.push_back(msg);
+    payload_sample_bytes_ += size;
+  }
+  while (payload_sample_bytes_ > max_payload_sample_bytes_) {
+    payload_sample_bytes_ -=
+        payload_samples_.front()->get()->write_payload().payload().size();
+    payload_samples_.pop_front();
+  }
+}
+
 void LogCache::TruncateOpsAfter(int64_t index) {
   {
     std::unique_lock<Mutex> l(lock_);
@@ -201,15 +496,125 @@ void LogCache::TruncateOpsAfterUnlocked(int64_t index) {
   // to the last index, i.e. we're overwriting.
   CHECK_LE(first_to_truncate, next_sequential_op_index_);
 
-  // Now remove the overwritten operations.
-  for (int64_t i = first_to_truncate; i < next_sequential_op_index_; ++i) {
-    auto it = cache_.find(i);
-    if (it != cache_.end()) {
-      AccountForMessageRemovalUnlocked(it->second);
-      cache_.erase(it);
+  // Now remove the overwritten operations, newest first so that the ring
+  // only ever shrinks from its end. The messages are only released once
+  // readers are let back in.
+  vector<CacheEntry> removed;
+  {
+    std::lock_guard<percpu_rwlock> ring_l(ring_lock_);
+    if (!cache_.empty()) {
+      int64_t first = std::max(first_to_truncate, cache_.first_index());
+      for (int64_t i = cache_.end_index() - 1; i >= first; --i) {
+        if (cache_.Find(i)) {
+          removed.emplace_back(cache_.Erase(i));
+        }
+      }
+    }
+    next_sequential_op_index_ = index + 1;
+  }
+  for (const CacheEntry& entry : removed) {
+    AccountForMessageRemovalUnlocked(entry);
+  }
+  TruncateWireFormsAfter(index);
+  TruncateSecondTierAfterUnlocked(index);
+}
+
+LogCache::MessageCache::MessageCache()
+    : first_index_(0), end_index_(0), size_(0) {}
+
+LogCache::CacheEntry* LogCache::MessageCache::Find(int64_t index) {
+  if (index < first_index_ || index >= end_index_) {
+    return nullptr;
+  }
+  CacheEntry& entry = Slot(index);
+  return entry.msg ? &entry : nullptr;
+}
+
+const LogCache::CacheEntry* LogCache::MessageCache::Find(
+    int64_t index) const {
+  if (index < first_index_ || index >= end_index_) {
+    return nullptr;
+  }
+  const CacheEntry& entry = Slot(index);
+  return entry.msg ? &entry : nullptr;
+}
+
+int64_t LogCache::MessageCache::NextCachedIndex(int64_t index) const {
+  for (int64_t i = std::max(index, first_index_); i < end_index_; i++) {
+    if (Slot(i).msg) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void LogCache::MessageCache::Insert(int64_t index, CacheEntry entry) {
+  DCHECK(entry.msg);
+  if (empty()) {
+    first_index_ = index;
+    end_index_ = index;
+  }
+  int64_t new_first = std::min(first_index_, index);
+  int64_t new_end = std::max(end_index_, index + 1);
+  if (new_end - new_first > static_cast<int64_t>(slots_.size())) {
+    Grow(new_end - new_first);
+  }
+  // Slots outside of [first_index_, end_index_) are always empty.
+  CacheEntry& slot = Slot(index);
+  CHECK(!slot.msg) << "Op " << index << " is already cached";
+  slot = std::move(entry);
+  first_index_ = new_first;
+  end_index_ = new_end;
+  size_++;
+}
+
+LogCache::CacheEntry LogCache::MessageCache::Erase(int64_t index) {
+  CacheEntry* entry = Find(index);
+  CHECK(entry) << "Op " << index << " is not cached";
+  CacheEntry removed = std::move(*entry);
+  *entry = CacheEntry();
+  size_--;
+  if (size_ == 0) {
+    first_index_ = end_index_ = 0;
+    return removed;
+  }
+  // Keep the span tight, so that new ops don't need the ring to grow.
+  while (!Slot(first_index_).msg) {
+    first_index_++;
+  }
+  while (!Slot(end_index_ - 1).msg) {
+    end_index_--;
+  }
+  return removed;
+}
+
+void LogCache::MessageCache::Clear() {
+  for (CacheEntry& slot : slots_) {
+    slot = CacheEntry();
+  }
+  first_index_ = end_index_ = 0;
+  size_ = 0;
+}
+
+void LogCache::MessageCache::Grow(int64_t span) {
+  size_t capacity = std::max<size_t>(slots_.size(), 64);
+  while (capacity < static_cast<size_t>(span)) {
+    capacity *= 2;
+  }
+  std::vector<CacheEntry> new_slots(capacity);
+  if (!empty()) {
+    for (int64_t i = first_index_; i < end_index_; i++) {
+      new_slots[i & (capacity - 1)] = std::move(Slot(i));
     }
   }
-  next_sequential_op_index_ = index + 1;
+  slots_.swap(new_slots);
+}
+
+const LogCache::CacheEntry* LogCache::FindUnlocked(int64_t index) const {
+  if (index == 0) {
+    return &zero_op_;
+  }
+  return cache_.Find(index);
 }
 
 namespace {
@@ -223,19 +628,273 @@ int64_t ApproxMsgSize(const ReplicateRefPtr& msg) {
 }
 } // anonymous namespace
 
+Status LogCache::GetUncompressed(
+    const ReplicateRefPtr& msg,
+    ReplicateRefPtr* uncompressed) {
+  if (msg->get()->write_payload().compression_codec() == NO_COMPRESSION ||
+      ReplicateMsgWrapper::IsPayloadStripped(*msg->get())) {
+    *uncompressed = msg;
+    return Status::OK();
+  }
+  // A copy, as 'uncompressed' may be 'msg'.
+  const OpId id = msg->get()->id();
+  {
+    std::lock_guard<simple_spinlock> l(uncompressed_lock_);
+    auto it = uncompressed_.find(id.index());
+    // The op at the index may have been replaced since.
+    if (it != uncompressed_.end() &&
+        OpIdEquals(it->second->get()->id(), id)) {
+      *uncompressed = it->second;
+      metrics_.log_cache_uncompressed_hot_set_hits->Increment();
+      return Status::OK();
+    }
+  }
+
+  ReplicateMsgWrapper msg_wrapper(msg);
+  RETURN_NOT_OK(msg_wrapper.Init(nullptr));
+  *uncompressed = msg_wrapper.GetUncompressedMsg();
+  metrics_.log_cache_uncompressed_hot_set_misses->Increment();
+
+  const int64_t max_bytes =
+      FLAGS_log_cache_uncompressed_hot_set_mb * 1024L * 1024L;
+  std::lock_guard<simple_spinlock> l(uncompressed_lock_);
+  ReplicateRefPtr& hot = uncompressed_[id.index()];
+  if (hot) {
+    uncompressed_bytes_ -= ApproxMsgSize(hot);
+  }
+  hot = *uncompressed;
+  uncompressed_bytes_ += ApproxMsgSize(hot);
+  // The users read forward, so the lowest indexes go first.
+  while (!uncompressed_.empty() && uncompressed_bytes_ > max_bytes) {
+    uncompressed_bytes_ -= ApproxMsgSize(uncompressed_.begin()->second);
+    uncompressed_.erase(uncompressed_.begin());
+  }
+  return Status::OK();
+}
+
+ReplicateRefPtr LogCache::LookupWireForm(int64_t index) {
+  std::lock_guard<simple_spinlock> l(wire_forms_lock_);
+  auto it = wire_forms_.find(index);
+  return it == wire_forms_.end() ? nullptr : it->second;
+}
+
+string LogCache::SecondTierKey(int64_t index) const {
+  // Big endian, so that the ops of a log cache are adjacent in key order.
+  char key[2 * sizeof(uint64_t)];
+  BigEndian::Store64(key, static_cast<uint64_t>(second_tier_id_));
+  BigEndian::Store64(key + sizeof(uint64_t), static_cast<uint64_t>(index));
+  return string(key, sizeof(key));
+}
+
+void LogCache::DemoteToSecondTierUnlocked(const vector<CacheEntry>& evicted) {
+  lock_.AssertAcquired();
+  if (!second_tier_ || evicted.empty()) {
+    return;
+  }
+  int64_t num_demoted = 0;
+  for (const CacheEntry& entry : evicted) {
+    int64_t index = entry.msg->get()->id().index();
+    // Serialized straight into the second tier, rather than through
+    // RefCountedReplicate::Serialized(), which would keep a copy alive for as
+    // long as the op is referenced elsewhere.
+    const ReplicateMsg& msg = *entry.msg->get();
+    Cache::PendingHandle* ph =
+        second_tier_->Allocate(SecondTierKey(index), msg.ByteSizeLong());
+    if (!ph) {
+      continue;
+    }
+    msg.SerializeWithCachedSizesToArray(second_tier_->MutableValue(ph));
+    second_tier_->Release(second_tier_->Insert(ph, nullptr));
+    if (second_tier_first_ == second_tier_end_) {
+      second_tier_first_ = index;
+    }
+    second_tier_first_ = std::min(second_tier_first_, index);
+    second_tier_end_ = std::max(second_tier_end_, index + 1);
+    num_demoted++;
+  }
+  metrics_.log_cache_second_tier_demotions->IncrementBy(num_demoted);
+}
+
+ReplicateRefPtr LogCache::LookupSecondTier(int64_t index) {
+  if (!second_tier_) {
+    return nullptr;
+  }
+  Cache::UniqueHandle handle(
+      second_tier_->Lookup(SecondTierKey(index), Cache::EXPECT_IN_CACHE),
+      Cache::HandleDeleter(second_tier_));
+  if (!handle) {
+    return nullptr;
+  }
+  Slice value = second_tier_->Value(handle.get());
+  unique_ptr<ReplicateMsg> msg(new ReplicateMsg());
+  if (!msg->ParseFromArray(value.data(), value.size())) {
+    LOG_WITH_PREFIX_UNLOCKED(DFATAL)
+        << "Unable to parse op " << index << " from the second tier";
+    return nullptr;
+  }
+  return make_scoped_refptr_replicate(msg.release());
+}
+
+void LogCache::TruncateSecondTierAfterUnlocked(int64_t index) {
+  lock_.AssertAcquired();
+  if (!second_tier_) {
+    return;
+  }
+  int64_t first = std::max(index + 1, second_tier_first_);
+  for (int64_t i = first; i < second_tier_end_; i++) {
+    second_tier_->Erase(SecondTierKey(i));
+  }
+  second_tier_end_ = std::max(second_tier_first_, first);
+}
+
+void LogCache::InsertWireForms(
+    const vector<ReplicateRefPtr>& msgs,
+    int64_t truncations) {
+  const int64_t limit =
+      FLAGS_log_cache_wire_form_size_limit_mb * 1024L * 1024L;
+  if (limit <= 0) {
+    return;
+  }
+  // The evicted messages are only released after the lock is dropped.
+  vector<ReplicateRefPtr> evicted;
+  std::lock_guard<simple_spinlock> l(wire_forms_lock_);
+  if (truncations >= 0 && truncations != wire_form_truncations_) {
+    return;
+  }
+  int64_t delta = 0;
+  for (const auto& msg : msgs) {
+    auto r = wire_forms_.emplace(msg->get()->id().index(), msg);
+    if (r.second) {
+      delta += ApproxMsgSize(msg);
+    }
+  }
+  // Peers read forward, so the lowest indexes are the least likely to be
+  // read again.
+  while (wire_forms_size_ + delta > limit && !wire_forms_.empty()) {
+    auto it = wire_forms_.begin();
+    delta -= ApproxMsgSize(it->second);
+    evicted.emplace_back(std::move(it->second));
+    wire_forms_.erase(it);
+  }
+  wire_forms_size_ += delta;
+  metrics_.log_cache_wire_form_size->IncrementBy(delta);
+}
+
+void LogCache::TruncateWireFormsAfter(int64_t index) {
+  vector<ReplicateRefPtr> removed;
+  std::lock_guard<simple_spinlock> l(wire_forms_lock_);
+  wire_form_truncations_++;
+  int64_t delta = 0;
+  for (auto it = wire_forms_.upper_bound(index); it != wire_forms_.end();) {
+    delta -= ApproxMsgSize(it->second);
+    removed.emplace_back(std::move(it->second));
+    it = wire_forms_.erase(it);
+  }
+  wire_forms_size_ += delta;
+  metrics_.log_cache_wire_form_size->IncrementBy(delta);
+}
+
+void LogCache::MaybePrefetchAfter(int64_t index) {
+  const int64_t prefetch_size_bytes = std::min(
+      FLAGS_log_cache_prefetch_size_mb * 1024L * 1024L,
+      FLAGS_log_cache_wire_form_size_limit_mb * 1024L * 1024L / 2);
+  if (!prefetch_token_ || prefetch_size_bytes <= 0 || prefetch_in_flight_) {
+    return;
+  }
+
+  // Skip the ops which are already read ahead.
+  int64_t from = index + 1;
+  int64_t buffered_bytes = 0;
+  int64_t truncations;
+  {
+    std::lock_guard<simple_spinlock> l(wire_forms_lock_);
+    for (auto it = wire_forms_.find(from);
+         it != wire_forms_.end() && it->first == from;
+         ++it, ++from) {
+      buffered_bytes += ApproxMsgSize(it->second);
+    }
+    truncations = wire_form_truncations_;
+  }
+  // Only top up once half of the read-ahead has been consumed, so that the
+  // log is read in large chunks rather than an op at a time.
+  if (buffered_bytes > prefetch_size_bytes / 2) {
+    return;
+  }
+
+  int64_t up_to;
+  {
+    shared_lock<rw_spinlock> l(ring_lock_.get_lock());
+    if (from >= next_sequential_op_index_) {
+      return;
+    }
+    int64_t next_cached = cache_.NextCachedIndex(from);
+    up_to = next_cached < 0 ? next_sequential_op_index_ - 1 : next_cached - 1;
+  }
+  if (up_to < from) {
+    // The peer is about to reach the ops which are still cached.
+    return;
+  }
+
+  bool expected = false;
+  if (!prefetch_in_flight_.compare_exchange_strong(expected, true)) {
+    return;
+  }
+  Status s = prefetch_token_->SubmitFunc(std::bind(
+      &LogCache::PrefetchOps,
+      this,
+      from,
+      up_to,
+      prefetch_size_bytes - buffered_bytes,
+      truncations));
+  if (!s.ok()) {
+    prefetch_in_flight_ = false;
+  }
+}
+
+void LogCache::PrefetchOps(
+    int64_t from,
+    int64_t up_to,
+    int64_t max_size_bytes,
+    int64_t truncations) {
+  vector<ReplicateMsg*> raw_replicate_ptrs;
+  vector<ReplicateRefPtr> wire_forms;
+  // The ops are not read for any one peer in particular.
+  Status s = log_->ReadReplicatesInRange(
+      from, up_to, max_size_bytes, ReadContext(), &raw_replicate_ptrs);
+  if (s.ok()) {
+    s = WrapOpsReadFromLog(raw_replicate_ptrs, ReadContext(), &wire_forms);
+  } else {
+    for (ReplicateMsg* msg : raw_replicate_ptrs) {
+      delete msg;
+    }
+  }
+  if (!s.ok()) {
+    // The peer's next read goes to the log itself, and reports the error.
+    VLOG_WITH_PREFIX_UNLOCKED(1) << "Failed to prefetch ops " << from << ".."
+                                 << up_to << ": " << s.ToString();
+  } else {
+    VLOG_WITH_PREFIX_UNLOCKED(2)
+        << "Prefetched " << wire_forms.size() << " ops from disk (" << from
+        << ".." << (from + wire_forms.size() - 1) << ")";
+    metrics_.log_cache_prefetched_ops->IncrementBy(wire_forms.size());
+    InsertWireForms(wire_forms, truncations);
+  }
+  prefetch_in_flight_ = false;
+}
+
 Status LogCache::AppendOperations(
     const vector<ReplicateRefPtr>& msgs,
     const StatusCallback& callback) {
   CHECK_GT(msgs.size(), 0);
 
-  // SpaceUsed is relatively expensive, so do calculations outside the lock
-  // and cache the result with each message.
+  // Do the size calculations outside the lock and cache the result with each
+  // message.
   int64_t mem_required = 0;
   vector<CacheEntry> entries_to_insert;
   entries_to_insert.reserve(msgs.size());
 
   for (const auto& msg : msgs) {
-    int64_t msg_size = static_cast<int64_t>(msg->get()->SpaceUsedLong());
+    int64_t msg_size = msg->MemoryFootprint();
     CacheEntry e = {msg, msg_size, msg_size};
     mem_required += e.mem_usage;
     entries_to_insert.emplace_back(std::move(e));
@@ -244,6 +903,7 @@ Status LogCache::AppendOperations(
   int64_t first_idx_in_batch = msgs.front()->get()->id().index();
   int64_t last_idx_in_batch = msgs.back()->get()->id().index();
 
+  last_access_micros_.store(GetMonoTimeMicros(), std::memory_order_relaxed);
   std::unique_lock<Mutex> l(lock_);
   // If we're not appending a consecutive op we're likely overwriting and
   // need to replace operations in the cache.
@@ -262,26 +922,28 @@ Status LogCache::AppendOperations(
         << " to log cache (available=" << HumanReadableNumBytes::ToString(spare)
         << "): attempting to evict some operations...";
 
-    // TODO: we should also try to evict from other tablets - probably better to
-    // evict really old ops from another tablet than evict recent ops from this
-    // one.
-    EvictSomeUnlocked(min_pinned_op_index_, need_to_free);
+    EvictToFitUnlocked(need_to_free, mem_required);
 
     // Force consuming, so that we don't refuse appending data. We might
-    // blow past our limit a little bit (as much as the number of tablets times
-    // the amount of in-flight data in the log), but until implementing the
-    // above TODO, it's difficult to solve this issue.
+    // blow past our limit a little bit, as ops which are in flight or not
+    // yet durable, in any tablet, can't be evicted.
     tracker_->Consume(mem_required);
 
     borrowed_memory = parent_tracker_->LimitExceeded();
   }
 
-  for (auto& e : entries_to_insert) {
-    auto index = e.msg->get()->id().index();
-    EmplaceOrDie(&cache_, index, std::move(e));
-    next_sequential_op_index_ = index + 1;
+  {
+    std::lock_guard<percpu_rwlock> ring_l(ring_lock_);
+    for (auto& e : entries_to_insert) {
+      auto index = e.msg->get()->id().index();
+      cache_.Insert(index, std::move(e));
+      next_sequential_op_index_ = index + 1;
+    }
   }
 
+  vector<OpAvailableCallback> ready_waiters;
+  TakeReadyOpWaitersUnlocked(&ready_waiters);
+
   // We drop the lock during the AsyncAppendReplicates call, since it may block
   // if the queue is full, and the queue might not drain if it's trying to call
   // our callback and blocked on this lock.
@@ -312,6 +974,9 @@ Status LogCache::AppendOperations(
   // Now signal any threads that might be waiting for Ops to be appended to the
   // log
   next_index_cond_.Broadcast();
+  for (const auto& callback : ready_waiters) {
+    callback(Status::OK());
+  }
   return Status::OK();
 }
 
@@ -320,8 +985,8 @@ Status LogCache::AppendOperations(
     const StatusCallback& callback) {
   CHECK_GT(msg_wrappers.size(), 0);
 
-  // SpaceUsed is relatively expensive, so do calculations outside the lock
-  // and cache the result with each message.
+  // Do the size calculations outside the lock and cache the result with each
+  // message.
   int64_t mem_required = 0;
   int64_t total_msg_size = 0;
   int64_t compressed_size = 0;
@@ -329,45 +994,62 @@ Status LogCache::AppendOperations(
   vector<CacheEntry> entries_to_insert;
   entries_to_insert.reserve(msg_wrappers.size());
 
+  const bool compress_at_rest = FLAGS_log_cache_compress_at_rest;
   for (const auto& msg_wrapper : msg_wrappers) {
     auto msg = msg_wrapper.GetUncompressedMsg();
     auto compressed_msg = msg_wrapper.GetCompressedMsg();
+    if (compress_at_rest && !compressed_msg &&
+        !msg->get()->write_payload().payload().empty()) {
+      // Only the log gets the uncompressed msg then.
+      ReplicateMsgWrapper at_rest(msg);
+      Status s = at_rest.Init(&log_cache_compression_buf_);
+      if (PREDICT_TRUE(s.ok())) {
+        compressed_msg = at_rest.GetCompressedMsg();
+      } else {
+        KLOG_EVERY_N_SECS(WARNING, 10)
+            << LogPrefixUnlocked() << "Could not compress op "
+            << OpIdToString(msg->get()->id())
+            << " for the log cache: " << s.ToString() << THROTTLE_MSG;
+      }
+    }
 
     CacheEntry e;
-    e.msg_size = ApproxMsgSize(msg);
-
-    uncompressed_size += e.msg_size;
+    uncompressed_size += ApproxMsgSize(msg);
 
     // We use the compressed msg if available. The compressed msg might
     // not be avaiblable if compression is disabled or the msg doesn't
     // support compression e.g. non write op
-    if (compressed_msg) {
-      e.mem_usage = ApproxMsgSize(compressed_msg);
-      e.msg = compressed_msg;
-    } else {
-      e.mem_usage = e.msg_size;
-      e.msg = msg;
-    }
+    e.msg = compressed_msg ? compressed_msg : msg;
 
     compressed_size +=
         static_cast<int64_t>(e.msg->get()->write_payload().payload().size());
 
-    // Update the crc32 checksum for the payload
-    uint32_t payload_crc32 = crc::Crc32c(
-        e.msg->get()->write_payload().payload().c_str(),
-        e.msg->get()->write_payload().payload().size());
-    e.msg->get()->mutable_write_payload()->set_crc32(payload_crc32);
+    // Update the crc32 checksum for the payload, which a stripped msg keeps
+    // for the payload it left out.
+    if (!ReplicateMsgWrapper::IsPayloadStripped(*e.msg->get())) {
+      uint32_t payload_crc32 = crc::Crc32c(
+          e.msg->get()->write_payload().payload().c_str(),
+          e.msg->get()->write_payload().payload().size());
+      e.msg->get()->mutable_write_payload()->set_crc32(payload_crc32);
+    }
+
+    e.msg_size = msg->MemoryFootprint();
+    e.mem_usage =
+        compressed_msg ? compressed_msg->MemoryFootprint() : e.msg_size;
 
     total_msg_size += e.msg_size;
     mem_required += e.mem_usage;
     entries_to_insert.emplace_back(std::move(e));
   }
 
+  SamplePayloads(msg_wrappers);
+
   int64_t first_idx_in_batch =
       msg_wrappers.front().GetOrigMsg()->get()->id().index();
   int64_t last_idx_in_batch =
       msg_wrappers.back().GetOrigMsg()->get()->id().index();
 
+  last_access_micros_.store(GetMonoTimeMicros(), std::memory_order_relaxed);
   std::unique_lock<Mutex> l(lock_);
   // If we're not appending a consecutive op we're likely overwriting and
   // need to replace operations in the cache.
@@ -386,26 +1068,28 @@ Status LogCache::AppendOperations(
         << " to log cache (available=" << HumanReadableNumBytes::ToString(spare)
         << "): attempting to evict some operations...";
 
-    // TODO: we should also try to evict from other tablets - probably better to
-    // evict really old ops from another tablet than evict recent ops from this
-    // one.
-    EvictSomeUnlocked(min_pinned_op_index_, need_to_free);
+    EvictToFitUnlocked(need_to_free, mem_required);
 
     // Force consuming, so that we don't refuse appending data. We might
-    // blow past our limit a little bit (as much as the number of tablets times
-    // the amount of in-flight data in the log), but until implementing the
-    // above TODO, it's difficult to solve this issue.
+    // blow past our limit a little bit, as ops which are in flight or not
+    // yet durable, in any tablet, can't be evicted.
     tracker_->Consume(mem_required);
 
     borrowed_memory = parent_tracker_->LimitExceeded();
   }
 
-  for (auto& e : entries_to_insert) {
-    auto index = e.msg->get()->id().index();
-    EmplaceOrDie(&cache_, index, std::move(e));
-    next_sequential_op_index_ = index + 1;
+  {
+    std::lock_guard<percpu_rwlock> ring_l(ring_lock_);
+    for (auto& e : entries_to_insert) {
+      auto index = e.msg->get()->id().index();
+      cache_.Insert(index, std::move(e));
+      next_sequential_op_index_ = index + 1;
+    }
   }
 
+  vector<OpAvailableCallback> ready_waiters;
+  TakeReadyOpWaitersUnlocked(&ready_waiters);
+
   // We drop the lock during the AsyncAppendReplicates call, since it may block
   // if the queue is full, and the queue might not drain if it's trying to call
   // our callback and blocked on this lock.
@@ -449,6 +1133,9 @@ Status LogCache::AppendOperations(
   // Now signal any threads that might be waiting for Ops to be appended to the
   // log
   next_index_cond_.Broadcast();
+  for (const auto& callback : ready_waiters) {
+    callback(Status::OK());
+  }
   return Status::OK();
 }
 
@@ -470,7 +1157,7 @@ void LogCache::LogCallback(
     if (borrowed_memory) {
       int64_t spare_capacity = parent_tracker_->SpareCapacity();
       if (spare_capacity < 0) {
-        EvictSomeUnlocked(min_pinned_op_index_, -spare_capacity);
+        EvictToFitUnlocked(-spare_capacity, 0);
       }
     }
   }
@@ -478,14 +1165,19 @@ void LogCache::LogCallback(
 }
 
 bool LogCache::HasOpBeenWritten(int64_t index) const {
-  std::lock_guard<Mutex> l(lock_);
+  shared_lock<rw_spinlock> l(ring_lock_.get_lock());
   return index < next_sequential_op_index_;
 }
 
+bool LogCache::HasOpBeenCached(int64_t index) const {
+  shared_lock<rw_spinlock> l(ring_lock_.get_lock());
+  return cache_.Find(index) != nullptr;
+}
+
 Status LogCache::LookupOpId(int64_t op_index, OpId* op_id) const {
   // First check the log cache itself.
   {
-    std::lock_guard<Mutex> l(lock_);
+    shared_lock<rw_spinlock> l(ring_lock_.get_lock());
 
     // We sometimes try to look up OpIds that have never been written
     // on the local node. In that case, don't try to read the op from
@@ -498,9 +1190,9 @@ Status LogCache::LookupOpId(int64_t op_index, OpId* op_id) const {
           op_index,
           next_sequential_op_index_));
     }
-    auto iter = cache_.find(op_index);
-    if (iter != cache_.end()) {
-      *op_id = iter->second.msg->get()->id();
+    const CacheEntry* entry = FindUnlocked(op_index);
+    if (entry) {
+      *op_id = entry->msg->get()->id();
       return Status::OK();
     }
   }
@@ -544,6 +1236,49 @@ Status LogCache::BlockingReadOps(
       after_op_index, max_size_bytes, context, messages, preceding_op);
 }
 
+void LogCache::AsyncWaitForOp(
+    int64_t after_op_index,
+    MonoTime deadline,
+    OpAvailableCallback callback) {
+  {
+    std::lock_guard<Mutex> l(lock_);
+    if ((after_op_index + 1) >= next_sequential_op_index_) {
+      op_waiters_.emplace(
+          after_op_index + 1, OpWaiter{deadline, std::move(callback)});
+      return;
+    }
+  }
+  callback(Status::OK());
+}
+
+void LogCache::ExpireOpWaiters(MonoTime now) {
+  vector<OpAvailableCallback> expired;
+  {
+    std::lock_guard<Mutex> l(lock_);
+    for (auto it = op_waiters_.begin(); it != op_waiters_.end();) {
+      if (it->second.deadline <= now) {
+        expired.emplace_back(std::move(it->second.callback));
+        it = op_waiters_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  for (const auto& callback : expired) {
+    callback(Status::TimedOut("timed out waiting for op to be appended"));
+  }
+}
+
+void LogCache::TakeReadyOpWaitersUnlocked(
+    vector<OpAvailableCallback>* ready) {
+  lock_.AssertAcquired();
+  auto end = op_waiters_.lower_bound(next_sequential_op_index_);
+  for (auto it = op_waiters_.begin(); it != end; ++it) {
+    ready->emplace_back(std::move(it->second.callback));
+  }
+  op_waiters_.erase(op_waiters_.begin(), end);
+}
+
 Status LogCache::ReadOps(
     int64_t after_op_index,
     int max_size_bytes,
@@ -551,6 +1286,7 @@ Status LogCache::ReadOps(
     std::vector<ReplicateRefPtr>* messages,
     OpId* preceding_op) {
   DCHECK_GE(after_op_index, 0);
+  last_access_micros_.store(GetMonoTimeMicros(), std::memory_order_relaxed);
 
   // Try to lookup the first OpId in index
   auto lookUpStatus = LookupOpId(after_op_index, preceding_op);
@@ -575,111 +1311,241 @@ Status LogCache::ReadOps(
     return lookUpStatus;
   }
 
-  std::unique_lock<Mutex> l(lock_);
   int64_t next_index = after_op_index + 1;
 
   // Return as many operations as we can, up to the limit
   int64_t remaining_space = max_size_bytes;
-  while (remaining_space > 0 && next_index < next_sequential_op_index_) {
-    // If the messages the peer needs haven't been loaded into the queue yet,
-    // load them.
-    MessageCache::const_iterator iter = cache_.lower_bound(next_index);
-    if (iter == cache_.end() || iter->first != next_index) {
-      int64_t up_to;
-      if (iter == cache_.end()) {
+  bool read_past_cache = false;
+  while (remaining_space > 0) {
+    int64_t up_to;
+    {
+      // Only 'ring_lock_' is needed to access the cache, so that readers
+      // neither wait for each other nor for the rest of AppendOperations().
+      shared_lock<rw_spinlock> l(ring_lock_.get_lock());
+      if (next_index >= next_sequential_op_index_) {
+        break;
+      }
+      if (cache_.Find(next_index)) {
+        // Pull contiguous messages from the cache until the size limit is
+        // achieved.
+        const CacheEntry* entry;
+        while ((entry = cache_.Find(next_index)) != nullptr) {
+          const ReplicateRefPtr& msg = entry->msg;
+
+          // The full size of the msg is actually returned by SpaceUsedLong()
+          // but that's very expensive, the payload size should be very close
+          // to the full msg size
+          remaining_space -= static_cast<int64_t>(
+              msg->get()->write_payload().payload().size());
+          if (remaining_space < 0 && !messages->empty()) {
+            break;
+          }
+
+          messages->push_back(msg);
+          next_index++;
+        }
+        continue;
+      }
+
+      // If the messages the peer needs haven't been loaded into the queue
+      // yet, load them.
+      int64_t next_cached = cache_.NextCachedIndex(next_index);
+      if (next_cached < 0) {
         // Read all the way to the current op
         up_to = next_sequential_op_index_ - 1;
       } else {
         // Read up to the next entry that's in the cache
-        up_to = iter->first - 1;
+        up_to = next_cached - 1;
       }
+    }
 
-      l.unlock();
-
-      vector<ReplicateMsg*> raw_replicate_ptrs;
-      RETURN_NOT_OK_PREPEND(
-          log_->ReadReplicatesInRange(
-              next_index, up_to, remaining_space, context, &raw_replicate_ptrs),
-          Substitute("Failed to read ops $0..$1", next_index, up_to));
-
-      // Compress messages read from the log if:
-      // (1) the feature is enabled through
-      // enable_compression_on_cache_miss_ flag
-      // (2) the request is not for a proxy host (the payload is discarded for
-      // a proxy request and it is wasteful to compress it here)
-      const bool should_compress =
-          enable_compression_on_cache_miss_ && !context.route_via_proxy;
-
-      vector<ReplicateMsgWrapper> msg_wrappers;
-      faststring buffer;
-
-      for (const auto& replicate : raw_replicate_ptrs) {
-        ReplicateMsgWrapper msg_wrapper(
-            make_scoped_refptr_replicate(replicate), should_compress);
-        RETURN_NOT_OK(msg_wrapper.Init(&buffer));
-        msg_wrappers.push_back(msg_wrapper);
+    // Another peer may have had the same ops read back from the log already.
+    int64_t num_wire_form_hits = 0;
+    ReplicateRefPtr wire_form;
+    while (next_index <= up_to &&
+           (wire_form = LookupWireForm(next_index)) != nullptr) {
+      remaining_space -= ApproxMsgSize(wire_form);
+      if (remaining_space < 0 && !messages->empty()) {
+        break;
       }
+      messages->push_back(std::move(wire_form));
+      next_index++;
+      num_wire_form_hits++;
+    }
+    if (num_wire_form_hits > 0) {
+      metrics_.log_cache_wire_form_hits->IncrementBy(num_wire_form_hits);
+      read_past_cache = true;
+      continue;
+    }
 
-      VLOG_WITH_PREFIX_UNLOCKED(2)
-          << "Successfully read " << msg_wrappers.size() << " ops "
-          << "from disk (" << next_index << ".."
-          << (next_index + msg_wrappers.size() - 1) << ")";
-
-      if (!context.route_via_proxy) {
-        // Compute crc checksums for the payload that was read from the log
-        // Note that this is done _only_ for non-proxy requests because payload
-        // is discarded for proxy requests
-        for (const auto& msg_wrapper : msg_wrappers) {
-          // We use the compressed msg if available. The compressed msg might
-          // not be avaiblable if compression is disabled or the msg doesn't
-          // support compression e.g. non write op
-          ReplicateMsg* msg = msg_wrapper.GetCompressedMsg()
-              ? msg_wrapper.GetCompressedMsg()->get()
-              : msg_wrapper.GetUncompressedMsg()->get();
-          const std::string& payload = msg->write_payload().payload();
-          uint32_t payload_crc32 = crc::Crc32c(payload.c_str(), payload.size());
-          msg->mutable_write_payload()->set_crc32(payload_crc32);
-        }
+    // Or the ops may have been demoted rather than dropped on eviction.
+    int64_t num_second_tier_hits = 0;
+    ReplicateRefPtr demoted;
+    while (next_index <= up_to &&
+           (demoted = LookupSecondTier(next_index)) != nullptr) {
+      remaining_space -= ApproxMsgSize(demoted);
+      if (remaining_space < 0 && !messages->empty()) {
+        break;
       }
+      messages->push_back(std::move(demoted));
+      next_index++;
+      num_second_tier_hits++;
+    }
+    if (num_second_tier_hits > 0) {
+      metrics_.log_cache_second_tier_hits->IncrementBy(num_second_tier_hits);
+      continue;
+    }
 
-      l.lock();
+    vector<ReplicateMsg*> raw_replicate_ptrs;
+    RETURN_NOT_OK_PREPEND(
+        log_->ReadReplicatesInRange(
+            next_index, up_to, remaining_space, context, &raw_replicate_ptrs),
+        Substitute("Failed to read ops $0..$1", next_index, up_to));
 
-      for (const auto& msg_wrapper : msg_wrappers) {
-        const auto& msg = msg_wrapper.GetCompressedMsg()
-            ? msg_wrapper.GetCompressedMsg()
-            : msg_wrapper.GetUncompressedMsg();
-        CHECK_EQ(next_index, msg->get()->id().index());
+    vector<ReplicateRefPtr> wire_forms;
+    RETURN_NOT_OK(
+        WrapOpsReadFromLog(raw_replicate_ptrs, context, &wire_forms));
 
-        remaining_space -= ApproxMsgSize(msg);
-        if (remaining_space > 0 || messages->empty()) {
-          messages->push_back(msg);
-          next_index++;
-        }
-      }
-    } else {
-      // Pull contiguous messages from the cache until the size limit is
-      // achieved.
-      for (; iter != cache_.end(); ++iter) {
-        const ReplicateRefPtr& msg = iter->second.msg;
-        int64_t index = msg->get()->id().index();
-        if (index != next_index) {
-          continue;
-        }
+    VLOG_WITH_PREFIX_UNLOCKED(2)
+        << "Successfully read " << wire_forms.size() << " ops "
+        << "from disk (" << next_index << ".."
+        << (next_index + wire_forms.size() - 1) << ")";
 
-        // The full size of the msg is actually returned by SpaceUsedLong() but
-        // that's very expensive, the payload size should be very close to the
-        // full msg size
-        remaining_space -=
-            static_cast<int64_t>(msg->get()->write_payload().payload().size());
-        if (remaining_space < 0 && !messages->empty()) {
-          break;
-        }
+    int64_t expected_index = next_index;
+    for (const auto& msg : wire_forms) {
+      CHECK_EQ(expected_index++, msg->get()->id().index());
 
+      remaining_space -= ApproxMsgSize(msg);
+      if (remaining_space > 0 || messages->empty()) {
         messages->push_back(msg);
         next_index++;
       }
     }
+    metrics_.log_cache_wire_form_misses->IncrementBy(wire_forms.size());
+    // The payloads read for a proxied peer are neither compressed nor
+    // checksummed, so they are not fit for anyone else.
+    if (!context.route_via_proxy) {
+      InsertWireForms(wire_forms);
+    }
+    read_past_cache = true;
+  }
+  if (read_past_cache && !context.route_via_proxy) {
+    MaybePrefetchAfter(next_index - 1);
+  }
+  return Status::OK();
+}
+
+Status LogCache::ReadOpsSequentially(
+    int64_t after_op_index,
+    int max_size_bytes,
+    const ReadContext& context,
+    std::shared_ptr<log::SequentialReplicateReader>* reader,
+    std::vector<ReplicateRefPtr>* messages,
+    OpId* preceding_op) {
+  DCHECK_GE(after_op_index, 0);
+  RETURN_NOT_OK(LookupOpId(after_op_index, preceding_op));
+
+  int64_t up_to;
+  {
+    shared_lock<rw_spinlock> l(ring_lock_.get_lock());
+    up_to = next_sequential_op_index_ - 1;
+  }
+  if (after_op_index >= up_to) {
+    return Status::OK();
+  }
+
+  if (!*reader) {
+    // Logs which aren't made of segments of their own, like the shared
+    // log, have no reader.
+    if (!log_->reader()) {
+      return Status::NotSupported("the log has no segments to read");
+    }
+    *reader = std::make_shared<log::SequentialReplicateReader>(log_->reader());
+  }
+  vector<ReplicateMsg*> raw_replicate_ptrs;
+  RETURN_NOT_OK_PREPEND(
+      (*reader)->ReadReplicates(
+          after_op_index + 1, up_to, max_size_bytes, &raw_replicate_ptrs),
+      Substitute("Failed to read ops $0..$1", after_op_index + 1, up_to));
+
+  vector<ReplicateRefPtr> wire_forms;
+  RETURN_NOT_OK(WrapOpsReadFromLog(raw_replicate_ptrs, context, &wire_forms));
+  VLOG_WITH_PREFIX_UNLOCKED(2)
+      << "Successfully read " << wire_forms.size() << " ops "
+      << "sequentially from disk, following " << after_op_index;
+  metrics_.log_cache_wire_form_misses->IncrementBy(wire_forms.size());
+  messages->insert(messages->end(), wire_forms.begin(), wire_forms.end());
+  return Status::OK();
+}
+
+Status LogCache::WrapOpsReadFromLog(
+    const vector<ReplicateMsg*>& replicates,
+    const ReadContext& context,
+    vector<ReplicateRefPtr>* wire_forms) {
+  // Compress messages read from the log if:
+  // (1) the feature is enabled through
+  // enable_compression_on_cache_miss_ flag, or --log_cache_compress_at_rest
+  // (2) the request is not for a proxy host (the payload is discarded for
+  // a proxy request and it is wasteful to compress it here)
+  const bool should_compress =
+      (enable_compression_on_cache_miss_ || FLAGS_log_cache_compress_at_rest) &&
+      !context.route_via_proxy;
+
+  vector<ReplicateMsgWrapper> msg_wrappers;
+  faststring buffer;
+
+  for (const auto& replicate : replicates) {
+    ReplicateMsgWrapper msg_wrapper(
+        make_scoped_refptr_replicate(replicate), should_compress);
+    RETURN_NOT_OK(msg_wrapper.Init(&buffer));
+    msg_wrappers.push_back(msg_wrapper);
+  }
+
+  if (!context.route_via_proxy) {
+    // Compute crc checksums for the payload that was read from the log
+    // Note that this is done _only_ for non-proxy requests because payload
+    // is discarded for proxy requests
+    for (const auto& msg_wrapper : msg_wrappers) {
+      // We use the compressed msg if available. The compressed msg might
+      // not be avaiblable if compression is disabled or the msg doesn't
+      // support compression e.g. non write op
+      ReplicateMsg* msg = msg_wrapper.GetCompressedMsg()
+          ? msg_wrapper.GetCompressedMsg()->get()
+          : msg_wrapper.GetUncompressedMsg()->get();
+      if (ReplicateMsgWrapper::IsPayloadStripped(*msg)) {
+        continue;
+      }
+      const std::string& payload = msg->write_payload().payload();
+      uint32_t payload_crc32 = crc::Crc32c(payload.c_str(), payload.size());
+      msg->mutable_write_payload()->set_crc32(payload_crc32);
+    }
+  }
+
+  wire_forms->reserve(wire_forms->size() + msg_wrappers.size());
+  for (const auto& msg_wrapper : msg_wrappers) {
+    wire_forms->push_back(
+        msg_wrapper.GetCompressedMsg() ? msg_wrapper.GetCompressedMsg()
+                                       : msg_wrapper.GetUncompressedMsg());
+  }
+  return Status::OK();
+}
+
+Status LogCache::ResetTo(const OpId& preceding_op) {
+  std::lock_guard<Mutex> l(lock_);
+  if (next_sequential_op_index_ != min_pinned_op_index_) {
+    return Status::IllegalState(Substitute(
+        "cannot reset the log cache while ops through $0 are being appended",
+        next_sequential_op_index_ - 1));
+  }
+  CHECK_GE(preceding_op.index() + 1, next_sequential_op_index_);
+  TruncateOpsAfterUnlocked(
+      cache_.empty() ? next_sequential_op_index_ - 1
+                     : cache_.first_index() - 1);
+  {
+    std::lock_guard<percpu_rwlock> ring_l(ring_lock_);
+    next_sequential_op_index_ = preceding_op.index() + 1;
   }
+  min_pinned_op_index_ = next_sequential_op_index_;
   return Status::OK();
 }
 
@@ -700,9 +1566,11 @@ Status LogCache::Clear() {
   }
   EvictSomeUnlocked(
       next_sequential_op_index_, MathLimits<int64_t>::kMax, /*force =*/true);
-  // Placeholder opid 0 will not be evicted from the cache
-  return cache_.size() == 1 ? Status::OK()
-                            : Status::RuntimeError("Log cache clearing failed");
+  TruncateWireFormsAfter(-1);
+  TruncateSecondTierAfterUnlocked(-1);
+  // Placeholder opid 0 is not part of 'cache_', it's never evicted
+  return cache_.empty() ? Status::OK()
+                        : Status::RuntimeError("Log cache clearing failed");
 }
 
 void LogCache::EvictThroughOp(int64_t index) {
@@ -711,7 +1579,7 @@ void LogCache::EvictThroughOp(int64_t index) {
   EvictSomeUnlocked(index, MathLimits<int64_t>::kMax);
 }
 
-void LogCache::EvictSomeUnlocked(
+int64_t LogCache::EvictSomeUnlocked(
     int64_t stop_after_index,
     int64_t bytes_to_evict,
     bool force) {
@@ -721,21 +1589,25 @@ void LogCache::EvictSomeUnlocked(
       << ": before state: " << ToStringUnlocked();
 
   int64_t bytes_evicted = 0;
-  for (auto iter = cache_.begin(); iter != cache_.end();) {
-    const CacheEntry& entry = (*iter).second;
-    const ReplicateRefPtr& msg = entry.msg;
-    VLOG_WITH_PREFIX_UNLOCKED(2)
-        << "considering for eviction: " << msg->get()->id();
-    int64_t msg_index = msg->get()->id().index();
-    if (msg_index == 0) {
-      // Always keep our special '0' op.
-      ++iter;
+  // The evicted messages are only released once readers are let back in.
+  vector<CacheEntry> evicted;
+  std::unique_lock<percpu_rwlock> ring_l(ring_lock_);
+  int64_t end = cache_.empty()
+      ? 0
+      : std::min(
+            {cache_.end_index(), stop_after_index + 1, min_pinned_op_index_});
+  for (int64_t msg_index = cache_.empty() ? 0 : cache_.first_index();
+       msg_index < end;
+       msg_index++) {
+    // Readers only copy refs while holding 'ring_lock_', so HasOneRef()
+    // can't change under us.
+    const CacheEntry* entry = cache_.Find(msg_index);
+    if (!entry) {
       continue;
     }
-
-    if (msg_index > stop_after_index || msg_index >= min_pinned_op_index_) {
-      break;
-    }
+    const ReplicateRefPtr& msg = entry->msg;
+    VLOG_WITH_PREFIX_UNLOCKED(2)
+        << "considering for eviction: " << msg->get()->id();
 
     // If a msg has more than one ref that means it is in flight to some peer.
     // We don't remove it so that memory accounting is accurate. If force is
@@ -744,27 +1616,122 @@ void LogCache::EvictSomeUnlocked(
       VLOG_WITH_PREFIX_UNLOCKED(2)
           << "Evicting cache: cannot remove " << msg->get()->id()
           << " because it is in-use by a peer.";
-      ++iter;
       continue;
     }
 
     VLOG_WITH_PREFIX_UNLOCKED(2)
         << "Evicting cache. Removing: " << msg->get()->id();
-    AccountForMessageRemovalUnlocked(entry);
-    bytes_evicted += entry.mem_usage;
-    cache_.erase(iter++);
+    bytes_evicted += entry->mem_usage;
+    evicted.emplace_back(cache_.Erase(msg_index));
 
     if (bytes_evicted >= bytes_to_evict) {
       break;
     }
   }
+  ring_l.unlock();
+  // A forced eviction clears the cache, so there is no point in demoting.
+  if (!force) {
+    DemoteToSecondTierUnlocked(evicted);
+  }
+  for (const CacheEntry& entry : evicted) {
+    AccountForMessageRemovalUnlocked(entry);
+  }
   VLOG_WITH_PREFIX_UNLOCKED(1)
       << "Evicting log cache: after state: " << ToStringUnlocked();
+  return bytes_evicted;
+}
+
+bool LogCache::IsUnderMemoryPressure(double* usage_pct) {
+  const int64_t limit = parent_tracker_->limit();
+  const int32_t threshold_pct = FLAGS_log_cache_throttle_threshold_percentage;
+  if (threshold_pct == 0 || limit <= 0) {
+    return false;
+  }
+  const int64_t threshold = limit / 100 * threshold_pct;
+  int64_t used = parent_tracker_->consumption();
+  if (used > threshold && FLAGS_log_cache_global_eviction) {
+    // Ops replicated to all peers are only kept in the hope of serving reads
+    // from the cache, which isn't worth rejecting writes for.
+    std::lock_guard<Mutex> l(lock_);
+    LogCacheManager::Get()->EvictForGlobalLimit(
+        this, used - threshold, /*needed_by_peers_too=*/false);
+    used = parent_tracker_->consumption();
+  }
+  *usage_pct = 100.0 * used / limit;
+  return used > threshold;
+}
+
+void LogCache::EvictToFitUnlocked(int64_t need_to_free, int64_t mem_required) {
+  lock_.AssertAcquired();
+  if (!FLAGS_log_cache_global_eviction) {
+    EvictSomeUnlocked(min_pinned_op_index_, need_to_free);
+    return;
+  }
+  // Only this tablet's ops count towards its own limit.
+  int64_t evicted = 0;
+  int64_t own_need =
+      mem_required - (tracker_->limit() - tracker_->consumption());
+  if (own_need > 0) {
+    evicted = EvictSomeUnlocked(min_pinned_op_index_, own_need);
+  }
+  if (need_to_free > evicted) {
+    LogCacheManager::Get()->EvictForGlobalLimit(this, need_to_free - evicted);
+  }
+}
+
+int64_t LogCache::EvictForGlobalLimit(
+    int64_t bytes,
+    bool needed_by_peers,
+    bool lock_held) {
+  std::unique_lock<Mutex> l(lock_, std::defer_lock);
+  if (!lock_held && !l.try_lock()) {
+    return 0;
+  }
+  int64_t stop_after_index = needed_by_peers
+      ? MathLimits<int64_t>::kMax
+      : slowest_peer_next_index_.load(std::memory_order_relaxed) - 1;
+  int64_t evicted = EvictSomeUnlocked(stop_after_index, bytes);
+  if (!lock_held) {
+    metrics_.log_cache_evicted_for_other_tablets->IncrementBy(evicted);
+  }
+  return evicted;
+}
+
+void LogCache::SetPeerNextIndexes(int64_t slowest, int64_t fastest) {
+  DCHECK_LE(slowest, fastest);
+  slowest_peer_next_index_.store(slowest, std::memory_order_relaxed);
+  fastest_peer_next_index_.store(fastest, std::memory_order_relaxed);
+}
+
+int64_t LogCache::GetBytesPinnedByPeers() const {
+  int64_t slowest = slowest_peer_next_index_.load(std::memory_order_relaxed);
+  int64_t fastest = fastest_peer_next_index_.load(std::memory_order_relaxed);
+  int64_t pinned = 0;
+  shared_lock<rw_spinlock> l(ring_lock_.get_lock());
+  if (cache_.empty()) {
+    return 0;
+  }
+  int64_t end = std::min(fastest, cache_.end_index());
+  for (int64_t i = std::max(slowest, cache_.first_index()); i < end; i++) {
+    const CacheEntry* entry = cache_.Find(i);
+    if (entry) {
+      pinned += entry->mem_usage;
+    }
+  }
+  return pinned;
 }
 
 void LogCache::AccountForMessageRemovalUnlocked(
     const LogCache::CacheEntry& entry) {
   tracker_->Release(entry.mem_usage);
+  // 'entry' holds a reference, so any other one means that the msg outlives
+  // its removal. Its memory is then accounted as in flight until it's freed.
+  // Other references may be dropped concurrently, but no new ones taken, so
+  // at worst the msg is freed as soon as 'entry' is.
+  if (!entry.msg->HasOneRef()) {
+    in_flight_tracker_->Consume(entry.mem_usage);
+    entry.msg->ReleaseOnDestruction(in_flight_tracker_, entry.mem_usage);
+  }
   metrics_.log_cache_size->DecrementBy(entry.mem_usage);
   metrics_.log_cache_msg_size->DecrementBy(entry.msg_size);
   metrics_.log_cache_num_ops->Decrement();
@@ -796,10 +1763,6 @@ std::string LogCache::ToStringUnlocked() const {
       "Pinned index: $0, $1", min_pinned_op_index_, StatsStringUnlocked());
 }
 
-std::string LogCache::LogPrefixUnlocked() const {
-  return Substitute("T $0 P $1: ", tablet_id_, local_uuid_);
-}
-
 void LogCache::DumpToLog() const {
   vector<string> strings;
   DumpToStrings(&strings);
@@ -813,8 +1776,8 @@ void LogCache::DumpToStrings(vector<string>* lines) const {
   int counter = 0;
   lines->push_back(ToStringUnlocked());
   lines->push_back("Messages:");
-  for (const auto& entry : cache_) {
-    const ReplicateMsg* msg = entry.second.msg->get();
+  ForEachEntryUnlocked([&](const CacheEntry& entry) {
+    const ReplicateMsg* msg = entry.msg->get();
     lines->push_back(Substitute(
         "Message[$0] $1.$2 : REPLICATE. Type: $3, Size: $4",
         counter++,
@@ -822,7 +1785,7 @@ void LogCache::DumpToStrings(vector<string>* lines) const {
         msg->id().index(),
         OperationType_Name(msg->op_type()),
         msg->ByteSize()));
-  }
+  });
 }
 
 void LogCache::DumpToHtml(std::ostream& out) const {
@@ -835,8 +1798,8 @@ void LogCache::DumpToHtml(std::ostream& out) const {
       << endl;
 
   int counter = 0;
-  for (const auto& entry : cache_) {
-    const ReplicateMsg* msg = entry.second.msg->get();
+  ForEachEntryUnlocked([&](const CacheEntry& entry) {
+    const ReplicateMsg* msg = entry.msg->get();
     out << Substitute(
                "<tr><th>$0</th><th>$1.$2</th><td>REPLICATE $3</td>"
                "<td>$4</td><td>$5</td></tr>",
@@ -847,7 +1810,7 @@ void LogCache::DumpToHtml(std::ostream& out) const {
                msg->ByteSize(),
                SecureShortDebugString(msg->id()))
         << endl;
-  }
+  });
   out << "</table>";
 }
 
@@ -860,6 +1823,24 @@ LogCache::Metrics::Metrics(const scoped_refptr<MetricEntity>& metric_entity)
       metric_entity->FindOrCreateCounter(&METRIC_log_cache_payload_size);
   log_cache_compressed_payload_size = metric_entity->FindOrCreateCounter(
       &METRIC_log_cache_compressed_payload_size);
+  log_cache_wire_form_hits =
+      metric_entity->FindOrCreateCounter(&METRIC_log_cache_wire_form_hits);
+  log_cache_wire_form_misses =
+      metric_entity->FindOrCreateCounter(&METRIC_log_cache_wire_form_misses);
+  log_cache_wire_form_size =
+      INSTANTIATE_METRIC(METRIC_log_cache_wire_form_size);
+  log_cache_prefetched_ops =
+      metric_entity->FindOrCreateCounter(&METRIC_log_cache_prefetched_ops);
+  log_cache_second_tier_demotions = metric_entity->FindOrCreateCounter(
+      &METRIC_log_cache_second_tier_demotions);
+  log_cache_second_tier_hits =
+      metric_entity->FindOrCreateCounter(&METRIC_log_cache_second_tier_hits);
+  log_cache_uncompressed_hot_set_hits = metric_entity->FindOrCreateCounter(
+      &METRIC_log_cache_uncompressed_hot_set_hits);
+  log_cache_uncompressed_hot_set_misses = metric_entity->FindOrCreateCounter(
+      &METRIC_log_cache_uncompressed_hot_set_misses);
+  log_cache_evicted_for_other_tablets = metric_entity->FindOrCreateCounter(
+      &METRIC_log_cache_evicted_for_other_tablets);
 }
 #undef INSTANTIATE_METRIC
 
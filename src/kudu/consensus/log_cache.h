@@ -17,7 +17,10 @@
 #ifndef KUDU_CONSENSUS_LOG_CACHE_H
 #define KUDU_CONSENSUS_LOG_CACHE_H
 
+#include <atomic>
 #include <cstdint>
+#include <deque>
+#include <functional>
 #include <iosfwd>
 #include <map>
 #include <memory>
@@ -32,18 +35,23 @@
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/util/condition_variable.h"
 #include "kudu/util/faststring.h"
+#include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/mutex.h"
 #include "kudu/util/status.h"
 #include "kudu/util/status_callback.h"
 
 namespace kudu {
 
+class Cache;
 class CompressionCodec;
 class MemTracker;
+class ThreadPoolToken;
 
 namespace log {
 class Log;
+class SequentialReplicateReader;
 } // namespace log
 
 namespace consensus {
@@ -68,6 +76,14 @@ class LogCache {
       std::string tablet_id);
   ~LogCache();
 
+  // Makes reads which miss the cache prefetch the ops following them into
+  // the wire form cache on 'token', so that the next read for the same peer
+  // is served from memory. Must be called before the cache is used.
+  void SetPrefetchToken(std::unique_ptr<ThreadPoolToken> token);
+
+  // Waits for the in-flight prefetch, if any, and stops further ones.
+  void ShutdownPrefetch();
+
   // Initialize the cache.
   //
   // 'preceding_op' is the current latest op. The next AppendOperation() call
@@ -98,6 +114,22 @@ class LogCache {
       std::vector<ReplicateRefPtr>* messages,
       OpId* preceding_op);
 
+  // Like ReadOps(), but for a peer too far behind for the ops it needs to be
+  // in the cache: reads them sequentially from the closed log segments through
+  // '*reader', which is created if NULL and continues where the previous call
+  // for the same peer stopped. The wire forms of the ops are not kept, as
+  // nobody else is likely to need them.
+  //
+  // May return no ops at all, e.g. once the peer has reached the log segment
+  // being written to, in which case the caller should go back to ReadOps().
+  Status ReadOpsSequentially(
+      int64_t after_op_index,
+      int max_size_bytes,
+      const ReadContext& context,
+      std::shared_ptr<log::SequentialReplicateReader>* reader,
+      std::vector<ReplicateRefPtr>* messages,
+      OpId* preceding_op);
+
   // Similar to ReadOps(...), but blocks for 'max_duration_ms' if
   // 'after_op_index' is not available in the local log.
   //
@@ -117,6 +149,29 @@ class LogCache {
       std::vector<ReplicateRefPtr>* messages,
       OpId* preceding_op);
 
+  // Fired by AsyncWaitForOp(): OK once the op is in the local log, TimedOut
+  // if the deadline passed first, or Aborted if the cache is destroyed.
+  typedef std::function<void(const Status&)> OpAvailableCallback;
+
+  // Non-blocking counterpart of the wait in BlockingReadOps(): fires
+  // 'callback' once the op following 'after_op_index' has been appended to
+  // the local log, so that a following ReadOps(after_op_index, ...) returns
+  // at least one op. Fires inline if the op is already available.
+  //
+  // The deadline is not enforced by a timer of the cache's own: waiters past
+  // their deadline are only fired by ExpireOpWaiters(), which the caller is
+  // expected to schedule. 'callback' is run without any lock held, on the
+  // appending thread or the one calling ExpireOpWaiters(), so it should not
+  // block.
+  void AsyncWaitForOp(
+      int64_t after_op_index,
+      MonoTime deadline,
+      OpAvailableCallback callback);
+
+  // Fires, with TimedOut, the AsyncWaitForOp() callbacks whose deadline is at
+  // or before 'now'.
+  void ExpireOpWaiters(MonoTime now);
+
   // Append the operations into the log and the cache.
   // When the messages have completed writing into the on-disk log, fires
   // 'callback'.
@@ -149,15 +204,38 @@ class LogCache {
   // still be en route to the log.
   bool HasOpBeenWritten(int64_t index) const;
 
+  // Return true if the operation with the given index is in the cache, i.e.
+  // whether a peer which needs it is within the cache window.
+  bool HasOpBeenCached(int64_t index) const;
+
   // Clear the cache
   Status Clear();
 
+  // Drops all the cached ops, and makes the next AppendOperation() call
+  // follow 'preceding_op', which must not be before the latest op. Used once
+  // a snapshot through 'preceding_op' was installed, see SnapshotProvider.
+  //
+  // Returns IllegalState if ops are still being appended to the log.
+  Status ResetTo(const OpId& preceding_op);
+
   // Evict any operations with op index <= 'index'.
   void EvictThroughOp(int64_t index);
 
+  // Tells the cache the lowest and highest next index of the peers it serves,
+  // so that ops below 'slowest' are the first to go when another tablet needs
+  // memory, and ops in ['slowest', 'fastest') count as pinned by slow peers.
+  void SetPeerNextIndexes(int64_t slowest, int64_t fastest);
+
   // Return the number of bytes of memory currently in use by the cache.
   int64_t BytesUsed() const;
 
+  // Returns whether the memory of all log caches, including that of their ops
+  // still in flight to peers, is above --log_cache_throttle_threshold_percentage
+  // of --global_log_cache_size_limit_mb, even after evicting the ops that no
+  // peer needs anymore, in any tablet. Sets '*usage_pct' to the percentage of
+  // the limit in use.
+  bool IsUnderMemoryPressure(double* usage_pct);
+
   int64_t num_cached_ops() const {
     return metrics_.log_cache_num_ops->value();
   }
@@ -187,12 +265,36 @@ class LogCache {
   // Enable (or disable) compression of messages read from log
   Status EnableCompressionOnCacheMiss(bool enable);
 
+  // Keeps the uncompressed WRITE_OP_EXT msgs appended from now on, up to
+  // 'max_bytes' of payload, dropping the oldest first. Zero stops sampling
+  // and drops the samples.
+  void SetPayloadSampling(int64_t max_bytes);
+
+  // Moves the msgs sampled since the previous call into 'samples', oldest
+  // first.
+  void TakePayloadSamples(std::vector<ReplicateRefPtr>* samples);
+
+  // Sets '*uncompressed' to 'msg' with its payload uncompressed, or to 'msg'
+  // itself if it isn't compressed, for the local users of the ops which need
+  // the raw payloads. The ops last uncompressed are kept, up to
+  // --log_cache_uncompressed_hot_set_mb, so that the users reading the same
+  // ops uncompress them once.
+  Status GetUncompressed(
+      const ReplicateRefPtr& msg,
+      ReplicateRefPtr* uncompressed);
+
  private:
   FRIEND_TEST(LogCacheTest, TestAppendAndGetMessages);
+  FRIEND_TEST(LogCacheTest, TestWireFormCache);
+  FRIEND_TEST(LogCacheTest, TestPrefetch);
   FRIEND_TEST(LogCacheTest, TestGlobalMemoryLimit);
+  FRIEND_TEST(LogCacheTest, TestInFlightMemory);
   FRIEND_TEST(LogCacheTest, TestReplaceMessages);
   FRIEND_TEST(LogCacheTest, TestTruncation);
+  FRIEND_TEST(LogCacheTest, TestSecondTier);
+  FRIEND_TEST(LogCacheTest, TestGlobalEviction);
   friend class LogCacheTest;
+  friend class LogCacheManager;
 
   // Uncompresses the payload of 'msg' based on its compression_codec and
   // populates a new ReplicateMsg with uncompressed payload in
@@ -206,25 +308,131 @@ class LogCache {
   // An entry in the cache.
   struct CacheEntry {
     ReplicateRefPtr msg;
-    // The cached value of msg->SpaceUsedLong(). This method is expensive
-    // to compute, so we compute it only once upon insertion.
+    // The memory held by msg, see RefCountedReplicate::MemoryFootprint(),
+    // computed once upon insertion.
     int64_t mem_usage;
     // The uncompressed size of the msg. If msg is not compressed, then it is
     // same as mem_usage
     int64_t msg_size;
   };
 
+  // A ring buffer of cache entries, addressed by op index. Cached indexes
+  // are dense, but the ring may have holes: eviction skips over ops which are
+  // still referenced by peers, leaving the ops it evicted behind them.
+  //
+  // Lookups are O(1) and iteration in index order walks contiguous memory.
+  // The ring grows (by powers of two) to span the cached indexes, and never
+  // shrinks.
+  //
+  // Not thread-safe.
+  class MessageCache {
+   public:
+    MessageCache();
+
+    // Returns the entry for 'index', or nullptr if it is not cached.
+    CacheEntry* Find(int64_t index);
+    const CacheEntry* Find(int64_t index) const;
+
+    // Returns the lowest cached index that is >= 'index', or -1 if there is
+    // none.
+    int64_t NextCachedIndex(int64_t index) const;
+
+    // Inserts 'entry' at 'index', which must not be cached already.
+    void Insert(int64_t index, CacheEntry entry);
+
+    // Removes and returns the entry at 'index', which must be cached.
+    CacheEntry Erase(int64_t index);
+
+    void Clear();
+
+    // The span [first_index(), end_index()) contains all cached indexes.
+    // Only meaningful if !empty().
+    int64_t first_index() const {
+      return first_index_;
+    }
+    int64_t end_index() const {
+      return end_index_;
+    }
+
+    size_t size() const {
+      return size_;
+    }
+    bool empty() const {
+      return size_ == 0;
+    }
+
+   private:
+    CacheEntry& Slot(int64_t index) {
+      return slots_[index & (slots_.size() - 1)];
+    }
+    const CacheEntry& Slot(int64_t index) const {
+      return slots_[index & (slots_.size() - 1)];
+    }
+
+    // Reallocates 'slots_' so that it can hold 'span' consecutive indexes.
+    void Grow(int64_t span);
+
+    std::vector<CacheEntry> slots_;
+    int64_t first_index_;
+    int64_t end_index_;
+    size_t size_;
+  };
+
+  // Returns the entry for 'index', including the special '0' op, or nullptr
+  // if it is not cached.
+  const CacheEntry* FindUnlocked(int64_t index) const;
+
+  // Calls 'f' with the special '0' op, then with every cached entry, in index
+  // order.
+  template <class F>
+  void ForEachEntryUnlocked(const F& f) const {
+    f(zero_op_);
+    if (cache_.empty()) {
+      return;
+    }
+    for (int64_t i = cache_.first_index(); i < cache_.end_index(); i++) {
+      const CacheEntry* entry = cache_.Find(i);
+      if (entry) {
+        f(*entry);
+      }
+    }
+  }
+
   // Try to evict the oldest operations from the queue, stopping either when
   // 'bytes_to_evict' bytes have been evicted, or the op with index
   // 'stop_after_index' has been evicted, whichever comes first.
   // Set 'force' to true when msgs that have refs in peers (i.e. in flight)
   // should also be evicted. This will not cause any correctness issues because
-  // msgs are ref counted but it can throw off memory accounting.
-  void EvictSomeUnlocked(
+  // msgs are ref counted, and their memory is moved to 'in_flight_tracker_'
+  // until the last ref is dropped.
+  // Returns the number of bytes evicted.
+  int64_t EvictSomeUnlocked(
       int64_t stop_after_index,
       int64_t bytes_to_evict,
       bool force = false);
 
+  // Frees 'need_to_free' bytes to append 'mem_required' more: from this cache
+  // as far as its own limit requires, and otherwise through the
+  // LogCacheManager if --log_cache_global_eviction is set.
+  void EvictToFitUnlocked(int64_t need_to_free, int64_t mem_required);
+
+  // Called by the LogCacheManager to evict up to 'bytes', only of the ops no
+  // peer needs unless 'needed_by_peers'. Unless 'lock_held', gives up if
+  // lock_ is busy. Returns the number of bytes evicted.
+  int64_t EvictForGlobalLimit(
+      int64_t bytes,
+      bool needed_by_peers,
+      bool lock_held);
+
+  int64_t last_access_micros() const {
+    return last_access_micros_.load(std::memory_order_relaxed);
+  }
+
+  // Bytes of the ops in ['slowest_peer_next_index_',
+  // 'fastest_peer_next_index_'), for the log_cache_bytes_pinned_by_peers
+  // gauge.
+  int64_t GetBytesPinnedByPeers() const;
+
   // Update metrics and MemTracker to account for the removal of the
   // given message.
   void AccountForMessageRemovalUnlocked(const CacheEntry& entry);
@@ -236,7 +444,69 @@ class LogCache {
 
   std::string ToStringUnlocked() const;
 
-  std::string LogPrefixUnlocked() const;
+  const std::string& LogPrefixUnlocked() const {
+    return log_prefix_;
+  }
+
+  // Wraps 'replicates', which were read from the log, into the form they are
+  // sent to peers in for 'context': compressed and checksummed unless the
+  // peer is sent its ops through a proxy. Takes ownership of 'replicates'.
+  Status WrapOpsReadFromLog(
+      const std::vector<ReplicateMsg*>& replicates,
+      const ReadContext& context,
+      std::vector<ReplicateRefPtr>* wire_forms);
+
+  // Returns the cached wire form of the op at 'index', or null.
+  ReplicateRefPtr LookupWireForm(int64_t index);
+
+  // Caches the wire forms of 'msgs', evicting the lowest indexes first if
+  // that exceeds --log_cache_wire_form_size_limit_mb. If 'truncations' is
+  // not negative, 'msgs' are dropped unless 'wire_form_truncations_' still
+  // has that value, i.e. the log was not truncated since they were read.
+  void InsertWireForms(
+      const std::vector<ReplicateRefPtr>& msgs,
+      int64_t truncations = -1);
+
+  // Drops the cached wire forms of ops with index > 'index'.
+  void TruncateWireFormsAfter(int64_t index);
+
+  // The key of the op at 'index' in 'second_tier_'.
+  std::string SecondTierKey(int64_t index) const;
+
+  // Copies the serialized form of the ops in 'evicted' to 'second_tier_'.
+  // Requires that lock_ is held.
+  void DemoteToSecondTierUnlocked(const std::vector<CacheEntry>& evicted);
+
+  // Returns the op at 'index' parsed back from 'second_tier_', or null.
+  ReplicateRefPtr LookupSecondTier(int64_t index);
+
+  // Drops the demoted ops with index > 'index' from 'second_tier_'.
+  // Requires that lock_ is held.
+  void TruncateSecondTierAfterUnlocked(int64_t index);
+
+  // Called after a read which had to go past the cache, up to (and
+  // including) 'index': unless enough of the ops after 'index' are already
+  // in the wire form cache, or a prefetch is already in flight, submits a
+  // read of the next --log_cache_prefetch_size_mb of them to
+  // 'prefetch_token_'.
+  void MaybePrefetchAfter(int64_t index);
+
+  // Reads the ops in ['from', 'up_to'], up to 'max_size_bytes' of them, from
+  // the log into the wire form cache. Runs on 'prefetch_token_'.
+  void PrefetchOps(
+      int64_t from,
+      int64_t up_to,
+      int64_t max_size_bytes,
+      int64_t truncations);
+
+  struct OpWaiter {
+    MonoTime deadline;
+    OpAvailableCallback callback;
+  };
+
+  // Removes the waiters that can be fired now that 'next_sequential_op_index_'
+  // has advanced and moves their callbacks to 'ready'.
+  void TakeReadyOpWaitersUnlocked(std::vector<OpAvailableCallback>* ready);
 
   void LogCallback(
       int64_t last_idx_in_batch,
@@ -252,18 +522,62 @@ class LogCache {
   // The id of the tablet.
   const std::string tablet_id_;
 
-  mutable Mutex lock_;
+  // Formatted once, see LogPrefixUnlocked().
+  const std::string log_prefix_;
+
+  mutable Mutex lock_{"LogCache::lock_"};
   ConditionVariable next_index_cond_;
 
-  // An ordered map that serves as the buffer for the cached messages.
-  // Maps from log index -> ReplicateMsg
-  typedef std::map<uint64_t, CacheEntry> MessageCache;
+  // Protects 'cache_' and 'next_sequential_op_index_', which are only
+  // modified with both 'lock_' and this lock (exclusively) held, so they can
+  // be read with either one held. Readers take it in shared mode only, so
+  // that ReadOps() and LookupOpId() never contend on 'lock_' with each other
+  // or with the bulk of AppendOperations(). Acquired after 'lock_'.
+  mutable percpu_rwlock ring_lock_;
+
+  // The buffer for the cached messages, by log index.
   MessageCache cache_;
 
+  // A fake message at index 0, since this simplifies a lot of our code paths
+  // elsewhere. Kept out of 'cache_' so that the ring only spans recent ops.
+  CacheEntry zero_op_;
+
   // The next log index to append. Each append operation must either
   // start with this log index, or go backward (but never skip forward).
+  // See 'ring_lock_'.
   int64_t next_sequential_op_index_;
 
+  // The wire form of ops which were evicted but had to be read back from
+  // the log for a peer: compressed as configured, and with their payload CRC
+  // set. Peers catching up on the same range, directly or through a proxy,
+  // then share a single read and compression. By index, protected by
+  // 'wire_forms_lock_'.
+  std::map<int64_t, ReplicateRefPtr> wire_forms_;
+  int64_t wire_forms_size_ = 0;
+  // The number of TruncateWireFormsAfter() calls, so that a prefetch racing
+  // with one does not cache ops which were just overwritten.
+  int64_t wire_form_truncations_ = 0;
+  mutable simple_spinlock wire_forms_lock_;
+
+  // Process-wide cache, of --log_cache_second_tier_type, where evicted ops
+  // are demoted so that lagging peers can still be caught up without reading
+  // the log. Null if --log_cache_second_tier_size_mb is 0. Keys are prefixed
+  // with 'second_tier_id_', unique to this cache, and demoted ops span
+  // ['second_tier_first_', 'second_tier_end_'), protected by 'lock_'.
+  Cache* second_tier_;
+  const int64_t second_tier_id_;
+  int64_t second_tier_first_ = 0;
+  int64_t second_tier_end_ = 0;
+
+  // Reads ops ahead of lagging peers, see SetPrefetchToken(). Only one
+  // prefetch is in flight at a time, while 'prefetch_in_flight_' is set.
+  std::unique_ptr<ThreadPoolToken> prefetch_token_;
+  std::atomic<bool> prefetch_in_flight_;
+
+  // AsyncWaitForOp() callbacks, by the index of the op they wait for.
+  // Protected by lock_.
+  std::multimap<int64_t, OpWaiter> op_waiters_;
+
   // Any operation with an index >= min_pinned_op_ may not be
   // evicted from the cache. This is used to prevent ops from being evicted
   // until they successfully have been appended to the underlying log.
@@ -283,6 +597,11 @@ class LogCache {
   // A MemTracker for this instance.
   std::shared_ptr<MemTracker> tracker_;
 
+  // Tracks the memory of the msgs removed from the cache but still referenced
+  // elsewhere, e.g. by requests in flight to peers. Shared with these msgs,
+  // which release their bytes when freed.
+  std::shared_ptr<MemTracker> in_flight_tracker_;
+
   struct Metrics {
     explicit Metrics(const scoped_refptr<MetricEntity>& metric_entity);
 
@@ -302,9 +621,40 @@ class LogCache {
     // Payload size of the compressed msg payload that is sent over the wire
     // If compression is disabled, it is the same as log_cache_payload_size
     scoped_refptr<Counter> log_cache_compressed_payload_size;
+
+    // Ops missing from the cache that were served from 'wire_forms_', or had
+    // to be read from the log.
+    scoped_refptr<Counter> log_cache_wire_form_hits;
+    scoped_refptr<Counter> log_cache_wire_form_misses;
+
+    // Payload bytes held in 'wire_forms_'.
+    scoped_refptr<AtomicGauge<int64_t>> log_cache_wire_form_size;
+
+    // Ops read into 'wire_forms_' ahead of the peers needing them.
+    scoped_refptr<Counter> log_cache_prefetched_ops;
+
+    // Ops evicted to 'second_tier_', and later read back from it.
+    scoped_refptr<Counter> log_cache_second_tier_demotions;
+    scoped_refptr<Counter> log_cache_second_tier_hits;
+
+    // Compressed ops served uncompressed by GetUncompressed(), from
+    // 'uncompressed_' or not.
+    scoped_refptr<Counter> log_cache_uncompressed_hot_set_hits;
+    scoped_refptr<Counter> log_cache_uncompressed_hot_set_misses;
+
+    // Bytes evicted from the cache for other tablets to stay under the
+    // global limit.
+    scoped_refptr<Counter> log_cache_evicted_for_other_tablets;
   };
   Metrics metrics_;
 
+  // See SetPeerNextIndexes().
+  std::atomic<int64_t> slowest_peer_next_index_;
+  std::atomic<int64_t> fastest_peer_next_index_;
+
+  // When the cache was last appended to or read from, in monotonic micros.
+  std::atomic<int64_t> last_access_micros_;
+
   // Temporary buffer to use for compression. This is used during append
   // operation to compress and/or uncompress payloads. Note that the same buffer
   // gets reused multiple times - this assumens that AppendOperation is
@@ -314,6 +664,26 @@ class LogCache {
 
   std::atomic<bool> enable_compression_on_cache_miss_;
 
+  // Adds the uncompressed WRITE_OP_EXT msgs of 'msg_wrappers' to
+  // 'payload_samples_'.
+  void SamplePayloads(const std::vector<ReplicateMsgWrapper>& msg_wrappers);
+
+  // Protects the payload samples below.
+  simple_spinlock payload_samples_lock_;
+  int64_t max_payload_sample_bytes_ = 0;
+  int64_t payload_sample_bytes_ = 0;
+  std::deque<ReplicateRefPtr> payload_samples_;
+
+  // The ops last uncompressed by GetUncompressed(), by index, and the bytes
+  // of their payloads.
+  simple_spinlock uncompressed_lock_;
+  int64_t uncompressed_bytes_ = 0;
+  std::map<int64_t, ReplicateRefPtr> uncompressed_;
+
+  // Last, so that function gauges are detached before anything they use is
+  // destroyed.
+  FunctionGaugeDetacher metric_detacher_;
+
   DISALLOW_COPY_AND_ASSIGN(LogCache);
 };
 
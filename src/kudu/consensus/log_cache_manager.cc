@@ -0,0 +1,82 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/log_cache_manager.h"
+
+#include <algorithm>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "kudu/consensus/log_cache.h"
+
+using std::pair;
+using std::vector;
+
+namespace kudu {
+namespace consensus {
+
+LogCacheManager* LogCacheManager::Get() {
+  static LogCacheManager* const manager = new LogCacheManager();
+  return manager;
+}
+
+void LogCacheManager::Register(LogCache* cache) {
+  std::lock_guard<Mutex> l(lock_);
+  CHECK(caches_.insert(cache).second);
+}
+
+void LogCacheManager::Unregister(LogCache* cache) {
+  std::lock_guard<Mutex> l(lock_);
+  caches_.erase(cache);
+}
+
+int64_t LogCacheManager::EvictForGlobalLimit(
+    LogCache* requestor,
+    int64_t bytes,
+    bool needed_by_peers_too) {
+  std::lock_guard<Mutex> l(lock_);
+  // Least recently used first. The requestor is being appended to, so it
+  // normally comes last.
+  vector<pair<int64_t, LogCache*>> by_access;
+  by_access.reserve(caches_.size());
+  for (LogCache* cache : caches_) {
+    by_access.emplace_back(cache->last_access_micros(), cache);
+  }
+  std::sort(by_access.begin(), by_access.end());
+
+  int64_t evicted = 0;
+  for (bool needed_by_peers : {false, true}) {
+    if (needed_by_peers && !needed_by_peers_too) {
+      break;
+    }
+    for (const auto& e : by_access) {
+      if (evicted >= bytes) {
+        return evicted;
+      }
+      LogCache* cache = e.second;
+      evicted += cache->EvictForGlobalLimit(
+          bytes - evicted, needed_by_peers, cache == requestor);
+    }
+  }
+  return evicted;
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,69 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <set>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/util/mutex.h"
+
+namespace kudu {
+namespace consensus {
+
+class LogCache;
+
+// Server-wide registry of the log caches, through which a cache that needs
+// memory under --global_log_cache_size_limit_mb evicts ops of any tablet
+// rather than only its own. Ops are evicted in order of need: first those no
+// peer needs anymore, then those only lagging peers still need, and within
+// each, from the least recently used caches first. So a busy tablet evicts
+// the ops an idle tablet keeps for a dead peer before evicting its own.
+class LogCacheManager {
+ public:
+  LogCacheManager() = default;
+
+  // The manager of the log caches of the process.
+  static LogCacheManager* Get();
+
+  void Register(LogCache* cache);
+
+  // Once this returns, 'cache' is no longer evicted from.
+  void Unregister(LogCache* cache);
+
+  // Evicts up to 'bytes' from the registered caches on behalf of 'requestor',
+  // whose lock is held by the caller. Other caches whose lock is busy are
+  // skipped rather than waited for. Ops still needed by peers are only
+  // evicted if 'needed_by_peers_too' is set. Returns the number of bytes
+  // evicted.
+  int64_t EvictForGlobalLimit(
+      LogCache* requestor,
+      int64_t bytes,
+      bool needed_by_peers_too = true);
+
+ private:
+  // Protects 'caches_', and is held while evicting so that Unregister() waits
+  // for an eviction to be done with the cache.
+  Mutex lock_;
+  std::set<LogCache*> caches_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogCacheManager);
+};
+
+} // namespace consensus
+} // namespace kudu
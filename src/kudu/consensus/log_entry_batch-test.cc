@@ -0,0 +1,130 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/log.h"
+#include "kudu/consensus/log_reader.h"
+#include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/fs/fs_manager.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/stl_util.h"
+#include "kudu/util/async_util.h"
+#include "kudu/util/faststring.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_string(log_compression_codec);
+
+using kudu::consensus::MakeOpId;
+using kudu::consensus::ReadContext;
+using kudu::consensus::ReplicateMsg;
+using kudu::consensus::ReplicateRefPtr;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace kudu {
+namespace log {
+
+// Tests the REPLICATE batches which LogEntryBatch frames by hand around the
+// ops' shared serialized buffers, through the WAL they are written to.
+class LogEntryBatchTest : public KuduTest {
+ public:
+  void SetUp() override {
+    KuduTest::SetUp();
+    fs_manager_.reset(new FsManager(env_, GetTestPath("fs_root")));
+    ASSERT_OK(fs_manager_->CreateInitialFileSystemLayout());
+    ASSERT_OK(fs_manager_->Open());
+  }
+
+ protected:
+  // Appends ops of various sizes in a single batch to a new WAL compressed
+  // with 'codec', or not if empty, then reads them back.
+  void AppendAndReadBack(const string& codec, const string& tablet_id) {
+    FLAGS_log_compression_codec = codec;
+    scoped_refptr<Log> log;
+    ASSERT_OK(
+        Log::Open(LogOptions(), fs_manager_.get(), tablet_id, nullptr, &log));
+
+    // Sizes around the varint boundaries of the framing's length prefixes.
+    const vector<int> payload_sizes = {0, 1, 100, 127, 128, 300, 16383,
+                                       16384, 70000};
+    vector<ReplicateRefPtr> replicates;
+    for (size_t i = 0; i < payload_sizes.size(); i++) {
+      ReplicateMsg* msg = new ReplicateMsg();
+      *msg->mutable_id() = MakeOpId(1, i + 1);
+      msg->set_timestamp(i);
+      msg->set_op_type(consensus::NO_OP);
+      msg->mutable_noop_request()->set_payload_for_tests(
+          string(payload_sizes[i], 'a' + i));
+      replicates.push_back(consensus::make_scoped_refptr_replicate(msg));
+    }
+    // The batch shares this buffer rather than serializing the op again.
+    shared_ptr<const faststring> first_serialized =
+        replicates[0]->Serialized();
+
+    Synchronizer s;
+    ASSERT_OK(log->AsyncAppendReplicates(replicates, s.AsStatusCallback()));
+    ASSERT_OK(s.Wait());
+
+    vector<ReplicateMsg*> read;
+    ElementDeleter d(&read);
+    ASSERT_OK(log->ReadReplicatesInRange(
+        1, replicates.size(), LogReader::kNoSizeLimit, ReadContext(), &read));
+    ASSERT_EQ(replicates.size(), read.size());
+    for (size_t i = 0; i < replicates.size(); i++) {
+      SCOPED_TRACE(i);
+      ASSERT_EQ(
+          replicates[i]->get()->SerializeAsString(),
+          read[i]->SerializeAsString());
+    }
+
+    // Once the batch is done with, the op no longer holds on to its buffer,
+    // and serializes itself again if asked to.
+    ASSERT_EVENTUALLY([&]() {
+      ASSERT_NE(first_serialized, replicates[0]->Serialized());
+    });
+    ASSERT_EQ(
+        first_serialized->ToString(),
+        replicates[0]->Serialized()->ToString());
+    ASSERT_OK(log->Close());
+  }
+
+  unique_ptr<FsManager> fs_manager_;
+};
+
+TEST_F(LogEntryBatchTest, TestUncompressedReplicates) {
+  NO_FATALS(AppendAndReadBack("", "uncompressed"));
+}
+
+TEST_F(LogEntryBatchTest, TestCompressedReplicates) {
+  NO_FATALS(AppendAndReadBack("LZ4", "compressed"));
+}
+
+} // namespace log
+} // namespace kudu
@@ -0,0 +1,96 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/log_gc_op.h"
+
+#include <string>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "kudu/consensus/log.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/status.h"
+
+METRIC_DEFINE_histogram(
+    server,
+    log_gc_duration,
+    "Log GC Duration",
+    kudu::MetricUnit::kMilliseconds,
+    "Time spent garbage collecting the logs",
+    60000LU,
+    1);
+
+METRIC_DEFINE_gauge_uint32(
+    server,
+    log_gc_running,
+    "Log GCs Running",
+    kudu::MetricUnit::kMaintenanceOperations,
+    "Number of log GC operations currently running");
+
+using strings::Substitute;
+
+namespace kudu {
+namespace log {
+
+LogGCOp::LogGCOp(
+    scoped_refptr<Log> log,
+    std::function<RetentionIndexes()> retention_indexes,
+    const scoped_refptr<MetricEntity>& metric_entity)
+    : MaintenanceOp(
+          Substitute("LogGCOp($0)", log->tablet_id()),
+          MaintenanceOp::LOW_IO_USAGE),
+      log_(std::move(log)),
+      retention_indexes_(std::move(retention_indexes)),
+      duration_(METRIC_log_gc_duration.Instantiate(metric_entity)),
+      running_(METRIC_log_gc_running.Instantiate(metric_entity, 0)),
+      sem_(1) {}
+
+void LogGCOp::UpdateStats(MaintenanceOpStats* stats) {
+  const int64_t gcable_bytes =
+      log_->GetGCableDataSize(retention_indexes_());
+  stats->set_runnable(gcable_bytes > 0 && sem_.GetValue() == 1);
+  stats->set_logs_retained_bytes(gcable_bytes);
+}
+
+bool LogGCOp::Prepare() {
+  return sem_.try_lock();
+}
+
+void LogGCOp::Perform() {
+  int32_t num_gced = 0;
+  Status s = log_->GC(retention_indexes_(), &num_gced);
+  if (s.ok()) {
+    VLOG(1) << "T " << log_->tablet_id() << ": log GC deleted " << num_gced
+            << " segments";
+  } else {
+    LOG(WARNING) << "T " << log_->tablet_id()
+                 << ": log GC failed: " << s.ToString();
+  }
+  sem_.unlock();
+}
+
+scoped_refptr<Histogram> LogGCOp::DurationHistogram() const {
+  return duration_;
+}
+
+scoped_refptr<AtomicGauge<uint32_t>> LogGCOp::RunningGauge() const {
+  return running_;
+}
+
+} // namespace log
+} // namespace kudu
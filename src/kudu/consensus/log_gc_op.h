@@ -0,0 +1,73 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/maintenance_manager.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/semaphore.h"
+
+namespace kudu {
+
+template <typename T>
+class AtomicGauge;
+class Histogram;
+class MetricEntity;
+
+namespace log {
+
+class Log;
+struct RetentionIndexes;
+
+// Maintenance op deleting the segments of a log which are no longer needed,
+// see Log::GC(). 'retention_indexes' returns what must be kept, usually
+// RaftConsensus::GetRetentionIndexes(). Deleting segments is cheap, so the
+// op is LOW_IO_USAGE and runs ahead of the others whenever it frees space.
+class LogGCOp : public MaintenanceOp {
+ public:
+  LogGCOp(
+      scoped_refptr<Log> log,
+      std::function<RetentionIndexes()> retention_indexes,
+      const scoped_refptr<MetricEntity>& metric_entity);
+
+  void UpdateStats(MaintenanceOpStats* stats) override;
+
+  bool Prepare() override;
+
+  void Perform() override;
+
+  scoped_refptr<Histogram> DurationHistogram() const override;
+
+  scoped_refptr<AtomicGauge<uint32_t>> RunningGauge() const override;
+
+ private:
+  const scoped_refptr<Log> log_;
+  const std::function<RetentionIndexes()> retention_indexes_;
+  scoped_refptr<Histogram> duration_;
+  scoped_refptr<AtomicGauge<uint32_t>> running_;
+  Semaphore sem_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogGCOp);
+};
+
+} // namespace log
+} // namespace kudu
@@ -117,5 +117,37 @@ TEST_F(LogIndexTest, TestMultiSegmentWithGC) {
   VerifyNotFound(2500000);
 }
 
+// Test that a durable index is trusted after a restart up to its last flush,
+// and is rebuilt if an entry it covers changed after the flush.
+TEST_F(LogIndexTest, TestDurableReopen) {
+  const int kEntriesPerChunk = 100;
+  index_->SetNumEntriesPerChunkForTest(kEntriesPerChunk);
+  int64_t sealed_seqno;
+  ASSERT_OK(index_->OpenDurable(env_, nullptr, &sealed_seqno));
+  ASSERT_EQ(-1, sealed_seqno);
+
+  for (int64_t i = 1; i <= 250; i++) {
+    ASSERT_OK(AddEntry(MakeOpId(1, i), i <= 150 ? 1 : 2, i * 10));
+  }
+  ASSERT_OK(index_->Flush(2));
+  // Not covered by the flush.
+  ASSERT_OK(AddEntry(MakeOpId(1, 251), 3, 2510));
+
+  index_ = new LogIndex(test_dir_);
+  index_->SetNumEntriesPerChunkForTest(kEntriesPerChunk);
+  ASSERT_OK(index_->OpenDurable(env_, nullptr, &sealed_seqno));
+  ASSERT_EQ(2, sealed_seqno);
+  VerifyEntry(MakeOpId(1, 1), 1, 10);
+  VerifyEntry(MakeOpId(1, 150), 1, 1500);
+  VerifyEntry(MakeOpId(1, 250), 2, 2500);
+
+  // Replace an op covered by the flush, as after a leader change.
+  ASSERT_OK(AddEntry(MakeOpId(2, 120), 3, 30));
+  index_ = new LogIndex(test_dir_);
+  index_->SetNumEntriesPerChunkForTest(kEntriesPerChunk);
+  ASSERT_OK(index_->OpenDurable(env_, nullptr, &sealed_seqno));
+  ASSERT_EQ(-1, sealed_seqno);
+}
+
 } // namespace log
 } // namespace kudu
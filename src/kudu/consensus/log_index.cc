@@ -25,6 +25,14 @@
 //
 // When the log is GCed, we remove any index chunks which are no longer needed,
 // and unmap them.
+//
+// In durable mode, Flush() writes a LogIndexMetadataPB next to the chunks with
+// the high-water index and the crc32c of the entries of every chunk up to it.
+// A chunk which wasn't written to since the previous flush keeps its checksum,
+// so a flush usually only syncs and checksums the latest chunk. An entry up to
+// the high-water index which is overwritten later, e.g. when ops are replaced
+// after a leader change, makes its chunk fail the verification on restart, in
+// which case the whole index is rebuilt.
 
 #include "kudu/consensus/log_index.h"
 
@@ -32,26 +40,41 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cerrno>
 #include <cinttypes>
 #include <cstdint>
 #include <cstring>
+#include <memory>
 #include <mutex>
 #include <ostream>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include "kudu/consensus/log.pb.h"
 #include "kudu/consensus/opid_util.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/stringprintf.h"
 #include "kudu/gutil/strings/split.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/crc.h"
 #include "kudu/util/env.h"
 #include "kudu/util/errno.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/pb_util.h"
+
+DEFINE_bool(
+    log_index_durable,
+    false,
+    "Whether to sync the log index each time a log segment is sealed, with "
+    "checksums of its chunks, so that on restart only the segments written "
+    "after the last sealed one need to be indexed again.");
+TAG_FLAG(log_index_durable, experimental);
 
 using std::string;
 using std::vector;
@@ -114,11 +137,27 @@ class LogIndex::IndexChunk : public RefCountedThreadSafe<LogIndex::IndexChunk> {
   // Is this chunk file memory mapped?
   bool IsMmapped() const;
 
+  // Sync the chunk file to disk. On Linux, this also writes back the pages
+  // dirtied through the mapping, even if the chunk is unmapped concurrently.
+  Status Sync();
+
+  // Compute the crc32c of the first 'num_entries' entries of the chunk file
+  Status Checksum(int64_t num_entries, uint32_t* crc);
+
+  // Was an entry set since the last call to MarkClean()?
+  bool IsDirty() const {
+    return dirty_.load(std::memory_order_acquire);
+  }
+  void MarkClean() {
+    dirty_.store(false, std::memory_order_release);
+  }
+
  private:
   const string path_; // path of the underlying chunk file
   int fd_; // file descriptor
   uint8_t* mapping_; // mmapped memory location of the chunk
   int64_t size_; // configured size for the chunk file
+  std::atomic<bool> dirty_; // whether an entry was set since the last flush
 };
 
 namespace {
@@ -132,7 +171,11 @@ Status CheckError(int rc, const char* operation) {
 } // anonymous namespace
 
 LogIndex::IndexChunk::IndexChunk(std::string path, int64_t size)
-    : path_(std::move(path)), fd_(-1), mapping_(nullptr), size_(size) {}
+    : path_(std::move(path)),
+      fd_(-1),
+      mapping_(nullptr),
+      size_(size),
+      dirty_(true) {}
 
 LogIndex::IndexChunk::~IndexChunk() {
   if (mapping_ != nullptr) {
@@ -202,18 +245,53 @@ void LogIndex::IndexChunk::SetEntry(
       mapping_ + sizeof(PhysicalEntry) * entry_index,
       &entry,
       sizeof(PhysicalEntry));
+  dirty_.store(true, std::memory_order_release);
 }
 
 bool LogIndex::IndexChunk::IsMmapped() const {
   return (mapping_ != nullptr);
 }
 
+Status LogIndex::IndexChunk::Sync() {
+  DCHECK_GE(fd_, 0) << "Must Open() first";
+  int err;
+  RETRY_ON_EINTR(err, fdatasync(fd_));
+  return CheckError(err, "fdatasync");
+}
+
+Status LogIndex::IndexChunk::Checksum(int64_t num_entries, uint32_t* crc) {
+  DCHECK_GE(fd_, 0) << "Must Open() first";
+  const int64_t kBufSize = 1024 * 1024;
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[kBufSize]);
+  int64_t remaining = num_entries * sizeof(PhysicalEntry);
+  CHECK_LE(remaining, size_);
+  int64_t offset = 0;
+  uint32_t result = 0;
+  while (remaining > 0) {
+    ssize_t n;
+    RETRY_ON_EINTR(
+        n, pread(fd_, buf.get(), std::min(remaining, kBufSize), offset));
+    RETURN_NOT_OK(CheckError(n, "pread"));
+    if (PREDICT_FALSE(n == 0)) {
+      return Status::Corruption("Index chunk is shorter than expected", path_);
+    }
+    result = crc::Crc32c(buf.get(), n, result);
+    offset += n;
+    remaining -= n;
+  }
+  *crc = result;
+  return Status::OK();
+}
+
 ////////////////////////////////////////////////////////////
 // LogIndex
 ////////////////////////////////////////////////////////////
 
 LogIndex::LogIndex(std::string base_dir)
-    : base_dir_(std::move(base_dir)), mmap_for_reads_(nullptr) {}
+    : base_dir_(std::move(base_dir)),
+      mmap_for_reads_(nullptr),
+      env_(nullptr),
+      last_added_index_(0) {}
 
 LogIndex::~LogIndex() {}
 
@@ -221,6 +299,10 @@ string LogIndex::GetChunkPath(int64_t chunk_idx) {
   return StringPrintf("%s/index.%09" PRId64, base_dir_.c_str(), chunk_idx);
 }
 
+string LogIndex::GetMetadataPath() const {
+  return Substitute("$0/index-meta", base_dir_);
+}
+
 Status LogIndex::OpenAllChunksOnStartup(
     Env* env,
     const scoped_refptr<MetricEntity>& metric_entity) {
@@ -229,8 +311,10 @@ Status LogIndex::OpenAllChunksOnStartup(
   RETURN_NOT_OK(env->GetChildren(base_dir_, &children));
 
   // Initialize metric counter
-  mmap_for_reads_ =
-      metric_entity->FindOrCreateCounter(&METRIC_log_index_chunk_mmap_for_read);
+  if (metric_entity) {
+    mmap_for_reads_ = metric_entity->FindOrCreateCounter(
+        &METRIC_log_index_chunk_mmap_for_read);
+  }
 
   for (const auto& fname : children) {
     if (fname.find("index.") != 0) {
@@ -275,6 +359,113 @@ Status LogIndex::OpenAllChunksOnStartup(
   return Status::OK();
 }
 
+Status LogIndex::OpenDurable(
+    Env* env,
+    const scoped_refptr<MetricEntity>& metric_entity,
+    int64_t* sealed_segment_seqno) {
+  *sealed_segment_seqno = -1;
+  RETURN_NOT_OK(OpenAllChunksOnStartup(env, metric_entity));
+  env_ = env;
+
+  LogIndexMetadataPB metadata;
+  Status s =
+      pb_util::ReadPBContainerFromPath(env, GetMetadataPath(), &metadata);
+  if (s.IsNotFound()) {
+    return Status::OK();
+  }
+  if (!s.ok()) {
+    LOG(WARNING) << "Unable to read log index metadata, the index will be "
+                 << "rebuilt: " << s.ToString();
+    return Status::OK();
+  }
+
+  std::map<int64_t, LogIndexMetadataPB::ChunkPB> flushed_chunks;
+  for (const LogIndexMetadataPB::ChunkPB& chunk_pb : metadata.chunks()) {
+    scoped_refptr<IndexChunk> chunk;
+    {
+      std::lock_guard<simple_spinlock> l(open_chunks_lock_);
+      if (!FindCopy(open_chunks_, chunk_pb.chunk_idx(), &chunk)) {
+        // The chunk was GCed after the flush.
+        continue;
+      }
+    }
+    uint32_t crc;
+    RETURN_NOT_OK(chunk->Checksum(chunk_pb.num_entries(), &crc));
+    if (crc != chunk_pb.crc32c()) {
+      LOG(WARNING) << "Checksum mismatch in log index chunk "
+                   << GetChunkPath(chunk_pb.chunk_idx())
+                   << ", the index will be rebuilt";
+      return Status::OK();
+    }
+    chunk->MarkClean();
+    flushed_chunks.emplace(chunk_pb.chunk_idx(), chunk_pb);
+  }
+
+  VLOG(1) << "Log index in " << base_dir_ << " is complete up to index "
+          << metadata.high_water_index() << " in segment "
+          << metadata.sealed_segment_sequence_number();
+  last_added_index_ = metadata.high_water_index();
+  flushed_chunks_.swap(flushed_chunks);
+  *sealed_segment_seqno = metadata.sealed_segment_sequence_number();
+  return Status::OK();
+}
+
+Status LogIndex::Flush(int64_t sealed_segment_seqno) {
+  DCHECK(env_) << "Must OpenDurable() first";
+  const int64_t high_water_index = last_added_index_;
+  const int64_t last_chunk_idx = high_water_index / kEntriesPerIndexChunk;
+
+  vector<std::pair<int64_t, scoped_refptr<IndexChunk>>> chunks;
+  {
+    std::lock_guard<simple_spinlock> l(open_chunks_lock_);
+    for (const auto& e : open_chunks_) {
+      if (e.first > last_chunk_idx) {
+        break;
+      }
+      chunks.emplace_back(e.first, e.second);
+    }
+  }
+
+  LogIndexMetadataPB metadata;
+  metadata.set_high_water_index(high_water_index);
+  metadata.set_sealed_segment_sequence_number(sealed_segment_seqno);
+  std::map<int64_t, LogIndexMetadataPB::ChunkPB> flushed_chunks;
+  for (const auto& e : chunks) {
+    const int64_t num_entries = e.first == last_chunk_idx
+        ? high_water_index % kEntriesPerIndexChunk + 1
+        : kEntriesPerIndexChunk;
+    const LogIndexMetadataPB::ChunkPB* prev =
+        FindOrNull(flushed_chunks_, e.first);
+    LogIndexMetadataPB::ChunkPB chunk_pb;
+    if (prev && !e.second->IsDirty() && prev->num_entries() == num_entries) {
+      chunk_pb = *prev;
+    } else {
+      RETURN_NOT_OK_PREPEND(e.second->Sync(), "Unable to sync index chunk");
+      uint32_t crc;
+      RETURN_NOT_OK(e.second->Checksum(num_entries, &crc));
+      chunk_pb.set_chunk_idx(e.first);
+      chunk_pb.set_num_entries(num_entries);
+      chunk_pb.set_crc32c(crc);
+    }
+    *metadata.add_chunks() = chunk_pb;
+    flushed_chunks.emplace(e.first, chunk_pb);
+  }
+
+  RETURN_NOT_OK_PREPEND(
+      pb_util::WritePBContainerToPath(
+          env_,
+          GetMetadataPath(),
+          metadata,
+          pb_util::OVERWRITE,
+          pb_util::SYNC),
+      "Unable to write log index metadata");
+  for (const auto& e : chunks) {
+    e.second->MarkClean();
+  }
+  flushed_chunks_.swap(flushed_chunks);
+  return Status::OK();
+}
+
 void LogIndex::SetNumMmapChunks(int64_t num_chunks) {
   if (num_chunks <= 0)
     return;
@@ -408,8 +599,33 @@ Status LogIndex::GetChunkForIndex(
 
 Status LogIndex::AddEntry(const LogIndexEntry& entry) {
   scoped_refptr<IndexChunk> chunk;
-  RETURN_NOT_OK(GetChunkForIndex(
-      entry.op_id.index(), true /* create if not found */, &chunk));
+  RETURN_NOT_OK(SetEntry(entry, true /* create if not found */, &chunk));
+  last_added_index_ = entry.op_id.index();
+
+  return Status::OK();
+}
+
+Status LogIndex::UpdateEntries(const vector<LogIndexEntry>& entries) {
+  vector<scoped_refptr<IndexChunk>> updated_chunks;
+  for (const LogIndexEntry& entry : entries) {
+    scoped_refptr<IndexChunk> chunk;
+    RETURN_NOT_OK(SetEntry(entry, false /* do not create */, &chunk));
+    if (updated_chunks.empty() || updated_chunks.back() != chunk) {
+      updated_chunks.push_back(std::move(chunk));
+    }
+  }
+  for (const scoped_refptr<IndexChunk>& chunk : updated_chunks) {
+    RETURN_NOT_OK_PREPEND(chunk->Sync(), "Unable to sync index chunk");
+  }
+  return Status::OK();
+}
+
+Status LogIndex::SetEntry(
+    const LogIndexEntry& entry,
+    bool create,
+    scoped_refptr<IndexChunk>* chunk_out) {
+  scoped_refptr<IndexChunk> chunk;
+  RETURN_NOT_OK(GetChunkForIndex(entry.op_id.index(), create, &chunk));
 
   int index_in_chunk = entry.op_id.index() % kEntriesPerIndexChunk;
   DCHECK_LT(index_in_chunk, kEntriesPerIndexChunk);
@@ -427,9 +643,9 @@ Status LogIndex::AddEntry(const LogIndexEntry& entry) {
       RETURN_NOT_OK(MmapChunk(&chunk));
     }
     chunk->SetEntry(index_in_chunk, phys);
-    VLOG(3) << "Added log index entry " << entry.ToString();
+    VLOG(3) << "Set log index entry " << entry.ToString();
   }
-
+  *chunk_out = std::move(chunk);
   return Status::OK();
 }
 
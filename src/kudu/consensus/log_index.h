@@ -17,10 +17,13 @@
 #ifndef KUDU_CONSENSUS_LOG_INDEX_H
 #define KUDU_CONSENSUS_LOG_INDEX_H
 
+#include <atomic>
 #include <cstdint>
 #include <map>
 #include <string>
+#include <vector>
 
+#include "kudu/consensus/log.pb.h"
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/ref_counted.h"
@@ -54,6 +57,11 @@ struct LogIndexEntry {
 // out, and never sync it to disk. Its only purpose is to allow random-reading
 // earlier entries from the log to serve to Raft followers.
 //
+// With --log_index_durable, the log flushes the index each time it seals a
+// segment: the chunks are synced and their checksums are written to a
+// metadata file, so that on restart the index can be trusted up to the last
+// sealed segment, and only the segments after it need to be indexed again.
+//
 // This class is thread-safe, but doesn't provide a memory barrier between
 // writers and readers. In other words, if a reader is expected to see an index
 // entry written by a writer, there should be some other synchronization between
@@ -67,6 +75,11 @@ class LogIndex : public RefCountedThreadSafe<LogIndex> {
   // Record an index entry in the index.
   Status AddEntry(const LogIndexEntry& entry);
 
+  // Overwrites existing entries of the index with 'entries', sorted by index,
+  // e.g. because their segment was rewritten, then syncs the chunks holding
+  // them. Unlike AddEntry(), this may be called concurrently with the writer.
+  Status UpdateEntries(const std::vector<LogIndexEntry>& entries);
+
   // Retrieve an existing entry from the index.
   // Returns NotFound() if the given log entry was never written.
   Status GetEntry(int64_t index, LogIndexEntry* entry);
@@ -92,6 +105,22 @@ class LogIndex : public RefCountedThreadSafe<LogIndex> {
       Env* env,
       const scoped_refptr<MetricEntity>& metric_entity);
 
+  // Opens the chunks left by a previous run like OpenAllChunksOnStartup(),
+  // and verifies them against the metadata written by the last Flush(). Sets
+  // 'sealed_segment_seqno' to the sequence number of the last segment whose
+  // entries the index holds, or to -1 if the index has to be rebuilt from all
+  // the segments.
+  Status OpenDurable(
+      Env* env,
+      const scoped_refptr<MetricEntity>& metric_entity,
+      int64_t* sealed_segment_seqno);
+
+  // Syncs the chunks and records that the index holds every entry added so
+  // far, all of which are in segments up to 'sealed_segment_seqno'.
+  // Requires OpenDurable() and must not be called concurrently with
+  // AddEntry().
+  Status Flush(int64_t sealed_segment_seqno);
+
  private:
   friend class RefCountedThreadSafe<LogIndex>;
 
@@ -128,6 +157,13 @@ class LogIndex : public RefCountedThreadSafe<LogIndex> {
   // not implemented yet). Check 'kChunksToMmap' for more details
   Status MmapChunk(scoped_refptr<IndexChunk>* chunk);
 
+  // Sets 'entry' in the chunk holding it, which is returned in 'chunk'.
+  // Creates the chunk if it doesn't exist and 'create' is true.
+  Status SetEntry(
+      const LogIndexEntry& entry,
+      bool create,
+      scoped_refptr<IndexChunk>* chunk);
+
   // Return the index chunk which contains the given log index.
   // If 'create' is true, creates it on-demand. If 'create' is false, and
   // the index chunk does not exist, returns NotFound.
@@ -140,6 +176,9 @@ class LogIndex : public RefCountedThreadSafe<LogIndex> {
   // Return the path of the given index chunk.
   std::string GetChunkPath(int64_t chunk_idx);
 
+  // Return the path of the metadata written by Flush().
+  std::string GetMetadataPath() const;
+
   // The base directory where index files are located.
   const std::string base_dir_;
 
@@ -187,6 +226,18 @@ class LogIndex : public RefCountedThreadSafe<LogIndex> {
   // dynamically for a read operation
   scoped_refptr<Counter> mmap_for_reads_;
 
+  // Set by OpenDurable().
+  Env* env_;
+
+  // The index of the last entry added, or of the last entry flushed by the
+  // previous run. Only accessed by the writer.
+  int64_t last_added_index_;
+
+  // The chunks written by the last Flush(), by chunk index. Their checksums
+  // are reused for the chunks which haven't changed since. Only accessed by
+  // the writer.
+  std::map<int64_t, LogIndexMetadataPB::ChunkPB> flushed_chunks_;
+
   DISALLOW_COPY_AND_ASSIGN(LogIndex);
 };
 
@@ -62,6 +62,27 @@ METRIC_DEFINE_histogram(
     60000000LU,
     2);
 
+METRIC_DEFINE_histogram(
+    server,
+    log_post_roll_append_latency,
+    "Log Post-Roll Append Latency",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds spent on the first append into each newly rolled over log "
+    "segment file. Higher than the usual append latency if the filesystem "
+    "converts unwritten extents on the write path",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_histogram(
+    server,
+    log_segment_prezero_latency,
+    "Log Segment Pre-zeroing Latency",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds spent in the background filling the next log segment file "
+    "with zeros",
+    60000000LU,
+    2);
+
 METRIC_DEFINE_histogram(
     server,
     log_entry_batches_per_group,
@@ -71,6 +92,78 @@ METRIC_DEFINE_histogram(
     1024,
     2);
 
+METRIC_DEFINE_histogram(
+    server,
+    log_group_write_stage_latency,
+    "Log Group Write Stage Latency",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds spent writing all the entry batches of a group commit "
+    "group to the log segment file",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_histogram(
+    server,
+    log_group_sync_stage_latency,
+    "Log Group Sync Stage Latency",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds spent synchronizing the log segment file for a group "
+    "commit group, before its callbacks are run",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_counter(
+    server,
+    log_pipelined_groups_overlapped,
+    "Log Pipelined Groups Overlapped",
+    kudu::MetricUnit::kRequests,
+    "Number of group commit groups that were written to the log while the "
+    "previous group was still being synchronized");
+
+METRIC_DEFINE_histogram(
+    server,
+    log_group_commit_delay,
+    "Log Group Commit Delay",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds the log append thread waited for more entry batches to "
+    "join a group commit group before appending it",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_histogram(
+    server,
+    log_append_wakeup_latency,
+    "Log Append Wakeup Latency",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds from when the first entry batch of a group commit group "
+    "was queued to when the log append thread picked it up",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_counter(
+    server,
+    log_append_thread_spin_time,
+    "Log Append Thread Spin Time",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds the log append thread spent busy-polling for entry "
+    "batches, see --log_append_thread_spin_us");
+
+METRIC_DEFINE_counter(
+    server,
+    log_append_thread_spin_hits,
+    "Log Append Thread Spin Hits",
+    kudu::MetricUnit::kRequests,
+    "Number of times entry batches arrived while the log append thread was "
+    "busy-polling for them, saving a wakeup");
+
+METRIC_DEFINE_counter(
+    server,
+    log_bytes_saved_by_recompression,
+    "Log Bytes Saved By Recompression",
+    kudu::MetricUnit::kBytes,
+    "Disk space saved by recompressing sealed log segments with "
+    "--log_recompression_codec");
+
 namespace kudu {
 namespace log {
 
@@ -81,7 +174,17 @@ LogMetrics::LogMetrics(const scoped_refptr<MetricEntity>& metric_entity)
       MINIT(append_latency),
       MINIT(group_commit_latency),
       MINIT(roll_latency),
-      MINIT(entry_batches_per_group) {}
+      MINIT(post_roll_append_latency),
+      MINIT(segment_prezero_latency),
+      MINIT(entry_batches_per_group),
+      MINIT(group_write_stage_latency),
+      MINIT(group_sync_stage_latency),
+      MINIT(pipelined_groups_overlapped),
+      MINIT(group_commit_delay),
+      MINIT(append_wakeup_latency),
+      MINIT(append_thread_spin_time),
+      MINIT(append_thread_spin_hits),
+      MINIT(bytes_saved_by_recompression) {}
 #undef MINIT
 
 } // namespace log
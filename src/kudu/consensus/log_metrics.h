@@ -34,7 +34,36 @@ struct LogMetrics {
   scoped_refptr<Histogram> append_latency;
   scoped_refptr<Histogram> group_commit_latency;
   scoped_refptr<Histogram> roll_latency;
+
+  // Latency of the first append into each newly rolled segment, and the time
+  // spent zeroing segments in the background (--log_prezero_segments).
+  scoped_refptr<Histogram> post_roll_append_latency;
+  scoped_refptr<Histogram> segment_prezero_latency;
   scoped_refptr<Histogram> entry_batches_per_group;
+
+  // Per-stage group commit stats. The write stage writes a group into the
+  // active segment, the sync stage fsyncs it and runs its callbacks.
+  scoped_refptr<Histogram> group_write_stage_latency;
+  scoped_refptr<Histogram> group_sync_stage_latency;
+
+  // Number of groups whose write stage overlapped with the sync of the
+  // previous group (only with --log_pipelined_append).
+  scoped_refptr<Counter> pipelined_groups_overlapped;
+
+  // Time the append thread spent waiting for more batches to join a group
+  // (only with --log_group_commit_max_delay_us).
+  scoped_refptr<Histogram> group_commit_delay;
+
+  // Time from when the first batch of a group was queued until the append
+  // thread picked it up, and the time the append thread spent spinning for
+  // batches and the spins that found one (--log_append_thread_spin_us).
+  scoped_refptr<Histogram> append_wakeup_latency;
+  scoped_refptr<Counter> append_thread_spin_time;
+  scoped_refptr<Counter> append_thread_spin_hits;
+
+  // Disk space saved by recompressing sealed segments, see
+  // Log::RecompressSegments().
+  scoped_refptr<Counter> bytes_saved_by_recompression;
 };
 
 } // namespace log
@@ -0,0 +1,143 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/log_reader.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/log.h"
+#include "kudu/consensus/log.pb.h"
+#include "kudu/consensus/log_index.h"
+#include "kudu/consensus/log_util.h"
+#include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/fs/fs_manager.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/async_util.h"
+#include "kudu/util/env.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_int32(log_reader_init_threads);
+
+using kudu::consensus::MakeOpId;
+using kudu::consensus::ReplicateMsg;
+using kudu::consensus::ReplicateRefPtr;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace kudu {
+namespace log {
+
+static const char* kTestTablet = "test-tablet";
+
+class LogReaderTest : public KuduTest {
+ public:
+  void SetUp() override {
+    KuduTest::SetUp();
+    fs_manager_.reset(new FsManager(env_, GetTestPath("fs_root")));
+    ASSERT_OK(fs_manager_->CreateInitialFileSystemLayout());
+    ASSERT_OK(fs_manager_->Open());
+    ASSERT_OK(Log::Open(
+        LogOptions(), fs_manager_.get(), kTestTablet, nullptr, &log_));
+  }
+
+  void TearDown() override {
+    if (log_) {
+      ASSERT_OK(log_->Close());
+    }
+    KuduTest::TearDown();
+  }
+
+ protected:
+  // Appends the ops ['first', 'last'] in a single batch.
+  void AppendOps(int64_t first, int64_t last) {
+    vector<ReplicateRefPtr> replicates;
+    for (int64_t index = first; index <= last; index++) {
+      ReplicateMsg* msg = new ReplicateMsg();
+      *msg->mutable_id() = MakeOpId(1, index);
+      msg->set_timestamp(index);
+      msg->set_op_type(consensus::NO_OP);
+      replicates.push_back(consensus::make_scoped_refptr_replicate(msg));
+    }
+    Synchronizer s;
+    ASSERT_OK(log_->AsyncAppendReplicates(replicates, s.AsStatusCallback()));
+    ASSERT_OK(s.Wait());
+  }
+
+  unique_ptr<FsManager> fs_manager_;
+  scoped_refptr<Log> log_;
+};
+
+// Opens a WAL whose last segment was left in progress, as by a crash, on one
+// thread and then on several: the segments come out in order either way, and
+// the footer of the last one is rebuilt by scanning it.
+TEST_F(LogReaderTest, TestInitOpensSegmentsInParallel) {
+  const int kNumSegments = 6;
+  const int kOpsPerSegment = 5;
+  for (int i = 0; i < kNumSegments; i++) {
+    NO_FATALS(AppendOps(i * kOpsPerSegment + 1, (i + 1) * kOpsPerSegment));
+    if (i < kNumSegments - 1) {
+      ASSERT_OK(log_->AllocateSegmentAndRollOver());
+    }
+  }
+  ASSERT_OK(log_->WaitUntilAllFlushed());
+
+  // A segment created right before a crash, whose header never made it to
+  // disk, is skipped.
+  ASSERT_OK(WriteStringToFile(
+      env_,
+      string(64, '\0'),
+      fs_manager_->GetWalSegmentFileName(kTestTablet, kNumSegments + 1)));
+
+  for (int threads : {1, 4}) {
+    SCOPED_TRACE(threads);
+    FLAGS_log_reader_init_threads = threads;
+    shared_ptr<LogReader> reader;
+    ASSERT_OK(LogReader::Open(
+        fs_manager_.get(), nullptr, kTestTablet, nullptr, &reader));
+    SegmentSequence segments;
+    ASSERT_OK(reader->GetSegmentsSnapshot(&segments));
+    ASSERT_EQ(kNumSegments, static_cast<int>(segments.size()));
+
+    int64_t next_index = 1;
+    for (const auto& segment : segments) {
+      ASSERT_TRUE(segment->HasFooter()) << segment->path();
+      ASSERT_EQ(kOpsPerSegment, segment->footer().num_entries());
+      LogEntries entries;
+      ASSERT_OK(segment->ReadEntries(&entries));
+      for (const auto& entry : entries) {
+        ASSERT_EQ(REPLICATE, entry->type());
+        ASSERT_EQ(next_index++, entry->replicate().id().index());
+      }
+    }
+    ASSERT_EQ(kNumSegments * kOpsPerSegment + 1, next_index);
+  }
+}
+
+} // namespace log
+} // namespace kudu
@@ -18,26 +18,87 @@
 #include "kudu/consensus/log_reader.h"
 
 #include <algorithm>
+#include <initializer_list>
 #include <memory>
 #include <mutex>
 #include <ostream>
+#include <utility>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/log.pb.h"
 #include "kudu/consensus/log_index.h"
 #include "kudu/consensus/opid.pb.h"
+#include "kudu/consensus/opid_util.h"
 #include "kudu/fs/fs_manager.h"
+#include "kudu/fs/io_scheduler.h"
+#include "kudu/gutil/gscoped_ptr.h"
+#include "kudu/gutil/once.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/stl_util.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/gutil/strings/util.h"
+#include "kudu/util/async_env.h"
+#include "kudu/util/countdown_latch.h"
 #include "kudu/util/env.h"
 #include "kudu/util/faststring.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/path_util.h"
 #include "kudu/util/pb_util.h"
+#include "kudu/util/stopwatch.h"
+#include "kudu/util/thread.h"
+#include "kudu/util/threadpool.h"
+
+DEFINE_int32(
+    log_reader_init_threads,
+    4,
+    "The number of threads used to open the segments of a WAL at startup. "
+    "Opening a segment which was left in progress by a crash requires "
+    "scanning it.");
+TAG_FLAG(log_reader_init_threads, advanced);
+
+DEFINE_bool(
+    log_reader_lazy_open,
+    false,
+    "Whether to open only the most recent segments of a WAL at startup and "
+    "the older ones in the background, so that the tablet can start serving "
+    "before its whole WAL is open. Reads which need the older segments, e.g. "
+    "to catch up a lagging peer, wait until they are open.");
+TAG_FLAG(log_reader_lazy_open, experimental);
+
+DEFINE_int32(
+    log_reader_lazy_open_tail_segments,
+    2,
+    "The number of most recent WAL segments opened at startup when "
+    "--log_reader_lazy_open is set.");
+TAG_FLAG(log_reader_lazy_open_tail_segments, experimental);
+
+DEFINE_int32(
+    log_sequential_read_buffer_bytes,
+    1024 * 1024,
+    "Size of the reads with which closed WAL segments are scanned to catch up "
+    "a peer which is far behind. The segment is advised to be read "
+    "sequentially and the next read is read ahead. 0 reads every entry batch "
+    "on its own instead.");
+TAG_FLAG(log_sequential_read_buffer_bytes, advanced);
+
+DEFINE_int32(
+    log_reader_async_read_depth,
+    0,
+    "The number of entry batches that a read of ops from the WAL, e.g. to "
+    "catch up a lagging peer, has in flight at once. They are read through "
+    "an asynchronous env shared by all the logs, and through io_uring if "
+    "--log_use_io_uring is set and io_uring is supported. 0 or 1 reads the "
+    "batches one at a time. The env is sized by the value at its first use.");
+DEFINE_validator(
+    log_reader_async_read_depth,
+    [](const char* /*flagname*/, int32_t value) { return value >= 0; });
+TAG_FLAG(log_reader_async_read_depth, experimental);
+
+DECLARE_bool(log_use_io_uring);
 
 METRIC_DEFINE_counter(
     server,
@@ -53,6 +114,14 @@ METRIC_DEFINE_counter(
     kudu::MetricUnit::kEntries,
     "Number of entries read from the WAL since tablet start");
 
+METRIC_DEFINE_gauge_int64(
+    server,
+    log_reader_init_time,
+    "Log Segments Open Time",
+    kudu::MetricUnit::kMilliseconds,
+    "Time spent opening the WAL segments of the tablet at startup, including "
+    "rebuilding the footers of the segments left in progress by a crash.");
+
 METRIC_DEFINE_histogram(
     server,
     log_reader_read_batch_latency,
@@ -63,6 +132,7 @@ METRIC_DEFINE_histogram(
     2);
 
 using kudu::consensus::OpId;
+using kudu::consensus::OpIdEquals;
 using kudu::consensus::ReplicateMsg;
 using kudu::pb_util::SecureDebugString;
 using kudu::pb_util::SecureShortDebugString;
@@ -76,6 +146,34 @@ namespace kudu {
 namespace log {
 
 namespace {
+
+GoogleOnceType catch_up_env_once = GOOGLE_ONCE_INIT;
+AsyncEnv* catch_up_env = nullptr;
+
+void InitCatchUpEnv() {
+  const int depth = FLAGS_log_reader_async_read_depth;
+  unique_ptr<AsyncEnv> env;
+  Status s = AsyncEnv::Create(
+      "log-read-ahead", depth, FLAGS_log_use_io_uring ? depth : 0, &env);
+  if (PREDICT_FALSE(!s.ok())) {
+    LOG(WARNING) << "Reading log entry batches one at a time: "
+                 << s.ToString();
+    return;
+  }
+  // Shared by all the logs until the process exits.
+  catch_up_env = env.release();
+}
+
+// Returns the env which ReadReplicatesInRange() reads batches ahead through,
+// or NULL if they are read one at a time.
+AsyncEnv* GetCatchUpEnv() {
+  if (FLAGS_log_reader_async_read_depth <= 1) {
+    return nullptr;
+  }
+  GoogleOnceInit(&catch_up_env_once, &InitCatchUpEnv);
+  return catch_up_env;
+}
+
 struct LogSegmentSeqnoComparator {
   bool operator()(
       const scoped_refptr<ReadableLogSegment>& a,
@@ -83,6 +181,69 @@ struct LogSegmentSeqnoComparator {
     return a->header().sequence_number() < b->header().sequence_number();
   }
 };
+
+// Opens the segment at 'path', rebuilding its footer if it has none.
+Status OpenSegment(
+    Env* env,
+    const string& path,
+    scoped_refptr<ReadableLogSegment>* segment) {
+  scoped_refptr<ReadableLogSegment> s;
+  RETURN_NOT_OK(ReadableLogSegment::Open(env, path, &s));
+  DCHECK(s);
+  CHECK(s->IsInitialized()) << "Uninitialized segment at: " << s->path();
+  if (!s->HasFooter()) {
+    VLOG(1) << "Log segment " << path << " was likely left in-progress "
+            << "after a previous crash. Will try to rebuild footer by "
+            << "scanning data.";
+    RETURN_NOT_OK(s->RebuildFooterByScanning());
+  }
+  *segment = std::move(s);
+  return Status::OK();
+}
+
+// Checks that the sequence numbers of 'segments', which are sorted by
+// sequence number, are consecutive.
+Status CheckSegmentsInSequence(const SegmentSequence& segments) {
+  string previous_seg_path;
+  int64_t previous_seg_seqno = -1;
+  for (const SegmentSequence::value_type& entry : segments) {
+    if (previous_seg_seqno != -1 &&
+        entry->header().sequence_number() != previous_seg_seqno + 1) {
+      return Status::Corruption(Substitute(
+          "Segment sequence numbers are not consecutive. "
+          "Previous segment: seqno $0, path $1; Current segment: seqno $2, path $3",
+          previous_seg_seqno,
+          previous_seg_path,
+          entry->header().sequence_number(),
+          entry->path()));
+    }
+    previous_seg_seqno = entry->header().sequence_number();
+    previous_seg_path = entry->path();
+  }
+  return Status::OK();
+}
+
+// Returns the segment of 'segments', which are contiguous and sorted by
+// sequence number, with sequence number 'seq', or NULL if there is none.
+scoped_refptr<ReadableLogSegment> FindSegment(
+    const SegmentSequence& segments,
+    int64_t seq) {
+  if (segments.empty()) {
+    return nullptr;
+  }
+
+  // We always have a contiguous set of log segments, so we can find the
+  // requested segment in our vector by calculating its offset vs the first
+  // element.
+  int64_t first_seqno = segments[0]->header().sequence_number();
+  int64_t relative = seq - first_seqno;
+  if (relative < 0 || relative >= segments.size()) {
+    return nullptr;
+  }
+
+  DCHECK_EQ(segments[relative]->header().sequence_number(), seq);
+  return segments[relative];
+}
 } // namespace
 
 const int64_t LogReader::kNoSizeLimit = -1;
@@ -126,16 +287,23 @@ LogReader::LogReader(
     : env_(env),
       log_index_(std::move(index)),
       tablet_id_(std::move(tablet_id)),
+      io_scheduler_(nullptr),
+      older_segments_opened_(0),
       state_(kLogReaderInitialized) {
   if (metric_entity) {
     bytes_read_ = METRIC_log_reader_bytes_read.Instantiate(metric_entity);
     entries_read_ = METRIC_log_reader_entries_read.Instantiate(metric_entity);
     read_batch_latency_ =
         METRIC_log_reader_read_batch_latency.Instantiate(metric_entity);
+    init_time_ = METRIC_log_reader_init_time.Instantiate(metric_entity, 0);
   }
 }
 
-LogReader::~LogReader() {}
+LogReader::~LogReader() {
+  if (older_segments_thread_) {
+    older_segments_thread_->Join();
+  }
+}
 
 Status LogReader::Init(const string& tablet_wal_path) {
   {
@@ -157,73 +325,169 @@ Status LogReader::Init(const string& tablet_wal_path) {
       env_->GetChildren(tablet_wal_path, &log_files),
       "Unable to read children from path");
 
-  SegmentSequence read_segments;
-
-  // build a log segment from each file
+  vector<string> segment_paths;
   for (const string& log_file : log_files) {
     if (HasPrefixString(log_file, FsManager::kWalFileNamePrefix)) {
-      string fqp = JoinPathSegments(tablet_wal_path, log_file);
-      scoped_refptr<ReadableLogSegment> segment;
-      Status s = ReadableLogSegment::Open(env_, fqp, &segment);
-      if (s.IsUninitialized()) {
-        // This indicates that the segment was created but the writer
-        // crashed before the header was successfully written. In this
-        // case, we should skip it.
-        LOG(WARNING) << "Ignoring log segment " << log_file
-                     << " since it was uninitialized "
-                     << "(probably left after a prior tablet server crash)";
-        continue;
-      }
-
-      RETURN_NOT_OK_PREPEND(s, "Unable to open readable log segment");
-      DCHECK(segment);
-      CHECK(segment->IsInitialized())
-          << "Uninitialized segment at: " << segment->path();
-
-      if (!segment->HasFooter()) {
-        VLOG(1)
-            << "Log segment " << fqp << " was likely left in-progress "
-            << "after a previous crash. Will try to rebuild footer by scanning data.";
-        RETURN_NOT_OK(segment->RebuildFooterByScanning());
-      }
-
-      read_segments.push_back(segment);
+      segment_paths.push_back(JoinPathSegments(tablet_wal_path, log_file));
     }
   }
 
-  // Sort the segments by sequence number.
-  std::sort(
-      read_segments.begin(), read_segments.end(), LogSegmentSeqnoComparator());
+  // Segment file names end with their zero-padded sequence number, so sorting
+  // the paths puts the most recent segments last.
+  std::sort(segment_paths.begin(), segment_paths.end());
+  const int tail_segments = FLAGS_log_reader_lazy_open_tail_segments;
+  if (FLAGS_log_reader_lazy_open && tail_segments > 0 &&
+      static_cast<int>(segment_paths.size()) > tail_segments) {
+    auto tail_begin = segment_paths.end() - tail_segments;
+    older_segment_paths_.assign(segment_paths.begin(), tail_begin);
+    segment_paths.erase(segment_paths.begin(), tail_begin);
+  }
+
+  Stopwatch sw;
+  sw.start();
+  SegmentSequence read_segments;
+  RETURN_NOT_OK(OpenSegments(segment_paths, &read_segments));
+  if (read_segments.empty() && !older_segment_paths_.empty()) {
+    // None of the tail segments were ever written to, so the older segments
+    // are needed to continue the log.
+    RETURN_NOT_OK(OpenSegments(older_segment_paths_, &read_segments));
+    older_segment_paths_.clear();
+  }
+  sw.stop();
+  if (init_time_ && older_segment_paths_.empty()) {
+    init_time_->set_value(sw.elapsed().wall_millis());
+  }
+  VLOG(1) << Substitute(
+      "Opened $0 log segments of tablet $1 in $2",
+      read_segments.size(),
+      tablet_id_,
+      sw.elapsed().ToString());
 
   {
     std::lock_guard<simple_spinlock> lock(lock_);
-
-    string previous_seg_path;
-    int64_t previous_seg_seqno = -1;
+    RETURN_NOT_OK(CheckSegmentsInSequence(read_segments));
     for (const SegmentSequence::value_type& entry : read_segments) {
       VLOG(1) << " Log Reader Indexed: "
               << SecureShortDebugString(entry->footer());
-      // Check that the log segments are in sequence.
-      if (previous_seg_seqno != -1 &&
-          entry->header().sequence_number() != previous_seg_seqno + 1) {
-        return Status::Corruption(Substitute(
-            "Segment sequence numbers are not consecutive. "
-            "Previous segment: seqno $0, path $1; Current segment: seqno $2, path $3",
-            previous_seg_seqno,
-            previous_seg_path,
-            entry->header().sequence_number(),
-            entry->path()));
-      }
-      previous_seg_seqno = entry->header().sequence_number();
-      previous_seg_path = entry->path();
       RETURN_NOT_OK(AppendSegmentUnlocked(entry));
     }
-
+    if (!older_segment_paths_.empty()) {
+      older_segments_opened_.Reset(1);
+    }
     state_ = kLogReaderReading;
   }
+
+  if (!older_segment_paths_.empty()) {
+    VLOG(1) << Substitute(
+        "Opening $0 older log segments of tablet $1 in the background",
+        older_segment_paths_.size(),
+        tablet_id_);
+    Status s = Thread::Create(
+        "log",
+        "log-reader-lazy-open",
+        &LogReader::OpenOlderSegments,
+        this,
+        sw.elapsed().wall_millis(),
+        &older_segments_thread_);
+    if (!s.ok()) {
+      older_segments_opened_.CountDown();
+      return s;
+    }
+  }
   return Status::OK();
 }
 
+Status LogReader::OpenSegments(
+    const vector<string>& segment_paths,
+    SegmentSequence* segments) {
+  // Opening a segment reads its header and footer, and a segment left in
+  // progress by a crash is scanned to rebuild its footer, so a long WAL is
+  // opened on several threads.
+  vector<scoped_refptr<ReadableLogSegment>> opened(segment_paths.size());
+  vector<Status> statuses(segment_paths.size());
+  const int num_threads = std::min<int>(
+      FLAGS_log_reader_init_threads, segment_paths.size());
+  if (num_threads <= 1) {
+    for (int i = 0; i < static_cast<int>(segment_paths.size()); i++) {
+      statuses[i] = OpenSegment(env_, segment_paths[i], &opened[i]);
+    }
+  } else {
+    gscoped_ptr<ThreadPool> pool;
+    RETURN_NOT_OK(ThreadPoolBuilder("log-reader-init")
+                      .set_max_threads(num_threads)
+                      .Build(&pool));
+    for (int i = 0; i < static_cast<int>(segment_paths.size()); i++) {
+      Env* env = env_;
+      const string* path = &segment_paths[i];
+      Status* status = &statuses[i];
+      scoped_refptr<ReadableLogSegment>* segment = &opened[i];
+      RETURN_NOT_OK(pool->SubmitFunc([env, path, status, segment]() {
+        *status = OpenSegment(env, *path, segment);
+      }));
+    }
+    pool->Wait();
+  }
+
+  SegmentSequence read_segments;
+  for (int i = 0; i < static_cast<int>(segment_paths.size()); i++) {
+    if (statuses[i].IsUninitialized()) {
+      // This indicates that the segment was created but the writer
+      // crashed before the header was successfully written. In this
+      // case, we should skip it.
+      LOG(WARNING) << "Ignoring log segment " << segment_paths[i]
+                   << " since it was uninitialized "
+                   << "(probably left after a prior tablet server crash)";
+      continue;
+    }
+    RETURN_NOT_OK_PREPEND(statuses[i], "Unable to open readable log segment");
+    read_segments.push_back(opened[i]);
+  }
+
+  // Sort the segments by sequence number.
+  std::sort(
+      read_segments.begin(), read_segments.end(), LogSegmentSeqnoComparator());
+  segments->swap(read_segments);
+  return Status::OK();
+}
+
+void LogReader::OpenOlderSegments(double tail_open_millis) {
+  Stopwatch sw;
+  sw.start();
+  SegmentSequence segments;
+  Status s = OpenSegments(older_segment_paths_, &segments);
+  sw.stop();
+  {
+    std::lock_guard<simple_spinlock> lock(lock_);
+    if (s.ok()) {
+      segments.insert(segments.end(), segments_.begin(), segments_.end());
+      s = CheckSegmentsInSequence(segments);
+    }
+    if (s.ok()) {
+      segments_.swap(segments);
+    }
+  }
+  if (s.ok()) {
+    VLOG(1) << Substitute(
+        "Opened $0 older log segments of tablet $1 in $2",
+        older_segment_paths_.size(),
+        tablet_id_,
+        sw.elapsed().ToString());
+  } else {
+    // The reader keeps serving the tail of the log, as if the older segments
+    // had been GCed.
+    LOG(ERROR) << "T " << tablet_id_
+               << ": unable to open older log segments: " << s.ToString();
+  }
+  if (init_time_) {
+    init_time_->set_value(tail_open_millis + sw.elapsed().wall_millis());
+  }
+  older_segments_opened_.CountDown();
+}
+
+void LogReader::WaitForOlderSegments() const {
+  older_segments_opened_.Wait();
+}
+
 Status LogReader::InitEmptyReaderForTests() {
   std::lock_guard<simple_spinlock> lock(lock_);
   state_ = kLogReaderReading;
@@ -231,17 +495,20 @@ Status LogReader::InitEmptyReaderForTests() {
 }
 
 int64_t LogReader::GetMinReplicateIndex() const {
+  WaitForOlderSegments();
   std::lock_guard<simple_spinlock> lock(lock_);
   int64_t min_remaining_op_idx = -1;
 
-  for (const scoped_refptr<ReadableLogSegment>& segment : segments_) {
-    if (!segment->HasFooter())
-      continue;
-    if (!segment->footer().has_min_replicate_index())
-      continue;
-    if (min_remaining_op_idx == -1 ||
-        segment->footer().min_replicate_index() < min_remaining_op_idx) {
-      min_remaining_op_idx = segment->footer().min_replicate_index();
+  for (const SegmentSequence* segments : {&archived_segments_, &segments_}) {
+    for (const scoped_refptr<ReadableLogSegment>& segment : *segments) {
+      if (!segment->HasFooter())
+        continue;
+      if (!segment->footer().has_min_replicate_index())
+        continue;
+      if (min_remaining_op_idx == -1 ||
+          segment->footer().min_replicate_index() < min_remaining_op_idx) {
+        min_remaining_op_idx = segment->footer().min_replicate_index();
+      }
     }
   }
   return min_remaining_op_idx;
@@ -249,22 +516,27 @@ int64_t LogReader::GetMinReplicateIndex() const {
 
 scoped_refptr<ReadableLogSegment> LogReader::GetSegmentBySequenceNumber(
     int64_t seq) const {
-  std::lock_guard<simple_spinlock> lock(lock_);
-  if (segments_.empty()) {
-    return nullptr;
+  {
+    std::lock_guard<simple_spinlock> lock(lock_);
+    if (!segments_.empty() &&
+        seq >= segments_[0]->header().sequence_number()) {
+      return GetSegmentBySequenceNumberUnlocked(seq);
+    }
   }
+  // The segment may be one of the older segments of a lazily opened log.
+  WaitForOlderSegments();
+  std::lock_guard<simple_spinlock> lock(lock_);
+  return GetSegmentBySequenceNumberUnlocked(seq);
+}
 
-  // We always have a contiguous set of log segments, so we can find the
-  // requested segment in our vector by calculating its offset vs the first
-  // element.
-  int64_t first_seqno = segments_[0]->header().sequence_number();
-  int64_t relative = seq - first_seqno;
-  if (relative < 0 || relative >= segments_.size()) {
-    return nullptr;
+scoped_refptr<ReadableLogSegment>
+LogReader::GetSegmentBySequenceNumberUnlocked(int64_t seq) const {
+  DCHECK(lock_.is_locked());
+  if (!segments_.empty() && seq >= segments_[0]->header().sequence_number()) {
+    return FindSegment(segments_, seq);
   }
-
-  DCHECK_EQ(segments_[relative]->header().sequence_number(), seq);
-  return segments_[relative];
+  // The segment may have been GCed to the archive.
+  return FindSegment(archived_segments_, seq);
 }
 
 Status LogReader::ReadBatchUsingIndexEntry(
@@ -297,7 +569,8 @@ Status LogReader::ReadBatchUsingIndexEntry(
           index_entry.offset_in_segment));
 
   if (bytes_read_) {
-    bytes_read_->IncrementBy(segment->entry_header_size() + tmp_buf->length());
+    // 'tmp_buf' holds none of the batch when it was parsed from a mapping.
+    bytes_read_->IncrementBy(offset - index_entry.offset_in_segment);
     entries_read_->IncrementBy((**batch).entry_size());
   }
 
@@ -321,6 +594,10 @@ Status LogReader::ReadReplicatesInRange(
   bool limit_exceeded = false;
   faststring tmp_buf;
   unique_ptr<LogEntryBatchPB> batch;
+  AsyncEnv* async_env = GetCatchUpEnv();
+  BatchesByLocation batches_ahead;
+  fs::ScopedIO io(io_scheduler_, fs::IOScheduler::CATCH_UP);
+  shared_lock<RWMutex> rewrite_lock(rewrite_lock_);
   for (int64_t index = starting_at; index <= up_to && !limit_exceeded;
        index++) {
     LogIndexEntry index_entry;
@@ -336,7 +613,36 @@ Status LogReader::ReadReplicatesInRange(
         index_entry.segment_sequence_number !=
             prev_index_entry.segment_sequence_number ||
         index_entry.offset_in_segment != prev_index_entry.offset_in_segment) {
-      RETURN_NOT_OK(ReadBatchUsingIndexEntry(index_entry, &tmp_buf, &batch));
+      batch.reset();
+      if (async_env) {
+        const auto location = std::make_pair(
+            index_entry.segment_sequence_number,
+            index_entry.offset_in_segment);
+        auto iter = batches_ahead.find(location);
+        if (iter == batches_ahead.end()) {
+          batches_ahead.clear();
+          ReadBatchesAhead(
+              index,
+              up_to,
+              max_bytes_to_read > 0
+                  ? std::max<int64_t>(1, max_bytes_to_read - total_size)
+                  : 0,
+              async_env,
+              &batches_ahead);
+          iter = batches_ahead.find(location);
+        }
+        if (iter != batches_ahead.end()) {
+          batch = std::move(iter->second);
+          batches_ahead.erase(iter);
+        } else {
+          // E.g. the rest is in mapped segments.
+          async_env = nullptr;
+        }
+      }
+      if (!batch) {
+        RETURN_NOT_OK(
+            ReadBatchUsingIndexEntry(index_entry, &tmp_buf, &batch));
+      }
 
       // Sanity-check the property that a batch should only have increasing
       // indexes.
@@ -381,11 +687,175 @@ Status LogReader::ReadReplicatesInRange(
 
     prev_index_entry = index_entry;
   }
+  io.AddBytes(total_size);
 
   replicates->swap(replicates_tmp);
   return Status::OK();
 }
 
+void LogReader::ReadBatchesAhead(
+    int64_t starting_at,
+    int64_t up_to,
+    int64_t max_bytes_to_read,
+    AsyncEnv* async_env,
+    BatchesByLocation* batches) const {
+  // A batch being read, and what was read of it so far.
+  struct BatchRead {
+    scoped_refptr<ReadableLogSegment> segment;
+    int64_t seqno;
+    int64_t offset;
+    faststring header_buf;
+    ReadableLogSegment::EntryHeader header;
+    // Has room for the uncompressed copy too, see DecodeEntryBatch().
+    faststring body;
+    Status status;
+  };
+  const int depth = FLAGS_log_reader_async_read_depth;
+  vector<unique_ptr<BatchRead>> reads;
+  LogIndexEntry prev_index_entry;
+  for (int64_t index = starting_at;
+       index <= up_to && static_cast<int>(reads.size()) < depth;
+       index++) {
+    LogIndexEntry index_entry;
+    if (!log_index_->GetEntry(index, &index_entry).ok()) {
+      break;
+    }
+    if (index != starting_at &&
+        index_entry.segment_sequence_number ==
+            prev_index_entry.segment_sequence_number &&
+        index_entry.offset_in_segment == prev_index_entry.offset_in_segment) {
+      continue;
+    }
+    prev_index_entry = index_entry;
+    scoped_refptr<ReadableLogSegment> segment;
+    if (!reads.empty() &&
+        reads.back()->seqno == index_entry.segment_sequence_number) {
+      segment = reads.back()->segment;
+    } else {
+      segment = GetSegmentBySequenceNumber(index_entry.segment_sequence_number);
+      if (!segment || segment->GetMapping()) {
+        break;
+      }
+    }
+    reads.emplace_back(new BatchRead());
+    BatchRead* read = reads.back().get();
+    read->segment = std::move(segment);
+    read->seqno = index_entry.segment_sequence_number;
+    read->offset = index_entry.offset_in_segment;
+  }
+  if (reads.size() < 2) {
+    // Nothing to gain over reading the batch the regular way.
+    return;
+  }
+
+  // Read all the headers, then all the batches they describe.
+  CountDownLatch headers_latch(reads.size());
+  for (const auto& read : reads) {
+    read->header_buf.resize(read->segment->entry_header_size());
+    async_env->ReadV(
+        read->segment->readable_file().get(),
+        read->offset,
+        vector<Slice>{Slice(read->header_buf.data(), read->header_buf.size())},
+        [&read, &headers_latch](const Status& s) {
+          read->status = s;
+          headers_latch.CountDown();
+        });
+  }
+  headers_latch.Wait();
+
+  int64_t total_bytes = 0;
+  size_t num_batches = 0;
+  for (const auto& read_ptr : reads) {
+    BatchRead& read = *read_ptr;
+    if (!read.status.ok() ||
+        read.segment->DecodeEntryHeader(
+            Slice(read.header_buf), &read.header) != EntryHeaderStatus::OK ||
+        read.header.msg_length == 0 ||
+        read.offset + read.header_buf.size() +
+                read.header.msg_length_compressed >
+            read.segment->readable_up_to()) {
+      break;
+    }
+    if (num_batches > 0 && max_bytes_to_read > 0 &&
+        total_bytes >= max_bytes_to_read) {
+      break;
+    }
+    total_bytes += read.header.msg_length;
+    num_batches++;
+  }
+
+  CountDownLatch batches_latch(num_batches);
+  for (size_t i = 0; i < num_batches; i++) {
+    BatchRead& read = *reads[i];
+    read.body.resize(
+        read.header.msg_length_compressed +
+        (read.segment->codec_ ? read.header.msg_length : 0));
+    async_env->ReadV(
+        read.segment->readable_file().get(),
+        read.offset + read.header_buf.size(),
+        vector<Slice>{
+            Slice(read.body.data(), read.header.msg_length_compressed)},
+        [&read, &batches_latch](const Status& s) {
+          read.status = s;
+          batches_latch.CountDown();
+        });
+  }
+  batches_latch.Wait();
+
+  for (size_t i = 0; i < num_batches; i++) {
+    BatchRead& read = *reads[i];
+    unique_ptr<LogEntryBatchPB> batch;
+    if (!read.status.ok() ||
+        !read.segment
+             ->DecodeEntryBatch(
+                 read.offset + read.header_buf.size(),
+                 read.header,
+                 Slice(read.body.data(), read.header.msg_length_compressed),
+                 &read.body,
+                 &batch)
+             .ok()) {
+      continue;
+    }
+    if (bytes_read_) {
+      bytes_read_->IncrementBy(
+          read.header_buf.size() + read.header.msg_length_compressed);
+      entries_read_->IncrementBy(batch->entry_size());
+    }
+    (*batches)[std::make_pair(read.seqno, read.offset)] = std::move(batch);
+  }
+}
+
+Status LogReader::IndexSegment(ReadableLogSegment* segment, LogIndex* index) {
+  const int64_t seqno = segment->header().sequence_number();
+  // Where the entries end, i.e. where the footer, if any, starts.
+  const int64_t read_up_to = LogEntryReader(segment).read_up_to_offset();
+  int64_t offset = segment->first_entry_offset();
+  faststring tmp_buf;
+  while (offset < read_up_to) {
+    const int64_t batch_offset = offset;
+    unique_ptr<LogEntryBatchPB> batch;
+    EntryHeaderStatus status_detail;
+    RETURN_NOT_OK_PREPEND(
+        segment->ReadEntryHeaderAndBatch(
+            &offset, &tmp_buf, &batch, &status_detail),
+        Substitute(
+            "Failed to read log segment $0 at offset $1",
+            segment->path(),
+            batch_offset));
+    for (const LogEntryPB& entry : batch->entry()) {
+      if (!entry.has_replicate()) {
+        continue;
+      }
+      LogIndexEntry index_entry;
+      index_entry.op_id = entry.replicate().id();
+      index_entry.segment_sequence_number = seqno;
+      index_entry.offset_in_segment = batch_offset;
+      RETURN_NOT_OK(index->AddEntry(index_entry));
+    }
+  }
+  return Status::OK();
+}
+
 Status LogReader::LookupOpId(int64_t op_index, OpId* op_id) const {
   LogIndexEntry index_entry;
   RETURN_NOT_OK_PREPEND(
@@ -396,14 +866,21 @@ Status LogReader::LookupOpId(int64_t op_index, OpId* op_id) const {
 }
 
 Status LogReader::GetSegmentsSnapshot(SegmentSequence* segments) const {
+  WaitForOlderSegments();
   std::lock_guard<simple_spinlock> lock(lock_);
   CHECK_EQ(state_, kLogReaderReading);
   segments->assign(segments_.begin(), segments_.end());
   return Status::OK();
 }
 
+int LogReader::num_archived_segments() const {
+  std::lock_guard<simple_spinlock> lock(lock_);
+  return archived_segments_.size();
+}
+
 Status LogReader::TrimSegmentsUpToAndIncluding(
     int64_t segment_sequence_number) {
+  WaitForOlderSegments();
   std::lock_guard<simple_spinlock> lock(lock_);
   CHECK_EQ(state_, kLogReaderReading);
   auto iter = segments_.begin();
@@ -422,6 +899,29 @@ Status LogReader::TrimSegmentsUpToAndIncluding(
   return Status::OK();
 }
 
+void LogReader::AddArchivedSegment(
+    const scoped_refptr<ReadableLogSegment>& segment,
+    int max_segments,
+    SegmentSequence* evicted) {
+  std::lock_guard<simple_spinlock> lock(lock_);
+  const int64_t seqno = segment->header().sequence_number();
+  if (!archived_segments_.empty() &&
+      archived_segments_.back()->header().sequence_number() + 1 != seqno) {
+    // A segment in between was deleted instead of archived, so the older
+    // archived segments can't be found by sequence number anymore.
+    evicted->insert(
+        evicted->end(), archived_segments_.begin(), archived_segments_.end());
+    archived_segments_.clear();
+  }
+  archived_segments_.push_back(segment);
+  if (max_segments > 0 &&
+      static_cast<int>(archived_segments_.size()) > max_segments) {
+    auto evict_end = archived_segments_.end() - max_segments;
+    evicted->insert(evicted->end(), archived_segments_.begin(), evict_end);
+    archived_segments_.erase(archived_segments_.begin(), evict_end);
+  }
+}
+
 void LogReader::UpdateLastSegmentOffset(int64_t readable_to_offset) {
   std::lock_guard<simple_spinlock> lock(lock_);
   CHECK_EQ(state_, kLogReaderReading);
@@ -432,6 +932,21 @@ void LogReader::UpdateLastSegmentOffset(int64_t readable_to_offset) {
   segment->UpdateReadableToOffset(readable_to_offset);
 }
 
+Status LogReader::ReplaceRewrittenSegment(
+    const scoped_refptr<ReadableLogSegment>& segment) {
+  DCHECK(segment->HasFooter());
+  const int64_t seqno = segment->header().sequence_number();
+  std::lock_guard<simple_spinlock> lock(lock_);
+  CHECK_EQ(state_, kLogReaderReading);
+  if (segments_.empty() || seqno < segments_[0]->header().sequence_number() ||
+      seqno >= segments_.back()->header().sequence_number()) {
+    return Status::NotFound(
+        Substitute("Segment $0 is not a sealed segment of the log", seqno));
+  }
+  segments_[seqno - segments_[0]->header().sequence_number()] = segment;
+  return Status::OK();
+}
+
 Status LogReader::ReplaceLastSegment(
     const scoped_refptr<ReadableLogSegment>& segment) {
   // This is used to replace the last segment once we close it properly so it
@@ -489,10 +1004,19 @@ Status LogReader::AppendEmptySegment(
 }
 
 const int LogReader::num_segments() const {
+  WaitForOlderSegments();
   std::lock_guard<simple_spinlock> lock(lock_);
   return segments_.size();
 }
 
+int64_t LogReader::GetLastSegmentSequenceNumber() const {
+  std::lock_guard<simple_spinlock> lock(lock_);
+  if (segments_.empty()) {
+    return -1;
+  }
+  return segments_.back()->header().sequence_number();
+}
+
 string LogReader::ToString() const {
   std::lock_guard<simple_spinlock> lock(lock_);
   string ret = "Reader's SegmentSequence: \n";
@@ -506,5 +1030,135 @@ string LogReader::ToString() const {
   return ret;
 }
 
+SequentialReplicateReader::SequentialReplicateReader(
+    shared_ptr<LogReader> reader)
+    : reader_(std::move(reader)), next_index_(-1) {
+  DCHECK(reader_->log_index_) << "Require an index to position the reader";
+  if (FLAGS_log_sequential_read_buffer_bytes > 0) {
+    read_buffer_.reset(
+        new LogReadAheadBuffer(FLAGS_log_sequential_read_buffer_bytes));
+  }
+}
+
+SequentialReplicateReader::~SequentialReplicateReader() {}
+
+void SequentialReplicateReader::Reset() {
+  pending_entry_.reset();
+  entry_reader_.reset();
+  segment_.reset();
+  next_index_ = -1;
+}
+
+Status SequentialReplicateReader::Seek(int64_t index) {
+  Reset();
+  shared_lock<RWMutex> rewrite_lock(reader_->rewrite_lock_);
+  LogIndexEntry index_entry;
+  RETURN_NOT_OK_PREPEND(
+      reader_->log_index_->GetEntry(index, &index_entry),
+      Substitute("Failed to read log index for op $0", index));
+  segment_ =
+      reader_->GetSegmentBySequenceNumber(index_entry.segment_sequence_number);
+  if (!segment_) {
+    return Status::NotFound(Substitute(
+        "Segment $0 containing op $1 has been GCed",
+        index_entry.segment_sequence_number,
+        index));
+  }
+  entry_reader_.reset(
+      new LogEntryReader(segment_.get(), index_entry.offset_in_segment));
+  entry_reader_->SetReadBuffer(read_buffer_.get());
+  next_index_ = index;
+  return Status::OK();
+}
+
+Status SequentialReplicateReader::ReadReplicates(
+    int64_t starting_at,
+    int64_t up_to,
+    int64_t max_bytes_to_read,
+    vector<ReplicateMsg*>* replicates) {
+  DCHECK_GT(starting_at, 0);
+  DCHECK_GE(up_to, starting_at);
+
+  if (!entry_reader_ || next_index_ != starting_at) {
+    RETURN_NOT_OK(Seek(starting_at));
+  }
+
+  vector<ReplicateMsg*> replicates_tmp;
+  ElementDeleter d(&replicates_tmp);
+  int64_t total_size = 0;
+  fs::ScopedIO io(reader_->io_scheduler_, fs::IOScheduler::CATCH_UP);
+  while (next_index_ <= up_to) {
+    // Only closed segments are read. The segment being written to (and thus
+    // the few most recent ops) is better served by the log cache. Once it is
+    // closed, the LogReader replaces it with a new, footered, instance, which
+    // the next Seek() picks up.
+    if (!segment_->HasFooter()) {
+      Reset();
+      break;
+    }
+
+    unique_ptr<LogEntryPB> entry;
+    if (pending_entry_) {
+      entry = std::move(pending_entry_);
+    } else {
+      Status s = entry_reader_->ReadNextEntry(&entry);
+      if (s.IsEndOfFile()) {
+        scoped_refptr<ReadableLogSegment> next =
+            reader_->GetSegmentBySequenceNumber(
+                segment_->header().sequence_number() + 1);
+        if (!next) {
+          Reset();
+          break;
+        }
+        segment_ = std::move(next);
+        entry_reader_.reset(new LogEntryReader(segment_.get()));
+        entry_reader_->SetReadBuffer(read_buffer_.get());
+        continue;
+      }
+      RETURN_NOT_OK(s);
+    }
+
+    if (!entry->has_replicate()) {
+      continue;
+    }
+    const OpId& op_id = entry->replicate().id();
+    // Skip the ops preceding 'starting_at' in the batch the reader was
+    // positioned at, as well as older copies of ops which were replaced.
+    if (op_id.index() < next_index_) {
+      continue;
+    }
+
+    if (op_id.index() > next_index_) {
+      Reset();
+      break;
+    }
+
+    // An op may have been replaced by one further down the log, e.g. after a
+    // leader change, in which case the index points to the latest copy.
+    LogIndexEntry index_entry;
+    RETURN_NOT_OK_PREPEND(
+        reader_->log_index_->GetEntry(op_id.index(), &index_entry),
+        Substitute("Failed to read log index for op $0", op_id.index()));
+    if (!OpIdEquals(index_entry.op_id, op_id)) {
+      Reset();
+      break;
+    }
+
+    int64_t space_required = entry->replicate().SpaceUsed();
+    if (!replicates_tmp.empty() && max_bytes_to_read > 0 &&
+        total_size + space_required >= max_bytes_to_read) {
+      pending_entry_ = std::move(entry);
+      break;
+    }
+    total_size += space_required;
+    replicates_tmp.push_back(entry->release_replicate());
+    next_index_++;
+  }
+  io.AddBytes(total_size);
+
+  replicates->swap(replicates_tmp);
+  return Status::OK();
+}
+
 } // namespace log
 } // namespace kudu
@@ -18,8 +18,10 @@
 #define KUDU_LOG_LOG_READER_H_
 
 #include <cstdint>
+#include <map>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <gtest/gtest_prod.h>
@@ -27,24 +29,34 @@
 #include "kudu/consensus/log_util.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/util/countdown_latch.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/make_shared.h"
+#include "kudu/util/rw_mutex.h"
 #include "kudu/util/status.h"
 
 namespace kudu {
 
+class AsyncEnv;
 class Counter;
 class Env;
 class FsManager;
 class Histogram;
 class MetricEntity;
+class Thread;
 class faststring;
+template <typename T>
+class AtomicGauge;
 
 namespace consensus {
 class OpId;
 class ReplicateMsg;
 } // namespace consensus
 
+namespace fs {
+class IOScheduler;
+} // namespace fs
+
 namespace log {
 class LogIndex;
 class LogEntryBatchPB;
@@ -80,18 +92,26 @@ class LogReader : public enable_make_shared<LogReader> {
       std::shared_ptr<LogReader>* reader);
 
   // Return the minimum replicate index that is retained in the currently
-  // available logs. May return -1 if no replicates have been logged.
+  // available logs, including the archived segments. May return -1 if no
+  // replicates have been logged.
   int64_t GetMinReplicateIndex() const;
 
   // Return a readable segment with the given sequence number, or NULL if it
-  // cannot be found (e.g. if it has already been GCed).
+  // cannot be found (e.g. if it has already been GCed). Segments which were
+  // GCed to the archive are still found. Waits for the older
+  // segments of a lazily opened log if the segment may be one of them.
   scoped_refptr<ReadableLogSegment> GetSegmentBySequenceNumber(
       int64_t seq) const;
 
   // Copies a snapshot of the current sequence of segments into 'segments'.
-  // 'segments' will be cleared first.
+  // 'segments' will be cleared first. Waits for the older segments of a
+  // lazily opened log.
   Status GetSegmentsSnapshot(SegmentSequence* segments) const;
 
+  // Returns the number of segments which were GCed to the archive and are
+  // still readable, see --log_archive_dir.
+  int num_archived_segments() const;
+
   // Reads all ReplicateMsgs from 'starting_at' to 'up_to' both inclusive.
   // The caller takes ownership of the returned ReplicateMsg objects.
   //
@@ -107,14 +127,30 @@ class LogReader : public enable_make_shared<LogReader> {
       std::vector<consensus::ReplicateMsg*>* replicates) const;
   static const int64_t kNoSizeLimit;
 
+  // Makes ReadReplicatesInRange() and SequentialReplicateReader go through
+  // 'scheduler' as catch-up reads. 'scheduler' must outlive the reader. Must
+  // be called before the reader is shared with other threads.
+  void set_io_scheduler(fs::IOScheduler* scheduler) {
+    io_scheduler_ = scheduler;
+  }
+
   // Look up the OpId for the given operation index.
   // Returns a bad Status if the log index fails to load (eg. due to an IO
   // error).
   Status LookupOpId(int64_t op_index, consensus::OpId* op_id) const;
 
+  // Adds an index entry for every REPLICATE message in 'segment' to 'index'.
+  // Used to build the index of segments which were not written by the local
+  // log, e.g. because they were copied from another server.
+  static Status IndexSegment(ReadableLogSegment* segment, LogIndex* index);
+
   // Returns the number of segments.
   const int num_segments() const;
 
+  // Returns the sequence number of the last segment, or -1 if there are none.
+  // Does not wait for the older segments of a lazily opened log.
+  int64_t GetLastSegmentSequenceNumber() const;
+
   std::string ToString() const;
 
  protected:
@@ -128,6 +164,7 @@ class LogReader : public enable_make_shared<LogReader> {
   FRIEND_TEST(LogTestOptionalCompression, TestLogReader);
   FRIEND_TEST(LogTestOptionalCompression, TestReadLogWithReplacedReplicates);
   friend class Log;
+  friend class SequentialReplicateReader;
   friend class LogTest;
   friend class LogTestOptionalCompression;
 
@@ -147,6 +184,24 @@ class LogReader : public enable_make_shared<LogReader> {
   // 'segment_sequence_number' from this reader.
   Status TrimSegmentsUpToAndIncluding(int64_t segment_sequence_number);
 
+  // Adds 'segment', which was GCed from this reader and moved to the archive,
+  // to the archived segments preceding 'segments_'. Keeps at most
+  // 'max_segments' of them, or all of them if 'max_segments' is 0; the ones
+  // evicted, including any which are no longer contiguous with 'segment', are
+  // moved to 'evicted' for the caller to delete.
+  void AddArchivedSegment(
+      const scoped_refptr<ReadableLogSegment>& segment,
+      int max_segments,
+      SegmentSequence* evicted);
+
+  // Replaces the segment with the same sequence number as 'segment', which
+  // must be one of 'segments_', with 'segment'. Used once a sealed segment
+  // was rewritten at its path. Returns NotFound if it was GCed.
+  //
+  // Requires 'rewrite_lock_' to be held for writing.
+  Status ReplaceRewrittenSegment(
+      const scoped_refptr<ReadableLogSegment>& segment);
+
   // Replaces the last segment in the reader with 'segment'.
   // Used to replace a segment that was still in the process of being written
   // with its complete version which has a footer and index entries.
@@ -176,9 +231,47 @@ class LogReader : public enable_make_shared<LogReader> {
       faststring* tmp_buf,
       std::unique_ptr<LogEntryBatchPB>* batch) const;
 
+  // Entry batches, by segment sequence number and offset in the segment.
+  typedef std::map<
+      std::pair<int64_t, int64_t>,
+      std::unique_ptr<LogEntryBatchPB>>
+      BatchesByLocation;
+
+  // Reads the entry batches of the ops from 'starting_at' on, up to 'up_to',
+  // into 'batches', with up to --log_reader_async_read_depth reads in flight
+  // through 'async_env'. Stops at a mapped segment, whose batches are parsed
+  // in place, or once the batches add up to 'max_bytes_to_read', if positive.
+  // A batch which can't be read is left out, to be read again, and have its
+  // error reported, by ReadBatchUsingIndexEntry().
+  void ReadBatchesAhead(
+      int64_t starting_at,
+      int64_t up_to,
+      int64_t max_bytes_to_read,
+      AsyncEnv* async_env,
+      BatchesByLocation* batches) const;
+
   // Reads the headers of all segments in 'tablet_wal_path'.
+  //
+  // With --log_reader_lazy_open, only the most recent segments are opened
+  // before returning, and the older ones are opened by a background thread.
   Status Init(const std::string& tablet_wal_path);
 
+  // Opens the segments at 'segment_paths' into 'segments', sorted by sequence
+  // number. Skips the segments which were left uninitialized by a crash.
+  Status OpenSegments(
+      const std::vector<std::string>& segment_paths,
+      SegmentSequence* segments);
+
+  // Opens 'older_segment_paths_' and puts them in front of 'segments_'.
+  // Run by 'older_segments_thread_'.
+  void OpenOlderSegments(double tail_open_millis);
+
+  // Waits until the older segments of a lazily opened log are open.
+  void WaitForOlderSegments() const;
+
+  scoped_refptr<ReadableLogSegment> GetSegmentBySequenceNumberUnlocked(
+      int64_t seq) const;
+
   // Initializes an 'empty' reader for tests, i.e. does not scan a path looking
   // for segments.
   Status InitEmptyReaderForTests();
@@ -187,22 +280,96 @@ class LogReader : public enable_make_shared<LogReader> {
   const scoped_refptr<LogIndex> log_index_;
   const std::string tablet_id_;
 
+  // Arbitrates the catch-up reads, if set. See set_io_scheduler().
+  fs::IOScheduler* io_scheduler_;
+
   // Metrics
   scoped_refptr<Counter> bytes_read_;
   scoped_refptr<Counter> entries_read_;
   scoped_refptr<Histogram> read_batch_latency_;
+  scoped_refptr<AtomicGauge<int64_t>> init_time_;
 
   // The sequence of all current log segments in increasing sequence number
   // order.
   SegmentSequence segments_;
 
+  // The contiguous sequence of GCed segments which were moved to the archive
+  // and still precede 'segments_', in increasing sequence number order.
+  SegmentSequence archived_segments_;
+
   mutable simple_spinlock lock_;
 
+  // Held for reading by the reads which look an op up in the log index and
+  // then read it from its segment, and for writing while a segment and its
+  // index entries are replaced, so that both always agree.
+  mutable RWMutex rewrite_lock_;
+
+  // The segments left to open in the background by a lazy Init(), and the
+  // thread opening them.
+  std::vector<std::string> older_segment_paths_;
+  scoped_refptr<Thread> older_segments_thread_;
+
+  // Counted down once the older segments are open, or failed to open.
+  CountDownLatch older_segments_opened_;
+
   State state_;
 
   DISALLOW_COPY_AND_ASSIGN(LogReader);
 };
 
+// Reads REPLICATE messages in index order from the closed segments of a log,
+// keeping its position in between calls. Unlike
+// LogReader::ReadReplicatesInRange(), which looks every op up in the log index
+// and reads the batch containing it, this scans the segments sequentially, so
+// that a peer which is far behind can be caught up with a few large reads.
+// These go through a read-ahead buffer, see LogReadAheadBuffer.
+//
+// This class is not thread safe.
+class SequentialReplicateReader {
+ public:
+  explicit SequentialReplicateReader(std::shared_ptr<LogReader> reader);
+  ~SequentialReplicateReader();
+
+  // Reads the ReplicateMsgs from 'starting_at' to 'up_to' both inclusive, with
+  // the same size limit semantics as LogReader::ReadReplicatesInRange(). The
+  // caller takes ownership of the returned ReplicateMsg objects.
+  //
+  // Stops early, possibly without reading anything, once it reaches the
+  // segment currently being written to, or ops which were replaced later in
+  // the log; the rest is left to ReadReplicatesInRange(). Returns NotFound if
+  // 'starting_at' was GCed.
+  Status ReadReplicates(
+      int64_t starting_at,
+      int64_t up_to,
+      int64_t max_bytes_to_read,
+      std::vector<consensus::ReplicateMsg*>* replicates);
+
+ private:
+  // Positions the reader at the batch containing op 'index'.
+  Status Seek(int64_t index);
+
+  void Reset();
+
+  const std::shared_ptr<LogReader> reader_;
+
+  // The segment being read and the reader over it, or NULL if the reader
+  // needs to seek before reading.
+  scoped_refptr<ReadableLogSegment> segment_;
+  std::unique_ptr<LogEntryReader> entry_reader_;
+
+  // Reused by the readers of all the segments, see
+  // --log_sequential_read_buffer_bytes. NULL if disabled.
+  std::unique_ptr<LogReadAheadBuffer> read_buffer_;
+
+  // An entry which was read but did not fit in the previous call.
+  std::unique_ptr<LogEntryPB> pending_entry_;
+
+  // The index of the next op this reader returns, if positioned.
+  int64_t next_index_;
+
+  DISALLOW_COPY_AND_ASSIGN(SequentialReplicateReader);
+};
+
 } // namespace log
 } // namespace kudu
 
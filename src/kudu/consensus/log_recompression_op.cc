@@ -0,0 +1,109 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/log_recompression_op.h"
+
+#include <string>
+#include <utility>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/consensus/log.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/status.h"
+
+DEFINE_int32(
+    log_recompression_segments_per_op,
+    4,
+    "The maximum number of WAL segments recompressed by one run of the log "
+    "recompression maintenance op.");
+TAG_FLAG(log_recompression_segments_per_op, experimental);
+TAG_FLAG(log_recompression_segments_per_op, runtime);
+
+METRIC_DEFINE_histogram(
+    server,
+    log_recompression_duration,
+    "Log Recompression Duration",
+    kudu::MetricUnit::kMilliseconds,
+    "Time spent recompressing sealed log segments",
+    60000LU,
+    1);
+
+METRIC_DEFINE_gauge_uint32(
+    server,
+    log_recompression_running,
+    "Log Recompressions Running",
+    kudu::MetricUnit::kMaintenanceOperations,
+    "Number of log recompression operations currently running");
+
+using strings::Substitute;
+
+namespace kudu {
+namespace log {
+
+LogRecompressionOp::LogRecompressionOp(
+    scoped_refptr<Log> log,
+    const scoped_refptr<MetricEntity>& metric_entity)
+    : MaintenanceOp(
+          Substitute("LogRecompressionOp($0)", log->tablet_id()),
+          MaintenanceOp::HIGH_IO_USAGE),
+      log_(std::move(log)),
+      duration_(METRIC_log_recompression_duration.Instantiate(metric_entity)),
+      running_(
+          METRIC_log_recompression_running.Instantiate(metric_entity, 0)),
+      sem_(1) {}
+
+void LogRecompressionOp::UpdateStats(MaintenanceOpStats* stats) {
+  const int64_t recompressible_bytes = log_->GetRecompressibleDataSize();
+  stats->set_runnable(recompressible_bytes > 0 && sem_.GetValue() == 1);
+  // Recompressing saves disk space and catch-up read bandwidth, but nothing
+  // depends on it, so it only runs when there is nothing better to do.
+  stats->set_perf_improvement(
+      static_cast<double>(recompressible_bytes) / (1024 * 1024 * 1024));
+}
+
+bool LogRecompressionOp::Prepare() {
+  return sem_.try_lock();
+}
+
+void LogRecompressionOp::Perform() {
+  int64_t bytes_saved;
+  Status s = log_->RecompressSegments(
+      FLAGS_log_recompression_segments_per_op, &bytes_saved);
+  if (s.ok()) {
+    VLOG(1) << "T " << log_->tablet_id() << ": log recompression saved "
+            << bytes_saved << " bytes";
+  } else {
+    LOG(WARNING) << "T " << log_->tablet_id()
+                 << ": log recompression failed: " << s.ToString();
+  }
+  sem_.unlock();
+}
+
+scoped_refptr<Histogram> LogRecompressionOp::DurationHistogram() const {
+  return duration_;
+}
+
+scoped_refptr<AtomicGauge<uint32_t>> LogRecompressionOp::RunningGauge()
+    const {
+  return running_;
+}
+
+} // namespace log
+} // namespace kudu
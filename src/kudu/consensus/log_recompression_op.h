@@ -0,0 +1,68 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/maintenance_manager.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/semaphore.h"
+
+namespace kudu {
+
+template <typename T>
+class AtomicGauge;
+class Histogram;
+class MetricEntity;
+
+namespace log {
+
+class Log;
+
+// Maintenance op recompressing the sealed segments of a log in the background
+// with --log_recompression_codec, see Log::RecompressSegments(). Only one
+// instance of it runs at a time.
+class LogRecompressionOp : public MaintenanceOp {
+ public:
+  LogRecompressionOp(
+      scoped_refptr<Log> log,
+      const scoped_refptr<MetricEntity>& metric_entity);
+
+  void UpdateStats(MaintenanceOpStats* stats) override;
+
+  bool Prepare() override;
+
+  void Perform() override;
+
+  scoped_refptr<Histogram> DurationHistogram() const override;
+
+  scoped_refptr<AtomicGauge<uint32_t>> RunningGauge() const override;
+
+ private:
+  const scoped_refptr<Log> log_;
+  scoped_refptr<Histogram> duration_;
+  scoped_refptr<AtomicGauge<uint32_t>> running_;
+  Semaphore sem_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogRecompressionOp);
+};
+
+} // namespace log
+} // namespace kudu
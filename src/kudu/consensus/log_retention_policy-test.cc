@@ -0,0 +1,147 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/log_retention_policy.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/util/monotime.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_int32(log_retention_peer_unavailable_s);
+DECLARE_int64(fs_wal_dir_reserved_bytes);
+DECLARE_int64(log_retention_max_catchup_bytes);
+DECLARE_int64(log_retention_min_free_bytes);
+
+using std::string;
+using std::vector;
+
+namespace kudu {
+namespace consensus {
+
+class LogRetentionPolicyTest : public KuduTest {
+ public:
+  void SetUp() override {
+    KuduTest::SetUp();
+    FLAGS_fs_wal_dir_reserved_bytes = 0;
+    FLAGS_log_retention_min_free_bytes = 0;
+    // Three sealed segments of 100 bytes each, ending at indexes 100, 200 and
+    // 300. Everything is committed.
+    replay_size_ = {{100, 300}, {200, 200}, {300, 100}};
+    peers_ = {
+        MakePeer("a", 250, 1),
+        MakePeer("c", 50, 1),
+        MakePeer("b", 150, 1),
+    };
+  }
+
+ protected:
+  static PeerLag MakePeer(const string& uuid, int64_t index, int seen_s) {
+    PeerLag peer;
+    peer.uuid = uuid;
+    peer.last_received_index = index;
+    peer.time_since_last_exchange = MonoDelta::FromSeconds(seen_s);
+    return peer;
+  }
+
+  LogRetentionDecision Decide(int64_t free_bytes) {
+    return DecideLogRetention(
+        replay_size_, 350, free_bytes, 1000, peers_, 300);
+  }
+
+  std::map<int64_t, int64_t> replay_size_;
+  vector<PeerLag> peers_;
+};
+
+TEST_F(LogRetentionPolicyTest, TestRetainsForAllPeers) {
+  LogRetentionDecision d = Decide(-1);
+  SCOPED_TRACE(d.ToString());
+  EXPECT_EQ(50, d.for_peers);
+  EXPECT_EQ(300, d.held_bytes);
+  EXPECT_EQ(0, d.num_abandoned_peers);
+  ASSERT_EQ(3, d.peers.size());
+  EXPECT_EQ("a", d.peers[0].uuid);
+  EXPECT_EQ(100, d.peers[0].held_bytes);
+  EXPECT_EQ("b", d.peers[1].uuid);
+  EXPECT_EQ(200, d.peers[1].held_bytes);
+  EXPECT_EQ("c", d.peers[2].uuid);
+  EXPECT_EQ(300, d.peers[2].held_bytes);
+}
+
+TEST_F(LogRetentionPolicyTest, TestAbandonsUnavailablePeers) {
+  FLAGS_log_retention_peer_unavailable_s = 60;
+  peers_[1].time_since_last_exchange = MonoDelta::FromSeconds(120);
+  LogRetentionDecision d = Decide(-1);
+  SCOPED_TRACE(d.ToString());
+  EXPECT_EQ(150, d.for_peers);
+  EXPECT_EQ(200, d.held_bytes);
+  EXPECT_EQ(1, d.num_abandoned_peers);
+  EXPECT_FALSE(d.peers[2].retained);
+}
+
+TEST_F(LogRetentionPolicyTest, TestAbandonsExpensiveCatchUps) {
+  FLAGS_log_retention_max_catchup_bytes = 150;
+  LogRetentionDecision d = Decide(-1);
+  SCOPED_TRACE(d.ToString());
+  EXPECT_EQ(250, d.for_peers);
+  EXPECT_EQ(2, d.num_abandoned_peers);
+}
+
+TEST_F(LogRetentionPolicyTest, TestDiskPressure) {
+  // The segments currently held for peers count towards the budget, as they
+  // would be freed by not retaining them anymore.
+  LogRetentionDecision d = Decide(0);
+  SCOPED_TRACE(d.ToString());
+  EXPECT_EQ(300, d.budget_bytes);
+  EXPECT_EQ(50, d.for_peers);
+
+  FLAGS_log_retention_min_free_bytes = 150;
+  d = Decide(0);
+  EXPECT_EQ(150, d.budget_bytes);
+  EXPECT_EQ(250, d.for_peers);
+  EXPECT_EQ(100, d.held_bytes);
+  EXPECT_EQ(2, d.num_abandoned_peers);
+
+  // 1% of the capacity is reserved by default.
+  FLAGS_log_retention_min_free_bytes = 0;
+  FLAGS_fs_wal_dir_reserved_bytes = -1;
+  d = Decide(0);
+  EXPECT_EQ(290, d.budget_bytes);
+  EXPECT_EQ(150, d.for_peers);
+}
+
+TEST_F(LogRetentionPolicyTest, TestFollowerKeepsAllReplicatedIndex) {
+  peers_.clear();
+  LogRetentionDecision d = DecideLogRetention(
+      replay_size_, 350, -1, 1000, peers_, 120);
+  EXPECT_EQ(120, d.for_peers);
+  EXPECT_EQ(200, d.held_bytes);
+
+  FLAGS_log_retention_min_free_bytes = 1000;
+  d = DecideLogRetention(replay_size_, 350, 0, 1000, peers_, 120);
+  EXPECT_EQ(INT64_MAX, d.for_peers);
+  EXPECT_EQ(1, d.num_abandoned_peers);
+}
+
+} // namespace consensus
+} // namespace kudu
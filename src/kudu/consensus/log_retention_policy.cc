@@ -0,0 +1,188 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/log_retention_policy.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gflags/gflags.h>
+
+#include "kudu/gutil/strings/join.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/flag_tags.h"
+
+DEFINE_int32(
+    log_retention_peer_unavailable_s,
+    3600,
+    "Peers which have not been successfully contacted for longer than this "
+    "many seconds are considered gone and the WAL is no longer retained to "
+    "catch them up. Only used with --log_retention_policy_enabled. A value "
+    "of 0 or less disables this check.");
+TAG_FLAG(log_retention_peer_unavailable_s, runtime);
+TAG_FLAG(log_retention_peer_unavailable_s, experimental);
+
+DEFINE_int64(
+    log_retention_max_catchup_bytes,
+    -1,
+    "The WAL is not retained for peers which would need to read more than "
+    "this many bytes of it to catch up, as copying the replica is expected to "
+    "be cheaper. Only used with --log_retention_policy_enabled. A value of -1 "
+    "means no limit.");
+TAG_FLAG(log_retention_max_catchup_bytes, runtime);
+TAG_FLAG(log_retention_max_catchup_bytes, experimental);
+
+DEFINE_int64(
+    log_retention_min_free_bytes,
+    1024L * 1024 * 1024,
+    "Number of bytes to keep free on the WAL filesystem, on top of "
+    "--fs_wal_dir_reserved_bytes, when retaining the WAL for lagging peers. "
+    "Only used with --log_retention_policy_enabled.");
+DEFINE_validator(
+    log_retention_min_free_bytes,
+    [](const char* /*n*/, int64_t v) { return v >= 0; });
+TAG_FLAG(log_retention_min_free_bytes, runtime);
+TAG_FLAG(log_retention_min_free_bytes, experimental);
+
+DECLARE_int64(fs_wal_dir_reserved_bytes);
+
+using std::string;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace consensus {
+
+namespace {
+
+// Returns the bytes of the segments retained when retaining 'index', see
+// GetPrefixSizeToGC() in log.cc.
+int64_t RetainedBytes(
+    const std::map<int64_t, int64_t>& replay_size,
+    int64_t index) {
+  auto it = replay_size.lower_bound(index);
+  return it == replay_size.end() ? 0 : it->second;
+}
+
+} // anonymous namespace
+
+string LogRetentionDecision::ToString() const {
+  vector<string> peer_strs;
+  peer_strs.reserve(peers.size());
+  for (const auto& p : peers) {
+    peer_strs.push_back(Substitute(
+        "$0: index $1, $2 bytes, $3",
+        p.uuid,
+        p.last_received_index,
+        p.held_bytes,
+        p.reason));
+  }
+  return Substitute(
+      "for_peers: $0, budget: $1 bytes, held: $2 bytes, "
+      "abandoned peers: $3, peers: [$4]",
+      for_peers,
+      budget_bytes,
+      held_bytes,
+      num_abandoned_peers,
+      JoinStrings(peer_strs, ", "));
+}
+
+LogRetentionDecision DecideLogRetention(
+    const std::map<int64_t, int64_t>& replay_size,
+    int64_t for_durability,
+    int64_t free_bytes,
+    int64_t capacity_bytes,
+    const vector<PeerLag>& peers,
+    int64_t fallback_for_peers) {
+  LogRetentionDecision decision;
+  const int64_t durable_bytes = RetainedBytes(replay_size, for_durability);
+
+  if (free_bytes >= 0) {
+    int64_t reserved = FLAGS_fs_wal_dir_reserved_bytes;
+    if (reserved == -1) {
+      reserved = capacity_bytes / 100;
+    }
+    // The segments currently held for peers would be freed if they weren't
+    // retained anymore, so they count towards the budget.
+    int64_t held_now = replay_size.empty()
+        ? 0
+        : std::max<int64_t>(
+              0, replay_size.begin()->second - durable_bytes);
+    decision.budget_bytes = std::max<int64_t>(
+        0,
+        free_bytes + held_now - reserved - FLAGS_log_retention_min_free_bytes);
+  }
+
+  vector<PeerLag> sorted_peers = peers;
+  if (sorted_peers.empty()) {
+    PeerLag all_replicated;
+    all_replicated.uuid = "<all replicated>";
+    all_replicated.last_received_index = fallback_for_peers;
+    all_replicated.time_since_last_exchange = MonoDelta::FromSeconds(0);
+    sorted_peers.push_back(std::move(all_replicated));
+  }
+  std::sort(
+      sorted_peers.begin(),
+      sorted_peers.end(),
+      [](const PeerLag& a, const PeerLag& b) {
+        return a.last_received_index > b.last_received_index;
+      });
+
+  const MonoDelta unavailable_timeout =
+      MonoDelta::FromSeconds(FLAGS_log_retention_peer_unavailable_s);
+  for (const auto& peer : sorted_peers) {
+    PeerRetention r;
+    r.uuid = peer.uuid;
+    r.last_received_index = peer.last_received_index;
+    int64_t catchup_bytes =
+        RetainedBytes(replay_size, peer.last_received_index);
+    r.held_bytes = std::max<int64_t>(0, catchup_bytes - durable_bytes);
+    r.retained = false;
+    if (FLAGS_log_retention_peer_unavailable_s > 0 &&
+        peer.time_since_last_exchange > unavailable_timeout) {
+      r.reason = Substitute(
+          "abandoned, unavailable for $0",
+          peer.time_since_last_exchange.ToString());
+    } else if (
+        FLAGS_log_retention_max_catchup_bytes >= 0 &&
+        catchup_bytes > FLAGS_log_retention_max_catchup_bytes) {
+      r.reason = "abandoned, catching up from the WAL costs more than "
+                 "--log_retention_max_catchup_bytes";
+    } else if (
+        decision.budget_bytes >= 0 && r.held_bytes > decision.budget_bytes) {
+      r.reason = "abandoned, does not fit on the WAL disk";
+    } else {
+      r.retained = true;
+      r.reason = "retained";
+      decision.for_peers =
+          std::min(decision.for_peers, peer.last_received_index);
+      decision.held_bytes = std::max(decision.held_bytes, r.held_bytes);
+    }
+    if (!r.retained) {
+      decision.num_abandoned_peers++;
+    }
+    decision.peers.push_back(std::move(r));
+  }
+  return decision;
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,106 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "kudu/util/monotime.h"
+
+namespace kudu {
+namespace consensus {
+
+// How far behind a peer of the leader is, as seen by the leader's queue. See
+// PeerMessageQueue::GetPeerLag().
+struct PeerLag {
+  std::string uuid;
+
+  // The index of the last operation the peer has received. The peer needs the
+  // operations after it to catch up.
+  int64_t last_received_index;
+
+  // Time since the last successful exchange with the peer.
+  MonoDelta time_since_last_exchange;
+};
+
+// The retention decided for one peer.
+struct PeerRetention {
+  std::string uuid;
+  int64_t last_received_index;
+
+  // Bytes of WAL kept only to catch this peer up, i.e. beyond what is needed
+  // for durability.
+  int64_t held_bytes;
+
+  // Whether the WAL is retained for the peer.
+  bool retained;
+
+  // Why the WAL is or isn't retained for the peer.
+  std::string reason;
+};
+
+// The outcome of a run of DecideLogRetention().
+struct LogRetentionDecision {
+  // The index to pass as RetentionIndexes::for_peers.
+  int64_t for_peers = INT64_MAX;
+
+  // Bytes of WAL which may be used to retain segments for peers, or -1 if the
+  // free space of the WAL directory is unknown.
+  int64_t budget_bytes = -1;
+
+  // Bytes of WAL held for the retained peers.
+  int64_t held_bytes = 0;
+
+  // The peers the WAL isn't retained for.
+  int num_abandoned_peers = 0;
+
+  // One entry per peer, from the least to the most lagging one.
+  std::vector<PeerRetention> peers;
+
+  std::string ToString() const;
+};
+
+// Decides up to which index the WAL is retained to catch up lagging peers,
+// instead of relying only on fixed segment counts. Peers are considered from
+// the least to the most lagging one and the WAL is retained for a peer if:
+//  - it was successfully contacted less than
+//    --log_retention_peer_unavailable_s ago, so it is likely to come back,
+//  - catching it up from the WAL reads at most
+//    --log_retention_max_catchup_bytes, beyond which copying the replica is
+//    cheaper, and
+//  - the bytes held for it fit in the space left on the WAL disk, leaving
+//    --fs_wal_dir_reserved_bytes and --log_retention_min_free_bytes free.
+//
+// 'replay_size' is as returned by Log::GetReplaySizeMap(). 'for_durability' is
+// the index retained regardless of the peers. 'free_bytes' and
+// 'capacity_bytes' describe the WAL filesystem, with 'free_bytes' -1 if
+// unknown. 'peers' is empty on a follower, in which case 'fallback_for_peers'
+// (the all-replicated index learned from the leader) is kept unless it doesn't
+// fit on the disk.
+LogRetentionDecision DecideLogRetention(
+    const std::map<int64_t, int64_t>& replay_size,
+    int64_t for_durability,
+    int64_t free_bytes,
+    int64_t capacity_bytes,
+    const std::vector<PeerLag>& peers,
+    int64_t fallback_for_peers);
+
+} // namespace consensus
+} // namespace kudu
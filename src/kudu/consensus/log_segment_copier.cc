@@ -0,0 +1,213 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/log_segment_copier.h"
+
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/common/wire_protocol.h"
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/consensus.proxy.h"
+#include "kudu/consensus/log_index.h"
+#include "kudu/consensus/log_reader.h"
+#include "kudu/consensus/log_util.h"
+#include "kudu/fs/fs_manager.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/strings/util.h"
+#include "kudu/rpc/rpc_controller.h"
+#include "kudu/util/crc.h"
+#include "kudu/util/env.h"
+#include "kudu/util/env_util.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/path_util.h"
+#include "kudu/util/scoped_cleanup.h"
+#include "kudu/util/slice.h"
+
+DEFINE_int32(
+    wal_copy_rpc_timeout_ms,
+    30000,
+    "Timeout of the RPCs which copy the WAL segments of a tablet from another "
+    "server.");
+TAG_FLAG(wal_copy_rpc_timeout_ms, advanced);
+
+using kudu::log::LogIndex;
+using kudu::log::LogReader;
+using kudu::log::ReadableLogSegment;
+using kudu::rpc::RpcController;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace consensus {
+
+LogSegmentCopier::LogSegmentCopier(
+    FsManager* fs_manager,
+    string tablet_id,
+    string source_uuid,
+    shared_ptr<ConsensusServiceProxy> proxy)
+    : fs_manager_(fs_manager),
+      tablet_id_(std::move(tablet_id)),
+      source_uuid_(std::move(source_uuid)),
+      proxy_(std::move(proxy)) {}
+
+LogSegmentCopier::~LogSegmentCopier() {}
+
+Status LogSegmentCopier::CopyAll(int64_t* last_index) {
+  Env* env = fs_manager_->env();
+  const string wal_dir = fs_manager_->GetTabletWalDir(tablet_id_);
+  RETURN_NOT_OK(env_util::CreateDirIfMissing(env, wal_dir));
+  vector<string> children;
+  RETURN_NOT_OK(env->GetChildren(wal_dir, &children));
+  for (const string& child : children) {
+    if (HasPrefixString(child, FsManager::kWalFileNamePrefix)) {
+      return Status::IllegalState(
+          "WAL directory already has log segments", wal_dir);
+    }
+  }
+
+  ListLogSegmentsRequestPB req;
+  req.set_dest_uuid(source_uuid_);
+  req.set_tablet_id(tablet_id_);
+  ListLogSegmentsResponsePB resp;
+  RpcController controller;
+  controller.set_timeout(
+      MonoDelta::FromMilliseconds(FLAGS_wal_copy_rpc_timeout_ms));
+  RETURN_NOT_OK_PREPEND(
+      proxy_->ListLogSegments(req, &resp, &controller),
+      "Failed to list the log segments of the source");
+  if (resp.has_error()) {
+    return StatusFromPB(resp.error().status())
+        .CloneAndPrepend("Failed to list the log segments of the source");
+  }
+
+  scoped_refptr<LogIndex> index(new LogIndex(wal_dir));
+  *last_index = -1;
+  int64_t bytes_copied = 0;
+  for (int i = 0; i < resp.segments_size(); i++) {
+    const LogSegmentInfoPB& info = resp.segments(i);
+    // The log expects a contiguous sequence of segments.
+    if (i > 0 &&
+        info.sequence_number() != resp.segments(i - 1).sequence_number() + 1) {
+      return Status::IllegalState(Substitute(
+          "Log segment $0 follows log segment $1 on the source",
+          info.sequence_number(),
+          resp.segments(i - 1).sequence_number()));
+    }
+    RETURN_NOT_OK(CopySegment(info, index));
+    if (info.has_max_replicate_index()) {
+      *last_index = info.max_replicate_index();
+    }
+    bytes_copied += info.size_bytes();
+  }
+  RETURN_NOT_OK(env->SyncDir(wal_dir));
+
+  LOG(INFO) << "T " << tablet_id_ << ": copied " << resp.segments_size()
+            << " log segments (" << bytes_copied << " bytes) from "
+            << source_uuid_ << ", up to op index " << *last_index;
+  return Status::OK();
+}
+
+Status LogSegmentCopier::CopySegment(
+    const LogSegmentInfoPB& info,
+    const scoped_refptr<LogIndex>& index) {
+  Env* env = fs_manager_->env();
+  const string path =
+      fs_manager_->GetWalSegmentFileName(tablet_id_, info.sequence_number());
+  // The temporary file must not look like a segment to the log reader.
+  const string tmp_path = JoinPathSegments(
+      DirName(path), Substitute("$0.$1", kTmpInfix, BaseName(path)));
+
+  unique_ptr<WritableFile> file;
+  RETURN_NOT_OK(env->NewWritableFile(tmp_path, &file));
+  auto delete_tmp_file = MakeScopedCleanup([&]() {
+    WARN_NOT_OK(
+        env->DeleteFile(tmp_path),
+        Substitute("Could not delete temporary file $0", tmp_path));
+  });
+
+  FetchLogSegmentRequestPB req;
+  req.set_dest_uuid(source_uuid_);
+  req.set_tablet_id(tablet_id_);
+  req.set_sequence_number(info.sequence_number());
+  int64_t offset = 0;
+  while (offset < info.size_bytes()) {
+    req.set_offset(offset);
+    FetchLogSegmentResponsePB resp;
+    RpcController controller;
+    controller.set_timeout(
+        MonoDelta::FromMilliseconds(FLAGS_wal_copy_rpc_timeout_ms));
+    const string error_prefix = Substitute(
+        "Failed to fetch log segment $0 at offset $1",
+        info.sequence_number(),
+        offset);
+    RETURN_NOT_OK_PREPEND(
+        proxy_->FetchLogSegment(req, &resp, &controller), error_prefix);
+    if (resp.has_error()) {
+      return StatusFromPB(resp.error().status()).CloneAndPrepend(error_prefix);
+    }
+    if (resp.size_bytes() != info.size_bytes()) {
+      return Status::IllegalState(
+          error_prefix,
+          Substitute(
+              "segment size changed from $0 to $1 bytes",
+              info.size_bytes(),
+              resp.size_bytes()));
+    }
+    Slice data;
+    RETURN_NOT_OK_PREPEND(
+        controller.GetInboundSidecar(resp.data_sidecar_idx(), &data),
+        error_prefix);
+    if (data.empty()) {
+      return Status::IllegalState(error_prefix, "no data returned");
+    }
+    if (crc::Crc32c(data.data(), data.size()) != resp.data_crc32()) {
+      return Status::Corruption(error_prefix, "checksum mismatch");
+    }
+    RETURN_NOT_OK(file->Append(data));
+    offset += data.size();
+  }
+  RETURN_NOT_OK(file->Sync());
+  RETURN_NOT_OK(file->Close());
+
+  // Build the index before the segment is renamed into place: a segment
+  // without its index entries would not be readable by the log.
+  scoped_refptr<ReadableLogSegment> segment;
+  RETURN_NOT_OK(ReadableLogSegment::Open(env, tmp_path, &segment));
+  if (!segment->HasFooter()) {
+    // The source rebuilt the footer in memory after a crash, but never wrote
+    // it out.
+    RETURN_NOT_OK(segment->RebuildFooterByScanning());
+  }
+  RETURN_NOT_OK_PREPEND(
+      LogReader::IndexSegment(segment.get(), index.get()),
+      Substitute("Failed to index log segment $0", info.sequence_number()));
+  RETURN_NOT_OK(env->RenameFile(tmp_path, path));
+  delete_tmp_file.cancel();
+  return Status::OK();
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,83 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#ifndef KUDU_CONSENSUS_LOG_SEGMENT_COPIER_H
+#define KUDU_CONSENSUS_LOG_SEGMENT_COPIER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+class FsManager;
+
+namespace log {
+class LogIndex;
+} // namespace log
+
+namespace consensus {
+
+class ConsensusServiceProxy;
+class LogSegmentInfoPB;
+
+// Copies the sealed WAL segments of a tablet from another server into the
+// local WAL directory of the tablet, and builds their log index. This lets a
+// new replica start with the log of an existing one, at the cost of sequential
+// disk reads, rather than being sent every op by the leader.
+//
+// Segments are fetched in chunks of up to --wal_copy_max_chunk_bytes of the
+// source. Each one is written to a temporary file which is only renamed into
+// place once complete and synced, so an interrupted copy never leaves a
+// partial segment behind.
+//
+// This class is not thread safe.
+class LogSegmentCopier {
+ public:
+  // 'source_uuid' is the permanent uuid of the server behind 'proxy'.
+  LogSegmentCopier(
+      FsManager* fs_manager,
+      std::string tablet_id,
+      std::string source_uuid,
+      std::shared_ptr<ConsensusServiceProxy> proxy);
+  ~LogSegmentCopier();
+
+  // Copies all the sealed segments of the source. The local WAL directory of
+  // the tablet must not have any segment yet. The index of the last op copied
+  // is returned in 'last_index', or -1 if the source had no sealed segment.
+  Status CopyAll(int64_t* last_index);
+
+ private:
+  Status CopySegment(
+      const LogSegmentInfoPB& info,
+      const scoped_refptr<log::LogIndex>& index);
+
+  FsManager* const fs_manager_;
+  const std::string tablet_id_;
+  const std::string source_uuid_;
+  const std::shared_ptr<ConsensusServiceProxy> proxy_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogSegmentCopier);
+};
+
+} // namespace consensus
+} // namespace kudu
+
+#endif // KUDU_CONSENSUS_LOG_SEGMENT_COPIER_H
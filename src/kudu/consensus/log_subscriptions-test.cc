@@ -0,0 +1,343 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/log_subscriptions.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/clock/clock.h"
+#include "kudu/clock/hybrid_clock.h"
+#include "kudu/consensus/consensus-test-util.h"
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/log.h"
+#include "kudu/consensus/log_cache.h"
+#include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/consensus/replicate_msg_wrapper.h"
+#include "kudu/fs/fs_manager.h"
+#include "kudu/gutil/bind.h"
+#include "kudu/gutil/gscoped_ptr.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/compression/compression_codec.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/scoped_cleanup.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+using std::atomic;
+using std::thread;
+using std::vector;
+
+DECLARE_bool(log_cache_compress_at_rest);
+DECLARE_int64(log_subscription_max_anchored_ops);
+
+namespace kudu {
+namespace consensus {
+
+METRIC_DECLARE_counter(raft_log_subscription_ops_read_from_log);
+METRIC_DECLARE_counter(raft_log_subscription_anchors_released);
+METRIC_DECLARE_counter(log_cache_uncompressed_hot_set_hits);
+METRIC_DECLARE_counter(log_cache_uncompressed_hot_set_misses);
+
+static const char* kPeerUuid = "leader";
+static const char* kTestTablet = "test-tablet";
+
+class LogSubscriptionsTest : public KuduTest {
+ public:
+  LogSubscriptionsTest()
+      : metric_entity_(METRIC_ENTITY_server.Instantiate(
+            &metric_registry_,
+            "LogSubscriptionsTest")),
+        committed_index_(0) {}
+
+  void SetUp() override {
+    KuduTest::SetUp();
+    fs_manager_.reset(new FsManager(env_, GetTestPath("fs_root")));
+    ASSERT_OK(fs_manager_->CreateInitialFileSystemLayout());
+    ASSERT_OK(fs_manager_->Open());
+    ASSERT_OK(log::Log::Open(
+        log::LogOptions(),
+        fs_manager_.get(),
+        kTestTablet,
+        nullptr,
+        &log_));
+    cache_.reset(
+        new LogCache(metric_entity_, log_.get(), kPeerUuid, kTestTablet));
+    cache_->Init(MinimumOpId());
+    clock_.reset(new clock::HybridClock());
+    ASSERT_OK(clock_->Init());
+
+    atomic<int64_t>* committed = &committed_index_;
+    subscriptions_.reset(new LogSubscriptionManager(
+        "",
+        cache_.get(),
+        [committed]() { return committed->load(); },
+        [committed](int64_t index, const MonoTime& deadline) {
+          while (committed->load() < index) {
+            if (MonoTime::Now() >= deadline) {
+              return Status::TimedOut("");
+            }
+            SleepFor(MonoDelta::FromMilliseconds(1));
+          }
+          return Status::OK();
+        },
+        metric_entity_));
+  }
+
+  void TearDown() override {
+    subscriptions_.reset();
+    log_->WaitUntilAllFlushed();
+  }
+
+ protected:
+  static void FatalOnError(const Status& s) {
+    CHECK_OK(s);
+  }
+
+  Status AppendReplicateMessagesToCache(int64_t first, int64_t count) {
+    for (int64_t index = first; index < first + count; index++) {
+      vector<ReplicateRefPtr> msgs;
+      msgs.push_back(make_scoped_refptr_replicate(
+          CreateDummyReplicate(1, index, clock_->Now(), kPayloadSize)
+              .release()));
+      RETURN_NOT_OK(cache_->AppendOperations(msgs, Bind(&FatalOnError)));
+    }
+    return Status::OK();
+  }
+
+  Status Read(
+      const std::string& name,
+      int64_t after_index,
+      int64_t max_bytes,
+      vector<ReplicateRefPtr>* ops,
+      bool uncompressed = false) {
+    ops->clear();
+    int64_t committed;
+    RETURN_NOT_OK(subscriptions_->Read(
+        name,
+        after_index,
+        max_bytes,
+        MonoDelta::FromMilliseconds(0),
+        uncompressed,
+        ops,
+        &committed));
+    EXPECT_EQ(committed_index_.load(), committed);
+    return Status::OK();
+  }
+
+  static void AssertOps(
+      int64_t first,
+      int64_t last,
+      const vector<ReplicateRefPtr>& ops) {
+    ASSERT_EQ(last - first + 1, ops.size());
+    for (int64_t i = 0; i < ops.size(); i++) {
+      ASSERT_EQ(first + i, ops[i]->get()->id().index());
+    }
+  }
+
+  static const int kPayloadSize = 10;
+
+  MetricRegistry metric_registry_;
+  scoped_refptr<MetricEntity> metric_entity_;
+  gscoped_ptr<FsManager> fs_manager_;
+  gscoped_ptr<LogCache> cache_;
+  scoped_refptr<log::Log> log_;
+  scoped_refptr<clock::Clock> clock_;
+  atomic<int64_t> committed_index_;
+  gscoped_ptr<LogSubscriptionManager> subscriptions_;
+};
+
+// Subscribers read the committed ops from the log cache, and anchor the log
+// from the last one they processed.
+TEST_F(LogSubscriptionsTest, TestReadCommittedOps) {
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 100));
+  committed_index_ = 50;
+  ASSERT_OK(subscriptions_->Subscribe("a", 0));
+  ASSERT_TRUE(subscriptions_->Subscribe("a", 0).IsAlreadyPresent());
+
+  vector<ReplicateRefPtr> ops;
+  ASSERT_OK(Read("a", 0, 1024 * 1024, &ops));
+  NO_FATALS(AssertOps(1, 50, ops));
+  // Nothing is committed past 50 yet.
+  ASSERT_OK(Read("a", 50, 1024 * 1024, &ops));
+  ASSERT_TRUE(ops.empty());
+  int64_t anchored;
+  ASSERT_OK(subscriptions_->GetEarliestAnchoredIndex(&anchored));
+  ASSERT_EQ(50, anchored);
+
+  // The reads are limited in size, but return at least one op.
+  committed_index_ = 100;
+  ASSERT_OK(Read("a", 50, 3 * kPayloadSize, &ops));
+  NO_FATALS(AssertOps(51, 53, ops));
+  ASSERT_OK(Read("a", 53, 1, &ops));
+  NO_FATALS(AssertOps(54, 54, ops));
+
+  vector<LogSubscriberInfo> subscribers;
+  subscriptions_->GetSubscribers(&subscribers);
+  ASSERT_EQ(1, subscribers.size());
+  ASSERT_EQ("a", subscribers[0].name);
+  ASSERT_EQ(53, subscribers[0].acked_index);
+  ASSERT_EQ(47, subscribers[0].lag_ops);
+  ASSERT_TRUE(subscribers[0].anchored);
+
+  ASSERT_OK(subscriptions_->Unsubscribe("a"));
+  ASSERT_TRUE(subscriptions_->GetEarliestAnchoredIndex(&anchored).IsNotFound());
+  ASSERT_TRUE(Read("a", 54, 1024, &ops).IsNotFound());
+}
+
+// A read waits for an op to be committed past the subscriber's position.
+TEST_F(LogSubscriptionsTest, TestWaitForCommittedOps) {
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 100));
+  committed_index_ = 50;
+  ASSERT_OK(subscriptions_->Subscribe("a", 50));
+  thread committer([&]() {
+    SleepFor(MonoDelta::FromMilliseconds(50));
+    committed_index_ = 60;
+  });
+  vector<ReplicateRefPtr> ops;
+  int64_t committed;
+  ASSERT_OK(subscriptions_->Read(
+      "a",
+      50,
+      1024 * 1024,
+      MonoDelta::FromSeconds(10),
+      false,
+      &ops,
+      &committed));
+  committer.join();
+  ASSERT_EQ(60, committed);
+  NO_FATALS(AssertOps(51, 60, ops));
+}
+
+// The ops no longer in the log cache are read once through the shared
+// cursor for all the subscribers following each other.
+TEST_F(LogSubscriptionsTest, TestSharedCursor) {
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 100));
+  log_->WaitUntilAllFlushed();
+  // Only closed segments are read by the cursor.
+  ASSERT_OK(log_->AllocateSegmentAndRollOver());
+  cache_->EvictThroughOp(100);
+  ASSERT_FALSE(cache_->HasOpBeenCached(1));
+  committed_index_ = 100;
+
+  scoped_refptr<Counter> read_from_log =
+      METRIC_raft_log_subscription_ops_read_from_log.Instantiate(
+          metric_entity_);
+  ASSERT_OK(subscriptions_->Subscribe("a", 0));
+  ASSERT_OK(subscriptions_->Subscribe("b", 0));
+  vector<ReplicateRefPtr> ops;
+  ASSERT_OK(Read("a", 0, 10 * kPayloadSize, &ops));
+  NO_FATALS(AssertOps(1, 10, ops));
+  const int64_t num_read = read_from_log->value();
+  ASSERT_GE(num_read, 10);
+
+  ASSERT_OK(Read("b", 0, 10 * kPayloadSize, &ops));
+  NO_FATALS(AssertOps(1, 10, ops));
+  ASSERT_OK(Read("a", 10, 10 * kPayloadSize, &ops));
+  NO_FATALS(AssertOps(11, 20, ops));
+  ASSERT_EQ(num_read, read_from_log->value());
+}
+
+// With --log_cache_compress_at_rest, the cache holds the ops compressed, and
+// the subscribers asking for the raw payloads get them uncompressed once.
+TEST_F(LogSubscriptionsTest, TestUncompressedReads) {
+  FLAGS_log_cache_compress_at_rest = true;
+  ASSERT_OK(CompressionCodecManager::SetCurrentCodec(LZ4));
+  SCOPED_CLEANUP({
+    CHECK_OK(CompressionCodecManager::SetCurrentCodec(NO_COMPRESSION));
+  });
+  const std::string kPayload(1000, 'x');
+  for (int index = 1; index <= 10; index++) {
+    gscoped_ptr<ReplicateMsg> msg =
+        CreateDummyReplicate(1, index, clock_->Now(), 0);
+    msg->clear_noop_request();
+    msg->set_op_type(WRITE_OP_EXT);
+    msg->mutable_write_payload()->set_payload(kPayload);
+    // As appended without a compressed form.
+    vector<ReplicateMsgWrapper> msg_wrappers;
+    msg_wrappers.emplace_back(
+        make_scoped_refptr_replicate(msg.release()), false);
+    ASSERT_OK(msg_wrappers.back().Init(nullptr));
+    ASSERT_OK(cache_->AppendOperations(msg_wrappers, Bind(&FatalOnError)));
+  }
+  committed_index_ = 10;
+  ASSERT_OK(subscriptions_->Subscribe("a", 0));
+
+  vector<ReplicateRefPtr> ops;
+  ASSERT_OK(Read("a", 0, 1024 * 1024, &ops));
+  NO_FATALS(AssertOps(1, 10, ops));
+  for (const auto& op : ops) {
+    ASSERT_EQ(LZ4, op->get()->write_payload().compression_codec());
+    ASSERT_LT(op->get()->write_payload().payload().size(), kPayload.size());
+  }
+
+  for (int i = 0; i < 2; i++) {
+    ASSERT_OK(Read("a", 0, 1024 * 1024, &ops, /* uncompressed */ true));
+    NO_FATALS(AssertOps(1, 10, ops));
+    for (const auto& op : ops) {
+      ASSERT_EQ(
+          NO_COMPRESSION, op->get()->write_payload().compression_codec());
+      ASSERT_EQ(kPayload, op->get()->write_payload().payload());
+    }
+  }
+  ASSERT_EQ(
+      10,
+      METRIC_log_cache_uncompressed_hot_set_misses.Instantiate(metric_entity_)
+          ->value());
+  ASSERT_EQ(
+      10,
+      METRIC_log_cache_uncompressed_hot_set_hits.Instantiate(metric_entity_)
+          ->value());
+}
+
+// Subscribers too far behind stop holding back the log GC, until they catch
+// up.
+TEST_F(LogSubscriptionsTest, TestAnchorPolicy) {
+  FLAGS_log_subscription_max_anchored_ops = 10;
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 100));
+  committed_index_ = 100;
+  ASSERT_OK(subscriptions_->Subscribe("a", 0));
+  int64_t anchored;
+  ASSERT_TRUE(subscriptions_->GetEarliestAnchoredIndex(&anchored).IsNotFound());
+
+  vector<ReplicateRefPtr> ops;
+  ASSERT_OK(Read("a", 95, 1024 * 1024, &ops));
+  NO_FATALS(AssertOps(96, 100, ops));
+  ASSERT_OK(subscriptions_->GetEarliestAnchoredIndex(&anchored));
+  ASSERT_EQ(95, anchored);
+
+  committed_index_ = 200;
+  ASSERT_TRUE(subscriptions_->GetEarliestAnchoredIndex(&anchored).IsNotFound());
+  ASSERT_EQ(
+      1,
+      METRIC_raft_log_subscription_anchors_released.Instantiate(metric_entity_)
+          ->value());
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,475 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/log_subscriptions.h"
+
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <utility>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/log.h"
+#include "kudu/consensus/log_cache.h"
+#include "kudu/consensus/log_reader.h"
+#include "kudu/consensus/opid.pb.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/scoped_cleanup.h"
+
+DEFINE_int64(
+    log_subscription_max_anchored_ops,
+    1000000,
+    "A log subscriber more committed ops behind than this stops holding back "
+    "the log GC until it catches up, and may find the ops it needs gone.");
+DEFINE_validator(
+    log_subscription_max_anchored_ops,
+    [](const char* /*n*/, int64_t v) { return v > 0; });
+TAG_FLAG(log_subscription_max_anchored_ops, advanced);
+TAG_FLAG(log_subscription_max_anchored_ops, runtime);
+
+DEFINE_int32(
+    log_subscription_anchor_idle_secs,
+    600,
+    "A log subscriber which hasn't read for this many seconds stops holding "
+    "back the log GC until it reads again.");
+DEFINE_validator(
+    log_subscription_anchor_idle_secs,
+    [](const char* /*n*/, int32_t v) { return v > 0; });
+TAG_FLAG(log_subscription_anchor_idle_secs, advanced);
+TAG_FLAG(log_subscription_anchor_idle_secs, runtime);
+
+DEFINE_int64(
+    log_subscription_cursor_read_bytes,
+    8 * 1024 * 1024,
+    "How many bytes of ops the cursor shared by the log subscribers reads "
+    "from the log segments at once.");
+DEFINE_validator(
+    log_subscription_cursor_read_bytes,
+    [](const char* /*n*/, int64_t v) { return v > 0; });
+TAG_FLAG(log_subscription_cursor_read_bytes, advanced);
+TAG_FLAG(log_subscription_cursor_read_bytes, runtime);
+
+DEFINE_int64(
+    log_subscription_window_bytes,
+    64 * 1024 * 1024,
+    "How many bytes of the ops last read by the cursor shared by the log "
+    "subscribers are kept for the subscribers following behind.");
+TAG_FLAG(log_subscription_window_bytes, advanced);
+TAG_FLAG(log_subscription_window_bytes, runtime);
+
+DEFINE_int32(
+    log_subscription_max_wait_ms,
+    10000,
+    "The longest a log subscriber's read waits for an op to be committed.");
+TAG_FLAG(log_subscription_max_wait_ms, advanced);
+TAG_FLAG(log_subscription_max_wait_ms, runtime);
+
+METRIC_DEFINE_gauge_int64(
+    server,
+    raft_log_subscribers,
+    "Log Subscribers",
+    kudu::MetricUnit::kUnits,
+    "Number of subscribers reading the committed ops from the log.");
+METRIC_DEFINE_gauge_int64(
+    server,
+    raft_log_subscription_max_lag,
+    "Log Subscription Max Lag",
+    kudu::MetricUnit::kOperations,
+    "Number of committed ops the slowest log subscriber is behind.");
+METRIC_DEFINE_counter(
+    server,
+    raft_log_subscription_ops_sent,
+    "Log Subscription Ops Sent",
+    kudu::MetricUnit::kOperations,
+    "Number of committed ops read by the log subscribers.");
+METRIC_DEFINE_counter(
+    server,
+    raft_log_subscription_ops_read_from_log,
+    "Log Subscription Ops Read From Log",
+    kudu::MetricUnit::kOperations,
+    "Number of ops read from the log segments by the cursor shared by the log "
+    "subscribers. The ops sent to the subscribers which are not read through "
+    "it came from the log cache, or were read once for several subscribers.");
+METRIC_DEFINE_counter(
+    server,
+    raft_log_subscription_anchors_released,
+    "Log Subscription Anchors Released",
+    kudu::MetricUnit::kUnits,
+    "Number of times a log subscriber stopped holding back the log GC, as it "
+    "was too far behind or idle.");
+
+using std::string;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace consensus {
+
+namespace {
+
+// How long a wait for the committed index goes without checking for a
+// shutdown.
+const int kWaitSliceMs = 100;
+
+int64_t OpSize(const ReplicateRefPtr& op) {
+  // As in LogCache::ReadOps(), the payload stands for the whole op.
+  return op->get()->write_payload().payload().size();
+}
+
+// Appends the ops from 'begin' up to 'end', or through index 'up_to', to
+// 'ops', up to 'max_bytes' after the first.
+template <typename Iterator>
+void AppendUpTo(
+    Iterator begin,
+    Iterator end,
+    int64_t up_to,
+    int64_t max_bytes,
+    vector<ReplicateRefPtr>* ops) {
+  int64_t remaining = max_bytes;
+  for (Iterator it = begin; it != end; ++it) {
+    if ((*it)->get()->id().index() > up_to ||
+        (remaining <= 0 && it != begin)) {
+      break;
+    }
+    remaining -= OpSize(*it);
+    ops->push_back(*it);
+  }
+}
+
+} // anonymous namespace
+
+LogSubscriptionManager::LogSubscriptionManager(
+    string log_prefix,
+    LogCache* log_cache,
+    CommittedIndexFunc committed_index,
+    WaitForCommittedFunc wait_for_committed,
+    const scoped_refptr<MetricEntity>& metric_entity)
+    : log_prefix_(std::move(log_prefix)),
+      log_cache_(DCHECK_NOTNULL(log_cache)),
+      committed_index_(std::move(committed_index)),
+      wait_for_committed_(std::move(wait_for_committed)),
+      anchor_registry_(new log::LogAnchorRegistry()),
+      num_subscribers_(metric_entity->FindOrCreateGauge(
+          &METRIC_raft_log_subscribers,
+          static_cast<int64_t>(0))),
+      max_lag_(metric_entity->FindOrCreateGauge(
+          &METRIC_raft_log_subscription_max_lag,
+          static_cast<int64_t>(0))),
+      ops_sent_(metric_entity->FindOrCreateCounter(
+          &METRIC_raft_log_subscription_ops_sent)),
+      ops_read_from_log_(metric_entity->FindOrCreateCounter(
+          &METRIC_raft_log_subscription_ops_read_from_log)),
+      anchors_released_(metric_entity->FindOrCreateCounter(
+          &METRIC_raft_log_subscription_anchors_released)) {}
+
+LogSubscriptionManager::~LogSubscriptionManager() {
+  std::lock_guard<simple_spinlock> l(lock_);
+  for (const auto& entry : subscribers_) {
+    WARN_NOT_OK(
+        anchor_registry_->UnregisterIfAnchored(&entry.second->anchor),
+        log_prefix_ + "Could not release a log subscriber's anchor");
+  }
+  num_subscribers_->DecrementBy(subscribers_.size());
+}
+
+Status LogSubscriptionManager::Subscribe(
+    const string& name,
+    int64_t after_index) {
+  if (after_index < 0) {
+    return Status::InvalidArgument(
+        Substitute("bad index to subscribe from: $0", after_index));
+  }
+  std::shared_ptr<Subscriber> subscriber = std::make_shared<Subscriber>();
+  subscriber->name = name;
+  subscriber->acked_index = after_index;
+  subscriber->last_read = MonoTime::Now();
+
+  std::lock_guard<simple_spinlock> l(lock_);
+  if (!subscribers_.emplace(name, subscriber).second) {
+    return Status::AlreadyPresent(
+        Substitute("log subscriber $0 already exists", name));
+  }
+  UpdateAnchorUnlocked(
+      subscriber.get(), committed_index_(), subscriber->last_read);
+  num_subscribers_->Increment();
+  LOG(INFO) << log_prefix_ << "Log subscriber " << name
+            << " subscribed from index " << after_index;
+  return Status::OK();
+}
+
+Status LogSubscriptionManager::Unsubscribe(const string& name) {
+  std::lock_guard<simple_spinlock> l(lock_);
+  auto it = subscribers_.find(name);
+  if (it == subscribers_.end()) {
+    return Status::NotFound(Substitute("no log subscriber $0", name));
+  }
+  RETURN_NOT_OK(anchor_registry_->UnregisterIfAnchored(&it->second->anchor));
+  it->second->anchored = false;
+  subscribers_.erase(it);
+  num_subscribers_->Decrement();
+  LOG(INFO) << log_prefix_ << "Log subscriber " << name << " unsubscribed";
+  return Status::OK();
+}
+
+void LogSubscriptionManager::UpdateAnchorUnlocked(
+    Subscriber* subscriber,
+    int64_t committed_index,
+    MonoTime now) {
+  DCHECK(lock_.is_locked());
+  const int64_t lag = committed_index - subscriber->acked_index;
+  const bool hold = lag <= FLAGS_log_subscription_max_anchored_ops &&
+      now - subscriber->last_read <=
+          MonoDelta::FromSeconds(FLAGS_log_subscription_anchor_idle_secs);
+  const string owner = "log subscriber " + subscriber->name;
+  if (!hold) {
+    if (subscriber->anchored) {
+      WARN_NOT_OK(
+          anchor_registry_->Unregister(&subscriber->anchor),
+          log_prefix_ + "Could not release a log subscriber's anchor");
+      subscriber->anchored = false;
+      anchors_released_->Increment();
+      LOG(INFO) << log_prefix_ << "Log subscriber " << subscriber->name
+                << " no longer holds back the log GC, it is " << lag
+                << " ops behind, and read "
+                << (now - subscriber->last_read).ToString() << " ago";
+    }
+    return;
+  }
+  if (subscriber->anchored) {
+    WARN_NOT_OK(
+        anchor_registry_->UpdateRegistration(
+            subscriber->acked_index, owner, &subscriber->anchor),
+        log_prefix_ + "Could not move a log subscriber's anchor");
+  } else {
+    anchor_registry_->Register(
+        subscriber->acked_index, owner, &subscriber->anchor);
+    subscriber->anchored = true;
+  }
+}
+
+Status LogSubscriptionManager::Read(
+    const string& name,
+    int64_t after_index,
+    int64_t max_bytes,
+    MonoDelta wait,
+    bool uncompressed,
+    vector<ReplicateRefPtr>* ops,
+    int64_t* committed_index) {
+  if (after_index < 0 || max_bytes <= 0) {
+    return Status::InvalidArgument(Substitute(
+        "bad log subscription read after $0 of $1 bytes",
+        after_index,
+        max_bytes));
+  }
+  std::shared_ptr<Subscriber> subscriber;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (shutdown_) {
+      return Status::ServiceUnavailable("log subscriptions are shut down");
+    }
+    auto it = subscribers_.find(name);
+    if (it == subscribers_.end()) {
+      return Status::NotFound(Substitute("no log subscriber $0", name));
+    }
+    subscriber = it->second;
+    if (subscriber->reading) {
+      return Status::IllegalState(
+          Substitute("log subscriber $0 is already reading", name));
+    }
+    subscriber->reading = true;
+    subscriber->acked_index = after_index;
+    subscriber->last_read = MonoTime::Now();
+    UpdateAnchorUnlocked(
+        subscriber.get(), committed_index_(), subscriber->last_read);
+  }
+  SCOPED_CLEANUP({
+    std::lock_guard<simple_spinlock> l(lock_);
+    subscriber->reading = false;
+  });
+
+  int64_t committed = committed_index_();
+  const MonoTime deadline = MonoTime::Now() +
+      std::min(wait,
+               MonoDelta::FromMilliseconds(FLAGS_log_subscription_max_wait_ms));
+  while (committed <= after_index) {
+    MonoTime now = MonoTime::Now();
+    if (now >= deadline) {
+      break;
+    }
+    {
+      std::lock_guard<simple_spinlock> l(lock_);
+      if (shutdown_) {
+        return Status::ServiceUnavailable("log subscriptions are shut down");
+      }
+    }
+    Status s = wait_for_committed_(
+        after_index + 1,
+        std::min(deadline, now + MonoDelta::FromMilliseconds(kWaitSliceMs)));
+    if (!s.ok() && !s.IsTimedOut()) {
+      return s;
+    }
+    committed = committed_index_();
+  }
+  *committed_index = committed;
+  if (committed <= after_index) {
+    return Status::OK();
+  }
+
+  const size_t num_ops = ops->size();
+  RETURN_NOT_OK(ReadCommittedOps(after_index, committed, max_bytes, ops));
+  if (uncompressed) {
+    for (size_t i = num_ops; i < ops->size(); i++) {
+      RETURN_NOT_OK(log_cache_->GetUncompressed((*ops)[i], &(*ops)[i]));
+    }
+  }
+  ops_sent_->IncrementBy(ops->size() - num_ops);
+  return Status::OK();
+}
+
+Status LogSubscriptionManager::ReadCommittedOps(
+    int64_t after_index,
+    int64_t up_to,
+    int64_t max_bytes,
+    vector<ReplicateRefPtr>* ops) {
+  if (!log_cache_->HasOpBeenCached(after_index + 1)) {
+    bool done = false;
+    RETURN_NOT_OK(
+        ReadThroughCursor(after_index, up_to, max_bytes, ops, &done));
+    if (done) {
+      return Status::OK();
+    }
+  }
+  // Mostly served from memory, but the ops evicted since the check above, or
+  // in the segment being written to, are read from the log for this
+  // subscriber alone.
+  vector<ReplicateRefPtr> read;
+  OpId preceding;
+  RETURN_NOT_OK(log_cache_->ReadOps(
+      after_index,
+      std::min<int64_t>(max_bytes, std::numeric_limits<int>::max()),
+      ReadContext(),
+      &read,
+      &preceding));
+  AppendUpTo(read.begin(), read.end(), up_to, max_bytes, ops);
+  return Status::OK();
+}
+
+Status LogSubscriptionManager::ReadThroughCursor(
+    int64_t after_index,
+    int64_t up_to,
+    int64_t max_bytes,
+    vector<ReplicateRefPtr>* ops,
+    bool* done) {
+  MutexLock l(cursor_lock_);
+  auto in_window = [&]() {
+    return !window_.empty() &&
+        window_.front()->get()->id().index() <= after_index + 1 &&
+        window_.back()->get()->id().index() > after_index;
+  };
+  if (!in_window()) {
+    // The cursor goes on from the end of the window when the subscriber is
+    // right after it, which is the common case of subscribers following
+    // each other, and seeks otherwise.
+    vector<ReplicateRefPtr> read;
+    OpId preceding;
+    Status s = log_cache_->ReadOpsSequentially(
+        after_index,
+        std::min<int64_t>(
+            FLAGS_log_subscription_cursor_read_bytes,
+            std::numeric_limits<int>::max()),
+        ReadContext(),
+        &cursor_,
+        &read,
+        &preceding);
+    // Logs without segments of their own, like the shared log, can't be read
+    // sequentially.
+    if (s.IsNotSupported() || (s.ok() && read.empty())) {
+      *done = false;
+      return Status::OK();
+    }
+    RETURN_NOT_OK(s);
+    ops_read_from_log_->IncrementBy(read.size());
+    if (window_.empty() ||
+        window_.back()->get()->id().index() + 1 !=
+            read.front()->get()->id().index()) {
+      window_.clear();
+      window_bytes_ = 0;
+    }
+    for (ReplicateRefPtr& op : read) {
+      window_bytes_ += OpSize(op);
+      window_.emplace_back(std::move(op));
+    }
+    // Drop the oldest ops past the window limit, but not those to be served.
+    while (window_bytes_ > FLAGS_log_subscription_window_bytes &&
+           window_.front()->get()->id().index() <= after_index) {
+      window_bytes_ -= OpSize(window_.front());
+      window_.pop_front();
+    }
+  }
+  const int64_t first_index = window_.front()->get()->id().index();
+  auto begin = window_.begin() + (after_index + 1 - first_index);
+  AppendUpTo(begin, window_.end(), up_to, max_bytes, ops);
+  *done = true;
+  return Status::OK();
+}
+
+Status LogSubscriptionManager::GetEarliestAnchoredIndex(int64_t* index) {
+  const int64_t committed = committed_index_();
+  const MonoTime now = MonoTime::Now();
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    int64_t max_lag = 0;
+    for (const auto& entry : subscribers_) {
+      Subscriber* subscriber = entry.second.get();
+      max_lag = std::max(max_lag, committed - subscriber->acked_index);
+      if (subscriber->anchored) {
+        UpdateAnchorUnlocked(subscriber, committed, now);
+      }
+    }
+    max_lag_->set_value(max_lag);
+  }
+  return anchor_registry_->GetEarliestRegisteredLogIndex(index);
+}
+
+void LogSubscriptionManager::GetSubscribers(
+    vector<LogSubscriberInfo>* subscribers) const {
+  const int64_t committed = committed_index_();
+  const MonoTime now = MonoTime::Now();
+  std::lock_guard<simple_spinlock> l(lock_);
+  for (const auto& entry : subscribers_) {
+    const Subscriber& subscriber = *entry.second;
+    LogSubscriberInfo info;
+    info.name = subscriber.name;
+    info.acked_index = subscriber.acked_index;
+    info.lag_ops = std::max<int64_t>(0, committed - subscriber.acked_index);
+    info.anchored = subscriber.anchored;
+    info.idle = now - subscriber.last_read;
+    subscribers->emplace_back(std::move(info));
+  }
+}
+
+void LogSubscriptionManager::Shutdown() {
+  std::lock_guard<simple_spinlock> l(lock_);
+  shutdown_ = true;
+}
+
+} // namespace consensus
+} // namespace kudu
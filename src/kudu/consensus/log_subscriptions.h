@@ -0,0 +1,201 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "kudu/consensus/log_anchor_registry.h"
+#include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/mutex.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+namespace log {
+class SequentialReplicateReader;
+} // namespace log
+
+namespace consensus {
+
+class LogCache;
+
+// What a log subscriber is up to, see LogSubscriptionManager::GetSubscribers().
+struct LogSubscriberInfo {
+  std::string name;
+  // The last op the subscriber has processed.
+  int64_t acked_index = 0;
+  // How many committed ops the subscriber is behind.
+  int64_t lag_ops = 0;
+  // Whether the subscriber holds back the log GC.
+  bool anchored = false;
+  // Since the subscriber's last read.
+  MonoDelta idle;
+};
+
+// Streams the committed ops of a tablet to change data capture consumers.
+// Each subscriber reads the ops following the last one it has processed, so
+// a slow subscriber only holds up itself. The ops are served from the log
+// cache when they are still in it, and otherwise from a single sequential
+// cursor over the log segments, shared by all the subscribers: the ops it
+// read for one are kept in a window of --log_subscription_window_bytes, so
+// that those following closely behind don't read and decode them again.
+//
+// Each subscriber anchors the log from the last op it processed, so that the
+// log GC keeps the ops it still needs. A subscriber which falls more than
+// --log_subscription_max_anchored_ops behind, or stops reading for
+// --log_subscription_anchor_idle_secs, loses its anchor until it reads again
+// within the limit, so that a stuck consumer can't fill up the disk.
+//
+// Thread-safe.
+class LogSubscriptionManager {
+ public:
+  // Returns the committed index.
+  typedef std::function<int64_t()> CommittedIndexFunc;
+  // Waits until the committed index reaches 'index', or 'deadline' passes.
+  typedef std::function<Status(int64_t index, const MonoTime& deadline)>
+      WaitForCommittedFunc;
+
+  // 'log_cache' must outlive the manager.
+  LogSubscriptionManager(
+      std::string log_prefix,
+      LogCache* log_cache,
+      CommittedIndexFunc committed_index,
+      WaitForCommittedFunc wait_for_committed,
+      const scoped_refptr<MetricEntity>& metric_entity);
+  ~LogSubscriptionManager();
+
+  // Adds the subscriber 'name', which starts from the op after
+  // 'after_index'. Returns AlreadyPresent if there is one by that name.
+  Status Subscribe(const std::string& name, int64_t after_index);
+
+  // Removes the subscriber 'name', and its anchor.
+  Status Unsubscribe(const std::string& name);
+
+  // Reads the committed ops following 'after_index' for the subscriber
+  // 'name', which has processed the ops through 'after_index': those before
+  // it are no longer anchored. Waits up to 'wait' for an op to be committed
+  // past 'after_index', if none is yet, and may return no ops at all.
+  //
+  // The ops are as they are in the log, so their payloads may be
+  // compressed, unless 'uncompressed', for the subscribers without the codecs,
+  // see LogCache::GetUncompressed(). They take up to 'max_bytes', as they are
+  // in the log, unless that would leave out the first one. '*committed_index'
+  // is set to the committed index they were read up to.
+  //
+  // Returns NotFound if the ops following 'after_index' were garbage
+  // collected, and IllegalState if the subscriber is already reading: each
+  // subscriber has a single read in flight.
+  Status Read(
+      const std::string& name,
+      int64_t after_index,
+      int64_t max_bytes,
+      MonoDelta wait,
+      bool uncompressed,
+      std::vector<ReplicateRefPtr>* ops,
+      int64_t* committed_index);
+
+  // Sets '*index' to the first op the subscribers need kept in the log,
+  // after releasing the anchors of those which fell too far behind. Returns
+  // NotFound if no subscriber anchors the log.
+  Status GetEarliestAnchoredIndex(int64_t* index);
+
+  void GetSubscribers(std::vector<LogSubscriberInfo>* subscribers) const;
+
+  // Fails the reads from now on. The reads in flight return shortly.
+  void Shutdown();
+
+  log::LogAnchorRegistry* anchor_registry() const {
+    return anchor_registry_.get();
+  }
+
+ private:
+  struct Subscriber {
+    std::string name;
+    int64_t acked_index = 0;
+    MonoTime last_read;
+    bool reading = false;
+    bool anchored = false;
+    log::LogAnchor anchor;
+  };
+
+  // Anchors the log from the last op 'subscriber' processed, which its next
+  // read looks up to follow on from, or releases its anchor if it is too far
+  // behind 'committed_index' or idle. Requires 'lock_'.
+  void UpdateAnchorUnlocked(
+      Subscriber* subscriber,
+      int64_t committed_index,
+      MonoTime now);
+
+  // Appends to 'ops' the ops in ('after_index', 'up_to'], up to 'max_bytes'.
+  Status ReadCommittedOps(
+      int64_t after_index,
+      int64_t up_to,
+      int64_t max_bytes,
+      std::vector<ReplicateRefPtr>* ops);
+
+  // Like ReadCommittedOps(), for ops no longer in the log cache: serves
+  // them from 'window_', which the shared cursor refills. Sets '*done' to
+  // false, without reading anything, if the ops are in the log segment being
+  // written to, or the log has no segments the cursor can read.
+  Status ReadThroughCursor(
+      int64_t after_index,
+      int64_t up_to,
+      int64_t max_bytes,
+      std::vector<ReplicateRefPtr>* ops,
+      bool* done);
+
+  const std::string log_prefix_;
+  LogCache* const log_cache_;
+  const CommittedIndexFunc committed_index_;
+  const WaitForCommittedFunc wait_for_committed_;
+  const scoped_refptr<log::LogAnchorRegistry> anchor_registry_;
+
+  mutable simple_spinlock lock_;
+  std::map<std::string, std::shared_ptr<Subscriber>> subscribers_;
+  bool shutdown_ = false;
+
+  // Serializes the reads through the shared cursor.
+  Mutex cursor_lock_;
+  std::shared_ptr<log::SequentialReplicateReader> cursor_;
+  // The ops the cursor read last, contiguous and in index order, taking up
+  // 'window_bytes_'.
+  std::deque<ReplicateRefPtr> window_;
+  int64_t window_bytes_ = 0;
+
+  scoped_refptr<AtomicGauge<int64_t>> num_subscribers_;
+  scoped_refptr<AtomicGauge<int64_t>> max_lag_;
+  scoped_refptr<Counter> ops_sent_;
+  scoped_refptr<Counter> ops_read_from_log_;
+  scoped_refptr<Counter> anchors_released_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogSubscriptionManager);
+};
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,57 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/log_util.h"
+
+#include <gtest/gtest.h>
+
+namespace kudu {
+namespace log {
+
+TEST(LogUtilTest, TestGroupCommitDelayDisabled) {
+  ASSERT_EQ(0, GroupCommitDelayUs(0, 2000, 300, 100));
+  ASSERT_EQ(0, GroupCommitDelayUs(-1, 2000, 300, 100));
+}
+
+TEST(LogUtilTest, TestGroupCommitDelayUntilMeasured) {
+  // Nothing is known of the syncs, nor of the arrivals.
+  ASSERT_EQ(0, GroupCommitDelayUs(1000, 2000, 0, 0));
+  ASSERT_EQ(0, GroupCommitDelayUs(1000, 2000, 0, 100));
+  ASSERT_EQ(0, GroupCommitDelayUs(1000, 2000, 300, 0));
+}
+
+TEST(LogUtilTest, TestGroupCommitDelayBounds) {
+  // As long as a sync takes.
+  ASSERT_EQ(300, GroupCommitDelayUs(1000, 2000, 300, 100));
+  // At most the upper bound.
+  ASSERT_EQ(200, GroupCommitDelayUs(200, 2000, 300, 100));
+  // Within what is left of the latency target once the group is synced.
+  ASSERT_EQ(200, GroupCommitDelayUs(1000, 500, 300, 100));
+  // Not at all once syncs alone miss the target.
+  ASSERT_EQ(0, GroupCommitDelayUs(1000, 300, 300, 100));
+  ASSERT_EQ(0, GroupCommitDelayUs(1000, 250, 300, 100));
+}
+
+TEST(LogUtilTest, TestGroupCommitDelayNeedsArrivals) {
+  // Only if another batch is expected before the delay is up.
+  ASSERT_EQ(300, GroupCommitDelayUs(1000, 2000, 300, 300));
+  ASSERT_EQ(0, GroupCommitDelayUs(1000, 2000, 300, 301));
+  ASSERT_EQ(0, GroupCommitDelayUs(200, 2000, 300, 250));
+}
+
+} // namespace log
+} // namespace kudu
@@ -17,10 +17,19 @@
 
 #include "kudu/consensus/log_util.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include <algorithm>
 #include <cstring>
 #include <iostream>
+#include <iterator>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
@@ -33,6 +42,7 @@
 #include "kudu/gutil/strings/split.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/gutil/strings/util.h"
+#include "kudu/util/alignment.h"
 #include "kudu/util/array_view.h" // IWYU pragma: keep
 #include "kudu/util/coding-inl.h"
 #include "kudu/util/coding.h"
@@ -41,8 +51,10 @@
 #include "kudu/util/crc.h"
 #include "kudu/util/debug/trace_event.h"
 #include "kudu/util/env_util.h"
+#include "kudu/util/errno.h"
 #include "kudu/util/fault_injection.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/locks.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/pb_util.h"
 
@@ -70,6 +82,41 @@ DEFINE_bool(
     "Whether the WAL segments preallocation should happen asynchronously");
 TAG_FLAG(log_async_preallocate_segments, advanced);
 
+DEFINE_bool(
+    log_use_io_uring,
+    false,
+    "Whether WAL segments should be written and synced through io_uring. When "
+    "a group commit needs a sync, the write of its last entry batch and the "
+    "fdatasync are submitted together. Falls back to regular I/O if io_uring "
+    "is not supported by the kernel.");
+TAG_FLAG(log_use_io_uring, experimental);
+
+DEFINE_bool(
+    log_use_direct_io,
+    false,
+    "Whether WAL segments should be written with O_DIRECT, bypassing the page "
+    "cache. Writes are padded to the filesystem block size in memory; the "
+    "on-disk segment format is unchanged. Falls back to buffered I/O if the "
+    "filesystem does not support direct I/O.");
+TAG_FLAG(log_use_direct_io, experimental);
+
+DEFINE_bool(
+    log_mmap_sealed_segments,
+    false,
+    "Whether sealed WAL segments, which are immutable, are memory-mapped to "
+    "read them, so that their entries are parsed in place instead of being "
+    "copied into buffers with a read per entry. Catching up peers and "
+    "reading ops back for proxied peers benefit most.");
+TAG_FLAG(log_mmap_sealed_segments, experimental);
+
+DEFINE_int32(
+    log_mmap_cache_segments,
+    64,
+    "The number of sealed WAL segments kept mapped between reads with "
+    "--log_mmap_sealed_segments, across all logs. The least recently used "
+    "mapping is released first, once it is no longer being read from.");
+TAG_FLAG(log_mmap_cache_segments, experimental);
+
 DEFINE_double(
     fault_crash_before_write_log_segment_header,
     0.0,
@@ -114,17 +161,209 @@ LogOptions::LogOptions()
     : segment_size_mb(FLAGS_log_segment_size_mb),
       force_fsync_all(FLAGS_log_force_fsync_all),
       preallocate_segments(FLAGS_log_preallocate_segments),
-      async_preallocate_segments(FLAGS_log_async_preallocate_segments) {}
+      async_preallocate_segments(FLAGS_log_async_preallocate_segments),
+      use_io_uring(FLAGS_log_use_io_uring),
+      use_direct_io(FLAGS_log_use_direct_io) {}
+
+////////////////////////////////////////////////////////////
+// LogSegmentMapping
+////////////////////////////////////////////////////////////
+
+namespace {
+// Windows start and end on page boundaries.
+const int64_t kReadAheadAlignment = 4096;
+
+// How far ahead of a sequential reader pages of a mapping are asked for.
+const int64_t kMappingReadAheadBytes = 1024 * 1024;
+
+// The mappings of sealed segments, up to --log_mmap_cache_segments of them
+// in least recently used order. A mapping outlives its eviction for as long
+// as it is being read from.
+class SegmentMappingCache {
+ public:
+  static SegmentMappingCache* Get() {
+    static SegmentMappingCache* cache = new SegmentMappingCache();
+    return cache;
+  }
+
+  shared_ptr<LogSegmentMapping> Lookup(const ReadableLogSegment* segment) {
+    std::lock_guard<simple_spinlock> l(lock_);
+    auto it = index_.find(segment);
+    if (it == index_.end()) {
+      return nullptr;
+    }
+    lru_.splice(lru_.end(), lru_, it->second);
+    return it->second->second;
+  }
+
+  // Returns the mapping cached for 'segment', which is 'mapping' unless
+  // another thread cached one first.
+  shared_ptr<LogSegmentMapping> Insert(
+      const ReadableLogSegment* segment,
+      shared_ptr<LogSegmentMapping> mapping) {
+    // Unmapped once the lock is released.
+    vector<shared_ptr<LogSegmentMapping>> evicted;
+    std::lock_guard<simple_spinlock> l(lock_);
+    auto it = index_.find(segment);
+    if (it != index_.end()) {
+      return it->second->second;
+    }
+    lru_.emplace_back(segment, std::move(mapping));
+    index_.emplace(segment, std::prev(lru_.end()));
+    const size_t capacity = std::max(1, FLAGS_log_mmap_cache_segments);
+    while (lru_.size() > capacity) {
+      evicted.emplace_back(std::move(lru_.front().second));
+      index_.erase(lru_.front().first);
+      lru_.pop_front();
+    }
+    return lru_.back().second;
+  }
+
+  void Erase(const ReadableLogSegment* segment) {
+    shared_ptr<LogSegmentMapping> evicted;
+    std::lock_guard<simple_spinlock> l(lock_);
+    auto it = index_.find(segment);
+    if (it != index_.end()) {
+      evicted = std::move(it->second->second);
+      lru_.erase(it->second);
+      index_.erase(it);
+    }
+  }
+
+ private:
+  typedef std::list<
+      std::pair<const ReadableLogSegment*, shared_ptr<LogSegmentMapping>>>
+      LruList;
+
+  simple_spinlock lock_;
+  LruList lru_;
+  std::unordered_map<const ReadableLogSegment*, LruList::iterator> index_;
+};
+} // anonymous namespace
+
+LogSegmentMapping::LogSegmentMapping(uint8_t* data, int64_t size)
+    : data_(data), size_(size) {}
+
+LogSegmentMapping::~LogSegmentMapping() {
+  if (PREDICT_FALSE(munmap(data_, size_) != 0)) {
+    PLOG(WARNING) << "Failed to unmap log segment";
+  }
+}
+
+Status LogSegmentMapping::Create(
+    const string& path,
+    int64_t size,
+    shared_ptr<LogSegmentMapping>* mapping) {
+  if (PREDICT_FALSE(size <= 0)) {
+    return Status::InvalidArgument("Empty log segment", path);
+  }
+  int fd;
+  RETRY_ON_EINTR(fd, open(path.c_str(), O_CLOEXEC | O_RDONLY));
+  if (PREDICT_FALSE(fd < 0)) {
+    int err = errno;
+    return Status::IOError("Unable to open " + path, ErrnoToString(err), err);
+  }
+  void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  int mmap_err = errno;
+  int ret;
+  RETRY_ON_EINTR(ret, close(fd));
+  if (PREDICT_FALSE(data == MAP_FAILED)) {
+    return Status::IOError(
+        "Unable to mmap " + path, ErrnoToString(mmap_err), mmap_err);
+  }
+  mapping->reset(new LogSegmentMapping(static_cast<uint8_t*>(data), size));
+  return Status::OK();
+}
+
+Status LogSegmentMapping::Read(int64_t offset, int64_t length, Slice* result)
+    const {
+  if (PREDICT_FALSE(offset < 0 || length < 0 || offset + length > size_)) {
+    return Status::Corruption(Substitute(
+        "Could not read $0 bytes at offset $1 of a $2-byte mapping",
+        length,
+        offset,
+        size_));
+  }
+  *result = Slice(data_ + offset, length);
+  return Status::OK();
+}
+
+void LogSegmentMapping::WillNeed(int64_t offset, int64_t length) const {
+  const int64_t start = offset - offset % kReadAheadAlignment;
+  const int64_t end = std::min(offset + length, size_);
+  if (start < end) {
+    // Only a hint, so failures are ignored.
+    madvise(data_ + start, end - start, MADV_WILLNEED);
+  }
+}
+
+////////////////////////////////////////////////////////////
+// LogReadAheadBuffer
+////////////////////////////////////////////////////////////
+
+LogReadAheadBuffer::LogReadAheadBuffer(int64_t window_size)
+    : window_size_(std::max<int64_t>(
+          KUDU_ALIGN_UP(window_size, kReadAheadAlignment),
+          kReadAheadAlignment)),
+      file_(nullptr),
+      start_(0) {}
+
+Status LogReadAheadBuffer::Read(
+    const RandomAccessFile* file,
+    int64_t offset,
+    int64_t length,
+    int64_t limit,
+    Slice* result) {
+  DCHECK_GE(offset, 0);
+  DCHECK_GE(length, 0);
+  const int64_t end = offset + length;
+  if (file != file_ || offset < start_ ||
+      end > start_ + static_cast<int64_t>(buf_.size())) {
+    const int64_t start = offset - offset % kReadAheadAlignment;
+    const int64_t window_end =
+        std::max(end, std::min(start + window_size_, limit));
+    file_ = nullptr;
+    buf_.resize(window_end - start);
+    RETURN_NOT_OK(file->Read(start, Slice(buf_.data(), buf_.size())));
+    file_ = file;
+    start_ = start;
+
+    // Have the next window read in the background.
+    if (window_end < limit) {
+      Status s = file->AdviseSequentialRead(
+          window_end, std::min(window_size_, limit - window_end));
+      if (PREDICT_FALSE(!s.ok())) {
+        KLOG_EVERY_N_SECS(WARNING, 300)
+            << "Unable to read ahead " << file->filename() << ": "
+            << s.ToString();
+      }
+    }
+  }
+  *result = Slice(buf_.data() + (offset - start_), length);
+  return Status::OK();
+}
+
+void LogReadAheadBuffer::Reset() {
+  file_ = nullptr;
+}
 
 ////////////////////////////////////////////////////////////
 // LogEntryReader
 ////////////////////////////////////////////////////////////
 
 LogEntryReader::LogEntryReader(ReadableLogSegment* seg)
+    : LogEntryReader(seg, seg->first_entry_offset()) {}
+
+LogEntryReader::LogEntryReader(ReadableLogSegment* seg, int64_t offset)
     : seg_(seg),
       num_batches_read_(0),
       num_entries_read_(0),
-      offset_(seg_->first_entry_offset()) {
+      offset_(offset),
+      start_offset_(offset),
+      read_buffer_(nullptr),
+      mapping_(seg->GetMapping()),
+      mapping_advised_up_to_(offset) {
+  DCHECK_GE(offset_, seg_->first_entry_offset());
   int64_t readable_to_offset = seg_->readable_to_offset_.Load();
 
   // If we have a footer we only read up to it. If we don't we likely crashed
@@ -140,6 +379,14 @@ LogEntryReader::LogEntryReader(ReadableLogSegment* seg)
 
 LogEntryReader::~LogEntryReader() {}
 
+void LogEntryReader::SetReadBuffer(LogReadAheadBuffer* read_buffer) {
+  read_buffer_ = read_buffer;
+  // The buffer may hold a window of another segment.
+  if (read_buffer_) {
+    read_buffer_->Reset();
+  }
+}
+
 Status LogEntryReader::ReadNextEntry(unique_ptr<LogEntryPB>* entry) {
   // Refill pending_entries_ if none are available.
   while (pending_entries_.empty()) {
@@ -147,6 +394,7 @@ Status LogEntryReader::ReadNextEntry(unique_ptr<LogEntryPB>* entry) {
     // and return EOF.
     if (offset_ >= read_up_to_) {
       if (seg_->footer_.IsInitialized() &&
+          start_offset_ == seg_->first_entry_offset() &&
           seg_->footer_.num_entries() != num_entries_read_) {
         return Status::Corruption(Substitute(
             "Read $0 log entries from $1, but expected $2 based on the footer",
@@ -165,8 +413,18 @@ Status LogEntryReader::ReadNextEntry(unique_ptr<LogEntryPB>* entry) {
     Status s;
     EntryHeaderStatus s_detail = EntryHeaderStatus::OTHER_ERROR;
     if (offset_ + seg_->entry_header_size() < read_up_to_) {
+      if (mapping_ && offset_ >= mapping_advised_up_to_) {
+        mapping_advised_up_to_ =
+            std::min(offset_ + kMappingReadAheadBytes, read_up_to_);
+        mapping_->WillNeed(offset_, mapping_advised_up_to_ - offset_);
+      }
       s = seg_->ReadEntryHeaderAndBatch(
-          &offset_, &tmp_buf_, &current_batch, &s_detail);
+          &offset_,
+          &tmp_buf_,
+          &current_batch,
+          &s_detail,
+          read_buffer_,
+          mapping_.get());
     } else {
       s = Status::Corruption(
           Substitute("Truncated log entry at offset $0", offset_));
@@ -176,6 +434,11 @@ Status LogEntryReader::ReadNextEntry(unique_ptr<LogEntryPB>* entry) {
       return HandleReadError(s, s_detail);
     }
 
+    // Sync markers are only of use to rebuild the footer.
+    if (IsSyncMarkerBatch(*current_batch)) {
+      continue;
+    }
+
     // Add the entries from this batch to our pending queue.
     for (int i = 0; i < current_batch->entry_size(); i++) {
       auto entry = current_batch->mutable_entry(i);
@@ -313,7 +576,38 @@ ReadableLogSegment::ReadableLogSegment(
       readable_file_(std::move(readable_file)),
       codec_(nullptr),
       is_initialized_(false),
-      footer_was_rebuilt_(false) {}
+      footer_was_rebuilt_(false),
+      rewritten_(false) {}
+
+ReadableLogSegment::~ReadableLogSegment() {
+  SegmentMappingCache::Get()->Erase(this);
+}
+
+shared_ptr<LogSegmentMapping> ReadableLogSegment::GetMapping() {
+  // Segments without a proper footer may still be written to, or repaired.
+  if (!FLAGS_log_mmap_sealed_segments || !HasFooter() || footer_was_rebuilt_ ||
+      rewritten_.Load()) {
+    return nullptr;
+  }
+  SegmentMappingCache* cache = SegmentMappingCache::Get();
+  shared_ptr<LogSegmentMapping> mapping = cache->Lookup(this);
+  if (mapping) {
+    return mapping;
+  }
+  Status s = LogSegmentMapping::Create(path_, file_size(), &mapping);
+  if (PREDICT_FALSE(!s.ok())) {
+    KLOG_EVERY_N_SECS(WARNING, 60)
+        << "Reading log segment " << path_
+        << " without mapping it: " << s.ToString();
+    return nullptr;
+  }
+  // The segment may have been rewritten in the meantime, in which case the
+  // mapping may be of the new file.
+  if (rewritten_.Load()) {
+    return nullptr;
+  }
+  return cache->Insert(this, std::move(mapping));
+}
 
 Status ReadableLogSegment::Init(
     const LogSegmentHeaderPB& header,
@@ -409,10 +703,16 @@ Status ReadableLogSegment::RebuildFooterByScanning() {
 
   DCHECK(!footer_.IsInitialized());
 
-  LogEntryReader reader(this);
-
+  // Only the entries after the last sync marker, if any, need to be read.
   LogSegmentFooterPB new_footer;
-  int num_entries = 0;
+  int64_t start_offset = first_entry_offset_;
+  Status s = FindLastSyncMarker(&start_offset, &new_footer);
+  if (!s.ok() && !s.IsNotFound()) {
+    return s;
+  }
+  LogEntryReader reader(this, start_offset);
+
+  int64_t num_entries = new_footer.num_entries();
   while (true) {
     unique_ptr<LogEntryPB> entry;
     Status s = reader.ReadNextEntry(&entry);
@@ -434,7 +734,83 @@ Status ReadableLogSegment::RebuildFooterByScanning() {
   readable_to_offset_.Store(reader.offset());
 
   VLOG(1) << "Successfully rebuilt footer for segment: " << path_
-          << " (valid entries through byte offset " << reader.offset() << ")";
+          << " (valid entries through byte offset " << reader.offset()
+          << ", scanned from byte offset " << start_offset << ")";
+  return Status::OK();
+}
+
+Status ReadableLogSegment::FindLastSyncMarker(
+    int64_t* offset,
+    LogSegmentFooterPB* footer) {
+  const int64_t interval = header_.sync_marker_interval_bytes();
+  if (interval <= 0) {
+    return Status::NotFound("segment has no sync markers");
+  }
+
+  // Since a marker is only written once the entries before it are synced,
+  // the segment has one in each interval up to where its entries end, and
+  // none after, unless a batch spans a whole interval. Such an interval
+  // without a marker can only steer the search to an earlier one, which is
+  // as good a place to start from, only further from the end.
+  int64_t lo = first_entry_offset_ / interval + 1;
+  int64_t hi = (file_size() - 1) / interval;
+  bool found = false;
+  while (lo <= hi) {
+    const int64_t mid = lo + (hi - lo) / 2;
+    int64_t marker_offset;
+    LogSegmentFooterPB marker_footer;
+    Status s = ReadSyncMarker(
+        mid * interval, (mid + 1) * interval, &marker_offset, &marker_footer);
+    if (s.ok()) {
+      found = true;
+      *offset = marker_offset;
+      footer->Swap(&marker_footer);
+      lo = mid + 1;
+    } else if (s.IsNotFound()) {
+      hi = mid - 1;
+    } else {
+      return s;
+    }
+  }
+  if (!found) {
+    return Status::NotFound("no valid sync marker in the segment");
+  }
+  VLOG(1) << "Found the last sync marker of " << path_ << " at offset "
+          << *offset;
+  return Status::OK();
+}
+
+Status ReadableLogSegment::ReadSyncMarker(
+    int64_t offset,
+    int64_t limit,
+    int64_t* marker_offset,
+    LogSegmentFooterPB* footer) {
+  // The batch of the marker is the first one starting at or after 'offset'.
+  int64_t batch_offset;
+  RETURN_NOT_OK(FindEntryHeader(offset, limit, &batch_offset));
+  *marker_offset = batch_offset;
+
+  faststring tmp_buf;
+  unique_ptr<LogEntryBatchPB> batch;
+  EntryHeaderStatus status_detail;
+  Status s = ReadEntryHeaderAndBatch(
+      &batch_offset, &tmp_buf, &batch, &status_detail);
+  if (!s.ok()) {
+    // The batch may have been torn by the crash.
+    if (s.IsCorruption() || s.IsEndOfFile()) {
+      return Status::NotFound(s.ToString());
+    }
+    return s;
+  }
+  if (!IsSyncMarkerBatch(*batch)) {
+    return Status::NotFound("not a sync marker");
+  }
+  const SyncMarkerPB& marker = batch->entry(0).sync_marker();
+  if (marker.sequence_number() != header_.sequence_number() ||
+      marker.offset() != *marker_offset) {
+    return Status::NotFound("sync marker of another segment");
+  }
+  footer->CopyFrom(marker.footer());
   return Status::OK();
 }
 
@@ -478,10 +854,12 @@ Status ReadableLogSegment::ReadHeader() {
       pb_util::ParseFromArray(&header, header_slice.data(), header_size),
       "Unable to parse protobuf");
 
-  if (header.incompatible_features_size() > 0) {
-    return Status::NotSupported(
-        "log segment uses a feature not supported by this version "
-        "of Kudu");
+  for (int32_t feature : header.incompatible_features()) {
+    if (feature != LogSegmentHeaderPB::SYNC_MARKERS) {
+      return Status::NotSupported(
+          "log segment uses a feature not supported by this version "
+          "of Kudu");
+    }
   }
 
   header_.Swap(&header);
@@ -640,14 +1018,34 @@ Status ReadableLogSegment::ScanForValidEntryHeaders(
           << "following offset " << offset << "...";
   *has_valid_entries = false;
 
+  int64_t header_offset;
+  Status s = FindEntryHeader(offset, file_size(), &header_offset);
+  if (s.IsNotFound()) {
+    VLOG(1) << "Found no log entry headers";
+    return Status::OK();
+  }
+  RETURN_NOT_OK(s);
+  VLOG(1) << "Found a valid entry header at offset " << header_offset;
+  *has_valid_entries = true;
+  return Status::OK();
+}
+
+Status ReadableLogSegment::FindEntryHeader(
+    int64_t offset,
+    int64_t limit,
+    int64_t* header_offset) {
   constexpr auto kChunkSize = 1024 * 1024;
   unique_ptr<uint8_t[]> buf(new uint8_t[kChunkSize]);
 
+  // The header found may extend past 'limit'.
+  const int64_t end = std::min<int64_t>(
+      limit + entry_header_size(), file_size());
+
   // We overlap the reads by the size of the header, so that if a header
   // spans chunks, we don't miss it.
-  for (; offset < file_size() - entry_header_size();
+  for (; offset < end - static_cast<int64_t>(entry_header_size());
        offset += kChunkSize - entry_header_size()) {
-    int rem = std::min<int64_t>(file_size() - offset, kChunkSize);
+    int rem = std::min<int64_t>(end - offset, kChunkSize);
     Slice chunk(buf.get(), rem);
     RETURN_NOT_OK(readable_file()->Read(offset, chunk));
 
@@ -659,35 +1057,58 @@ Status ReadableLogSegment::ScanForValidEntryHeaders(
     }
 
     // Check if this chunk has a valid entry header.
-    for (int off_in_chunk = 0;
-         off_in_chunk < chunk.size() - entry_header_size();
+    const size_t header_size = entry_header_size();
+    for (size_t off_in_chunk = 0; off_in_chunk < chunk.size() - header_size;
          off_in_chunk++) {
-      Slice potential_header = Slice(&chunk[off_in_chunk], entry_header_size());
+      // A header of zeros never has a matching CRC, so skip over the runs of
+      // zeros, e.g. the padding between batches, to the first offset whose
+      // header includes the next non-zero byte.
+      if (chunk[off_in_chunk] == 0) {
+        size_t non_zero = off_in_chunk +
+            FindFirstNonZeroByte(Slice(
+                &chunk[off_in_chunk], chunk.size() - off_in_chunk));
+        if (non_zero >= chunk.size()) {
+          break;
+        }
+        if (non_zero >= off_in_chunk + header_size) {
+          off_in_chunk = non_zero - header_size + 1;
+          if (off_in_chunk >= chunk.size() - header_size) {
+            break;
+          }
+        }
+      }
+      Slice potential_header = Slice(&chunk[off_in_chunk], header_size);
 
       EntryHeader header;
       if (DecodeEntryHeader(potential_header, &header) ==
           EntryHeaderStatus::OK) {
-        VLOG(1) << "Found a valid entry header at offset "
-                << (offset + off_in_chunk);
-        *has_valid_entries = true;
+        *header_offset = offset + off_in_chunk;
         return Status::OK();
       }
     }
   }
 
-  VLOG(1) << "Found no log entry headers";
-  return Status::OK();
+  return Status::NotFound("no valid entry header");
 }
 
 Status ReadableLogSegment::ReadEntryHeaderAndBatch(
     int64_t* offset,
     faststring* tmp_buf,
     unique_ptr<LogEntryBatchPB>* batch,
-    EntryHeaderStatus* status_detail) {
+    EntryHeaderStatus* status_detail,
+    LogReadAheadBuffer* read_buffer,
+    const LogSegmentMapping* mapping) {
+  shared_ptr<LogSegmentMapping> own_mapping;
+  if (!mapping && !read_buffer) {
+    own_mapping = GetMapping();
+    mapping = own_mapping.get();
+  }
   int64_t cur_offset = *offset;
   EntryHeader header;
-  RETURN_NOT_OK(ReadEntryHeader(&cur_offset, &header, status_detail));
-  Status s = ReadEntryBatch(&cur_offset, header, tmp_buf, batch);
+  RETURN_NOT_OK(ReadEntryHeader(
+      &cur_offset, &header, status_detail, read_buffer, mapping));
+  Status s = ReadEntryBatch(
+      &cur_offset, header, tmp_buf, batch, read_buffer, mapping);
   if (PREDICT_FALSE(!s.ok())) {
     // If we failed to actually decode the batch, make sure to set status_detail
     // to non-OK.
@@ -701,12 +1122,27 @@ Status ReadableLogSegment::ReadEntryHeaderAndBatch(
 Status ReadableLogSegment::ReadEntryHeader(
     int64_t* offset,
     EntryHeader* header,
-    EntryHeaderStatus* status_detail) {
+    EntryHeaderStatus* status_detail,
+    LogReadAheadBuffer* read_buffer,
+    const LogSegmentMapping* mapping) {
   const size_t header_size = entry_header_size();
   uint8_t scratch[header_size];
   Slice slice(scratch, header_size);
-  RETURN_NOT_OK_PREPEND(
-      readable_file()->Read(*offset, slice), "Could not read log entry header");
+  if (mapping) {
+    RETURN_NOT_OK_PREPEND(
+        mapping->Read(*offset, header_size, &slice),
+        "Could not read log entry header");
+  } else if (read_buffer) {
+    RETURN_NOT_OK_PREPEND(
+        read_buffer->Read(
+            readable_file_.get(), *offset, header_size, readable_up_to(),
+            &slice),
+        "Could not read log entry header");
+  } else {
+    RETURN_NOT_OK_PREPEND(
+        readable_file()->Read(*offset, slice),
+        "Could not read log entry header");
+  }
 
   *status_detail = DecodeEntryHeader(slice, header);
   switch (*status_detail) {
@@ -758,7 +1194,9 @@ Status ReadableLogSegment::ReadEntryBatch(
     int64_t* offset,
     const EntryHeader& header,
     faststring* tmp_buf,
-    unique_ptr<LogEntryBatchPB>* entry_batch) {
+    unique_ptr<LogEntryBatchPB>* entry_batch,
+    LogReadAheadBuffer* read_buffer,
+    const LogSegmentMapping* mapping) {
   TRACE_EVENT2(
       "log",
       "ReadableLogSegment::ReadEntryBatch",
@@ -783,19 +1221,47 @@ Status ReadableLogSegment::ReadEntryBatch(
   }
 
   tmp_buf->clear();
-  size_t buf_len = header.msg_length_compressed;
-  if (codec_) {
-    // Reserve some space for the decompressed copy as well.
-    buf_len += header.msg_length;
+  Slice entry_batch_slice;
+  Status s;
+  if (mapping || read_buffer) {
+    // The batch is used in place, so 'tmp_buf' only needs room for the
+    // decompressed copy.
+    s = mapping ? mapping->Read(
+                      *offset, header.msg_length_compressed, &entry_batch_slice)
+                : read_buffer->Read(
+                      readable_file_.get(),
+                      *offset,
+                      header.msg_length_compressed,
+                      limit,
+                      &entry_batch_slice);
+    tmp_buf->resize(codec_ ? header.msg_length : 0);
+  } else {
+    size_t buf_len = header.msg_length_compressed;
+    if (codec_) {
+      // Reserve some space for the decompressed copy as well.
+      buf_len += header.msg_length;
+    }
+    tmp_buf->resize(buf_len);
+    entry_batch_slice = Slice(tmp_buf->data(), header.msg_length_compressed);
+    s = readable_file()->Read(*offset, entry_batch_slice);
   }
-  tmp_buf->resize(buf_len);
-  Slice entry_batch_slice(tmp_buf->data(), header.msg_length_compressed);
-  Status s = readable_file()->Read(*offset, entry_batch_slice);
 
   if (!s.ok())
     return Status::IOError(
         Substitute("Could not read entry. Cause: $0", s.ToString()));
 
+  RETURN_NOT_OK(DecodeEntryBatch(
+      *offset, header, entry_batch_slice, tmp_buf, entry_batch));
+  *offset += header.msg_length_compressed;
+  return Status::OK();
+}
+
+Status ReadableLogSegment::DecodeEntryBatch(
+    int64_t offset,
+    const EntryHeader& header,
+    Slice entry_batch_slice,
+    faststring* tmp_buf,
+    unique_ptr<LogEntryBatchPB>* entry_batch) {
   // Verify the CRC.
   uint32_t read_crc =
       crc::Crc32c(entry_batch_slice.data(), entry_batch_slice.size());
@@ -803,16 +1269,18 @@ Status ReadableLogSegment::ReadEntryBatch(
     return Status::Corruption(Substitute(
         "Entry CRC mismatch in byte range $0-$1: "
         "expected CRC=$2, computed=$3",
-        *offset,
-        *offset + header.msg_length,
+        offset,
+        offset + header.msg_length,
         header.msg_crc,
         read_crc));
   }
 
   // If it was compressed, decompress it.
   if (codec_) {
-    // We pre-reserved space for the decompression up above.
-    uint8_t* uncompress_buf = &(*tmp_buf)[header.msg_length_compressed];
+    // We pre-reserved space for the decompression up above, at the end of
+    // 'tmp_buf'.
+    uint8_t* uncompress_buf =
+        tmp_buf->data() + tmp_buf->size() - header.msg_length;
     RETURN_NOT_OK_PREPEND(
         codec_->Uncompress(
             entry_batch_slice, uncompress_buf, header.msg_length),
@@ -821,7 +1289,7 @@ Status ReadableLogSegment::ReadEntryBatch(
   }
 
   unique_ptr<LogEntryBatchPB> read_entry_batch(new LogEntryBatchPB);
-  s = pb_util::ParseFromArray(
+  Status s = pb_util::ParseFromArray(
       read_entry_batch.get(), entry_batch_slice.data(), header.msg_length);
 
   if (!s.ok()) {
@@ -829,7 +1297,6 @@ Status ReadableLogSegment::ReadEntryBatch(
         Substitute("Could not parse PB. Cause: $0", s.ToString()));
   }
 
-  *offset += header.msg_length_compressed;
   entry_batch->reset(read_entry_batch.release());
   return Status::OK();
 }
@@ -841,7 +1308,9 @@ WritableLogSegment::WritableLogSegment(
       writable_file_(std::move(writable_file)),
       is_header_written_(false),
       is_footer_written_(false),
-      written_offset_(0) {}
+      written_offset_(0),
+      sync_marker_interval_(0),
+      next_sync_marker_offset_(0) {}
 
 Status WritableLogSegment::WriteHeaderAndOpen(
     const LogSegmentHeaderPB& new_header) {
@@ -864,6 +1333,11 @@ Status WritableLogSegment::WriteHeaderAndOpen(
   first_entry_offset_ = buf.size();
   written_offset_ = first_entry_offset_;
   is_header_written_ = true;
+  sync_marker_interval_ = header_.sync_marker_interval_bytes();
+  if (sync_marker_interval_ > 0) {
+    next_sync_marker_offset_ =
+        (written_offset_ / sync_marker_interval_ + 1) * sync_marker_interval_;
+  }
 
   return Status::OK();
 }
@@ -894,39 +1368,84 @@ Status WritableLogSegment::WriteFooterAndClose(
 }
 
 Status WritableLogSegment::WriteEntryBatch(
-    const Slice& data,
-    const std::shared_ptr<CompressionCodec>& codec) {
+    const vector<Slice>& data,
+    const std::shared_ptr<CompressionCodec>& codec,
+    bool sync) {
   DCHECK(is_header_written_);
   DCHECK(!is_footer_written_);
   uint8_t header_buf[kEntryHeaderSizeV2];
 
-  const uint32_t uncompressed_len = data.size();
+  uint32_t uncompressed_len = 0;
+  for (const Slice& d : data) {
+    uncompressed_len += d.size();
+  }
+
+  // The header goes first, followed by the batch data itself.
+  write_slices_.clear();
+  write_slices_.emplace_back(header_buf, arraysize(header_buf));
 
   // If necessary, compress the data.
-  Slice data_to_write;
+  uint32_t len_to_write;
+  uint32_t crc;
   if (codec) {
     DCHECK_NE(header_.compression_codec(), NO_COMPRESSION);
     compress_buf_.resize(codec->MaxCompressedLength(uncompressed_len));
     size_t compressed_len;
     RETURN_NOT_OK(codec->Compress(data, &compress_buf_[0], &compressed_len));
     compress_buf_.resize(compressed_len);
-    data_to_write = Slice(compress_buf_.data(), compress_buf_.size());
+    write_slices_.emplace_back(compress_buf_.data(), compress_buf_.size());
+    len_to_write = compressed_len;
+    crc = crc::Crc32c(compress_buf_.data(), compress_buf_.size());
   } else {
-    data_to_write = data;
+    len_to_write = uncompressed_len;
+    crc = 0;
+    for (const Slice& d : data) {
+      crc = crc::Crc32c(d.data(), d.size(), crc);
+      write_slices_.push_back(d);
+    }
   }
 
   // Fill in the header.
-  InlineEncodeFixed32(&header_buf[0], data_to_write.size());
+  InlineEncodeFixed32(&header_buf[0], len_to_write);
   InlineEncodeFixed32(&header_buf[4], uncompressed_len);
-  InlineEncodeFixed32(
-      &header_buf[8], crc::Crc32c(data_to_write.data(), data_to_write.size()));
+  InlineEncodeFixed32(&header_buf[8], crc);
   InlineEncodeFixed32(
       &header_buf[12], crc::Crc32c(&header_buf[0], kEntryHeaderSizeV2 - 4));
 
-  // Write the header to the file, followed by the batch data itself.
-  Slice slices[2] = {Slice(header_buf, arraysize(header_buf)), data_to_write};
-  RETURN_NOT_OK(writable_file_->AppendV(slices));
-  written_offset_ += arraysize(header_buf) + data_to_write.size();
+  if (sync) {
+    RETURN_NOT_OK(writable_file_->AppendVAndSync(write_slices_));
+  } else {
+    RETURN_NOT_OK(writable_file_->AppendV(write_slices_));
+  }
+  written_offset_ += arraysize(header_buf) + len_to_write;
+  return Status::OK();
+}
+
+Status WritableLogSegment::WriteSyncMarker(
+    const LogSegmentFooterPB& footer,
+    const std::shared_ptr<CompressionCodec>& codec,
+    bool synced) {
+  DCHECK(NeedsSyncMarker());
+  // A marker which made it to disk vouches for the entries before it, which
+  // recovery then doesn't read.
+  if (!synced) {
+    RETURN_NOT_OK(writable_file_->Sync());
+  }
+
+  LogEntryBatchPB batch;
+  LogEntryPB* entry = batch.add_entry();
+  entry->set_type(SYNC_MARKER);
+  SyncMarkerPB* marker = entry->mutable_sync_marker();
+  marker->set_sequence_number(header_.sequence_number());
+  marker->set_offset(written_offset_);
+  marker->mutable_footer()->CopyFrom(footer);
+  marker->mutable_footer()->clear_close_timestamp_micros();
+  faststring buf;
+  pb_util::AppendToString(batch, &buf);
+  RETURN_NOT_OK(WriteEntryBatch({Slice(buf)}, codec));
+
+  next_sync_marker_offset_ =
+      (written_offset_ / sync_marker_interval_ + 1) * sync_marker_interval_;
   return Status::OK();
 }
 
@@ -937,7 +1456,7 @@ unique_ptr<LogEntryBatchPB> CreateBatchFromAllocatedOperations(
   for (const auto& msg : msgs) {
     LogEntryPB* entry_pb = entry_batch->add_entry();
     entry_pb->set_type(log::REPLICATE);
-    entry_pb->set_allocated_replicate(msg->get());
+    entry_pb->unsafe_arena_set_allocated_replicate(msg->get());
   }
   return entry_batch;
 }
@@ -973,5 +1492,30 @@ void UpdateFooterForReplicateEntry(
   }
 }
 
+bool IsSyncMarkerBatch(const LogEntryBatchPB& batch) {
+  return batch.entry_size() == 1 && batch.entry(0).type() == SYNC_MARKER;
+}
+
+int64_t GroupCommitDelayUs(
+    int64_t max_delay_us,
+    int64_t target_latency_us,
+    int64_t ewma_sync_us,
+    double ewma_arrival_interval_us) {
+  if (max_delay_us <= 0) {
+    return 0;
+  }
+  // Never wait for longer than a sync takes: at that point we'd be better
+  // off issuing this sync and letting the next group collect the newcomers.
+  int64_t delay_us = std::min(max_delay_us, ewma_sync_us);
+  // Stay within the latency budget.
+  delay_us = std::min(delay_us, target_latency_us - ewma_sync_us);
+  // Only wait if at least one more batch is expected to show up in time.
+  if (delay_us <= 0 || ewma_arrival_interval_us == 0 ||
+      ewma_arrival_interval_us > delay_us) {
+    return 0;
+  }
+  return delay_us;
+}
+
 } // namespace log
 } // namespace kudu
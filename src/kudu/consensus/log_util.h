@@ -74,6 +74,12 @@ struct LogOptions {
   // Whether the allocation should happen asynchronously.
   bool async_preallocate_segments;
 
+  // Whether segments should be written and synced through io_uring.
+  bool use_io_uring;
+
+  // Whether segments should be written with O_DIRECT.
+  bool use_direct_io;
+
   std::shared_ptr<LogFactory> log_factory;
 
   LogOptions();
@@ -98,6 +104,75 @@ enum class EntryHeaderStatus {
   OTHER_ERROR
 };
 
+// A read-only mapping of a sealed log segment, from which entries are parsed
+// in place. See --log_mmap_sealed_segments.
+//
+// This class is thread safe.
+class LogSegmentMapping {
+ public:
+  // Maps the first 'size' bytes of the file at 'path'.
+  static Status Create(
+      const std::string& path,
+      int64_t size,
+      std::shared_ptr<LogSegmentMapping>* mapping);
+
+  ~LogSegmentMapping();
+
+  // Sets 'result' to the 'length' bytes at 'offset' of the mapping.
+  Status Read(int64_t offset, int64_t length, Slice* result) const;
+
+  // Hints that the 'length' bytes at 'offset' are read soon.
+  void WillNeed(int64_t offset, int64_t length) const;
+
+  int64_t size() const {
+    return size_;
+  }
+
+ private:
+  LogSegmentMapping(uint8_t* data, int64_t size);
+
+  uint8_t* const data_;
+  const int64_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogSegmentMapping);
+};
+
+// A window over a log segment which is filled with large, aligned reads, for
+// readers going through segments in order. The file is advised to be read
+// sequentially and the window following the current one is read ahead.
+//
+// The buffer is reused from one window and segment to the next. This class is
+// not thread safe.
+class LogReadAheadBuffer {
+ public:
+  // Reads the file 'window_size' bytes at a time.
+  explicit LogReadAheadBuffer(int64_t window_size);
+
+  // Sets 'result' to the 'length' bytes at 'offset' in 'file', which is only
+  // read up to 'limit' unless the range goes past it. 'result' points into the
+  // buffer and is valid until the next call.
+  Status Read(
+      const RandomAccessFile* file,
+      int64_t offset,
+      int64_t length,
+      int64_t limit,
+      Slice* result);
+
+  // Forgets the current window, e.g. because the file it was read from may
+  // have been closed.
+  void Reset();
+
+ private:
+  const int64_t window_size_;
+
+  // The file 'buf_' holds data of, from 'start_' on. NULL if none.
+  const RandomAccessFile* file_;
+  int64_t start_;
+  faststring buf_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogReadAheadBuffer);
+};
+
 // LogEntryReader provides iterator-style access to read the entries
 // from an open log segment.
 class LogEntryReader {
@@ -106,6 +181,10 @@ class LogEntryReader {
   // 'seg' must outlive the LogEntryReader.
   explicit LogEntryReader(ReadableLogSegment* seg);
 
+  // Same as above, but starts reading at 'offset', which must be the offset of
+  // an entry batch in 'seg' (e.g. as recorded in the log index).
+  LogEntryReader(ReadableLogSegment* seg, int64_t offset);
+
   ~LogEntryReader();
 
   // Read the next entry from the log, replacing the contents of 'entry'.
@@ -123,6 +202,10 @@ class LogEntryReader {
     return read_up_to_;
   }
 
+  // Makes this reader read the segment through 'read_buffer', which must
+  // outlive it, instead of issuing a read per entry header and batch.
+  void SetReadBuffer(LogReadAheadBuffer* read_buffer);
+
  private:
   friend class ReadableLogSegment;
 
@@ -158,12 +241,25 @@ class LogEntryReader {
   // The offset of the next entry to be read.
   int64_t offset_;
 
+  // The offset this reader started reading at. The number of entries read is
+  // only checked against the footer if this is the first entry of the segment.
+  const int64_t start_offset_;
+
   // The offset at which this reader will stop reading entries.
   int64_t read_up_to_;
 
   // Temporary buffer used for deserialization.
   faststring tmp_buf_;
 
+  // See SetReadBuffer(). NULL if the segment is read directly.
+  LogReadAheadBuffer* read_buffer_;
+
+  // The mapping of the segment if it is sealed and mapped, which takes
+  // precedence over 'read_buffer_', and how far it was advised to be read
+  // ahead.
+  std::shared_ptr<LogSegmentMapping> mapping_;
+  int64_t mapping_advised_up_to_;
+
   DISALLOW_COPY_AND_ASSIGN(LogEntryReader);
 };
 
@@ -244,6 +340,17 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
     return footer_.IsInitialized();
   }
 
+  // Returns a mapping of the segment if it is sealed and
+  // --log_mmap_sealed_segments is set, or NULL. Mappings are shared, and a
+  // bounded number of them is kept between calls.
+  std::shared_ptr<LogSegmentMapping> GetMapping();
+
+  // Marks the segment as rewritten, i.e. about to be replaced at its path by
+  // another file, after which it is only read through the file it has open.
+  void MarkRewritten() {
+    rewritten_.Store(true);
+  }
+
   // Returns this log segment's footer.
   //
   // If HasFooter() returns false this cannot be called.
@@ -276,9 +383,11 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
 
  private:
   friend class RefCountedThreadSafe<ReadableLogSegment>;
+  friend class Log;
   friend class LogEntryReader;
   friend class LogReader;
   FRIEND_TEST(LogTest, TestWriteAndReadToAndFromInProgressSegment);
+  FRIEND_TEST(LogTestOptionalCompression, TestRebuildFooterFromSyncMarker);
 
   struct EntryHeader {
     // The length of the batch data (uncompressed)
@@ -296,7 +405,7 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
     uint32_t header_crc;
   };
 
-  ~ReadableLogSegment() {}
+  ~ReadableLogSegment();
 
   // Helper functions called by Init().
 
@@ -340,17 +449,45 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
   // the file.
   Status ScanForValidEntryHeaders(int64_t offset, bool* has_valid_entries);
 
+  // Sets '*header_offset' to the first offset in ['offset', 'limit') at which
+  // a valid log entry header starts. Returns NotFound if there is none.
+  Status FindEntryHeader(
+      int64_t offset,
+      int64_t limit,
+      int64_t* header_offset);
+
+  // Looks for the last valid sync marker of the segment, with a binary search
+  // over the intervals of its header's sync_marker_interval_bytes. If one is
+  // found, sets '*offset' to the offset of its batch, and 'footer' to the
+  // footer of the entries before it. Returns NotFound otherwise.
+  Status FindLastSyncMarker(int64_t* offset, LogSegmentFooterPB* footer);
+
+  // Reads the sync marker which is the first batch in ['offset', 'limit'),
+  // like FindLastSyncMarker(). Returns NotFound if that batch is not a valid
+  // sync marker of this segment.
+  Status ReadSyncMarker(
+      int64_t offset,
+      int64_t limit,
+      int64_t* marker_offset,
+      LogSegmentFooterPB* footer);
+
   // Read an entry header and its associated batch at the given offset.
   // If successful, updates '*offset' to point to the next batch
   // in the file.
   //
   // If unsuccessful, '*offset' is not updated, and *status_detail will be
   // updated to indicate the cause of the error.
+  //
+  // The entry is parsed in place from 'mapping' if it is not NULL, or else
+  // read through 'read_buffer' if it is not NULL. If both are NULL, the
+  // segment's own mapping is used if there is one.
   Status ReadEntryHeaderAndBatch(
       int64_t* offset,
       faststring* tmp_buf,
       std::unique_ptr<LogEntryBatchPB>* batch,
-      EntryHeaderStatus* status_detail);
+      EntryHeaderStatus* status_detail,
+      LogReadAheadBuffer* read_buffer = nullptr,
+      const LogSegmentMapping* mapping = nullptr);
 
   // Reads a log entry header from the segment.
   //
@@ -359,7 +496,9 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
   Status ReadEntryHeader(
       int64_t* offset,
       EntryHeader* header,
-      EntryHeaderStatus* status_detail);
+      EntryHeaderStatus* status_detail,
+      LogReadAheadBuffer* read_buffer = nullptr,
+      const LogSegmentMapping* mapping = nullptr);
 
   // Decode a log entry header from the given slice. The header length is
   // determined by 'entry_header_size()'.
@@ -375,6 +514,19 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
       int64_t* offset,
       const EntryHeader& header,
       faststring* tmp_buf,
+      std::unique_ptr<LogEntryBatchPB>* entry_batch,
+      LogReadAheadBuffer* read_buffer = nullptr,
+      const LogSegmentMapping* mapping = nullptr);
+
+  // Checks 'entry_batch_slice', the bytes of the batch of 'header' read from
+  // 'offset', against their CRC and decodes them into 'entry_batch'. If the
+  // segment is compressed, they are uncompressed into the last
+  // 'header.msg_length' bytes of 'tmp_buf', which must not overlap them.
+  Status DecodeEntryBatch(
+      int64_t offset,
+      const EntryHeader& header,
+      Slice entry_batch_slice,
+      faststring* tmp_buf,
       std::unique_ptr<LogEntryBatchPB>* entry_batch);
 
   void UpdateReadableToOffset(int64_t readable_to_offset);
@@ -410,6 +562,10 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
   // True if the footer was rebuilt, rather than actually found on disk.
   bool footer_was_rebuilt_;
 
+  // Set by MarkRewritten(). A rewritten segment is no longer mapped, since
+  // mappings are created from its path.
+  AtomicBool rewritten_;
+
   // the offset of the first entry in the log
   int64_t first_entry_offset_;
 
@@ -438,13 +594,33 @@ class WritableLogSegment {
     return writable_file_->Size();
   }
 
-  // Appends the provided batch of data, including a header
-  // and checksum. If 'codec' is not NULL, compresses the batch.
+  // Appends the provided batch of data, given as the concatenation of the
+  // 'data' slices, including a header and checksum. If 'codec' is not NULL,
+  // compresses the batch. Otherwise the slices are written with a single
+  // vectored write, without being copied.
   // Makes sure that the log segment has not been closed.
-  // Write a compressed entry to the log.
+  //
+  // If 'sync' is true, also syncs the underlying file, possibly along with
+  // the write itself.
   Status WriteEntryBatch(
-      const Slice& data,
-      const std::shared_ptr<CompressionCodec>& codec);
+      const std::vector<Slice>& data,
+      const std::shared_ptr<CompressionCodec>& codec,
+      bool sync = false);
+
+  // Returns true if the header has a sync_marker_interval_bytes, and the
+  // entries written cross a multiple of it which has no sync marker yet.
+  bool NeedsSyncMarker() const {
+    return sync_marker_interval_ > 0 &&
+        written_offset_ >= next_sync_marker_offset_;
+  }
+
+  // Writes a sync marker recording 'footer', which must be the footer of the
+  // entries written so far, compressed with 'codec' like WriteEntryBatch().
+  // Syncs the entries before the marker first, unless 'synced'.
+  Status WriteSyncMarker(
+      const LogSegmentFooterPB& footer,
+      const std::shared_ptr<CompressionCodec>& codec,
+      bool synced);
 
   // Makes sure the I/O buffers in the underlying writable file are flushed.
   Status Sync() {
@@ -508,9 +684,16 @@ class WritableLogSegment {
   // The offset where the last written entry ends.
   int64_t written_offset_;
 
+  // See NeedsSyncMarker().
+  int64_t sync_marker_interval_;
+  int64_t next_sync_marker_offset_;
+
   // Buffer used for output when compressing.
   faststring compress_buf_;
 
+  // The slices of the entry being written, reused across writes.
+  std::vector<Slice> write_slices_;
+
   DISALLOW_COPY_AND_ASSIGN(WritableLogSegment);
 };
 
@@ -528,6 +711,20 @@ void UpdateFooterForReplicateEntry(
     const LogEntryPB& entry_pb,
     LogSegmentFooterPB* footer);
 
+// Returns true if 'batch' is a sync marker, see SyncMarkerPB.
+bool IsSyncMarkerBatch(const LogEntryBatchPB& batch);
+
+// Returns how long, in microseconds, the WAL append thread waits for more
+// entry batches to join a group before syncing it, given the upper bound
+// 'max_delay_us', the group commit latency target 'target_latency_us', and
+// the moving averages of the sync latency and of the interval between batch
+// arrivals, which are 0 until measured. See --log_group_commit_max_delay_us.
+int64_t GroupCommitDelayUs(
+    int64_t max_delay_us,
+    int64_t target_latency_us,
+    int64_t ewma_sync_us,
+    double ewma_arrival_interval_us);
+
 } // namespace log
 } // namespace kudu
 
@@ -38,7 +38,7 @@
 
 #include "kudu/clock/clock.h"
 #include "kudu/common/timestamp.h"
-#include "kudu/common/wire_protocol-test-util.h"
+//#include "kudu/common/wire_protocol-test-util.h"
 #include "kudu/common/wire_protocol.pb.h"
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/log-test-base.h"
@@ -91,7 +91,7 @@ using consensus::make_scoped_refptr_replicate;
 using consensus::OpId;
 using consensus::ReplicateMsg;
 using consensus::ReplicateRefPtr;
-using consensus::WRITE_OP;
+using consensus::WRITE_OP_EXT;
 using std::shared_ptr;
 using std::vector;
 
@@ -137,8 +137,9 @@ class MultiThreadedLogTest : public LogTestBase {
     for (int j = 0; j < num_ops; j++) {
       ReplicateRefPtr replicate =
           make_scoped_refptr_replicate(new ReplicateMsg);
-      replicate->get()->set_op_type(WRITE_OP);
+      replicate->get()->set_op_type(WRITE_OP_EXT);
       replicate->get()->set_timestamp(clock_->Now().ToUint64());
+#ifdef FB_DO_NOT_REMOVE
       tserver::WriteRequestPB* request =
           replicate->get()->mutable_write_request();
       AddTestRowToPB(
@@ -149,6 +150,10 @@ class MultiThreadedLogTest : public LogTestBase {
           "this is a test insert",
           request->mutable_row_operations());
       request->set_tablet_id(kTestTablet);
+#else
+      replicate->get()->mutable_write_payload()->set_payload(
+          "this is a test insert");
+#endif
       ret.push_back(replicate);
     }
     return ret;
@@ -286,5 +291,35 @@ TEST_F(MultiThreadedLogTest, TestAppendThreadStartStopRaces) {
   ASSERT_NO_FATAL_FAILURE(VerifyLog());
 }
 
+// Compares the throughput of fsynced appends with buffered and direct I/O
+// WAL segments.
+class MultiThreadedLogIoModeTest : public MultiThreadedLogTest,
+                                   public ::testing::WithParamInterface<bool> {
+};
+
+TEST_P(MultiThreadedLogIoModeTest, BenchmarkSyncedAppends) {
+  options_.use_direct_io = GetParam();
+  options_.force_fsync_all = true;
+  ASSERT_OK(BuildLog());
+  LOG_TIMING(
+      INFO,
+      strings::Substitute(
+          "inserting $0 synced batches with $1 I/O ($2 threads)",
+          FLAGS_num_writer_threads * FLAGS_num_batches_per_thread,
+          GetParam() ? "direct" : "buffered",
+          FLAGS_num_writer_threads)) {
+    ASSERT_NO_FATAL_FAILURE(Run());
+  }
+  ASSERT_OK(log_->Close());
+  if (FLAGS_verify_log) {
+    ASSERT_NO_FATAL_FAILURE(VerifyLog());
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(
+    DirectIo,
+    MultiThreadedLogIoModeTest,
+    ::testing::Values(false, true));
+
 } // namespace log
 } // namespace kudu
@@ -0,0 +1,172 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/multi_raft_batcher.h"
+
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/consensus.proxy.h"
+#include "kudu/rpc/messenger.h"
+#include "kudu/rpc/rpc_controller.h"
+#include "kudu/util/countdown_latch.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/net/sockaddr.h"
+#include "kudu/util/net/socket.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_int32(consensus_heartbeat_batch_max_size);
+DECLARE_int32(consensus_heartbeat_batch_window_ms);
+DECLARE_int32(consensus_rpc_timeout_ms);
+DECLARE_int32(raft_proxy_fanout_batch_max_size);
+DECLARE_int32(raft_proxy_fanout_batch_window_us);
+
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace kudu {
+namespace consensus {
+
+class MultiRaftBatcherTest : public KuduTest {
+ public:
+  void SetUp() override {
+    KuduTest::SetUp();
+    ASSERT_OK(rpc::MessengerBuilder("test").Build(&messenger_));
+
+    // A bound socket which does not listen refuses connections, so that
+    // every call to it fails quickly.
+    Sockaddr addr;
+    ASSERT_OK(addr.ParseString("127.0.0.1", 0));
+    ASSERT_OK(sock_.Init(0));
+    ASSERT_OK(sock_.Bind(addr));
+    ASSERT_OK(sock_.GetSocketAddress(&addr));
+    proxy_ = std::make_shared<ConsensusServiceProxy>(
+        messenger_, addr, addr.host());
+  }
+
+  void TearDown() override {
+    messenger_->Shutdown();
+    KuduTest::TearDown();
+  }
+
+ protected:
+  struct Heartbeat {
+    ConsensusRequestPB request;
+    ConsensusResponsePB response;
+    rpc::RpcController controller;
+  };
+
+  // Queues 'n' heartbeats on 'batcher', which count down 'latch' when done.
+  template <class Batcher>
+  void AddHeartbeats(
+      Batcher* batcher,
+      int n,
+      CountDownLatch* latch) {
+    for (int i = 0; i < n; i++) {
+      heartbeats_.emplace_back(new Heartbeat());
+      Heartbeat* hb = heartbeats_.back().get();
+      hb->request.set_tablet_id(std::to_string(i));
+      hb->request.set_caller_uuid("leader");
+      hb->request.set_caller_term(1);
+      if (std::is_same<Batcher, ProxyFanoutBatcher>::value) {
+        hb->request.set_dest_uuid("peer-" + std::to_string(i));
+        hb->request.set_proxy_dest_uuid("proxy");
+      }
+      hb->controller.set_timeout(
+          MonoDelta::FromMilliseconds(FLAGS_consensus_rpc_timeout_ms));
+      batcher->AddRequest(
+          &hb->request, &hb->response, &hb->controller, [latch]() {
+            latch->CountDown();
+          });
+    }
+  }
+
+  shared_ptr<rpc::Messenger> messenger_;
+  Socket sock_;
+  shared_ptr<ConsensusServiceProxy> proxy_;
+  vector<std::unique_ptr<Heartbeat>> heartbeats_;
+};
+
+// When the batch as a whole fails, every heartbeat is retried on its own and
+// reports its failure through its own controller.
+TEST_F(MultiRaftBatcherTest, TestFallsBackWhenBatchFails) {
+  FLAGS_consensus_heartbeat_batch_window_ms = 10;
+  auto batcher =
+      std::make_shared<MultiRaftHeartbeatBatcher>(messenger_, proxy_);
+
+  const int kNumHeartbeats = 5;
+  CountDownLatch latch(kNumHeartbeats);
+  NO_FATALS(AddHeartbeats(batcher.get(), kNumHeartbeats, &latch));
+  ASSERT_TRUE(latch.WaitFor(MonoDelta::FromSeconds(30)));
+  for (const auto& hb : heartbeats_) {
+    ASSERT_TRUE(hb->controller.status().IsNetworkError())
+        << hb->controller.status().ToString();
+  }
+  // A refused connection says nothing about what the server supports.
+  ASSERT_TRUE(batcher->supported());
+}
+
+// A full batch does not wait for the batching window to end.
+TEST_F(MultiRaftBatcherTest, TestFullBatchIsSentRightAway) {
+  FLAGS_consensus_heartbeat_batch_window_ms = 3600 * 1000;
+  FLAGS_consensus_heartbeat_batch_max_size = 4;
+  auto batcher =
+      std::make_shared<MultiRaftHeartbeatBatcher>(messenger_, proxy_);
+
+  CountDownLatch latch(FLAGS_consensus_heartbeat_batch_max_size);
+  NO_FATALS(AddHeartbeats(
+      batcher.get(), FLAGS_consensus_heartbeat_batch_max_size, &latch));
+  ASSERT_TRUE(latch.WaitFor(MonoDelta::FromSeconds(30)));
+
+  // A partial batch waits for the window, which aborts on shutdown so that
+  // its callbacks still run.
+  CountDownLatch partial_latch(1);
+  NO_FATALS(AddHeartbeats(batcher.get(), 1, &partial_latch));
+  ASSERT_FALSE(partial_latch.WaitFor(MonoDelta::FromMilliseconds(100)));
+  messenger_->Shutdown();
+  ASSERT_TRUE(partial_latch.WaitFor(MonoDelta::FromSeconds(30)));
+}
+
+// Proxy requests fall back the same way when their batch fails.
+TEST_F(MultiRaftBatcherTest, TestProxyFanoutFallsBackWhenBatchFails) {
+  FLAGS_raft_proxy_fanout_batch_window_us = 10 * 1000;
+  FLAGS_raft_proxy_fanout_batch_max_size = 3;
+  auto batcher = std::make_shared<ProxyFanoutBatcher>(messenger_, proxy_);
+
+  // One full batch, and one sent at the end of the window.
+  const int kNumRequests = 5;
+  CountDownLatch latch(kNumRequests);
+  NO_FATALS(AddHeartbeats(batcher.get(), kNumRequests, &latch));
+  ASSERT_TRUE(latch.WaitFor(MonoDelta::FromSeconds(30)));
+  for (const auto& hb : heartbeats_) {
+    ASSERT_TRUE(hb->controller.status().IsNetworkError())
+        << hb->controller.status().ToString();
+  }
+  ASSERT_TRUE(batcher->supported());
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,311 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/multi_raft_batcher.h"
+
+#include <mutex>
+#include <utility>
+
+#include <boost/function.hpp>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/consensus/consensus.proxy.h"
+#include "kudu/rpc/messenger.h"
+#include "kudu/rpc/rpc_header.pb.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/status.h"
+
+DEFINE_bool(
+    consensus_batch_heartbeats,
+    false,
+    "Whether the heartbeats which the Raft groups of this server send to the "
+    "same remote server are coalesced into single RPCs.");
+TAG_FLAG(consensus_batch_heartbeats, experimental);
+TAG_FLAG(consensus_batch_heartbeats, runtime);
+
+DEFINE_int32(
+    consensus_heartbeat_batch_window_ms,
+    50,
+    "With --consensus_batch_heartbeats, the longest a heartbeat waits for "
+    "others to the same server before they are all sent.");
+TAG_FLAG(consensus_heartbeat_batch_window_ms, experimental);
+TAG_FLAG(consensus_heartbeat_batch_window_ms, runtime);
+
+DEFINE_int32(
+    consensus_heartbeat_batch_max_size,
+    1000,
+    "With --consensus_batch_heartbeats, the most heartbeats sent in one RPC. "
+    "A batch which fills up is sent right away.");
+TAG_FLAG(consensus_heartbeat_batch_max_size, experimental);
+TAG_FLAG(consensus_heartbeat_batch_max_size, runtime);
+
+DEFINE_bool(
+    raft_proxy_fanout,
+    false,
+    "Whether the requests which a leader sends through the same proxy peer "
+    "are coalesced into single RPCs, which the proxy fans out to their "
+    "destinations, instead of taking one RPC to the proxy each.");
+TAG_FLAG(raft_proxy_fanout, experimental);
+TAG_FLAG(raft_proxy_fanout, runtime);
+
+DEFINE_int32(
+    raft_proxy_fanout_batch_window_us,
+    500,
+    "With --raft_proxy_fanout, the longest a proxy request waits for others "
+    "through the same proxy peer before they are all sent.");
+TAG_FLAG(raft_proxy_fanout_batch_window_us, experimental);
+TAG_FLAG(raft_proxy_fanout_batch_window_us, runtime);
+
+DEFINE_int32(
+    raft_proxy_fanout_batch_max_size,
+    64,
+    "With --raft_proxy_fanout, the most proxy requests sent in one RPC. A "
+    "batch which fills up is sent right away.");
+TAG_FLAG(raft_proxy_fanout_batch_max_size, experimental);
+TAG_FLAG(raft_proxy_fanout_batch_max_size, runtime);
+
+DECLARE_int32(consensus_rpc_timeout_ms);
+
+using std::shared_ptr;
+using std::string;
+using std::weak_ptr;
+
+namespace kudu {
+namespace consensus {
+
+MultiRaftHeartbeatBatcher::MultiRaftHeartbeatBatcher(
+    shared_ptr<rpc::Messenger> messenger,
+    shared_ptr<ConsensusServiceProxy> proxy)
+    : messenger_(std::move(messenger)),
+      proxy_(std::move(proxy)),
+      supported_(true) {}
+
+void MultiRaftHeartbeatBatcher::AddRequest(
+    const ConsensusRequestPB* request,
+    ConsensusResponsePB* response,
+    rpc::RpcController* controller,
+    rpc::ResponseCallback callback) {
+  DCHECK_EQ(0, request->ops_size());
+  shared_ptr<Batch> new_batch;
+  shared_ptr<Batch> full_batch;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (!current_batch_) {
+      current_batch_ = std::make_shared<Batch>();
+      current_batch_->batcher = shared_from_this();
+      new_batch = current_batch_;
+    }
+    current_batch_->entries.push_back(
+        {request, response, controller, std::move(callback)});
+    if (static_cast<int>(current_batch_->entries.size()) >=
+        FLAGS_consensus_heartbeat_batch_max_size) {
+      full_batch = std::move(current_batch_);
+    }
+  }
+
+  if (full_batch) {
+    SendBatch(full_batch);
+  } else if (new_batch) {
+    // The batch is sent even if the reactor is shutting down and aborts the
+    // task, so that every callback runs.
+    messenger_->ScheduleOnReactor(
+        [new_batch](const Status& /* s */) {
+          new_batch->batcher->FlushIfCurrent(new_batch);
+        },
+        MonoDelta::FromMilliseconds(FLAGS_consensus_heartbeat_batch_window_ms));
+  }
+}
+
+void MultiRaftHeartbeatBatcher::FlushIfCurrent(const shared_ptr<Batch>& batch) {
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (current_batch_ != batch) {
+      // It filled up and went out already.
+      return;
+    }
+    current_batch_.reset();
+  }
+  SendBatch(batch);
+}
+
+void MultiRaftHeartbeatBatcher::SendBatch(const shared_ptr<Batch>& batch) {
+  batch->request.mutable_consensus_requests()->Reserve(batch->entries.size());
+  for (const Entry& entry : batch->entries) {
+    *batch->request.add_consensus_requests() = *entry.request;
+  }
+  batch->controller.set_timeout(
+      MonoDelta::FromMilliseconds(FLAGS_consensus_rpc_timeout_ms));
+  proxy_->MultiRaftUpdateConsensusAsync(
+      batch->request, &batch->response, &batch->controller, [batch]() {
+        ProcessBatchResponse(batch);
+      });
+}
+
+void MultiRaftHeartbeatBatcher::ProcessBatchResponse(
+    const shared_ptr<Batch>& batch) {
+  const Status s = batch->controller.status();
+  const int num_entries = static_cast<int>(batch->entries.size());
+  if (s.ok() && batch->response.consensus_responses_size() == num_entries) {
+    for (int i = 0; i < num_entries; i++) {
+      Entry& entry = batch->entries[i];
+      entry.response->Swap(batch->response.mutable_consensus_responses(i));
+      entry.callback();
+    }
+    return;
+  }
+
+  MultiRaftHeartbeatBatcher* batcher = batch->batcher.get();
+  const rpc::ErrorStatusPB* err = batch->controller.error_response();
+  if (err && err->code() == rpc::ErrorStatusPB::ERROR_NO_SUCH_METHOD) {
+    if (batcher->supported_.exchange(false)) {
+      LOG(INFO) << "Remote server does not support batched heartbeats, "
+                << "sending them one by one: " << s.ToString();
+    }
+  } else if (s.ok()) {
+    LOG(WARNING) << "Got " << batch->response.consensus_responses_size()
+                 << " responses to " << num_entries
+                 << " batched heartbeats, sending them one by one";
+  }
+
+  // Sending each heartbeat on its own gives its caller the status of its own
+  // call to go by.
+  for (Entry& entry : batch->entries) {
+    batcher->proxy_->UpdateConsensusAsync(
+        *entry.request, entry.response, entry.controller, entry.callback);
+  }
+}
+
+ProxyFanoutBatcher::ProxyFanoutBatcher(
+    shared_ptr<rpc::Messenger> messenger,
+    shared_ptr<ConsensusServiceProxy> proxy)
+    : messenger_(std::move(messenger)),
+      proxy_(std::move(proxy)),
+      supported_(true) {}
+
+void ProxyFanoutBatcher::AddRequest(
+    const ConsensusRequestPB* request,
+    ConsensusResponsePB* response,
+    rpc::RpcController* controller,
+    rpc::ResponseCallback callback) {
+  DCHECK(request->has_proxy_dest_uuid());
+  shared_ptr<Batch> new_batch;
+  shared_ptr<Batch> full_batch;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (!current_batch_) {
+      current_batch_ = std::make_shared<Batch>();
+      current_batch_->batcher = shared_from_this();
+      new_batch = current_batch_;
+    }
+    current_batch_->entries.push_back(
+        {request, response, controller, std::move(callback)});
+    if (static_cast<int>(current_batch_->entries.size()) >=
+        FLAGS_raft_proxy_fanout_batch_max_size) {
+      full_batch = std::move(current_batch_);
+    }
+  }
+
+  if (full_batch) {
+    SendBatch(full_batch);
+  } else if (new_batch) {
+    // As for heartbeats, the batch is sent even if the task is aborted.
+    messenger_->ScheduleOnReactor(
+        [new_batch](const Status& /* s */) {
+          new_batch->batcher->FlushIfCurrent(new_batch);
+        },
+        MonoDelta::FromMicroseconds(FLAGS_raft_proxy_fanout_batch_window_us));
+  }
+}
+
+void ProxyFanoutBatcher::FlushIfCurrent(const shared_ptr<Batch>& batch) {
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (current_batch_ != batch) {
+      // It filled up and went out already.
+      return;
+    }
+    current_batch_.reset();
+  }
+  SendBatch(batch);
+}
+
+void ProxyFanoutBatcher::SendBatch(const shared_ptr<Batch>& batch) {
+  batch->request.mutable_consensus_requests()->Reserve(batch->entries.size());
+  for (const Entry& entry : batch->entries) {
+    *batch->request.add_consensus_requests() = *entry.request;
+  }
+  // The proxy waits for the slowest destination before responding.
+  batch->controller.set_timeout(
+      MonoDelta::FromMilliseconds(FLAGS_consensus_rpc_timeout_ms));
+  proxy_->ProxyFanoutUpdateConsensusAsync(
+      batch->request, &batch->response, &batch->controller, [batch]() {
+        ProcessBatchResponse(batch);
+      });
+}
+
+void ProxyFanoutBatcher::ProcessBatchResponse(const shared_ptr<Batch>& batch) {
+  const Status s = batch->controller.status();
+  const int num_entries = static_cast<int>(batch->entries.size());
+  if (s.ok() && batch->response.consensus_responses_size() == num_entries) {
+    for (int i = 0; i < num_entries; i++) {
+      Entry& entry = batch->entries[i];
+      entry.response->Swap(batch->response.mutable_consensus_responses(i));
+      entry.callback();
+    }
+    return;
+  }
+
+  ProxyFanoutBatcher* batcher = batch->batcher.get();
+  const rpc::ErrorStatusPB* err = batch->controller.error_response();
+  if (err && err->code() == rpc::ErrorStatusPB::ERROR_NO_SUCH_METHOD) {
+    if (batcher->supported_.exchange(false)) {
+      LOG(INFO) << "Proxy does not support fanned out requests, sending them "
+                << "one by one: " << s.ToString();
+    }
+  } else if (s.ok()) {
+    LOG(WARNING) << "Got " << batch->response.consensus_responses_size()
+                 << " responses to " << num_entries
+                 << " fanned out proxy requests, sending them one by one";
+  }
+
+  for (Entry& entry : batch->entries) {
+    batcher->proxy_->UpdateConsensusAsync(
+        *entry.request, entry.response, entry.controller, entry.callback);
+  }
+}
+
+MultiRaftManager::MultiRaftManager(shared_ptr<rpc::Messenger> messenger)
+    : messenger_(std::move(messenger)) {}
+
+shared_ptr<MultiRaftHeartbeatBatcher> MultiRaftManager::GetBatcher(
+    const string& peer_uuid,
+    shared_ptr<ConsensusServiceProxy> proxy) {
+  std::lock_guard<simple_spinlock> l(lock_);
+  weak_ptr<MultiRaftHeartbeatBatcher>& slot = batchers_[peer_uuid];
+  shared_ptr<MultiRaftHeartbeatBatcher> batcher = slot.lock();
+  if (!batcher) {
+    batcher = std::make_shared<MultiRaftHeartbeatBatcher>(
+        messenger_, std::move(proxy));
+    slot = batcher;
+  }
+  return batcher;
+}
+
+} // namespace consensus
+} // namespace kudu
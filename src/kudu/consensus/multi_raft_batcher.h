@@ -0,0 +1,210 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/gutil/macros.h"
+#include "kudu/rpc/response_callback.h"
+#include "kudu/rpc/rpc_controller.h"
+#include "kudu/util/locks.h"
+
+namespace kudu {
+
+namespace rpc {
+class Messenger;
+} // namespace rpc
+
+namespace consensus {
+
+class ConsensusServiceProxy;
+
+// Coalesces the heartbeats which the Raft groups hosted in this process send
+// to one remote server. Heartbeats queued within
+// --consensus_heartbeat_batch_window_ms of each other go out as a single
+// MultiRaftUpdateConsensus() RPC, whose responses are handed back to the
+// individual callers.
+//
+// This class is thread-safe.
+class MultiRaftHeartbeatBatcher
+    : public std::enable_shared_from_this<MultiRaftHeartbeatBatcher> {
+ public:
+  MultiRaftHeartbeatBatcher(
+      std::shared_ptr<rpc::Messenger> messenger,
+      std::shared_ptr<ConsensusServiceProxy> proxy);
+
+  // Queues the heartbeat 'request', which must carry no ops. Once its batch
+  // completes, 'response' is filled in and 'callback' runs. If the batch
+  // fails as a whole, the heartbeat is sent on its own with 'controller', so
+  // that 'controller' reports why it failed. 'request', 'response' and
+  // 'controller' must stay valid until 'callback' runs.
+  void AddRequest(
+      const ConsensusRequestPB* request,
+      ConsensusResponsePB* response,
+      rpc::RpcController* controller,
+      rpc::ResponseCallback callback);
+
+  // Whether the remote server is believed to serve MultiRaftUpdateConsensus().
+  // Cleared when it turns out not to.
+  bool supported() const {
+    return supported_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Entry {
+    const ConsensusRequestPB* request;
+    ConsensusResponsePB* response;
+    rpc::RpcController* controller;
+    rpc::ResponseCallback callback;
+  };
+
+  struct Batch {
+    // Keeps the batcher alive while the batch is in flight.
+    std::shared_ptr<MultiRaftHeartbeatBatcher> batcher;
+
+    std::vector<Entry> entries;
+    MultiRaftConsensusRequestPB request;
+    MultiRaftConsensusResponsePB response;
+    rpc::RpcController controller;
+  };
+
+  // Sends 'batch' if it is still the one being filled.
+  void FlushIfCurrent(const std::shared_ptr<Batch>& batch);
+
+  void SendBatch(const std::shared_ptr<Batch>& batch);
+
+  static void ProcessBatchResponse(const std::shared_ptr<Batch>& batch);
+
+  const std::shared_ptr<rpc::Messenger> messenger_;
+  const std::shared_ptr<ConsensusServiceProxy> proxy_;
+
+  std::atomic<bool> supported_;
+
+  // Protects 'current_batch_'.
+  simple_spinlock lock_;
+
+  // The batch which new heartbeats are added to, or null if no heartbeat is
+  // waiting.
+  std::shared_ptr<Batch> current_batch_;
+
+  DISALLOW_COPY_AND_ASSIGN(MultiRaftHeartbeatBatcher);
+};
+
+// Coalesces the proxy requests which a leader sends through one proxy peer,
+// one per destination behind it. Requests queued within
+// --raft_proxy_fanout_batch_window_us of each other go out as a single
+// ProxyFanoutUpdateConsensus() RPC, which the proxy fans out to the
+// destinations, and whose response carries the response of each of them.
+//
+// This class is thread-safe.
+class ProxyFanoutBatcher
+    : public std::enable_shared_from_this<ProxyFanoutBatcher> {
+ public:
+  ProxyFanoutBatcher(
+      std::shared_ptr<rpc::Messenger> messenger,
+      std::shared_ptr<ConsensusServiceProxy> proxy);
+
+  // Queues the proxy request 'request', whose ops must all be PROXY_OP ops.
+  // Otherwise as MultiRaftHeartbeatBatcher::AddRequest().
+  void AddRequest(
+      const ConsensusRequestPB* request,
+      ConsensusResponsePB* response,
+      rpc::RpcController* controller,
+      rpc::ResponseCallback callback);
+
+  // Whether the proxy is believed to serve ProxyFanoutUpdateConsensus().
+  // Cleared when it turns out not to.
+  bool supported() const {
+    return supported_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Entry {
+    const ConsensusRequestPB* request;
+    ConsensusResponsePB* response;
+    rpc::RpcController* controller;
+    rpc::ResponseCallback callback;
+  };
+
+  struct Batch {
+    // Keeps the batcher alive while the batch is in flight.
+    std::shared_ptr<ProxyFanoutBatcher> batcher;
+
+    std::vector<Entry> entries;
+    MultiRaftConsensusRequestPB request;
+    MultiRaftConsensusResponsePB response;
+    rpc::RpcController controller;
+  };
+
+  // Sends 'batch' if it is still the one being filled.
+  void FlushIfCurrent(const std::shared_ptr<Batch>& batch);
+
+  void SendBatch(const std::shared_ptr<Batch>& batch);
+
+  static void ProcessBatchResponse(const std::shared_ptr<Batch>& batch);
+
+  const std::shared_ptr<rpc::Messenger> messenger_;
+  const std::shared_ptr<ConsensusServiceProxy> proxy_;
+
+  std::atomic<bool> supported_;
+
+  // Protects 'current_batch_'.
+  simple_spinlock lock_;
+
+  // The batch which new requests are added to, or null if no request is
+  // waiting.
+  std::shared_ptr<Batch> current_batch_;
+
+  DISALLOW_COPY_AND_ASSIGN(ProxyFanoutBatcher);
+};
+
+// Hands out the MultiRaftHeartbeatBatcher of each remote server, so that all
+// Raft groups of this process share it.
+//
+// This class is thread-safe.
+class MultiRaftManager {
+ public:
+  explicit MultiRaftManager(std::shared_ptr<rpc::Messenger> messenger);
+
+  // Returns the batcher for the server with uuid 'peer_uuid', creating it
+  // with 'proxy' if there is none yet.
+  std::shared_ptr<MultiRaftHeartbeatBatcher> GetBatcher(
+      const std::string& peer_uuid,
+      std::shared_ptr<ConsensusServiceProxy> proxy);
+
+ private:
+  const std::shared_ptr<rpc::Messenger> messenger_;
+
+  // Protects 'batchers_'.
+  simple_spinlock lock_;
+
+  // Batchers are owned by the peer proxies using them, so that the ones of
+  // servers which left every config go away.
+  std::unordered_map<std::string, std::weak_ptr<MultiRaftHeartbeatBatcher>>
+      batchers_;
+
+  DISALLOW_COPY_AND_ASSIGN(MultiRaftManager);
+};
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,129 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/op_tracer.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/consensus/opid_util.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_int32(consensus_op_trace_sample_rate);
+DECLARE_int32(consensus_slow_op_trace_threshold_ms);
+
+using std::string;
+using std::vector;
+
+namespace kudu {
+namespace consensus {
+
+METRIC_DECLARE_histogram(op_trace_committed_time);
+METRIC_DECLARE_histogram(op_trace_first_acked_time);
+
+class OpTracerTest : public KuduTest {
+ public:
+  OpTracerTest()
+      : entity_(METRIC_ENTITY_server.Instantiate(&registry_, "test")),
+        tracer_(entity_) {}
+
+ protected:
+  int64_t TotalCount(HistogramPrototype& prototype) {
+    return prototype.Instantiate(entity_)->TotalCount();
+  }
+
+  MetricRegistry registry_;
+  scoped_refptr<MetricEntity> entity_;
+  OpTracer tracer_;
+};
+
+TEST_F(OpTracerTest, TestSampling) {
+  FLAGS_consensus_op_trace_sample_rate = 10;
+  EXPECT_TRUE(OpTracer::ShouldTrace(10));
+  EXPECT_TRUE(OpTracer::ShouldTrace(20));
+  EXPECT_FALSE(OpTracer::ShouldTrace(11));
+  FLAGS_consensus_op_trace_sample_rate = 0;
+  EXPECT_FALSE(OpTracer::ShouldTrace(10));
+}
+
+// Ops are recorded in the stage histograms once committed, and only the slow
+// ones are kept, with their timeline.
+TEST_F(OpTracerTest, TestLifecycle) {
+  FLAGS_consensus_slow_op_trace_threshold_ms = 0;
+  MonoTime start = MonoTime::Now();
+  tracer_.StartOp(MakeOpId(1, 10), start);
+  tracer_.StartOp(MakeOpId(1, 20), start);
+  tracer_.RecordStage(1, 20, OpTracer::kQueued);
+  tracer_.RecordStage(1, 20, OpTracer::kLocalDurable);
+  tracer_.RecordSent("peer-a", 5, 20);
+  tracer_.RecordAcked("peer-a", 15, 100, 200);
+  tracer_.RecordStage(1, 15, OpTracer::kMajorityReplicated);
+
+  // Only the first op is committed.
+  tracer_.RecordCommitted(15);
+  ASSERT_EQ(1, tracer_.NumTracedOpsForTests());
+  ASSERT_EQ(1, TotalCount(METRIC_op_trace_committed_time));
+  ASSERT_EQ(1, TotalCount(METRIC_op_trace_first_acked_time));
+
+  vector<string> slow_ops = tracer_.SlowOpsForTests();
+  ASSERT_EQ(1, slow_ops.size());
+  ASSERT_STR_CONTAINS(slow_ops[0], "1.10:");
+  ASSERT_STR_CONTAINS(slow_ops[0], "peer peer-a sent +");
+  ASSERT_STR_CONTAINS(slow_ops[0], "update lock wait 100us");
+  ASSERT_STR_CONTAINS(slow_ops[0], "log append 200us");
+
+  // The second op wasn't acknowledged before being committed, e.g. as the
+  // majority was made of other peers.
+  tracer_.RecordCommitted(20);
+  ASSERT_EQ(0, tracer_.NumTracedOpsForTests());
+  ASSERT_EQ(2, TotalCount(METRIC_op_trace_committed_time));
+  ASSERT_EQ(1, TotalCount(METRIC_op_trace_first_acked_time));
+  slow_ops = tracer_.SlowOpsForTests();
+  ASSERT_EQ(2, slow_ops.size());
+  ASSERT_STR_CONTAINS(slow_ops[1], "first acked -");
+}
+
+TEST_F(OpTracerTest, TestFastOpsAreNotKept) {
+  FLAGS_consensus_slow_op_trace_threshold_ms = 60 * 1000;
+  tracer_.StartOp(MakeOpId(1, 10), MonoTime::Now());
+  tracer_.RecordCommitted(10);
+  ASSERT_EQ(1, TotalCount(METRIC_op_trace_committed_time));
+  ASSERT_TRUE(tracer_.SlowOpsForTests().empty());
+}
+
+TEST_F(OpTracerTest, TestAbortOps) {
+  MonoTime start = MonoTime::Now();
+  tracer_.StartOp(MakeOpId(1, 10), start);
+  tracer_.StartOp(MakeOpId(1, 20), start);
+  tracer_.AbortOpsAfter(10);
+  ASSERT_EQ(1, tracer_.NumTracedOpsForTests());
+  tracer_.Clear();
+  ASSERT_EQ(0, tracer_.NumTracedOpsForTests());
+  tracer_.RecordCommitted(20);
+  ASSERT_EQ(0, TotalCount(METRIC_op_trace_committed_time));
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,368 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/op_tracer.h"
+
+#include <mutex>
+#include <ostream>
+#include <utility>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/consensus/opid_util.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/logging.h"
+#include "kudu/util/url-coding.h"
+
+DEFINE_int32(
+    consensus_op_trace_sample_rate,
+    1000,
+    "Trace one in this many of the ops replicated as leader, by index, from "
+    "Replicate() until they are committed, to break down where their "
+    "latency goes. 0 disables the tracing.");
+DEFINE_validator(
+    consensus_op_trace_sample_rate,
+    [](const char* /*n*/, int32_t v) { return v >= 0; });
+TAG_FLAG(consensus_op_trace_sample_rate, advanced);
+TAG_FLAG(consensus_op_trace_sample_rate, runtime);
+
+DEFINE_int32(
+    consensus_slow_op_trace_threshold_ms,
+    1000,
+    "Traced ops which take longer than this number of milliseconds from "
+    "Replicate() until they are committed are logged, and the latest of them "
+    "are kept for the consensus status page with their full timeline. See "
+    "--consensus_op_trace_sample_rate.");
+TAG_FLAG(consensus_slow_op_trace_threshold_ms, advanced);
+TAG_FLAG(consensus_slow_op_trace_threshold_ms, runtime);
+
+using std::string;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace consensus {
+
+METRIC_DEFINE_histogram(
+    server,
+    op_trace_queued_time,
+    "Traced Op Queued Time",
+    MetricUnit::kMicroseconds,
+    "Microseconds from Replicate() until the traced ops were appended to the "
+    "log cache. See --consensus_op_trace_sample_rate.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    op_trace_local_durable_time,
+    "Traced Op Local Durable Time",
+    MetricUnit::kMicroseconds,
+    "Microseconds from Replicate() until the traced ops were durable in the "
+    "local log. See --consensus_op_trace_sample_rate.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    op_trace_first_sent_time,
+    "Traced Op First Sent Time",
+    MetricUnit::kMicroseconds,
+    "Microseconds from Replicate() until the traced ops were first sent to a "
+    "peer. See --consensus_op_trace_sample_rate.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    op_trace_first_acked_time,
+    "Traced Op First Acked Time",
+    MetricUnit::kMicroseconds,
+    "Microseconds from Replicate() until the traced ops were first "
+    "acknowledged by a peer. See --consensus_op_trace_sample_rate.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    op_trace_majority_replicated_time,
+    "Traced Op Majority Replicated Time",
+    MetricUnit::kMicroseconds,
+    "Microseconds from Replicate() until the traced ops were replicated to a "
+    "majority. See --consensus_op_trace_sample_rate.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    op_trace_committed_time,
+    "Traced Op Committed Time",
+    MetricUnit::kMicroseconds,
+    "Microseconds from Replicate() until the traced ops were committed and "
+    "their commit callbacks ran. See --consensus_op_trace_sample_rate.",
+    60000000LU,
+    2);
+
+namespace {
+
+// Bounds the ops traced at once, should the commit index stop advancing.
+const size_t kMaxTracedOps = 1024;
+
+// How many slow ops are kept for the status page.
+const size_t kMaxSlowOps = 16;
+
+string OffsetToString(MonoTime start, MonoTime t) {
+  if (!t.Initialized()) {
+    return "-";
+  }
+  return Substitute("+$0us", (t - start).ToMicroseconds());
+}
+
+} // anonymous namespace
+
+const char* OpTracer::StageToString(Stage stage) {
+  switch (stage) {
+    case kQueued:
+      return "queued";
+    case kLocalDurable:
+      return "local durable";
+    case kFirstSent:
+      return "first sent";
+    case kFirstAcked:
+      return "first acked";
+    case kMajorityReplicated:
+      return "majority replicated";
+    case kCommitted:
+      return "committed";
+    case kNumStages:
+      break;
+  }
+  LOG(FATAL) << "unknown stage " << stage;
+  return nullptr;
+}
+
+OpTracer::OpTracer(const scoped_refptr<MetricEntity>& metric_entity) {
+  stage_latencies_[kQueued] =
+      METRIC_op_trace_queued_time.Instantiate(metric_entity);
+  stage_latencies_[kLocalDurable] =
+      METRIC_op_trace_local_durable_time.Instantiate(metric_entity);
+  stage_latencies_[kFirstSent] =
+      METRIC_op_trace_first_sent_time.Instantiate(metric_entity);
+  stage_latencies_[kFirstAcked] =
+      METRIC_op_trace_first_acked_time.Instantiate(metric_entity);
+  stage_latencies_[kMajorityReplicated] =
+      METRIC_op_trace_majority_replicated_time.Instantiate(metric_entity);
+  stage_latencies_[kCommitted] =
+      METRIC_op_trace_committed_time.Instantiate(metric_entity);
+}
+
+bool OpTracer::ShouldTrace(int64_t index) {
+  int32_t rate = FLAGS_consensus_op_trace_sample_rate;
+  return rate > 0 && index % rate == 0;
+}
+
+void OpTracer::StartOp(const OpId& id, MonoTime replicate_start) {
+  std::lock_guard<simple_spinlock> l(lock_);
+  if (ops_.size() >= kMaxTracedOps) {
+    ops_.erase(ops_.begin());
+  }
+  TracedOp& op = ops_[id.index()];
+  op = TracedOp();
+  op.id = id;
+  op.start = replicate_start;
+}
+
+void OpTracer::RecordStage(
+    int64_t first_index,
+    int64_t last_index,
+    Stage stage) {
+  std::lock_guard<simple_spinlock> l(lock_);
+  if (ops_.empty()) {
+    return;
+  }
+  MonoTime now = MonoTime::Now();
+  for (auto it = ops_.lower_bound(first_index);
+       it != ops_.end() && it->first <= last_index;
+       ++it) {
+    MonoTime& t = it->second.stages[stage];
+    if (!t.Initialized()) {
+      t = now;
+    }
+  }
+}
+
+void OpTracer::RecordSent(
+    const string& peer_uuid,
+    int64_t first_index,
+    int64_t last_index) {
+  std::lock_guard<simple_spinlock> l(lock_);
+  if (ops_.empty()) {
+    return;
+  }
+  MonoTime now = MonoTime::Now();
+  for (auto it = ops_.lower_bound(first_index);
+       it != ops_.end() && it->first <= last_index;
+       ++it) {
+    TracedOp& op = it->second;
+    if (!op.stages[kFirstSent].Initialized()) {
+      op.stages[kFirstSent] = now;
+    }
+    PeerTimeline* peer = op.FindOrAddPeer(peer_uuid);
+    if (!peer->sent.Initialized()) {
+      peer->sent = now;
+    }
+  }
+}
+
+void OpTracer::RecordAcked(
+    const string& peer_uuid,
+    int64_t last_received,
+    int64_t update_lock_wait_us,
+    int64_t log_append_us) {
+  std::lock_guard<simple_spinlock> l(lock_);
+  if (ops_.empty()) {
+    return;
+  }
+  MonoTime now = MonoTime::Now();
+  for (auto it = ops_.begin(); it != ops_.end() && it->first <= last_received;
+       ++it) {
+    TracedOp& op = it->second;
+    PeerTimeline* peer = op.FindOrAddPeer(peer_uuid);
+    if (peer->acked.Initialized()) {
+      continue;
+    }
+    peer->acked = now;
+    peer->update_lock_wait_us = update_lock_wait_us;
+    peer->log_append_us = log_append_us;
+    if (!op.stages[kFirstAcked].Initialized()) {
+      op.stages[kFirstAcked] = now;
+    }
+  }
+}
+
+void OpTracer::RecordCommitted(int64_t commit_index) {
+  std::lock_guard<simple_spinlock> l(lock_);
+  if (ops_.empty()) {
+    return;
+  }
+  MonoTime now = MonoTime::Now();
+  auto end = ops_.upper_bound(commit_index);
+  for (auto it = ops_.begin(); it != end; ++it) {
+    TracedOp& op = it->second;
+    if (!op.stages[kCommitted].Initialized()) {
+      op.stages[kCommitted] = now;
+    }
+    FinishOpUnlocked(op);
+  }
+  ops_.erase(ops_.begin(), end);
+}
+
+void OpTracer::AbortOpsAfter(int64_t index) {
+  std::lock_guard<simple_spinlock> l(lock_);
+  ops_.erase(ops_.upper_bound(index), ops_.end());
+}
+
+void OpTracer::Clear() {
+  std::lock_guard<simple_spinlock> l(lock_);
+  ops_.clear();
+}
+
+void OpTracer::FinishOpUnlocked(const TracedOp& op) {
+  DCHECK(lock_.is_locked());
+  for (int i = 0; i < kNumStages; i++) {
+    if (op.stages[i].Initialized()) {
+      stage_latencies_[i]->Increment(
+          (op.stages[i] - op.start).ToMicroseconds());
+    }
+  }
+  MonoDelta total = op.stages[kCommitted] - op.start;
+  if (total.ToMilliseconds() < FLAGS_consensus_slow_op_trace_threshold_ms) {
+    return;
+  }
+  string timeline = op.ToString();
+  KLOG_EVERY_N_SECS(WARNING, 10)
+      << "Slow op, took " << total.ToString() << ": " << timeline;
+  if (slow_ops_.size() >= kMaxSlowOps) {
+    slow_ops_.pop_front();
+  }
+  slow_ops_.emplace_back(std::move(timeline));
+}
+
+void OpTracer::DumpToHtml(std::ostream& out) const {
+  using std::endl;
+
+  std::lock_guard<simple_spinlock> l(lock_);
+  out << "<h3>Slow traced ops</h3>" << endl;
+  out << "<p>One in " << FLAGS_consensus_op_trace_sample_rate
+      << " ops is traced; the latest which took over "
+      << FLAGS_consensus_slow_op_trace_threshold_ms
+      << " ms to commit are shown, with the time since Replicate() of each "
+      << "stage.</p>" << endl;
+  out << "<ul>" << endl;
+  for (const auto& timeline : slow_ops_) {
+    out << "  <li>" << EscapeForHtmlToString(timeline) << "</li>" << endl;
+  }
+  out << "</ul>" << endl;
+}
+
+vector<string> OpTracer::SlowOpsForTests() const {
+  std::lock_guard<simple_spinlock> l(lock_);
+  return vector<string>(slow_ops_.begin(), slow_ops_.end());
+}
+
+size_t OpTracer::NumTracedOpsForTests() const {
+  std::lock_guard<simple_spinlock> l(lock_);
+  return ops_.size();
+}
+
+OpTracer::PeerTimeline* OpTracer::TracedOp::FindOrAddPeer(
+    const string& uuid) {
+  for (auto& peer : peers) {
+    if (peer.uuid == uuid) {
+      return &peer;
+    }
+  }
+  peers.emplace_back();
+  peers.back().uuid = uuid;
+  return &peers.back();
+}
+
+string OpTracer::TracedOp::ToString() const {
+  string ret = OpIdToString(id) + ":";
+  for (int i = 0; i < kNumStages; i++) {
+    ret += Substitute(
+        " $0 $1,",
+        StageToString(static_cast<Stage>(i)),
+        OffsetToString(start, stages[i]));
+  }
+  ret.pop_back();
+  for (const auto& peer : peers) {
+    ret += Substitute(
+        "; peer $0 sent $1, acked $2",
+        peer.uuid,
+        OffsetToString(start, peer.sent),
+        OffsetToString(start, peer.acked));
+    if (peer.update_lock_wait_us >= 0) {
+      ret += Substitute(
+          ", update lock wait $0us", peer.update_lock_wait_us);
+    }
+    if (peer.log_append_us >= 0) {
+      ret += Substitute(", log append $0us", peer.log_append_us);
+    }
+  }
+  return ret;
+}
+
+} // namespace consensus
+} // namespace kudu
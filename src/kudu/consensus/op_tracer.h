@@ -0,0 +1,157 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "kudu/consensus/opid.pb.h"
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+
+namespace kudu {
+namespace consensus {
+
+// Follows a sample of the ops replicated as leader, one in every
+// --consensus_op_trace_sample_rate by index, from RaftConsensus::Replicate()
+// until their commit callbacks ran, timestamping each stage they go through
+// on the way. Once an op is committed, the time it took to reach each stage
+// is recorded in the stage histograms, and ops which took longer than
+// --consensus_slow_op_trace_threshold_ms are logged and kept for the
+// consensus status page with their full timeline, including what each peer
+// reported about its part.
+//
+// Stages are recorded for ranges of indexes, since that's how the queue sees
+// the ops, so the cost of an unsampled op is a lookup in an empty or small
+// map. Thread-safe; the methods may be called with or without the queue lock
+// held.
+class OpTracer {
+ public:
+  enum Stage {
+    // Appended to the log cache, i.e. queued for the local log and the peers.
+    kQueued = 0,
+    // Durable in the local log.
+    kLocalDurable,
+    // First sent to a remote peer.
+    kFirstSent,
+    // First acknowledged by a remote peer.
+    kFirstAcked,
+    // Replicated to a majority.
+    kMajorityReplicated,
+    // Committed, and the commit callback ran.
+    kCommitted,
+    kNumStages
+  };
+
+  static const char* StageToString(Stage stage);
+
+  explicit OpTracer(const scoped_refptr<MetricEntity>& metric_entity);
+
+  // Whether the op at 'index' should be traced.
+  static bool ShouldTrace(int64_t index);
+
+  // Starts tracing the op 'id', whose Replicate() call started at
+  // 'replicate_start'. Must be called before the op is appended to the queue.
+  void StartOp(const OpId& id, MonoTime replicate_start);
+
+  // Records that the traced ops with indexes in [first_index, last_index]
+  // reached 'stage', unless they already had.
+  void RecordStage(int64_t first_index, int64_t last_index, Stage stage);
+
+  // Records that a request with the ops in [first_index, last_index] was
+  // sent to the remote peer 'peer_uuid'.
+  void RecordSent(
+      const std::string& peer_uuid,
+      int64_t first_index,
+      int64_t last_index);
+
+  // Records that 'peer_uuid' acknowledged the ops up to 'last_received'. The
+  // follower-side timings it reported for the request, in microseconds, are
+  // attributed to the ops it acknowledges for the first time; -1 if it didn't
+  // report them.
+  void RecordAcked(
+      const std::string& peer_uuid,
+      int64_t last_received,
+      int64_t update_lock_wait_us,
+      int64_t log_append_us);
+
+  // Records that the ops up to 'commit_index' were committed, and finishes
+  // tracing them.
+  void RecordCommitted(int64_t commit_index);
+
+  // Stops tracing the ops after 'index', e.g. as they were truncated.
+  void AbortOpsAfter(int64_t index);
+
+  // Stops tracing all the ops, e.g. on losing leadership.
+  void Clear();
+
+  // Appends the timelines of the latest slow ops to 'out', as HTML.
+  void DumpToHtml(std::ostream& out) const;
+
+  // Returns the timelines of the latest slow ops, oldest first.
+  std::vector<std::string> SlowOpsForTests() const;
+
+  // Returns the number of ops being traced.
+  size_t NumTracedOpsForTests() const;
+
+ private:
+  // What a remote peer did with a traced op.
+  struct PeerTimeline {
+    std::string uuid;
+    MonoTime sent;
+    MonoTime acked;
+    int64_t update_lock_wait_us = -1;
+    int64_t log_append_us = -1;
+  };
+
+  struct TracedOp {
+    OpId id;
+    MonoTime start;
+    MonoTime stages[kNumStages];
+    std::vector<PeerTimeline> peers;
+
+    PeerTimeline* FindOrAddPeer(const std::string& uuid);
+    std::string ToString() const;
+  };
+
+  // Records the stage latencies of 'op', and keeps it if it was slow.
+  void FinishOpUnlocked(const TracedOp& op);
+
+  mutable simple_spinlock lock_;
+
+  // The ops being traced, by index.
+  std::map<int64_t, TracedOp> ops_;
+
+  // The timelines of the latest slow ops, oldest first.
+  std::deque<std::string> slow_ops_;
+
+  // The time from Replicate() until each stage, in microseconds.
+  scoped_refptr<Histogram> stage_latencies_[kNumStages];
+
+  DISALLOW_COPY_AND_ASSIGN(OpTracer);
+};
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,150 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/peer_health_history.h"
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/util/monotime.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_int32(consensus_peer_health_history_interval_ms);
+DECLARE_int32(consensus_peer_health_history_samples);
+
+using std::string;
+using std::vector;
+
+namespace kudu {
+namespace consensus {
+
+class PeerHealthHistoryTest : public KuduTest {
+ public:
+  PeerHealthHistoryTest() : start_(MonoTime::Now()) {
+    FLAGS_consensus_peer_health_history_interval_ms = 1000;
+  }
+
+ protected:
+  MonoTime At(int64_t ms) const {
+    return start_ + MonoDelta::FromMilliseconds(ms);
+  }
+
+  const MonoTime start_;
+  PeerHealthHistory history_;
+};
+
+// Exchanges are summed up into one sample per interval, closed by the first
+// exchange after it.
+TEST_F(PeerHealthHistoryTest, TestSamples) {
+  // Ten batches of 10 ops with 100 bytes each.
+  for (int i = 1; i <= 10; i++) {
+    history_.RecordAppend(i * 10, 1000);
+  }
+  const MonoDelta rtt = MonoDelta::FromMicroseconds(500);
+  history_.RecordExchange("peer-a", 0, 20, 100, rtt, At(0));
+  history_.RecordExchange(
+      "peer-a", 20, 40, 100, MonoDelta::FromMicroseconds(1500), At(500));
+  history_.RecordError("peer-a", 40, 100, At(900));
+  ASSERT_TRUE(history_.SamplesForTests("peer-a").empty());
+
+  // Closes the first sample.
+  history_.RecordExchange("peer-a", 40, 40, 100, rtt, At(1000));
+  vector<PeerHealthHistory::Sample> samples =
+      history_.SamplesForTests("peer-a");
+  ASSERT_EQ(1, samples.size());
+  const PeerHealthHistory::Sample& s = samples[0];
+  EXPECT_EQ(1000000, s.duration_us);
+  EXPECT_EQ(2, s.exchanges);
+  EXPECT_EQ(2, s.batches);
+  EXPECT_EQ(40, s.ops);
+  EXPECT_EQ(4000, s.bytes);
+  EXPECT_EQ(1, s.errors);
+  EXPECT_EQ(1000, s.rtt_mean_us);
+  EXPECT_EQ(1500, s.rtt_max_us);
+  EXPECT_EQ(60, s.lag_ops);
+  EXPECT_EQ(6000, s.lag_bytes);
+  EXPECT_DOUBLE_EQ(20, s.ops_per_batch());
+  EXPECT_DOUBLE_EQ(40, s.ops_per_sec());
+  EXPECT_DOUBLE_EQ(4000, s.bytes_per_sec());
+
+  // An exchange-less interval is folded into the next sample.
+  history_.RecordExchange("peer-a", 40, 100, 100, rtt, At(3500));
+  samples = history_.SamplesForTests("peer-a");
+  ASSERT_EQ(2, samples.size());
+  EXPECT_EQ(2500000, samples[1].duration_us);
+  EXPECT_EQ(0, samples[1].ops);
+  EXPECT_EQ(60, samples[1].lag_ops);
+
+  // Peers are kept apart, and forgotten on request.
+  history_.RecordError("peer-b", 0, 100, At(0));
+  history_.ForgetPeer("peer-a");
+  ASSERT_TRUE(history_.SamplesForTests("peer-a").empty());
+  ASSERT_STR_NOT_CONTAINS(history_.ToJson(), "peer-a");
+  ASSERT_STR_CONTAINS(history_.ToJson(), "\"peer-b\":[{");
+}
+
+// Only the latest samples are kept.
+TEST_F(PeerHealthHistoryTest, TestRing) {
+  FLAGS_consensus_peer_health_history_samples = 3;
+  for (int i = 0; i < 10; i++) {
+    history_.RecordError("peer-a", 0, 0, At(i * 1000));
+  }
+  ASSERT_EQ(3, history_.SamplesForTests("peer-a").size());
+
+  FLAGS_consensus_peer_health_history_samples = 0;
+  history_.RecordError("peer-b", 0, 0, At(0));
+  ASSERT_STR_NOT_CONTAINS(history_.ToJson(), "peer-b");
+}
+
+// The lag in bytes is tracked through truncations, and unknown once the
+// ledger doesn't go back far enough.
+TEST_F(PeerHealthHistoryTest, TestLagBytes) {
+  history_.RecordAppend(10, 100);
+  history_.RecordAppend(20, 100);
+  history_.RecordAppend(30, 100);
+  history_.TruncateAfter(20);
+  history_.RecordAppend(25, 50);
+  history_.RecordExchange("peer-a", 0, 10, 25, MonoDelta(), At(0));
+  history_.RecordExchange("peer-a", 10, 10, 25, MonoDelta(), At(1000));
+  vector<PeerHealthHistory::Sample> samples =
+      history_.SamplesForTests("peer-a");
+  ASSERT_EQ(1, samples.size());
+  EXPECT_EQ(15, samples[0].lag_ops);
+  EXPECT_EQ(150, samples[0].lag_bytes);
+  EXPECT_EQ(100, samples[0].bytes);
+  EXPECT_EQ(-1, samples[0].rtt_mean_us);
+
+  for (int i = 0; i < 20000; i++) {
+    history_.RecordAppend(26 + i, 1);
+  }
+  history_.RecordExchange("peer-a", 10, 15, 20025, MonoDelta(), At(2000));
+  history_.RecordExchange("peer-a", 15, 15, 20025, MonoDelta(), At(3000));
+  samples = history_.SamplesForTests("peer-a");
+  ASSERT_EQ(3, samples.size());
+  EXPECT_EQ(-1, samples[2].lag_bytes);
+  EXPECT_EQ(5, samples[2].ops);
+  EXPECT_EQ(0, samples[2].bytes);
+}
+
+} // namespace consensus
+} // namespace kudu
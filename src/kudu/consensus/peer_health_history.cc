@@ -0,0 +1,333 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/peer_health_history.h"
+
+#include <algorithm>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+
+#include <gflags/gflags.h>
+
+#include "kudu/gutil/stringprintf.h"
+#include "kudu/gutil/strings/human_readable.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/walltime.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/jsonwriter.h"
+#include "kudu/util/url-coding.h"
+
+DEFINE_int32(
+    consensus_peer_health_history_interval_ms,
+    1000,
+    "Length of each sample of the replication history kept per peer by a "
+    "leader. See --consensus_peer_health_history_samples.");
+DEFINE_validator(
+    consensus_peer_health_history_interval_ms,
+    [](const char* /*n*/, int32_t v) { return v > 0; });
+TAG_FLAG(consensus_peer_health_history_interval_ms, advanced);
+TAG_FLAG(consensus_peer_health_history_interval_ms, runtime);
+
+DEFINE_int32(
+    consensus_peer_health_history_samples,
+    300,
+    "Number of samples of lag, round trip, batch size, throughput and errors "
+    "kept per peer by a leader, shown on the consensus status page. 0 "
+    "disables the history.");
+DEFINE_validator(
+    consensus_peer_health_history_samples,
+    [](const char* /*n*/, int32_t v) { return v >= 0; });
+TAG_FLAG(consensus_peer_health_history_samples, advanced);
+TAG_FLAG(consensus_peer_health_history_samples, runtime);
+
+using std::string;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace consensus {
+
+namespace {
+
+// Number of appended batches the ledger goes back, beyond which the lag in
+// bytes of a peer is unknown.
+const size_t kMaxLedgerBatches = 10000;
+
+double PerSecond(int64_t count, int64_t duration_us) {
+  return duration_us > 0 ? count * 1e6 / duration_us : 0;
+}
+
+void SampleToJson(const PeerHealthHistory::Sample& s, JsonWriter* jw) {
+  jw->StartObject();
+  jw->String("start_unix_us");
+  jw->Int64(s.start_unix_us);
+  jw->String("duration_us");
+  jw->Int64(s.duration_us);
+  jw->String("lag_ops");
+  jw->Int64(s.lag_ops);
+  jw->String("lag_bytes");
+  jw->Int64(s.lag_bytes);
+  jw->String("rtt_mean_us");
+  jw->Int64(s.rtt_mean_us);
+  jw->String("rtt_max_us");
+  jw->Int64(s.rtt_max_us);
+  jw->String("exchanges");
+  jw->Int64(s.exchanges);
+  jw->String("batches");
+  jw->Int64(s.batches);
+  jw->String("ops");
+  jw->Int64(s.ops);
+  jw->String("bytes");
+  jw->Int64(s.bytes);
+  jw->String("errors");
+  jw->Int64(s.errors);
+  jw->EndObject();
+}
+
+} // anonymous namespace
+
+double PeerHealthHistory::Sample::ops_per_batch() const {
+  return batches > 0 ? static_cast<double>(ops) / batches : 0;
+}
+
+double PeerHealthHistory::Sample::ops_per_sec() const {
+  return PerSecond(ops, duration_us);
+}
+
+double PeerHealthHistory::Sample::bytes_per_sec() const {
+  return PerSecond(bytes, duration_us);
+}
+
+PeerHealthHistory::PeerHealthHistory() {}
+
+PeerHealthHistory::Sample PeerHealthHistory::FinishSample(
+    const PeerHistory& peer,
+    MonoTime now) {
+  Sample s = peer.current;
+  s.duration_us = (now - peer.current_start).ToMicroseconds();
+  if (peer.rtt_count > 0) {
+    s.rtt_mean_us = peer.rtt_sum_us / peer.rtt_count;
+  }
+  return s;
+}
+
+void PeerHealthHistory::RecordAppend(
+    int64_t last_index,
+    int64_t payload_bytes) {
+  std::lock_guard<simple_spinlock> l(lock_);
+  appended_bytes_ += payload_bytes;
+  if (ledger_.size() >= kMaxLedgerBatches) {
+    ledger_.pop_front();
+    ledger_trimmed_ = true;
+  }
+  ledger_.emplace_back(last_index, appended_bytes_);
+}
+
+void PeerHealthHistory::TruncateAfter(int64_t index) {
+  std::lock_guard<simple_spinlock> l(lock_);
+  while (!ledger_.empty() && ledger_.back().first > index) {
+    ledger_.pop_back();
+  }
+  appended_bytes_ = ledger_.empty() ? 0 : ledger_.back().second;
+}
+
+int64_t PeerHealthHistory::BytesThroughUnlocked(int64_t index) const {
+  auto it = std::upper_bound(
+      ledger_.begin(),
+      ledger_.end(),
+      index,
+      [](int64_t i, const std::pair<int64_t, int64_t>& batch) {
+        return i < batch.first;
+      });
+  if (it == ledger_.begin()) {
+    // Before the first batch of the ledger: only known if it is the first
+    // batch ever appended, and then counted from its start.
+    return ledger_trimmed_ ? -1 : 0;
+  }
+  --it;
+  return it->second;
+}
+
+PeerHealthHistory::PeerHistory* PeerHealthHistory::PeerForSampleUnlocked(
+    const string& uuid,
+    MonoTime now) {
+  PeerHistory* peer = &peers_[uuid];
+  const MonoDelta interval = MonoDelta::FromMilliseconds(
+      FLAGS_consensus_peer_health_history_interval_ms);
+  if (peer->current_start.Initialized() &&
+      now - peer->current_start < interval) {
+    return peer;
+  }
+  if (peer->current_start.Initialized()) {
+    const size_t max_samples = FLAGS_consensus_peer_health_history_samples;
+    peer->samples.push_back(FinishSample(*peer, now));
+    while (peer->samples.size() > max_samples) {
+      peer->samples.pop_front();
+    }
+  }
+  // The lag carries over until the next exchange updates it.
+  Sample next;
+  next.lag_ops = peer->current.lag_ops;
+  next.lag_bytes = peer->current.lag_bytes;
+  next.start_unix_us = GetCurrentTimeMicros();
+  peer->current = next;
+  peer->current_start = now;
+  peer->rtt_sum_us = 0;
+  peer->rtt_count = 0;
+  return peer;
+}
+
+void PeerHealthHistory::UpdateLagUnlocked(
+    PeerHistory* peer,
+    int64_t last_received,
+    int64_t last_appended) const {
+  peer->current.lag_ops = std::max<int64_t>(0, last_appended - last_received);
+  int64_t received_bytes = BytesThroughUnlocked(last_received);
+  peer->current.lag_bytes = received_bytes < 0
+      ? -1
+      : std::max<int64_t>(0, appended_bytes_ - received_bytes);
+}
+
+void PeerHealthHistory::RecordExchange(
+    const string& uuid,
+    int64_t prev_last_received,
+    int64_t last_received,
+    int64_t last_appended,
+    MonoDelta rtt,
+    MonoTime now) {
+  if (FLAGS_consensus_peer_health_history_samples == 0) {
+    return;
+  }
+  std::lock_guard<simple_spinlock> l(lock_);
+  PeerHistory* peer = PeerForSampleUnlocked(uuid, now);
+  Sample* s = &peer->current;
+  s->exchanges++;
+  if (rtt.Initialized()) {
+    int64_t rtt_us = rtt.ToMicroseconds();
+    peer->rtt_sum_us += rtt_us;
+    peer->rtt_count++;
+    s->rtt_max_us = std::max(s->rtt_max_us, rtt_us);
+  }
+  if (last_received > prev_last_received) {
+    s->batches++;
+    s->ops += last_received - prev_last_received;
+    int64_t before = BytesThroughUnlocked(prev_last_received);
+    int64_t after = BytesThroughUnlocked(last_received);
+    if (before >= 0 && after > before) {
+      s->bytes += after - before;
+    }
+  }
+  UpdateLagUnlocked(peer, last_received, last_appended);
+}
+
+void PeerHealthHistory::RecordError(
+    const string& uuid,
+    int64_t last_received,
+    int64_t last_appended,
+    MonoTime now) {
+  if (FLAGS_consensus_peer_health_history_samples == 0) {
+    return;
+  }
+  std::lock_guard<simple_spinlock> l(lock_);
+  PeerHistory* peer = PeerForSampleUnlocked(uuid, now);
+  peer->current.errors++;
+  UpdateLagUnlocked(peer, last_received, last_appended);
+}
+
+void PeerHealthHistory::ForgetPeer(const string& uuid) {
+  std::lock_guard<simple_spinlock> l(lock_);
+  peers_.erase(uuid);
+}
+
+void PeerHealthHistory::DumpToHtml(std::ostream& out) const {
+  using std::endl;
+
+  const MonoTime now = MonoTime::Now();
+  const int64_t now_us = GetCurrentTimeMicros();
+  std::lock_guard<simple_spinlock> l(lock_);
+  out << "<h3>Peer health history</h3>" << endl;
+  out << "<p>One sample every "
+      << FLAGS_consensus_peer_health_history_interval_ms
+      << " ms, newest first. Lag is as of the end of each sample.</p>" << endl;
+  for (const auto& entry : peers_) {
+    const PeerHistory& peer = entry.second;
+    out << "<h4>" << EscapeForHtmlToString(entry.first) << "</h4>" << endl;
+    out << "<table>" << endl;
+    out << "  <tr><th>Age</th><th>Duration</th><th>Lag (ops)</th>"
+        << "<th>Lag (bytes)</th><th>Round trip mean / max</th>"
+        << "<th>Ops/batch</th><th>Ops/s</th><th>Bytes/s</th>"
+        << "<th>Errors</th></tr>" << endl;
+    vector<Sample> samples(peer.samples.rbegin(), peer.samples.rend());
+    samples.insert(samples.begin(), FinishSample(peer, now));
+    for (const Sample& s : samples) {
+      out << Substitute(
+                 "  <tr><td>$0 s</td><td>$1 ms</td><td>$2</td><td>$3</td>"
+                 "<td>$4</td><td>$5</td><td>$6</td><td>$7</td><td>$8</td>"
+                 "</tr>",
+                 (now_us - s.start_unix_us) / 1000000,
+                 s.duration_us / 1000,
+                 s.lag_ops,
+                 s.lag_bytes < 0
+                     ? "-"
+                     : HumanReadableNumBytes::ToString(s.lag_bytes),
+                 s.rtt_max_us >= 0
+                     ? Substitute("$0 / $1 us", s.rtt_mean_us, s.rtt_max_us)
+                     : "-",
+                 StringPrintf("%.1f", s.ops_per_batch()),
+                 StringPrintf("%.1f", s.ops_per_sec()),
+                 HumanReadableNumBytes::ToString(
+                     static_cast<int64_t>(s.bytes_per_sec())),
+                 s.errors)
+          << endl;
+    }
+    out << "</table>" << endl;
+  }
+}
+
+string PeerHealthHistory::ToJson() const {
+  const MonoTime now = MonoTime::Now();
+  std::ostringstream out;
+  JsonWriter jw(&out, JsonWriter::COMPACT);
+  std::lock_guard<simple_spinlock> l(lock_);
+  jw.StartObject();
+  for (const auto& entry : peers_) {
+    const PeerHistory& peer = entry.second;
+    jw.String(entry.first);
+    jw.StartArray();
+    for (const Sample& s : peer.samples) {
+      SampleToJson(s, &jw);
+    }
+    SampleToJson(FinishSample(peer, now), &jw);
+    jw.EndArray();
+  }
+  jw.EndObject();
+  return out.str();
+}
+
+vector<PeerHealthHistory::Sample> PeerHealthHistory::SamplesForTests(
+    const string& uuid) const {
+  std::lock_guard<simple_spinlock> l(lock_);
+  auto it = peers_.find(uuid);
+  if (it == peers_.end()) {
+    return {};
+  }
+  return vector<Sample>(it->second.samples.begin(), it->second.samples.end());
+}
+
+} // namespace consensus
+} // namespace kudu
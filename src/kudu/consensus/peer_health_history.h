@@ -0,0 +1,162 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
+
+namespace kudu {
+namespace consensus {
+
+// Keeps a rolling history of how replication to each remote peer went, for
+// the consensus status page and as JSON, so that a slowdown can be looked
+// into after the fact. The exchanges with a peer are summed up into one
+// sample every --consensus_peer_health_history_interval_ms, and the latest
+// --consensus_peer_health_history_samples samples are kept per peer.
+//
+// Samples are closed by the first exchange after their interval ended, so an
+// interval without any exchange is folded into the next sample, whose
+// duration says so. Lag in bytes counts the payload bytes appended after the
+// last op the peer received, from a bounded ledger of the appended batches.
+//
+// Thread-safe; the methods may be called with or without the queue lock
+// held.
+class PeerHealthHistory {
+ public:
+  struct Sample {
+    // Wall clock time at which the sample started, and how long it covers.
+    int64_t start_unix_us = 0;
+    int64_t duration_us = 0;
+
+    // How far behind the last op appended to the leader the peer was at the
+    // end of the sample, in ops and in payload bytes. -1 bytes if the ledger
+    // doesn't go back far enough.
+    int64_t lag_ops = 0;
+    int64_t lag_bytes = -1;
+
+    // Mean and highest round trip of the successful exchanges, in
+    // microseconds. -1 if there were none.
+    int64_t rtt_mean_us = -1;
+    int64_t rtt_max_us = -1;
+
+    // Successful exchanges, those of them which had the peer acknowledge new
+    // ops, the ops and payload bytes acknowledged, and failed exchanges.
+    int64_t exchanges = 0;
+    int64_t batches = 0;
+    int64_t ops = 0;
+    int64_t bytes = 0;
+    int64_t errors = 0;
+
+    // Ops and payload bytes acknowledged per batch and per second.
+    double ops_per_batch() const;
+    double ops_per_sec() const;
+    double bytes_per_sec() const;
+  };
+
+  PeerHealthHistory();
+
+  // Records that ops up to 'last_index', carrying 'payload_bytes', were
+  // appended to the queue.
+  void RecordAppend(int64_t last_index, int64_t payload_bytes);
+
+  // Forgets the ops appended after 'index'.
+  void TruncateAfter(int64_t index);
+
+  // Records a successful exchange with 'uuid', which moved the last op it
+  // received from 'prev_last_received' to 'last_received' and took 'rtt',
+  // while 'last_appended' was the last op appended to the leader.
+  void RecordExchange(
+      const std::string& uuid,
+      int64_t prev_last_received,
+      int64_t last_received,
+      int64_t last_appended,
+      MonoDelta rtt,
+      MonoTime now);
+
+  // Records a failed exchange with 'uuid'.
+  void RecordError(
+      const std::string& uuid,
+      int64_t last_received,
+      int64_t last_appended,
+      MonoTime now);
+
+  // Drops the history of 'uuid', e.g. as it left the config.
+  void ForgetPeer(const std::string& uuid);
+
+  // Appends the history of each peer to 'out', as HTML tables.
+  void DumpToHtml(std::ostream& out) const;
+
+  // Returns the history of each peer as a JSON object keyed by uuid, oldest
+  // sample first, the current partial sample last.
+  std::string ToJson() const;
+
+  // Returns the closed samples of 'uuid', oldest first.
+  std::vector<Sample> SamplesForTests(const std::string& uuid) const;
+
+ private:
+  struct PeerHistory {
+    std::deque<Sample> samples;
+
+    // The sample being accumulated, with when it started and the sum and
+    // number of its round trips.
+    Sample current;
+    MonoTime current_start;
+    int64_t rtt_sum_us = 0;
+    int64_t rtt_count = 0;
+  };
+
+  // Returns the current sample of 'peer' as if it ended at 'now'.
+  static Sample FinishSample(const PeerHistory& peer, MonoTime now);
+
+  // Returns the history of 'uuid', closing its current sample first if its
+  // interval is over, or starting it as of 'now'.
+  PeerHistory* PeerForSampleUnlocked(const std::string& uuid, MonoTime now);
+
+  // Stamps the lag of 'peer' as of the given indexes.
+  void UpdateLagUnlocked(
+      PeerHistory* peer,
+      int64_t last_received,
+      int64_t last_appended) const;
+
+  // Returns the payload bytes appended through 'index', relative to an
+  // arbitrary origin, or -1 if the ledger doesn't go back that far.
+  int64_t BytesThroughUnlocked(int64_t index) const;
+
+  mutable simple_spinlock lock_;
+  std::map<std::string, PeerHistory> peers_;
+
+  // The last index of each appended batch with the payload bytes appended
+  // through it, oldest first; bounded, after which 'ledger_trimmed_' is set.
+  std::deque<std::pair<int64_t, int64_t>> ledger_;
+  int64_t appended_bytes_ = 0;
+  bool ledger_trimmed_ = false;
+
+  DISALLOW_COPY_AND_ASSIGN(PeerHealthHistory);
+};
+
+} // namespace consensus
+} // namespace kudu
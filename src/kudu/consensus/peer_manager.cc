@@ -22,20 +22,39 @@
 #include <ostream>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "kudu/consensus/consensus_peers.h"
 #include "kudu/consensus/log.h"
 #include "kudu/consensus/metadata.pb.h"
+#include "kudu/consensus/quorum_util.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/pb_util.h"
+#include "kudu/util/scoped_cleanup.h"
+
+DEFINE_bool(
+    raft_signal_commit_quorum_peers_first,
+    true,
+    "Whether the leader hands requests for the peers whose acknowledgements "
+    "count toward the commit rule to the raft thread pool before those of "
+    "the other peers (learners, voters outside the FlexiRaft commit "
+    "quorums), so that replication toward the commit quorum goes first "
+    "when the pool is busy. Takes effect on the next config update.");
+TAG_FLAG(raft_signal_commit_quorum_peers_first, advanced);
+
+DECLARE_bool(enable_flexi_raft);
 
 using kudu::log::Log;
 using kudu::pb_util::SecureShortDebugString;
 using std::shared_ptr;
+using std::string;
+using std::vector;
 using strings::Substitute;
 
 namespace kudu {
@@ -62,6 +81,9 @@ Status PeerManager::UpdateRaftConfig(const RaftConfigPB& config) {
           << SecureShortDebugString(config);
 
   std::lock_guard<simple_spinlock> lock(lock_);
+  // Peers created before a failure below must still be signaled.
+  auto update_order =
+      MakeScopedCleanup([&]() { UpdateSignalOrderUnlocked(config); });
   // Create new peers
   for (const RaftPeerPB& peer_pb : config.peers()) {
     if (ContainsKey(peers_, peer_pb.permanent_uuid())) {
@@ -95,15 +117,61 @@ Status PeerManager::UpdateRaftConfig(const RaftConfigPB& config) {
   return Status::OK();
 }
 
+void PeerManager::UpdateSignalOrderUnlocked(const RaftConfigPB& config) {
+  RaftConfigPB rule_config;
+  if (FLAGS_enable_flexi_raft && config.has_commit_rule()) {
+    *rule_config.mutable_commit_rule() = config.commit_rule();
+  }
+  string leader_quorum_id;
+  for (const RaftPeerPB& peer_pb : config.peers()) {
+    if (peer_pb.permanent_uuid() == local_uuid_ && peer_pb.has_attrs()) {
+      leader_quorum_id = IsUseQuorumId(config.commit_rule())
+          ? peer_pb.attrs().quorum_id()
+          : peer_pb.attrs().region();
+    }
+  }
+
+  vector<shared_ptr<Peer>> critical;
+  vector<shared_ptr<Peer>> voters;
+  vector<shared_ptr<Peer>> others;
+  for (const RaftPeerPB& peer_pb : config.peers()) {
+    const shared_ptr<Peer>* peer = FindOrNull(peers_, peer_pb.permanent_uuid());
+    if (peer == nullptr) {
+      continue;
+    }
+    if (!FLAGS_raft_signal_commit_quorum_peers_first ||
+        PeerCountsTowardCommit(rule_config, peer_pb, leader_quorum_id)) {
+      critical.push_back(*peer);
+    } else if (
+        peer_pb.has_member_type() &&
+        peer_pb.member_type() == RaftPeerPB::VOTER) {
+      voters.push_back(*peer);
+    } else {
+      others.push_back(*peer);
+    }
+  }
+  // Peers on their way out of the config are still signaled until they close.
+  for (const auto& entry : peers_) {
+    if (!IsRaftConfigMember(entry.first, config)) {
+      others.push_back(entry.second);
+    }
+  }
+
+  signal_order_ = std::move(critical);
+  signal_order_.insert(signal_order_.end(), voters.begin(), voters.end());
+  signal_order_.insert(signal_order_.end(), others.begin(), others.end());
+}
+
 void PeerManager::SignalRequest(bool force_if_queue_empty) {
   std::lock_guard<simple_spinlock> lock(lock_);
-  for (auto iter = peers_.begin(); iter != peers_.end();) {
-    Status s = (*iter).second->SignalRequest(force_if_queue_empty);
+  for (auto iter = signal_order_.begin(); iter != signal_order_.end();) {
+    Status s = (*iter)->SignalRequest(force_if_queue_empty);
     if (PREDICT_FALSE(!s.ok())) {
       LOG(WARNING) << GetLogPrefix()
                    << "Peer was closed, removing from peers. Peer: "
-                   << SecureShortDebugString((*iter).second->peer_pb());
-      peers_.erase(iter++);
+                   << SecureShortDebugString((*iter)->peer_pb());
+      peers_.erase((*iter)->peer_pb().permanent_uuid());
+      iter = signal_order_.erase(iter);
     } else {
       ++iter;
     }
@@ -133,6 +201,7 @@ void PeerManager::Close() {
       entry.second->Close();
     }
     peers_.clear();
+    signal_order_.clear();
     peer_proxy_pool_.Clear();
   }
 }
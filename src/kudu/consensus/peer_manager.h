@@ -20,6 +20,7 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "kudu/consensus/consensus_peers.h"
 #include "kudu/gutil/macros.h"
@@ -55,7 +56,8 @@ class PeerManager {
   Status UpdateRaftConfig(const RaftConfigPB& config);
 
   // Signals all peers of the current configuration that there is a new request
-  // pending.
+  // pending. Peers whose acknowledgements count toward the commit rule are
+  // signaled first, see --raft_signal_commit_quorum_peers_first.
   void SignalRequest(bool force_if_queue_empty = false);
 
   // Start an election on the peer with UUID 'uuid'.
@@ -70,6 +72,9 @@ class PeerManager {
  private:
   std::string GetLogPrefix() const;
 
+  // Rebuilds 'signal_order_' from 'peers_' for 'config'.
+  void UpdateSignalOrderUnlocked(const RaftConfigPB& config);
+
   const std::string tablet_id_;
   const std::string local_uuid_;
   PeerProxyFactory* peer_proxy_factory_;
@@ -77,6 +82,10 @@ class PeerManager {
   ThreadPoolToken* raft_pool_token_;
   PeerProxyPool peer_proxy_pool_;
   std::unordered_map<std::string, std::shared_ptr<Peer>> peers_;
+  // The peers of 'peers_' in the order in which SignalRequest() hands them
+  // to 'raft_pool_token_': commit-critical voters, then the other voters,
+  // then non-voters and peers which have left the config.
+  std::vector<std::shared_ptr<Peer>> signal_order_;
   mutable simple_spinlock lock_;
 
   DISALLOW_COPY_AND_ASSIGN(PeerManager);
@@ -0,0 +1,179 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/pending_rounds.h"
+
+#include <cstdint>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "kudu/consensus/consensus-test-util.h"
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/opid.pb.h"
+#include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/raft_consensus.h"
+#include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/consensus/time_manager.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/status.h"
+#include "kudu/util/stopwatch.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+using strings::Substitute;
+
+namespace kudu {
+namespace consensus {
+
+class PendingRoundsTest : public KuduTest {
+ public:
+  PendingRoundsTest()
+      : pending_("T test P test: ", new TimeManagerDummy()),
+        num_committed_(0),
+        num_aborted_(0),
+        num_region_durable_(0),
+        num_region_durable_failed_(0) {}
+
+ protected:
+  // Adds pending rounds with indexes ['first', 'last'] in 'term'.
+  void AddRounds(int64_t term, int64_t first, int64_t last) {
+    for (int64_t index = first; index <= last; index++) {
+      ReplicateMsg* msg = new ReplicateMsg();
+      msg->set_op_type(NO_OP);
+      *msg->mutable_id() = MakeOpId(term, index);
+      scoped_refptr<ConsensusRound> round(
+          new ConsensusRound(nullptr, make_scoped_refptr_replicate(msg)));
+      round->SetConsensusReplicatedCallback([this](const Status& s) {
+        if (s.ok()) {
+          num_committed_++;
+        } else {
+          num_aborted_++;
+        }
+      });
+      round->SetLocalRegionDurableCallback([this](const Status& s) {
+        if (s.ok()) {
+          num_region_durable_++;
+        } else {
+          num_region_durable_failed_++;
+        }
+      });
+      ASSERT_OK(pending_.AddPendingOperation(round));
+    }
+  }
+
+  PendingRounds pending_;
+  int num_committed_;
+  int num_aborted_;
+  int num_region_durable_;
+  int num_region_durable_failed_;
+};
+
+TEST_F(PendingRoundsTest, TestCommitAndAbort) {
+  NO_FATALS(AddRounds(1, 1, 10));
+  ASSERT_EQ(10, pending_.GetNumPendingTxns());
+  ASSERT_OPID_EQ(MakeOpId(1, 10), pending_.GetLastPendingTransactionOpId());
+
+  bool term_mismatch;
+  ASSERT_TRUE(pending_.IsOpCommittedOrPending(MakeOpId(1, 5), &term_mismatch));
+  ASSERT_FALSE(
+      pending_.IsOpCommittedOrPending(MakeOpId(2, 5), &term_mismatch));
+  ASSERT_TRUE(term_mismatch);
+  ASSERT_FALSE(
+      pending_.IsOpCommittedOrPending(MakeOpId(1, 11), &term_mismatch));
+  ASSERT_FALSE(term_mismatch);
+
+  ASSERT_OK(pending_.AdvanceCommittedIndex(4));
+  ASSERT_EQ(4, num_committed_);
+  ASSERT_EQ(4, pending_.GetCommittedIndex());
+  ASSERT_EQ(6, pending_.GetNumPendingTxns());
+  ASSERT_FALSE(pending_.GetPendingOpByIndexOrNull(4));
+  ASSERT_TRUE(pending_.GetPendingOpByIndexOrNull(5));
+
+  pending_.AbortOpsAfter(7);
+  ASSERT_EQ(3, num_aborted_);
+  ASSERT_EQ(3, pending_.GetNumPendingTxns());
+  ASSERT_OPID_EQ(MakeOpId(1, 7), pending_.GetLastPendingTransactionOpId());
+  ASSERT_FALSE(pending_.GetPendingOpByIndexOrNull(8));
+
+  // A new leader's ops take the place of the aborted ones.
+  NO_FATALS(AddRounds(2, 8, 9));
+  ASSERT_OK(pending_.AdvanceCommittedIndex(9));
+  ASSERT_EQ(9, num_committed_);
+  ASSERT_EQ(0, pending_.GetNumPendingTxns());
+  ASSERT_OPID_EQ(MakeOpId(2, 9), pending_.GetLastPendingTransactionOpId());
+
+  // Aborting everything after the committed index is allowed even with no
+  // pending ops.
+  pending_.AbortOpsAfter(9);
+  ASSERT_EQ(3, num_aborted_);
+}
+
+// The rounds are told once that they are durable in the leader's region:
+// ahead of their commit, or else when they are committed or aborted.
+TEST_F(PendingRoundsTest, TestLocalRegionDurable) {
+  NO_FATALS(AddRounds(1, 1, 10));
+  pending_.AdvanceLocalRegionDurableIndex(6);
+  ASSERT_EQ(6, num_region_durable_);
+  ASSERT_EQ(0, num_committed_);
+
+  // Going back or committing the rounds already told does nothing more.
+  pending_.AdvanceLocalRegionDurableIndex(5);
+  ASSERT_OK(pending_.AdvanceCommittedIndex(4));
+  ASSERT_EQ(6, num_region_durable_);
+  ASSERT_EQ(4, num_committed_);
+
+  // Committing ahead of the region tells the rounds too.
+  ASSERT_OK(pending_.AdvanceCommittedIndex(8));
+  ASSERT_EQ(8, num_region_durable_);
+  pending_.AdvanceLocalRegionDurableIndex(8);
+  ASSERT_EQ(8, num_region_durable_);
+
+  // Aborted rounds fail, and the ops of a new leader taking their place are
+  // told again.
+  pending_.AbortOpsAfter(8);
+  ASSERT_EQ(2, num_region_durable_failed_);
+  NO_FATALS(AddRounds(2, 9, 10));
+  pending_.AdvanceLocalRegionDurableIndex(10);
+  ASSERT_EQ(10, num_region_durable_);
+  ASSERT_OK(pending_.AdvanceCommittedIndex(10));
+  ASSERT_EQ(10, num_region_durable_);
+  ASSERT_EQ(2, num_region_durable_failed_);
+}
+
+// Measures committing and aborting a large number of pending rounds.
+TEST_F(PendingRoundsTest, TestManyPendingRounds) {
+  const int kNumRounds = AllowSlowTests() ? 1000000 : 100000;
+  const int kCommitBatch = 100;
+
+  NO_FATALS(AddRounds(1, 1, kNumRounds));
+  LOG_TIMING(INFO, Substitute("committing $0 rounds", kNumRounds / 2)) {
+    for (int64_t i = kCommitBatch; i <= kNumRounds / 2; i += kCommitBatch) {
+      ASSERT_OK(pending_.AdvanceCommittedIndex(i));
+    }
+  }
+  LOG_TIMING(INFO, Substitute("aborting $0 rounds", kNumRounds / 2)) {
+    pending_.AbortOpsAfter(kNumRounds / 2);
+  }
+  ASSERT_EQ(kNumRounds / 2, num_committed_);
+  ASSERT_EQ(kNumRounds / 2, num_aborted_);
+  ASSERT_EQ(0, pending_.GetNumPendingTxns());
+}
+
+} // namespace consensus
+} // namespace kudu
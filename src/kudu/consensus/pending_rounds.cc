@@ -17,6 +17,7 @@
 
 #include "kudu/consensus/pending_rounds.h"
 
+#include <algorithm>
 #include <ostream>
 #include <utility>
 
@@ -26,7 +27,6 @@
 #include "kudu/consensus/opid_util.h"
 #include "kudu/consensus/raft_consensus.h"
 #include "kudu/consensus/time_manager.h"
-#include "kudu/gutil/map-util.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/debug-util.h"
@@ -50,7 +50,12 @@ PendingRounds::PendingRounds(
     string log_prefix,
     scoped_refptr<ITimeManager> time_manager)
     : log_prefix_(std::move(log_prefix)),
+      first_pending_index_(0),
+      num_pending_txns_(0),
+      local_region_durable_index_(MinimumOpId().index()),
       last_committed_op_id_(MinimumOpId()),
+      committed_index_cond_(&committed_index_lock_),
+      published_committed_index_(MinimumOpId().index()),
       time_manager_(std::move(time_manager)) {}
 
 PendingRounds::~PendingRounds() {}
@@ -61,14 +66,15 @@ Status PendingRounds::CancelPendingTransactions() {
     return Status::OK();
   }
 
-  LOG_WITH_PREFIX(INFO) << "Trying to abort " << pending_txns_.size()
+  LOG_WITH_PREFIX(INFO) << "Trying to abort " << num_pending_txns_
                         << " pending transactions.";
-  for (const auto& txn : pending_txns_) {
-    const scoped_refptr<ConsensusRound>& round = txn.second;
+  for (const auto& round : pending_txns_) {
+    if (!round) {
+      continue;
+    }
     // We cancel only transactions whose applies have not yet been triggered.
     LOG_WITH_PREFIX(INFO) << "Aborting transaction as it isn't in flight: "
-                          << SecureShortDebugString(
-                                 *txn.second->replicate_msg());
+                          << SecureShortDebugString(*round->replicate_msg());
     round->NotifyReplicationFinished(Status::Aborted("Transaction aborted"));
   }
   return Status::OK();
@@ -81,20 +87,29 @@ void PendingRounds::AbortOpsAfter(int64_t index) {
   DCHECK_GE(index, 0);
   OpId new_preceding;
 
-  auto iter = pending_txns_.lower_bound(index);
-
   // Either the new preceding id is in the pendings set or it must be equal to
   // the committed index since we can't truncate already committed operations.
-  if (iter != pending_txns_.end() && (*iter).first == index) {
-    new_preceding = (*iter).second->replicate_msg()->id();
-    ++iter;
+  const scoped_refptr<ConsensusRound>* preceding = FindPendingOp(index);
+  if (preceding) {
+    new_preceding = (*preceding)->replicate_msg()->id();
   } else {
     CHECK_EQ(index, last_committed_op_id_.index());
     new_preceding = last_committed_op_id_;
   }
 
-  for (; iter != pending_txns_.end();) {
-    const scoped_refptr<ConsensusRound>& round = (*iter).second;
+  int64_t end_index = first_pending_index_ + pending_txns_.size();
+  int64_t first_aborted = std::max(index + 1, first_pending_index_);
+  if (first_aborted >= end_index) {
+    return;
+  }
+
+  auto first_iter =
+      pending_txns_.begin() + (first_aborted - first_pending_index_);
+  for (auto iter = first_iter; iter != pending_txns_.end(); ++iter) {
+    const scoped_refptr<ConsensusRound>& round = *iter;
+    if (!round) {
+      continue;
+    }
     auto op_type = round->replicate_msg()->op_type();
     LOG_WITH_PREFIX(INFO) << "Aborting uncommitted "
                           << OperationType_Name(op_type)
@@ -103,20 +118,71 @@ void PendingRounds::AbortOpsAfter(int64_t index) {
 
     round->NotifyReplicationFinished(
         Status::Aborted("Transaction aborted by new leader"));
-    // Erase the entry from pendings.
-    pending_txns_.erase(iter++);
+    --num_pending_txns_;
   }
+  // Erase the aborted tail from pendings in one go.
+  pending_txns_.erase(first_iter, pending_txns_.end());
+  TrimPendingTxns();
+  local_region_durable_index_ = std::min(local_region_durable_index_, index);
 }
 
 Status PendingRounds::AddPendingOperation(
     const scoped_refptr<ConsensusRound>& round) {
-  InsertOrDie(&pending_txns_, round->replicate_msg()->id().index(), round);
+  int64_t index = round->replicate_msg()->id().index();
+  int64_t end_index = first_pending_index_ + pending_txns_.size();
+  if (pending_txns_.empty()) {
+    first_pending_index_ = index;
+    pending_txns_.push_back(round);
+  } else if (index >= end_index) {
+    // Ops are appended in index order, so this is the common case.
+    pending_txns_.resize(index - first_pending_index_);
+    pending_txns_.push_back(round);
+  } else if (index < first_pending_index_) {
+    pending_txns_.insert(
+        pending_txns_.begin(),
+        first_pending_index_ - index,
+        scoped_refptr<ConsensusRound>());
+    first_pending_index_ = index;
+    pending_txns_.front() = round;
+  } else {
+    scoped_refptr<ConsensusRound>& slot =
+        pending_txns_[index - first_pending_index_];
+    CHECK(!slot) << LogPrefix() << "duplicate pending operation with index "
+                 << index;
+    slot = round;
+  }
+  ++num_pending_txns_;
   return Status::OK();
 }
 
+const scoped_refptr<ConsensusRound>* PendingRounds::FindPendingOp(
+    int64_t index) const {
+  int64_t end_index = first_pending_index_ + pending_txns_.size();
+  if (index < first_pending_index_ || index >= end_index) {
+    return nullptr;
+  }
+  const scoped_refptr<ConsensusRound>& round =
+      pending_txns_[index - first_pending_index_];
+  return round ? &round : nullptr;
+}
+
+void PendingRounds::TrimPendingTxns() {
+  while (!pending_txns_.empty() && !pending_txns_.front()) {
+    pending_txns_.pop_front();
+    ++first_pending_index_;
+  }
+  while (!pending_txns_.empty() && !pending_txns_.back()) {
+    pending_txns_.pop_back();
+  }
+}
+
 scoped_refptr<ConsensusRound> PendingRounds::GetPendingOpByIndexOrNull(
     int64_t index) {
-  return FindPtrOrNull(pending_txns_, index);
+  const scoped_refptr<ConsensusRound>* round = FindPendingOp(index);
+  if (!round) {
+    return nullptr;
+  }
+  return *round;
 }
 
 bool PendingRounds::IsOpCommittedOrPending(
@@ -128,22 +194,43 @@ bool PendingRounds::IsOpCommittedOrPending(
     return true;
   }
 
-  scoped_refptr<ConsensusRound> round =
-      GetPendingOpByIndexOrNull(op_id.index());
+  const scoped_refptr<ConsensusRound>* round = FindPendingOp(op_id.index());
   if (!round) {
     return false;
   }
 
-  if (round->id().term() != op_id.term()) {
+  if ((*round)->id().term() != op_id.term()) {
     *term_mismatch = true;
     return false;
   }
   return true;
 }
 
+bool PendingRounds::GetPendingTermStart(
+    int64_t index,
+    int64_t* term,
+    int64_t* first_index) const {
+  const scoped_refptr<ConsensusRound>* round = FindPendingOp(index);
+  if (!round) {
+    return false;
+  }
+  *term = (*round)->id().term();
+  // The terms only go up along the pending ops. An empty slot, if any, is
+  // taken for an op of an earlier term, which at worst leaves out of the
+  // term the ops before it.
+  const int64_t t = *term;
+  auto first = std::partition_point(
+      pending_txns_.begin(),
+      pending_txns_.begin() + (index - first_pending_index_),
+      [t](const scoped_refptr<ConsensusRound>& r) {
+        return !r || r->id().term() < t;
+      });
+  *first_index = first_pending_index_ + (first - pending_txns_.begin());
+  return true;
+}
+
 OpId PendingRounds::GetLastPendingTransactionOpId() const {
-  return pending_txns_.empty() ? MinimumOpId()
-                               : (--pending_txns_.end())->second->id();
+  return pending_txns_.empty() ? MinimumOpId() : pending_txns_.back()->id();
 }
 
 Status PendingRounds::AdvanceCommittedIndex(int64_t committed_index) {
@@ -169,36 +256,88 @@ Status PendingRounds::AdvanceCommittedIndex(int64_t committed_index) {
   }
 
   // Start at the operation after the last committed one.
-  auto iter = pending_txns_.upper_bound(last_committed_op_id_.index());
+  int64_t end_index = first_pending_index_ + pending_txns_.size();
+  int64_t start_index =
+      std::max(last_committed_op_id_.index() + 1, first_pending_index_);
   // Stop at the operation after the last one we must commit.
-  auto end_iter = pending_txns_.upper_bound(committed_index);
-  CHECK(iter != pending_txns_.end());
+  int64_t stop_index = std::min(committed_index + 1, end_index);
+  CHECK_LT(start_index, end_index);
+  while (!pending_txns_[start_index - first_pending_index_]) {
+    ++start_index;
+  }
 
   VLOG_WITH_PREFIX(1) << "Last triggered apply was: " << last_committed_op_id_
-                      << " Starting to apply from log index: " << (*iter).first;
-
-  while (iter != end_iter) {
-    scoped_refptr<ConsensusRound> round = (*iter).second; // Make a copy.
-    DCHECK(round);
+                      << " Starting to apply from log index: " << start_index;
+
+  for (int64_t index = start_index; index < stop_index; ++index) {
+    // Take the round out of its slot rather than copying it.
+    scoped_refptr<ConsensusRound> round;
+    round.swap(pending_txns_[index - first_pending_index_]);
+    if (!round) {
+      continue;
+    }
+    --num_pending_txns_;
     const OpId& current_id = round->id();
 
     if (PREDICT_TRUE(!OpIdEquals(last_committed_op_id_, MinimumOpId()))) {
       CHECK_OK(CheckOpInSequence(last_committed_op_id_, current_id));
     }
 
-    pending_txns_.erase(iter++);
-    last_committed_op_id_ = round->id();
+    last_committed_op_id_ = current_id;
     time_manager_->AdvanceSafeTimeWithMessage(*round->replicate_msg());
     round->NotifyReplicationFinished(Status::OK());
   }
+  // The committed rounds were at the front, so this pops them all at once.
+  TrimPendingTxns();
+  PublishCommittedIndex();
+
+  return Status::OK();
+}
 
+Status PendingRounds::ResetToSnapshot(const OpId& last_included) {
+  if (num_pending_txns_ != 0) {
+    return Status::IllegalState(Substitute(
+        "cannot install a snapshot through $0 with $1 pending operations",
+        OpIdToString(last_included),
+        num_pending_txns_));
+  }
+  if (last_included.index() < last_committed_op_id_.index()) {
+    return Status::IllegalState(Substitute(
+        "snapshot through $0 is behind the committed operation $1",
+        OpIdToString(last_included),
+        OpIdToString(last_committed_op_id_)));
+  }
+  pending_txns_.clear();
+  first_pending_index_ = last_included.index() + 1;
+  last_committed_op_id_ = last_included;
+  local_region_durable_index_ =
+      std::max(local_region_durable_index_, last_included.index());
+  PublishCommittedIndex();
   return Status::OK();
 }
 
+void PendingRounds::AdvanceLocalRegionDurableIndex(int64_t index) {
+  if (index <= local_region_durable_index_) {
+    return;
+  }
+  int64_t end_index = first_pending_index_ + pending_txns_.size();
+  int64_t start_index =
+      std::max(local_region_durable_index_ + 1, first_pending_index_);
+  int64_t stop_index = std::min(index + 1, end_index);
+  for (int64_t i = start_index; i < stop_index; ++i) {
+    const scoped_refptr<ConsensusRound>& round =
+        pending_txns_[i - first_pending_index_];
+    if (round) {
+      round->NotifyLocalRegionDurable(Status::OK());
+    }
+  }
+  local_region_durable_index_ = index;
+}
+
 Status PendingRounds::SetInitialCommittedOpId(const OpId& committed_op) {
   CHECK_EQ(last_committed_op_id_.index(), 0);
   if (!pending_txns_.empty()) {
-    int64_t first_pending_index = pending_txns_.begin()->first;
+    int64_t first_pending_index = first_pending_index_;
     if (committed_op.index() < first_pending_index) {
       if (committed_op.index() != first_pending_index - 1) {
         return Status::Corruption(Substitute(
@@ -218,6 +357,7 @@ Status PendingRounds::SetInitialCommittedOpId(const OpId& committed_op) {
   } else {
     last_committed_op_id_ = committed_op;
   }
+  PublishCommittedIndex();
   return Status::OK();
 }
 
@@ -245,12 +385,39 @@ int64_t PendingRounds::GetCommittedIndex() const {
   return last_committed_op_id_.index();
 }
 
+Status PendingRounds::WaitForCommittedIndex(
+    int64_t index,
+    const MonoTime& deadline) const {
+  ThreadRestrictions::AssertWaitAllowed();
+  MutexLock l(committed_index_lock_);
+  while (published_committed_index_ < index) {
+    if (!committed_index_cond_.WaitUntil(deadline)) {
+      return Status::TimedOut(Substitute(
+          "committed index $0 has not reached $1",
+          published_committed_index_,
+          index));
+    }
+  }
+  return Status::OK();
+}
+
+int64_t PendingRounds::GetPublishedCommittedIndex() const {
+  MutexLock l(committed_index_lock_);
+  return published_committed_index_;
+}
+
+void PendingRounds::PublishCommittedIndex() {
+  MutexLock l(committed_index_lock_);
+  published_committed_index_ = last_committed_op_id_.index();
+  committed_index_cond_.Broadcast();
+}
+
 int64_t PendingRounds::GetTermWithLastCommittedOp() const {
   return last_committed_op_id_.term();
 }
 
 int PendingRounds::GetNumPendingTxns() const {
-  return pending_txns_.size();
+  return num_pending_txns_;
 }
 
 } // namespace consensus
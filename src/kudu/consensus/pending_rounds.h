@@ -18,12 +18,15 @@
 #pragma once
 
 #include <cstdint>
-#include <map>
+#include <deque>
 #include <string>
 
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/util/condition_variable.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/mutex.h"
 
 namespace kudu {
 class Status;
@@ -35,7 +38,8 @@ class ITimeManager;
 // Tracks the pending consensus rounds being managed by a Raft replica (either
 // leader or follower).
 //
-// This class is not thread-safe.
+// This class is not thread-safe, except for WaitForCommittedIndex() and
+// GetPublishedCommittedIndex().
 //
 // TODO(todd): this class inconsistently uses the term "round", "op", and
 // "transaction". We should consolidate to "round".
@@ -62,11 +66,20 @@ class PendingRounds {
   // This is a no-op if the committed index has not changed.
   Status AdvanceCommittedIndex(int64_t committed_index);
 
+  // Notifies the pending rounds through 'index' that they are durable in the
+  // leader's region, see ConsensusRound::SetLocalRegionDurableCallback().
+  void AdvanceLocalRegionDurableIndex(int64_t index);
+
   // Aborts pending operations after, but not including 'index'. The OpId with
   // 'index' will become our new last received id. If there are pending
   // operations with indexes higher than 'index' those operations are aborted.
   void AbortOpsAfter(int64_t index);
 
+  // Makes 'last_included', the last op of a snapshot which was just
+  // installed, the last committed op. The ops after the committed index must
+  // have been aborted, see SnapshotProvider.
+  Status ResetToSnapshot(const OpId& last_included);
+
   // Returns true if an operation is in this replica's log, namely:
   // - If the op's index is lower than or equal to our committed index
   // - If the op id matches an inflight op.
@@ -74,6 +87,12 @@ class PendingRounds {
   // are different 'term_mismatch' is set to true, it is false otherwise.
   bool IsOpCommittedOrPending(const OpId& op_id, bool* term_mismatch);
 
+  // Sets 'term' to the term of the pending op with 'index', and
+  // 'first_index' to the index of the first pending op of that term. Returns
+  // false if there is no pending op with 'index'.
+  bool GetPendingTermStart(int64_t index, int64_t* term, int64_t* first_index)
+      const;
+
   // Returns the id of the latest pending transaction (i.e. the one with the
   // latest index). This must be called under the lock.
   OpId GetLastPendingTransactionOpId() const;
@@ -93,6 +112,15 @@ class PendingRounds {
   int64_t GetCommittedIndex() const;
   int64_t GetTermWithLastCommittedOp() const;
 
+  // Waits until the committed index reaches 'index'. Returns TimedOut if it
+  // has not by 'deadline'. This may be called concurrently with the other
+  // methods, and must not be called with the consensus lock held.
+  Status WaitForCommittedIndex(int64_t index, const MonoTime& deadline) const;
+
+  // The committed index WaitForCommittedIndex() waits on. This may be called
+  // concurrently with the other methods.
+  int64_t GetPublishedCommittedIndex() const;
+
   // Checks that 'current' correctly follows 'previous'. Specifically it checks
   // that the term is the same or higher and that the index is sequential.
   static Status CheckOpInSequence(const OpId& previous, const OpId& current);
@@ -104,16 +132,42 @@ class PendingRounds {
 
   const std::string log_prefix_;
 
-  // Index=>Round map that manages pending ops, i.e. operations for which we've
-  // received a replicate message from the leader but have yet to be committed.
-  // The key is the index of the replicate operation.
-  typedef std::map<int64_t, scoped_refptr<ConsensusRound>> IndexToRoundMap;
-  IndexToRoundMap pending_txns_;
+  // Returns the slot of the pending op with 'index', or nullptr if there is
+  // no such op. Does not touch the round's refcount.
+  const scoped_refptr<ConsensusRound>* FindPendingOp(int64_t index) const;
+
+  // Pops the empty slots left at either end of 'pending_txns_'.
+  void TrimPendingTxns();
+
+  // Pending ops, i.e. operations for which we've received a replicate message
+  // from the leader but have yet to be committed, addressed by index: the op
+  // with index 'first_pending_index_ + i' is in slot 'i'. Pending indexes are
+  // contiguous in practice; a gap, should one ever be added, is held as an
+  // empty slot. The first and last slots are never empty.
+  std::deque<scoped_refptr<ConsensusRound>> pending_txns_;
+  int64_t first_pending_index_;
+
+  // The number of non-empty slots in 'pending_txns_'.
+  int num_pending_txns_;
+
+  // The rounds through this index were told that they are durable in the
+  // leader's region. Moved back when ops are aborted.
+  int64_t local_region_durable_index_;
 
   // The OpId of the round that was last committed. Initialized to
   // MinimumOpId().
   OpId last_committed_op_id_;
 
+  // Makes the index of 'last_committed_op_id_' visible to
+  // WaitForCommittedIndex().
+  void PublishCommittedIndex();
+
+  // The last committed index published for WaitForCommittedIndex(), under
+  // 'committed_index_lock_'.
+  mutable Mutex committed_index_lock_;
+  ConditionVariable committed_index_cond_;
+  int64_t published_committed_index_;
+
   scoped_refptr<ITimeManager> time_manager_;
 
   DISALLOW_COPY_AND_ASSIGN(PendingRounds);
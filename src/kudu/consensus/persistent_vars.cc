@@ -168,6 +168,18 @@ bool PersistentVars::FileExists(
       fs_manager->GetPersistentVarsPath(tablet_id));
 }
 
+Status PersistentVars::DeleteOnDiskData(
+    FsManager* fs_manager,
+    const std::string& tablet_id) {
+  Status s = fs_manager->env()->DeleteFile(
+      fs_manager->GetPersistentVarsPath(tablet_id));
+  if (!s.ok() && !s.IsNotFound()) {
+    return s.CloneAndPrepend(Substitute(
+        "Unable to delete persistent vars for tablet $0", tablet_id));
+  }
+  return Status::OK();
+}
+
 std::string PersistentVars::LogPrefix() const {
   // No need to lock to read const members.
   return Substitute("T $0 P $1: ", tablet_id_, peer_uuid_);
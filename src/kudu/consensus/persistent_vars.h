@@ -100,6 +100,11 @@ class PersistentVars : public RefCountedThreadSafe<PersistentVars> {
   // Check whether the persistent_vars file exists for the given tablet
   static bool FileExists(FsManager* fs_manager, const std::string& tablet_id);
 
+  // Delete the on-disk data for the given tablet, if there is any.
+  static Status DeleteOnDiskData(
+      FsManager* fs_manager,
+      const std::string& tablet_id);
+
   std::string LogPrefix() const;
 
   FsManager* const fs_manager_;
@@ -101,5 +101,13 @@ bool PersistentVarsManager::PersistentVarsFileExists(
   return PersistentVars::FileExists(fs_manager_, tablet_id);
 }
 
+Status PersistentVarsManager::DeletePersistentVars(const string& tablet_id) {
+  {
+    lock_guard<Mutex> l(persistent_vars_lock_);
+    persistent_vars_cache_.erase(tablet_id);
+  }
+  return PersistentVars::DeleteOnDiskData(fs_manager_, tablet_id);
+}
+
 } // namespace consensus
 } // namespace kudu
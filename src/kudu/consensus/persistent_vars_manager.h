@@ -65,6 +65,10 @@ class PersistentVarsManager
   // Check whether the Persistent Vars file exists for a given tablet
   bool PersistentVarsFileExists(const std::string& tablet_id) const;
 
+  // Delete the PersistentVars instance keyed by 'tablet_id' from the cache
+  // and from disk. Deleting a missing instance is not an error.
+  Status DeletePersistentVars(const std::string& tablet_id);
+
  private:
   friend class RefCountedThreadSafe<PersistentVarsManager>;
 
@@ -0,0 +1,141 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#include "kudu/consensus/phi_accrual_detector.h"
+
+#include <cstdint>
+#include <vector>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "kudu/util/monotime.h"
+#include "kudu/util/test_util.h"
+
+namespace kudu {
+namespace consensus {
+
+static const double kThreshold = 8;
+
+class PhiAccrualDetectorTest : public KuduTest {
+ public:
+  PhiAccrualDetectorTest()
+      : start_(MonoTime::Now()),
+        detector_(100, 10, MonoDelta::FromMilliseconds(50)) {}
+
+ protected:
+  MonoTime At(int64_t ms) const {
+    return start_ + MonoDelta::FromMilliseconds(ms);
+  }
+
+  // Sends heartbeats from 'leader' at each of 'times_ms'.
+  void Heartbeats(const char* leader, const std::vector<int64_t>& times_ms) {
+    for (int64_t ms : times_ms) {
+      detector_.Heartbeat(leader, At(ms));
+    }
+  }
+
+  int64_t SuspicionTimeoutMs(MonoDelta expected_interval) const {
+    MonoDelta timeout;
+    CHECK(detector_.GetSuspicionTimeout(
+        kThreshold, expected_interval, &timeout));
+    return timeout.ToMilliseconds();
+  }
+
+  static const MonoDelta kNoInterval;
+
+  const MonoTime start_;
+  PhiAccrualDetector detector_;
+};
+
+const MonoDelta PhiAccrualDetectorTest::kNoInterval =
+    MonoDelta::FromMilliseconds(0);
+
+// A leader heard from like clockwork is suspected soon after it is late, as
+// phi grows with its silence.
+TEST_F(PhiAccrualDetectorTest, TestRegularHeartbeats) {
+  std::vector<int64_t> times_ms;
+  for (int i = 0; i <= 9; i++) {
+    times_ms.push_back(i * 500);
+  }
+  Heartbeats("a", times_ms);
+  MonoDelta timeout;
+  ASSERT_FALSE(
+      detector_.GetSuspicionTimeout(kThreshold, kNoInterval, &timeout));
+  ASSERT_EQ(0, detector_.Phi(At(10000), kNoInterval));
+
+  Heartbeats("a", {5000});
+  ASSERT_EQ(10, detector_.num_samples());
+  // The standard deviation is taken to be 50ms.
+  const int64_t timeout_ms = SuspicionTimeoutMs(kNoInterval);
+  ASSERT_NEAR(761, timeout_ms, 2);
+
+  const double phi_on_time = detector_.Phi(At(5500), kNoInterval);
+  ASSERT_NEAR(0.3, phi_on_time, 0.01);
+  const double phi_late = detector_.Phi(At(5600), kNoInterval);
+  ASSERT_GT(phi_late, phi_on_time);
+  ASSERT_NEAR(
+      kThreshold, detector_.Phi(At(5000 + timeout_ms), kNoInterval), 0.1);
+  ASSERT_GT(detector_.Phi(At(7000), kNoInterval), kThreshold);
+}
+
+// The intervals of a jittery link stretch the timeout.
+TEST_F(PhiAccrualDetectorTest, TestJitteryHeartbeats) {
+  std::vector<int64_t> times_ms;
+  int64_t ms = 0;
+  for (int i = 0; i <= 20; i++) {
+    times_ms.push_back(ms);
+    ms += i % 2 == 0 ? 300 : 700;
+  }
+  Heartbeats("a", times_ms);
+  // The mean is 500ms and the standard deviation 200ms.
+  ASSERT_NEAR(1544, SuspicionTimeoutMs(kNoInterval), 5);
+}
+
+// A busy leader's requests don't make its timeout shorter than its
+// heartbeats allow for.
+TEST_F(PhiAccrualDetectorTest, TestExpectedInterval) {
+  std::vector<int64_t> times_ms;
+  for (int i = 0; i <= 50; i++) {
+    times_ms.push_back(i * 10);
+  }
+  Heartbeats("a", times_ms);
+  ASSERT_LT(SuspicionTimeoutMs(kNoInterval), 300);
+  ASSERT_NEAR(761, SuspicionTimeoutMs(MonoDelta::FromMilliseconds(500)), 2);
+}
+
+// The intervals start over with another leader, and after an interruption.
+TEST_F(PhiAccrualDetectorTest, TestNewLeaderAndInterrupt) {
+  std::vector<int64_t> times_ms;
+  for (int i = 0; i <= 10; i++) {
+    times_ms.push_back(i * 500);
+  }
+  Heartbeats("a", times_ms);
+  ASSERT_EQ(10, detector_.num_samples());
+  const int64_t timeout_ms = SuspicionTimeoutMs(kNoInterval);
+
+  detector_.Interrupt();
+  ASSERT_EQ(0, detector_.Phi(At(60000), kNoInterval));
+  Heartbeats("a", {60000});
+  ASSERT_EQ(10, detector_.num_samples());
+  ASSERT_EQ(timeout_ms, SuspicionTimeoutMs(kNoInterval));
+
+  Heartbeats("b", {60100});
+  ASSERT_EQ(0, detector_.num_samples());
+}
+
+} // namespace consensus
+} // namespace kudu
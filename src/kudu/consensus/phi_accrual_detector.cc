@@ -0,0 +1,133 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#include "kudu/consensus/phi_accrual_detector.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include <glog/logging.h>
+
+namespace kudu {
+namespace consensus {
+
+namespace {
+
+// The coefficients of the logistic approximation of the cumulative
+// distribution function of the standard normal distribution,
+// 1 / (1 + exp(-y * (kA * y^2 + kB))), which is accurate to within 1e-4.
+constexpr double kA = 0.070566;
+constexpr double kB = 1.5976;
+
+} // anonymous namespace
+
+PhiAccrualDetector::PhiAccrualDetector(
+    int window_size,
+    int min_samples,
+    MonoDelta min_stddev)
+    : window_size_(std::max(window_size, 1)),
+      min_samples_(std::max(min_samples, 1)),
+      min_stddev_ms_(std::max(min_stddev.ToSeconds() * 1000, 1e-3)) {}
+
+void PhiAccrualDetector::Heartbeat(
+    const std::string& leader_uuid,
+    MonoTime now) {
+  if (leader_uuid != leader_uuid_) {
+    leader_uuid_ = leader_uuid;
+    samples_ms_.clear();
+    sum_ms_ = 0;
+    sum_squares_ms_ = 0;
+  } else if (last_heartbeat_.Initialized() && now > last_heartbeat_) {
+    const double interval_ms = (now - last_heartbeat_).ToSeconds() * 1000;
+    samples_ms_.push_back(interval_ms);
+    sum_ms_ += interval_ms;
+    sum_squares_ms_ += interval_ms * interval_ms;
+    if (samples_ms_.size() > static_cast<size_t>(window_size_)) {
+      const double oldest_ms = samples_ms_.front();
+      samples_ms_.pop_front();
+      sum_ms_ -= oldest_ms;
+      sum_squares_ms_ -= oldest_ms * oldest_ms;
+    }
+  }
+  last_heartbeat_ = now;
+}
+
+void PhiAccrualDetector::Interrupt() {
+  last_heartbeat_ = MonoTime();
+}
+
+bool PhiAccrualDetector::GetDistribution(
+    MonoDelta expected_interval,
+    double* mean,
+    double* stddev) const {
+  if (samples_ms_.size() < static_cast<size_t>(min_samples_)) {
+    return false;
+  }
+  const double n = samples_ms_.size();
+  const double raw_mean = sum_ms_ / n;
+  const double variance =
+      std::max(sum_squares_ms_ / n - raw_mean * raw_mean, 0.0);
+  *mean = std::max(raw_mean, expected_interval.ToSeconds() * 1000);
+  *stddev = std::max(std::sqrt(variance), min_stddev_ms_);
+  return true;
+}
+
+double PhiAccrualDetector::Phi(
+    MonoTime now,
+    MonoDelta expected_interval) const {
+  double mean;
+  double stddev;
+  if (!last_heartbeat_.Initialized() ||
+      !GetDistribution(expected_interval, &mean, &stddev)) {
+    return 0;
+  }
+  const double elapsed_ms = (now - last_heartbeat_).ToSeconds() * 1000;
+  const double y = (elapsed_ms - mean) / stddev;
+  const double e = std::exp(-y * (kA * y * y + kB));
+  // Computed from the side of the mean which doesn't lose precision.
+  if (elapsed_ms > mean) {
+    return -std::log10(e / (1 + e));
+  }
+  return -std::log10(1 - 1 / (1 + e));
+}
+
+bool PhiAccrualDetector::GetSuspicionTimeout(
+    double threshold,
+    MonoDelta expected_interval,
+    MonoDelta* timeout) const {
+  DCHECK_GE(threshold, 1);
+  double mean;
+  double stddev;
+  if (!GetDistribution(expected_interval, &mean, &stddev)) {
+    return false;
+  }
+  // Phi reaches the threshold when e / (1 + e) = p, i.e. for the y which
+  // solves kA * y^3 + kB * y + ln(e) = 0. Since kA and kB are positive, the
+  // cubic has a single real root, given by Cardano's formula.
+  const double p = std::pow(10, -threshold);
+  const double q = std::log(p / (1 - p)) / kA;
+  const double r = kB / kA;
+  const double d = std::sqrt(q * q / 4 + r * r * r / 27);
+  const double y = std::cbrt(-q / 2 + d) + std::cbrt(-q / 2 - d);
+  *timeout = MonoDelta::FromMicroseconds(
+      static_cast<int64_t>((mean + y * stddev) * 1000));
+  return true;
+}
+
+} // namespace consensus
+} // namespace kudu
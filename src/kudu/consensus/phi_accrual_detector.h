@@ -0,0 +1,100 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#pragma once
+
+#include <deque>
+#include <string>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/util/monotime.h"
+
+namespace kudu {
+namespace consensus {
+
+// A phi accrual failure detector of the leader, as seen by a follower: it
+// models the intervals between the leader's requests as a normal
+// distribution, from a window of the latest ones, and rather than deciding
+// whether the leader failed at a fixed timeout, measures how suspicious its
+// silence has become with phi = -log10(P(the next request comes later)).
+// A leader whose requests come like clockwork is thus suspected soon after
+// one is late, while the intervals of a jittery link stretch the timeout.
+//
+// The intervals are those of the current leader only, and start over when
+// another leader is heard from.
+//
+// Not thread-safe.
+class PhiAccrualDetector {
+ public:
+  // Keeps up to 'window_size' intervals, and only suspects the leader once
+  // it has 'min_samples' of them. The standard deviation of the intervals is
+  // taken to be at least 'min_stddev', so that the timeout of a very regular
+  // leader still leaves room for some jitter.
+  PhiAccrualDetector(int window_size, int min_samples, MonoDelta min_stddev);
+
+  // Records a request from 'leader_uuid' at 'now'. The intervals of any
+  // previous leader are dropped.
+  void Heartbeat(const std::string& leader_uuid, MonoTime now);
+
+  // Makes the next request start over, without recording the interval since
+  // the last one, e.g. after the leader slowed down its heartbeats.
+  void Interrupt();
+
+  // Returns the suspicion of the leader at 'now', or 0 if there aren't enough
+  // intervals yet. 'expected_interval' is the longest the leader may go
+  // without sending a request while it is healthy, the interval between its
+  // heartbeats, which the mean interval is taken to be at least: a busy
+  // leader sends requests much more often, until it runs out of ops.
+  double Phi(MonoTime now, MonoDelta expected_interval) const;
+
+  // Sets 'timeout' to the time after the last request at which Phi() reaches
+  // 'threshold', which must be at least 1. Returns false if there aren't
+  // enough intervals yet.
+  bool GetSuspicionTimeout(
+      double threshold,
+      MonoDelta expected_interval,
+      MonoDelta* timeout) const;
+
+  int num_samples() const {
+    return samples_ms_.size();
+  }
+
+ private:
+  // Sets 'mean' and 'stddev' to those of the intervals, in milliseconds, as
+  // adjusted for 'expected_interval' and 'min_stddev_'. Returns false if there
+  // aren't enough intervals.
+  bool GetDistribution(
+      MonoDelta expected_interval,
+      double* mean,
+      double* stddev) const;
+
+  const int window_size_;
+  const int min_samples_;
+  const double min_stddev_ms_;
+
+  std::string leader_uuid_;
+  MonoTime last_heartbeat_;
+
+  // The latest intervals, oldest first, with their sum and sum of squares.
+  std::deque<double> samples_ms_;
+  double sum_ms_ = 0;
+  double sum_squares_ms_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(PhiAccrualDetector);
+};
+
+} // namespace consensus
+} // namespace kudu
@@ -24,9 +24,13 @@ enum class ProxyPolicy {
   // Proxy is disabled and the leader ships ops to all peers directly
   DISABLE_PROXY = 1,
   // Proxy routing is built implicily using current active raft configs.
-  // One peer is choosen to act as a 'proxy peer' in a given region.
+  // Up to --raft_proxy_peers_per_region peers are choosen to act as 'proxy
+  // peers' in a given region.
   // The rules used to build proxy topology in this policy is:
-  // 1. A given region has at-most one valid proxy peer.
+  // 1. A given region has at-most --raft_proxy_peers_per_region valid proxy
+  //    peers, and the peers proxied in it are spread across them by
+  //    consistent hashing. A proxy peer the leader can't reach is dropped
+  //    until it responds again, and only its share of peers moves.
   // 2. The proxy peer in a region is always backed by a database i.e a peer
   //    that acts as a witness (of raft log) cannot be a proxy peer.
   // 3. A region can have no valid proxy peers, in which case the leader ships
@@ -39,6 +43,22 @@ enum class ProxyPolicy {
   // Routing topology needs to be explicilty supplied by external entities
   // Read DurableRoutingTable in routing.h/routing.cc for more details
   DURABLE_ROUTING_POLICY = 3,
+  // Routing topology is built by the leader from the round trips it
+  // measures to each peer and those its proxies report to their
+  // destinations. Read LatencyAwareRoutingTable in routing.h for details.
+  // The rules used are:
+  // 1. The leader ships ops directly to all peers in its own region, and to
+  //    the fastest remote voters it needs for a commit quorum, so proxying
+  //    never delays commits.
+  // 2. In each remote region, the peer with the fastest round trip from the
+  //    leader acts as the region's proxy peer.
+  // 3. Other remote peers are proxied through their region's proxy peer,
+  //    saving WAN bytes, unless the path through it is slower than shipping
+  //    to them directly by more than --raft_latency_routing_proxy_slack.
+  // 4. Routes only change when the alternative is better by
+  //    --raft_latency_routing_switch_margin, so that they re-route smoothly
+  //    as a proxy slows down instead of flapping.
+  LATENCY_AWARE_ROUTING_POLICY = 4,
 };
 } // namespace consensus
 } // namespace kudu
@@ -17,6 +17,8 @@
 
 #include "kudu/consensus/quorum_util.h"
 
+#include <cstdint>
+#include <map>
 #include <memory>
 #include <ostream>
 #include <string>
@@ -28,6 +30,7 @@
 
 #include "kudu/common/common.pb.h"
 #include "kudu/consensus/metadata.pb.h"
+#include "kudu/consensus/raft_config_index.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/status.h"
 #include "kudu/util/test_macros.h"
@@ -1941,5 +1944,112 @@ TEST(QuorumUtilTest, ReplaceAllTabletReplicas) {
   EXPECT_FALSE(ShouldAddReplica(config, kReplicationFactor, kPolicy));
 }
 
+TEST(QuorumUtilTest, PeerCountsTowardCommit) {
+  RaftConfigPB config;
+  const vector<pair<string, string>> peers = {
+      {"A", "east"}, {"B", "east"}, {"C", "west"}, {"D", "north"}};
+  for (const auto& peer : peers) {
+    AddPeer(&config, peer.first, V);
+    config.mutable_peers()->rbegin()->mutable_attrs()->set_region(
+        peer.second);
+  }
+  AddPeer(&config, "L", N);
+  config.mutable_peers()->rbegin()->mutable_attrs()->set_region("east");
+
+  // Without a commit rule every voter counts.
+  for (const RaftPeerPB& peer : config.peers()) {
+    EXPECT_EQ(peer.member_type() == V, PeerCountsTowardCommit(config, peer, ""))
+        << peer.permanent_uuid();
+  }
+
+  // A static rule only needs the regions named by its predicates.
+  CommitRulePB* rule = config.mutable_commit_rule();
+  rule->set_mode(QuorumMode::STATIC_CONJUNCTION);
+  CommitRulePredicatePB* predicate = rule->add_rule_predicates();
+  predicate->add_regions("east");
+  predicate->add_regions("west");
+  predicate->set_regions_subset_size(2);
+  vector<string> counted;
+  for (const RaftPeerPB& peer : config.peers()) {
+    if (PeerCountsTowardCommit(config, peer, "east")) {
+      counted.push_back(peer.permanent_uuid());
+    }
+  }
+  EXPECT_EQ((vector<string>{"A", "B", "C"}), counted);
+
+  // The dynamic mode only needs the region of the leader.
+  rule->set_mode(QuorumMode::SINGLE_REGION_DYNAMIC);
+  counted.clear();
+  for (const RaftPeerPB& peer : config.peers()) {
+    if (PeerCountsTowardCommit(config, peer, "west")) {
+      counted.push_back(peer.permanent_uuid());
+    }
+  }
+  EXPECT_EQ((vector<string>{"C"}), counted);
+}
+
+TEST(QuorumUtilTest, RaftConfigIndex) {
+  RaftConfigPB config;
+  const vector<pair<string, string>> peers = {
+      {"A", "east"}, {"B", "east"}, {"C", "west"}};
+  for (const auto& peer : peers) {
+    AddPeer(&config, peer.first, V);
+    config.mutable_peers()->rbegin()->mutable_attrs()->set_region(
+        peer.second);
+  }
+  config.mutable_peers(1)->mutable_attrs()->set_backing_db_present(false);
+  AddPeer(&config, "L", N);
+  config.mutable_peers()->rbegin()->mutable_attrs()->set_region("north");
+
+  RaftConfigIndex index(config);
+  EXPECT_EQ(4, index.num_members());
+  EXPECT_EQ(3, index.num_voters());
+  ASSERT_NE(nullptr, index.FindMember("C"));
+  EXPECT_EQ("west", index.FindMember("C")->attrs().region());
+  EXPECT_EQ(nullptr, index.FindMember("Z"));
+  EXPECT_TRUE(index.IsMember("L"));
+  EXPECT_FALSE(index.IsVoter("L"));
+  EXPECT_TRUE(index.IsVoter("A"));
+  EXPECT_FALSE(index.IsVoter("Z"));
+
+  // The counts match what GetActualVoterCountsFromConfig() reports.
+  std::map<string, int> expected;
+  string leader_quorum_id;
+  GetActualVoterCountsFromConfig(config, "A", &expected, &leader_quorum_id);
+  EXPECT_EQ(expected, index.VoterCountsByQuorum());
+  EXPECT_EQ((std::map<string, int>{{"east", 1}, {"west", 1}}),
+            index.VoterCountsByQuorum(/* backed_by_db_only */ true));
+
+  // Quorums without any voter left are dropped from the voter distribution.
+  std::map<string, int> vd = {{"east", 3}, {"west", 3}, {"north", 3}};
+  AdjustVoterDistributionWithCurrentVoters(index, &vd);
+  EXPECT_EQ((std::map<string, int>{{"east", 3}, {"west", 3}}), vd);
+}
+
+TEST(QuorumUtilTest, RaftConfigIndexElectionPriorities) {
+  RaftConfigPB config;
+  const vector<pair<string, int32_t>> peers = {
+      {"A", 10}, {"B", 10}, {"C", 5}, {"D", 0}};
+  for (const auto& peer : peers) {
+    AddPeer(&config, peer.first, V);
+    config.mutable_peers()->rbegin()->mutable_attrs()->set_election_priority(
+        peer.second);
+  }
+  // Non-voters don't rank.
+  AddPeer(&config, "L", N);
+  config.mutable_peers()->rbegin()->mutable_attrs()->set_election_priority(20);
+
+  RaftConfigIndex index(config);
+  EXPECT_EQ(3, index.num_election_priorities());
+  EXPECT_EQ(10, index.ElectionPriority("B"));
+  EXPECT_EQ(20, index.ElectionPriority("L"));
+  EXPECT_EQ(0, index.ElectionPriority("Z"));
+  EXPECT_EQ(0, index.ElectionPriorityRank(20));
+  EXPECT_EQ(0, index.ElectionPriorityRank(10));
+  EXPECT_EQ(1, index.ElectionPriorityRank(5));
+  EXPECT_EQ(2, index.ElectionPriorityRank(0));
+  EXPECT_EQ(3, index.ElectionPriorityRank(-1));
+}
+
 } // namespace consensus
 } // namespace kudu
@@ -16,6 +16,7 @@
 // under the License.
 #include "kudu/consensus/quorum_util.h"
 
+#include <algorithm>
 #include <map>
 #include <memory>
 #include <ostream>
@@ -29,6 +30,7 @@
 
 #include "kudu/common/common.pb.h"
 #include "kudu/consensus/metadata.pb.h"
+#include "kudu/consensus/raft_config_index.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/port.h"
@@ -969,6 +971,34 @@ void GetActualVoterCountsFromConfig(
   }
 }
 
+namespace {
+
+// Raises the voter count of each quorum of 'voter_distribution' to the number
+// of voters it has in 'voters_per_quorum', dropping the quorums which have
+// none.
+void AdjustVoterDistribution(
+    const std::map<std::string, int>& voters_per_quorum,
+    std::map<std::string, int>* voter_distribution) {
+  for (auto itr = voter_distribution->begin();
+       itr != voter_distribution->end();) {
+    auto fnditr = voters_per_quorum.find(itr->first);
+
+    // There is a region in voter distribution which has no voters.
+    // We need to remove it, otherwise Pessismistic quorum will be invalid.
+    // This can happen during region removals. The voter distribution is
+    // still around till the last voter in a region has been deleted.
+    if (fnditr == voters_per_quorum.end()) {
+      itr = voter_distribution->erase(itr);
+      continue;
+    }
+
+    itr->second = std::max(itr->second, fnditr->second);
+    ++itr;
+  }
+}
+
+} // anonymous namespace
+
 void AdjustVoterDistributionWithCurrentVoters(
     const RaftConfigPB& config,
     std::map<std::string, int>* voter_distribution) {
@@ -986,23 +1016,16 @@ void AdjustVoterDistributionWithCurrentVoters(
       &voters_in_config_per_quorum,
       &unused_leader_region);
 
-  std::map<std::string, int>::iterator itr;
   // We will increase the voter distribution to the max of the 2 maps
-  for (itr = voter_distribution->begin(); itr != voter_distribution->end();
-       ++itr) {
-    auto fnditr = voters_in_config_per_quorum.find(itr->first);
-
-    // There is a region in voter distribution which has no voters.
-    // We need to remove it, otherwise Pessismistic quorum will be invalid.
-    // This can happen during region removals. The voter distribution is
-    // still around till the last voter in a region has been deleted.
-    if (fnditr == voters_in_config_per_quorum.end()) {
-      itr = voter_distribution->erase(itr);
-      continue;
-    }
+  AdjustVoterDistribution(voters_in_config_per_quorum, voter_distribution);
+}
 
-    itr->second = std::max(itr->second, fnditr->second);
-  }
+void AdjustVoterDistributionWithCurrentVoters(
+    const RaftConfigIndex& config_index,
+    std::map<std::string, int>* voter_distribution) {
+  CHECK(voter_distribution);
+  AdjustVoterDistribution(
+      config_index.VoterCountsByQuorum(), voter_distribution);
 }
 
 void GetVoterDistributionForQuorumId(
@@ -1100,5 +1123,34 @@ bool PeerHasValidQuorumId(const RaftPeerPB& peer) {
       !peer.attrs().quorum_id().empty();
 }
 
+bool PeerCountsTowardCommit(
+    const RaftConfigPB& config,
+    const RaftPeerPB& peer,
+    const std::string& leader_quorum_id) {
+  if (!peer.has_member_type() || peer.member_type() != RaftPeerPB::VOTER) {
+    return false;
+  }
+  if (!config.has_commit_rule()) {
+    return true;
+  }
+
+  const CommitRulePB& commit_rule = config.commit_rule();
+  const std::string& quorum_id = IsUseQuorumId(commit_rule)
+      ? peer.attrs().quorum_id()
+      : peer.attrs().region();
+  if (IsStaticQuorumMode(commit_rule.mode())) {
+    for (const CommitRulePredicatePB& predicate :
+         commit_rule.rule_predicates()) {
+      for (const std::string& region : predicate.regions()) {
+        if (region == quorum_id) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+  return leader_quorum_id.empty() || quorum_id == leader_quorum_id;
+}
+
 } // namespace consensus
 } // namespace kudu
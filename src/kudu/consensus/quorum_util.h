@@ -27,6 +27,8 @@
 namespace kudu {
 namespace consensus {
 
+class RaftConfigIndex;
+
 enum RaftConfigState {
   PENDING_CONFIG,
   COMMITTED_CONFIG,
@@ -187,6 +189,12 @@ void AdjustVoterDistributionWithCurrentVoters(
     const RaftConfigPB& config,
     std::map<std::string, int>* voter_distribution);
 
+// Same as above, with the voters counted by 'config_index' rather than by
+// scanning the config.
+void AdjustVoterDistributionWithCurrentVoters(
+    const RaftConfigIndex& config_index,
+    std::map<std::string, int>* voter_distribution);
+
 // For QuorumType = Region, it returns the current VD. For QuorumType =
 // QuorumID, it returns default quorum size with current voter quorums, and
 // overrided by current VD.
@@ -215,6 +223,17 @@ const std::string& GetQuorumId(const RaftPeerPB& peer, bool use_quorum_id);
 // Return true of the peer has a non-empty quorum_id
 bool PeerHasValidQuorumId(const RaftPeerPB& peer);
 
+// Returns true if acknowledgements from 'peer' can count toward the commit
+// rule of 'config' while a replica of 'leader_quorum_id' leads. Non-voters
+// never count. In a static mode only voters of quorums named by one of the
+// rule predicates count, and in SINGLE_REGION_DYNAMIC only voters of the
+// leader's quorum do. Without a commit rule, or with an empty
+// 'leader_quorum_id' in dynamic mode, every voter counts.
+bool PeerCountsTowardCommit(
+    const RaftConfigPB& config,
+    const RaftPeerPB& peer,
+    const std::string& leader_quorum_id);
+
 } // namespace consensus
 } // namespace kudu
 
@@ -0,0 +1,82 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/quorum_watermarks.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "kudu/util/test_util.h"
+
+namespace kudu {
+namespace consensus {
+
+class QuorumWatermarksTest : public KuduTest {};
+
+TEST_F(QuorumWatermarksTest, TestKthHighest) {
+  QuorumWatermarks watermarks;
+  ASSERT_EQ(std::nullopt, watermarks.KthHighest("a", 1));
+
+  watermarks.Set("p1", "a", 5);
+  watermarks.Set("p2", "a", 7);
+  watermarks.Set("p3", "a", 3);
+  watermarks.Set("p4", "b", 1);
+  ASSERT_EQ(3, watermarks.NumPeers("a"));
+  ASSERT_EQ(7, watermarks.KthHighest("a", 1));
+  ASSERT_EQ(5, watermarks.KthHighest("a", 2));
+  ASSERT_EQ(3, watermarks.KthHighest("a", 3));
+  ASSERT_EQ(std::nullopt, watermarks.KthHighest("a", 4));
+  ASSERT_EQ(1, watermarks.KthHighest("b", 1));
+
+  // Equal watermarks are counted once per peer.
+  watermarks.Set("p3", "a", 7);
+  ASSERT_EQ(7, watermarks.KthHighest("a", 2));
+  ASSERT_EQ(5, watermarks.KthHighest("a", 3));
+
+  // Watermarks may move down too.
+  watermarks.Set("p2", "a", 0);
+  ASSERT_EQ(5, watermarks.KthHighest("a", 2));
+  ASSERT_EQ(0, watermarks.KthHighest("a", 3));
+}
+
+TEST_F(QuorumWatermarksTest, TestMoveAndErase) {
+  QuorumWatermarks watermarks;
+  watermarks.Set("p1", "a", 5);
+  watermarks.Set("p2", "a", 7);
+
+  // Moving a peer takes it out of its old quorum.
+  watermarks.Set("p2", "b", 7);
+  ASSERT_EQ(1, watermarks.NumPeers("a"));
+  ASSERT_EQ(std::nullopt, watermarks.KthHighest("a", 2));
+  ASSERT_EQ(7, watermarks.KthHighest("b", 1));
+
+  watermarks.Erase("p1");
+  watermarks.Erase("unknown");
+  ASSERT_EQ(0, watermarks.NumPeers("a"));
+  ASSERT_EQ(std::nullopt, watermarks.KthHighest("a", 1));
+
+  watermarks.Clear();
+  ASSERT_EQ(0, watermarks.NumPeers("b"));
+  watermarks.Set("p2", "a", 1);
+  ASSERT_EQ(1, watermarks.KthHighest("a", 1));
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,92 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/quorum_watermarks.h"
+
+#include <iterator>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "kudu/gutil/map-util.h"
+
+using std::string;
+
+namespace kudu {
+namespace consensus {
+
+void QuorumWatermarks::Set(
+    const string& uuid,
+    const string& quorum,
+    int64_t watermark) {
+  auto it = peers_.find(uuid);
+  if (it != peers_.end()) {
+    Peer& peer = it->second;
+    if (peer.quorum == quorum) {
+      if (*peer.watermark == watermark) {
+        return;
+      }
+      Watermarks& watermarks = quorums_[quorum];
+      // Watermarks mostly move up a little: insert next to the old one.
+      Watermarks::iterator hint = std::next(peer.watermark);
+      watermarks.erase(peer.watermark);
+      peer.watermark = watermarks.insert(hint, watermark);
+      return;
+    }
+    Erase(uuid);
+  }
+  Watermarks& watermarks = quorums_[quorum];
+  peers_.emplace(uuid, Peer{quorum, watermarks.insert(watermark)});
+}
+
+void QuorumWatermarks::Erase(const string& uuid) {
+  auto it = peers_.find(uuid);
+  if (it == peers_.end()) {
+    return;
+  }
+  auto quorum_it = quorums_.find(it->second.quorum);
+  DCHECK(quorum_it != quorums_.end());
+  quorum_it->second.erase(it->second.watermark);
+  if (quorum_it->second.empty()) {
+    quorums_.erase(quorum_it);
+  }
+  peers_.erase(it);
+}
+
+void QuorumWatermarks::Clear() {
+  peers_.clear();
+  quorums_.clear();
+}
+
+int QuorumWatermarks::NumPeers(const string& quorum) const {
+  const Watermarks* watermarks = FindOrNull(quorums_, quorum);
+  return watermarks ? static_cast<int>(watermarks->size()) : 0;
+}
+
+std::optional<int64_t> QuorumWatermarks::KthHighest(
+    const string& quorum,
+    int k) const {
+  DCHECK_GT(k, 0);
+  const Watermarks* watermarks = FindOrNull(quorums_, quorum);
+  if (!watermarks || static_cast<int>(watermarks->size()) < k) {
+    return std::nullopt;
+  }
+  return *std::next(watermarks->rbegin(), k - 1);
+}
+
+} // namespace consensus
+} // namespace kudu
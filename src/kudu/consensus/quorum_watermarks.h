@@ -0,0 +1,71 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+namespace kudu {
+namespace consensus {
+
+// The watermarks of a set of peers, each in one quorum, kept sorted per
+// quorum so that the watermark which a given number of the peers of a quorum
+// reached is found without visiting every peer. Setting the watermark of a
+// peer takes O(log n), and finding the one which 'k' peers reached takes
+// O(log n + k).
+//
+// Not thread-safe.
+class QuorumWatermarks {
+ public:
+  // Sets the watermark of the peer 'uuid' to 'watermark' in 'quorum', moving
+  // the peer there if it was in another quorum.
+  void Set(
+      const std::string& uuid,
+      const std::string& quorum,
+      int64_t watermark);
+
+  // Forgets the peer 'uuid', if it is known.
+  void Erase(const std::string& uuid);
+
+  void Clear();
+
+  // The number of peers in 'quorum'.
+  int NumPeers(const std::string& quorum) const;
+
+  // The highest watermark which 'k' of the peers of 'quorum' reached, i.e.
+  // its 'k'-th highest watermark, or none if fewer than 'k' peers are in
+  // 'quorum'. 'k' must be positive.
+  std::optional<int64_t> KthHighest(const std::string& quorum, int k) const;
+
+ private:
+  typedef std::multiset<int64_t> Watermarks;
+
+  struct Peer {
+    std::string quorum;
+    Watermarks::iterator watermark;
+  };
+
+  std::unordered_map<std::string, Peer> peers_;
+  std::unordered_map<std::string, Watermarks> quorums_;
+};
+
+} // namespace consensus
+} // namespace kudu
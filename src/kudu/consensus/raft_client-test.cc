@@ -0,0 +1,414 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/raft_client.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "kudu/common/wire_protocol.h"
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/metadata.pb.h"
+#include "kudu/consensus/opid.pb.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/rpc/messenger.h"
+#include "kudu/rpc/rpc_controller.h"
+#include "kudu/util/countdown_latch.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/net/net_util.h"
+#include "kudu/util/net/sockaddr.h"
+#include "kudu/util/net/socket.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+using std::map;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace consensus {
+
+namespace {
+
+// Replicas named after the hosts of their addresses, which answer as the
+// leader, or point to it, as set by the test.
+class FakeCluster {
+ public:
+  explicit FakeCluster(shared_ptr<rpc::Messenger> messenger)
+      : messenger_(std::move(messenger)) {}
+
+  void SetLeader(int64_t term, const string& leader, bool hint = true) {
+    std::lock_guard<simple_spinlock> l(lock_);
+    term_ = term;
+    leader_ = leader;
+    hint_ = hint;
+  }
+
+  // Holds the responses back until Release().
+  void Hold() {
+    std::lock_guard<simple_spinlock> l(lock_);
+    hold_ = true;
+  }
+
+  void Release() {
+    vector<rpc::ResponseCallback> held;
+    {
+      std::lock_guard<simple_spinlock> l(lock_);
+      hold_ = false;
+      held.swap(held_);
+    }
+    for (const auto& callback : held) {
+      Respond(callback);
+    }
+  }
+
+  void Handle(
+      const string& uuid,
+      const SubmitOpsRequestPB* req,
+      SubmitOpsResponsePB* resp,
+      const rpc::ResponseCallback& callback) {
+    {
+      std::lock_guard<simple_spinlock> l(lock_);
+      requests_[uuid]++;
+      if (uuid == leader_) {
+        batch_sizes_.push_back(req->ops_size());
+        for (const auto& op : req->ops()) {
+          payloads_.push_back(op.payload());
+          OpId* id = resp->add_op_ids();
+          id->set_term(term_);
+          id->set_index(next_index_++);
+        }
+      } else {
+        resp->mutable_error()->set_code(ServerErrorPB::NOT_THE_LEADER);
+        StatusToPB(
+            Status::IllegalState("not the leader"),
+            resp->mutable_error()->mutable_status());
+        resp->set_term(term_);
+        if (hint_ && !leader_.empty()) {
+          resp->mutable_leader()->set_permanent_uuid(leader_);
+          HostPortPB* addr = resp->mutable_leader()->mutable_last_known_addr();
+          addr->set_host(leader_);
+          addr->set_port(1);
+        }
+      }
+      if (hold_) {
+        held_.push_back(callback);
+        return;
+      }
+    }
+    Respond(callback);
+  }
+
+  int requests(const string& uuid) const {
+    std::lock_guard<simple_spinlock> l(lock_);
+    auto it = requests_.find(uuid);
+    return it == requests_.end() ? 0 : it->second;
+  }
+
+  vector<int> batch_sizes() const {
+    std::lock_guard<simple_spinlock> l(lock_);
+    return batch_sizes_;
+  }
+
+  vector<string> payloads() const {
+    std::lock_guard<simple_spinlock> l(lock_);
+    return payloads_;
+  }
+
+ private:
+  // Off the caller's thread, as over RPC.
+  void Respond(const rpc::ResponseCallback& callback) {
+    messenger_->ScheduleOnReactor(
+        [callback](const Status& /* s */) { callback(); },
+        MonoDelta::FromMilliseconds(0));
+  }
+
+  const shared_ptr<rpc::Messenger> messenger_;
+  mutable simple_spinlock lock_;
+  int64_t term_ = 1;
+  string leader_;
+  bool hint_ = true;
+  bool hold_ = false;
+  int64_t next_index_ = 1;
+  vector<rpc::ResponseCallback> held_;
+  map<string, int> requests_;
+  vector<int> batch_sizes_;
+  vector<string> payloads_;
+};
+
+class FakeProxy : public RaftClientProxy {
+ public:
+  FakeProxy(FakeCluster* cluster, string uuid)
+      : cluster_(cluster), uuid_(std::move(uuid)) {}
+
+  void SubmitOpsAsync(
+      const SubmitOpsRequestPB* request,
+      SubmitOpsResponsePB* response,
+      rpc::RpcController* /* controller */,
+      const rpc::ResponseCallback& callback) override {
+    cluster_->Handle(uuid_, request, response, callback);
+  }
+
+ private:
+  FakeCluster* const cluster_;
+  const string uuid_;
+};
+
+class FakeProxyFactory : public RaftClientProxyFactory {
+ public:
+  explicit FakeProxyFactory(FakeCluster* cluster) : cluster_(cluster) {}
+
+  Status NewProxy(const HostPort& hostport, unique_ptr<RaftClientProxy>* proxy)
+      override {
+    proxy->reset(new FakeProxy(cluster_, hostport.host()));
+    return Status::OK();
+  }
+
+ private:
+  FakeCluster* const cluster_;
+};
+
+} // anonymous namespace
+
+class RaftClientTest : public KuduTest {
+ public:
+  void SetUp() override {
+    KuduTest::SetUp();
+    ASSERT_OK(rpc::MessengerBuilder("test").Build(&messenger_));
+    cluster_.reset(new FakeCluster(messenger_));
+    options_.seeds = {HostPort("a", 1), HostPort("b", 1), HostPort("c", 1)};
+    options_.tablet_id = "tablet";
+  }
+
+  void TearDown() override {
+    client_.reset();
+    messenger_->Shutdown();
+    KuduTest::TearDown();
+  }
+
+ protected:
+  void StartClient() {
+    client_.reset(new RaftClient(
+        messenger_,
+        unique_ptr<RaftClientProxyFactory>(
+            new FakeProxyFactory(cluster_.get())),
+        options_,
+        nullptr));
+  }
+
+  // Submits 'num_ops' ops, recording their outcomes in 'statuses' and 'ids'.
+  void SubmitOps(
+      int num_ops,
+      CountDownLatch* latch,
+      vector<Status>* statuses,
+      vector<OpId>* ids) {
+    statuses->resize(num_ops);
+    ids->resize(num_ops);
+    for (int i = 0; i < num_ops; i++) {
+      client_->Submit(
+          Substitute("op $0", i),
+          [i, latch, statuses, ids](const Status& s, const OpId& id) {
+            (*statuses)[i] = s;
+            (*ids)[i] = id;
+            latch->CountDown();
+          });
+    }
+  }
+
+  shared_ptr<rpc::Messenger> messenger_;
+  unique_ptr<FakeCluster> cluster_;
+  RaftClientOptions options_;
+  unique_ptr<RaftClient> client_;
+};
+
+// The client follows the hint of the first seed to the leader, and sticks
+// to it.
+TEST_F(RaftClientTest, TestFindsLeaderThroughHints) {
+  cluster_->SetLeader(2, "c");
+  options_.max_outstanding_batches = 1;
+  StartClient();
+
+  CountDownLatch latch(10);
+  vector<Status> statuses;
+  vector<OpId> ids;
+  SubmitOps(10, &latch, &statuses, &ids);
+  latch.Wait();
+  for (int i = 0; i < 10; i++) {
+    ASSERT_OK(statuses[i]);
+    ASSERT_EQ(2, ids[i].term());
+  }
+  ASSERT_EQ("c", client_->leader_uuid());
+  ASSERT_EQ(1, cluster_->requests("a"));
+  ASSERT_EQ(0, cluster_->requests("b"));
+
+  // The ops are replicated in the order they were submitted.
+  vector<string> payloads = cluster_->payloads();
+  ASSERT_EQ(10, payloads.size());
+  for (int i = 0; i < 10; i++) {
+    ASSERT_EQ(Substitute("op $0", i), payloads[i]);
+    ASSERT_EQ(i + 1, ids[i].index());
+  }
+}
+
+// The ops submitted while the batches allowed are in flight are sent
+// together, up to the batch limits.
+TEST_F(RaftClientTest, TestBatchesWhileOutstanding) {
+  cluster_->SetLeader(1, "a");
+  options_.max_outstanding_batches = 1;
+  options_.max_batch_ops = 20;
+  StartClient();
+  cluster_->Hold();
+
+  CountDownLatch latch(51);
+  vector<Status> statuses;
+  vector<OpId> ids;
+  SubmitOps(51, &latch, &statuses, &ids);
+  ASSERT_EQ(vector<int>({1}), cluster_->batch_sizes());
+  cluster_->Release();
+  latch.Wait();
+  for (const Status& s : statuses) {
+    ASSERT_OK(s);
+  }
+  ASSERT_EQ(vector<int>({1, 20, 20, 10}), cluster_->batch_sizes());
+}
+
+// The leader's successor takes over once the leader points to it.
+TEST_F(RaftClientTest, TestLeaderChange) {
+  cluster_->SetLeader(1, "a");
+  StartClient();
+  {
+    CountDownLatch latch(1);
+    vector<Status> statuses;
+    vector<OpId> ids;
+    SubmitOps(1, &latch, &statuses, &ids);
+    latch.Wait();
+    ASSERT_OK(statuses[0]);
+  }
+  ASSERT_EQ("a", client_->leader_uuid());
+
+  cluster_->SetLeader(3, "b");
+  CountDownLatch latch(5);
+  vector<Status> statuses;
+  vector<OpId> ids;
+  SubmitOps(5, &latch, &statuses, &ids);
+  latch.Wait();
+  for (int i = 0; i < 5; i++) {
+    ASSERT_OK(statuses[i]);
+    ASSERT_EQ(3, ids[i].term());
+  }
+  ASSERT_EQ("b", client_->leader_uuid());
+}
+
+// Without a leader the client keeps trying the seeds, until one is elected
+// or the ops time out.
+TEST_F(RaftClientTest, TestNoLeader) {
+  cluster_->SetLeader(1, "", /*hint=*/false);
+  options_.timeout = MonoDelta::FromMilliseconds(300);
+  options_.retry_delay = MonoDelta::FromMilliseconds(10);
+  StartClient();
+  {
+    CountDownLatch latch(3);
+    vector<Status> statuses;
+    vector<OpId> ids;
+    SubmitOps(3, &latch, &statuses, &ids);
+    latch.Wait();
+    for (const Status& s : statuses) {
+      ASSERT_TRUE(s.IsTimedOut()) << s.ToString();
+    }
+  }
+  ASSERT_GT(cluster_->requests("a"), 1);
+  ASSERT_GT(cluster_->requests("b"), 1);
+  ASSERT_GT(cluster_->requests("c"), 1);
+
+  // An election which elects a replica which doesn't tell the others.
+  cluster_->SetLeader(2, "b", /*hint=*/false);
+  CountDownLatch latch(1);
+  vector<Status> statuses;
+  vector<OpId> ids;
+  SubmitOps(1, &latch, &statuses, &ids);
+  latch.Wait();
+  ASSERT_OK(statuses[0]);
+  ASSERT_EQ(2, ids[0].term());
+}
+
+// Over RPC, the ops sent to replicas which can't be reached time out.
+TEST_F(RaftClientTest, TestUnreachableReplicas) {
+  // A bound socket which does not listen refuses connections.
+  Sockaddr addr;
+  ASSERT_OK(addr.ParseString("127.0.0.1", 0));
+  Socket sock;
+  ASSERT_OK(sock.Init(0));
+  ASSERT_OK(sock.Bind(addr));
+  ASSERT_OK(sock.GetSocketAddress(&addr));
+  options_.seeds = {HostPort(addr)};
+  options_.timeout = MonoDelta::FromMilliseconds(300);
+  options_.retry_delay = MonoDelta::FromMilliseconds(10);
+  client_.reset(new RaftClient(messenger_, nullptr, options_, nullptr));
+
+  CountDownLatch latch(2);
+  vector<Status> statuses;
+  vector<OpId> ids;
+  SubmitOps(2, &latch, &statuses, &ids);
+  latch.Wait();
+  for (const Status& s : statuses) {
+    ASSERT_TRUE(s.IsTimedOut()) << s.ToString();
+  }
+}
+
+// Shutting down fails the ops not sent yet.
+TEST_F(RaftClientTest, TestShutdown) {
+  cluster_->SetLeader(1, "a");
+  options_.max_outstanding_batches = 1;
+  StartClient();
+  cluster_->Hold();
+
+  CountDownLatch latch(3);
+  vector<Status> statuses;
+  vector<OpId> ids;
+  SubmitOps(3, &latch, &statuses, &ids);
+  // Shutdown() waits for the batch in flight.
+  std::thread releaser([this]() {
+    SleepFor(MonoDelta::FromMilliseconds(50));
+    cluster_->Release();
+  });
+  client_->Shutdown();
+  releaser.join();
+  latch.Wait();
+  ASSERT_OK(statuses[0]);
+  ASSERT_TRUE(statuses[1].IsAborted()) << statuses[1].ToString();
+  ASSERT_TRUE(statuses[2].IsAborted()) << statuses[2].ToString();
+
+  CountDownLatch after(1);
+  SubmitOps(1, &after, &statuses, &ids);
+  after.Wait();
+  ASSERT_TRUE(statuses[0].IsAborted()) << statuses[0].ToString();
+}
+
+} // namespace consensus
+} // namespace kudu
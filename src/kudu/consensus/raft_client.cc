@@ -0,0 +1,523 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/raft_client.h"
+
+#include <algorithm>
+#include <ostream>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "kudu/common/wire_protocol.h"
+#include "kudu/consensus/consensus.proxy.h"
+#include "kudu/consensus/metadata.pb.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/rpc/messenger.h"
+#include "kudu/rpc/rpc_controller.h"
+#include "kudu/rpc/rpc_header.pb.h"
+#include "kudu/util/logging.h"
+#include "kudu/util/net/sockaddr.h"
+#include "kudu/util/oid_generator.h"
+#include "kudu/util/pb_util.h"
+
+METRIC_DEFINE_histogram(
+    server,
+    raft_client_submit_latency,
+    "Raft Client Submit Latency",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds from the submission of an op by a Raft client until it was "
+    "replicated, retries included.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    raft_client_batch_size,
+    "Raft Client Batch Size",
+    kudu::MetricUnit::kOperations,
+    "Number of ops in the batches a Raft client sends to the leader.",
+    10000,
+    2);
+METRIC_DEFINE_counter(
+    server,
+    raft_client_leader_redirects,
+    "Raft Client Leader Redirects",
+    kudu::MetricUnit::kRequests,
+    "Number of batches a Raft client resent to the leader a replica pointed "
+    "it to.");
+METRIC_DEFINE_counter(
+    server,
+    raft_client_retries,
+    "Raft Client Retries",
+    kudu::MetricUnit::kRequests,
+    "Number of batches a Raft client resent after a delay, because no "
+    "replica it reached knew the leader or the batch was lost in flight.");
+
+using kudu::pb_util::SecureShortDebugString;
+using kudu::rpc::ErrorStatusPB;
+using kudu::rpc::Messenger;
+using kudu::rpc::RequestIdPB;
+using kudu::rpc::ResponseCallback;
+using kudu::rpc::RpcController;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace consensus {
+
+namespace {
+
+// After this many attempts, a batch is only resent to the leader it was
+// pointed to after a delay, e.g. for replicas with different ideas of the
+// leader during an election.
+const int kMaxImmediateAttempts = 3;
+
+class RpcRaftClientProxy : public RaftClientProxy {
+ public:
+  explicit RpcRaftClientProxy(unique_ptr<ConsensusServiceProxy> proxy)
+      : proxy_(std::move(proxy)) {}
+
+  void SubmitOpsAsync(
+      const SubmitOpsRequestPB* request,
+      SubmitOpsResponsePB* response,
+      RpcController* controller,
+      const ResponseCallback& callback) override {
+    proxy_->SubmitOpsAsync(*request, response, controller, callback);
+  }
+
+ private:
+  const unique_ptr<ConsensusServiceProxy> proxy_;
+};
+
+class RpcRaftClientProxyFactory : public RaftClientProxyFactory {
+ public:
+  explicit RpcRaftClientProxyFactory(shared_ptr<Messenger> messenger)
+      : messenger_(std::move(messenger)) {}
+
+  Status NewProxy(const HostPort& hostport, unique_ptr<RaftClientProxy>* proxy)
+      override {
+    vector<Sockaddr> addrs;
+    RETURN_NOT_OK(hostport.ResolveAddresses(&addrs));
+    if (addrs.size() > 1) {
+      LOG(WARNING) << "Replica address '" << hostport.ToString() << "' "
+                   << "resolves to " << addrs.size()
+                   << " different addresses. Using " << addrs[0].ToString();
+    }
+    proxy->reset(new RpcRaftClientProxy(unique_ptr<ConsensusServiceProxy>(
+        new ConsensusServiceProxy(messenger_, addrs[0], hostport.host()))));
+    return Status::OK();
+  }
+
+ private:
+  const shared_ptr<Messenger> messenger_;
+};
+
+} // anonymous namespace
+
+struct RaftClient::Batch {
+  vector<PendingOp> ops;
+  HostPort target;
+  // Whether 'target' is the leader the client knew of, rather than a seed.
+  bool to_leader = false;
+  // Null if no proxy could be had for 'target'.
+  RaftClientProxy* proxy = nullptr;
+  SubmitOpsRequestPB req;
+  SubmitOpsResponsePB resp;
+  RpcController controller;
+};
+
+RaftClient::RaftClient(
+    shared_ptr<Messenger> messenger,
+    unique_ptr<RaftClientProxyFactory> factory,
+    RaftClientOptions options,
+    const scoped_refptr<MetricEntity>& metric_entity)
+    : messenger_(std::move(messenger)),
+      factory_(std::move(factory)),
+      options_(std::move(options)),
+      client_id_(ObjectIdGenerator().Next()),
+      batches_done_(&lock_) {
+  CHECK(messenger_);
+  CHECK(!options_.seeds.empty());
+  CHECK_GT(options_.max_batch_ops, 0);
+  CHECK_GT(options_.max_outstanding_batches, 0);
+  if (!factory_) {
+    factory_.reset(new RpcRaftClientProxyFactory(messenger_));
+  }
+  if (metric_entity) {
+    submit_latency_ =
+        METRIC_raft_client_submit_latency.Instantiate(metric_entity);
+    batch_size_ = METRIC_raft_client_batch_size.Instantiate(metric_entity);
+    leader_redirects_ =
+        METRIC_raft_client_leader_redirects.Instantiate(metric_entity);
+    retries_ = METRIC_raft_client_retries.Instantiate(metric_entity);
+  }
+}
+
+RaftClient::~RaftClient() {
+  Shutdown();
+}
+
+void RaftClient::Submit(string payload, SubmitCallback callback) {
+  const MonoTime now = MonoTime::Now();
+  bool shutting_down;
+  {
+    MutexLock l(lock_);
+    shutting_down = shutting_down_;
+    if (!shutting_down) {
+      PendingOp op = {std::move(payload),
+                      std::move(callback),
+                      now,
+                      now + options_.timeout,
+                      next_seq_no_++,
+                      0};
+      incomplete_seq_nos_.insert(op.seq_no);
+      pending_.emplace_back(std::move(op));
+    }
+  }
+  if (PREDICT_FALSE(shutting_down)) {
+    callback(Status::Aborted("the Raft client is shutting down"), OpId());
+    return;
+  }
+  MaybeSendBatches(0, 0);
+}
+
+void RaftClient::Shutdown() {
+  vector<PendingOp> aborted;
+  {
+    MutexLock l(lock_);
+    shutting_down_ = true;
+    for (auto& op : pending_) {
+      incomplete_seq_nos_.erase(op.seq_no);
+      aborted.emplace_back(std::move(op));
+    }
+    pending_.clear();
+  }
+  FailOps(&aborted, Status::Aborted("the Raft client is shutting down"));
+
+  MutexLock l(lock_);
+  while (outstanding_batches_ > 0 || delayed_batches_ > 0) {
+    batches_done_.Wait();
+  }
+}
+
+string RaftClient::leader_uuid() const {
+  MutexLock l(lock_);
+  return leader_uuid_;
+}
+
+void RaftClient::FailOps(vector<PendingOp>* ops, const Status& s) {
+  for (auto& op : *ops) {
+    op.callback(s, OpId());
+  }
+  ops->clear();
+}
+
+void RaftClient::MaybeSendBatches(int finished_batches, int finished_delays) {
+  vector<shared_ptr<Batch>> batches;
+  vector<PendingOp> timed_out;
+  vector<PendingOp> aborted;
+  {
+    MutexLock l(lock_);
+    outstanding_batches_ -= finished_batches;
+    delayed_batches_ -= finished_delays;
+    DCHECK_GE(outstanding_batches_, 0);
+    DCHECK_GE(delayed_batches_, 0);
+    if (shutting_down_) {
+      for (auto& op : pending_) {
+        incomplete_seq_nos_.erase(op.seq_no);
+        aborted.emplace_back(std::move(op));
+      }
+      pending_.clear();
+    }
+    while (outstanding_batches_ < options_.max_outstanding_batches) {
+      shared_ptr<Batch> batch = NextBatchUnlocked(&timed_out);
+      if (!batch) {
+        break;
+      }
+      outstanding_batches_++;
+      batches.emplace_back(std::move(batch));
+    }
+    if (outstanding_batches_ == 0 && delayed_batches_ == 0) {
+      batches_done_.Broadcast();
+    }
+  }
+  // Shutdown() may return from now on if no batch is left, so that only the
+  // batches sent, which hold it back, may touch the client.
+  FailOps(&timed_out, Status::TimedOut("timed out replicating the op"));
+  FailOps(&aborted, Status::Aborted("the Raft client is shutting down"));
+  for (const auto& batch : batches) {
+    SendBatch(batch);
+  }
+}
+
+shared_ptr<RaftClient::Batch> RaftClient::NextBatchUnlocked(
+    vector<PendingOp>* failed) {
+  lock_.AssertAcquired();
+  const MonoTime now = MonoTime::Now();
+  shared_ptr<Batch> batch;
+  int64_t bytes = 0;
+  MonoTime deadline = MonoTime::Max();
+  const size_t max_ops = options_.max_batch_ops;
+  while (!pending_.empty() && (!batch || batch->ops.size() < max_ops)) {
+    PendingOp& op = pending_.front();
+    if (op.deadline < now) {
+      incomplete_seq_nos_.erase(op.seq_no);
+      failed->emplace_back(std::move(op));
+      pending_.pop_front();
+      continue;
+    }
+    if (!batch) {
+      batch = std::make_shared<Batch>();
+      batch->to_leader = !leader_uuid_.empty();
+      batch->target = batch->to_leader
+          ? leader_hostport_
+          : options_.seeds[next_seed_ % options_.seeds.size()];
+      Status s = GetProxyUnlocked(batch->target, &batch->proxy);
+      if (PREDICT_FALSE(!s.ok())) {
+        KLOG_EVERY_N_SECS(WARNING, 1)
+            << "Could not get a proxy for " << batch->target.ToString()
+            << ": " << s.ToString() << THROTTLE_MSG;
+      }
+      batch->req.set_tablet_id(options_.tablet_id);
+      if (batch->to_leader) {
+        batch->req.set_dest_uuid(leader_uuid_);
+      }
+    } else if (bytes + static_cast<int64_t>(op.payload.size()) >
+               options_.max_batch_bytes) {
+      break;
+    }
+    bytes += op.payload.size();
+    deadline = std::min(deadline, op.deadline);
+    op.attempts++;
+    SubmitOpPB* op_pb = batch->req.add_ops();
+    // Taken back from the request should the batch be resent.
+    op_pb->set_payload(std::move(op.payload));
+    RequestIdPB* request_id = op_pb->mutable_request_id();
+    request_id->set_client_id(client_id_);
+    request_id->set_seq_no(op.seq_no);
+    request_id->set_first_incomplete_seq_no(*incomplete_seq_nos_.begin());
+    request_id->set_attempt_no(op.attempts);
+    batch->ops.emplace_back(std::move(op));
+    pending_.pop_front();
+  }
+  if (batch) {
+    batch->controller.set_deadline(deadline);
+  }
+  return batch;
+}
+
+void RaftClient::SendBatch(const shared_ptr<Batch>& batch) {
+  if (batch_size_) {
+    batch_size_->Increment(batch->ops.size());
+  }
+  if (PREDICT_FALSE(!batch->proxy)) {
+    BatchDone(batch);
+    return;
+  }
+  batch->proxy->SubmitOpsAsync(
+      &batch->req, &batch->resp, &batch->controller, [this, batch]() {
+        BatchDone(batch);
+      });
+}
+
+void RaftClient::BatchDone(const shared_ptr<Batch>& batch) {
+  // How the batch went: replicated, failed for good, or to resend, right
+  // away or after a delay.
+  enum { kReplicated, kFailed, kRedirect, kRetryLater } outcome;
+  Status s;
+  if (PREDICT_FALSE(!batch->proxy)) {
+    outcome = kRetryLater;
+    s = Status::NetworkError("no proxy", batch->target.ToString());
+  } else if (PREDICT_FALSE(!batch->controller.status().ok())) {
+    s = batch->controller.status();
+    const ErrorStatusPB* err = batch->controller.error_response();
+    outcome = !err || err->code() == ErrorStatusPB::ERROR_SERVER_TOO_BUSY
+        ? kRetryLater
+        : kFailed;
+  } else if (PREDICT_FALSE(batch->resp.has_error())) {
+    s = StatusFromPB(batch->resp.error().status());
+    switch (batch->resp.error().code()) {
+      case ServerErrorPB::NOT_THE_LEADER:
+        outcome = kRedirect;
+        break;
+      case ServerErrorPB::TABLET_NOT_FOUND:
+      case ServerErrorPB::WRONG_SERVER_UUID:
+      case ServerErrorPB::CONSENSUS_NOT_RUNNING:
+      case ServerErrorPB::SERVICE_UNAVAILABLE:
+        outcome = kRetryLater;
+        break;
+      default:
+        outcome = kFailed;
+        break;
+    }
+  } else if (PREDICT_FALSE(
+                 batch->resp.op_ids_size() !=
+                 static_cast<int>(batch->ops.size()))) {
+    outcome = kFailed;
+    s = Status::Corruption(Substitute(
+        "$0 OpIds for a batch of $1 ops",
+        batch->resp.op_ids_size(),
+        batch->ops.size()));
+  } else {
+    outcome = kReplicated;
+  }
+
+  {
+    MutexLock l(lock_);
+    if (outcome == kRedirect) {
+      const string target_uuid =
+          batch->to_leader ? batch->req.dest_uuid() : string();
+      UpdateLeaderUnlocked(
+          batch->resp.has_term() ? batch->resp.term() : -1,
+          batch->resp.leader());
+      if (leader_uuid_.empty() || leader_uuid_ == target_uuid) {
+        ForgetTargetUnlocked(batch->target.ToString());
+        outcome = kRetryLater;
+      } else if (batch->ops[0].attempts >= kMaxImmediateAttempts) {
+        outcome = kRetryLater;
+      }
+    } else if (outcome == kRetryLater) {
+      ForgetTargetUnlocked(batch->target.ToString());
+    }
+    if (outcome == kReplicated || outcome == kFailed) {
+      for (const auto& op : batch->ops) {
+        incomplete_seq_nos_.erase(op.seq_no);
+      }
+    } else if (outcome == kRedirect) {
+      RequeueUnlocked(batch);
+    } else {
+      delayed_batches_++;
+    }
+  }
+
+  switch (outcome) {
+    case kReplicated: {
+      const MonoTime now = MonoTime::Now();
+      for (size_t i = 0; i < batch->ops.size(); i++) {
+        PendingOp& op = batch->ops[i];
+        if (submit_latency_) {
+          submit_latency_->Increment((now - op.submitted).ToMicroseconds());
+        }
+        op.callback(Status::OK(), batch->resp.op_ids(static_cast<int>(i)));
+      }
+      break;
+    }
+    case kFailed: {
+      KLOG_EVERY_N_SECS(WARNING, 1)
+          << "Could not replicate a batch of " << batch->ops.size()
+          << " ops through " << batch->target.ToString() << ": "
+          << s.ToString() << THROTTLE_MSG;
+      FailOps(&batch->ops, s);
+      break;
+    }
+    case kRedirect:
+      if (leader_redirects_) {
+        leader_redirects_->Increment();
+      }
+      VLOG(1) << "Resending a batch of " << batch->req.ops_size()
+              << " ops to the leader: " << s.ToString();
+      break;
+    case kRetryLater: {
+      if (retries_) {
+        retries_->Increment();
+      }
+      VLOG(1) << "Resending a batch of " << batch->ops.size() << " ops in "
+              << options_.retry_delay.ToString() << ": " << s.ToString();
+      shared_ptr<Batch> delayed = batch;
+      messenger_->ScheduleOnReactor(
+          [this, delayed](const Status& /* s */) {
+            {
+              MutexLock l(lock_);
+              RequeueUnlocked(delayed);
+            }
+            MaybeSendBatches(0, 1);
+          },
+          options_.retry_delay);
+      break;
+    }
+  }
+  MaybeSendBatches(1, 0);
+}
+
+void RaftClient::RequeueUnlocked(const shared_ptr<Batch>& batch) {
+  lock_.AssertAcquired();
+  for (int i = static_cast<int>(batch->ops.size()) - 1; i >= 0; i--) {
+    PendingOp& op = batch->ops[i];
+    op.payload = std::move(*batch->req.mutable_ops(i)->mutable_payload());
+    pending_.emplace_front(std::move(op));
+  }
+  batch->ops.clear();
+}
+
+void RaftClient::UpdateLeaderUnlocked(int64_t term, const RaftPeerPB& leader) {
+  lock_.AssertAcquired();
+  if (term < leader_term_) {
+    // Stale: the replica hasn't heard of the latest election yet.
+    return;
+  }
+  HostPort hostport;
+  const bool known = leader.has_permanent_uuid() &&
+      leader.has_last_known_addr() &&
+      HostPortFromPB(leader.last_known_addr(), &hostport).ok();
+  if (term == leader_term_ && !known) {
+    return;
+  }
+  leader_term_ = term;
+  if (known) {
+    if (leader.permanent_uuid() != leader_uuid_) {
+      VLOG(1) << "Leader of " << options_.tablet_id << " in term " << term
+              << ": " << SecureShortDebugString(leader);
+    }
+    leader_uuid_ = leader.permanent_uuid();
+    leader_hostport_ = hostport;
+  } else {
+    leader_uuid_.clear();
+  }
+}
+
+void RaftClient::ForgetTargetUnlocked(const string& target) {
+  lock_.AssertAcquired();
+  if (!leader_uuid_.empty() && leader_hostport_.ToString() == target) {
+    leader_uuid_.clear();
+    return;
+  }
+  if (options_.seeds[next_seed_ % options_.seeds.size()].ToString() ==
+      target) {
+    next_seed_++;
+  }
+}
+
+Status RaftClient::GetProxyUnlocked(
+    const HostPort& hostport,
+    RaftClientProxy** proxy) {
+  lock_.AssertAcquired();
+  const string key = hostport.ToString();
+  auto it = proxies_.find(key);
+  if (it == proxies_.end()) {
+    unique_ptr<RaftClientProxy> new_proxy;
+    RETURN_NOT_OK(factory_->NewProxy(hostport, &new_proxy));
+    it = proxies_.emplace(key, std::move(new_proxy)).first;
+  }
+  *proxy = it->second.get();
+  return Status::OK();
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,220 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/opid.pb.h"
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/rpc/response_callback.h"
+#include "kudu/util/condition_variable.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/mutex.h"
+#include "kudu/util/net/net_util.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+namespace rpc {
+class Messenger;
+class RpcController;
+} // namespace rpc
+
+namespace consensus {
+
+// Sends SubmitOps requests to a replica.
+class RaftClientProxy {
+ public:
+  virtual ~RaftClientProxy() {}
+
+  virtual void SubmitOpsAsync(
+      const SubmitOpsRequestPB* request,
+      SubmitOpsResponsePB* response,
+      rpc::RpcController* controller,
+      const rpc::ResponseCallback& callback) = 0;
+};
+
+// Creates the proxies of a RaftClient, over RPC by default.
+class RaftClientProxyFactory {
+ public:
+  virtual ~RaftClientProxyFactory() {}
+
+  virtual Status NewProxy(
+      const HostPort& hostport,
+      std::unique_ptr<RaftClientProxy>* proxy) = 0;
+};
+
+struct RaftClientOptions {
+  // Where to look for the leader: the addresses of some of the replicas.
+  std::vector<HostPort> seeds;
+
+  std::string tablet_id;
+
+  // The ops submitted while 'max_outstanding_batches' are in flight are
+  // batched into a single request, up to these limits.
+  int max_batch_ops = 256;
+  int64_t max_batch_bytes = 1024 * 1024;
+  int max_outstanding_batches = 4;
+
+  // How long an op may take, from Submit() until it is replicated, retries
+  // included.
+  MonoDelta timeout = MonoDelta::FromSeconds(10);
+
+  // How long to wait before retrying once the leader is unknown, e.g. during
+  // an election.
+  MonoDelta retry_delay = MonoDelta::FromMilliseconds(50);
+};
+
+// Submits ops to the leader of a Raft group, as WRITE_OP_EXT ops carrying
+// the payloads given, and reports their OpIds once replicated.
+//
+// The client sends its requests to the leader it last heard of, which the
+// replicas' NOT_THE_LEADER errors point it to, a newer term prevailing over
+// an older one. Without a leader it tries the seeds in turn. The ops
+// submitted while all the batches allowed are in flight make up the next
+// batch, so that the batches grow with the load and an op on an idle
+// client is sent right away.
+//
+// A batch the leader rejected up front is resent to the new leader. One lost
+// in flight, e.g. when the connection broke, is resent too, with the same
+// request ids (see SubmitOpPB): its ops may be replicated twice. Any other
+// failure fails the ops of the batch. The ops of different batches may be
+// replicated out of order.
+//
+// This class is thread-safe.
+class RaftClient {
+ public:
+  // Called with the OpId of the op once replicated, or with the reason it
+  // wasn't.
+  typedef std::function<void(const Status& s, const OpId& id)> SubmitCallback;
+
+  // 'factory' may be null for proxies over 'messenger', which runs the
+  // retries. 'metric_entity' may be null.
+  RaftClient(
+      std::shared_ptr<rpc::Messenger> messenger,
+      std::unique_ptr<RaftClientProxyFactory> factory,
+      RaftClientOptions options,
+      const scoped_refptr<MetricEntity>& metric_entity);
+  ~RaftClient();
+
+  // Replicates 'payload'. 'callback' runs on a reactor thread, or on this
+  // one if the op fails right away.
+  void Submit(std::string payload, SubmitCallback callback);
+
+  // Fails the ops waiting to be sent and waits for the batches in flight.
+  // Called by the destructor.
+  void Shutdown();
+
+  // The uuid of the leader as far as the client knows, empty if none.
+  std::string leader_uuid() const;
+
+  // The unique id of the client, the 'client_id' of its request ids.
+  const std::string& client_id() const {
+    return client_id_;
+  }
+
+ private:
+  struct PendingOp {
+    std::string payload;
+    SubmitCallback callback;
+    MonoTime submitted;
+    MonoTime deadline;
+    int64_t seq_no;
+    int attempts;
+  };
+
+  struct Batch;
+
+  // Releases 'finished_batches' of the batches in flight and
+  // 'finished_delays' of those waiting to be retried, then sends as many
+  // batches as allowed from 'pending_'. Fails the ops which timed out, or all
+  // of them once shutting down.
+  void MaybeSendBatches(int finished_batches, int finished_delays);
+
+  // Takes the next batch off 'pending_', null if there is none to send.
+  // Moves the ops which timed out to 'failed'.
+  std::shared_ptr<Batch> NextBatchUnlocked(std::vector<PendingOp>* failed);
+
+  void SendBatch(const std::shared_ptr<Batch>& batch);
+  void BatchDone(const std::shared_ptr<Batch>& batch);
+
+  // Puts the ops of 'batch' back in front of 'pending_', to be resent.
+  void RequeueUnlocked(const std::shared_ptr<Batch>& batch);
+
+  // Runs the callbacks of 'ops', which failed with 's'.
+  static void FailOps(std::vector<PendingOp>* ops, const Status& s);
+
+  // Records a leader hint from a replica in term 'term', an empty
+  // 'leader' for none.
+  void UpdateLeaderUnlocked(int64_t term, const RaftPeerPB& leader);
+
+  // Moves on from the current target, which failed us.
+  void ForgetTargetUnlocked(const std::string& target);
+
+  // The proxy for 'hostport', created on first use.
+  Status GetProxyUnlocked(const HostPort& hostport, RaftClientProxy** proxy);
+
+  const std::shared_ptr<rpc::Messenger> messenger_;
+  std::unique_ptr<RaftClientProxyFactory> factory_;
+  const RaftClientOptions options_;
+  const std::string client_id_;
+
+  mutable Mutex lock_;
+  // Signaled when the last batch in flight, or waiting to be retried, is
+  // done with.
+  ConditionVariable batches_done_;
+
+  // The ops not sent yet, or to resend, in submission order.
+  std::deque<PendingOp> pending_;
+  int64_t next_seq_no_ = 1;
+  // The sequence numbers of the ops not replicated or failed yet.
+  std::set<int64_t> incomplete_seq_nos_;
+  int outstanding_batches_ = 0;
+  // Batches which wait to be retried.
+  int delayed_batches_ = 0;
+  bool shutting_down_ = false;
+
+  // The leader and the highest term heard from the replicas.
+  int64_t leader_term_ = -1;
+  std::string leader_uuid_;
+  HostPort leader_hostport_;
+  // The seed to try next when the leader is unknown.
+  size_t next_seed_ = 0;
+
+  std::map<std::string, std::unique_ptr<RaftClientProxy>> proxies_;
+
+  scoped_refptr<Histogram> submit_latency_;
+  scoped_refptr<Histogram> batch_size_;
+  scoped_refptr<Counter> leader_redirects_;
+  scoped_refptr<Counter> retries_;
+
+  DISALLOW_COPY_AND_ASSIGN(RaftClient);
+};
+
+} // namespace consensus
+} // namespace kudu
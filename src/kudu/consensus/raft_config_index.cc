@@ -0,0 +1,84 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/raft_config_index.h"
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+#include "kudu/consensus/quorum_util.h"
+#include "kudu/gutil/map-util.h"
+
+namespace kudu {
+namespace consensus {
+
+RaftConfigIndex::RaftConfigIndex(const RaftConfigPB& config)
+    : config_(config), num_voters_(0) {
+  const bool use_quorum_id = IsUseQuorumId(config.commit_rule());
+  members_.reserve(config.peers_size());
+  for (const RaftPeerPB& peer : config.peers()) {
+    members_.emplace(peer.permanent_uuid(), &peer);
+    if (!peer.has_member_type() || peer.member_type() != RaftPeerPB::VOTER) {
+      continue;
+    }
+    ++num_voters_;
+    // Unlike GetQuorumId(), a voter without a region or quorum id counts in
+    // the empty quorum, as configs outside of FlexiRaft are indexed too.
+    const std::string& quorum_id =
+        use_quorum_id ? peer.attrs().quorum_id() : peer.attrs().region();
+    ++LookupOrInsert(&voter_counts_, quorum_id, 0);
+    if (!peer.has_attrs() || !peer.attrs().has_backing_db_present() ||
+        peer.attrs().backing_db_present()) {
+      ++LookupOrInsert(&backed_by_db_voter_counts_, quorum_id, 0);
+    }
+    voter_priorities_.push_back(peer.attrs().election_priority());
+  }
+  std::sort(
+      voter_priorities_.begin(),
+      voter_priorities_.end(),
+      std::greater<int32_t>());
+  voter_priorities_.erase(
+      std::unique(voter_priorities_.begin(), voter_priorities_.end()),
+      voter_priorities_.end());
+}
+
+const RaftPeerPB* RaftConfigIndex::FindMember(const std::string& uuid) const {
+  return FindWithDefault(members_, uuid, nullptr);
+}
+
+bool RaftConfigIndex::IsVoter(const std::string& uuid) const {
+  const RaftPeerPB* peer = FindMember(uuid);
+  return peer != nullptr && peer->member_type() == RaftPeerPB::VOTER;
+}
+
+int32_t RaftConfigIndex::ElectionPriority(const std::string& uuid) const {
+  const RaftPeerPB* peer = FindMember(uuid);
+  return peer == nullptr ? 0 : peer->attrs().election_priority();
+}
+
+int RaftConfigIndex::ElectionPriorityRank(int32_t priority) const {
+  return std::lower_bound(
+             voter_priorities_.begin(),
+             voter_priorities_.end(),
+             priority,
+             std::greater<int32_t>()) -
+      voter_priorities_.begin();
+}
+
+} // namespace consensus
+} // namespace kudu
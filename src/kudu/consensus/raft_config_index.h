@@ -0,0 +1,94 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "kudu/consensus/metadata.pb.h"
+
+namespace kudu {
+namespace consensus {
+
+// An index of a RaftConfigPB: its members by uuid, and the number of its
+// voters by role and by quorum, so that the lookups made when validating
+// config and voter distribution changes don't scan or copy the config. The
+// quorum of a voter is its region, or its quorum id if the commit rule of the
+// config uses QUORUM_ID, see GetQuorumId(). The election priorities of the
+// voters are ranked, for priority elections.
+//
+// The index points into the config it was built from, which must outlive it
+// and not change. Not thread-safe.
+class RaftConfigIndex {
+ public:
+  explicit RaftConfigIndex(const RaftConfigPB& config);
+
+  const RaftConfigPB& config() const {
+    return config_;
+  }
+
+  // The member with 'uuid', or nullptr if there is none.
+  const RaftPeerPB* FindMember(const std::string& uuid) const;
+
+  bool IsMember(const std::string& uuid) const {
+    return FindMember(uuid) != nullptr;
+  }
+  bool IsVoter(const std::string& uuid) const;
+
+  int num_members() const {
+    return config_.peers_size();
+  }
+  int num_voters() const {
+    return num_voters_;
+  }
+
+  // The number of voters in each quorum, as GetActualVoterCountsFromConfig()
+  // counts them. With 'backed_by_db_only', the voters known to have no
+  // backing database are left out.
+  const std::map<std::string, int>& VoterCountsByQuorum(
+      bool backed_by_db_only = false) const {
+    return backed_by_db_only ? backed_by_db_voter_counts_ : voter_counts_;
+  }
+
+  // The election priority of the member with 'uuid', or 0 if there is none.
+  int32_t ElectionPriority(const std::string& uuid) const;
+
+  // How many of the distinct election priorities of the voters are higher
+  // than 'priority': 0 for the highest.
+  int ElectionPriorityRank(int32_t priority) const;
+
+  // The number of distinct election priorities of the voters.
+  int num_election_priorities() const {
+    return voter_priorities_.size();
+  }
+
+ private:
+  const RaftConfigPB& config_;
+  std::unordered_map<std::string, const RaftPeerPB*> members_;
+  int num_voters_;
+  std::map<std::string, int> voter_counts_;
+  std::map<std::string, int> backed_by_db_voter_counts_;
+  // Distinct, highest first.
+  std::vector<int32_t> voter_priorities_;
+};
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,1010 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// In-process Raft replication benchmark. Builds a quorum of RaftConsensus
+// instances wired together through local proxies that emulate the delay,
+// jitter, bandwidth and loss of each link (see rpc/link_emulation.h), and
+//  - drives Replicate() on the leader and reports throughput, commit
+//    latency percentiles, CPU per op and bytes exchanged between peers;
+//  - kills the leader and reports how long the quorum takes to elect a new
+//    one and commit through it;
+//  - replays a workload captured with --consensus_workload_capture_dir, or
+//    the ops of a replica's WAL, against the quorum and reports the same as
+//    the first.
+//
+// Example, 5 voters over 3 regions 20ms apart with 2ms of jitter:
+//   raft_consensus-bench --raft_bench_num_voters=5 \
+//       --raft_bench_num_regions=3 --raft_bench_cross_region_link=10/2 \
+//       --raft_bench_concurrency=32
+
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "kudu/clock/clock.h"
+#include "kudu/clock/hybrid_clock.h"
+#include "kudu/clock/logical_clock.h"
+#include "kudu/common/common.pb.h"
+#include "kudu/common/timestamp.h"
+#include "kudu/consensus/consensus-test-util.h"
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/consensus_meta_manager.h"
+#include "kudu/consensus/log.h"
+#include "kudu/consensus/metadata.pb.h"
+#include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/persistent_vars_manager.h"
+#include "kudu/consensus/raft_consensus.h"
+#include "kudu/consensus/time_manager.h"
+#include "kudu/consensus/workload_capture.h"
+#include "kudu/fs/fs_manager.h"
+#include "kudu/gutil/bind.h"
+#include "kudu/gutil/gscoped_ptr.h"
+#include "kudu/gutil/map-util.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/stl_util.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/walltime.h"
+#include "kudu/rpc/link_emulation.h"
+#include "kudu/util/async_util.h"
+#include "kudu/util/hdr_histogram.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/mem_tracker.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/random.h"
+#include "kudu/util/random_util.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+#include "kudu/util/threadpool.h"
+
+DEFINE_int32(
+    raft_bench_num_voters,
+    3,
+    "Number of voters in the benchmarked quorum.");
+DEFINE_int32(
+    raft_bench_num_regions,
+    0,
+    "If positive, run the quorum in FlexiRaft single region dynamic mode "
+    "with the voters spread round-robin over this many regions. The leader "
+    "is placed in the first region.");
+DEFINE_string(
+    raft_bench_link,
+    "0",
+    "One-way link between two peers in the same region, or between any two "
+    "peers when regions are not in use, as "
+    "delay_ms[/jitter_ms[/bandwidth_kbps[/loss_pct]]].");
+DEFINE_string(
+    raft_bench_cross_region_link,
+    "0",
+    "One-way link between two peers in different regions, in the format of "
+    "--raft_bench_link.");
+DEFINE_int32(
+    raft_bench_ops_per_sec,
+    0,
+    "Target rate of operations submitted to the leader across all client "
+    "threads. 0 means as fast as the quorum commits them.");
+DEFINE_int32(
+    raft_bench_payload_bytes,
+    1024,
+    "Size of the payload carried by each replicated operation.");
+DEFINE_int32(
+    raft_bench_concurrency,
+    16,
+    "Number of client threads, each with one outstanding operation.");
+DEFINE_int32(
+    raft_bench_runtime_secs,
+    5,
+    "Duration of the measured part of the benchmark.");
+DEFINE_int32(
+    raft_bench_failovers,
+    5,
+    "Number of times the failover benchmark fails the leader.");
+DEFINE_int32(
+    raft_bench_failover_timeout_secs,
+    60,
+    "How long the failover benchmark waits for a new leader to commit. In "
+    "FlexiRaft mode a new leader can only be elected if the old leader's "
+    "region keeps a majority of its voters.");
+DEFINE_string(
+    raft_bench_replay_pattern,
+    "",
+    "Glob pattern of the workload capture files replayed by the replay "
+    "benchmark, see --consensus_workload_capture_dir. The ops the leader "
+    "replicated are replayed with the same payload sizes, batching and "
+    "inter-arrival times. If empty, --raft_bench_runtime_secs of ops of "
+    "around --raft_bench_payload_bytes arriving at random at "
+    "--raft_bench_ops_per_sec, or 1000 per second, are captured first.");
+DEFINE_double(
+    raft_bench_replay_speedup,
+    1.0,
+    "How many times faster than they were captured the replay benchmark "
+    "submits the ops.");
+DEFINE_string(
+    raft_bench_replay_wal_dir,
+    "",
+    "WAL directory of a replica whose ops the WAL replay benchmark replays, "
+    "with the same payload sizes and the inter-arrival times of their "
+    "timestamps. If empty, a WAL of --raft_bench_runtime_secs of ops of "
+    "around --raft_bench_payload_bytes arriving at random at "
+    "--raft_bench_ops_per_sec, or 1000 per second, is written first.");
+
+DECLARE_string(consensus_workload_capture_dir);
+
+DECLARE_bool(enable_flexi_raft);
+DECLARE_bool(enable_leader_failure_detection);
+DECLARE_double(leader_failure_max_missed_heartbeat_periods);
+DECLARE_int32(raft_heartbeat_interval_ms);
+
+METRIC_DECLARE_histogram(raft_failover_detection_duration);
+METRIC_DECLARE_histogram(raft_failover_pre_election_duration);
+METRIC_DECLARE_histogram(raft_failover_election_duration);
+METRIC_DECLARE_histogram(raft_failover_noop_commit_duration);
+METRIC_DECLARE_histogram(raft_failover_first_commit_duration);
+METRIC_DECLARE_histogram(raft_failover_duration);
+
+using kudu::log::Log;
+using kudu::log::LogOptions;
+using kudu::rpc::EmulatedLink;
+using kudu::rpc::LinkEmulator;
+using std::shared_ptr;
+using std::string;
+using std::thread;
+using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace consensus {
+
+namespace {
+
+const char* kBenchTablet = "BenchTablet";
+
+// Commit latencies above this are clamped, in microseconds.
+constexpr uint64_t kMaxLatencyUs = 60 * 1000 * 1000;
+
+void DoNothing(const string& /*s*/) {}
+
+int64_t CpuTimeMicros() {
+  struct rusage ru;
+  CHECK_EQ(0, getrusage(RUSAGE_SELF, &ru));
+  return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000L +
+      ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+// Bytes carried by UpdateConsensus calls, summed over all links.
+struct WireStats {
+  std::atomic<int64_t> request_bytes{0};
+  std::atomic<int64_t> response_bytes{0};
+  std::atomic<int64_t> requests{0};
+};
+
+// The peers cut off from all the others.
+class Partition {
+ public:
+  void Isolate(const string& uuid) {
+    std::lock_guard<simple_spinlock> l(lock_);
+    isolated_.insert(uuid);
+  }
+
+  void Heal() {
+    std::lock_guard<simple_spinlock> l(lock_);
+    isolated_.clear();
+  }
+
+  bool IsCut(const string& from_uuid, const string& to_uuid) const {
+    std::lock_guard<simple_spinlock> l(lock_);
+    return ContainsKey(isolated_, from_uuid) || ContainsKey(isolated_, to_uuid);
+  }
+
+ private:
+  mutable simple_spinlock lock_;
+  std::unordered_set<string> isolated_;
+};
+
+// A LocalTestPeerProxy that delivers requests and responses over an
+// emulated link, fails them while the link is cut by a Partition, and
+// accounts for the serialized size of UpdateConsensus requests and
+// responses.
+class EmulatedLinkPeerProxy : public LocalTestPeerProxy {
+ public:
+  EmulatedLinkPeerProxy(
+      string local_uuid,
+      string peer_uuid,
+      ThreadPool* pool,
+      TestPeerMapManager* peers,
+      const EmulatedLink& link,
+      Partition* partition,
+      WireStats* stats)
+      : LocalTestPeerProxy(std::move(peer_uuid), pool, peers),
+        local_uuid_(std::move(local_uuid)),
+        link_(link),
+        outbound_(SeedRandom()),
+        inbound_(SeedRandom()),
+        partition_(partition),
+        stats_(stats) {}
+
+  void UpdateAsync(
+      const ConsensusRequestPB* request,
+      ConsensusResponsePB* response,
+      rpc::RpcController* /*controller*/,
+      const rpc::ResponseCallback& callback) override {
+    size_t bytes = request->ByteSizeLong();
+    stats_->requests++;
+    stats_->request_bytes += bytes;
+    RegisterCallback(kUpdate, [this, response, callback]() {
+      size_t bytes = response->ByteSizeLong();
+      stats_->response_bytes += bytes;
+      Deliver(&inbound_, bytes);
+      callback();
+    });
+    CHECK_OK(pool_->SubmitFunc([this, bytes, request, response]() {
+      Deliver(&outbound_, bytes);
+      if (IsCut()) {
+        SetResponseError(Status::NetworkError("partitioned"), response);
+        Respond(kUpdate);
+        return;
+      }
+      // The emulated links drop nothing for being late.
+      SendUpdateRequest(request, response, MonoTime::Max());
+    }));
+  }
+
+  void RequestConsensusVoteAsync(
+      const VoteRequestPB* request,
+      VoteResponsePB* response,
+      rpc::RpcController* /*controller*/,
+      const rpc::ResponseCallback& callback) override {
+    RegisterCallback(kRequestVote, [this, response, callback]() {
+      Deliver(&inbound_, response->ByteSizeLong());
+      callback();
+    });
+    size_t bytes = request->ByteSizeLong();
+    CHECK_OK(pool_->SubmitFunc([this, bytes, request, response]() {
+      Deliver(&outbound_, bytes);
+      if (IsCut()) {
+        SetResponseError(Status::NetworkError("partitioned"), response);
+        Respond(kRequestVote);
+        return;
+      }
+      SendVoteRequest(request, response);
+    }));
+  }
+
+ private:
+  // Blocks until a message of 'bytes' sent now over 'emulator' arrives.
+  void Deliver(LinkEmulator* emulator, size_t bytes) {
+    if (link_.IsNoop()) {
+      return;
+    }
+    MonoTime now = MonoTime::Now();
+    MonoTime arrival;
+    {
+      std::lock_guard<simple_spinlock> l(link_lock_);
+      arrival = emulator->Schedule(link_, bytes, now);
+    }
+    if (now < arrival) {
+      SleepFor(arrival - now);
+    }
+  }
+
+  bool IsCut() const {
+    return partition_->IsCut(local_uuid_, GetTarget());
+  }
+
+  const string local_uuid_;
+  const EmulatedLink link_;
+
+  // Protects the emulators below.
+  simple_spinlock link_lock_;
+
+  // The emulated link to the remote peer and the one back from it.
+  LinkEmulator outbound_;
+  LinkEmulator inbound_;
+
+  Partition* const partition_;
+  WireStats* const stats_;
+};
+
+class EmulatedLinkPeerProxyFactory : public PeerProxyFactory {
+ public:
+  EmulatedLinkPeerProxyFactory(
+      TestPeerMapManager* peers,
+      const RaftPeerPB& local_peer_pb,
+      Partition* partition,
+      WireStats* stats)
+      : peers_(peers),
+        local_peer_pb_(local_peer_pb),
+        partition_(partition),
+        stats_(stats) {
+    // Every remote peer may have a request, a vote and a response parked
+    // in the link at any time, so size the pool to never queue one link
+    // behind another.
+    CHECK_OK(ThreadPoolBuilder("bench-peer-pool")
+                 .set_max_threads(4 * FLAGS_raft_bench_num_voters)
+                 .Build(&pool_));
+    CHECK_OK(rpc::MessengerBuilder("bench").Build(&messenger_));
+  }
+
+  Status NewProxy(const RaftPeerPB& peer_pb, shared_ptr<PeerProxy>* proxy)
+      override {
+    bool same_region =
+        local_peer_pb_.attrs().region() == peer_pb.attrs().region();
+    EmulatedLink link;
+    RETURN_NOT_OK(ParseEmulatedLink(
+        same_region ? FLAGS_raft_bench_link
+                    : FLAGS_raft_bench_cross_region_link,
+        &link));
+    proxy->reset(new EmulatedLinkPeerProxy(
+        local_peer_pb_.permanent_uuid(),
+        peer_pb.permanent_uuid(),
+        pool_.get(),
+        peers_,
+        link,
+        partition_,
+        stats_));
+    return Status::OK();
+  }
+
+  const shared_ptr<rpc::Messenger>& messenger() const override {
+    return messenger_;
+  }
+
+ private:
+  gscoped_ptr<ThreadPool> pool_;
+  shared_ptr<rpc::Messenger> messenger_;
+  TestPeerMapManager* const peers_;
+  const RaftPeerPB local_peer_pb_;
+  Partition* const partition_;
+  WireStats* const stats_;
+};
+
+} // anonymous namespace
+
+class RaftConsensusBench : public KuduTest {
+ public:
+  RaftConsensusBench()
+      : clock_(clock::LogicalClock::CreateStartingAt(Timestamp(1))),
+        metric_entity_(
+            METRIC_ENTITY_server.Instantiate(&metric_registry_, "raft-bench")),
+        latency_hist_(kMaxLatencyUs, 3) {
+    options_.tablet_id = kBenchTablet;
+    FLAGS_enable_leader_failure_detection = false;
+    CHECK_OK(ThreadPoolBuilder("raft").Build(&raft_pool_));
+  }
+
+  ~RaftConsensusBench() {
+    leader_.reset();
+    if (peers_) {
+      peers_->Clear();
+    }
+    STLDeleteElements(&txn_factories_);
+    logs_.clear();
+    STLDeleteElements(&fs_managers_);
+  }
+
+ protected:
+  Status BuildFsManagersAndLogs(int num) {
+    for (int i = 0; i < num; i++) {
+      shared_ptr<MemTracker> parent_mem_tracker =
+          MemTracker::CreateTracker(-1, Substitute("peer-$0", i));
+      parent_mem_trackers_.push_back(parent_mem_tracker);
+      string test_path = GetTestPath(Substitute("peer-$0-root", i));
+      FsManagerOpts opts;
+      opts.parent_mem_tracker = parent_mem_tracker;
+      opts.wal_root = test_path;
+      opts.data_roots = {test_path};
+      gscoped_ptr<FsManager> fs_manager(new FsManager(env_, opts));
+      RETURN_NOT_OK(fs_manager->CreateInitialFileSystemLayout());
+      RETURN_NOT_OK(fs_manager->Open());
+
+      cmeta_managers_.emplace_back(
+          new ConsensusMetadataManager(fs_manager.get()));
+      persistent_vars_managers_.emplace_back(
+          new PersistentVarsManager(fs_manager.get()));
+
+      scoped_refptr<Log> log;
+      RETURN_NOT_OK(Log::Open(
+          LogOptions(), fs_manager.get(), kBenchTablet, nullptr, &log));
+      logs_.emplace_back(std::move(log));
+      fs_managers_.push_back(fs_manager.release());
+    }
+    return Status::OK();
+  }
+
+  // Builds a configuration of 'num' voters. With 'num_regions' > 0 the
+  // voters are spread round-robin over the regions and the configuration
+  // uses the FlexiRaft single region dynamic commit rule.
+  RaftConfigPB BuildRaftConfigPB(int num, int num_regions) {
+    RaftConfigPB raft_config;
+    for (int i = 0; i < num; i++) {
+      RaftPeerPB* peer_pb = raft_config.add_peers();
+      peer_pb->set_member_type(RaftPeerPB::VOTER);
+      peer_pb->set_permanent_uuid(fs_managers_[i]->uuid());
+      HostPortPB* hp = peer_pb->mutable_last_known_addr();
+      hp->set_host(Substitute("peer-$0.fake-domain-for-tests", i));
+      hp->set_port(0);
+      if (num_regions > 0) {
+        string region = Substitute("region-$0", i % num_regions);
+        peer_pb->mutable_attrs()->set_region(region);
+        (*raft_config.mutable_voter_distribution())[region]++;
+      }
+    }
+    if (num_regions > 0) {
+      raft_config.mutable_commit_rule()->set_mode(
+          QuorumMode::SINGLE_REGION_DYNAMIC);
+    }
+    raft_config.set_opid_index(kInvalidOpIdIndex);
+    return raft_config;
+  }
+
+  Status BuildAndStartQuorum(int num, int num_regions) {
+    RETURN_NOT_OK(BuildFsManagersAndLogs(num));
+    config_ = BuildRaftConfigPB(num, num_regions);
+    peers_.reset(new TestPeerMapManager(config_));
+
+    for (int i = 0; i < num; i++) {
+      RETURN_NOT_OK(
+          cmeta_managers_[i]->CreateCMeta(kBenchTablet, config_, kMinimumTerm));
+      RETURN_NOT_OK(
+          persistent_vars_managers_[i]->CreatePersistentVars(kBenchTablet));
+      shared_ptr<RaftConsensus> peer;
+      RETURN_NOT_OK(RaftConsensus::Create(
+          options_,
+          config_.peers(i),
+          cmeta_managers_[i],
+          persistent_vars_managers_[i],
+          raft_pool_.get(),
+          &peer));
+      peers_->AddPeer(config_.peers(i).permanent_uuid(), peer);
+    }
+
+    ConsensusBootstrapInfo boot_info;
+    for (int i = 0; i < num; i++) {
+      shared_ptr<RaftConsensus> peer;
+      RETURN_NOT_OK(peers_->GetPeerByIdx(i, &peer));
+      gscoped_ptr<PeerProxyFactory> proxy_factory(
+          new EmulatedLinkPeerProxyFactory(
+              peers_.get(), config_.peers(i), &partition_, &wire_stats_));
+      scoped_refptr<TimeManager> time_manager(
+          new TimeManager(clock_, Timestamp::kMin));
+      auto txn_factory = new TestTransactionFactory(logs_[i].get());
+      txn_factory->SetConsensus(peer.get());
+      txn_factories_.push_back(txn_factory);
+      RETURN_NOT_OK(peer->Start(
+          boot_info,
+          std::move(proxy_factory),
+          logs_[i],
+          time_manager,
+          txn_factory,
+          metric_entity_,
+          Bind(&DoNothing)));
+    }
+
+    // The first peer is in the first region, so that is where the leader
+    // lives in FlexiRaft mode.
+    RETURN_NOT_OK(peers_->GetPeerByIdx(0, &leader_));
+    return leader_->EmulateElection();
+  }
+
+  // Waits until one of the live peers other than 'excluded_uuid' is leader
+  // and sets 'leader_' to it.
+  Status WaitForLeader(const string& excluded_uuid, MonoTime deadline) {
+    while (MonoTime::Now() < deadline) {
+      for (int i = 0; i < config_.peers_size(); i++) {
+        shared_ptr<RaftConsensus> peer;
+        if (!peers_->GetPeerByIdx(i, &peer).ok() ||
+            peer->peer_uuid() == excluded_uuid) {
+          continue;
+        }
+        if (peer->role() == RaftPeerPB::LEADER) {
+          leader_ = std::move(peer);
+          return Status::OK();
+        }
+      }
+      SleepFor(MonoDelta::FromMilliseconds(1));
+    }
+    return Status::TimedOut("no leader elected");
+  }
+
+  // Replicates a single NO_OP carrying 'payload' through the leader and
+  // waits for it to be committed.
+  Status ReplicateOne(const string& payload) {
+    gscoped_ptr<ReplicateMsg> msg(new ReplicateMsg());
+    msg->set_op_type(NO_OP);
+    msg->mutable_noop_request()->set_payload_for_tests(payload);
+    msg->set_timestamp(clock_->Now().ToUint64());
+
+    Synchronizer sync;
+    scoped_refptr<ConsensusRound> round =
+        leader_->NewRound(std::move(msg), sync.AsStdStatusCallback());
+    RETURN_NOT_OK(leader_->Replicate(round.get()));
+    return sync.Wait();
+  }
+
+  // Runs 'concurrency' closed-loop client threads for 'runtime', each
+  // paced so that all of them together submit at most 'ops_per_sec'.
+  void RunLoad(int concurrency, int ops_per_sec, MonoDelta runtime) {
+    std::atomic<bool> stop(false);
+    std::atomic<int64_t> errors(0);
+    const MonoDelta interval = ops_per_sec > 0
+        ? MonoDelta::FromNanoseconds(
+              concurrency * MonoTime::kNanosecondsPerSecond / ops_per_sec)
+        : MonoDelta::FromNanoseconds(0);
+
+    vector<thread> threads;
+    for (int t = 0; t < concurrency; t++) {
+      threads.emplace_back([&, t]() {
+        Random rng(SeedRandom() + t);
+        string payload =
+            RandomString(FLAGS_raft_bench_payload_bytes, &rng);
+        MonoTime next = MonoTime::Now();
+        while (!stop) {
+          if (interval.ToNanoseconds() > 0) {
+            MonoTime now = MonoTime::Now();
+            if (now < next) {
+              SleepFor(next - now);
+            }
+            next += interval;
+          }
+          MonoTime start = MonoTime::Now();
+          Status s = ReplicateOne(payload);
+          if (PREDICT_FALSE(!s.ok())) {
+            LOG(WARNING) << "Replicate failed: " << s.ToString();
+            errors++;
+            continue;
+          }
+          int64_t us = (MonoTime::Now() - start).ToMicroseconds();
+          latency_hist_.Increment(std::min<int64_t>(us, kMaxLatencyUs));
+        }
+      });
+    }
+    SleepFor(runtime);
+    stop = true;
+    for (auto& t : threads) {
+      t.join();
+    }
+    ASSERT_EQ(0, errors.load());
+  }
+
+  // Captures a synthetic workload of Poisson arrivals and returns the
+  // pattern of its files in 'pattern'.
+  void CaptureSyntheticWorkload(string* pattern) {
+    const string kPeer = "synthetic";
+    const string dir = GetTestPath("capture");
+    FLAGS_consensus_workload_capture_dir = dir;
+    unique_ptr<WorkloadCapture> capture;
+    ASSERT_OK(WorkloadCapture::Create(env_, kBenchTablet, kPeer, &capture));
+    FLAGS_consensus_workload_capture_dir = "";
+    ASSERT_TRUE(capture);
+
+    const int ops_per_sec = FLAGS_raft_bench_ops_per_sec > 0
+        ? FLAGS_raft_bench_ops_per_sec
+        : 1000;
+    const int num_ops = ops_per_sec * FLAGS_raft_bench_runtime_secs;
+    const int payload_bytes = FLAGS_raft_bench_payload_bytes;
+    Random rng(SeedRandom());
+    ReplicateMsg msg;
+    msg.set_op_type(NO_OP);
+    MonoTime next = MonoTime::Now();
+    for (int i = 0; i < num_ops; i++) {
+      MonoTime now = MonoTime::Now();
+      if (now < next) {
+        SleepFor(next - now);
+      }
+      next += MonoDelta::FromSeconds(
+          -std::log(1 - rng.NextDoubleFraction() * 0.999) / ops_per_sec);
+      msg.mutable_noop_request()->set_payload_for_tests(
+          string(payload_bytes / 2 + rng.Uniform(payload_bytes + 1), 'x'));
+      msg.set_timestamp(clock_->Now().ToUint64());
+      capture->Record(msg, CapturedOpPB::LEADER_REPLICATE, 1);
+    }
+    capture.reset();
+    *pattern = WorkloadCapture::FilePattern(dir, kBenchTablet, kPeer);
+  }
+
+  // Writes a WAL of synthetic ops with the timestamps of Poisson arrivals
+  // and returns its directory in 'wal_dir'.
+  void WriteSyntheticWal(string* wal_dir) {
+    gscoped_ptr<FsManager> fs_manager(
+        new FsManager(env_, GetTestPath("wal-source")));
+    ASSERT_OK(fs_manager->CreateInitialFileSystemLayout());
+    ASSERT_OK(fs_manager->Open());
+    scoped_refptr<Log> log;
+    ASSERT_OK(Log::Open(
+        LogOptions(), fs_manager.get(), kBenchTablet, nullptr, &log));
+
+    const int ops_per_sec = FLAGS_raft_bench_ops_per_sec > 0
+        ? FLAGS_raft_bench_ops_per_sec
+        : 1000;
+    const int num_ops = ops_per_sec * FLAGS_raft_bench_runtime_secs;
+    const int payload_bytes = FLAGS_raft_bench_payload_bytes;
+    constexpr int kOpsPerAppend = 100;
+    Random rng(SeedRandom());
+    double arrival_micros = GetCurrentTimeMicros();
+    for (int i = 0; i < num_ops; i += kOpsPerAppend) {
+      vector<ReplicateRefPtr> replicates;
+      for (int j = i; j < std::min(num_ops, i + kOpsPerAppend); j++) {
+        arrival_micros += -std::log(1 - rng.NextDoubleFraction() * 0.999) *
+            1e6 / ops_per_sec;
+        ReplicateRefPtr replicate =
+            make_scoped_refptr_replicate(new ReplicateMsg());
+        ReplicateMsg* msg = replicate->get();
+        *msg->mutable_id() = MakeOpId(1, j + 1);
+        msg->set_op_type(NO_OP);
+        msg->mutable_noop_request()->set_payload_for_tests(
+            string(payload_bytes / 2 + rng.Uniform(payload_bytes + 1), 'x'));
+        msg->set_timestamp(clock::HybridClock::TimestampFromMicroseconds(
+                               static_cast<uint64_t>(arrival_micros))
+                               .ToUint64());
+        replicates.push_back(std::move(replicate));
+      }
+      Synchronizer s;
+      ASSERT_OK(log->AsyncAppendReplicates(replicates, s.AsStatusCallback()));
+      ASSERT_OK(s.Wait());
+    }
+    ASSERT_OK(log->Close());
+    *wal_dir = fs_manager->GetTabletWalDir(kBenchTablet);
+  }
+
+  // Submits 'ops' to the leader at the times they were captured, scaled by
+  // --raft_bench_replay_speedup, and waits for all of them to be committed.
+  // The ops which came in one call are submitted with one ReplicateBatch().
+  void ReplayOps(const vector<CapturedOpPB>& ops) {
+    int64_t max_payload = 0;
+    for (const CapturedOpPB& op : ops) {
+      max_payload = std::max(max_payload, op.payload_bytes());
+    }
+    const string payload(max_payload, 'x');
+    const int64_t first_arrival = ops.front().arrival_micros();
+    const MonoTime start = MonoTime::Now();
+    size_t i = 0;
+    while (i < ops.size()) {
+      // The ops of a batch were captured together.
+      size_t end = i + 1;
+      while (end < ops.size() &&
+             end - i < static_cast<size_t>(ops[i].batch_size()) &&
+             ops[end].arrival_micros() == ops[i].arrival_micros()) {
+        end++;
+      }
+      MonoTime due = start +
+          MonoDelta::FromMicroseconds(
+                         (ops[i].arrival_micros() - first_arrival) /
+                         FLAGS_raft_bench_replay_speedup);
+      MonoTime now = MonoTime::Now();
+      if (now < due) {
+        SleepFor(due - now);
+      }
+
+      MonoTime submitted = MonoTime::Now();
+      vector<scoped_refptr<ConsensusRound>> rounds;
+      for (size_t k = i; k < end; k++) {
+        gscoped_ptr<ReplicateMsg> msg(new ReplicateMsg());
+        msg->set_op_type(NO_OP);
+        msg->mutable_noop_request()->set_payload_for_tests(
+            payload.substr(0, ops[k].payload_bytes()));
+        msg->set_timestamp(clock_->Now().ToUint64());
+        rounds.push_back(leader_->NewRound(
+            std::move(msg), [this, submitted](const Status& s) {
+              if (PREDICT_FALSE(!s.ok())) {
+                replay_errors_++;
+              } else {
+                int64_t us = (MonoTime::Now() - submitted).ToMicroseconds();
+                latency_hist_.Increment(std::min<int64_t>(us, kMaxLatencyUs));
+              }
+              replay_done_++;
+            }));
+      }
+      ASSERT_OK(
+          rounds.size() == 1 ? leader_->Replicate(rounds[0])
+                             : leader_->ReplicateBatch(rounds));
+      i = end;
+    }
+    ASSERT_EVENTUALLY([&]() {
+      ASSERT_EQ(static_cast<int64_t>(ops.size()), replay_done_.load());
+    });
+    ASSERT_EQ(0, replay_errors_.load());
+  }
+
+  // Replays 'ops', which came from 'source', against a new quorum with
+  // ReplayOps() and reports how it went.
+  void ReplayAndReport(const vector<CapturedOpPB>& ops, const string& source) {
+    int64_t payload_bytes = 0;
+    int64_t uncompressed_bytes = 0;
+    for (const CapturedOpPB& op : ops) {
+      payload_bytes += op.payload_bytes();
+      uncompressed_bytes += op.uncompressed_bytes();
+    }
+    const double captured_secs =
+        (ops.back().arrival_micros() - ops.front().arrival_micros()) / 1e6;
+    const int num_regions = FLAGS_raft_bench_num_regions;
+    if (num_regions > 0) {
+      FLAGS_enable_flexi_raft = true;
+    }
+    ASSERT_OK(BuildAndStartQuorum(FLAGS_raft_bench_num_voters, num_regions));
+    ASSERT_OK(ReplicateOne(string(FLAGS_raft_bench_payload_bytes, 'x')));
+    latency_hist_.ResetHistogram();
+    int64_t start_request_bytes = wire_stats_.request_bytes;
+    int64_t start_requests = wire_stats_.requests;
+
+    MonoTime start = MonoTime::Now();
+    int64_t start_cpu_us = CpuTimeMicros();
+    NO_FATALS(ReplayOps(ops));
+    int64_t cpu_us = CpuTimeMicros() - start_cpu_us;
+    double elapsed_secs = (MonoTime::Now() - start).ToSeconds();
+    const int64_t num_ops = ops.size();
+    int64_t request_bytes = wire_stats_.request_bytes - start_request_bytes;
+    int64_t requests = wire_stats_.requests - start_requests;
+
+    LOG(INFO) << Substitute(
+        "replayed $0 ops captured over $1 s from $2 at $3x, $4 voters, "
+        "$5 regions, link $6, cross region link $7",
+        num_ops,
+        captured_secs,
+        source,
+        FLAGS_raft_bench_replay_speedup,
+        FLAGS_raft_bench_num_voters,
+        num_regions,
+        FLAGS_raft_bench_link,
+        FLAGS_raft_bench_cross_region_link);
+    LOG(INFO) << Substitute(
+        "captured payload: $0 bytes/op, $1 bytes/op uncompressed",
+        static_cast<double>(payload_bytes) / num_ops,
+        static_cast<double>(uncompressed_bytes) / num_ops);
+    LOG(INFO) << Substitute(
+        "throughput: $0 ops/sec ($1 ops in $2 s)",
+        num_ops / elapsed_secs,
+        num_ops,
+        elapsed_secs);
+    LOG(INFO) << Substitute(
+        "commit latency us: mean $0 p50 $1 p99 $2 p99.9 $3 max $4",
+        latency_hist_.MeanValue(),
+        latency_hist_.ValueAtPercentile(50),
+        latency_hist_.ValueAtPercentile(99),
+        latency_hist_.ValueAtPercentile(99.9),
+        latency_hist_.MaxValue());
+    LOG(INFO) << Substitute(
+        "cpu: $0 us/op (all peers in this process)",
+        static_cast<double>(cpu_us) / num_ops);
+    LOG(INFO) << Substitute(
+        "wire: $0 UpdateConsensus calls, $1 request bytes/op",
+        requests,
+        static_cast<double>(request_bytes) / num_ops);
+  }
+
+  ConsensusOptions options_;
+  RaftConfigPB config_;
+  vector<shared_ptr<MemTracker>> parent_mem_trackers_;
+  vector<FsManager*> fs_managers_;
+  vector<scoped_refptr<Log>> logs_;
+  gscoped_ptr<ThreadPool> raft_pool_;
+  unique_ptr<TestPeerMapManager> peers_;
+  vector<TestTransactionFactory*> txn_factories_;
+  vector<scoped_refptr<ConsensusMetadataManager>> cmeta_managers_;
+  vector<scoped_refptr<PersistentVarsManager>> persistent_vars_managers_;
+  scoped_refptr<clock::Clock> clock_;
+  MetricRegistry metric_registry_;
+  scoped_refptr<MetricEntity> metric_entity_;
+  shared_ptr<RaftConsensus> leader_;
+  Partition partition_;
+  WireStats wire_stats_;
+  HdrHistogram latency_hist_;
+
+  // The replayed ops which were committed or failed. Members rather than
+  // locals of ReplayOps(), as their callbacks may run after it returned.
+  std::atomic<int64_t> replay_done_{0};
+  std::atomic<int64_t> replay_errors_{0};
+};
+
+TEST_F(RaftConsensusBench, Replicate) {
+  const int num_regions = FLAGS_raft_bench_num_regions;
+  if (num_regions > 0) {
+    FLAGS_enable_flexi_raft = true;
+  }
+  ASSERT_OK(BuildAndStartQuorum(FLAGS_raft_bench_num_voters, num_regions));
+
+  // Warm up the log and the peers before measuring.
+  ASSERT_OK(ReplicateOne(string(FLAGS_raft_bench_payload_bytes, 'x')));
+  latency_hist_.ResetHistogram();
+  int64_t start_request_bytes = wire_stats_.request_bytes;
+  int64_t start_response_bytes = wire_stats_.response_bytes;
+  int64_t start_requests = wire_stats_.requests;
+
+  MonoTime start = MonoTime::Now();
+  int64_t start_cpu_us = CpuTimeMicros();
+  NO_FATALS(RunLoad(
+      FLAGS_raft_bench_concurrency,
+      FLAGS_raft_bench_ops_per_sec,
+      MonoDelta::FromSeconds(FLAGS_raft_bench_runtime_secs)));
+  int64_t cpu_us = CpuTimeMicros() - start_cpu_us;
+  double elapsed_secs = (MonoTime::Now() - start).ToSeconds();
+
+  const int64_t ops = latency_hist_.TotalCount();
+  ASSERT_GT(ops, 0);
+  int64_t request_bytes = wire_stats_.request_bytes - start_request_bytes;
+  int64_t response_bytes = wire_stats_.response_bytes - start_response_bytes;
+  int64_t requests = wire_stats_.requests - start_requests;
+
+  LOG(INFO) << Substitute(
+      "$0 voters, $1 regions, $2 clients, $3 byte payloads, "
+      "link $4, cross region link $5",
+      FLAGS_raft_bench_num_voters,
+      num_regions,
+      FLAGS_raft_bench_concurrency,
+      FLAGS_raft_bench_payload_bytes,
+      FLAGS_raft_bench_link,
+      FLAGS_raft_bench_cross_region_link);
+  LOG(INFO) << Substitute(
+      "throughput: $0 ops/sec ($1 ops in $2 s)",
+      ops / elapsed_secs,
+      ops,
+      elapsed_secs);
+  LOG(INFO) << Substitute(
+      "commit latency us: mean $0 p50 $1 p99 $2 p99.9 $3 max $4",
+      latency_hist_.MeanValue(),
+      latency_hist_.ValueAtPercentile(50),
+      latency_hist_.ValueAtPercentile(99),
+      latency_hist_.ValueAtPercentile(99.9),
+      latency_hist_.MaxValue());
+  LOG(INFO) << Substitute(
+      "cpu: $0 us/op (all peers in this process)",
+      static_cast<double>(cpu_us) / ops);
+  LOG(INFO) << Substitute(
+      "wire: $0 UpdateConsensus calls, $1 request bytes/op, "
+      "$2 response bytes/op",
+      requests,
+      static_cast<double>(request_bytes) / ops,
+      static_cast<double>(response_bytes) / ops);
+}
+
+// Replays the ops a leader replicated in a captured workload, see
+// --raft_bench_replay_pattern.
+TEST_F(RaftConsensusBench, Replay) {
+  string pattern = FLAGS_raft_bench_replay_pattern;
+  if (pattern.empty()) {
+    NO_FATALS(CaptureSyntheticWorkload(&pattern));
+  }
+  vector<CapturedOpPB> captured;
+  ASSERT_OK(WorkloadCapture::ReadCapture(env_, pattern, &captured));
+  vector<CapturedOpPB> ops;
+  for (CapturedOpPB& op : captured) {
+    if (op.source() == CapturedOpPB::LEADER_REPLICATE) {
+      ops.push_back(std::move(op));
+    }
+  }
+  ASSERT_FALSE(ops.empty()) << "no ops replicated as leader in " << pattern;
+  NO_FATALS(ReplayAndReport(ops, pattern));
+}
+
+// Replays the ops of a WAL, see --raft_bench_replay_wal_dir.
+TEST_F(RaftConsensusBench, ReplayWal) {
+  string wal_dir = FLAGS_raft_bench_replay_wal_dir;
+  if (wal_dir.empty()) {
+    NO_FATALS(WriteSyntheticWal(&wal_dir));
+  }
+  vector<CapturedOpPB> ops;
+  ASSERT_OK(WorkloadCapture::ReadWal(env_, wal_dir, &ops));
+  ASSERT_FALSE(ops.empty()) << "no ops in " << wal_dir;
+  if (FLAGS_raft_bench_replay_wal_dir.empty()) {
+    ASSERT_EQ(
+        FLAGS_raft_bench_runtime_secs *
+            (FLAGS_raft_bench_ops_per_sec > 0 ? FLAGS_raft_bench_ops_per_sec
+                                              : 1000),
+        ops.size());
+  }
+  NO_FATALS(ReplayAndReport(ops, wal_dir));
+}
+// Isolates the leader --raft_bench_failovers times and reports the
+// distribution of each phase of the failovers, as timed by the replicas
+// that won them.
+TEST_F(RaftConsensusBench, Failover) {
+  const int num_regions = FLAGS_raft_bench_num_regions;
+  if (num_regions > 0) {
+    FLAGS_enable_flexi_raft = true;
+  }
+  FLAGS_enable_leader_failure_detection = true;
+  ASSERT_OK(BuildAndStartQuorum(FLAGS_raft_bench_num_voters, num_regions));
+  const MonoDelta timeout =
+      MonoDelta::FromSeconds(FLAGS_raft_bench_failover_timeout_secs);
+  const string payload(FLAGS_raft_bench_payload_bytes, 'x');
+  ASSERT_OK(WaitForLeader("", MonoTime::Now() + timeout));
+  ASSERT_OK(ReplicateOne(payload));
+
+  HdrHistogram elected_hist(kMaxLatencyUs, 3);
+  HdrHistogram committed_hist(kMaxLatencyUs, 3);
+  for (int i = 0; i < FLAGS_raft_bench_failovers; i++) {
+    // Cut the leader off from its peers, as if it had crashed.
+    shared_ptr<RaftConsensus> old_leader = leader_;
+    const string old_leader_uuid = old_leader->peer_uuid();
+    MonoTime failure = MonoTime::Now();
+    partition_.Isolate(old_leader_uuid);
+
+    ASSERT_OK(WaitForLeader(old_leader_uuid, failure + timeout));
+    elected_hist.Increment((MonoTime::Now() - failure).ToMicroseconds());
+    ASSERT_OK(ReplicateOne(payload));
+    committed_hist.Increment((MonoTime::Now() - failure).ToMicroseconds());
+
+    // Bring the old leader back, and wait for it to learn of the new term
+    // before failing the next leader.
+    partition_.Heal();
+    ASSERT_EVENTUALLY([&]() {
+      ASSERT_NE(RaftPeerPB::LEADER, old_leader->role());
+    });
+    ASSERT_OK(ReplicateOne(payload));
+  }
+
+  LOG(INFO) << Substitute(
+      "$0 failovers of $1 voters, $2 regions, link $3, cross region link $4, "
+      "failure timeout $5 ms",
+      FLAGS_raft_bench_failovers,
+      FLAGS_raft_bench_num_voters,
+      num_regions,
+      FLAGS_raft_bench_link,
+      FLAGS_raft_bench_cross_region_link,
+      FLAGS_leader_failure_max_missed_heartbeat_periods *
+          FLAGS_raft_heartbeat_interval_ms);
+  auto log_phase = [](const string& name, const HdrHistogram& hist) {
+    LOG(INFO) << Substitute(
+        "$0 ms: count $1 p50 $2 p99 $3 max $4",
+        name,
+        hist.TotalCount(),
+        hist.ValueAtPercentile(50) / 1000.0,
+        hist.ValueAtPercentile(99) / 1000.0,
+        hist.MaxValue() / 1000.0);
+  };
+  const std::pair<const char*, HistogramPrototype*> kPhases[] = {
+      {"detection", &METRIC_raft_failover_detection_duration},
+      {"pre-election", &METRIC_raft_failover_pre_election_duration},
+      {"election", &METRIC_raft_failover_election_duration},
+      {"no-op commit", &METRIC_raft_failover_noop_commit_duration},
+      {"first commit", &METRIC_raft_failover_first_commit_duration},
+      {"total (as seen by the new leader)", &METRIC_raft_failover_duration},
+  };
+  for (const auto& phase : kPhases) {
+    log_phase(
+        phase.first, *phase.second->Instantiate(metric_entity_)->histogram());
+  }
+  log_phase("total to new leader (wall)", elected_hist);
+  log_phase("total to first commit (wall)", committed_hist);
+
+  // Every failover was won by a replica whose failure detector fired, so
+  // each was timed to its first commit.
+  ASSERT_GE(
+      METRIC_raft_failover_duration.Instantiate(metric_entity_)->TotalCount(),
+      static_cast<uint64_t>(FLAGS_raft_bench_failovers));
+}
+
+} // namespace consensus
+} // namespace kudu
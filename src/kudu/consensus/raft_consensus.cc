@@ -25,11 +25,13 @@
 
 #include <glog/logging.h>
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cmath>
 #include <cstdint>
 #include <functional>
 #include <iterator>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <ostream>
@@ -37,6 +39,7 @@
 #include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include <boost/optional/optional.hpp>
@@ -47,13 +50,17 @@
 
 #include "kudu/common/timestamp.h"
 #include "kudu/common/wire_protocol.h"
+#include "kudu/consensus/apply_pipeline.h"
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/consensus_meta.h"
 #include "kudu/consensus/consensus_meta_manager.h"
 #include "kudu/consensus/consensus_peers.h"
 #include "kudu/consensus/leader_election.h"
 #include "kudu/consensus/log.h"
+#include "kudu/consensus/log_retention_policy.h"
+#include "kudu/consensus/log_subscriptions.h"
 #include "kudu/consensus/metadata.pb.h"
+#include "kudu/consensus/op_tracer.h"
 #include "kudu/consensus/opid_util.h"
 #include "kudu/consensus/peer_manager.h"
 #include "kudu/consensus/pending_rounds.h"
@@ -61,9 +68,12 @@
 #include "kudu/consensus/persistent_vars.pb.h"
 #include "kudu/consensus/persistent_vars_manager.h"
 #include "kudu/consensus/quorum_util.h"
+#include "kudu/consensus/raft_config_index.h"
 #include "kudu/consensus/replicate_msg_wrapper.h"
 #include "kudu/consensus/routing.h"
+#include "kudu/consensus/snapshot_provider.h"
 #include "kudu/consensus/time_manager.h"
+#include "kudu/consensus/workload_capture.h"
 #include "kudu/gutil/bind.h"
 #include "kudu/gutil/bind_helpers.h"
 #include "kudu/gutil/macros.h"
@@ -74,18 +84,23 @@
 #include "kudu/gutil/strings/stringpiece.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/gutil/walltime.h"
+#include "kudu/rpc/messenger.h"
 #include "kudu/rpc/periodic.h"
 #include "kudu/rpc/rpc_context.h"
+#include "kudu/rpc/rpc_controller.h"
 #include "kudu/util/async_util.h"
 #include "kudu/util/compression/compression.pb.h"
 #include "kudu/util/compression/compression_codec.h"
+#include "kudu/util/compression/compression_dict_trainer.h"
 #include "kudu/util/crc.h"
+#include "kudu/util/env.h"
 #include "kudu/util/debug/trace_event.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/process_memory.h"
+#include "kudu/util/promise.h"
 #include "kudu/util/random.h"
 #include "kudu/util/random_util.h"
 #include "kudu/util/scoped_cleanup.h"
@@ -112,6 +127,33 @@ DEFINE_double(
     "The value passed to this flag may be fractional.");
 TAG_FLAG(leader_failure_max_missed_heartbeat_periods, advanced);
 
+DEFINE_bool(
+    raft_enable_quiescence,
+    false,
+    "Whether the leader of an idle Raft group quiesces it once every peer has "
+    "acknowledged its last op and committed index: heartbeats are then sent "
+    "every raft_quiesced_heartbeat_interval_ms, and the followers' failure "
+    "detectors stretched to match, until there are ops to replicate again.");
+TAG_FLAG(raft_enable_quiescence, experimental);
+
+DEFINE_bool(
+    log_retention_policy_enabled,
+    false,
+    "Whether the WAL retained for lagging peers is decided from their lag "
+    "and last contact, the cost of catching them up and the free space of "
+    "the WAL disk, instead of only from the index replicated by all of them. "
+    "See the --log_retention_* flags.");
+TAG_FLAG(log_retention_policy_enabled, runtime);
+TAG_FLAG(log_retention_policy_enabled, experimental);
+
+DEFINE_int32(
+    raft_quiesced_heartbeat_interval_ms,
+    10000,
+    "The heartbeat interval of a quiesced Raft group. If 0, a quiesced group "
+    "doesn't heartbeat at all, and its followers suspend failure detection "
+    "until traffic resumes or a node-level liveness signal unquiesces them.");
+TAG_FLAG(raft_quiesced_heartbeat_interval_ms, experimental);
+
 DEFINE_double(
     snooze_for_leader_ban_ratio,
     1.0,
@@ -150,6 +192,41 @@ DEFINE_bool(
     "Warning! This is only intended for testing.");
 TAG_FLAG(follower_reject_update_consensus_requests, unsafe);
 
+DEFINE_bool(
+    follower_pipeline_updates,
+    false,
+    "Whether a follower lets the next UpdateConsensus() request in while the "
+    "ops of the previous one are being made durable, rather than only once it "
+    "responded to it. Each request is still only acknowledged once its ops "
+    "are durable. Only helps with "
+    "--consensus_max_inflight_requests_per_peer above 1 on the leader.");
+TAG_FLAG(follower_pipeline_updates, advanced);
+TAG_FLAG(follower_pipeline_updates, runtime);
+
+DEFINE_bool(
+    enable_leader_leases,
+    false,
+    "Whether the leader keeps a lease, which lets it serve linearizable reads "
+    "without a round trip to the followers, see "
+    "RaftConsensus::CheckLeaseForRead(). A replica withholds its vote for the "
+    "minimum election timeout after hearing from the leader, and so no other "
+    "leader can be elected until that long after a quorum of the voters "
+    "accepted a request sent by the leader.");
+TAG_FLAG(enable_leader_leases, advanced);
+TAG_FLAG(enable_leader_leases, runtime);
+
+DEFINE_double(
+    leader_lease_clock_drift_ratio,
+    0.05,
+    "The fraction of the minimum election timeout the leader lease is "
+    "shortened by, to make up for the monotonic clocks of the replicas "
+    "running at different rates. Must be in [0, 1).");
+DEFINE_validator(
+    leader_lease_clock_drift_ratio,
+    [](const char* /*n*/, double v) { return v >= 0 && v < 1; });
+TAG_FLAG(leader_lease_clock_drift_ratio, advanced);
+TAG_FLAG(leader_lease_clock_drift_ratio, runtime);
+
 DEFINE_bool(
     follower_fail_all_prepare,
     false,
@@ -165,6 +242,105 @@ DEFINE_bool(
 TAG_FLAG(raft_enable_pre_election, experimental);
 TAG_FLAG(raft_enable_pre_election, runtime);
 
+DEFINE_bool(
+    raft_phi_accrual_failure_detection,
+    false,
+    "Whether followers suspect the leader from the intervals between its "
+    "requests, with a phi accrual failure detector, rather than after the "
+    "fixed minimum election timeout, which then only bounds the adaptive "
+    "one. The leader is suspected once phi, the -log10 of the probability of "
+    "its next request still coming, reaches --raft_phi_accrual_threshold, "
+    "and a pre-election is then started. Voters also withhold their votes "
+    "for the adaptive timeout only, unless --enable_leader_leases is set.");
+TAG_FLAG(raft_phi_accrual_failure_detection, experimental);
+TAG_FLAG(raft_phi_accrual_failure_detection, runtime);
+
+DEFINE_double(
+    raft_phi_accrual_threshold,
+    8.0,
+    "The phi at which the leader is suspected, see "
+    "--raft_phi_accrual_failure_detection. A threshold of N means a healthy "
+    "leader is wrongly suspected about once every 10^N intervals, if they "
+    "are normally distributed. Must be at least 1.");
+DEFINE_validator(
+    raft_phi_accrual_threshold,
+    [](const char* /*n*/, double v) { return v >= 1; });
+TAG_FLAG(raft_phi_accrual_threshold, experimental);
+TAG_FLAG(raft_phi_accrual_threshold, runtime);
+
+DEFINE_int32(
+    raft_phi_accrual_window_size,
+    200,
+    "The number of the latest intervals between the leader's requests which "
+    "--raft_phi_accrual_failure_detection models.");
+TAG_FLAG(raft_phi_accrual_window_size, experimental);
+
+DEFINE_int32(
+    raft_phi_accrual_min_samples,
+    20,
+    "The number of intervals between the leader's requests needed before the "
+    "phi accrual failure detector is used, the fixed timeout being used "
+    "until then.");
+TAG_FLAG(raft_phi_accrual_min_samples, experimental);
+
+DEFINE_int32(
+    raft_phi_accrual_min_stddev_ms,
+    50,
+    "The least standard deviation of the intervals between the leader's "
+    "requests the phi accrual failure detector assumes, so that a leader "
+    "heard from like clockwork isn't suspected as soon as it is a little "
+    "late.");
+TAG_FLAG(raft_phi_accrual_min_stddev_ms, experimental);
+
+DEFINE_bool(
+    raft_priority_elections,
+    false,
+    "Whether the voters run for leader in the order of their election "
+    "priority, the election_priority attribute of the peers in the config. "
+    "The randomized election timeout window is split between the distinct "
+    "priorities, so that the voters of a higher priority time out first and "
+    "don't split the votes with those of a lower one, and a voter asked for "
+    "its vote by a candidate of a higher priority holds off its own "
+    "elections.");
+TAG_FLAG(raft_priority_elections, experimental);
+TAG_FLAG(raft_priority_elections, runtime);
+
+DEFINE_int64(
+    raft_priority_elections_max_lag_ops,
+    1000,
+    "With --raft_priority_elections, a voter whose log is behind the "
+    "committed index of the leader by more than this many ops times out "
+    "after all the others, whatever its priority, as it would have to catch "
+    "up before it could commit anything as the leader.");
+DEFINE_validator(
+    raft_priority_elections_max_lag_ops,
+    [](const char* /*n*/, int64_t v) { return v >= 0; });
+TAG_FLAG(raft_priority_elections_max_lag_ops, experimental);
+TAG_FLAG(raft_priority_elections_max_lag_ops, runtime);
+
+DEFINE_bool(
+    raft_priority_leader_reclaim,
+    false,
+    "With --raft_priority_elections, whether a leader transfers leadership "
+    "to a voter of a higher election priority than its own once the voter is "
+    "caught up, so that the preferred voters take back the leadership after "
+    "a failover without waiting for an election timeout.");
+TAG_FLAG(raft_priority_leader_reclaim, experimental);
+TAG_FLAG(raft_priority_leader_reclaim, runtime);
+
+DEFINE_int32(
+    raft_priority_leader_reclaim_delay_ms,
+    30000,
+    "With --raft_priority_leader_reclaim, how long a replica leads before it "
+    "transfers leadership to a voter of a higher priority, and then between "
+    "attempts, so that a preferred voter which keeps failing doesn't churn "
+    "the leadership.");
+DEFINE_validator(
+    raft_priority_leader_reclaim_delay_ms,
+    [](const char* /*n*/, int32_t v) { return v >= 0; });
+TAG_FLAG(raft_priority_leader_reclaim_delay_ms, experimental);
+TAG_FLAG(raft_priority_leader_reclaim_delay_ms, runtime);
+
 DEFINE_bool(
     raft_enable_tombstoned_voting,
     true,
@@ -172,6 +348,27 @@ DEFINE_bool(
 TAG_FLAG(raft_enable_tombstoned_voting, experimental);
 TAG_FLAG(raft_enable_tombstoned_voting, runtime);
 
+DEFINE_bool(
+    raft_pre_vote_fast_path,
+    true,
+    "When enabled, pre-election and normal election vote requests which are "
+    "bound to be denied, because a leader is believed to be alive or the "
+    "candidate is behind our term, are answered without taking the Raft "
+    "locks.");
+TAG_FLAG(raft_pre_vote_fast_path, advanced);
+TAG_FLAG(raft_pre_vote_fast_path, runtime);
+
+DEFINE_int32(
+    raft_vote_denial_cache_ms,
+    250,
+    "For how long the last vote denied to a candidate for having voted for "
+    "another candidate or for a stale log is sent again, without taking the "
+    "Raft locks, to identical requests from that candidate. Protects voters "
+    "from candidates retrying their vote requests during election storms. "
+    "0 disables the cache.");
+TAG_FLAG(raft_vote_denial_cache_ms, advanced);
+TAG_FLAG(raft_vote_denial_cache_ms, runtime);
+
 // Enable improved re-replication (KUDU-1097).
 DEFINE_bool(
     raft_prepare_replacement_before_eviction,
@@ -200,6 +397,15 @@ DEFINE_bool(
 TAG_FLAG(raft_enable_multi_hop_proxy_routing, advanced);
 TAG_FLAG(raft_enable_multi_hop_proxy_routing, runtime);
 
+DEFINE_bool(
+    raft_proxy_multi_hop_passthrough,
+    false,
+    "When a proxy forwards a request to another proxy, forward the request as "
+    "it was received, rewriting only its routing fields, instead of copying "
+    "its header fields and PROXY_OP ops into a new request.");
+TAG_FLAG(raft_proxy_multi_hop_passthrough, experimental);
+TAG_FLAG(raft_proxy_multi_hop_passthrough, runtime);
+
 DEFINE_int32(
     raft_log_cache_proxy_wait_time_ms,
     500,
@@ -208,6 +414,77 @@ DEFINE_int32(
 TAG_FLAG(raft_log_cache_proxy_wait_time_ms, advanced);
 TAG_FLAG(raft_log_cache_proxy_wait_time_ms, runtime);
 
+DEFINE_bool(
+    leader_reject_on_soft_memory_limit,
+    true,
+    "Whether a leader rejects new ops with ServiceUnavailable while the soft "
+    "memory limit of the process is exceeded, as followers reject requests "
+    "from their leader. See also --log_cache_throttle_threshold_percentage.");
+TAG_FLAG(leader_reject_on_soft_memory_limit, advanced);
+TAG_FLAG(leader_reject_on_soft_memory_limit, runtime);
+
+DEFINE_int64(
+    raft_admission_max_outstanding_bytes,
+    0,
+    "Bytes of ops a leader admits for replication, and which aren't "
+    "replicated yet, beyond which each tenant of the ops only gets its "
+    "weighted share of them, and its ops over that are rejected with "
+    "ServiceUnavailable. See --raft_admission_tenant_weights. 0 disables "
+    "the fair sharing.");
+DEFINE_validator(
+    raft_admission_max_outstanding_bytes,
+    [](const char* /*n*/, int64_t v) { return v >= 0; });
+TAG_FLAG(raft_admission_max_outstanding_bytes, experimental);
+
+DEFINE_int64(
+    raft_admission_tenant_ops_per_sec,
+    0,
+    "The rate of ops a leader admits for replication for each tenant, "
+    "times its weight. 0 for no limit.");
+DEFINE_validator(
+    raft_admission_tenant_ops_per_sec,
+    [](const char* /*n*/, int64_t v) { return v >= 0; });
+TAG_FLAG(raft_admission_tenant_ops_per_sec, experimental);
+
+DEFINE_int64(
+    raft_admission_tenant_bytes_per_sec,
+    0,
+    "The rate of bytes of ops a leader admits for replication for each "
+    "tenant, times its weight. It must leave room for the largest op in a "
+    "second, which is as long as the bursts last. 0 for no limit.");
+DEFINE_validator(
+    raft_admission_tenant_bytes_per_sec,
+    [](const char* /*n*/, int64_t v) { return v >= 0; });
+TAG_FLAG(raft_admission_tenant_bytes_per_sec, experimental);
+
+DEFINE_string(
+    raft_admission_tenant_weights,
+    "",
+    "The weights of the tenants of the ops a leader replicates, for their "
+    "shares and rates, as a comma-separated list of <tenant>:<weight>. The "
+    "other tenants have a weight of 1.");
+DEFINE_validator(
+    raft_admission_tenant_weights,
+    [](const char* /*n*/, const std::string& v) {
+      using kudu::consensus::ReplicateAdmissionController;
+      ReplicateAdmissionController::Options options;
+      return ReplicateAdmissionController::ParseWeights(v, &options.weights)
+          .ok();
+    });
+TAG_FLAG(raft_admission_tenant_weights, experimental);
+
+DEFINE_bool(
+    raft_witness_strip_payloads,
+    false,
+    "Whether a follower which isn't backed by a database, i.e. a witness, "
+    "stores the write ops it's sent without their payloads, in its log and in "
+    "its log cache. It keeps their ids, types, and the sizes and checksums of "
+    "their payloads. Should it become leader, it only sends those ops through "
+    "proxies, which fill them in from their own logs, and the peers it sends "
+    "ops to directly wait for a leader with the payloads for them.");
+TAG_FLAG(raft_witness_strip_payloads, experimental);
+TAG_FLAG(raft_witness_strip_payloads, runtime);
+
 DECLARE_int32(memory_limit_warn_threshold_percentage);
 DECLARE_int32(consensus_max_batch_size_bytes); // defined in consensus_queue
                                                // (expose as method?)
@@ -263,6 +540,116 @@ DEFINE_bool(
     true,
     "Should only update LKL after a op from the new term has been appened");
 
+DEFINE_bool(
+    raft_fast_leader_transfer,
+    false,
+    "Whether a leader keeps accepting writes and config changes while the "
+    "successor catches up during a leadership transfer, pausing them only "
+    "once the successor is within --raft_fast_leader_transfer_pause_lag_ops "
+    "of its log. The designated successor, if any, also gets full batches "
+    "rather than its adaptive batch size limit meanwhile. Otherwise writes "
+    "are paused for the whole transfer period.");
+TAG_FLAG(raft_fast_leader_transfer, experimental);
+TAG_FLAG(raft_fast_leader_transfer, runtime);
+
+DEFINE_int32(
+    raft_fast_leader_transfer_pause_lag_ops,
+    16,
+    "With --raft_fast_leader_transfer, how many ops behind the leader's log "
+    "the successor may be at most for the leader to pause new writes.");
+TAG_FLAG(raft_fast_leader_transfer_pause_lag_ops, experimental);
+TAG_FLAG(raft_fast_leader_transfer_pause_lag_ops, runtime);
+
+DEFINE_int32(
+    raft_warm_peer_connections_interval_ms,
+    0,
+    "If positive, a replica that is not the leader calls every other member "
+    "of its committed config this often, so that the connections it needs "
+    "if it is elected are already negotiated. Should be lower than "
+    "--rpc_default_keepalive_time_ms, or servers close the connections "
+    "between calls. 0 disables.");
+TAG_FLAG(raft_warm_peer_connections_interval_ms, experimental);
+TAG_FLAG(raft_warm_peer_connections_interval_ms, runtime);
+
+DEFINE_int32(
+    raft_compression_threads,
+    0,
+    "The number of threads, shared by all Raft groups, which compress the "
+    "msgs of a leader's batch in parallel before they are appended to the "
+    "WAL and the log cache. If 0, the msgs are compressed one after the "
+    "other by the thread replicating them. Read once, at first use.");
+TAG_FLAG(raft_compression_threads, experimental);
+
+DEFINE_int32(
+    raft_apply_pipeline_threads,
+    0,
+    "The number of threads, shared by all Raft groups, which apply the "
+    "committed transaction rounds, in batches, through "
+    "ConsensusRoundHandler::ApplyCommittedRounds(). Each Raft group hashes "
+    "the partition keys of its rounds onto as many partitions, applied "
+    "concurrently. If 0, the rounds are applied by the thread which "
+    "committed them, under the consensus lock. Read once, at first use.");
+TAG_FLAG(raft_apply_pipeline_threads, experimental);
+
+DEFINE_int32(
+    raft_apply_pipeline_max_batch_size,
+    64,
+    "The most committed rounds of a partition applied at once by the apply "
+    "pipeline. See --raft_apply_pipeline_threads. Must be positive.");
+DEFINE_validator(
+    raft_apply_pipeline_max_batch_size,
+    [](const char* /*n*/, int32_t v) { return v > 0; });
+TAG_FLAG(raft_apply_pipeline_max_batch_size, experimental);
+
+DEFINE_int32(
+    raft_compression_dict_training_interval_ms,
+    0,
+    "How often a leader trains a compression dictionary on the payloads it "
+    "appended since the previous round, and rolls it out if it compresses "
+    "them better than the current one. Only applies while a dictionary "
+    "codec (ZSTD_DICT or LZ4_DICT) is in use. If 0, dictionaries are not "
+    "trained.");
+TAG_FLAG(raft_compression_dict_training_interval_ms, experimental);
+
+DEFINE_int64(
+    raft_compression_dict_sample_bytes,
+    8 * 1024 * 1024,
+    "The most bytes of recently appended payloads a leader keeps to train "
+    "compression dictionaries on.");
+TAG_FLAG(raft_compression_dict_sample_bytes, advanced);
+
+DEFINE_int32(
+    raft_compression_dict_max_size,
+    64 * 1024,
+    "The maximum size in bytes of a trained compression dictionary.");
+TAG_FLAG(raft_compression_dict_max_size, advanced);
+TAG_FLAG(raft_compression_dict_max_size, runtime);
+
+DEFINE_double(
+    raft_compression_dict_min_improvement,
+    0.05,
+    "How much better, as a fraction of the current compression ratio, a "
+    "trained dictionary must compress the held out samples to be rolled "
+    "out.");
+TAG_FLAG(raft_compression_dict_min_improvement, advanced);
+TAG_FLAG(raft_compression_dict_min_improvement, runtime);
+
+DEFINE_double(
+    raft_compression_dict_max_slowdown,
+    1.5,
+    "A trained dictionary is not rolled out if compressing the held out "
+    "samples with it takes more than this many times as long as with the "
+    "current one.");
+TAG_FLAG(raft_compression_dict_max_slowdown, advanced);
+TAG_FLAG(raft_compression_dict_max_slowdown, runtime);
+
+DEFINE_int32(
+    consensus_health_summary_refresh_ms,
+    100,
+    "How stale the indexes and peer lags returned by the GetHealthSummary() "
+    "RPC may get. Role, term, leader and config changes show up right away.");
+TAG_FLAG(consensus_health_summary_refresh_ms, runtime);
+
 // Metrics
 // ---------
 METRIC_DEFINE_counter(
@@ -280,6 +667,89 @@ METRIC_DEFINE_counter(
     kudu::MetricUnit::kRequests,
     "Number of RPC requests rejected due to "
     "memory pressure while FOLLOWER.");
+METRIC_DEFINE_counter(
+    server,
+    follower_early_acked_updates,
+    "Follower Early Acked Updates",
+    kudu::MetricUnit::kRequests,
+    "Number of RPC requests with ops acknowledged while FOLLOWER before the "
+    "ops were durable in the log, in the QUORUM_MEMORY and LEADER_DURABLE "
+    "durability modes.");
+METRIC_DEFINE_counter(
+    server,
+    leader_memory_pressure_rejections,
+    "Leader Memory Pressure Rejections",
+    kudu::MetricUnit::kRequests,
+    "Number of calls to replicate new ops rejected due to memory pressure "
+    "while LEADER, see --log_cache_throttle_threshold_percentage and "
+    "--leader_reject_on_soft_memory_limit.");
+METRIC_DEFINE_counter(
+    server,
+    leader_admission_rejections,
+    "Leader Admission Rejections",
+    kudu::MetricUnit::kRequests,
+    "Number of calls to replicate new ops rejected while LEADER because "
+    "their tenant was over its share or its rate, see "
+    "--raft_admission_max_outstanding_bytes.");
+METRIC_DEFINE_counter(
+    server,
+    raft_witness_stripped_payload_bytes,
+    "Witness Stripped Payload Bytes",
+    kudu::MetricUnit::kBytes,
+    "Number of bytes of write op payloads left out of the log while a witness, "
+    "see --raft_witness_strip_payloads.");
+METRIC_DEFINE_counter(
+    server,
+    raft_removed_peers_filter_negatives,
+    "Removed Peers Filter Negatives",
+    kudu::MetricUnit::kRequests,
+    "Number of vote requests from peers outside the config that the bloom "
+    "filter of removed peers showed were never removed.");
+METRIC_DEFINE_counter(
+    server,
+    raft_removed_peers_filter_false_positives,
+    "Removed Peers Filter False Positives",
+    kudu::MetricUnit::kRequests,
+    "Number of vote requests from peers outside the config that the bloom "
+    "filter of removed peers let through, but that weren't removed. Compare "
+    "with raft_removed_peers_filter_negatives for the false positive rate.");
+METRIC_DEFINE_counter(
+    server,
+    raft_vote_requests_denied_without_lock,
+    "Vote Requests Denied Without Lock",
+    kudu::MetricUnit::kRequests,
+    "Number of vote requests denied from the published voter state, because "
+    "a leader was believed to be alive or the candidate was behind our term, "
+    "without taking the Raft locks.");
+METRIC_DEFINE_counter(
+    server,
+    raft_vote_requests_denied_from_cache,
+    "Vote Requests Denied From Cache",
+    kudu::MetricUnit::kRequests,
+    "Number of repeated vote requests answered with the denial cached for "
+    "their candidate, without taking the Raft locks. See "
+    "--raft_vote_denial_cache_ms.");
+METRIC_DEFINE_counter(
+    server,
+    raft_leadership_reclaims,
+    "Leadership Reclaims",
+    kudu::MetricUnit::kRequests,
+    "Number of leadership transfers started by a leader to a voter of a "
+    "higher election priority. See --raft_priority_leader_reclaim.");
+METRIC_DEFINE_counter(
+    server,
+    raft_snapshots_installed,
+    "Snapshots Installed",
+    kudu::MetricUnit::kUnits,
+    "Number of snapshots of the state machine installed from the leader "
+    "because this replica was behind the leader's log.");
+METRIC_DEFINE_gauge_int64(
+    server,
+    raft_replication_throttled,
+    "Replication Throttled",
+    kudu::MetricUnit::kUnits,
+    "1 if the last call to replicate new ops was rejected due to memory "
+    "pressure, 0 otherwise.");
 METRIC_DEFINE_gauge_int64(
     server,
     raft_term,
@@ -295,6 +765,163 @@ METRIC_DEFINE_gauge_int64(
     "Number of failed elections on this node since there was a stable "
     "leader. This number increments on each failed election and resets on "
     "each successful one.");
+METRIC_DEFINE_histogram(
+    server,
+    raft_pre_election_duration,
+    "Pre-Election Duration",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds from the start of a pre-election on this node until it "
+    "was decided.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    raft_pool_token_queue_length,
+    "Raft Thread Pool Token Queue Length",
+    kudu::MetricUnit::kTasks,
+    "Number of tasks of the Raft group queued in the Raft thread pool when a "
+    "task is submitted.",
+    10000,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    raft_pool_token_queue_time,
+    "Raft Thread Pool Token Queue Time",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds the tasks of the Raft group spent waiting in the Raft "
+    "thread pool queue.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    raft_pool_token_run_time,
+    "Raft Thread Pool Token Run Time",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds the tasks of the Raft group spent running on the Raft "
+    "thread pool.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    raft_election_duration,
+    "Election Duration",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds from the start of an election on this node until it was "
+    "decided.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    raft_failover_detection_duration,
+    "Failover Detection Duration",
+    kudu::MetricUnit::kMicroseconds,
+    "For failovers this node won, microseconds from its last contact with "
+    "the old leader until its failure detector fired.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    raft_leader_transfer_write_pause_duration,
+    "Leader Transfer Write Pause Duration",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds a leader rejected writes for a leadership transfer, until "
+    "it stepped down or the transfer period ended. See "
+    "--raft_fast_leader_transfer.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    raft_failover_pre_election_duration,
+    "Failover Pre-Election Duration",
+    kudu::MetricUnit::kMicroseconds,
+    "For failovers this node won, microseconds from its failure detector "
+    "firing until it started the election it won, including any failed "
+    "pre-elections and elections before it.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    raft_failover_election_duration,
+    "Failover Election Duration",
+    kudu::MetricUnit::kMicroseconds,
+    "For failovers this node won, microseconds from the start of the "
+    "election it won until it became leader.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    raft_failover_noop_commit_duration,
+    "Failover No-Op Commit Duration",
+    kudu::MetricUnit::kMicroseconds,
+    "For failovers this node won, microseconds from becoming leader until "
+    "the NO_OP of its term was committed.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    raft_failover_first_commit_duration,
+    "Failover First Commit Duration",
+    kudu::MetricUnit::kMicroseconds,
+    "For failovers this node won, microseconds from the commit of the NO_OP "
+    "of its term until the commit of the first op after it.",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    raft_failover_duration,
+    "Failover Duration",
+    kudu::MetricUnit::kMicroseconds,
+    "For failovers this node won, microseconds from its last contact with "
+    "the old leader until it committed the first op after the NO_OP of its "
+    "term. The sum of the raft_failover_*_duration phases.",
+    60000000LU,
+    2);
+METRIC_DEFINE_counter(
+    server,
+    raft_compression_dicts_trained,
+    "Raft Compression Dictionaries Trained",
+    kudu::MetricUnit::kUnits,
+    "Number of compression dictionaries trained by this replica while "
+    "leader.");
+METRIC_DEFINE_counter(
+    server,
+    raft_compression_dicts_rolled_out,
+    "Raft Compression Dictionaries Rolled Out",
+    kudu::MetricUnit::kUnits,
+    "Number of trained compression dictionaries which compressed better "
+    "than the current one, and were rolled out to the peers.");
+METRIC_DEFINE_gauge_int64(
+    server,
+    log_retention_held_bytes,
+    "Log Bytes Retained For Peers",
+    kudu::MetricUnit::kBytes,
+    "Bytes of WAL retained only to catch up lagging peers, as of the last "
+    "decision of --log_retention_policy_enabled.");
+METRIC_DEFINE_gauge_int64(
+    server,
+    log_retention_abandoned_peers,
+    "Peers Abandoned By Log Retention",
+    kudu::MetricUnit::kUnits,
+    "Number of lagging peers the WAL is not retained for, as of the last "
+    "decision of --log_retention_policy_enabled.");
+METRIC_DEFINE_histogram(
+    server,
+    raft_compression_queue_depth,
+    "Raft Compression Queue Depth",
+    kudu::MetricUnit::kMessages,
+    "Number of msgs of all Raft groups waiting on, or being compressed by, "
+    "the compression pool when a batch is handed to it.",
+    100000,
+    2);
+METRIC_DEFINE_histogram(
+    server,
+    raft_compression_time,
+    "Raft Compression Time",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds spent compressing the msgs of a batch on the compression "
+    "pool.",
+    60000000LU,
+    2);
 METRIC_DEFINE_gauge_int64(
     server,
     time_since_last_leader_heartbeat,
@@ -318,6 +945,23 @@ METRIC_DEFINE_counter(
     "Number of RPC requests (not events) delivered to the next hop without any "
     "problems. This may include requests where only a subset of events were "
     "delivered.");
+METRIC_DEFINE_counter(
+    server,
+    raft_proxy_num_requests_full_forward,
+    "Number of RPC requests whose events were all reconstituted",
+    kudu::MetricUnit::kRequests,
+    "Number of RPC requests for which every proxied event was found in the "
+    "local log and forwarded to the destination.");
+METRIC_DEFINE_counter(
+    server,
+    raft_proxy_num_requests_partial_forward,
+    "Number of RPC requests of which only a prefix of events was reconstituted",
+    kudu::MetricUnit::kRequests,
+    "Number of RPC requests for which only a prefix of the proxied events "
+    "could be served from the local log and forwarded to the destination, "
+    "eg. because the proxy is catching up or the batch exceeded "
+    "--consensus_max_batch_size_bytes. Requests degraded to heartbeats are "
+    "not included.");
 METRIC_DEFINE_counter(
     server,
     raft_proxy_num_requests_unknown_dest,
@@ -325,6 +969,13 @@ METRIC_DEFINE_counter(
     kudu::MetricUnit::kRequests,
     "Number of RPC requests received that could not be "
     "delivered because the destination node was unroutable.");
+METRIC_DEFINE_counter(
+    server,
+    raft_proxy_num_requests_expired,
+    "Number of RPC requests dropped past their caller's deadline",
+    kudu::MetricUnit::kRequests,
+    "Number of RPC requests received that were not forwarded to the next "
+    "hop because the caller had already given up on them.");
 METRIC_DEFINE_counter(
     server,
     raft_proxy_num_requests_log_read_timeout,
@@ -379,10 +1030,18 @@ RaftConsensus::RaftConsensus(
       persistent_vars_manager_(std::move(persistent_vars_manager)),
       raft_pool_(raft_pool),
       state_(kNew),
+      state_version_(0),
       proxy_policy_(options_.proxy_policy),
       rng_(GetRandomSeed32()),
+      leader_heartbeats_(
+          FLAGS_raft_phi_accrual_window_size,
+          FLAGS_raft_phi_accrual_min_samples,
+          MonoDelta::FromMilliseconds(FLAGS_raft_phi_accrual_min_stddev_ms)),
       leader_transfer_in_progress_(false),
       withhold_votes_until_(MonoTime::Min()),
+      withhold_votes_until_nanos_(0),
+      defer_cmeta_flushes_(false),
+      deferred_cmeta_flush_version_(0),
       reject_append_entries_(false),
       adjust_voter_distribution_(true),
       withhold_votes_(false),
@@ -390,11 +1049,27 @@ RaftConsensus::RaftConsensus(
       failed_elections_since_stable_leader_(0),
       failed_elections_candidate_not_in_config_(0),
       disable_noop_(false),
+      voter_rtt_tracker_(std::make_shared<VoterRttTracker>()),
       shutdown_(false),
       update_calls_for_tests_(0) {
   DCHECK(local_peer_pb_.has_permanent_uuid());
+  log_prefix_thread_safe_ =
+      Substitute("T $0 P $1: ", options_.tablet_id, peer_uuid());
   DCHECK(cmeta_manager_ != NULL);
   DCHECK(persistent_vars_manager_ != NULL);
+  if (FLAGS_raft_admission_max_outstanding_bytes > 0 ||
+      FLAGS_raft_admission_tenant_ops_per_sec > 0 ||
+      FLAGS_raft_admission_tenant_bytes_per_sec > 0) {
+    ReplicateAdmissionController::Options admission;
+    admission.max_outstanding_bytes =
+        FLAGS_raft_admission_max_outstanding_bytes;
+    admission.ops_per_sec = FLAGS_raft_admission_tenant_ops_per_sec;
+    admission.bytes_per_sec = FLAGS_raft_admission_tenant_bytes_per_sec;
+    CHECK_OK(ReplicateAdmissionController::ParseWeights(
+        FLAGS_raft_admission_tenant_weights, &admission.weights));
+    admission_controller_.reset(
+        new ReplicateAdmissionController(std::move(admission)));
+  }
 }
 
 Status RaftConsensus::Init() {
@@ -455,6 +1130,33 @@ Status RaftConsensus::Create(
   return Status::OK();
 }
 
+namespace {
+
+// Returns the pool applying the committed rounds of all Raft groups, or null
+// if --raft_apply_pipeline_threads is 0.
+ThreadPool* ApplyPool() {
+  static ThreadPool* const pool = []() -> ThreadPool* {
+    const int num_threads = FLAGS_raft_apply_pipeline_threads;
+    if (num_threads <= 0) {
+      return nullptr;
+    }
+    gscoped_ptr<ThreadPool> new_pool;
+    Status s = ThreadPoolBuilder("raft-apply")
+                   .set_min_threads(0)
+                   .set_max_threads(num_threads)
+                   .Build(&new_pool);
+    if (!s.ok()) {
+      LOG(WARNING) << "Could not create the apply pool, applying committed "
+                   << "rounds inline: " << s.ToString();
+      return nullptr;
+    }
+    return new_pool.release();
+  }();
+  return pool;
+}
+
+} // anonymous namespace
+
 Status RaftConsensus::Start(
     const ConsensusBootstrapInfo& info,
     gscoped_ptr<PeerProxyFactory> peer_proxy_factory,
@@ -478,11 +1180,62 @@ Status RaftConsensus::Start(
 
   raft_log_truncation_counter_ =
       metric_entity->FindOrCreateCounter(&METRIC_raft_log_truncation_counter);
+  pre_election_duration_ =
+      METRIC_raft_pre_election_duration.Instantiate(metric_entity);
+  election_duration_ = METRIC_raft_election_duration.Instantiate(metric_entity);
+  transfer_write_pause_duration_ =
+      METRIC_raft_leader_transfer_write_pause_duration.Instantiate(
+          metric_entity);
+  failover_detection_duration_ =
+      METRIC_raft_failover_detection_duration.Instantiate(metric_entity);
+  failover_pre_election_duration_ =
+      METRIC_raft_failover_pre_election_duration.Instantiate(metric_entity);
+  failover_election_duration_ =
+      METRIC_raft_failover_election_duration.Instantiate(metric_entity);
+  failover_noop_commit_duration_ =
+      METRIC_raft_failover_noop_commit_duration.Instantiate(metric_entity);
+  failover_first_commit_duration_ =
+      METRIC_raft_failover_first_commit_duration.Instantiate(metric_entity);
+  failover_duration_ =
+      METRIC_raft_failover_duration.Instantiate(metric_entity);
+  compression_queue_depth_ =
+      METRIC_raft_compression_queue_depth.Instantiate(metric_entity);
+  compression_time_ = METRIC_raft_compression_time.Instantiate(metric_entity);
+  compression_dicts_trained_ =
+      METRIC_raft_compression_dicts_trained.Instantiate(metric_entity);
+  compression_dicts_rolled_out_ =
+      METRIC_raft_compression_dicts_rolled_out.Instantiate(metric_entity);
+  log_retention_held_bytes_ =
+      metric_entity->FindOrCreateGauge(&METRIC_log_retention_held_bytes, 0L);
+  log_retention_abandoned_peers_ = metric_entity->FindOrCreateGauge(
+      &METRIC_log_retention_abandoned_peers, 0L);
 
   term_metric_ =
       metric_entity->FindOrCreateGauge(&METRIC_raft_term, CurrentTerm());
   follower_memory_pressure_rejections_ = metric_entity->FindOrCreateCounter(
       &METRIC_follower_memory_pressure_rejections);
+  follower_early_acked_updates_ = metric_entity->FindOrCreateCounter(
+      &METRIC_follower_early_acked_updates);
+  leader_memory_pressure_rejections_ = metric_entity->FindOrCreateCounter(
+      &METRIC_leader_memory_pressure_rejections);
+  leader_admission_rejections_ = metric_entity->FindOrCreateCounter(
+      &METRIC_leader_admission_rejections);
+  witness_stripped_payload_bytes_ = metric_entity->FindOrCreateCounter(
+      &METRIC_raft_witness_stripped_payload_bytes);
+  removed_peers_filter_negatives_ = metric_entity->FindOrCreateCounter(
+      &METRIC_raft_removed_peers_filter_negatives);
+  removed_peers_filter_false_positives_ = metric_entity->FindOrCreateCounter(
+      &METRIC_raft_removed_peers_filter_false_positives);
+  vote_requests_denied_without_lock_ = metric_entity->FindOrCreateCounter(
+      &METRIC_raft_vote_requests_denied_without_lock);
+  vote_requests_denied_from_cache_ = metric_entity->FindOrCreateCounter(
+      &METRIC_raft_vote_requests_denied_from_cache);
+  snapshots_installed_ =
+      metric_entity->FindOrCreateCounter(&METRIC_raft_snapshots_installed);
+  leadership_reclaims_ =
+      metric_entity->FindOrCreateCounter(&METRIC_raft_leadership_reclaims);
+  replication_throttled_ =
+      metric_entity->FindOrCreateGauge(&METRIC_raft_replication_throttled, 0L);
 
   num_failed_elections_metric_ = metric_entity->FindOrCreateGauge(
       &METRIC_failed_elections_since_stable_leader,
@@ -500,6 +1253,11 @@ Status RaftConsensus::Start(
       &METRIC_raft_proxy_num_requests_received);
   raft_proxy_num_requests_success_ = metric_entity->FindOrCreateCounter(
       &METRIC_raft_proxy_num_requests_success);
+  raft_proxy_num_requests_full_forward_ = metric_entity->FindOrCreateCounter(
+      &METRIC_raft_proxy_num_requests_full_forward);
+  raft_proxy_num_requests_partial_forward_ =
+      metric_entity->FindOrCreateCounter(
+          &METRIC_raft_proxy_num_requests_partial_forward);
   raft_proxy_num_requests_unknown_dest_ = metric_entity->FindOrCreateCounter(
       &METRIC_raft_proxy_num_requests_unknown_dest);
   raft_proxy_num_requests_log_read_timeout_ =
@@ -508,13 +1266,18 @@ Status RaftConsensus::Start(
   raft_proxy_num_requests_hops_remaining_exhausted_ =
       metric_entity->FindOrCreateCounter(
           &METRIC_raft_proxy_num_requests_hops_remaining_exhausted);
+  raft_proxy_num_requests_expired_ = metric_entity->FindOrCreateCounter(
+      &METRIC_raft_proxy_num_requests_expired);
 
   // A single Raft thread pool token is shared between RaftConsensus and
   // PeerManager. Because PeerManager is owned by RaftConsensus, it receives a
   // raw pointer to the token, to emphasize that RaftConsensus is responsible
   // for destroying the token.
-  raft_pool_token_ =
-      raft_pool_->NewToken(ThreadPool::ExecutionMode::CONCURRENT);
+  raft_pool_token_ = raft_pool_->NewTokenWithMetrics(
+      ThreadPool::ExecutionMode::CONCURRENT,
+      {METRIC_raft_pool_token_queue_length.Instantiate(metric_entity),
+       METRIC_raft_pool_token_queue_time.Instantiate(metric_entity),
+       METRIC_raft_pool_token_run_time.Instantiate(metric_entity)});
 
   // The message queue that keeps track of which operations need to be
   // replicated where.
@@ -537,6 +1300,14 @@ Status RaftConsensus::Start(
       info.last_id,
       info.last_committed_id));
 
+  queue->SetSnapshotProvider(snapshot_provider_);
+  queue->SetDurabilityMode(options_.durability_mode);
+
+  // Reads from the log ahead of lagging peers get a token of their own too,
+  // so that they don't hold up the observers.
+  queue->log_cache()->SetPrefetchToken(
+      raft_pool_->NewToken(ThreadPool::ExecutionMode::SERIAL));
+
   // Proxy failure threshold is set to "2 * leader failure timeout" which
   // is roughly equivalent to 3000 ms
   queue->SetProxyFailureThreshold(
@@ -554,6 +1325,35 @@ Status RaftConsensus::Start(
   unique_ptr<PendingRounds> pending(
       new PendingRounds(LogPrefixThreadSafe(), time_manager_));
 
+  if (ThreadPool* apply_pool = ApplyPool()) {
+    ConsensusRoundHandler* handler = round_handler_;
+    apply_pipeline_.reset(new ApplyPipeline(
+        apply_pool,
+        FLAGS_raft_apply_pipeline_threads,
+        FLAGS_raft_apply_pipeline_max_batch_size,
+        [handler](const vector<scoped_refptr<ConsensusRound>>& rounds) {
+          handler->ApplyCommittedRounds(rounds);
+        },
+        metric_entity));
+  }
+
+  PendingRounds* pending_rounds = pending.get();
+  log_subscriptions_.reset(new LogSubscriptionManager(
+      LogPrefixThreadSafe(),
+      queue->log_cache(),
+      [pending_rounds]() {
+        return pending_rounds->GetPublishedCommittedIndex();
+      },
+      [pending_rounds](int64_t index, const MonoTime& deadline) {
+        return pending_rounds->WaitForCommittedIndex(index, deadline);
+      },
+      metric_entity));
+
+  WARN_NOT_OK(
+      WorkloadCapture::Create(
+          Env::Default(), options_.tablet_id, peer_uuid(), &workload_capture_),
+      "could not start capturing the consensus workload");
+
   // Capture a weak_ptr reference into the functor so it can safely handle
   // outliving the consensus instance.
   weak_ptr<RaftConsensus> w = shared_from_this();
@@ -578,6 +1378,30 @@ Status RaftConsensus::Start(
       MinimumElectionTimeout(),
       opts);
 
+  if (FLAGS_raft_warm_peer_connections_interval_ms > 0) {
+    connection_warmer_ = PeriodicTimer::Create(
+        peer_proxy_factory_->messenger(),
+        [w]() {
+          if (auto consensus = w.lock()) {
+            consensus->WarmPeerConnections();
+          }
+        },
+        MonoDelta::FromMilliseconds(
+            FLAGS_raft_warm_peer_connections_interval_ms));
+  }
+
+  if (FLAGS_raft_compression_dict_training_interval_ms > 0) {
+    compression_dict_trainer_ = PeriodicTimer::Create(
+        peer_proxy_factory_->messenger(),
+        [w]() {
+          if (auto consensus = w.lock()) {
+            consensus->TrainCompressionDict();
+          }
+        },
+        MonoDelta::FromMilliseconds(
+            FLAGS_raft_compression_dict_training_interval_ms));
+  }
+
   {
     ThreadRestrictions::AssertWaitAllowed();
     LockGuard l(lock_);
@@ -649,7 +1473,15 @@ Status RaftConsensus::Start(
     // Now assume non-leader replica duties.
     RETURN_NOT_OK(BecomeReplicaUnlocked(fd_initial_delta));
 
+    // We may have heard from a leader just before restarting, and that
+    // leader may be counting on us not to vote for anyone else for a while.
+    if (FLAGS_enable_leader_leases && CurrentTermUnlocked() > 0) {
+      SetWithholdVotesUntilUnlocked(
+          MonoTime::Now() + MinimumElectionTimeout());
+    }
+
     SetStateUnlocked(kRunning);
+    PublishVoterStateUnlocked();
   }
 
   if (IsSingleVoterConfig() && FLAGS_enable_leader_failure_detection) {
@@ -660,6 +1492,17 @@ Status RaftConsensus::Start(
         {INITIAL_SINGLE_NODE_ELECTION, std::chrono::system_clock::now()}));
   }
 
+  if (connection_warmer_) {
+    connection_warmer_->Start();
+    WarmPeerConnections();
+  }
+
+  if (compression_dict_trainer_) {
+    queue_->log_cache()->SetPayloadSampling(
+        FLAGS_raft_compression_dict_sample_bytes);
+    compression_dict_trainer_->Start();
+  }
+
   // Report become visible to the Master.
   MarkDirty("RaftConsensus started");
 
@@ -739,6 +1582,10 @@ Status RaftConsensus::StartElection(
       "mode",
       mode_str);
   scoped_refptr<LeaderElection> election;
+  // Should we bail out after voting for ourselves, the vote still gets
+  // persisted.
+  uint64_t cmeta_flush_version = 0;
+  SCOPED_CLEANUP({ FlushDeferredCmeta(cmeta_flush_version); });
   {
     ThreadRestrictions::AssertWaitAllowed();
     LockGuard l(lock_);
@@ -807,9 +1654,17 @@ Status RaftConsensus::StartElection(
 
       // We skip flushing the term to disk because setting the vote just below
       // also flushes to disk, and the double fsync doesn't buy us anything.
+      // That flush is deferred until 'lock_' is released, but happens before
+      // any vote request is sent out.
       RETURN_NOT_OK(HandleTermAdvanceUnlocked(
           CurrentTermUnlocked() + 1, SKIP_FLUSH_TO_DISK));
-      RETURN_NOT_OK(SetVotedForCurrentTermUnlocked(peer_uuid()));
+      DeferCmetaFlushesUnlocked();
+      Status s = SetVotedForCurrentTermUnlocked(peer_uuid());
+      cmeta_flush_version = EndDeferCmetaFlushesUnlocked();
+      RETURN_NOT_OK(s);
+    }
+    if (mode == NORMAL_ELECTION && failover_.detected.Initialized()) {
+      failover_.election_started = MonoTime::Now();
     }
 
     RaftConfigPB active_config = cmeta_->ActiveConfig();
@@ -926,10 +1781,13 @@ Status RaftConsensus::StartElection(
             std::move(context),
             std::placeholders::_1,
             std::move(callback)),
-        vote_logger_));
+        vote_logger_,
+        voter_rtt_tracker_));
   }
 
-  // Start the election outside the lock.
+  // Persist the term and vote, then start the election outside the lock.
+  FlushDeferredCmeta(cmeta_flush_version);
+  cmeta_flush_version = 0;
   election->Run();
 
   return Status::OK();
@@ -1129,9 +1987,17 @@ Status RaftConsensus::BeginLeaderTransferPeriodUnlocked(
         "leadership transfer for $0 already in progress", options_.tablet_id));
   }
   leader_transfer_in_progress_.Store(true, kMemOrderAcquire);
+  const bool fast = FLAGS_raft_fast_leader_transfer;
+  fast_leader_transfer_.Store(fast);
+  if (!fast) {
+    StartTransferWritePause();
+  }
 
   queue_->BeginWatchForSuccessor(
-      successor_uuid, filter_fn, election_ctx.TransferContext());
+      successor_uuid,
+      filter_fn,
+      election_ctx.TransferContext(),
+      /*prioritize_successor=*/fast);
 
   transfer_period_timer_->Start();
   return Status::OK();
@@ -1140,7 +2006,44 @@ Status RaftConsensus::BeginLeaderTransferPeriodUnlocked(
 void RaftConsensus::EndLeaderTransferPeriod() {
   transfer_period_timer_->Stop();
   queue_->EndWatchForSuccessor();
+  if (leader_transfer_in_progress_.Load()) {
+    // The successor may still be holding an election which the voters don't
+    // withhold their votes from, so the acks seen so far say nothing about the
+    // lease.
+    queue_->RevokeLeaderLease(MinimumElectionTimeout());
+  }
   leader_transfer_in_progress_.Store(false, kMemOrderRelease);
+  EndTransferWritePause();
+}
+
+bool RaftConsensus::LeaderTransferPausesWritesUnlocked() const {
+  DCHECK(lock_.is_locked());
+  if (fast_leader_transfer_.Load() &&
+      !queue_->SuccessorWithinLag(
+          FLAGS_raft_fast_leader_transfer_pause_lag_ops)) {
+    return false;
+  }
+  StartTransferWritePause();
+  return true;
+}
+
+void RaftConsensus::StartTransferWritePause() const {
+  std::lock_guard<simple_spinlock> l(transfer_pause_lock_);
+  if (!transfer_paused_at_.Initialized()) {
+    transfer_paused_at_ = MonoTime::Now();
+  }
+}
+
+void RaftConsensus::EndTransferWritePause() {
+  MonoTime paused_at;
+  {
+    std::lock_guard<simple_spinlock> l(transfer_pause_lock_);
+    std::swap(paused_at, transfer_paused_at_);
+  }
+  if (paused_at.Initialized()) {
+    transfer_write_pause_duration_->Increment(
+        (MonoTime::Now() - paused_at).ToMicroseconds());
+  }
 }
 
 scoped_refptr<ConsensusRound> RaftConsensus::NewRound(
@@ -1160,6 +2063,13 @@ void RaftConsensus::ReportFailureDetectedTask() {
   std::unique_lock<simple_mutexlock> try_lock(
       failure_detector_election_lock_, std::try_to_lock);
   if (try_lock.owns_lock()) {
+    StartFailoverTimeline(
+        MonoDelta::FromMicroseconds(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now() -
+                failure_detector_last_snoozed_)
+                .count()));
+
     // failure_detector_last_snoozed_ is the time the failure detector was
     // active from. Adding 1 heartbeat gives a proxy to first heartbeat failure
     std::chrono::system_clock::time_point failureTime =
@@ -1170,23 +2080,148 @@ void RaftConsensus::ReportFailureDetectedTask() {
       // heartbeat interval. Reset the failure time if so
       failureTime = std::chrono::system_clock::now();
     }
+    // The adaptive timeout may suspect a leader which is merely slow, which
+    // a pre-election doesn't depose.
     WARN_NOT_OK(
         StartElection(
-            FLAGS_raft_enable_pre_election ? PRE_ELECTION : NORMAL_ELECTION,
+            FLAGS_raft_enable_pre_election || failure_detector_adaptive_
+                ? PRE_ELECTION
+                : NORMAL_ELECTION,
             {ELECTION_TIMEOUT_EXPIRED, failureTime}),
         LogPrefixThreadSafe() + "failed to trigger leader election");
   }
 }
 
+void RaftConsensus::StartFailoverTimeline(MonoDelta since_leader_contact) {
+  ThreadRestrictions::AssertWaitAllowed();
+  LockGuard l(lock_);
+  // Retries after failed elections are part of the same failover.
+  if (failover_.detected.Initialized()) {
+    return;
+  }
+  failover_.detection = since_leader_contact;
+  failover_.detected = MonoTime::Now();
+}
+
+void RaftConsensus::RecordFailoverCommitUnlocked(int64_t commit_index) {
+  DCHECK(lock_.is_locked());
+  // Only a failover this replica ends up leading is timed to the end.
+  if (PREDICT_TRUE(!failover_.became_leader.Initialized()) ||
+      failover_.noop_index < 0 || commit_index < failover_.noop_index) {
+    return;
+  }
+  MonoTime now = MonoTime::Now();
+  if (!failover_.noop_committed.Initialized()) {
+    failover_.noop_committed = now;
+    if (failover_noop_commit_duration_) {
+      failover_noop_commit_duration_->Increment(
+          (now - failover_.became_leader).ToMicroseconds());
+    }
+  }
+  if (commit_index == failover_.noop_index) {
+    return;
+  }
+  if (failover_first_commit_duration_) {
+    failover_first_commit_duration_->Increment(
+        (now - failover_.noop_committed).ToMicroseconds());
+    failover_duration_->Increment(
+        failover_.detection.ToMicroseconds() +
+        (now - failover_.detected).ToMicroseconds());
+  }
+  failover_ = FailoverTimeline();
+}
+
 void RaftConsensus::ReportFailureDetected() {
   // We're running on a timer thread; start an election on a different thread
   // pool.
   WARN_NOT_OK(
-      raft_pool_token_->SubmitFunc(std::bind(
-          &RaftConsensus::ReportFailureDetectedTask, shared_from_this())),
+      raft_pool_token_->SubmitFunc(
+          std::bind(
+              &RaftConsensus::ReportFailureDetectedTask, shared_from_this()),
+          ThreadPool::Priority::HIGH),
       LogPrefixThreadSafe() + "failed to submit failure detected task");
 }
 
+void RaftConsensus::WarmPeerConnections() {
+  // Making proxies resolves addresses, which mustn't block the timer's
+  // reactor thread.
+  WARN_NOT_OK(
+      raft_pool_token_->SubmitFunc(std::bind(
+          &RaftConsensus::WarmPeerConnectionsTask, shared_from_this())),
+      LogPrefixThreadSafe() + "failed to submit connection warming task");
+}
+
+void RaftConsensus::WarmPeerConnectionsTask() {
+  RaftConfigPB config;
+  {
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    // A leader's peers already heartbeat every member of the config.
+    if (state_ != kRunning || cmeta_->active_role() == RaftPeerPB::LEADER) {
+      return;
+    }
+    config = cmeta_->CommittedConfig();
+  }
+
+  struct Ping {
+    rpc::RpcController controller;
+    GetNodeInstanceResponsePB response;
+    shared_ptr<PeerProxy> proxy;
+  };
+  for (const RaftPeerPB& peer_pb : config.peers()) {
+    if (peer_pb.permanent_uuid() == peer_uuid() ||
+        !peer_pb.has_last_known_addr()) {
+      continue;
+    }
+    const string addr = SecureShortDebugString(peer_pb.last_known_addr());
+    shared_ptr<PeerProxy> proxy;
+    {
+      std::lock_guard<simple_spinlock> l(warm_peer_proxies_lock_);
+      auto* entry = FindOrNull(warm_peer_proxies_, peer_pb.permanent_uuid());
+      if (entry && entry->first == addr) {
+        proxy = entry->second;
+      }
+    }
+    if (!proxy) {
+      Status s = peer_proxy_factory_->NewProxy(peer_pb, &proxy);
+      if (!s.ok()) {
+        VLOG_WITH_PREFIX(1) << "Could not create proxy to "
+                            << peer_pb.permanent_uuid() << ": "
+                            << s.ToString();
+        continue;
+      }
+      std::lock_guard<simple_spinlock> l(warm_peer_proxies_lock_);
+      warm_peer_proxies_[peer_pb.permanent_uuid()] =
+          std::make_pair(addr, proxy);
+    }
+
+    // The ping holds a reference to its proxy until it completes.
+    Ping* ping = new Ping();
+    ping->proxy = proxy;
+    ping->controller.set_timeout(
+        MonoDelta::FromMilliseconds(FLAGS_consensus_rpc_timeout_ms));
+    string prefix = LogPrefixThreadSafe();
+    proxy->PingAsync(&ping->response, &ping->controller, [ping, prefix]() {
+      Status s = ping->controller.status();
+      if (!s.ok()) {
+        VLOG(1) << prefix << "Warming connection to "
+                << ping->proxy->PeerName() << " failed: " << s.ToString();
+      }
+      delete ping;
+    });
+  }
+
+  // Forget proxies of peers that have left the config.
+  std::lock_guard<simple_spinlock> l(warm_peer_proxies_lock_);
+  for (auto it = warm_peer_proxies_.begin(); it != warm_peer_proxies_.end();) {
+    if (!IsRaftConfigMember(it->first, config)) {
+      it = warm_peer_proxies_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
 Status RaftConsensus::BecomeLeaderUnlocked() {
   DCHECK(lock_.is_locked());
 
@@ -1204,15 +2239,35 @@ Status RaftConsensus::BecomeLeaderUnlocked() {
   DisableFailureDetector();
 
   // Don't vote for anyone if we're a leader.
-  withhold_votes_until_ = MonoTime::Max();
+  SetWithholdVotesUntilUnlocked(MonoTime::Max());
 
   // Leadership never starts in a transfer period.
   EndLeaderTransferPeriod();
+  next_leadership_reclaim_ = MonoTime::Now() +
+      MonoDelta::FromMilliseconds(FLAGS_raft_priority_leader_reclaim_delay_ms);
 
   queue_->RegisterObserver(this);
   RETURN_NOT_OK(RefreshConsensusQueueAndPeersUnlocked());
 
+  if (failover_.election_started.Initialized()) {
+    MonoTime now = MonoTime::Now();
+    if (failover_detection_duration_) {
+      failover_detection_duration_->Increment(
+          failover_.detection.ToMicroseconds());
+      failover_pre_election_duration_->Increment(
+          (failover_.election_started - failover_.detected).ToMicroseconds());
+      failover_election_duration_->Increment(
+          (now - failover_.election_started).ToMicroseconds());
+    }
+    failover_.became_leader = now;
+  } else {
+    // Became leader without a failover, e.g. through a leadership transfer.
+    failover_ = FailoverTimeline();
+  }
+
   if (disable_noop_) {
+    // Without a NO_OP there is nothing further to time.
+    failover_ = FailoverTimeline();
     return Status::OK();
   }
 
@@ -1236,7 +2291,11 @@ Status RaftConsensus::BecomeLeaderUnlocked() {
 
   last_leader_communication_time_micros_ = 0;
 
-  return AppendNewRoundToQueueUnlocked(round);
+  RETURN_NOT_OK(AppendNewRoundToQueueUnlocked(round));
+  if (failover_.became_leader.Initialized()) {
+    failover_.noop_index = round->id().index();
+  }
+  return Status::OK();
 }
 
 Status RaftConsensus::BecomeReplicaUnlocked(
@@ -1246,50 +2305,151 @@ Status RaftConsensus::BecomeReplicaUnlocked(
   LOG_WITH_PREFIX_UNLOCKED(INFO)
       << "Becoming Follower/Learner. State: " << ToStringUnlocked();
   ClearLeaderUnlocked();
+  if (failover_.became_leader.Initialized()) {
+    // Stepped down before committing anything for a client.
+    failover_ = FailoverTimeline();
+  }
 
   // Enable/disable leader failure detection if becoming VOTER/NON_VOTER replica
   // correspondingly.
   UpdateFailureDetectorState(std::move(fd_delta));
 
   // Now that we're a replica, we can allow voting for other nodes.
-  withhold_votes_until_ = MonoTime::Min();
+  SetWithholdVotesUntilUnlocked(MonoTime::Min());
 
   // Deregister ourselves from the queue. We no longer need to track what gets
   // replicated since we're stepping down.
   queue_->UnRegisterObserver(this);
   queue_->SetNonLeaderMode(cmeta_->ActiveConfig());
   peer_manager_->Close();
+  // Clients go to the new leader from here on.
+  EndTransferWritePause();
 
   return Status::OK();
 }
 
 Status RaftConsensus::Replicate(const scoped_refptr<ConsensusRound>& round) {
+  MonoTime replicate_start = MonoTime::Now();
   std::lock_guard<simple_mutexlock> lock(update_lock_);
   {
     ThreadRestrictions::AssertWaitAllowed();
     LockGuard l(lock_);
     RETURN_NOT_OK(CheckSafeToReplicateUnlocked(*round->replicate_msg()));
     RETURN_NOT_OK(round->CheckBoundTerm(CurrentTermUnlocked()));
-    RETURN_NOT_OK(AppendNewRoundToQueueUnlocked(round));
+    // Config changes may be what frees the memory, e.g. by removing a dead
+    // follower.
+    if (round->replicate_msg()->op_type() != CHANGE_CONFIG_OP) {
+      RETURN_NOT_OK(CheckMemoryPressureUnlocked());
+      RETURN_NOT_OK(AdmitRoundUnlocked(round.get(), replicate_start));
+    }
+    Status s = AppendNewRoundToQueueUnlocked(round, replicate_start);
+    if (PREDICT_FALSE(!s.ok())) {
+      round->ReleaseAdmission();
+      return s;
+    }
   }
 
   peer_manager_->SignalRequest();
   return Status::OK();
 }
 
-Status RaftConsensus::TruncateCallbackWithRaftLock(
-    int64_t* index_if_truncated) {
-  DCHECK(FLAGS_raft_derived_log_mode);
-  ThreadRestrictions::AssertWaitAllowed();
-  LockGuard l(lock_);
-  RETURN_NOT_OK(CheckRunningUnlocked());
-
-  // We pass -1 to TruncateOpsAfter in the log abstraction
-  // It is the responsibility of the derived log to truncate from
-  // the cached truncation index and clear it.
-  RETURN_NOT_OK(log_->TruncateOpsAfter(-1, index_if_truncated));
-
-  if (index_if_truncated && *index_if_truncated != -1) {
+Status RaftConsensus::ReplicateBatch(
+    const vector<scoped_refptr<ConsensusRound>>& rounds) {
+  if (rounds.empty()) {
+    return Status::OK();
+  }
+  MonoTime replicate_start = MonoTime::Now();
+  Status s;
+  {
+    std::lock_guard<simple_mutexlock> lock(update_lock_);
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    for (const auto& round : rounds) {
+      if (PREDICT_FALSE(
+              round->replicate_msg()->op_type() == CHANGE_CONFIG_OP)) {
+        return Status::InvalidArgument(
+            "config changes can't be replicated in a batch");
+      }
+      RETURN_NOT_OK(CheckSafeToReplicateUnlocked(*round->replicate_msg()));
+      RETURN_NOT_OK(round->CheckBoundTerm(CurrentTermUnlocked()));
+    }
+    RETURN_NOT_OK(CheckMemoryPressureUnlocked());
+    s = AppendNewRoundsToQueueUnlocked(rounds, replicate_start);
+  }
+
+  // Some of the rounds may have been appended even if 's' is bad.
+  peer_manager_->SignalRequest();
+  return s;
+}
+
+Status RaftConsensus::AdmitRoundUnlocked(ConsensusRound* round, MonoTime now) {
+  DCHECK(lock_.is_locked());
+  if (!admission_controller_) {
+    return Status::OK();
+  }
+  const int64_t bytes = round->replicate_msg()->ByteSizeLong();
+  Status s = admission_controller_->Admit(round->tenant(), bytes, now);
+  if (PREDICT_FALSE(!s.ok())) {
+    leader_admission_rejections_->Increment();
+    KLOG_EVERY_N_SECS(WARNING, 1)
+        << LogPrefixUnlocked() << "Rejecting op: " << s.ToString()
+        << THROTTLE_MSG;
+    return s;
+  }
+  round->admitted_ = now;
+  round->admitted_bytes_ = bytes;
+  round->admission_ = admission_controller_.get();
+  return Status::OK();
+}
+
+std::map<string, ReplicateAdmissionController::TenantStats>
+RaftConsensus::GetAdmissionStats() const {
+  if (!admission_controller_) {
+    return {};
+  }
+  return admission_controller_->GetTenantStats();
+}
+
+Status RaftConsensus::CheckMemoryPressureUnlocked() {
+  DCHECK(lock_.is_locked());
+  double capacity_pct;
+  string msg;
+  if (queue_->log_cache()->IsUnderMemoryPressure(&capacity_pct)) {
+    msg = StringPrintf(
+        "Log cache memory limit nearly reached (at %.2f%% of capacity)",
+        capacity_pct);
+  } else if (
+      FLAGS_leader_reject_on_soft_memory_limit &&
+      process_memory::SoftLimitExceeded(&capacity_pct)) {
+    msg = StringPrintf(
+        "Soft memory limit exceeded (at %.2f%% of capacity)", capacity_pct);
+  }
+  if (PREDICT_TRUE(msg.empty())) {
+    replication_throttled_->set_value(0);
+    return Status::OK();
+  }
+  replication_throttled_->set_value(1);
+  leader_memory_pressure_rejections_->Increment();
+  KLOG_EVERY_N_SECS(WARNING, 1)
+      << LogPrefixUnlocked()
+      << "Rejecting ops to replicate [EVERY 1 second]: " << msg
+      << THROTTLE_MSG;
+  return Status::ServiceUnavailable(msg);
+}
+
+Status RaftConsensus::TruncateCallbackWithRaftLock(
+    int64_t* index_if_truncated) {
+  DCHECK(FLAGS_raft_derived_log_mode);
+  ThreadRestrictions::AssertWaitAllowed();
+  LockGuard l(lock_);
+  RETURN_NOT_OK(CheckRunningUnlocked());
+
+  // We pass -1 to TruncateOpsAfter in the log abstraction
+  // It is the responsibility of the derived log to truncate from
+  // the cached truncation index and clear it.
+  RETURN_NOT_OK(log_->TruncateOpsAfter(-1, index_if_truncated));
+
+  if (index_if_truncated && *index_if_truncated != -1) {
     raft_log_truncation_counter_->Increment();
   }
 
@@ -1305,8 +2465,397 @@ Status RaftConsensus::CheckLeadershipAndBindTerm(
   return Status::OK();
 }
 
+Status RaftConsensus::CheckLeaseForRead(int64_t* read_index) {
+  DCHECK(read_index);
+  if (!FLAGS_enable_leader_leases) {
+    return Status::NotSupported("leader leases are disabled");
+  }
+  ThreadRestrictions::AssertWaitAllowed();
+  LockGuard l(lock_);
+  return CheckLeaseForReadUnlocked(read_index);
+}
+
+Status RaftConsensus::CheckLeaderForReadUnlocked() const {
+  DCHECK(lock_.is_locked());
+  RETURN_NOT_OK(CheckRunningUnlocked());
+  RETURN_NOT_OK(CheckActiveLeaderUnlocked());
+
+  // Until an op of its own term is committed, the leader may not know about
+  // everything the previous leaders committed.
+  if (!queue_->IsCommittedIndexInCurrentTerm()) {
+    return Status::ServiceUnavailable(
+        "leader has not yet committed an operation in its term");
+  }
+  return Status::OK();
+}
+
+Status RaftConsensus::CheckLeaseForReadUnlocked(int64_t* read_index) const {
+  DCHECK(lock_.is_locked());
+  RETURN_NOT_OK(CheckLeaderForReadUnlocked());
+
+  const MonoDelta lease_duration =
+      MonoDelta::FromNanoseconds(static_cast<int64_t>(
+          MinimumElectionTimeout().ToNanoseconds() *
+          (1 - FLAGS_leader_lease_clock_drift_ratio)));
+  const MonoTime expiry = queue_->LeaderLeaseExpiry(lease_duration);
+  if (!expiry.Initialized() || MonoTime::Now() >= expiry) {
+    return Status::ServiceUnavailable("leader does not hold a lease");
+  }
+  *read_index = queue_->GetCommittedIndex();
+  return Status::OK();
+}
+
+void RaftConsensus::GetReadIndexAsync(ReadIndexCallback callback) {
+  Status s;
+  int64_t read_index = -1;
+  bool leased = false;
+  MonoTime since;
+  {
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    s = CheckLeaderForReadUnlocked();
+    if (s.ok()) {
+      leased = FLAGS_enable_leader_leases &&
+          CheckLeaseForReadUnlocked(&read_index).ok();
+      if (!leased) {
+        read_index = queue_->GetCommittedIndex();
+        since = MonoTime::Now();
+      }
+    }
+  }
+  if (!s.ok() || leased) {
+    callback(s, read_index);
+    return;
+  }
+
+  // Any request sent from now on which a quorum accepts confirms that we
+  // were still the leader when the read index was taken.
+  if (queue_->ConfirmLeadershipAsync(
+          since, [callback, read_index](const Status& status) {
+            callback(status, read_index);
+          })) {
+    peer_manager_->SignalRequest(/*force_if_queue_empty=*/true);
+  }
+}
+
+void RaftConsensus::SubmitOpsAsync(
+    const SubmitOpsRequestPB& req,
+    SubmitOpsCallback callback) {
+  // The outcome of each of the ops, reported once all of them are known.
+  struct Batch {
+    Batch(int num_ops, SubmitOpsCallback cb)
+        : ids(num_ops),
+          finished(num_ops, false),
+          remaining(num_ops),
+          callback(std::move(cb)) {}
+
+    void Finish(int i, const Status& s, const OpId& id) {
+      {
+        std::lock_guard<simple_spinlock> l(lock);
+        if (finished[i]) {
+          return;
+        }
+        finished[i] = true;
+        if (s.ok()) {
+          ids[i] = id;
+        } else if (status.ok()) {
+          status = s;
+        }
+        if (--remaining > 0) {
+          return;
+        }
+      }
+      callback(status, ids);
+    }
+
+    simple_spinlock lock;
+    vector<OpId> ids;
+    vector<bool> finished;
+    int remaining;
+    Status status;
+    const SubmitOpsCallback callback;
+  };
+
+  if (req.ops_size() == 0) {
+    callback(Status::OK(), {});
+    return;
+  }
+  auto batch = std::make_shared<Batch>(req.ops_size(), std::move(callback));
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  rounds.reserve(req.ops_size());
+  Status s;
+  for (int i = 0; i < req.ops_size() && s.ok(); i++) {
+    const SubmitOpPB& op = req.ops(i);
+    auto replicate = new ReplicateMsg;
+    scoped_refptr<ConsensusRound> round(new ConsensusRound(
+        this, make_scoped_refptr(new RefCountedReplicate(replicate))));
+    replicate->set_op_type(WRITE_OP_EXT);
+    replicate->set_timestamp(Timestamp::kInitialTimestamp.value());
+    replicate->mutable_write_payload()->set_payload(op.payload());
+    if (op.has_request_id()) {
+      *replicate->mutable_request_id() = op.request_id();
+    }
+    s = time_manager_->AssignTimestamp(replicate);
+    if (s.ok()) {
+      s = CheckLeadershipAndBindTerm(round);
+    }
+    if (s.ok()) {
+      s = round_handler_->StartLeaderTransaction(round);
+    }
+    // The batch hears of the round after what the round handler set.
+    ConsensusReplicatedCallback applied = std::move(round->replicated_cb_);
+    ConsensusRound* round_ptr = round.get();
+    round->SetConsensusReplicatedCallback(
+        [batch, i, applied, round_ptr](const Status& status) {
+          if (applied) {
+            applied(status);
+          }
+          batch->Finish(i, status, round_ptr->id());
+        });
+    rounds.push_back(std::move(round));
+  }
+  if (s.ok()) {
+    s = ReplicateBatch(rounds);
+  }
+  if (PREDICT_FALSE(!s.ok())) {
+    // Fails the ops which won't be replicated, and those in flight: whatever
+    // their outcome, the batch failed.
+    for (int i = 0; i < req.ops_size(); i++) {
+      batch->Finish(i, s, OpId());
+    }
+  }
+}
+
+Status RaftConsensus::ReadIndex(const MonoDelta& timeout, int64_t* read_index) {
+  DCHECK(read_index);
+  const MonoTime deadline = MonoTime::Now() + timeout;
+  bool is_leader;
+  RaftPeerPB leader_pb;
+  {
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    RETURN_NOT_OK(CheckRunningUnlocked());
+    is_leader = cmeta_->active_role() == RaftPeerPB::LEADER;
+    if (!is_leader) {
+      if (!HasLeaderUnlocked()) {
+        return Status::ServiceUnavailable("no leader known to ask for reads");
+      }
+      RETURN_NOT_OK_PREPEND(
+          cmeta_->GetConfigMemberCopy(cmeta_->leader_uuid(), &leader_pb),
+          "leader is not in the active config");
+    }
+  }
+
+  int64_t index;
+  if (is_leader) {
+    auto result = std::make_shared<Promise<std::pair<Status, int64_t>>>();
+    GetReadIndexAsync([result](const Status& s, int64_t idx) {
+      result->Set(std::make_pair(s, idx));
+    });
+    const std::pair<Status, int64_t>* r =
+        result->WaitFor(deadline - MonoTime::Now());
+    if (!r) {
+      return Status::TimedOut("timed out confirming the leadership");
+    }
+    RETURN_NOT_OK(r->first);
+    index = r->second;
+  } else {
+    shared_ptr<PeerProxy> proxy;
+    RETURN_NOT_OK(peer_proxy_factory_->NewProxy(leader_pb, &proxy));
+    ReadIndexRequestPB req;
+    req.set_dest_uuid(leader_pb.permanent_uuid());
+    req.set_tablet_id(options_.tablet_id);
+    req.set_caller_uuid(peer_uuid());
+    ReadIndexResponsePB resp;
+    rpc::RpcController controller;
+    controller.set_deadline(deadline);
+    RETURN_NOT_OK_PREPEND(
+        proxy->ReadIndex(&req, &resp, &controller),
+        Substitute("ReadIndex RPC to leader $0 failed", proxy->PeerName()));
+    if (resp.has_error()) {
+      return StatusFromPB(resp.error().status());
+    }
+    index = resp.read_index();
+  }
+
+  RETURN_NOT_OK(pending_->WaitForCommittedIndex(index, deadline));
+  *read_index = index;
+  return Status::OK();
+}
+
+int64_t RaftConsensus::GetLocalRegionDurableIndex() const {
+  return queue_->GetLocalRegionDurableIndex();
+}
+
+Status RaftConsensus::AppendNewRoundsToQueueUnlocked(
+    const vector<scoped_refptr<ConsensusRound>>& rounds,
+    MonoTime replicate_start) {
+  DCHECK(lock_.is_locked());
+
+  OpId next_id = queue_->GetNextOpId();
+  vector<ReplicateMsgWrapper> msg_wrappers;
+  msg_wrappers.reserve(rounds.size());
+  Status s;
+  for (const auto& round : rounds) {
+    // Same as in AppendNewRoundToQueueUnlocked(): an index set before the
+    // round was submitted must be the one it gets.
+    if (PREDICT_TRUE(round->replicate_msg()->id().index() != 0)) {
+      if (PREDICT_FALSE(
+              round->replicate_msg()->id().index() != next_id.index())) {
+        s = Status::Aborted(strings::Substitute(
+            "Transaction submitted with index $0 mismatches with queue index $1",
+            round->replicate_msg()->id().index(),
+            next_id.index()));
+        break;
+      }
+    } else {
+      *round->replicate_msg()->mutable_id() = next_id;
+    }
+    msg_wrappers.emplace_back(round->replicate_scoped_refptr());
+    next_id.set_index(next_id.index() + 1);
+  }
+
+  vector<Status> init_statuses;
+  InitMsgWrappersUnlocked(&msg_wrappers, &init_statuses);
+  size_t num_prepared = 0;
+  for (; num_prepared < msg_wrappers.size(); num_prepared++) {
+    Status prepare_status = init_statuses[num_prepared];
+    if (PREDICT_TRUE(prepare_status.ok())) {
+      prepare_status = AddPendingOperationUnlocked(rounds[num_prepared]);
+    }
+    if (PREDICT_FALSE(!prepare_status.ok())) {
+      s = prepare_status;
+      break;
+    }
+  }
+  msg_wrappers.erase(msg_wrappers.begin() + num_prepared, msg_wrappers.end());
+  if (msg_wrappers.empty()) {
+    return s;
+  }
+  for (size_t i = 0; i < msg_wrappers.size(); i++) {
+    MaybeStartTracingOpUnlocked(rounds[i]->id(), replicate_start);
+    const ReplicateMsgWrapper& msg_wrapper = msg_wrappers[i];
+    MaybeCaptureOp(
+        msg_wrapper.GetCompressedMsg() ? msg_wrapper.GetCompressedMsg()
+                                       : msg_wrapper.GetUncompressedMsg(),
+        CapturedOpPB::LEADER_REPLICATE,
+        msg_wrappers.size());
+  }
+
+  // The only reasons for a bad status would be if the log itself were shut
+  // down, or if we had an actual IO error, which we currently don't handle.
+  CHECK_OK_PREPEND(
+      queue_->AppendOperations(
+          msg_wrappers,
+          Bind(
+              CrashIfNotOkStatusCB,
+              "Enqueued replicate operation failed to write to WAL")),
+      Substitute("$0: could not append to queue", LogPrefixUnlocked()));
+  for (size_t i = 0; i < msg_wrappers.size(); i++) {
+    if (rounds[i]->replicate_msg()->op_type() == NO_OP) {
+      HandleNewTermAppendedUnlocked(rounds[i]->replicate_msg()->id().term());
+    }
+  }
+  return s;
+}
+
+namespace {
+// Msgs of all Raft groups waiting on, or being compressed by, the
+// compression pool.
+std::atomic<int64_t> compression_queue_depth(0);
+
+// Returns the pool compressing the msgs of leader batches, which all Raft
+// groups share, or null if --raft_compression_threads is 0.
+ThreadPool* CompressionPool() {
+  static ThreadPool* const pool = []() -> ThreadPool* {
+    const int num_threads = FLAGS_raft_compression_threads;
+    if (num_threads <= 0) {
+      return nullptr;
+    }
+    gscoped_ptr<ThreadPool> new_pool;
+    Status s = ThreadPoolBuilder("raft-compress")
+                   .set_min_threads(0)
+                   .set_max_threads(num_threads)
+                   .set_max_queue_size(num_threads * 16)
+                   .Build(&new_pool);
+    if (!s.ok()) {
+      LOG(WARNING) << "Could not create the compression pool, compressing "
+                   << "inline: " << s.ToString();
+      return nullptr;
+    }
+    return new_pool.release();
+  }();
+  return pool;
+}
+
+// Returns the single threaded pool training the compression dictionaries of
+// all Raft groups, or null if it could not be created.
+ThreadPool* DictTrainingPool() {
+  static ThreadPool* const pool = []() -> ThreadPool* {
+    gscoped_ptr<ThreadPool> new_pool;
+    Status s = ThreadPoolBuilder("raft-dict-train")
+                   .set_min_threads(0)
+                   .set_max_threads(1)
+                   .Build(&new_pool);
+    if (!s.ok()) {
+      LOG(WARNING) << "Could not create the dictionary training pool: "
+                   << s.ToString();
+      return nullptr;
+    }
+    return new_pool.release();
+  }();
+  return pool;
+}
+} // anonymous namespace
+
+void RaftConsensus::InitMsgWrappersUnlocked(
+    vector<ReplicateMsgWrapper>* msg_wrappers,
+    vector<Status>* statuses) {
+  DCHECK(lock_.is_locked());
+  statuses->assign(msg_wrappers->size(), Status::OK());
+
+  vector<size_t> to_compress;
+  for (size_t i = 0; i < msg_wrappers->size(); i++) {
+    if ((*msg_wrappers)[i].NeedsCompression()) {
+      to_compress.push_back(i);
+    } else {
+      (*statuses)[i] = (*msg_wrappers)[i].Init(&compression_buffer_);
+    }
+  }
+  ThreadPool* pool = to_compress.size() > 1 ? CompressionPool() : nullptr;
+  if (!pool) {
+    // The contents of the compression buffer are copied out, so it can be
+    // reused for the whole batch.
+    for (size_t i : to_compress) {
+      (*statuses)[i] = (*msg_wrappers)[i].Init(&compression_buffer_);
+    }
+    return;
+  }
+
+  // Split the msgs in strides between the pool's threads and this one.
+  const int num_tasks = std::min<size_t>(
+      FLAGS_raft_compression_threads + 1, to_compress.size());
+  vector<ReplicateMsgWrapper*> wrappers;
+  for (size_t i : to_compress) {
+    wrappers.push_back(&(*msg_wrappers)[i]);
+  }
+
+  MonoTime start = MonoTime::Now();
+  compression_queue_depth_->Increment(
+      compression_queue_depth.fetch_add(to_compress.size()) +
+      to_compress.size());
+  vector<Status> compress_statuses;
+  InitMsgWrappersInStrides(pool, num_tasks, wrappers, &compress_statuses);
+  compression_queue_depth.fetch_sub(to_compress.size());
+  compression_time_->Increment((MonoTime::Now() - start).ToMicroseconds());
+  for (size_t k = 0; k < to_compress.size(); k++) {
+    (*statuses)[to_compress[k]] = std::move(compress_statuses[k]);
+  }
+}
+
 Status RaftConsensus::AppendNewRoundToQueueUnlocked(
-    const scoped_refptr<ConsensusRound>& round) {
+    const scoped_refptr<ConsensusRound>& round,
+    MonoTime replicate_start) {
   DCHECK(lock_.is_locked());
 
   // If index was set in the ReplicateMsgg Round before starting
@@ -1330,6 +2879,14 @@ Status RaftConsensus::AppendNewRoundToQueueUnlocked(
 
   ReplicateMsgWrapper msg_wrapper(round->replicate_scoped_refptr());
   RETURN_NOT_OK(msg_wrapper.Init(&compression_buffer_));
+  MaybeStartTracingOpUnlocked(
+      round->id(),
+      replicate_start.Initialized() ? replicate_start : MonoTime::Now());
+  MaybeCaptureOp(
+      msg_wrapper.GetCompressedMsg() ? msg_wrapper.GetCompressedMsg()
+                                     : msg_wrapper.GetUncompressedMsg(),
+      CapturedOpPB::LEADER_REPLICATE,
+      1);
 
   // The only reasons for a bad status would be if the log itself were shut
   // down, or if we had an actual IO error, which we currently don't handle.
@@ -1342,6 +2899,29 @@ Status RaftConsensus::AppendNewRoundToQueueUnlocked(
   return Status::OK();
 }
 
+void RaftConsensus::MaybeStartTracingOpUnlocked(
+    const OpId& id,
+    MonoTime replicate_start) {
+  DCHECK(lock_.is_locked());
+  if (PREDICT_FALSE(OpTracer::ShouldTrace(id.index()))) {
+    queue_->op_tracer()->StartOp(id, replicate_start);
+  }
+}
+
+void RaftConsensus::MaybeCaptureOp(
+    const ReplicateRefPtr& msg,
+    CapturedOpPB::Source source,
+    int batch_size) {
+  if (PREDICT_FALSE(workload_capture_ != nullptr)) {
+    workload_capture_->Record(*msg->get(), source, batch_size);
+  }
+}
+
+// Helper function to check if the op is a non-Transaction op.
+static bool IsConsensusOnlyOperation(OperationType op_type) {
+  return op_type == NO_OP || op_type == CHANGE_CONFIG_OP;
+}
+
 Status RaftConsensus::AddPendingOperationUnlocked(
     const scoped_refptr<ConsensusRound>& round) {
   DCHECK(lock_.is_locked());
@@ -1396,6 +2976,12 @@ Status RaftConsensus::AddPendingOperationUnlocked(
     }
   }
 
+  if (apply_pipeline_ &&
+      !IsConsensusOnlyOperation(round->replicate_msg()->op_type())) {
+    round->SetApplyPipeline(
+        apply_pipeline_.get(), round_handler_->ApplyPartitionKey(round.get()));
+  }
+
   return pending_->AddPendingOperation(round);
 }
 
@@ -1416,11 +3002,18 @@ void RaftConsensus::NotifyCommitIndex(int64_t commit_index, bool need_lock) {
   // which has initiated a Prepare() / Replicate() may eventually commit even if
   // its state has changed after the initial Append() / Update().
   if (PREDICT_FALSE(state_ != kRunning && state_ != kStopping)) {
-    LOG_WITH_PREFIX_UNLOCKED(WARNING)
-        << "Unable to update committed index: "
-        << "Replica not in running state: " << State_Name(state_);
+    KLOG_EVERY_N_SECS(WARNING, 1)
+        << LogPrefixUnlocked() << "Unable to update committed index: "
+        << "Replica not in running state: " << State_Name(state_)
+        << THROTTLE_MSG;
   } else {
     pending_->AdvanceCommittedIndex(commit_index);
+    queue_->op_tracer()->RecordCommitted(commit_index);
+    RecordFailoverCommitUnlocked(commit_index);
+    if (FLAGS_raft_priority_elections && FLAGS_raft_priority_leader_reclaim &&
+        cmeta_->active_role() == RaftPeerPB::LEADER) {
+      MaybeReclaimLeadershipUnlocked();
+    }
 
     if (FLAGS_notify_commit_index_after_response &&
         cmeta_->active_role() == RaftPeerPB::LEADER) {
@@ -1433,6 +3026,25 @@ void RaftConsensus::NotifyCommitIndex(int64_t commit_index, bool need_lock) {
   }
 }
 
+void RaftConsensus::NotifyLocalRegionDurableIndex(int64_t index) {
+  TRACE_EVENT2(
+      "consensus",
+      "RaftConsensus::NotifyLocalRegionDurableIndex",
+      "tablet",
+      options_.tablet_id,
+      "index",
+      index);
+
+  ThreadRestrictions::AssertWaitAllowed();
+  LockGuard l(lock_);
+  // Rounds of an earlier leadership are told when they commit or abort.
+  if (PREDICT_FALSE(state_ != kRunning) ||
+      cmeta_->active_role() != RaftPeerPB::LEADER) {
+    return;
+  }
+  pending_->AdvanceLocalRegionDurableIndex(index);
+}
+
 void RaftConsensus::NotifyTermChange(int64_t term) {
   TRACE_EVENT2(
       "consensus",
@@ -1539,6 +3151,7 @@ void RaftConsensus::HandleNewTermAppendedUnlocked(int64_t new_term) {
   DCHECK(lock_.is_locked());
   if (FLAGS_update_lkl_after_new_term_append) {
     CHECK_OK(cmeta_->sync_last_known_leader(new_term));
+    PublishVoterStateUnlocked();
   }
 }
 
@@ -1684,7 +3297,8 @@ void RaftConsensus::TryStartElectionOnPeerTask(
 
 Status RaftConsensus::Update(
     const ConsensusRequestPB* request,
-    ConsensusResponsePB* response) {
+    ConsensusResponsePB* response,
+    scoped_refptr<RefCountedArena> ops_arena) {
   update_calls_for_tests_.Increment();
 
   if (PREDICT_FALSE(
@@ -1701,8 +3315,28 @@ Status RaftConsensus::Update(
                       << SecureShortDebugString(*request);
 
   // see var declaration
-  std::lock_guard<simple_mutexlock> lock(update_lock_);
-  Status s = UpdateReplica(request, response);
+  MonoTime lock_start = MonoTime::Now();
+  std::unique_lock<simple_mutexlock> lock(update_lock_);
+  if (!request->ops().empty()) {
+    response->set_update_lock_wait_us(
+        (MonoTime::Now() - lock_start).ToMicroseconds());
+  }
+  Status s = UpdateReplica(request, response, &lock, std::move(ops_arena));
+  if (s.ok() && lock.owns_lock() && pipelined_log_append_) {
+    // This request didn't wait for the log itself, e.g. it is a heartbeat or
+    // all of its ops were deduplicated, but its response reports as received
+    // the ops of a pipelined request that may still be synced. The leader
+    // counts those toward the majority, so they must be durable first. The
+    // log makes ops durable in order, and nothing else is appended while we
+    // hold 'update_lock_', so the last pipelined append covers them all.
+    s = WaitForLogAppend(*pipelined_log_append_);
+    if (s.ok()) {
+      pipelined_log_append_ = boost::none;
+      response->mutable_status()->set_last_durable_idx(
+          queue_->GetLocalDurableIndex());
+      CheckTermAfterLogWait(*request, response);
+    }
+  }
   if (PREDICT_FALSE(VLOG_IS_ON(1))) {
     if (request->ops().empty()) {
       VLOG_WITH_PREFIX(1) << "Replica replied to status only request. Replica: "
@@ -1713,9 +3347,128 @@ Status RaftConsensus::Update(
   return s;
 }
 
-// Helper function to check if the op is a non-Transaction op.
-static bool IsConsensusOnlyOperation(OperationType op_type) {
-  return op_type == NO_OP || op_type == CHANGE_CONFIG_OP;
+Status RaftConsensus::InstallSnapshot(
+    const InstallSnapshotRequestPB* request,
+    InstallSnapshotResponsePB* response) {
+  response->set_responder_uuid(peer_uuid());
+  if (PREDICT_FALSE(snapshot_provider_ == nullptr)) {
+    return Status::NotSupported("no snapshot provider is registered");
+  }
+  const SnapshotInfoPB& snapshot = request->snapshot();
+  if (PREDICT_FALSE(!snapshot.has_id() || !snapshot.has_last_included())) {
+    return Status::InvalidArgument("the snapshot has no id or last op");
+  }
+
+  // Lock ordering: update_lock_ must be acquired before lock_. Holding it
+  // keeps the leader's ops from being appended meanwhile.
+  std::lock_guard<simple_mutexlock> update_guard(update_lock_);
+  if (request->done()) {
+    // The log cache can only be reset once the ops appended so far, e.g. by
+    // a pipelined update, are in the log.
+    RETURN_NOT_OK(log_->WaitUntilAllFlushed());
+  }
+  ThreadRestrictions::AssertWaitAllowed();
+  LockGuard l(lock_);
+  RETURN_NOT_OK(CheckRunningUnlocked());
+
+  if (request->caller_term() < CurrentTermUnlocked()) {
+    response->set_responder_term(CurrentTermUnlocked());
+    return Status::IllegalState(Substitute(
+        "Rejecting a snapshot from peer $0 for earlier term $1. "
+        "Current term is $2.",
+        request->caller_uuid(),
+        request->caller_term(),
+        CurrentTermUnlocked()));
+  }
+  if (request->caller_term() > CurrentTermUnlocked()) {
+    RETURN_NOT_OK(HandleTermAdvanceUnlocked(request->caller_term()));
+  }
+  response->set_responder_term(CurrentTermUnlocked());
+  if (PREDICT_FALSE(
+          HasLeaderUnlocked() &&
+          GetLeaderUuidUnlocked() != request->caller_uuid())) {
+    return Status::IllegalState(Substitute(
+        "Rejecting a snapshot from peer $0, which is not the leader of "
+        "term $1: $2 is",
+        request->caller_uuid(),
+        request->caller_term(),
+        GetLeaderUuidUnlocked()));
+  }
+  if (!HasLeaderUnlocked()) {
+    RETURN_NOT_OK(SetLeaderUuidUnlocked(request->caller_uuid()));
+  }
+  UnquiesceFailureDetectorUnlocked();
+  SnoozeFailureDetector(boost::none, MinimumElectionTimeoutWithBan());
+  last_leader_communication_time_micros_ = GetMonoTimeMicros();
+
+  // There is nothing to install if the ops of the snapshot are committed
+  // here already.
+  if (snapshot.last_included().index() <= pending_->GetCommittedIndex()) {
+    installing_snapshot_ = boost::none;
+    response->set_installed(true);
+    return Status::OK();
+  }
+
+  if (!installing_snapshot_ || installing_snapshot_->id() != snapshot.id()) {
+    int64_t next_offset = 0;
+    RETURN_NOT_OK_PREPEND(
+        snapshot_provider_->BeginSnapshotInstall(snapshot, &next_offset),
+        "could not begin installing the snapshot");
+    LOG_WITH_PREFIX_UNLOCKED(INFO)
+        << "Installing snapshot " << snapshot.id() << " through "
+        << OpIdToString(snapshot.last_included()) << " from "
+        << request->caller_uuid() << ", starting at offset " << next_offset;
+    installing_snapshot_ = snapshot;
+    installing_snapshot_offset_ = next_offset;
+  }
+
+  // Any chunk other than the next one, e.g. one sent again after its
+  // response was lost, only tells the leader where to go on from.
+  if (request->offset() != installing_snapshot_offset_) {
+    response->set_next_offset(installing_snapshot_offset_);
+    return Status::OK();
+  }
+  const string& data = request->data();
+  if (PREDICT_FALSE(
+          crc::Crc32c(data.data(), data.size()) != request->data_crc32())) {
+    return Status::Corruption(Substitute(
+        "the snapshot chunk at offset $0 is corrupt", request->offset()));
+  }
+  RETURN_NOT_OK_PREPEND(
+      snapshot_provider_->WriteSnapshotChunk(
+          snapshot.id(), request->offset(), data),
+      "could not write the snapshot chunk");
+  installing_snapshot_offset_ += data.size();
+  response->set_next_offset(installing_snapshot_offset_);
+  if (!request->done()) {
+    return Status::OK();
+  }
+
+  // The ops after the committed index may not be the leader's, and those
+  // through the snapshot are in it.
+  int64_t committed_index = pending_->GetCommittedIndex();
+  if (queue_->GetLastOpIdInLog().index() > committed_index) {
+    TruncateAndAbortOpsAfterUnlocked(committed_index);
+  }
+  RETURN_NOT_OK_PREPEND(
+      snapshot_provider_->FinishSnapshotInstall(snapshot),
+      "could not install the snapshot");
+  installing_snapshot_ = boost::none;
+  installing_snapshot_offset_ = 0;
+
+  // The state machine holds the snapshot now, so there is no going back.
+  CHECK_OK_PREPEND(
+      pending_->ResetToSnapshot(snapshot.last_included()),
+      LogPrefixUnlocked() + "could not move past the installed snapshot");
+  CHECK_OK_PREPEND(
+      queue_->ResetToSnapshot(snapshot.last_included()),
+      LogPrefixUnlocked() + "could not move past the installed snapshot");
+  snapshots_installed_->Increment();
+  LOG_WITH_PREFIX_UNLOCKED(INFO)
+      << "Installed snapshot " << snapshot.id() << " through "
+      << OpIdToString(snapshot.last_included());
+  response->set_installed(true);
+  return Status::OK();
 }
 
 Status RaftConsensus::StartFollowerTransactionUnlocked(
@@ -1726,6 +3479,20 @@ Status RaftConsensus::StartFollowerTransactionUnlocked(
   return StartFollowerTransactionUnlocked(msg_wrapper.GetUncompressedMsg());
 }
 
+bool RaftConsensus::ShouldStripPayloadsUnlocked() const {
+  DCHECK(lock_.is_locked());
+  if (!FLAGS_raft_witness_strip_payloads) {
+    return false;
+  }
+  for (const auto& peer : cmeta_->ActiveConfig().peers()) {
+    if (peer.permanent_uuid() == peer_uuid()) {
+      return peer.attrs().has_backing_db_present() &&
+          !peer.attrs().backing_db_present();
+    }
+  }
+  return false;
+}
+
 Status RaftConsensus::StartFollowerTransactionUnlocked(
     const ReplicateRefPtr& msg) {
   DCHECK(lock_.is_locked());
@@ -1842,7 +3609,7 @@ void RaftConsensus::DeduplicateLeaderRequestUnlocked(
       deduplicated_req->first_message_idx = i;
     }
     deduplicated_req->messages.push_back(
-        make_scoped_refptr_replicate(leader_msg));
+        make_scoped_refptr_replicate(leader_msg, deduplicated_req->ops_arena));
   }
 
   if (deduplicated_req->messages.size() != rpc_req->ops_size()) {
@@ -1901,6 +3668,20 @@ Status RaftConsensus::EnforceLogMatchingPropertyMatchesUnlocked(
       ConsensusErrorPB::PRECEDING_ENTRY_DIDNT_MATCH,
       Status::IllegalState(error_msg));
 
+  // Let the leader skip the whole term of the divergent op, before it is
+  // aborted below.
+  int64_t conflict_term;
+  int64_t conflict_term_first_index;
+  if (pending_->GetPendingTermStart(
+          term_mismatch ? req.preceding_opid->index()
+                        : queue_->GetLastOpIdInLog().index(),
+          &conflict_term,
+          &conflict_term_first_index)) {
+    response->mutable_status()->set_conflict_term(conflict_term);
+    response->mutable_status()->set_conflict_term_first_index(
+        conflict_term_first_index);
+  }
+
   LOG_WITH_PREFIX_UNLOCKED(INFO) << "Refusing update from remote peer "
                                  << req.leader_uuid << ": " << error_msg;
 
@@ -2030,7 +3811,9 @@ Status RaftConsensus::CheckLeaderRequestUnlocked(
 
 Status RaftConsensus::UpdateReplica(
     const ConsensusRequestPB* request,
-    ConsensusResponsePB* response) {
+    ConsensusResponsePB* response,
+    std::unique_lock<simple_mutexlock>* update_lock,
+    scoped_refptr<RefCountedArena> ops_arena) {
   TRACE_EVENT2(
       "consensus",
       "RaftConsensus::UpdateReplica",
@@ -2040,6 +3823,7 @@ Status RaftConsensus::UpdateReplica(
       options_.tablet_id);
   Synchronizer log_synchronizer;
   StatusCallback sync_status_cb = log_synchronizer.AsStatusCallback();
+  MonoTime log_append_start;
   // this is a temp variable. reset every time.
   new_leader_detected_failsafe_ = false;
 
@@ -2140,6 +3924,7 @@ Status RaftConsensus::UpdateReplica(
 
   // The deduplicated request.
   LeaderRequest deduped_req;
+  deduped_req.ops_arena = std::move(ops_arena);
   auto& messages = deduped_req.messages;
   {
     ThreadRestrictions::AssertWaitAllowed();
@@ -2165,7 +3950,18 @@ Status RaftConsensus::UpdateReplica(
     // If this particular instance is banned from cluster manager,
     // then we snooze for longer to give other instances an opportunity to win
     // the election
-    SnoozeFailureDetector(boost::none, MinimumElectionTimeoutWithBan());
+    //
+    // A quiesced heartbeat is honoured whatever our own
+    // --raft_enable_quiescence: the leader has slowed down its heartbeats.
+    if (request->quiesce() && request->ops_size() == 0) {
+      QuiesceFailureDetectorUnlocked();
+      // The intervals of the slowed down heartbeats aren't modeled.
+      leader_heartbeats_.Interrupt();
+      failure_detector_adaptive_ = false;
+    } else {
+      UnquiesceFailureDetectorUnlocked();
+      SnoozeFailureDetectorForLeaderUnlocked(request->caller_uuid());
+    }
 
     last_leader_communication_time_micros_ = GetMonoTimeMicros();
 
@@ -2191,7 +3987,14 @@ Status RaftConsensus::UpdateReplica(
     // will try to keep ring stable for next MinElectionTimeout.
     // However it will allow itself to solicit votes only after a Random
     // interval from 1x -> 2X of election timeout.
-    withhold_votes_until_ = MonoTime::Now() + MinimumElectionTimeout();
+    //
+    // The adaptive timeout is used the same way, unless leader leases rely on
+    // the votes being withheld for the regular one.
+    SetWithholdVotesUntilUnlocked(
+        MonoTime::Now() +
+        (failure_detector_adaptive_ && !FLAGS_enable_leader_leases
+             ? adaptive_election_timeout_
+             : MinimumElectionTimeout()));
 
     // 1 - Early commit pending (and committed) transactions
 
@@ -2241,6 +4044,7 @@ Status RaftConsensus::UpdateReplica(
     }
 
     std::vector<ReplicateMsgWrapper> msg_wrappers;
+    const bool strip_payloads = ShouldStripPayloadsUnlocked();
     // This is a best-effort way of isolating safe and expected failures
     // from true warnings.
     bool expected_rotation_delay = false;
@@ -2265,6 +4069,19 @@ Status RaftConsensus::UpdateReplica(
       if (op_type == NO_OP) {
         new_leader_detected_failsafe_ = false;
       }
+      MaybeCaptureOp(*iter, CapturedOpPB::FOLLOWER_UPDATE, messages.size());
+
+      // Follow the leader's codec, so that we compress with it too should we
+      // become leader.
+      const CompressionType msg_codec_type =
+          (*iter)->get()->write_payload().compression_codec();
+      if (msg_codec_type != NO_COMPRESSION) {
+        prepare_status =
+            CompressionCodecManager::SetCurrentCodec(msg_codec_type);
+        if (PREDICT_FALSE(!prepare_status.ok())) {
+          break;
+        }
+      }
 
       // Create a ReplicateMsgWrapper which handles compression, here we'll be
       // decompressing the msg
@@ -2281,11 +4098,17 @@ Status RaftConsensus::UpdateReplica(
              std::string::npos);
         break;
       }
-      // TODO(dralves) Without leader leases this shouldn't be allowed to fail.
-      // Once we have that functionality we'll have to revisit this.
-      CHECK_OK(time_manager_->MessageReceivedFromLeader(*(*iter)->get()));
       ++iter;
-      msg_wrappers.push_back(msg_wrapper);
+      if (strip_payloads) {
+        // The round applies the op as sent, the log and the log cache only
+        // get what a witness keeps of it.
+        ReplicateMsgWrapper stripped(msg_wrapper.GetStrippedMsg(), false);
+        witness_stripped_payload_bytes_->IncrementBy(
+            stripped.GetOrigMsg()->get()->write_payload().stripped_size());
+        msg_wrappers.push_back(std::move(stripped));
+      } else {
+        msg_wrappers.push_back(msg_wrapper);
+      }
     }
 
     // If we stopped before reaching the end we failed to prepare some
@@ -2295,12 +4118,15 @@ Status RaftConsensus::UpdateReplica(
     // first deduped.
     if (iter != messages.end()) {
       if (!expected_rotation_delay) {
-        LOG_WITH_PREFIX_UNLOCKED(WARNING) << Substitute(
-            "Could not prepare transaction for op '$0' and following $1 ops. "
-            "Status for this op: $2",
-            (*iter)->get()->id().ShortDebugString(),
-            std::distance(iter, messages.end()) - 1,
-            prepare_status.ToString());
+        KLOG_EVERY_N_SECS(WARNING, 1)
+            << LogPrefixUnlocked()
+            << Substitute(
+                   "Could not prepare transaction for op '$0' and following "
+                   "$1 ops. Status for this op: $2",
+                   (*iter)->get()->id().ShortDebugString(),
+                   std::distance(iter, messages.end()) - 1,
+                   prepare_status.ToString())
+            << THROTTLE_MSG;
       }
       iter = messages.erase(iter, messages.end());
 
@@ -2333,6 +4159,12 @@ Status RaftConsensus::UpdateReplica(
       }
     }
 
+    // Update the clock with the timestamps of the prepared messages, all at
+    // once rather than per message.
+    // TODO(dralves) Without leader leases this shouldn't be allowed to fail.
+    // Once we have that functionality we'll have to revisit this.
+    CHECK_OK(time_manager_->MessagesReceivedFromLeader(messages));
+
     // All transactions that are going to be prepared were started, advance the
     // safe timestamp.
     // TODO(dralves) This is only correct because the queue only sets safe time
@@ -2355,6 +4187,7 @@ Status RaftConsensus::UpdateReplica(
       //
       // Since we've prepared, we need to be able to append (or we risk trying
       // to apply later something that wasn't logged). We crash if we can't.
+      log_append_start = MonoTime::Now();
       CHECK_OK(queue_->AppendOperations(msg_wrappers, sync_status_cb));
       if (cmeta_->last_known_leader().uuid().empty() ||
           last_from_leader.term() != preceding_term) {
@@ -2387,6 +4220,7 @@ Status RaftConsensus::UpdateReplica(
     VLOG_WITH_PREFIX_UNLOCKED(1) << "Marking committed up to " << apply_up_to;
     TRACE("Marking committed up to $0", apply_up_to);
     CHECK_OK(pending_->AdvanceCommittedIndex(apply_up_to));
+    leader_committed_index_ = request->committed_index();
     queue_->UpdateFollowerWatermarks(
         apply_up_to,
         request->all_replicated_index(),
@@ -2409,26 +4243,47 @@ Status RaftConsensus::UpdateReplica(
   // can go through. We'll re-acquire it before we update the state again.
 
   // Update the last replicated op id
-  if (!messages.empty()) {
+  if (!messages.empty() &&
+      options_.durability_mode != DurabilityMode::DURABLE) {
+    // 5 - The leader counts the writes once they are in the log buffer, see
+    // durability_mode.h. The response still reports what is durable so far.
+    //
+    // The ack can't be taken back: the log crashes the server if it fails to
+    // make the ops durable.
+    follower_early_acked_updates_->Increment();
+    response->set_log_append_us(
+        (MonoTime::Now() - log_append_start).ToMicroseconds());
+  } else if (!messages.empty()) {
     // 5 - We wait for the writes to be durable.
 
     // Note that this is safe because dist consensus now only supports a single
     // outstanding request at a time and this way we can allow commits to
     // proceed while we wait.
+    //
+    // With --follower_pipeline_updates the next request is let in as well,
+    // so that its ops are appended while these are synced. The log makes
+    // them durable in order, so its response still follows this one.
+    const bool pipelined = FLAGS_follower_pipeline_updates;
+    if (pipelined) {
+      // A later request that doesn't wait for the log itself waits on this.
+      pipelined_log_append_ = log_synchronizer;
+      update_lock->unlock();
+    }
     TRACE("Waiting on the replicates to finish logging");
     TRACE_EVENT0("consensus", "Wait for log");
-    Status s;
-    do {
-      s = log_synchronizer.WaitFor(
-          MonoDelta::FromMilliseconds(FLAGS_raft_heartbeat_interval_ms));
-      // If just waiting for our log append to finish lets snooze the timer.
-      // We don't want to fire leader election because we're waiting on our own
-      // log.
-      if (s.IsTimedOut()) {
-        SnoozeFailureDetector();
-      }
-    } while (s.IsTimedOut());
-    RETURN_NOT_OK(s);
+    RETURN_NOT_OK(WaitForLogAppend(log_synchronizer));
+    if (!pipelined) {
+      // Everything appended before is durable as well.
+      pipelined_log_append_ = boost::none;
+    }
+    response->set_log_append_us(
+        (MonoTime::Now() - log_append_start).ToMicroseconds());
+    response->mutable_status()->set_last_durable_idx(
+        queue_->GetLocalDurableIndex());
+
+    if (pipelined) {
+      CheckTermAfterLogWait(*request, response);
+    }
 
     TRACE("finished");
   }
@@ -2440,6 +4295,44 @@ Status RaftConsensus::UpdateReplica(
   return Status::OK();
 }
 
+Status RaftConsensus::WaitForLogAppend(const Synchronizer& sync) {
+  Status s;
+  do {
+    s = sync.WaitFor(
+        MonoDelta::FromMilliseconds(FLAGS_raft_heartbeat_interval_ms));
+    // If just waiting for our log append to finish lets snooze the timer.
+    // We don't want to fire leader election because we're waiting on our own
+    // log.
+    if (s.IsTimedOut()) {
+      SnoozeFailureDetector();
+    }
+  } while (s.IsTimedOut());
+  return s;
+}
+
+void RaftConsensus::CheckTermAfterLogWait(
+    const ConsensusRequestPB& request,
+    ConsensusResponsePB* response) {
+  // Without 'update_lock_', or while waiting on an earlier request's ops, a
+  // vote may have gone through, or a request from a new leader. The ops must
+  // not then be acknowledged to the leader of the term they were received
+  // in: they may have been overwritten, or not been counted in the vote.
+  ThreadRestrictions::AssertWaitAllowed();
+  LockGuard l(lock_);
+  if (CurrentTermUnlocked() == response->responder_term()) {
+    return;
+  }
+  string msg = Substitute(
+      "Term advanced from $0 to $1 while logging ops $2",
+      response->responder_term(),
+      CurrentTermUnlocked(),
+      OpsRangeString(request));
+  LOG_WITH_PREFIX_UNLOCKED(INFO) << msg;
+  response->set_responder_term(CurrentTermUnlocked());
+  FillConsensusResponseError(
+      response, ConsensusErrorPB::INVALID_TERM, Status::IllegalState(msg));
+}
+
 void RaftConsensus::FillConsensusResponseOKUnlocked(
     ConsensusResponsePB* response) {
   DCHECK(lock_.is_locked());
@@ -2458,6 +4351,17 @@ void RaftConsensus::FillConsensusResponseOKUnlocked(
       last_received_cur_leader_);
   response->mutable_status()->set_last_committed_idx(
       queue_->GetCommittedIndex());
+  response->mutable_status()->set_last_durable_idx(
+      queue_->GetLocalDurableIndex());
+  const int64_t apply_backlog = ApplyBacklogOps();
+  if (apply_backlog > 0) {
+    response->mutable_status()->set_apply_backlog_ops(apply_backlog);
+  }
+}
+
+int64_t RaftConsensus::ApplyBacklogOps() const {
+  return (apply_pipeline_ ? apply_pipeline_->num_unapplied() : 0) +
+      (round_handler_ ? round_handler_->ApplyBacklog() : 0);
 }
 
 void RaftConsensus::FillConsensusResponseError(
@@ -2482,6 +4386,28 @@ Status RaftConsensus::RequestVote(
       options_.tablet_id);
   response->set_responder_uuid(peer_uuid());
 
+  // Only pre-elections and normal elections respect a live leader, and are
+  // bound to be retried by candidates that lose them.
+  bool can_deny_without_lock = request->mode() == ElectionMode::PRE_ELECTION ||
+      request->mode() == ElectionMode::NORMAL_ELECTION;
+  if (can_deny_without_lock && FLAGS_raft_pre_vote_fast_path &&
+      RequestVoteFastPath(request, response)) {
+    return Status::OK();
+  }
+  bool cache_denial = false;
+  if (can_deny_without_lock && FLAGS_raft_vote_denial_cache_ms > 0) {
+    if (RequestVoteFromDenialCache(request, response)) {
+      return Status::OK();
+    }
+    cache_denial = true;
+  }
+  // Runs last, once the locks are released and any vote is flushed.
+  SCOPED_CLEANUP({
+    if (cache_denial) {
+      CacheVoteDenial(request, *response);
+    }
+  });
+
   // We must acquire the update lock in order to ensure that this vote action
   // takes place between requests.
   // Lock ordering: update_lock_ must be acquired before lock_.
@@ -2509,9 +4435,21 @@ Status RaftConsensus::RequestVote(
     return RequestVoteRespondIsBusy(request, response);
   }
 
+  // The term and vote changes made under 'lock_' are written out once it is
+  // released, but still before 'update_lock_' is and the response is sent.
+  uint64_t cmeta_flush_version = 0;
+  SCOPED_CLEANUP({ FlushDeferredCmeta(cmeta_flush_version); });
+
   // Acquire the replica state lock so we can read / modify the consensus state.
   ThreadRestrictions::AssertWaitAllowed();
   LockGuard l(lock_);
+  DeferCmetaFlushesUnlocked();
+  SCOPED_CLEANUP({ cmeta_flush_version = EndDeferCmetaFlushesUnlocked(); });
+
+  // Another replica is campaigning, so stop relying on a quiesced leader.
+  if (state_ == kRunning) {
+    UnquiesceFailureDetectorUnlocked();
+  }
 
   // Ensure our lifecycle state is compatible with voting.
   // If RaftConsensus is running, we use the latest OpId from the WAL to vote.
@@ -2584,8 +4522,14 @@ Status RaftConsensus::RequestVote(
     LOG_WITH_PREFIX_UNLOCKED(INFO)
         << "Handling vote request from an unknown peer "
         << request->candidate_uuid();
-    if (cmeta_->IsPeerRemoved(request->candidate_uuid())) {
+    bool answered_by_filter = false;
+    if (cmeta_->IsPeerRemoved(
+            request->candidate_uuid(), &answered_by_filter)) {
       response->mutable_voter_context()->set_is_candidate_removed(true);
+    } else if (answered_by_filter) {
+      removed_peers_filter_negatives_->Increment();
+    } else {
+      removed_peers_filter_false_positives_->Increment();
     }
 
     // Now try to see if Candidate Context was sent in order to populate
@@ -2646,6 +4590,23 @@ Status RaftConsensus::RequestVote(
     return RequestVoteRespondInvalidTerm(request, hostname_port, response);
   }
 
+  // Hold off our own elections for a candidate of a higher priority, which
+  // is not behind us, even if we don't vote for it now, e.g. having voted for
+  // another candidate of the same term: it runs again before us.
+  if (FLAGS_raft_priority_elections && request->mode() != MOCK_ELECTION &&
+      cmeta_->active_role() != RaftPeerPB::LEADER &&
+      !OpIdLessThan(
+          request->candidate_status().last_received(),
+          local_last_logged_opid)) {
+    const RaftConfigIndex& index = cmeta_->ActiveConfigIndex();
+    if (index.ElectionPriority(request->candidate_uuid()) >
+        index.ElectionPriority(peer_uuid())) {
+      SnoozeFailureDetector(
+          string("deferring to a candidate of a higher priority"),
+          LeaderElectionExpBackoffDeltaUnlocked());
+    }
+  }
+
   // We already voted this term.
   if (request->candidate_term() == CurrentTermUnlocked() &&
       HasVotedCurrentTermUnlocked()) {
@@ -2850,7 +4811,10 @@ Status RaftConsensus::CheckBulkConfigChangeAndGetNewConfigUnlocked(
           "Leader has not yet committed an operation in its own term");
     }
 
-    const RaftConfigPB committed_config = cmeta_->CommittedConfig();
+    // Validate against the cached index of the committed config rather than
+    // scanning it for every change in the request.
+    const RaftConfigPB& committed_config = cmeta_->CommittedConfig();
+    const RaftConfigIndex& committed_index = cmeta_->CommittedConfigIndex();
 
     // Support atomic ChangeConfig requests.
     if (req.has_cas_config_opid_index()) {
@@ -2916,7 +4880,7 @@ Status RaftConsensus::CheckBulkConfigChangeAndGetNewConfigUnlocked(
         case ADD_PEER:
           // Ensure the peer we are adding is not already a member of the
           // configuration.
-          if (IsRaftConfigMember(server_uuid, committed_config)) {
+          if (committed_index.IsMember(server_uuid)) {
             return Status::InvalidArgument(Substitute(
                 "Server with UUID $0 is already a member of the config. RaftConfig: $1",
                 server_uuid,
@@ -2956,16 +4920,11 @@ Status RaftConsensus::CheckBulkConfigChangeAndGetNewConfigUnlocked(
           if (FLAGS_enable_flexi_raft &&
               IsUseQuorumId(committed_config.commit_rule()) &&
               !FLAGS_allow_multiple_backed_by_db_per_quorum && peer_bbd) {
-            std::string leader_uuid_unused;
             // A map from quorum id to actual number of backed_by_db voters in
             // config
-            std::map<std::string, int> actual_bbd_voter_counts;
-            GetActualVoterCountsFromConfig(
-                committed_config,
-                leader_uuid_unused,
-                &actual_bbd_voter_counts,
-                /* leader_quorum_id */ nullptr,
-                /* backed_by_db_only */ true);
+            const std::map<std::string, int>& actual_bbd_voter_counts =
+                committed_index.VoterCountsByQuorum(
+                    /* backed_by_db_only */ true);
             std::string peer_quorum_id =
                 GetQuorumId(peer, /* use_quorum_id */ true);
             int count =
@@ -2999,7 +4958,7 @@ Status RaftConsensus::CheckBulkConfigChangeAndGetNewConfigUnlocked(
                 server_uuid,
                 SecureShortDebugString(committed_config)));
           }
-          if (IsRaftConfigVoter(server_uuid, committed_config)) {
+          if (committed_index.IsVoter(server_uuid)) {
             num_voters_modified++;
 
             // If we are in flexi-raft mode, we want to make sure that the
@@ -3019,26 +4978,19 @@ Status RaftConsensus::CheckBulkConfigChangeAndGetNewConfigUnlocked(
               std::map<std::string, int> vd_map;
               GetVoterDistributionForQuorumId(committed_config, &vd_map);
 
-              std::map<std::string, int> voters_in_config_per_quorum;
-              std::string unused_leader_quorum;
-              std::string unused_leader_uuid;
               // Get number of voters in each region
-              GetActualVoterCountsFromConfig(
-                  committed_config,
-                  unused_leader_uuid,
-                  &voters_in_config_per_quorum,
-                  &unused_leader_quorum);
+              const std::map<std::string, int>& voters_in_config_per_quorum =
+                  committed_index.VoterCountsByQuorum();
 
               // single region dynamic mode.
               bool srd_mode = committed_config.has_commit_rule() &&
                   (committed_config.commit_rule().mode() ==
                    QuorumMode::SINGLE_REGION_DYNAMIC);
-              for (const RaftPeerPB& peer : committed_config.peers()) {
-                if (peer.permanent_uuid() != server_uuid) {
-                  continue;
-                }
+              // The peer we are about to remove is a voter, see above.
+              do {
+                const RaftPeerPB& peer =
+                    *committed_index.FindMember(server_uuid);
 
-                // Zeroed in on the peer we are about to remove.
                 const std::string& quorum_id =
                     GetQuorumId(peer, cmeta_->ActiveConfig().commit_rule());
 
@@ -3049,7 +5001,8 @@ Status RaftConsensus::CheckBulkConfigChangeAndGetNewConfigUnlocked(
                     quorum_id != peer_quorum_id(/* need_lock */ false)) {
                   break;
                 }
-                int current_count = voters_in_config_per_quorum[quorum_id];
+                int current_count =
+                    FindWithDefault(voters_in_config_per_quorum, quorum_id, 0);
                 // reduce count by 1
                 int future_count = current_count - 1;
                 auto vd_itr = vd_map.find(quorum_id);
@@ -3065,8 +5018,7 @@ Status RaftConsensus::CheckBulkConfigChangeAndGetNewConfigUnlocked(
                         quorum));
                   }
                 }
-                break;
-              }
+              } while (false);
             }
           }
           break;
@@ -3321,6 +5273,7 @@ void RaftConsensus::Stop() {
       return;
     // Transition to kStopping state.
     SetStateUnlocked(kStopping);
+    PublishVoterStateUnlocked();
     LOG_WITH_PREFIX_UNLOCKED(INFO) << "Raft consensus shutting down.";
   }
 
@@ -3348,7 +5301,7 @@ void RaftConsensus::Stop() {
 
     // If we were the leader, stop withholding votes.
     if (withhold_votes_until_ == MonoTime::Max()) {
-      withhold_votes_until_ = MonoTime::Min();
+      SetWithholdVotesUntilUnlocked(MonoTime::Min());
     }
 
     LOG_WITH_PREFIX_UNLOCKED(INFO) << "Raft consensus is shut down!";
@@ -3357,8 +5310,17 @@ void RaftConsensus::Stop() {
   // Shut down things that might acquire locks during destruction.
   if (raft_pool_token_)
     raft_pool_token_->Shutdown();
+  // The rounds committed before stopping are still applied.
+  if (apply_pipeline_)
+    apply_pipeline_->WaitForIdle();
+  if (log_subscriptions_)
+    log_subscriptions_->Shutdown();
   if (failure_detector_)
     DisableFailureDetector();
+  if (connection_warmer_)
+    connection_warmer_->Stop();
+  if (compression_dict_trainer_)
+    compression_dict_trainer_->Stop();
 }
 
 void RaftConsensus::Shutdown() {
@@ -3374,6 +5336,11 @@ void RaftConsensus::Shutdown() {
     LockGuard l(lock_);
     SetStateUnlocked(kShutdown);
   }
+  if (workload_capture_) {
+    WARN_NOT_OK(
+        workload_capture_->Flush(),
+        "could not write out the consensus workload capture");
+  }
   shutdown_.Store(true, kMemOrderRelease);
 }
 
@@ -3581,6 +5548,153 @@ Status RaftConsensus::RequestVoteRespondVoteWitheld(
   return Status::OK();
 }
 
+bool RaftConsensus::RequestVoteFastPath(
+    const VoteRequestPB* request,
+    VoteResponsePB* response) {
+  std::shared_ptr<const VoterState> voter_state =
+      std::atomic_load_explicit(&voter_state_, std::memory_order_acquire);
+  // Whatever needs more than the published state (e.g. the last-logged OpId
+  // or the config) goes through the regular path.
+  if (!voter_state || !voter_state->running || withhold_votes_) {
+    return false;
+  }
+  ConsensusErrorPB::Code code;
+  string reason;
+  if (MonoTime::Now() <
+      MonoTime::Min() +
+          MonoDelta::FromNanoseconds(withhold_votes_until_nanos_.load(
+              std::memory_order_relaxed))) {
+    code = ConsensusErrorPB::LEADER_IS_ALIVE;
+    reason = Substitute(
+        "for term $0 because replica is either leader or believes a valid "
+        "leader to be alive",
+        request->candidate_term());
+  } else if (request->candidate_term() < voter_state->term) {
+    code = ConsensusErrorPB::INVALID_TERM;
+    reason = Substitute(
+        "for earlier term $0. Current term is $1",
+        request->candidate_term(),
+        voter_state->term);
+  } else {
+    return false;
+  }
+
+  response->MergeFrom(voter_state->denial);
+  response->mutable_consensus_error()->set_code(code);
+  string msg = Substitute(
+      "$0Denying $1 to candidate $2 $3. Candidate context: $4.",
+      LogPrefixThreadSafe(),
+      ElectionMode_Name(request->mode()),
+      request->candidate_uuid(),
+      reason,
+      GetCandidateContextString(request));
+  VLOG(1) << msg;
+  StatusToPB(
+      Status::InvalidArgument(msg),
+      response->mutable_consensus_error()->mutable_status());
+  vote_requests_denied_without_lock_->Increment();
+  // Another replica is campaigning, as on the regular path.
+  MaybeUnquiesceFailureDetector();
+  return true;
+}
+
+bool RaftConsensus::RequestVoteFromDenialCache(
+    const VoteRequestPB* request,
+    VoteResponsePB* response) {
+  std::shared_ptr<const VoterState> voter_state =
+      std::atomic_load_explicit(&voter_state_, std::memory_order_acquire);
+  if (!voter_state || !voter_state->running || withhold_votes_) {
+    return false;
+  }
+  {
+    std::lock_guard<simple_spinlock> l(vote_denials_lock_);
+    const VoteDenial* denial =
+        FindOrNull(vote_denials_, request->candidate_uuid());
+    // The denial only stands for the very same request, and as long as we
+    // haven't moved to another term.
+    if (!denial || denial->expires < MonoTime::Now() ||
+        denial->mode != request->mode() ||
+        denial->candidate_term != request->candidate_term() ||
+        denial->voter_term != voter_state->term ||
+        !OpIdEquals(
+            denial->last_received,
+            request->candidate_status().last_received())) {
+      return false;
+    }
+    response->CopyFrom(denial->response);
+  }
+  VLOG(1) << Substitute(
+      "$0Re-sending cached denial of $1 to candidate $2 for term $3.",
+      LogPrefixThreadSafe(),
+      ElectionMode_Name(request->mode()),
+      request->candidate_uuid(),
+      request->candidate_term());
+  vote_requests_denied_from_cache_->Increment();
+  MaybeUnquiesceFailureDetector();
+  return true;
+}
+
+void RaftConsensus::CacheVoteDenial(
+    const VoteRequestPB* request,
+    const VoteResponsePB& response) {
+  // Only the denials that stand until the term changes are worth repeating:
+  // the others depend on timers or on the load of this replica.
+  if (response.vote_granted() || !response.has_consensus_error() ||
+      (response.consensus_error().code() != ConsensusErrorPB::ALREADY_VOTED &&
+       response.consensus_error().code() !=
+           ConsensusErrorPB::LAST_OPID_TOO_OLD)) {
+    return;
+  }
+  // Bounds the cache when it's flooded with unknown candidates.
+  const size_t kMaxCachedVoteDenials = 64;
+
+  MonoTime now = MonoTime::Now();
+  std::lock_guard<simple_spinlock> l(vote_denials_lock_);
+  if (vote_denials_.size() >= kMaxCachedVoteDenials &&
+      !ContainsKey(vote_denials_, request->candidate_uuid())) {
+    for (auto it = vote_denials_.begin(); it != vote_denials_.end();) {
+      if (it->second.expires < now) {
+        it = vote_denials_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    if (vote_denials_.size() >= kMaxCachedVoteDenials) {
+      return;
+    }
+  }
+  VoteDenial& denial = vote_denials_[request->candidate_uuid()];
+  denial.mode = request->mode();
+  denial.candidate_term = request->candidate_term();
+  denial.last_received = request->candidate_status().last_received();
+  denial.voter_term = response.responder_term();
+  denial.expires =
+      now + MonoDelta::FromMilliseconds(FLAGS_raft_vote_denial_cache_ms);
+  denial.response = response;
+}
+
+void RaftConsensus::PublishVoterStateUnlocked() {
+  DCHECK(lock_.is_locked());
+  std::shared_ptr<VoterState> voter_state = std::make_shared<VoterState>();
+  voter_state->running = state_ == kRunning;
+  voter_state->term = CurrentTermUnlocked();
+  voter_state->denial.set_responder_term(voter_state->term);
+  voter_state->denial.set_vote_granted(false);
+  FillVoteResponsePreviousVoteHistory(&voter_state->denial);
+  FillVoteResponseLastKnownLeader(&voter_state->denial);
+  std::atomic_store_explicit(
+      &voter_state_,
+      std::shared_ptr<const VoterState>(std::move(voter_state)),
+      std::memory_order_release);
+}
+
+void RaftConsensus::SetWithholdVotesUntilUnlocked(const MonoTime& until) {
+  DCHECK(lock_.is_locked());
+  withhold_votes_until_ = until;
+  withhold_votes_until_nanos_.store(
+      (until - MonoTime::Min()).ToNanoseconds(), std::memory_order_relaxed);
+}
+
 Status RaftConsensus::RequestVoteRespondLeaderIsAlive(
     const VoteRequestPB* request,
     const std::string& hostname_port,
@@ -3691,19 +5805,15 @@ std::string RaftConsensus::GetCandidateContextString(
 }
 
 RaftPeerPB::Role RaftConsensus::role() const {
-  ThreadRestrictions::AssertWaitAllowed();
-  LockGuard l(lock_);
-  return cmeta_->active_role();
+  return GetConsensusStateSnapshot()->role;
 }
 
 int64_t RaftConsensus::CurrentTerm() const {
-  LockGuard l(lock_);
-  return CurrentTermUnlocked();
+  return GetConsensusStateSnapshot()->cstate.current_term();
 }
 
 string RaftConsensus::GetLeaderUuid() const {
-  LockGuard l(lock_);
-  return GetLeaderUuidUnlocked();
+  return GetConsensusStateSnapshot()->cstate.leader_uuid();
 }
 
 std::pair<string, unsigned int> RaftConsensus::GetLeaderHostPort() const {
@@ -3736,6 +5846,7 @@ void RaftConsensus::SetStateUnlocked(State new_state) {
       break;
   }
   state_ = new_state;
+  state_version_.fetch_add(1, std::memory_order_release);
 }
 
 const char* RaftConsensus::State_Name(State state) {
@@ -3764,11 +5875,16 @@ Status RaftConsensus::SetLeaderUuidUnlocked(const string& uuid) {
   failed_elections_candidate_not_in_config_ = 0;
   num_failed_elections_metric_->set_value(
       failed_elections_since_stable_leader_);
+  if (uuid != peer_uuid()) {
+    // Someone else won; whatever failover this replica was timing is over.
+    failover_ = FailoverTimeline();
+  }
   cmeta_->set_leader_uuid(uuid);
 
   Status s = Status::OK();
   if (!FLAGS_update_lkl_after_new_term_append) {
     s = cmeta_->sync_last_known_leader();
+    PublishVoterStateUnlocked();
   }
   routing_table_container_->UpdateLeader(uuid);
   MarkDirty(Substitute("New leader $0", uuid));
@@ -3865,25 +5981,48 @@ const string& RaftConsensus::tablet_id() const {
   return options_.tablet_id;
 }
 
+std::shared_ptr<const RaftConsensus::ConsensusStateSnapshot>
+RaftConsensus::GetConsensusStateSnapshot() const {
+  std::shared_ptr<const ConsensusStateSnapshot> snapshot =
+      std::atomic_load_explicit(
+          &consensus_state_snapshot_, std::memory_order_acquire);
+  if (snapshot && snapshot->cmeta_version == cmeta_->state_version() &&
+      snapshot->state_version ==
+          state_version_.load(std::memory_order_acquire)) {
+    return snapshot;
+  }
+
+  ThreadRestrictions::AssertWaitAllowed();
+  LockGuard l(lock_);
+  std::shared_ptr<ConsensusStateSnapshot> fresh =
+      std::make_shared<ConsensusStateSnapshot>();
+  fresh->cmeta_version = cmeta_->state_version();
+  fresh->state_version = state_version_.load(std::memory_order_relaxed);
+  fresh->state = state_;
+  fresh->role = cmeta_->active_role();
+  fresh->cstate = cmeta_->ToConsensusStatePB();
+  snapshot = std::move(fresh);
+  std::atomic_store_explicit(
+      &consensus_state_snapshot_, snapshot, std::memory_order_release);
+  return snapshot;
+}
+
 Status RaftConsensus::ConsensusState(
     ConsensusStatePB* cstate,
     IncludeHealthReport report_health) const {
-  ThreadRestrictions::AssertWaitAllowed();
-  UniqueLock l(lock_);
-  if (state_ == kShutdown) {
+  std::shared_ptr<const ConsensusStateSnapshot> snapshot =
+      GetConsensusStateSnapshot();
+  if (snapshot->state == kShutdown) {
     return Status::IllegalState("Tablet replica is shutdown");
   }
-  ConsensusStatePB cstate_tmp = cmeta_->ToConsensusStatePB();
+  ConsensusStatePB cstate_tmp = snapshot->cstate;
 
   // If we need to include the health report, merge it into the committed
   // config iff we believe we are the current leader of the config.
   if (report_health == INCLUDE_HEALTH_REPORT &&
-      cmeta_->active_role() == RaftPeerPB::LEADER) {
+      snapshot->role == RaftPeerPB::LEADER) {
     auto reports = queue_->ReportHealthOfPeers();
 
-    // We don't need to access the queue anymore, so drop the consensus lock.
-    l.unlock();
-
     // Iterate through each peer in the committed config and attach the health
     // report to it.
     RaftConfigPB* committed_raft_config = cstate_tmp.mutable_committed_config();
@@ -3900,39 +6039,75 @@ Status RaftConsensus::ConsensusState(
   return Status::OK();
 }
 
+Status RaftConsensus::GetHealthSummary(
+    ConsensusHealthSummaryPB* summary) const {
+  std::shared_ptr<const ConsensusStateSnapshot> snapshot =
+      GetConsensusStateSnapshot();
+  if (snapshot->state != kRunning) {
+    return Status::IllegalState("Tablet replica is not running");
+  }
+  const MonoTime now = MonoTime::Now();
+  std::shared_ptr<const HealthSummary> cached =
+      std::atomic_load_explicit(&health_summary_, std::memory_order_acquire);
+  const MonoDelta refresh =
+      MonoDelta::FromMilliseconds(FLAGS_consensus_health_summary_refresh_ms);
+  if (!cached || cached->source != snapshot ||
+      now - cached->built_at >= refresh) {
+    // Concurrent pollers may all rebuild it, which only costs them a pass
+    // over the peers under the queue lock.
+    std::shared_ptr<HealthSummary> fresh = std::make_shared<HealthSummary>();
+    fresh->source = snapshot;
+    fresh->built_at = now;
+    ConsensusHealthSummaryPB* pb = &fresh->summary;
+    pb->set_role(snapshot->role);
+    pb->set_current_term(snapshot->cstate.current_term());
+    if (snapshot->cstate.has_leader_uuid()) {
+      pb->set_leader_uuid(snapshot->cstate.leader_uuid());
+    }
+    queue_->FillHealthSummary(pb);
+    cached = std::move(fresh);
+    std::atomic_store_explicit(
+        &health_summary_, cached, std::memory_order_release);
+  }
+  *summary = cached->summary;
+  summary->set_age_ms((now - cached->built_at).ToMilliseconds());
+  return Status::OK();
+}
+
 RaftConfigPB RaftConsensus::CommittedConfig() const {
-  ThreadRestrictions::AssertWaitAllowed();
-  LockGuard l(lock_);
-  return cmeta_->CommittedConfig();
+  return GetConsensusStateSnapshot()->cstate.committed_config();
 }
 
 Status RaftConsensus::PendingConfig(RaftConfigPB* pendingConfig) const {
-  ThreadRestrictions::AssertWaitAllowed();
-  LockGuard l(lock_);
-  if (cmeta_->has_pending_config()) {
-    *pendingConfig = cmeta_->PendingConfig();
+  std::shared_ptr<const ConsensusStateSnapshot> snapshot =
+      GetConsensusStateSnapshot();
+  if (snapshot->cstate.has_pending_config()) {
+    *pendingConfig = snapshot->cstate.pending_config();
     return Status::OK();
   }
   return Status::NotFound("No pending config found");
 }
 
 void RaftConsensus::DumpStatusHtml(std::ostream& out) const {
-  RaftPeerPB::Role role;
-  {
-    ThreadRestrictions::AssertWaitAllowed();
-    LockGuard l(lock_);
-    if (state_ != kRunning) {
-      out << "Tablet " << EscapeForHtmlToString(tablet_id()) << " not running"
-          << std::endl;
-      return;
-    }
-    role = cmeta_->active_role();
+  std::shared_ptr<const ConsensusStateSnapshot> snapshot =
+      GetConsensusStateSnapshot();
+  if (snapshot->state != kRunning) {
+    out << "Tablet " << EscapeForHtmlToString(tablet_id()) << " not running"
+        << std::endl;
+    return;
   }
+  RaftPeerPB::Role role = snapshot->role;
 
   out << "<h1>Raft Consensus State</h1>" << std::endl;
 
   out << "<h2>State</h2>" << std::endl;
-  out << "<pre>" << EscapeForHtmlToString(ToString()) << "</pre>" << std::endl;
+  out << "<pre>"
+      << EscapeForHtmlToString(Substitute(
+             "Replica: $0, State: $1, Role: $2",
+             peer_uuid(),
+             State_Name(snapshot->state),
+             RaftPeerPB::Role_Name(role)))
+      << "</pre>" << std::endl;
   out << "<h2>Queue</h2>" << std::endl;
   out << "<pre>" << EscapeForHtmlToString(queue_->ToString()) << "</pre>"
       << std::endl;
@@ -3948,6 +6123,15 @@ void RaftConsensus::DumpStatusHtml(std::ostream& out) const {
   }
 }
 
+string RaftConsensus::PeerHealthHistoryJson() const {
+  std::shared_ptr<const ConsensusStateSnapshot> snapshot =
+      GetConsensusStateSnapshot();
+  if (snapshot->state != kRunning) {
+    return "{}";
+  }
+  return queue_->PeerHealthHistoryJson();
+}
+
 void RaftConsensus::ElectionCallback(
     ElectionContext context,
     const ElectionResult& result,
@@ -3962,15 +6146,25 @@ void RaftConsensus::ElectionCallback(
     return;
   }
 
+  scoped_refptr<Histogram>& duration_hist =
+      result.vote_request.mode() == ElectionMode::PRE_ELECTION
+      ? pre_election_duration_
+      : election_duration_;
+  if (duration_hist && result.duration.Initialized()) {
+    duration_hist->Increment(result.duration.ToMicroseconds());
+  }
+
   // The election callback runs on a reactor thread, so we need to defer to our
   // threadpool. If the threadpool is already shut down for some reason, it's OK
   // -- we're OK with the callback never running.
   WARN_NOT_OK(
-      raft_pool_token_->SubmitFunc(std::bind(
-          &RaftConsensus::NestedElectionDecisionCallback,
-          shared_from_this(),
-          std::move(context),
-          result)),
+      raft_pool_token_->SubmitFunc(
+          std::bind(
+              &RaftConsensus::NestedElectionDecisionCallback,
+              shared_from_this(),
+              std::move(context),
+              result),
+          ThreadPool::Priority::HIGH),
       LogPrefixThreadSafe() + "Unable to run election callback");
 }
 
@@ -4152,10 +6346,72 @@ log::RetentionIndexes RaftConsensus::GetRetentionIndexes() {
   // separately -- the worst case is we see a relatively "out of date" watermark
   // which just means we'll retain slightly more than necessary in this
   // invocation of log GC.
-  return log::RetentionIndexes(
+  log::RetentionIndexes indexes(
       queue_->GetCommittedIndex(), // for durability
       queue_->GetAllReplicatedIndex(), // for peers
       queue_->GetRegionDurableIndex()); // for region based durability
+
+  // The peers behind the latest snapshot are sent the snapshot rather than
+  // the ops it holds.
+  int64_t snapshot_floor = 0;
+  SnapshotInfoPB snapshot;
+  if (snapshot_provider_ != nullptr &&
+      snapshot_provider_->GetLatestSnapshot(&snapshot).ok()) {
+    snapshot_floor = snapshot.last_included().index() + 1;
+    indexes.for_peers = std::max(indexes.for_peers, snapshot_floor);
+  }
+  // The log subscribers' anchors are bounded by their own policy, see
+  // LogSubscriptionManager, so they are held like the ops needed to restart.
+  int64_t anchored_index;
+  if (log_subscriptions_ &&
+      log_subscriptions_->GetEarliestAnchoredIndex(&anchored_index).ok()) {
+    indexes.for_durability =
+        std::min(indexes.for_durability, anchored_index);
+  }
+  if (!FLAGS_log_retention_policy_enabled) {
+    return indexes;
+  }
+
+  std::map<int64_t, int64_t> replay_size;
+  SpaceInfo space;
+  Status s = log_->GetReplaySizeAndSpaceInfo(&replay_size, &space);
+  if (!s.ok()) {
+    KLOG_EVERY_N_SECS(WARNING, 60)
+        << LogPrefixThreadSafe()
+        << "Could not get the WAL disk usage, retaining with no disk limit: "
+        << s.ToString();
+    space.free_bytes = -1;
+    space.capacity_bytes = -1;
+  }
+  vector<PeerLag> peers;
+  queue_->GetPeerLag(&peers);
+  LogRetentionDecision decision = DecideLogRetention(
+      replay_size,
+      indexes.for_durability,
+      space.free_bytes,
+      space.capacity_bytes,
+      peers,
+      indexes.for_peers);
+  indexes.for_peers = std::max(decision.for_peers, snapshot_floor);
+
+  log_retention_held_bytes_->set_value(decision.held_bytes);
+  log_retention_abandoned_peers_->set_value(decision.num_abandoned_peers);
+  {
+    std::lock_guard<simple_spinlock> l(retention_decision_lock_);
+    if (decision.num_abandoned_peers >
+        last_retention_decision_.num_abandoned_peers) {
+      LOG_WITH_PREFIX(INFO) << "Not retaining the WAL for "
+                            << decision.num_abandoned_peers
+                            << " lagging peers: " << decision.ToString();
+    }
+    last_retention_decision_ = std::move(decision);
+  }
+  return indexes;
+}
+
+LogRetentionDecision RaftConsensus::GetLastLogRetentionDecision() const {
+  std::lock_guard<simple_spinlock> l(retention_decision_lock_);
+  return last_retention_decision_;
 }
 
 void RaftConsensus::MarkDirty(const std::string& reason) {
@@ -4344,6 +6600,7 @@ bool RaftConsensus::ShouldEnforceRaftRpcToken() const {
 }
 
 void RaftConsensus::EnableFailureDetector(boost::optional<MonoDelta> delta) {
+  failure_detector_adaptive_ = false;
   if (PREDICT_TRUE(FLAGS_enable_leader_failure_detection)) {
     failure_detector_last_snoozed_ = std::chrono::system_clock::now();
     failure_detector_->Start(std::move(delta));
@@ -4388,6 +6645,7 @@ void RaftConsensus::UpdateFailureDetectorState(
 void RaftConsensus::SnoozeFailureDetector(
     boost::optional<string> reason_for_log,
     boost::optional<MonoDelta> delta) {
+  failure_detector_adaptive_ = false;
   if (PREDICT_TRUE(
           failure_detector_ && FLAGS_enable_leader_failure_detection)) {
     if (reason_for_log) {
@@ -4406,6 +6664,87 @@ void RaftConsensus::SnoozeFailureDetector(
   }
 }
 
+void RaftConsensus::SnoozeFailureDetectorForLeaderUnlocked(
+    const string& leader_uuid) {
+  DCHECK(lock_.is_locked());
+  // A banned instance keeps its longer timeout.
+  if (!FLAGS_raft_phi_accrual_failure_detection ||
+      fabs(FLAGS_snooze_for_leader_ban_ratio - 1.0) >= 0.001) {
+    SnoozeFailureDetector(boost::none, MinimumElectionTimeoutWithBan());
+    return;
+  }
+  leader_heartbeats_.Heartbeat(leader_uuid, MonoTime::Now());
+  MonoDelta suspicion;
+  // The regular timeout, set for the worst links, bounds the adaptive one.
+  if (!leader_heartbeats_.GetSuspicionTimeout(
+          FLAGS_raft_phi_accrual_threshold,
+          MonoDelta::FromMilliseconds(FLAGS_raft_heartbeat_interval_ms),
+          &suspicion) ||
+      suspicion >= MinimumElectionTimeout()) {
+    SnoozeFailureDetector(boost::none, MinimumElectionTimeoutWithBan());
+    return;
+  }
+
+  // Randomized by up to a half, like the regular timeout, so that the
+  // followers don't all suspect the leader at once.
+  const MonoDelta delta = MonoDelta::FromNanoseconds(static_cast<int64_t>(
+      suspicion.ToNanoseconds() * (1 + 0.5 * rng_.NextDoubleFraction())));
+  const bool was_adaptive = failure_detector_adaptive_;
+  SnoozeFailureDetector(boost::none, delta);
+  failure_detector_adaptive_ = true;
+  adaptive_election_timeout_ = suspicion;
+  // The failure detector checks for its deadline only about every regular
+  // timeout, which the first shorter deadline may come before.
+  if (!was_adaptive && failure_detector_ &&
+      FLAGS_enable_leader_failure_detection) {
+    failure_detector_->Expedite(delta);
+  }
+}
+
+void RaftConsensus::Unquiesce() {
+  ThreadRestrictions::AssertWaitAllowed();
+  LockGuard l(lock_);
+  if (state_ == kRunning) {
+    UnquiesceFailureDetectorUnlocked();
+  }
+}
+
+void RaftConsensus::QuiesceFailureDetectorUnlocked() {
+  DCHECK(lock_.is_locked());
+  if (!failure_detector_quiesced_) {
+    VLOG_WITH_PREFIX_UNLOCKED(1) << "Quiescing failure detection";
+    failure_detector_quiesced_ = true;
+  }
+  if (FLAGS_raft_quiesced_heartbeat_interval_ms > 0) {
+    SnoozeFailureDetector(
+        boost::none,
+        MonoDelta::FromMilliseconds(
+            FLAGS_leader_failure_max_missed_heartbeat_periods *
+            FLAGS_raft_quiesced_heartbeat_interval_ms));
+  } else {
+    DisableFailureDetector();
+  }
+}
+
+void RaftConsensus::UnquiesceFailureDetectorUnlocked() {
+  DCHECK(lock_.is_locked());
+  if (!failure_detector_quiesced_) {
+    return;
+  }
+  VLOG_WITH_PREFIX_UNLOCKED(1) << "Unquiescing failure detection";
+  failure_detector_quiesced_ = false;
+  // Restarts the failure detector if it was stopped, and otherwise brings the
+  // stretched deadline back to the regular election timeout.
+  UpdateFailureDetectorState();
+  SnoozeFailureDetector();
+}
+
+void RaftConsensus::MaybeUnquiesceFailureDetector() {
+  if (failure_detector_quiesced_.load(std::memory_order_relaxed)) {
+    Unquiesce();
+  }
+}
+
 MonoDelta RaftConsensus::MinimumElectionTimeout() const {
   int32_t failure_timeout = FLAGS_leader_failure_max_missed_heartbeat_periods *
       FLAGS_raft_heartbeat_interval_ms;
@@ -4454,13 +6793,101 @@ MonoDelta RaftConsensus::TimeoutBackoffHelper(double backoff_factor) {
   // We do this after the above capping to the max. Otherwise, after a
   // churny period, we'd end up highly likely to backoff exactly the max
   // amount.
+  double window = max_timeout - min_timeout;
+  double offset = 0;
+  int rank;
+  int num_ranks;
+  if (FLAGS_raft_priority_elections &&
+      ElectionPriorityRankUnlocked(&rank, &num_ranks)) {
+    // Randomized within the slice of our rank, so that only the candidates of
+    // one rank contend for the votes at a time, the highest first.
+    window /= num_ranks;
+    offset = rank * window;
+  }
   double timeout =
-      min_timeout + (max_timeout - min_timeout) * rng_.NextDoubleFraction();
+      min_timeout + offset + window * rng_.NextDoubleFraction();
   DCHECK_GE(timeout, min_timeout);
 
   return MonoDelta::FromMilliseconds(timeout);
 }
 
+bool RaftConsensus::ElectionPriorityRankUnlocked(int* rank, int* num_ranks) {
+  DCHECK(lock_.is_locked());
+  const RaftConfigIndex& index = cmeta_->ActiveConfigIndex();
+  *num_ranks = index.num_election_priorities();
+  *rank = index.ElectionPriorityRank(index.ElectionPriority(peer_uuid()));
+  if (queue_ && leader_committed_index_ >= 0 &&
+      leader_committed_index_ - queue_->GetLastOpIdInLog().index() >
+          FLAGS_raft_priority_elections_max_lag_ops) {
+    *rank = *num_ranks;
+  }
+  return *rank > 0 || *num_ranks > 1;
+}
+
+void RaftConsensus::MaybeReclaimLeadershipUnlocked() {
+  DCHECK(lock_.is_locked());
+  const MonoTime now = MonoTime::Now();
+  if (now < next_leadership_reclaim_ || leader_transfer_in_progress_.Load()) {
+    return;
+  }
+  next_leadership_reclaim_ = now +
+      MonoDelta::FromMilliseconds(FLAGS_raft_priority_leader_reclaim_delay_ms);
+  const RaftConfigIndex& index = cmeta_->ActiveConfigIndex();
+  if (index.ElectionPriorityRank(index.ElectionPriority(peer_uuid())) == 0) {
+    return;
+  }
+  WARN_NOT_OK(
+      raft_pool_token_->SubmitFunc(std::bind(
+          &RaftConsensus::ReclaimLeadershipTask, shared_from_this())),
+      LogPrefixUnlocked() + "failed to submit leadership reclaim task");
+}
+
+void RaftConsensus::ReclaimLeadershipTask() {
+  ThreadRestrictions::AssertWaitAllowed();
+  LockGuard l(lock_);
+  if (state_ != kRunning || cmeta_->active_role() != RaftPeerPB::LEADER ||
+      leader_transfer_in_progress_.Load()) {
+    return;
+  }
+  vector<PeerLag> peers;
+  queue_->GetPeerLag(&peers);
+  const int64_t committed_index = queue_->GetCommittedIndex();
+  const RaftConfigIndex& index = cmeta_->ActiveConfigIndex();
+  int32_t best_priority = index.ElectionPriority(peer_uuid());
+  string best_uuid;
+  for (const PeerLag& peer : peers) {
+    if (!index.IsVoter(peer.uuid) ||
+        peer.time_since_last_exchange > MinimumElectionTimeout() ||
+        committed_index - peer.last_received_index >
+            FLAGS_raft_priority_elections_max_lag_ops) {
+      continue;
+    }
+    const int32_t priority = index.ElectionPriority(peer.uuid);
+    if (priority > best_priority) {
+      best_priority = priority;
+      best_uuid = peer.uuid;
+    }
+  }
+  if (best_uuid.empty()) {
+    return;
+  }
+  LOG_WITH_PREFIX_UNLOCKED(INFO)
+      << "Transferring leadership to " << best_uuid
+      << ", which has the higher election priority " << best_priority;
+  Status s = BeginLeaderTransferPeriodUnlocked(
+      best_uuid,
+      nullptr,
+      ElectionContext(
+          ElectionReason::EXTERNAL_REQUEST, std::chrono::system_clock::now()));
+  if (s.ok()) {
+    leadership_reclaims_->Increment();
+  } else {
+    LOG_WITH_PREFIX_UNLOCKED(WARNING)
+        << "Could not transfer leadership to " << best_uuid << ": "
+        << s.ToString();
+  }
+}
+
 Status RaftConsensus::HandleTermAdvanceUnlocked(
     ConsensusTerm new_term,
     FlushToDisk flush) {
@@ -4514,7 +6941,8 @@ Status RaftConsensus::CheckActiveLeaderUnlocked() const {
       // Check for the consistency of the information in the consensus metadata
       // and the state of the consensus queue.
       DCHECK(queue_->IsInLeaderMode());
-      if (leader_transfer_in_progress_.Load()) {
+      if (leader_transfer_in_progress_.Load() &&
+          LeaderTransferPausesWritesUnlocked()) {
         return Status::ServiceUnavailable("leader transfer in progress");
       }
       return Status::OK();
@@ -4593,13 +7021,9 @@ Status RaftConsensus::ChangeVoterDistribution(
     RETURN_NOT_OK(s);
   }
 
-  RaftConfigPB config = cmeta_->ActiveConfig();
-  config.clear_voter_distribution();
-  config.mutable_voter_distribution()->insert(
-      topology_config.voter_distribution().begin(),
-      topology_config.voter_distribution().end());
-
-  cmeta_->set_active_config(config);
+  // Only the voter distribution changes, so update it in place instead of
+  // copying and re-setting the whole active config.
+  cmeta_->set_active_voter_distribution(topology_config.voter_distribution());
   CHECK_OK(cmeta_->Flush());
   // NB: Not calling the Proxy routing table update as the
   // proxy routing table does not deal with Voter Distribution.
@@ -4882,6 +7306,7 @@ Status RaftConsensus::SetCurrentTermBootstrap(int64_t new_term) {
   }
   cmeta_->set_current_term(new_term);
   CHECK_OK(cmeta_->Flush());
+  PublishVoterStateUnlocked();
   if (vote_logger_) {
     vote_logger_->advanceEpoch(new_term);
   }
@@ -4904,10 +7329,11 @@ Status RaftConsensus::SetCurrentTermUnlocked(
   cmeta_->set_current_term(new_term);
   cmeta_->clear_voted_for();
   if (flush == FLUSH_TO_DISK) {
-    CHECK_OK(cmeta_->Flush());
+    FlushCmetaUnlocked();
   }
 
   ClearLeaderUnlocked();
+  PublishVoterStateUnlocked();
   if (vote_logger_) {
     vote_logger_->advanceEpoch(new_term);
   }
@@ -4951,10 +7377,41 @@ Status RaftConsensus::SetVotedForCurrentTermUnlocked(const std::string& uuid) {
       uuid);
   DCHECK(lock_.is_locked());
   cmeta_->set_voted_for(uuid);
-  CHECK_OK(cmeta_->Flush());
+  FlushCmetaUnlocked();
+  PublishVoterStateUnlocked();
   return Status::OK();
 }
 
+void RaftConsensus::FlushCmetaUnlocked() {
+  DCHECK(lock_.is_locked());
+  if (defer_cmeta_flushes_) {
+    deferred_cmeta_flush_version_ = cmeta_->PrepareFlush();
+    return;
+  }
+  CHECK_OK(cmeta_->Flush());
+}
+
+void RaftConsensus::DeferCmetaFlushesUnlocked() {
+  DCHECK(lock_.is_locked());
+  DCHECK(!defer_cmeta_flushes_);
+  defer_cmeta_flushes_ = true;
+  deferred_cmeta_flush_version_ = 0;
+}
+
+uint64_t RaftConsensus::EndDeferCmetaFlushesUnlocked() {
+  DCHECK(lock_.is_locked());
+  DCHECK(defer_cmeta_flushes_);
+  defer_cmeta_flushes_ = false;
+  return deferred_cmeta_flush_version_;
+}
+
+void RaftConsensus::FlushDeferredCmeta(uint64_t version) {
+  if (version == 0) {
+    return;
+  }
+  CHECK_OK(cmeta_->FlushPrepared(version));
+}
+
 const std::string& RaftConsensus::GetVotedForCurrentTermUnlocked() const {
   DCHECK(lock_.is_locked());
   DCHECK(cmeta_->has_voted_for());
@@ -4971,22 +7428,31 @@ string RaftConsensus::LogPrefix() const {
   return LogPrefixUnlocked();
 }
 
-string RaftConsensus::LogPrefixUnlocked() const {
+const string& RaftConsensus::LogPrefixUnlocked() const {
   DCHECK(lock_.is_locked());
   // 'cmeta_' may not be set if initialization failed.
-  string cmeta_info;
-  if (cmeta_) {
-    cmeta_info = Substitute(
-        " [term $0 $1]",
-        cmeta_->current_term(),
-        RaftPeerPB::Role_Name(cmeta_->active_role()));
+  if (!cmeta_) {
+    return log_prefix_thread_safe_;
+  }
+  // Only format the prefix again when the term or the role changed.
+  const int64_t term = cmeta_->current_term();
+  const RaftPeerPB::Role role = cmeta_->active_role();
+  if (log_prefix_.empty() || term != log_prefix_term_ ||
+      role != log_prefix_role_) {
+    log_prefix_ = Substitute(
+        "T $0 P $1 [term $2 $3]: ",
+        options_.tablet_id,
+        peer_uuid(),
+        term,
+        RaftPeerPB::Role_Name(role));
+    log_prefix_term_ = term;
+    log_prefix_role_ = role;
   }
-  return Substitute(
-      "T $0 P $1$2: ", options_.tablet_id, peer_uuid(), cmeta_info);
+  return log_prefix_;
 }
 
-string RaftConsensus::LogPrefixThreadSafe() const {
-  return Substitute("T $0 P $1: ", options_.tablet_id, peer_uuid());
+const string& RaftConsensus::LogPrefixThreadSafe() const {
+  return log_prefix_thread_safe_;
 }
 
 string RaftConsensus::ToString() const {
@@ -5049,17 +7515,60 @@ bool RaftConsensus::IsProxyRequest(const ConsensusRequestPB* request) const {
   return !request->proxy_dest_uuid().empty();
 }
 
+bool RaftConsensus::CanUpdateWithoutWaiting() const {
+  std::unique_lock<simple_mutexlock> lock(update_lock_, std::try_to_lock);
+  return lock.owns_lock() && !pipelined_log_append_;
+}
+
+namespace {
+
+// Responds to a proxied request over the RPC it came in.
+class RpcProxyResponder : public ProxyResponder {
+ public:
+  explicit RpcProxyResponder(rpc::RpcContext* context) : context_(context) {}
+
+  MonoTime GetClientDeadline() const override {
+    return context_->GetClientDeadline();
+  }
+
+  string requestor_string() const override {
+    return context_->requestor_string();
+  }
+
+  void RespondSuccess() override {
+    context_->RespondSuccess();
+  }
+
+  void RespondNoCache() override {
+    context_->RespondNoCache();
+  }
+
+  void RespondFailure(const Status& status) override {
+    context_->RespondFailure(status);
+  }
+
+  void RespondTooBusy(const Status& status) override {
+    context_->RespondRpcFailure(
+        rpc::ErrorStatusPB::ERROR_SERVER_TOO_BUSY, status);
+  }
+
+ private:
+  rpc::RpcContext* const context_;
+};
+
+} // anonymous namespace
+
 // Set an error and respond.
 // Stolen (mostly) from tablet_service.cc
 static void SetupErrorAndRespond(
     const Status& s,
     ServerErrorPB::Code code,
     ConsensusResponsePB* response,
-    rpc::RpcContext* context) {
+    ProxyResponder* context) {
   // Generic "service unavailable" errors will cause the client to retry later.
   if ((code == ServerErrorPB::UNKNOWN_ERROR /*||
        code == TabletServerErrorPB::THROTTLED */) && s.IsServiceUnavailable()) {
-    context->RespondRpcFailure(rpc::ErrorStatusPB::ERROR_SERVER_TOO_BUSY, s);
+    context->RespondTooBusy(s);
     return;
   }
 
@@ -5079,13 +7588,78 @@ static void SetupErrorAndRespond(
     }                                                           \
   } while (0)
 
+// State of a proxied request, from the time its ops are looked up in the
+// local log until the next hop responds.
+struct RaftConsensus::ProxyRequest {
+  ProxyRequest(
+      const ConsensusRequestPB* request,
+      ConsensusResponsePB* response,
+      shared_ptr<ProxyResponder> responder)
+      : request(request),
+        response(response),
+        responder(std::move(responder)) {}
+
+  ~ProxyRequest() {
+    // The reconstituted ops belong to 'messages'. Prevent their
+    // double-deletion.
+    if (!messages.empty()) {
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+      downstream_request.mutable_ops()->UnsafeArenaExtractSubrange(
+          /*start=*/0,
+          /*num=*/downstream_request.ops_size(),
+          /*elements=*/nullptr);
+#else
+      downstream_request.mutable_ops()->ExtractSubrange(
+          /*start=*/0,
+          /*num=*/downstream_request.ops_size(),
+          /*elements=*/nullptr);
+#endif
+    }
+  }
+
+  // Must stay valid until 'responder' is called.
+  const ConsensusRequestPB* const request;
+  ConsensusResponsePB* const response;
+  const shared_ptr<ProxyResponder> responder;
+
+  RaftPeerPB next_peer_pb;
+  ReadContext read_context;
+  int64_t first_op_index = -1;
+  bool degraded_to_heartbeat = false;
+  std::vector<ReplicateRefPtr> messages;
+
+  ConsensusRequestPB downstream_request;
+  ConsensusResponsePB downstream_response;
+  rpc::RpcController controller;
+  shared_ptr<PeerProxy> next_proxy;
+
+  // When the downstream request was sent to the next hop.
+  MonoTime forward_time;
+};
+
 void RaftConsensus::HandleProxyRequest(
     const ConsensusRequestPB* request,
     ConsensusResponsePB* response,
     rpc::RpcContext* context) {
+  HandleProxyRequest(
+      request, response, std::make_shared<RpcProxyResponder>(context));
+}
+
+void RaftConsensus::HandleProxyRequest(
+    const ConsensusRequestPB* request,
+    ConsensusResponsePB* response,
+    shared_ptr<ProxyResponder> responder) {
+  ProxyResponder* context = responder.get();
+  // The caller's deadline bounds the wait for the ops to land, so that a
+  // request the leader gave up on doesn't hold a spot in the log cache's wait
+  // list, and gets dropped when it is resumed.
   MonoDelta wal_wait_timeout =
       MonoDelta::FromMilliseconds(FLAGS_raft_log_cache_proxy_wait_time_ms);
-  MonoTime wal_wait_deadline = MonoTime::Now() + wal_wait_timeout;
+  MonoTime now = MonoTime::Now();
+  MonoTime wal_wait_deadline =
+      std::min(now + wal_wait_timeout, context->GetClientDeadline());
+  wal_wait_timeout =
+      std::max(wal_wait_deadline - now, MonoDelta::FromNanoseconds(0));
 
   // TODO(mpercy): Remove this config lookup when refactoring DRT to return a
   // RaftPeerPB, which will prevent a validation race.
@@ -5100,15 +7674,15 @@ void RaftConsensus::HandleProxyRequest(
 
   raft_proxy_num_requests_received_->Increment();
 
-  // Initial implementation:
-  //
   // Synchronously:
   // 1. Validate that the request is addressed to the local node via
   // 'proxy_dest_uuid'.
-  // 2. Reconstitute each message from the local cache.
   //
   // Asynchronously:
-  // 4. Deliver the reconstituted request directly to the remote (async).
+  // 2. Wait for the proxied events to be appended to the local log, without
+  // holding up the RPC worker thread.
+  // 3. Reconstitute each message from the local cache.
+  // 4. Deliver the reconstituted request directly to the remote.
   // 5. Proxy the response from the remote back to the caller.
 
   // Validate the request.
@@ -5118,51 +7692,87 @@ void RaftConsensus::HandleProxyRequest(
         "Local UUID: $1. Requested UUID: $2",
         peer_uuid(),
         request->proxy_dest_uuid()));
-    LOG_WITH_PREFIX(WARNING)
-        << s.ToString() << ": from " << context->requestor_string() << ": "
-        << SecureShortDebugString(*request);
+    KLOG_EVERY_N_SECS(WARNING, 1)
+        << LogPrefixThreadSafe() << s.ToString() << ": from "
+        << context->requestor_string() << ": "
+        << SecureShortDebugString(*request) << THROTTLE_MSG;
     SetupErrorAndRespond(
         s, ServerErrorPB::WRONG_SERVER_UUID, response, context);
     return;
   }
   if (request->dest_uuid() == peer_uuid()) {
-    LOG_WITH_PREFIX(WARNING)
+    KLOG_EVERY_N_SECS(WARNING, 1)
+        << LogPrefixThreadSafe()
         << "dest_uuid and proxy_dest_uuid are the same: "
-        << request->proxy_dest_uuid() << ": " << request->ShortDebugString();
+        << request->proxy_dest_uuid() << ": " << request->ShortDebugString()
+        << THROTTLE_MSG;
     context->RespondFailure(
         Status::InvalidArgument("proxy and desination must be different"));
     return;
   }
 
   if (request->proxy_hops_remaining() < 1) {
-    LOG_WITH_PREFIX(WARNING)
+    KLOG_EVERY_N_SECS(WARNING, 1)
+        << LogPrefixThreadSafe()
         << "Proxy hops remaining exhausted (possible routing loop?) "
         << "in request to peer " << request->proxy_dest_uuid() << ": "
-        << request->ShortDebugString();
+        << request->ShortDebugString() << THROTTLE_MSG;
     raft_proxy_num_requests_hops_remaining_exhausted_->Increment();
     context->RespondFailure(Status::Incomplete(
         "proxy hops remaining exhausted", "possible routing loop"));
     return;
   }
 
+  string next_uuid = request->dest_uuid();
+  if (FLAGS_raft_enable_multi_hop_proxy_routing) {
+    Status s = routing_table_container_->NextHop(
+        peer_uuid(), request->dest_uuid(), &next_uuid);
+    if (PREDICT_FALSE(!s.ok())) {
+      raft_proxy_num_requests_unknown_dest_->Increment();
+    }
+    RET_RESPOND_ERROR_NOT_OK(s);
+  }
+
+  // Find the address of the remote given our local config.
+  RaftPeerPB* next_peer_pb;
+  Status s = GetRaftConfigMember(&active_config, next_uuid, &next_peer_pb);
+  if (PREDICT_FALSE(!s.ok())) {
+    RET_RESPOND_ERROR_NOT_OK(s.CloneAndPrepend(Substitute(
+        "unable to proxy to peer {} because it is not in the active config: {}",
+        next_uuid,
+        SecureShortDebugString(active_config))));
+  }
+  if (!next_peer_pb->has_last_known_addr()) {
+    s = Status::IllegalState("no known address for peer", next_uuid);
+    LOG_WITH_PREFIX(ERROR) << s.ToString();
+    RET_RESPOND_ERROR_NOT_OK(s);
+  }
+
+  auto proxy_req = std::make_shared<ProxyRequest>(
+      request, response, std::move(responder));
+  if (DropExpiredProxyRequest(proxy_req)) {
+    return;
+  }
+  proxy_req->next_peer_pb = *next_peer_pb;
+  ConsensusRequestPB& downstream_request = proxy_req->downstream_request;
+
+  const bool multi_hop = request->dest_uuid() != next_uuid;
+  if (multi_hop && FLAGS_raft_proxy_multi_hop_passthrough) {
+    // The next hop is a proxy too, so it needs nothing from us but new
+    // routing fields. Take over the request instead of copying it: nothing
+    // reads it after this point, and its owner only frees it.
+    ConsensusRequestPB* received = const_cast<ConsensusRequestPB*>(request);
+    const int32_t hops_remaining = received->proxy_hops_remaining() - 1;
+    downstream_request.Swap(received);
+    downstream_request.set_proxy_hops_remaining(hops_remaining);
+    downstream_request.set_proxy_caller_uuid(peer_uuid());
+    downstream_request.set_proxy_dest_uuid(next_uuid);
+    ForwardProxyRequest(proxy_req);
+    return;
+  }
+
   // Construct the downstream request; copy the relevant fields from the
   // proxied request.
-  ConsensusRequestPB downstream_request;
-  auto prevent_ops_deletion = MakeScopedCleanup([&]() {
-  // Prevent double-deletion of these requests.
-#if GOOGLE_PROTOBUF_VERSION >= 3017003
-    downstream_request.mutable_ops()->UnsafeArenaExtractSubrange(
-        /*start=*/0,
-        /*num=*/downstream_request.ops_size(),
-        /*elements=*/nullptr);
-#else
-    downstream_request.mutable_ops()->ExtractSubrange(
-        /*start=*/0,
-        /*num=*/downstream_request.ops_size(),
-        /*elements=*/nullptr);
-#endif
-  });
-
   downstream_request.set_dest_uuid(request->dest_uuid());
   downstream_request.set_tablet_id(request->tablet_id());
   downstream_request.set_caller_uuid(request->caller_uuid());
@@ -5198,159 +7808,244 @@ void RaftConsensus::HandleProxyRequest(
 
   downstream_request.set_proxy_caller_uuid(peer_uuid());
 
-  string next_uuid = request->dest_uuid();
-  if (FLAGS_raft_enable_multi_hop_proxy_routing) {
-    Status s = routing_table_container_->NextHop(
-        peer_uuid(), request->dest_uuid(), &next_uuid);
-    if (PREDICT_FALSE(!s.ok())) {
-      raft_proxy_num_requests_unknown_dest_->Increment();
+  if (multi_hop) {
+    downstream_request.set_proxy_dest_uuid(next_uuid);
+    // Forward the existing PROXY_OP ops.
+    for (int i = 0; i < request->ops_size(); i++) {
+      *downstream_request.add_ops() = request->ops(i);
     }
-    RET_RESPOND_ERROR_NOT_OK(s);
+    ForwardProxyRequest(proxy_req);
+    return;
   }
 
-  // Find the address of the remote given our local config.
-  RaftPeerPB* next_peer_pb;
-  Status s = GetRaftConfigMember(&active_config, next_uuid, &next_peer_pb);
-  if (PREDICT_FALSE(!s.ok())) {
-    RET_RESPOND_ERROR_NOT_OK(s.CloneAndPrepend(Substitute(
-        "unable to proxy to peer {} because it is not in the active config: {}",
-        next_uuid,
-        SecureShortDebugString(active_config))));
+  const HostPortPB& next_addr = proxy_req->next_peer_pb.last_known_addr();
+  ReadContext& read_context = proxy_req->read_context;
+  read_context.for_peer_uuid = &request->dest_uuid();
+  read_context.for_peer_host = &next_addr.host();
+  read_context.for_peer_port = next_addr.port();
+
+  for (int i = 0; i < request->ops_size(); i++) {
+    auto& msg = request->ops(i);
+    if (PREDICT_FALSE(msg.op_type() != PROXY_OP)) {
+      RET_RESPOND_ERROR_NOT_OK(Status::InvalidArgument(Substitute(
+          "proxy expected PROXY_OP but received opid {} of type {}",
+          OpIdToString(msg.id()),
+          OperationType_Name(msg.op_type()))));
+    }
+    if (i == 0) {
+      proxy_req->first_op_index = msg.id().index();
+    } else if (PREDICT_FALSE(
+                   msg.id().index() <= request->ops(i - 1).id().index())) {
+      // The batch may have holes, but has to be in log order.
+      RET_RESPOND_ERROR_NOT_OK(Status::InvalidArgument(Substitute(
+          "proxy requires increasing indexes in batch, but received $0 after $1",
+          OpIdToString(msg.id()),
+          OpIdToString(request->ops(i - 1).id()))));
+    }
   }
-  if (!next_peer_pb->has_last_known_addr()) {
-    s = Status::IllegalState("no known address for peer", next_uuid);
-    LOG_WITH_PREFIX(ERROR) << s.ToString();
-    RET_RESPOND_ERROR_NOT_OK(s);
+
+  if (request->ops_size() == 0) {
+    ForwardProxyRequest(proxy_req);
+    return;
   }
 
-  bool degraded_to_heartbeat = false;
-  vector<ReplicateRefPtr> messages;
-  messages.clear();
+  // Park the request until the first op is available in the local log. If it
+  // does not show up by FLAGS_raft_log_cache_proxy_wait_time_ms, the request
+  // is degraded to a heartbeat. Either way the request is resumed on the raft
+  // pool, since reconstituting the ops may read from disk.
+  weak_ptr<RaftConsensus> w = shared_from_this();
+  queue_->log_cache()->AsyncWaitForOp(
+      proxy_req->first_op_index - 1,
+      wal_wait_deadline,
+      [w, proxy_req](const Status& wait_status) {
+        auto consensus = w.lock();
+        if (PREDICT_FALSE(!consensus)) {
+          proxy_req->responder->RespondFailure(
+              Status::Aborted("consensus instance was destroyed"));
+          return;
+        }
+        bool timed_out = !wait_status.ok();
+        Status s = consensus->raft_pool_->SubmitFunc(
+            [consensus, proxy_req, timed_out]() {
+              consensus->ReconstituteAndForwardProxyRequest(
+                  proxy_req, timed_out);
+            });
+        if (PREDICT_FALSE(!s.ok())) {
+          SetupErrorAndRespond(
+              s.CloneAndPrepend("unable to resume proxy request"),
+              ServerErrorPB::UNKNOWN_ERROR,
+              proxy_req->response,
+              proxy_req->responder.get());
+        }
+      });
 
-  if (request->dest_uuid() != next_uuid) {
-    // Multi-hop proxy request.
-    downstream_request.set_proxy_dest_uuid(next_uuid);
-    // Forward the existing PROXY_OP ops.
-    for (int i = 0; i < request->ops_size(); i++) {
-      *downstream_request.add_ops() = request->ops(i);
-    }
-    prevent_ops_deletion.cancel(); // The ops we copy here are not pre-allocated
-  } else {
-    ReadContext read_context;
-    read_context.for_peer_uuid = &request->dest_uuid();
-    read_context.for_peer_host = &next_peer_pb->last_known_addr().host();
-    read_context.for_peer_port = next_peer_pb->last_known_addr().port();
+  // There is no timer in the log cache: expire the waiters ourselves. If the
+  // request was already resumed this is a no-op.
+  peer_proxy_factory_->messenger()->ScheduleOnReactor(
+      [w](const Status& /*s*/) {
+        if (auto consensus = w.lock()) {
+          consensus->queue_->log_cache()->ExpireOpWaiters(MonoTime::Now());
+        }
+      },
+      wal_wait_timeout);
+}
 
-    int64_t first_op_index = -1;
-    int64_t max_batch_size =
-        FLAGS_consensus_max_batch_size_bytes - request->ByteSizeLong();
+void RaftConsensus::ReconstituteAndForwardProxyRequest(
+    const std::shared_ptr<ProxyRequest>& proxy_req,
+    bool timed_out) {
+  const ConsensusRequestPB* request = proxy_req->request;
+  ConsensusResponsePB* response = proxy_req->response;
+  ProxyResponder* context = proxy_req->responder.get();
+  ConsensusRequestPB& downstream_request = proxy_req->downstream_request;
+  vector<ReplicateRefPtr>& messages = proxy_req->messages;
 
-    // Reconstitute proxied events from the local cache.
-    // If the cache does not have all events, we retry up until the specified
-    // retry timeout.
-    // TODO(mpercy): Switch this from polling to event-triggered.
+  if (DropExpiredProxyRequest(proxy_req)) {
+    return;
+  }
 
-    for (int i = 0; i < request->ops_size(); i++) {
-      auto& msg = request->ops(i);
-      if (PREDICT_FALSE(msg.op_type() != PROXY_OP)) {
-        RET_RESPOND_ERROR_NOT_OK(Status::InvalidArgument(Substitute(
-            "proxy expected PROXY_OP but received opid {} of type {}",
-            OpIdToString(msg.id()),
-            OperationType_Name(msg.op_type()))));
-      }
-      if (i == 0) {
-        first_op_index = msg.id().index();
-      } else {
-        // TODO(mpercy): It would be nice not to require consecutive indexes in
-        // the batch. We should see if we can support it without a big perf
-        // penalty in IOPS.
-        if (PREDICT_FALSE(msg.id().index() != first_op_index + i)) {
-          RET_RESPOND_ERROR_NOT_OK(Status::InvalidArgument(Substitute(
-              "proxy requires consecutive indexes in batch, but received {} after index {}",
-              OpIdToString(msg.id()),
-              first_op_index + i - 1)));
-        }
+  // Reconstitute proxied events from the local cache.
+  if (!timed_out) {
+    int64_t max_batch_size =
+        FLAGS_consensus_max_batch_size_bytes - request->ByteSizeLong();
+    OpId preceding_id;
+    queue_->log_cache()->ReadOps(
+        proxy_req->first_op_index - 1,
+        max_batch_size,
+        proxy_req->read_context,
+        &messages,
+        &preceding_id);
+  }
+
+  if (messages.empty()) {
+    // We timed out and got nothing from the log cache. Send a heartbeat to
+    // the destination to prevent it from starting (pre) election
+    raft_proxy_num_requests_log_read_timeout_->Increment();
+    proxy_req->degraded_to_heartbeat = true;
+  }
+
+  // Reconstitute the proxied ops. The local log is contiguous, so holes in
+  // the requested batch are filled in from it: by the log matching property,
+  // the ops in between two requested ops with matching OpIds are the leader's
+  // too. Since that only holds up to the last matched op, and the log cache
+  // may return fewer ops than requested, we forward the longest prefix of the
+  // batch that ends in a requested op.
+  int num_matched = 0;
+  size_t num_to_forward = 0;
+  for (size_t i = 0;
+       i < messages.size() && num_matched < request->ops_size();
+       i++) {
+    const OpId& requested_id = request->ops(num_matched).id();
+    const OpId& local_id = messages[i]->get()->id();
+    if (local_id.index() < requested_id.index()) {
+      continue;
+    }
+    // Ensure that the OpIds match. We don't expect a mismatch to ever
+    // happen, so we log an error locally before reponding to the caller.
+    if (!OpIdEquals(requested_id, local_id)) {
+      string extra_info;
+      if (i > 0) {
+        extra_info = Substitute(
+            " (previously received OpId: $0)",
+            OpIdToString(messages[i - 1]->get()->id()));
       }
+      Status s = Status::IllegalState(Substitute(
+          "log cache returned unexpected OpId for message $0 in request: "
+          "requested $1, received $2$3",
+          num_matched,
+          OpIdToString(requested_id),
+          OpIdToString(local_id),
+          extra_info));
+      LOG_WITH_PREFIX(ERROR) << s.ToString();
+      RET_RESPOND_ERROR_NOT_OK(s);
     }
+    num_matched++;
+    num_to_forward = i + 1;
+  }
+  for (size_t i = 0; i < num_to_forward; i++) {
+    downstream_request.mutable_ops()->UnsafeArenaAddAllocated(
+        messages[i]->get());
+  }
 
-    // Now we know that all ops we are reconstituting are consecutive.
-    //
-    // Block until the required op is available in local log. This might timeout
-    // based on FLAGS_raft_log_cache_proxy_wait_time_ms in which case we return
-    // an error
-    OpId preceding_id;
-    if (request->ops_size() > 0) {
-      queue_->log_cache()->BlockingReadOps(
-          first_op_index - 1,
-          max_batch_size,
-          read_context,
-          FLAGS_raft_log_cache_proxy_wait_time_ms,
-          &messages,
-          &preceding_id);
-    }
-
-    if (request->ops_size() > 0 && messages.size() == 0) {
-      // We timed out and got nothing from the log cache. Send a heartbeat to
-      // the destination to prevent it from starting (pre) election
-      raft_proxy_num_requests_log_read_timeout_->Increment();
-      degraded_to_heartbeat = true;
-    }
-
-    // Reconstitute the proxied ops. We silently tolerate proxying a subset of
-    // the requested batch.
-    for (int i = 0; i < request->ops_size() && i < messages.size(); i++) {
-      // Ensure that the OpIds match. We don't expect a mismatch to ever
-      // happen, so we log an error locally before reponding to the caller.
-      if (!OpIdEquals(request->ops(i).id(), messages[i]->get()->id())) {
-        string extra_info;
-        if (i > 0) {
-          extra_info = Substitute(
-              " (previously received OpId: $0)",
-              OpIdToString(messages[i - 1]->get()->id()));
-        }
-        Status s = Status::IllegalState(Substitute(
-            "log cache returned non-consecutive OpId index for message $0 in request: "
-            "requested $1, received $2$3",
-            i,
-            OpIdToString(request->ops(i).id()),
-            OpIdToString(messages[i]->get()->id()),
-            extra_info));
-        LOG_WITH_PREFIX(ERROR) << s.ToString();
-        RET_RESPOND_ERROR_NOT_OK(s);
-      }
-      downstream_request.mutable_ops()->AddAllocated(messages[i]->get());
+  if (!proxy_req->degraded_to_heartbeat) {
+    if (num_matched == request->ops_size()) {
+      raft_proxy_num_requests_full_forward_->Increment();
+    } else {
+      raft_proxy_num_requests_partial_forward_->Increment();
     }
   }
 
-  VLOG_WITH_PREFIX(3) << "Downstream proxy request: "
-                      << SecureShortDebugString(downstream_request);
+  ForwardProxyRequest(proxy_req);
+}
 
-  // Asynchronously:
-  // Send the request to the remote.
+void RaftConsensus::ForwardProxyRequest(
+    const std::shared_ptr<ProxyRequest>& proxy_req) {
+  ConsensusResponsePB* response = proxy_req->response;
+  ProxyResponder* context = proxy_req->responder.get();
+
+  VLOG_WITH_PREFIX(3) << "Downstream proxy request: "
+                      << SecureShortDebugString(proxy_req->downstream_request);
 
   // TODO(mpercy): Cache this proxy object (although they are lightweight).
   // We can use a PeerProxyPool, like we do when sending from the leader.
-  shared_ptr<PeerProxy> next_proxy;
-  RET_RESPOND_ERROR_NOT_OK(
-      peer_proxy_factory_->NewProxy(*next_peer_pb, &next_proxy));
+  RET_RESPOND_ERROR_NOT_OK(peer_proxy_factory_->NewProxy(
+      proxy_req->next_peer_pb, &proxy_req->next_proxy));
 
-  ConsensusResponsePB downstream_response;
-  rpc::RpcController controller;
-  controller.set_timeout(
-      MonoDelta::FromMilliseconds(FLAGS_consensus_rpc_timeout_ms));
-
-  // Here, we turn an async API into a blocking one with a CountdownLatch.
-  // TODO(mpercy): Use an async approach instead.
-  CountDownLatch latch(/*count=*/1);
-  rpc::ResponseCallback callback = [&latch] { latch.CountDown(); };
-  next_proxy->UpdateAsync(
-      &downstream_request, &downstream_response, &controller, callback);
-  latch.Wait();
-  if (PREDICT_FALSE(!controller.status().ok())) {
-    RET_RESPOND_ERROR_NOT_OK(controller.status().CloneAndPrepend(Substitute(
-        "Error proxying request from $0 to $1",
-        SecureShortDebugString(local_peer_pb_),
-        SecureShortDebugString(*next_peer_pb))));
+  if (DropExpiredProxyRequest(proxy_req)) {
+    return;
+  }
+  // Don't wait on the next hop past the point our caller stops waiting on
+  // us. The deadline goes out with the call, so every later hop is bound by
+  // the origin's deadline too.
+  proxy_req->controller.set_deadline(std::min(
+      MonoTime::Now() +
+          MonoDelta::FromMilliseconds(FLAGS_consensus_rpc_timeout_ms),
+      context->GetClientDeadline()));
+
+  weak_ptr<RaftConsensus> w = shared_from_this();
+  rpc::ResponseCallback callback = [w, proxy_req] {
+    if (auto consensus = w.lock()) {
+      consensus->ProxyResponseReceived(proxy_req);
+    } else {
+      proxy_req->responder->RespondFailure(
+          Status::Aborted("consensus instance was destroyed"));
+    }
+  };
+  proxy_req->forward_time = MonoTime::Now();
+  proxy_req->next_proxy->UpdateAsync(
+      &proxy_req->downstream_request,
+      &proxy_req->downstream_response,
+      &proxy_req->controller,
+      callback);
+}
+
+bool RaftConsensus::DropExpiredProxyRequest(
+    const std::shared_ptr<ProxyRequest>& proxy_req) {
+  ProxyResponder* context = proxy_req->responder.get();
+  if (PREDICT_TRUE(MonoTime::Now() < context->GetClientDeadline())) {
+    return false;
+  }
+  raft_proxy_num_requests_expired_->Increment();
+  VLOG_WITH_PREFIX(1) << "Dropping proxy request from "
+                      << context->requestor_string()
+                      << ": its caller has timed out";
+  context->RespondFailure(Status::TimedOut(
+      "caller's deadline passed before the request could be forwarded"));
+  return true;
+}
+
+void RaftConsensus::ProxyResponseReceived(
+    const std::shared_ptr<ProxyRequest>& proxy_req) {
+  ConsensusResponsePB* response = proxy_req->response;
+  ProxyResponder* context = proxy_req->responder.get();
+  const ConsensusResponsePB& downstream_response =
+      proxy_req->downstream_response;
+
+  if (PREDICT_FALSE(!proxy_req->controller.status().ok())) {
+    RET_RESPOND_ERROR_NOT_OK(
+        proxy_req->controller.status().CloneAndPrepend(Substitute(
+            "Error proxying request from $0 to $1",
+            SecureShortDebugString(local_peer_pb_),
+            SecureShortDebugString(proxy_req->next_peer_pb))));
   }
 
   // Proxy the response back to the caller.
@@ -5366,8 +8061,11 @@ void RaftConsensus::HandleProxyRequest(
   if (downstream_response.has_error()) {
     *response->mutable_error() = downstream_response.error();
   }
+  response->set_proxy_uuid(peer_uuid());
+  response->set_proxy_downstream_rtt_us(
+      (MonoTime::Now() - proxy_req->forward_time).ToMicroseconds());
 
-  if (!degraded_to_heartbeat) {
+  if (!proxy_req->degraded_to_heartbeat) {
     raft_proxy_num_requests_success_->Increment();
   }
 
@@ -5424,12 +8122,144 @@ Status RaftConsensus::LoadCompressionDict(const std::string& filename) {
   }
 
   LockGuard l(lock_);
-  RETURN_NOT_OK(queue_->SetCompressionDictionary(dict_buffer));
-  persistent_vars_->set_compression_dictionary(dict_buffer);
+  return SetCompressionDictUnlocked(dict_buffer);
+}
+
+Status RaftConsensus::SetCompressionDictUnlocked(const std::string& dict) {
+  DCHECK(lock_.is_locked());
+  RETURN_NOT_OK(queue_->SetCompressionDictionary(dict));
+  persistent_vars_->set_compression_dictionary(dict);
   RETURN_NOT_OK(persistent_vars_->Flush());
   return Status::OK();
 }
 
+void RaftConsensus::TrainCompressionDict() {
+  ThreadPool* pool = DictTrainingPool();
+  if (!pool) {
+    return;
+  }
+  // Training takes a while, so it runs on a pool of its own rather than
+  // holding up the timer's reactor thread or this group's Raft tasks.
+  WARN_NOT_OK(
+      pool->SubmitFunc(std::bind(
+          &RaftConsensus::TrainCompressionDictTask, shared_from_this())),
+      LogPrefixThreadSafe() + "failed to submit dictionary training task");
+}
+
+void RaftConsensus::TrainCompressionDictTask() {
+  // Too few samples would make for a dictionary worse than none.
+  const size_t kMinSamples = 64;
+  // One sample out of this many is held out to evaluate the dictionary on.
+  const size_t kHeldOutEvery = 4;
+
+  vector<ReplicateRefPtr> samples;
+  {
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    if (state_ != kRunning) {
+      return;
+    }
+    // Followers sample what they append too: drop that.
+    queue_->log_cache()->TakePayloadSamples(&samples);
+    if (cmeta_->active_role() != RaftPeerPB::LEADER) {
+      return;
+    }
+  }
+  shared_ptr<CompressionCodec> current =
+      CompressionCodecManager::GetCurrentCodec();
+  if (!current || (current->type() != ZSTD_DICT &&
+                   current->type() != LZ4_DICT)) {
+    return;
+  }
+  if (samples.size() < kMinSamples) {
+    VLOG_WITH_PREFIX(1) << "Only " << samples.size()
+                        << " payloads sampled, not training a dictionary";
+    return;
+  }
+
+  vector<Slice> training;
+  vector<Slice> held_out;
+  for (size_t i = 0; i < samples.size(); i++) {
+    Slice payload(samples[i]->get()->write_payload().payload());
+    if (i % kHeldOutEvery == 0) {
+      held_out.push_back(payload);
+    } else {
+      training.push_back(payload);
+    }
+  }
+
+  string dict;
+  Status s = kudu::TrainCompressionDict(
+      training, FLAGS_raft_compression_dict_max_size, &dict);
+  if (!s.ok()) {
+    LOG_WITH_PREFIX(WARNING) << "Could not train a compression dictionary: "
+                             << s.ToString();
+    return;
+  }
+  compression_dicts_trained_->Increment();
+
+  shared_ptr<CompressionCodec> candidate;
+  s = CompressionCodecManager::GetCodec(current->type(), &candidate);
+  if (s.ok()) {
+    s = candidate->SetDictionary(dict);
+  }
+  if (s.ok()) {
+    s = candidate->SetCompressionLevel(current->CompressionLevel());
+  }
+  CompressionEvaluation current_eval;
+  CompressionEvaluation candidate_eval;
+  if (s.ok()) {
+    s = EvaluateCompressionCodec(current.get(), held_out, &current_eval);
+  }
+  if (s.ok()) {
+    s = EvaluateCompressionCodec(candidate.get(), held_out, &candidate_eval);
+  }
+  if (!s.ok()) {
+    LOG_WITH_PREFIX(WARNING)
+        << "Could not evaluate the trained compression dictionary: "
+        << s.ToString();
+    return;
+  }
+
+  const string summary = Substitute(
+      "ratio $0 in $1 us with dict $2, ratio $3 in $4 us with trained dict $5 "
+      "of $6 bytes, on $7 held out payloads",
+      current_eval.Ratio(),
+      current_eval.compress_micros,
+      CompressionCodecManager::GetDictionaryID(current->GetDictionary()),
+      candidate_eval.Ratio(),
+      candidate_eval.compress_micros,
+      CompressionCodecManager::GetDictionaryID(dict),
+      dict.size(),
+      held_out.size());
+  if (candidate_eval.Ratio() <
+          current_eval.Ratio() *
+              (1 + FLAGS_raft_compression_dict_min_improvement) ||
+      candidate_eval.compress_micros >
+          current_eval.compress_micros *
+              FLAGS_raft_compression_dict_max_slowdown) {
+    LOG_WITH_PREFIX(INFO) << "Keeping the compression dictionary: "
+                          << summary;
+    return;
+  }
+
+  ThreadRestrictions::AssertWaitAllowed();
+  LockGuard l(lock_);
+  if (state_ != kRunning || cmeta_->active_role() != RaftPeerPB::LEADER) {
+    return;
+  }
+  s = SetCompressionDictUnlocked(dict);
+  if (!s.ok()) {
+    LOG_WITH_PREFIX_UNLOCKED(WARNING)
+        << "Could not roll out the trained compression dictionary: "
+        << s.ToString();
+    return;
+  }
+  compression_dicts_rolled_out_->Increment();
+  LOG_WITH_PREFIX_UNLOCKED(INFO)
+      << "Rolled out a trained compression dictionary: " << summary;
+}
+
 std::string RaftConsensus::GetCompressionStats() const {
   LockGuard l(lock_);
   auto codec = CompressionCodecManager::GetCurrentCodec();
@@ -5456,6 +8286,9 @@ void RaftConsensus::GetProxyPolicy(std::string* proxy_policy) {
     case ProxyPolicy::DURABLE_ROUTING_POLICY:
       *proxy_policy = "DURABLE_ROUTING_POLICY";
       break;
+    case ProxyPolicy::LATENCY_AWARE_ROUTING_POLICY:
+      *proxy_policy = "LATENCY_AWARE_ROUTING_POLICY";
+      break;
     default:
       *proxy_policy = "UNKNOWN";
       break;
@@ -5524,11 +8357,44 @@ ConsensusRound::ConsensusRound(
 }
 
 void ConsensusRound::NotifyReplicationFinished(const Status& status) {
+  ReleaseAdmission();
+  NotifyLocalRegionDurable(status);
+  if (apply_pipeline_ && status.ok()) {
+    apply_pipeline_->Submit(apply_partition_key_, this);
+    return;
+  }
+  RunReplicatedCallback(status);
+}
+
+void ConsensusRound::RunReplicatedCallback(const Status& status) {
   if (PREDICT_FALSE(!replicated_cb_))
     return;
   replicated_cb_(status);
 }
 
+void ConsensusRoundHandler::ApplyCommittedRounds(
+    const vector<scoped_refptr<ConsensusRound>>& rounds) {
+  for (const auto& round : rounds) {
+    round->RunReplicatedCallback(Status::OK());
+  }
+}
+
+void ConsensusRound::ReleaseAdmission() {
+  ReplicateAdmissionController* admission = admission_.exchange(nullptr);
+  if (admission) {
+    admission->Release(tenant_, admitted_bytes_, admitted_, MonoTime::Now());
+  }
+}
+
+void ConsensusRound::NotifyLocalRegionDurable(const Status& status) {
+  if (!local_region_durable_cb_) {
+    return;
+  }
+  StdStatusCallback cb = std::move(local_region_durable_cb_);
+  local_region_durable_cb_ = nullptr;
+  cb(status);
+}
+
 Status ConsensusRound::CheckBoundTerm(int64_t current_term) const {
   if (PREDICT_FALSE(bound_term_ != -1 && bound_term_ != current_term)) {
     return Status::Aborted(strings::Substitute(
@@ -26,9 +26,11 @@
 #include <atomic>
 #include <cstdint>
 #include <iosfwd>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -39,13 +41,17 @@
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/consensus_meta.h" // IWYU pragma: keep
 #include "kudu/consensus/consensus_queue.h"
+#include "kudu/consensus/durability_mode.h"
 #include "kudu/consensus/log.h"
+#include "kudu/consensus/log_retention_policy.h"
 #include "kudu/consensus/metadata.pb.h"
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/consensus/persistent_vars.h"
 #include "kudu/consensus/persistent_vars.pb.h"
+#include "kudu/consensus/phi_accrual_detector.h"
 #include "kudu/consensus/proxy_policy.h"
 #include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/consensus/replicate_admission.h"
 #include "kudu/consensus/routing.h"
 #include "kudu/gutil/callback.h"
 #include "kudu/gutil/gscoped_ptr.h"
@@ -58,6 +64,7 @@
 #include "kudu/tserver/tserver.pb.h" // @manual
 #endif
 
+#include "kudu/util/async_util.h"
 #include "kudu/util/atomic.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/locks.h"
@@ -94,25 +101,60 @@ class RpcContext;
 
 namespace tserver {
 class TSTabletManager;
+class TSTabletManagerTest_TestInlineHeartbeats_Test;
 }
 
 namespace consensus {
 
+class ApplyPipeline;
 class ConsensusMetadataManager;
 class ConsensusRound;
 class ConsensusRoundHandler;
+class LogSubscriptionManager;
 class PeerManager;
+class PeerProxy;
 class PeerProxyFactory;
 class PersistentVarsManager;
 class PendingRounds;
+class SnapshotProvider;
 struct ConsensusBootstrapInfo;
 struct ElectionResult;
 class VoteLoggerInterface;
+class VoterRttTracker;
+class WorkloadCapture;
+
+// Where the response to a proxied request goes once it is filled in: back
+// over the RPC the request came in, or into the batch of a fan-out request,
+// see RaftConsensus::HandleProxyRequest().
+class ProxyResponder {
+ public:
+  virtual ~ProxyResponder() {}
+
+  // When the caller stops waiting for the response.
+  virtual MonoTime GetClientDeadline() const = 0;
+
+  // A description of the caller, for logging.
+  virtual std::string requestor_string() const = 0;
+
+  // The response, which may carry an error, is filled in.
+  virtual void RespondSuccess() = 0;
+
+  // As RespondSuccess(), for a response that carries an error.
+  virtual void RespondNoCache() = 0;
+
+  // The request failed without a response.
+  virtual void RespondFailure(const Status& status) = 0;
+
+  // The request was turned down, and may be retried later.
+  virtual void RespondTooBusy(const Status& status) = 0;
+};
 
 struct ConsensusOptions {
   std::string tablet_id;
   ProxyPolicy proxy_policy;
   boost::optional<std::string> initial_raft_rpc_token;
+  // When the ops are acked and committed, see durability_mode.h.
+  DurabilityMode durability_mode = DurabilityMode::DURABLE;
 };
 
 struct TabletVotingState {
@@ -286,6 +328,14 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // If the failure detector is already disabled, has no effect.
   void DisableFailureDetector();
 
+  // Makes a follower of a quiesced group (see --raft_enable_quiescence) watch
+  // the leader at the regular election timeout again. Meant to be called when
+  // a node-level liveness signal, e.g. of the leader's server, fails: if the
+  // leader is indeed gone, an election follows.
+  //
+  // Has no effect if the failure detector isn't quiesced.
+  void Unquiesce();
+
   // Pauses outgoing votes from this server during elections, if set to true.
   void SetWithholdVotesForTests(bool withhold_votes);
 
@@ -407,8 +457,9 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
 
   // Begin or end a leadership transfer period. During a transfer period, a
   // leader will not accept writes or config changes, but will continue updating
-  // followers. If a leader transfer period is already in progress,
-  // BeginLeaderTransferPeriodUnlocked returns ServiceUnavailable.
+  // followers. With --raft_fast_leader_transfer, it keeps accepting them until
+  // the successor has nearly caught up. If a leader transfer period is already
+  // in progress, BeginLeaderTransferPeriodUnlocked returns ServiceUnavailable.
   Status BeginLeaderTransferPeriodUnlocked(
       const boost::optional<std::string>& successor_uuid,
       const std::function<bool(const kudu::consensus::RaftPeerPB&)>& filter_fn,
@@ -462,6 +513,19 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // This method can only be called on the leader, i.e. role() == LEADER
   Status Replicate(const scoped_refptr<ConsensusRound>& round);
 
+  // Like Replicate(), but for a batch of rounds which get consecutive OpIds
+  // and are appended to the queue, and so written to the log, together, with
+  // a single acquisition of the locks.
+  //
+  // The rounds are checked up front, and all of them are rejected if any of
+  // them can't be replicated. Should adding one of them to the pending rounds
+  // fail afterwards, that one and the following ones are not replicated,
+  // while the preceding ones are, as if they had been passed to Replicate().
+  //
+  // Config changes can't be part of a batch.
+  Status ReplicateBatch(
+      const std::vector<scoped_refptr<ConsensusRound>>& rounds);
+
   // Ensures that the consensus implementation is currently acting as LEADER,
   // and thus is allowed to submit operations to be prepared before they are
   // replicated. To avoid a time-of-check-to-time-of-use (TOCTOU) race, the
@@ -470,6 +534,71 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // verify that the term has not changed in the meantime.
   Status CheckLeadershipAndBindTerm(const scoped_refptr<ConsensusRound>& round);
 
+  // Checks that this replica is the leader and holds its lease (see
+  // --enable_leader_leases), which means that no other replica can have been
+  // elected leader and committed anything this one doesn't know about. It is
+  // then safe to serve a linearizable read locally, without replicating
+  // anything, once the ops up to '*read_index' have been applied.
+  //
+  // Returns IllegalState if this replica is not the leader, and
+  // ServiceUnavailable if it has no lease right now: it has not heard from a
+  // quorum lately, it is transferring its leadership, or it has not yet
+  // committed an op of its own term.
+  Status CheckLeaseForRead(int64_t* read_index);
+
+  // Called with the read index, or with an error if none could be had.
+  typedef std::function<void(const Status& s, int64_t read_index)>
+      ReadIndexCallback;
+
+  // The leader side of ReadIndex(): calls 'callback' with the commit index
+  // once this replica confirmed that it was still the leader when it was
+  // called, which takes a quorum of the voters accepting a request sent
+  // since. All the reads waiting share the next round of heartbeats. With a
+  // lease (see CheckLeaseForRead()) the callback runs right away.
+  void GetReadIndexAsync(ReadIndexCallback callback);
+
+  // Called with the OpIds of the ops submitted, in order, once all of them
+  // are replicated, or with the first error.
+  typedef std::function<void(const Status& s, const std::vector<OpId>& ids)>
+      SubmitOpsCallback;
+
+  // The leader side of SubmitOps(): replicates the ops of 'req' as a batch of
+  // write ops, see ReplicateBatch(), on behalf of a RaftClient. The round
+  // handler's StartLeaderTransaction() sees each of the rounds first, to set
+  // how it is applied, and 'callback' runs once their replicated callbacks
+  // did. If the replica isn't the leader, none of the ops are replicated and
+  // 'callback' gets an IllegalState. The ops a failed batch didn't append
+  // don't run their replicated callbacks.
+  void SubmitOpsAsync(
+      const SubmitOpsRequestPB& req,
+      SubmitOpsCallback callback);
+
+  // The committed ops this replica has yet to apply: those the apply
+  // pipeline holds and those the round handler reports, see
+  // ConsensusRoundHandler::ApplyBacklog(). Followers report it to the
+  // leader, which holds back the ops it sends them when it grows, see
+  // --consensus_max_peer_apply_backlog_ops.
+  int64_t ApplyBacklogOps() const;
+
+  // Waits, for up to 'timeout', until this replica has committed all the ops
+  // that the leader had committed when this was called, and sets
+  // '*read_index' to the index of the last of them. A linearizable read may
+  // then be served locally once the ops up to '*read_index' have been
+  // applied. On a follower this asks the leader for its read index with the
+  // ReadIndex RPC.
+  Status ReadIndex(const MonoDelta& timeout, int64_t* read_index);
+
+  // Returns the index through which this leader's ops are durable on a
+  // majority of the voters in its region, while the commit rule may still be
+  // waiting for other regions. See
+  // ConsensusRound::SetLocalRegionDurableCallback() to wait for a round.
+  int64_t GetLocalRegionDurableIndex() const;
+
+  // The stats of the tenants of the ops replicated while LEADER, with
+  // admission control enabled, see --raft_admission_max_outstanding_bytes.
+  std::map<std::string, ReplicateAdmissionController::TenantStats>
+  GetAdmissionStats() const;
+
   // Messages sent from LEADER to FOLLOWERS and LEARNERS to update their
   // state machines. This is equivalent to "AppendEntries()" in Raft
   // terminology.
@@ -494,9 +623,13 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // error response could not be formed, which will result in the service
   // returning an UNKNOWN_ERROR RPC error code to the caller and including the
   // stringified Status message.
+  //
+  // If the ops of 'request' were parsed on 'ops_arena' (see UncompressOps()),
+  // the ops taken from the request keep it alive.
   Status Update(
       const ConsensusRequestPB* request,
-      ConsensusResponsePB* response);
+      ConsensusResponsePB* response,
+      scoped_refptr<RefCountedArena> ops_arena = nullptr);
 
   // Messages sent from CANDIDATEs to voting peers to request their vote
   // in leader election.
@@ -509,6 +642,31 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
       TabletVotingState tablet_voting_state,
       VoteResponsePB* response);
 
+  // Registers the snapshots of the state machine, which catch up the peers
+  // behind the leader's log and let the log below the latest snapshot be
+  // garbage collected. Must be called before Start(), and 'provider' must
+  // outlive this instance. See SnapshotProvider.
+  void SetSnapshotProvider(SnapshotProvider* provider) {
+    snapshot_provider_ = provider;
+  }
+
+  // Handles a chunk of the leader's latest snapshot, sent because this
+  // replica is behind the leader's log. Once the last chunk is written,
+  // the snapshot is installed: the ops after the committed index are
+  // aborted and the replica goes on from the op after the snapshot.
+  //
+  // Returns OK if 'response' has been filled in. A non-OK Status results in
+  // an error response.
+  Status InstallSnapshot(
+      const InstallSnapshotRequestPB* request,
+      InstallSnapshotResponsePB* response);
+
+  // The subscribers streaming the committed ops of this replica, or null
+  // before Start(). See LogSubscriptionManager.
+  LogSubscriptionManager* log_subscriptions() const {
+    return log_subscriptions_.get();
+  }
+
   // Utility Function:
   // From a simple ChangeConfigRequest, create a BulkChangeConfigRequest
   static void GetBulkConfigChangeRequest(
@@ -634,6 +792,12 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
     return time_manager_;
   }
 
+  // Returns the log this consensus instance replicates into, or NULL if it
+  // was not started yet.
+  scoped_refptr<log::Log> log() const {
+    return log_;
+  }
+
   // Return the minimum election timeout. Due to backoff and random
   // jitter, election timeouts may be longer than this.
   MonoDelta MinimumElectionTimeout() const;
@@ -651,6 +815,15 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
       ConsensusStatePB* cstate,
       IncludeHealthReport report_health = EXCLUDE_HEALTH_REPORT) const;
 
+  // Fills in 'summary' with the role, term and leader of this replica, its
+  // indexes and, on the leader, how far behind its peers are. Meant for
+  // health checks polled at a high rate: the summary is cached, rebuilt at
+  // most every --consensus_health_summary_refresh_ms or as soon as the
+  // ConsensusStateSnapshot changes, and 'lock_' is never taken while the
+  // snapshot is current.
+  // Returns Status::IllegalState if RaftConsensus is not running.
+  Status GetHealthSummary(ConsensusHealthSummaryPB* summary) const;
+
   // Returns a copy of the current committed Raft configuration.
   RaftConfigPB CommittedConfig() const;
 
@@ -659,6 +832,10 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
 
   void DumpStatusHtml(std::ostream& out) const;
 
+  // Returns the rolling replication history of each remote peer kept while
+  // leader, as JSON. See PeerHealthHistory.
+  std::string PeerHealthHistoryJson() const;
+
   // Transition to kStopped state. See State enum definition for details.
   // This is a no-op if the tablet is already in kStopped or kShutdown state;
   // otherwise, Raft will pass through the kStopping state on the way to
@@ -702,15 +879,27 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
 
   void NotifyPeerHealthChange() override;
 
+  // Notifies the pending rounds through 'index' that they are durable in
+  // this leader's region.
+  void NotifyLocalRegionDurableIndex(int64_t index) override;
+
   // Return the log indexes which the consensus implementation would like to
   // retain.
   //
   // The returned 'for_durability' index ensures that no logs are GCed before
   // the operation is fully committed. The returned 'for_peers' index indicates
   // the index of the farthest-behind peer so that the log will try to avoid
-  // GCing these before the peer has caught up.
+  // GCing these before the peer has caught up. With
+  // --log_retention_policy_enabled, 'for_peers' is instead decided by
+  // DecideLogRetention() from the lag of the peers and the free space of the
+  // WAL disk. Either way, with a SnapshotProvider, 'for_peers' is no lower
+  // than the op after the latest snapshot.
   log::RetentionIndexes GetRetentionIndexes();
 
+  // Returns the last decision made by GetRetentionIndexes() with
+  // --log_retention_policy_enabled.
+  LogRetentionDecision GetLastLogRetentionDecision() const;
+
   // Return the on-disk size of the consensus metadata, in bytes.
   int64_t MetadataOnDiskSize() const;
 
@@ -719,13 +908,49 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // Returns true if the request is intended to be proxied.
   bool IsProxyRequest(const ConsensusRequestPB* request) const;
 
+  // Returns true if no other update holds 'update_lock_' and no pipelined log
+  // append is outstanding, i.e. if a heartbeat handled now would neither
+  // block on the lock nor wait on the log. This is only a hint, another update
+  // may come in right after.
+  bool CanUpdateWithoutWaiting() const;
+
   // Handle proxy RPC request.
-  // This method is intended to be executed on an RPC worker thread.
+  // This method is intended to be executed on an RPC worker thread. It does
+  // not wait for the proxied ops nor for the next hop: if the ops are not in
+  // the local log yet, the request is parked until they are appended (or
+  // --raft_log_cache_proxy_wait_time_ms elapses) and resumed on the raft pool.
   void HandleProxyRequest(
       const ConsensusRequestPB* request,
       ConsensusResponsePB* response,
       rpc::RpcContext* context);
 
+  // As above, responding through 'responder': used for the requests of a
+  // fan-out batch, which share an RPC. 'request' and 'response' must stay
+  // valid until 'responder' is called.
+  void HandleProxyRequest(
+      const ConsensusRequestPB* request,
+      ConsensusResponsePB* response,
+      std::shared_ptr<ProxyResponder> responder);
+
+  // A proxied request in flight. See HandleProxyRequest().
+  struct ProxyRequest;
+
+  // Fills in the downstream request of 'proxy_req' from the local log, or
+  // degrades it to a heartbeat if 'timed_out', and forwards it.
+  void ReconstituteAndForwardProxyRequest(
+      const std::shared_ptr<ProxyRequest>& proxy_req,
+      bool timed_out);
+
+  // Sends the downstream request of 'proxy_req' to the next hop.
+  void ForwardProxyRequest(const std::shared_ptr<ProxyRequest>& proxy_req);
+
+  // Responds with a timeout and returns true if the caller of 'proxy_req'
+  // has already given up on it, which makes forwarding it pointless.
+  bool DropExpiredProxyRequest(const std::shared_ptr<ProxyRequest>& proxy_req);
+
+  // Relays the response of the next hop back to the caller of 'proxy_req'.
+  void ProxyResponseReceived(const std::shared_ptr<ProxyRequest>& proxy_req);
+
   // Trigger that a non-Transaction ConsensusRound has finished replication.
   // If the replication was successful, an status will be OK. Otherwise, it
   // may be Aborted or some other error status.
@@ -751,6 +976,9 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // Load and set compression dictionary from file
   Status LoadCompressionDict(const std::string& filename);
 
+  // Rolls out 'dict' to the peers and persists it.
+  Status SetCompressionDictUnlocked(const std::string& dict);
+
   std::string GetCompressionStats() const;
 
   // Clear the 'removed_peers_' list managed by consensus_meta
@@ -773,6 +1001,7 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
  private:
   friend class RaftConsensusQuorumTest;
   friend class tserver::TSTabletManager;
+  friend class tserver::TSTabletManagerTest_TestInlineHeartbeats_Test;
   friend class facebook::datashuttle::KuduRingManager;
   FRIEND_TEST(
       RaftConsensusQuorumTest,
@@ -784,7 +1013,13 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   FRIEND_TEST(
       RaftConsensusQuorumTest,
       TestReplicasEnforceTheLogMatchingProperty);
+  FRIEND_TEST(
+      RaftConsensusQuorumTest,
+      TestPipelinedHeartbeatWaitsForDurableOps);
   FRIEND_TEST(RaftConsensusQuorumTest, TestRequestVote);
+  FRIEND_TEST(RaftConsensusQuorumTest, TestConsensusStateSnapshot);
+  FRIEND_TEST(RaftConsensusQuorumTest, TestLeaderTransferPausesWrites);
+  FRIEND_TEST(RaftConsensusQuorumTest, TestFastLeaderTransferPausesWritesLate);
 
   // RaftConsensus lifecycle states.
   //
@@ -837,6 +1072,8 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
     // The positional index of the first message selected to be appended, in the
     // original leader's request message sequence.
     int64_t first_message_idx;
+    // The arena the ops of the request were parsed on, if any.
+    scoped_refptr<RefCountedArena> ops_arena;
 
     std::string OpsRangeString() const;
   };
@@ -905,9 +1142,25 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // log and triggering the required transactions. This method won't return
   // until all operations have been stored in the log and all Prepares() have
   // been completed, and a replica cannot accept any more Update() requests
-  // until this is done.
+  // until this is done, unless --follower_pipeline_updates is set: then
+  // 'update_lock', which holds 'update_lock_', is released once the
+  // operations are enqueued to the log.
   Status UpdateReplica(
       const ConsensusRequestPB* request,
+      ConsensusResponsePB* response,
+      std::unique_lock<simple_mutexlock>* update_lock,
+      scoped_refptr<RefCountedArena> ops_arena);
+
+  // Waits for the log append 'sync' to finish, snoozing the failure detector
+  // so that the wait on our own log doesn't start an election.
+  Status WaitForLogAppend(const Synchronizer& sync);
+
+  // Called once the ops 'response' reports as received are durable, after a
+  // wait without 'update_lock_'. Turns 'response' into an INVALID_TERM error
+  // if the term advanced meanwhile: the ops may have been overwritten, or
+  // not been counted in a vote.
+  void CheckTermAfterLogWait(
+      const ConsensusRequestPB& request,
       ConsensusResponsePB* response);
 
   // Deduplicates an RPC request making sure that we get only messages that we
@@ -962,6 +1215,11 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   Status StartFollowerTransactionUnlocked(
       const ReplicateMsgWrapper& msg_wrapper);
 
+  // Returns true if this node stores the ops it's sent without their
+  // payloads, i.e. with --raft_witness_strip_payloads when the active config
+  // has it without a database. 'lock_' must be held.
+  bool ShouldStripPayloadsUnlocked() const;
+
   // Returns true if this node is the only voter in the Raft configuration.
   bool IsSingleVoterConfig() const;
 
@@ -1032,6 +1290,35 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
       const std::string& withhold_reason,
       VoteResponsePB* response);
 
+  // Denies a vote which is bound to fail (because we believe the leader
+  // to be alive, or the candidate is behind our term) from the published
+  // VoterState, without taking any lock. Returns false, without touching
+  // 'response', if the request has to go through the regular path.
+  bool RequestVoteFastPath(
+      const VoteRequestPB* request,
+      VoteResponsePB* response);
+
+  // Answers a vote request identical to one denied to the same candidate in
+  // the last --raft_vote_denial_cache_ms, in the current term, with the same
+  // denial. Returns false, without touching 'response', if there is no such
+  // denial.
+  bool RequestVoteFromDenialCache(
+      const VoteRequestPB* request,
+      VoteResponsePB* response);
+
+  // Remembers 'response' for RequestVoteFromDenialCache(), if it's a denial
+  // which stands for the rest of the term.
+  void CacheVoteDenial(
+      const VoteRequestPB* request,
+      const VoteResponsePB& response);
+
+  // Publishes the VoterState used by RequestVoteFastPath(). Must be called
+  // whenever the term, the vote, the last known leader or the state change.
+  void PublishVoterStateUnlocked();
+
+  // Sets 'withhold_votes_until_', and its lock-free copy.
+  void SetWithholdVotesUntilUnlocked(const MonoTime& until);
+
   // Respond to VoteRequest that the vote was not granted because we believe
   // the leader to be alive.
   Status RequestVoteRespondLeaderIsAlive(
@@ -1099,6 +1386,24 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
       boost::optional<std::string> reason_for_log = boost::none,
       boost::optional<MonoDelta> delta = boost::none);
 
+  // Stretches the failure detector to the quiesced heartbeat interval, or
+  // stops it if quiesced groups don't heartbeat, after a quiesced heartbeat
+  // from the leader.
+  void QuiesceFailureDetectorUnlocked();
+
+  // Undoes QuiesceFailureDetectorUnlocked(), if it is in effect.
+  void UnquiesceFailureDetectorUnlocked();
+
+  // Like Unquiesce(), for the vote requests answered without 'lock_': it is
+  // only taken if the failure detector is quiesced.
+  void MaybeUnquiesceFailureDetector();
+
+  // Snoozes the failure detector after a request from the leader
+  // 'leader_uuid', for the adaptive timeout of 'leader_heartbeats_' with
+  // --raft_phi_accrual_failure_detection once it is shorter than the regular
+  // one, and for the latter otherwise.
+  void SnoozeFailureDetectorForLeaderUnlocked(const std::string& leader_uuid);
+
   // Calculates a snooze delta for leader election.
   //
   // The delta increases exponentially with the difference between the current
@@ -1109,8 +1414,28 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   MonoDelta LeaderElectionExpBackoffDeltaUnlocked();
   MonoDelta LeaderElectionExpBackoffNotInConfig();
 
+  // Randomizes the election timeout between the minimum and 'backoff_factor'
+  // times it. With --raft_priority_elections, each election priority rank of
+  // the voters gets its own slice of that window, see
+  // ElectionPriorityRankUnlocked().
   MonoDelta TimeoutBackoffHelper(double backoff_factor);
 
+  // Sets '*rank' to how many of the distinct election priorities of the
+  // voters of the active config are higher than ours, and '*num_ranks' to how
+  // many there are. A replica whose log is behind the leader's committed index
+  // by more than --raft_priority_elections_max_lag_ops ranks after all of
+  // them. Returns false if there is nothing to rank.
+  bool ElectionPriorityRankUnlocked(int* rank, int* num_ranks);
+
+  // With --raft_priority_leader_reclaim, submits ReclaimLeadershipTask() at
+  // most every --raft_priority_leader_reclaim_delay_ms while leader, if a
+  // voter has a higher election priority than ours.
+  void MaybeReclaimLeadershipUnlocked();
+
+  // Hands leadership over to the caught up voter with the highest election
+  // priority, when it is higher than ours, through a leadership transfer.
+  void ReclaimLeadershipTask();
+
   // Handle when the term has advanced beyond the current term.
   //
   // 'flush' may be used to control whether the term change is flushed to disk.
@@ -1163,6 +1488,38 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // being shut down).
   void ReportFailureDetectedTask();
 
+  // Starts timing a failover, 'since_leader_contact' after this replica
+  // last heard from the leader, unless one is already being timed.
+  void StartFailoverTimeline(MonoDelta since_leader_contact);
+
+  // Records the end of the failover phases that 'commit_index' completes,
+  // once this replica has won the failover it timed.
+  void RecordFailoverCommitUnlocked(int64_t commit_index);
+
+  // Called by 'connection_warmer_'. Submits WarmPeerConnectionsTask() to a
+  // thread pool.
+  void WarmPeerConnections();
+
+  // While this replica is not the leader, sends a trivial call to every other
+  // member of the committed config, so that the connections a new leader
+  // needs are already negotiated when it is elected. The servers' idle
+  // connection scan sees the calls as activity, which keeps the connections
+  // open between rounds.
+  void WarmPeerConnectionsTask();
+
+  // Called by 'compression_dict_trainer_'. Submits TrainCompressionDictTask()
+  // to the shared dictionary training pool.
+  void TrainCompressionDict();
+
+  // While this replica is leader and a dictionary codec is in use, trains a
+  // dictionary on the payloads the log cache sampled since the previous
+  // round. Compresses every fourth payload, held out from training, with
+  // both the current and the trained dictionary, and rolls the trained one
+  // out if it compresses enough better without being too much slower. The
+  // peers get the dictionary along with the first msgs compressed with it,
+  // as with LoadCompressionDict().
+  void TrainCompressionDictTask();
+
   // Handle the completion of replication of a config change operation.
   // If 'status' is OK, this takes care of persisting the new configuration
   // to disk as the committed configuration. A non-OK status indicates that
@@ -1173,8 +1530,36 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
       const Status& status);
 
   // As a leader, append a new ConsensusRound to the queue.
+  //
+  // 'replicate_start', if initialized, is when Replicate() was called, for
+  // the op tracing. See OpTracer.
   Status AppendNewRoundToQueueUnlocked(
-      const scoped_refptr<ConsensusRound>& round);
+      const scoped_refptr<ConsensusRound>& round,
+      MonoTime replicate_start = MonoTime());
+
+  // As a leader, append new ConsensusRounds to the queue with a single
+  // append, see ReplicateBatch().
+  Status AppendNewRoundsToQueueUnlocked(
+      const std::vector<scoped_refptr<ConsensusRound>>& rounds,
+      MonoTime replicate_start);
+
+  // Starts tracing the op 'id' if it is sampled, see OpTracer.
+  void MaybeStartTracingOpUnlocked(const OpId& id, MonoTime replicate_start);
+
+  // Records 'msg', which came from 'source' in a call with 'batch_size' ops,
+  // if the workload is being captured. See WorkloadCapture.
+  void MaybeCaptureOp(
+      const ReplicateRefPtr& msg,
+      CapturedOpPB::Source source,
+      int batch_size);
+
+  // Inits 'msg_wrappers', compressing their msgs on the compression pool in
+  // parallel if --raft_compression_threads is set, and stores the outcome
+  // for each in 'statuses'. Returns once all are done, so the msgs keep
+  // their order.
+  void InitMsgWrappersUnlocked(
+      std::vector<ReplicateMsgWrapper>* msg_wrappers,
+      std::vector<Status>* statuses);
 
   // As a follower, start a consensus round not associated with a Transaction.
   Status StartConsensusOnlyRoundUnlocked(const ReplicateRefPtr& msg);
@@ -1192,6 +1577,17 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   Status CheckSafeToReplicateUnlocked(const ReplicateMsg& msg) const
       WARN_UNUSED_RESULT;
 
+  // Returns ServiceUnavailable if new ops shouldn't be replicated for now, as
+  // the log caches are close to their server-wide memory limit even after
+  // evicting the ops replicated to all peers, or the process is over its soft
+  // memory limit, and updates the raft_replication_throttled gauge.
+  Status CheckMemoryPressureUnlocked() WARN_UNUSED_RESULT;
+
+  // Returns ServiceUnavailable if the admission control turns 'round' down,
+  // or admits it at 'now', see ReplicateAdmissionController.
+  Status AdmitRoundUnlocked(ConsensusRound* round, MonoTime now)
+      WARN_UNUSED_RESULT;
+
   // Return Status::IllegalState if 'state_' != kRunning, OK otherwise.
   Status CheckRunningUnlocked() const WARN_UNUSED_RESULT;
 
@@ -1199,6 +1595,23 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // Returns OK if leader, IllegalState otherwise.
   Status CheckActiveLeaderUnlocked() const WARN_UNUSED_RESULT;
 
+  // Whether the leadership transfer in progress rejects writes now. See
+  // --raft_fast_leader_transfer.
+  bool LeaderTransferPausesWritesUnlocked() const;
+
+  // Start or end timing how long writes are paused for a leadership
+  // transfer. Starting again while paused does nothing.
+  void StartTransferWritePause() const;
+  void EndTransferWritePause();
+
+  // Returns OK if this replica is the leader and has committed an op of its
+  // term, which it needs to know the commit index of the config.
+  Status CheckLeaderForReadUnlocked() const WARN_UNUSED_RESULT;
+
+  // CheckLeaseForRead(), with 'lock_' held.
+  Status CheckLeaseForReadUnlocked(int64_t* read_index) const
+      WARN_UNUSED_RESULT;
+
   // Returns OK if there is currently *no* configuration change pending, and
   // IllegalState is there *is* a configuration change pending.
   Status CheckNoConfigChangePendingUnlocked() const WARN_UNUSED_RESULT;
@@ -1249,6 +1662,23 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   Status SetVotedForCurrentTermUnlocked(const std::string& uuid)
       WARN_UNUSED_RESULT;
 
+  // Flushes the consensus metadata to disk. Between
+  // DeferCmetaFlushesUnlocked() and EndDeferCmetaFlushesUnlocked() the flush
+  // is only prepared: the term and vote changes of a critical section then
+  // get written out with a single fsync once 'lock_' is released, see
+  // FlushDeferredCmeta().
+  void FlushCmetaUnlocked();
+  void DeferCmetaFlushesUnlocked();
+
+  // Returns the version of the consensus metadata to pass to
+  // FlushDeferredCmeta(), or 0 if nothing was prepared.
+  uint64_t EndDeferCmetaFlushesUnlocked();
+
+  // Makes the changes prepared under 'lock_' durable. Must be called without
+  // 'lock_' held, and before anything depending on their durability (e.g. a
+  // vote response or a vote request) leaves this server.
+  void FlushDeferredCmeta(uint64_t version);
+
   // Return replica's vote for the current term.
   // The vote must be set; use HasVotedCurrentTermUnlocked() to check.
   const std::string& GetVotedForCurrentTermUnlocked() const;
@@ -1259,16 +1689,35 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   boost::optional<OpId> GetLastOpIdUnlocked(OpIdType type);
 
   std::string LogPrefix() const;
-  std::string LogPrefixUnlocked() const;
+  // Only formats the prefix again when the term or the role changed since the
+  // last call, see 'log_prefix_'.
+  const std::string& LogPrefixUnlocked() const;
 
   // A variant of LogPrefix which does not take the lock. This is a slightly
   // less thorough prefix which only includes immutable (and thus thread-safe)
-  // information, but does not require the lock.
-  std::string LogPrefixThreadSafe() const;
+  // information, but does not require the lock. Formatted once, at
+  // construction.
+  const std::string& LogPrefixThreadSafe() const;
 
   std::string ToString() const;
   std::string ToStringUnlocked() const;
 
+  // What the observers (role(), CurrentTerm(), ConsensusState(), ...) read,
+  // so that monitoring does not contend on 'lock_' with the replication path.
+  // It is immutable once published, and current as long as the versions
+  // match.
+  struct ConsensusStateSnapshot {
+    uint64_t cmeta_version;
+    uint64_t state_version;
+    State state;
+    RaftPeerPB::Role role;
+    ConsensusStatePB cstate;
+  };
+
+  // Returns the current snapshot, rebuilding it under 'lock_' if it is stale.
+  std::shared_ptr<const ConsensusStateSnapshot> GetConsensusStateSnapshot()
+      const;
+
   ConsensusMetadata* consensus_metadata_for_tests() const;
 
   void SetElectionDecisionCallback(ElectionDecisionCallback edcb);
@@ -1299,13 +1748,35 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   //
   // Lock ordering note: If both 'update_lock_' and 'lock_' are to be taken,
   // 'update_lock_' lock must be taken first.
-  mutable simple_mutexlock update_lock_;
+  mutable simple_mutexlock update_lock_{"RaftConsensus::update_lock_"};
+
+  // The log append of the last request that released 'update_lock_' before
+  // its ops were durable, see --follower_pipeline_updates. Protected by
+  // 'update_lock_'.
+  boost::optional<Synchronizer> pipelined_log_append_;
 
   // Coarse-grained lock that protects all mutable data members.
-  mutable simple_mutexlock lock_;
+  mutable simple_mutexlock lock_{"RaftConsensus::lock_"};
 
   State state_;
 
+  // Bumped on every change of 'state_', see ConsensusStateSnapshot.
+  std::atomic<uint64_t> state_version_;
+
+  // The last ConsensusStateSnapshot built, accessed atomically.
+  mutable std::shared_ptr<const ConsensusStateSnapshot>
+      consensus_state_snapshot_;
+
+  // The last summary built by GetHealthSummary(), accessed atomically. It is
+  // current as long as 'source' is the current ConsensusStateSnapshot and it
+  // is not older than --consensus_health_summary_refresh_ms.
+  struct HealthSummary {
+    std::shared_ptr<const ConsensusStateSnapshot> source;
+    MonoTime built_at;
+    ConsensusHealthSummaryPB summary;
+  };
+  mutable std::shared_ptr<const HealthSummary> health_summary_;
+
   // Consensus metadata persistence object.
   scoped_refptr<ConsensusMetadata> cmeta_;
 
@@ -1330,7 +1801,15 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // When we receive a message from a remote peer telling us to start a
   // transaction, or finish a round, we use this handler to handle it.
   // This may update replica state (e.g. the tablet replica).
-  ConsensusRoundHandler* round_handler_;
+  ConsensusRoundHandler* round_handler_ = nullptr;
+
+  // See SetSnapshotProvider(). May be null.
+  SnapshotProvider* snapshot_provider_ = nullptr;
+
+  // The snapshot being installed from the leader, and the offset of the next
+  // chunk it needs, see InstallSnapshot(). Protected by 'lock_'.
+  boost::optional<SnapshotInfoPB> installing_snapshot_;
+  int64_t installing_snapshot_offset_ = 0;
 
   std::unique_ptr<PeerManager> peer_manager_;
 
@@ -1342,15 +1821,74 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // TODO(todd) these locks will become more fine-grained.
   std::unique_ptr<PendingRounds> pending_;
 
+  // Set if --consensus_workload_capture_dir is.
+  std::unique_ptr<WorkloadCapture> workload_capture_;
+
   Random rng_;
 
   std::shared_ptr<rpc::PeriodicTimer> failure_detector_;
   std::chrono::system_clock::time_point failure_detector_last_snoozed_;
 
+  // Whether the failure detector was quiesced by a heartbeat of the leader.
+  // Written under 'lock_', and read without it by
+  // MaybeUnquiesceFailureDetector().
+  std::atomic<bool> failure_detector_quiesced_{false};
+
+  // The intervals between the leader's requests, with
+  // --raft_phi_accrual_failure_detection. Protected by 'lock_'.
+  PhiAccrualDetector leader_heartbeats_;
+
+  // Null unless --raft_admission_max_outstanding_bytes or a tenant rate is
+  // set. See Replicate().
+  std::unique_ptr<ReplicateAdmissionController> admission_controller_;
+  // Whether the failure detector was last snoozed for the adaptive timeout of
+  // 'leader_heartbeats_', which is then 'adaptive_election_timeout_' before
+  // randomization. The latter is protected by 'lock_'.
+  std::atomic<bool> failure_detector_adaptive_{false};
+  MonoDelta adaptive_election_timeout_;
+
+  // The committed index of the last request from the leader, which
+  // ElectionPriorityRankUnlocked() measures the freshness of our log against.
+  // Protected by 'lock_'.
+  int64_t leader_committed_index_ = -1;
+
+  // When MaybeReclaimLeadershipUnlocked() may next look for a voter with a
+  // higher election priority. Protected by 'lock_'.
+  MonoTime next_leadership_reclaim_;
+
   AtomicBool leader_transfer_in_progress_;
+  // Whether the transfer in progress was started with
+  // --raft_fast_leader_transfer.
+  AtomicBool fast_leader_transfer_{false};
+  // When the transfer in progress started pausing writes, uninitialized if
+  // it has not. The transfer period also ends on a timer, without 'lock_'.
+  mutable simple_spinlock transfer_pause_lock_;
+  mutable MonoTime transfer_paused_at_;
   boost::optional<std::string> designated_successor_uuid_;
   std::shared_ptr<rpc::PeriodicTimer> transfer_period_timer_;
 
+  // Runs WarmPeerConnections() every
+  // --raft_warm_peer_connections_interval_ms, if that is positive.
+  std::shared_ptr<rpc::PeriodicTimer> connection_warmer_;
+
+  // Runs TrainCompressionDict() every
+  // --raft_compression_dict_training_interval_ms, if that is positive.
+  std::shared_ptr<rpc::PeriodicTimer> compression_dict_trainer_;
+
+  // Applies the committed rounds off the consensus lock, or null if
+  // --raft_apply_pipeline_threads is 0. See ConsensusRound::SetApplyPipeline().
+  std::unique_ptr<ApplyPipeline> apply_pipeline_;
+
+  // Streams the committed ops to the log subscribers, whose anchors hold
+  // back the log GC, see GetRetentionIndexes().
+  std::unique_ptr<LogSubscriptionManager> log_subscriptions_;
+
+  // The proxies WarmPeerConnectionsTask() calls peers with, by peer uuid,
+  // along with the address each was made for.
+  simple_spinlock warm_peer_proxies_lock_;
+  std::unordered_map<std::string, std::pair<std::string, std::shared_ptr<PeerProxy>>>
+      warm_peer_proxies_;
+
   // Lock held while starting a failure-triggered election.
   //
   // After reporting a failure and asynchronously starting an election, the
@@ -1372,6 +1910,40 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // nodes from disturbing the healthy leader.
   MonoTime withhold_votes_until_;
 
+  // 'withhold_votes_until_' in nanoseconds since MonoTime::Min(), for
+  // RequestVoteFastPath().
+  std::atomic<int64_t> withhold_votes_until_nanos_;
+
+  // What RequestVoteFastPath() needs to know about this replica, published
+  // atomically by PublishVoterStateUnlocked().
+  struct VoterState {
+    bool running;
+    int64_t term;
+    // A denial, as filled in by FillVoteResponseVoteDenied() without the
+    // error code.
+    VoteResponsePB denial;
+  };
+  std::shared_ptr<const VoterState> voter_state_;
+
+  // The last vote denied to each candidate, see CacheVoteDenial(). Protected
+  // by 'vote_denials_lock_'.
+  struct VoteDenial {
+    ElectionMode mode;
+    int64_t candidate_term;
+    OpId last_received;
+    int64_t voter_term;
+    MonoTime expires;
+    VoteResponsePB response;
+  };
+  std::unordered_map<std::string, VoteDenial> vote_denials_;
+  simple_spinlock vote_denials_lock_;
+
+  // Whether the cmeta flushes are being deferred, and the version of the
+  // consensus metadata prepared in the meantime, see
+  // DeferCmetaFlushesUnlocked(). Protected by 'lock_'.
+  bool defer_cmeta_flushes_;
+  uint64_t deferred_cmeta_flush_version_;
+
   // This is used in tests to reject AppendEntries RPC requests.
   bool reject_append_entries_;
 
@@ -1379,7 +1951,7 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   bool adjust_voter_distribution_;
 
   // This is used in tests to reject RequestVote RPC requests.
-  bool withhold_votes_;
+  std::atomic<bool> withhold_votes_;
 
   // The last OpId received from the current leader. This is updated whenever
   // the follower accepts operations from a leader, and passed back so that the
@@ -1411,6 +1983,10 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // Vote logger for voting events
   std::shared_ptr<VoteLoggerInterface> vote_logger_;
 
+  // Round-trip times of the vote requests sent by our elections, used to ask
+  // the fastest voters first.
+  const std::shared_ptr<VoterRttTracker> voter_rtt_tracker_;
+
   // A flag to help us avoid taking a lock on the reactor thread if the object
   // is already in kShutdown state.
   // TODO(mpercy): Try to get rid of this extra flag.
@@ -1420,11 +1996,30 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // assertions.
   AtomicInt<int32_t> update_calls_for_tests_;
 
+  // The prefix LogPrefixUnlocked() last formatted, and the term and role it
+  // was formatted for. Protected by 'lock_'.
+  mutable std::string log_prefix_;
+  mutable int64_t log_prefix_term_ = -1;
+  mutable RaftPeerPB::Role log_prefix_role_ = RaftPeerPB::UNKNOWN_ROLE;
+
+  // See LogPrefixThreadSafe().
+  std::string log_prefix_thread_safe_;
+
   FunctionGaugeDetacher metric_detacher_;
 
   std::atomic<int64_t> last_leader_communication_time_micros_;
 
   scoped_refptr<Counter> follower_memory_pressure_rejections_;
+  scoped_refptr<Counter> follower_early_acked_updates_;
+  scoped_refptr<Counter> leader_memory_pressure_rejections_;
+  scoped_refptr<Counter> leader_admission_rejections_;
+  scoped_refptr<Counter> witness_stripped_payload_bytes_;
+  scoped_refptr<Counter> removed_peers_filter_negatives_;
+  scoped_refptr<Counter> removed_peers_filter_false_positives_;
+  scoped_refptr<Counter> vote_requests_denied_without_lock_;
+  scoped_refptr<Counter> vote_requests_denied_from_cache_;
+  scoped_refptr<Counter> snapshots_installed_;
+  scoped_refptr<AtomicGauge<int64_t>> replication_throttled_;
   scoped_refptr<AtomicGauge<int64_t>> term_metric_;
   scoped_refptr<AtomicGauge<int64_t>> num_failed_elections_metric_;
 
@@ -1438,12 +2033,68 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // overwriting the log
   scoped_refptr<Counter> raft_log_truncation_counter_;
 
+  // How long our pre-elections and elections took to be decided.
+  scoped_refptr<Histogram> pre_election_duration_;
+  scoped_refptr<Histogram> election_duration_;
+
+  // How long leadership transfers kept rejecting writes.
+  scoped_refptr<Histogram> transfer_write_pause_duration_;
+
+  // Leadership transfers started to voters of a higher election priority.
+  scoped_refptr<Counter> leadership_reclaims_;
+
+  // The phases of the failover this replica is running, from when its
+  // failure detector fires until it commits the first op of a client as the
+  // new leader. Times are unset until their phase starts. Reset when
+  // another replica becomes leader, or this one steps down.
+  struct FailoverTimeline {
+    // How long the failure detector took to fire.
+    MonoDelta detection;
+    MonoTime detected;
+    // The start of the last election, after any pre-election.
+    MonoTime election_started;
+    MonoTime became_leader;
+    // The index of the NO_OP of the new term, and when it was committed.
+    int64_t noop_index = -1;
+    MonoTime noop_committed;
+  };
+  FailoverTimeline failover_; // Protected by lock_.
+
+  // The durations of the phases of the failovers won by this replica.
+  scoped_refptr<Histogram> failover_detection_duration_;
+  scoped_refptr<Histogram> failover_pre_election_duration_;
+  scoped_refptr<Histogram> failover_election_duration_;
+  scoped_refptr<Histogram> failover_noop_commit_duration_;
+  scoped_refptr<Histogram> failover_first_commit_duration_;
+  scoped_refptr<Histogram> failover_duration_;
+
+  // How many msgs were waiting on the compression pool, and how long it
+  // took to compress a batch.
+  scoped_refptr<Histogram> compression_queue_depth_;
+  scoped_refptr<Histogram> compression_time_;
+
+  // Dictionaries trained, and rolled out, while leader.
+  scoped_refptr<Counter> compression_dicts_trained_;
+  scoped_refptr<Counter> compression_dicts_rolled_out_;
+
+  // Bytes of WAL retained for lagging peers, and the peers the WAL isn't
+  // retained for, as of the last retention decision.
+  scoped_refptr<AtomicGauge<int64_t>> log_retention_held_bytes_;
+  scoped_refptr<AtomicGauge<int64_t>> log_retention_abandoned_peers_;
+
+  // Protects last_retention_decision_.
+  mutable simple_spinlock retention_decision_lock_;
+  LogRetentionDecision last_retention_decision_;
+
   // Proxy metrics.
   scoped_refptr<Counter> raft_proxy_num_requests_received_;
   scoped_refptr<Counter> raft_proxy_num_requests_success_;
+  scoped_refptr<Counter> raft_proxy_num_requests_full_forward_;
+  scoped_refptr<Counter> raft_proxy_num_requests_partial_forward_;
   scoped_refptr<Counter> raft_proxy_num_requests_unknown_dest_;
   scoped_refptr<Counter> raft_proxy_num_requests_log_read_timeout_;
   scoped_refptr<Counter> raft_proxy_num_requests_hops_remaining_exhausted_;
+  scoped_refptr<Counter> raft_proxy_num_requests_expired_;
 
   faststring compression_buffer_;
 
@@ -1487,6 +2138,39 @@ class ConsensusRoundHandler {
   // replication. This can be used to trigger callbacks, akin to an Apply() for
   // transaction ops.
   virtual void FinishConsensusOnlyRound(ConsensusRound* round) = 0;
+
+  // Called on the leader with each round of the ops clients submit, see
+  // RaftConsensus::SubmitOpsAsync(), before it is replicated, to set its
+  // replicated callback. Rejecting a round rejects the batch. By default
+  // the rounds are only replicated, for embedders which apply the committed
+  // ops from the log, e.g. through a log subscription.
+  virtual Status StartLeaderTransaction(
+      const scoped_refptr<ConsensusRound>& /* round */) {
+    return Status::OK();
+  }
+
+  // With --raft_apply_pipeline_threads set, the committed transaction rounds
+  // are applied through an apply pipeline, off the thread which advanced the
+  // commit index. Rounds with the same partition key are applied in order,
+  // those with different keys possibly concurrently. By default every round
+  // has the same key, so rounds are only applied off the consensus lock.
+  virtual std::string ApplyPartitionKey(ConsensusRound* /* round */) {
+    return std::string();
+  }
+
+  // Applies a batch of committed rounds which share a partition key, in
+  // order, from a thread of the apply pipeline. By default runs their
+  // replicated callbacks one after the other.
+  virtual void ApplyCommittedRounds(
+      const std::vector<scoped_refptr<ConsensusRound>>& rounds);
+
+  // The committed rounds handed to the state machine which it has yet to
+  // apply, e.g. queued for appliers of its own, beyond those the apply
+  // pipeline holds. Reported to the leader, see
+  // RaftConsensus::ApplyBacklogOps().
+  virtual int64_t ApplyBacklog() {
+    return 0;
+  }
 };
 
 // Context for a consensus round on the LEADER side, typically created as an
@@ -1533,8 +2217,37 @@ class ConsensusRound : public RefCountedThreadSafe<ConsensusRound> {
   }
 
   // If a continuation was set, notifies it that the round has been replicated.
+  // With an apply pipeline set, a successfully replicated round is queued on
+  // it instead.
   void NotifyReplicationFinished(const Status& status);
 
+  // Makes NotifyReplicationFinished() hand the round, once successfully
+  // replicated, to 'pipeline' under 'partition_key', rather than run the
+  // replicated callback right away. Failures are still notified right away.
+  // Must be set before the round is replicated.
+  void SetApplyPipeline(ApplyPipeline* pipeline, std::string partition_key) {
+    apply_pipeline_ = pipeline;
+    apply_partition_key_ = std::move(partition_key);
+  }
+
+  // Runs the replicated callback, if any, bypassing the apply pipeline. See
+  // ConsensusRoundHandler::ApplyCommittedRounds().
+  void RunReplicatedCallback(const Status& status);
+
+  // Register a callback that is called once the round is durable on a
+  // majority of the voters in the leader's region, possibly before the commit
+  // rule is satisfied. See RaftConsensus::GetLocalRegionDurableIndex(). It is
+  // called at most once: should the round be replicated or fail first, it is
+  // called right before the replicated callback, with the same status. Like
+  // the replicated callback, it must be set before the round is replicated.
+  void SetLocalRegionDurableCallback(StdStatusCallback cb) {
+    local_region_durable_cb_ = std::move(cb);
+  }
+
+  // If a callback was set and has not run yet, notifies it that the round is
+  // durable in the leader's region, if 'status' is OK(), or that it failed.
+  void NotifyLocalRegionDurable(const Status& status);
+
   // Binds this round such that it may not be eventually executed in any term
   // other than 'term'.
   // See CheckBoundTerm().
@@ -1558,10 +2271,26 @@ class ConsensusRound : public RefCountedThreadSafe<ConsensusRound> {
     return consensus_->tablet_id();
   }
 
+  // The client or tenant the round is replicated for, which the leader's
+  // admission control shares its queue between, see
+  // ReplicateAdmissionController. Untagged rounds share the empty tenant.
+  // Must be set before the round is replicated.
+  void set_tenant(std::string tenant) {
+    tenant_ = std::move(tenant);
+  }
+  const std::string& tenant() const {
+    return tenant_;
+  }
+
  private:
   friend class RefCountedThreadSafe<ConsensusRound>;
+  friend class RaftConsensus;
   friend class RaftConsensusQuorumTest;
 
+  // Releases the admission of the round, if it has one which wasn't
+  // released yet.
+  void ReleaseAdmission();
+
   ~ConsensusRound() {}
 
   RaftConsensus* consensus_;
@@ -1572,6 +2301,21 @@ class ConsensusRound : public RefCountedThreadSafe<ConsensusRound> {
   // deemed committed/aborted by consensus.
   ConsensusReplicatedCallback replicated_cb_;
 
+  // See SetLocalRegionDurableCallback(). Cleared once it has run.
+  StdStatusCallback local_region_durable_cb_;
+
+  std::string tenant_;
+
+  // The admission control which admitted the round at 'admitted_', for
+  // 'admitted_bytes_'. Null if the round holds no admission.
+  std::atomic<ReplicateAdmissionController*> admission_{nullptr};
+  MonoTime admitted_;
+  int64_t admitted_bytes_ = 0;
+
+  // See SetApplyPipeline(). Null if the round is applied right away.
+  ApplyPipeline* apply_pipeline_ = nullptr;
+  std::string apply_partition_key_;
+
   // The leader term that this round was submitted in. CheckBoundTerm()
   // ensures that, when it is eventually replicated, the term has not
   // changed in the meantime.
@@ -26,6 +26,7 @@
 #include <memory>
 #include <ostream>
 #include <string>
+#include <thread>
 #include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
@@ -60,6 +61,7 @@
 #include "kudu/consensus/persistent_vars.h"
 #include "kudu/consensus/persistent_vars.pb.h"
 #include "kudu/consensus/persistent_vars_manager.h"
+#include "kudu/consensus/proxy_policy.h"
 #include "kudu/consensus/quorum_util.h"
 #include "kudu/consensus/raft_consensus.h"
 #include "kudu/consensus/time_manager.h"
@@ -87,6 +89,26 @@
 
 DECLARE_int32(raft_heartbeat_interval_ms);
 DECLARE_bool(enable_leader_failure_detection);
+DECLARE_bool(follower_pipeline_updates);
+DECLARE_bool(log_inject_latency);
+DECLARE_int32(log_inject_latency_ms_mean);
+DECLARE_int32(log_inject_latency_ms_stddev);
+DECLARE_bool(raft_enable_quiescence);
+DECLARE_int32(raft_quiesced_heartbeat_interval_ms);
+DECLARE_int32(raft_warm_peer_connections_interval_ms);
+DECLARE_bool(raft_fast_leader_transfer);
+DECLARE_int32(raft_fast_leader_transfer_pause_lag_ops);
+DECLARE_double(leader_failure_max_missed_heartbeat_periods);
+DECLARE_bool(raft_enable_multi_hop_proxy_routing);
+DECLARE_bool(raft_proxy_multi_hop_passthrough);
+DECLARE_int32(raft_log_cache_proxy_wait_time_ms);
+
+METRIC_DECLARE_counter(raft_proxy_num_requests_expired);
+METRIC_DECLARE_counter(raft_proxy_num_requests_full_forward);
+METRIC_DECLARE_counter(raft_proxy_num_requests_log_read_timeout);
+METRIC_DECLARE_counter(raft_proxy_num_requests_partial_forward);
+METRIC_DECLARE_counter(raft_proxy_num_requests_success);
+METRIC_DECLARE_counter(raft_vote_requests_denied_without_lock);
 
 // METRIC_DECLARE_entity(tablet);
 
@@ -137,6 +159,7 @@ class RaftConsensusQuorumTest : public KuduTest {
 #endif
   {
     options_.tablet_id = kTestTablet;
+    options_.proxy_policy = ProxyPolicy::DISABLE_PROXY;
     FLAGS_enable_leader_failure_detection = false;
     CHECK_OK(ThreadPoolBuilder("raft").Build(&raft_pool_));
   }
@@ -630,6 +653,112 @@ class RaftConsensusQuorumTest : public KuduTest {
     ASSERT_FALSE(cmeta->has_voted_for());
   }
 
+  // The proxies the peer at 'peer_idx' made, to any peer.
+  vector<LocalTestPeerProxy*> GetProxies(int peer_idx) {
+    shared_ptr<RaftConsensus> peer;
+    CHECK_OK(peers_->GetPeerByIdx(peer_idx, &peer));
+    return down_cast<LocalTestPeerProxyFactory*>(
+               peer->peer_proxy_factory_.get())
+        ->GetProxies();
+  }
+
+  // The number of calls the peer at 'from_idx' made to the peer at 'to_idx'
+  // to warm their connection.
+  int WarmingPings(int from_idx, int to_idx) {
+    shared_ptr<RaftConsensus> to;
+    CHECK_OK(peers_->GetPeerByIdx(to_idx, &to));
+    int pings = 0;
+    for (LocalTestPeerProxy* proxy : GetProxies(from_idx)) {
+      if (proxy->GetTarget() == to->peer_uuid()) {
+        pings += proxy->pings();
+      }
+    }
+    return pings;
+  }
+
+  // Starts transferring the leadership of the peer at 'leader_idx' to the
+  // peer at 'successor_idx'.
+  void TransferLeadership(int leader_idx, int successor_idx) {
+    shared_ptr<RaftConsensus> leader;
+    CHECK_OK(peers_->GetPeerByIdx(leader_idx, &leader));
+    shared_ptr<RaftConsensus> successor;
+    CHECK_OK(peers_->GetPeerByIdx(successor_idx, &successor));
+    LeaderStepDownResponsePB resp;
+    ASSERT_OK(leader->TransferLeadership(
+        successor->peer_uuid(),
+        nullptr,
+        ElectionContext(
+            ElectionReason::EXTERNAL_REQUEST,
+            std::chrono::system_clock::now()),
+        &resp));
+    ASSERT_FALSE(resp.has_error()) << resp.ShortDebugString();
+  }
+
+  // Builds a request, as the leader at 'leader_idx' would, for the peer at
+  // 'proxy_idx' to proxy the ops at 'indexes' of the leader's log to the peer
+  // at 'dest_idx'.
+  ConsensusRequestPB BuildProxyRequest(
+      int leader_idx,
+      int proxy_idx,
+      int dest_idx,
+      const vector<int64_t>& indexes) {
+    shared_ptr<RaftConsensus> leader;
+    CHECK_OK(peers_->GetPeerByIdx(leader_idx, &leader));
+    shared_ptr<RaftConsensus> proxy;
+    CHECK_OK(peers_->GetPeerByIdx(proxy_idx, &proxy));
+    shared_ptr<RaftConsensus> dest;
+    CHECK_OK(peers_->GetPeerByIdx(dest_idx, &dest));
+    const int64_t term = leader->CurrentTerm();
+
+    ConsensusRequestPB req;
+    req.set_tablet_id(kTestTablet);
+    req.set_caller_uuid(leader->peer_uuid());
+    req.set_caller_term(term);
+    req.set_dest_uuid(dest->peer_uuid());
+    req.set_proxy_dest_uuid(proxy->peer_uuid());
+    req.set_proxy_hops_remaining(2);
+    *req.mutable_preceding_id() = MakeOpId(term, indexes.front() - 1);
+    req.set_committed_index(indexes.front() - 1);
+    req.set_all_replicated_index(0);
+    req.set_last_idx_appended_to_leader(indexes.back());
+    for (int64_t index : indexes) {
+      ReplicateMsg* op = req.add_ops();
+      *op->mutable_id() = MakeOpId(term, index);
+      op->set_timestamp(clock_->Now().ToUint64());
+      op->set_op_type(PROXY_OP);
+    }
+    return req;
+  }
+
+  // Has the peer at 'proxy_idx' proxy 'request' for a caller which waits on
+  // it until 'deadline'. Returns the error it responded with, if any.
+  Status SendProxyRequest(
+      int proxy_idx,
+      ConsensusRequestPB* request,
+      MonoTime deadline,
+      ConsensusResponsePB* response) {
+    shared_ptr<RaftConsensus> proxy;
+    RETURN_NOT_OK(peers_->GetPeerByIdx(proxy_idx, &proxy));
+    auto responder = std::make_shared<TestProxyResponder>(deadline);
+    proxy->HandleProxyRequest(request, response, responder);
+    RETURN_NOT_OK(responder->Wait());
+    if (response->has_error()) {
+      return StatusFromPB(response->error().status());
+    }
+    return Status::OK();
+  }
+
+  // The value of the counter of 'prototype', which all the peers share.
+  int64_t CounterValue(CounterPrototype& prototype) {
+    return prototype.Instantiate(metric_entity_)->value();
+  }
+
+  // Whether 'peer' was told by its leader that the group is quiesced.
+  bool IsFailureDetectorQuiesced(RaftConsensus* peer) {
+    RaftConsensus::LockGuard l(peer->lock_);
+    return peer->failure_detector_quiesced_;
+  }
+
   ~RaftConsensusQuorumTest() {
     peers_->Clear();
     STLDeleteElements(&txn_factories_);
@@ -744,6 +873,96 @@ TEST_F(RaftConsensusQuorumTest, TestFollowersReplicateAndCommitSequence) {
   VerifyLogs(2, 0, 1);
 }
 
+// Tests Replicate/Commit a batch of messages submitted together through the
+// leader.
+TEST_F(RaftConsensusQuorumTest, TestFollowersReplicateAndCommitBatch) {
+  const int kFollower0Idx = 0;
+  const int kFollower1Idx = 1;
+  const int kLeaderIdx = 2;
+  const int kBatchSize = 10;
+
+  ASSERT_OK(BuildAndStartConfig(3));
+
+  shared_ptr<RaftConsensus> leader;
+  ASSERT_OK(peers_->GetPeerByIdx(kLeaderIdx, &leader));
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  for (int i = 0; i < kBatchSize; i++) {
+    gscoped_ptr<ReplicateMsg> msg(new ReplicateMsg());
+    msg->set_op_type(NO_OP);
+    msg->mutable_noop_request();
+    msg->set_timestamp(clock_->Now().ToUint64());
+    gscoped_ptr<Synchronizer> sync(new Synchronizer());
+    rounds.push_back(
+        leader->NewRound(std::move(msg), sync->AsStdStatusCallback()));
+    InsertOrDie(&syncs_, rounds.back().get(), sync.release());
+  }
+  ASSERT_OK(leader->ReplicateBatch(rounds));
+
+  // The rounds got consecutive OpIds.
+  for (int i = 1; i < kBatchSize; i++) {
+    ASSERT_EQ(rounds[i - 1]->id().index() + 1, rounds[i]->id().index());
+  }
+
+  shared_ptr<Synchronizer> commit_sync;
+  for (const scoped_refptr<ConsensusRound>& round : rounds) {
+    ASSERT_OK(WaitForReplicate(round.get()));
+    ASSERT_OK(CommitDummyMessage(kLeaderIdx, round.get(), &commit_sync));
+  }
+
+  // See comment at the end of TestFollowersReplicateAndCommitMessage
+  // for an explanation on this waiting sequence.
+  ASSERT_OK(commit_sync->Wait());
+  int64_t last_index = rounds.back()->id().index();
+  WaitForCommitIfNotAlreadyPresent(last_index, kFollower0Idx, kLeaderIdx);
+  WaitForCommitIfNotAlreadyPresent(last_index, kFollower1Idx, kLeaderIdx);
+  VerifyLogs(2, 0, 1);
+}
+
+// The ops a client submits get consecutive OpIds, once replicated.
+TEST_F(RaftConsensusQuorumTest, TestSubmitOps) {
+  const int kFollower0Idx = 0;
+  const int kFollower1Idx = 1;
+  const int kLeaderIdx = 2;
+
+  ASSERT_OK(BuildAndStartConfig(3));
+
+  SubmitOpsRequestPB req;
+  req.set_tablet_id(kTestTablet);
+  for (int i = 0; i < 5; i++) {
+    req.add_ops()->set_payload(Substitute("op $0", i));
+  }
+
+  shared_ptr<RaftConsensus> leader;
+  ASSERT_OK(peers_->GetPeerByIdx(kLeaderIdx, &leader));
+  Synchronizer sync;
+  vector<OpId> ids;
+  leader->SubmitOpsAsync(
+      req, [&sync, &ids](const Status& s, const vector<OpId>& op_ids) {
+        ids = op_ids;
+        sync.StatusCB(s);
+      });
+  ASSERT_OK(sync.Wait());
+  ASSERT_EQ(5, ids.size());
+  for (int i = 1; i < 5; i++) {
+    ASSERT_EQ(ids[i - 1].index() + 1, ids[i].index());
+  }
+  WaitForCommitIfNotAlreadyPresent(
+      ids.back().index(), kFollower0Idx, kLeaderIdx);
+  WaitForCommitIfNotAlreadyPresent(
+      ids.back().index(), kFollower1Idx, kLeaderIdx);
+
+  // A follower replicates none of them.
+  shared_ptr<RaftConsensus> follower;
+  ASSERT_OK(peers_->GetPeerByIdx(kFollower0Idx, &follower));
+  Synchronizer follower_sync;
+  follower->SubmitOpsAsync(
+      req, [&follower_sync](const Status& s, const vector<OpId>& /* ids */) {
+        follower_sync.StatusCB(s);
+      });
+  Status s = follower_sync.Wait();
+  ASSERT_TRUE(s.IsIllegalState()) << s.ToString();
+}
+
 TEST_F(RaftConsensusQuorumTest, TestConsensusContinuesIfAMinorityFallsBehind) {
   // Constants with the indexes of peers with certain roles,
   // since peers don't change roles in this test.
@@ -961,6 +1180,473 @@ TEST_F(RaftConsensusQuorumTest, TestLeaderHeartbeats) {
   VerifyLogs(2, 0, 1);
 }
 
+// The observers read a snapshot of the consensus state, which is only rebuilt
+// once the state, the term, the leader or the config change.
+TEST_F(RaftConsensusQuorumTest, TestConsensusStateSnapshot) {
+  const int kFollowerIdx = 0;
+  const int kLeaderIdx = 2;
+  ASSERT_OK(BuildConfig(3));
+  shared_ptr<RaftConsensus> follower;
+  CHECK_OK(peers_->GetPeerByIdx(kFollowerIdx, &follower));
+  shared_ptr<RaftConsensus> leader;
+  CHECK_OK(peers_->GetPeerByIdx(kLeaderIdx, &leader));
+
+  auto initialized = leader->GetConsensusStateSnapshot();
+  ASSERT_EQ(RaftConsensus::kInitialized, initialized->state);
+  ASSERT_EQ(initialized, leader->GetConsensusStateSnapshot());
+
+  ASSERT_OK(StartPeers());
+  auto running = leader->GetConsensusStateSnapshot();
+  ASSERT_NE(initialized, running);
+  ASSERT_EQ(RaftConsensus::kRunning, running->state);
+  ASSERT_EQ(RaftPeerPB::FOLLOWER, running->role);
+  ASSERT_EQ(RaftPeerPB::FOLLOWER, leader->role());
+
+  ASSERT_OK(leader->EmulateElection());
+  WaitForCommitIfNotAlreadyPresent(1, kFollowerIdx, kLeaderIdx);
+  auto elected = leader->GetConsensusStateSnapshot();
+  ASSERT_NE(running, elected);
+  ASSERT_EQ(RaftPeerPB::LEADER, elected->role);
+  ASSERT_EQ(running->cstate.current_term() + 1, elected->cstate.current_term());
+  ASSERT_EQ(leader->peer_uuid(), elected->cstate.leader_uuid());
+  ASSERT_EQ(RaftPeerPB::LEADER, leader->role());
+  ASSERT_EQ(elected->cstate.current_term(), leader->CurrentTerm());
+  ASSERT_EQ(leader->peer_uuid(), leader->GetLeaderUuid());
+  ASSERT_EQ(
+      leader->peer_uuid(),
+      follower->GetConsensusStateSnapshot()->cstate.leader_uuid());
+
+  // Replicating ops leaves the state alone, so the snapshot is reused.
+  OpId last_op_id;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  NO_FATALS(ReplicateSequenceOfMessages(
+      5,
+      kLeaderIdx,
+      WAIT_FOR_ALL_REPLICAS,
+      COMMIT_ONE_BY_ONE,
+      &last_op_id,
+      &rounds));
+  auto settled = leader->GetConsensusStateSnapshot();
+  ASSERT_EQ(elected->cstate.current_term(), settled->cstate.current_term());
+  NO_FATALS(ReplicateSequenceOfMessages(
+      5,
+      kLeaderIdx,
+      WAIT_FOR_ALL_REPLICAS,
+      COMMIT_ONE_BY_ONE,
+      &last_op_id,
+      &rounds));
+  ASSERT_EQ(settled, leader->GetConsensusStateSnapshot());
+}
+
+// Replicas which are not the leader keep calling the other members of the
+// config, through the same proxies round after round, and stop once elected.
+TEST_F(RaftConsensusQuorumTest, TestWarmPeerConnections) {
+  const int kInterval = 20;
+  FLAGS_raft_warm_peer_connections_interval_ms = kInterval;
+  const int kFollowerIdx = 0;
+  const int kLeaderIdx = 2;
+  ASSERT_OK(BuildConfig(3));
+  ASSERT_OK(StartPeers());
+
+  ASSERT_EVENTUALLY([&]() {
+    for (int from = 0; from < 3; from++) {
+      for (int to = 0; to < 3; to++) {
+        if (from != to) {
+          ASSERT_GT(WarmingPings(from, to), 1) << from << " -> " << to;
+        }
+      }
+    }
+  });
+  // Each peer made a single proxy to each other peer.
+  ASSERT_EQ(2U, GetProxies(kFollowerIdx).size());
+
+  shared_ptr<RaftConsensus> leader;
+  CHECK_OK(peers_->GetPeerByIdx(kLeaderIdx, &leader));
+  ASSERT_OK(leader->EmulateElection());
+  WaitForCommitIfNotAlreadyPresent(1, kFollowerIdx, kLeaderIdx);
+  // Lets a round which started before the election finish.
+  SleepFor(MonoDelta::FromMilliseconds(kInterval * 5));
+
+  const int leader_pings = WarmingPings(kLeaderIdx, kFollowerIdx);
+  const int follower_pings = WarmingPings(kFollowerIdx, kLeaderIdx);
+  const size_t follower_proxies = GetProxies(kFollowerIdx).size();
+  SleepFor(MonoDelta::FromMilliseconds(kInterval * 10));
+  ASSERT_EQ(leader_pings, WarmingPings(kLeaderIdx, kFollowerIdx));
+  ASSERT_GT(WarmingPings(kFollowerIdx, kLeaderIdx), follower_pings);
+  ASSERT_EQ(follower_proxies, GetProxies(kFollowerIdx).size());
+}
+
+// By default, a leader rejects writes for the whole leadership transfer
+// period, however far behind its successor is.
+TEST_F(RaftConsensusQuorumTest, TestLeaderTransferPausesWrites) {
+  const int kSuccessorIdx = 0;
+  const int kLeaderIdx = 2;
+  ASSERT_OK(BuildAndStartConfig(3));
+  shared_ptr<RaftConsensus> leader;
+  CHECK_OK(peers_->GetPeerByIdx(kLeaderIdx, &leader));
+  OpId last_op_id;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  NO_FATALS(ReplicateSequenceOfMessages(
+      1,
+      kLeaderIdx,
+      WAIT_FOR_ALL_REPLICAS,
+      COMMIT_ONE_BY_ONE,
+      &last_op_id,
+      &rounds));
+
+  NO_FATALS(TransferLeadership(kLeaderIdx, kSuccessorIdx));
+  scoped_refptr<ConsensusRound> round;
+  Status s = AppendDummyMessage(kLeaderIdx, &round);
+  ASSERT_TRUE(s.IsServiceUnavailable()) << s.ToString();
+
+  // The test proxies do not run the successor's election, so the period ends
+  // on its timer, which ends timing the pause.
+  ASSERT_EVENTUALLY([&]() {
+    ASSERT_EQ(1, leader->transfer_write_pause_duration_->TotalCount());
+  });
+  ASSERT_OK(AppendDummyMessage(kLeaderIdx, &round));
+}
+
+// With --raft_fast_leader_transfer, a leader keeps accepting writes while its
+// successor catches up, until the successor is within the pause lag.
+TEST_F(RaftConsensusQuorumTest, TestFastLeaderTransferPausesWritesLate) {
+  FLAGS_raft_fast_leader_transfer = true;
+  FLAGS_raft_fast_leader_transfer_pause_lag_ops = 16;
+  // Leaves the test time to write during the transfer period.
+  FLAGS_leader_failure_max_missed_heartbeat_periods = 20;
+  const int kSuccessorIdx = 0;
+  const int kLeaderIdx = 2;
+  ASSERT_OK(BuildAndStartConfig(3));
+  shared_ptr<RaftConsensus> successor;
+  CHECK_OK(peers_->GetPeerByIdx(kSuccessorIdx, &successor));
+  shared_ptr<RaftConsensus> leader;
+  CHECK_OK(peers_->GetPeerByIdx(kLeaderIdx, &leader));
+  OpId last_op_id;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  NO_FATALS(ReplicateSequenceOfMessages(
+      1,
+      kLeaderIdx,
+      WAIT_FOR_ALL_REPLICAS,
+      COMMIT_ONE_BY_ONE,
+      &last_op_id,
+      &rounds));
+
+  {
+    // The successor falls behind by more than the pause lag, as it cannot
+    // take the leader's requests while its lock is held.
+    RaftConsensus::LockGuard l(successor->lock_);
+    NO_FATALS(ReplicateSequenceOfMessages(
+        20,
+        kLeaderIdx,
+        WAIT_FOR_MAJORITY,
+        COMMIT_ONE_BY_ONE,
+        &last_op_id,
+        &rounds));
+    NO_FATALS(TransferLeadership(kLeaderIdx, kSuccessorIdx));
+    scoped_refptr<ConsensusRound> round;
+    ASSERT_OK(AppendDummyMessage(kLeaderIdx, &round));
+    ASSERT_OK(WaitForReplicate(round.get()));
+  }
+
+  // Once it has caught up, writes are paused.
+  ASSERT_EVENTUALLY([&]() {
+    scoped_refptr<ConsensusRound> round;
+    Status s = AppendDummyMessage(kLeaderIdx, &round);
+    ASSERT_TRUE(s.IsServiceUnavailable()) << s.ToString();
+  });
+  ASSERT_EQ(0, leader->transfer_write_pause_duration_->TotalCount());
+}
+
+// A proxy fills the holes of a sparse batch in from its own log, and forwards
+// as much of the batch as it has.
+TEST_F(RaftConsensusQuorumTest, TestProxyForwardsSparseBatches) {
+  const int kDestIdx = 0;
+  const int kProxyIdx = 1;
+  const int kLeaderIdx = 2;
+  ASSERT_OK(BuildAndStartConfig(3));
+  shared_ptr<RaftConsensus> proxy;
+  CHECK_OK(peers_->GetPeerByIdx(kProxyIdx, &proxy));
+  OpId last_op_id;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  // The ops at indexes 2 to 6, after the leader's NO_OP.
+  NO_FATALS(ReplicateSequenceOfMessages(
+      5,
+      kLeaderIdx,
+      WAIT_FOR_ALL_REPLICAS,
+      COMMIT_ONE_BY_ONE,
+      &last_op_id,
+      &rounds));
+  ASSERT_EQ(6, last_op_id.index());
+  const MonoTime deadline = MonoTime::Now() + MonoDelta::FromSeconds(10);
+
+  {
+    ConsensusRequestPB req =
+        BuildProxyRequest(kLeaderIdx, kProxyIdx, kDestIdx, {2, 4, 6});
+    ConsensusResponsePB resp;
+    ASSERT_OK(SendProxyRequest(kProxyIdx, &req, deadline, &resp));
+    ASSERT_EQ(proxy->peer_uuid(), resp.proxy_uuid());
+    ASSERT_EQ(1, CounterValue(METRIC_raft_proxy_num_requests_full_forward));
+    ASSERT_EQ(
+        0, CounterValue(METRIC_raft_proxy_num_requests_partial_forward));
+  }
+
+  {
+    // The proxy has no op 100, so it only forwards the ops up to 4.
+    ConsensusRequestPB req =
+        BuildProxyRequest(kLeaderIdx, kProxyIdx, kDestIdx, {2, 4, 100});
+    ConsensusResponsePB resp;
+    ASSERT_OK(SendProxyRequest(kProxyIdx, &req, deadline, &resp));
+    ASSERT_EQ(1, CounterValue(METRIC_raft_proxy_num_requests_full_forward));
+    ASSERT_EQ(
+        1, CounterValue(METRIC_raft_proxy_num_requests_partial_forward));
+  }
+
+  {
+    // The batch may have holes, but must be in log order.
+    ConsensusRequestPB req =
+        BuildProxyRequest(kLeaderIdx, kProxyIdx, kDestIdx, {4, 2});
+    ConsensusResponsePB resp;
+    Status s = SendProxyRequest(kProxyIdx, &req, deadline, &resp);
+    ASSERT_TRUE(s.IsInvalidArgument()) << s.ToString();
+    ASSERT_STR_CONTAINS(s.ToString(), "increasing indexes");
+  }
+  ASSERT_EQ(2, CounterValue(METRIC_raft_proxy_num_requests_success));
+}
+
+// A proxy drops the requests whose caller has given up, rather than forward
+// them, and waits on its log for the ops no longer than the caller does.
+TEST_F(RaftConsensusQuorumTest, TestProxyDropsExpiredRequests) {
+  FLAGS_raft_log_cache_proxy_wait_time_ms = 60 * 1000;
+  const int kDestIdx = 0;
+  const int kProxyIdx = 1;
+  const int kLeaderIdx = 2;
+  ASSERT_OK(BuildAndStartConfig(3));
+  OpId last_op_id;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  NO_FATALS(ReplicateSequenceOfMessages(
+      5,
+      kLeaderIdx,
+      WAIT_FOR_ALL_REPLICAS,
+      COMMIT_ONE_BY_ONE,
+      &last_op_id,
+      &rounds));
+
+  {
+    // The caller has already given up.
+    ConsensusRequestPB req =
+        BuildProxyRequest(kLeaderIdx, kProxyIdx, kDestIdx, {2, 4, 6});
+    ConsensusResponsePB resp;
+    Status s = SendProxyRequest(
+        kProxyIdx,
+        &req,
+        MonoTime::Now() - MonoDelta::FromMilliseconds(1),
+        &resp);
+    ASSERT_TRUE(s.IsTimedOut()) << s.ToString();
+    ASSERT_EQ(1, CounterValue(METRIC_raft_proxy_num_requests_expired));
+  }
+
+  {
+    // The caller gives up while the proxy waits for an op it doesn't have.
+    ConsensusRequestPB req =
+        BuildProxyRequest(kLeaderIdx, kProxyIdx, kDestIdx, {100});
+    ConsensusResponsePB resp;
+    const MonoTime start = MonoTime::Now();
+    Status s = SendProxyRequest(
+        kProxyIdx,
+        &req,
+        start + MonoDelta::FromMilliseconds(200),
+        &resp);
+    ASSERT_TRUE(s.IsTimedOut()) << s.ToString();
+    ASSERT_LT((MonoTime::Now() - start).ToSeconds(), 30);
+    ASSERT_EQ(2, CounterValue(METRIC_raft_proxy_num_requests_expired));
+    // It wasn't degraded to a heartbeat and sent on either.
+    ASSERT_EQ(
+        0, CounterValue(METRIC_raft_proxy_num_requests_log_read_timeout));
+  }
+  ASSERT_EQ(0, CounterValue(METRIC_raft_proxy_num_requests_success));
+}
+
+// With --raft_proxy_multi_hop_passthrough, a proxy whose next hop is another
+// proxy takes the request it received over, and only the last hop fills the
+// ops in.
+TEST_F(RaftConsensusQuorumTest, TestMultiHopProxyPassthrough) {
+  FLAGS_raft_enable_multi_hop_proxy_routing = true;
+  const int kDestIdx = 0;
+  const int kFirstHopIdx = 1;
+  const int kSecondHopIdx = 2;
+  const int kLeaderIdx = 3;
+  ASSERT_OK(BuildAndStartConfig(4));
+  OpId last_op_id;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  NO_FATALS(ReplicateSequenceOfMessages(
+      5,
+      kLeaderIdx,
+      WAIT_FOR_ALL_REPLICAS,
+      COMMIT_ONE_BY_ONE,
+      &last_op_id,
+      &rounds));
+
+  // The leader sends directly to the first hop, which proxies to the
+  // destination through the second hop.
+  ProxyTopologyPB topology;
+  ProxyEdgePB* edge = topology.add_proxy_edges();
+  edge->set_peer_uuid(config_.peers(kDestIdx).permanent_uuid());
+  edge->set_proxy_from_uuid(config_.peers(kSecondHopIdx).permanent_uuid());
+  edge = topology.add_proxy_edges();
+  edge->set_peer_uuid(config_.peers(kSecondHopIdx).permanent_uuid());
+  edge->set_proxy_from_uuid(config_.peers(kFirstHopIdx).permanent_uuid());
+  shared_ptr<RaftConsensus> first_hop;
+  for (int idx : {kFirstHopIdx, kSecondHopIdx}) {
+    shared_ptr<RaftConsensus> hop;
+    CHECK_OK(peers_->GetPeerByIdx(idx, &hop));
+    ASSERT_OK(hop->SetProxyPolicy(ProxyPolicy::DURABLE_ROUTING_POLICY));
+    ASSERT_OK(hop->ChangeProxyTopology(topology));
+    if (idx == kFirstHopIdx) {
+      first_hop = hop;
+    }
+  }
+
+  const MonoTime deadline = MonoTime::Now() + MonoDelta::FromSeconds(10);
+  for (bool passthrough : {false, true}) {
+    SCOPED_TRACE(passthrough);
+    FLAGS_raft_proxy_multi_hop_passthrough = passthrough;
+    ConsensusRequestPB req =
+        BuildProxyRequest(kLeaderIdx, kFirstHopIdx, kDestIdx, {2, 4, 6});
+    ConsensusResponsePB resp;
+    ASSERT_OK(SendProxyRequest(kFirstHopIdx, &req, deadline, &resp));
+    ASSERT_EQ(first_hop->peer_uuid(), resp.proxy_uuid());
+    ASSERT_EQ(
+        passthrough ? 2 : 1,
+        CounterValue(METRIC_raft_proxy_num_requests_full_forward));
+    // Only a copy of the request went on, or the request itself.
+    ASSERT_EQ(passthrough ? 0 : 3, req.ops_size());
+  }
+}
+
+// Once the followers have acknowledged everything, the leader quiesces the
+// group: heartbeats stop, as --raft_quiesced_heartbeat_interval_ms is 0, until
+// there are ops to replicate again.
+TEST_F(RaftConsensusQuorumTest, TestIdleGroupQuiesces) {
+  const int kLeaderIdx = 2;
+  FLAGS_raft_enable_quiescence = true;
+  FLAGS_raft_quiesced_heartbeat_interval_ms = 0;
+  ASSERT_OK(BuildAndStartConfig(3));
+
+  vector<shared_ptr<RaftConsensus>> followers(2);
+  for (int i = 0; i < 2; i++) {
+    CHECK_OK(peers_->GetPeerByIdx(i, &followers[i]));
+  }
+  auto replicate_one = [&]() {
+    OpId last_op_id;
+    shared_ptr<Synchronizer> commit_sync;
+    vector<scoped_refptr<ConsensusRound>> rounds;
+    NO_FATALS(ReplicateSequenceOfMessages(
+        1,
+        kLeaderIdx,
+        WAIT_FOR_ALL_REPLICAS,
+        COMMIT_ONE_BY_ONE,
+        &last_op_id,
+        &rounds,
+        &commit_sync));
+    ASSERT_OK(commit_sync->Wait());
+    // The followers learn of the commit from a heartbeat.
+    for (int i = 0; i < 2; i++) {
+      WaitForCommitIfNotAlreadyPresent(last_op_id.index(), i, kLeaderIdx);
+    }
+  };
+  auto wait_for_quiescence = [&]() {
+    ASSERT_EVENTUALLY([&]() {
+      for (const auto& follower : followers) {
+        ASSERT_TRUE(IsFailureDetectorQuiesced(follower.get()));
+      }
+    });
+  };
+
+  NO_FATALS(replicate_one());
+  NO_FATALS(wait_for_quiescence());
+
+  // Let a quiescing heartbeat still in flight land, then make sure that no
+  // more follow.
+  SleepFor(MonoDelta::FromMilliseconds(FLAGS_raft_heartbeat_interval_ms * 2LL));
+  vector<int> update_calls;
+  for (const auto& follower : followers) {
+    update_calls.push_back(follower->update_calls_for_tests());
+  }
+  SleepFor(MonoDelta::FromMilliseconds(FLAGS_raft_heartbeat_interval_ms * 4LL));
+  for (int i = 0; i < 2; i++) {
+    ASSERT_EQ(update_calls[i], followers[i]->update_calls_for_tests());
+  }
+
+  // New ops bring the heartbeats back, which carry the commit index to the
+  // followers, after which the group quiesces again.
+  NO_FATALS(replicate_one());
+  NO_FATALS(wait_for_quiescence());
+  for (int i = 0; i < 2; i++) {
+    ASSERT_GT(followers[i]->update_calls_for_tests(), update_calls[i]);
+  }
+
+  // A node-level liveness failure makes the follower watch the leader again.
+  followers[0]->Unquiesce();
+  ASSERT_FALSE(IsFailureDetectorQuiesced(followers[0].get()));
+  ASSERT_TRUE(IsFailureDetectorQuiesced(followers[1].get()));
+  VerifyLogs(2, 0, 1);
+}
+
+// A vote request denied without the Raft locks, see --raft_pre_vote_fast_path,
+// still makes a quiesced follower watch the leader again: another replica is
+// campaigning.
+TEST_F(RaftConsensusQuorumTest, TestFastPathVoteUnquiesces) {
+  const int kLeaderIdx = 2;
+  FLAGS_raft_enable_quiescence = true;
+  FLAGS_raft_quiesced_heartbeat_interval_ms = 0;
+  ASSERT_OK(BuildAndStartConfig(3));
+
+  vector<shared_ptr<RaftConsensus>> followers(2);
+  for (int i = 0; i < 2; i++) {
+    CHECK_OK(peers_->GetPeerByIdx(i, &followers[i]));
+  }
+  OpId last_op_id;
+  shared_ptr<Synchronizer> commit_sync;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  NO_FATALS(ReplicateSequenceOfMessages(
+      1,
+      kLeaderIdx,
+      WAIT_FOR_ALL_REPLICAS,
+      COMMIT_ONE_BY_ONE,
+      &last_op_id,
+      &rounds,
+      &commit_sync));
+  ASSERT_OK(commit_sync->Wait());
+  ASSERT_EVENTUALLY([&]() {
+    for (const auto& follower : followers) {
+      ASSERT_TRUE(IsFailureDetectorQuiesced(follower.get()));
+    }
+  });
+
+  // A pre-vote for an earlier term is always denied on the fast path.
+  const int64_t denied_without_lock =
+      CounterValue(METRIC_raft_vote_requests_denied_without_lock);
+  VoteRequestPB request;
+  request.set_tablet_id(kTestTablet);
+  request.set_candidate_uuid(fs_managers_[1]->uuid());
+  request.set_candidate_term(followers[0]->CurrentTerm() - 1);
+  request.set_mode(ElectionMode::PRE_ELECTION);
+  *request.mutable_candidate_status()->mutable_last_received() = last_op_id;
+  VoteResponsePB response;
+  ASSERT_OK(followers[0]->RequestVote(
+      &request,
+      TabletVotingState(boost::none /* , tablet::TABLET_DATA_READY */),
+      &response));
+  ASSERT_FALSE(response.vote_granted());
+  ASSERT_EQ(ConsensusErrorPB::INVALID_TERM, response.consensus_error().code());
+  ASSERT_EQ(
+      denied_without_lock + 1,
+      CounterValue(METRIC_raft_vote_requests_denied_without_lock));
+
+  ASSERT_FALSE(IsFailureDetectorQuiesced(followers[0].get()));
+  ASSERT_TRUE(IsFailureDetectorQuiesced(followers[1].get()));
+}
+
 // After creating the initial configuration, this test writes a small sequence
 // of messages to the initial leader. It then shuts down the current
 // leader, makes another peer become leader and writes a sequence of
@@ -1117,6 +1803,83 @@ TEST_F(RaftConsensusQuorumTest, TestReplicasEnforceTheLogMatchingProperty) {
       "Log matching property violated");
 }
 
+// With --follower_pipeline_updates, a heartbeat let in while the ops of the
+// previous request are synced must not report them as received before they
+// are durable, since the leader counts them toward the majority.
+TEST_F(RaftConsensusQuorumTest, TestPipelinedHeartbeatWaitsForDurableOps) {
+  ASSERT_OK(BuildAndStartConfig(3));
+
+  OpId last_op_id;
+  shared_ptr<Synchronizer> last_commit_sync;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  NO_FATALS(ReplicateSequenceOfMessages(
+      10,
+      2,
+      WAIT_FOR_ALL_REPLICAS,
+      COMMIT_ONE_BY_ONE,
+      &last_op_id,
+      &rounds,
+      &last_commit_sync));
+  ASSERT_OK(last_commit_sync->Wait());
+  WaitForCommitIfNotAlreadyPresent(last_op_id.index(), 0, 2);
+
+  shared_ptr<RaftConsensus> leader;
+  CHECK_OK(peers_->GetPeerByIdx(2, &leader));
+  shared_ptr<RaftConsensus> follower;
+  CHECK_OK(peers_->GetPeerByIdx(0, &follower));
+
+  FLAGS_follower_pipeline_updates = true;
+  FLAGS_log_inject_latency = true;
+  FLAGS_log_inject_latency_ms_mean = 2000;
+  FLAGS_log_inject_latency_ms_stddev = 0;
+
+  ConsensusRequestPB req;
+  req.set_caller_uuid(leader->peer_uuid());
+  req.set_caller_term(last_op_id.term());
+  req.mutable_preceding_id()->CopyFrom(last_op_id);
+  req.set_committed_index(last_op_id.index());
+  req.set_all_replicated_index(0);
+  ReplicateMsg* replicate = req.add_ops();
+  replicate->set_timestamp(clock_->Now().ToUint64());
+  OpId* id = replicate->mutable_id();
+  id->set_term(last_op_id.term());
+  id->set_index(last_op_id.index() + 1);
+  replicate->set_op_type(NO_OP);
+  req.set_last_idx_appended_to_leader(id->index());
+  const OpId next_id = *id;
+
+  ConsensusResponsePB resp;
+  Status update_status;
+  std::thread updater(
+      [&]() { update_status = follower->Update(&req, &resp); });
+
+  // Once the op is appended the next request is let in, while it is synced.
+  PeerMessageQueue* queue = follower->queue_.get();
+  ASSERT_EVENTUALLY([&]() {
+    ASSERT_TRUE(OpIdEquals(queue->GetLastOpIdInLog(), next_id));
+  });
+  ASSERT_LT(queue->GetLocalDurableIndex(), next_id.index());
+
+  ConsensusRequestPB heartbeat;
+  heartbeat.set_caller_uuid(leader->peer_uuid());
+  heartbeat.set_caller_term(next_id.term());
+  heartbeat.mutable_preceding_id()->CopyFrom(next_id);
+  heartbeat.set_committed_index(last_op_id.index());
+  heartbeat.set_all_replicated_index(0);
+  heartbeat.set_last_idx_appended_to_leader(next_id.index());
+  ConsensusResponsePB heartbeat_resp;
+  ASSERT_OK(follower->Update(&heartbeat, &heartbeat_resp));
+  ASSERT_FALSE(heartbeat_resp.status().has_error());
+  ASSERT_TRUE(OpIdEquals(heartbeat_resp.status().last_received(), next_id));
+  ASSERT_GE(heartbeat_resp.status().last_durable_idx(), next_id.index());
+  ASSERT_GE(queue->GetLocalDurableIndex(), next_id.index());
+
+  updater.join();
+  ASSERT_OK(update_status);
+  ASSERT_TRUE(OpIdEquals(resp.status().last_received(), next_id));
+  FLAGS_log_inject_latency = false;
+}
+
 // Test that RequestVote performs according to "spec".
 TEST_F(RaftConsensusQuorumTest, TestRequestVote) {
   ASSERT_OK(BuildAndStartConfig(3));
@@ -1169,6 +1932,25 @@ TEST_F(RaftConsensusQuorumTest, TestRequestVote) {
   ASSERT_EQ(0, flush_count() - flush_count_before)
       << "A rejected vote should not flush metadata";
 
+  // A pre-vote gets the same answer, without going through the Raft locks.
+  int64_t denied_without_lock =
+      peer->vote_requests_denied_without_lock_->value();
+  request.set_mode(ElectionMode::PRE_ELECTION);
+  response.Clear();
+  ASSERT_OK(peer->RequestVote(
+      &request,
+      TabletVotingState(boost::none /* , tablet::TABLET_DATA_READY */),
+      &response));
+  ASSERT_FALSE(response.vote_granted());
+  ASSERT_EQ(
+      ConsensusErrorPB::LEADER_IS_ALIVE, response.consensus_error().code());
+  ASSERT_EQ(peer->CurrentTerm(), response.responder_term());
+  ASSERT_EQ(0, flush_count() - flush_count_before)
+      << "A rejected pre-vote should not flush metadata";
+  ASSERT_EQ(
+      denied_without_lock + 1,
+      peer->vote_requests_denied_without_lock_->value());
+
   // Test that replicas only vote yes for a single peer per term.
 
   // Indicate that replicas should vote even if they think another leader is
@@ -1299,6 +2081,34 @@ TEST_F(RaftConsensusQuorumTest, TestRequestVote) {
   ASSERT_EQ(1, flush_count() - flush_count_before)
       << "Rejected votes for old op index but new term should flush once.";
 
+  // The candidate asking again gets the same denial, from the cache.
+  flush_count_before = flush_count();
+  int64_t denied_from_cache = peer->vote_requests_denied_from_cache_->value();
+  VoteResponsePB cached_response;
+  ASSERT_OK(peer->RequestVote(
+      &request,
+      TabletVotingState(boost::none /* , tablet::TABLET_DATA_READY */),
+      &cached_response));
+  ASSERT_EQ(
+      SecureShortDebugString(response),
+      SecureShortDebugString(cached_response));
+  ASSERT_EQ(
+      denied_from_cache + 1, peer->vote_requests_denied_from_cache_->value());
+  ASSERT_EQ(0, flush_count() - flush_count_before)
+      << "Cached denials should not flush";
+
+  // The cache doesn't answer for another log position of the candidate.
+  request.mutable_candidate_status()->mutable_last_received()->CopyFrom(
+      last_op_id);
+  response.Clear();
+  ASSERT_OK(peer->RequestVote(
+      &request,
+      TabletVotingState(boost::none /* , tablet::TABLET_DATA_READY */),
+      &response));
+  ASSERT_TRUE(response.vote_granted());
+  ASSERT_EQ(
+      denied_from_cache + 1, peer->vote_requests_denied_from_cache_->value());
+
   // Send a "heartbeat" to the peer. It should be rejected.
   ConsensusRequestPB req;
   req.set_caller_term(last_op_id.term());
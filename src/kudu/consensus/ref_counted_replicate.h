@@ -18,32 +18,186 @@
 #ifndef KUDU_CONSENSUS_REF_COUNTED_REPLICATE_H_
 #define KUDU_CONSENSUS_REF_COUNTED_REPLICATE_H_
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+#include <google/protobuf/arena.h>
+
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/util/faststring.h"
+#include "kudu/util/mem_tracker.h"
+#include "kudu/util/slab_allocator.h"
+#include "kudu/util/slice.h"
 
 namespace kudu {
 namespace consensus {
 
+// A ref-counted protobuf arena, on which a follower parses the ops of a
+// request. Every RefCountedReplicate of one of these ops holds a reference, so
+// the ops are freed at once, along with the arena, when the last of them is.
+class RefCountedArena : public RefCountedThreadSafe<RefCountedArena> {
+ public:
+  // The first block of the arena is 'initial_block_size' bytes, so that
+  // parsing about as many bytes of ops takes a single allocation. The blocks
+  // come from the SlabAllocator if 'use_slab_allocator', e.g. so that those
+  // large enough are backed by huge pages.
+  explicit RefCountedArena(
+      size_t initial_block_size,
+      bool use_slab_allocator = false)
+      : arena_(MakeOptions(initial_block_size, use_slab_allocator)) {}
+
+  google::protobuf::Arena* get() {
+    return &arena_;
+  }
+
+ private:
+  friend class RefCountedThreadSafe<RefCountedArena>;
+  ~RefCountedArena() = default;
+
+  static google::protobuf::ArenaOptions MakeOptions(
+      size_t initial_block_size,
+      bool use_slab_allocator) {
+    google::protobuf::ArenaOptions options;
+    options.start_block_size =
+        std::max(options.start_block_size, initial_block_size);
+    options.max_block_size =
+        std::max(options.max_block_size, options.start_block_size);
+    if (use_slab_allocator) {
+      options.block_alloc = &SlabAllocator::AllocateArenaBlock;
+      options.block_dealloc = &SlabAllocator::FreeArenaBlock;
+    }
+    return options;
+  }
+
+  google::protobuf::Arena arena_;
+};
+
 // A simple ref-counted wrapper around ReplicateMsg.
 class RefCountedReplicate : public RefCountedThreadSafe<RefCountedReplicate> {
  public:
   explicit RefCountedReplicate(ReplicateMsg* msg) : msg_(msg) {}
 
+  // 'msg' is allocated on 'arena', which is kept alive as long as this is. If
+  // 'arena' is null, 'msg' is owned as with the other constructor.
+  RefCountedReplicate(ReplicateMsg* msg, scoped_refptr<RefCountedArena> arena)
+      : msg_(msg), arena_(std::move(arena)) {
+    DCHECK_EQ(msg->GetArena(), arena_ ? arena_->get() : nullptr);
+  }
+
+  ~RefCountedReplicate() {
+    if (release_tracker_) {
+      release_tracker_->Release(release_bytes_);
+    }
+    if (arena_) {
+      std::ignore = msg_.release();
+    }
+  }
+
   ReplicateMsg* get() {
     return msg_.get();
   }
 
+  // Returns the serialized message. It's only serialized if no buffer is
+  // held yet, so that the users of the op at the same time (e.g. the WAL)
+  // share the same buffer. The message must not be modified once this has
+  // been called.
+  std::shared_ptr<const faststring> Serialized() {
+    std::lock_guard<std::mutex> l(serialized_lock_);
+    if (!serialized_) {
+      std::shared_ptr<faststring> serialized = std::make_shared<faststring>();
+      serialized->resize(msg_->ByteSize());
+      msg_->SerializeWithCachedSizesToArray(serialized->data());
+      serialized_ = std::move(serialized);
+    }
+    return serialized_;
+  }
+
+  // Drops the reference to the buffer returned by Serialized(), e.g. once the
+  // op is in the WAL, so that the buffer is freed as soon as its current users
+  // are done with it rather than along with the op.
+  void ReleaseSerialized() {
+    std::lock_guard<std::mutex> l(serialized_lock_);
+    serialized_.reset();
+  }
+
+  // Returns the bytes of memory held by the message: its encoded size plus
+  // the fixed size of its objects. The buffer returned by Serialized() is not
+  // included, as it is only held until the op is in the WAL. Unlike
+  // SpaceUsedLong(), which walks the message through reflection, this is
+  // cheap: the encoded size is computed from the field lengths, and cached
+  // for serializing.
+  int64_t MemoryFootprint() {
+    return static_cast<int64_t>(msg_->ByteSizeLong()) + sizeof(*this) +
+        sizeof(ReplicateMsg) + sizeof(OpId) +
+        (msg_->has_write_payload() ? sizeof(WritePayloadPB) : 0);
+  }
+
+  // Releases 'bytes' from 'tracker' once this is destroyed, i.e. once the last
+  // reference to the message is dropped. Used to account for messages which
+  // are kept alive by references outside of their owner. May only be called
+  // once.
+  void ReleaseOnDestruction(std::shared_ptr<MemTracker> tracker, int64_t bytes) {
+    DCHECK(!release_tracker_);
+    release_tracker_ = std::move(tracker);
+    release_bytes_ = bytes;
+  }
+
  private:
   gscoped_ptr<ReplicateMsg> msg_;
+  scoped_refptr<RefCountedArena> arena_;
+
+  std::shared_ptr<MemTracker> release_tracker_;
+  int64_t release_bytes_ = 0;
+
+  std::mutex serialized_lock_;
+  std::shared_ptr<const faststring> serialized_;
 };
 
 typedef scoped_refptr<RefCountedReplicate> ReplicateRefPtr;
 
+// An immutable batch of ops, e.g. those sent to a peer in one request. It
+// holds a reference to each of its ops, so that passing the batch on, e.g. to
+// the request of another peer, takes a single atomic increment on the batch
+// rather than one per op on counters which the LogCache, the WAL and the other
+// peers keep touching from their own threads.
+class RefCountedReplicateBatch
+    : public RefCountedThreadSafe<RefCountedReplicateBatch> {
+ public:
+  explicit RefCountedReplicateBatch(std::vector<ReplicateRefPtr> msgs)
+      : msgs_(std::move(msgs)) {}
+
+  const std::vector<ReplicateRefPtr>& msgs() const {
+    return msgs_;
+  }
+
+ private:
+  friend class RefCountedThreadSafe<RefCountedReplicateBatch>;
+  ~RefCountedReplicateBatch() = default;
+
+  const std::vector<ReplicateRefPtr> msgs_;
+};
+
+typedef scoped_refptr<RefCountedReplicateBatch> ReplicateBatchRefPtr;
+
 inline ReplicateRefPtr make_scoped_refptr_replicate(ReplicateMsg* replicate) {
   return ReplicateRefPtr(new RefCountedReplicate(replicate));
 }
 
+inline ReplicateRefPtr make_scoped_refptr_replicate(
+    ReplicateMsg* replicate,
+    scoped_refptr<RefCountedArena> arena) {
+  return ReplicateRefPtr(new RefCountedReplicate(replicate, std::move(arena)));
+}
+
 } // namespace consensus
 } // namespace kudu
 
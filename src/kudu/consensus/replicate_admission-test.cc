@@ -0,0 +1,125 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/replicate_admission.h"
+
+#include <map>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "kudu/util/monotime.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+
+using std::map;
+using std::string;
+
+namespace kudu {
+namespace consensus {
+
+// Past the outstanding limit, a tenant is held to its weighted share while
+// the others are still admitted.
+TEST(ReplicateAdmissionTest, TestFairShare) {
+  ReplicateAdmissionController::Options options;
+  options.max_outstanding_bytes = 1000;
+  options.weights = {{"online", 3}};
+  ReplicateAdmissionController admission(options);
+  const MonoTime now = MonoTime::Now();
+
+  // Under the limit, the flooding tenant takes what it wants.
+  for (int i = 0; i < 8; i++) {
+    ASSERT_OK(admission.Admit("batch", 100, now));
+  }
+  // Past it, its share is 1000 * 1 / (1 + 3) once "online" is outstanding.
+  ASSERT_OK(admission.Admit("online", 200, now));
+  Status s = admission.Admit("batch", 100, now);
+  ASSERT_TRUE(s.IsServiceUnavailable()) << s.ToString();
+  ASSERT_OK(admission.Admit("online", 100, now));
+  ASSERT_OK(admission.Admit("online", 100, now));
+
+  map<string, ReplicateAdmissionController::TenantStats> stats =
+      admission.GetTenantStats();
+  ASSERT_EQ(8, stats["batch"].admitted);
+  ASSERT_EQ(1, stats["batch"].rejected);
+  ASSERT_EQ(800, stats["batch"].outstanding_bytes);
+  ASSERT_EQ(3, stats["online"].admitted);
+  ASSERT_EQ(400, stats["online"].outstanding_bytes);
+
+  // Once its ops are replicated, the tenant is back under its share.
+  for (int i = 0; i < 7; i++) {
+    admission.Release(
+        "batch", 100, now, now + MonoDelta::FromMilliseconds(5));
+  }
+  ASSERT_OK(admission.Admit("batch", 100, now));
+  stats = admission.GetTenantStats();
+  ASSERT_EQ(200, stats["batch"].outstanding_bytes);
+  ASSERT_GE(stats["batch"].queue_delay_p99_us, 4900);
+  ASSERT_LE(stats["batch"].queue_delay_max_us, 5100);
+}
+
+// A tenant with nothing outstanding gets an op admitted, however large.
+TEST(ReplicateAdmissionTest, TestLargeOpAdmitted) {
+  ReplicateAdmissionController::Options options;
+  options.max_outstanding_bytes = 1000;
+  ReplicateAdmissionController admission(options);
+  const MonoTime now = MonoTime::Now();
+  ASSERT_OK(admission.Admit("a", 900, now));
+  ASSERT_OK(admission.Admit("b", 5000, now));
+  Status s = admission.Admit("b", 1, now);
+  ASSERT_TRUE(s.IsServiceUnavailable()) << s.ToString();
+}
+
+// Each tenant's rate scales with its weight.
+TEST(ReplicateAdmissionTest, TestRateLimit) {
+  ReplicateAdmissionController::Options options;
+  options.ops_per_sec = 10;
+  options.weights = {{"heavy", 2}};
+  ReplicateAdmissionController admission(options);
+  const MonoTime now = MonoTime::Now();
+  // The tenants start with a refill period's worth of tokens, and build up
+  // to a second's worth.
+  for (const MonoDelta& delay :
+       {MonoDelta::FromSeconds(0), MonoDelta::FromSeconds(2)}) {
+    int light = 0;
+    int heavy = 0;
+    for (int i = 0; i < 100; i++) {
+      light += admission.Admit("light", 1, now + delay).ok();
+      heavy += admission.Admit("heavy", 1, now + delay).ok();
+    }
+    const int periods = delay.ToSeconds() > 0 ? 10 : 1;
+    ASSERT_EQ(periods, light);
+    ASSERT_EQ(2 * periods, heavy);
+  }
+  ASSERT_EQ(189, admission.GetTenantStats()["light"].rejected);
+}
+
+TEST(ReplicateAdmissionTest, TestParseWeights) {
+  map<string, int> weights;
+  ASSERT_OK(ReplicateAdmissionController::ParseWeights("", &weights));
+  ASSERT_TRUE(weights.empty());
+  ASSERT_OK(
+      ReplicateAdmissionController::ParseWeights("a:1,b:4", &weights));
+  ASSERT_EQ((map<string, int>{{"a", 1}, {"b", 4}}), weights);
+  for (const char* spec : {"a", "a:0", "a:x", ":2", "a:1,a:2"}) {
+    Status s = ReplicateAdmissionController::ParseWeights(spec, &weights);
+    ASSERT_TRUE(s.IsInvalidArgument()) << spec;
+  }
+}
+
+} // namespace consensus
+} // namespace kudu
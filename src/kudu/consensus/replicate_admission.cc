@@ -0,0 +1,172 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/replicate_admission.h"
+
+#include <algorithm>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "kudu/gutil/map-util.h"
+#include "kudu/gutil/strings/numbers.h"
+#include "kudu/gutil/strings/split.h"
+#include "kudu/gutil/strings/substitute.h"
+
+using std::map;
+using std::string;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace consensus {
+
+namespace {
+
+// The queueing delays above a minute are recorded as a minute.
+constexpr int64_t kMaxQueueDelayUs = 60 * 1000 * 1000;
+
+} // anonymous namespace
+
+ReplicateAdmissionController::Tenant::Tenant(
+    int weight,
+    MonoTime now,
+    uint64_t ops_per_sec,
+    uint64_t bytes_per_sec)
+    : weight(weight),
+      // Bursts of up to a second's worth.
+      throttler(
+          now,
+          ops_per_sec * weight,
+          bytes_per_sec * weight,
+          MonoTime::kMicrosecondsPerSecond / Throttler::kRefillPeriodMicros),
+      queue_delay_us(kMaxQueueDelayUs, 2) {}
+
+ReplicateAdmissionController::ReplicateAdmissionController(Options options)
+    : options_(std::move(options)) {}
+
+Status ReplicateAdmissionController::ParseWeights(
+    const string& spec,
+    map<string, int>* weights) {
+  map<string, int> parsed;
+  vector<string> entries = strings::Split(spec, ",", strings::SkipEmpty());
+  for (const string& entry : entries) {
+    vector<string> parts = strings::Split(entry, ":");
+    int32_t weight;
+    if (parts.size() != 2 || parts[0].empty() ||
+        !safe_strto32(parts[1], &weight) || weight < 1) {
+      return Status::InvalidArgument("invalid tenant weight", entry);
+    }
+    if (!InsertIfNotPresent(&parsed, parts[0], weight)) {
+      return Status::InvalidArgument("duplicate tenant weight", entry);
+    }
+  }
+  *weights = std::move(parsed);
+  return Status::OK();
+}
+
+ReplicateAdmissionController::Tenant*
+ReplicateAdmissionController::GetOrCreateTenantUnlocked(
+    const string& tenant,
+    MonoTime now) {
+  auto it = tenants_.find(tenant);
+  if (it != tenants_.end()) {
+    return it->second.get();
+  }
+  const int weight = FindWithDefault(options_.weights, tenant, 1);
+  std::unique_ptr<Tenant> t(new Tenant(
+      weight, now, options_.ops_per_sec, options_.bytes_per_sec));
+  Tenant* ret = t.get();
+  tenants_.emplace(tenant, std::move(t));
+  return ret;
+}
+
+Status ReplicateAdmissionController::Admit(
+    const string& tenant,
+    int64_t bytes,
+    MonoTime now) {
+  std::lock_guard<simple_spinlock> l(lock_);
+  Tenant* t = GetOrCreateTenantUnlocked(tenant, now);
+  if (options_.max_outstanding_bytes > 0 && t->outstanding_rounds > 0 &&
+      outstanding_bytes_ + bytes > options_.max_outstanding_bytes) {
+    const int64_t share =
+        options_.max_outstanding_bytes * t->weight / outstanding_weight_;
+    if (t->outstanding_bytes + bytes > share) {
+      t->rejected++;
+      return Status::ServiceUnavailable(Substitute(
+          "tenant '$0' has $1 bytes of ops outstanding, its share is $2",
+          tenant,
+          t->outstanding_bytes,
+          share));
+    }
+  }
+  if (!t->throttler.Take(now, 1, bytes)) {
+    t->rejected++;
+    return Status::ServiceUnavailable(
+        Substitute("tenant '$0' is over its rate limit", tenant));
+  }
+  t->admitted++;
+  if (t->outstanding_rounds++ == 0) {
+    outstanding_weight_ += t->weight;
+  }
+  t->outstanding_bytes += bytes;
+  outstanding_bytes_ += bytes;
+  return Status::OK();
+}
+
+void ReplicateAdmissionController::Release(
+    const string& tenant,
+    int64_t bytes,
+    MonoTime admitted,
+    MonoTime now) {
+  std::lock_guard<simple_spinlock> l(lock_);
+  Tenant* t = FindPointeeOrNull(tenants_, tenant);
+  CHECK(t) << "no rounds admitted for tenant " << tenant;
+  DCHECK_GT(t->outstanding_rounds, 0);
+  if (--t->outstanding_rounds == 0) {
+    outstanding_weight_ -= t->weight;
+  }
+  t->outstanding_bytes -= bytes;
+  outstanding_bytes_ -= bytes;
+  t->queue_delay_us.Increment(std::min(
+      std::max<int64_t>((now - admitted).ToMicroseconds(), 0),
+      kMaxQueueDelayUs));
+}
+
+map<string, ReplicateAdmissionController::TenantStats>
+ReplicateAdmissionController::GetTenantStats() const {
+  map<string, TenantStats> ret;
+  std::lock_guard<simple_spinlock> l(lock_);
+  for (const auto& entry : tenants_) {
+    const Tenant& t = *entry.second;
+    TenantStats& stats = ret[entry.first];
+    stats.admitted = t.admitted;
+    stats.rejected = t.rejected;
+    stats.outstanding_bytes = t.outstanding_bytes;
+    if (t.queue_delay_us.TotalCount() > 0) {
+      stats.queue_delay_p50_us = t.queue_delay_us.ValueAtPercentile(50);
+      stats.queue_delay_p99_us = t.queue_delay_us.ValueAtPercentile(99);
+      stats.queue_delay_max_us = t.queue_delay_us.MaxValue();
+    }
+  }
+  return ret;
+}
+
+} // namespace consensus
+} // namespace kudu
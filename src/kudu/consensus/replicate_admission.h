@@ -0,0 +1,129 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/util/hdr_histogram.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/status.h"
+#include "kudu/util/throttler.h"
+
+namespace kudu {
+namespace consensus {
+
+// Admission control for the rounds a leader replicates, across the clients
+// or tenants they are tagged with (see ConsensusRound::set_tenant()), so that
+// one flooding a tablet with writes doesn't take all of its queue.
+//
+// Each tenant has a weight, 1 unless configured otherwise. Rounds are
+// admitted freely while the bytes of those admitted and not yet replicated
+// stay under 'max_outstanding_bytes'. Past it, a tenant only gets its share
+// of that, in proportion to its weight among the tenants with rounds
+// outstanding, and its rounds are turned down once it has used its share:
+// those of the other tenants are still admitted. A tenant with no rounds
+// outstanding always gets one admitted, however large. Each tenant may also be
+// held to a rate, scaled by its weight.
+//
+// Rounds which are turned down aren't queued: Replicate() fails with
+// ServiceUnavailable, for the client to back off and retry, as it does when
+// the log cache is full.
+//
+// Thread-safe.
+class ReplicateAdmissionController {
+ public:
+  struct Options {
+    // 0 for no limit.
+    int64_t max_outstanding_bytes = 0;
+    // The rate of each unit of weight, 0 for no limit.
+    uint64_t ops_per_sec = 0;
+    uint64_t bytes_per_sec = 0;
+    // The weight of each tenant which isn't 1.
+    std::map<std::string, int> weights;
+  };
+
+  struct TenantStats {
+    int64_t admitted = 0;
+    int64_t rejected = 0;
+    int64_t outstanding_bytes = 0;
+    // Microseconds from the admission of the tenant's rounds until they were
+    // replicated: the time they spent in the queue.
+    int64_t queue_delay_p50_us = 0;
+    int64_t queue_delay_p99_us = 0;
+    int64_t queue_delay_max_us = 0;
+  };
+
+  explicit ReplicateAdmissionController(Options options);
+
+  // Parses 'spec', a comma-separated list of <tenant>:<weight>, with weights
+  // of at least 1, into 'weights'.
+  static Status ParseWeights(
+      const std::string& spec,
+      std::map<std::string, int>* weights);
+
+  // Admits a round of 'bytes' from 'tenant' at 'now', or returns
+  // ServiceUnavailable if the tenant is over its share or its rate.
+  Status Admit(const std::string& tenant, int64_t bytes, MonoTime now);
+
+  // A round Admit() admitted at 'admitted' left the queue at 'now'.
+  void Release(
+      const std::string& tenant,
+      int64_t bytes,
+      MonoTime admitted,
+      MonoTime now);
+
+  // The stats of every tenant seen so far.
+  std::map<std::string, TenantStats> GetTenantStats() const;
+
+ private:
+  struct Tenant {
+    Tenant(
+        int weight,
+        MonoTime now,
+        uint64_t ops_per_sec,
+        uint64_t bytes_per_sec);
+
+    const int weight;
+    Throttler throttler;
+    int64_t admitted = 0;
+    int64_t rejected = 0;
+    int64_t outstanding_rounds = 0;
+    int64_t outstanding_bytes = 0;
+    HdrHistogram queue_delay_us;
+  };
+
+  Tenant* GetOrCreateTenantUnlocked(const std::string& tenant, MonoTime now);
+
+  const Options options_;
+
+  mutable simple_spinlock lock_;
+  std::map<std::string, std::unique_ptr<Tenant>> tenants_;
+  int64_t outstanding_bytes_ = 0;
+  // The sum of the weights of the tenants with rounds outstanding.
+  int64_t outstanding_weight_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(ReplicateAdmissionController);
+};
+
+} // namespace consensus
+} // namespace kudu
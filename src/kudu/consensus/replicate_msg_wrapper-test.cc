@@ -0,0 +1,129 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/replicate_msg_wrapper.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/gutil/gscoped_ptr.h"
+#include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/compression/compression_codec.h"
+#include "kudu/util/countdown_latch.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+#include "kudu/util/threadpool.h"
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace kudu {
+namespace consensus {
+
+class ReplicateMsgWrapperTest : public KuduTest {
+ public:
+  void SetUp() override {
+    KuduTest::SetUp();
+    ASSERT_OK(CompressionCodecManager::SetCurrentCodec(LZ4));
+    for (int i = 0; i < kNumMsgs; i++) {
+      ReplicateMsg* msg = new ReplicateMsg();
+      *msg->mutable_id() = MakeOpId(1, i + 1);
+      msg->set_timestamp(i);
+      msg->set_op_type(WRITE_OP_EXT);
+      msg->mutable_write_payload()->set_payload(Payload(i));
+      wrappers_.emplace_back(
+          new ReplicateMsgWrapper(make_scoped_refptr_replicate(msg)));
+      ASSERT_TRUE(wrappers_.back()->NeedsCompression());
+    }
+  }
+
+  void TearDown() override {
+    ASSERT_OK(CompressionCodecManager::SetCurrentCodec(NO_COMPRESSION));
+    KuduTest::TearDown();
+  }
+
+ protected:
+  static const int kNumMsgs = 10;
+
+  static string Payload(int i) {
+    return string(1000 + i, 'a' + i);
+  }
+
+  vector<ReplicateMsgWrapper*> Wrappers() const {
+    vector<ReplicateMsgWrapper*> wrappers;
+    for (const auto& wrapper : wrappers_) {
+      wrappers.push_back(wrapper.get());
+    }
+    return wrappers;
+  }
+
+  // Asserts that every msg was compressed, into what uncompresses back to
+  // its payload.
+  void AssertCompressed(const vector<Status>& statuses) {
+    ASSERT_EQ(kNumMsgs, static_cast<int>(statuses.size()));
+    for (int i = 0; i < kNumMsgs; i++) {
+      SCOPED_TRACE(i);
+      ASSERT_OK(statuses[i]);
+      ReplicateRefPtr compressed = wrappers_[i]->GetCompressedMsg();
+      ASSERT_TRUE(compressed);
+      ASSERT_EQ(LZ4, compressed->get()->write_payload().compression_codec());
+      ReplicateMsgWrapper uncompressor(compressed);
+      ASSERT_OK(uncompressor.Init(nullptr));
+      ASSERT_EQ(
+          Payload(i),
+          uncompressor.GetUncompressedMsg()->get()->write_payload().payload());
+    }
+  }
+
+  vector<unique_ptr<ReplicateMsgWrapper>> wrappers_;
+};
+
+TEST_F(ReplicateMsgWrapperTest, TestStridesRunOnPool) {
+  gscoped_ptr<ThreadPool> pool;
+  ASSERT_OK(ThreadPoolBuilder("compress").set_max_threads(3).Build(&pool));
+  vector<Status> statuses;
+  // More tasks than msgs divide evenly in.
+  ASSERT_EQ(3, InitMsgWrappersInStrides(pool.get(), 4, Wrappers(), &statuses));
+  NO_FATALS(AssertCompressed(statuses));
+}
+
+TEST_F(ReplicateMsgWrapperTest, TestStridesRunInlineWhenPoolIsFull) {
+  gscoped_ptr<ThreadPool> pool;
+  ASSERT_OK(ThreadPoolBuilder("compress")
+                .set_max_threads(1)
+                .set_max_queue_size(0)
+                .Build(&pool));
+  CountDownLatch release(1);
+  ASSERT_OK(pool->SubmitFunc([&release]() { release.Wait(); }));
+
+  vector<Status> statuses;
+  ASSERT_EQ(0, InitMsgWrappersInStrides(pool.get(), 3, Wrappers(), &statuses));
+  NO_FATALS(AssertCompressed(statuses));
+  release.CountDown();
+  pool->Wait();
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -1,9 +1,15 @@
+#include <vector>
+
 #include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/gutil/port.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/compression/compression.pb.h"
 #include "kudu/util/compression/compression_codec.h"
+#include "kudu/util/countdown_latch.h"
 #include "kudu/util/crc.h"
 #include "kudu/util/faststring.h"
+#include "kudu/util/status.h"
+#include "kudu/util/threadpool.h"
 
 namespace kudu {
 namespace consensus {
@@ -20,6 +26,11 @@ class ReplicateMsgWrapper {
       const ReplicateRefPtr& msg,
       const bool should_compress = true) {
     orig_msg_ = msg;
+    // A stripped msg has no payload to (un)compress.
+    if (IsPayloadStripped(*orig_msg_->get())) {
+      msg_ = orig_msg_;
+      return;
+    }
     auto codec_hint = CompressionCodecManager::GetCurrentCodec();
     const CompressionType msg_codec_type =
         orig_msg_->get()->write_payload().compression_codec();
@@ -29,9 +40,11 @@ class ReplicateMsgWrapper {
       should_compress_ = should_compress &&
           msg_->get()->op_type() == WRITE_OP_EXT && codec_ != nullptr;
     } else {
+      // Uncompress with a shared codec of the msg's type, which leaves the
+      // current codec alone.
       compressed_msg_ = orig_msg_;
-      CHECK_OK(CompressionCodecManager::SetCurrentCodec(msg_codec_type));
-      codec_ = CompressionCodecManager::GetCurrentCodec();
+      CHECK_OK(
+          CompressionCodecManager::GetCodecForType(msg_codec_type, &codec_));
     }
     DCHECK(msg_ || compressed_msg_);
   }
@@ -65,6 +78,11 @@ class ReplicateMsgWrapper {
     return Status::OK();
   }
 
+  /** Returns true if Init() is going to compress the msg **/
+  bool NeedsCompression() const {
+    return should_compress_ && msg_ && !compressed_msg_;
+  }
+
   /** Returns the msg that was originally passed to the ctor **/
   ReplicateRefPtr GetOrigMsg() const {
     return orig_msg_;
@@ -80,6 +98,44 @@ class ReplicateMsgWrapper {
     return compressed_msg_;
   }
 
+  /**
+   * Returns the msg to store on a witness in place of the one wrapped, see
+   * --raft_witness_strip_payloads: the msg itself if it has no payload,
+   * otherwise its header fields along with the size and the crc32 checksum
+   * of the payload as sent, i.e. compressed if the msg is.
+   */
+  ReplicateRefPtr GetStrippedMsg() const {
+    const ReplicateRefPtr& msg = compressed_msg_ ? compressed_msg_ : msg_;
+    DCHECK(msg);
+    const ReplicateMsg& src = *msg->get();
+    if (src.op_type() != WRITE_OP_EXT || IsPayloadStripped(src)) {
+      return msg;
+    }
+    const WritePayloadPB& src_payload = src.write_payload();
+    std::unique_ptr<ReplicateMsg> rep_msg(new ReplicateMsg);
+    *(rep_msg->mutable_id()) = src.id();
+    rep_msg->set_timestamp(src.timestamp());
+    rep_msg->set_op_type(src.op_type());
+    if (src.has_request_id()) {
+      *(rep_msg->mutable_request_id()) = src.request_id();
+    }
+
+    WritePayloadPB* write_payload = rep_msg->mutable_write_payload();
+    write_payload->set_compression_codec(src_payload.compression_codec());
+    if (src_payload.has_uncompressed_size()) {
+      write_payload->set_uncompressed_size(src_payload.uncompressed_size());
+    }
+    write_payload->set_crc32(crc::Crc32c(
+        src_payload.payload().c_str(), src_payload.payload().size()));
+    write_payload->set_stripped_size(src_payload.payload().size());
+    return make_scoped_refptr_replicate(rep_msg.release());
+  }
+
+  /** Returns true if 'msg' was stored without its payload **/
+  static bool IsPayloadStripped(const ReplicateMsg& msg) {
+    return msg.has_write_payload() && msg.write_payload().has_stripped_size();
+  }
+
  private:
   Status UncompressMsg(faststring* buffer) {
     DCHECK(!msg_ && compressed_msg_);
@@ -210,5 +266,48 @@ class ReplicateMsgWrapper {
   std::shared_ptr<faststring> compression_buffer_;
 };
 
+/**
+ * Inits 'msg_wrappers' in 'num_tasks' strides, the stride of task t being
+ * every num_tasks-th wrapper from the t-th on, each with a buffer of its own.
+ * Task 0 runs on the calling thread and the others on 'pool', or there too
+ * if the pool's queue is full.
+ *
+ * @param statuses Set to the outcome of Init() for each wrapper
+ *
+ * @return    The number of tasks which ran on 'pool', once all are done
+ */
+inline int InitMsgWrappersInStrides(
+    ThreadPool* pool,
+    int num_tasks,
+    const std::vector<ReplicateMsgWrapper*>& msg_wrappers,
+    std::vector<Status>* statuses) {
+  statuses->assign(msg_wrappers.size(), Status::OK());
+  auto init_stride = [&](int task) {
+    faststring buffer;
+    for (size_t k = task; k < msg_wrappers.size(); k += num_tasks) {
+      (*statuses)[k] = msg_wrappers[k]->Init(&buffer);
+    }
+  };
+
+  int pooled_tasks = 0;
+  CountDownLatch latch(num_tasks - 1);
+  for (int task = 1; task < num_tasks; task++) {
+    Status s = pool->SubmitFunc([&init_stride, &latch, task]() {
+      init_stride(task);
+      latch.CountDown();
+    });
+    if (PREDICT_FALSE(!s.ok())) {
+      // The pool's queue is full, so init this stride here.
+      init_stride(task);
+      latch.CountDown();
+    } else {
+      pooled_tasks++;
+    }
+  }
+  init_stride(0);
+  latch.Wait();
+  return pooled_tasks;
+}
+
 } // namespace consensus
 } // namespace kudu
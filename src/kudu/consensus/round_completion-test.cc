@@ -0,0 +1,132 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/round_completion.h"
+
+#include <poll.h>
+
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/raft_consensus.h"
+#include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+using std::thread;
+using std::unique_ptr;
+using std::vector;
+
+namespace kudu {
+namespace consensus {
+
+namespace {
+
+scoped_refptr<ConsensusRound> MakeRound(int64_t index) {
+  ReplicateMsg* msg = new ReplicateMsg();
+  msg->set_op_type(WRITE_OP_EXT);
+  *msg->mutable_id() = MakeOpId(1, index);
+  return scoped_refptr<ConsensusRound>(
+      new ConsensusRound(nullptr, make_scoped_refptr_replicate(msg)));
+}
+
+bool IsReadable(int fd) {
+  struct pollfd pfd = {fd, POLLIN, 0};
+  return ::poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+} // anonymous namespace
+
+TEST(RoundCompletionTest, TestFuture) {
+  scoped_refptr<ConsensusRound> round = MakeRound(1);
+  RoundFuture future = RoundFuture::Watch(round.get());
+  ASSERT_FALSE(future.IsReady());
+  ASSERT_TRUE(future.WaitFor(MonoDelta::FromMilliseconds(10)).IsTimedOut());
+
+  thread replicator([&]() { round->NotifyReplicationFinished(Status::OK()); });
+  ASSERT_OK(future.Wait());
+  replicator.join();
+  ASSERT_TRUE(future.IsReady());
+}
+
+// A batch completes once all its rounds have, with the first failure.
+TEST(RoundCompletionTest, TestBatchFuture) {
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  for (int i = 1; i <= 3; i++) {
+    rounds.push_back(MakeRound(i));
+  }
+  RoundFuture future = RoundFuture::WatchBatch(rounds);
+  rounds[0]->NotifyReplicationFinished(Status::OK());
+  rounds[2]->NotifyReplicationFinished(Status::Aborted("lost leadership"));
+  ASSERT_FALSE(future.IsReady());
+  rounds[1]->NotifyReplicationFinished(Status::OK());
+  ASSERT_TRUE(future.IsReady());
+  ASSERT_TRUE(future.Wait().IsAborted());
+
+  ASSERT_TRUE(RoundFuture::WatchBatch({}).IsReady());
+}
+
+// A burst of completions signals the eventfd once, and a completion queued
+// after a poll signals it again.
+TEST(RoundCompletionTest, TestCompletionQueue) {
+  unique_ptr<RoundCompletionQueue> queue;
+  ASSERT_OK(RoundCompletionQueue::Create(&queue));
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  for (int i = 1; i <= 4; i++) {
+    rounds.push_back(MakeRound(i));
+    queue->Watch(rounds.back().get(), 100 + i);
+  }
+  ASSERT_FALSE(IsReadable(queue->fd()));
+
+  for (int i = 0; i < 3; i++) {
+    rounds[i]->NotifyReplicationFinished(Status::OK());
+  }
+  ASSERT_TRUE(IsReadable(queue->fd()));
+  vector<RoundCompletionQueue::Completion> completions;
+  queue->Poll(&completions);
+  ASSERT_FALSE(IsReadable(queue->fd()));
+  ASSERT_EQ(3, completions.size());
+  for (int i = 0; i < 3; i++) {
+    ASSERT_EQ(i + 1, completions[i].id.index());
+    ASSERT_EQ(101 + i, completions[i].tag);
+    ASSERT_OK(completions[i].status);
+  }
+
+  rounds[3]->NotifyReplicationFinished(Status::Aborted("lost leadership"));
+  ASSERT_TRUE(IsReadable(queue->fd()));
+  completions.clear();
+  queue->Poll(&completions);
+  ASSERT_EQ(1, completions.size());
+  ASSERT_EQ(104, completions[0].tag);
+  ASSERT_TRUE(completions[0].status.IsAborted());
+
+  completions.clear();
+  queue->Poll(&completions);
+  ASSERT_TRUE(completions.empty());
+}
+
+} // namespace consensus
+} // namespace kudu
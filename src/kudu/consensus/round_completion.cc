@@ -0,0 +1,148 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/round_completion.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "kudu/consensus/raft_consensus.h"
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/port.h"
+#include "kudu/util/errno.h"
+
+using std::unique_ptr;
+using std::vector;
+
+namespace kudu {
+namespace consensus {
+
+void RoundFuture::Data::Complete(const Status& s) {
+  {
+    std::lock_guard<simple_spinlock> l(lock);
+    if (status.ok() && !s.ok()) {
+      status = s;
+    }
+  }
+  latch.CountDown();
+}
+
+RoundFuture RoundFuture::Watch(ConsensusRound* round) {
+  auto data = std::make_shared<Data>(1);
+  round->SetConsensusReplicatedCallback(
+      [data](const Status& s) { data->Complete(s); });
+  return RoundFuture(std::move(data));
+}
+
+RoundFuture RoundFuture::WatchBatch(
+    const vector<scoped_refptr<ConsensusRound>>& rounds) {
+  auto data = std::make_shared<Data>(static_cast<int>(rounds.size()));
+  for (const auto& round : rounds) {
+    round->SetConsensusReplicatedCallback(
+        [data](const Status& s) { data->Complete(s); });
+  }
+  return RoundFuture(std::move(data));
+}
+
+Status RoundFuture::Wait() const {
+  data_->latch.Wait();
+  std::lock_guard<simple_spinlock> l(data_->lock);
+  return data_->status;
+}
+
+Status RoundFuture::WaitFor(const MonoDelta& delta) const {
+  if (!data_->latch.WaitFor(delta)) {
+    return Status::TimedOut("timed out waiting for the rounds to complete");
+  }
+  std::lock_guard<simple_spinlock> l(data_->lock);
+  return data_->status;
+}
+
+Status RoundCompletionQueue::Create(unique_ptr<RoundCompletionQueue>* queue) {
+  int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd < 0) {
+    int err = errno;
+    return Status::IOError(
+        "could not create an eventfd", ErrnoToString(err), err);
+  }
+  queue->reset(new RoundCompletionQueue(fd));
+  return Status::OK();
+}
+
+RoundCompletionQueue::~RoundCompletionQueue() {
+  ::close(fd_);
+}
+
+void RoundCompletionQueue::Watch(ConsensusRound* round, uint64_t tag) {
+  round->SetConsensusReplicatedCallback([this, round, tag](const Status& s) {
+    Push({round->id(), tag, s});
+  });
+}
+
+void RoundCompletionQueue::Push(Completion completion) {
+  bool was_empty;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    was_empty = completions_.empty();
+    completions_.emplace_back(std::move(completion));
+  }
+  if (!was_empty) {
+    // The poller was woken up by the first of them, and hasn't polled yet.
+    return;
+  }
+  const uint64_t one = 1;
+  ssize_t ret;
+  RETRY_ON_EINTR(ret, ::write(fd_, &one, sizeof(one)));
+  if (PREDICT_FALSE(ret < 0)) {
+    int err = errno;
+    LOG(WARNING) << "Could not signal the round completion eventfd: "
+                 << ErrnoToString(err);
+  }
+}
+
+void RoundCompletionQueue::Poll(vector<Completion>* completions) {
+  // Cleared first: a completion queued once the queue is swapped out below
+  // signals it again.
+  uint64_t value;
+  ssize_t ret;
+  RETRY_ON_EINTR(ret, ::read(fd_, &value, sizeof(value)));
+  if (PREDICT_FALSE(ret < 0 && errno != EAGAIN)) {
+    int err = errno;
+    LOG(WARNING) << "Could not read the round completion eventfd: "
+                 << ErrnoToString(err);
+  }
+  vector<Completion> taken;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    taken.swap(completions_);
+  }
+  completions->insert(
+      completions->end(),
+      std::make_move_iterator(taken.begin()),
+      std::make_move_iterator(taken.end()));
+}
+
+} // namespace consensus
+} // namespace kudu
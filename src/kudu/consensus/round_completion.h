@@ -0,0 +1,125 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "kudu/consensus/opid.pb.h"
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/countdown_latch.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+namespace consensus {
+class ConsensusRound;
+
+// Ways for an embedder to learn of the completion of the rounds it
+// replicates other than their replicated callbacks, which run on the raft
+// pool threads. Both take over the replicated callback of the rounds they
+// watch, so they must watch them before they are replicated.
+
+// The completion of a round, or of a batch of rounds, which a thread can
+// check for or wait on. Copies share the same completion.
+class RoundFuture {
+ public:
+  // Completes once 'round' is replicated, or failed to be.
+  static RoundFuture Watch(ConsensusRound* round);
+
+  // Completes once all of 'rounds' are done, with the status of the first of
+  // them to fail, if any.
+  static RoundFuture WatchBatch(
+      const std::vector<scoped_refptr<ConsensusRound>>& rounds);
+
+  bool IsReady() const {
+    return data_->latch.count() == 0;
+  }
+
+  // Returns the status of the rounds once they are done.
+  Status Wait() const;
+
+  // Like Wait(), but returns TimedOut if they are not done within 'delta'.
+  Status WaitFor(const MonoDelta& delta) const;
+
+ private:
+  struct Data {
+    explicit Data(int count) : latch(count) {}
+
+    void Complete(const Status& status);
+
+    CountDownLatch latch;
+    // Protects 'status'.
+    simple_spinlock lock;
+    Status status;
+  };
+
+  explicit RoundFuture(std::shared_ptr<Data> data) : data_(std::move(data)) {}
+
+  std::shared_ptr<Data> data_;
+};
+
+// A queue the completions of rounds are delivered to, which an embedder polls
+// from its own event loop. Its eventfd becomes readable when completions are
+// queued while there were none, so that a burst of them takes a single
+// wakeup rather than one per round.
+class RoundCompletionQueue {
+ public:
+  struct Completion {
+    OpId id;
+    // As passed to Watch().
+    uint64_t tag;
+    Status status;
+  };
+
+  static Status Create(std::unique_ptr<RoundCompletionQueue>* queue);
+  ~RoundCompletionQueue();
+
+  // The eventfd to poll for reads, e.g. with epoll, before calling Poll().
+  int fd() const {
+    return fd_;
+  }
+
+  // Queues the completion of 'round' once it is replicated, or failed to
+  // be, tagged with 'tag'. The queue must outlive the round.
+  void Watch(ConsensusRound* round, uint64_t tag);
+
+  // Moves the completions queued so far to 'completions', without blocking,
+  // and clears the eventfd.
+  void Poll(std::vector<Completion>* completions);
+
+ private:
+  explicit RoundCompletionQueue(int fd) : fd_(fd) {}
+
+  void Push(Completion completion);
+
+  const int fd_;
+
+  // Protects 'completions_'.
+  simple_spinlock lock_;
+  std::vector<Completion> completions_;
+
+  DISALLOW_COPY_AND_ASSIGN(RoundCompletionQueue);
+};
+
+} // namespace consensus
+} // namespace kudu
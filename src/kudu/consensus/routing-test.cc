@@ -21,14 +21,21 @@
 #include <string>
 #include <unordered_map>
 
+#include <gflags/gflags.h>
 #include <gtest/gtest.h>
 
 #include "kudu/consensus/consensus-test-util.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/stopwatch.h"
 #include "kudu/util/test_macros.h"
 
+DECLARE_int32(raft_proxy_peers_per_region);
+
 using std::string;
 using std::unique_ptr;
 using std::unordered_map;
+using strings::Substitute;
 
 namespace kudu {
 namespace consensus {
@@ -106,5 +113,291 @@ TEST(RoutingTest, TestStaleRouter) {
   ASSERT_EQ("peer-2", next_hop); // Direct routing fallback.
 }
 
+// Checks that 'routing_table' routes between all peers of 'raft_config' like
+// one built from scratch.
+static void AssertSameRoutesAsInit(
+    const RoutingTable& routing_table,
+    const RaftConfigPB& raft_config,
+    const ProxyTopologyPB& proxy_topology,
+    const string& leader_uuid) {
+  RoutingTable expected;
+  Status s = expected.Init(raft_config, proxy_topology, leader_uuid);
+  ASSERT_TRUE(s.ok() || s.IsIncomplete()) << s.ToString();
+  for (const RaftPeerPB& src : raft_config.peers()) {
+    for (const RaftPeerPB& dest : raft_config.peers()) {
+      string expected_hop;
+      string next_hop;
+      ASSERT_OK(expected.NextHop(
+          src.permanent_uuid(), dest.permanent_uuid(), &expected_hop));
+      ASSERT_OK(routing_table.NextHop(
+          src.permanent_uuid(), dest.permanent_uuid(), &next_hop));
+      ASSERT_EQ(expected_hop, next_hop)
+          << src.permanent_uuid() << " -> " << dest.permanent_uuid();
+    }
+  }
+}
+
+// Incremental updates give the same routes as rebuilding the routing table.
+TEST(RoutingTest, TestIncrementalUpdates) {
+  RaftConfigPB full_config = BuildRaftConfigPBForTests(/*num_voters=*/13);
+  full_config.set_opid_index(1); // required for validation
+  RaftConfigPB raft_config = full_config;
+  raft_config.mutable_peers()->RemoveLast(); // peer-12
+
+  ProxyTopologyPB proxy_topology;
+  AddEdge(&proxy_topology, /*to=*/"peer-3", /*proxy_from=*/"peer-2");
+  AddEdge(&proxy_topology, /*to=*/"peer-4", /*proxy_from=*/"peer-3");
+  AddEdge(&proxy_topology, /*to=*/"peer-5", /*proxy_from=*/"peer-3");
+  AddEdge(&proxy_topology, /*to=*/"peer-7", /*proxy_from=*/"peer-6");
+  AddEdge(&proxy_topology, /*to=*/"peer-8", /*proxy_from=*/"peer-6");
+  AddEdge(&proxy_topology, /*to=*/"peer-9", /*proxy_from=*/"peer-8");
+  AddEdge(&proxy_topology, /*to=*/"peer-11", /*proxy_from=*/"peer-12");
+
+  RoutingTable routing_table;
+  Status s = routing_table.Init(raft_config, proxy_topology, "peer-0");
+  ASSERT_TRUE(s.IsIncomplete()) << s.ToString();
+
+  // A leader with a proxy chain above it, then one without.
+  s = routing_table.UpdateLeader("peer-4");
+  ASSERT_TRUE(s.IsIncomplete()) << s.ToString();
+  NO_FATALS(AssertSameRoutesAsInit(
+      routing_table, raft_config, proxy_topology, "peer-4"));
+  s = routing_table.UpdateLeader("peer-1");
+  ASSERT_TRUE(s.IsIncomplete()) << s.ToString();
+  NO_FATALS(AssertSameRoutesAsInit(
+      routing_table, raft_config, proxy_topology, "peer-1"));
+
+  // Remove proxy peers, then add them back along with the missing one.
+  RaftConfigPB smaller_config = raft_config;
+  smaller_config.clear_peers();
+  for (const RaftPeerPB& peer : raft_config.peers()) {
+    if (peer.permanent_uuid() != "peer-3" &&
+        peer.permanent_uuid() != "peer-6") {
+      *smaller_config.add_peers() = peer;
+    }
+  }
+  s = routing_table.UpdateRaftConfig(smaller_config);
+  ASSERT_TRUE(s.IsIncomplete()) << s.ToString();
+  NO_FATALS(AssertSameRoutesAsInit(
+      routing_table, smaller_config, proxy_topology, "peer-1"));
+  ASSERT_OK(routing_table.UpdateRaftConfig(full_config));
+  NO_FATALS(AssertSameRoutesAsInit(
+      routing_table, full_config, proxy_topology, "peer-1"));
+
+  // A config without the leader, or with a duplicate peer, changes nothing.
+  ASSERT_OK(routing_table.UpdateLeader("peer-9"));
+  RaftConfigPB bad_config = full_config;
+  bad_config.mutable_peers(9)->set_permanent_uuid("peer-1");
+  ASSERT_FALSE(routing_table.UpdateRaftConfig(bad_config).ok());
+  bad_config.mutable_peers()->SwapElements(9, bad_config.peers_size() - 1);
+  bad_config.mutable_peers()->RemoveLast();
+  s = routing_table.UpdateRaftConfig(bad_config);
+  ASSERT_TRUE(s.IsInvalidArgument()) << s.ToString();
+  NO_FATALS(AssertSameRoutesAsInit(
+      routing_table, full_config, proxy_topology, "peer-9"));
+
+  // Re-route proxied peers, and give the leader a proxy chain.
+  ProxyTopologyPB new_topology;
+  AddEdge(&new_topology, /*to=*/"peer-3", /*proxy_from=*/"peer-1");
+  AddEdge(&new_topology, /*to=*/"peer-4", /*proxy_from=*/"peer-3");
+  AddEdge(&new_topology, /*to=*/"peer-8", /*proxy_from=*/"peer-4");
+  AddEdge(&new_topology, /*to=*/"peer-9", /*proxy_from=*/"peer-8");
+  AddEdge(&new_topology, /*to=*/"peer-10", /*proxy_from=*/"peer-9");
+  ASSERT_OK(routing_table.UpdateProxyTopology(new_topology));
+  NO_FATALS(AssertSameRoutesAsInit(
+      routing_table, full_config, new_topology, "peer-9"));
+  ASSERT_OK(routing_table.UpdateLeader("peer-0"));
+  NO_FATALS(AssertSameRoutesAsInit(
+      routing_table, full_config, new_topology, "peer-0"));
+}
+
+// Compares the incremental updates of a routing table of thousands of peers
+// with rebuilding it.
+TEST(RoutingTest, BenchmarkIncrementalUpdates) {
+  const int kNumProxies = 40;
+  const int kPeersPerProxy = 100;
+  const int kNumLeaderChanges = 20;
+  const int kNumConfigChanges = 200;
+
+  // The leader region has the voters, each of a number of remote regions a
+  // proxy peer for the learners of the region.
+  RaftConfigPB raft_config = BuildRaftConfigPBForTests(/*num_voters=*/5);
+  raft_config.set_opid_index(1); // required for validation
+  ProxyTopologyPB proxy_topology;
+  for (int i = 0; i < kNumProxies; i++) {
+    for (int j = 0; j < kPeersPerProxy; j++) {
+      RaftPeerPB* peer = raft_config.add_peers();
+      *peer = raft_config.peers(0);
+      peer->set_member_type(RaftPeerPB::NON_VOTER);
+      peer->set_permanent_uuid(Substitute("learner-$0-$1", i, j));
+      if (j > 0) {
+        AddEdge(
+            &proxy_topology,
+            peer->permanent_uuid(),
+            Substitute("learner-$0-0", i));
+      }
+    }
+  }
+  LOG(INFO) << "Routing table of " << raft_config.peers_size() << " peers";
+
+  RoutingTable rebuilt;
+  LOG_TIMING(
+      INFO, Substitute("$0 leader changes, rebuilt", kNumLeaderChanges)) {
+    for (int i = 0; i < kNumLeaderChanges; i++) {
+      ASSERT_OK(rebuilt.Init(
+          raft_config, proxy_topology, Substitute("peer-$0", i % 5)));
+    }
+  }
+  RoutingTable routing_table;
+  ASSERT_OK(routing_table.Init(raft_config, proxy_topology, "peer-0"));
+  LOG_TIMING(
+      INFO, Substitute("$0 leader changes, updated", kNumLeaderChanges)) {
+    for (int i = 0; i < kNumLeaderChanges; i++) {
+      ASSERT_OK(routing_table.UpdateLeader(Substitute("peer-$0", i % 5)));
+    }
+  }
+
+  // Learners leaving the config and coming back.
+  RaftConfigPB smaller_config = raft_config;
+  smaller_config.mutable_peers()->RemoveLast();
+  LOG_TIMING(
+      INFO, Substitute("$0 config changes, rebuilt", kNumConfigChanges)) {
+    for (int i = 0; i < kNumConfigChanges; i++) {
+      ASSERT_OK(rebuilt.Init(
+          i % 2 ? raft_config : smaller_config, proxy_topology, "peer-4"));
+    }
+  }
+  LOG_TIMING(
+      INFO, Substitute("$0 config changes, updated", kNumConfigChanges)) {
+    for (int i = 0; i < kNumConfigChanges; i++) {
+      ASSERT_OK(routing_table.UpdateRaftConfig(
+          i % 2 ? raft_config : smaller_config));
+    }
+  }
+
+  for (const RaftPeerPB& peer : raft_config.peers()) {
+    string expected_hop;
+    string next_hop;
+    ASSERT_OK(rebuilt.NextHop("peer-4", peer.permanent_uuid(), &expected_hop));
+    ASSERT_OK(
+        routing_table.NextHop("peer-4", peer.permanent_uuid(), &next_hop));
+    ASSERT_EQ(expected_hop, next_hop);
+  }
+}
+
+// Peers proxied in a region are spread across its proxy peers, and only those
+// of an unreachable proxy peer move.
+TEST(RoutingTest, TestSimpleRegionRoutingWithMultipleProxies) {
+  gflags::FlagSaver saver;
+  FLAGS_raft_proxy_peers_per_region = 2;
+
+  // peer-0 is alone in its region. peer-1 and peer-2 are backed by a database
+  // in the other region, and proxy the witnesses peer-3 to peer-8.
+  RaftConfigPB raft_config = BuildRaftConfigPBForTests(/*num_voters=*/9);
+  raft_config.set_opid_index(1); // required for validation
+  for (int i = 0; i < raft_config.peers_size(); i++) {
+    RaftPeerAttrsPB* attrs = raft_config.mutable_peers(i)->mutable_attrs();
+    attrs->set_region(i == 0 ? "region-a" : "region-b");
+    attrs->set_backing_db_present(i < 3);
+  }
+
+  std::shared_ptr<SimpleRegionRoutingTable> srt;
+  ASSERT_OK(SimpleRegionRoutingTable::Create(
+      raft_config, raft_config.peers(0), &srt));
+  unordered_map<string, string> routes;
+  for (int i = 1; i < raft_config.peers_size(); i++) {
+    const string& uuid = raft_config.peers(i).permanent_uuid();
+    string next_hop;
+    ASSERT_OK(srt->NextHop("peer-0", uuid, &next_hop));
+    if (i < 3) {
+      ASSERT_EQ(uuid, next_hop);
+    } else {
+      ASSERT_TRUE(next_hop == "peer-1" || next_hop == "peer-2") << next_hop;
+      routes[uuid] = next_hop;
+    }
+  }
+
+  const string failed_proxy = routes["peer-3"];
+  const string other_proxy = failed_proxy == "peer-1" ? "peer-2" : "peer-1";
+  srt->SetPeerReachable(failed_proxy, false);
+  for (const auto& route : routes) {
+    string next_hop;
+    ASSERT_OK(srt->NextHop("peer-0", route.first, &next_hop));
+    ASSERT_EQ(other_proxy, next_hop);
+  }
+
+  // Back to the same spread once it is reachable again.
+  srt->SetPeerReachable(failed_proxy, true);
+  for (const auto& route : routes) {
+    string next_hop;
+    ASSERT_OK(srt->NextHop("peer-0", route.first, &next_hop));
+    ASSERT_EQ(route.second, next_hop);
+  }
+}
+
+// The leader keeps the remote voter it needs for a quorum direct, and proxies
+// the other peers of that region through the one closest to it.
+TEST(RoutingTest, TestLatencyAwareRouting) {
+  RaftConfigPB raft_config = BuildRaftConfigPBForTests(/*num_voters=*/5);
+  raft_config.set_opid_index(1); // required for validation
+  for (int i = 0; i < raft_config.peers_size(); i++) {
+    raft_config.mutable_peers(i)->mutable_attrs()->set_region(
+        i < 2 ? "region-a" : "region-b");
+  }
+  const RaftPeerPB local_peer_pb = raft_config.peers(0);
+
+  std::shared_ptr<LatencyAwareRoutingTable> lart;
+  ASSERT_OK(
+      LatencyAwareRoutingTable::Create(raft_config, local_peer_pb, &lart));
+  lart->UpdateLeader("peer-0");
+
+  // Nothing measured yet: all direct.
+  string next_hop;
+  ASSERT_OK(lart->NextHop("peer-0", "peer-3", &next_hop));
+  ASSERT_EQ("peer-3", next_hop);
+
+  MonoTime now = MonoTime::Now();
+  const MonoDelta kNoDownstream = MonoDelta::FromMicroseconds(0);
+  lart->RecordRoundTrip(
+      "peer-1", "", MonoDelta::FromMilliseconds(1), kNoDownstream, now);
+  lart->RecordRoundTrip(
+      "peer-3", "", MonoDelta::FromMilliseconds(20), kNoDownstream, now);
+  lart->RecordRoundTrip(
+      "peer-4", "", MonoDelta::FromMilliseconds(30), kNoDownstream, now);
+  lart->RecordRoundTrip(
+      "peer-2", "", MonoDelta::FromMilliseconds(10), kNoDownstream, now);
+  lart->RebuildRoutes();
+
+  // The first request to a newly proxied peer probes it directly.
+  ASSERT_OK(lart->NextHop("peer-0", "peer-3", &next_hop));
+  ASSERT_EQ("peer-3", next_hop);
+  ASSERT_OK(lart->NextHop("peer-0", "peer-3", &next_hop));
+  ASSERT_EQ("peer-2", next_hop);
+  ASSERT_OK(lart->NextHop("peer-0", "peer-4", &next_hop));
+  ASSERT_OK(lart->NextHop("peer-0", "peer-4", &next_hop));
+  ASSERT_EQ("peer-2", next_hop);
+  ASSERT_OK(lart->NextHop("peer-0", "peer-2", &next_hop));
+  ASSERT_EQ("peer-2", next_hop);
+  ASSERT_OK(lart->NextHop("peer-0", "peer-1", &next_hop));
+  ASSERT_EQ("peer-1", next_hop);
+  ASSERT_EQ(2, lart->GetProxyTopology().proxy_edges_size());
+
+  // A proxied path much slower than the direct one goes back to direct.
+  lart->RecordRoundTrip(
+      "peer-4",
+      "peer-2",
+      MonoDelta::FromMilliseconds(200),
+      MonoDelta::FromMilliseconds(190),
+      now + MonoDelta::FromSeconds(10));
+  ASSERT_OK(lart->NextHop("peer-0", "peer-4", &next_hop));
+  ASSERT_EQ("peer-4", next_hop);
+
+  // Only the leader proxies.
+  lart->UpdateLeader("peer-1");
+  ASSERT_OK(lart->NextHop("peer-0", "peer-3", &next_hop));
+  ASSERT_EQ("peer-3", next_hop);
+  ASSERT_EQ(0, lart->GetProxyTopology().proxy_edges_size());
+}
+
 } // namespace consensus
 } // namespace kudu
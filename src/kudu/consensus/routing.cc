@@ -17,8 +17,13 @@
 
 #include "kudu/consensus/routing.h"
 
+#include <algorithm>
+#include <map>
+#include <mutex>
 #include <unordered_set>
+#include <utility>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <google/protobuf/util/message_differencer.h>
 
@@ -29,12 +34,77 @@
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/env.h"
 #include "kudu/util/env_util.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/hash_util.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/status.h"
 
+DEFINE_int32(
+    raft_proxy_peers_per_region,
+    1,
+    "Maximum number of peers backed by a database that act as proxy peers "
+    "of a region with SIMPLE_REGION_ROUTING_POLICY. The peers proxied in a "
+    "region are spread across them.");
+TAG_FLAG(raft_proxy_peers_per_region, advanced);
+
+static bool ValidateProxyPeersPerRegion(const char* flagname, int32_t value) {
+  if (value < 1) {
+    LOG(ERROR) << "--" << flagname << " must be at least 1, got " << value;
+    return false;
+  }
+  return true;
+}
+DEFINE_validator(raft_proxy_peers_per_region, &ValidateProxyPeersPerRegion);
+
+DEFINE_int32(
+    raft_latency_routing_rebuild_interval_ms,
+    1000,
+    "How often the leader rebuilds its proxy routes from the measured round "
+    "trips with LATENCY_AWARE_ROUTING_POLICY.");
+TAG_FLAG(raft_latency_routing_rebuild_interval_ms, advanced);
+TAG_FLAG(raft_latency_routing_rebuild_interval_ms, runtime);
+
+DEFINE_int32(
+    raft_latency_routing_probe_interval_ms,
+    30000,
+    "How often the leader sends a request straight to a peer it proxies "
+    "with LATENCY_AWARE_ROUTING_POLICY, to keep its direct round trip "
+    "current.");
+TAG_FLAG(raft_latency_routing_probe_interval_ms, advanced);
+TAG_FLAG(raft_latency_routing_probe_interval_ms, runtime);
+
+DEFINE_double(
+    raft_latency_routing_proxy_slack,
+    0.5,
+    "With LATENCY_AWARE_ROUTING_POLICY, peers the leader doesn't need for a "
+    "commit quorum are proxied unless the path through their region's proxy "
+    "peer is slower than sending to them directly by more than this "
+    "fraction, to save WAN bytes.");
+TAG_FLAG(raft_latency_routing_proxy_slack, advanced);
+TAG_FLAG(raft_latency_routing_proxy_slack, runtime);
+
+DEFINE_double(
+    raft_latency_routing_switch_margin,
+    0.2,
+    "With LATENCY_AWARE_ROUTING_POLICY, a route only changes when the "
+    "alternative is faster by this fraction, so that routes don't flap "
+    "with the noise of the round trips.");
+TAG_FLAG(raft_latency_routing_switch_margin, advanced);
+TAG_FLAG(raft_latency_routing_switch_margin, runtime);
+
+DEFINE_int32(
+    raft_latency_routing_unmeasured_link_us,
+    1000,
+    "Round trip assumed, in microseconds, from a proxy peer to a peer of "
+    "its region until one is measured, with LATENCY_AWARE_ROUTING_POLICY.");
+TAG_FLAG(raft_latency_routing_unmeasured_link_us, advanced);
+TAG_FLAG(raft_latency_routing_unmeasured_link_us, runtime);
+
+DECLARE_bool(enable_flexi_raft);
+
 using boost::optional;
 using google::protobuf::util::MessageDifferencer;
 using kudu::pb_util::SecureShortDebugString;
@@ -49,6 +119,42 @@ using strings::Substitute;
 namespace kudu {
 namespace consensus {
 
+namespace {
+
+// Weight of each new sample in the moving averages of the round trips.
+const double kRoundTripWeight = 0.2;
+
+void UpdateMovingAverage(double* avg_us, MonoDelta sample) {
+  double sample_us = sample.ToMicroseconds();
+  if (*avg_us <= 0) {
+    *avg_us = sample_us;
+  } else {
+    *avg_us += kRoundTripWeight * (sample_us - *avg_us);
+  }
+}
+
+// The proxy peer among 'proxy_peers' that 'dest_uuid' is routed through.
+// Rendezvous hashing: removing a proxy peer only moves the peers it served,
+// and adding one only takes its share from the others.
+const string& PickProxyPeer(
+    const string& dest_uuid,
+    const vector<string>& proxy_peers) {
+  DCHECK(!proxy_peers.empty());
+  const string* best = nullptr;
+  uint64_t best_weight = 0;
+  for (const string& proxy_uuid : proxy_peers) {
+    string key = dest_uuid + "/" + proxy_uuid;
+    uint64_t weight = HashUtil::MurmurHash2_64(key.data(), key.size(), 0);
+    if (best == nullptr || weight > best_weight) {
+      best = &proxy_uuid;
+      best_weight = weight;
+    }
+  }
+  return *best;
+}
+
+} // anonymous namespace
+
 ////////////////////////////////////////////////////////////////////////////////
 // RoutingTable
 ////////////////////////////////////////////////////////////////////////////////
@@ -71,9 +177,285 @@ Status RoutingTable::Init(
   index_ = std::move(index);
   topology_root_ = std::move(forest.begin()->second);
 
+  raft_config_ = raft_config;
+  proxy_topology_ = proxy_topology;
+  leader_uuid_ = leader_uuid;
+  dest_to_proxy_from_.clear();
+  for (const auto& edge : proxy_topology.proxy_edges()) {
+    dest_to_proxy_from_.emplace(edge.peer_uuid(), edge.proxy_from_uuid());
+  }
+  has_proxy_cycle_ = HasProxyCycle();
+
   return s;
 }
 
+Status RoutingTable::UpdateRaftConfig(const RaftConfigPB& raft_config) {
+  RETURN_NOT_OK_PREPEND(VerifyRaftConfig(raft_config), "invalid raft config");
+  if (!IsRaftConfigMember(leader_uuid_, raft_config)) {
+    return Status::InvalidArgument(
+        "invalid config: cannot find leader", leader_uuid_);
+  }
+  if (has_proxy_cycle_) {
+    return Rebuild(raft_config, proxy_topology_, leader_uuid_);
+  }
+
+  unordered_set<string> members;
+  unordered_set<Node*> dirty;
+  unordered_map<Node*, unique_ptr<Node>> detached;
+  for (const RaftPeerPB& peer : raft_config.peers()) {
+    members.insert(peer.permanent_uuid());
+    Node* node = FindWithDefault(index_, peer.permanent_uuid(), nullptr);
+    if (node) {
+      if (!MessageDifferencer::Equals(node->peer_pb, peer)) {
+        node->peer_pb = peer;
+      }
+      continue;
+    }
+    unique_ptr<Node> new_node(new Node(peer));
+    new_node->routes.emplace(new_node->id(), new_node->id());
+    index_.emplace(new_node->id(), new_node.get());
+    detached.emplace(new_node.get(), std::move(new_node));
+  }
+
+  // Nodes proxied from a removed node are left without a parent.
+  vector<string> removed;
+  for (const auto& entry : index_) {
+    if (!ContainsKey(members, entry.first)) {
+      removed.push_back(entry.first);
+    }
+  }
+  for (const string& uuid : removed) {
+    Node* node = FindOrDie(index_, uuid);
+    while (!node->children.empty()) {
+      Node* child = node->children.begin()->second.get();
+      detached.emplace(child, Detach(child));
+    }
+    // A removed node may already be detached as the child of another one.
+    if (!ContainsKey(detached, node)) {
+      detached.emplace(node, Detach(node));
+    }
+    detached.erase(node);
+    index_.erase(uuid);
+  }
+
+  // Nodes proxied from an added node now have a parent.
+  for (const auto& edge : dest_to_proxy_from_) {
+    Node* node = FindWithDefault(index_, edge.first, nullptr);
+    Node* proxy_from = FindWithDefault(index_, edge.second, nullptr);
+    if (node && proxy_from && ContainsKey(detached, proxy_from)) {
+      dirty.insert(node);
+    }
+  }
+
+  raft_config_ = raft_config;
+  if (HasProxyCycle()) {
+    // Added nodes closed a loop: do what Init() does about it.
+    return Rebuild(raft_config_, proxy_topology_, leader_uuid_);
+  }
+  Relink(std::move(dirty), std::move(detached));
+  return CheckProxyFromPeers();
+}
+
+Status RoutingTable::UpdateLeader(const std::string& leader_uuid) {
+  Node* leader = FindWithDefault(index_, leader_uuid, nullptr);
+  if (!leader) {
+    return Status::InvalidArgument(
+        "invalid config: cannot find leader", leader_uuid);
+  }
+  if (has_proxy_cycle_) {
+    return Rebuild(raft_config_, proxy_topology_, leader_uuid);
+  }
+
+  // The old leader's implicit children, i.e. the nodes not otherwise
+  // proxied, now hang off the new leader.
+  Node* old_leader = FindOrDie(index_, leader_uuid_);
+  unordered_set<Node*> dirty;
+  for (const auto& child : old_leader->children) {
+    if (ProxyFrom(child.second.get()) != old_leader) {
+      dirty.insert(child.second.get());
+    }
+  }
+  leader_uuid_ = leader_uuid;
+  Relink(std::move(dirty), {});
+  return CheckProxyFromPeers();
+}
+
+Status RoutingTable::UpdateProxyTopology(
+    const ProxyTopologyPB& proxy_topology) {
+  RETURN_NOT_OK_PREPEND(
+      VerifyProxyTopology(proxy_topology), "invalid proxy topology");
+  if (has_proxy_cycle_) {
+    return Rebuild(raft_config_, proxy_topology, leader_uuid_);
+  }
+
+  unordered_map<string, string> dest_to_proxy_from;
+  for (const auto& edge : proxy_topology.proxy_edges()) {
+    dest_to_proxy_from.emplace(edge.peer_uuid(), edge.proxy_from_uuid());
+  }
+  unordered_set<Node*> dirty;
+  for (const auto& edge : dest_to_proxy_from) {
+    const string* old_proxy_from = FindOrNull(dest_to_proxy_from_, edge.first);
+    Node* node = FindWithDefault(index_, edge.first, nullptr);
+    if (node && (!old_proxy_from || *old_proxy_from != edge.second)) {
+      dirty.insert(node);
+    }
+  }
+  for (const auto& edge : dest_to_proxy_from_) {
+    Node* node = FindWithDefault(index_, edge.first, nullptr);
+    if (node && !ContainsKey(dest_to_proxy_from, edge.first)) {
+      dirty.insert(node);
+    }
+  }
+
+  unordered_map<string, string> old_dest_to_proxy_from =
+      std::move(dest_to_proxy_from_);
+  dest_to_proxy_from_ = std::move(dest_to_proxy_from);
+  if (HasProxyCycle()) {
+    dest_to_proxy_from_ = std::move(old_dest_to_proxy_from);
+    return Rebuild(raft_config_, proxy_topology, leader_uuid_);
+  }
+  proxy_topology_ = proxy_topology;
+  has_explicit_routes_ = !proxy_topology.proxy_edges().empty();
+  Relink(std::move(dirty), {});
+  return CheckProxyFromPeers();
+}
+
+Status RoutingTable::Rebuild(
+    const RaftConfigPB& raft_config,
+    const ProxyTopologyPB& proxy_topology,
+    const std::string& leader_uuid) {
+  RoutingTable routing_table;
+  Status s = routing_table.Init(raft_config, proxy_topology, leader_uuid);
+  if (PREDICT_FALSE(!s.ok() && !s.IsIncomplete())) {
+    return s;
+  }
+  *this = std::move(routing_table);
+  return s;
+}
+
+RoutingTable::Node* RoutingTable::ProxyFrom(const Node* node) const {
+  const string* proxy_from_uuid = FindOrNull(dest_to_proxy_from_, node->id());
+  if (!proxy_from_uuid) {
+    return nullptr;
+  }
+  return FindWithDefault(index_, *proxy_from_uuid, nullptr);
+}
+
+bool RoutingTable::HasProxyCycle() const {
+  // Walk up from every node, remembering the nodes whose walk is over (true)
+  // and those on the current walk (false).
+  unordered_map<const Node*, bool> walked;
+  for (const auto& entry : index_) {
+    vector<const Node*> path;
+    const Node* node = entry.second;
+    while (node && !ContainsKey(walked, node)) {
+      walked.emplace(node, false);
+      path.push_back(node);
+      node = ProxyFrom(node);
+    }
+    if (node && !walked[node]) {
+      return true;
+    }
+    for (const Node* walked_node : path) {
+      walked[walked_node] = true;
+    }
+  }
+  return false;
+}
+
+Status RoutingTable::CheckProxyFromPeers() const {
+  vector<string> proxy_from_nodes_not_found;
+  for (const auto& edge : dest_to_proxy_from_) {
+    if (ContainsKey(index_, edge.first) && !ContainsKey(index_, edge.second)) {
+      proxy_from_nodes_not_found.push_back(edge.second);
+    }
+  }
+  if (!proxy_from_nodes_not_found.empty()) {
+    return Status::Incomplete(
+        "the following proxy_from nodes specified in the proxy topology were "
+        "not found in the active Raft config and have been ignored",
+        JoinStrings(proxy_from_nodes_not_found, ", "));
+  }
+  return Status::OK();
+}
+
+unique_ptr<RoutingTable::Node> RoutingTable::Detach(Node* node) {
+  Node* parent = node->proxy_from;
+  if (!parent) {
+    DCHECK_EQ(topology_root_.get(), node);
+    return std::move(topology_root_);
+  }
+  for (Node* ancestor = parent; ancestor; ancestor = ancestor->proxy_from) {
+    for (const auto& route : node->routes) {
+      ancestor->routes.erase(route.first);
+    }
+  }
+  auto iter = parent->children.find(node->id());
+  DCHECK(iter != parent->children.end());
+  unique_ptr<Node> owned = std::move(iter->second);
+  parent->children.erase(iter);
+  owned->proxy_from = nullptr;
+  return owned;
+}
+
+void RoutingTable::Attach(unique_ptr<Node> node, Node* parent) {
+  node->proxy_from = parent;
+  string next_hop = node->id();
+  for (Node* ancestor = parent; ancestor; ancestor = ancestor->proxy_from) {
+    for (const auto& route : node->routes) {
+      ancestor->routes[route.first] = next_hop;
+    }
+    next_hop = ancestor->id();
+  }
+  string uuid = node->id();
+  parent->children.emplace(std::move(uuid), std::move(node));
+}
+
+void RoutingTable::Relink(
+    unordered_set<Node*> dirty,
+    unordered_map<Node*, unique_ptr<Node>> detached) {
+  // The tree is rooted at the top of the leader's proxy chain.
+  Node* leader = FindOrDie(index_, leader_uuid_);
+  Node* root = leader;
+  while (Node* proxy_from = ProxyFrom(root)) {
+    root = proxy_from;
+  }
+  if (root != topology_root_.get()) {
+    if (topology_root_) {
+      Node* old_root = topology_root_.get();
+      detached.emplace(old_root, std::move(topology_root_));
+    }
+    dirty.insert(root);
+  }
+
+  // Detach all the nodes that move first, so that no node is attached under
+  // one of its own descendants, which is yet to move.
+  for (Node* node : dirty) {
+    if (ContainsKey(detached, node)) {
+      continue;
+    }
+    Node* parent = nullptr;
+    if (node != root) {
+      parent = ProxyFrom(node);
+      if (!parent) {
+        parent = leader;
+      }
+    }
+    if (node->proxy_from != parent) {
+      detached.emplace(node, Detach(node));
+    }
+  }
+  for (auto& entry : detached) {
+    Node* node = entry.first;
+    if (node == root) {
+      topology_root_ = std::move(entry.second);
+      continue;
+    }
+    Node* parent = ProxyFrom(node);
+    Attach(std::move(entry.second), parent ? parent : leader);
+  }
+}
+
 Status RoutingTable::ConstructForest(
     const RaftConfigPB& raft_config,
     const ProxyTopologyPB& proxy_topology,
@@ -288,7 +670,8 @@ Status DurableRoutingTable::Create(
       std::move(tablet_id),
       std::move(proxy_topology),
       std::move(raft_config)));
-  RETURN_NOT_OK(tmp_drt->Flush()); // no lock needed as object is unpublished
+  // No lock needed as object is unpublished.
+  RETURN_NOT_OK(tmp_drt->Flush(tmp_drt->proxy_topology_));
   *drt = std::move(tmp_drt);
   return Status::OK();
 }
@@ -337,9 +720,9 @@ Status DurableRoutingTable::UpdateProxyTopology(
   lock_.WriteLock();
   auto release_write_lock = MakeScopedCleanup([&] { lock_.WriteUnlock(); });
 
-  // Rebuild the routing table.
+  // Build the routing table, unless there is one to update in place.
   RoutingTable routing_table;
-  if (leader_uuid_) {
+  if (leader_uuid_ && !routing_table_) {
     Status s = routing_table.Init(raft_config_, proxy_topology, *leader_uuid_);
     if (PREDICT_FALSE(s.IsIncomplete())) {
       // Log but continue for Incomplete, which is a warning.
@@ -347,12 +730,15 @@ Status DurableRoutingTable::UpdateProxyTopology(
     } else {
       RETURN_NOT_OK(s);
     }
+  } else if (routing_table_) {
+    RETURN_NOT_OK_PREPEND(
+        VerifyProxyTopology(proxy_topology), "invalid proxy topology");
   }
 
   // Only flush the proxy graph protobuf to disk when it changes.
   if (!MessageDifferencer::Equals(proxy_topology, proxy_topology_)) {
     VLOG_WITH_PREFIX(3) << "proxy routes updated, flushing to disk...";
-    RETURN_NOT_OK(Flush());
+    RETURN_NOT_OK(Flush(proxy_topology));
   }
 
   // Upgrade to an exclusive commit lock and make atomic changes here.
@@ -361,10 +747,21 @@ Status DurableRoutingTable::UpdateProxyTopology(
       .cancel(); // Unlocking the commit lock releases the write lock.
   auto release_commit_lock = MakeScopedCleanup([&] { lock_.CommitUnlock(); });
 
+  if (leader_uuid_ && routing_table_) {
+    // Only the routes of the peers that move are patched.
+    Status s = routing_table_->UpdateProxyTopology(proxy_topology);
+    if (PREDICT_FALSE(s.IsIncomplete())) {
+      LOG_WITH_PREFIX(WARNING) << s.ToString();
+    } else {
+      RETURN_NOT_OK(s);
+    }
+  }
   proxy_topology_ = std::move(proxy_topology);
 
   if (leader_uuid_) {
-    routing_table_ = std::move(routing_table);
+    if (!routing_table_) {
+      routing_table_ = std::move(routing_table);
+    }
     LOG_WITH_PREFIX(INFO) << "updated proxy routes:\n"
                           << routing_table_->ToString();
   } else {
@@ -381,13 +778,13 @@ Status DurableRoutingTable::UpdateRaftConfig(RaftConfigPB raft_config) {
   lock_.WriteLock();
   auto release_write_lock = MakeScopedCleanup([&] { lock_.WriteUnlock(); });
 
-  // Rebuild the routing table.
+  // Build the routing table, unless there is one to update in place.
   RoutingTable routing_table;
   bool leader_in_config = false;
   if (leader_uuid_) {
     leader_in_config = IsRaftConfigMember(*leader_uuid_, raft_config);
   }
-  if (leader_in_config) {
+  if (leader_in_config && !routing_table_) {
     Status s = routing_table.Init(raft_config, proxy_topology_, *leader_uuid_);
     if (PREDICT_FALSE(s.IsIncomplete())) {
       // Log but continue for Incomplete, which is a warning.
@@ -405,10 +802,21 @@ Status DurableRoutingTable::UpdateRaftConfig(RaftConfigPB raft_config) {
       .cancel(); // Unlocking the commit lock releases the write lock.
   auto release_commit_lock = MakeScopedCleanup([&] { lock_.CommitUnlock(); });
 
+  if (leader_in_config && routing_table_) {
+    // Only the routes of the peers added, removed or moved are patched.
+    Status s = routing_table_->UpdateRaftConfig(raft_config);
+    if (PREDICT_FALSE(s.IsIncomplete())) {
+      LOG_WITH_PREFIX(WARNING) << s.ToString();
+    } else {
+      RETURN_NOT_OK(s);
+    }
+  }
   raft_config_ = std::move(raft_config);
 
   if (leader_in_config) {
-    routing_table_ = std::move(routing_table);
+    if (!routing_table_) {
+      routing_table_ = std::move(routing_table);
+    }
     LOG_WITH_PREFIX(INFO) << "updated proxy routes:\n"
                           << routing_table_->ToString();
   } else {
@@ -425,9 +833,12 @@ void DurableRoutingTable::UpdateLeader(string leader_uuid) {
   lock_.WriteLock();
   auto release_write_lock = MakeScopedCleanup([&] { lock_.WriteUnlock(); });
 
+  // Build the routing table, unless there is one to update in place.
   RoutingTable routing_table;
   bool initialized = false;
-  if (IsRaftConfigMember(leader_uuid, raft_config_)) {
+  bool leader_in_config = IsRaftConfigMember(leader_uuid, raft_config_);
+  bool update_in_place = leader_in_config && routing_table_;
+  if (leader_in_config && !update_in_place) {
     // Rebuild the routing table. If this fails, remember the new leader anyway.
     Status s = routing_table.Init(raft_config_, proxy_topology_, leader_uuid);
     if (PREDICT_FALSE(s.IsIncomplete())) {
@@ -448,9 +859,25 @@ void DurableRoutingTable::UpdateLeader(string leader_uuid) {
       .cancel(); // Unlocking the commit lock releases the write lock.
   auto release_commit_lock = MakeScopedCleanup([&] { lock_.CommitUnlock(); });
 
+  if (update_in_place) {
+    // Only the peers that hang off the leader move.
+    Status s = routing_table_->UpdateLeader(leader_uuid);
+    if (PREDICT_FALSE(s.IsIncomplete())) {
+      LOG_WITH_PREFIX(WARNING) << s.ToString();
+      initialized = true;
+    } else if (PREDICT_FALSE(!s.ok())) {
+      LOG_WITH_PREFIX(WARNING)
+          << "unable to update proxy routing table: " << s.ToString();
+    } else {
+      initialized = true;
+    }
+  }
+
   leader_uuid_ = std::move(leader_uuid);
   if (initialized) {
-    routing_table_ = std::move(routing_table);
+    if (!update_in_place) {
+      routing_table_ = std::move(routing_table);
+    }
     LOG_WITH_PREFIX(INFO) << "updated proxy routes: \n"
                           << routing_table_->ToString();
   } else {
@@ -502,7 +929,8 @@ DurableRoutingTable::DurableRoutingTable(
   // TODO(mpercy): Do we have any validation to perform here?
 }
 
-Status DurableRoutingTable::Flush() const {
+Status DurableRoutingTable::Flush(
+    const ProxyTopologyPB& proxy_topology) const {
   // TODO(mpercy): This entire method is copy / pasted from
   // ConsensusMetadata::Flush(). Factor out?
 
@@ -525,7 +953,7 @@ Status DurableRoutingTable::Flush() const {
       pb_util::WritePBContainerToPath(
           fs_manager_->env(),
           path,
-          proxy_topology_,
+          proxy_topology,
           pb_util::OVERWRITE,
           // We use FLAGS_log_force_fsync_all here because the consensus
           // metadata is essentially an extension of the primary durability
@@ -570,24 +998,42 @@ Status SimpleRegionRoutingTable::RebuildProxyTopology(
 
   // Take a copy of current map
   std::unordered_map<std::string, std::string> current_dst_to_proxy_map;
+  std::unordered_set<std::string> unreachable_peers;
   {
     shared_lock<RWMutex> l(lock_);
     current_dst_to_proxy_map = dst_to_proxy_map_;
+    unreachable_peers = unreachable_peers_;
+  }
+  std::unordered_set<std::string> current_proxy_peers;
+  for (const auto& entry : current_dst_to_proxy_map) {
+    current_proxy_peers.insert(entry.second);
   }
 
-  // 1. Identify the 'proxy peer' for each region. The peer that is backed by a
-  // database in a region acts as a 'proxy peer' for the region. [Update when
-  // region splitting is supported]. If there are multiple such peers in a
-  // region, then pick the first peer as the 'proxy peer' for the region [this
-  // cannot happen once region splitting is supported]
+  // 1. Identify the 'proxy peers' of each region. The peers that are backed by
+  // a database in a region and that the leader can reach act as 'proxy peers'
+  // for the region, up to --raft_proxy_peers_per_region of them. Peers that
+  // already are proxy peers are kept first, then the others in config order.
   // 2. Also build a map of "peer-uuid to peer-region" for all peers
-  std::unordered_map<std::string, std::string> region_proxy_peer_map;
+  const size_t max_proxy_peers = FLAGS_raft_proxy_peers_per_region;
+  std::unordered_map<std::string, std::vector<std::string>>
+      region_proxy_peers_map;
   std::unordered_map<std::string, std::string> peer_region_map;
-  for (const RaftPeerPB& peer : raft_config.peers()) {
-    if (peer.attrs().backing_db_present()) {
-      region_proxy_peer_map.emplace(
-          peer.attrs().region(), peer.permanent_uuid());
+  for (int pass = 0; pass < 2; pass++) {
+    for (const RaftPeerPB& peer : raft_config.peers()) {
+      const std::string& uuid = peer.permanent_uuid();
+      if (!peer.attrs().backing_db_present() ||
+          ContainsKey(unreachable_peers, uuid) ||
+          ContainsKey(current_proxy_peers, uuid) != (pass == 0)) {
+        continue;
+      }
+      std::vector<std::string>* proxy_peers =
+          &region_proxy_peers_map[peer.attrs().region()];
+      if (proxy_peers->size() < max_proxy_peers) {
+        proxy_peers->push_back(uuid);
+      }
     }
+  }
+  for (const RaftPeerPB& peer : raft_config.peers()) {
     peer_region_map.emplace(peer.permanent_uuid(), peer.attrs().region());
   }
 
@@ -600,9 +1046,9 @@ Status SimpleRegionRoutingTable::RebuildProxyTopology(
   // get messages directly from the 'source'
   // 3. A peer which is in a region without any valid 'proxy peer' will recieve
   // messages directly from the 'source'
-  // 4. Also note that to avoid flapping stable proxy routes, if a peer is
-  // already being proxied and the proxy peer is part of the new config, then
-  // the  proxy host for such a peer is left unchanged
+  // 4. Peers of a region are spread across its proxy peers by consistent
+  // hashing, so that proxy routes stay stable as long as the set of proxy
+  // peers does, and only the share of a proxy peer that is lost moves
   std::unordered_map<std::string, std::string> dst_to_proxy_map;
   for (const RaftPeerPB& dest_peer : raft_config.peers()) {
     std::string dest_peer_region = dest_peer.attrs().region();
@@ -610,41 +1056,22 @@ Status SimpleRegionRoutingTable::RebuildProxyTopology(
       // Peers that have a backing database are not proxied (rule #1)
       continue;
     } else {
-      const auto& proxy_peer_uuid =
-          region_proxy_peer_map.find(dest_peer_region);
-      if (proxy_peer_uuid == region_proxy_peer_map.end() ||
+      const auto& proxy_peers = region_proxy_peers_map.find(dest_peer_region);
+      if (proxy_peers == region_proxy_peers_map.end() ||
+          proxy_peers->second.empty() ||
           dest_peer_region == local_peer_region) {
         // Region without a valid 'proxy' peer or peers that are in the same
         // region as this peer are not proxied (rule #2 and #3)
         continue;
       } else {
-        // Add a new edge into the topology
+        // 'dest_peer' will be proxied through one of the region's 'proxy
+        // peers' (rule #4)
+        const std::string& proxy_peer_uuid =
+            PickProxyPeer(dest_peer.permanent_uuid(), proxy_peers->second);
         ProxyEdgePB* proxy_edge = proxy_topology.add_proxy_edges();
         proxy_edge->set_peer_uuid(dest_peer.permanent_uuid());
-
-        // Check if this 'destination peer' is being currently proxied.
-        // If yes, check if current 'proxy peer' exists in the new config.
-        // If yes, then do not change the 'proxy peer' for this
-        // 'destination peer'.
-        const auto& current_proxy_peer =
-            current_dst_to_proxy_map.find(dest_peer.permanent_uuid());
-        if (current_proxy_peer != current_dst_to_proxy_map.end()) {
-          // Check if the proxy peer exists in the new config.
-          const auto& current_proxy_peer_region =
-              peer_region_map.find(current_proxy_peer->second);
-          if (current_proxy_peer_region != peer_region_map.end()) {
-            // Continue to route through the existing 'proxy peer'
-            proxy_edge->set_proxy_from_uuid(current_proxy_peer->second);
-            dst_to_proxy_map.emplace(
-                dest_peer.permanent_uuid(), current_proxy_peer->second);
-            continue;
-          }
-        }
-
-        // 'dest_peer' will be proxied through 'proxy_peer_uuid'
-        proxy_edge->set_proxy_from_uuid(proxy_peer_uuid->second);
-        dst_to_proxy_map.emplace(
-            dest_peer.permanent_uuid(), proxy_peer_uuid->second);
+        proxy_edge->set_proxy_from_uuid(proxy_peer_uuid);
+        dst_to_proxy_map.emplace(dest_peer.permanent_uuid(), proxy_peer_uuid);
       }
     }
   }
@@ -701,10 +1128,330 @@ void SimpleRegionRoutingTable::SetLocalPeerPB(RaftPeerPB local_peer_pb) {
   local_peer_pb_ = std::move(local_peer_pb);
 }
 
+void SimpleRegionRoutingTable::SetPeerReachable(
+    const std::string& peer_uuid,
+    bool reachable) {
+  {
+    // Called on every exchange: most don't change anything.
+    shared_lock<RWMutex> l(lock_);
+    if (ContainsKey(unreachable_peers_, peer_uuid) != reachable) {
+      return;
+    }
+  }
+  RaftConfigPB raft_config;
+  {
+    std::lock_guard<RWMutex> l(lock_);
+    bool changed = reachable ? unreachable_peers_.erase(peer_uuid) > 0
+                             : unreachable_peers_.insert(peer_uuid).second;
+    if (!changed) {
+      return;
+    }
+    raft_config = raft_config_;
+  }
+  RebuildProxyTopology(std::move(raft_config));
+}
+
 ProxyPolicy SimpleRegionRoutingTable::GetProxyPolicy() const {
   return ProxyPolicy::SIMPLE_REGION_ROUTING_POLICY;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// LatencyAwareRoutingTable
+////////////////////////////////////////////////////////////////////////////////
+Status LatencyAwareRoutingTable::Create(
+    RaftConfigPB raft_config,
+    RaftPeerPB local_peer_pb,
+    std::shared_ptr<LatencyAwareRoutingTable>* lart) {
+  auto table = std::make_shared<LatencyAwareRoutingTable>();
+  table->SetLocalPeerPB(std::move(local_peer_pb));
+  RETURN_NOT_OK(table->UpdateRaftConfig(std::move(raft_config)));
+  *lart = std::move(table);
+  return Status::OK();
+}
+
+Status LatencyAwareRoutingTable::NextHop(
+    const std::string& /* src_uuid */,
+    const std::string& dest_uuid,
+    std::string* next_hop) const {
+  shared_lock<RWMutex> l(lock_);
+  const auto& proxy_uuid = dst_to_proxy_map_.find(dest_uuid);
+  if (proxy_uuid == dst_to_proxy_map_.end() || ShouldProbe(dest_uuid)) {
+    *next_hop = dest_uuid;
+    return Status::OK();
+  }
+  *next_hop = proxy_uuid->second;
+  return Status::OK();
+}
+
+bool LatencyAwareRoutingTable::ShouldProbe(const string& dest_uuid) const {
+  MonoTime now = MonoTime::Now();
+  std::lock_guard<simple_spinlock> l(rtt_lock_);
+  MonoTime& last_probe = last_probe_[dest_uuid];
+  if (last_probe.Initialized() &&
+      now - last_probe < MonoDelta::FromMilliseconds(
+                             FLAGS_raft_latency_routing_probe_interval_ms)) {
+    return false;
+  }
+  last_probe = now;
+  return true;
+}
+
+void LatencyAwareRoutingTable::RecordRoundTrip(
+    const string& dest_uuid,
+    const string& proxy_uuid,
+    MonoDelta rtt,
+    MonoDelta downstream_rtt,
+    MonoTime now) {
+  {
+    std::lock_guard<simple_spinlock> l(rtt_lock_);
+    if (proxy_uuid.empty()) {
+      UpdateMovingAverage(&rtts_.direct[dest_uuid], rtt);
+    } else {
+      UpdateMovingAverage(&rtts_.proxied[dest_uuid], rtt);
+      UpdateMovingAverage(
+          &rtts_.proxy_links[std::make_pair(proxy_uuid, dest_uuid)],
+          downstream_rtt);
+    }
+    MonoDelta rebuild_interval = MonoDelta::FromMilliseconds(
+        FLAGS_raft_latency_routing_rebuild_interval_ms);
+    if (last_rebuild_.Initialized() && now - last_rebuild_ < rebuild_interval) {
+      return;
+    }
+    last_rebuild_ = now;
+  }
+  RebuildRoutes();
+}
+
+void LatencyAwareRoutingTable::RebuildRoutes() {
+  RaftConfigPB raft_config;
+  string leader_uuid;
+  unordered_map<string, string> current;
+  {
+    shared_lock<RWMutex> l(lock_);
+    if (leader_uuid_ && *leader_uuid_ == local_peer_pb_.permanent_uuid()) {
+      leader_uuid = *leader_uuid_;
+    }
+    raft_config = raft_config_;
+    current = dst_to_proxy_map_;
+  }
+  RoundTrips rtts;
+  {
+    std::lock_guard<simple_spinlock> l(rtt_lock_);
+    rtts = rtts_;
+  }
+
+  // Only the leader proxies.
+  unordered_map<string, string> routes;
+  if (!leader_uuid.empty()) {
+    routes = ComputeRoutes(raft_config, leader_uuid, rtts, current);
+  }
+  ProxyTopologyPB proxy_topology;
+  for (const auto& route : routes) {
+    ProxyEdgePB* proxy_edge = proxy_topology.add_proxy_edges();
+    proxy_edge->set_peer_uuid(route.first);
+    proxy_edge->set_proxy_from_uuid(route.second);
+  }
+
+  {
+    std::lock_guard<simple_spinlock> l(rtt_lock_);
+    // The path through a new proxy has yet to be measured.
+    for (const auto& route : routes) {
+      const auto& prev = current.find(route.first);
+      if (prev == current.end() || prev->second != route.second) {
+        rtts_.proxied.erase(route.first);
+      }
+    }
+  }
+  std::lock_guard<RWMutex> l(lock_);
+  if (routes != dst_to_proxy_map_) {
+    VLOG(1) << "Latency aware routes rebuilt: "
+            << SecureShortDebugString(proxy_topology);
+  }
+  proxy_topology_ = std::move(proxy_topology);
+  dst_to_proxy_map_ = std::move(routes);
+}
+
+unordered_map<string, string> LatencyAwareRoutingTable::ComputeRoutes(
+    const RaftConfigPB& raft_config,
+    const string& leader_uuid,
+    const RoundTrips& rtts,
+    const unordered_map<string, string>& current) const {
+  const double margin = FLAGS_raft_latency_routing_switch_margin;
+  const double slack = FLAGS_raft_latency_routing_proxy_slack;
+  auto direct_rtt = [&](const string& uuid) {
+    const auto& it = rtts.direct.find(uuid);
+    return it == rtts.direct.end() ? -1 : it->second;
+  };
+
+  string leader_region;
+  int num_voters = 0;
+  for (const RaftPeerPB& peer : raft_config.peers()) {
+    if (peer.permanent_uuid() == leader_uuid) {
+      leader_region = peer.attrs().region();
+    }
+    if (peer.member_type() == RaftPeerPB::VOTER) {
+      num_voters++;
+    }
+  }
+
+  // The remote peers by region, and the remote voters the leader needs for
+  // a commit quorum on top of those of its own region. With FlexiRaft the
+  // leader's region commits on its own.
+  std::map<string, vector<const RaftPeerPB*>> remote_regions;
+  vector<const RaftPeerPB*> remote_voters;
+  int needed_remote_voters = MajoritySize(num_voters) - 1;
+  for (const RaftPeerPB& peer : raft_config.peers()) {
+    if (peer.permanent_uuid() == leader_uuid) {
+      continue;
+    }
+    if (peer.attrs().region() == leader_region) {
+      if (peer.member_type() == RaftPeerPB::VOTER) {
+        needed_remote_voters--;
+      }
+      continue;
+    }
+    remote_regions[peer.attrs().region()].push_back(&peer);
+    if (peer.member_type() == RaftPeerPB::VOTER) {
+      remote_voters.push_back(&peer);
+    }
+  }
+  if (FLAGS_enable_flexi_raft) {
+    needed_remote_voters = 0;
+  }
+
+  // Keep the fastest remote voters direct, the unmeasured ones last.
+  std::sort(
+      remote_voters.begin(),
+      remote_voters.end(),
+      [&](const RaftPeerPB* a, const RaftPeerPB* b) {
+        double rtt_a = direct_rtt(a->permanent_uuid());
+        double rtt_b = direct_rtt(b->permanent_uuid());
+        if ((rtt_a < 0) != (rtt_b < 0)) {
+          return rtt_b < 0;
+        }
+        return rtt_a < rtt_b;
+      });
+  unordered_set<string> quorum;
+  for (int i = 0;
+       i < needed_remote_voters && i < static_cast<int>(remote_voters.size());
+       i++) {
+    quorum.insert(remote_voters[i]->permanent_uuid());
+  }
+
+  unordered_map<string, string> routes;
+  for (const auto& region : remote_regions) {
+    const vector<const RaftPeerPB*>& peers = region.second;
+
+    // The region's proxy peer: the fastest from the leader, unless the
+    // current one is about as fast.
+    string hub;
+    double hub_rtt = -1;
+    for (const RaftPeerPB* peer : peers) {
+      double rtt = direct_rtt(peer->permanent_uuid());
+      if (rtt >= 0 && (hub_rtt < 0 || rtt < hub_rtt)) {
+        hub = peer->permanent_uuid();
+        hub_rtt = rtt;
+      }
+    }
+    if (hub.empty()) {
+      continue;
+    }
+    string cur_hub;
+    bool cur_hub_in_region = false;
+    for (const RaftPeerPB* peer : peers) {
+      const auto& cur = current.find(peer->permanent_uuid());
+      if (cur != current.end() && cur_hub.empty()) {
+        cur_hub = cur->second;
+      }
+    }
+    for (const RaftPeerPB* peer : peers) {
+      cur_hub_in_region |= peer->permanent_uuid() == cur_hub;
+    }
+    double cur_hub_rtt = cur_hub_in_region ? direct_rtt(cur_hub) : -1;
+    if (cur_hub_rtt >= 0 && cur_hub_rtt <= hub_rtt * (1 + margin)) {
+      hub = cur_hub;
+      hub_rtt = cur_hub_rtt;
+    }
+
+    for (const RaftPeerPB* peer : peers) {
+      const string& uuid = peer->permanent_uuid();
+      if (uuid == hub || ContainsKey(quorum, uuid)) {
+        continue;
+      }
+      const auto& cur = current.find(uuid);
+      const bool proxied_via_hub =
+          cur != current.end() && cur->second == hub;
+
+      // The path through the hub: as measured if it is already in use, else
+      // estimated from its parts.
+      double via_rtt = -1;
+      const auto& measured = rtts.proxied.find(uuid);
+      if (proxied_via_hub && measured != rtts.proxied.end()) {
+        via_rtt = measured->second;
+      } else {
+        const auto& link = rtts.proxy_links.find(std::make_pair(hub, uuid));
+        via_rtt = hub_rtt +
+            (link != rtts.proxy_links.end()
+                 ? link->second
+                 : FLAGS_raft_latency_routing_unmeasured_link_us);
+      }
+
+      // Proxying saves WAN bytes, so it wins unless notably slower. Peers
+      // never measured directly are proxied until a probe measures them.
+      double rtt = direct_rtt(uuid);
+      bool proxy;
+      if (rtt < 0) {
+        proxy = true;
+      } else if (proxied_via_hub) {
+        proxy = via_rtt * (1 - margin) <= rtt * (1 + slack);
+      } else {
+        proxy = via_rtt <= rtt * (1 + slack) * (1 - margin);
+      }
+      if (proxy) {
+        routes.emplace(uuid, hub);
+      }
+    }
+  }
+  return routes;
+}
+
+Status LatencyAwareRoutingTable::UpdateProxyTopology(
+    ProxyTopologyPB /* proxy_topology */) {
+  // LatencyAwareRoutingTable builds the topology from the round trips.
+  return Status::OK();
+}
+
+ProxyTopologyPB LatencyAwareRoutingTable::GetProxyTopology() const {
+  shared_lock<RWMutex> l(lock_);
+  return proxy_topology_;
+}
+
+Status LatencyAwareRoutingTable::UpdateRaftConfig(RaftConfigPB raft_config) {
+  {
+    std::lock_guard<RWMutex> l(lock_);
+    raft_config_ = std::move(raft_config);
+  }
+  RebuildRoutes();
+  return Status::OK();
+}
+
+void LatencyAwareRoutingTable::UpdateLeader(string leader_uuid) {
+  {
+    std::lock_guard<RWMutex> l(lock_);
+    leader_uuid_ = std::move(leader_uuid);
+  }
+  RebuildRoutes();
+}
+
+void LatencyAwareRoutingTable::SetLocalPeerPB(RaftPeerPB local_peer_pb) {
+  std::lock_guard<RWMutex> l(lock_);
+  local_peer_pb_ = std::move(local_peer_pb);
+}
+
+ProxyPolicy LatencyAwareRoutingTable::GetProxyPolicy() const {
+  return ProxyPolicy::LATENCY_AWARE_ROUTING_POLICY;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // RoutingTableContainer implementation
 ////////////////////////////////////////////////////////////////////////////////
@@ -719,6 +1466,11 @@ RoutingTableContainer::RoutingTableContainer(
   std::shared_ptr<SimpleRegionRoutingTable> srt;
   SimpleRegionRoutingTable::Create(raft_config, local_peer_pb, &srt);
   srt_ = std::move(srt);
+
+  std::shared_ptr<LatencyAwareRoutingTable> lart;
+  LatencyAwareRoutingTable::Create(
+      std::move(raft_config), local_peer_pb, &lart);
+  lart_ = std::move(lart);
 }
 
 Status RoutingTableContainer::NextHop(
@@ -732,6 +1484,8 @@ Status RoutingTableContainer::NextHop(
       return drt_->NextHop(src_uuid, dest_uuid, next_hop);
     case ProxyPolicy::SIMPLE_REGION_ROUTING_POLICY:
       return srt_->NextHop(src_uuid, dest_uuid, next_hop);
+    case ProxyPolicy::LATENCY_AWARE_ROUTING_POLICY:
+      return lart_->NextHop(src_uuid, dest_uuid, next_hop);
     case ProxyPolicy::DISABLE_PROXY:
       *next_hop = dest_uuid;
       return Status::OK();
@@ -763,6 +1517,8 @@ ProxyTopologyPB RoutingTableContainer::GetProxyTopology() const {
       return drt_->GetProxyTopology();
     case ProxyPolicy::SIMPLE_REGION_ROUTING_POLICY:
       return srt_->GetProxyTopology();
+    case ProxyPolicy::LATENCY_AWARE_ROUTING_POLICY:
+      return lart_->GetProxyTopology();
     default:
       break; // placate the compiler
   }
@@ -778,6 +1534,8 @@ Status RoutingTableContainer::UpdateRaftConfig(RaftConfigPB raft_config) {
       return drt_->UpdateRaftConfig(std::move(raft_config));
     case ProxyPolicy::SIMPLE_REGION_ROUTING_POLICY:
       return srt_->UpdateRaftConfig(std::move(raft_config));
+    case ProxyPolicy::LATENCY_AWARE_ROUTING_POLICY:
+      return lart_->UpdateRaftConfig(std::move(raft_config));
     default:
       break; // placate the compiler
   }
@@ -795,6 +1553,9 @@ void RoutingTableContainer::UpdateLeader(string leader_uuid) {
     case ProxyPolicy::SIMPLE_REGION_ROUTING_POLICY:
       srt_->UpdateLeader(std::move(leader_uuid));
       break;
+    case ProxyPolicy::LATENCY_AWARE_ROUTING_POLICY:
+      lart_->UpdateLeader(std::move(leader_uuid));
+      break;
     default:
       break; // placate the compiler
   }
@@ -809,11 +1570,34 @@ void RoutingTableContainer::SetLocalPeerPB(RaftPeerPB local_peer_pb) {
     case ProxyPolicy::SIMPLE_REGION_ROUTING_POLICY:
       srt_->SetLocalPeerPB(std::move(local_peer_pb));
       break;
+    case ProxyPolicy::LATENCY_AWARE_ROUTING_POLICY:
+      lart_->SetLocalPeerPB(std::move(local_peer_pb));
+      break;
     default:
       break; // placate the compiler
   }
 }
 
+void RoutingTableContainer::SetPeerReachable(
+    const std::string& peer_uuid,
+    bool reachable) {
+  // Kept up to date whatever the policy, so that it is current when the
+  // policy changes.
+  srt_->SetPeerReachable(peer_uuid, reachable);
+}
+
+void RoutingTableContainer::RecordRoundTrip(
+    const std::string& dest_uuid,
+    const std::string& proxy_uuid,
+    MonoDelta rtt,
+    MonoDelta downstream_rtt) {
+  if (proxy_policy_.load() != ProxyPolicy::LATENCY_AWARE_ROUTING_POLICY) {
+    return;
+  }
+  lart_->RecordRoundTrip(
+      dest_uuid, proxy_uuid, rtt, downstream_rtt, MonoTime::Now());
+}
+
 ProxyPolicy RoutingTableContainer::GetProxyPolicy() const {
   return proxy_policy_.load();
 }
@@ -824,9 +1608,11 @@ Status RoutingTableContainer::SetProxyPolicy(
     RaftConfigPB raft_config) {
   drt_->UpdateLeader(leader_uuid);
   srt_->UpdateLeader(leader_uuid);
+  lart_->UpdateLeader(leader_uuid);
 
   RETURN_NOT_OK(drt_->UpdateRaftConfig(raft_config));
   RETURN_NOT_OK(srt_->UpdateRaftConfig(raft_config));
+  RETURN_NOT_OK(lart_->UpdateRaftConfig(raft_config));
 
   proxy_policy_ = proxy_policy;
 
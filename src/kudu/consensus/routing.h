@@ -17,15 +17,20 @@
 
 #pragma once
 
+#include <map>
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 
 #include <boost/optional/optional.hpp>
 
 #include "kudu/consensus/metadata.pb.h"
 #include "kudu/consensus/proxy_policy.h"
 #include "kudu/fs/fs_manager.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/rw_mutex.h"
 #include "kudu/util/rwc_lock.h"
 
@@ -117,6 +122,17 @@ class RoutingTable {
       const ProxyTopologyPB& proxy_topology,
       const std::string& leader_uuid);
 
+  // Update a successfully initialized routing table in place: only the peers
+  // whose place in the tree changes are moved, and only the routes of their
+  // old and new ancestors are patched. The result and the Status returned are
+  // the same as those of Init() with the updated arguments, which these fall
+  // back to when the proxy topology has a cycle.
+  //
+  // On error, the routing table is left unchanged.
+  Status UpdateRaftConfig(const RaftConfigPB& raft_config);
+  Status UpdateLeader(const std::string& leader_uuid);
+  Status UpdateProxyTopology(const ProxyTopologyPB& proxy_topology);
+
   // Find the UUID of the next hop, given the UUIDs of the current source
   // and the ultimate destination.
   Status NextHop(
@@ -137,7 +153,7 @@ class RoutingTable {
       return peer_pb.permanent_uuid();
     }
 
-    const RaftPeerPB peer_pb;
+    RaftPeerPB peer_pb;
     Node* proxy_from = nullptr;
 
     // children: child uuid -> child Node
@@ -184,9 +200,47 @@ class RoutingTable {
   // Recursive helper for DFS to build the debug string emitted by ToString().
   void ToStringHelperRec(Node* cur, int level, std::string* out) const;
 
+  // Replace this routing table with one built from scratch by Init().
+  Status Rebuild(
+      const RaftConfigPB& raft_config,
+      const ProxyTopologyPB& proxy_topology,
+      const std::string& leader_uuid);
+
+  // The node that the proxy topology has 'node' proxied from, or nullptr if
+  // there is none in the config.
+  Node* ProxyFrom(const Node* node) const;
+
+  // Whether the proxy_from edges between the peers in the config loop.
+  bool HasProxyCycle() const;
+
+  // Returns Status::Incomplete, as Init() does, if proxy_from peers of the
+  // proxy topology are not in the config.
+  Status CheckProxyFromPeers() const;
+
+  // Remove 'node' from its parent, and its routes from its ancestors.
+  std::unique_ptr<Node> Detach(Node* node);
+
+  // Make 'node' a child of 'parent', adding its routes to its new ancestors.
+  void Attach(std::unique_ptr<Node> node, Node* parent);
+
+  // Move the 'dirty' nodes, whose parent may have changed, and the 'detached'
+  // ones under the parents they now belong to, re-rooting the tree if the
+  // leader's proxy chain tops out at another node.
+  void Relink(
+      std::unordered_set<Node*> dirty,
+      std::unordered_map<Node*, std::unique_ptr<Node>> detached);
+
   bool has_explicit_routes_{false}; // Whether there are any topology edges.
+  bool has_proxy_cycle_{false}; // Whether Init() had to drop a loop.
   std::unique_ptr<Node> topology_root_;
   std::unordered_map<std::string, Node*> index_;
+
+  // What the table was built from, for the incremental updates.
+  RaftConfigPB raft_config_;
+  ProxyTopologyPB proxy_topology_;
+  std::string leader_uuid_;
+  // dest uuid -> proxy_from uuid, as given by 'proxy_topology_'.
+  std::unordered_map<std::string, std::string> dest_to_proxy_from_;
 };
 
 // Thread-safe and durable metadata layer on top of RoutingTable. Only keeps
@@ -262,7 +316,7 @@ class DurableRoutingTable : public IRoutingTable {
   // We flush a new ProxyTopologyPB to disk before committing the updated
   // version to memory. This method is not thread-safe and must be synchronized
   // by taking the lock or similar.
-  Status Flush() const;
+  Status Flush(const ProxyTopologyPB& proxy_topology) const;
 
   // Thread-safe log prefix helper.
   std::string LogPrefix() const;
@@ -298,6 +352,11 @@ class SimpleRegionRoutingTable : public IRoutingTable {
   void SetLocalPeerPB(RaftPeerPB local_peer_pb);
   ProxyPolicy GetProxyPolicy() const override;
 
+  // Records whether the leader can reach 'peer_uuid'. Unreachable peers are
+  // not used as proxy peers, and the peers they served are spread across the
+  // other proxy peers of their region.
+  void SetPeerReachable(const std::string& peer_uuid, bool reachable);
+
   static Status Create(
       RaftConfigPB raft_config,
       RaftPeerPB local_peer_pb,
@@ -314,6 +373,95 @@ class SimpleRegionRoutingTable : public IRoutingTable {
   boost::optional<std::string> leader_uuid_;
   std::unordered_map<std::string, std::string> peer_region_map_;
   std::unordered_map<std::string, std::string> dst_to_proxy_map_;
+  std::unordered_set<std::string> unreachable_peers_;
+};
+
+// A routing table built by the leader from measured round trips. This table
+// is instantiated when proxy policy is set to
+// ProxyPolicy::LATENCY_AWARE_ROUTING_POLICY, see proxy_policy.h for the
+// rules it follows.
+//
+// The leader feeds it the round trip of each exchange with a peer through
+// RecordRoundTrip(): either straight to the peer, or through a proxy, which
+// reports its own round trip to the peer. Routes are rebuilt from moving
+// averages of these every --raft_latency_routing_rebuild_interval_ms, and
+// proxied peers are sent a request directly every
+// --raft_latency_routing_probe_interval_ms to keep their direct round trip
+// current. Bandwidth is not estimated separately: thin links show up as
+// longer round trips for the batches sent over them.
+//
+// Only the leader proxies with this table: on other peers, and until round
+// trips were measured, all routes are direct. Thread-safe.
+class LatencyAwareRoutingTable : public IRoutingTable {
+ public:
+  ~LatencyAwareRoutingTable() override {}
+
+  Status NextHop(
+      const std::string& src_uuid,
+      const std::string& dest_uuid,
+      std::string* next_hop) const override;
+
+  Status UpdateRaftConfig(RaftConfigPB raft_config) override;
+  void UpdateLeader(std::string leader_uuid) override;
+  ProxyTopologyPB GetProxyTopology() const override;
+  Status UpdateProxyTopology(ProxyTopologyPB proxy_topology) override;
+  void SetLocalPeerPB(RaftPeerPB local_peer_pb);
+  ProxyPolicy GetProxyPolicy() const override;
+
+  // Records the round trip of an exchange of the leader with 'dest_uuid'.
+  // If it went through the proxy 'proxy_uuid', empty otherwise,
+  // 'downstream_rtt' is the round trip from the proxy to 'dest_uuid'.
+  void RecordRoundTrip(
+      const std::string& dest_uuid,
+      const std::string& proxy_uuid,
+      MonoDelta rtt,
+      MonoDelta downstream_rtt,
+      MonoTime now);
+
+  // Rebuilds the routes from the latest round trips.
+  void RebuildRoutes();
+
+  static Status Create(
+      RaftConfigPB raft_config,
+      RaftPeerPB local_peer_pb,
+      std::shared_ptr<LatencyAwareRoutingTable>* lart);
+
+ private:
+  // Moving averages of the round trips, in microseconds.
+  struct RoundTrips {
+    // From the leader straight to each peer.
+    std::unordered_map<std::string, double> direct;
+    // From the leader to each peer through its current proxy.
+    std::unordered_map<std::string, double> proxied;
+    // From a proxy to a peer, keyed by (proxy, peer).
+    std::map<std::pair<std::string, std::string>, double> proxy_links;
+  };
+
+  // Returns the proxy of each peer to proxy given the round trips
+  // 'rtts' and the current proxy of each peer 'current'.
+  std::unordered_map<std::string, std::string> ComputeRoutes(
+      const RaftConfigPB& raft_config,
+      const std::string& leader_uuid,
+      const RoundTrips& rtts,
+      const std::unordered_map<std::string, std::string>& current) const;
+
+  // Whether a request should go straight to the proxied peer 'dest_uuid' to
+  // measure its direct round trip.
+  bool ShouldProbe(const std::string& dest_uuid) const;
+
+  // Lock protecting the routes and config below.
+  mutable RWMutex lock_;
+  ProxyTopologyPB proxy_topology_;
+  RaftConfigPB raft_config_;
+  RaftPeerPB local_peer_pb_;
+  boost::optional<std::string> leader_uuid_;
+  std::unordered_map<std::string, std::string> dst_to_proxy_map_;
+
+  // Protects the round trips, the time of the last rebuild and the probes.
+  mutable simple_spinlock rtt_lock_;
+  RoundTrips rtts_;
+  MonoTime last_rebuild_;
+  mutable std::unordered_map<std::string, MonoTime> last_probe_;
 };
 
 // A container to hols all available routing tables (implemented based on
@@ -355,6 +503,18 @@ class RoutingTableContainer {
   // Updates the locak_peer on all tables that use it
   void SetLocalPeerPB(RaftPeerPB local_peer_pb);
 
+  // Records whether the leader can reach 'peer_uuid', see
+  // SimpleRegionRoutingTable::SetPeerReachable().
+  void SetPeerReachable(const std::string& peer_uuid, bool reachable);
+
+  // Records the round trip of an exchange with a peer, see
+  // LatencyAwareRoutingTable::RecordRoundTrip(). No-op for other policies.
+  void RecordRoundTrip(
+      const std::string& dest_uuid,
+      const std::string& proxy_uuid,
+      MonoDelta rtt,
+      MonoDelta downstream_rtt);
+
   // returns the current proxy_policy_
   ProxyPolicy GetProxyPolicy() const;
 
@@ -371,6 +531,7 @@ class RoutingTableContainer {
   std::atomic<ProxyPolicy> proxy_policy_;
   std::shared_ptr<SimpleRegionRoutingTable> srt_;
   std::shared_ptr<DurableRoutingTable> drt_;
+  std::shared_ptr<LatencyAwareRoutingTable> lart_;
 };
 
 // Verify that a ProxyTopologyPB is well-formed.
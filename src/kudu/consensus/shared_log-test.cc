@@ -0,0 +1,228 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#include "kudu/consensus/shared_log.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/consensus/consensus-test-util.h"
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/log.h"
+#include "kudu/consensus/opid.pb.h"
+#include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/gutil/stl_util.h"
+#include "kudu/util/async_util.h"
+#include "kudu/util/env.h"
+#include "kudu/util/path_util.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_double(shared_log_compaction_live_ratio);
+DECLARE_int32(shared_log_segment_size_mb);
+
+using kudu::consensus::CommitMsg;
+using kudu::consensus::ConsensusBootstrapInfo;
+using kudu::consensus::MakeOpId;
+using kudu::consensus::OpId;
+using kudu::consensus::ReplicateMsg;
+using kudu::consensus::ReplicateRefPtr;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace kudu {
+namespace log {
+
+class SharedLogTest : public KuduTest {
+ public:
+  void SetUp() override {
+    KuduTest::SetUp();
+    dir_ = GetTestPath("shared");
+    ASSERT_OK(SharedLogStore::Open(env_, dir_, &store_));
+  }
+
+  void TearDown() override {
+    store_.reset();
+    KuduTest::TearDown();
+  }
+
+ protected:
+  void Reopen() {
+    store_.reset();
+    ASSERT_OK(SharedLogStore::Open(env_, dir_, &store_));
+  }
+
+  // Appends ops with indexes ['first', 'last'] in 'term' to 'tablet_id', in
+  // a single record, and waits for them to be synced.
+  void AppendOps(
+      const string& tablet_id,
+      int64_t term,
+      int64_t first,
+      int64_t last,
+      int payload_size = 0) {
+    vector<ReplicateRefPtr> replicates;
+    for (int64_t index = first; index <= last; index++) {
+      ReplicateMsg* msg = new ReplicateMsg();
+      *msg->mutable_id() = MakeOpId(term, index);
+      msg->set_timestamp(index);
+      msg->set_op_type(consensus::NO_OP);
+      msg->mutable_noop_request()->set_payload_for_tests(
+          string(payload_size, 'x'));
+      replicates.push_back(make_scoped_refptr_replicate(msg));
+    }
+    Synchronizer s;
+    ASSERT_OK(store_->AsyncAppendReplicates(
+        tablet_id, replicates, s.AsStatusCallback()));
+    ASSERT_OK(s.Wait());
+  }
+
+  void AppendCommit(const string& tablet_id, int64_t term, int64_t index) {
+    CommitMsg commit;
+    commit.set_op_type(consensus::NO_OP);
+    *commit.mutable_commited_op_id() = MakeOpId(term, index);
+    Synchronizer s;
+    ASSERT_OK(
+        store_->AsyncAppendCommit(tablet_id, commit, s.AsStatusCallback()));
+    ASSERT_OK(s.Wait());
+  }
+
+  // Asserts that 'tablet_id' holds the ops ['first', 'last'] in 'term'.
+  void AssertOps(
+      const string& tablet_id,
+      int64_t term,
+      int64_t first,
+      int64_t last) {
+    vector<ReplicateMsg*> replicates;
+    ElementDeleter d(&replicates);
+    ASSERT_OK(
+        store_->ReadReplicatesInRange(tablet_id, first, last, 0, &replicates));
+    ASSERT_EQ(static_cast<size_t>(last - first + 1), replicates.size());
+    for (int64_t index = first; index <= last; index++) {
+      ASSERT_OPID_EQ(MakeOpId(term, index), replicates[index - first]->id());
+      OpId op_id;
+      ASSERT_OK(store_->LookupOpId(tablet_id, index, &op_id));
+      ASSERT_OPID_EQ(MakeOpId(term, index), op_id);
+    }
+  }
+
+  string dir_;
+  shared_ptr<SharedLogStore> store_;
+};
+
+TEST_F(SharedLogTest, TestInterleavedTabletsSurviveRestart) {
+  for (int64_t i = 0; i < 10; i++) {
+    NO_FATALS(AppendOps("a", 1, 2 * i + 1, 2 * i + 2));
+    NO_FATALS(AppendOps("b", 3, i + 1, i + 1));
+  }
+  NO_FATALS(AppendCommit("a", 1, 15));
+  NO_FATALS(Reopen());
+
+  NO_FATALS(AssertOps("a", 1, 1, 20));
+  NO_FATALS(AssertOps("b", 3, 1, 10));
+  OpId op_id;
+  ASSERT_TRUE(store_->LookupOpId("b", 11, &op_id).IsNotFound());
+  ASSERT_TRUE(store_->LookupOpId("c", 1, &op_id).IsNotFound());
+
+  ConsensusBootstrapInfo info;
+  ASSERT_OK(store_->GetRecoveryInfo("a", &info));
+  ASSERT_OPID_EQ(MakeOpId(1, 20), info.last_id);
+  ASSERT_OPID_EQ(MakeOpId(1, 15), info.last_committed_id);
+  ASSERT_EQ(5, info.orphaned_replicates.size());
+  ASSERT_OPID_EQ(MakeOpId(1, 16), info.orphaned_replicates[0]->id());
+
+  // The byte limit still lets the first op through.
+  vector<ReplicateMsg*> replicates;
+  ElementDeleter d(&replicates);
+  ASSERT_OK(store_->ReadReplicatesInRange("a", 1, 20, 1, &replicates));
+  ASSERT_EQ(1, replicates.size());
+}
+
+TEST_F(SharedLogTest, TestTruncateAndDelete) {
+  NO_FATALS(AppendOps("a", 1, 1, 10));
+  NO_FATALS(AppendOps("b", 1, 1, 10));
+  ASSERT_OK(store_->TruncateOpsAfter("a", 5));
+  NO_FATALS(AppendOps("a", 2, 6, 7));
+  NO_FATALS(AssertOps("a", 2, 6, 7));
+  OpId op_id;
+  ASSERT_TRUE(store_->LookupOpId("a", 8, &op_id).IsNotFound());
+
+  // The truncation is replayed at startup.
+  NO_FATALS(Reopen());
+  NO_FATALS(AssertOps("a", 1, 1, 5));
+  NO_FATALS(AssertOps("a", 2, 6, 7));
+  ASSERT_TRUE(store_->LookupOpId("a", 8, &op_id).IsNotFound());
+
+  ASSERT_OK(store_->DeleteTablet("b"));
+  ASSERT_TRUE(store_->LookupOpId("b", 1, &op_id).IsNotFound());
+  NO_FATALS(Reopen());
+  ASSERT_EQ(vector<string>{"a"}, store_->GetTabletIds());
+}
+
+TEST_F(SharedLogTest, TestCompactsMostlyDeadSegments) {
+  FLAGS_shared_log_segment_size_mb = 1;
+  FLAGS_shared_log_compaction_live_ratio = 0.75;
+  const int kPayloadSize = 32 * 1024;
+  for (int64_t index = 1; index <= 40; index++) {
+    NO_FATALS(AppendOps("a", 1, index, index, kPayloadSize));
+    NO_FATALS(AppendOps("b", 1, index, index, kPayloadSize));
+  }
+  ASSERT_GE(store_->num_segments_for_tests(), 3);
+  const string first_segment = JoinPathSegments(dir_, "shared-000000001");
+  ASSERT_TRUE(env_->FileExists(first_segment));
+
+  // Half of the data of every segment is dead once "b" is deleted, so the
+  // entries of "a" are relocated and the old segments go away.
+  ASSERT_OK(store_->DeleteTablet("b"));
+  ASSERT_EVENTUALLY([&] {
+    ASSERT_GE(store_->num_compactions_for_tests(), 1);
+    ASSERT_FALSE(env_->FileExists(first_segment));
+  });
+  NO_FATALS(AssertOps("a", 1, 1, 40));
+
+  NO_FATALS(Reopen());
+  NO_FATALS(AssertOps("a", 1, 1, 40));
+  ASSERT_EQ(vector<string>{"a"}, store_->GetTabletIds());
+}
+
+// Entries which are no longer retained become dead, and their segments are
+// deleted once nothing else in them is live.
+TEST_F(SharedLogTest, TestGC) {
+  FLAGS_shared_log_segment_size_mb = 1;
+  const int kPayloadSize = 64 * 1024;
+  for (int64_t index = 1; index <= 40; index++) {
+    NO_FATALS(AppendOps("a", 1, index, index, kPayloadSize));
+  }
+  ASSERT_GE(store_->num_segments_for_tests(), 3);
+
+  int num_gced;
+  ASSERT_OK(store_->GC("a", RetentionIndexes(35, 35), &num_gced));
+  ASSERT_GE(num_gced, 1);
+  ASSERT_FALSE(env_->FileExists(JoinPathSegments(dir_, "shared-000000001")));
+  NO_FATALS(AssertOps("a", 1, 35, 40));
+  OpId op_id;
+  ASSERT_TRUE(store_->LookupOpId("a", 1, &op_id).IsNotFound());
+}
+
+} // namespace log
+} // namespace kudu
@@ -0,0 +1,1105 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#include "kudu/consensus/shared_log.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <utility>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <google/protobuf/repeated_field.h>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/log_util.h"
+#include "kudu/fs/fs_manager.h"
+#include "kudu/gutil/bind.h"
+#include "kudu/gutil/map-util.h"
+#include "kudu/gutil/stl_util.h"
+#include "kudu/gutil/stringprintf.h"
+#include "kudu/gutil/strings/numbers.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/strings/util.h"
+#include "kudu/util/array_view.h"
+#include "kudu/util/async_util.h"
+#include "kudu/util/coding.h"
+#include "kudu/util/crc.h"
+#include "kudu/util/env.h"
+#include "kudu/util/env_util.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/path_util.h"
+#include "kudu/util/slice.h"
+#include "kudu/util/thread.h"
+
+DEFINE_int32(
+    shared_log_segment_size_mb,
+    64,
+    "The size of the segments of the WAL which is shared by the tablets of a "
+    "server. A segment is rolled over once it reaches this size.");
+TAG_FLAG(shared_log_segment_size_mb, advanced);
+TAG_FLAG(shared_log_segment_size_mb, experimental);
+
+DEFINE_double(
+    shared_log_compaction_live_ratio,
+    0.25,
+    "A segment of the shared WAL whose live data drops below this fraction "
+    "of its size is compacted, by rewriting its live records into the "
+    "active segment. Segments without any live data are always deleted.");
+TAG_FLAG(shared_log_compaction_live_ratio, advanced);
+TAG_FLAG(shared_log_compaction_live_ratio, experimental);
+TAG_FLAG(shared_log_compaction_live_ratio, runtime);
+
+using kudu::consensus::CommitMsg;
+using kudu::consensus::ConsensusBootstrapInfo;
+using kudu::consensus::OpId;
+using kudu::consensus::ReadContext;
+using kudu::consensus::ReplicateMsg;
+using kudu::consensus::ReplicateRefPtr;
+using std::deque;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace log {
+
+namespace {
+
+// Every segment starts with this magic.
+const char kSegmentMagic[] = "kdshrwal";
+const size_t kSegmentMagicSize = 8;
+
+// A record is framed by its length and the CRC32C of its payload.
+const size_t kRecordHeaderSize = 8;
+
+const char kSegmentPrefix[] = "shared-";
+
+string SegmentPath(const string& dir, int64_t seqno) {
+  return JoinPathSegments(
+      dir, StringPrintf("%s%09" PRId64, kSegmentPrefix, seqno));
+}
+
+bool ParseSegmentName(const string& name, int64_t* seqno) {
+  if (!HasPrefixString(name, kSegmentPrefix)) {
+    return false;
+  }
+  return safe_strto64(name.substr(strlen(kSegmentPrefix)), seqno);
+}
+
+} // anonymous namespace
+
+SharedLogStore::PendingWrite::PendingWrite() {}
+
+SharedLogStore::PendingWrite::~PendingWrite() {
+  // The replicates are owned by 'replicates', not by the record.
+  if (record && !replicates.empty()) {
+    for (LogEntryPB& entry : *record->mutable_batch()->mutable_entry()) {
+      entry.unsafe_arena_release_replicate();
+    }
+  }
+}
+
+Status SharedLogStore::Open(
+    Env* env,
+    string dir,
+    shared_ptr<SharedLogStore>* store) {
+  shared_ptr<SharedLogStore> s(new SharedLogStore(env, std::move(dir)));
+  RETURN_NOT_OK(s->Init());
+  *store = std::move(s);
+  return Status::OK();
+}
+
+SharedLogStore::SharedLogStore(Env* env, string dir)
+    : env_(env),
+      dir_(std::move(dir)),
+      queue_cond_(&queue_lock_),
+      closing_(false),
+      maybe_compact_(false),
+      num_compactions_(0) {}
+
+SharedLogStore::~SharedLogStore() {
+  Shutdown();
+}
+
+Status SharedLogStore::Init() {
+  RETURN_NOT_OK(env_util::CreateDirIfMissing(env_, dir_));
+  vector<string> children;
+  RETURN_NOT_OK(env_->GetChildren(dir_, &children));
+  vector<int64_t> seqnos;
+  for (const string& child : children) {
+    int64_t seqno;
+    if (ParseSegmentName(child, &seqno)) {
+      seqnos.push_back(seqno);
+    }
+  }
+  std::sort(seqnos.begin(), seqnos.end());
+
+  for (int64_t seqno : seqnos) {
+    auto segment = std::make_shared<Segment>();
+    segment->seqno = seqno;
+    segment->path = SegmentPath(dir_, seqno);
+    RETURN_NOT_OK(env_->NewRandomAccessFile(segment->path, &segment->file));
+    RETURN_NOT_OK_PREPEND(
+        RecoverSegment(segment),
+        Substitute("Unable to recover shared WAL segment $0", segment->path));
+  }
+  RETURN_NOT_OK(CreateActiveSegment(seqnos.empty() ? 1 : seqnos.back() + 1));
+
+  vector<shared_ptr<Segment>> dead;
+  {
+    std::lock_guard<RWMutex> l(lock_);
+    CollectDeadSegmentsUnlocked(&dead);
+    LOG(INFO) << Substitute(
+        "Opened shared WAL in $0 with $1 tablets in $2 segments",
+        dir_,
+        tablets_.size(),
+        segments_.size());
+  }
+  DeleteSegments(dead);
+  maybe_compact_ = true;
+
+  return Thread::Create(
+      "log",
+      "shared-log-append",
+      &SharedLogStore::AppendThreadMain,
+      this,
+      &append_thread_);
+}
+
+Status SharedLogStore::RecoverSegment(const shared_ptr<Segment>& segment) {
+  uint64_t file_size;
+  RETURN_NOT_OK(segment->file->Size(&file_size));
+  std::lock_guard<RWMutex> l(lock_);
+  InsertOrDie(&segments_, segment->seqno, segment);
+  if (file_size < kSegmentMagicSize) {
+    // The segment was being created when the server stopped.
+    segment->size = file_size;
+    return Status::OK();
+  }
+  uint8_t magic[kSegmentMagicSize];
+  RETURN_NOT_OK(segment->file->Read(0, Slice(magic, kSegmentMagicSize)));
+  if (memcmp(magic, kSegmentMagic, kSegmentMagicSize) != 0) {
+    return Status::Corruption("bad segment magic");
+  }
+
+  int64_t offset = kSegmentMagicSize;
+  faststring buf;
+  SharedLogRecordPB record;
+  while (true) {
+    int64_t size;
+    Status s =
+        ReadRecord(*segment->file, file_size, offset, &buf, &record, &size);
+    if (s.IsIncomplete()) {
+      break;
+    }
+    if (!s.ok()) {
+      // Records are only acknowledged once synced, so whatever follows a bad
+      // record was never acknowledged.
+      LOG(WARNING) << Substitute(
+          "Ignoring shared WAL segment $0 from offset $1: $2",
+          segment->path,
+          offset,
+          s.ToString());
+      break;
+    }
+    ApplyRecordUnlocked(
+        record, Position{segment->seqno, offset}, size, nullptr);
+    offset += size;
+  }
+  segment->size = offset;
+  return Status::OK();
+}
+
+void SharedLogStore::Shutdown() {
+  {
+    MutexLock l(queue_lock_);
+    if (closing_) {
+      return;
+    }
+    closing_ = true;
+    queue_cond_.Signal();
+  }
+  if (append_thread_) {
+    append_thread_->Join();
+  }
+  if (active_writer_) {
+    WARN_NOT_OK(active_writer_->Sync(), "Unable to sync the shared WAL");
+    WARN_NOT_OK(active_writer_->Close(), "Unable to close the shared WAL");
+    active_writer_.reset();
+  }
+}
+
+void SharedLogStore::FrameRecord(PendingWrite* pending) {
+  if (!pending->record) {
+    return;
+  }
+  const SharedLogRecordPB& record = *pending->record;
+  const uint32_t length = record.ByteSize();
+  pending->data.resize(kRecordHeaderSize + length);
+  uint8_t* header = pending->data.data();
+  uint8_t* payload = header + kRecordHeaderSize;
+  record.SerializeWithCachedSizesToArray(payload);
+  EncodeFixed32(header, length);
+  EncodeFixed32(header + 4, crc::Crc32c(payload, length));
+}
+
+Status SharedLogStore::Enqueue(unique_ptr<PendingWrite> pending) {
+  FrameRecord(pending.get());
+  MutexLock l(queue_lock_);
+  if (closing_) {
+    return Log::kLogShutdownStatus;
+  }
+  queue_.emplace_back(std::move(pending));
+  queue_cond_.Signal();
+  return Status::OK();
+}
+
+Status SharedLogStore::AppendSync(unique_ptr<SharedLogRecordPB> record) {
+  unique_ptr<PendingWrite> pending(new PendingWrite());
+  pending->record = std::move(record);
+  Synchronizer s;
+  pending->callback = s.AsStatusCallback();
+  RETURN_NOT_OK(Enqueue(std::move(pending)));
+  return s.Wait();
+}
+
+Status SharedLogStore::AsyncAppendReplicates(
+    const string& tablet_id,
+    const vector<ReplicateRefPtr>& replicates,
+    const StatusCallback& callback) {
+  unique_ptr<PendingWrite> pending(new PendingWrite());
+  pending->record.reset(new SharedLogRecordPB());
+  pending->record->set_tablet_id(tablet_id);
+  LogEntryBatchPB* batch = pending->record->mutable_batch();
+  batch->mutable_entry()->Reserve(replicates.size());
+  for (const ReplicateRefPtr& replicate : replicates) {
+    LogEntryPB* entry = batch->add_entry();
+    entry->set_type(REPLICATE);
+    entry->unsafe_arena_set_allocated_replicate(replicate->get());
+  }
+  pending->replicates = replicates;
+  pending->callback = callback;
+  return Enqueue(std::move(pending));
+}
+
+Status SharedLogStore::AsyncAppendCommit(
+    const string& tablet_id,
+    const CommitMsg& commit,
+    const StatusCallback& callback) {
+  unique_ptr<PendingWrite> pending(new PendingWrite());
+  pending->record.reset(new SharedLogRecordPB());
+  pending->record->set_tablet_id(tablet_id);
+  LogEntryPB* entry = pending->record->mutable_batch()->add_entry();
+  entry->set_type(COMMIT);
+  entry->mutable_commit()->CopyFrom(commit);
+  pending->callback = callback;
+  return Enqueue(std::move(pending));
+}
+
+Status SharedLogStore::TruncateOpsAfter(
+    const string& tablet_id,
+    int64_t index) {
+  unique_ptr<SharedLogRecordPB> record(new SharedLogRecordPB());
+  record->set_tablet_id(tablet_id);
+  record->set_truncate_after_index(index);
+  return AppendSync(std::move(record));
+}
+
+Status SharedLogStore::DeleteTablet(const string& tablet_id) {
+  unique_ptr<SharedLogRecordPB> record(new SharedLogRecordPB());
+  record->set_tablet_id(tablet_id);
+  record->set_truncate_after_index(0);
+  record->set_deleted(true);
+  return AppendSync(std::move(record));
+}
+
+Status SharedLogStore::WaitUntilAllFlushed() {
+  unique_ptr<PendingWrite> pending(new PendingWrite());
+  Synchronizer s;
+  pending->callback = s.AsStatusCallback();
+  RETURN_NOT_OK(Enqueue(std::move(pending)));
+  return s.Wait();
+}
+
+void SharedLogStore::AppendThreadMain() {
+  while (true) {
+    deque<unique_ptr<PendingWrite>> writes;
+    {
+      MutexLock l(queue_lock_);
+      while (queue_.empty() && !closing_ && !maybe_compact_) {
+        queue_cond_.Wait();
+      }
+      if (queue_.empty() && closing_) {
+        break;
+      }
+      writes.swap(queue_);
+    }
+
+    // All the writes queued since the last group are written and synced at
+    // once.
+    Status s = write_status_;
+    if (s.ok() && !writes.empty()) {
+      s = WriteGroup(writes);
+      if (!s.ok()) {
+        LOG(ERROR) << "Unable to write to the shared WAL in " << dir_ << ": "
+                   << s.ToString();
+        write_status_ = s;
+      }
+    }
+    for (const auto& write : writes) {
+      if (!write->callback.is_null()) {
+        write->callback.Run(s);
+      }
+    }
+
+    if (s.ok() && maybe_compact_.exchange(false)) {
+      WARN_NOT_OK(MaybeCompact(), "Unable to compact the shared WAL");
+    }
+  }
+}
+
+Status SharedLogStore::WriteGroup(
+    const deque<unique_ptr<PendingWrite>>& writes,
+    const Segment* relocated_from) {
+  const int64_t max_segment_size =
+      static_cast<int64_t>(FLAGS_shared_log_segment_size_mb) * 1024 * 1024;
+  vector<Position> positions;
+  positions.reserve(writes.size());
+  vector<Slice> slices;
+  for (const auto& write : writes) {
+    const int64_t size = write->data.size();
+    if (size == 0) {
+      positions.push_back(Position{0, 0});
+      continue;
+    }
+    if (active_->size > static_cast<int64_t>(kSegmentMagicSize) &&
+        active_->size + size > max_segment_size) {
+      if (!slices.empty()) {
+        RETURN_NOT_OK(active_writer_->AppendV(slices));
+        slices.clear();
+      }
+      RETURN_NOT_OK(RollOver());
+    }
+    positions.push_back(Position{active_->seqno, active_->size});
+    slices.emplace_back(write->data);
+    active_->size += size;
+  }
+  if (!slices.empty()) {
+    RETURN_NOT_OK(active_writer_->AppendV(slices));
+    RETURN_NOT_OK(active_writer_->Sync());
+  }
+
+  // The entries are only visible once durable.
+  std::lock_guard<RWMutex> l(lock_);
+  for (int i = 0; i < static_cast<int>(writes.size()); i++) {
+    const PendingWrite& write = *writes[i];
+    if (write.record) {
+      ApplyRecordUnlocked(
+          *write.record, positions[i], write.data.size(), relocated_from);
+    }
+  }
+  return Status::OK();
+}
+
+Status SharedLogStore::RollOver() {
+  RETURN_NOT_OK(active_writer_->Sync());
+  RETURN_NOT_OK(active_writer_->Close());
+  maybe_compact_ = true;
+  return CreateActiveSegment(active_->seqno + 1);
+}
+
+Status SharedLogStore::CreateActiveSegment(int64_t seqno) {
+  auto segment = std::make_shared<Segment>();
+  segment->seqno = seqno;
+  segment->path = SegmentPath(dir_, seqno);
+  unique_ptr<WritableFile> writer;
+  RETURN_NOT_OK(env_->NewWritableFile(segment->path, &writer));
+  RETURN_NOT_OK(writer->Append(Slice(kSegmentMagic, kSegmentMagicSize)));
+  RETURN_NOT_OK(writer->Sync());
+  RETURN_NOT_OK(env_->SyncDir(dir_));
+  RETURN_NOT_OK(env_->NewRandomAccessFile(segment->path, &segment->file));
+  segment->size = kSegmentMagicSize;
+  {
+    std::lock_guard<RWMutex> l(lock_);
+    InsertOrDie(&segments_, seqno, segment);
+    active_ = segment;
+  }
+  active_writer_ = std::move(writer);
+  VLOG(1) << "Rolled the shared WAL over to " << segment->path;
+  return Status::OK();
+}
+
+Status SharedLogStore::MaybeCompact() {
+  vector<shared_ptr<Segment>> dead;
+  shared_ptr<Segment> victim;
+  {
+    std::lock_guard<RWMutex> l(lock_);
+    CollectDeadSegmentsUnlocked(&dead);
+    double lowest_ratio = FLAGS_shared_log_compaction_live_ratio;
+    for (const auto& e : segments_) {
+      const Segment& segment = *e.second;
+      if (e.second == active_ ||
+          segment.size <= static_cast<int64_t>(kSegmentMagicSize)) {
+        continue;
+      }
+      int64_t live_bytes = segment.live_bytes;
+      for (const Truncation& truncation : segment.truncations) {
+        if (TruncationNeededUnlocked(truncation, segment.seqno)) {
+          live_bytes += truncation.bytes;
+        }
+      }
+      double ratio = static_cast<double>(live_bytes) / segment.size;
+      if (ratio < lowest_ratio) {
+        lowest_ratio = ratio;
+        victim = e.second;
+      }
+    }
+  }
+  DeleteSegments(dead);
+  if (!victim) {
+    return Status::OK();
+  }
+  RETURN_NOT_OK_PREPEND(
+      CompactSegment(victim),
+      Substitute("Unable to compact shared WAL segment $0", victim->path));
+  // Look for another segment to compact once the queued writes are done.
+  maybe_compact_ = true;
+  return Status::OK();
+}
+
+Status SharedLogStore::CompactSegment(const shared_ptr<Segment>& segment) {
+  // Only the append thread writes, so the live records of the segment can't
+  // change while they are being relocated, other than by being garbage
+  // collected.
+  deque<unique_ptr<PendingWrite>> relocated;
+  faststring buf;
+  int64_t offset = kSegmentMagicSize;
+  while (offset < segment->size) {
+    unique_ptr<SharedLogRecordPB> record(new SharedLogRecordPB());
+    int64_t size;
+    RETURN_NOT_OK(ReadRecord(
+        *segment->file, segment->size, offset, &buf, record.get(), &size));
+    const Position pos{segment->seqno, offset};
+    offset += size;
+
+    shared_lock<RWMutex> l(lock_);
+    if (record->has_truncate_after_index()) {
+      Truncation truncation;
+      truncation.scope = record->has_scope_segment()
+          ? Position{record->scope_segment(), record->scope_offset()}
+          : pos;
+      if (!TruncationNeededUnlocked(truncation, segment->seqno)) {
+        continue;
+      }
+      record->set_scope_segment(truncation.scope.segment);
+      record->set_scope_offset(truncation.scope.offset);
+    } else {
+      const Tablet* tablet = FindOrNull(tablets_, record->tablet_id());
+      if (!tablet || !record->has_batch()) {
+        continue;
+      }
+      google::protobuf::RepeatedPtrField<LogEntryPB> live;
+      for (LogEntryPB& entry : *record->mutable_batch()->mutable_entry()) {
+        bool is_live = false;
+        if (entry.has_replicate()) {
+          const IndexEntry* e =
+              FindOrNull(tablet->index, entry.replicate().id().index());
+          is_live = e && e->pos == pos;
+        } else if (entry.has_commit()) {
+          is_live = tablet->has_commit && tablet->commit_pos == pos;
+        }
+        if (is_live) {
+          live.Add()->Swap(&entry);
+        }
+      }
+      if (live.empty()) {
+        continue;
+      }
+      record->mutable_batch()->mutable_entry()->Swap(&live);
+    }
+    unique_ptr<PendingWrite> write(new PendingWrite());
+    write->record = std::move(record);
+    FrameRecord(write.get());
+    relocated.emplace_back(std::move(write));
+  }
+
+  RETURN_NOT_OK(WriteGroup(relocated, segment.get()));
+
+  vector<shared_ptr<Segment>> dead;
+  {
+    std::lock_guard<RWMutex> l(lock_);
+    // The truncations which are still needed were relocated.
+    segment->truncations.clear();
+    CollectDeadSegmentsUnlocked(&dead);
+    num_compactions_++;
+  }
+  VLOG(1) << Substitute(
+      "Compacted shared WAL segment $0: relocated $1 records",
+      segment->path,
+      relocated.size());
+  DeleteSegments(dead);
+  return Status::OK();
+}
+
+Status SharedLogStore::ReadRecord(
+    const RandomAccessFile& file,
+    int64_t file_size,
+    int64_t offset,
+    faststring* buf,
+    SharedLogRecordPB* record,
+    int64_t* size) {
+  if (offset + static_cast<int64_t>(kRecordHeaderSize) > file_size) {
+    return Status::Incomplete("end of segment");
+  }
+  uint8_t header[kRecordHeaderSize];
+  RETURN_NOT_OK(file.Read(offset, Slice(header, kRecordHeaderSize)));
+  const uint32_t length = DecodeFixed32(header);
+  const uint32_t crc = DecodeFixed32(header + 4);
+  const int64_t payload_offset = offset + kRecordHeaderSize;
+  if (payload_offset + length > file_size) {
+    return Status::Incomplete("partially written record");
+  }
+  buf->resize(length);
+  RETURN_NOT_OK(file.Read(payload_offset, Slice(buf->data(), length)));
+  if (crc::Crc32c(buf->data(), length) != crc) {
+    return Status::Corruption(
+        Substitute("checksum mismatch in record at offset $0", offset));
+  }
+  if (!record->ParseFromArray(buf->data(), length)) {
+    return Status::Corruption(
+        Substitute("unable to parse record at offset $0", offset));
+  }
+  *size = kRecordHeaderSize + length;
+  return Status::OK();
+}
+
+void SharedLogStore::ApplyRecordUnlocked(
+    const SharedLogRecordPB& record,
+    Position pos,
+    int64_t size,
+    const Segment* relocated_from) {
+  Segment* segment = FindOrDie(segments_, pos.segment).get();
+
+  if (record.has_truncate_after_index()) {
+    Truncation truncation;
+    truncation.tablet_id = record.tablet_id();
+    truncation.scope = record.has_scope_segment()
+        ? Position{record.scope_segment(), record.scope_offset()}
+        : pos;
+    truncation.bytes = size;
+    Tablet* tablet = FindOrNull(tablets_, record.tablet_id());
+    if (tablet) {
+      // Entries written after the truncation took the place of the ones it
+      // dropped.
+      auto iter = tablet->index.upper_bound(record.truncate_after_index());
+      while (iter != tablet->index.end()) {
+        if (iter->second.pos < truncation.scope) {
+          ReleaseBytesUnlocked(iter->second.pos.segment, iter->second.bytes);
+          iter = tablet->index.erase(iter);
+        } else {
+          ++iter;
+        }
+      }
+      if (record.deleted()) {
+        if (tablet->has_commit && tablet->commit_pos < truncation.scope) {
+          ReleaseBytesUnlocked(
+              tablet->commit_pos.segment, tablet->commit_bytes);
+          tablet->has_commit = false;
+        }
+        if (tablet->index.empty() && !tablet->has_commit) {
+          tablets_.erase(record.tablet_id());
+        }
+      }
+    }
+    segment->truncations.emplace_back(std::move(truncation));
+    maybe_compact_ = true;
+    return;
+  }
+
+  if (!record.has_batch()) {
+    return;
+  }
+  Tablet* tablet;
+  if (relocated_from) {
+    tablet = FindOrNull(tablets_, record.tablet_id());
+    if (!tablet) {
+      return;
+    }
+  } else {
+    tablet = &tablets_[record.tablet_id()];
+  }
+
+  // The record's size is split between its replicates.
+  int num_replicates = 0;
+  for (const LogEntryPB& entry : record.batch().entry()) {
+    if (entry.has_replicate()) {
+      num_replicates++;
+    }
+  }
+  const int64_t share = num_replicates > 0 ? size / num_replicates : 0;
+  int64_t remainder = size - share * num_replicates;
+
+  for (const LogEntryPB& entry : record.batch().entry()) {
+    if (entry.has_replicate()) {
+      const int64_t bytes = share + remainder;
+      remainder = 0;
+      const OpId& op_id = entry.replicate().id();
+      IndexEntry* existing = FindOrNull(tablet->index, op_id.index());
+      if (relocated_from &&
+          (!existing || existing->pos.segment != relocated_from->seqno)) {
+        continue;
+      }
+      if (existing) {
+        if (!(existing->pos < pos)) {
+          continue;
+        }
+        ReleaseBytesUnlocked(existing->pos.segment, existing->bytes);
+      }
+      IndexEntry& index_entry = tablet->index[op_id.index()];
+      index_entry.op_id = op_id;
+      index_entry.pos = pos;
+      index_entry.bytes = bytes;
+      segment->live_bytes += bytes;
+    } else if (entry.has_commit()) {
+      const OpId& op_id = entry.commit().commited_op_id();
+      if (relocated_from) {
+        if (!tablet->has_commit ||
+            tablet->commit_pos.segment != relocated_from->seqno) {
+          continue;
+        }
+      } else if (
+          tablet->has_commit &&
+          op_id.index() < tablet->last_committed.index()) {
+        continue;
+      }
+      if (tablet->has_commit) {
+        ReleaseBytesUnlocked(tablet->commit_pos.segment, tablet->commit_bytes);
+      }
+      tablet->has_commit = true;
+      tablet->last_committed = op_id;
+      tablet->commit_pos = pos;
+      tablet->commit_bytes = size;
+      segment->live_bytes += size;
+    }
+  }
+}
+
+void SharedLogStore::ReleaseBytesUnlocked(int64_t seqno, int64_t bytes) {
+  shared_ptr<Segment>* segment = FindOrNull(segments_, seqno);
+  if (segment) {
+    (*segment)->live_bytes -= bytes;
+    DCHECK_GE((*segment)->live_bytes, 0);
+  }
+}
+
+bool SharedLogStore::TruncationNeededUnlocked(
+    const Truncation& truncation,
+    int64_t excluding) const {
+  // Entries written after the truncation can't be dropped by it, so only
+  // the segments up to its scope matter.
+  for (const auto& e : segments_) {
+    if (e.first > truncation.scope.segment) {
+      break;
+    }
+    if (e.first != excluding) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SharedLogStore::SegmentDeadUnlocked(const Segment& segment) const {
+  if (segment.live_bytes > 0) {
+    return false;
+  }
+  for (const Truncation& truncation : segment.truncations) {
+    if (TruncationNeededUnlocked(truncation, segment.seqno)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void SharedLogStore::CollectDeadSegmentsUnlocked(
+    vector<shared_ptr<Segment>>* dead) {
+  // Oldest first, since deleting a segment may make the truncations of the
+  // following ones unnecessary.
+  auto iter = segments_.begin();
+  while (iter != segments_.end()) {
+    if (iter->second != active_ && SegmentDeadUnlocked(*iter->second)) {
+      dead->push_back(iter->second);
+      iter = segments_.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+}
+
+void SharedLogStore::DeleteSegments(const vector<shared_ptr<Segment>>& dead) {
+  // Readers which still hold a segment keep reading its open file.
+  for (const shared_ptr<Segment>& segment : dead) {
+    VLOG(1) << "Deleting shared WAL segment " << segment->path;
+    WARN_NOT_OK(
+        env_->DeleteFile(segment->path),
+        "Unable to delete shared WAL segment " + segment->path);
+  }
+}
+
+Status SharedLogStore::GC(
+    const string& tablet_id,
+    RetentionIndexes retention_indexes,
+    int* num_gced) {
+  const int64_t min_index = std::min(
+      retention_indexes.for_durability, retention_indexes.for_peers);
+  vector<shared_ptr<Segment>> dead;
+  {
+    std::lock_guard<RWMutex> l(lock_);
+    Tablet* tablet = FindOrNull(tablets_, tablet_id);
+    if (tablet && !tablet->index.empty()) {
+      auto last = std::prev(tablet->index.end());
+      auto iter = tablet->index.begin();
+      while (iter != last && iter->first < min_index) {
+        ReleaseBytesUnlocked(iter->second.pos.segment, iter->second.bytes);
+        iter = tablet->index.erase(iter);
+      }
+    }
+    CollectDeadSegmentsUnlocked(&dead);
+  }
+  DeleteSegments(dead);
+  *num_gced = dead.size();
+
+  MutexLock l(queue_lock_);
+  maybe_compact_ = true;
+  queue_cond_.Signal();
+  return Status::OK();
+}
+
+Status SharedLogStore::ReadReplicatesInRange(
+    const string& tablet_id,
+    int64_t starting_at,
+    int64_t up_to,
+    int64_t max_bytes_to_read,
+    vector<ReplicateMsg*>* replicates) const {
+  DCHECK_GT(starting_at, 0);
+  DCHECK_GE(up_to, starting_at);
+
+  // Find where the entries are, up to about 'max_bytes_to_read'.
+  vector<std::pair<IndexEntry, shared_ptr<Segment>>> entries;
+  {
+    shared_lock<RWMutex> l(lock_);
+    const Tablet* tablet = FindOrNull(tablets_, tablet_id);
+    int64_t bytes = 0;
+    for (int64_t index = starting_at; index <= up_to; index++) {
+      const IndexEntry* e = tablet ? FindOrNull(tablet->index, index) : nullptr;
+      if (!e) {
+        return Status::NotFound(
+            Substitute("Failed to read log index for op $0", index),
+            "entry not found");
+      }
+      entries.emplace_back(*e, FindOrDie(segments_, e->pos.segment));
+      bytes += e->bytes;
+      if (max_bytes_to_read > 0 && bytes >= max_bytes_to_read) {
+        break;
+      }
+    }
+  }
+
+  vector<ReplicateMsg*> replicates_tmp;
+  ElementDeleter d(&replicates_tmp);
+  int64_t total_size = 0;
+  faststring buf;
+  SharedLogRecordPB record;
+  for (int i = 0; i < static_cast<int>(entries.size()); i++) {
+    const IndexEntry& e = entries[i].first;
+    // Consecutive ops are usually in the same record.
+    if (i == 0 || !(e.pos == entries[i - 1].first.pos)) {
+      int64_t size;
+      RETURN_NOT_OK_PREPEND(
+          ReadRecord(
+              *entries[i].second->file,
+              std::numeric_limits<int64_t>::max(),
+              e.pos.offset,
+              &buf,
+              &record,
+              &size),
+          Substitute("Failed to read op $0", e.op_id.index()));
+    }
+    LogEntryPB* found = nullptr;
+    for (LogEntryPB& entry : *record.mutable_batch()->mutable_entry()) {
+      if (entry.has_replicate() &&
+          entry.replicate().id().index() == e.op_id.index()) {
+        found = &entry;
+        break;
+      }
+    }
+    if (!found) {
+      return Status::Corruption(Substitute(
+          "op $0 is missing from its shared WAL record", e.op_id.index()));
+    }
+    int64_t space_required = found->replicate().SpaceUsed();
+    if (replicates_tmp.empty() || max_bytes_to_read <= 0 ||
+        total_size + space_required < max_bytes_to_read) {
+      total_size += space_required;
+      replicates_tmp.push_back(found->release_replicate());
+    } else {
+      break;
+    }
+  }
+  replicates->swap(replicates_tmp);
+  return Status::OK();
+}
+
+Status SharedLogStore::LookupOpId(
+    const string& tablet_id,
+    int64_t op_index,
+    OpId* op_id) const {
+  shared_lock<RWMutex> l(lock_);
+  const Tablet* tablet = FindOrNull(tablets_, tablet_id);
+  const IndexEntry* e = tablet ? FindOrNull(tablet->index, op_index) : nullptr;
+  if (!e) {
+    return Status::NotFound(
+        Substitute("Failed to read log index for op $0", op_index),
+        "entry not found");
+  }
+  *op_id = e->op_id;
+  return Status::OK();
+}
+
+Status SharedLogStore::GetRecoveryInfo(
+    const string& tablet_id,
+    ConsensusBootstrapInfo* info) const {
+  int64_t first_orphaned;
+  int64_t last;
+  {
+    shared_lock<RWMutex> l(lock_);
+    const Tablet* tablet = FindOrNull(tablets_, tablet_id);
+    if (!tablet) {
+      return Status::OK();
+    }
+    first_orphaned = 1;
+    if (tablet->has_commit) {
+      info->last_committed_id = tablet->last_committed;
+      first_orphaned = tablet->last_committed.index() + 1;
+    }
+    if (tablet->index.empty()) {
+      return Status::OK();
+    }
+    info->last_id = tablet->index.rbegin()->second.op_id;
+    last = tablet->index.rbegin()->first;
+    first_orphaned = std::max(first_orphaned, tablet->index.begin()->first);
+  }
+  if (first_orphaned > last) {
+    return Status::OK();
+  }
+  return ReadReplicatesInRange(
+      tablet_id, first_orphaned, last, 0, &info->orphaned_replicates);
+}
+
+vector<string> SharedLogStore::GetTabletIds() const {
+  shared_lock<RWMutex> l(lock_);
+  vector<string> ids;
+  AppendKeysFromMap(tablets_, &ids);
+  return ids;
+}
+
+int SharedLogStore::num_segments_for_tests() const {
+  shared_lock<RWMutex> l(lock_);
+  return segments_.size();
+}
+
+int64_t SharedLogStore::num_compactions_for_tests() const {
+  shared_lock<RWMutex> l(lock_);
+  return num_compactions_;
+}
+
+SharedLog::SharedLog(
+    LogOptions options,
+    FsManager* fs_manager,
+    string log_path,
+    string tablet_id,
+    scoped_refptr<MetricEntity> metric_entity,
+    shared_ptr<SharedLogStore> store)
+    : Log(std::move(options),
+          fs_manager,
+          std::move(log_path),
+          std::move(tablet_id),
+          std::move(metric_entity)),
+      store_(std::move(store)) {}
+
+Status SharedLog::Init() {
+  std::lock_guard<percpu_rwlock> l(state_lock_);
+  CHECK_EQ(kLogInitialized, log_state_);
+  log_state_ = kLogWriting;
+  return Status::OK();
+}
+
+Status SharedLog::CheckWriting() const {
+  shared_lock<rw_spinlock> l(state_lock_.get_lock());
+  if (log_state_ != kLogWriting) {
+    return kLogShutdownStatus;
+  }
+  return Status::OK();
+}
+
+Status SharedLog::Append(LogEntryPB* entry) {
+  Synchronizer s;
+  if (entry->has_replicate()) {
+    vector<ReplicateRefPtr> replicates;
+    replicates.push_back(
+        make_scoped_refptr_replicate(new ReplicateMsg(entry->replicate())));
+    RETURN_NOT_OK(AsyncAppendReplicates(replicates, s.AsStatusCallback()));
+  } else if (entry->has_commit()) {
+    gscoped_ptr<CommitMsg> commit(new CommitMsg(entry->commit()));
+    RETURN_NOT_OK(AsyncAppendCommit(std::move(commit), s.AsStatusCallback()));
+  } else {
+    return Status::InvalidArgument("unexpected log entry type");
+  }
+  return s.Wait();
+}
+
+Status SharedLog::AsyncAppendReplicates(
+    const vector<ReplicateRefPtr>& replicates,
+    const StatusCallback& callback) {
+  RETURN_NOT_OK(CheckWriting());
+  return store_->AsyncAppendReplicates(tablet_id_, replicates, callback);
+}
+
+Status SharedLog::AsyncAppendCommit(
+    gscoped_ptr<CommitMsg> commit_msg,
+    const StatusCallback& callback) {
+  RETURN_NOT_OK(CheckWriting());
+  return store_->AsyncAppendCommit(tablet_id_, *commit_msg, callback);
+}
+
+Status SharedLog::Close() {
+  if (CheckWriting().ok()) {
+    RETURN_NOT_OK(store_->WaitUntilAllFlushed());
+  }
+  std::lock_guard<percpu_rwlock> l(state_lock_);
+  log_state_ = kLogClosed;
+  return Status::OK();
+}
+
+void SharedLog::GetRecoveryInfo(ConsensusBootstrapInfo* bootstrap_info) {
+  WARN_NOT_OK(
+      store_->GetRecoveryInfo(tablet_id_, bootstrap_info),
+      LogPrefix() + "Unable to recover from the shared WAL");
+}
+
+Status SharedLog::WaitUntilAllFlushed() {
+  return store_->WaitUntilAllFlushed();
+}
+
+Status SharedLog::TruncateOpsAfter(int64_t index, int64_t* index_if_truncated) {
+  if (index_if_truncated) {
+    *index_if_truncated = -1;
+  }
+  // There is no cached truncation index to apply (see
+  // RaftConsensus::TruncateCallbackWithRaftLock()).
+  if (index < 0) {
+    return Status::OK();
+  }
+  RETURN_NOT_OK(CheckWriting());
+  RETURN_NOT_OK(store_->TruncateOpsAfter(tablet_id_, index));
+  if (index_if_truncated) {
+    *index_if_truncated = index;
+  }
+  return Status::OK();
+}
+
+Status SharedLog::GC(RetentionIndexes retention_indexes, int* num_gced) {
+  CHECK_GE(retention_indexes.for_durability, 0);
+  return store_->GC(tablet_id_, retention_indexes, num_gced);
+}
+
+Status SharedLog::ReadReplicatesInRange(
+    int64_t starting_at,
+    int64_t up_to,
+    int64_t max_bytes_to_read,
+    const ReadContext& /* context */,
+    vector<ReplicateMsg*>* replicates) const {
+  return store_->ReadReplicatesInRange(
+      tablet_id_, starting_at, up_to, max_bytes_to_read, replicates);
+}
+
+Status SharedLog::LookupOpId(int64_t op_index, OpId* op_id) const {
+  return store_->LookupOpId(tablet_id_, op_index, op_id);
+}
+
+SharedLogFactory::SharedLogFactory() {}
+
+SharedLogFactory::~SharedLogFactory() {
+  Shutdown();
+}
+
+Status SharedLogFactory::GetStore(
+    FsManager* fs_manager,
+    shared_ptr<SharedLogStore>* out) {
+  std::lock_guard<Mutex> l(lock_);
+  if (!store_) {
+    RETURN_NOT_OK(SharedLogStore::Open(
+        fs_manager->env(),
+        JoinPathSegments(fs_manager->GetWalsRootDir(), "shared"),
+        &store_));
+  }
+  *out = store_;
+  return Status::OK();
+}
+
+Status SharedLogFactory::createLog(
+    LogOptions options,
+    FsManager* fs_manager,
+    string log_path,
+    string tablet_id,
+    scoped_refptr<MetricEntity> metric_entity,
+    scoped_refptr<Log>* new_log) {
+  shared_ptr<SharedLogStore> store;
+  RETURN_NOT_OK(GetStore(fs_manager, &store));
+  *new_log = new SharedLog(
+      std::move(options),
+      fs_manager,
+      std::move(log_path),
+      std::move(tablet_id),
+      std::move(metric_entity),
+      std::move(store));
+  return Status::OK();
+}
+
+Status SharedLogFactory::DeleteOnDiskData(
+    FsManager* fs_manager,
+    const string& tablet_id) {
+  shared_ptr<SharedLogStore> store;
+  RETURN_NOT_OK(GetStore(fs_manager, &store));
+  return store->DeleteTablet(tablet_id);
+}
+
+void SharedLogFactory::Shutdown() {
+  std::lock_guard<Mutex> l(lock_);
+  if (store_) {
+    store_->Shutdown();
+  }
+}
+
+} // namespace log
+} // namespace kudu
@@ -0,0 +1,395 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "kudu/consensus/log.h"
+#include "kudu/consensus/log.pb.h"
+#include "kudu/consensus/opid.pb.h"
+#include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/condition_variable.h"
+#include "kudu/util/faststring.h"
+#include "kudu/util/mutex.h"
+#include "kudu/util/rw_mutex.h"
+#include "kudu/util/status.h"
+#include "kudu/util/status_callback.h"
+
+namespace kudu {
+
+class Env;
+class FsManager;
+class MetricEntity;
+class RandomAccessFile;
+class Thread;
+class WritableFile;
+
+namespace consensus {
+class CommitMsg;
+struct ConsensusBootstrapInfo;
+class ReplicateMsg;
+} // namespace consensus
+
+namespace log {
+
+// A write-ahead log shared by all the tablets of a server.
+//
+// Rather than each tablet writing to its own segments, the entries of all the
+// tablets are interleaved into a common sequence of segments. A single thread
+// appends whatever was queued by all the tablets as one group, with a single
+// fsync, so that the number of syncs does not grow with the number of
+// tablets.
+//
+// Each record of a segment belongs to a single tablet. The store keeps an
+// in-memory index of each tablet, from the op index to the position of the
+// record which holds it, which is rebuilt from the segments when the store is
+// opened. An entry is live until it is truncated, garbage collected, or its
+// tablet is deleted. A segment without live data is deleted; a segment whose
+// live data dropped below --shared_log_compaction_live_ratio of its size is
+// compacted, by appending its live records to the active segment.
+//
+// This class is thread-safe.
+class SharedLogStore {
+ public:
+  // Opens the store in 'dir', creating the directory if it doesn't exist, and
+  // recovers the tablets' entries from the segments found there.
+  static Status Open(
+      Env* env,
+      std::string dir,
+      std::shared_ptr<SharedLogStore>* store);
+
+  ~SharedLogStore();
+
+  // Waits for the queued writes to complete and stops the append thread.
+  // Writes queued afterwards fail.
+  void Shutdown();
+
+  // Appends 'replicates' of the tablet 'tablet_id', asynchronously. The
+  // replicates must have increasing indexes.
+  Status AsyncAppendReplicates(
+      const std::string& tablet_id,
+      const std::vector<consensus::ReplicateRefPtr>& replicates,
+      const StatusCallback& callback);
+
+  // Appends the commit message 'commit' of the tablet 'tablet_id',
+  // asynchronously.
+  Status AsyncAppendCommit(
+      const std::string& tablet_id,
+      const consensus::CommitMsg& commit,
+      const StatusCallback& callback);
+
+  // Durably drops the entries of the tablet after 'index'.
+  Status TruncateOpsAfter(const std::string& tablet_id, int64_t index);
+
+  // Durably drops all the entries of the tablet.
+  Status DeleteTablet(const std::string& tablet_id);
+
+  // Blocks until all the writes queued so far are synced.
+  Status WaitUntilAllFlushed();
+
+  // Drops the entries of the tablet which 'retention_indexes' no longer
+  // requires, and deletes the segments left without live data. Sets
+  // 'num_gced' to the number of deleted segments. The last entry of the
+  // tablet is always retained.
+  Status GC(
+      const std::string& tablet_id,
+      RetentionIndexes retention_indexes,
+      int* num_gced);
+
+  // See Log::ReadReplicatesInRange().
+  Status ReadReplicatesInRange(
+      const std::string& tablet_id,
+      int64_t starting_at,
+      int64_t up_to,
+      int64_t max_bytes_to_read,
+      std::vector<consensus::ReplicateMsg*>* replicates) const;
+
+  // See Log::LookupOpId().
+  Status LookupOpId(
+      const std::string& tablet_id,
+      int64_t op_index,
+      consensus::OpId* op_id) const;
+
+  // Fills in 'info' with the last entry and the last commit of the tablet,
+  // and with the replicates after the last commit.
+  Status GetRecoveryInfo(
+      const std::string& tablet_id,
+      consensus::ConsensusBootstrapInfo* info) const;
+
+  // Returns the ids of the tablets which have entries in the store.
+  std::vector<std::string> GetTabletIds() const;
+
+  int num_segments_for_tests() const;
+  int64_t num_compactions_for_tests() const;
+
+ private:
+  // A position in the store: a segment sequence number and an offset in it.
+  struct Position {
+    int64_t segment;
+    int64_t offset;
+
+    bool operator<(const Position& other) const {
+      return segment < other.segment ||
+          (segment == other.segment && offset < other.offset);
+    }
+    bool operator==(const Position& other) const {
+      return segment == other.segment && offset == other.offset;
+    }
+  };
+
+  // The location of an op of a tablet. 'bytes' is the share of the record's
+  // size which the op accounts for.
+  struct IndexEntry {
+    consensus::OpId op_id;
+    Position pos;
+    int64_t bytes = 0;
+  };
+
+  // A truncation or deletion record, which has to be kept as long as the
+  // entries it drops may still be read back from an older segment.
+  struct Truncation {
+    std::string tablet_id;
+    Position scope;
+    int64_t bytes = 0;
+  };
+
+  struct Segment {
+    int64_t seqno = 0;
+    std::string path;
+    // The size of the valid records, including the segment's header.
+    int64_t size = 0;
+    // The bytes of the records that still hold live entries.
+    int64_t live_bytes = 0;
+    std::vector<Truncation> truncations;
+    std::unique_ptr<RandomAccessFile> file;
+  };
+
+  struct Tablet {
+    std::map<int64_t, IndexEntry> index;
+    bool has_commit = false;
+    consensus::OpId last_committed;
+    Position commit_pos;
+    int64_t commit_bytes = 0;
+  };
+
+  // A record waiting to be written by the append thread, or a flush marker
+  // if 'data' is empty.
+  struct PendingWrite {
+    PendingWrite();
+    ~PendingWrite();
+
+    std::unique_ptr<SharedLogRecordPB> record;
+    // Keeps alive the messages the record's batch points to.
+    std::vector<consensus::ReplicateRefPtr> replicates;
+    // The framed record.
+    faststring data;
+    StatusCallback callback;
+  };
+
+  SharedLogStore(Env* env, std::string dir);
+
+  // Reads the existing segments and opens a new active segment.
+  Status Init();
+
+  // Reads all the records of 'segment' and applies them.
+  Status RecoverSegment(const std::shared_ptr<Segment>& segment);
+
+  // Serializes 'pending->record', if any, into 'pending->data'.
+  static void FrameRecord(PendingWrite* pending);
+
+  // Frames 'pending->record' and queues it for the append thread.
+  Status Enqueue(std::unique_ptr<PendingWrite> pending);
+
+  // Queues 'record' and waits for it to be synced.
+  Status AppendSync(std::unique_ptr<SharedLogRecordPB> record);
+
+  void AppendThreadMain();
+
+  // Writes 'writes' to the active segment, rolling over as needed, syncs
+  // them and applies them to the index. See ApplyRecordUnlocked() for
+  // 'relocated_from'.
+  Status WriteGroup(
+      const std::deque<std::unique_ptr<PendingWrite>>& writes,
+      const Segment* relocated_from = nullptr);
+
+  // Closes the active segment and opens the next one.
+  Status RollOver();
+
+  // Creates the segment 'seqno' and makes it the active segment.
+  Status CreateActiveSegment(int64_t seqno);
+
+  // Relocates the live records of the most dead of the segments qualifying
+  // for compaction, if any. Called by the append thread.
+  Status MaybeCompact();
+  Status CompactSegment(const std::shared_ptr<Segment>& segment);
+
+  // Reads the record at 'offset' in 'segment' into 'record', setting 'size'
+  // to the size of the framed record. Returns Incomplete at the end of the
+  // segment's data.
+  static Status ReadRecord(
+      const RandomAccessFile& file,
+      int64_t file_size,
+      int64_t offset,
+      faststring* buf,
+      SharedLogRecordPB* record,
+      int64_t* size);
+
+  // Updates the index according to 'record', which was written at 'pos'
+  // with the framed size 'size'. If 'relocated_from' is set, the record
+  // holds entries relocated from that segment, which are only taken if they
+  // are still live there.
+  void ApplyRecordUnlocked(
+      const SharedLogRecordPB& record,
+      Position pos,
+      int64_t size,
+      const Segment* relocated_from);
+
+  // Subtracts 'bytes' from the live bytes of the segment 'seqno'.
+  void ReleaseBytesUnlocked(int64_t seqno, int64_t bytes);
+
+  // Returns true if 'truncation' may still drop entries of a segment other
+  // than 'excluding'.
+  bool TruncationNeededUnlocked(
+      const Truncation& truncation,
+      int64_t excluding) const;
+
+  // Returns true if the segment may be deleted.
+  bool SegmentDeadUnlocked(const Segment& segment) const;
+
+  // Removes the dead segments from 'segments_' and moves them to 'dead'.
+  void CollectDeadSegmentsUnlocked(
+      std::vector<std::shared_ptr<Segment>>* dead);
+
+  // Deletes the files of 'dead'.
+  void DeleteSegments(const std::vector<std::shared_ptr<Segment>>& dead);
+
+  Env* const env_;
+  const std::string dir_;
+
+  // Protects 'queue_' and 'closing_'.
+  mutable Mutex queue_lock_;
+  ConditionVariable queue_cond_;
+  std::deque<std::unique_ptr<PendingWrite>> queue_;
+  bool closing_;
+
+  scoped_refptr<Thread> append_thread_;
+
+  // Only accessed by the append thread, once the store is initialized.
+  std::unique_ptr<WritableFile> active_writer_;
+  std::shared_ptr<Segment> active_;
+  // Set once a write fails; all the later writes fail with it.
+  Status write_status_;
+  // Set when segments may have become eligible for compaction.
+  std::atomic<bool> maybe_compact_;
+
+  // Protects the index of the tablets and the segments.
+  mutable RWMutex lock_;
+  std::unordered_map<std::string, Tablet> tablets_;
+  std::map<int64_t, std::shared_ptr<Segment>> segments_;
+  int64_t num_compactions_;
+
+  DISALLOW_COPY_AND_ASSIGN(SharedLogStore);
+};
+
+// A Log whose entries are kept in a SharedLogStore. It has no LogReader: the
+// tablet's entries are only read back by index.
+class SharedLog : public Log {
+ public:
+  Status Init() override;
+  Status Append(LogEntryPB* entry) override;
+  Status AsyncAppendReplicates(
+      const std::vector<consensus::ReplicateRefPtr>& replicates,
+      const StatusCallback& callback) override;
+  Status AsyncAppendCommit(
+      gscoped_ptr<consensus::CommitMsg> commit_msg,
+      const StatusCallback& callback) override;
+  Status Close() override;
+  void GetRecoveryInfo(
+      consensus::ConsensusBootstrapInfo* bootstrap_info) override;
+  Status WaitUntilAllFlushed() override;
+  Status TruncateOpsAfter(int64_t index, int64_t* index_if_truncated)
+      override;
+  Status GC(RetentionIndexes retention_indexes, int* num_gced) override;
+  Status ReadReplicatesInRange(
+      int64_t starting_at,
+      int64_t up_to,
+      int64_t max_bytes_to_read,
+      const consensus::ReadContext& context,
+      std::vector<consensus::ReplicateMsg*>* replicates) const override;
+  Status LookupOpId(int64_t op_index, consensus::OpId* op_id) const override;
+
+ private:
+  friend class SharedLogFactory;
+
+  SharedLog(
+      LogOptions options,
+      FsManager* fs_manager,
+      std::string log_path,
+      std::string tablet_id,
+      scoped_refptr<MetricEntity> metric_entity,
+      std::shared_ptr<SharedLogStore> store);
+
+  // Returns a bad status unless the log was initialized and is not closed.
+  Status CheckWriting() const;
+
+  const std::shared_ptr<SharedLogStore> store_;
+
+  DISALLOW_COPY_AND_ASSIGN(SharedLog);
+};
+
+// Creates SharedLogs backed by a single SharedLogStore, which is opened in
+// the 'shared' subdirectory of the WAL root on first use.
+class SharedLogFactory : public LogFactory {
+ public:
+  SharedLogFactory();
+  ~SharedLogFactory() override;
+
+  Status createLog(
+      LogOptions options,
+      FsManager* fs_manager,
+      std::string log_path,
+      std::string tablet_id,
+      scoped_refptr<MetricEntity> metric_entity,
+      scoped_refptr<Log>* new_log) override;
+
+  // Drops all the entries of the tablet from the store. The tablet's log must
+  // be closed.
+  Status DeleteOnDiskData(FsManager* fs_manager, const std::string& tablet_id);
+
+  // Shuts the store down. The logs created by the factory must be closed.
+  void Shutdown();
+
+ private:
+  Status GetStore(FsManager* fs_manager, std::shared_ptr<SharedLogStore>* out);
+
+  Mutex lock_;
+  std::shared_ptr<SharedLogStore> store_;
+
+  DISALLOW_COPY_AND_ASSIGN(SharedLogFactory);
+};
+
+} // namespace log
+} // namespace kudu
@@ -0,0 +1,81 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "kudu/util/slice.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+namespace consensus {
+class SnapshotInfoPB;
+
+// Snapshots of the state machine, registered with
+// RaftConsensus::SetSnapshotProvider(). A snapshot holds the effects of all
+// the ops up to its 'last_included' op, so the log below it is not needed to
+// catch up peers: the leader sends the snapshot, in chunks, to a peer whose
+// next op is no longer in its log, the peer installs it and goes on from the
+// op after it. The log prefix below the latest snapshot is garbage collected
+// regardless of the peers.
+//
+// The snapshot bytes are opaque to consensus. The provider is called from
+// the Raft threads, so its methods should not block for long, and must be
+// thread-safe.
+class SnapshotProvider {
+ public:
+  virtual ~SnapshotProvider() {}
+
+  // The leader side.
+
+  // Fills in 'snapshot' with the latest snapshot, which must hold only
+  // committed ops. Returns NotFound if there is none.
+  virtual Status GetLatestSnapshot(SnapshotInfoPB* snapshot) = 0;
+
+  // Reads up to 'max_bytes' of the snapshot 'id' at 'offset' into 'data'.
+  // Returns NotFound if the snapshot is gone, e.g. replaced by a newer one.
+  virtual Status ReadSnapshotChunk(
+      const std::string& id,
+      int64_t offset,
+      int64_t max_bytes,
+      std::string* data) = 0;
+
+  // The peer side.
+
+  // Starts, or resumes, installing 'snapshot', and sets 'next_offset' to the
+  // size of what was already written of it, from which the leader goes on.
+  // An install of another snapshot left unfinished can be discarded.
+  virtual Status BeginSnapshotInstall(
+      const SnapshotInfoPB& snapshot,
+      int64_t* next_offset) = 0;
+
+  // Writes 'data' at 'offset' of the snapshot 'id' being installed. The
+  // chunks come in order, without gaps.
+  virtual Status WriteSnapshotChunk(
+      const std::string& id,
+      int64_t offset,
+      const Slice& data) = 0;
+
+  // Loads the fully written 'snapshot' into the state machine. Once this
+  // returns OK the replica goes on from the op after its 'last_included'.
+  virtual Status FinishSnapshotInstall(const SnapshotInfoPB& snapshot) = 0;
+};
+
+} // namespace consensus
+} // namespace kudu
@@ -26,11 +26,14 @@
 #include "kudu/clock/hybrid_clock.h"
 #include "kudu/common/timestamp.h"
 #include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/ref_counted_replicate.h"
 #include "kudu/consensus/time_manager.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/countdown_latch.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/status.h"
+#include "kudu/util/stopwatch.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
 
@@ -38,6 +41,8 @@ namespace kudu {
 namespace consensus {
 
 using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
 
 class TimeManagerTest : public KuduTest {
  public:
@@ -213,5 +218,112 @@ TEST_F(TimeManagerTest, TestTimeManagerLeaderMode) {
   after_latch->Wait();
 }
 
+// Tests that advancing safe time wakes exactly the waiters it makes safe, and
+// that a batch of messages from the leader moves the clock past all of them.
+TEST_F(TimeManagerTest, TestWaitersWokenInTimestampOrder) {
+  Timestamp init = clock_->Now();
+  InitTimeManager(init);
+  Timestamp t1 = clock_->Now();
+  Timestamp t2 = clock_->Now();
+  Timestamp t3 = clock_->Now();
+  // Registered out of order.
+  CountDownLatch* latch3 = WaitForSafeTimeAsync(t3);
+  CountDownLatch* latch1 = WaitForSafeTimeAsync(t1);
+  CountDownLatch* latch2 = WaitForSafeTimeAsync(t2);
+
+  time_manager_->AdvanceSafeTime(t2);
+  latch1->Wait();
+  latch2->Wait();
+  ASSERT_EQ(latch3->count(), 1);
+  ASSERT_EQ(time_manager_->GetSafeTime(), t2);
+
+  time_manager_->AdvanceSafeTime(t3);
+  latch3->Wait();
+  ASSERT_EQ(time_manager_->GetSafeTime(), t3);
+
+  // The clock is updated with the highest timestamp of the batch, whatever
+  // its position, and the last one is the last serial timestamp.
+  Timestamp ahead(clock_->Now().value() + 1000);
+  vector<ReplicateRefPtr> batch;
+  for (Timestamp ts : {ahead, t1, t2}) {
+    ReplicateMsg* msg = new ReplicateMsg;
+    msg->set_timestamp(ts.value());
+    batch.push_back(make_scoped_refptr_replicate(msg));
+  }
+  ASSERT_OK(time_manager_->MessagesReceivedFromLeader(batch));
+  ASSERT_GT(clock_->Now(), ahead);
+  ASSERT_EQ(time_manager_->last_serial_ts_assigned_, t2);
+  ASSERT_OK(time_manager_->MessagesReceivedFromLeader({}));
+}
+
+// Tests that a batch of messages gets increasing timestamps, all of which
+// stay below the ones assigned afterwards.
+TEST_F(TimeManagerTest, TestAssignTimestampsInBatch) {
+  InitTimeManager(clock_->Now());
+  const int kBatchSize = 16;
+  vector<ReplicateMsg> messages(kBatchSize);
+  vector<ReplicateMsg*> batch;
+  for (auto& message : messages) {
+    batch.push_back(&message);
+  }
+
+  // Not possible in non-leader mode, and then nothing gets a timestamp.
+  ASSERT_TRUE(time_manager_->AssignTimestamps(batch).IsIllegalState());
+  for (const auto& message : messages) {
+    ASSERT_FALSE(message.has_timestamp());
+  }
+
+  time_manager_->SetLeaderMode();
+  ReplicateMsg before;
+  ASSERT_OK(time_manager_->AssignTimestamp(&before));
+  ASSERT_OK(time_manager_->AssignTimestamps(batch));
+  Timestamp last(before.timestamp());
+  for (const auto& message : messages) {
+    ASSERT_TRUE(message.has_timestamp());
+    ASSERT_GT(Timestamp(message.timestamp()), last);
+    last = Timestamp(message.timestamp());
+  }
+  ASSERT_EQ(time_manager_->last_serial_ts_assigned_, last);
+  ReplicateMsg after;
+  ASSERT_OK(time_manager_->AssignTimestamp(&after));
+  ASSERT_GT(Timestamp(after.timestamp()), last);
+  ASSERT_GT(clock_->Now(), last);
+
+  // Safe time is pinned until the last assigned message is appended.
+  Timestamp safe_before = time_manager_->GetSafeTime();
+  time_manager_->AdvanceSafeTimeWithMessage(after);
+  ASSERT_GT(time_manager_->GetSafeTime(), safe_before);
+}
+
+// Compares assigning timestamps one message at a time with doing it in
+// batches, as the leader's Replicate() path would.
+TEST_F(TimeManagerTest, BenchmarkAssignTimestamps) {
+  InitTimeManager(clock_->Now());
+  time_manager_->SetLeaderMode();
+  const int kNumMessages = AllowSlowTests() ? 1000000 : 100000;
+  const int kBatchSize = 64;
+  vector<ReplicateMsg> messages(kBatchSize);
+  vector<ReplicateMsg*> batch;
+  for (auto& message : messages) {
+    batch.push_back(&message);
+  }
+
+  LOG_TIMING(INFO, Substitute("assigning $0 timestamps singly", kNumMessages)) {
+    for (int i = 0; i < kNumMessages; i++) {
+      CHECK_OK(time_manager_->AssignTimestamp(&messages[i % kBatchSize]));
+    }
+  }
+  LOG_TIMING(
+      INFO,
+      Substitute(
+          "assigning $0 timestamps in batches of $1",
+          kNumMessages,
+          kBatchSize)) {
+    for (int i = 0; i < kNumMessages; i += kBatchSize) {
+      CHECK_OK(time_manager_->AssignTimestamps(batch));
+    }
+  }
+}
+
 } // namespace consensus
 } // namespace kudu
@@ -25,6 +25,7 @@
 #include <cstdint>
 #include <mutex>
 #include <ostream>
+#include <vector>
 
 #include <gflags/gflags.h>
 #include <gflags/gflags_declare.h>
@@ -66,6 +67,7 @@ DECLARE_int32(scanner_max_wait_ms);
 
 using kudu::clock::Clock;
 using std::string;
+using std::vector;
 using strings::Substitute;
 
 namespace kudu {
@@ -94,26 +96,45 @@ TimeManager::TimeManager(
       last_safe_ts_(initial_safe_time),
       last_advanced_safe_time_(MonoTime::Now()),
       mode_(NON_LEADER),
+      published_safe_ts_(initial_safe_time.value()),
+      published_is_leader_(false),
       clock_(std::move(clock)) {}
 
 void TimeManager::SetLeaderMode() {
   Lock l(lock_);
-  mode_ = LEADER;
+  SetModeUnlocked(LEADER);
   AdvanceSafeTimeAndWakeUpWaitersUnlocked(clock_->Now());
 }
 
 void TimeManager::SetNonLeaderMode() {
   Lock l(lock_);
-  mode_ = NON_LEADER;
+  SetModeUnlocked(NON_LEADER);
+}
+
+void TimeManager::SetModeUnlocked(Mode mode) {
+  DCHECK(lock_.is_locked());
+  mode_ = mode;
+  published_is_leader_.store(mode == LEADER, std::memory_order_release);
+}
+
+void TimeManager::SetLastSafeTimeUnlocked(Timestamp safe_time) {
+  DCHECK(lock_.is_locked());
+  last_safe_ts_ = safe_time;
+  published_safe_ts_.store(safe_time.value(), std::memory_order_release);
+}
+
+Status TimeManager::NotLeaderErrorUnlocked() const {
+  DCHECK(lock_.is_locked());
+  return Status::IllegalState(Substitute(
+      "Cannot assign timestamp to transaction. Tablet is not "
+      "in leader mode. Last heard from a leader: $0 secs ago.",
+      last_advanced_safe_time_.ToString()));
 }
 
 Status TimeManager::AssignTimestamp(ReplicateMsg* message) {
   Lock l(lock_);
   if (PREDICT_FALSE(mode_ == NON_LEADER)) {
-    return Status::IllegalState(Substitute(
-        "Cannot assign timestamp to transaction. Tablet is not "
-        "in leader mode. Last heard from a leader: $0 secs ago.",
-        last_advanced_safe_time_.ToString()));
+    return NotLeaderErrorUnlocked();
   }
   Timestamp t;
   switch (GetMessageConsistencyMode(*message)) {
@@ -130,6 +151,45 @@ Status TimeManager::AssignTimestamp(ReplicateMsg* message) {
   return Status::OK();
 }
 
+Status TimeManager::AssignTimestamps(const vector<ReplicateMsg*>& messages) {
+  if (messages.empty()) {
+    return Status::OK();
+  }
+  Lock l(lock_);
+  if (PREDICT_FALSE(mode_ == NON_LEADER)) {
+    return NotLeaderErrorUnlocked();
+  }
+  int num_serial = 0;
+  for (const ReplicateMsg* message : messages) {
+    switch (GetMessageConsistencyMode(*message)) {
+      case COMMIT_WAIT:
+        break;
+      case CLIENT_PROPAGATED:
+        num_serial++;
+        break;
+      default:
+        return Status::NotSupported("Unsupported external consistency mode.");
+    }
+  }
+
+  // All the serial timestamps come from a single reading of the clock, rather
+  // than one reading per message.
+  Timestamp next;
+  if (PREDICT_TRUE(num_serial > 0)) {
+    next = clock_->NowRange(num_serial);
+  }
+  for (ReplicateMsg* message : messages) {
+    if (GetMessageConsistencyMode(*message) == COMMIT_WAIT) {
+      message->set_timestamp(GetSerialTimestampPlusMaxError().value());
+      continue;
+    }
+    last_serial_ts_assigned_ = next;
+    message->set_timestamp(next.value());
+    next = Timestamp(next.value() + 1);
+  }
+  return Status::OK();
+}
+
 Status TimeManager::MessageReceivedFromLeader(const ReplicateMsg& message) {
   // NOTE: Currently this method just updates the clock and stores the message's
   // timestamp.
@@ -166,6 +226,36 @@ Status TimeManager::MessageReceivedFromLeader(const ReplicateMsg& message) {
   return Status::OK();
 }
 
+Status TimeManager::MessagesReceivedFromLeader(
+    const vector<ReplicateRefPtr>& messages) {
+  if (messages.empty()) {
+    return Status::OK();
+  }
+  // See MessageReceivedFromLeader(). Since the clock never moves back,
+  // updating it with the highest timestamp of the batch is the same as
+  // updating it with each of them in turn.
+  Timestamp max_ts = Timestamp::kMin;
+  const ReplicateMsg* last_serial = nullptr;
+  for (const ReplicateRefPtr& msg : messages) {
+    const ReplicateMsg& message = *msg->get();
+    DCHECK(message.has_timestamp());
+    max_ts = std::max(max_ts, Timestamp(message.timestamp()));
+    if (GetMessageConsistencyMode(message) == CLIENT_PROPAGATED) {
+      last_serial = &message;
+    }
+  }
+  RETURN_NOT_OK(clock_->Update(max_ts));
+  {
+    Lock l(lock_);
+    CHECK_EQ(mode_, NON_LEADER)
+        << "Cannot receive messages from a leader in leader mode.";
+    if (last_serial != nullptr) {
+      last_serial_ts_assigned_ = Timestamp(last_serial->timestamp());
+    }
+  }
+  return Status::OK();
+}
+
 void TimeManager::AdvanceSafeTimeWithMessage(const ReplicateMsg& message) {
   Lock l(lock_);
   if (GetMessageConsistencyMode(message) == CLIENT_PROPAGATED) {
@@ -253,6 +343,9 @@ Status TimeManager::WaitUntilSafe(
   // - If this timestamp is before the last safe time return.
   // - If we're not the leader make sure we've heard from the leader recently.
   // - If we're not the leader make sure safe time isn't lagging too much.
+  Timestamp published(published_safe_ts_.load(std::memory_order_acquire));
+  if (timestamp < published)
+    return Status::OK();
   {
     Lock l(lock_);
     if (timestamp < GetSafeTimeUnlocked())
@@ -286,7 +379,7 @@ Status TimeManager::WaitUntilSafe(
     Lock l(lock_);
     if (IsTimestampSafeUnlocked(timestamp))
       return Status::OK();
-    waiters_.push_back(&waiter);
+    waiter.position = waiters_.emplace(timestamp, &waiter);
   }
 
   // Wait until we get notified or 'deadline' elapses.
@@ -300,7 +393,7 @@ Status TimeManager::WaitUntilSafe(
     if (waiter.latch->count() == 0)
       return Status::OK();
 
-    waiters_.erase(std::find(waiters_.begin(), waiters_.end(), &waiter));
+    waiters_.erase(waiter.position);
 
     MakeWaiterTimeoutMessageUnlocked(waiter.timestamp, &error_message);
     return Status::TimedOut(error_message);
@@ -313,20 +406,17 @@ void TimeManager::AdvanceSafeTimeAndWakeUpWaitersUnlocked(Timestamp safe_time) {
   if (safe_time <= last_safe_ts_) {
     return;
   }
-  last_safe_ts_ = safe_time;
+  SetLastSafeTimeUnlocked(safe_time);
   last_advanced_safe_time_ = MonoTime::Now();
 
   if (PREDICT_FALSE(!waiters_.empty())) {
-    auto iter = waiters_.begin();
-    while (iter != waiters_.end()) {
-      WaitingState* waiter = *iter;
-      if (IsTimestampSafeUnlocked(waiter->timestamp)) {
-        iter = waiters_.erase(iter);
-        waiter->latch->CountDown();
-        continue;
-      }
-      iter++;
+    // The waiters are ordered by timestamp, so the ones now safe are at the
+    // front.
+    auto end = waiters_.upper_bound(GetSafeTimeUnlocked());
+    for (auto iter = waiters_.begin(); iter != end; ++iter) {
+      iter->second->latch->CountDown();
     }
+    waiters_.erase(waiters_.begin(), end);
   }
 }
 
@@ -340,6 +430,10 @@ bool TimeManager::IsTimestampSafeUnlocked(Timestamp timestamp) {
 }
 
 Timestamp TimeManager::GetSafeTime() {
+  // Non-leaders only ever return the last safe time they were sent.
+  if (!published_is_leader_.load(std::memory_order_acquire)) {
+    return Timestamp(published_safe_ts_.load(std::memory_order_acquire));
+  }
   Lock l(lock_);
   return GetSafeTimeUnlocked();
 }
@@ -370,7 +464,7 @@ Timestamp TimeManager::GetSafeTimeUnlocked() {
       // 'N'. We know the leader will never assign a new timestamp lower than
       // it.
       if (PREDICT_TRUE(last_serial_ts_assigned_ <= last_safe_ts_)) {
-        last_safe_ts_ = clock_->Now();
+        SetLastSafeTimeUnlocked(clock_->Now());
         last_advanced_safe_time_ = MonoTime::Now();
         return last_safe_ts_;
       }
@@ -16,6 +16,8 @@
 // under the License.
 #pragma once
 
+#include <atomic>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -24,6 +26,7 @@
 #include "kudu/clock/clock.h"
 #include "kudu/common/common.pb.h"
 #include "kudu/common/timestamp.h"
+#include "kudu/consensus/ref_counted_replicate.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/monotime.h"
@@ -45,7 +48,11 @@ class ITimeManager : public RefCountedThreadSafe<ITimeManager> {
   virtual void SetLeaderMode() = 0;
   virtual void SetNonLeaderMode() = 0;
   virtual Status AssignTimestamp(ReplicateMsg* message) = 0;
+  virtual Status AssignTimestamps(
+      const std::vector<ReplicateMsg*>& messages) = 0;
   virtual Status MessageReceivedFromLeader(const ReplicateMsg& message) = 0;
+  virtual Status MessagesReceivedFromLeader(
+      const std::vector<ReplicateRefPtr>& messages) = 0;
   virtual void AdvanceSafeTimeWithMessage(const ReplicateMsg& message) = 0;
   virtual void AdvanceSafeTime(Timestamp safe_time) = 0;
   virtual Status WaitUntilSafe(
@@ -70,10 +77,19 @@ class TimeManagerDummy : public ITimeManager {
     return Status::OK();
   }
 
+  Status AssignTimestamps(const std::vector<ReplicateMsg*>& messages) override {
+    return Status::OK();
+  }
+
   Status MessageReceivedFromLeader(const ReplicateMsg& message) override {
     return Status::OK();
   }
 
+  Status MessagesReceivedFromLeader(
+      const std::vector<ReplicateRefPtr>& messages) override {
+    return Status::OK();
+  }
+
   void AdvanceSafeTimeWithMessage(const ReplicateMsg& message) override {
     return;
   }
@@ -158,6 +174,15 @@ class TimeManager : public ITimeManager {
   // Requires Leader mode (non-OK status otherwise).
   Status AssignTimestamp(ReplicateMsg* message) override;
 
+  // Like AssignTimestamp(), for a batch of messages which are then appended to
+  // the queue in order. The messages get increasing timestamps, with the
+  // clock read once for the whole batch rather than once per message.
+  //
+  // Either all the messages are assigned a timestamp or none is.
+  //
+  // Requires Leader mode (non-OK status otherwise).
+  Status AssignTimestamps(const std::vector<ReplicateMsg*>& messages) override;
+
   // Updates the internal state based on 'message' received from a leader
   // replica. Replicas are expected to call this for every message received from
   // a valid leader.
@@ -168,6 +193,13 @@ class TimeManager : public ITimeManager {
   // Requires non-leader mode (CHECK failure if it isn't).
   Status MessageReceivedFromLeader(const ReplicateMsg& message) override;
 
+  // Same as above for all the messages of a request from the leader, in order,
+  // updating the clock and the internal state once for the whole batch.
+  //
+  // Requires non-leader mode (CHECK failure if it isn't).
+  Status MessagesReceivedFromLeader(
+      const std::vector<ReplicateRefPtr>& messages) override;
+
   // Advances safe time based on the timestamp and type of 'message'.
   //
   // This only moves safe time if 'message's timestamp is higher than the
@@ -200,7 +232,8 @@ class TimeManager : public ITimeManager {
   //
   // In leader mode returns clock_->Now() or some value close to it.
   //
-  // In non-leader mode returns the last safe time received from a leader.
+  // In non-leader mode returns the last safe time received from a leader,
+  // without taking the lock.
   Timestamp GetSafeTime() override;
 
   // Returns a timestamp that is guaranteed to be higher than all other
@@ -211,6 +244,11 @@ class TimeManager : public ITimeManager {
  private:
   FRIEND_TEST(TimeManagerTest, TestTimeManagerNonLeaderMode);
   FRIEND_TEST(TimeManagerTest, TestTimeManagerLeaderMode);
+  FRIEND_TEST(TimeManagerTest, TestAssignTimestampsInBatch);
+  FRIEND_TEST(TimeManagerTest, TestWaitersWokenInTimestampOrder);
+
+  // Returns the error to give when asked to assign timestamps as a non-leader.
+  Status NotLeaderErrorUnlocked() const;
 
   // Returns whether we've advanced safe time recently.
   // If this returns false we might be partitioned or there might be election
@@ -244,6 +282,8 @@ class TimeManager : public ITimeManager {
     // Latch that will be count down once 'timestamp' if safe, unblocking the
     // waiter.
     CountDownLatch* latch;
+    // Where the waiter is in 'waiters_', to remove it should it time out.
+    std::multimap<Timestamp, WaitingState*>::iterator position;
   };
 
   // Returns whether 'timestamp' is safe.
@@ -267,11 +307,19 @@ class TimeManager : public ITimeManager {
   // Internal, unlocked implementation of GetSafeTime().
   Timestamp GetSafeTimeUnlocked();
 
+  // Sets 'last_safe_ts_' and publishes it to the lock-free readers.
+  void SetLastSafeTimeUnlocked(Timestamp safe_time);
+
+  // Sets 'mode_', publishing it to the lock-free readers.
+  void SetModeUnlocked(Mode mode);
+
   // Lock to protect the non-const fields below.
   mutable simple_spinlock lock_;
 
-  // Vector of waiters to be notified when the safe time advances.
-  mutable std::vector<WaitingState*> waiters_;
+  // Waiters to be notified when the safe time advances, ordered by the
+  // timestamp they wait for, so that advancing safe time only visits the
+  // waiters it unblocks.
+  std::multimap<Timestamp, WaitingState*> waiters_;
 
   // The last serial timestamp that was assigned.
   Timestamp last_serial_ts_assigned_;
@@ -287,6 +335,12 @@ class TimeManager : public ITimeManager {
   // The current mode of the TimeManager.
   Mode mode_;
 
+  // Copies of 'last_safe_ts_' and of whether 'mode_' is LEADER, for the
+  // callers which don't need to take 'lock_': safe time only moves forward,
+  // so a slightly stale value is still a safe one.
+  std::atomic<Timestamp::val_type> published_safe_ts_;
+  std::atomic<bool> published_is_leader_;
+
   const scoped_refptr<clock::Clock> clock_;
   const std::string local_peer_uuid_;
 };
@@ -0,0 +1,265 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/workload_capture.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/clock/hybrid_clock.h"
+#include "kudu/common/timestamp.h"
+#include "kudu/consensus/log.pb.h"
+#include "kudu/consensus/log_index.h"
+#include "kudu/consensus/log_reader.h"
+#include "kudu/consensus/log_util.h"
+#include "kudu/gutil/strings/stringpiece.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/walltime.h"
+#include "kudu/util/coding.h"
+#include "kudu/util/env.h"
+#include "kudu/util/env_util.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/path_util.h"
+#include "kudu/util/rolling_log.h"
+#include "kudu/util/slice.h"
+
+DEFINE_string(
+    consensus_workload_capture_dir,
+    "",
+    "If set, every replica records the size, type, timestamp and arrival "
+    "time of the ops it replicates or receives, but not their payload, to "
+    "rolling files in this directory, for replaying the workload against a "
+    "benchmark quorum.");
+TAG_FLAG(consensus_workload_capture_dir, advanced);
+
+DEFINE_int32(
+    consensus_workload_capture_segment_size_mb,
+    64,
+    "Size at which the workload capture files are rolled, in MB. See "
+    "--consensus_workload_capture_dir.");
+DEFINE_validator(
+    consensus_workload_capture_segment_size_mb,
+    [](const char* /*n*/, int32_t v) { return v > 0; });
+TAG_FLAG(consensus_workload_capture_segment_size_mb, advanced);
+
+DEFINE_int32(
+    consensus_workload_capture_max_segments,
+    10,
+    "Number of workload capture files kept per replica, the oldest are "
+    "deleted. See --consensus_workload_capture_dir.");
+DEFINE_validator(
+    consensus_workload_capture_max_segments,
+    [](const char* /*n*/, int32_t v) { return v > 0; });
+TAG_FLAG(consensus_workload_capture_max_segments, advanced);
+
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace consensus {
+
+namespace {
+
+// The buffered records are written out once they add up to this.
+constexpr size_t kFlushThresholdBytes = 64 * 1024;
+
+string CaptureLogName(const string& tablet_id, const string& peer_uuid) {
+  return Substitute("consensus-workload-$0-$1", tablet_id, peer_uuid);
+}
+
+// Returns the record of 'msg', which came from 'source' in a call with
+// 'batch_size' ops, without its arrival time.
+CapturedOpPB ToCapturedOp(
+    const ReplicateMsg& msg,
+    CapturedOpPB::Source source,
+    int batch_size) {
+  CapturedOpPB op;
+  op.set_source(source);
+  op.set_op_type(msg.op_type());
+  op.set_timestamp(msg.timestamp());
+  if (msg.has_write_payload()) {
+    const WritePayloadPB& payload = msg.write_payload();
+    op.set_payload_bytes(payload.payload().size());
+    op.set_uncompressed_bytes(
+        payload.has_uncompressed_size() ? payload.uncompressed_size()
+                                        : payload.payload().size());
+    op.set_codec(payload.compression_codec());
+  } else if (msg.has_noop_request()) {
+    const int64_t size = msg.noop_request().payload_for_tests().size();
+    op.set_payload_bytes(size);
+    op.set_uncompressed_bytes(size);
+  }
+  op.set_serialized_bytes(msg.ByteSizeLong());
+  op.set_batch_size(batch_size);
+  return op;
+}
+
+} // anonymous namespace
+
+Status WorkloadCapture::Create(
+    Env* env,
+    const string& tablet_id,
+    const string& peer_uuid,
+    unique_ptr<WorkloadCapture>* capture) {
+  capture->reset();
+  const string& dir = FLAGS_consensus_workload_capture_dir;
+  if (dir.empty()) {
+    return Status::OK();
+  }
+  RETURN_NOT_OK_PREPEND(
+      env_util::CreateDirsRecursively(env, dir),
+      Substitute("could not create workload capture dir $0", dir));
+  unique_ptr<RollingLog> log(
+      new RollingLog(env, dir, CaptureLogName(tablet_id, peer_uuid)));
+  log->SetRollThresholdBytes(
+      FLAGS_consensus_workload_capture_segment_size_mb * 1024L * 1024L);
+  log->SetMaxNumSegments(FLAGS_consensus_workload_capture_max_segments);
+  // ReadCapture() reads the files back as they were written.
+  log->SetCompressionEnabled(false);
+  RETURN_NOT_OK(log->Open());
+  capture->reset(new WorkloadCapture(std::move(log)));
+  return Status::OK();
+}
+
+WorkloadCapture::WorkloadCapture(unique_ptr<RollingLog> log)
+    : log_(std::move(log)) {}
+
+WorkloadCapture::~WorkloadCapture() {
+  WARN_NOT_OK(Flush(), "could not write out the workload capture");
+  WARN_NOT_OK(log_->Close(), "could not close the workload capture");
+}
+
+void WorkloadCapture::Record(
+    const ReplicateMsg& msg,
+    CapturedOpPB::Source source,
+    int batch_size) {
+  CapturedOpPB op = ToCapturedOp(msg, source, batch_size);
+  op.set_arrival_micros(GetMonoTimeMicros());
+
+  const size_t size = op.ByteSizeLong();
+  MutexLock l(lock_);
+  PutVarint32(&buffer_, size);
+  const size_t offset = buffer_.size();
+  buffer_.resize(offset + size);
+  op.SerializeWithCachedSizesToArray(buffer_.data() + offset);
+  if (buffer_.size() >= kFlushThresholdBytes) {
+    WARN_NOT_OK(FlushUnlocked(), "could not write out the workload capture");
+  }
+}
+
+Status WorkloadCapture::Flush() {
+  MutexLock l(lock_);
+  return FlushUnlocked();
+}
+
+Status WorkloadCapture::FlushUnlocked() {
+  if (buffer_.size() == 0) {
+    return Status::OK();
+  }
+  // Drop the records on failure rather than let them pile up.
+  Status s = log_->Append(StringPiece(
+      reinterpret_cast<const char*>(buffer_.data()), buffer_.size()));
+  buffer_.clear();
+  return s;
+}
+
+string WorkloadCapture::FilePattern(
+    const string& dir,
+    const string& tablet_id,
+    const string& peer_uuid) {
+  return JoinPathSegments(
+      dir, Substitute("*.$0.*", CaptureLogName(tablet_id, peer_uuid)));
+}
+
+Status WorkloadCapture::ReadCapture(
+    Env* env,
+    const string& pattern,
+    vector<CapturedOpPB>* ops) {
+  vector<string> paths;
+  RETURN_NOT_OK(env->Glob(pattern, &paths));
+  if (paths.empty()) {
+    return Status::NotFound("no workload capture files match", pattern);
+  }
+  // The files are named after the time they were created.
+  std::sort(paths.begin(), paths.end());
+  for (const string& path : paths) {
+    faststring data;
+    RETURN_NOT_OK(ReadFileToString(env, path, &data));
+    Slice input(data);
+    while (!input.empty()) {
+      uint32_t size;
+      if (PREDICT_FALSE(!GetVarint32(&input, &size) || input.size() < size)) {
+        return Status::Corruption("truncated workload capture record", path);
+      }
+      CapturedOpPB op;
+      if (PREDICT_FALSE(!op.ParseFromArray(input.data(), size))) {
+        return Status::Corruption("bad workload capture record", path);
+      }
+      ops->push_back(std::move(op));
+      input.remove_prefix(size);
+    }
+  }
+  return Status::OK();
+}
+
+Status WorkloadCapture::ReadWal(
+    Env* env,
+    const string& wal_dir,
+    vector<CapturedOpPB>* ops) {
+  shared_ptr<log::LogReader> reader;
+  RETURN_NOT_OK(
+      log::LogReader::Open(env, wal_dir, nullptr, "", nullptr, &reader));
+  log::SegmentSequence segments;
+  RETURN_NOT_OK(reader->GetSegmentsSnapshot(&segments));
+  if (segments.empty()) {
+    return Status::NotFound("no WAL segments found", wal_dir);
+  }
+  int64_t arrival_micros = 0;
+  for (const scoped_refptr<log::ReadableLogSegment>& segment : segments) {
+    log::LogEntryReader entry_reader(segment.get());
+    while (true) {
+      unique_ptr<log::LogEntryPB> entry;
+      Status s = entry_reader.ReadNextEntry(&entry);
+      if (s.IsEndOfFile()) {
+        break;
+      }
+      RETURN_NOT_OK_PREPEND(s, segment->path());
+      if (entry->type() != log::REPLICATE) {
+        continue;
+      }
+      const ReplicateMsg& msg = entry->replicate();
+      CapturedOpPB op =
+          ToCapturedOp(msg, CapturedOpPB::LEADER_REPLICATE, /*batch_size=*/1);
+      arrival_micros = std::max<int64_t>(
+          arrival_micros,
+          clock::HybridClock::GetPhysicalValueMicros(
+              Timestamp(msg.timestamp())));
+      op.set_arrival_micros(arrival_micros);
+      ops->push_back(std::move(op));
+    }
+  }
+  return Status::OK();
+}
+
+} // namespace consensus
+} // namespace kudu
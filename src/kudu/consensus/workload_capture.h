@@ -0,0 +1,112 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/gutil/macros.h"
+#include "kudu/util/faststring.h"
+#include "kudu/util/mutex.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+class Env;
+class RollingLog;
+
+namespace consensus {
+
+// Records the shape of the consensus traffic of a replica: for every op it
+// replicates as leader or receives from the leader, its arrival time,
+// timestamp, type, sizes and compression codec, but not its payload, so
+// that a production workload can be replayed against a benchmark quorum
+// with the same distribution of sizes, batching and inter-arrival times
+// (see the Replay benchmark in raft_consensus-bench.cc).
+//
+// The records are CapturedOpPBs, each prefixed with its varint32 length,
+// written to a RollingLog under --consensus_workload_capture_dir. They are
+// buffered and written out in the caller's thread once the buffer fills
+// up, so capturing costs a serialization per op and a synchronous write
+// every so often. Thread-safe.
+class WorkloadCapture {
+ public:
+  // Returns a new capture for the replica 'peer_uuid' of 'tablet_id' in
+  // 'capture', or nullptr if --consensus_workload_capture_dir isn't set.
+  static Status Create(
+      Env* env,
+      const std::string& tablet_id,
+      const std::string& peer_uuid,
+      std::unique_ptr<WorkloadCapture>* capture);
+
+  // Flushes the buffered records.
+  ~WorkloadCapture();
+
+  // Records 'msg', which came from 'source' in a call with 'batch_size'
+  // ops. 'msg' should be the op as replicated, i.e. compressed if it is.
+  void Record(
+      const ReplicateMsg& msg,
+      CapturedOpPB::Source source,
+      int batch_size);
+
+  // Writes out the buffered records.
+  Status Flush();
+
+  // Returns the glob pattern matching the capture files of the replica
+  // 'peer_uuid' of 'tablet_id' in 'dir'.
+  static std::string FilePattern(
+      const std::string& dir,
+      const std::string& tablet_id,
+      const std::string& peer_uuid);
+
+  // Reads the records of the capture files matching 'pattern', in the order
+  // they were written, and appends them to 'ops'.
+  static Status ReadCapture(
+      Env* env,
+      const std::string& pattern,
+      std::vector<CapturedOpPB>* ops);
+
+  // Reads the REPLICATE ops of the WAL segments in 'wal_dir', in log order,
+  // and appends them to 'ops' as ops their leader replicated one at a time.
+  // Their arrival times are the physical part of their hybrid timestamps,
+  // held back from going backwards, so that a WAL replays at the speed it
+  // was written.
+  static Status ReadWal(
+      Env* env,
+      const std::string& wal_dir,
+      std::vector<CapturedOpPB>* ops);
+
+ private:
+  explicit WorkloadCapture(std::unique_ptr<RollingLog> log);
+
+  Status FlushUnlocked();
+
+  Mutex lock_;
+  std::unique_ptr<RollingLog> log_;
+
+  // The records not written out yet. Protected by 'lock_'.
+  faststring buffer_;
+
+  DISALLOW_COPY_AND_ASSIGN(WorkloadCapture);
+};
+
+} // namespace consensus
+} // namespace kudu
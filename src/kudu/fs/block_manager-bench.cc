@@ -0,0 +1,420 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Benchmarks the block managers against workloads resembling how they are
+// used by a server: bulk appends (as WAL-like or flush traffic produces),
+// random reads of a mostly static set of blocks (as a spilled cache would
+// see), and rapid create/delete churn.
+//
+// Example invocation comparing the block managers across two devices:
+//
+//   block_manager-bench --bench_data_dirs=/data/1/bench,/data/2/bench \
+//     --bench_num_threads=16 --bench_block_size_bytes=1048576 \
+//     --bench_sync=false --bench_run_seconds=30
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <gflags/gflags_declare.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "kudu/fs/block_id.h"
+#include "kudu/fs/block_manager.h"
+#include "kudu/fs/data_dirs.h"
+#include "kudu/fs/error_manager.h"
+#include "kudu/fs/file_block_manager.h" // IWYU pragma: keep
+#include "kudu/fs/log_block_manager.h" // IWYU pragma: keep
+#include "kudu/gutil/stringprintf.h"
+#include "kudu/gutil/strings/numbers.h"
+#include "kudu/gutil/strings/split.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/env.h"
+#include "kudu/util/faststring.h"
+#include "kudu/util/hdr_histogram.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/random.h"
+#include "kudu/util/random_util.h"
+#include "kudu/util/slice.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_bool(enable_data_block_fsync);
+
+DEFINE_int32(
+    bench_run_seconds,
+    1,
+    "Number of seconds to run each workload of the benchmark");
+DEFINE_int32(
+    bench_num_threads,
+    4,
+    "Number of threads issuing block operations concurrently");
+DEFINE_int32(
+    bench_block_size_bytes,
+    64 * 1024,
+    "Size of each block written by the benchmark");
+DEFINE_int32(
+    bench_write_size_bytes,
+    4 * 1024,
+    "Size of each individual append to a block being written");
+DEFINE_int32(
+    bench_blocks_per_transaction,
+    8,
+    "Number of blocks created or deleted together in one transaction");
+DEFINE_int32(
+    bench_read_percent,
+    95,
+    "Percentage of operations that are reads in the read-mostly workload; "
+    "the rest write new blocks");
+DEFINE_int32(
+    bench_num_preloaded_blocks,
+    1024,
+    "Number of blocks written before the read-mostly workload starts");
+DEFINE_bool(
+    bench_sync,
+    true,
+    "Whether blocks are synchronized to disk when their creation is "
+    "committed. Sets --enable_data_block_fsync for the benchmark");
+DEFINE_int32(
+    bench_num_data_dirs,
+    1,
+    "Number of data directories to spread blocks across, created under the "
+    "test directory. Ignored if --bench_data_dirs is set");
+DEFINE_string(
+    bench_data_dirs,
+    "",
+    "Comma-separated list of data directories to use, e.g. one per device. "
+    "If empty, --bench_num_data_dirs directories under the test directory "
+    "are used");
+
+using std::atomic;
+using std::string;
+using std::thread;
+using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace fs {
+
+namespace {
+
+enum class Workload {
+  // Each operation writes and commits a transaction of new blocks.
+  APPEND,
+  // Each operation either reads a random existing block in full or, with
+  // probability (100 - --bench_read_percent)%, writes a new block.
+  READ_MOSTLY,
+  // Each operation writes a transaction of new blocks and immediately
+  // deletes them again.
+  DELETE_HEAVY,
+};
+
+const char* WorkloadToString(Workload w) {
+  switch (w) {
+    case Workload::APPEND:
+      return "APPEND";
+    case Workload::READ_MOSTLY:
+      return "READ_MOSTLY";
+    case Workload::DELETE_HEAVY:
+      return "DELETE_HEAVY";
+  }
+  LOG(FATAL) << "unknown workload";
+  return nullptr;
+}
+
+// Returns the number of read and write system calls issued by this process so
+// far, as accounted in /proc/self/io. Returns -1 if the counters are not
+// available on this platform.
+//
+// Note that fsync() and friends aren't accounted here.
+int64_t CountIoSyscalls(Env* env) {
+  faststring buf;
+  if (!ReadFileToString(env, "/proc/self/io", &buf).ok()) {
+    return -1;
+  }
+  int64_t total = 0;
+  int found = 0;
+  for (StringPiece line :
+       strings::Split(buf.ToString(), "\n", strings::SkipEmpty())) {
+    vector<string> kv = strings::Split(line, ": ");
+    if (kv.size() != 2 || (kv[0] != "syscr" && kv[0] != "syscw")) {
+      continue;
+    }
+    int64_t v;
+    if (!safe_strto64(kv[1], &v)) {
+      return -1;
+    }
+    total += v;
+    found++;
+  }
+  return found == 2 ? total : -1;
+}
+
+} // anonymous namespace
+
+template <typename T>
+class BlockManagerBench : public KuduTest {
+ public:
+  BlockManagerBench()
+      : error_manager_(new FsErrorManager()),
+        tablet_name_("bench_tablet"),
+        bytes_(0),
+        // Track latencies of up to 100 seconds with 3 significant digits.
+        latency_us_(100 * 1000 * 1000, 3) {}
+
+  void SetUp() override {
+    KuduTest::SetUp();
+    FLAGS_enable_data_block_fsync = FLAGS_bench_sync;
+
+    vector<string> data_dirs;
+    if (FLAGS_bench_data_dirs.empty()) {
+      for (int i = 0; i < FLAGS_bench_num_data_dirs; i++) {
+        data_dirs.push_back(GetTestPath(Substitute("data-$0", i)));
+      }
+    } else {
+      data_dirs =
+          strings::Split(FLAGS_bench_data_dirs, ",", strings::SkipEmpty());
+    }
+    ASSERT_OK(DataDirManager::CreateNewForTests(
+        env_, data_dirs, DataDirManagerOptions(), &dd_manager_));
+    bm_.reset(new T(
+        env_, dd_manager_.get(), error_manager_.get(), BlockManagerOptions()));
+    ASSERT_OK(bm_->Open(nullptr));
+    ASSERT_OK(dd_manager_->CreateDataDirGroup(tablet_name_));
+
+    data_.resize(FLAGS_bench_write_size_bytes);
+    Random r(SeedRandom());
+    for (auto& c : data_) {
+      c = static_cast<char>(r.Next());
+    }
+  }
+
+  void TearDown() override {
+    // The directory manager must outlive the block manager.
+    bm_.reset();
+    if (!FLAGS_bench_data_dirs.empty()) {
+      for (const auto& dd : dd_manager_->GetDataRoots()) {
+        WARN_NOT_OK(
+            env_->DeleteRecursively(dd),
+            Substitute("Couldn't recursively delete $0", dd));
+      }
+    }
+    dd_manager_.reset();
+    KuduTest::TearDown();
+  }
+
+  // Runs the given workload for --bench_run_seconds and logs its results.
+  void RunWorkload(Workload w) {
+    bytes_ = 0;
+    latency_us_.ResetHistogram();
+    if (w == Workload::READ_MOSTLY) {
+      Preload();
+    }
+
+    atomic<bool> done(false);
+    int64_t syscalls_before = CountIoSyscalls(env_);
+    MonoTime start = MonoTime::Now();
+    vector<thread> threads;
+    for (int i = 0; i < FLAGS_bench_num_threads; i++) {
+      threads.emplace_back([this, w, &done]() {
+        Random r(GetRandomSeed32());
+        while (!done) {
+          MonoTime op_start = MonoTime::Now();
+          CHECK_OK(RunOp(w, &r));
+          latency_us_.Increment(
+              (MonoTime::Now() - op_start).ToMicroseconds());
+        }
+      });
+    }
+    SleepFor(MonoDelta::FromSeconds(FLAGS_bench_run_seconds));
+    done = true;
+    for (auto& t : threads) {
+      t.join();
+    }
+    double secs = (MonoTime::Now() - start).ToSeconds();
+    int64_t syscalls_after = CountIoSyscalls(env_);
+
+    int64_t ops = latency_us_.TotalCount();
+    string syscalls_per_op = "N/A";
+    if (syscalls_before >= 0 && syscalls_after >= 0 && ops > 0) {
+      syscalls_per_op = StringPrintf(
+          "%.1f",
+          static_cast<double>(syscalls_after - syscalls_before) / ops);
+    }
+    LOG(INFO) << Substitute(
+        "$0 $1 threads=$2 block_size=$3 sync=$4 dirs=$5: "
+        "$6 ops/sec, $7 MB/sec, p50=$8us p99=$9us",
+        bm_name(),
+        WorkloadToString(w),
+        FLAGS_bench_num_threads,
+        FLAGS_bench_block_size_bytes,
+        FLAGS_bench_sync,
+        dd_manager_->GetDataRoots().size(),
+        StringPrintf("%.0f", ops / secs),
+        StringPrintf("%.1f", bytes_ / secs / (1024 * 1024)),
+        latency_us_.ValueAtPercentile(50),
+        latency_us_.ValueAtPercentile(99));
+    LOG(INFO) << Substitute(
+        "$0 $1: $2 read/write syscalls/op, max latency $3us",
+        bm_name(),
+        WorkloadToString(w),
+        syscalls_per_op,
+        latency_us_.MaxValue());
+  }
+
+ private:
+  static const char* bm_name();
+
+  Status RunOp(Workload w, Random* r) {
+    switch (w) {
+      case Workload::APPEND:
+        return WriteBlocks(FLAGS_bench_blocks_per_transaction, nullptr);
+      case Workload::READ_MOSTLY:
+        if (r->Uniform(100) < FLAGS_bench_read_percent) {
+          return ReadRandomBlock(r);
+        }
+        return WriteBlocks(1, nullptr);
+      case Workload::DELETE_HEAVY: {
+        vector<BlockId> ids;
+        RETURN_NOT_OK(WriteBlocks(FLAGS_bench_blocks_per_transaction, &ids));
+        return DeleteBlocks(ids);
+      }
+    }
+    LOG(FATAL) << "unknown workload";
+    return Status::OK();
+  }
+
+  // Writes and commits 'num_blocks' new blocks of --bench_block_size_bytes
+  // each. If 'ids' is not null, the IDs of the new blocks are appended to it.
+  Status WriteBlocks(int num_blocks, vector<BlockId>* ids) {
+    unique_ptr<BlockCreationTransaction> txn = bm_->NewCreationTransaction();
+    for (int i = 0; i < num_blocks; i++) {
+      unique_ptr<WritableBlock> block;
+      RETURN_NOT_OK(
+          bm_->CreateBlock(CreateBlockOptions({tablet_name_}), &block));
+      int64_t remaining = FLAGS_bench_block_size_bytes;
+      while (remaining > 0) {
+        int64_t n = std::min<int64_t>(remaining, data_.size());
+        RETURN_NOT_OK(block->Append(Slice(data_.data(), n)));
+        remaining -= n;
+      }
+      RETURN_NOT_OK(block->Finalize());
+      if (ids) {
+        ids->push_back(block->id());
+      }
+      txn->AddCreatedBlock(std::move(block));
+    }
+    RETURN_NOT_OK(txn->CommitCreatedBlocks());
+    bytes_ += static_cast<int64_t>(num_blocks) * FLAGS_bench_block_size_bytes;
+    return Status::OK();
+  }
+
+  Status DeleteBlocks(const vector<BlockId>& ids) {
+    std::shared_ptr<BlockDeletionTransaction> txn =
+        bm_->NewDeletionTransaction();
+    for (const auto& id : ids) {
+      txn->AddDeletedBlock(id);
+    }
+    vector<BlockId> deleted;
+    return txn->CommitDeletedBlocks(&deleted);
+  }
+
+  Status ReadRandomBlock(Random* r) {
+    BlockId id;
+    {
+      std::lock_guard<simple_spinlock> l(lock_);
+      id = preloaded_[r->Uniform(preloaded_.size())];
+    }
+    unique_ptr<ReadableBlock> block;
+    RETURN_NOT_OK(bm_->OpenBlock(id, &block));
+    uint64_t size;
+    RETURN_NOT_OK(block->Size(&size));
+    unique_ptr<uint8_t[]> scratch(new uint8_t[size]);
+    RETURN_NOT_OK(block->Read(0, Slice(scratch.get(), size)));
+    bytes_ += size;
+    return Status::OK();
+  }
+
+  // Writes --bench_num_preloaded_blocks blocks for the read-mostly workload
+  // to read from.
+  void Preload() {
+    if (!preloaded_.empty()) {
+      return;
+    }
+    vector<BlockId> ids;
+    while (ids.size() < static_cast<size_t>(FLAGS_bench_num_preloaded_blocks)) {
+      CHECK_OK(WriteBlocks(FLAGS_bench_blocks_per_transaction, &ids));
+    }
+    std::lock_guard<simple_spinlock> l(lock_);
+    preloaded_.swap(ids);
+  }
+
+  unique_ptr<FsErrorManager> error_manager_;
+  unique_ptr<DataDirManager> dd_manager_;
+  unique_ptr<BlockManager> bm_;
+  const string tablet_name_;
+
+  // Source data for every append.
+  string data_;
+
+  // Blocks the read-mostly workload reads from. Never deleted.
+  simple_spinlock lock_;
+  vector<BlockId> preloaded_;
+
+  // Results of the workload currently running.
+  atomic<int64_t> bytes_;
+  HdrHistogram latency_us_;
+};
+
+template <>
+const char* BlockManagerBench<FileBlockManager>::bm_name() {
+  return "file";
+}
+
+template <>
+const char* BlockManagerBench<LogBlockManager>::bm_name() {
+  return "log";
+}
+
+// What kinds of BlockManagers are supported?
+#if defined(__linux__)
+typedef ::testing::Types<FileBlockManager, LogBlockManager> BlockManagers;
+#else
+typedef ::testing::Types<FileBlockManager> BlockManagers;
+#endif
+TYPED_TEST_CASE(BlockManagerBench, BlockManagers);
+
+TYPED_TEST(BlockManagerBench, RunBench) {
+  for (Workload w :
+       {Workload::APPEND, Workload::READ_MOSTLY, Workload::DELETE_HEAVY}) {
+    this->RunWorkload(w);
+  }
+}
+
+} // namespace fs
+} // namespace kudu
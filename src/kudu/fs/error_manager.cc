@@ -45,6 +45,10 @@ FsErrorManager::FsErrorManager() {
       &callbacks_,
       ErrorHandlerType::CFILE_CORRUPTION,
       Bind(DoNothingErrorNotification));
+  InsertOrDie(
+      &callbacks_,
+      ErrorHandlerType::WAL_DISK_ERROR,
+      Bind(DoNothingErrorNotification));
 }
 
 void FsErrorManager::SetErrorNotificationCb(
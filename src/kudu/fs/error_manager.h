@@ -120,6 +120,10 @@ enum ErrorHandlerType {
 
   // For CFile corruptions.
   CFILE_CORRUPTION,
+
+  // For disk failures of WAL directories. The callback takes the root of the
+  // directory rather than a UUID.
+  WAL_DISK_ERROR,
 };
 
 // When certain operations fail, the side effects of the error can span multiple
@@ -232,6 +232,39 @@ TEST_F(FsManagerTestBase, TestOnlyWALPath) {
   ASSERT_TRUE(HasPrefixString(data_dirs[0], path));
 }
 
+TEST_F(FsManagerTestBase, TestExtraWalRoots) {
+  FsManagerOpts opts;
+  opts.wal_root = GetTestPath("wal");
+  opts.extra_wal_roots = {
+      GetTestPath("wal-extra-1"), GetTestPath("wal-extra-2")};
+  opts.data_roots = {GetTestPath("data")};
+  ReinitFsManagerWithOpts(opts);
+  ASSERT_OK(fs_manager()->CreateInitialFileSystemLayout());
+  ASSERT_OK(fs_manager()->Open());
+
+  // The logs of the tablets are spread across the WAL roots.
+  vector<string> wal_dirs;
+  for (int i = 0; i < 3; i++) {
+    const string tablet_id = Substitute("tablet-$0", i);
+    wal_dirs.emplace_back(fs_manager()->GetTabletWalDir(tablet_id));
+    ASSERT_OK(env_->CreateDir(wal_dirs.back()));
+  }
+  ASSERT_TRUE(HasPrefixString(wal_dirs[0], opts.wal_root));
+  ASSERT_TRUE(HasPrefixString(wal_dirs[1], opts.extra_wal_roots[0]));
+  ASSERT_TRUE(HasPrefixString(wal_dirs[2], opts.extra_wal_roots[1]));
+  ASSERT_TRUE(HasPrefixString(
+      fs_manager()->GetTabletWalRecoveryDir("tablet-2"),
+      opts.extra_wal_roots[1]));
+
+  // They are found where they are once reopened.
+  ReinitFsManagerWithOpts(opts);
+  ASSERT_OK(fs_manager()->Open());
+  for (int i = 0; i < 3; i++) {
+    ASSERT_EQ(
+        wal_dirs[i], fs_manager()->GetTabletWalDir(Substitute("tablet-$0", i)));
+  }
+}
+
 TEST_F(FsManagerTestBase, TestFormatWithSpecificUUID) {
   string path = GetTestPath("new_fs_root");
   ReinitFsManagerWithPaths(path, {});
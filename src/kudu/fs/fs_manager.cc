@@ -36,6 +36,7 @@
 #include "kudu/fs/fs.pb.h"
 #include "kudu/fs/fs_report.h"
 #include "kudu/fs/log_block_manager.h"
+#include "kudu/fs/wal_dirs.h"
 #include "kudu/gutil/bind.h"
 #include "kudu/gutil/bind_helpers.h"
 #include "kudu/gutil/gscoped_ptr.h"
@@ -100,6 +101,13 @@ DEFINE_string(
     "Directory with write-ahead logs. If this is not specified, the "
     "program will not start. May be the same as fs_data_dirs");
 TAG_FLAG(fs_wal_dir, stable);
+DEFINE_string(
+    fs_extra_wal_dirs,
+    "",
+    "Comma-separated list of additional directories with write-ahead logs, "
+    "each ideally on its own device. The log of each tablet is placed in "
+    "fs_wal_dir or one of these, avoiding the failed and slow ones.");
+TAG_FLAG(fs_extra_wal_dirs, experimental);
 DEFINE_string(
     fs_data_dirs,
     "",
@@ -129,6 +137,7 @@ using kudu::fs::FsErrorManager;
 using kudu::fs::FsReport;
 using kudu::fs::LogBlockManager;
 using kudu::fs::ReadableBlock;
+using kudu::fs::WalDirManager;
 using kudu::fs::WritableBlock;
 using kudu::pb_util::SecureDebugString;
 using std::ostream;
@@ -160,6 +169,8 @@ FsManagerOpts::FsManagerOpts()
       read_only(false),
       consistency_check(ConsistencyCheckBehavior::ENFORCE_CONSISTENCY) {
   data_roots = strings::Split(FLAGS_fs_data_dirs, ",", strings::SkipEmpty());
+  extra_wal_roots =
+      strings::Split(FLAGS_fs_extra_wal_dirs, ",", strings::SkipEmpty());
 }
 
 FsManagerOpts::FsManagerOpts(const string& root)
@@ -211,6 +222,7 @@ Status FsManager::Init() {
   // Deduplicate all of the roots.
   unordered_set<string> all_roots = {opts_.wal_root};
   all_roots.insert(opts_.data_roots.begin(), opts_.data_roots.end());
+  all_roots.insert(opts_.extra_wal_roots.begin(), opts_.extra_wal_roots.end());
 
   // If the metadata root not set, Kudu will either use the wal root or the
   // first data root, in which case we needn't canonicalize additional roots.
@@ -274,6 +286,17 @@ Status FsManager::Init() {
   if (InsertIfNotPresent(&unique_roots, canonicalized_wal_fs_root_.path)) {
     canonicalized_all_fs_roots_.emplace_back(canonicalized_wal_fs_root_);
   }
+  unordered_set<string> unique_wal_roots = {canonicalized_wal_fs_root_.path};
+  for (const string& wal_fs_root : opts_.extra_wal_roots) {
+    const auto& root = FindOrDie(canonicalized_roots, wal_fs_root);
+    if (!InsertIfNotPresent(&unique_wal_roots, root.path)) {
+      continue;
+    }
+    canonicalized_extra_wal_fs_roots_.emplace_back(root);
+    if (InsertIfNotPresent(&unique_roots, root.path)) {
+      canonicalized_all_fs_roots_.emplace_back(root);
+    }
+  }
 
   // Decide on a metadata root to use.
   if (opts_.metadata_root.empty()) {
@@ -315,6 +338,11 @@ Status FsManager::Init() {
 
   if (VLOG_IS_ON(1)) {
     VLOG(1) << "WAL root: " << canonicalized_wal_fs_root_.path;
+    VLOG(1) << "Extra WAL roots: "
+            << JoinStrings(
+                   DataDirManager::GetRootNames(
+                       canonicalized_extra_wal_fs_roots_),
+                   ",");
     VLOG(1) << "Metadata root: " << canonicalized_metadata_fs_root_.path;
     VLOG(1) << "Data roots: "
             << JoinStrings(
@@ -330,6 +358,42 @@ Status FsManager::Init() {
   return Status::OK();
 }
 
+Status FsManager::OpenWalDirManager(vector<string>* created_dirs) {
+  vector<string> roots = {canonicalized_wal_fs_root_.path};
+  vector<string> wals_dirs = {GetWalsRootDir()};
+  vector<string> failed_roots;
+  for (const auto& root : canonicalized_extra_wal_fs_roots_) {
+    const string wals_dir = JoinPathSegments(root.path, kWalDirName);
+    roots.emplace_back(root.path);
+    wals_dirs.emplace_back(wals_dir);
+    Status s = root.status;
+    if (s.ok() && !opts_.read_only) {
+      bool created;
+      s = env_util::CreateDirIfMissing(env_, wals_dir, &created);
+      if (s.ok() && created) {
+        created_dirs->emplace_back(wals_dir);
+      }
+    }
+    if (PREDICT_FALSE(!s.ok())) {
+      if (!s.IsDiskFailure() && !s.IsNotFound()) {
+        return s.CloneAndPrepend(
+            Substitute("unable to create WAL directory $0", wals_dir));
+      }
+      LOG(ERROR) << "WAL root " << root.path
+                 << " is unusable: " << s.ToString();
+      failed_roots.emplace_back(root.path);
+    }
+  }
+  unique_ptr<WalDirManager> wal_dir_manager(
+      new WalDirManager(roots, wals_dirs, opts_.metric_registry));
+  for (const string& root : failed_roots) {
+    wal_dir_manager->MarkWalDirFailedByRoot(root);
+  }
+  RETURN_NOT_OK(wal_dir_manager->Open(env_));
+  wal_dir_manager_ = std::move(wal_dir_manager);
+  return Status::OK();
+}
+
 void FsManager::InitBlockManager() {
   BlockManagerOptions bm_opts;
   bm_opts.metric_entity = opts_.metric_entity;
@@ -423,6 +487,11 @@ Status FsManager::Open(FsReport* report) {
         "unable to create missing filesystem roots");
   }
 
+  if (!wal_dir_manager_) {
+    RETURN_NOT_OK_PREPEND(
+        OpenWalDirManager(&created_dirs), "unable to open WAL directories");
+  }
+
   // Open the directory manager if it has not been opened already.
   if (!dd_manager_) {
     DataDirManagerOptions dm_opts;
@@ -453,6 +522,11 @@ Status FsManager::Open(FsReport* report) {
       Bind(
           &DataDirManager::MarkDataDirFailedByUuid,
           Unretained(dd_manager_.get())));
+  error_manager_->SetErrorNotificationCb(
+      ErrorHandlerType::WAL_DISK_ERROR,
+      Bind(
+          &WalDirManager::MarkWalDirFailedByRoot,
+          Unretained(wal_dir_manager_.get())));
 
   // Finally, initialize and open the block manager.
   InitBlockManager();
@@ -539,6 +613,8 @@ Status FsManager::CreateInitialFileSystemLayout(boost::optional<string> uuid) {
       created_dirs.emplace_back(dir);
     }
   }
+  RETURN_NOT_OK_PREPEND(
+      OpenWalDirManager(&created_dirs), "unable to create WAL directories");
 
   // Create the directory manager.
   //
@@ -729,8 +805,15 @@ string FsManager::GetInstanceMetadataPath(const string& root) const {
   return JoinPathSegments(root, kInstanceMetadataFileName);
 }
 
+string FsManager::GetTabletWalDir(const string& tablet_id) const {
+  if (!wal_dir_manager_) {
+    return JoinPathSegments(GetWalsRootDir(), tablet_id);
+  }
+  return wal_dir_manager_->GetTabletWalDir(tablet_id);
+}
+
 string FsManager::GetTabletWalRecoveryDir(const string& tablet_id) const {
-  string path = JoinPathSegments(GetWalsRootDir(), tablet_id);
+  string path = GetTabletWalDir(tablet_id);
   StrAppend(&path, kWalsRecoveryDirSuffix);
   return path;
 }
@@ -750,8 +833,13 @@ void FsManager::CleanTmpFiles() {
   DCHECK(!opts_.read_only);
   // Temporary files in the Block Manager directories are cleaned during
   // Block Manager startup.
-  for (const auto& s :
-       {GetWalsRootDir(), GetTabletMetadataDir(), GetConsensusMetadataDir()}) {
+  vector<string> dirs = {GetTabletMetadataDir(), GetConsensusMetadataDir()};
+  for (const auto& dir : wal_dir_manager_->dirs()) {
+    if (!dir->is_failed()) {
+      dirs.emplace_back(dir->wals_dir());
+    }
+  }
+  for (const auto& s : dirs) {
     WARN_NOT_OK(
         env_util::DeleteTmpFilesRecursively(env_, s),
         Substitute("Error deleting tmp files in $0", s));
@@ -50,6 +50,7 @@ namespace fs {
 
 class BlockManager;
 class ReadableBlock;
+class WalDirManager;
 class WritableBlock;
 struct CreateBlockOptions;
 struct FsReport;
@@ -86,9 +87,19 @@ struct FsManagerOpts {
   // Defaults to null.
   std::shared_ptr<MemTracker> parent_mem_tracker;
 
+  // The registry under which the metrics of each WAL root are grouped. If
+  // null, they will not be produced.
+  //
+  // Defaults to null.
+  MetricRegistry* metric_registry = nullptr;
+
   // The directory root where WALs will be stored. Cannot be empty.
   std::string wal_root;
 
+  // Additional directory roots where WALs will be stored, each ideally on its
+  // own device. The log of each tablet is placed in one of the WAL roots.
+  std::vector<std::string> extra_wal_roots;
+
   // The directory root where data blocks will be stored. If empty, Kudu will
   // use the WAL root.
   std::vector<std::string> data_roots;
@@ -204,14 +215,15 @@ class FsManager {
   // ==========================================================================
   std::vector<std::string> GetDataRootDirs() const;
 
+  // Returns the wals directory of the default WAL root.
   std::string GetWalsRootDir() const {
     DCHECK(initted_);
     return JoinPathSegments(canonicalized_wal_fs_root_.path, kWalDirName);
   }
 
-  std::string GetTabletWalDir(const std::string& tablet_id) const {
-    return JoinPathSegments(GetWalsRootDir(), tablet_id);
-  }
+  // Returns the directory of the log of 'tablet_id', in the WAL root it is
+  // placed in. A tablet without a log yet is placed by this call.
+  std::string GetTabletWalDir(const std::string& tablet_id) const;
 
   std::string GetTabletWalRecoveryDir(const std::string& tablet_id) const;
 
@@ -282,6 +294,15 @@ class FsManager {
     return block_manager_.get();
   }
 
+  // Null until the filesystem is opened or created.
+  fs::WalDirManager* wal_dir_manager() const {
+    return wal_dir_manager_.get();
+  }
+
+  fs::FsErrorManager* error_manager() const {
+    return error_manager_.get();
+  }
+
  private:
   FRIEND_TEST(FsManagerTestBase, TestDuplicatePaths);
   FRIEND_TEST(FsManagerTestBase, TestMetadataDirInWALRoot);
@@ -294,6 +315,11 @@ class FsManager {
   // Determines the correct filesystem root for tablet-specific metadata.
   Status Init();
 
+  // Creates and opens the manager of the WAL roots. Unless read-only, creates
+  // the wals directory of the extra roots missing one, appending them to
+  // 'created_dirs'. Extra roots which are unusable are marked failed.
+  Status OpenWalDirManager(std::vector<std::string>* created_dirs);
+
   // Select and create an instance of the appropriate block manager.
   //
   // Does not actually perform any on-disk operations.
@@ -366,6 +392,7 @@ class FsManager {
   // - The first data root is used as the metadata root.
   // - Common roots in the collections have been deduplicated.
   CanonicalizedRootAndStatus canonicalized_wal_fs_root_;
+  CanonicalizedRootsList canonicalized_extra_wal_fs_roots_;
   CanonicalizedRootAndStatus canonicalized_metadata_fs_root_;
   CanonicalizedRootsList canonicalized_data_fs_roots_;
   CanonicalizedRootsList canonicalized_all_fs_roots_;
@@ -375,6 +402,7 @@ class FsManager {
   std::unique_ptr<fs::FsErrorManager> error_manager_;
   std::unique_ptr<fs::DataDirManager> dd_manager_;
   std::unique_ptr<fs::BlockManager> block_manager_;
+  std::unique_ptr<fs::WalDirManager> wal_dir_manager_;
 
   ObjectIdGenerator oid_generator_;
 
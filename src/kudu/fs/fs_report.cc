@@ -281,12 +281,27 @@ string FsReport::Stats::ToString() const {
 // FsReport
 ///////////////////////////////////////////////////////////////////////////////
 
+string FsReport::DataDirTiming::ToString() const {
+  return Substitute(
+      "data directory $0: $1 containers, listed in $2, loaded in $3, "
+      "repaired in $4",
+      dir,
+      container_count,
+      list_time.ToString(),
+      load_time.ToString(),
+      repair_time.ToString());
+}
+
 void FsReport::MergeFrom(const FsReport& other) {
   DCHECK_EQ(metadata_dir, other.metadata_dir);
   DCHECK_EQ(wal_dir, other.wal_dir);
 
   data_dirs.insert(
       data_dirs.end(), other.data_dirs.begin(), other.data_dirs.end());
+  data_dir_timings.insert(
+      data_dir_timings.end(),
+      other.data_dir_timings.begin(),
+      other.data_dir_timings.end());
 
   stats.MergeFrom(other.stats);
 
@@ -320,6 +335,9 @@ string FsReport::ToString() const {
       data_dirs.size(),
       JoinStrings(data_dirs, ", "));
   s += stats.ToString();
+  for (const auto& t : data_dir_timings) {
+    s += t.ToString() + "\n";
+  }
 
 #define TOSTRING_ONE_CHECK(c, name)      \
   if ((c)) {                             \
@@ -24,6 +24,7 @@
 
 #include "kudu/fs/block_id.h"
 #include "kudu/fs/fs.pb.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/status.h"
 
 namespace kudu {
@@ -245,6 +246,30 @@ struct FsReport {
   // Data directories described by this report.
   std::vector<std::string> data_dirs;
 
+  // How long it took to open a data directory, broken down by phase.
+  struct DataDirTiming {
+    // Returns a single-line string representation of the timing.
+    std::string ToString() const;
+
+    std::string dir;
+
+    // Number of containers found in the directory.
+    int64_t container_count = 0;
+
+    // Time spent listing the directory's contents.
+    MonoDelta list_time;
+
+    // Time spent opening containers and loading their block records.
+    MonoDelta load_time;
+
+    // Time spent repairing inconsistencies found while loading.
+    MonoDelta repair_time;
+  };
+
+  // Per-directory open timings, in the same order as 'data_dirs'. Only
+  // populated by block managers that time their startup.
+  std::vector<DataDirTiming> data_dir_timings;
+
   // WAL directory.
   std::string wal_dir;
 
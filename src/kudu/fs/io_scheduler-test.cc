@@ -0,0 +1,139 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/fs/io_scheduler.h"
+
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_int32(io_scheduler_catch_up_read_mb_per_sec);
+DECLARE_int32(io_scheduler_max_queue_depth);
+
+METRIC_DECLARE_entity(wal_dir);
+METRIC_DECLARE_counter(io_scheduler_catch_up_throttled);
+
+using std::thread;
+using std::vector;
+
+namespace kudu {
+namespace fs {
+
+class IOSchedulerTest : public KuduTest {};
+
+// Tests that WAL operations are never held back, and that once a slot frees
+// up, waiting operations are admitted in priority order.
+TEST_F(IOSchedulerTest, TestPriorities) {
+  FLAGS_io_scheduler_max_queue_depth = 1;
+  IOScheduler scheduler(nullptr);
+
+  // WAL operations go beyond the queue depth.
+  scheduler.Admit(IOScheduler::WAL);
+  scheduler.Admit(IOScheduler::WAL);
+  ASSERT_EQ(2, scheduler.in_flight());
+
+  std::mutex order_lock;
+  vector<IOScheduler::Priority> order;
+  auto issue = [&](IOScheduler::Priority priority) {
+    scheduler.Admit(priority);
+    {
+      std::lock_guard<std::mutex> l(order_lock);
+      order.push_back(priority);
+    }
+    scheduler.Release(priority, 0);
+  };
+  thread catch_up([&]() { issue(IOScheduler::CATCH_UP); });
+  SleepFor(MonoDelta::FromMilliseconds(100));
+  thread normal([&]() { issue(IOScheduler::NORMAL); });
+  SleepFor(MonoDelta::FromMilliseconds(100));
+  {
+    std::lock_guard<std::mutex> l(order_lock);
+    ASSERT_TRUE(order.empty());
+  }
+
+  // Though the catch-up read has been waiting longer, the other operation
+  // goes first.
+  scheduler.Release(IOScheduler::WAL, 0);
+  scheduler.Release(IOScheduler::WAL, 0);
+  catch_up.join();
+  normal.join();
+  ASSERT_EQ(
+      vector<IOScheduler::Priority>({IOScheduler::NORMAL,
+                                     IOScheduler::CATCH_UP}),
+      order);
+  ASSERT_EQ(0, scheduler.in_flight());
+}
+
+// Tests that a queue depth of 0 admits everything.
+TEST_F(IOSchedulerTest, TestUnlimitedQueueDepth) {
+  FLAGS_io_scheduler_max_queue_depth = 0;
+  IOScheduler scheduler(nullptr);
+  for (int i = 0; i < 100; i++) {
+    scheduler.Admit(i % 2 ? IOScheduler::NORMAL : IOScheduler::CATCH_UP);
+  }
+  ASSERT_EQ(100, scheduler.in_flight());
+  for (int i = 0; i < 100; i++) {
+    scheduler.Release(i % 2 ? IOScheduler::NORMAL : IOScheduler::CATCH_UP, 0);
+  }
+  ASSERT_EQ(0, scheduler.in_flight());
+}
+
+// Tests that catch-up reads are held to their rate limit.
+TEST_F(IOSchedulerTest, TestCatchUpThrottling) {
+  FLAGS_io_scheduler_catch_up_read_mb_per_sec = 1;
+  MetricRegistry registry;
+  scoped_refptr<MetricEntity> entity =
+      METRIC_ENTITY_wal_dir.Instantiate(&registry, "test");
+  IOScheduler scheduler(entity);
+
+  // Each read takes about one refill period's worth of tokens.
+  const int64_t kReadBytes = 100 * 1024;
+  const int kNumReads = 5;
+  const MonoTime start = MonoTime::Now();
+  for (int i = 0; i < kNumReads; i++) {
+    ScopedIO io(&scheduler, IOScheduler::CATCH_UP);
+    io.AddBytes(kReadBytes);
+  }
+  ASSERT_GE(
+      MonoTime::Now() - start,
+      MonoDelta::FromMilliseconds(300));
+  ASSERT_GT(
+      METRIC_io_scheduler_catch_up_throttled.Instantiate(entity)->value(), 0);
+
+  // Other I/O isn't throttled.
+  const MonoTime normal_start = MonoTime::Now();
+  for (int i = 0; i < kNumReads; i++) {
+    ScopedIO io(&scheduler, IOScheduler::NORMAL);
+    io.AddBytes(kReadBytes);
+  }
+  ASSERT_LT(
+      MonoTime::Now() - normal_start,
+      MonoDelta::FromMilliseconds(100));
+}
+
+} // namespace fs
+} // namespace kudu
@@ -0,0 +1,195 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/fs/io_scheduler.h"
+
+#include <algorithm>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/throttler.h"
+
+DEFINE_int32(
+    io_scheduler_max_queue_depth,
+    16,
+    "Maximum number of I/O operations in flight at once to a WAL device. WAL "
+    "appends and syncs are never held back, but count towards the limit. 0 "
+    "means no limit.");
+DEFINE_validator(
+    io_scheduler_max_queue_depth,
+    [](const char* /*flagname*/, int32_t value) { return value >= 0; });
+TAG_FLAG(io_scheduler_max_queue_depth, advanced);
+TAG_FLAG(io_scheduler_max_queue_depth, runtime);
+
+DEFINE_int32(
+    io_scheduler_catch_up_read_mb_per_sec,
+    0,
+    "Maximum rate, in MiB per second, at which old log entries are read from "
+    "a WAL device to catch up lagging peers. 0 means no limit.");
+DEFINE_validator(
+    io_scheduler_catch_up_read_mb_per_sec,
+    [](const char* /*flagname*/, int32_t value) { return value >= 0; });
+TAG_FLAG(io_scheduler_catch_up_read_mb_per_sec, advanced);
+TAG_FLAG(io_scheduler_catch_up_read_mb_per_sec, runtime);
+
+METRIC_DEFINE_gauge_uint64(
+    wal_dir,
+    io_scheduler_in_flight,
+    "I/O Operations In Flight",
+    kudu::MetricUnit::kOperations,
+    "Number of I/O operations currently in flight to this WAL directory");
+METRIC_DEFINE_histogram(
+    wal_dir,
+    io_scheduler_normal_queue_time,
+    "Foreground I/O Queue Time",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds that foreground I/O other than WAL appends and syncs waited "
+    "for a slot in this WAL directory",
+    60000000LU,
+    2);
+METRIC_DEFINE_histogram(
+    wal_dir,
+    io_scheduler_catch_up_queue_time,
+    "Catch-up Read Queue Time",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds that catch-up reads waited for a slot in this WAL directory",
+    60000000LU,
+    2);
+METRIC_DEFINE_counter(
+    wal_dir,
+    io_scheduler_catch_up_throttled,
+    "Catch-up Reads Throttled",
+    kudu::MetricUnit::kOperations,
+    "Number of catch-up reads from this WAL directory delayed by "
+    "--io_scheduler_catch_up_read_mb_per_sec");
+
+namespace kudu {
+namespace fs {
+
+IOScheduler::IOScheduler(const scoped_refptr<MetricEntity>& entity)
+    : slot_freed_(&lock_), in_flight_(0), throttler_mb_per_sec_(0) {
+  std::fill(waiting_, waiting_ + NUM_PRIORITIES, 0);
+  if (entity) {
+    in_flight_gauge_ = METRIC_io_scheduler_in_flight.Instantiate(entity, 0);
+    queue_time_[NORMAL] =
+        METRIC_io_scheduler_normal_queue_time.Instantiate(entity);
+    queue_time_[CATCH_UP] =
+        METRIC_io_scheduler_catch_up_queue_time.Instantiate(entity);
+    catch_up_throttled_ =
+        METRIC_io_scheduler_catch_up_throttled.Instantiate(entity);
+  }
+}
+
+IOScheduler::~IOScheduler() {}
+
+bool IOScheduler::HigherPriorityWaitingUnlocked(Priority priority) const {
+  for (int p = 0; p < priority; p++) {
+    if (waiting_[p] > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void IOScheduler::Admit(Priority priority) {
+  DCHECK_LT(priority, NUM_PRIORITIES);
+  const MonoTime start = MonoTime::Now();
+  {
+    MutexLock l(lock_);
+    if (priority != WAL) {
+      waiting_[priority]++;
+      while (true) {
+        const int32_t depth = FLAGS_io_scheduler_max_queue_depth;
+        if (depth == 0 ||
+            (in_flight_ < depth && !HigherPriorityWaitingUnlocked(priority))) {
+          break;
+        }
+        slot_freed_.Wait();
+      }
+      waiting_[priority]--;
+    }
+    in_flight_++;
+
+    // Lower priority operations may have left waiting on this one, even
+    // though there are slots left.
+    if (in_flight_ < FLAGS_io_scheduler_max_queue_depth) {
+      slot_freed_.Broadcast();
+    }
+  }
+  if (in_flight_gauge_) {
+    in_flight_gauge_->Increment();
+  }
+  if (queue_time_[priority]) {
+    const MonoDelta waited = MonoTime::Now() - start;
+    queue_time_[priority]->Increment(waited.ToMicroseconds());
+  }
+}
+
+void IOScheduler::Release(Priority priority, int64_t bytes) {
+  {
+    MutexLock l(lock_);
+    DCHECK_GT(in_flight_, 0);
+    in_flight_--;
+    slot_freed_.Broadcast();
+  }
+  if (in_flight_gauge_) {
+    in_flight_gauge_->Decrement();
+  }
+  if (priority == CATCH_UP && bytes > 0) {
+    ThrottleCatchUp(bytes);
+  }
+}
+
+int IOScheduler::in_flight() const {
+  MutexLock l(lock_);
+  return in_flight_;
+}
+
+void IOScheduler::ThrottleCatchUp(int64_t bytes) {
+  const int32_t mb_per_sec = FLAGS_io_scheduler_catch_up_read_mb_per_sec;
+  if (mb_per_sec == 0) {
+    return;
+  }
+  const uint64_t byte_rate = static_cast<uint64_t>(mb_per_sec) * 1024 * 1024;
+
+  // The throttler never holds more than one refill period worth of tokens, so
+  // larger reads are charged just that much.
+  const uint64_t max_take = byte_rate /
+      (MonoTime::kMicrosecondsPerSecond / Throttler::kRefillPeriodMicros);
+  const uint64_t take = std::min<uint64_t>(bytes, max_take);
+
+  // Readers take turns, so the lock is held while waiting for tokens.
+  bool throttled = false;
+  MutexLock l(throttler_lock_);
+  if (!throttler_ || throttler_mb_per_sec_ != mb_per_sec) {
+    throttler_.reset(new Throttler(MonoTime::Now(), 0, byte_rate, 1.0));
+    throttler_mb_per_sec_ = mb_per_sec;
+  }
+  while (!throttler_->Take(MonoTime::Now(), 0, take)) {
+    throttled = true;
+    SleepFor(MonoDelta::FromMicroseconds(Throttler::kRefillPeriodMicros));
+  }
+  if (throttled && catch_up_throttled_) {
+    catch_up_throttled_->Increment();
+  }
+}
+
+} // namespace fs
+} // namespace kudu
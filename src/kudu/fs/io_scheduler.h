@@ -0,0 +1,129 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/condition_variable.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/mutex.h"
+
+namespace kudu {
+
+class Throttler;
+
+namespace fs {
+
+// Arbitrates the I/O issued to a device among callers of different
+// priorities, so that background work can't inflate the latency of the WAL.
+//
+// At most --io_scheduler_max_queue_depth operations are in flight at once.
+// WAL operations are always admitted immediately, but count towards the
+// limit, so that the other classes back off while the WAL is busy. Once a
+// slot frees up, a waiting operation of a higher priority goes before those of
+// lower priorities. Catch-up reads are additionally limited to
+// --io_scheduler_catch_up_read_mb_per_sec.
+//
+// This class is thread-safe.
+class IOScheduler {
+ public:
+  enum Priority {
+    // WAL appends and syncs.
+    WAL = 0,
+    // Other foreground I/O, e.g. log segment preallocation.
+    NORMAL,
+    // Reads of old log entries to catch up lagging peers.
+    CATCH_UP,
+    NUM_PRIORITIES
+  };
+
+  // 'entity' may be null, in which case no metrics are produced.
+  explicit IOScheduler(const scoped_refptr<MetricEntity>& entity);
+  ~IOScheduler();
+
+  // Waits until an operation of 'priority' may be issued.
+  void Admit(Priority priority);
+
+  // Releases the slot taken by Admit(). 'bytes' is the amount of data the
+  // operation moved; for catch-up reads, waits until it fits in the rate
+  // limit, which delays the next read of the caller.
+  void Release(Priority priority, int64_t bytes);
+
+  int in_flight() const;
+
+ private:
+  // Returns whether an operation of a higher priority than 'priority' is
+  // waiting for a slot.
+  bool HigherPriorityWaitingUnlocked(Priority priority) const;
+
+  // Charges 'bytes' against the catch-up read rate limit, waiting for tokens
+  // if needed.
+  void ThrottleCatchUp(int64_t bytes);
+
+  mutable Mutex lock_;
+  ConditionVariable slot_freed_;
+  int in_flight_;
+  int waiting_[NUM_PRIORITIES];
+
+  // Protected by 'throttler_lock_'. Rebuilt when the rate limit changes.
+  Mutex throttler_lock_;
+  std::unique_ptr<Throttler> throttler_;
+  int32_t throttler_mb_per_sec_;
+
+  scoped_refptr<AtomicGauge<uint64_t>> in_flight_gauge_;
+  scoped_refptr<Histogram> queue_time_[NUM_PRIORITIES];
+  scoped_refptr<Counter> catch_up_throttled_;
+
+  DISALLOW_COPY_AND_ASSIGN(IOScheduler);
+};
+
+// Holds a slot of an IOScheduler for the lifetime of the object. Does nothing
+// if the scheduler is null.
+class ScopedIO {
+ public:
+  ScopedIO(IOScheduler* scheduler, IOScheduler::Priority priority)
+      : scheduler_(scheduler), priority_(priority), bytes_(0) {
+    if (scheduler_) {
+      scheduler_->Admit(priority_);
+    }
+  }
+
+  ~ScopedIO() {
+    if (scheduler_) {
+      scheduler_->Release(priority_, bytes_);
+    }
+  }
+
+  // Records that the operation moved 'bytes' more bytes.
+  void AddBytes(int64_t bytes) {
+    bytes_ += bytes;
+  }
+
+ private:
+  IOScheduler* const scheduler_;
+  const IOScheduler::Priority priority_;
+  int64_t bytes_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedIO);
+};
+
+} // namespace fs
+} // namespace kudu
@@ -53,6 +53,7 @@
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/gutil/strings/util.h"
 #include "kudu/util/atomic.h"
+#include "kudu/util/countdown_latch.h"
 #include "kudu/util/env.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/path_util.h"
@@ -76,9 +77,11 @@ using strings::Substitute;
 
 DECLARE_bool(cache_force_single_shard);
 DECLARE_bool(crash_on_eio);
+DECLARE_bool(log_container_online_metadata_compaction);
 DECLARE_double(env_inject_eio);
 DECLARE_double(log_container_excess_space_before_cleanup_fraction);
 DECLARE_double(log_container_live_metadata_before_compact_ratio);
+DECLARE_int32(log_block_manager_open_threads_per_dir);
 DECLARE_int64(block_manager_max_open_files);
 DECLARE_int64(log_container_max_blocks);
 DECLARE_string(block_manager_preflush_control);
@@ -93,6 +96,7 @@ METRIC_DECLARE_counter(block_manager_total_blocks_deleted);
 METRIC_DECLARE_gauge_uint64(log_block_manager_bytes_under_management);
 METRIC_DECLARE_gauge_uint64(log_block_manager_blocks_under_management);
 METRIC_DECLARE_counter(log_block_manager_holes_punched);
+METRIC_DECLARE_gauge_uint64(log_block_manager_pending_deletion_bytes);
 METRIC_DECLARE_gauge_uint64(log_block_manager_containers);
 METRIC_DECLARE_gauge_uint64(log_block_manager_full_containers);
 
@@ -468,6 +472,55 @@ TEST_F(LogBlockManagerTest, MetricsTest) {
        {11, &METRIC_block_manager_total_blocks_deleted}}));
 }
 
+// Tests that holes queued by separate deletions are punched together once the
+// data directory's thread pool gets to them.
+TEST_F(LogBlockManagerTest, TestHolePunchBatching) {
+  MetricRegistry registry;
+  scoped_refptr<MetricEntity> entity =
+      METRIC_ENTITY_server.Instantiate(&registry, "test");
+  ASSERT_OK(ReopenBlockManager(entity));
+
+  // Create contiguous blocks in one container.
+  const int kNumBlocks = 10;
+  vector<BlockId> ids;
+  for (int i = 0; i < kNumBlocks; i++) {
+    unique_ptr<WritableBlock> block;
+    ASSERT_OK(bm_->CreateBlock(test_block_opts_, &block));
+    ASSERT_OK(block->Append("aaaa"));
+    ASSERT_OK(block->Close());
+    ids.push_back(block->id());
+  }
+  NO_FATALS(AssertNumContainers(1));
+
+  // Keep the thread pool busy while the blocks are deleted one transaction
+  // at a time.
+  CountDownLatch latch(1);
+  ASSERT_EQ(1, dd_manager_->data_dirs().size());
+  dd_manager_->data_dirs()[0]->ExecClosure(
+      Bind(&CountDownLatch::Wait, Unretained(&latch)));
+  for (const auto& id : ids) {
+    shared_ptr<BlockDeletionTransaction> deletion_transaction =
+        bm_->NewDeletionTransaction();
+    deletion_transaction->AddDeletedBlock(id);
+    vector<BlockId> deleted;
+    ASSERT_OK(deletion_transaction->CommitDeletedBlocks(&deleted));
+  }
+  AtomicGauge<uint64_t>* pending = down_cast<AtomicGauge<uint64_t>*>(
+      entity->FindOrNull(METRIC_log_block_manager_pending_deletion_bytes)
+          .get());
+  ASSERT_GE(pending->value(), kNumBlocks * 4);
+
+  // All of the deletions are coalesced into a single hole.
+  latch.CountDown();
+  dd_manager_->WaitOnClosures();
+  NO_FATALS(CheckLogMetrics(
+      entity,
+      {{0, &METRIC_log_block_manager_pending_deletion_bytes},
+       {0, &METRIC_log_block_manager_blocks_under_management}},
+      {{1, &METRIC_log_block_manager_holes_punched},
+       {kNumBlocks, &METRIC_block_manager_total_blocks_deleted}}));
+}
+
 TEST_F(LogBlockManagerTest, ContainerPreallocationTest) {
   string kTestData = "test data";
 
@@ -1519,10 +1572,53 @@ TEST_F(LogBlockManagerTest, TestDeleteDeadContainersAtStartup) {
   ASSERT_FALSE(env_->FileExists(metadata_file_name));
 }
 
+// Tests that containers opened concurrently yield the same block manager state
+// and report as containers opened one at a time.
+TEST_F(LogBlockManagerTest, TestParallelContainerOpen) {
+  const int kNumContainers = 50;
+
+  // Force every block into its own container.
+  FLAGS_log_container_max_size = 0;
+  vector<BlockId> ids;
+  for (int i = 0; i < kNumContainers; i++) {
+    unique_ptr<WritableBlock> block;
+    ASSERT_OK(bm_->CreateBlock(test_block_opts_, &block));
+    ASSERT_OK(block->Append("aaaa"));
+    ASSERT_OK(block->Close());
+    ids.push_back(block->id());
+  }
+
+  for (int num_threads : {1, 8}) {
+    FLAGS_log_block_manager_open_threads_per_dir = num_threads;
+    FsReport report;
+    ASSERT_OK(ReopenBlockManager(nullptr, &report));
+    ASSERT_EQ(kNumContainers, report.stats.lbm_container_count);
+    ASSERT_EQ(kNumContainers, report.stats.lbm_full_container_count);
+    ASSERT_EQ(kNumContainers, report.stats.live_block_count);
+
+    // Every data directory reports how long it took to open.
+    ASSERT_EQ(report.data_dirs.size(), report.data_dir_timings.size());
+    int64_t timed_containers = 0;
+    for (const auto& t : report.data_dir_timings) {
+      ASSERT_FALSE(t.dir.empty());
+      ASSERT_TRUE(t.load_time.Initialized());
+      timed_containers += t.container_count;
+    }
+    ASSERT_EQ(kNumContainers, timed_containers);
+
+    for (const auto& id : ids) {
+      unique_ptr<ReadableBlock> block;
+      ASSERT_OK(bm_->OpenBlock(id, &block));
+    }
+    NO_FATALS(AssertNumContainers(kNumContainers));
+  }
+}
+
 TEST_F(LogBlockManagerTest, TestCompactFullContainerMetadataAtStartup) {
   // With this ratio, the metadata of a full container comprised of half dead
   // blocks will be compacted at startup.
   FLAGS_log_container_live_metadata_before_compact_ratio = 0.50;
+  FLAGS_log_container_online_metadata_compaction = false;
 
   // Set an easy-to-test upper bound on container size.
   FLAGS_log_container_max_blocks = 10;
@@ -1581,6 +1677,74 @@ TEST_F(LogBlockManagerTest, TestCompactFullContainerMetadataAtStartup) {
   ASSERT_EQ(last_live_aligned_bytes, report.stats.live_block_bytes_aligned);
 }
 
+TEST_F(LogBlockManagerTest, TestOnlineMetadataCompaction) {
+  // With this ratio, the metadata of a full container comprised of half dead
+  // blocks will be compacted as soon as the last of them is deleted.
+  FLAGS_log_container_live_metadata_before_compact_ratio = 0.50;
+  FLAGS_log_container_max_blocks = 10;
+  ASSERT_OK(ReopenBlockManager());
+
+  vector<BlockId> block_ids;
+  for (int i = 0; i < FLAGS_log_container_max_blocks; i++) {
+    unique_ptr<WritableBlock> block;
+    ASSERT_OK(bm_->CreateBlock(test_block_opts_, &block));
+    ASSERT_OK(block->Append("a"));
+    ASSERT_OK(block->Close());
+    block_ids.emplace_back(block->id());
+  }
+  string metadata_file_name;
+  NO_FATALS(GetOnlyContainerMetadataFile(&metadata_file_name));
+  uint64_t pre_compaction_file_size;
+  ASSERT_OK(env_->GetFileSize(metadata_file_name, &pre_compaction_file_size));
+
+  auto delete_block = [&](const BlockId& id) {
+    shared_ptr<BlockDeletionTransaction> deletion_transaction =
+        bm_->NewDeletionTransaction();
+    deletion_transaction->AddDeletedBlock(id);
+    vector<BlockId> deleted;
+    ASSERT_OK(deletion_transaction->CommitDeletedBlocks(&deleted));
+  };
+
+  // Delete blocks without restarting; the metadata file should be compacted
+  // in the background once half of the blocks are dead.
+  int num_blocks_deleted = 0;
+  uint64_t post_compaction_file_size;
+  for (const auto& id : block_ids) {
+    NO_FATALS(delete_block(id));
+    num_blocks_deleted++;
+    dd_manager_->WaitOnClosures();
+    ASSERT_OK(
+        env_->GetFileSize(metadata_file_name, &post_compaction_file_size));
+    if (post_compaction_file_size < pre_compaction_file_size) {
+      break;
+    }
+  }
+  ASSERT_EQ(
+      FLAGS_log_container_max_blocks *
+          FLAGS_log_container_live_metadata_before_compact_ratio,
+      num_blocks_deleted);
+
+  // Deletions after the compaction land in the new metadata file, and the
+  // remaining blocks are still readable.
+  NO_FATALS(delete_block(block_ids[num_blocks_deleted]));
+  num_blocks_deleted++;
+  for (int i = num_blocks_deleted; i < block_ids.size(); i++) {
+    unique_ptr<ReadableBlock> block;
+    ASSERT_OK(bm_->OpenBlock(block_ids[i], &block));
+  }
+
+  // Nothing is left for startup to compact or repair.
+  FsReport report;
+  ASSERT_OK(ReopenBlockManager(nullptr, &report));
+  NO_FATALS(AssertEmptyReport(report));
+  ASSERT_EQ(
+      FLAGS_log_container_max_blocks - num_blocks_deleted,
+      report.stats.live_block_count);
+  uint64_t reopened_file_size;
+  ASSERT_OK(env_->GetFileSize(metadata_file_name, &reopened_file_size));
+  ASSERT_GT(reopened_file_size, post_compaction_file_size);
+}
+
 // Regression test for a bug in which, after a metadata file was compacted,
 // we would not properly handle appending to the new (post-compaction) metadata.
 //
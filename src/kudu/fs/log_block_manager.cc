@@ -47,6 +47,7 @@
 #include "kudu/gutil/bind_helpers.h"
 #include "kudu/gutil/callback.h"
 #include "kudu/gutil/casts.h"
+#include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/stl_util.h"
@@ -64,6 +65,7 @@
 #include "kudu/util/locks.h"
 #include "kudu/util/malloc.h"
 #include "kudu/util/metrics.h"
+#include "kudu/util/mutex.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/path_util.h"
 #include "kudu/util/pb_util.h"
@@ -73,6 +75,7 @@
 #include "kudu/util/slice.h"
 #include "kudu/util/sorted_disjoint_interval_list.h"
 #include "kudu/util/test_util_prod.h"
+#include "kudu/util/threadpool.h"
 #include "kudu/util/trace.h"
 
 DECLARE_bool(enable_data_block_fsync);
@@ -117,6 +120,16 @@ DEFINE_double(
     "the container's metadata file will be compacted at startup.");
 TAG_FLAG(log_container_live_metadata_before_compact_ratio, experimental);
 
+DEFINE_bool(
+    log_container_online_metadata_compaction,
+    true,
+    "Whether to compact the metadata of full log containers in the background "
+    "as soon as their live block ratio dips below "
+    "--log_container_live_metadata_before_compact_ratio, rather than waiting "
+    "for the next startup.");
+TAG_FLAG(log_container_online_metadata_compaction, experimental);
+TAG_FLAG(log_container_online_metadata_compaction, runtime);
+
 DEFINE_bool(
     log_block_manager_test_hole_punching,
     true,
@@ -124,6 +137,17 @@ DEFINE_bool(
 TAG_FLAG(log_block_manager_test_hole_punching, advanced);
 TAG_FLAG(log_block_manager_test_hole_punching, unsafe);
 
+DEFINE_int32(
+    log_block_manager_open_threads_per_dir,
+    4,
+    "Number of threads used to open the log block containers of each data "
+    "directory at startup. Containers in different data directories are "
+    "always opened in parallel.");
+DEFINE_validator(
+    log_block_manager_open_threads_per_dir,
+    [](const char* /*n*/, int32_t v) { return v > 0; });
+TAG_FLAG(log_block_manager_open_threads_per_dir, advanced);
+
 METRIC_DEFINE_gauge_uint64(
     server,
     log_block_manager_bytes_under_management,
@@ -152,6 +176,14 @@ METRIC_DEFINE_gauge_uint64(
     kudu::MetricUnit::kLogBlockContainers,
     "Number of full log block containers");
 
+METRIC_DEFINE_gauge_uint64(
+    server,
+    log_block_manager_pending_deletion_bytes,
+    "Bytes Pending Deletion",
+    kudu::MetricUnit::kBytes,
+    "Space used by deleted blocks that is queued to be reclaimed by hole "
+    "punching");
+
 METRIC_DEFINE_counter(
     server,
     log_block_manager_holes_punched,
@@ -159,6 +191,14 @@ METRIC_DEFINE_counter(
     kudu::MetricUnit::kHoles,
     "Number of holes punched since service start");
 
+METRIC_DEFINE_counter(
+    server,
+    log_block_manager_metadata_compactions,
+    "Number of Online Metadata Compactions",
+    kudu::MetricUnit::kLogBlockContainers,
+    "Number of log block container metadata files compacted in the "
+    "background since service start");
+
 namespace kudu {
 
 namespace fs {
@@ -171,6 +211,7 @@ using pb_util::ReadablePBContainerFile;
 using pb_util::WritablePBContainerFile;
 using std::accumulate;
 using std::map;
+using std::pair;
 using std::set;
 using std::shared_ptr;
 using std::string;
@@ -202,8 +243,10 @@ struct LogBlockManagerMetrics {
 
   scoped_refptr<AtomicGauge<uint64_t>> containers;
   scoped_refptr<AtomicGauge<uint64_t>> full_containers;
+  scoped_refptr<AtomicGauge<uint64_t>> pending_deletion_bytes;
 
   scoped_refptr<Counter> holes_punched;
+  scoped_refptr<Counter> metadata_compactions;
 };
 
 #define MINIT(x) x(METRIC_log_block_manager_##x.Instantiate(metric_entity))
@@ -215,7 +258,9 @@ LogBlockManagerMetrics::LogBlockManagerMetrics(
       GINIT(blocks_under_management),
       GINIT(containers),
       GINIT(full_containers),
-      MINIT(holes_punched) {}
+      GINIT(pending_deletion_bytes),
+      MINIT(holes_punched),
+      MINIT(metadata_compactions) {}
 #undef GINIT
 
 ////////////////////////////////////////////////////////////
@@ -328,10 +373,11 @@ class LogWritableBlock : public WritableBlock {
   // Starts an asynchronous flush of dirty block data to disk.
   Status FlushDataAsync();
 
-  // Write this block's metadata to disk.
+  // Fills in the record of this block's metadata, to be written to disk by
+  // the container.
   //
-  // Does not synchronize the written data; that takes place in Close().
-  Status AppendMetadata();
+  // The written data is synchronized in Close().
+  void BuildMetadataRecord(BlockRecordPB* record) const;
 
   LogBlockContainer* container() const {
     return container_;
@@ -411,8 +457,11 @@ class LogBlockContainer {
   // The on-disk effects of this call are made durable only after SyncData().
   Status PunchHole(int64_t offset, int64_t length);
 
-  // Executes a hole punching operation at 'offset' with the given 'length'.
-  void ContainerDeletionAsync(int64_t offset, int64_t length);
+  // Queues the [start, end) byte ranges in 'holes' to be punched on this
+  // container's data directory thread pool. Ranges queued before an earlier
+  // batch starts running join that batch and are coalesced with it, so a
+  // burst of deletions costs as few hole punches as possible.
+  void PunchHolesAsync(std::vector<std::pair<int64_t, int64_t>> holes);
 
   // Preallocate enough space to ensure that an append of 'next_append_length'
   // can be satisfied by this container. The offset of the beginning of this
@@ -440,8 +489,13 @@ class LogBlockContainer {
   //
   // The on-disk effects of this call are made durable only after
   // SyncMetadata().
+  //
+  // Blocks while the metadata file is being compacted.
   Status AppendMetadata(const BlockRecordPB& pb);
 
+  // Like AppendMetadata(), for several records written at once.
+  Status AppendMetadataBatch(const vector<BlockRecordPB>& pbs);
+
   // Asynchronously flush this container's data file from 'offset' through
   // to 'length'.
   //
@@ -469,8 +523,27 @@ class LogBlockContainer {
 
   // Reopen the metadata file record writer. Should be called if the underlying
   // file was changed.
+  //
+  // This function is thread unsafe.
   Status ReopenMetadataWriter();
 
+  // Schedules a background compaction of this container's metadata file if
+  // the container is full, its live block ratio has dipped below
+  // --log_container_live_metadata_before_compact_ratio, and no compaction is
+  // already scheduled.
+  void MaybeScheduleMetadataCompaction();
+
+  // Rewrites this container's metadata file with only its live block
+  // records. Appends to the metadata file wait for the rewrite to finish, but
+  // reads and writes of block data proceed concurrently.
+  Status CompactMetadata();
+
+  // Records that the metadata file now holds the CREATE records of just
+  // 'num_blocks' blocks, following a metadata compaction.
+  void MetadataCompacted(int64_t num_blocks) {
+    metadata_blocks_.Store(num_blocks);
+  }
+
   // Truncates this container's data file to 'next_block_offset_' if it is
   // full. This effectively removes any preallocated but unused space.
   //
@@ -516,6 +589,10 @@ class LogBlockContainer {
   // available.
   void FinalizeBlock(int64_t block_offset, int64_t block_length);
 
+  // Compacts this container's metadata file, logging any failure. Runs on
+  // the data directory's thread pool.
+  void CompactMetadataAsync();
+
   // Runs a task on this container's data directory thread pool.
   //
   // Normally the task is performed asynchronously. However, if submission to
@@ -609,6 +686,16 @@ class LogBlockContainer {
       uint64_t* data_file_size,
       uint64_t* max_block_id);
 
+  // Punches every hole queued by PunchHolesAsync() so far.
+  void PunchQueuedHoles();
+
+  // Reads the live block records from this container's metadata file, in the
+  // order in which they were written. Fails if the file holds any record that
+  // ProcessRecords() would report as an inconsistency.
+  //
+  // Must be called with 'metadata_lock_' held.
+  Status ReadLiveRecords(std::vector<BlockRecordPB>* records) const;
+
   // Updates this container data file's position based on the offset and length
   // of a block, marking this container as full if needed. Should only be called
   // when a block is fully written, as it will round up the container data
@@ -629,6 +716,10 @@ class LogBlockContainer {
   int64_t preallocated_offset_ = 0;
 
   // Opened file handles to the container's files.
+  //
+  // 'metadata_file_' is protected by 'metadata_lock_' once the container is
+  // open, as a background compaction may swap it for a new file.
+  Mutex metadata_lock_;
   unique_ptr<WritablePBContainerFile> metadata_file_;
   shared_ptr<RWFile> data_file_;
 
@@ -652,6 +743,19 @@ class LogBlockContainer {
   // The number of not-yet-deleted blocks in the container.
   AtomicInt<int64_t> live_blocks_;
 
+  // The number of blocks with a CREATE record in the metadata file. Equal to
+  // 'total_blocks_' until the metadata file is first compacted.
+  AtomicInt<int64_t> metadata_blocks_;
+
+  // Whether a background metadata compaction is scheduled or running.
+  AtomicBool metadata_compaction_scheduled_;
+
+  // Byte ranges waiting to be hole punched, and whether a task to punch them
+  // has been submitted but hasn't yet started.
+  simple_spinlock hole_punch_lock_;
+  std::vector<std::pair<int64_t, int64_t>> queued_holes_;
+  bool hole_punch_scheduled_ = false;
+
   // The metrics. Not owned by the log container; it has the same lifespan
   // as the block manager.
   const LogBlockManagerMetrics* metrics_;
@@ -682,6 +786,8 @@ LogBlockContainer::LogBlockContainer(
       live_bytes_(0),
       live_bytes_aligned_(0),
       live_blocks_(0),
+      metadata_blocks_(0),
+      metadata_compaction_scheduled_(false),
       metrics_(block_manager->metrics()) {}
 
 void LogBlockContainer::HandleError(const Status& s) const {
@@ -1012,14 +1118,19 @@ Status LogBlockContainer::DoCloseBlocks(
 
     // Append metadata only after data is synced so that there's
     // no chance of metadata landing on the disk before the data.
-    for (auto* block : blocks) {
-      RETURN_NOT_OK_PREPEND(
-          block->AppendMetadata(),
-          "unable to append block's metadata during close");
+    //
+    // All the records go out in a single write, and are made durable by a
+    // single sync below.
+    vector<BlockRecordPB> records(blocks.size());
+    for (size_t i = 0; i < blocks.size(); i++) {
+      blocks[i]->BuildMetadataRecord(&records[i]);
     }
+    RETURN_NOT_OK_PREPEND(
+        AppendMetadataBatch(records),
+        "unable to append blocks' metadata during close");
 
     if (mode == SYNC) {
-      VLOG(3) << "Syncing metadata file " << metadata_file_->filename();
+      VLOG(3) << "Syncing metadata file of container " << ToString();
       RETURN_NOT_OK(SyncMetadata());
     }
 
@@ -1100,10 +1211,24 @@ Status LogBlockContainer::AppendMetadata(const BlockRecordPB& pb) {
   RETURN_NOT_OK_HANDLE_ERROR(read_only_status());
   // Note: We don't check for sufficient disk space for metadata writes in
   // order to allow for block deletion on full disks.
+  std::lock_guard<Mutex> l(metadata_lock_);
   RETURN_NOT_OK_HANDLE_ERROR(metadata_file_->Append(pb));
   return Status::OK();
 }
 
+Status LogBlockContainer::AppendMetadataBatch(
+    const vector<BlockRecordPB>& pbs) {
+  RETURN_NOT_OK_HANDLE_ERROR(read_only_status());
+  vector<const google::protobuf::Message*> msgs;
+  msgs.reserve(pbs.size());
+  for (const auto& pb : pbs) {
+    msgs.push_back(&pb);
+  }
+  std::lock_guard<Mutex> l(metadata_lock_);
+  RETURN_NOT_OK_HANDLE_ERROR(metadata_file_->AppendBatch(msgs));
+  return Status::OK();
+}
+
 Status LogBlockContainer::FlushData(int64_t offset, int64_t length) {
   RETURN_NOT_OK_HANDLE_ERROR(read_only_status());
   DCHECK_GE(offset, 0);
@@ -1115,6 +1240,7 @@ Status LogBlockContainer::FlushData(int64_t offset, int64_t length) {
 
 Status LogBlockContainer::FlushMetadata() {
   RETURN_NOT_OK_HANDLE_ERROR(read_only_status());
+  std::lock_guard<Mutex> l(metadata_lock_);
   RETURN_NOT_OK_HANDLE_ERROR(metadata_file_->Flush());
   return Status::OK();
 }
@@ -1134,6 +1260,7 @@ Status LogBlockContainer::SyncMetadata() {
   if (FLAGS_enable_data_block_fsync) {
     if (metrics_)
       metrics_->generic_metrics.total_disk_sync->Increment();
+    std::lock_guard<Mutex> l(metadata_lock_);
     RETURN_NOT_OK_HANDLE_ERROR(metadata_file_->Sync());
   }
   return Status::OK();
@@ -1243,6 +1370,7 @@ void LogBlockContainer::BlockCreated(const scoped_refptr<LogBlock>& block) {
   live_bytes_.IncrementBy(block->length());
   live_bytes_aligned_.IncrementBy(block->fs_aligned_length());
   live_blocks_.Increment();
+  metadata_blocks_.Increment();
 }
 
 void LogBlockContainer::BlockDeleted(const scoped_refptr<LogBlock>& block) {
@@ -1253,6 +1381,122 @@ void LogBlockContainer::BlockDeleted(const scoped_refptr<LogBlock>& block) {
   live_blocks_.IncrementBy(-1);
 }
 
+void LogBlockContainer::MaybeScheduleMetadataCompaction() {
+  if (!FLAGS_log_container_online_metadata_compaction ||
+      block_manager_->opts_.read_only || !full() ||
+      !read_only_status().ok()) {
+    return;
+  }
+  int64_t metadata_blocks = metadata_blocks_.Load();
+  if (metadata_blocks == 0 ||
+      static_cast<double>(live_blocks()) / metadata_blocks >
+          FLAGS_log_container_live_metadata_before_compact_ratio) {
+    return;
+  }
+  if (!metadata_compaction_scheduled_.CompareAndSet(false, true)) {
+    return;
+  }
+  ExecClosure(
+      Bind(&LogBlockContainer::CompactMetadataAsync, Unretained(this)));
+}
+
+Status LogBlockContainer::CompactMetadata() {
+  RETURN_NOT_OK_HANDLE_ERROR(read_only_status());
+  std::lock_guard<Mutex> l(metadata_lock_);
+  vector<BlockRecordPB> records;
+  RETURN_NOT_OK(ReadLiveRecords(&records));
+
+  int64_t file_bytes_delta;
+  RETURN_NOT_OK(
+      block_manager_->RewriteMetadataFile(*this, records, &file_bytes_delta));
+
+  // The old metadata file is gone, so any failure from here on leaves us
+  // unable to append to the container.
+  Status s = block_manager_->env()->SyncDir(data_dir_->dir());
+  if (s.ok()) {
+    s = ReopenMetadataWriter();
+  }
+  if (!s.ok()) {
+    HandleError(s);
+    SetReadOnly(s);
+    return s.CloneAndPrepend("could not reopen compacted metadata file");
+  }
+  MetadataCompacted(records.size());
+  if (metrics_) {
+    metrics_->metadata_compactions->Increment();
+  }
+  VLOG(1) << "Compacted metadata file of container " << ToString()
+          << " (saved " << file_bytes_delta << " bytes)";
+  return Status::OK();
+}
+
+void LogBlockContainer::CompactMetadataAsync() {
+  WARN_NOT_OK(
+      CompactMetadata(),
+      Substitute("could not compact metadata of container $0", ToString()));
+  metadata_compaction_scheduled_.Store(false);
+}
+
+Status LogBlockContainer::ReadLiveRecords(
+    vector<BlockRecordPB>* records) const {
+  unique_ptr<RandomAccessFile> metadata_reader;
+  RETURN_NOT_OK_HANDLE_ERROR(block_manager()->env()->NewRandomAccessFile(
+      metadata_file_->filename(), &metadata_reader));
+  ReadablePBContainerFile pb_reader(std::move(metadata_reader));
+  RETURN_NOT_OK_HANDLE_ERROR(pb_reader.Open());
+
+  // All records, with deleted blocks' CREATE records cleared, and the index
+  // of each live block's CREATE record.
+  vector<BlockRecordPB> all_records;
+  unordered_map<BlockId, size_t, BlockIdHash, BlockIdEqual> live;
+  Status read_status;
+  while (true) {
+    BlockRecordPB record;
+    read_status = pb_reader.ReadNextPB(&record);
+    if (!read_status.ok()) {
+      break;
+    }
+    const BlockId block_id(BlockId::FromPB(record.block_id()));
+    switch (record.op_type()) {
+      case CREATE:
+        if (!InsertIfNotPresent(&live, block_id, all_records.size())) {
+          return Status::Corruption(
+              "duplicate CREATE record", block_id.ToString());
+        }
+        all_records.emplace_back();
+        all_records.back().Swap(&record);
+        break;
+      case DELETE: {
+        auto it = live.find(block_id);
+        if (it == live.end()) {
+          return Status::Corruption(
+              "DELETE record without CREATE record", block_id.ToString());
+        }
+        all_records[it->second].Clear();
+        live.erase(it);
+        break;
+      }
+      default:
+        return Status::Corruption(
+            "unknown record type", block_id.ToString());
+    }
+  }
+  if (!read_status.IsEndOfFile()) {
+    HandleError(read_status);
+    return read_status;
+  }
+
+  records->clear();
+  records->reserve(live.size());
+  for (auto& r : all_records) {
+    if (r.has_op_type()) {
+      records->emplace_back();
+      records->back().Swap(&r);
+    }
+  }
+  return Status::OK();
+}
+
 void LogBlockContainer::ExecClosure(const Closure& task) {
   data_dir_->ExecClosure(task);
 }
@@ -1272,14 +1516,61 @@ void LogBlockContainer::SetReadOnly(const Status& error) {
   read_only_status_ = error;
 }
 
-void LogBlockContainer::ContainerDeletionAsync(int64_t offset, int64_t length) {
-  VLOG(3) << "Freeing space belonging to container " << ToString();
-  Status s = PunchHole(offset, length);
-  if (s.ok() && metrics_)
-    metrics_->holes_punched->Increment();
-  WARN_NOT_OK(
-      s,
-      Substitute("could not delete blocks in container $0", data_dir()->dir()));
+void LogBlockContainer::PunchHolesAsync(vector<pair<int64_t, int64_t>> holes) {
+  if (holes.empty()) {
+    return;
+  }
+  int64_t bytes = 0;
+  for (const auto& h : holes) {
+    bytes += h.second - h.first;
+  }
+  if (metrics_) {
+    metrics_->pending_deletion_bytes->IncrementBy(bytes);
+  }
+  bool schedule;
+  {
+    std::lock_guard<simple_spinlock> l(hole_punch_lock_);
+    queued_holes_.insert(queued_holes_.end(), holes.begin(), holes.end());
+    schedule = !hole_punch_scheduled_;
+    hole_punch_scheduled_ = true;
+  }
+  if (schedule) {
+    ExecClosure(Bind(&LogBlockContainer::PunchQueuedHoles, Unretained(this)));
+  }
+}
+
+void LogBlockContainer::PunchQueuedHoles() {
+  vector<pair<int64_t, int64_t>> holes;
+  {
+    std::lock_guard<simple_spinlock> l(hole_punch_lock_);
+    holes.swap(queued_holes_);
+    hole_punch_scheduled_ = false;
+  }
+  int64_t bytes = 0;
+  for (const auto& h : holes) {
+    bytes += h.second - h.first;
+  }
+  CHECK_OK_PREPEND(
+      CoalesceIntervals<int64_t>(&holes),
+      Substitute(
+          "could not coalesce hole punching for container: $0", ToString()));
+
+  VLOG(3) << Substitute(
+      "Freeing space belonging to container $0 ($1 holes)",
+      ToString(),
+      holes.size());
+  for (const auto& h : holes) {
+    Status s = PunchHole(h.first, h.second - h.first);
+    if (s.ok() && metrics_)
+      metrics_->holes_punched->Increment();
+    WARN_NOT_OK(
+        s,
+        Substitute(
+            "could not delete blocks in container $0", data_dir()->dir()));
+  }
+  if (metrics_) {
+    metrics_->pending_deletion_bytes->DecrementBy(bytes);
+  }
 }
 
 ///////////////////////////////////////////////////////////
@@ -1346,8 +1637,9 @@ class LogBlockDeletionTransaction
   explicit LogBlockDeletionTransaction(LogBlockManager* lbm) : lbm_(lbm) {}
 
   // Given the shared ownership of LogBlockDeletionTransaction, at this point
-  // all registered blocks should be destructed. Thus, coalescing deletions
-  // for blocks that are contiguous in a container and schedules hole punching.
+  // all registered blocks should be destructed. Thus, schedules hole punching
+  // for the deleted blocks of each container; contiguous blocks are coalesced
+  // when the holes are punched.
   virtual ~LogBlockDeletionTransaction();
 
   virtual void AddDeletedBlock(BlockId block) override;
@@ -1378,20 +1670,7 @@ void LogBlockDeletionTransaction::AddDeletedBlock(BlockId block) {
 
 LogBlockDeletionTransaction::~LogBlockDeletionTransaction() {
   for (auto& entry : deleted_interval_map_) {
-    LogBlockContainer* container = entry.first;
-    CHECK_OK_PREPEND(
-        CoalesceIntervals<int64_t>(&entry.second),
-        Substitute(
-            "could not coalesce hole punching for container: $0",
-            container->ToString()));
-
-    for (const auto& interval : entry.second) {
-      container->ExecClosure(Bind(
-          &LogBlockContainer::ContainerDeletionAsync,
-          Unretained(container),
-          interval.first,
-          interval.second - interval.first));
-    }
+    entry.first->PunchHolesAsync(std::move(entry.second));
   }
 }
 
@@ -1665,14 +1944,12 @@ void LogWritableBlock::DoClose() {
   state_ = CLOSED;
 }
 
-Status LogWritableBlock::AppendMetadata() {
-  BlockRecordPB record;
-  id().CopyToPB(record.mutable_block_id());
-  record.set_op_type(CREATE);
-  record.set_timestamp_us(GetCurrentTimeMicros());
-  record.set_offset(block_offset_);
-  record.set_length(block_length_);
-  return container_->AppendMetadata(record);
+void LogWritableBlock::BuildMetadataRecord(BlockRecordPB* record) const {
+  id().CopyToPB(record->mutable_block_id());
+  record->set_op_type(CREATE);
+  record->set_timestamp_us(GetCurrentTimeMicros());
+  record->set_offset(block_offset_);
+  record->set_length(block_length_);
 }
 
 ////////////////////////////////////////////////////////////
@@ -2285,6 +2562,7 @@ Status LogBlockManager::RemoveLogBlocks(
       }
     } else {
       deleted->emplace_back(lb->block_id());
+      lb->container()->MaybeScheduleMetadataCompaction();
       log_blocks->emplace_back(std::move(lb));
     }
   }
@@ -2330,12 +2608,46 @@ Status LogBlockManager::RemoveLogBlockUnlocked(
   return Status::OK();
 }
 
+// The outcome of opening a single container, to be merged into its data
+// directory's report and repair lists once all containers are open.
+struct LogBlockManager::ContainerOpenResult {
+  ContainerOpenResult() {
+    // The same checks as in OpenDataDir(), so the reports can be merged.
+    report.full_container_space_check.emplace();
+    report.incomplete_container_check.emplace();
+    report.malformed_record_check.emplace();
+    report.misaligned_block_check.emplace();
+    report.partial_record_check.emplace();
+  }
+
+  string name;
+
+  // The container's path without a file suffix, once open.
+  string path;
+
+  Status status;
+  FsReport report;
+
+  // Deleted blocks whose space hasn't been punched.
+  vector<scoped_refptr<internal::LogBlock>> need_repunching;
+
+  // Whether the container has nothing but dead blocks.
+  bool dead = false;
+
+  // Whether the container's live block ratio is low, and if so, its live
+  // block records in on-disk order.
+  bool low_live = false;
+  vector<BlockRecordPB> low_live_block_records;
+};
+
 void LogBlockManager::OpenDataDir(
     DataDir* dir,
     FsReport* report,
     Status* result_status) {
   FsReport local_report;
   local_report.data_dirs.push_back(dir->dir());
+  FsReport::DataDirTiming timing;
+  timing.dir = dir->dir();
 
   // We are going to perform these checks.
   //
@@ -2347,19 +2659,8 @@ void LogBlockManager::OpenDataDir(
   local_report.misaligned_block_check.emplace();
   local_report.partial_record_check.emplace();
 
-  // Keep track of deleted blocks whose space hasn't been punched; they will
-  // be repunched during repair.
-  vector<scoped_refptr<internal::LogBlock>> need_repunching;
-
-  // Keep track of containers that have nothing but dead blocks; they will be
-  // deleted during repair.
-  vector<string> dead_containers;
-
-  // Keep track of containers whose live block ratio is low; their metadata
-  // files will be compacted during repair.
-  unordered_map<string, vector<BlockRecordPB>> low_live_block_containers;
-
-  // Find all containers and open them.
+  // Find all containers.
+  MonoTime start = MonoTime::Now();
   unordered_set<string> containers_seen;
   vector<string> children;
   Status s = env_->GetChildren(dir->dir(), &children);
@@ -2372,7 +2673,7 @@ void LogBlockManager::OpenDataDir(
         Substitute("Could not list children of $0", dir->dir()));
     return;
   }
-  MonoTime last_opened_container_log_time = MonoTime::Now();
+  vector<ContainerOpenResult> results;
   for (const string& child : children) {
     string container_name;
     if (!TryStripSuffixString(
@@ -2388,222 +2689,108 @@ void LogBlockManager::OpenDataDir(
     if (!InsertIfNotPresent(&containers_seen, container_name)) {
       continue;
     }
-
-    unique_ptr<LogBlockContainer> container;
-    s = LogBlockContainer::Open(
-        this, dir, &local_report, container_name, &container);
-    if (s.IsAborted()) {
-      // Skip the container. Open() added a record of it to 'local_report' for
-      // us.
-      continue;
-    }
-    if (!s.ok()) {
-      *result_status = s.CloneAndPrepend(
-          Substitute("Could not open container $0", container_name));
-      return;
-    }
-
-    // Process the records, building a container-local map for live blocks and
-    // a list of dead blocks.
-    //
-    // It's important that we don't try to add these blocks to the global map
-    // incrementally as we see each record, since it's possible that one
-    // container has a "CREATE <b>" while another has a "CREATE <b> ; DELETE
-    // <b>" pair. If we processed those two containers in this order, then upon
-    // processing the second container, we'd think there was a duplicate block.
-    // Building the container-local map first ensures that we discount deleted
-    // blocks before checking for duplicate IDs.
-    //
-    // NOTE: Since KUDU-1538, we allocate sequential block IDs, which makes
-    // reuse exceedingly unlikely. However, we might have old data which still
-    // exhibits the above issue.
-    UntrackedBlockMap live_blocks;
-    BlockRecordMap live_block_records;
-    vector<scoped_refptr<internal::LogBlock>> dead_blocks;
-    uint64_t max_block_id = 0;
-    s = container->ProcessRecords(
-        &local_report,
-        &live_blocks,
-        &live_block_records,
-        &dead_blocks,
-        &max_block_id);
+    results.emplace_back();
+    results.back().name = std::move(container_name);
+  }
+  MonoTime listed = MonoTime::Now();
+  timing.list_time = listed - start;
+  timing.container_count = results.size();
+
+  // Open the containers. Opening is dominated by reading and parsing metadata
+  // files, so several containers of a directory are opened at once; they
+  // share a lock only when merged into the global block map.
+  AtomicInt<int64_t> num_opened(0);
+  auto open_one = [this, dir, &num_opened](ContainerOpenResult* r) {
+    OpenContainer(dir, r->name, r);
+    num_opened.Increment();
+  };
+  static const MonoDelta kProgressInterval = MonoDelta::FromSeconds(10);
+  int num_threads = std::min<int64_t>(
+      FLAGS_log_block_manager_open_threads_per_dir, results.size());
+  gscoped_ptr<ThreadPool> pool;
+  if (num_threads > 1) {
+    s = ThreadPoolBuilder("lbm-open")
+            .set_min_threads(num_threads)
+            .set_max_threads(num_threads)
+            .Build(&pool);
     if (!s.ok()) {
-      *result_status = s.CloneAndPrepend(Substitute(
-          "Could not process records in container $0", container->ToString()));
-      return;
+      LOG(WARNING) << Substitute(
+          "Could not create thread pool to open containers in $0, opening "
+          "them serially: $1",
+          dir->dir(),
+          s.ToString());
+      pool.reset();
     }
-
-    // With deleted blocks out of the way, check for misaligned blocks.
-    //
-    // We could also enforce that the record's offset is aligned with the
-    // underlying filesystem's block size, an invariant maintained by the log
-    // block manager. However, due to KUDU-1793, that invariant may have been
-    // broken, so we'll note but otherwise allow it.
-    for (const auto& e : live_blocks) {
-      if (PREDICT_FALSE(
-              e.second->offset() %
-                  container->instance()->filesystem_block_size_bytes() !=
-              0)) {
-        local_report.misaligned_block_check->entries.emplace_back(
-            container->ToString(), e.first);
-      }
-    }
-
-    if (container->full()) {
-      // Full containers without any live blocks can be deleted outright.
-      //
-      // TODO(adar): this should be reported as an inconsistency once dead
-      // container deletion is also done in real time. Until then, it would be
-      // confusing to report it as such since it'll be a natural event at
-      // startup.
-      if (container->live_blocks() == 0) {
-        DCHECK(live_blocks.empty());
-        dead_containers.emplace_back(container->ToString());
-      } else if (
-          static_cast<double>(container->live_blocks()) /
-              container->total_blocks() <=
-          FLAGS_log_container_live_metadata_before_compact_ratio) {
-        // Metadata files of containers with very few live blocks will be
-        // compacted.
-        //
-        // TODO(adar): this should be reported as an inconsistency once
-        // container metadata compaction is also done in realtime. Until then,
-        // it would be confusing to report it as such since it'll be a natural
-        // event at startup.
-        vector<BlockRecordPB> records(live_block_records.size());
-        int i = 0;
-        for (auto& e : live_block_records) {
-          records[i].Swap(&e.second);
-          i++;
-        }
-
-        // Sort the records such that their ordering reflects the ordering in
-        // the pre-compacted metadata file.
-        //
-        // This is preferred to storing the records in an order-preserving
-        // container (such as std::map) because while records are temporarily
-        // retained for every container, only some containers will actually
-        // undergo metadata compaction.
-        std::sort(
-            records.begin(),
-            records.end(),
-            [](const BlockRecordPB& a, const BlockRecordPB& b) {
-              // Sort by timestamp.
-              if (a.timestamp_us() != b.timestamp_us()) {
-                return a.timestamp_us() < b.timestamp_us();
-              }
-
-              // If the timestamps match, sort by offset.
-              //
-              // If the offsets also match (i.e. both blocks are of zero
-              // length), it doesn't matter which of the two records comes
-              // first.
-              return a.offset() < b.offset();
-            });
-
-        low_live_block_containers[container->ToString()] = std::move(records);
-      }
-
-      // Having processed the block records, let's check whether any full
-      // containers have any extra space (left behind after a crash or from an
-      // older version of Kudu).
-      //
-      // Filesystems are unpredictable beasts and may misreport the amount of
-      // space allocated to a file in various interesting ways. Some examples:
-      // - XFS's speculative preallocation feature may artificially enlarge the
-      //   container's data file without updating its file size. This makes the
-      //   file size untrustworthy for the purposes of measuring allocated
-      //   space. See KUDU-1856 for more details.
-      // - On el6.6/ext4 a container data file that consumed ~32K according to
-      //   its extent tree was actually reported as consuming an additional fs
-      //   block (2k) of disk space. A similar container data file (generated
-      //   via the same workload) on Ubuntu 16.04/ext4 did not exhibit this.
-      //   The suspicion is that older versions of ext4 include interior nodes
-      //   of the extent tree when reporting file block usage.
-      //
-      // To deal with these issues, our extra space cleanup code (deleted block
-      // repunching and container truncation) is gated on an "actual disk space
-      // consumed" heuristic. To prevent unnecessary triggering of the
-      // heuristic, we allow for some slop in our size measurements. The exact
-      // amount of slop is configurable via
-      // log_container_excess_space_before_cleanup_fraction.
-      //
-      // Too little slop and we'll do unnecessary work at startup. Too much and
-      // more unused space may go unreclaimed.
-      string data_filename =
-          StrCat(container->ToString(), kContainerDataFileSuffix);
-      uint64_t reported_size;
-      s = env_->GetFileSizeOnDisk(data_filename, &reported_size);
-      if (!s.ok()) {
-        HANDLE_DISK_FAILURE(
-            s,
-            error_manager_->RunErrorNotificationCb(
-                ErrorHandlerType::DISK_ERROR, dir));
-        *result_status = s.CloneAndPrepend(Substitute(
-            "Could not get on-disk file size of container $0",
-            container->ToString()));
-        return;
-      }
-      int64_t cleanup_threshold_size = container->live_bytes_aligned() *
-          (1 + FLAGS_log_container_excess_space_before_cleanup_fraction);
-      if (reported_size > cleanup_threshold_size) {
-        local_report.full_container_space_check->entries.emplace_back(
-            container->ToString(),
-            reported_size - container->live_bytes_aligned());
-
-        // If the container is to be deleted outright, don't bother repunching
-        // its blocks. The report entry remains, however, so it's clear that
-        // there was a space discrepancy.
-        if (container->live_blocks()) {
-          need_repunching.insert(
-              need_repunching.end(), dead_blocks.begin(), dead_blocks.end());
-        }
+  }
+  if (pool) {
+    for (auto& r : results) {
+      ContainerOpenResult* rp = &r;
+      if (!pool->SubmitFunc([open_one, rp]() { open_one(rp); }).ok()) {
+        open_one(rp);
       }
-
-      local_report.stats.lbm_full_container_count++;
     }
-    local_report.stats.live_block_bytes += container->live_bytes();
-    local_report.stats.live_block_bytes_aligned +=
-        container->live_bytes_aligned();
-    local_report.stats.live_block_count += container->live_blocks();
-    local_report.stats.lbm_container_count++;
-
-    // Log number of containers opened every 10 seconds
-    MonoTime now = MonoTime::Now();
-    if ((now - last_opened_container_log_time).ToSeconds() > 10) {
+    // Log the number of containers opened every 10 seconds.
+    while (!pool->WaitFor(kProgressInterval)) {
       LOG(INFO) << Substitute(
-          "Opened $0 log block containers in $1",
-          local_report.stats.lbm_container_count,
+          "Opened $0 of $1 log block containers in $2",
+          num_opened.Load(),
+          results.size(),
           dir->dir());
-      last_opened_container_log_time = now;
     }
+    pool->Shutdown();
+  } else {
+    MonoTime last_opened_container_log_time = MonoTime::Now();
+    for (auto& r : results) {
+      open_one(&r);
+
+      // Log the number of containers opened every 10 seconds.
+      MonoTime now = MonoTime::Now();
+      if (now - last_opened_container_log_time > kProgressInterval) {
+        LOG(INFO) << Substitute(
+            "Opened $0 of $1 log block containers in $2",
+            num_opened.Load(),
+            results.size(),
+            dir->dir());
+        last_opened_container_log_time = now;
+      }
+    }
+  }
 
-    next_block_id_.StoreMax(max_block_id + 1);
+  // Merge the per-container results in directory order, just as if they had
+  // been opened one after another.
+  //
+  // Keep track of deleted blocks whose space hasn't been punched; they will
+  // be repunched during repair.
+  vector<scoped_refptr<internal::LogBlock>> need_repunching;
 
-    // Under the lock, merge this map into the main block map and add
-    // the container.
-    {
-      std::lock_guard<simple_spinlock> l(lock_);
-      // To avoid cacheline contention during startup, we aggregate all of the
-      // memory in a local and add it to the mem-tracker in a single increment
-      // at the end of this loop.
-      int64_t mem_usage = 0;
-      for (UntrackedBlockMap::value_type& e : live_blocks) {
-        int block_mem = kudu_malloc_usable_size(e.second.get());
-        if (!AddLogBlockUnlocked(std::move(e.second))) {
-          // TODO(adar): track as an inconsistency?
-          LOG(FATAL) << "Found duplicate CREATE record for block " << e.first
-                     << " which already is alive from another container when "
-                     << " processing container " << container->ToString();
-        }
-        mem_usage += block_mem;
-      }
+  // Keep track of containers that have nothing but dead blocks; they will be
+  // deleted during repair.
+  vector<string> dead_containers;
 
-      mem_tracker_->Consume(mem_usage);
-      AddNewContainerUnlocked(container.get());
-      MakeContainerAvailableUnlocked(container.release());
+  // Keep track of containers whose live block ratio is low; their metadata
+  // files will be compacted during repair.
+  unordered_map<string, vector<BlockRecordPB>> low_live_block_containers;
+  for (auto& r : results) {
+    if (!r.status.ok()) {
+      *result_status = r.status;
+      return;
+    }
+    local_report.MergeFrom(r.report);
+    need_repunching.insert(
+        need_repunching.end(),
+        r.need_repunching.begin(),
+        r.need_repunching.end());
+    if (r.dead) {
+      dead_containers.emplace_back(r.path);
+    }
+    if (r.low_live) {
+      low_live_block_containers[r.path] =
+          std::move(r.low_live_block_records);
     }
   }
+  results.clear();
+  MonoTime loaded = MonoTime::Now();
+  timing.load_time = loaded - listed;
 
   // Like the rest of Open(), repairs are performed per data directory to take
   // advantage of parallelism.
@@ -2619,11 +2806,224 @@ void LogBlockManager::OpenDataDir(
         dir->dir()));
     return;
   }
+  timing.repair_time = MonoTime::Now() - loaded;
+  local_report.data_dir_timings.emplace_back(std::move(timing));
 
   *report = std::move(local_report);
   *result_status = Status::OK();
 }
 
+void LogBlockManager::OpenContainer(
+    DataDir* dir,
+    const string& container_name,
+    ContainerOpenResult* result) {
+  unique_ptr<LogBlockContainer> container;
+  Status s = LogBlockContainer::Open(
+      this, dir, &result->report, container_name, &container);
+  if (s.IsAborted()) {
+    // Skip the container. Open() added a record of it to 'result->report' for
+    // us.
+    return;
+  }
+  if (!s.ok()) {
+    result->status = s.CloneAndPrepend(
+        Substitute("Could not open container $0", container_name));
+    return;
+  }
+  result->path = container->ToString();
+
+  // Process the records, building a container-local map for live blocks and
+  // a list of dead blocks.
+  //
+  // It's important that we don't try to add these blocks to the global map
+  // incrementally as we see each record, since it's possible that one
+  // container has a "CREATE <b>" while another has a "CREATE <b> ; DELETE
+  // <b>" pair. If we processed those two containers in this order, then upon
+  // processing the second container, we'd think there was a duplicate block.
+  // Building the container-local map first ensures that we discount deleted
+  // blocks before checking for duplicate IDs.
+  //
+  // NOTE: Since KUDU-1538, we allocate sequential block IDs, which makes
+  // reuse exceedingly unlikely. However, we might have old data which still
+  // exhibits the above issue.
+  UntrackedBlockMap live_blocks;
+  BlockRecordMap live_block_records;
+  vector<scoped_refptr<internal::LogBlock>> dead_blocks;
+  uint64_t max_block_id = 0;
+  s = container->ProcessRecords(
+      &result->report,
+      &live_blocks,
+      &live_block_records,
+      &dead_blocks,
+      &max_block_id);
+  if (!s.ok()) {
+    result->status = s.CloneAndPrepend(Substitute(
+        "Could not process records in container $0", container->ToString()));
+    return;
+  }
+
+  // With deleted blocks out of the way, check for misaligned blocks.
+  //
+  // We could also enforce that the record's offset is aligned with the
+  // underlying filesystem's block size, an invariant maintained by the log
+  // block manager. However, due to KUDU-1793, that invariant may have been
+  // broken, so we'll note but otherwise allow it.
+  for (const auto& e : live_blocks) {
+    if (PREDICT_FALSE(
+            e.second->offset() %
+                container->instance()->filesystem_block_size_bytes() !=
+            0)) {
+      result->report.misaligned_block_check->entries.emplace_back(
+          container->ToString(), e.first);
+    }
+  }
+
+  if (container->full()) {
+    // Full containers without any live blocks can be deleted outright.
+    //
+    // TODO(adar): this should be reported as an inconsistency once dead
+    // container deletion is also done in real time. Until then, it would be
+    // confusing to report it as such since it'll be a natural event at
+    // startup.
+    if (container->live_blocks() == 0) {
+      DCHECK(live_blocks.empty());
+      result->dead = true;
+    } else if (
+        static_cast<double>(container->live_blocks()) /
+            container->total_blocks() <=
+        FLAGS_log_container_live_metadata_before_compact_ratio) {
+      // Metadata files of containers with very few live blocks will be
+      // compacted.
+      //
+      // TODO(adar): this should be reported as an inconsistency once
+      // container metadata compaction is also done in realtime. Until then,
+      // it would be confusing to report it as such since it'll be a natural
+      // event at startup.
+      vector<BlockRecordPB> records(live_block_records.size());
+      int i = 0;
+      for (auto& e : live_block_records) {
+        records[i].Swap(&e.second);
+        i++;
+      }
+
+      // Sort the records such that their ordering reflects the ordering in
+      // the pre-compacted metadata file.
+      //
+      // This is preferred to storing the records in an order-preserving
+      // container (such as std::map) because while records are temporarily
+      // retained for every container, only some containers will actually
+      // undergo metadata compaction.
+      std::sort(
+          records.begin(),
+          records.end(),
+          [](const BlockRecordPB& a, const BlockRecordPB& b) {
+            // Sort by timestamp.
+            if (a.timestamp_us() != b.timestamp_us()) {
+              return a.timestamp_us() < b.timestamp_us();
+            }
+
+            // If the timestamps match, sort by offset.
+            //
+            // If the offsets also match (i.e. both blocks are of zero
+            // length), it doesn't matter which of the two records comes
+            // first.
+            return a.offset() < b.offset();
+          });
+
+      result->low_live_block_records = std::move(records);
+      result->low_live = true;
+    }
+
+    // Having processed the block records, let's check whether any full
+    // containers have any extra space (left behind after a crash or from an
+    // older version of Kudu).
+    //
+    // Filesystems are unpredictable beasts and may misreport the amount of
+    // space allocated to a file in various interesting ways. Some examples:
+    // - XFS's speculative preallocation feature may artificially enlarge the
+    //   container's data file without updating its file size. This makes the
+    //   file size untrustworthy for the purposes of measuring allocated
+    //   space. See KUDU-1856 for more details.
+    // - On el6.6/ext4 a container data file that consumed ~32K according to
+    //   its extent tree was actually reported as consuming an additional fs
+    //   block (2k) of disk space. A similar container data file (generated
+    //   via the same workload) on Ubuntu 16.04/ext4 did not exhibit this.
+    //   The suspicion is that older versions of ext4 include interior nodes
+    //   of the extent tree when reporting file block usage.
+    //
+    // To deal with these issues, our extra space cleanup code (deleted block
+    // repunching and container truncation) is gated on an "actual disk space
+    // consumed" heuristic. To prevent unnecessary triggering of the
+    // heuristic, we allow for some slop in our size measurements. The exact
+    // amount of slop is configurable via
+    // log_container_excess_space_before_cleanup_fraction.
+    //
+    // Too little slop and we'll do unnecessary work at startup. Too much and
+    // more unused space may go unreclaimed.
+    string data_filename =
+        StrCat(container->ToString(), kContainerDataFileSuffix);
+    uint64_t reported_size;
+    s = env_->GetFileSizeOnDisk(data_filename, &reported_size);
+    if (!s.ok()) {
+      HANDLE_DISK_FAILURE(
+          s,
+          error_manager_->RunErrorNotificationCb(
+              ErrorHandlerType::DISK_ERROR, dir));
+      result->status = s.CloneAndPrepend(Substitute(
+          "Could not get on-disk file size of container $0",
+          container->ToString()));
+      return;
+    }
+    int64_t cleanup_threshold_size = container->live_bytes_aligned() *
+        (1 + FLAGS_log_container_excess_space_before_cleanup_fraction);
+    if (reported_size > cleanup_threshold_size) {
+      result->report.full_container_space_check->entries.emplace_back(
+          container->ToString(),
+          reported_size - container->live_bytes_aligned());
+
+      // If the container is to be deleted outright, don't bother repunching
+      // its blocks. The report entry remains, however, so it's clear that
+      // there was a space discrepancy.
+      if (container->live_blocks()) {
+        result->need_repunching = std::move(dead_blocks);
+      }
+    }
+
+    result->report.stats.lbm_full_container_count++;
+  }
+  result->report.stats.live_block_bytes += container->live_bytes();
+  result->report.stats.live_block_bytes_aligned +=
+      container->live_bytes_aligned();
+  result->report.stats.live_block_count += container->live_blocks();
+  result->report.stats.lbm_container_count++;
+
+  next_block_id_.StoreMax(max_block_id + 1);
+
+  // Under the lock, merge this map into the main block map and add
+  // the container.
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    // To avoid cacheline contention during startup, we aggregate all of the
+    // memory in a local and add it to the mem-tracker in a single increment
+    // once every block is added.
+    int64_t mem_usage = 0;
+    for (UntrackedBlockMap::value_type& e : live_blocks) {
+      int block_mem = kudu_malloc_usable_size(e.second.get());
+      if (!AddLogBlockUnlocked(std::move(e.second))) {
+        // TODO(adar): track as an inconsistency?
+        LOG(FATAL) << "Found duplicate CREATE record for block " << e.first
+                   << " which already is alive from another container when "
+                   << " processing container " << container->ToString();
+      }
+      mem_usage += block_mem;
+    }
+
+    mem_tracker_->Consume(mem_usage);
+    AddNewContainerUnlocked(container.get());
+    MakeContainerAvailableUnlocked(container.release());
+  }
+}
+
 #define RETURN_NOT_OK_LBM_DISK_FAILURE_PREPEND(status_expr, msg) \
   do {                                                           \
     Status s_ = (status_expr);                                   \
@@ -2867,6 +3267,7 @@ Status LogBlockManager::Repair(
     RETURN_NOT_OK_PREPEND(
         container->ReopenMetadataWriter(),
         "could not reopen new metadata file");
+    container->MetadataCompacted(e.second.size());
 
     metadata_files_compacted++;
     metadata_bytes_delta += file_bytes_delta;
@@ -378,6 +378,20 @@ class LogBlockManager : public BlockManager {
   // Success or failure is set in 'result_status'.
   void OpenDataDir(DataDir* dir, FsReport* report, Status* result_status);
 
+  // The outcome of opening a single container; see OpenContainer().
+  struct ContainerOpenResult;
+
+  // Opens the container named 'container_name' in 'dir', processes its
+  // records and, if successful, adds it and its live blocks to the block
+  // manager. Anything that must be repaired once every container in 'dir' is
+  // open is written to 'result' instead.
+  //
+  // Safe to call concurrently for different containers.
+  void OpenContainer(
+      DataDir* dir,
+      const std::string& container_name,
+      ContainerOpenResult* result);
+
   // Perform basic initialization.
   Status Init();
 
@@ -0,0 +1,185 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/fs/wal_dirs.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/env.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/path_util.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_int32(fs_wal_dir_maintenance_sync_latency_ms);
+DECLARE_int32(fs_wal_dir_slow_sync_threshold_ms);
+DECLARE_int32(fs_wal_dir_space_refresh_interval_ms);
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace fs {
+
+class WalDirManagerTest : public KuduTest {
+ public:
+  void SetUp() override {
+    KuduTest::SetUp();
+    for (int i = 0; i < 3; i++) {
+      roots_.emplace_back(GetTestPath(Substitute("wal-root-$0", i)));
+      wals_dirs_.emplace_back(JoinPathSegments(roots_.back(), "wals"));
+      ASSERT_OK(env_->CreateDir(roots_.back()));
+      ASSERT_OK(env_->CreateDir(wals_dirs_.back()));
+    }
+  }
+
+ protected:
+  unique_ptr<WalDirManager> NewManager() {
+    return unique_ptr<WalDirManager>(
+        new WalDirManager(roots_, wals_dirs_, nullptr));
+  }
+
+  vector<string> roots_;
+  vector<string> wals_dirs_;
+};
+
+// Tests that new tablets are spread across the directories, avoiding the
+// failed and slow ones.
+TEST_F(WalDirManagerTest, TestPlacement) {
+  unique_ptr<WalDirManager> manager = NewManager();
+  ASSERT_OK(manager->Open(env_));
+  const auto& dirs = manager->dirs();
+  for (int i = 0; i < 6; i++) {
+    ASSERT_EQ(
+        dirs[i % 3].get(),
+        manager->GetOrPlaceTablet(Substitute("tablet-$0", i)));
+  }
+  // A placed tablet stays where it is.
+  ASSERT_EQ(dirs[1].get(), manager->GetOrPlaceTablet("tablet-1"));
+  ASSERT_EQ(
+      JoinPathSegments(wals_dirs_[1], "tablet-1"),
+      manager->GetTabletWalDir("tablet-1"));
+
+  manager->MarkWalDirFailedByRoot(roots_[0]);
+  ASSERT_TRUE(dirs[0]->is_failed());
+  for (int i = 6; i < 10; i++) {
+    ASSERT_NE(
+        dirs[0].get(), manager->GetOrPlaceTablet(Substitute("tablet-$0", i)));
+  }
+
+  // Directory 2 now has the fewest tablets, but it is slow.
+  manager->RemoveTablet("tablet-2");
+  manager->RemoveTablet("tablet-5");
+  FLAGS_fs_wal_dir_slow_sync_threshold_ms = 10;
+  for (int i = 0; i < 50; i++) {
+    dirs[2]->RecordSync(MonoDelta::FromMilliseconds(100));
+  }
+  ASSERT_TRUE(dirs[2]->is_slow());
+  ASSERT_FALSE(dirs[1]->is_slow());
+  ASSERT_EQ(dirs[1].get(), manager->GetOrPlaceTablet("tablet-10"));
+
+  // A slow directory is still better than a failed one.
+  manager->MarkWalDirFailedByRoot(roots_[1]);
+  ASSERT_EQ(dirs[2].get(), manager->GetOrPlaceTablet("tablet-11"));
+
+  // With every directory failed, the default one is used.
+  manager->MarkWalDirFailedByRoot(roots_[2]);
+  ASSERT_EQ(dirs[0].get(), manager->GetOrPlaceTablet("tablet-12"));
+}
+
+// Tests that the maintenance I/O budget shrinks as the syncs of the slowest
+// healthy directory slow down.
+TEST_F(WalDirManagerTest, TestMaintenanceIOBudget) {
+  unique_ptr<WalDirManager> manager = NewManager();
+  ASSERT_OK(manager->Open(env_));
+  const auto& dirs = manager->dirs();
+  FLAGS_fs_wal_dir_maintenance_sync_latency_ms = 20;
+  ASSERT_EQ(4, manager->MaintenanceIOBudget(4));
+
+  auto settle_at = [&](int dir, int ms) {
+    for (int i = 0; i < 100; i++) {
+      dirs[dir]->RecordSync(MonoDelta::FromMilliseconds(ms));
+    }
+  };
+  settle_at(1, 15);
+  int budget = manager->MaintenanceIOBudget(4);
+  ASSERT_GT(budget, 0);
+  ASSERT_LT(budget, 4);
+  settle_at(1, 30);
+  ASSERT_EQ(0, manager->MaintenanceIOBudget(4));
+
+  // A failed directory doesn't hold back the work on the others.
+  manager->MarkWalDirFailedByRoot(roots_[1]);
+  ASSERT_EQ(4, manager->MaintenanceIOBudget(4));
+
+  settle_at(2, 30);
+  ASSERT_EQ(0, manager->MaintenanceIOBudget(4));
+  FLAGS_fs_wal_dir_maintenance_sync_latency_ms = 0;
+  ASSERT_EQ(4, manager->MaintenanceIOBudget(4));
+}
+
+// Tests that the logs already on disk are found where they are.
+TEST_F(WalDirManagerTest, TestOpenFindsExistingLogs) {
+  ASSERT_OK(env_->CreateDir(JoinPathSegments(wals_dirs_[2], "tablet-a")));
+  ASSERT_OK(
+      env_->CreateDir(JoinPathSegments(wals_dirs_[1], "tablet-b.recovery")));
+  unique_ptr<WalDirManager> manager = NewManager();
+  ASSERT_OK(manager->Open(env_));
+  const auto& dirs = manager->dirs();
+  ASSERT_EQ(dirs[2].get(), manager->GetOrPlaceTablet("tablet-a"));
+  ASSERT_EQ(dirs[1].get(), manager->GetOrPlaceTablet("tablet-b"));
+  ASSERT_EQ(dirs[0].get(), manager->GetOrPlaceTablet("tablet-c"));
+}
+
+// Tests that space checks against the cached free space account for the
+// space requested since the last refresh.
+TEST_F(WalDirManagerTest, TestCachedSpaceChecks) {
+  // Only refresh explicitly.
+  FLAGS_fs_wal_dir_space_refresh_interval_ms = 1000 * 1000;
+  unique_ptr<WalDirManager> manager = NewManager();
+  ASSERT_OK(manager->Open(env_));
+  WalDir* dir = manager->dirs()[0].get();
+
+  SpaceInfo space_info;
+  ASSERT_OK(env_->GetSpaceInfo(roots_[0], &space_info));
+  const int64_t half = space_info.free_bytes / 2 + 1;
+  ASSERT_OK(dir->VerifySufficientSpace(half, 0));
+
+  // The filesystem itself would still allow this, but together with the
+  // previous request it exceeds the cached free space.
+  Status s = dir->VerifySufficientSpace(half, 0);
+  ASSERT_TRUE(s.IsIOError()) << s.ToString();
+  ASSERT_EQ(ENOSPC, s.posix_code());
+
+  // A refresh accounts for the earlier request anew.
+  ASSERT_OK(dir->RefreshSpace());
+  ASSERT_OK(dir->VerifySufficientSpace(half, 0));
+}
+
+} // namespace fs
+} // namespace kudu
@@ -0,0 +1,496 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/fs/wal_dirs.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/gutil/map-util.h"
+#include "kudu/gutil/port.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/strings/util.h"
+#include "kudu/util/env.h"
+#include "kudu/util/env_util.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/logging.h"
+#include "kudu/util/path_util.h"
+#include "kudu/util/thread.h"
+
+DEFINE_int32(
+    fs_wal_dir_slow_sync_threshold_ms,
+    50,
+    "A WAL directory whose recent syncs took longer than this on average is "
+    "considered slow, and the logs of new tablets are placed in other "
+    "directories when possible. 0 disables this.");
+DEFINE_validator(
+    fs_wal_dir_slow_sync_threshold_ms,
+    [](const char* /*flagname*/, int32_t value) { return value >= 0; });
+TAG_FLAG(fs_wal_dir_slow_sync_threshold_ms, advanced);
+TAG_FLAG(fs_wal_dir_slow_sync_threshold_ms, runtime);
+
+DEFINE_int32(
+    fs_wal_dir_maintenance_sync_latency_ms,
+    20,
+    "Maintenance ops which use a lot of I/O, e.g. log recompression, may all "
+    "run while the recent syncs of the healthy WAL directories took less than "
+    "half this on average, none once one of them takes this long, and a "
+    "proportional share of them in between, so that background work backs "
+    "off when the WAL slows down. 0 disables this.");
+DEFINE_validator(
+    fs_wal_dir_maintenance_sync_latency_ms,
+    [](const char* /*flagname*/, int32_t value) { return value >= 0; });
+TAG_FLAG(fs_wal_dir_maintenance_sync_latency_ms, advanced);
+TAG_FLAG(fs_wal_dir_maintenance_sync_latency_ms, runtime);
+
+DEFINE_int32(
+    fs_wal_dir_space_refresh_interval_ms,
+    1000,
+    "Period of time (in ms) between refreshes of the cached free space of "
+    "each WAL directory. Log segment allocations check their space against "
+    "this cache rather than querying the filesystem.");
+DEFINE_validator(
+    fs_wal_dir_space_refresh_interval_ms,
+    [](const char* /*flagname*/, int32_t value) { return value > 0; });
+TAG_FLAG(fs_wal_dir_space_refresh_interval_ms, advanced);
+TAG_FLAG(fs_wal_dir_space_refresh_interval_ms, runtime);
+
+DEFINE_int32(
+    fs_wal_dir_full_warning_secs,
+    3600,
+    "Warn when the filesystem of a WAL directory is predicted to fill up in "
+    "less than this many seconds at its recent write rate. 0 disables the "
+    "warning.");
+DEFINE_validator(
+    fs_wal_dir_full_warning_secs,
+    [](const char* /*flagname*/, int32_t value) { return value >= 0; });
+TAG_FLAG(fs_wal_dir_full_warning_secs, advanced);
+TAG_FLAG(fs_wal_dir_full_warning_secs, runtime);
+
+METRIC_DEFINE_entity(wal_dir);
+
+METRIC_DEFINE_histogram(
+    wal_dir,
+    wal_dir_sync_latency,
+    "WAL Directory Sync Latency",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds spent on synchronizing the log segment files in this WAL "
+    "directory",
+    60000000LU,
+    2);
+METRIC_DEFINE_gauge_uint64(
+    wal_dir,
+    wal_dir_failed,
+    "WAL Directory Failed",
+    kudu::MetricUnit::kState,
+    "Whether the disk of this WAL directory is in a failed state");
+METRIC_DEFINE_gauge_uint64(
+    wal_dir,
+    wal_dir_num_tablets,
+    "WAL Directory Tablets",
+    kudu::MetricUnit::kTablets,
+    "Number of tablets whose logs are in this WAL directory");
+METRIC_DEFINE_gauge_uint64(
+    wal_dir,
+    wal_dir_free_bytes,
+    "WAL Directory Free Space",
+    kudu::MetricUnit::kBytes,
+    "Free space of the filesystem of this WAL directory, as of the last "
+    "refresh");
+METRIC_DEFINE_gauge_uint64(
+    wal_dir,
+    wal_dir_write_rate,
+    "WAL Directory Write Rate",
+    kudu::MetricUnit::kBytes,
+    "Recent growth of the used space of the filesystem of this WAL "
+    "directory, in bytes per second");
+METRIC_DEFINE_gauge_int64(
+    wal_dir,
+    wal_dir_seconds_until_full,
+    "WAL Directory Time Until Full",
+    kudu::MetricUnit::kSeconds,
+    "Estimated time until the filesystem of this WAL directory is full at its "
+    "recent write rate, or -1 if it isn't filling up");
+METRIC_DEFINE_gauge_uint64(
+    wal_dir,
+    wal_dir_filling_up,
+    "WAL Directory Filling Up",
+    kudu::MetricUnit::kState,
+    "Whether the filesystem of this WAL directory is predicted to be full "
+    "within --fs_wal_dir_full_warning_secs");
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace fs {
+
+namespace {
+
+// The weight of the latest sync in the moving average of the sync latency, as
+// a power of two.
+const int kSyncLatencyWeightShift = 3;
+
+// The weight of the latest sample in the moving average of the write rate.
+const double kWriteRateWeight = 0.25;
+
+} // anonymous namespace
+
+WalDir::WalDir(string root, string wals_dir, MetricRegistry* registry)
+    : root_(std::move(root)),
+      wals_dir_(std::move(wals_dir)),
+      recent_sync_latency_us_(0),
+      failed_(false),
+      num_tablets_(0),
+      env_(nullptr),
+      space_info_({0, 0}),
+      requested_since_refresh_(0),
+      write_rate_(0) {
+  if (registry) {
+    metric_entity_ =
+        METRIC_ENTITY_wal_dir.Instantiate(registry, root_, {{"path", root_}});
+    sync_latency_ = METRIC_wal_dir_sync_latency.Instantiate(metric_entity_);
+    failed_gauge_ = METRIC_wal_dir_failed.Instantiate(metric_entity_, 0);
+    num_tablets_gauge_ =
+        METRIC_wal_dir_num_tablets.Instantiate(metric_entity_, 0);
+    free_bytes_gauge_ =
+        METRIC_wal_dir_free_bytes.Instantiate(metric_entity_, 0);
+    write_rate_gauge_ =
+        METRIC_wal_dir_write_rate.Instantiate(metric_entity_, 0);
+    seconds_until_full_gauge_ =
+        METRIC_wal_dir_seconds_until_full.Instantiate(metric_entity_, -1);
+    filling_up_gauge_ =
+        METRIC_wal_dir_filling_up.Instantiate(metric_entity_, 0);
+  }
+  io_scheduler_.reset(new IOScheduler(metric_entity_));
+}
+
+void WalDir::RecordSync(MonoDelta latency) {
+  const int64_t latency_us = latency.ToMicroseconds();
+  if (sync_latency_) {
+    sync_latency_->Increment(latency_us);
+  }
+  // Only the log appender threads update this, and an update lost to a race
+  // only delays the average by one sync.
+  const int64_t average =
+      recent_sync_latency_us_.load(std::memory_order_relaxed);
+  recent_sync_latency_us_.store(
+      average + ((latency_us - average) >> kSyncLatencyWeightShift),
+      std::memory_order_relaxed);
+}
+
+bool WalDir::is_slow() const {
+  const int32_t threshold_ms = FLAGS_fs_wal_dir_slow_sync_threshold_ms;
+  return threshold_ms > 0 &&
+      recent_sync_latency() > MonoDelta::FromMilliseconds(threshold_ms);
+}
+
+Status WalDir::VerifySufficientSpace(
+    int64_t requested_bytes,
+    int64_t reserved_bytes) {
+  bool cached;
+  SpaceInfo space_info;
+  {
+    std::lock_guard<simple_spinlock> l(space_lock_);
+    cached = space_refreshed_.Initialized();
+    space_info = space_info_;
+    space_info.free_bytes -= requested_since_refresh_;
+  }
+  if (PREDICT_FALSE(!cached)) {
+    DCHECK(env_);
+    return env_util::VerifySufficientDiskSpace(
+        env_, root_, requested_bytes, reserved_bytes);
+  }
+  RETURN_NOT_OK(env_util::VerifySufficientDiskSpace(
+      space_info, root_, requested_bytes, reserved_bytes));
+  std::lock_guard<simple_spinlock> l(space_lock_);
+  requested_since_refresh_ += requested_bytes;
+  return Status::OK();
+}
+
+Status WalDir::RefreshSpace() {
+  DCHECK(env_);
+  // Requests made while the filesystem is queried may or may not be reflected
+  // in the result; they are only forgotten by the next refresh.
+  int64_t requested_before;
+  {
+    std::lock_guard<simple_spinlock> l(space_lock_);
+    requested_before = requested_since_refresh_;
+  }
+  SpaceInfo space_info;
+  RETURN_NOT_OK(env_->GetSpaceInfo(root_, &space_info));
+  const MonoTime now = MonoTime::Now();
+
+  double write_rate;
+  {
+    std::lock_guard<simple_spinlock> l(space_lock_);
+    if (space_refreshed_.Initialized()) {
+      const double elapsed_secs = (now - space_refreshed_).ToSeconds();
+      if (elapsed_secs > 0) {
+        const int64_t used_delta =
+            (space_info.capacity_bytes - space_info.free_bytes) -
+            (space_info_.capacity_bytes - space_info_.free_bytes);
+        write_rate_ +=
+            kWriteRateWeight * (used_delta / elapsed_secs - write_rate_);
+      }
+    }
+    space_info_ = space_info;
+    space_refreshed_ = now;
+    requested_since_refresh_ -= requested_before;
+    write_rate = write_rate_;
+  }
+
+  const int64_t secs_until_full = seconds_until_full();
+  const int32_t warning_secs = FLAGS_fs_wal_dir_full_warning_secs;
+  const bool filling_up = warning_secs > 0 && secs_until_full >= 0 &&
+      secs_until_full < warning_secs;
+  if (PREDICT_FALSE(filling_up)) {
+    KLOG_EVERY_N_SECS(WARNING, 60) << Substitute(
+        "WAL directory $0 is predicted to be full in $1 seconds ($2 bytes "
+        "free, growing by $3 bytes per second)",
+        root_,
+        secs_until_full,
+        space_info.free_bytes,
+        static_cast<int64_t>(write_rate));
+  }
+  if (metric_entity_) {
+    free_bytes_gauge_->set_value(std::max<int64_t>(space_info.free_bytes, 0));
+    write_rate_gauge_->set_value(std::max<int64_t>(write_rate, 0));
+    seconds_until_full_gauge_->set_value(secs_until_full);
+    filling_up_gauge_->set_value(filling_up ? 1 : 0);
+  }
+  return Status::OK();
+}
+
+int64_t WalDir::seconds_until_full() const {
+  std::lock_guard<simple_spinlock> l(space_lock_);
+  if (write_rate_ <= 0) {
+    return -1;
+  }
+  return std::max<int64_t>(space_info_.free_bytes, 0) / write_rate_;
+}
+
+void WalDir::MarkFailed() {
+  if (failed_.exchange(true, std::memory_order_acq_rel)) {
+    return;
+  }
+  LOG(ERROR) << "WAL directory " << root_ << " failed; no new tablets will "
+             << "place their logs in it";
+  if (failed_gauge_) {
+    failed_gauge_->set_value(1);
+  }
+}
+
+WalDirManager::WalDirManager(
+    const vector<string>& roots,
+    const vector<string>& wals_dirs,
+    MetricRegistry* registry)
+    : shutdown_latch_(1) {
+  CHECK_EQ(roots.size(), wals_dirs.size());
+  CHECK(!roots.empty());
+  for (int i = 0; i < roots.size(); i++) {
+    dirs_.emplace_back(new WalDir(roots[i], wals_dirs[i], registry));
+  }
+}
+
+WalDirManager::~WalDirManager() {
+  shutdown_latch_.CountDown();
+  if (space_refresh_thread_) {
+    space_refresh_thread_->Join();
+  }
+}
+
+Status WalDirManager::Open(Env* env) {
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    RETURN_NOT_OK(FindTabletsUnlocked(env));
+  }
+  RefreshSpace();
+  return Thread::Create(
+      "fs",
+      "wal-dir-space",
+      &WalDirManager::RunSpaceRefresh,
+      this,
+      &space_refresh_thread_);
+}
+
+Status WalDirManager::FindTabletsUnlocked(Env* env) {
+  for (const auto& dir : dirs_) {
+    dir->env_ = env;
+    if (dir->is_failed()) {
+      continue;
+    }
+    vector<string> children;
+    Status s = env->GetChildren(dir->wals_dir(), &children);
+    if (PREDICT_FALSE(!s.ok())) {
+      if (s.IsDiskFailure()) {
+        LOG(ERROR) << "Unable to list WAL directory " << dir->wals_dir()
+                   << ": " << s.ToString();
+        dir->MarkFailed();
+        continue;
+      }
+      return s.CloneAndPrepend(
+          "unable to list WAL directory " + dir->wals_dir());
+    }
+    for (const string& child : children) {
+      if (HasPrefixString(child, ".")) {
+        continue;
+      }
+      // Recovery directories are named after their tablet, with a suffix.
+      const string tablet_id = child.substr(0, child.find('.'));
+      WalDir** existing = FindOrNull(dir_by_tablet_, tablet_id);
+      if (!existing) {
+        InsertOrDie(&dir_by_tablet_, tablet_id, dir.get());
+        dir->num_tablets_++;
+      } else if (*existing != dir.get()) {
+        LOG(WARNING) << "Logs of tablet " << tablet_id << " found in both "
+                     << (*existing)->root() << " and " << dir->root()
+                     << "; using the former";
+      }
+    }
+  }
+  for (const auto& dir : dirs_) {
+    if (dir->num_tablets_gauge_) {
+      dir->num_tablets_gauge_->set_value(dir->num_tablets_);
+    }
+  }
+  return Status::OK();
+}
+
+WalDir* WalDirManager::GetOrPlaceTablet(const string& tablet_id) {
+  std::lock_guard<simple_spinlock> l(lock_);
+  WalDir** existing = FindOrNull(dir_by_tablet_, tablet_id);
+  if (existing) {
+    return *existing;
+  }
+  WalDir* dir = PickDirUnlocked();
+  InsertOrDie(&dir_by_tablet_, tablet_id, dir);
+  dir->num_tablets_++;
+  if (dir->num_tablets_gauge_) {
+    dir->num_tablets_gauge_->set_value(dir->num_tablets_);
+  }
+  if (dirs_.size() > 1) {
+    VLOG(1) << "Placing the logs of tablet " << tablet_id << " in "
+            << dir->root();
+  }
+  return dir;
+}
+
+string WalDirManager::GetTabletWalDir(const string& tablet_id) {
+  return JoinPathSegments(GetOrPlaceTablet(tablet_id)->wals_dir(), tablet_id);
+}
+
+void WalDirManager::RemoveTablet(const string& tablet_id) {
+  std::lock_guard<simple_spinlock> l(lock_);
+  WalDir* dir = nullptr;
+  if (!FindCopy(dir_by_tablet_, tablet_id, &dir)) {
+    return;
+  }
+  dir_by_tablet_.erase(tablet_id);
+  dir->num_tablets_--;
+  if (dir->num_tablets_gauge_) {
+    dir->num_tablets_gauge_->set_value(dir->num_tablets_);
+  }
+}
+
+void WalDirManager::RefreshSpace() {
+  for (const auto& dir : dirs_) {
+    if (dir->is_failed()) {
+      continue;
+    }
+    Status s = dir->RefreshSpace();
+    if (PREDICT_FALSE(!s.ok())) {
+      KLOG_EVERY_N_SECS(WARNING, 60)
+          << "Could not refresh the free space of WAL directory "
+          << dir->root() << ": " << s.ToString();
+    }
+  }
+}
+
+void WalDirManager::RunSpaceRefresh() {
+  while (!shutdown_latch_.WaitFor(MonoDelta::FromMilliseconds(
+      FLAGS_fs_wal_dir_space_refresh_interval_ms))) {
+    RefreshSpace();
+  }
+}
+
+void WalDirManager::MarkWalDirFailedByRoot(const string& root) {
+  for (const auto& dir : dirs_) {
+    if (dir->root() == root) {
+      dir->MarkFailed();
+      return;
+    }
+  }
+  LOG(WARNING) << "Unknown WAL directory " << root << " reported as failed";
+}
+
+int WalDirManager::MaintenanceIOBudget(int max_ops) const {
+  const int64_t target_us =
+      FLAGS_fs_wal_dir_maintenance_sync_latency_ms * 1000L;
+  if (target_us <= 0) {
+    return max_ops;
+  }
+  int64_t worst_us = 0;
+  for (const auto& dir : dirs_) {
+    if (!dir->is_failed()) {
+      worst_us =
+          std::max(worst_us, dir->recent_sync_latency().ToMicroseconds());
+    }
+  }
+  const int64_t full_budget_us = target_us / 2;
+  if (worst_us <= full_budget_us) {
+    return max_ops;
+  }
+  if (worst_us >= target_us) {
+    return 0;
+  }
+  return max_ops * (target_us - worst_us) / (target_us - full_budget_us);
+}
+
+WalDir* WalDirManager::PickDirUnlocked() const {
+  // The healthy directory with the fewest tablets, preferring the ones which
+  // aren't slow. If every directory failed, the default one is used, and
+  // writing the logs fails there.
+  WalDir* best = nullptr;
+  bool best_is_slow = true;
+  for (const auto& dir : dirs_) {
+    if (dir->is_failed()) {
+      continue;
+    }
+    const bool is_slow = dir->is_slow();
+    if (!best || (best_is_slow && !is_slow) ||
+        (best_is_slow == is_slow && dir->num_tablets_ < best->num_tablets_)) {
+      best = dir.get();
+      best_is_slow = is_slow;
+    }
+  }
+  return best ? best : dirs_[0].get();
+}
+
+} // namespace fs
+} // namespace kudu
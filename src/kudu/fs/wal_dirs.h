@@ -0,0 +1,219 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "kudu/fs/io_scheduler.h"
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/countdown_latch.h"
+#include "kudu/util/env.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+class Thread;
+
+namespace fs {
+
+// A root holding write-ahead logs, e.g. on its own device. The logs of each
+// tablet are in a subdirectory of its wals directory.
+class WalDir {
+ public:
+  // 'registry' may be null, in which case no metrics are produced.
+  WalDir(std::string root, std::string wals_dir, MetricRegistry* registry);
+
+  // Records that syncing a log in this directory took 'latency'.
+  void RecordSync(MonoDelta latency);
+
+  // Returns a moving average of the latency of the recent syncs.
+  MonoDelta recent_sync_latency() const {
+    return MonoDelta::FromMicroseconds(
+        recent_sync_latency_us_.load(std::memory_order_relaxed));
+  }
+
+  // Returns true if the latency of the recent syncs is above
+  // --fs_wal_dir_slow_sync_threshold_ms.
+  bool is_slow() const;
+
+  bool is_failed() const {
+    return failed_.load(std::memory_order_acquire);
+  }
+
+  const std::string& root() const {
+    return root_;
+  }
+
+  const std::string& wals_dir() const {
+    return wals_dir_;
+  }
+
+  // Arbitrates the I/O to the logs in this directory.
+  IOScheduler* io_scheduler() const {
+    return io_scheduler_.get();
+  }
+
+  // Like env_util::VerifySufficientDiskSpace() for the filesystem of this
+  // directory, but in constant time: checks against the free space cached by
+  // the last RefreshSpace(), less what was successfully requested since. Only
+  // queries the filesystem if the free space isn't cached yet.
+  Status VerifySufficientSpace(int64_t requested_bytes, int64_t reserved_bytes);
+
+  // Re-reads the free space of the filesystem of this directory, and updates
+  // the estimated write rate and time until the filesystem is full. Called
+  // periodically by the WalDirManager.
+  Status RefreshSpace();
+
+  // Returns the estimated number of seconds until the filesystem of this
+  // directory is full at the recent write rate, or -1 if it isn't filling up.
+  int64_t seconds_until_full() const;
+
+ private:
+  friend class WalDirManager;
+
+  void MarkFailed();
+
+  const std::string root_;
+  const std::string wals_dir_;
+
+  std::atomic<int64_t> recent_sync_latency_us_;
+  std::atomic<bool> failed_;
+
+  // Number of tablets whose logs are placed in this directory. Protected by
+  // the lock of the WalDirManager.
+  int num_tablets_;
+
+  scoped_refptr<MetricEntity> metric_entity_;
+  scoped_refptr<Histogram> sync_latency_;
+  scoped_refptr<AtomicGauge<uint64_t>> failed_gauge_;
+  scoped_refptr<AtomicGauge<uint64_t>> num_tablets_gauge_;
+  scoped_refptr<AtomicGauge<uint64_t>> free_bytes_gauge_;
+  scoped_refptr<AtomicGauge<uint64_t>> write_rate_gauge_;
+  scoped_refptr<AtomicGauge<int64_t>> seconds_until_full_gauge_;
+  scoped_refptr<AtomicGauge<uint64_t>> filling_up_gauge_;
+
+  std::unique_ptr<IOScheduler> io_scheduler_;
+
+  // Set by WalDirManager::Open().
+  Env* env_;
+
+  // Protects the cached free space state below.
+  mutable simple_spinlock space_lock_;
+
+  // The result of the last successful RefreshSpace(), and when it was taken.
+  // 'space_refreshed_' is uninitialized until then.
+  SpaceInfo space_info_;
+  MonoTime space_refreshed_;
+
+  // Bytes successfully requested via VerifySufficientSpace() since the last
+  // refresh, which the cached free space doesn't account for yet.
+  int64_t requested_since_refresh_;
+
+  // Moving average of the growth of the used space of the filesystem, in
+  // bytes per second. Negative while space is being freed.
+  double write_rate_;
+
+  DISALLOW_COPY_AND_ASSIGN(WalDir);
+};
+
+// Places the logs of the tablets across the WAL directories.
+//
+// The logs of a tablet stay in the directory they were first created in. New
+// tablets go to the healthy directory with the fewest tablets, avoiding the
+// failed ones and, if possible, the slow ones.
+class WalDirManager {
+ public:
+  // 'roots' and 'wals_dirs' are the WAL roots and their wals directories, the
+  // first of which is the default one. 'registry' is as with WalDir.
+  WalDirManager(
+      const std::vector<std::string>& roots,
+      const std::vector<std::string>& wals_dirs,
+      MetricRegistry* registry);
+
+  // Finds the tablets whose logs are already in the directories. A directory
+  // whose listing fails with a disk failure is marked failed. Also caches the
+  // free space of the directories, and starts refreshing it every
+  // --fs_wal_dir_space_refresh_interval_ms.
+  Status Open(Env* env);
+
+  // Returns the directory of the logs of 'tablet_id', placing them if they
+  // were not yet.
+  WalDir* GetOrPlaceTablet(const std::string& tablet_id);
+
+  // Returns the path of the directory of the logs of 'tablet_id', as with
+  // GetOrPlaceTablet().
+  std::string GetTabletWalDir(const std::string& tablet_id);
+
+  // Forgets where the logs of 'tablet_id' are, once they are deleted, so that
+  // they may be placed anew.
+  void RemoveTablet(const std::string& tablet_id);
+
+  // Stops refreshing the free space of the directories.
+  ~WalDirManager();
+
+  // Marks the directory with root 'root' failed. New tablets aren't placed in
+  // it anymore. Does nothing if there is no such directory.
+  void MarkWalDirFailedByRoot(const std::string& root);
+
+  const std::vector<std::unique_ptr<WalDir>>& dirs() const {
+    return dirs_;
+  }
+
+  // Returns how many of 'max_ops' maintenance ops using a lot of I/O may run
+  // at once given the recent sync latency of the directories, see
+  // --fs_wal_dir_maintenance_sync_latency_ms and
+  // MaintenanceManager::set_high_io_budget_func().
+  int MaintenanceIOBudget(int max_ops) const;
+
+ private:
+  // Finds the tablets whose logs are already in the directories, as part of
+  // Open().
+  Status FindTabletsUnlocked(Env* env);
+
+  // Picks the directory for the logs of a new tablet.
+  WalDir* PickDirUnlocked() const;
+
+  // Refreshes the free space of the healthy directories.
+  void RefreshSpace();
+
+  // Calls RefreshSpace() periodically until 'shutdown_latch_' counts down.
+  void RunSpaceRefresh();
+
+  std::vector<std::unique_ptr<WalDir>> dirs_;
+
+  // Protects 'dir_by_tablet_' and the tablet count of the directories.
+  simple_spinlock lock_;
+  std::unordered_map<std::string, WalDir*> dir_by_tablet_;
+
+  scoped_refptr<Thread> space_refresh_thread_;
+  CountDownLatch shutdown_latch_;
+
+  DISALLOW_COPY_AND_ASSIGN(WalDirManager);
+};
+
+} // namespace fs
+} // namespace kudu
@@ -36,6 +36,7 @@
 #include "kudu/util/faststring.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/status.h"
 #include "kudu/util/threadpool.h"
 
@@ -59,6 +60,14 @@ DEFINE_int32(
     raft_thread_pool_min_size,
     0,
     "Min threads in the raft thread pool");
+DEFINE_int32(
+    raft_thread_pool_fairness_quantum_us,
+    0,
+    "If positive, the Raft groups sharing the raft thread pool are scheduled "
+    "by deficit round-robin on the run time of their tasks, each earning "
+    "this many microseconds of run time per turn, so that a few busy groups "
+    "can't monopolize the pool. If 0, tasks run in submission order.");
+TAG_FLAG(raft_thread_pool_fairness_quantum_us, experimental);
 
 static bool ValidateThreadPoolThreadLimit(
     const char* /*flagname*/,
@@ -198,6 +207,12 @@ Status KuduServer::Init() {
                                               : server_wide_pool_limit)
           .set_idle_timeout(MonoDelta::FromSeconds(
               static_cast<double>(FLAGS_raft_thread_pool_idle_timeout_second)))
+          .set_cpu_affinity(numa_local_cpus_)
+          .set_fairness_quantum(
+              FLAGS_raft_thread_pool_fairness_quantum_us > 0
+                  ? MonoDelta::FromMicroseconds(
+                        FLAGS_raft_thread_pool_fairness_quantum_us)
+                  : MonoDelta())
           .Build(&raft_pool_));
 
   return Status::OK();
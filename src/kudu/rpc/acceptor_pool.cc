@@ -17,8 +17,17 @@
 
 #include "kudu/rpc/acceptor_pool.h"
 
+#if defined(__linux__)
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+#include <algorithm>
+#include <memory>
 #include <ostream>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <gflags/gflags.h>
@@ -26,8 +35,12 @@
 
 #include "kudu/gutil/basictypes.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/strings/numbers.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/rpc/messenger.h"
+#include "kudu/rpc/transport.h"
+#include "kudu/util/env.h"
+#include "kudu/util/faststring.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
@@ -46,6 +59,7 @@ class Message;
 
 using google::protobuf::Message;
 using std::string;
+using std::unique_ptr;
 
 METRIC_DEFINE_counter(
     server,
@@ -54,20 +68,87 @@ METRIC_DEFINE_counter(
     kudu::MetricUnit::kConnections,
     "Number of incoming TCP connections made to the RPC server");
 
+METRIC_DEFINE_histogram(
+    server,
+    rpc_accept_queue_length,
+    "RPC Accept Queue Length",
+    kudu::MetricUnit::kConnections,
+    "Number of connections waiting in the accept queue of the RPC server's "
+    "listening socket, sampled at each accept. Queues close to "
+    "--rpc_acceptor_listen_backlog drop connection requests.",
+    65536,
+    2);
+
 DEFINE_int32(
     rpc_acceptor_listen_backlog,
-    128,
+    512,
     "Socket backlog parameter used when listening for RPC connections. "
     "This defines the maximum length to which the queue of pending "
     "TCP connections inbound to the RPC server may grow. If a connection "
     "request arrives when the queue is full, the client may receive "
     "an error. Higher values may help the server ride over bursts of "
-    "new inbound connection requests.");
+    "new inbound connection requests. The kernel caps it at "
+    "net.core.somaxconn.");
+DEFINE_validator(
+    rpc_acceptor_listen_backlog,
+    [](const char* /*n*/, int32_t v) { return v > 0; });
 TAG_FLAG(rpc_acceptor_listen_backlog, advanced);
 
+DEFINE_int32(
+    rpc_acceptor_listen_sockets,
+    1,
+    "Number of sockets each acceptor pool listens on, bound to the same "
+    "address with SO_REUSEPORT. The kernel spreads the incoming connections "
+    "over them, and the pool's threads over them, which lets a burst of "
+    "reconnecting clients, e.g. after a leader change, be accepted in "
+    "parallel.");
+DEFINE_validator(
+    rpc_acceptor_listen_sockets,
+    [](const char* /*n*/, int32_t v) { return v >= 1 && v <= 64; });
+TAG_FLAG(rpc_acceptor_listen_sockets, advanced);
+
+DEFINE_bool(
+    rpc_acceptor_pin_to_reactors,
+    false,
+    "Whether the connections accepted on each listening socket of an "
+    "acceptor pool go to one reactor, rather than to the reactor their "
+    "remote address hashes to. See --rpc_acceptor_listen_sockets.");
+TAG_FLAG(rpc_acceptor_pin_to_reactors, advanced);
+
 namespace kudu {
 namespace rpc {
 
+namespace {
+
+// Opens another listening socket on 'address', the bound address of an
+// acceptor pool.
+Status ListenWithReusePort(const Sockaddr& address, Socket* socket) {
+  RETURN_NOT_OK(socket->Init(0));
+  RETURN_NOT_OK(socket->SetReuseAddr(true));
+  RETURN_NOT_OK(socket->SetReusePort(true));
+  RETURN_NOT_OK(socket->Bind(address));
+  return socket->Listen(FLAGS_rpc_acceptor_listen_backlog);
+}
+
+// Warns if the kernel caps the backlog of the listening sockets.
+void CheckListenBacklog() {
+  faststring contents;
+  Status s = ReadFileToString(
+      Env::Default(), "/proc/sys/net/core/somaxconn", &contents);
+  if (!s.ok()) {
+    return;
+  }
+  int32_t somaxconn;
+  if (safe_strto32(contents.ToString(), &somaxconn) &&
+      somaxconn < FLAGS_rpc_acceptor_listen_backlog) {
+    LOG(WARNING) << "--rpc_acceptor_listen_backlog is "
+                 << FLAGS_rpc_acceptor_listen_backlog
+                 << ", but net.core.somaxconn caps it at " << somaxconn;
+  }
+}
+
+} // anonymous namespace
+
 AcceptorPool::AcceptorPool(
     Messenger* messenger,
     Socket* socket,
@@ -77,6 +158,8 @@ AcceptorPool::AcceptorPool(
       bind_address_(bind_address),
       rpc_connections_accepted_(METRIC_rpc_connections_accepted.Instantiate(
           messenger->metric_entity())),
+      accept_queue_length_(METRIC_rpc_accept_queue_length.Instantiate(
+          messenger->metric_entity())),
       closing_(false) {}
 
 AcceptorPool::~AcceptorPool() {
@@ -85,14 +168,38 @@ AcceptorPool::~AcceptorPool() {
 
 Status AcceptorPool::Start(int num_threads) {
   RETURN_NOT_OK(socket_.Listen(FLAGS_rpc_acceptor_listen_backlog));
+  CheckListenBacklog();
 
-  for (int i = 0; i < num_threads; i++) {
+  std::vector<Socket*> sockets = {&socket_};
+  if (FLAGS_rpc_acceptor_listen_sockets > 1) {
+    Sockaddr address;
+    RETURN_NOT_OK(GetBoundAddress(&address));
+    for (int i = 1; i < FLAGS_rpc_acceptor_listen_sockets; i++) {
+      unique_ptr<Socket> socket(new Socket);
+      Status s = ListenWithReusePort(address, socket.get());
+      if (!s.ok()) {
+        Shutdown();
+        return s.CloneAndPrepend(strings::Substitute(
+            "could not open listening socket $0 on $1",
+            i,
+            address.ToString()));
+      }
+      sockets.push_back(socket.get());
+      reuseport_sockets_.push_back(std::move(socket));
+    }
+  }
+
+  const int total_threads = std::max<int>(num_threads, sockets.size());
+  for (int i = 0; i < total_threads; i++) {
+    const int socket_index = i % sockets.size();
     scoped_refptr<kudu::Thread> new_thread;
     Status s = kudu::Thread::Create(
         "acceptor pool",
         "acceptor",
         &AcceptorPool::RunThread,
         this,
+        sockets[socket_index],
+        FLAGS_rpc_acceptor_pin_to_reactors ? socket_index : -1,
         &new_thread);
     if (!s.ok()) {
       Shutdown();
@@ -100,6 +207,28 @@ Status AcceptorPool::Start(int num_threads) {
     }
     threads_.push_back(new_thread);
   }
+
+  Transport* transport = messenger_->transport();
+  if (transport) {
+    Sockaddr address;
+    Status s = GetBoundAddress(&address);
+    if (s.ok()) {
+      s = transport->Listen(
+          address,
+          [this](std::unique_ptr<Socket> sock, const Sockaddr& remote) {
+            rpc_connections_accepted_->Increment();
+            messenger_->RegisterInboundSocket(std::move(sock), remote);
+          });
+    }
+    if (!s.ok()) {
+      Shutdown();
+      return s.CloneAndPrepend(strings::Substitute(
+          "$0 transport could not listen on $1",
+          transport->name(),
+          bind_address_.ToString()));
+    }
+    transport_address_ = address;
+  }
   return Status::OK();
 }
 
@@ -110,6 +239,10 @@ void AcceptorPool::Shutdown() {
     return;
   }
 
+  if (transport_address_) {
+    messenger_->transport()->StopListening(*transport_address_);
+  }
+
 #if defined(__linux__)
   // Closing the socket will break us out of accept() if we're in it, and
   // prevent future accepts.
@@ -118,6 +251,13 @@ void AcceptorPool::Shutdown() {
       strings::Substitute(
           "Could not shut down acceptor socket on $0",
           bind_address_.ToString()));
+  for (const auto& socket : reuseport_sockets_) {
+    WARN_NOT_OK(
+        socket->Shutdown(true, true),
+        strings::Substitute(
+            "Could not shut down acceptor socket on $0",
+            bind_address_.ToString()));
+  }
 #else
   // Calling shutdown on an accepting (non-connected) socket is illegal on most
   // platforms (but not Linux). Instead, the accepting threads are interrupted
@@ -141,6 +281,9 @@ void AcceptorPool::Shutdown() {
   // here, it would  necessary to wait until Messenger::Shutdown() is called for
   // the corresponding messenger object to close this socket.
   ignore_result(socket_.Close());
+  for (const auto& socket : reuseport_sockets_) {
+    ignore_result(socket->Close());
+  }
 }
 
 Sockaddr AcceptorPool::bind_address() const {
@@ -155,13 +298,25 @@ int64_t AcceptorPool::num_rpc_connections_accepted() const {
   return rpc_connections_accepted_->value();
 }
 
-void AcceptorPool::RunThread() {
+void AcceptorPool::RecordAcceptQueueLength(const Socket& socket) {
+#if defined(__linux__)
+  // For a listening socket, the kernel reports the length of its accept
+  // queue as the unacknowledged segments.
+  struct tcp_info info;
+  socklen_t len = sizeof(info);
+  if (getsockopt(socket.GetFd(), IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+    accept_queue_length_->Increment(info.tcpi_unacked);
+  }
+#endif
+}
+
+void AcceptorPool::RunThread(Socket* socket, int reactor_index) {
   while (true) {
     Socket new_sock;
     Sockaddr remote;
-    VLOG(2) << "calling accept() on socket " << socket_.GetFd()
+    VLOG(2) << "calling accept() on socket " << socket->GetFd()
             << " listening on " << bind_address_.ToString();
-    Status s = socket_.Accept(&new_sock, &remote, Socket::FLAG_NONBLOCKING);
+    Status s = socket->Accept(&new_sock, &remote, Socket::FLAG_NONBLOCKING);
     if (!s.ok()) {
       if (Release_Load(&closing_)) {
         break;
@@ -170,6 +325,7 @@ void AcceptorPool::RunThread() {
           << "AcceptorPool: accept failed: " << s.ToString() << THROTTLE_MSG;
       continue;
     }
+    RecordAcceptQueueLength(*socket);
     s = new_sock.SetNoDelay(true);
     if (s.ok() && messenger_->get_receive_buffer() > 0) {
       s = new_sock.SetReceiveBuf(messenger_->get_receive_buffer());
@@ -182,7 +338,7 @@ void AcceptorPool::RunThread() {
       continue;
     }
     rpc_connections_accepted_->Increment();
-    messenger_->RegisterInboundSocket(&new_sock, remote);
+    messenger_->RegisterInboundSocket(&new_sock, remote, reactor_index);
   }
   VLOG(1) << "AcceptorPool shutting down.";
 }
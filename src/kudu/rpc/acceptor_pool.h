@@ -19,8 +19,11 @@
 #define KUDU_RPC_ACCEPTOR_POOL_H
 
 #include <stdint.h>
+#include <memory>
 #include <vector>
 
+#include <boost/optional/optional.hpp>
+
 #include "kudu/gutil/atomicops.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/ref_counted.h"
@@ -31,6 +34,7 @@
 namespace kudu {
 
 class Counter;
+class Histogram;
 class Thread;
 
 namespace rpc {
@@ -40,6 +44,14 @@ class Messenger;
 // A pool of threads calling accept() to create new connections.
 // Acceptor pool threads terminate when they notice that the messenger has been
 // shut down, if Shutdown() is called, or if the pool object is destructed.
+//
+// With --rpc_acceptor_listen_sockets, the pool listens on several sockets
+// bound to the same port with SO_REUSEPORT, so that the kernel spreads the
+// incoming connections over their accept queues, and the threads over the
+// sockets: a reconnect storm isn't serialized behind one queue.
+//
+// With --rpc_acceptor_pin_to_reactors, the connections accepted on each
+// socket go to one reactor, instead of the one their remote hashes to.
 class AcceptorPool {
  public:
   // Create a new acceptor pool.  Calls socket::Release to take ownership of the
@@ -48,7 +60,8 @@ class AcceptorPool {
   AcceptorPool(Messenger* messenger, Socket* socket, Sockaddr bind_address);
   ~AcceptorPool();
 
-  // Start listening and accepting connections.
+  // Start listening and accepting connections, with at least one thread per
+  // listening socket.
   Status Start(int num_threads);
   void Shutdown();
 
@@ -65,17 +78,28 @@ class AcceptorPool {
   int64_t num_rpc_connections_accepted() const;
 
  private:
-  void RunThread();
+  // Accepts connections on 'socket', for the reactor 'reactor_index' (see
+  // Messenger::RegisterInboundSocket()).
+  void RunThread(Socket* socket, int reactor_index);
+
+  // Samples the accept queue length of 'socket'.
+  void RecordAcceptQueueLength(const Socket& socket);
 
   Messenger* messenger_;
   Socket socket_;
+  // The listening sockets besides 'socket_', bound to its port.
+  std::vector<std::unique_ptr<Socket>> reuseport_sockets_;
   Sockaddr bind_address_;
   std::vector<scoped_refptr<kudu::Thread>> threads_;
 
   scoped_refptr<Counter> rpc_connections_accepted_;
+  scoped_refptr<Histogram> accept_queue_length_;
 
   Atomic32 closing_;
 
+  // The address the messenger's transport listens on, if it does.
+  boost::optional<Sockaddr> transport_address_;
+
   DISALLOW_COPY_AND_ASSIGN(AcceptorPool);
 };
 
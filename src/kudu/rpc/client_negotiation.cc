@@ -218,6 +218,19 @@ Status ClientNegotiation::Negotiate(unique_ptr<ErrorStatusPB>* rpc_error) {
           security::TlsVerificationMode::VERIFY_NONE);
     }
 
+    // Sessions are only resumed for the same kind of authentication, so that
+    // one negotiated without verifying the server's certificate never stands
+    // in for one which did.
+    const string session_key = tls_session_peer_.empty()
+        ? string()
+        : Substitute(
+              "$0 $1",
+              tls_session_peer_,
+              AuthenticationTypeToString(negotiated_authn_));
+    if (!session_key.empty()) {
+      tls_context_->ResumeSession(session_key, &tls_handshake_);
+    }
+
     // To initiate the TLS handshake, we pretend as if the server sent us an
     // empty TLS_HANDSHAKE token.
     NegotiatePB initial;
@@ -232,6 +245,12 @@ Status ClientNegotiation::Negotiate(unique_ptr<ErrorStatusPB>* rpc_error) {
     }
     RETURN_NOT_OK(s);
     tls_negotiated_ = true;
+    if (!session_key.empty()) {
+      tls_context_->CacheSession(session_key, &tls_handshake_);
+    }
+    if (tls_handshake_.session_reused()) {
+      TRACE("Resumed TLS session");
+    }
   }
 
   // Step 4: Authentication
@@ -100,6 +100,12 @@ class ClientNegotiation {
     return normal_tls_negotiated_;
   }
 
+  // Returns true if TLS was negotiated by resuming an earlier session.
+  // Must be called after Negotiate().
+  bool tls_session_reused() const {
+    return tls_negotiated_ && tls_handshake_.session_reused();
+  }
+
   // Returns the set of RPC system features supported by the remote server.
   // Must be called before Negotiate().
   std::set<RpcFeatureFlag> server_features() const {
@@ -121,6 +127,13 @@ class ClientNegotiation {
   // Set deadline for connection negotiation.
   void set_deadline(const MonoTime& deadline);
 
+  // Identify the remote server for TLS session resumption: the session of an
+  // earlier connection to the same 'peer' is offered, and the one negotiated
+  // is kept for the next. Must be called before Negotiate().
+  void set_tls_session_peer(std::string peer) {
+    tls_session_peer_ = std::move(peer);
+  }
+
   Socket* socket() {
     return socket_.get();
   }
@@ -281,6 +294,9 @@ class ClientNegotiation {
 
   // Negotiation timeout deadline.
   MonoTime deadline_;
+
+  // The peer to resume TLS sessions with, if any.
+  std::string tls_session_peer_;
 };
 
 } // namespace rpc
@@ -17,8 +17,11 @@
 
 #include "kudu/rpc/connection.h"
 
+#include <sys/uio.h>
+
 #include <algorithm>
 #include <cerrno>
+#include <climits>
 #include <iostream>
 #include <memory>
 #include <set>
@@ -28,12 +31,14 @@
 #include <boost/intrusive/detail/list_iterator.hpp>
 #include <boost/intrusive/list.hpp>
 #include <ev.h>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/strings/human_readable.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/rpc/inbound_call.h"
+#include "kudu/rpc/link_emulation.h"
 #include "kudu/rpc/messenger.h"
 #include "kudu/rpc/outbound_call.h"
 #include "kudu/rpc/reactor.h"
@@ -41,7 +46,10 @@
 #include "kudu/rpc/rpc_header.pb.h"
 #include "kudu/rpc/rpc_introspection.pb.h"
 #include "kudu/rpc/transfer.h"
+#include "kudu/security/tls_socket.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
+#include "kudu/util/metrics.h"
 #include "kudu/util/net/sockaddr.h"
 #include "kudu/util/net/socket.h"
 #include "kudu/util/slice.h"
@@ -53,6 +61,23 @@ using std::shared_ptr;
 using std::unique_ptr;
 using strings::Substitute;
 
+DEFINE_bool(
+    rpc_coalesce_outbound_transfers,
+    true,
+    "Whether a connection sends all of its queued outbound transfers with "
+    "a single write, rather than one write per transfer.");
+TAG_FLAG(rpc_coalesce_outbound_transfers, advanced);
+TAG_FLAG(rpc_coalesce_outbound_transfers, runtime);
+
+DEFINE_int32(
+    rpc_zerocopy_min_bytes,
+    0,
+    "Writes of at least this many bytes on unencrypted connections are sent "
+    "with MSG_ZEROCOPY, so that the kernel doesn't copy them. Connections "
+    "opened while this is 0 never use zero-copy sends.");
+TAG_FLAG(rpc_zerocopy_min_bytes, experimental);
+TAG_FLAG(rpc_zerocopy_min_bytes, runtime);
+
 namespace kudu {
 namespace rpc {
 
@@ -77,7 +102,12 @@ Connection::Connection(
       credentials_policy_(policy),
       negotiation_complete_(false),
       is_confidential_(false),
-      scheduled_for_shutdown_(false) {}
+      scheduled_for_shutdown_(false),
+      flush_deferred_(false),
+      zerocopy_enabled_(false),
+      zerocopy_sends_(0),
+      zerocopy_completed_(0),
+      delayed_release_scheduled_(false) {}
 
 Status Connection::SetNonBlocking(bool enabled) {
   return socket_->SetNonBlocking(enabled);
@@ -102,6 +132,7 @@ void Connection::EpollRegister(ev::loop_ref& loop) {
 Connection::~Connection() {
   // Must clear the outbound_transfers_ list before deleting.
   CHECK(outbound_transfers_.begin() == outbound_transfers_.end());
+  CHECK(zerocopy_transfers_.begin() == zerocopy_transfers_.end());
 
   // It's crucial that the connection is Shutdown first -- otherwise
   // our destructor will end up calling read_io_.stop() and write_io_.stop()
@@ -118,7 +149,8 @@ bool Connection::Idle() const {
     return false;
   }
   // check if we still need to send something
-  if (!outbound_transfers_.empty()) {
+  if (!outbound_transfers_.empty() || !zerocopy_transfers_.empty() ||
+      !delayed_transfers_.empty()) {
     return false;
   }
   // can't kill a connection if calls are waiting response
@@ -180,6 +212,15 @@ void Connection::Shutdown(
     outbound_transfers_.pop_front();
     delete t;
   }
+  while (!zerocopy_transfers_.empty()) {
+    OutboundTransfer* t = &zerocopy_transfers_.front();
+    zerocopy_transfers_.pop_front();
+    delete t;
+  }
+  for (const auto& delayed : delayed_transfers_) {
+    delete delayed.second;
+  }
+  delayed_transfers_.clear();
 
   read_io_.stop();
   write_io_.stop();
@@ -204,9 +245,26 @@ void Connection::QueueOutbound(gscoped_ptr<OutboundTransfer> transfer) {
 
   DVLOG(3) << "Queueing transfer: " << transfer->HexDump();
 
+  if (PREDICT_FALSE(MaybeDelayOutbound(&transfer))) {
+    return;
+  }
+  EnqueueOutbound(std::move(transfer));
+}
+
+void Connection::EnqueueOutbound(gscoped_ptr<OutboundTransfer> transfer) {
   outbound_transfers_.push_back(*transfer.release());
 
   if (negotiation_complete_ && !write_io_.is_active()) {
+    if (FLAGS_rpc_coalesce_outbound_transfers &&
+        reactor_thread_->running_tasks_) {
+      // Other tasks run in the same wakeup are likely to queue transfers
+      // too, so send them all together once the tasks are done.
+      if (!flush_deferred_) {
+        flush_deferred_ = true;
+        reactor_thread_->deferred_flush_conns_.emplace_back(this);
+      }
+      return;
+    }
     // Optimistically assume that the socket is writable if we didn't already
     // have something queued.
     if (ProcessOutboundTransfers() == kMoreToSend) {
@@ -215,6 +273,77 @@ void Connection::QueueOutbound(gscoped_ptr<OutboundTransfer> transfer) {
   }
 }
 
+bool Connection::MaybeDelayOutbound(gscoped_ptr<OutboundTransfer>* transfer) {
+  EmulatedLink link;
+  if (PREDICT_TRUE(
+          !GetEmulatedLink(remote_, &link) && delayed_transfers_.empty())) {
+    return false;
+  }
+  // Even with emulation turned off, transfers must not overtake the ones
+  // still held back, so they go through the emulator as over a perfect
+  // link until those are out.
+  if (!link_emulator_) {
+    link_emulator_.reset(
+        new LinkEmulator(static_cast<uint32_t>(remote_.HashCode())));
+  }
+  MonoTime now = MonoTime::Now();
+  MonoTime due =
+      link_emulator_->Schedule(link, (*transfer)->TotalLength(), now);
+  if (due <= now && delayed_transfers_.empty()) {
+    return false;
+  }
+  delayed_transfers_.emplace_back(due, transfer->release());
+  if (!delayed_release_scheduled_) {
+    ScheduleDelayedRelease();
+  }
+  return true;
+}
+
+void Connection::ScheduleDelayedRelease() {
+  DCHECK(!delayed_transfers_.empty());
+  delayed_release_scheduled_ = true;
+  MonoDelta wait = delayed_transfers_.front().first - MonoTime::Now();
+  scoped_refptr<Connection> self(this);
+  reactor_thread_->reactor()->ScheduleReactorTask(new DelayedTask(
+      [self](const Status& s) { self->ReleaseDelayedOutbound(s); },
+      std::max(wait, MonoDelta::FromNanoseconds(0))));
+}
+
+void Connection::ReleaseDelayedOutbound(const Status& status) {
+  // The reactor aborts its delayed tasks when it shuts down, possibly from
+  // another thread. Shutdown() then drops the transfers.
+  if (!status.ok()) {
+    return;
+  }
+  DCHECK(reactor_thread_->IsCurrentThread());
+  delayed_release_scheduled_ = false;
+  if (!shutdown_status_.ok()) {
+    return;
+  }
+  MonoTime now = MonoTime::Now();
+  while (!delayed_transfers_.empty() &&
+         delayed_transfers_.front().first <= now) {
+    gscoped_ptr<OutboundTransfer> transfer(delayed_transfers_.front().second);
+    delayed_transfers_.pop_front();
+    EnqueueOutbound(std::move(transfer));
+  }
+  if (!delayed_transfers_.empty()) {
+    ScheduleDelayedRelease();
+  }
+}
+
+void Connection::FlushDeferredOutbound() {
+  DCHECK(reactor_thread_->IsCurrentThread());
+  flush_deferred_ = false;
+  if (!shutdown_status_.ok() || write_io_.is_active() ||
+      outbound_transfers_.empty()) {
+    return;
+  }
+  if (ProcessOutboundTransfers() == kMoreToSend) {
+    write_io_.start();
+  }
+}
+
 Connection::CallAwaitingResponse::~CallAwaitingResponse() {
   DCHECK(conn->reactor_thread_->IsCurrentThread());
 }
@@ -241,6 +370,27 @@ void Connection::CallAwaitingResponse::HandleTimeout(
   conn->HandleOutboundCallTimeout(this);
 }
 
+void Connection::CallAwaitingResponse::Fire() {
+  if (remaining_timeout > 0) {
+    MonoTime now = MonoTime::Now();
+    MonoDelta late = now - deadline();
+    if (late.ToSeconds() > 1.0) {
+      LOG(WARNING)
+          << "RPC call timeout handler was delayed by " << late.ToSeconds()
+          << "s! This may be due to a process-wide "
+          << "pause such as swapping, logging-related delays, or allocator lock "
+          << "contention. Will allow an additional " << remaining_timeout
+          << "s for a response.";
+    }
+    conn->reactor_thread_->ScheduleTimer(
+        this, now + MonoDelta::FromSeconds(remaining_timeout));
+    remaining_timeout = 0;
+    return;
+  }
+
+  conn->HandleOutboundCallTimeout(this);
+}
+
 void Connection::HandleOutboundCallTimeout(CallAwaitingResponse* car) {
   DCHECK(reactor_thread_->IsCurrentThread());
   DCHECK(car->call);
@@ -295,9 +445,20 @@ struct CallTransferCallbacks : public TransferCallbacks {
   explicit CallTransferCallbacks(
       shared_ptr<OutboundCall> call,
       Connection* conn)
-      : call_(std::move(call)), conn_(conn) {}
+      : call_(std::move(call)), conn_(conn), written_(false) {}
 
   virtual void NotifyTransferFinished() override {
+    if (!written_) {
+      NotifyTransferWritten();
+    }
+    delete this;
+  }
+
+  // The call counts as sent once it is written, so that its response can be
+  // handled; 'call_' keeps the request buffers alive until the zero-copy
+  // sends complete.
+  virtual void NotifyTransferWritten() override {
+    written_ = true;
     // TODO: would be better to cancel the transfer while it is still on the
     // queue if we timed out before the transfer started, but there is still a
     // race in the case of a partial send that we have to handle here
@@ -308,7 +469,6 @@ struct CallTransferCallbacks : public TransferCallbacks {
       // Test cancellation when 'call_' is in 'SENT' state.
       conn_->MaybeInjectCancellation(call_);
     }
-    delete this;
   }
 
   virtual void NotifyTransferAborted(const Status& status) override {
@@ -320,6 +480,7 @@ struct CallTransferCallbacks : public TransferCallbacks {
  private:
   shared_ptr<OutboundCall> call_;
   Connection* conn_;
+  bool written_;
 };
 
 void Connection::QueueOutboundCall(shared_ptr<OutboundCall> call) {
@@ -363,10 +524,13 @@ void Connection::QueueOutboundCall(shared_ptr<OutboundCall> call) {
   // Set up the timeout timer.
   const MonoDelta& timeout = call->controller()->timeout();
   if (timeout.Initialized()) {
-    reactor_thread_->RegisterTimeout(&car->timeout_timer);
-    car->timeout_timer.set<
-        CallAwaitingResponse, // NOLINT(*)
-        &CallAwaitingResponse::HandleTimeout>(car.get());
+    bool use_wheel = reactor_thread_->has_timer_wheel();
+    if (!use_wheel) {
+      reactor_thread_->RegisterTimeout(&car->timeout_timer);
+      car->timeout_timer.set<
+          CallAwaitingResponse, // NOLINT(*)
+          &CallAwaitingResponse::HandleTimeout>(car.get());
+    }
 
     // For calls with a timeout of at least 500ms, we actually run the timeout
     // handler in two stages. The first timeout fires with a timeout 10% less
@@ -403,8 +567,13 @@ void Connection::QueueOutboundCall(shared_ptr<OutboundCall> call) {
       car->remaining_timeout = 0;
     }
 
-    car->timeout_timer.set(time, 0);
-    car->timeout_timer.start();
+    if (use_wheel) {
+      reactor_thread_->ScheduleTimer(
+          car.get(), MonoTime::Now() + MonoDelta::FromSeconds(time));
+    } else {
+      car->timeout_timer.set(time, 0);
+      car->timeout_timer.start();
+    }
   }
 
   TransferCallbacks* cb = new CallTransferCallbacks(std::move(call), this);
@@ -430,6 +599,7 @@ struct ResponseTransferCallbacks : public TransferCallbacks {
   }
 
   virtual void NotifyTransferFinished() override {
+    call_->RecordResponseSent();
     delete this;
   }
 
@@ -517,9 +687,15 @@ void Connection::ReadHandler(ev::io& /* watcher */, int revents) {
   }
   last_activity_time_ = reactor_thread_->cur_time();
 
+  if (zerocopy_enabled_) {
+    // Completions are signalled as socket errors, which wake up this handler.
+    ReapZeroCopyCompletions();
+  }
+
   while (true) {
     if (!inbound_) {
-      inbound_.reset(new InboundTransfer());
+      inbound_.reset(
+          new InboundTransfer(reactor_thread_->inbound_buffer_pool()));
     }
     Status status = inbound_->ReceiveBuffer(*socket_);
     if (PREDICT_FALSE(!status.ok())) {
@@ -599,7 +775,7 @@ void Connection::HandleCallResponse(gscoped_ptr<InboundTransfer> transfer) {
   }
 
   // The car->timeout_timer ev::timer will be stopped automatically by its
-  // destructor.
+  // destructor, which also takes the car off the timer wheel.
   scoped_car car(car_pool_.make_scoped_ptr(car_ptr));
 
   if (PREDICT_FALSE(!car->call)) {
@@ -640,75 +816,145 @@ void Connection::WriteHandler(ev::io& /* watcher */, int revents) {
   }
 }
 
+bool Connection::PrepareToSend(OutboundTransfer* transfer) {
+  if (!transfer->is_for_outbound_call()) {
+    return true;
+  }
+  CallAwaitingResponse* car =
+      FindOrDie(awaiting_response_, transfer->call_id());
+  if (!car->call) {
+    // If the call has already timed out or has already been cancelled,
+    // the 'call' field would be set to NULL. In that case, don't bother
+    // sending it.
+    transfer->Abort(Status::Aborted("already timed out or cancelled"));
+    return false;
+  }
+
+  // If this is the start of the transfer, then check if the server has
+  // the required RPC flags. We have to wait until just before the
+  // transfer in order to ensure that the negotiation has taken place, so
+  // that the flags are available.
+  const set<RpcFeatureFlag>& required_features =
+      car->call->required_rpc_features();
+  if (!includes(
+          remote_features_.begin(),
+          remote_features_.end(),
+          required_features.begin(),
+          required_features.end())) {
+    Status s = Status::NotSupported(
+        "server does not support the required RPC features");
+    transfer->Abort(s);
+    Phase phase = negotiation_complete_ ? Phase::REMOTE_CALL
+                                        : Phase::CONNECTION_NEGOTIATION;
+    car->call->SetFailed(std::move(s), phase);
+    // Test cancellation when 'call_' is in 'FINISHED_ERROR' state.
+    MaybeInjectCancellation(car->call);
+    car->call.reset();
+    return false;
+  }
+
+  car->call->SetSending();
+
+  // Test cancellation when 'call_' is in 'SENDING' state.
+  MaybeInjectCancellation(car->call);
+  return true;
+}
+
 Connection::ProcessOutboundTransfersResult
 Connection::ProcessOutboundTransfers() {
+  struct iovec iov[IOV_MAX];
   while (!outbound_transfers_.empty()) {
-    OutboundTransfer* transfer = &(outbound_transfers_.front());
-    transfer = &(outbound_transfers_.front());
-
-    if (!transfer->TransferStarted()) {
-      if (transfer->is_for_outbound_call()) {
-        CallAwaitingResponse* car =
-            FindOrDie(awaiting_response_, transfer->call_id());
-        if (!car->call) {
-          // If the call has already timed out or has already been cancelled,
-          // the 'call' field would be set to NULL. In that case, don't bother
-          // sending it.
-          outbound_transfers_.pop_front();
-          transfer->Abort(Status::Aborted("already timed out or cancelled"));
-          delete transfer;
-          continue;
-        }
-
-        // If this is the start of the transfer, then check if the server has
-        // the required RPC flags. We have to wait until just before the
-        // transfer in order to ensure that the negotiation has taken place, so
-        // that the flags are available.
-        const set<RpcFeatureFlag>& required_features =
-            car->call->required_rpc_features();
-        if (!includes(
-                remote_features_.begin(),
-                remote_features_.end(),
-                required_features.begin(),
-                required_features.end())) {
-          outbound_transfers_.pop_front();
-          Status s = Status::NotSupported(
-              "server does not support the required RPC features");
-          transfer->Abort(s);
-          Phase phase = negotiation_complete_ ? Phase::REMOTE_CALL
-                                              : Phase::CONNECTION_NEGOTIATION;
-          car->call->SetFailed(std::move(s), phase);
-          // Test cancellation when 'call_' is in 'FINISHED_ERROR' state.
-          MaybeInjectCancellation(car->call);
-          car->call.reset();
-          delete transfer;
-          continue;
-        }
-
-        car->call->SetSending();
-
-        // Test cancellation when 'call_' is in 'SENDING' state.
-        MaybeInjectCancellation(car->call);
+    // Gather as many queued transfers as fit into a single write. Once a
+    // transfer is part of a write it counts as started and is sent in full,
+    // even if the write doesn't complete, since SSL_write() must be retried
+    // with the same data.
+    int n_iovecs = 0;
+    int n_transfers = 0;
+    auto it = outbound_transfers_.begin();
+    while (it != outbound_transfers_.end()) {
+      OutboundTransfer* transfer = &*it;
+      if (!transfer->TransferStarted() && !PrepareToSend(transfer)) {
+        it = outbound_transfers_.erase(it);
+        delete transfer;
+        continue;
+      }
+      int n = transfer->AppendIovecs(iov + n_iovecs, IOV_MAX - n_iovecs);
+      if (n == 0) {
+        break;
       }
+      n_iovecs += n;
+      n_transfers++;
+      ++it;
+      if (!FLAGS_rpc_coalesce_outbound_transfers) {
+        break;
+      }
+    }
+    if (n_transfers == 0) {
+      DCHECK(outbound_transfers_.empty());
+      break;
     }
 
     last_activity_time_ = reactor_thread_->cur_time();
-    Status status = transfer->SendBuffer(*socket_);
+    bool zerocopy = false;
+    if (zerocopy_enabled_ && FLAGS_rpc_zerocopy_min_bytes > 0) {
+      int64_t total_bytes = 0;
+      for (int i = 0; i < n_iovecs; i++) {
+        total_bytes += iov[i].iov_len;
+      }
+      zerocopy = total_bytes >= FLAGS_rpc_zerocopy_min_bytes;
+    }
+    int64_t written = 0;
+    Status status;
+    if (zerocopy) {
+      status = socket_->WritevZeroCopy(iov, n_iovecs, &written);
+      if (PREDICT_FALSE(status.posix_code() == ENOBUFS)) {
+        // Not enough memory to pin the pages: copy them instead.
+        zerocopy = false;
+      }
+    }
+    if (!zerocopy) {
+      status = socket_->Writev(iov, n_iovecs, &written);
+    }
     if (PREDICT_FALSE(!status.ok())) {
-      KLOG_EVERY_N_SECS(WARNING, 300)
-          << ToString()
-          << " send error [EVERY 300 seconds]: " << status.ToString();
-      reactor_thread_->DestroyConnection(this, status);
-      return kConnectionDestroyed;
+      if (!Socket::IsTemporarySocketError(status.posix_code())) {
+        KLOG_EVERY_N_SECS(WARNING, 300)
+            << ToString()
+            << " send error [EVERY 300 seconds]: " << status.ToString();
+        reactor_thread_->DestroyConnection(this, status);
+        return kConnectionDestroyed;
+      }
+      written = 0;
     }
-
-    if (!transfer->TransferFinished()) {
-      DVLOG(3) << ToString() << ": writeHandler: xfer not finished.";
-      return kMoreToSend;
+    Histogram* transfers_per_write =
+        reactor_thread_->transfers_per_write_histogram_.get();
+    if (transfers_per_write) {
+      transfers_per_write->Increment(n_transfers);
     }
 
-    outbound_transfers_.pop_front();
-    delete transfer;
+    uint32_t zerocopy_send = 0;
+    if (zerocopy && written > 0) {
+      zerocopy_send = zerocopy_sends_++;
+    } else {
+      zerocopy = false;
+    }
+    for (int i = 0; i < n_transfers; i++) {
+      OutboundTransfer* transfer = &outbound_transfers_.front();
+      if (zerocopy && written > 0) {
+        transfer->AddZeroCopySend(zerocopy_send);
+      }
+      written = transfer->ConsumeWritten(written);
+      if (!transfer->TransferFinished()) {
+        DVLOG(3) << ToString() << ": writeHandler: xfer not finished.";
+        return kMoreToSend;
+      }
+      outbound_transfers_.pop_front();
+      if (transfer->AwaitingZeroCopy()) {
+        zerocopy_transfers_.push_back(*transfer);
+      } else {
+        delete transfer;
+      }
+    }
+    DCHECK_EQ(0, written);
   }
   return kNoMoreToSend;
 }
@@ -766,6 +1012,31 @@ void Connection::CompleteNegotiation(
 void Connection::MarkNegotiationComplete() {
   DCHECK(reactor_thread_->IsCurrentThread());
   negotiation_complete_ = true;
+  if (FLAGS_rpc_zerocopy_min_bytes > 0) {
+    Status s = socket_->EnableZeroCopy();
+    zerocopy_enabled_ = s.ok();
+    if (!s.ok()) {
+      VLOG(2) << ToString() << ": not using zero-copy sends: " << s.ToString();
+    }
+  }
+}
+
+void Connection::ReapZeroCopyCompletions() {
+  DCHECK(reactor_thread_->IsCurrentThread());
+  Status s = socket_->ReadZeroCopyCompletions(&zerocopy_completed_);
+  if (PREDICT_FALSE(!s.ok())) {
+    KLOG_EVERY_N_SECS(WARNING, 300)
+        << ToString() << " failed to read zero-copy completions: "
+        << s.ToString();
+  }
+  while (!zerocopy_transfers_.empty()) {
+    OutboundTransfer* transfer = &zerocopy_transfers_.front();
+    if (!transfer->MaybeCompleteZeroCopy(zerocopy_completed_)) {
+      break;
+    }
+    zerocopy_transfers_.pop_front();
+    delete transfer;
+  }
 }
 
 Status Connection::DumpPB(
@@ -801,6 +1072,14 @@ Status Connection::DumpPB(
   } else {
     LOG(FATAL);
   }
+  if (negotiation_complete_) {
+    auto* tls_socket = dynamic_cast<security::TlsSocket*>(socket_.get());
+    if (tls_socket) {
+      resp->set_tls_cipher_suite(tls_socket->cipher_suite());
+      resp->set_tls_bytes_encrypted(tls_socket->bytes_encrypted());
+      resp->set_tls_bytes_decrypted(tls_socket->bytes_decrypted());
+    }
+  }
   return Status::OK();
 }
 
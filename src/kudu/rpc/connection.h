@@ -20,6 +20,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <limits>
 #include <memory>
 #include <set>
@@ -37,9 +38,11 @@
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/rpc/connection_direction.h"
 #include "kudu/rpc/connection_id.h"
+#include "kudu/rpc/link_emulation.h"
 #include "kudu/rpc/remote_user.h"
 #include "kudu/rpc/rpc_controller.h"
 #include "kudu/rpc/rpc_header.pb.h"
+#include "kudu/rpc/timer_wheel.h"
 #include "kudu/rpc/transfer.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/net/sockaddr.h"
@@ -126,6 +129,10 @@ class Connection : public RefCountedThreadSafe<Connection> {
   // This may be called from a non-reactor thread.
   void QueueResponseForCall(gscoped_ptr<InboundCall> call);
 
+  // Sends the transfers queued while the reactor thread was running its
+  // tasks. Must be called from the reactor thread.
+  void FlushDeferredOutbound();
+
   // Cancel an outbound call by removing any reference to it by
   // CallAwaitingResponse in 'awaiting_responses_'.
   void CancelOutboundCall(const std::shared_ptr<OutboundCall>& call);
@@ -156,6 +163,15 @@ class Connection : public RefCountedThreadSafe<Connection> {
   // Set/unset the 'confidentiality' property for this connection.
   void set_confidential(bool is_confidential);
 
+  // Whether the connection goes through the messenger's transport rather
+  // than TCP. See transport.h.
+  bool via_transport() const {
+    return via_transport_;
+  }
+  void set_via_transport() {
+    via_transport_ = true;
+  }
+
   // Credentials policy to start connection negotiation.
   CredentialsPolicy credentials_policy() const {
     return credentials_policy_;
@@ -194,7 +210,17 @@ class Connection : public RefCountedThreadSafe<Connection> {
     kConnectionDestroyed
   };
 
-  // Process any pending outbound transfers in outbound_transfers_.
+  // Called before the first byte of 'transfer' is sent. Returns false if the
+  // transfer was aborted instead, in which case the caller must dequeue and
+  // delete it.
+  bool PrepareToSend(OutboundTransfer* transfer);
+
+  // Notifies the transfers in zerocopy_transfers_ whose zero-copy sends the
+  // kernel has completed.
+  void ReapZeroCopyCompletions();
+
+  // Process any pending outbound transfers in outbound_transfers_, sending
+  // as many of them as fit with each write.
   // Result indicates the state of the connection following the attempt.
   //
   // NOTE: This may invoke DestroyConnection() on 'this'.
@@ -274,12 +300,16 @@ class Connection : public RefCountedThreadSafe<Connection> {
 
   // A call which has been fully sent to the server, which we're waiting for
   // the server to process. This is used on the client side only.
-  struct CallAwaitingResponse {
+  struct CallAwaitingResponse : public TimerWheel::Timer {
     ~CallAwaitingResponse();
 
     // Notification from libev that the call has timed out.
     void HandleTimeout(ev::timer& watcher, int revents);
 
+    // Notification from the reactor's timer wheel, which is used instead of
+    // 'timeout_timer' if the reactor has one.
+    void Fire() override;
+
     Connection* conn;
     std::shared_ptr<OutboundCall> call;
     ev::timer timeout_timer;
@@ -324,6 +354,21 @@ class Connection : public RefCountedThreadSafe<Connection> {
   // This must be called from the reactor thread.
   void QueueOutbound(gscoped_ptr<OutboundTransfer> transfer);
 
+  // Adds 'transfer' to outbound_transfers_ and starts sending it.
+  void EnqueueOutbound(gscoped_ptr<OutboundTransfer> transfer);
+
+  // If a WAN link is emulated towards the remote end, holds 'transfer' in
+  // delayed_transfers_ until the emulated link would have delivered it, and
+  // returns true. See link_emulation.h.
+  bool MaybeDelayOutbound(gscoped_ptr<OutboundTransfer>* transfer);
+
+  // Schedules ReleaseDelayedOutbound() for when the first of
+  // delayed_transfers_ is due.
+  void ScheduleDelayedRelease();
+
+  // Moves the delayed transfers which are due to outbound_transfers_.
+  void ReleaseDelayedOutbound(const Status& status);
+
   // Internal test function for injecting cancellation request when 'call'
   // reaches state specified in 'FLAGS_rpc_inject_cancellation_state'.
   void MaybeInjectCancellation(const std::shared_ptr<OutboundCall>& call);
@@ -412,8 +457,37 @@ class Connection : public RefCountedThreadSafe<Connection> {
   // is considered confidential.
   bool is_confidential_;
 
+  bool via_transport_ = false;
+
   // Whether the connection is scheduled for shutdown.
   bool scheduled_for_shutdown_;
+
+  // Whether the reactor thread will call FlushDeferredOutbound() once it
+  // has run its current tasks.
+  bool flush_deferred_;
+
+  // Whether large writes use zero-copy sends; see --rpc_zerocopy_min_bytes.
+  bool zerocopy_enabled_;
+
+  // The number of zero-copy sends made, and how many of them the kernel has
+  // completed.
+  uint32_t zerocopy_sends_;
+  uint32_t zerocopy_completed_;
+
+  // Transfers which are fully written but whose buffers the kernel may still
+  // be reading because of zero-copy sends, in the order they were sent.
+  boost::intrusive::list<OutboundTransfer> zerocopy_transfers_; // NOLINT(*)
+
+  // The emulated link towards the remote end, created with the first
+  // transfer sent while link emulation is on.
+  gscoped_ptr<LinkEmulator> link_emulator_;
+
+  // Transfers held back by link emulation, with the times they are due to
+  // be sent, in order.
+  std::deque<std::pair<MonoTime, OutboundTransfer*>> delayed_transfers_;
+
+  // Whether a reactor task to release delayed_transfers_ is scheduled.
+  bool delayed_release_scheduled_;
 };
 
 } // namespace rpc
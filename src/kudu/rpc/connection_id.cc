@@ -30,7 +30,7 @@ using std::string;
 namespace kudu {
 namespace rpc {
 
-ConnectionId::ConnectionId() {}
+ConnectionId::ConnectionId() : stream_(0) {}
 
 ConnectionId::ConnectionId(
     const Sockaddr& remote,
@@ -38,7 +38,8 @@ ConnectionId::ConnectionId(
     UserCredentials user_credentials)
     : remote_(remote),
       hostname_(std::move(hostname)),
-      user_credentials_(std::move(user_credentials)) {
+      user_credentials_(std::move(user_credentials)),
+      stream_(0) {
   CHECK(!hostname_.empty());
 }
 
@@ -55,8 +56,13 @@ string ConnectionId::ToString() const {
     remote = remote_.ToString();
   }
 
-  return strings::Substitute(
-      "{remote=$0, user_credentials=$1}", remote, user_credentials_.ToString());
+  string ret = strings::Substitute(
+      "{remote=$0, user_credentials=$1", remote, user_credentials_.ToString());
+  if (stream_ != 0) {
+    strings::SubstituteAndAppend(&ret, ", stream=$0", stream_);
+  }
+  ret.append("}");
+  return ret;
 }
 
 size_t ConnectionId::HashCode() const {
@@ -64,12 +70,14 @@ size_t ConnectionId::HashCode() const {
   boost::hash_combine(seed, remote_.HashCode());
   boost::hash_combine(seed, hostname_);
   boost::hash_combine(seed, user_credentials_.HashCode());
+  boost::hash_combine(seed, stream_);
   return seed;
 }
 
 bool ConnectionId::Equals(const ConnectionId& other) const {
   return remote() == other.remote() && hostname_ == other.hostname_ &&
-      user_credentials().Equals(other.user_credentials());
+      user_credentials().Equals(other.user_credentials()) &&
+      stream_ == other.stream_;
 }
 
 size_t ConnectionIdHash::operator()(const ConnectionId& conn_id) const {
@@ -58,6 +58,16 @@ class ConnectionId {
     return user_credentials_;
   }
 
+  // Which of several parallel connections to the remote this identifies (see
+  // Proxy::set_num_streams()). 0 unless the caller stripes its calls.
+  void set_stream(int stream) {
+    stream_ = stream;
+  }
+
+  int stream() const {
+    return stream_;
+  }
+
   // Copy state from another object to this one.
   void CopyFrom(const ConnectionId& other);
 
@@ -78,6 +88,8 @@ class ConnectionId {
   std::string hostname_;
 
   UserCredentials user_credentials_;
+
+  int stream_;
 };
 
 class ConnectionIdHash {
@@ -55,6 +55,7 @@
 DECLARE_int64(remember_clients_ttl_ms);
 DECLARE_int64(remember_responses_ttl_ms);
 DECLARE_int64(result_tracker_gc_interval_ms);
+DECLARE_int64(result_tracker_memory_limit_bytes);
 
 using kudu::pb_util::SecureDebugString;
 using kudu::pb_util::SecureShortDebugString;
@@ -611,6 +612,34 @@ TEST_F(ExactlyOnceRpcTest, TestExactlyOnceSemanticsGarbageCollection) {
   ASSERT_NE(SecureShortDebugString(resp), SecureShortDebugString(original));
 }
 
+// Tests that GC drops cached responses to stay under the memory limit, well
+// before their TTLs run out.
+TEST_F(ExactlyOnceRpcTest, TestExactlyOnceSemanticsMemoryLimit) {
+  ASSERT_OK(StartServer());
+
+  ExactlyOnceResponsePB original;
+  ResultTracker::SequenceNumber sequence_number = 0;
+  ASSERT_OK(MakeAddCall(sequence_number, 1, &original));
+
+  // Under the limit, GC keeps the response.
+  FLAGS_result_tracker_memory_limit_bytes = 1024 * 1024;
+  int64_t memory_consumption = mem_tracker_->consumption();
+  result_tracker_->GCResults();
+  ASSERT_EQ(memory_consumption, mem_tracker_->consumption());
+  ExactlyOnceResponsePB resp;
+  ASSERT_OK(MakeAddCall(sequence_number, 1, &resp));
+  ASSERT_EQ(SecureShortDebugString(original), SecureShortDebugString(resp));
+
+  // Over it, the response goes, and retries are reported as stale.
+  FLAGS_result_tracker_memory_limit_bytes = 1;
+  result_tracker_->GCResults();
+  ASSERT_LT(mem_tracker_->consumption(), memory_consumption);
+  resp.Clear();
+  Status s = MakeAddCall(sequence_number, 1, &resp);
+  ASSERT_TRUE(s.IsRemoteError());
+  ASSERT_STR_CONTAINS(s.ToString(), "is stale");
+}
+
 // This test creates a thread continuously making requests to the server, some
 // lasting longer than the GC period, at the same time it runs GC, making sure
 // that the corresponding CompletionRecords/ClientStates are not deleted from
@@ -313,13 +313,22 @@ void InboundCall::RecordCallReceived() {
   timing_.time_received = MonoTime::Now();
 }
 
-void InboundCall::RecordHandlingStarted(Histogram* incoming_queue_time) {
+void InboundCall::RecordHandlingStarted(
+    Histogram* incoming_queue_time,
+    Histogram* class_queue_time) {
   DCHECK(incoming_queue_time != nullptr);
   DCHECK(
       !timing_.time_handled.Initialized()); // Protect against multiple calls.
   timing_.time_handled = MonoTime::Now();
-  incoming_queue_time->Increment(
-      (timing_.time_handled - timing_.time_received).ToMicroseconds());
+  int64_t queue_time_us =
+      (timing_.time_handled - timing_.time_received).ToMicroseconds();
+  incoming_queue_time->Increment(queue_time_us);
+  if (class_queue_time) {
+    class_queue_time->Increment(queue_time_us);
+  }
+  if (method_info_ && method_info_->queue_time_histogram) {
+    method_info_->queue_time_histogram->Increment(queue_time_us);
+  }
 }
 
 void InboundCall::RecordHandlingCompleted() {
@@ -340,6 +349,17 @@ void InboundCall::RecordHandlingCompleted() {
   }
 }
 
+void InboundCall::RecordResponseSent() {
+  DCHECK(!timing_.time_response_sent.Initialized());
+  timing_.time_response_sent = MonoTime::Now();
+  if (!timing_.time_completed.Initialized() || !method_info_ ||
+      !method_info_->response_send_histogram) {
+    return;
+  }
+  method_info_->response_send_histogram->Increment(
+      (timing_.time_response_sent - timing_.time_completed).ToMicroseconds());
+}
+
 bool InboundCall::ClientTimedOut() const {
   return MonoTime::Now() >= deadline_;
 }
@@ -63,6 +63,7 @@ struct InboundCallTiming {
   MonoTime time_received; // Time the call was first accepted.
   MonoTime time_handled; // Time the call handler was kicked off.
   MonoTime time_completed; // Time the call handler completed.
+  MonoTime time_response_sent; // Time the response was written out.
 
   MonoDelta TotalDuration() const {
     return time_completed - time_received;
@@ -173,6 +174,17 @@ class InboundCall {
     return method_info_.get();
   }
 
+  // Keeps a request which was already parsed from serialized_request(), so
+  // that the handler does not parse it again.
+  void set_parsed_request(std::unique_ptr<google::protobuf::Message> req) {
+    parsed_request_ = std::move(req);
+  }
+
+  // Returns the request set by set_parsed_request(), or nullptr.
+  std::unique_ptr<google::protobuf::Message> release_parsed_request() {
+    return std::move(parsed_request_);
+  }
+
   // When this InboundCall was received (instantiated).
   // Should only be called once on a given instance.
   // Not thread-safe. Should only be called by the current "owner" thread.
@@ -180,9 +192,17 @@ class InboundCall {
 
   // When RPC call Handle() was called on the server side.
   // Updates the Histogram with time elapsed since the call was received,
-  // and should only be called once on a given instance.
+  // and should only be called once on a given instance. If
+  // 'class_queue_time' is set, the time is recorded there as well.
   // Not thread-safe. Should only be called by the current "owner" thread.
-  void RecordHandlingStarted(Histogram* incoming_queue_time);
+  void RecordHandlingStarted(
+      Histogram* incoming_queue_time,
+      Histogram* class_queue_time = nullptr);
+
+  // When the response to this call has been written to the socket. Updates
+  // the method's response send histogram, if any.
+  // Not thread-safe. Should only be called by the reactor thread.
+  void RecordResponseSent();
 
   // Return true if the deadline set by the client has already elapsed.
   // In this case, the server may stop processing the call, since the
@@ -282,6 +302,9 @@ class InboundCall {
   // per-method info such as tracing.
   scoped_refptr<RpcMethodInfo> method_info_;
 
+  // See set_parsed_request().
+  std::unique_ptr<google::protobuf::Message> parsed_request_;
+
   // A time at which the client will time out, or MonoTime::Max if the
   // client did not pass a timeout.
   MonoTime deadline_;
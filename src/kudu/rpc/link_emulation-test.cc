@@ -0,0 +1,152 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/rpc/link_emulation.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/util/monotime.h"
+#include "kudu/util/net/sockaddr.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_int32(rpc_emulated_link_delay_ms);
+DECLARE_int32(rpc_emulated_link_jitter_ms);
+
+using std::string;
+using std::unordered_map;
+
+namespace kudu {
+namespace rpc {
+
+class LinkEmulationTest : public KuduTest {};
+
+TEST_F(LinkEmulationTest, TestParse) {
+  EmulatedLink link;
+  ASSERT_OK(ParseEmulatedLink("50", &link));
+  EXPECT_EQ(50, link.delay.ToMilliseconds());
+  EXPECT_EQ(0, link.jitter.ToNanoseconds());
+  EXPECT_EQ(0, link.bandwidth_bytes_per_sec);
+  EXPECT_EQ(0, link.loss_fraction);
+
+  ASSERT_OK(ParseEmulatedLink("40/5/8000/0.5", &link));
+  EXPECT_EQ(40, link.delay.ToMilliseconds());
+  EXPECT_EQ(5, link.jitter.ToMilliseconds());
+  EXPECT_EQ(1000 * 1000, link.bandwidth_bytes_per_sec);
+  EXPECT_DOUBLE_EQ(0.005, link.loss_fraction);
+
+  ASSERT_OK(ParseEmulatedLink("0", &link));
+  EXPECT_TRUE(link.IsNoop());
+
+  for (const char* bad : {"", "x", "1/2/3/4/5", "-1", "1/2/3/100"}) {
+    Status s = ParseEmulatedLink(bad, &link);
+    EXPECT_TRUE(s.IsInvalidArgument()) << bad << ": " << s.ToString();
+  }
+
+  unordered_map<string, EmulatedLink> links;
+  ASSERT_OK(ParseEmulatedLinks("127.0.0.2=30,127.0.0.3:7051=60/10", &links));
+  ASSERT_EQ(2, links.size());
+  EXPECT_EQ(30, links["127.0.0.2"].delay.ToMilliseconds());
+  EXPECT_EQ(10, links["127.0.0.3:7051"].jitter.ToMilliseconds());
+  ASSERT_OK(ParseEmulatedLinks("", &links));
+  EXPECT_TRUE(links.empty());
+  EXPECT_TRUE(ParseEmulatedLinks("127.0.0.2", &links).IsInvalidArgument());
+  Status s = ParseEmulatedLinks("127.0.0.2=1,127.0.0.2=2", &links);
+  EXPECT_TRUE(s.IsInvalidArgument()) << s.ToString();
+}
+
+TEST_F(LinkEmulationTest, TestDefaultsFromFlags) {
+  Sockaddr addr;
+  ASSERT_OK(addr.ParseString("127.0.0.1", 12345));
+  EmulatedLink link;
+  ASSERT_FALSE(GetEmulatedLink(addr, &link));
+
+  FLAGS_rpc_emulated_link_delay_ms = 25;
+  FLAGS_rpc_emulated_link_jitter_ms = 3;
+  ASSERT_TRUE(GetEmulatedLink(addr, &link));
+  EXPECT_EQ(25, link.delay.ToMilliseconds());
+  EXPECT_EQ(3, link.jitter.ToMilliseconds());
+}
+
+TEST_F(LinkEmulationTest, TestDelayAndJitter) {
+  EmulatedLink link;
+  link.delay = MonoDelta::FromMilliseconds(20);
+  link.jitter = MonoDelta::FromMilliseconds(5);
+  LinkEmulator emulator(SeedRandom());
+  MonoTime now = MonoTime::Now();
+  MonoTime last = now;
+  for (int i = 0; i < 1000; i++) {
+    MonoTime sent = now + MonoDelta::FromMicroseconds(i);
+    MonoTime delivery = emulator.Schedule(link, 100, sent);
+    MonoDelta latency = delivery - sent;
+    // Jitter may be absorbed by keeping messages in order, but never adds
+    // more than its bound on top of the delay.
+    ASSERT_GE(latency.ToMicroseconds(), 20 * 1000);
+    ASSERT_LE(latency.ToMicroseconds(), 25 * 1000);
+    ASSERT_TRUE(last <= delivery);
+    last = delivery;
+  }
+}
+
+TEST_F(LinkEmulationTest, TestBandwidth) {
+  EmulatedLink link;
+  link.bandwidth_bytes_per_sec = 1000 * 1000;
+  LinkEmulator emulator(SeedRandom());
+  MonoTime now = MonoTime::Now();
+  // Ten back-to-back 100KB messages take a second to serialize at 1MB/s.
+  MonoTime delivery;
+  for (int i = 0; i < 10; i++) {
+    delivery = emulator.Schedule(link, 100 * 1000, now);
+  }
+  ASSERT_EQ(1000, (delivery - now).ToMilliseconds());
+
+  // Once the link drains, a message goes out right away again.
+  MonoTime later = now + MonoDelta::FromSeconds(5);
+  delivery = emulator.Schedule(link, 1000, later);
+  ASSERT_EQ(1, (delivery - later).ToMilliseconds());
+}
+
+TEST_F(LinkEmulationTest, TestLoss) {
+  EmulatedLink link;
+  link.delay = MonoDelta::FromMilliseconds(10);
+  link.loss_fraction = 0.1;
+  LinkEmulator emulator(SeedRandom());
+  MonoTime now = MonoTime::Now();
+  const int kMessages = 10000;
+  int retransmitted = 0;
+  for (int i = 0; i < kMessages; i++) {
+    // Space the messages out so that none is held up by an earlier one.
+    MonoTime sent = now + MonoDelta::FromSeconds(i);
+    MonoDelta latency = emulator.Schedule(link, 100, sent) - sent;
+    if (latency.ToMilliseconds() > 10) {
+      ASSERT_EQ(210, latency.ToMilliseconds());
+      retransmitted++;
+    }
+  }
+  // One segment per message, so about 10% of them are retransmitted.
+  ASSERT_GT(retransmitted, kMessages / 20);
+  ASSERT_LT(retransmitted, kMessages / 5);
+}
+
+} // namespace rpc
+} // namespace kudu
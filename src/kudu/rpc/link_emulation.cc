@@ -0,0 +1,238 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/rpc/link_emulation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/gutil/strings/numbers.h"
+#include "kudu/gutil/strings/split.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/net/sockaddr.h"
+
+DEFINE_int32(
+    rpc_emulated_link_delay_ms,
+    0,
+    "One-way delay added to everything this process sends over RPC "
+    "connections, to emulate a wide area network. Only for testing.");
+TAG_FLAG(rpc_emulated_link_delay_ms, unsafe);
+TAG_FLAG(rpc_emulated_link_delay_ms, runtime);
+
+DEFINE_int32(
+    rpc_emulated_link_jitter_ms,
+    0,
+    "Each RPC message sent is additionally delayed by a uniformly random "
+    "amount of up to this many milliseconds. Only for testing.");
+TAG_FLAG(rpc_emulated_link_jitter_ms, unsafe);
+TAG_FLAG(rpc_emulated_link_jitter_ms, runtime);
+
+DEFINE_int32(
+    rpc_emulated_link_bandwidth_kbps,
+    0,
+    "If positive, the bandwidth in kilobits per second of each emulated "
+    "RPC connection. Only for testing.");
+TAG_FLAG(rpc_emulated_link_bandwidth_kbps, unsafe);
+TAG_FLAG(rpc_emulated_link_bandwidth_kbps, runtime);
+
+DEFINE_double(
+    rpc_emulated_link_loss_pct,
+    0,
+    "Percentage of TCP segments lost on emulated RPC connections. A lost "
+    "segment delays its message by a retransmission timeout. Only for "
+    "testing.");
+TAG_FLAG(rpc_emulated_link_loss_pct, unsafe);
+TAG_FLAG(rpc_emulated_link_loss_pct, runtime);
+
+DEFINE_string(
+    rpc_emulated_links,
+    "",
+    "Comma-separated list of address[:port]=delay_ms[/jitter_ms"
+    "[/bandwidth_kbps[/loss_pct]]] entries giving the emulated link towards "
+    "particular destinations, overriding the --rpc_emulated_link_* "
+    "defaults. An entry of 0 turns emulation off for that destination. "
+    "Only for testing.");
+TAG_FLAG(rpc_emulated_links, unsafe);
+
+static bool ValidateEmulatedLinks(const char*, const std::string& value) {
+  std::unordered_map<std::string, kudu::rpc::EmulatedLink> links;
+  kudu::Status s = kudu::rpc::ParseEmulatedLinks(value, &links);
+  if (!s.ok()) {
+    LOG(ERROR) << "Invalid --rpc_emulated_links: " << s.ToString();
+    return false;
+  }
+  return true;
+}
+DEFINE_validator(rpc_emulated_links, &ValidateEmulatedLinks);
+
+DEFINE_validator(rpc_emulated_link_loss_pct, [](const char*, double value) {
+  return value >= 0 && value < 100;
+});
+
+using std::string;
+using std::unordered_map;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace rpc {
+
+namespace {
+
+// The payload of a full-sized TCP segment over Ethernet.
+constexpr int64_t kSegmentBytes = 1448;
+
+// Linux never retransmits a lost segment sooner than this.
+const MonoDelta kMinRetransmitTimeout = MonoDelta::FromMilliseconds(200);
+
+int64_t KbpsToBytesPerSec(int64_t kbps) {
+  return kbps * 1000 / 8;
+}
+
+} // anonymous namespace
+
+bool EmulatedLink::IsNoop() const {
+  return delay.ToNanoseconds() <= 0 && jitter.ToNanoseconds() <= 0 &&
+      bandwidth_bytes_per_sec <= 0 && loss_fraction <= 0;
+}
+
+Status ParseEmulatedLink(const string& spec, EmulatedLink* link) {
+  vector<string> fields = strings::Split(spec, "/");
+  if (fields.empty() || fields.size() > 4) {
+    return Status::InvalidArgument("invalid emulated link", spec);
+  }
+  int32_t delay_ms = 0;
+  int32_t jitter_ms = 0;
+  int32_t bandwidth_kbps = 0;
+  double loss_pct = 0;
+  if (!safe_strto32(fields[0], &delay_ms) ||
+      (fields.size() > 1 && !safe_strto32(fields[1], &jitter_ms)) ||
+      (fields.size() > 2 && !safe_strto32(fields[2], &bandwidth_kbps)) ||
+      (fields.size() > 3 && !safe_strtod(fields[3], &loss_pct))) {
+    return Status::InvalidArgument("invalid emulated link", spec);
+  }
+  if (delay_ms < 0 || jitter_ms < 0 || bandwidth_kbps < 0 || loss_pct < 0 ||
+      loss_pct >= 100) {
+    return Status::InvalidArgument("emulated link out of range", spec);
+  }
+  link->delay = MonoDelta::FromMilliseconds(delay_ms);
+  link->jitter = MonoDelta::FromMilliseconds(jitter_ms);
+  link->bandwidth_bytes_per_sec = KbpsToBytesPerSec(bandwidth_kbps);
+  link->loss_fraction = loss_pct / 100;
+  return Status::OK();
+}
+
+Status ParseEmulatedLinks(
+    const string& spec,
+    unordered_map<string, EmulatedLink>* links) {
+  links->clear();
+  vector<string> entries = strings::Split(spec, ",", strings::SkipEmpty());
+  for (const string& entry : entries) {
+    vector<string> kv = strings::Split(entry, "=");
+    if (kv.size() != 2 || kv[0].empty()) {
+      return Status::InvalidArgument("invalid emulated link entry", entry);
+    }
+    EmulatedLink link;
+    RETURN_NOT_OK(ParseEmulatedLink(kv[1], &link));
+    if (!links->emplace(kv[0], link).second) {
+      return Status::InvalidArgument(
+          Substitute("duplicate emulated link for $0", kv[0]));
+    }
+  }
+  return Status::OK();
+}
+
+bool GetEmulatedLink(const Sockaddr& remote, EmulatedLink* link) {
+  // --rpc_emulated_links can't change at runtime, so parse it once.
+  static const unordered_map<string, EmulatedLink>* const overrides = [] {
+    auto* links = new unordered_map<string, EmulatedLink>();
+    CHECK_OK(ParseEmulatedLinks(FLAGS_rpc_emulated_links, links));
+    return links;
+  }();
+
+  if (PREDICT_FALSE(!overrides->empty())) {
+    auto it = overrides->find(remote.ToString());
+    if (it == overrides->end()) {
+      it = overrides->find(remote.host());
+    }
+    if (it != overrides->end()) {
+      *link = it->second;
+      return !link->IsNoop();
+    }
+  }
+
+  link->delay = MonoDelta::FromMilliseconds(FLAGS_rpc_emulated_link_delay_ms);
+  link->jitter =
+      MonoDelta::FromMilliseconds(FLAGS_rpc_emulated_link_jitter_ms);
+  link->bandwidth_bytes_per_sec =
+      KbpsToBytesPerSec(FLAGS_rpc_emulated_link_bandwidth_kbps);
+  link->loss_fraction = FLAGS_rpc_emulated_link_loss_pct / 100;
+  return !link->IsNoop();
+}
+
+LinkEmulator::LinkEmulator(uint32_t seed)
+    : rng_(seed),
+      link_free_(MonoTime::Min()),
+      last_delivery_(MonoTime::Min()) {}
+
+MonoTime LinkEmulator::Schedule(
+    const EmulatedLink& link,
+    size_t bytes,
+    MonoTime now) {
+  // The message starts going out once the link is done with the previous
+  // ones, and takes up the link for as long as its bytes take at the
+  // link's bandwidth.
+  link_free_ = std::max(link_free_, now);
+  if (link.bandwidth_bytes_per_sec > 0) {
+    link_free_ += MonoDelta::FromNanoseconds(
+        bytes * MonoTime::kNanosecondsPerSecond /
+        link.bandwidth_bytes_per_sec);
+  }
+
+  MonoTime delivery = link_free_ + link.delay;
+  if (link.jitter.ToNanoseconds() > 0) {
+    delivery += MonoDelta::FromNanoseconds(
+        rng_.Uniform64(link.jitter.ToNanoseconds() + 1));
+  }
+  if (link.loss_fraction > 0) {
+    // The message is held up if any of its segments is lost. TCP then
+    // resends it after a timeout of at least one round trip.
+    int64_t segments =
+        std::max<int64_t>(1, (bytes + kSegmentBytes - 1) / kSegmentBytes);
+    double p_message_lost = 1 - std::pow(1 - link.loss_fraction, segments);
+    if (rng_.NextDoubleFraction() < p_message_lost) {
+      delivery += std::max(
+          kMinRetransmitTimeout,
+          MonoDelta::FromNanoseconds(2 * link.delay.ToNanoseconds()));
+    }
+  }
+
+  // TCP delivers in order, so a message never overtakes an earlier one.
+  delivery = std::max(delivery, last_delivery_);
+  last_delivery_ = delivery;
+  return delivery;
+}
+
+} // namespace rpc
+} // namespace kudu
@@ -0,0 +1,103 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "kudu/util/monotime.h"
+#include "kudu/util/random.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+class Sockaddr;
+
+namespace rpc {
+
+// Emulation of wide area network links on RPC connections, so that a
+// cluster running on one host sees the round trip times, jitter, bandwidth
+// caps and packet loss of a cross-region deployment.
+//
+// The emulation delays what this process writes to a connection; it does
+// not touch what it reads. A link between two servers is therefore
+// emulated in both directions only when both are configured, and each
+// side's settings give the one-way characteristics of its half.
+
+// The characteristics of one direction of an emulated link.
+struct EmulatedLink {
+  // One-way propagation delay.
+  MonoDelta delay;
+
+  // Each message is additionally delayed by a uniformly random amount of
+  // up to this much.
+  MonoDelta jitter;
+
+  // The rate at which the link carries bytes, or 0 if unlimited.
+  int64_t bandwidth_bytes_per_sec = 0;
+
+  // The fraction of TCP segments lost. A lost segment holds up its message
+  // for a retransmission timeout, as it would over a real TCP connection.
+  double loss_fraction = 0;
+
+  bool IsNoop() const;
+};
+
+// Parses a link from "delay_ms[/jitter_ms[/bandwidth_kbps[/loss_pct]]]".
+Status ParseEmulatedLink(const std::string& spec, EmulatedLink* link);
+
+// Parses a comma-separated list of "address[:port]=link" entries, where each
+// link is in the format accepted by ParseEmulatedLink().
+Status ParseEmulatedLinks(
+    const std::string& spec,
+    std::unordered_map<std::string, EmulatedLink>* links);
+
+// Sets 'link' to the link to emulate towards 'remote' according to the
+// --rpc_emulated_link* flags, and returns whether there is one. An entry of
+// --rpc_emulated_links for the remote's address and port takes precedence
+// over one for its address alone, which takes precedence over the
+// defaults.
+bool GetEmulatedLink(const Sockaddr& remote, EmulatedLink* link);
+
+// Tracks the messages sent over one emulated link and decides when each is
+// delivered.
+//
+// Not thread safe.
+class LinkEmulator {
+ public:
+  explicit LinkEmulator(uint32_t seed);
+
+  // Returns when a message of 'bytes' handed to 'link' at 'now' reaches the
+  // far end. Messages are delivered in the order they were sent, as over
+  // TCP, so the returned times never decrease.
+  MonoTime Schedule(const EmulatedLink& link, size_t bytes, MonoTime now);
+
+ private:
+  Random rng_;
+
+  // When the link has finished serializing the messages sent so far.
+  MonoTime link_free_;
+
+  // The delivery time of the last message.
+  MonoTime last_delivery_;
+};
+
+} // namespace rpc
+} // namespace kudu
@@ -25,6 +25,9 @@
 #include <type_traits>
 #include <utility>
 
+#include <boost/algorithm/string/predicate.hpp>
+#include <ev++.h>
+#include <gflags/gflags_declare.h>
 #include <glog/logging.h>
 
 #include "kudu/gutil/gscoped_ptr.h"
@@ -45,10 +48,12 @@
 #include "kudu/rpc/sasl_common.h"
 #include "kudu/rpc/server_negotiation.h"
 #include "kudu/rpc/service_if.h"
+#include "kudu/rpc/transport.h"
 #include "kudu/security/openssl_util.h"
 #include "kudu/security/tls_context.h"
 #include "kudu/security/token_verifier.h"
 #include "kudu/util/flags.h"
+#include "kudu/util/io_uring.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/net/socket.h"
@@ -57,13 +62,31 @@
 #include "kudu/util/thread_restrictions.h"
 #include "kudu/util/threadpool.h"
 
+DECLARE_int32(rpc_acceptor_listen_sockets);
+
 using std::make_shared;
 using std::shared_ptr;
 using std::string;
+using std::unique_ptr;
 using strings::Substitute;
 
 constexpr int kMinSockBuf = 1024;
 
+// When compiling on Mac OS X, use 'kqueue' instead of the default, 'select',
+// for the event loop. Otherwise we run into problems because 'select' can't
+// handle connections when more than 1024 file descriptors are open by the
+// process.
+#if defined(__APPLE__)
+static const int kDefaultLibEvFlags = ev::KQUEUE;
+#else
+static const int kDefaultLibEvFlags = ev::AUTO;
+#endif
+
+// libev gained its io_uring backend in 4.31.
+#if EV_VERSION_MAJOR > 4 || (EV_VERSION_MAJOR == 4 && EV_VERSION_MINOR >= 31)
+#define KUDU_LIBEV_HAS_IO_URING 1
+#endif
+
 namespace boost {
 template <typename Signature>
 class function;
@@ -89,7 +112,9 @@ MessengerBuilder::MessengerBuilder(std::string name)
       enable_inbound_tls_(false),
       reuseport_(false),
       send_buf_(0),
-      receive_buf_(0) {}
+      receive_buf_(0),
+      reactor_backend_("auto"),
+      reactor_libev_flags_(0) {}
 
 MessengerBuilder& MessengerBuilder::set_connection_keepalive_time(
     const MonoDelta& keepalive) {
@@ -224,10 +249,65 @@ MessengerBuilder& MessengerBuilder::set_receive_buf(int receive_buf) {
   return *this;
 }
 
+MessengerBuilder& MessengerBuilder::set_reactor_backend(
+    const string& reactor_backend) {
+  reactor_backend_ = reactor_backend;
+  return *this;
+}
+
+MessengerBuilder& MessengerBuilder::set_reactor_cpus(std::vector<int> cpus) {
+  reactor_cpus_ = std::move(cpus);
+  return *this;
+}
+
+MessengerBuilder& MessengerBuilder::set_timer_wheel_tick(
+    const MonoDelta& tick) {
+  timer_wheel_tick_ = tick;
+  return *this;
+}
+
+MessengerBuilder& MessengerBuilder::set_transport(
+    shared_ptr<Transport> transport) {
+  transport_ = std::move(transport);
+  return *this;
+}
+
+Status MessengerBuilder::ResolveReactorBackend() {
+  if (boost::iequals(reactor_backend_, "auto")) {
+    reactor_libev_flags_ = kDefaultLibEvFlags;
+  } else if (boost::iequals(reactor_backend_, "epoll")) {
+    if (!(ev::supported_backends() & ev::EPOLL)) {
+      return Status::NotSupported("epoll reactor backend is not supported");
+    }
+    reactor_libev_flags_ = ev::EPOLL;
+  } else if (boost::iequals(reactor_backend_, "io_uring")) {
+#ifdef KUDU_LIBEV_HAS_IO_URING
+    if ((ev::supported_backends() & EVBACKEND_IOURING) &&
+        IoUring::IsSupported()) {
+      reactor_libev_flags_ = EVBACKEND_IOURING;
+      return Status::OK();
+    }
+#endif
+    LOG(WARNING) << "io_uring reactor backend is not available for messenger "
+                 << name_ << "; using the default backend";
+    reactor_backend_ = "auto";
+    reactor_libev_flags_ = kDefaultLibEvFlags;
+  } else {
+    return Status::InvalidArgument(
+        "unknown reactor backend; must be one of 'auto', 'epoll' or "
+        "'io_uring'",
+        reactor_backend_);
+  }
+  return Status::OK();
+}
+
 Status MessengerBuilder::Build(shared_ptr<Messenger>* msgr) {
   // Initialize SASL library before we start making requests
   RETURN_NOT_OK(SaslInit(!keytab_file_.empty()));
 
+  // The reactors create their event loops in the Messenger constructor.
+  RETURN_NOT_OK(ResolveReactorBackend());
+
   Messenger* new_msgr(new Messenger(*this));
 
   auto cleanup =
@@ -357,7 +437,8 @@ Status Messenger::AddAcceptorPool(
   Socket sock;
   RETURN_NOT_OK(sock.Init(0));
   RETURN_NOT_OK(sock.SetReuseAddr(true));
-  if (reuseport_) {
+  // The acceptor pool binds its other listening sockets to the same port.
+  if (reuseport_ || FLAGS_rpc_acceptor_listen_sockets > 1) {
     RETURN_NOT_OK(sock.SetReusePort(true));
   }
   RETURN_NOT_OK(sock.Bind(accept_addr));
@@ -408,7 +489,8 @@ Status Messenger::UnregisterService(const string& service_name) {
 }
 
 void Messenger::QueueOutboundCall(const shared_ptr<OutboundCall>& call) {
-  Reactor* reactor = RemoteToReactor(call->conn_id().remote());
+  Reactor* reactor =
+      RemoteToReactor(call->conn_id().remote(), call->conn_id().stream());
   reactor->QueueOutboundCall(call);
 }
 
@@ -435,15 +517,26 @@ void Messenger::QueueInboundCall(gscoped_ptr<InboundCall> call) {
 }
 
 void Messenger::QueueCancellation(const shared_ptr<OutboundCall>& call) {
-  Reactor* reactor = RemoteToReactor(call->conn_id().remote());
+  Reactor* reactor =
+      RemoteToReactor(call->conn_id().remote(), call->conn_id().stream());
   reactor->QueueCancellation(call);
 }
 
 void Messenger::RegisterInboundSocket(
     Socket* new_socket,
+    const Sockaddr& remote,
+    int reactor_index) {
+  Reactor* reactor = reactor_index < 0
+      ? RemoteToReactor(remote)
+      : reactors_[reactor_index % reactors_.size()];
+  reactor->RegisterInboundSocket(new_socket, remote);
+}
+
+void Messenger::RegisterInboundSocket(
+    unique_ptr<Socket> new_socket,
     const Sockaddr& remote) {
   Reactor* reactor = RemoteToReactor(remote);
-  reactor->RegisterInboundSocket(new_socket, remote);
+  reactor->RegisterInboundSocket(std::move(new_socket), remote);
 }
 
 Messenger::Messenger(const MessengerBuilder& bld)
@@ -463,6 +556,8 @@ Messenger::Messenger(const MessengerBuilder& bld)
       reuseport_(bld.reuseport_),
       send_buf_(bld.send_buf_),
       receive_buf_(bld.receive_buf_),
+      reactor_backend_(bld.reactor_backend_),
+      transport_(bld.transport_),
       retain_self_(this) {
   for (int i = 0; i < bld.num_reactors_; i++) {
     reactors_.push_back(new Reactor(retain_self_, i, bld));
@@ -475,6 +570,9 @@ Messenger::Messenger(const MessengerBuilder& bld)
                .set_min_threads(bld.min_negotiation_threads_)
                .set_max_threads(bld.max_negotiation_threads_)
                .Build(&server_negotiation_pool_));
+  if (metric_entity_) {
+    token_verifier_->InitMetrics(metric_entity_);
+  }
 }
 
 Messenger::~Messenger() {
@@ -483,8 +581,8 @@ Messenger::~Messenger() {
   STLDeleteElements(&reactors_);
 }
 
-Reactor* Messenger::RemoteToReactor(const Sockaddr& remote) {
-  uint32_t hashCode = remote.HashCode();
+Reactor* Messenger::RemoteToReactor(const Sockaddr& remote, int stream) {
+  uint32_t hashCode = remote.HashCode() + stream;
   int reactor_idx = hashCode % reactors_.size();
   // This is just a static partitioning; we could get a lot
   // fancier with assigning Sockaddrs to Reactors.
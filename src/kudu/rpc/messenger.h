@@ -68,6 +68,7 @@ class OutboundCall;
 class Reactor;
 class RpcService;
 class RpczStore;
+class Transport;
 
 struct AcceptorPoolInfo {
  public:
@@ -186,9 +187,32 @@ class MessengerBuilder {
   // as 0.
   MessengerBuilder& set_receive_buf(int receive_buf);
 
+  // Set the event loop backend of the reactor threads. 'auto' lets libev pick
+  // the best one available, while 'epoll' and 'io_uring' ask for that Linux
+  // interface. 'io_uring' needs a libev with io_uring support (4.31 or later)
+  // and a kernel which supports it; without those it falls back to 'auto'.
+  MessengerBuilder& set_reactor_backend(const std::string& reactor_backend);
+
+  // Pin each reactor thread to one of 'cpus', round-robin by reactor index.
+  // An empty list leaves the reactors unpinned.
+  MessengerBuilder& set_reactor_cpus(std::vector<int> cpus);
+
+  // Keep the timeouts of outbound calls and the tasks scheduled with
+  // Messenger::ScheduleOnReactor() on a timing wheel of 'tick' granularity in
+  // each reactor, rather than on a libev timer each. They may then fire up to
+  // a tick late. An uninitialized or zero 'tick' keeps the libev timers.
+  MessengerBuilder& set_timer_wheel_tick(const MonoDelta& tick);
+
+  // Connect to the remotes 'transport' handles through it, and accept its
+  // connections alongside those of the acceptor pools. See transport.h.
+  MessengerBuilder& set_transport(std::shared_ptr<Transport> transport);
+
   Status Build(std::shared_ptr<Messenger>* msgr);
 
  private:
+  // Maps 'reactor_backend_' to the libev flags of the reactors' event loops.
+  Status ResolveReactorBackend();
+
   const std::string name_;
   MonoDelta connection_keepalive_time_;
   int num_reactors_;
@@ -211,6 +235,11 @@ class MessengerBuilder {
   bool reuseport_;
   int send_buf_;
   int receive_buf_;
+  std::string reactor_backend_;
+  int reactor_libev_flags_;
+  std::vector<int> reactor_cpus_;
+  MonoDelta timer_wheel_tick_;
+  std::shared_ptr<Transport> transport_;
 };
 
 // A Messenger is a container for the reactor threads which run event loops
@@ -287,8 +316,18 @@ class Messenger {
   // Queue a cancellation for the given outbound call.
   void QueueCancellation(const std::shared_ptr<OutboundCall>& call);
 
-  // Take ownership of the socket via Socket::Release
-  void RegisterInboundSocket(Socket* new_socket, const Sockaddr& remote);
+  // Take ownership of the socket via Socket::Release. The connection goes to
+  // the reactor 'reactor_index' modulo the number of reactors, or, if it is
+  // negative, to the one the remote hashes to.
+  void RegisterInboundSocket(
+      Socket* new_socket,
+      const Sockaddr& remote,
+      int reactor_index = -1);
+
+  // Like the above, for a connection accepted by the transport.
+  void RegisterInboundSocket(
+      std::unique_ptr<Socket> new_socket,
+      const Sockaddr& remote);
 
   // Dump the current RPCs into the given protobuf.
   Status DumpRunningRpcs(
@@ -366,6 +405,16 @@ class Messenger {
     return rpc_negotiation_timeout_ms_;
   }
 
+  // The event loop backend of the reactor threads, after any fallback.
+  const std::string& reactor_backend() const {
+    return reactor_backend_;
+  }
+
+  // The transport set with MessengerBuilder::set_transport(), or null.
+  Transport* transport() const {
+    return transport_.get();
+  }
+
   const std::string& sasl_proto_name() const {
     return sasl_proto_name_;
   }
@@ -400,7 +449,10 @@ class Messenger {
 
   explicit Messenger(const MessengerBuilder& bld);
 
-  Reactor* RemoteToReactor(const Sockaddr& remote);
+  // Returns the reactor handling connections to 'remote'. Parallel streams
+  // to the same remote (see ConnectionId::stream()) go to different reactors
+  // when there are enough of them.
+  Reactor* RemoteToReactor(const Sockaddr& remote, int stream = 0);
   Status Init();
   void RunTimeoutThread();
   void UpdateCurTime();
@@ -481,6 +533,11 @@ class Messenger {
   // inbound sockets. 0 or negative values will skip setting the option.
   int receive_buf_;
 
+  // The event loop backend of the reactor threads.
+  const std::string reactor_backend_;
+
+  const std::shared_ptr<Transport> transport_;
+
   // The ownership of the Messenger object is somewhat subtle. The pointer graph
   // looks like this:
   //
@@ -41,6 +41,7 @@
 #include "kudu/rpc/rpc_controller.h"
 #include "kudu/rpc/rpc_header.pb.h"
 #include "kudu/rpc/server_negotiation.h"
+#include "kudu/rpc/transport.h"
 #include "kudu/rpc/user_credentials.h"
 #include "kudu/security/tls_context.h"
 #include "kudu/security/token.pb.h"
@@ -229,6 +230,16 @@ static Status DisableSocketTimeouts(Socket* socket) {
   return Status::OK();
 }
 
+// Whether 'conn' stays on this host, so that it is confidential without TLS.
+static bool IsLocalConnection(Connection* conn) {
+  if (conn->via_transport() &&
+      conn->reactor_thread()->reactor()->messenger()->transport()->IsLocal()) {
+    return true;
+  }
+  return conn->socket()->IsLoopbackConnection() &&
+      !FLAGS_rpc_encrypt_loopback_connections;
+}
+
 // Perform client negotiation. We don't LOG() anything, we leave that to our
 // caller.
 static Status DoClientNegotiation(
@@ -236,7 +247,8 @@ static Status DoClientNegotiation(
     RpcAuthentication authentication,
     RpcEncryption encryption,
     MonoTime deadline,
-    unique_ptr<ErrorStatusPB>* rpc_error) {
+    unique_ptr<ErrorStatusPB>* rpc_error,
+    bool* tls_session_reused) {
   const auto* messenger = conn->reactor_thread()->reactor()->messenger();
   // Prefer secondary credentials (such as authn token) if permitted by policy.
   const auto authn_token =
@@ -250,7 +262,14 @@ static Status DoClientNegotiation(
       encryption,
       messenger->sasl_proto_name());
 
+  // Over a Unix domain socket, the server checks the user PLAIN claims against
+  // the peer credentials, which authenticates it.
+  uid_t uid;
+  const bool peer_credentials =
+      client_negotiation.socket()->GetPeerUid(&uid).ok();
+
   client_negotiation.set_server_fqdn(conn->outbound_connection_id().hostname());
+  client_negotiation.set_tls_session_peer(conn->remote().ToString());
 
   if (authentication != RpcAuthentication::DISABLED) {
     Status s = client_negotiation.EnableGSSAPI();
@@ -270,7 +289,7 @@ static Status DoClientNegotiation(
       }
 
       if (authentication == RpcAuthentication::REQUIRED && !authn_token &&
-          !messenger->tls_context().has_signed_cert()) {
+          !messenger->tls_context().has_signed_cert() && !peer_credentials) {
         return Status::InvalidArgument(
             "Kerberos, token, or PKI certificate credentials must be provided in order to "
             "require authentication for a client");
@@ -278,7 +297,7 @@ static Status DoClientNegotiation(
     }
   }
 
-  if (authentication != RpcAuthentication::REQUIRED) {
+  if (authentication != RpcAuthentication::REQUIRED || peer_credentials) {
     const auto& creds = conn->outbound_connection_id().user_credentials();
     RETURN_NOT_OK(client_negotiation.EnablePlain(creds.real_user(), ""));
   }
@@ -289,6 +308,7 @@ static Status DoClientNegotiation(
   RETURN_NOT_OK(client_negotiation.socket()->SetNonBlocking(false));
   RETURN_NOT_OK(client_negotiation.Negotiate(rpc_error));
   RETURN_NOT_OK(DisableSocketTimeouts(client_negotiation.socket()));
+  *tls_session_reused = client_negotiation.tls_session_reused();
 
   // increment normal tls counter
   if (client_negotiation.normal_tls_negotiated()) {
@@ -299,9 +319,7 @@ static Status DoClientNegotiation(
   conn->adopt_socket(client_negotiation.release_socket());
   conn->set_remote_features(client_negotiation.take_server_features());
   conn->set_confidential(
-      client_negotiation.tls_negotiated() ||
-      (conn->socket()->IsLoopbackConnection() &&
-       !FLAGS_rpc_encrypt_loopback_connections));
+      client_negotiation.tls_negotiated() || IsLocalConnection(conn));
 
   // Sanity check: if no authn token was supplied as user credentials,
   // the negotiated authentication type cannot be AuthenticationType::TOKEN.
@@ -318,9 +336,14 @@ static Status DoServerNegotiation(
     Connection* conn,
     RpcAuthentication authentication,
     RpcEncryption encryption,
-    const MonoTime& deadline) {
+    const MonoTime& deadline,
+    bool* tls_session_reused) {
   const auto* messenger = conn->reactor_thread()->reactor()->messenger();
-  if (authentication == RpcAuthentication::REQUIRED &&
+  // Over a Unix domain socket, PLAIN authentication checks the user the client
+  // claims against the peer credentials.
+  uid_t uid;
+  const bool peer_credentials = conn->socket()->GetPeerUid(&uid).ok();
+  if (authentication == RpcAuthentication::REQUIRED && !peer_credentials &&
       messenger->keytab_file().empty() &&
       !messenger->tls_context().is_external_cert()) {
     return Status::InvalidArgument(
@@ -348,7 +371,7 @@ static Status DoServerNegotiation(
       !messenger->keytab_file().empty()) {
     RETURN_NOT_OK(server_negotiation.EnableGSSAPI());
   }
-  if (authentication != RpcAuthentication::REQUIRED) {
+  if (authentication != RpcAuthentication::REQUIRED || peer_credentials) {
     RETURN_NOT_OK(server_negotiation.EnablePlain());
   }
 
@@ -358,6 +381,7 @@ static Status DoServerNegotiation(
 
   RETURN_NOT_OK(server_negotiation.Negotiate());
   RETURN_NOT_OK(DisableSocketTimeouts(server_negotiation.socket()));
+  *tls_session_reused = server_negotiation.tls_session_reused();
 
   // increment normal tls counter
   if (server_negotiation.normal_tls_negotiated()) {
@@ -369,9 +393,7 @@ static Status DoServerNegotiation(
   conn->set_remote_features(server_negotiation.take_client_features());
   conn->set_remote_user(server_negotiation.take_authenticated_user());
   conn->set_confidential(
-      server_negotiation.tls_negotiated() ||
-      (conn->socket()->IsLoopbackConnection() &&
-       !FLAGS_rpc_encrypt_loopback_connections));
+      server_negotiation.tls_negotiated() || IsLocalConnection(conn));
 
   return Status::OK();
 }
@@ -401,12 +423,37 @@ void Negotiation::RunNegotiation(
 
   Status s;
   unique_ptr<ErrorStatusPB> rpc_error;
-  if (conn->direction() == ConnectionDirection::SERVER) {
-    s = DoServerNegotiation(conn.get(), authentication, encryption, deadline);
+  bool tls_session_reused = false;
+  MonoTime start = MonoTime::Now();
+  const Transport* transport = messenger->transport();
+  if (conn->via_transport() && !transport->SupportsTls()) {
+    // TLS runs over TCP sockets only. Unless the connection stays on this
+    // host, a messenger requiring encryption falls back to TCP for the remote.
+    if (encryption == RpcEncryption::REQUIRED && !transport->IsLocal()) {
+      s = Status::NotSupported(Substitute(
+          "encryption is required, and the $0 transport does not support TLS",
+          transport->name()));
+    }
+    encryption = RpcEncryption::DISABLED;
+  }
+  if (!s.ok()) {
+    // Nothing to negotiate.
+  } else if (conn->direction() == ConnectionDirection::SERVER) {
+    s = DoServerNegotiation(
+        conn.get(), authentication, encryption, deadline, &tls_session_reused);
   } else {
     s = DoClientNegotiation(
-        conn.get(), authentication, encryption, deadline, &rpc_error);
+        conn.get(),
+        authentication,
+        encryption,
+        deadline,
+        &rpc_error,
+        &tls_session_reused);
   }
+  conn->reactor_thread()->RecordNegotiation(
+      conn->direction() == ConnectionDirection::SERVER,
+      tls_session_reused,
+      MonoTime::Now() - start);
 
   if (PREDICT_FALSE(!s.ok())) {
     string msg = Substitute(
@@ -99,8 +99,47 @@ OutboundCall::OutboundCall(
            << (controller->timeout().Initialized()
                    ? controller->timeout().ToString()
                    : "none");
+  InitFromController();
+}
+
+void OutboundCall::Reinit(
+    const ConnectionId& conn_id,
+    int stream,
+    const string& service_name,
+    const string& method_name,
+    google::protobuf::Message* response_storage,
+    RpcController* controller,
+    const ResponseCallback& callback) {
+  DCHECK(IsFinished());
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    state_ = READY;
+    status_ = Status::OK();
+    error_pb_.reset();
+  }
+  // Clear() keeps the sub-messages and strings of the header around, and
+  // clear() keeps the capacity of the buffers.
+  header_.Clear();
+  remote_method_.Assign(service_name, method_name);
+  required_rpc_features_.clear();
+  conn_id_ = conn_id;
+  conn_id_.set_stream(stream);
+  callback_ = callback;
+  controller_ = DCHECK_NOTNULL(controller);
+  response_ = DCHECK_NOTNULL(response_storage);
+  header_buf_.clear();
+  request_buf_.clear();
+  call_response_.reset();
+  sidecars_.clear();
+  sidecar_byte_size_ = -1;
+  cancellation_requested_ = false;
+  DVLOG(4) << "OutboundCall " << this << " reinitialized";
+  InitFromController();
+}
+
+void OutboundCall::InitFromController() {
   header_.set_call_id(kInvalidCallId);
-  remote_method.ToPB(header_.mutable_remote_method());
+  remote_method_.ToPB(header_.mutable_remote_method());
   start_time_ = MonoTime::Now();
 
   if (!controller_->required_server_features().empty()) {
@@ -349,7 +388,8 @@ void OutboundCall::SetSent() {
   // behavior is a lot more efficient if memory is freed from the same thread
   // which allocated it -- this lets it keep to thread-local operations instead
   // of taking a mutex to put memory back on the global freelist.
-  delete[] header_buf_.release();
+  header_buf_.clear();
+  header_buf_.shrink_to_fit();
 
   // request_buf_ is also done being used here, but since it was allocated by
   // the caller thread, we would rather let that thread free it whenever it
@@ -91,6 +91,23 @@ class OutboundCall {
 
   ~OutboundCall();
 
+  // Prepares a finished call to be sent again, as if it had just been
+  // constructed with these arguments. Unlike a new call, it keeps the storage
+  // of its header and its serialization buffers, so a caller that sends
+  // similar calls over and over doesn't allocate them every time (see
+  // RpcController::set_reuse_outbound_call()).
+  //
+  // The call is sent on 'stream' of 'conn_id'. It must not be referenced by
+  // the RPC system anymore.
+  void Reinit(
+      const ConnectionId& conn_id,
+      int stream,
+      const std::string& service_name,
+      const std::string& method_name,
+      google::protobuf::Message* response_storage,
+      RpcController* controller,
+      const ResponseCallback& callback);
+
   // Serialize the given request PB into this call's internal storage, and
   // assume ownership of any sidecars that should accompany this request.
   //
@@ -236,6 +253,9 @@ class OutboundCall {
   // lock_
   void set_state_unlocked(State new_state);
 
+  // Initialization shared by the constructor and Reinit().
+  void InitFromController();
+
   // return current status
   Status status() const;
 
@@ -270,7 +290,7 @@ class OutboundCall {
   // RPC-system features required to send this call.
   std::set<RpcFeatureFlag> required_rpc_features_;
 
-  const ConnectionId conn_id_;
+  ConnectionId conn_id_;
   ResponseCallback callback_;
   RpcController* controller_;
 
@@ -158,6 +158,19 @@ TEST_P(JitteredPeriodicTimerTest, TestStartWithDelta) {
   ASSERT_EVENTUALLY([&]() { ASSERT_GT(counter_, 0); });
 }
 
+TEST_P(JitteredPeriodicTimerTest, TestExpedite) {
+  timer_->Start();
+
+  // The task runs well before the first period is up...
+  timer_->Expedite(MonoDelta::FromMilliseconds(1));
+  ASSERT_EVENTUALLY([&]() { ASSERT_GT(counter_, 0); });
+  int64_t v = counter_;
+
+  // ...after which the timer reverts to its regular period.
+  SleepFor(MonoDelta::FromMilliseconds(period_ms_ / 4));
+  ASSERT_EQ(v, counter_);
+}
+
 TEST_F(PeriodicTimerTest, TestCallbackRestartsTimer) {
   const int64_t kPeriods = 10;
 
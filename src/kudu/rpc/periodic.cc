@@ -113,6 +113,22 @@ void PeriodicTimer::SnoozeUnlocked(boost::optional<MonoDelta> next_task_delta) {
   next_task_time_ = MonoTime::Now() + *next_task_delta;
 }
 
+void PeriodicTimer::Expedite(MonoDelta next_task_delta) {
+  int64_t new_callback_generation;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (!started_) {
+      return;
+    }
+    SnoozeUnlocked(next_task_delta);
+
+    // The outstanding callback may be scheduled further out than
+    // 'next_task_delta', so start a new callback loop which supersedes it.
+    new_callback_generation = ++current_callback_generation_;
+  }
+  ScheduleCallback(new_callback_generation, next_task_delta);
+}
+
 bool PeriodicTimer::started() const {
   std::lock_guard<simple_spinlock> l(lock_);
   return started_;
@@ -197,6 +213,12 @@ void PeriodicTimer::Callback(int64_t my_callback_generation) {
     Snooze();
   }
 
+  ScheduleCallback(my_callback_generation, delay);
+}
+
+void PeriodicTimer::ScheduleCallback(
+    int64_t my_callback_generation,
+    MonoDelta delay) {
   // Capture a weak_ptr reference into the submitted functor so that we can
   // safely handle the functor outliving its timer.
   weak_ptr<PeriodicTimer> w = shared_from_this();
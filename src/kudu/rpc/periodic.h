@@ -133,6 +133,13 @@ class PeriodicTimer : public std::enable_shared_from_this<PeriodicTimer>,
   // Does nothing if the timer is stopped.
   void Snooze(boost::optional<MonoDelta> next_task_delta = boost::none);
 
+  // Runs the task 'next_task_delta' from now, even if that is sooner than
+  // GetMinimumPeriod() would allow with Snooze(). Subsequent tasks revert to
+  // the timer's regular period. The task is never run on the calling thread.
+  //
+  // Does nothing if the timer is stopped.
+  void Expedite(MonoDelta next_task_delta);
+
   // Stops the timer.
   //
   // Stopping is asynchronous; that is, it is still possible for the task to
@@ -163,6 +170,9 @@ class PeriodicTimer : public std::enable_shared_from_this<PeriodicTimer>,
   // when it was constructed.
   void Callback(int64_t my_callback_generation);
 
+  // Schedules Callback() for 'my_callback_generation' to run after 'delay'.
+  void ScheduleCallback(int64_t my_callback_generation, MonoDelta delay);
+
   // Like Stop() but must be called with 'lock_' held.
   void StopUnlocked();
 
@@ -202,6 +202,11 @@ class MethodSubstitutions : public Substituter {
     bool track_result =
         static_cast<bool>(method_->options().GetExtension(track_rpc_result));
     (*map)["track_result"] = track_result ? " true" : "false";
+    bool non_blocking =
+        static_cast<bool>(method_->options().GetExtension(async_handler));
+    (*map)["run_inline"] = non_blocking
+        ? "    mi->run_inline = [](const Message* /*req*/) { return true; };\n"
+        : "";
     (*map)["authz_method"] =
         GetAuthzMethod(*method_).get_value_or("AuthorizeAllowAll");
   }
@@ -473,11 +478,26 @@ class CodeGenerator : public ::google::protobuf::compiler::CodeGenerator {
         Print(
             printer,
             *subs,
-            "METRIC_DEFINE_histogram(server, handler_latency_$rpc_full_name_plainchars$,\n"
+            "METRIC_DEFINE_sharded_histogram(server, handler_latency_$rpc_full_name_plainchars$,\n"
             "  \"$rpc_full_name$ RPC Time\",\n"
             "  kudu::MetricUnit::kMicroseconds,\n"
             "  \"Microseconds spent handling $rpc_full_name$() RPC requests\",\n"
             "  60000000LU, 2);\n"
+            "\n"
+            "METRIC_DEFINE_histogram(server, queue_time_$rpc_full_name_plainchars$,\n"
+            "  \"$rpc_full_name$ RPC Queue Time\",\n"
+            "  kudu::MetricUnit::kMicroseconds,\n"
+            "  \"Microseconds $rpc_full_name$() RPC requests spent between being \"\n"
+            "  \"received and being handled\",\n"
+            "  60000000LU, 2);\n"
+            "\n"
+            "METRIC_DEFINE_histogram(server, response_send_time_$rpc_full_name_plainchars$,\n"
+            "  \"$rpc_full_name$ RPC Response Send Time\",\n"
+            "  kudu::MetricUnit::kMicroseconds,\n"
+            "  \"Microseconds spent sending the responses of $rpc_full_name$() \"\n"
+            "  \"RPC requests, from the handler responding until the response \"\n"
+            "  \"was written to the socket\",\n"
+            "  60000000LU, 2);\n"
             "\n");
         subs->Pop();
       }
@@ -530,11 +550,16 @@ class CodeGenerator : public ::google::protobuf::compiler::CodeGenerator {
             "    mi->track_result = $track_result$;\n"
             "    mi->handler_latency_histogram =\n"
             "        METRIC_handler_latency_$rpc_full_name_plainchars$.Instantiate(entity);\n"
+            "    mi->queue_time_histogram =\n"
+            "        METRIC_queue_time_$rpc_full_name_plainchars$.Instantiate(entity);\n"
+            "    mi->response_send_histogram =\n"
+            "        METRIC_response_send_time_$rpc_full_name_plainchars$.Instantiate(entity);\n"
             "    mi->func = [this](const Message* req, Message* resp, RpcContext* ctx) {\n"
             "      this->$rpc_name$(static_cast<const $request$*>(req),\n"
             "                       static_cast<$response$*>(resp),\n"
             "                       ctx);\n"
             "    };\n"
+            "$run_inline$"
             "    methods_by_name_[\"$rpc_name$\"] = std::move(mi);\n"
             "  }\n");
         subs->Pop();
@@ -574,11 +599,13 @@ class CodeGenerator : public ::google::protobuf::compiler::CodeGenerator {
         "#ifndef KUDU_RPC_$upper_case$_PROXY_DOT_H\n"
         "#define KUDU_RPC_$upper_case$_PROXY_DOT_H\n"
         "\n"
+        "#include <functional>\n"
         "#include <memory>\n"
         "#include <string>\n"
         "\n"
         "#include \"kudu/rpc/proxy.h\"\n"
         "#include \"kudu/rpc/response_callback.h\"\n"
+        "#include \"kudu/util/monotime.h\"\n"
         "#include \"kudu/util/status.h\"\n"
         "\n"
         "namespace kudu { class Sockaddr; }\n"
@@ -623,7 +650,14 @@ class CodeGenerator : public ::google::protobuf::compiler::CodeGenerator {
             "  void $rpc_name$Async(const class $request$ &req,\n"
             "                       class $response$ *response,\n"
             "                       ::kudu::rpc::RpcController *controller,\n"
-            "                       const ::kudu::rpc::ResponseCallback &callback);\n");
+            "                       const ::kudu::rpc::ResponseCallback &callback);\n"
+            "  // Calls $rpc_name$ with 'timeout', then 'callback' with the status of\n"
+            "  // the call and its response, on the reactor thread. The call owns\n"
+            "  // the response until the callback returns.\n"
+            "  void $rpc_name$Then(const class $request$ &req,\n"
+            "                      ::kudu::MonoDelta timeout,\n"
+            "                      std::function<void(const ::kudu::Status&,\n"
+            "                                         class $response$*)> callback);\n");
         subs->Pop();
       }
       Print(printer, *subs, "};\n");
@@ -647,12 +681,16 @@ class CodeGenerator : public ::google::protobuf::compiler::CodeGenerator {
         *subs,
         "// THIS FILE IS AUTOGENERATED FROM $path$\n"
         "\n"
+        "#include <functional>\n"
+        "#include <memory>\n"
         "#include <string>\n"
         "#include <utility>\n"
         "\n"
         "#include \"$path_no_extension$.pb.h\"\n"
         "#include \"$path_no_extension$.proxy.h\"\n"
         "\n"
+        "#include \"kudu/rpc/rpc_controller.h\"\n"
+        "\n"
         "namespace kudu {\n"
         "namespace rpc {\n"
         "class Messenger;\n"
@@ -697,6 +735,23 @@ class CodeGenerator : public ::google::protobuf::compiler::CodeGenerator {
             "                     const ::kudu::rpc::ResponseCallback &callback) {\n"
             "  AsyncRequest(\"$rpc_name$\", req, resp, controller, callback);\n"
             "}\n"
+            "\n"
+            "void $service_name$Proxy::$rpc_name$Then(const $request$ &req,\n"
+            "                     ::kudu::MonoDelta timeout,\n"
+            "                     std::function<void(const ::kudu::Status&, $response$*)> callback) {\n"
+            "  struct State {\n"
+            "    $response$ resp;\n"
+            "    ::kudu::rpc::RpcController controller;\n"
+            "  };\n"
+            "  // The call's callback holds the state, and the call drops it once\n"
+            "  // the callback has run.\n"
+            "  std::shared_ptr<State> state = std::make_shared<State>();\n"
+            "  state->controller.set_timeout(timeout);\n"
+            "  AsyncRequest(\"$rpc_name$\", req, &state->resp, &state->controller,\n"
+            "      [state, callback]() {\n"
+            "        callback(state->controller.status(), &state->resp);\n"
+            "      });\n"
+            "}\n"
             "\n");
         subs->Pop();
       }
@@ -17,6 +17,7 @@
 
 #include "kudu/rpc/proxy.h"
 
+#include <cstdint>
 #include <iostream>
 #include <memory>
 #include <utility>
@@ -25,6 +26,7 @@
 #include <boost/core/ref.hpp>
 #include <glog/logging.h>
 
+#include "kudu/gutil/port.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/rpc/messenger.h"
 #include "kudu/rpc/outbound_call.h"
@@ -51,7 +53,10 @@ Proxy::Proxy(
     string service_name)
     : service_name_(std::move(service_name)),
       messenger_(std::move(messenger)),
-      is_started_(false) {
+      is_started_(false),
+      num_streams_(1),
+      stream_policy_(StreamPolicy::SEPARATE_BULK),
+      next_stream_(0) {
   CHECK(messenger_ != nullptr);
   DCHECK(!service_name_.empty()) << "Proxy service name must not be blank";
 
@@ -80,9 +85,28 @@ void Proxy::AsyncRequest(
     const ResponseCallback& callback) const {
   CHECK(!controller->call_) << "Controller should be reset";
   base::subtle::NoBarrier_Store(&is_started_, true);
-  RemoteMethod remote_method(service_name_, method);
-  controller->call_.reset(new OutboundCall(
-      conn_id_, remote_method, response, controller, callback));
+  int stream = PickStream(*controller);
+  if (controller->spare_call_) {
+    controller->call_ = std::move(controller->spare_call_);
+    controller->call_->Reinit(
+        conn_id_,
+        stream,
+        service_name_,
+        method,
+        response,
+        controller,
+        callback);
+  } else if (PREDICT_TRUE(stream == 0)) {
+    RemoteMethod remote_method(service_name_, method);
+    controller->call_.reset(new OutboundCall(
+        conn_id_, remote_method, response, controller, callback));
+  } else {
+    RemoteMethod remote_method(service_name_, method);
+    ConnectionId conn_id(conn_id_);
+    conn_id.set_stream(stream);
+    controller->call_.reset(new OutboundCall(
+        conn_id, remote_method, response, controller, callback));
+  }
   controller->SetRequestParam(req);
   controller->SetMessenger(messenger_.get());
 
@@ -114,6 +138,27 @@ void Proxy::set_user_credentials(const UserCredentials& user_credentials) {
   conn_id_.set_user_credentials(user_credentials);
 }
 
+void Proxy::set_num_streams(int num_streams, StreamPolicy policy) {
+  CHECK(base::subtle::NoBarrier_Load(&is_started_) == false)
+      << "It is illegal to call set_num_streams() after request processing has started";
+  CHECK_GE(num_streams, 1);
+  num_streams_ = num_streams;
+  stream_policy_ = policy;
+}
+
+int Proxy::PickStream(const RpcController& controller) const {
+  if (num_streams_ == 1 ||
+      (stream_policy_ == StreamPolicy::SEPARATE_BULK && !controller.bulk())) {
+    return 0;
+  }
+  uint32_t n = static_cast<uint32_t>(
+      base::subtle::NoBarrier_AtomicIncrement(&next_stream_, 1));
+  if (stream_policy_ == StreamPolicy::SEPARATE_BULK) {
+    return 1 + n % (num_streams_ - 1);
+  }
+  return n % num_streams_;
+}
+
 std::string Proxy::ToString() const {
   return strings::Substitute("$0@$1", service_name_, conn_id_.ToString());
 }
@@ -43,6 +43,19 @@ class Messenger;
 class RpcController;
 class UserCredentials;
 
+// How a proxy with several streams (see Proxy::set_num_streams()) spreads its
+// calls over them.
+enum class StreamPolicy {
+  // Stream 0 carries the calls which are not marked bulk, such as
+  // heartbeats, and the other streams carry bulk calls round-robin. This
+  // keeps control calls from queueing behind large transfers.
+  SEPARATE_BULK,
+
+  // All calls are striped over the streams round-robin, which helps to fill
+  // links with a large bandwidth-delay product.
+  ROUND_ROBIN,
+};
+
 // Interface to send calls to a remote service.
 //
 // Proxy objects do not map one-to-one with TCP connections.  The underlying TCP
@@ -115,14 +128,25 @@ class Proxy {
     return conn_id_.user_credentials();
   }
 
+  // Spread calls over 'num_streams' separate connections to the remote
+  // instead of one, as chosen by 'policy'.
+  void set_num_streams(int num_streams, StreamPolicy policy);
+
   std::string ToString() const;
 
  private:
+  // Returns the stream the call of 'controller' should be sent on.
+  int PickStream(const RpcController& controller) const;
+
   const std::string service_name_;
   std::shared_ptr<Messenger> messenger_;
   ConnectionId conn_id_;
   mutable Atomic32 is_started_;
 
+  int num_streams_;
+  StreamPolicy stream_policy_;
+  mutable Atomic32 next_stream_;
+
   DISALLOW_COPY_AND_ASSIGN(Proxy);
 };
 
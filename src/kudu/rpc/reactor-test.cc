@@ -101,6 +101,40 @@ TEST_F(ReactorTest, TestFunctionIsCalledIfReactorShutdown) {
   latch_.Wait();
 }
 
+TEST_F(ReactorTest, TestTimerWheel) {
+  messenger_->Shutdown();
+  timer_wheel_tick_ms_ = 10;
+  ASSERT_OK(CreateMessenger("wheel_messenger", &messenger_, 4));
+
+  // Tasks run no earlier than asked, and at most about a tick late.
+  MonoTime before = MonoTime::Now();
+  messenger_->ScheduleOnReactor(
+      boost::bind(&ReactorTest::ScheduledTask, this, _1, Status::OK()),
+      MonoDelta::FromMilliseconds(100));
+  latch_.Wait();
+  MonoDelta delta = MonoTime::Now() - before;
+  ASSERT_GE(delta.ToMilliseconds(), 100);
+
+  // A task that reschedules itself goes back on the wheel.
+  latch_.Reset(2);
+  messenger_->ScheduleOnReactor(
+      boost::bind(&ReactorTest::ScheduledTaskScheduleAgain, this, _1),
+      MonoDelta::FromMilliseconds(0));
+  latch_.Wait();
+
+  // Tasks still on the wheel are aborted on shutdown.
+  latch_.Reset(1);
+  messenger_->ScheduleOnReactor(
+      boost::bind(
+          &ReactorTest::ScheduledTask,
+          this,
+          _1,
+          Status::Aborted("doesn't matter")),
+      MonoDelta::FromSeconds(60));
+  messenger_->Shutdown();
+  latch_.Wait();
+}
+
 TEST_F(ReactorTest, TestReschedulesOnSameReactorThread) {
   // Our scheduled task will schedule yet another task.
   latch_.Reset(2);
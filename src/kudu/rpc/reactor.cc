@@ -17,12 +17,15 @@
 
 #include "kudu/rpc/reactor.h"
 
+#include <algorithm>
 #include <cerrno>
+#include <climits>
 #include <memory>
 #include <mutex>
 #include <ostream>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <boost/bind.hpp> // IWYU pragma: keep
 #include <boost/intrusive/list.hpp>
@@ -42,9 +45,12 @@
 #include "kudu/rpc/outbound_call.h"
 #include "kudu/rpc/rpc_introspection.pb.h"
 #include "kudu/rpc/server_negotiation.h"
+#include "kudu/rpc/transfer.h"
+#include "kudu/rpc/transport.h"
 #include "kudu/util/countdown_latch.h"
 #include "kudu/util/debug/sanitizer_scopes.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/mem_tracker.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/net/sockaddr.h"
@@ -55,19 +61,10 @@
 #include "kudu/util/threadpool.h"
 #include "kudu/util/trace.h"
 
-// When compiling on Mac OS X, use 'kqueue' instead of the default, 'select',
-// for the event loop. Otherwise we run into problems because 'select' can't
-// handle connections when more than 1024 file descriptors are open by the
-// process.
-#if defined(__APPLE__)
-static const int kDefaultLibEvFlags = ev::KQUEUE;
-#else
-static const int kDefaultLibEvFlags = ev::AUTO;
-#endif
-
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
+using std::vector;
 using strings::Substitute;
 
 DEFINE_bool(
@@ -83,6 +80,17 @@ DEFINE_bool(
 TAG_FLAG(rpc_reopen_outbound_connections, unsafe);
 TAG_FLAG(rpc_reopen_outbound_connections, runtime);
 
+DEFINE_int32(
+    rpc_transport_fallback_secs,
+    60,
+    "For how long to connect over TCP to a remote the messenger's transport "
+    "failed to connect or negotiate with, before trying the transport again.");
+DEFINE_validator(rpc_transport_fallback_secs, [](const char* /*n*/, int32_t v) {
+  return v >= 0;
+});
+TAG_FLAG(rpc_transport_fallback_secs, advanced);
+TAG_FLAG(rpc_transport_fallback_secs, runtime);
+
 METRIC_DEFINE_histogram(
     server,
     reactor_load_percent,
@@ -95,7 +103,7 @@ METRIC_DEFINE_histogram(
     100,
     2);
 
-METRIC_DEFINE_histogram(
+METRIC_DEFINE_sharded_histogram(
     server,
     reactor_active_latency_us,
     "Reactor Thread Active Latency",
@@ -107,6 +115,55 @@ METRIC_DEFINE_histogram(
     1000000,
     2);
 
+METRIC_DEFINE_histogram(
+    server,
+    reactor_transfers_per_write,
+    "Reactor Transfers Per Write",
+    kudu::MetricUnit::kUnits,
+    "Number of outbound transfers (RPC requests or responses) a connection "
+    "sent with each write system call.",
+    IOV_MAX,
+    2);
+
+METRIC_DEFINE_histogram(
+    server,
+    rpc_server_negotiation_time,
+    "RPC Server Negotiation Time",
+    kudu::MetricUnit::kMicroseconds,
+    "Number of microseconds the negotiation of inbound RPC connections took "
+    "on the negotiation threads.",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_histogram(
+    server,
+    rpc_client_negotiation_time,
+    "RPC Client Negotiation Time",
+    kudu::MetricUnit::kMicroseconds,
+    "Number of microseconds the negotiation of outbound RPC connections took "
+    "on the negotiation threads.",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_histogram(
+    server,
+    rpc_accept_latency,
+    "RPC Accept Latency",
+    kudu::MetricUnit::kMicroseconds,
+    "Number of microseconds from accepting an inbound RPC connection until "
+    "its reactor started negotiating it. See also rpc_accept_queue_length.",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_counter(
+    server,
+    rpc_tls_sessions_resumed,
+    "RPC TLS Sessions Resumed",
+    kudu::MetricUnit::kConnections,
+    "Number of inbound and outbound RPC connections which resumed an earlier "
+    "TLS session instead of negotiating a new one. See "
+    "--rpc_tls_session_resumption.");
+
 namespace kudu {
 namespace rpc {
 
@@ -134,8 +191,11 @@ void DoInitLibEv() {
 
 } // anonymous namespace
 
-ReactorThread::ReactorThread(Reactor* reactor, const MessengerBuilder& bld)
-    : loop_(kDefaultLibEvFlags),
+ReactorThread::ReactorThread(
+    Reactor* reactor,
+    int index,
+    const MessengerBuilder& bld)
+    : loop_(bld.reactor_libev_flags_),
       cur_time_(MonoTime::Now()),
       last_unused_tcp_scan_(cur_time_),
       reactor_(reactor),
@@ -144,12 +204,35 @@ ReactorThread::ReactorThread(Reactor* reactor, const MessengerBuilder& bld)
       total_client_conns_cnt_(0),
       total_server_conns_cnt_(0),
       total_client_normal_tls_conns_cnt_(0),
-      total_server_normal_tls_conns_cnt_(0) {
+      total_server_normal_tls_conns_cnt_(0),
+      cpu_(
+          bld.reactor_cpus_.empty()
+              ? -1
+              : bld.reactor_cpus_[index % bld.reactor_cpus_.size()]) {
+  if (bld.timer_wheel_tick_.Initialized() &&
+      bld.timer_wheel_tick_.ToNanoseconds() > 0) {
+    timer_wheel_.reset(new TimerWheel(bld.timer_wheel_tick_, MonoTime::Now()));
+  }
+  inbound_buffer_pool_ = std::make_shared<InboundBufferPool>(
+      MemTracker::CreateTracker(
+          -1,
+          reactor->name(),
+          MemTracker::FindOrCreateGlobalTracker(-1, "rpc_inbound_buffers")));
   if (bld.metric_entity_) {
     invoke_us_histogram_ =
         METRIC_reactor_active_latency_us.Instantiate(bld.metric_entity_);
     load_percent_histogram_ =
         METRIC_reactor_load_percent.Instantiate(bld.metric_entity_);
+    transfers_per_write_histogram_ =
+        METRIC_reactor_transfers_per_write.Instantiate(bld.metric_entity_);
+    server_negotiation_time_histogram_ =
+        METRIC_rpc_server_negotiation_time.Instantiate(bld.metric_entity_);
+    client_negotiation_time_histogram_ =
+        METRIC_rpc_client_negotiation_time.Instantiate(bld.metric_entity_);
+    accept_latency_histogram_ =
+        METRIC_rpc_accept_latency.Instantiate(bld.metric_entity_);
+    tls_sessions_resumed_ =
+        METRIC_rpc_tls_sessions_resumed.Instantiate(bld.metric_entity_);
   }
 }
 
@@ -170,6 +253,12 @@ Status ReactorThread::Init() {
       coarse_timer_granularity_.ToSeconds(),
       coarse_timer_granularity_.ToSeconds());
 
+  if (timer_wheel_) {
+    wheel_timer_.set(loop_);
+    wheel_timer_.set<ReactorThread, &ReactorThread::WheelTimerHandler>(
+        this); // NOLINT(*)
+  }
+
   // Register our callbacks. ev++ doesn't provide handy wrappers for these.
   ev_set_userdata(loop_, this);
   ev_set_loop_release_cb(
@@ -313,6 +402,20 @@ void ReactorThread::IncrementNormalTLSConnections(bool is_server) {
   }
 }
 
+void ReactorThread::RecordNegotiation(
+    bool is_server,
+    bool tls_session_reused,
+    const MonoDelta& elapsed) {
+  const auto& histogram = is_server ? server_negotiation_time_histogram_
+                                    : client_negotiation_time_histogram_;
+  if (histogram) {
+    histogram->Increment(elapsed.ToMicroseconds());
+  }
+  if (tls_session_reused && tls_sessions_resumed_) {
+    tls_sessions_resumed_->Increment();
+  }
+}
+
 void ReactorThread::WakeThread() {
   // libev uses some lock-free synchronization, but doesn't have TSAN
   // annotations. See http://lists.schmorp.de/pipermail/libev/2013q2/002178.html
@@ -337,15 +440,31 @@ void ReactorThread::AsyncHandler(ev::async& /*watcher*/, int /*revents*/) {
   boost::intrusive::list<ReactorTask> tasks;
   reactor_->DrainTaskQueue(&tasks);
 
+  running_tasks_ = true;
   while (!tasks.empty()) {
     ReactorTask& task = tasks.front();
     tasks.pop_front();
     task.Run(this);
   }
+  running_tasks_ = false;
+
+  // Send what the tasks queued on each connection with as few writes as the
+  // socket allows.
+  vector<scoped_refptr<Connection>> conns;
+  conns.swap(deferred_flush_conns_);
+  for (const auto& conn : conns) {
+    conn->FlushDeferredOutbound();
+  }
 }
 
-void ReactorThread::RegisterConnection(scoped_refptr<Connection> conn) {
+void ReactorThread::RegisterConnection(
+    scoped_refptr<Connection> conn,
+    MonoTime accepted) {
   DCHECK(IsCurrentThread());
+  if (accept_latency_histogram_) {
+    accept_latency_histogram_->Increment(
+        (MonoTime::Now() - accepted).ToMicroseconds());
+  }
 
   Status s = StartConnectionNegotiation(conn);
   if (PREDICT_FALSE(!s.ok())) {
@@ -448,6 +567,42 @@ void ReactorThread::RegisterTimeout(ev::timer* watcher) {
   watcher->set(loop_);
 }
 
+void ReactorThread::ScheduleTimer(
+    TimerWheel::Timer* timer,
+    MonoTime deadline) {
+  DCHECK(IsCurrentThread());
+  DCHECK(timer_wheel_);
+  timer_wheel_->Schedule(timer, deadline);
+  ArmWheelTimer(timer_wheel_->WakeupFor(timer));
+}
+
+void ReactorThread::ArmWheelTimer(MonoTime wakeup) {
+  if (wheel_timer_.is_active()) {
+    if (wheel_wakeup_ <= wakeup) {
+      return;
+    }
+    wheel_timer_.stop();
+  }
+  wheel_wakeup_ = wakeup;
+  MonoDelta delay = std::max(
+      wakeup - MonoTime::Now(), MonoDelta::FromNanoseconds(0));
+  wheel_timer_.set(delay.ToSeconds(), 0);
+  wheel_timer_.start();
+}
+
+void ReactorThread::WheelTimerHandler(ev::timer& /*watcher*/, int revents) {
+  DCHECK(IsCurrentThread());
+  if (EV_ERROR & revents) {
+    LOG(WARNING) << "Reactor " << name()
+                 << " got an error in the timer wheel handler.";
+  }
+  // Fired timers may schedule others, which re-arms the timer if need be.
+  timer_wheel_->Advance(MonoTime::Now());
+  if (!timer_wheel_->empty()) {
+    ArmWheelTimer(timer_wheel_->NextWakeup());
+  }
+}
+
 void ReactorThread::ScanIdleConnections() {
   DCHECK(IsCurrentThread());
   // Enforce TCP connection timeouts: server-side connections.
@@ -517,6 +672,11 @@ bool ReactorThread::IsCurrentThread() const {
 }
 
 void ReactorThread::RunThread() {
+  if (cpu_ >= 0) {
+    WARN_NOT_OK(
+        SetThreadAffinity(Thread::CurrentThreadId(), {cpu_}),
+        Substitute("$0: could not pin reactor to CPU $1", name(), cpu_));
+  }
   ThreadRestrictions::SetWaitAllowed(false);
   ThreadRestrictions::SetIOAllowed(false);
   DVLOG(6) << "Calling ReactorThread::RunThread()...";
@@ -592,12 +752,16 @@ Status ReactorThread::FindOrStartConnection(
           << "new connection for " << conn_id.remote().ToString();
 
   // Create a new socket and start connecting to the remote.
-  Socket sock;
-  RETURN_NOT_OK(
-      CreateClientSocket(&sock, reactor_->messenger_->get_send_buffer()));
-  RETURN_NOT_OK(StartConnect(&sock, conn_id.remote()));
-
-  unique_ptr<Socket> new_socket(new Socket(sock.Release()));
+  unique_ptr<Socket> new_socket;
+  MaybeStartTransportConnect(conn_id.remote(), &new_socket);
+  const bool via_transport = new_socket != nullptr;
+  if (!via_transport) {
+    Socket sock;
+    RETURN_NOT_OK(
+        CreateClientSocket(&sock, reactor_->messenger_->get_send_buffer()));
+    RETURN_NOT_OK(StartConnect(&sock, conn_id.remote()));
+    new_socket.reset(new Socket(sock.Release()));
+  }
 
   // Register the new connection in our map.
   *conn = new Connection(
@@ -607,6 +771,9 @@ Status ReactorThread::FindOrStartConnection(
       ConnectionDirection::CLIENT,
       cred_policy);
   (*conn)->set_outbound_connection_id(conn_id);
+  if (via_transport) {
+    (*conn)->set_via_transport();
+  }
 
   // Kick off blocking client connection negotiation.
   Status s = StartConnectionNegotiation(*conn);
@@ -658,6 +825,14 @@ void ReactorThread::CompleteConnectionNegotiation(
     unique_ptr<ErrorStatusPB> rpc_error) {
   DCHECK(IsCurrentThread());
   if (PREDICT_FALSE(!status.ok())) {
+    if (conn->via_transport() &&
+        conn->direction() == ConnectionDirection::CLIENT) {
+      // The next connection to the remote is opened over TCP.
+      LOG(WARNING) << name() << ": falling back to TCP for "
+                   << conn->remote().ToString() << ": " << status.ToString();
+      transport_fallbacks_[conn->remote()] = MonoTime::Now() +
+          MonoDelta::FromSeconds(FLAGS_rpc_transport_fallback_secs);
+    }
     DestroyConnection(conn.get(), status, std::move(rpc_error));
     return;
   }
@@ -689,6 +864,34 @@ Status ReactorThread::CreateClientSocket(Socket* sock, int buf_size) {
   return ret;
 }
 
+void ReactorThread::MaybeStartTransportConnect(
+    const Sockaddr& remote,
+    unique_ptr<Socket>* socket) {
+  Messenger* messenger = reactor_->messenger();
+  Transport* transport = messenger->transport();
+  if (!transport || !transport->Handles(remote) ||
+      (messenger->encryption() == RpcEncryption::REQUIRED &&
+       !transport->SupportsTls() && !transport->IsLocal())) {
+    return;
+  }
+  auto it = transport_fallbacks_.find(remote);
+  if (it != transport_fallbacks_.end()) {
+    if (MonoTime::Now() < it->second) {
+      return;
+    }
+    transport_fallbacks_.erase(it);
+  }
+  Status s = transport->StartConnect(remote, socket);
+  if (PREDICT_FALSE(!s.ok())) {
+    LOG(WARNING) << name() << ": falling back to TCP for " << remote.ToString()
+                 << ": " << transport->name()
+                 << " transport could not connect: " << s.ToString();
+    transport_fallbacks_[remote] = MonoTime::Now() +
+        MonoDelta::FromSeconds(FLAGS_rpc_transport_fallback_secs);
+    socket->reset();
+  }
+}
+
 Status ReactorThread::StartConnect(Socket* sock, const Sockaddr& remote) {
   const Status ret = sock->Connect(remote);
   if (ret.ok()) {
@@ -755,6 +958,11 @@ void DelayedTask::Run(ReactorThread* thread) {
 
   // Schedule the task to run later.
   thread_ = thread;
+  if (thread->has_timer_wheel()) {
+    thread->ScheduleTimer(this, MonoTime::Now() + when_);
+    thread_->scheduled_tasks_.push_back(*this);
+    return;
+  }
   timer_.set(thread->loop_);
   timer_.set<DelayedTask, &DelayedTask::TimerHandler>(this); // NOLINT(*)
   timer_.start(
@@ -768,6 +976,13 @@ void DelayedTask::Abort(const Status& abort_status) {
   delete this;
 }
 
+void DelayedTask::Fire() {
+  DCHECK(is_linked()) << "should be linked on scheduled_tasks_";
+  thread_->scheduled_tasks_.erase(thread_->scheduled_tasks_.iterator_to(*this));
+  func_(Status::OK());
+  delete this;
+}
+
 void DelayedTask::TimerHandler(ev::timer& /*watcher*/, int revents) {
   DCHECK(is_linked()) << "should be linked on scheduled_tasks_";
   // We will free this task's memory.
@@ -790,7 +1005,7 @@ Reactor::Reactor(
     : messenger_(std::move(messenger)),
       name_(StringPrintf("%s_R%03d", messenger_->name().c_str(), index)),
       closing_(false),
-      thread_(this, bld) {
+      thread_(this, index, bld) {
   static std::once_flag libev_once;
   std::call_once(libev_once, DoInitLibEv);
 }
@@ -883,10 +1098,10 @@ Status Reactor::DumpRunningRpcs(
 class RegisterConnectionTask : public ReactorTask {
  public:
   explicit RegisterConnectionTask(scoped_refptr<Connection> conn)
-      : conn_(std::move(conn)) {}
+      : conn_(std::move(conn)), accepted_(MonoTime::Now()) {}
 
   void Run(ReactorThread* reactor) override {
-    reactor->RegisterConnection(std::move(conn_));
+    reactor->RegisterConnection(std::move(conn_), accepted_);
     delete this;
   }
 
@@ -899,6 +1114,7 @@ class RegisterConnectionTask : public ReactorTask {
 
  private:
   scoped_refptr<Connection> conn_;
+  const MonoTime accepted_;
 };
 
 void Reactor::RegisterInboundSocket(Socket* socket, const Sockaddr& remote) {
@@ -909,6 +1125,17 @@ void Reactor::RegisterInboundSocket(Socket* socket, const Sockaddr& remote) {
   ScheduleReactorTask(task);
 }
 
+void Reactor::RegisterInboundSocket(
+    unique_ptr<Socket> socket,
+    const Sockaddr& remote) {
+  VLOG(3) << name_ << ": new inbound " << messenger_->transport()->name()
+          << " connection to " << remote.ToString();
+  scoped_refptr<Connection> conn(new Connection(
+      &thread_, remote, std::move(socket), ConnectionDirection::SERVER));
+  conn->set_via_transport();
+  ScheduleReactorTask(new RegisterConnectionTask(conn));
+}
+
 // Task which runs in the reactor thread to assign an outbound call
 // to a connection.
 class AssignOutboundCallTask : public ReactorTask {
@@ -22,6 +22,7 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include <boost/function.hpp> // IWYU pragma: keep
 #include <boost/intrusive/list.hpp>
@@ -34,6 +35,7 @@
 #include "kudu/rpc/connection_id.h"
 #include "kudu/rpc/messenger.h"
 #include "kudu/rpc/rpc_header.pb.h"
+#include "kudu/rpc/timer_wheel.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
@@ -51,6 +53,7 @@ typedef std::list<scoped_refptr<Connection>> conn_list_t;
 
 class DumpRunningRpcsRequestPB;
 class DumpRunningRpcsResponsePB;
+class InboundBufferPool;
 class OutboundCall;
 class Reactor;
 class ReactorThread;
@@ -106,7 +109,7 @@ class ReactorTask : public boost::intrusive::list_base_hook<> {
 //    user function is _always_ invoked, even during reactor shutdown.
 // 2. To differentiate between Abort and non-Abort, the user function
 //    receives a Status as its first argument.
-class DelayedTask : public ReactorTask {
+class DelayedTask : public ReactorTask, public TimerWheel::Timer {
  public:
   DelayedTask(boost::function<void(const Status&)> func, MonoDelta when);
 
@@ -120,6 +123,9 @@ class DelayedTask : public ReactorTask {
   // libev callback for when the registered timer fires.
   void TimerHandler(ev::timer& watcher, int revents);
 
+  // Called instead of TimerHandler() when the reactor has a timer wheel.
+  void Fire() override;
+
   // User function to invoke when timer fires or when task is aborted.
   const boost::function<void(const Status&)> func_;
 
@@ -152,7 +158,7 @@ class ReactorThread {
       ConnectionIdEqual>
       conn_multimap_t;
 
-  ReactorThread(Reactor* reactor, const MessengerBuilder& bld);
+  ReactorThread(Reactor* reactor, int index, const MessengerBuilder& bld);
 
   // This may be called from another thread.
   Status Init();
@@ -164,6 +170,13 @@ class ReactorThread {
 
   void IncrementNormalTLSConnections(bool is_server);
 
+  // Records the time one of this thread's connections took to negotiate, and
+  // whether it resumed a TLS session. Called on the negotiation thread.
+  void RecordNegotiation(
+      bool is_server,
+      bool tls_session_reused,
+      const MonoDelta& elapsed);
+
   // Shuts down a reactor thread, optionally waiting for it to exit.
   // Reactor::Shutdown() must have been called already.
   //
@@ -183,6 +196,16 @@ class ReactorThread {
   // Does not set a timeout or start it.
   void RegisterTimeout(ev::timer* watcher);
 
+  // Whether timers should go on the timer wheel of this thread rather than on
+  // libev timers. See MessengerBuilder::set_timer_wheel_tick().
+  bool has_timer_wheel() const {
+    return timer_wheel_ != nullptr;
+  }
+
+  // Schedules 'timer' on the timer wheel of this thread, to fire once
+  // 'deadline' passed. Requires has_timer_wheel().
+  void ScheduleTimer(TimerWheel::Timer* timer, MonoTime deadline);
+
   // This may be called from another thread.
   const std::string& name() const;
 
@@ -191,6 +214,11 @@ class ReactorThread {
   // This may be called from another thread.
   Reactor* reactor();
 
+  // The pool of receive buffers for large inbound messages on this reactor.
+  const std::shared_ptr<InboundBufferPool>& inbound_buffer_pool() const {
+    return inbound_buffer_pool_;
+  }
+
   // Return true if this reactor thread is the thread currently
   // running. Should be used in DCHECK assertions.
   bool IsCurrentThread() const;
@@ -220,6 +248,12 @@ class ReactorThread {
   // Run the main event loop of the reactor.
   void RunThread();
 
+  // libev callback which turns the timer wheel once its next slot comes up.
+  void WheelTimerHandler(ev::timer& watcher, int revents);
+
+  // Arms 'wheel_timer_' for 'wakeup', unless it's armed for earlier already.
+  void ArmWheelTimer(MonoTime wakeup);
+
   // When libev has noticed that it needs to wake up an application watcher,
   // it calls this callback. The callback simply calls back into libev's
   // ev_invoke_pending() to trigger all the watcher callbacks, but
@@ -273,6 +307,13 @@ class ReactorThread {
   // Initiate a new connection on the given socket.
   static Status StartConnect(Socket* sock, const Sockaddr& remote);
 
+  // Starts connecting to 'remote' through the messenger's transport, if it
+  // handles the remote and we haven't fallen back to TCP for it. Leaves
+  // 'socket' null if TCP is to be used.
+  void MaybeStartTransportConnect(
+      const Sockaddr& remote,
+      std::unique_ptr<Socket>* socket);
+
   // Assign a new outbound call to the appropriate connection object.
   // If this fails, the call is marked failed and completed.
   void AssignOutboundCall(std::shared_ptr<OutboundCall> call);
@@ -284,8 +325,8 @@ class ReactorThread {
   // waiting for a response from the remote.
   void CancelOutboundCall(const std::shared_ptr<OutboundCall>& call);
 
-  // Register a new connection.
-  void RegisterConnection(scoped_refptr<Connection> conn);
+  // Register a new connection, accepted at 'accepted'.
+  void RegisterConnection(scoped_refptr<Connection> conn, MonoTime accepted);
 
   // Manually destroy all connections so they can be recreated.
   void ResetAllConnections();
@@ -305,6 +346,12 @@ class ReactorThread {
   // Handles the periodic timer.
   ev::timer timer_;
 
+  // The timer wheel, if there is one, and the libev timer which turns it.
+  // 'wheel_timer_' is armed for 'wheel_wakeup_' while the wheel has timers.
+  std::unique_ptr<TimerWheel> timer_wheel_;
+  ev::timer wheel_timer_;
+  MonoTime wheel_wakeup_;
+
   // Scheduled (but not yet run) delayed tasks.
   //
   // Each task owns its own memory and must be freed by its TaskRun and
@@ -323,6 +370,9 @@ class ReactorThread {
   // List of current connections coming into the server.
   conn_list_t server_conns_;
 
+  // The remotes we fell back to TCP for, and until when.
+  std::unordered_map<Sockaddr, MonoTime> transport_fallbacks_;
+
   Reactor* reactor_;
 
   // If a connection has been idle for this much time, it is torn down.
@@ -334,6 +384,13 @@ class ReactorThread {
   // Metrics.
   scoped_refptr<Histogram> invoke_us_histogram_;
   scoped_refptr<Histogram> load_percent_histogram_;
+  scoped_refptr<Histogram> transfers_per_write_histogram_;
+  scoped_refptr<Histogram> server_negotiation_time_histogram_;
+  scoped_refptr<Histogram> client_negotiation_time_histogram_;
+  scoped_refptr<Histogram> accept_latency_histogram_;
+  scoped_refptr<Counter> tls_sessions_resumed_;
+
+  std::shared_ptr<InboundBufferPool> inbound_buffer_pool_;
 
   // Total number of client connections opened during Reactor's lifetime.
   uint64_t total_client_conns_cnt_;
@@ -349,6 +406,9 @@ class ReactorThread {
   // lifetime.
   uint64_t total_server_normal_tls_conns_cnt_;
 
+  // The CPU to pin the reactor thread to, or -1 to leave it unpinned.
+  int cpu_;
+
   // Set prior to calling epoll and then reset back to -1 after each invocation
   // completes. Used for accounting total_poll_cycles_.
   int64_t cycle_clock_before_poll_ = -1;
@@ -357,6 +417,13 @@ class ReactorThread {
   // started.
   int64_t total_poll_cycles_ = 0;
 
+  // True while AsyncHandler() is running tasks.
+  bool running_tasks_ = false;
+
+  // Connections which had transfers queued by the tasks currently running,
+  // to be sent once they are done.
+  std::vector<scoped_refptr<Connection>> deferred_flush_conns_;
+
   // Accounting for determining load average in each cycle of TimerHandler.
   struct {
     // The cycle-time at which the load average was last calculated.
@@ -396,6 +463,11 @@ class Reactor {
   // If the reactor is already shut down, takes care of closing the socket.
   void RegisterInboundSocket(Socket* socket, const Sockaddr& remote);
 
+  // Like the above, for a connection accepted by the messenger's transport.
+  void RegisterInboundSocket(
+      std::unique_ptr<Socket> socket,
+      const Sockaddr& remote);
+
   // Queue a new call to be sent. If the reactor is already shut down, marks
   // the call as failed.
   void QueueOutboundCall(const std::shared_ptr<OutboundCall>& call);
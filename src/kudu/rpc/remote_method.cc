@@ -33,6 +33,13 @@ RemoteMethod::RemoteMethod(std::string service_name, std::string method_name)
     : service_name_(std::move(service_name)),
       method_name_(std::move(method_name)) {}
 
+void RemoteMethod::Assign(
+    const std::string& service_name,
+    const std::string& method_name) {
+  service_name_ = service_name;
+  method_name_ = method_name;
+}
+
 void RemoteMethod::FromPB(const RemoteMethodPB& pb) {
   DCHECK(pb.IsInitialized())
       << "PB is uninitialized: " << pb.InitializationErrorString();
@@ -38,6 +38,10 @@ class RemoteMethod {
     return method_name_;
   }
 
+  // Points this at 'method_name' of 'service_name', reusing the storage of
+  // the current names where it is large enough.
+  void Assign(const std::string& service_name, const std::string& method_name);
+
   // Encode/decode to/from 'pb'.
   void FromPB(const RemoteMethodPB& pb);
   void ToPB(RemoteMethodPB* pb) const;
@@ -40,7 +40,10 @@ class RemoteUser {
     // Authenticated by a Kudu authentication token.
     AUTHN_TOKEN,
     // Authenticated by a client certificate.
-    CLIENT_CERT
+    CLIENT_CERT,
+    // Authenticated by the kernel, as the user of the process at the other
+    // end of a Unix domain socket.
+    PEER_CREDENTIALS
   };
 
   Method authenticated_by() const {
@@ -81,6 +84,12 @@ class RemoteUser {
     principal_ = boost::none;
   }
 
+  void SetAuthenticatedByPeerCredentials(std::string username) {
+    authenticated_by_ = PEER_CREDENTIALS;
+    username_ = std::move(username);
+    principal_ = boost::none;
+  }
+
   // Returns a string representation of the object.
   std::string ToString() const;
 
@@ -18,8 +18,10 @@
 #include "kudu/rpc/result_tracker.h"
 
 #include <algorithm>
+#include <functional>
 #include <mutex>
 #include <ostream>
+#include <tuple>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
@@ -63,9 +65,27 @@ DEFINE_int64(
     "Interval at which the result tracker will look for entries to GC.");
 TAG_FLAG(result_tracker_gc_interval_ms, hidden);
 
+DEFINE_int64(
+    result_tracker_memory_limit_bytes,
+    0,
+    "If positive, each GC run of the result tracker also drops the cached "
+    "responses of the clients it has heard from least recently until the "
+    "tracker uses no more than this much memory. Retries of requests whose "
+    "responses were dropped are reported as stale. 0 means no limit other "
+    "than the TTLs.");
+TAG_FLAG(result_tracker_memory_limit_bytes, advanced);
+TAG_FLAG(result_tracker_memory_limit_bytes, runtime);
+
 namespace kudu {
 namespace rpc {
 
+namespace {
+
+// Number of shards the client states are spread over.
+constexpr int kNumShards = 16;
+
+} // anonymous namespace
+
 using google::protobuf::Message;
 using kudu::MemTracker;
 using kudu::pb_util::SecureDebugString;
@@ -110,11 +130,12 @@ struct ScopedMemTrackerUpdater {
 };
 
 ResultTracker::ResultTracker(shared_ptr<MemTracker> mem_tracker)
-    : mem_tracker_(std::move(mem_tracker)),
-      clients_(
-          ClientStateMap::key_compare(),
-          ClientStateMapAllocator(mem_tracker_)),
-      gc_thread_stop_latch_(1) {}
+    : mem_tracker_(std::move(mem_tracker)), gc_thread_stop_latch_(1) {
+  shards_.reserve(kNumShards);
+  for (int i = 0; i < kNumShards; i++) {
+    shards_.emplace_back(new Shard(mem_tracker_));
+  }
+}
 
 ResultTracker::~ResultTracker() {
   if (gc_thread_) {
@@ -122,29 +143,37 @@ ResultTracker::~ResultTracker() {
     gc_thread_->Join();
   }
 
-  lock_guard<simple_spinlock> l(lock_);
   // Release all the memory for the stuff we'll delete on destruction.
-  for (auto& client_state : clients_) {
-    client_state.second->GCCompletionRecords(
-        mem_tracker_, [](SequenceNumber, CompletionRecord*) { return true; });
-    mem_tracker_->Release(client_state.second->memory_footprint());
+  for (auto& shard : shards_) {
+    lock_guard<simple_spinlock> l(shard->lock);
+    for (auto& client_state : shard->clients) {
+      client_state.second->GCCompletionRecords(
+          mem_tracker_, [](SequenceNumber, CompletionRecord*) { return true; });
+      mem_tracker_->Release(client_state.second->memory_footprint());
+    }
   }
 }
 
+ResultTracker::Shard* ResultTracker::ShardFor(const string& client_id) const {
+  return shards_[std::hash<string>()(client_id) % shards_.size()].get();
+}
+
 ResultTracker::RpcState ResultTracker::TrackRpc(
     const RequestIdPB& request_id,
     Message* response,
     RpcContext* context) {
-  lock_guard<simple_spinlock> l(lock_);
-  return TrackRpcUnlocked(request_id, response, context);
+  Shard* shard = ShardFor(request_id.client_id());
+  lock_guard<simple_spinlock> l(shard->lock);
+  return TrackRpcUnlocked(shard, request_id, response, context);
 }
 
 ResultTracker::RpcState ResultTracker::TrackRpcUnlocked(
+    Shard* shard,
     const RequestIdPB& request_id,
     Message* response,
     RpcContext* context) {
   ClientState* client_state =
-      ComputeIfAbsent(&clients_, request_id.client_id(), [&] {
+      ComputeIfAbsent(&shard->clients, request_id.client_id(), [&] {
         unique_ptr<ClientState> client_state(new ClientState(mem_tracker_));
         mem_tracker_->Consume(client_state->memory_footprint());
         client_state->stale_before_seq_no =
@@ -230,14 +259,15 @@ ResultTracker::RpcState ResultTracker::TrackRpcUnlocked(
 
 ResultTracker::RpcState ResultTracker::TrackRpcOrChangeDriver(
     const RequestIdPB& request_id) {
-  lock_guard<simple_spinlock> l(lock_);
-  RpcState state = TrackRpcUnlocked(request_id, nullptr, nullptr);
+  Shard* shard = ShardFor(request_id.client_id());
+  lock_guard<simple_spinlock> l(shard->lock);
+  RpcState state = TrackRpcUnlocked(shard, request_id, nullptr, nullptr);
 
   if (state != RpcState::IN_PROGRESS)
     return state;
 
   CompletionRecord* completion_record =
-      FindCompletionRecordOrDieUnlocked(request_id);
+      FindCompletionRecordOrDieUnlocked(shard, request_id);
   ScopedMemTrackerUpdater<CompletionRecord> updater(
       mem_tracker_.get(), completion_record);
 
@@ -252,9 +282,10 @@ ResultTracker::RpcState ResultTracker::TrackRpcOrChangeDriver(
 }
 
 bool ResultTracker::IsCurrentDriver(const RequestIdPB& request_id) {
-  lock_guard<simple_spinlock> l(lock_);
+  Shard* shard = ShardFor(request_id.client_id());
+  lock_guard<simple_spinlock> l(shard->lock);
   CompletionRecord* completion_record =
-      FindCompletionRecordOrNullUnlocked(request_id);
+      FindCompletionRecordOrNullUnlocked(shard, request_id);
 
   // If we couldn't find the CompletionRecord, someone might have called
   // FailAndRespond() so just return false.
@@ -326,18 +357,20 @@ void ResultTracker::LogAndTraceFailure(
 
 ResultTracker::CompletionRecord*
 ResultTracker::FindCompletionRecordOrDieUnlocked(
+    Shard* shard,
     const RequestIdPB& request_id) {
-  ClientState* client_state =
-      DCHECK_NOTNULL(FindPointeeOrNull(clients_, request_id.client_id()));
+  ClientState* client_state = DCHECK_NOTNULL(
+      FindPointeeOrNull(shard->clients, request_id.client_id()));
   return DCHECK_NOTNULL(
       FindPointeeOrNull(client_state->completion_records, request_id.seq_no()));
 }
 
 pair<ResultTracker::ClientState*, ResultTracker::CompletionRecord*>
 ResultTracker::FindClientStateAndCompletionRecordOrNullUnlocked(
+    Shard* shard,
     const RequestIdPB& request_id) {
   ClientState* client_state =
-      FindPointeeOrNull(clients_, request_id.client_id());
+      FindPointeeOrNull(shard->clients, request_id.client_id());
   CompletionRecord* completion_record = nullptr;
   if (client_state != nullptr) {
     completion_record = FindPointeeOrNull(
@@ -348,8 +381,10 @@ ResultTracker::FindClientStateAndCompletionRecordOrNullUnlocked(
 
 ResultTracker::CompletionRecord*
 ResultTracker::FindCompletionRecordOrNullUnlocked(
+    Shard* shard,
     const RequestIdPB& request_id) {
-  return FindClientStateAndCompletionRecordOrNullUnlocked(request_id).second;
+  return FindClientStateAndCompletionRecordOrNullUnlocked(shard, request_id)
+      .second;
 }
 
 void ResultTracker::RecordCompletionAndRespond(
@@ -357,10 +392,11 @@ void ResultTracker::RecordCompletionAndRespond(
     const Message* response) {
   vector<OnGoingRpcInfo> to_respond;
   {
-    lock_guard<simple_spinlock> l(lock_);
+    Shard* shard = ShardFor(request_id.client_id());
+    lock_guard<simple_spinlock> l(shard->lock);
 
     CompletionRecord* completion_record =
-        FindCompletionRecordOrDieUnlocked(request_id);
+        FindCompletionRecordOrDieUnlocked(shard, request_id);
     ScopedMemTrackerUpdater<CompletionRecord> updater(
         mem_tracker_.get(), completion_record);
 
@@ -368,7 +404,7 @@ void ResultTracker::RecordCompletionAndRespond(
         << "Called RecordCompletionAndRespond() from an executor identified with an "
         << "attempt number that was not marked as the driver for the RPC. RequestId: "
         << SecureShortDebugString(request_id) << "\nTracker state:\n "
-        << ToStringUnlocked();
+        << ShardToStringUnlocked(*shard);
     DCHECK_EQ(completion_record->state, RpcState::IN_PROGRESS);
     completion_record->response.reset(DCHECK_NOTNULL(response)->New());
     completion_record->response->CopyFrom(*response);
@@ -412,13 +448,14 @@ void ResultTracker::FailAndRespondInternal(
     const HandleOngoingRpcFunc& func) {
   vector<OnGoingRpcInfo> to_handle;
   {
-    lock_guard<simple_spinlock> l(lock_);
+    Shard* shard = ShardFor(request_id.client_id());
+    lock_guard<simple_spinlock> l(shard->lock);
     auto state_and_record =
-        FindClientStateAndCompletionRecordOrNullUnlocked(request_id);
+        FindClientStateAndCompletionRecordOrNullUnlocked(shard, request_id);
     if (PREDICT_FALSE(state_and_record.first == nullptr)) {
       LOG(FATAL) << "Couldn't find ClientState for request: "
                  << SecureShortDebugString(request_id) << ". \nTracker state:\n"
-                 << ToStringUnlocked();
+                 << ShardToStringUnlocked(*shard);
     }
 
     CompletionRecord* completion_record = state_and_record.second;
@@ -532,7 +569,6 @@ void ResultTracker::RunGCThread() {
 }
 
 void ResultTracker::GCResults() {
-  lock_guard<simple_spinlock> l(lock_);
   MonoTime now = MonoTime::Now();
   // Calculate the instants before which we'll start GCing ClientStates and
   // CompletionRecords.
@@ -543,11 +579,26 @@ void ResultTracker::GCResults() {
   time_to_gc_responses_from.AddDelta(
       MonoDelta::FromMilliseconds(-FLAGS_remember_responses_ttl_ms));
 
+  for (auto& shard : shards_) {
+    GCShard(shard.get(), time_to_gc_clients_from, time_to_gc_responses_from);
+  }
+
+  int64_t limit = FLAGS_result_tracker_memory_limit_bytes;
+  if (limit > 0 && mem_tracker_->consumption() > limit) {
+    GCToMemoryLimit(limit);
+  }
+}
+
+void ResultTracker::GCShard(
+    Shard* shard,
+    MonoTime time_to_gc_clients_from,
+    MonoTime time_to_gc_responses_from) {
+  lock_guard<simple_spinlock> l(shard->lock);
   // Now go through the ClientStates. If we haven't heard from a client in a
   // while GC it and all its completion records (making sure there isn't
   // actually one in progress first). If we've heard from a client recently, but
   // some of its responses are old, GC those responses.
-  for (auto iter = clients_.begin(); iter != clients_.end();) {
+  for (auto iter = shard->clients.begin(); iter != shard->clients.end();) {
     auto& client_state = iter->second;
     if (client_state->last_heard_from < time_to_gc_clients_from) {
       // Client should be GCed.
@@ -568,7 +619,7 @@ void ResultTracker::GCResults() {
         continue;
       }
       mem_tracker_->Release(client_state->memory_footprint());
-      iter = clients_.erase(iter);
+      iter = shard->clients.erase(iter);
     } else {
       // Client can't be GCed, but its calls might be GCable.
       iter->second->GCCompletionRecords(
@@ -582,22 +633,66 @@ void ResultTracker::GCResults() {
   }
 }
 
+void ResultTracker::GCToMemoryLimit(int64_t limit) {
+  // Order the clients by when we last heard from them. The order may be
+  // slightly off by the time we get to a client, which is fine.
+  typedef std::tuple<MonoTime, Shard*, string> Candidate;
+  vector<Candidate> lru;
+  for (auto& shard : shards_) {
+    lock_guard<simple_spinlock> l(shard->lock);
+    for (const auto& e : shard->clients) {
+      if (!e.second->completion_records.empty()) {
+        lru.emplace_back(e.second->last_heard_from, shard.get(), e.first);
+      }
+    }
+  }
+  std::sort(
+      lru.begin(), lru.end(), [](const Candidate& a, const Candidate& b) {
+        return std::get<0>(a) < std::get<0>(b);
+      });
+
+  int64_t num_clients_trimmed = 0;
+  for (const auto& c : lru) {
+    if (mem_tracker_->consumption() <= limit) {
+      break;
+    }
+    Shard* shard = std::get<1>(c);
+    lock_guard<simple_spinlock> l(shard->lock);
+    ClientState* client_state =
+        FindPointeeOrNull(shard->clients, std::get<2>(c));
+    if (!client_state) {
+      continue;
+    }
+    // Records are GCed in sequence number order up to the first one in
+    // progress, which keeps 'stale_before_seq_no' meaningful.
+    client_state->GCCompletionRecords(
+        mem_tracker_, [](SequenceNumber, CompletionRecord* completion_record) {
+          return completion_record->state != RpcState::IN_PROGRESS;
+        });
+    num_clients_trimmed++;
+  }
+  VLOG(1) << "Result tracker over its " << limit << " byte memory limit: "
+          << "dropped the cached responses of " << num_clients_trimmed
+          << " clients";
+}
+
 string ResultTracker::ToString() {
-  lock_guard<simple_spinlock> l(lock_);
-  return ToStringUnlocked();
+  string result = Substitute("ResultTracker[this: $0, Client States:\n", this);
+  for (const auto& shard : shards_) {
+    lock_guard<simple_spinlock> l(shard->lock);
+    result.append(ShardToStringUnlocked(*shard));
+  }
+  result.append("]");
+  return result;
 }
 
-string ResultTracker::ToStringUnlocked() const {
-  string result = Substitute(
-      "ResultTracker[this: $0, Num. Client States: $1, Client States:\n",
-      this,
-      clients_.size());
-  for (auto& cs : clients_) {
+string ResultTracker::ShardToStringUnlocked(const Shard& shard) const {
+  string result;
+  for (auto& cs : shard.clients) {
     SubstituteAndAppend(
         &result,
         Substitute("\n\tClient: $0, $1", cs.first, cs.second->ToString()));
   }
-  result.append("]");
   return result;
 }
 
@@ -273,6 +273,14 @@ class ResultTracker : public RefCountedThreadSafe<ResultTracker> {
   //     GCs the CompletionRecord and advances the 'stale_before_seq_no'
   //     watermark.
   //
+  // If the tracker uses more memory than --result_tracker_memory_limit_bytes
+  // after that, also GCs the completed responses of the clients least recently
+  // heard from, until it doesn't. As with TTL-based GC, retries of those
+  // requests are reported as STALE rather than executed again.
+  //
+  // Each shard of clients is collected under its own lock, so a GC pass never
+  // holds up the whole tracker.
+  //
   // Typically this is invoked from an internal thread started by
   // 'StartGCThread()'.
   void GCResults();
@@ -374,7 +382,44 @@ class ResultTracker : public RefCountedThreadSafe<ResultTracker> {
     }
   };
 
+  typedef MemTrackerAllocator<
+      std::pair<const std::string, std::unique_ptr<ClientState>>>
+      ClientStateMapAllocator;
+  typedef std::map<
+      std::string,
+      std::unique_ptr<ClientState>,
+      std::less<std::string>,
+      ClientStateMapAllocator>
+      ClientStateMap;
+
+  // A subset of the clients, picked by the hash of their client ids.
+  struct Shard {
+    explicit Shard(std::shared_ptr<MemTracker> mem_tracker)
+        : clients(
+              ClientStateMap::key_compare(),
+              ClientStateMapAllocator(std::move(mem_tracker))) {}
+
+    // Protects 'clients' and the state contained in each ClientState.
+    simple_spinlock lock;
+
+    ClientStateMap clients;
+  };
+
+  // Returns the shard of the client with 'client_id'.
+  Shard* ShardFor(const std::string& client_id) const;
+
+  // Runs time-based GC on the clients of 'shard'.
+  void GCShard(
+      Shard* shard,
+      MonoTime time_to_gc_clients_from,
+      MonoTime time_to_gc_responses_from);
+
+  // GCs the completed responses of the clients least recently heard from
+  // until the memory consumption is at most 'limit'.
+  void GCToMemoryLimit(int64_t limit);
+
   RpcState TrackRpcUnlocked(
+      Shard* shard,
       const RequestIdPB& request_id,
       google::protobuf::Message* response,
       RpcContext* context);
@@ -388,11 +433,14 @@ class ResultTracker : public RefCountedThreadSafe<ResultTracker> {
       const HandleOngoingRpcFunc& func);
 
   CompletionRecord* FindCompletionRecordOrNullUnlocked(
+      Shard* shard,
       const RequestIdPB& request_id);
   CompletionRecord* FindCompletionRecordOrDieUnlocked(
+      Shard* shard,
       const RequestIdPB& request_id);
   std::pair<ClientState*, CompletionRecord*>
   FindClientStateAndCompletionRecordOrNullUnlocked(
+      Shard* shard,
       const RequestIdPB& request_id);
 
   // A handler must handle an RPC attempt if:
@@ -423,29 +471,17 @@ class ResultTracker : public RefCountedThreadSafe<ResultTracker> {
       ErrorStatusPB_RpcErrorCodePB err,
       const Status& status);
 
-  std::string ToStringUnlocked() const;
+  // Dumps the clients of 'shard', whose lock must be held.
+  std::string ShardToStringUnlocked(const Shard& shard) const;
 
   void RunGCThread();
 
   // The memory tracker that tracks this ResultTracker's memory consumption.
   std::shared_ptr<kudu::MemTracker> mem_tracker_;
 
-  // Lock that protects access to 'clients_' and to the state contained in each
-  // ClientState.
-  // TODO consider a per-ClientState lock if we find this too coarse grained.
-  simple_spinlock lock_;
-
-  typedef MemTrackerAllocator<
-      std::pair<const std::string, std::unique_ptr<ClientState>>>
-      ClientStateMapAllocator;
-  typedef std::map<
-      std::string,
-      std::unique_ptr<ClientState>,
-      std::less<std::string>,
-      ClientStateMapAllocator>
-      ClientStateMap;
-
-  ClientStateMap clients_;
+  // The clients' states. Sharded so that calls from different clients
+  // rarely contend on a lock.
+  std::vector<std::unique_ptr<Shard>> shards_;
 
   // The thread which runs GC, and a latch to stop it.
   scoped_refptr<Thread> gc_thread_;
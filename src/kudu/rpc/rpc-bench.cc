@@ -74,6 +74,7 @@ DEFINE_int32(server_reactors, 4, "Number of server reactor threads");
 DEFINE_int32(run_seconds, 1, "Seconds to run the test");
 
 DECLARE_bool(rpc_encrypt_loopback_connections);
+DECLARE_bool(rpc_inline_dispatch);
 DEFINE_bool(
     enable_encryption,
     false,
@@ -87,7 +88,10 @@ namespace rpc {
 
 class RpcBench : public RpcTestBase {
  public:
-  RpcBench() : should_run_(true), stop_(0) {}
+  RpcBench()
+      : should_run_(true),
+        stop_(0),
+        latency_us_(MonoDelta::FromSeconds(60).ToMicroseconds(), 2) {}
 
   void SetUp() override {
     RpcTestBase::SetUp();
@@ -132,8 +136,16 @@ class RpcBench : public RpcTestBase {
     LOG(INFO) << "Worker threads:   " << FLAGS_worker_threads;
     LOG(INFO) << "Server reactors:  " << FLAGS_server_reactors;
     LOG(INFO) << "Encryption:       " << FLAGS_enable_encryption;
+    LOG(INFO) << "Inline dispatch:  " << FLAGS_rpc_inline_dispatch;
+    LOG(INFO) << "Reactor backend:  " << server_messenger_->reactor_backend();
     LOG(INFO) << "----------------------------------";
     LOG(INFO) << "Reqs/sec:         " << reqs_per_second;
+    if (latency_us_.TotalCount() > 0) {
+      LOG(INFO) << "Latency (p50):    " << latency_us_.ValueAtPercentile(50)
+                << "us";
+      LOG(INFO) << "Latency (p99):    " << latency_us_.ValueAtPercentile(99)
+                << "us";
+    }
     LOG(INFO) << "User CPU per req: " << user_cpu_micros_per_req << "us";
     LOG(INFO) << "Sys CPU per req:  " << sys_cpu_micros_per_req << "us";
     LOG(INFO) << "Ctx Sw. per req:  " << csw_per_req;
@@ -151,9 +163,18 @@ class RpcBench : public RpcTestBase {
   friend class ClientThread;
   friend class ClientAsyncWorkload;
 
+  // Runs the synchronous benchmark.
+  void RunSyncBenchmark();
+
+  // Runs the asynchronous benchmark.
+  void RunAsyncBenchmark();
+
   Sockaddr server_addr_;
   Atomic32 should_run_;
   CountDownLatch stop_;
+
+  // Client-side latency of the synchronous calls.
+  HdrHistogram latency_us_;
 };
 
 class ClientThread {
@@ -182,7 +203,10 @@ class ClientThread {
       req.set_y(request_count_);
       RpcController controller;
       controller.set_timeout(MonoDelta::FromSeconds(10));
+      MonoTime start = MonoTime::Now();
       CHECK_OK(p.Add(req, &resp, &controller));
+      bench_->latency_us_.Increment(
+          (MonoTime::Now() - start).ToMicroseconds());
       CHECK_EQ(req.x() + req.y(), resp.result());
       request_count_++;
     }
@@ -193,8 +217,7 @@ class ClientThread {
   int request_count_;
 };
 
-// Test making successful RPC calls.
-TEST_F(RpcBench, BenchmarkCalls) {
+void RpcBench::RunSyncBenchmark() {
   Stopwatch sw(Stopwatch::ALL_THREADS);
   sw.start();
 
@@ -218,6 +241,18 @@ TEST_F(RpcBench, BenchmarkCalls) {
   SummarizePerf(sw.elapsed(), total_reqs, true);
 }
 
+// Test making successful RPC calls.
+TEST_F(RpcBench, BenchmarkCalls) {
+  RunSyncBenchmark();
+}
+
+// Same as above, but with the calls handled on the server's reactor threads,
+// as small heartbeat-like calls would be.
+TEST_F(RpcBench, BenchmarkCallsInline) {
+  FLAGS_rpc_inline_dispatch = true;
+  RunSyncBenchmark();
+}
+
 class ClientAsyncWorkload {
  public:
   ClientAsyncWorkload(RpcBench* bench, shared_ptr<Messenger> messenger)
@@ -260,14 +295,14 @@ class ClientAsyncWorkload {
   AddResponsePB resp_;
 };
 
-TEST_F(RpcBench, BenchmarkCallsAsync) {
+void RpcBench::RunAsyncBenchmark() {
   int threads = FLAGS_client_threads;
   int concurrency = FLAGS_async_call_concurrency;
 
   vector<shared_ptr<Messenger>> messengers;
   for (int i = 0; i < threads; i++) {
     shared_ptr<Messenger> m;
-    ASSERT_OK(CreateMessenger("Client", &m));
+    CHECK_OK(CreateMessenger("Client", &m));
     messengers.emplace_back(std::move(m));
   }
 
@@ -300,5 +335,27 @@ TEST_F(RpcBench, BenchmarkCallsAsync) {
   SummarizePerf(sw.elapsed(), total_reqs, false);
 }
 
+TEST_F(RpcBench, BenchmarkCallsAsync) {
+  RunAsyncBenchmark();
+}
+
+// Runs the benchmarks with the reactors on libev's io_uring backend, for
+// comparison with the default one.
+class IoUringRpcBench : public RpcBench {
+ public:
+  void SetUp() override {
+    reactor_backend_ = "io_uring";
+    RpcBench::SetUp();
+  }
+};
+
+TEST_F(IoUringRpcBench, BenchmarkCalls) {
+  RunSyncBenchmark();
+}
+
+TEST_F(IoUringRpcBench, BenchmarkCallsAsync) {
+  RunAsyncBenchmark();
+}
+
 } // namespace rpc
 } // namespace kudu
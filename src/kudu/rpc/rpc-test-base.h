@@ -459,6 +459,8 @@ class RpcTestBase : public KuduTest {
         service_queue_length_(100),
         n_server_reactor_threads_(3),
         keepalive_time_ms_(1000),
+        reactor_backend_("auto"),
+        timer_wheel_tick_ms_(0),
         metric_entity_(METRIC_ENTITY_server.Instantiate(
             &metric_registry_,
             "test.rpc_test")) {}
@@ -506,6 +508,11 @@ class RpcTestBase : public KuduTest {
           MonoDelta::FromMilliseconds(std::min(keepalive_time_ms_ / 5, 100)));
     }
     bld.set_metric_entity(metric_entity_);
+    bld.set_reactor_backend(reactor_backend_);
+    if (timer_wheel_tick_ms_ > 0) {
+      bld.set_timer_wheel_tick(
+          MonoDelta::FromMilliseconds(timer_wheel_tick_ms_));
+    }
     return bld.Build(messenger);
   }
 
@@ -645,8 +652,10 @@ class RpcTestBase : public KuduTest {
 
   Status StartTestServerWithGeneratedCode(
       Sockaddr* server_addr,
-      bool enable_ssl = false) {
-    return DoStartTestServer<CalculatorService>(server_addr, enable_ssl);
+      bool enable_ssl = false,
+      const std::shared_ptr<Messenger>& messenger = nullptr) {
+    return DoStartTestServer<CalculatorService>(
+        server_addr, enable_ssl, "", "", "", "", messenger);
   }
 
   Status StartTestServerWithCustomMessenger(
@@ -733,6 +742,9 @@ class RpcTestBase : public KuduTest {
   int service_queue_length_;
   int n_server_reactor_threads_;
   int keepalive_time_ms_;
+  std::string reactor_backend_;
+  // If positive, messengers keep their timers on a wheel of this granularity.
+  int timer_wheel_tick_ms_;
 
   MetricRegistry metric_registry_;
   scoped_refptr<MetricEntity> metric_entity_;
@@ -17,7 +17,10 @@
 
 #include "kudu/rpc/rpc-test-base.h"
 
+#include <sys/uio.h>
 #include <unistd.h>
+
+#include <atomic>
 #include <cerrno>
 #include <cstdint>
 #include <cstdlib>
@@ -54,12 +57,18 @@
 #include "kudu/rpc/rpc_introspection.pb.h"
 #include "kudu/rpc/rpc_sidecar.h"
 #include "kudu/rpc/rtest.pb.h"
+#include "kudu/rpc/rtest.proxy.h"
 #include "kudu/rpc/serialization.h"
 #include "kudu/rpc/transfer.h"
+#include "kudu/rpc/transport.h"
+#include "kudu/rpc/unix_socket_transport.h"
+#include "kudu/rpc/user_credentials.h"
 #include "kudu/security/test/test_certs.h"
 #include "kudu/security/tls_context.h"
 #include "kudu/util/countdown_latch.h"
 #include "kudu/util/env.h"
+#include "kudu/util/faststring.h"
+#include "kudu/util/mem_tracker.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/net/sockaddr.h"
@@ -71,15 +80,27 @@
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
 #include "kudu/util/thread.h"
+#include "kudu/util/user.h"
 
 METRIC_DECLARE_histogram(handler_latency_kudu_rpc_test_CalculatorService_Sleep);
 METRIC_DECLARE_histogram(rpc_incoming_queue_time);
-
+METRIC_DECLARE_counter(rpcs_handled_inline);
+METRIC_DECLARE_histogram(reactor_transfers_per_write);
+METRIC_DECLARE_histogram(rpc_accept_latency);
+METRIC_DECLARE_histogram(rpc_accept_queue_length);
+METRIC_DECLARE_counter(rpc_connections_accepted);
+
+DECLARE_bool(rpc_inline_dispatch);
+DECLARE_int32(rpc_inbound_buffer_pool_max_idle_mb);
+DECLARE_int32(rpc_zerocopy_min_bytes);
+DECLARE_int32(rpc_emulated_link_delay_ms);
 DECLARE_bool(rpc_reopen_outbound_connections);
 DECLARE_int32(rpc_negotiation_inject_delay_ms);
 DECLARE_bool(authenticate_via_CN);
 DECLARE_string(trusted_CNs);
 DECLARE_bool(use_normal_tls);
+DECLARE_int32(rpc_acceptor_listen_sockets);
+DECLARE_bool(rpc_acceptor_pin_to_reactors);
 
 using std::shared_ptr;
 using std::string;
@@ -548,6 +569,50 @@ TEST_P(TestRpc, TestConnectionKeepalive) {
       << "Client should have 0 client connections";
 }
 
+// Test that a proxy with several streams keeps control calls on one
+// connection and spreads bulk calls over the others.
+TEST_P(TestRpc, TestProxyStreams) {
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+  Proxy p(
+      client_messenger,
+      server_addr,
+      server_addr.host(),
+      GenericCalculatorService::static_service_name());
+  p.set_num_streams(3, StreamPolicy::SEPARATE_BULK);
+
+  auto do_call = [&](bool bulk) {
+    AddRequestPB req;
+    req.set_x(rand());
+    req.set_y(rand());
+    AddResponsePB resp;
+    RpcController controller;
+    controller.set_timeout(MonoDelta::FromMilliseconds(10000));
+    controller.set_bulk(bulk);
+    RETURN_NOT_OK(p.SyncRequest(
+        GenericCalculatorService::kAddMethodName, req, &resp, &controller));
+    CHECK_EQ(req.x() + req.y(), resp.result());
+    return Status::OK();
+  };
+
+  ReactorMetrics metrics;
+  for (int i = 0; i < 5; i++) {
+    ASSERT_OK(do_call(false));
+  }
+  ASSERT_OK(client_messenger->reactors_[0]->GetMetrics(&metrics));
+  ASSERT_EQ(1, metrics.num_client_connections_);
+
+  for (int i = 0; i < 5; i++) {
+    ASSERT_OK(do_call(true));
+  }
+  ASSERT_OK(client_messenger->reactors_[0]->GetMetrics(&metrics));
+  ASSERT_EQ(3, metrics.num_client_connections_);
+}
+
 // Test that idle connection is kept alive when 'keepalive_time_ms_' is set to
 // -1.
 TEST_P(TestRpc, TestConnectionAlwaysKeepalive) {
@@ -674,6 +739,313 @@ TEST_P(TestRpc, TestClientConnectionMetrics) {
   }
 }
 
+// Test that calls queued on a connection during one reactor wakeup are sent
+// with a single write.
+TEST_P(TestRpc, TestCoalescedOutboundTransfers) {
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+  Proxy p(
+      client_messenger,
+      server_addr,
+      server_addr.host(),
+      GenericCalculatorService::static_service_name());
+  ASSERT_OK(DoTestSyncCall(p, GenericCalculatorService::kAddMethodName));
+
+  // Block the client's only reactor thread so that the calls below are all
+  // handed to it in the same wakeup.
+  client_messenger->ScheduleOnReactor(
+      boost::bind(SleepFor, MonoDelta::FromMilliseconds(500)),
+      MonoDelta::FromSeconds(0));
+
+  const int kNumCalls = 100;
+  AddRequestPB add_req;
+  add_req.set_x(1);
+  add_req.set_y(2);
+  vector<AddResponsePB> add_resps(kNumCalls);
+  vector<RpcController> controllers(kNumCalls);
+  CountDownLatch latch(kNumCalls);
+  for (int i = 0; i < kNumCalls; i++) {
+    p.AsyncRequest(
+        GenericCalculatorService::kAddMethodName,
+        add_req,
+        &add_resps[i],
+        &controllers[i],
+        boost::bind(&CountDownLatch::CountDown, boost::ref(latch)));
+  }
+  latch.Wait();
+  for (int i = 0; i < kNumCalls; i++) {
+    ASSERT_OK(controllers[i].status());
+    ASSERT_EQ(3, add_resps[i].result());
+  }
+
+  scoped_refptr<Histogram> transfers_per_write =
+      METRIC_reactor_transfers_per_write.Instantiate(
+          client_messenger->metric_entity());
+  ASSERT_GT(transfers_per_write->MaxValueForTests(), 1U);
+}
+
+// Test that an acceptor pool listening on several SO_REUSEPORT sockets, its
+// connections pinned to reactors, accepts the connections of many clients.
+TEST_P(TestRpc, TestReusePortListenSockets) {
+  FLAGS_rpc_acceptor_listen_sockets = 4;
+  FLAGS_rpc_acceptor_pin_to_reactors = true;
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+
+  const int kNumClients = 8;
+  for (int i = 0; i < kNumClients; i++) {
+    shared_ptr<Messenger> client_messenger;
+    ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+    Proxy p(
+        client_messenger,
+        server_addr,
+        server_addr.host(),
+        GenericCalculatorService::static_service_name());
+    ASSERT_OK(DoTestSyncCall(p, GenericCalculatorService::kAddMethodName));
+  }
+
+  const auto& entity = server_messenger_->metric_entity();
+  ASSERT_EQ(
+      kNumClients,
+      METRIC_rpc_connections_accepted.Instantiate(entity)->value());
+  ASSERT_EQ(
+      kNumClients,
+      METRIC_rpc_accept_latency.Instantiate(entity)->TotalCount());
+  ASSERT_EQ(
+      kNumClients,
+      METRIC_rpc_accept_queue_length.Instantiate(entity)->TotalCount());
+}
+
+// Test that an emulated link delays both the request and the response, and
+// that calls sent back to back over it still all succeed.
+TEST_P(TestRpc, TestEmulatedLinkDelay) {
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+  Proxy p(
+      client_messenger,
+      server_addr,
+      server_addr.host(),
+      GenericCalculatorService::static_service_name());
+  // Negotiate the connection before the link slows down.
+  ASSERT_OK(DoTestSyncCall(p, GenericCalculatorService::kAddMethodName));
+
+  // The client and the server share the flag, so each call goes through the
+  // delay twice.
+  FLAGS_rpc_emulated_link_delay_ms = 100;
+  MonoTime start = MonoTime::Now();
+  ASSERT_OK(DoTestSyncCall(p, GenericCalculatorService::kAddMethodName));
+  ASSERT_GE((MonoTime::Now() - start).ToMilliseconds(), 200);
+
+  // Calls queued together are delayed together rather than one after the
+  // other.
+  const int kNumCalls = 10;
+  AddRequestPB add_req;
+  add_req.set_x(1);
+  add_req.set_y(2);
+  vector<AddResponsePB> add_resps(kNumCalls);
+  vector<RpcController> controllers(kNumCalls);
+  CountDownLatch latch(kNumCalls);
+  start = MonoTime::Now();
+  for (int i = 0; i < kNumCalls; i++) {
+    p.AsyncRequest(
+        GenericCalculatorService::kAddMethodName,
+        add_req,
+        &add_resps[i],
+        &controllers[i],
+        boost::bind(&CountDownLatch::CountDown, boost::ref(latch)));
+  }
+  latch.Wait();
+  MonoDelta elapsed = MonoTime::Now() - start;
+  ASSERT_GE(elapsed.ToMilliseconds(), 200);
+  ASSERT_LT(elapsed.ToMilliseconds(), 2000);
+  for (int i = 0; i < kNumCalls; i++) {
+    ASSERT_OK(controllers[i].status());
+    ASSERT_EQ(3, add_resps[i].result());
+  }
+
+  // Turning emulation off again takes effect right away.
+  FLAGS_rpc_emulated_link_delay_ms = 0;
+  start = MonoTime::Now();
+  ASSERT_OK(DoTestSyncCall(p, GenericCalculatorService::kAddMethodName));
+  ASSERT_LT((MonoTime::Now() - start).ToMilliseconds(), 200);
+}
+
+namespace {
+
+// A transport over TCP, which counts what goes through it.
+class TestTransport : public Transport {
+ public:
+  const char* name() const override {
+    return "test";
+  }
+
+  bool Handles(const Sockaddr& /*remote*/) const override {
+    return true;
+  }
+
+  Status StartConnect(const Sockaddr& remote, unique_ptr<Socket>* socket)
+      override {
+    num_connects_++;
+    if (fail_connects_) {
+      return Status::NetworkError("injected connect failure");
+    }
+    unique_ptr<CountingSocket> sock(new CountingSocket(&num_writes_));
+    RETURN_NOT_OK(sock->Init(Socket::FLAG_NONBLOCKING));
+    Status s = sock->Connect(remote);
+    if (!s.ok() && s.posix_code() != EINPROGRESS) {
+      return s;
+    }
+    *socket = std::move(sock);
+    return Status::OK();
+  }
+
+  Status Listen(const Sockaddr& address, AcceptedCallback /*callback*/)
+      override {
+    listening_.insert(address.ToString());
+    return Status::OK();
+  }
+
+  void StopListening(const Sockaddr& address) override {
+    listening_.erase(address.ToString());
+  }
+
+  std::atomic<int> num_connects_{0};
+  std::atomic<int64_t> num_writes_{0};
+  std::atomic<bool> fail_connects_{false};
+  std::set<string> listening_;
+
+ private:
+  class CountingSocket : public Socket {
+   public:
+    explicit CountingSocket(std::atomic<int64_t>* num_writes)
+        : num_writes_(num_writes) {}
+
+    Status Write(const uint8_t* buf, int32_t amt, int32_t* nwritten)
+        override {
+      (*num_writes_)++;
+      return Socket::Write(buf, amt, nwritten);
+    }
+
+    Status Writev(const struct ::iovec* iov, int iov_len, int64_t* nwritten)
+        override {
+      (*num_writes_)++;
+      return Socket::Writev(iov, iov_len, nwritten);
+    }
+
+    Status EnableZeroCopy() override {
+      return Status::NotSupported("no zero-copy sends over the test transport");
+    }
+
+   private:
+    std::atomic<int64_t>* const num_writes_;
+  };
+};
+
+} // anonymous namespace
+
+// Calls go through the messenger's transport, and fall back to TCP when it
+// fails to connect.
+TEST_F(TestRpc, TestTransport) {
+  FLAGS_rpc_reopen_outbound_connections = true;
+  Sockaddr server_addr;
+  ASSERT_OK(StartTestServer(&server_addr));
+
+  auto transport = std::make_shared<TestTransport>();
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(MessengerBuilder("Client")
+                .set_metric_entity(metric_entity_)
+                .set_transport(transport)
+                .Build(&client_messenger));
+  Proxy p(
+      client_messenger,
+      server_addr,
+      server_addr.host(),
+      GenericCalculatorService::static_service_name());
+  ASSERT_OK(DoTestSyncCall(p, GenericCalculatorService::kAddMethodName));
+  ASSERT_EQ(1, transport->num_connects_);
+  ASSERT_GT(transport->num_writes_, 0);
+
+  // Each call opens a connection, the first one through the transport, the
+  // next ones over TCP for --rpc_transport_fallback_secs.
+  transport->fail_connects_ = true;
+  const int64_t num_writes = transport->num_writes_;
+  for (int i = 0; i < 3; i++) {
+    ASSERT_OK(DoTestSyncCall(p, GenericCalculatorService::kAddMethodName));
+  }
+  ASSERT_EQ(2, transport->num_connects_);
+  ASSERT_EQ(num_writes, transport->num_writes_);
+
+  // An acceptor pool listens on the transport while it runs.
+  shared_ptr<AcceptorPool> pool;
+  ASSERT_OK(client_messenger->AddAcceptorPool(Sockaddr(), &pool));
+  ASSERT_OK(pool->Start(1));
+  ASSERT_EQ(1, transport->listening_.size());
+  pool->Shutdown();
+  ASSERT_TRUE(transport->listening_.empty());
+}
+
+// A client on the same host connects to the Unix socket of the server, which
+// authenticates it by its peer credentials even though Kerberos isn't set up,
+// and rejects a user the client process isn't.
+TEST_F(TestRpc, TestUnixSocketTransport) {
+  const string dir = GetTestDataDirectory();
+  auto server_transport = std::make_shared<UnixSocketTransport>(dir);
+  shared_ptr<Messenger> server_messenger;
+  ASSERT_OK(MessengerBuilder("TestServer")
+                .set_metric_entity(metric_entity_)
+                .set_rpc_authentication("required")
+                .set_transport(server_transport)
+                .Build(&server_messenger));
+  Sockaddr server_addr;
+  ASSERT_OK(StartTestServerWithGeneratedCode(
+      &server_addr, false, server_messenger));
+  ASSERT_TRUE(
+      env_->FileExists(server_transport->SocketPath(server_addr.port())));
+
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(MessengerBuilder("Client")
+                .set_metric_entity(metric_entity_)
+                .set_rpc_authentication("required")
+                .set_transport(std::make_shared<UnixSocketTransport>(dir))
+                .Build(&client_messenger));
+  string user;
+  ASSERT_OK(GetLoggedInUser(&user));
+  {
+    CalculatorServiceProxy p(
+        client_messenger, server_addr, server_addr.host());
+    RpcController controller;
+    WhoAmIRequestPB req;
+    WhoAmIResponsePB resp;
+    ASSERT_OK(p.WhoAmI(req, &resp, &controller));
+    ASSERT_EQ(user, resp.credentials().real_user());
+    ASSERT_STR_CONTAINS(resp.address(), "[::1]");
+  }
+  {
+    CalculatorServiceProxy p(
+        client_messenger, server_addr, server_addr.host());
+    UserCredentials creds;
+    creds.set_real_user("not-" + user);
+    p.set_user_credentials(creds);
+    RpcController controller;
+    WhoAmIRequestPB req;
+    WhoAmIResponsePB resp;
+    Status s = p.WhoAmI(req, &resp, &controller);
+    ASSERT_TRUE(s.IsNotAuthorized()) << s.ToString();
+  }
+
+  server_messenger->Shutdown();
+  ASSERT_FALSE(
+      env_->FileExists(server_transport->SocketPath(server_addr.port())));
+}
+
 // Test that outbound connections to the same server are reopen upon every RPC
 // call when the 'rpc_reopen_outbound_connections' flag is set.
 TEST_P(TestRpc, TestReopenOutboundConnections) {
@@ -862,6 +1234,30 @@ TEST_P(TestRpc, TestRpcSidecar) {
   DoTestOutgoingSidecarExpectOK(p, 3000 * 1024, 2000 * 1024);
 }
 
+// Test that large calls and responses sent with zero-copy sends arrive
+// intact. Connections using TLS fall back to regular sends.
+TEST_P(TestRpc, TestZeroCopySends) {
+  FLAGS_rpc_zerocopy_min_bytes = 64 * 1024;
+
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+  Proxy p(
+      client_messenger,
+      server_addr,
+      server_addr.host(),
+      GenericCalculatorService::static_service_name());
+
+  DoTestSidecar(p, 123, 456);
+  for (int i = 0; i < 10; i++) {
+    DoTestSidecar(p, 3000 * 1024, 2000 * 1024);
+    DoTestOutgoingSidecarExpectOK(p, 3000 * 1024, 2000 * 1024);
+  }
+}
+
 TEST_P(TestRpc, TestRpcSidecarLimits) {
   {
     // Test that the limits on the number of sidecars is respected.
@@ -995,6 +1391,28 @@ TEST_P(TestRpc, TestCallTimeout) {
       DoTestExpectTimeout(p, MonoDelta::FromMilliseconds(1500)));
 }
 
+// Same as above, with the timeouts kept on the client reactor's timer wheel.
+TEST_P(TestRpc, TestCallTimeoutWithTimerWheel) {
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+  timer_wheel_tick_ms_ = 5;
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+  Proxy p(
+      client_messenger,
+      server_addr,
+      server_addr.host(),
+      GenericCalculatorService::static_service_name());
+
+  ASSERT_NO_FATAL_FAILURE(
+      DoTestExpectTimeout(p, MonoDelta::FromNanoseconds(1)));
+  ASSERT_NO_FATAL_FAILURE(
+      DoTestExpectTimeout(p, MonoDelta::FromMilliseconds(200)));
+  ASSERT_NO_FATAL_FAILURE(
+      DoTestExpectTimeout(p, MonoDelta::FromMilliseconds(1500)));
+}
+
 // Inject 500ms delay in negotiation, and send a call with a short timeout,
 // followed by one with a long timeout. The call with the long timeout should
 // succeed even though the previous one failed.
@@ -1217,6 +1635,90 @@ TEST_P(TestRpc, TestRpcHandlerLatencyMetric) {
   ASSERT_TRUE(FindOrDie(metric_map, &METRIC_rpc_incoming_queue_time));
 }
 
+// Test that calls whose method accepts it are handled on the reactor thread
+// when inline dispatch is enabled, and queued otherwise.
+TEST_P(TestRpc, TestInlineDispatch) {
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServerWithGeneratedCode(&server_addr, enable_ssl));
+
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+  Proxy p(
+      client_messenger,
+      server_addr,
+      server_addr.host(),
+      CalculatorService::static_service_name());
+
+  scoped_refptr<Counter> handled_inline =
+      METRIC_rpcs_handled_inline.Instantiate(
+          server_messenger_->metric_entity());
+
+  // Add accepts inline dispatch, Sleep does not.
+  for (bool inline_dispatch : {false, true}) {
+    FLAGS_rpc_inline_dispatch = inline_dispatch;
+    int64_t before = handled_inline->value();
+
+    RpcController controller;
+    AddRequestPB add_req;
+    add_req.set_x(1);
+    add_req.set_y(2);
+    AddResponsePB add_resp;
+    ASSERT_OK(p.SyncRequest("Add", add_req, &add_resp, &controller));
+    ASSERT_EQ(3, add_resp.result());
+
+    controller.Reset();
+    SleepRequestPB sleep_req;
+    sleep_req.set_sleep_micros(1000);
+    SleepResponsePB sleep_resp;
+    ASSERT_OK(p.SyncRequest("Sleep", sleep_req, &sleep_resp, &controller));
+
+    ASSERT_EQ(before + (inline_dispatch ? 1 : 0), handled_inline->value());
+  }
+}
+
+// Test that the generated <method>Then() proxy calls pass the status and the
+// response of their calls to their callbacks.
+TEST_P(TestRpc, TestProxyThen) {
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServerWithGeneratedCode(&server_addr, enable_ssl));
+
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+  CalculatorServiceProxy p(client_messenger, server_addr, server_addr.host());
+
+  CountDownLatch latch(2);
+  Status add_status;
+  int32_t result = 0;
+  AddRequestPB add_req;
+  add_req.set_x(1);
+  add_req.set_y(2);
+  p.AddThen(
+      add_req,
+      MonoDelta::FromSeconds(10),
+      [&](const Status& s, AddResponsePB* resp) {
+        add_status = s;
+        result = resp->result();
+        latch.CountDown();
+      });
+
+  Status sleep_status;
+  SleepRequestPB sleep_req;
+  sleep_req.set_sleep_micros(500 * 1000);
+  p.SleepThen(
+      sleep_req,
+      MonoDelta::FromMilliseconds(10),
+      [&](const Status& s, SleepResponsePB* /*resp*/) {
+        sleep_status = s;
+        latch.CountDown();
+      });
+  latch.Wait();
+  ASSERT_OK(add_status);
+  ASSERT_EQ(3, result);
+  ASSERT_TRUE(sleep_status.IsTimedOut()) << sleep_status.ToString();
+}
+
 static void DestroyMessengerCallback(
     shared_ptr<Messenger>* messenger,
     CountDownLatch* latch) {
@@ -1727,5 +2229,30 @@ TEST_F(TestRpc, TestCallWithNormalTLSOnBothClientAndServer) {
       << "Client should have 1 client normal TLS connections";
 }
 
+// Test that large receive buffers are reused and that the idle ones are
+// accounted to the pool's memory tracker.
+TEST_F(TestRpc, TestInboundBufferPoolReuse) {
+  shared_ptr<MemTracker> tracker = MemTracker::CreateTracker(-1, "pool-test");
+  InboundBufferPool pool(tracker);
+  const size_t kSize = 3 * 1024 * 1024;
+
+  unique_ptr<faststring> buf = pool.Acquire(kSize);
+  ASSERT_EQ(kSize, buf->size());
+  const uint8_t* first_data = buf->data();
+  pool.Release(std::move(buf));
+  ASSERT_EQ(4 * 1024 * 1024, tracker->consumption());
+
+  // A message of the same size class gets the same buffer back.
+  buf = pool.Acquire(kSize + 1);
+  ASSERT_EQ(first_data, buf->data());
+  ASSERT_EQ(kSize + 1, buf->size());
+  ASSERT_EQ(0, tracker->consumption());
+
+  // Buffers beyond the idle limit are freed rather than kept.
+  FLAGS_rpc_inbound_buffer_pool_max_idle_mb = 1;
+  pool.Release(std::move(buf));
+  ASSERT_EQ(0, tracker->consumption());
+}
+
 } // namespace rpc
 } // namespace kudu
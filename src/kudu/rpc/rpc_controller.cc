@@ -17,6 +17,7 @@
 
 #include "kudu/rpc/rpc_controller.h"
 
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <ostream>
@@ -41,6 +42,7 @@ namespace rpc {
 
 RpcController::RpcController()
     : credentials_policy_(CredentialsPolicy::ANY_CREDENTIALS),
+      bulk_(false),
       messenger_(nullptr) {
   DVLOG(4) << "RpcController " << this << " constructed";
 }
@@ -63,6 +65,7 @@ void RpcController::Swap(RpcController* other) {
       outbound_sidecars_total_bytes_, other->outbound_sidecars_total_bytes_);
   std::swap(timeout_, other->timeout_);
   std::swap(credentials_policy_, other->credentials_policy_);
+  std::swap(bulk_, other->bulk_);
   std::swap(call_, other->call_);
 }
 
@@ -70,10 +73,18 @@ void RpcController::Reset() {
   std::lock_guard<simple_spinlock> l(lock_);
   if (call_) {
     CHECK(finished());
+    // The reactor thread drops its references to a call only after it
+    // finished, so the call may still be in use even if it is finished.
+    if (reuse_outbound_call_ && call_.use_count() == 1) {
+      // Pairs with the release of the references dropped by other threads.
+      std::atomic_thread_fence(std::memory_order_acquire);
+      spare_call_ = std::move(call_);
+    }
   }
   call_.reset();
   required_server_features_.clear();
   credentials_policy_ = CredentialsPolicy::ANY_CREDENTIALS;
+  bulk_ = false;
   messenger_ = nullptr;
   outbound_sidecars_total_bytes_ = 0;
 }
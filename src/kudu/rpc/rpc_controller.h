@@ -212,6 +212,29 @@ class RpcController {
     credentials_policy_ = policy;
   }
 
+  // Marks the call as carrying bulk data, e.g. a large batch of operations.
+  // A proxy which spreads its calls over several connections may keep such
+  // calls off the connection of control calls (see Proxy::set_num_streams()).
+  bool bulk() const {
+    return bulk_;
+  }
+
+  void set_bulk(bool bulk) {
+    bulk_ = bulk;
+  }
+
+  // Keeps the finished call of this controller around on Reset() and sends
+  // the next call through it, instead of allocating a new call, when nothing
+  // else references it anymore. Meant for a controller that is used for one
+  // call after the other, like the controller of a periodic heartbeat.
+  // Unlike the other call properties, this survives Reset().
+  void set_reuse_outbound_call(bool reuse) {
+    reuse_outbound_call_ = reuse;
+    if (!reuse) {
+      spare_call_.reset();
+    }
+  }
+
   // Fills the 'sidecar' parameter with the slice pointing to the i-th
   // sidecar upon success.
   //
@@ -261,6 +284,9 @@ class RpcController {
   // RPC authentication policy for outbound calls.
   CredentialsPolicy credentials_policy_;
 
+  // Whether the call carries bulk data. See set_bulk().
+  bool bulk_;
+
   mutable simple_spinlock lock_;
 
   // The id of this request.
@@ -274,6 +300,11 @@ class RpcController {
   // Once the call is sent, it is tracked here.
   std::shared_ptr<OutboundCall> call_;
 
+  // See set_reuse_outbound_call(). A previous call, finished and referenced
+  // only by this controller, which the next call may reuse.
+  bool reuse_outbound_call_ = false;
+  std::shared_ptr<OutboundCall> spare_call_;
+
   std::vector<std::unique_ptr<RpcSidecar>> outbound_sidecars_;
 
   // Total size of sidecars in outbound_sidecars_. This is limited to a maximum
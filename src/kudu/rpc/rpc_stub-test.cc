@@ -18,6 +18,7 @@
 #include <algorithm>
 #include <atomic>
 #include <csignal>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -36,6 +37,9 @@
 #include <glog/logging.h>
 #include <glog/stl_logging.h>
 #include <gtest/gtest.h>
+#ifdef TCMALLOC_ENABLED
+#include <gperftools/malloc_hook.h>
+#endif
 
 #include "kudu/gutil/atomicops.h"
 #include "kudu/gutil/gscoped_ptr.h"
@@ -43,6 +47,7 @@
 #include "kudu/gutil/stl_util.h"
 #include "kudu/rpc/messenger.h"
 #include "kudu/rpc/proxy.h"
+#include "kudu/rpc/response_callback.h"
 #include "kudu/rpc/rpc-test-base.h"
 #include "kudu/rpc/rpc_controller.h"
 #include "kudu/rpc/rpc_header.pb.h"
@@ -79,6 +84,20 @@ using std::vector;
 namespace kudu {
 namespace rpc {
 
+#ifdef TCMALLOC_ENABLED
+namespace {
+// Counts the allocations of the thread that sets 'count_allocations'.
+thread_local bool count_allocations = false;
+thread_local int64_t num_allocations = 0;
+
+void CountAllocation(const void* /* ptr */, size_t /* size */) {
+  if (count_allocations) {
+    num_allocations++;
+  }
+}
+} // anonymous namespace
+#endif
+
 class RpcStubTest : public RpcTestBase {
  public:
   void SetUp() override {
@@ -740,6 +759,14 @@ TEST_F(RpcStubTest, TestDumpSampledCalls) {
       "    }");
   ASSERT_STR_CONTAINS(SecureDebugString(sampled_rpcs), "SleepRequestPB");
   ASSERT_STR_CONTAINS(SecureDebugString(sampled_rpcs), "duration_ms");
+
+  // Every call shows up in the method's latency breakdown.
+  const RpczMethodPB& method = sampled_rpcs.methods(0);
+  EXPECT_EQ(2, method.queue_time().count());
+  EXPECT_EQ(2, method.handler_time().count());
+  EXPECT_GE(method.handler_time().max_us(), 1500 * 1000);
+  // The response send times may be recorded only after the client saw them.
+  EXPECT_TRUE(method.has_response_send_time());
 }
 
 namespace {
@@ -758,6 +785,56 @@ void MyTestCallback(
 // Verify that, after a call has returned, no copy of the call's callback
 // is held. This is important when the callback holds a refcounted ptr,
 // since we expect to be able to release that pointer when the call is done.
+// Test that a controller which reuses its calls sends the next call without
+// allocating a new one.
+TEST_F(RpcStubTest, TestReuseOutboundCall) {
+#ifndef TCMALLOC_ENABLED
+  LOG(WARNING) << "Allocations can only be counted with tcmalloc, skipping";
+#else
+  CalculatorServiceProxy p(
+      client_messenger_, server_addr_, server_addr_.host());
+  AddRequestPB req;
+  req.set_x(10);
+  req.set_y(20);
+  AddResponsePB resp;
+
+  CountDownLatch latch(1);
+  ResponseCallback callback = [&latch]() { latch.CountDown(); };
+
+  // Returns the fewest allocations the calling thread made to send a call.
+  auto min_allocations_per_call = [&](bool reuse) {
+    RpcController controller;
+    controller.set_reuse_outbound_call(reuse);
+    int64_t min_allocations = std::numeric_limits<int64_t>::max();
+    for (int i = 0; i < 100; i++) {
+      controller.Reset();
+      latch.Reset(1);
+      num_allocations = 0;
+      count_allocations = true;
+      p.AddAsync(req, &resp, &controller, callback);
+      count_allocations = false;
+      latch.Wait();
+      CHECK_OK(controller.status());
+      CHECK_EQ(30, resp.result());
+      // The reactor may not have dropped its references to the call by the
+      // time it responds, in which case the next call can't reuse it.
+      min_allocations = std::min(min_allocations, num_allocations);
+    }
+    return min_allocations;
+  };
+
+  ASSERT_TRUE(MallocHook::AddNewHook(&CountAllocation));
+  int64_t without_reuse = min_allocations_per_call(false);
+  int64_t with_reuse = min_allocations_per_call(true);
+  ASSERT_TRUE(MallocHook::RemoveNewHook(&CountAllocation));
+  LOG(INFO) << "Allocations per call: " << without_reuse << " without reuse, "
+            << with_reuse << " with reuse";
+  ASSERT_LT(with_reuse, without_reuse);
+  // All that's left is the task which hands the call to its reactor.
+  ASSERT_LE(with_reuse, 1);
+#endif
+}
+
 TEST_F(RpcStubTest, TestCallbackClearedAfterRunning) {
   CalculatorServiceProxy p(
       client_messenger_, server_addr_, server_addr_.host());
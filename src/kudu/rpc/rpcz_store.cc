@@ -20,6 +20,7 @@
 #include <algorithm> // IWYU pragma: keep
 #include <array>
 #include <cstdint>
+#include <memory>
 #include <mutex> // for unique_lock
 #include <ostream>
 #include <string>
@@ -41,6 +42,8 @@
 #include "kudu/rpc/service_if.h"
 #include "kudu/util/atomic.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/hdr_histogram.h"
+#include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/trace.h"
 #include "kudu/util/trace_metrics.h"
@@ -217,6 +220,19 @@ void MethodSampler::GetSamplePBs(RpczMethodPB* method_pb) {
   }
 }
 
+namespace {
+
+void StageLatencyToPB(const Histogram* h, RpczStageLatencyPB* pb) {
+  std::unique_ptr<HdrHistogram> hist = h->Snapshot();
+  pb->set_count(hist->TotalCount());
+  pb->set_p50_us(hist->ValueAtPercentile(50));
+  pb->set_p99_us(hist->ValueAtPercentile(99));
+  pb->set_p999_us(hist->ValueAtPercentile(99.9));
+  pb->set_max_us(hist->MaxValue());
+}
+
+} // anonymous namespace
+
 RpczStore::RpczStore() {}
 RpczStore::~RpczStore() {}
 
@@ -249,6 +265,22 @@ void RpczStore::DumpPB(
     // is close enough.
     method_pb->set_method_name(p.first->req_prototype->GetTypeName());
     sampler->GetSamplePBs(method_pb);
+
+    const RpcMethodInfo* info = p.first;
+    if (info->queue_time_histogram) {
+      StageLatencyToPB(
+          info->queue_time_histogram.get(), method_pb->mutable_queue_time());
+    }
+    if (info->handler_latency_histogram) {
+      StageLatencyToPB(
+          info->handler_latency_histogram.get(),
+          method_pb->mutable_handler_time());
+    }
+    if (info->response_send_histogram) {
+      StageLatencyToPB(
+          info->response_send_histogram.get(),
+          method_pb->mutable_response_send_time());
+    }
   }
 }
 
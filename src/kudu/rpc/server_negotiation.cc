@@ -57,6 +57,7 @@
 #include "kudu/util/net/socket.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/trace.h"
+#include "kudu/util/user.h"
 
 using std::set;
 using std::string;
@@ -797,6 +798,8 @@ Status ServerNegotiation::AuthenticateBySasl(faststring* recv_buf) {
             "could not map krb5 principal '$0' to username", principal));
     authenticated_user_.SetAuthenticatedByKerberos(
         std::move(local_name), std::move(principal));
+  } else if (peer_credentials_verified_) {
+    authenticated_user_.SetAuthenticatedByPeerCredentials(c_username);
   } else {
     authenticated_user_.SetUnauthenticated(c_username);
   }
@@ -1191,7 +1194,21 @@ int ServerNegotiation::PlainAuthCb(
         << "Password authentication callback called while PLAIN auth disabled";
     return SASL_BADPARAM;
   }
-  // We always allow PLAIN authentication to succeed.
+  // Over a Unix domain socket the kernel vouches for the user of the client
+  // process, which has to be the one it claims. Otherwise, we always allow
+  // PLAIN authentication to succeed.
+  uid_t uid;
+  if (socket_->GetPeerUid(&uid).ok()) {
+    string peer_user;
+    Status s = GetUserName(uid, &peer_user);
+    if (!s.ok() || peer_user != user) {
+      LOG(WARNING) << "Client claimed to be '" << user << "' over a Unix "
+                   << "domain socket from uid " << uid << ": "
+                   << (s.ok() ? peer_user : s.ToString());
+      return SASL_BADAUTH;
+    }
+    peer_credentials_verified_ = true;
+  }
   return SASL_OK;
 }
 
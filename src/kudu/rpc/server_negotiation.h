@@ -102,6 +102,12 @@ class ServerNegotiation {
     return normal_tls_negotiated_;
   }
 
+  // Returns true if TLS was negotiated by resuming an earlier session.
+  // Must be called after Negotiate().
+  bool tls_session_reused() const {
+    return tls_negotiated_ && tls_handshake_.session_reused();
+  }
+
   // Returns the set of RPC system features supported by the remote client.
   // Must be called after Negotiate().
   std::set<RpcFeatureFlag> client_features() const {
@@ -279,6 +285,10 @@ class ServerNegotiation {
   // negotiation.
   RemoteUser authenticated_user_;
 
+  // Whether PLAIN authentication checked the client's user against the peer
+  // credentials of the socket.
+  bool peer_credentials_verified_ = false;
+
   // The authentication type. Filled in during negotiation.
   AuthenticationType negotiated_authn_;
 
@@ -57,6 +57,20 @@ using strings::Substitute;
 namespace kudu {
 namespace rpc {
 
+const char* RpcPriorityClassToString(RpcPriorityClass priority) {
+  switch (priority) {
+    case RPC_PRIORITY_HIGH:
+      return "high";
+    case RPC_PRIORITY_NORMAL:
+      return "normal";
+    case RPC_PRIORITY_LOW:
+      return "low";
+    default:
+      LOG(FATAL) << "unknown RPC priority class: " << priority;
+  }
+  return "unknown";
+}
+
 ServiceIf::~ServiceIf() {}
 
 void ServiceIf::Shutdown() {}
@@ -107,9 +121,12 @@ void GeneratedServiceIf::Handle(InboundCall* call) {
     RespondBadMethod(call);
     return;
   }
-  unique_ptr<Message> req(method_info->req_prototype->New());
-  if (PREDICT_FALSE(!ParseParam(call, req.get()))) {
-    return;
+  unique_ptr<Message> req = call->release_parsed_request();
+  if (!req) {
+    req.reset(method_info->req_prototype->New());
+    if (PREDICT_FALSE(!ParseParam(call, req.get()))) {
+      return;
+    }
   }
   Message* resp = method_info->resp_prototype->New();
 
@@ -150,5 +167,21 @@ RpcMethodInfo* GeneratedServiceIf::LookupMethod(const RemoteMethod& method) {
   return it->second.get();
 }
 
+bool GeneratedServiceIf::AcceptInline(InboundCall* call) {
+  const RpcMethodInfo* method_info = call->method_info();
+  if (!method_info || !method_info->run_inline || method_info->track_result) {
+    return false;
+  }
+  unique_ptr<Message> req(method_info->req_prototype->New());
+  Slice param(call->serialized_request());
+  if (PREDICT_FALSE(!req->ParseFromArray(param.data(), param.size()))) {
+    // Leave it to Handle() to respond with the error.
+    return false;
+  }
+  bool accepted = method_info->run_inline(req.get());
+  call->set_parsed_request(std::move(req));
+  return accepted;
+}
+
 } // namespace rpc
 } // namespace kudu
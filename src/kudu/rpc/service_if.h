@@ -17,6 +17,7 @@
 #ifndef KUDU_RPC_SERVICE_IF_H
 #define KUDU_RPC_SERVICE_IF_H
 
+#include <atomic>
 #include <cstdint>
 #include <functional>
 #include <memory>
@@ -36,6 +37,18 @@ class RemoteMethod;
 class ResultTracker;
 class RpcContext;
 
+// Priority classes of RPC methods. The service queue keeps a lane per class
+// and serves higher-priority lanes more often, so that e.g. Raft heartbeats
+// and votes are not stuck behind a backlog of bulk calls.
+enum RpcPriorityClass {
+  RPC_PRIORITY_HIGH = 0,
+  RPC_PRIORITY_NORMAL = 1,
+  RPC_PRIORITY_LOW = 2,
+  NUM_RPC_PRIORITY_CLASSES = 3,
+};
+
+const char* RpcPriorityClassToString(RpcPriorityClass priority);
+
 // Generated services define an instance of this class for each
 // method that they implement. The generic server code implemented
 // by GeneratedServiceIf look up the RpcMethodInfo in order to handle
@@ -49,6 +62,12 @@ struct RpcMethodInfo : public RefCountedThreadSafe<RpcMethodInfo> {
 
   scoped_refptr<Histogram> handler_latency_histogram;
 
+  // Time calls to this method spend between being received and being
+  // handled, and between being responded to and the response having been
+  // written to the socket. May be null.
+  scoped_refptr<Histogram> queue_time_histogram;
+  scoped_refptr<Histogram> response_send_histogram;
+
   // Whether we should track this method's result, using ResultTracker.
   bool track_result;
 
@@ -67,6 +86,20 @@ struct RpcMethodInfo : public RefCountedThreadSafe<RpcMethodInfo> {
       google::protobuf::Message* resp,
       RpcContext* ctx)>
       func;
+
+  // If set, called on the reactor thread with the parsed request of an
+  // incoming call when --rpc_inline_dispatch is enabled. Returning true runs
+  // 'func' right there instead of queueing the call for a service thread, so
+  // this must only return true for requests which are cheap to handle and do
+  // not block. Must not respond to the call itself.
+  std::function<bool(const google::protobuf::Message* req)> run_inline;
+
+  // Inline dispatch is turned off for this method until this time (in
+  // nanoseconds since MonoTime::Min()) after a call ran over its budget.
+  std::atomic<int64_t> inline_disabled_until_nanos{0};
+
+  // The service queue lane which calls to this method wait in.
+  RpcPriorityClass priority = RPC_PRIORITY_NORMAL;
 };
 
 // Handles incoming messages that initiate an RPC.
@@ -89,6 +122,13 @@ class ServiceIf {
     return nullptr;
   }
 
+  // Returns true if 'incoming' may be handled by Handle() on the calling
+  // reactor thread rather than on a service thread. Called before the call
+  // is queued; must not respond to it.
+  virtual bool AcceptInline(InboundCall* /*incoming*/) {
+    return false;
+  }
+
   // Default authorization method, which just allows all RPCs.
   //
   // See docs/design-docs/rpc.md for details on how to add custom
@@ -118,6 +158,11 @@ class GeneratedServiceIf : public ServiceIf {
 
   RpcMethodInfo* LookupMethod(const RemoteMethod& method) override;
 
+  // Parses the request and asks the method's 'run_inline', if any. The
+  // parsed request is kept in the call so that Handle() does not parse it
+  // again.
+  bool AcceptInline(InboundCall* incoming) override;
+
   // Returns the mapping from method names to method infos.
   typedef std::unordered_map<std::string, scoped_refptr<RpcMethodInfo>>
       MethodInfoMap;
@@ -17,6 +17,7 @@
 
 #include "kudu/rpc/service_pool.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <memory>
 #include <ostream>
@@ -26,6 +27,7 @@
 #include <vector>
 
 #include <boost/optional/optional.hpp>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "kudu/gutil/basictypes.h"
@@ -38,13 +40,66 @@
 #include "kudu/rpc/rpc_header.pb.h"
 #include "kudu/rpc/service_if.h"
 #include "kudu/rpc/service_queue.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/net/sockaddr.h"
 #include "kudu/util/status.h"
 #include "kudu/util/thread.h"
+#include "kudu/util/thread_restrictions.h"
 #include "kudu/util/trace.h"
 
+DEFINE_bool(
+    rpc_inline_dispatch,
+    false,
+    "Whether to handle the calls that their service accepts for it (such as "
+    "Raft heartbeats) on the reactor thread which received them, rather than "
+    "queueing them for a service thread.");
+TAG_FLAG(rpc_inline_dispatch, experimental);
+TAG_FLAG(rpc_inline_dispatch, runtime);
+
+DEFINE_int32(
+    rpc_inline_dispatch_max_request_bytes,
+    4096,
+    "Calls whose serialized request is larger than this are never handled "
+    "inline. See --rpc_inline_dispatch.");
+TAG_FLAG(rpc_inline_dispatch_max_request_bytes, advanced);
+TAG_FLAG(rpc_inline_dispatch_max_request_bytes, runtime);
+
+DEFINE_int32(
+    rpc_inline_dispatch_budget_us,
+    500,
+    "If a call handled inline takes longer than this, inline dispatch of its "
+    "method is turned off for --rpc_inline_dispatch_backoff_ms.");
+TAG_FLAG(rpc_inline_dispatch_budget_us, advanced);
+TAG_FLAG(rpc_inline_dispatch_budget_us, runtime);
+
+DEFINE_int32(
+    rpc_inline_dispatch_backoff_ms,
+    1000,
+    "How long the calls of a method go back to the service threads after one "
+    "of them ran over --rpc_inline_dispatch_budget_us.");
+TAG_FLAG(rpc_inline_dispatch_backoff_ms, advanced);
+TAG_FLAG(rpc_inline_dispatch_backoff_ms, runtime);
+
+DEFINE_int32(
+    rpc_service_queue_time_target_us,
+    1000,
+    "A service pool allowed to grow beyond its initial size adds a thread "
+    "whenever a call waited in its queue for longer than this while none of "
+    "its threads were idle. See --rpc_max_service_threads.");
+TAG_FLAG(rpc_service_queue_time_target_us, advanced);
+TAG_FLAG(rpc_service_queue_time_target_us, runtime);
+
+DEFINE_int32(
+    rpc_service_thread_idle_timeout_ms,
+    10000,
+    "How long a service thread added beyond a service pool's initial size "
+    "may be idle before it exits.");
+TAG_FLAG(rpc_service_thread_idle_timeout_ms, advanced);
+TAG_FLAG(rpc_service_thread_idle_timeout_ms, runtime);
+
 using std::shared_ptr;
 using std::string;
 using std::vector;
@@ -59,6 +114,36 @@ METRIC_DEFINE_histogram(
     60000000LU,
     3);
 
+METRIC_DEFINE_histogram(
+    server,
+    rpc_incoming_queue_time_high_priority,
+    "RPC Queue Time (High Priority)",
+    kudu::MetricUnit::kMicroseconds,
+    "Number of microseconds incoming RPC requests of high-priority methods, "
+    "such as Raft heartbeats and votes, spend in the worker queue",
+    60000000LU,
+    3);
+
+METRIC_DEFINE_histogram(
+    server,
+    rpc_incoming_queue_time_normal_priority,
+    "RPC Queue Time (Normal Priority)",
+    kudu::MetricUnit::kMicroseconds,
+    "Number of microseconds incoming RPC requests of normal-priority methods "
+    "spend in the worker queue",
+    60000000LU,
+    3);
+
+METRIC_DEFINE_histogram(
+    server,
+    rpc_incoming_queue_time_low_priority,
+    "RPC Queue Time (Low Priority)",
+    kudu::MetricUnit::kMicroseconds,
+    "Number of microseconds incoming RPC requests of low-priority methods, "
+    "such as bulk or administrative calls, spend in the worker queue",
+    60000000LU,
+    3);
+
 METRIC_DEFINE_counter(
     server,
     rpcs_timed_out_in_queue,
@@ -75,6 +160,40 @@ METRIC_DEFINE_counter(
     "Number of RPCs dropped because the service queue "
     "was full.");
 
+METRIC_DEFINE_counter(
+    server,
+    rpcs_handled_inline,
+    "RPCs Handled Inline",
+    kudu::MetricUnit::kRequests,
+    "Number of RPCs handled on the reactor thread which received them "
+    "instead of being queued for a service thread. See "
+    "--rpc_inline_dispatch.");
+
+METRIC_DEFINE_counter(
+    server,
+    rpcs_inline_over_budget,
+    "RPCs Handled Inline Over Budget",
+    kudu::MetricUnit::kRequests,
+    "Number of RPCs handled inline which took longer than "
+    "--rpc_inline_dispatch_budget_us, each turning off inline dispatch of "
+    "their method for a while.");
+
+METRIC_DEFINE_counter(
+    server,
+    rpc_service_threads_added,
+    "RPC Service Threads Added",
+    kudu::MetricUnit::kThreads,
+    "Number of service threads added to service pools because calls waited "
+    "in the queue for longer than --rpc_service_queue_time_target_us.");
+
+METRIC_DEFINE_counter(
+    server,
+    rpc_service_threads_retired,
+    "RPC Service Threads Retired",
+    kudu::MetricUnit::kThreads,
+    "Number of added service threads which exited after being idle for "
+    "--rpc_service_thread_idle_timeout_ms.");
+
 namespace kudu {
 namespace rpc {
 
@@ -83,32 +202,62 @@ ServicePool::ServicePool(
     const scoped_refptr<MetricEntity>& entity,
     size_t service_queue_length)
     : service_(std::move(service)),
+      min_threads_(0),
+      max_threads_(0),
+      num_threads_(0),
+      threads_closed_(false),
       service_queue_(service_queue_length),
       incoming_queue_time_(METRIC_rpc_incoming_queue_time.Instantiate(entity)),
       rpcs_timed_out_in_queue_(
           METRIC_rpcs_timed_out_in_queue.Instantiate(entity)),
       rpcs_queue_overflow_(METRIC_rpcs_queue_overflow.Instantiate(entity)),
+      rpcs_handled_inline_(METRIC_rpcs_handled_inline.Instantiate(entity)),
+      rpcs_inline_over_budget_(
+          METRIC_rpcs_inline_over_budget.Instantiate(entity)),
+      rpc_service_threads_added_(
+          METRIC_rpc_service_threads_added.Instantiate(entity)),
+      rpc_service_threads_retired_(
+          METRIC_rpc_service_threads_retired.Instantiate(entity)),
       closing_(false),
-      logged_busy_(false) {}
+      logged_busy_(false) {
+  priority_queue_time_[RPC_PRIORITY_HIGH] =
+      METRIC_rpc_incoming_queue_time_high_priority.Instantiate(entity);
+  priority_queue_time_[RPC_PRIORITY_NORMAL] =
+      METRIC_rpc_incoming_queue_time_normal_priority.Instantiate(entity);
+  priority_queue_time_[RPC_PRIORITY_LOW] =
+      METRIC_rpc_incoming_queue_time_low_priority.Instantiate(entity);
+}
 
 ServicePool::~ServicePool() {
   Shutdown();
 }
 
 Status ServicePool::Init(int num_threads) {
+  min_threads_ = num_threads;
+  max_threads_ = std::max(max_threads_, num_threads);
   for (int i = 0; i < num_threads; i++) {
-    scoped_refptr<kudu::Thread> new_thread;
-    CHECK_OK(kudu::Thread::Create(
-        "service pool",
-        "rpc_worker",
-        &ServicePool::RunThread,
-        this,
-        &new_thread));
-    threads_.push_back(new_thread);
+    num_threads_++;
+    CHECK_OK(StartThread());
   }
   return Status::OK();
 }
 
+Status ServicePool::StartThread() {
+  MutexLock l(threads_lock_);
+  if (threads_closed_) {
+    return Status::ServiceUnavailable("Service is shutting down");
+  }
+  scoped_refptr<kudu::Thread> new_thread;
+  RETURN_NOT_OK(kudu::Thread::Create(
+      "service pool",
+      "rpc_worker",
+      &ServicePool::RunThread,
+      this,
+      &new_thread));
+  threads_.push_back(new_thread);
+  return Status::OK();
+}
+
 void ServicePool::Shutdown() {
   service_queue_.Shutdown();
 
@@ -116,8 +265,14 @@ void ServicePool::Shutdown() {
   if (closing_)
     return;
   closing_ = true;
+  vector<scoped_refptr<kudu::Thread>> threads;
+  {
+    MutexLock l(threads_lock_);
+    threads_closed_ = true;
+    threads.swap(threads_);
+  }
   // TODO: Use a proper thread pool implementation.
-  for (scoped_refptr<kudu::Thread>& thread : threads_) {
+  for (scoped_refptr<kudu::Thread>& thread : threads) {
     CHECK_OK(ThreadJoiner(thread.get()).Join());
   }
 
@@ -188,6 +343,10 @@ Status ServicePool::QueueInboundCall(gscoped_ptr<InboundCall> call) {
             ", "));
   }
 
+  if (FLAGS_rpc_inline_dispatch && TryHandleInline(c)) {
+    return Status::OK();
+  }
+
   TRACE_TO(c->trace(), "Inserting onto call queue");
 
   // Queue message on service queue
@@ -224,15 +383,133 @@ Status ServicePool::QueueInboundCall(gscoped_ptr<InboundCall> call) {
   return status;
 }
 
+bool ServicePool::TryHandleInline(InboundCall* c) {
+  // Cheap checks first: this runs on the reactor thread for every call.
+  RpcMethodInfo* method_info = c->method_info();
+  if (!method_info || !method_info->run_inline ||
+      c->serialized_request().size() >
+          FLAGS_rpc_inline_dispatch_max_request_bytes) {
+    return false;
+  }
+  MonoTime start = MonoTime::Now();
+  int64_t start_nanos = (start - MonoTime::Min()).ToNanoseconds();
+  if (start_nanos <
+      method_info->inline_disabled_until_nanos.load(
+          std::memory_order_relaxed)) {
+    return false;
+  }
+
+  // Inline handlers are expected to take no more than short-lived locks,
+  // which is enforced by the budget below rather than by the reactor's
+  // thread restrictions.
+  ThreadRestrictions::ScopedAllowWait allow_wait;
+  if (!service_->AcceptInline(c)) {
+    return false;
+  }
+
+  c->RecordHandlingStarted(incoming_queue_time_.get());
+  ADOPT_TRACE(c->trace());
+  TRACE_TO(c->trace(), "Handling call inline");
+  // 'c' may be gone as soon as it is handled.
+  service_->Handle(c);
+  rpcs_handled_inline_->Increment();
+
+  MonoDelta elapsed = MonoTime::Now() - start;
+  if (PREDICT_FALSE(
+          elapsed.ToMicroseconds() > FLAGS_rpc_inline_dispatch_budget_us)) {
+    rpcs_inline_over_budget_->Increment();
+    method_info->inline_disabled_until_nanos.store(
+        start_nanos +
+            MonoDelta::FromMilliseconds(FLAGS_rpc_inline_dispatch_backoff_ms)
+                .ToNanoseconds(),
+        std::memory_order_relaxed);
+    KLOG_EVERY_N_SECS(WARNING, 60)
+        << "Call handled inline on " << service_->service_name() << " took "
+        << elapsed.ToString() << "; queueing its method's calls for a while";
+  }
+  return true;
+}
+
+bool ServicePool::ClaimThreadSlot() {
+  int n = num_threads_.load();
+  while (n < max_threads_) {
+    if (num_threads_.compare_exchange_weak(n, n + 1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ServicePool::ReleaseThreadSlot() {
+  int n = num_threads_.load();
+  while (n > min_threads_) {
+    if (num_threads_.compare_exchange_weak(n, n - 1)) {
+      MutexLock l(threads_lock_);
+      // Dropping our own reference detaches the thread, so that nobody needs
+      // to join it. If Shutdown() already took the list, it joins us instead.
+      kudu::Thread* self = kudu::Thread::current_thread();
+      for (auto it = threads_.begin(); it != threads_.end(); ++it) {
+        if (it->get() == self) {
+          threads_.erase(it);
+          break;
+        }
+      }
+      rpc_service_threads_retired_->Increment();
+      return true;
+    }
+  }
+  return false;
+}
+
+void ServicePool::MaybeAddThread(const MonoDelta& queue_time) {
+  if (queue_time.ToMicroseconds() < FLAGS_rpc_service_queue_time_target_us ||
+      service_queue_.estimated_idle_worker_count() > 0 || !ClaimThreadSlot()) {
+    return;
+  }
+  Status s = StartThread();
+  if (!s.ok()) {
+    num_threads_--;
+    KLOG_EVERY_N_SECS(WARNING, 60)
+        << "Could not add a thread to the " << service_->service_name()
+        << " service pool: " << s.ToString();
+    return;
+  }
+  rpc_service_threads_added_->Increment();
+  VLOG(1) << "Added a thread to the " << service_->service_name()
+          << " service pool after a call waited " << queue_time.ToString();
+}
+
 void ServicePool::RunThread() {
   while (true) {
     std::unique_ptr<InboundCall> incoming;
-    if (!service_queue_.BlockingGet(&incoming)) {
-      VLOG(1) << "ServicePool: messenger shutting down.";
-      return;
+    // Threads beyond the initial ones leave when idle for long enough.
+    MonoTime deadline = MonoTime::Max();
+    if (num_threads_.load(std::memory_order_relaxed) > min_threads_) {
+      deadline = MonoTime::Now() +
+          MonoDelta::FromMilliseconds(FLAGS_rpc_service_thread_idle_timeout_ms);
+    }
+    bool timed_out;
+    if (!service_queue_.BlockingGet(&incoming, deadline, &timed_out)) {
+      if (!timed_out) {
+        VLOG(1) << "ServicePool: messenger shutting down.";
+        return;
+      }
+      if (ReleaseThreadSlot()) {
+        VLOG(1) << "ServicePool: idle thread exiting.";
+        return;
+      }
+      continue;
     }
 
-    incoming->RecordHandlingStarted(incoming_queue_time_.get());
+    RpcMethodInfo* method_info = incoming->method_info();
+    incoming->RecordHandlingStarted(
+        incoming_queue_time_.get(),
+        priority_queue_time_[method_info ? method_info->priority
+                                         : RPC_PRIORITY_NORMAL]
+            .get());
+    if (max_threads_ > min_threads_) {
+      MaybeAddThread(MonoTime::Now() - incoming->GetTimeReceived());
+    }
     ADOPT_TRACE(incoming->trace());
 
     if (PREDICT_FALSE(incoming->ClientTimedOut())) {
@@ -30,6 +30,7 @@
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/rpc/rpc_service.h"
+#include "kudu/rpc/service_if.h"
 #include "kudu/rpc/service_queue.h"
 #include "kudu/util/mutex.h"
 #include "kudu/util/status.h"
@@ -39,6 +40,7 @@ namespace kudu {
 class Counter;
 class Histogram;
 class MetricEntity;
+class MonoDelta;
 class Thread;
 
 namespace rpc {
@@ -70,6 +72,16 @@ class ServicePool : public RpcService {
     too_busy_hook_ = std::move(hook);
   }
 
+  // Let the pool grow up to 'max_threads' threads. While calls wait in the
+  // queue for longer than --rpc_service_queue_time_target_us and no thread is
+  // idle, a thread is added; threads beyond the number passed to Init() exit
+  // once they have been idle for --rpc_service_thread_idle_timeout_ms.
+  // Values not above the Init() count keep the pool at a fixed size. Must be
+  // called before Init().
+  void set_max_threads(int max_threads) {
+    max_threads_ = max_threads;
+  }
+
   // Start up the thread pool.
   virtual Status Init(int num_threads);
 
@@ -88,6 +100,11 @@ class ServicePool : public RpcService {
     return incoming_queue_time_.get();
   }
 
+  const Histogram* IncomingQueueTimeMetricForTests(
+      RpcPriorityClass priority) const {
+    return priority_queue_time_[priority].get();
+  }
+
   const Counter* RpcsQueueOverflowMetric() const {
     return rpcs_queue_overflow_.get();
   }
@@ -103,12 +120,54 @@ class ServicePool : public RpcService {
   void RunThread();
   void RejectTooBusy(InboundCall* c);
 
+  // Adds a service thread if 'queue_time', the time the call just dequeued
+  // waited, is over target and the pool may still grow.
+  void MaybeAddThread(const MonoDelta& queue_time);
+
+  // Claims a slot for a new thread within 'max_threads_'. Returns false if
+  // the pool is at its maximum size.
+  bool ClaimThreadSlot();
+
+  // Decides whether a thread which went idle for the idle timeout should
+  // exit, releasing its slot if so.
+  bool ReleaseThreadSlot();
+
+  // Starts a service thread in an already claimed slot and adds it to
+  // 'threads_'.
+  Status StartThread();
+
+  // Handles 'c' on the calling reactor thread if its method and service
+  // accept that (see RpcMethodInfo::run_inline). Returns false if 'c' must
+  // be queued as usual.
+  bool TryHandleInline(InboundCall* c);
+
   gscoped_ptr<ServiceIf> service_;
+
+  // Number of threads the pool starts with and never shrinks below, and the
+  // most it may grow to.
+  int min_threads_;
+  int max_threads_;
+
+  // Number of live service threads, including ones about to start.
+  std::atomic<int> num_threads_;
+
+  // Protects 'threads_' and 'threads_closed_'. Separate from
+  // 'shutdown_lock_', which is held while joining the threads that may take
+  // this lock as they exit.
+  Mutex threads_lock_;
   std::vector<scoped_refptr<kudu::Thread>> threads_;
+  bool threads_closed_;
+
   LifoServiceQueue service_queue_;
   scoped_refptr<Histogram> incoming_queue_time_;
+  // Queue time of calls by the priority class of their method.
+  scoped_refptr<Histogram> priority_queue_time_[NUM_RPC_PRIORITY_CLASSES];
   scoped_refptr<Counter> rpcs_timed_out_in_queue_;
   scoped_refptr<Counter> rpcs_queue_overflow_;
+  scoped_refptr<Counter> rpcs_handled_inline_;
+  scoped_refptr<Counter> rpcs_inline_over_budget_;
+  scoped_refptr<Counter> rpc_service_threads_added_;
+  scoped_refptr<Counter> rpc_service_threads_retired_;
 
   mutable Mutex shutdown_lock_;
   bool closing_;
@@ -15,6 +15,7 @@
 // specific language governing permissions and limitations
 // under the License.
 
+#include <algorithm>
 #include <atomic>
 #include <cstdint>
 #include <memory>
@@ -30,7 +31,9 @@
 
 #include "kudu/gutil/atomicops.h"
 #include "kudu/gutil/port.h"
+#include "kudu/gutil/ref_counted.h"
 #include "kudu/rpc/inbound_call.h"
+#include "kudu/rpc/service_if.h"
 #include "kudu/rpc/service_queue.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/stopwatch.h"
@@ -149,5 +152,90 @@ TEST(TestServiceQueue, LifoServiceQueuePerf) {
             << total_idle_workers / static_cast<double>(total_sample);
 }
 
+// Returns a call to 'method_info'.
+static InboundCall* NewCall(const scoped_refptr<RpcMethodInfo>& method_info) {
+  InboundCall* call = new InboundCall(nullptr);
+  call->set_method_info(method_info);
+  return call;
+}
+
+TEST(TestServiceQueue, LifoServiceQueuePriorityLanes) {
+  scoped_refptr<RpcMethodInfo> methods[NUM_RPC_PRIORITY_CLASSES];
+  for (int i = 0; i < NUM_RPC_PRIORITY_CLASSES; i++) {
+    methods[i] = new RpcMethodInfo();
+    methods[i]->priority = static_cast<RpcPriorityClass>(i);
+  }
+
+  const int kCallsPerClass = 20;
+  LifoServiceQueue queue(NUM_RPC_PRIORITY_CLASSES * kCallsPerClass);
+  boost::optional<InboundCall*> evicted;
+  for (int i = 0; i < kCallsPerClass; i++) {
+    for (int p = NUM_RPC_PRIORITY_CLASSES - 1; p >= 0; p--) {
+      ASSERT_EQ(QUEUE_SUCCESS, queue.Put(NewCall(methods[p]), &evicted));
+      ASSERT_TRUE(evicted == boost::none);
+    }
+  }
+  ASSERT_EQ(kCallsPerClass, queue.estimated_queue_length(RPC_PRIORITY_LOW));
+
+  // In a full queue, a more important call evicts one from the lowest lane.
+  unique_ptr<InboundCall> call(NewCall(methods[RPC_PRIORITY_HIGH]));
+  ASSERT_EQ(QUEUE_SUCCESS, queue.Put(call.get(), &evicted));
+  call.release();
+  ASSERT_TRUE(evicted != boost::none);
+  ASSERT_EQ(RPC_PRIORITY_LOW, (*evicted)->method_info()->priority);
+  delete *evicted;
+  evicted = boost::none;
+
+  // Consume from another thread: consumers get bound to the queue.
+  vector<RpcPriorityClass> order;
+  std::thread consumer([&]() {
+    unique_ptr<InboundCall> c;
+    while (queue.estimated_queue_length() > 0 && queue.BlockingGet(&c)) {
+      order.push_back(c->method_info()->priority);
+    }
+  });
+  consumer.join();
+  ASSERT_EQ(
+      NUM_RPC_PRIORITY_CLASSES * kCallsPerClass,
+      static_cast<int>(order.size()));
+
+  // High-priority calls go first, without starving the other lanes.
+  ASSERT_EQ(RPC_PRIORITY_HIGH, order[0]);
+  int high_in_first_lot = 0;
+  for (int i = 0; i < kCallsPerClass; i++) {
+    high_in_first_lot += order[i] == RPC_PRIORITY_HIGH;
+  }
+  ASSERT_GE(high_in_first_lot, kCallsPerClass - 3);
+  auto first_low = std::find(order.begin(), order.end(), RPC_PRIORITY_LOW);
+  auto last_high =
+      std::find(order.rbegin(), order.rend(), RPC_PRIORITY_HIGH).base();
+  ASSERT_TRUE(first_low < last_high);
+  queue.Shutdown();
+}
+
+TEST(TestServiceQueue, LifoServiceQueueBlockingGetTimesOut) {
+  scoped_refptr<RpcMethodInfo> method(new RpcMethodInfo());
+  LifoServiceQueue queue(10);
+  std::thread consumer([&]() {
+    // An idle consumer gives up at its deadline and leaves the queue.
+    unique_ptr<InboundCall> c;
+    bool timed_out;
+    ASSERT_FALSE(queue.BlockingGet(
+        &c, MonoTime::Now() + MonoDelta::FromMilliseconds(10), &timed_out));
+    ASSERT_TRUE(timed_out);
+    ASSERT_EQ(0, queue.estimated_idle_worker_count());
+
+    // It may come back, and then gets calls as usual.
+    boost::optional<InboundCall*> evicted;
+    ASSERT_EQ(QUEUE_SUCCESS, queue.Put(NewCall(method), &evicted));
+    ASSERT_TRUE(queue.BlockingGet(
+        &c, MonoTime::Now() + MonoDelta::FromSeconds(10), &timed_out));
+    ASSERT_FALSE(timed_out);
+    ASSERT_TRUE(c != nullptr);
+  });
+  consumer.join();
+  queue.Shutdown();
+}
+
 } // namespace rpc
 } // namespace kudu
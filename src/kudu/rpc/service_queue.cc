@@ -17,12 +17,24 @@
 
 #include "kudu/rpc/service_queue.h"
 
+#include <algorithm>
 #include <mutex>
 #include <ostream>
 
 #include <boost/optional/optional.hpp>
+#include <gflags/gflags.h>
 
 #include "kudu/gutil/port.h"
+#include "kudu/util/flag_tags.h"
+
+DEFINE_int32(
+    rpc_service_queue_priority_weight,
+    8,
+    "While calls of several priority classes wait in a service queue, the "
+    "number of calls taken from each class for every call taken from the "
+    "next lower one. 1 serves the classes round-robin.");
+TAG_FLAG(rpc_service_queue_priority_weight, advanced);
+TAG_FLAG(rpc_service_queue_priority_weight, runtime);
 
 namespace kudu {
 namespace rpc {
@@ -31,16 +43,28 @@ __thread LifoServiceQueue::ConsumerState* LifoServiceQueue::tl_consumer_ =
     nullptr;
 
 LifoServiceQueue::LifoServiceQueue(int max_size)
-    : shutdown_(false), max_queue_size_(max_size) {
+    : shutdown_(false), max_queue_size_(max_size), queue_size_(0) {
   CHECK_GT(max_queue_size_, 0);
+  for (auto& credit : lane_credit_) {
+    credit = 0;
+  }
 }
 
 LifoServiceQueue::~LifoServiceQueue() {
-  DCHECK(queue_.empty())
+  DCHECK_EQ(0, queue_size_)
       << "ServiceQueue holds bare pointers at destruction time";
 }
 
 bool LifoServiceQueue::BlockingGet(std::unique_ptr<InboundCall>* out) {
+  bool timed_out;
+  return BlockingGet(out, MonoTime::Max(), &timed_out);
+}
+
+bool LifoServiceQueue::BlockingGet(
+    std::unique_ptr<InboundCall>* out,
+    const MonoTime& deadline,
+    bool* timed_out) {
+  *timed_out = false;
   auto consumer = tl_consumer_;
   if (PREDICT_FALSE(!consumer)) {
     consumer = tl_consumer_ = new ConsumerState(this);
@@ -51,10 +75,12 @@ bool LifoServiceQueue::BlockingGet(std::unique_ptr<InboundCall>* out) {
   while (true) {
     {
       std::lock_guard<simple_spinlock> l(lock_);
-      if (!queue_.empty()) {
-        auto it = queue_.begin();
+      if (queue_size_ > 0) {
+        Lane* lane = PickLaneUnlocked();
+        auto it = lane->begin();
         out->reset(*it);
-        queue_.erase(it);
+        lane->erase(it);
+        queue_size_--;
         return true;
       }
       if (PREDICT_FALSE(shutdown_)) {
@@ -63,7 +89,30 @@ bool LifoServiceQueue::BlockingGet(std::unique_ptr<InboundCall>* out) {
       consumer->DCheckBoundInstance(this);
       waiting_consumers_.push_back(consumer);
     }
-    InboundCall* call = consumer->Wait();
+    InboundCall* call;
+    if (deadline == MonoTime::Max()) {
+      call = consumer->Wait();
+    } else if (!consumer->WaitUntil(deadline, &call)) {
+      std::unique_lock<simple_spinlock> l(lock_);
+      auto it = std::find(
+          waiting_consumers_.begin(), waiting_consumers_.end(), consumer);
+      if (it != waiting_consumers_.end()) {
+        waiting_consumers_.erase(it);
+        for (auto c = consumers_.begin(); c != consumers_.end(); ++c) {
+          if (c->get() == consumer) {
+            consumers_.erase(c);
+            break;
+          }
+        }
+        tl_consumer_ = nullptr;
+        *timed_out = true;
+        return false;
+      }
+      // A producer or Shutdown() popped this consumer just as it gave up, and
+      // is about to post to it.
+      l.unlock();
+      call = consumer->Wait();
+    }
     if (call != nullptr) {
       out->reset(call);
       return true;
@@ -81,10 +130,10 @@ QueueStatus LifoServiceQueue::Put(
     return QUEUE_SHUTDOWN;
   }
 
-  DCHECK(!(waiting_consumers_.size() > 0 && queue_.size() > 0));
+  DCHECK(!(waiting_consumers_.size() > 0 && queue_size_ > 0));
 
   // fast path
-  if (queue_.empty() && waiting_consumers_.size() > 0) {
+  if (queue_size_ == 0 && waiting_consumers_.size() > 0) {
     auto consumer = waiting_consumers_[waiting_consumers_.size() - 1];
     waiting_consumers_.pop_back();
     // Notify condition var(and wake up consumer thread) takes time,
@@ -94,23 +143,60 @@ QueueStatus LifoServiceQueue::Put(
     return QUEUE_SUCCESS;
   }
 
-  if (PREDICT_FALSE(queue_.size() >= max_queue_size_)) {
-    // eviction
-    DCHECK_EQ(queue_.size(), max_queue_size_);
-    auto it = queue_.end();
+  RpcPriorityClass priority = PriorityOf(call);
+  if (PREDICT_FALSE(queue_size_ >= max_queue_size_)) {
+    // eviction: the victim comes from the lowest-priority non-empty lane,
+    // and only if that lane is not more important than 'call'.
+    DCHECK_EQ(queue_size_, max_queue_size_);
+    int victim_priority = NUM_RPC_PRIORITY_CLASSES - 1;
+    while (lanes_[victim_priority].empty()) {
+      victim_priority--;
+    }
+    if (victim_priority < priority) {
+      return QUEUE_FULL;
+    }
+    Lane* victim_lane = &lanes_[victim_priority];
+    auto it = victim_lane->end();
     --it;
-    if (DeadlineLess(*it, call)) {
+    if (victim_priority == priority && DeadlineLess(*it, call)) {
       return QUEUE_FULL;
     }
 
     *evicted = *it;
-    queue_.erase(it);
+    victim_lane->erase(it);
+    queue_size_--;
   }
 
-  queue_.insert(call);
+  lanes_[priority].insert(call);
+  queue_size_++;
   return QUEUE_SUCCESS;
 }
 
+LifoServiceQueue::Lane* LifoServiceQueue::PickLaneUnlocked() {
+  DCHECK_GT(queue_size_, 0);
+  // Smooth weighted round-robin: every non-empty lane earns its weight, and
+  // the richest one is served and pays the total. Empty lanes don't save up
+  // credit for later.
+  int64_t factor = std::max(FLAGS_rpc_service_queue_priority_weight, 1);
+  int64_t weight = 1;
+  int64_t total_weight = 0;
+  int picked = -1;
+  for (int i = NUM_RPC_PRIORITY_CLASSES - 1; i >= 0; i--, weight *= factor) {
+    if (lanes_[i].empty()) {
+      lane_credit_[i] = 0;
+      continue;
+    }
+    lane_credit_[i] += weight;
+    total_weight += weight;
+    if (picked < 0 || lane_credit_[i] >= lane_credit_[picked]) {
+      picked = i;
+    }
+  }
+  DCHECK_GE(picked, 0);
+  lane_credit_[picked] -= total_weight;
+  return &lanes_[picked];
+}
+
 void LifoServiceQueue::Shutdown() {
   std::lock_guard<simple_spinlock> l(lock_);
   shutdown_ = true;
@@ -124,7 +210,7 @@ void LifoServiceQueue::Shutdown() {
 
 bool LifoServiceQueue::empty() const {
   std::lock_guard<simple_spinlock> l(lock_);
-  return queue_.empty();
+  return queue_size_ == 0;
 }
 
 int LifoServiceQueue::max_size() const {
@@ -135,9 +221,11 @@ std::string LifoServiceQueue::ToString() const {
   std::string ret;
 
   std::lock_guard<simple_spinlock> l(lock_);
-  for (const auto* t : queue_) {
-    ret.append(t->ToString());
-    ret.append("\n");
+  for (const auto& lane : lanes_) {
+    for (const auto* t : lane) {
+      ret.append(t->ToString());
+      ret.append("\n");
+    }
   }
   return ret;
 }
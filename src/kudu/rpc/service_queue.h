@@ -27,6 +27,7 @@
 #include "kudu/gutil/dynamic_annotations.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/rpc/inbound_call.h"
+#include "kudu/rpc/service_if.h"
 #include "kudu/util/condition_variable.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/monotime.h"
@@ -53,6 +54,14 @@ enum QueueStatus { QUEUE_SUCCESS = 0, QUEUE_SHUTDOWN = 1, QUEUE_FULL = 2 };
 // deadline can evict any call that does not have a deadline. This incentivizes
 // clients to provide accurate deadlines for their calls.
 //
+// Queued calls wait in one lane per priority class of their method (see
+// RpcMethodInfo::priority). Consumers pick a lane by weighted round-robin
+// over the non-empty lanes, each lane weighing
+// --rpc_service_queue_priority_weight times as much as the next lower one, and
+// take the earliest-deadline call from it. When the queue is full, a call may
+// only evict a call of the same or a lower priority class, and the victim is
+// taken from the lowest-priority non-empty lane.
+//
 // In order to improve concurrent throughput, this class uses a LIFO design:
 // Each consumer thread has its own lock and condition variable. If a
 // consumer arrives and there is no work available in the queue, it will not
@@ -82,6 +91,15 @@ class LifoServiceQueue {
   // getting the element.
   bool BlockingGet(std::unique_ptr<InboundCall>* out);
 
+  // Like BlockingGet(), but gives up if no call arrives before 'deadline', in
+  // which case *timed_out is set. A consumer which timed out is no longer
+  // bound to the queue: its thread may exit, or call BlockingGet() again to
+  // rejoin.
+  bool BlockingGet(
+      std::unique_ptr<InboundCall>* out,
+      const MonoTime& deadline,
+      bool* timed_out);
+
   // Add a new call to the queue.
   // Returns:
   // - QUEUE_SHUTDOWN if Shutdown() has already been called.
@@ -109,12 +127,21 @@ class LifoServiceQueue {
 
   // Return an estimate of the current queue length.
   int estimated_queue_length() const {
+    ANNOTATE_IGNORE_READS_BEGIN();
+    int ret = queue_size_;
+    ANNOTATE_IGNORE_READS_END();
+    return ret;
+  }
+
+  // Return an estimate of the number of calls waiting in the lane of
+  // 'priority'.
+  int estimated_queue_length(RpcPriorityClass priority) const {
     ANNOTATE_IGNORE_READS_BEGIN();
     // The C++ standard says that std::multiset::size must be constant time,
     // so this method won't try to traverse any actual nodes of the underlying
     // RB tree. Investigation of the libstdcxx implementation confirms that
     // size() is a simple field access of the _Rb_tree structure.
-    int ret = queue_.size();
+    int ret = lanes_[priority].size();
     ANNOTATE_IGNORE_READS_END();
     return ret;
   }
@@ -149,6 +176,18 @@ class LifoServiceQueue {
     }
   };
 
+  typedef std::multiset<InboundCall*, DeadlineLessStruct> Lane;
+
+  // Returns the priority class of the lane 'call' waits in.
+  static RpcPriorityClass PriorityOf(InboundCall* call) {
+    RpcMethodInfo* method_info = call->method_info();
+    return method_info ? method_info->priority : RPC_PRIORITY_NORMAL;
+  }
+
+  // Returns the lane the next consumer should take a call from. Must only be
+  // called with 'lock_' held and at least one call queued.
+  Lane* PickLaneUnlocked();
+
   // The thread-local record corresponding to a single consumer thread.
   // Threads push this record onto the waiting_consumers_ stack when
   // they are awaiting work. Producers pop the top waiting consumer and
@@ -180,6 +219,20 @@ class LifoServiceQueue {
       return ret;
     }
 
+    // Like Wait(), but returns false if nothing was posted by 'deadline'.
+    bool WaitUntil(const MonoTime& deadline, InboundCall** call) {
+      MutexLock l(lock_);
+      while (should_wake_ == false) {
+        if (!cond_.WaitUntil(deadline) && should_wake_ == false) {
+          return false;
+        }
+      }
+      should_wake_ = false;
+      *call = call_;
+      call_ = nullptr;
+      return true;
+    }
+
     void DCheckBoundInstance(LifoServiceQueue* q) {
       DCHECK_EQ(q, bound_queue_);
     }
@@ -204,9 +257,17 @@ class LifoServiceQueue {
   // Stack of consumer threads which are currently waiting for work.
   std::vector<ConsumerState*> waiting_consumers_;
 
-  // The actual queue. Work is only added to the queue when there were no
-  // consumers available for a "direct hand-off".
-  std::multiset<InboundCall*, DeadlineLessStruct> queue_;
+  // The actual queue, as one lane per priority class. Work is only added to
+  // the queue when there were no consumers available for a "direct
+  // hand-off".
+  Lane lanes_[NUM_RPC_PRIORITY_CLASSES];
+
+  // Total number of calls in 'lanes_'.
+  int queue_size_;
+
+  // Weighted round-robin state of each lane: the lane with the most credit is
+  // served next.
+  int64_t lane_credit_[NUM_RPC_PRIORITY_CLASSES];
 
   // The total set of consumers who have ever accessed this queue.
   std::vector<std::unique_ptr<ConsumerState>> consumers_;
@@ -0,0 +1,185 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/rpc/timer_wheel.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "kudu/util/monotime.h"
+#include "kudu/util/random.h"
+#include "kudu/util/test_util.h"
+
+using std::unique_ptr;
+using std::vector;
+
+namespace kudu {
+namespace rpc {
+
+namespace {
+
+// A timer that records when it fired, and runs 'on_fire' if set.
+class TestTimer : public TimerWheel::Timer {
+ public:
+  int num_fired = 0;
+  MonoTime fired_at;
+  std::function<void()> on_fire;
+
+  // The time the wheel was advanced to, which the timers fire "at".
+  static MonoTime now;
+
+ protected:
+  void Fire() override {
+    num_fired++;
+    fired_at = now;
+    if (on_fire) {
+      on_fire();
+    }
+  }
+};
+
+MonoTime TestTimer::now;
+
+} // anonymous namespace
+
+class TimerWheelTest : public KuduTest {
+ public:
+  TimerWheelTest()
+      : tick_(MonoDelta::FromMilliseconds(1)),
+        start_(MonoTime::Now()),
+        wheel_(tick_, start_) {}
+
+ protected:
+  void AdvanceTo(MonoTime now) {
+    TestTimer::now = now;
+    wheel_.Advance(now);
+  }
+
+  const MonoDelta tick_;
+  const MonoTime start_;
+  TimerWheel wheel_;
+};
+
+// Timers on every level fire once, no earlier than their deadline and at most
+// a tick after it.
+TEST_F(TimerWheelTest, TestFiresOnTime) {
+  Random rng(SeedRandom());
+  const int kNumTimers = 1000;
+  vector<unique_ptr<TestTimer>> timers;
+  for (int i = 0; i < kNumTimers; i++) {
+    timers.emplace_back(new TestTimer());
+    // Up to about 10 hours out, well beyond the range of the wheel.
+    int64_t delay_us = rng.Uniform64(int64_t{1} << (5 + rng.Uniform(31)));
+    wheel_.Schedule(
+        timers.back().get(), start_ + MonoDelta::FromMicroseconds(delay_us));
+  }
+  ASSERT_EQ(kNumTimers, wheel_.num_timers());
+
+  // Turn the wheel as a reactor would, waking up when the wheel asks to.
+  MonoTime now = start_;
+  while (!wheel_.empty()) {
+    MonoTime wakeup = wheel_.NextWakeup();
+    ASSERT_TRUE(wakeup.Initialized());
+    ASSERT_GT(wakeup, now);
+    now = wakeup;
+    AdvanceTo(now);
+  }
+  for (const auto& t : timers) {
+    ASSERT_EQ(1, t->num_fired);
+    ASSERT_GE(t->fired_at, t->deadline());
+    ASSERT_LE(t->fired_at, t->deadline() + tick_);
+    ASSERT_FALSE(t->is_scheduled());
+  }
+}
+
+// Advancing far ahead in one go fires everything that became due.
+TEST_F(TimerWheelTest, TestLargeJump) {
+  TestTimer near, far, later;
+  wheel_.Schedule(&near, start_ + MonoDelta::FromMilliseconds(5));
+  wheel_.Schedule(&far, start_ + MonoDelta::FromSeconds(100));
+  wheel_.Schedule(&later, start_ + MonoDelta::FromSeconds(1000));
+  AdvanceTo(start_ + MonoDelta::FromSeconds(500));
+  ASSERT_EQ(1, near.num_fired);
+  ASSERT_EQ(1, far.num_fired);
+  ASSERT_EQ(0, later.num_fired);
+  ASSERT_TRUE(later.is_scheduled());
+  ASSERT_EQ(1, wheel_.num_timers());
+}
+
+TEST_F(TimerWheelTest, TestCancelAndReschedule) {
+  TestTimer a, b;
+  wheel_.Schedule(&a, start_ + MonoDelta::FromMilliseconds(10));
+  wheel_.Schedule(&b, start_ + MonoDelta::FromMilliseconds(10));
+  wheel_.Cancel(&a);
+  ASSERT_FALSE(a.is_scheduled());
+  // Rescheduling moves the timer rather than adding it twice.
+  wheel_.Schedule(&b, start_ + MonoDelta::FromMilliseconds(20));
+  ASSERT_EQ(1, wheel_.num_timers());
+
+  // Destroying a scheduled timer takes it off the wheel.
+  {
+    TestTimer c;
+    wheel_.Schedule(&c, start_ + MonoDelta::FromMilliseconds(10));
+    ASSERT_EQ(2, wheel_.num_timers());
+  }
+  ASSERT_EQ(1, wheel_.num_timers());
+
+  AdvanceTo(start_ + MonoDelta::FromMilliseconds(15));
+  ASSERT_EQ(0, a.num_fired);
+  ASSERT_EQ(0, b.num_fired);
+  AdvanceTo(start_ + MonoDelta::FromMilliseconds(20));
+  ASSERT_EQ(1, b.num_fired);
+  ASSERT_TRUE(wheel_.empty());
+  ASSERT_FALSE(wheel_.NextWakeup().Initialized());
+}
+
+// A timer may schedule itself and cancel other timers while firing.
+TEST_F(TimerWheelTest, TestScheduleFromFire) {
+  TestTimer periodic, victim;
+  periodic.on_fire = [&]() {
+    wheel_.Cancel(&victim);
+    if (periodic.num_fired < 10) {
+      wheel_.Schedule(
+          &periodic, TestTimer::now + MonoDelta::FromMilliseconds(100));
+    }
+  };
+  wheel_.Schedule(&periodic, start_ + MonoDelta::FromMilliseconds(100));
+  wheel_.Schedule(&victim, start_ + MonoDelta::FromMilliseconds(150));
+  for (int i = 1; i <= 20; i++) {
+    AdvanceTo(start_ + MonoDelta::FromMilliseconds(100 * i));
+  }
+  ASSERT_EQ(10, periodic.num_fired);
+  ASSERT_EQ(0, victim.num_fired);
+  ASSERT_TRUE(wheel_.empty());
+}
+
+// Timers which are due already fire on the next tick.
+TEST_F(TimerWheelTest, TestPastDeadline) {
+  AdvanceTo(start_ + MonoDelta::FromMilliseconds(100));
+  TestTimer t;
+  wheel_.Schedule(&t, start_);
+  ASSERT_EQ(start_ + MonoDelta::FromMilliseconds(101), wheel_.WakeupFor(&t));
+  AdvanceTo(start_ + MonoDelta::FromMilliseconds(101));
+  ASSERT_EQ(1, t.num_fired);
+}
+
+} // namespace rpc
+} // namespace kudu
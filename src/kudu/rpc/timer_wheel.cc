@@ -0,0 +1,207 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/rpc/timer_wheel.h"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+
+namespace kudu {
+namespace rpc {
+
+constexpr int TimerWheel::kBitsPerLevel;
+constexpr int TimerWheel::kSlotsPerLevel;
+constexpr int TimerWheel::kNumLevels;
+
+namespace {
+
+constexpr int64_t kSlotMask = TimerWheel::kSlotsPerLevel - 1;
+
+// The number of ticks spanned by a slot of 'level'.
+int64_t SlotSpan(int level) {
+  return int64_t{1} << (TimerWheel::kBitsPerLevel * level);
+}
+
+} // anonymous namespace
+
+TimerWheel::Timer::Timer()
+    : wheel_(nullptr), level_(0), slot_(0), expiry_tick_(0), wakeup_tick_(0) {}
+
+TimerWheel::Timer::~Timer() {
+  if (wheel_) {
+    wheel_->Cancel(this);
+  }
+}
+
+TimerWheel::TimerWheel(MonoDelta tick, MonoTime now)
+    : tick_(tick), origin_(now), current_tick_(0), num_timers_(0) {
+  CHECK_GT(tick_.ToNanoseconds(), 0);
+  std::fill_n(num_timers_per_level_, kNumLevels, 0);
+}
+
+TimerWheel::~TimerWheel() {
+  for (auto& level : slots_) {
+    for (Slot& slot : level) {
+      while (!slot.empty()) {
+        slot.front().wheel_ = nullptr;
+        slot.pop_front();
+      }
+    }
+  }
+}
+
+void TimerWheel::Schedule(Timer* timer, MonoTime deadline) {
+  Cancel(timer);
+  timer->deadline_ = deadline;
+  // Round up, so that the timer never fires before its deadline.
+  int64_t nanos = (deadline - origin_).ToNanoseconds();
+  int64_t tick_nanos = tick_.ToNanoseconds();
+  timer->expiry_tick_ = nanos <= 0 ? 0 : (nanos + tick_nanos - 1) / tick_nanos;
+  Insert(timer);
+}
+
+void TimerWheel::Cancel(Timer* timer) {
+  if (!timer->wheel_) {
+    return;
+  }
+  DCHECK_EQ(this, timer->wheel_);
+  Slot& slot = slots_[timer->level_][timer->slot_];
+  slot.erase(Slot::s_iterator_to(*timer));
+  timer->wheel_ = nullptr;
+  num_timers_--;
+  num_timers_per_level_[timer->level_]--;
+}
+
+void TimerWheel::Insert(Timer* timer) {
+  DCHECK(!timer->wheel_);
+  // A timer that is already due fires on the next tick.
+  int64_t slot_tick = std::max(timer->expiry_tick_, current_tick_ + 1);
+  int64_t delta = slot_tick - current_tick_;
+  int level = 0;
+  while (level < kNumLevels - 1 && delta >= SlotSpan(level + 1)) {
+    level++;
+  }
+  if (delta >= SlotSpan(kNumLevels)) {
+    // Beyond the range of the wheel: wait in the farthest slot of the top
+    // level, and get filed again from there.
+    slot_tick = current_tick_ + SlotSpan(kNumLevels) - 1;
+  }
+  int64_t block = slot_tick >> (kBitsPerLevel * level);
+  timer->wheel_ = this;
+  timer->level_ = level;
+  timer->slot_ = static_cast<int>(block & kSlotMask);
+  timer->wakeup_tick_ = block << (kBitsPerLevel * level);
+  slots_[level][timer->slot_].push_back(*timer);
+  num_timers_++;
+  num_timers_per_level_[level]++;
+}
+
+void TimerWheel::Process(int level, int slot) {
+  Slot timers;
+  timers.swap(slots_[level][slot]);
+  num_timers_ -= timers.size();
+  num_timers_per_level_[level] -= timers.size();
+  while (!timers.empty()) {
+    Timer* timer = &timers.front();
+    timers.pop_front();
+    timer->wheel_ = nullptr;
+    if (timer->expiry_tick_ <= current_tick_) {
+      // May schedule or cancel other timers, but none of 'timers', which
+      // are off the wheel.
+      timer->Fire();
+    } else {
+      Insert(timer);
+    }
+  }
+}
+
+void TimerWheel::Advance(MonoTime now) {
+  int64_t target_tick = TicksUntil(now);
+  while (current_tick_ < target_tick) {
+    // Skip the ticks at which no slot with timers comes up.
+    int lowest_level = 0;
+    while (lowest_level < kNumLevels &&
+           num_timers_per_level_[lowest_level] == 0) {
+      lowest_level++;
+    }
+    if (lowest_level == kNumLevels) {
+      current_tick_ = target_tick;
+      break;
+    }
+    if (lowest_level > 0) {
+      int64_t shift = kBitsPerLevel * lowest_level;
+      int64_t next_boundary = ((current_tick_ >> shift) + 1) << shift;
+      current_tick_ = std::min(target_tick, next_boundary - 1);
+      if (current_tick_ == target_tick) {
+        break;
+      }
+    }
+
+    current_tick_++;
+    // Cascade the higher levels first, so that a timer moving down to the
+    // slot of the current tick fires right away.
+    for (int level = kNumLevels - 1; level > 0; level--) {
+      if ((current_tick_ & (SlotSpan(level) - 1)) == 0) {
+        Process(level, (current_tick_ >> (kBitsPerLevel * level)) & kSlotMask);
+      }
+    }
+    Process(0, current_tick_ & kSlotMask);
+  }
+}
+
+MonoTime TimerWheel::NextWakeup() const {
+  if (num_timers_ == 0) {
+    return MonoTime();
+  }
+  int64_t next_tick = -1;
+  for (int level = 0; level < kNumLevels; level++) {
+    if (num_timers_per_level_[level] == 0) {
+      continue;
+    }
+    int shift = kBitsPerLevel * level;
+    int64_t block = current_tick_ >> shift;
+    for (int i = 1; i <= kSlotsPerLevel; i++) {
+      if (!slots_[level][(block + i) & kSlotMask].empty()) {
+        int64_t tick = (block + i) << shift;
+        if (next_tick < 0 || tick < next_tick) {
+          next_tick = tick;
+        }
+        break;
+      }
+    }
+  }
+  DCHECK_GE(next_tick, 0);
+  return TimeOfTick(next_tick);
+}
+
+MonoTime TimerWheel::WakeupFor(const Timer* timer) const {
+  DCHECK_EQ(this, timer->wheel_);
+  return TimeOfTick(timer->wakeup_tick_);
+}
+
+int64_t TimerWheel::TicksUntil(MonoTime time) const {
+  int64_t nanos = (time - origin_).ToNanoseconds();
+  return nanos <= 0 ? 0 : nanos / tick_.ToNanoseconds();
+}
+
+MonoTime TimerWheel::TimeOfTick(int64_t tick) const {
+  return origin_ + MonoDelta::FromNanoseconds(tick * tick_.ToNanoseconds());
+}
+
+} // namespace rpc
+} // namespace kudu
@@ -0,0 +1,161 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+
+#include <boost/intrusive/list.hpp>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/util/monotime.h"
+
+namespace kudu {
+namespace rpc {
+
+// A hierarchical timing wheel, for the timers of a reactor thread.
+//
+// Timers are kept in buckets of 'tick' granularity rather than in a heap, so
+// scheduling and cancelling a timer is O(1), at the price of a timer firing
+// up to a tick late (never early). This suits timers that are numerous and
+// coarse, like the timeouts of outbound calls and periodic heartbeats, which
+// otherwise each cost a libev timer in the reactor's heap.
+//
+// The wheel has kNumLevels levels of kSlotsPerLevel slots. A slot of level L
+// spans kSlotsPerLevel^L ticks. A timer goes into the level whose range
+// covers its delay, and moves down a level every time the wheel turns past
+// its slot ("cascading"), until it fires from level 0. Timers further out
+// than the top level's range wait in the top level and get re-filed.
+//
+// Not thread-safe: the wheel and its timers must only be used by one thread.
+class TimerWheel {
+ public:
+  static constexpr int kBitsPerLevel = 6;
+  static constexpr int kSlotsPerLevel = 1 << kBitsPerLevel;
+  static constexpr int kNumLevels = 4;
+
+  // A timer which can be scheduled on a wheel. Destroying a scheduled timer
+  // cancels it.
+  class Timer {
+   public:
+    Timer();
+    virtual ~Timer();
+
+    bool is_scheduled() const {
+      return wheel_ != nullptr;
+    }
+
+    // The deadline the timer was last scheduled for.
+    MonoTime deadline() const {
+      return deadline_;
+    }
+
+   protected:
+    // Runs on the wheel's thread once the deadline passed. The timer is no
+    // longer scheduled by then, so it may schedule itself again.
+    virtual void Fire() = 0;
+
+   private:
+    friend class TimerWheel;
+
+    boost::intrusive::list_member_hook<> hook_;
+    // Where the timer is filed while it is scheduled.
+    TimerWheel* wheel_;
+    int level_;
+    int slot_;
+
+    // The first tick at or after the deadline, and the tick at which the
+    // wheel turns to the timer's slot.
+    int64_t expiry_tick_;
+    int64_t wakeup_tick_;
+    MonoTime deadline_;
+
+    DISALLOW_COPY_AND_ASSIGN(Timer);
+  };
+
+  // Creates a wheel of 'tick' granularity, which starts turning at 'now'.
+  TimerWheel(MonoDelta tick, MonoTime now);
+
+  // Unschedules any timers still on the wheel, without firing them.
+  ~TimerWheel();
+
+  // Schedules 'timer' to fire once 'deadline' passed. Reschedules it if it was
+  // already scheduled.
+  void Schedule(Timer* timer, MonoTime deadline);
+
+  // Unschedules 'timer', if it was scheduled.
+  void Cancel(Timer* timer);
+
+  // Turns the wheel to 'now', firing every timer whose deadline passed.
+  void Advance(MonoTime now);
+
+  // Returns the earliest time at which Advance() may have something to do,
+  // or an uninitialized MonoTime if no timers are scheduled. Finding it
+  // takes a scan of the slots, so it's meant to be called once per Advance().
+  MonoTime NextWakeup() const;
+
+  // Returns the time Advance() may first have something to do for 'timer',
+  // which must be scheduled. This is O(1).
+  MonoTime WakeupFor(const Timer* timer) const;
+
+  bool empty() const {
+    return num_timers_ == 0;
+  }
+
+  int64_t num_timers() const {
+    return num_timers_;
+  }
+
+  MonoDelta tick() const {
+    return tick_;
+  }
+
+ private:
+  typedef boost::intrusive::list<
+      Timer,
+      boost::intrusive::member_hook<
+          Timer,
+          boost::intrusive::list_member_hook<>,
+          &Timer::hook_>>
+      Slot;
+
+  // Files 'timer' into the slot for its expiry tick.
+  void Insert(Timer* timer);
+
+  // Takes the timers of 'slot' of 'level' off the wheel and files each one
+  // again, firing it if it's due.
+  void Process(int level, int slot);
+
+  // The number of whole ticks from the start of the wheel to 'time'.
+  int64_t TicksUntil(MonoTime time) const;
+  MonoTime TimeOfTick(int64_t tick) const;
+
+  const MonoDelta tick_;
+  const MonoTime origin_;
+
+  // The last tick the wheel turned to. The timers due at or before it fired.
+  int64_t current_tick_;
+
+  int64_t num_timers_;
+  int64_t num_timers_per_level_[kNumLevels];
+  Slot slots_[kNumLevels][kSlotsPerLevel];
+
+  DISALLOW_COPY_AND_ASSIGN(TimerWheel);
+};
+
+} // namespace rpc
+} // namespace kudu
@@ -23,7 +23,9 @@
 #include <cstdint>
 #include <iostream>
 #include <limits>
+#include <mutex>
 #include <set>
+#include <utility>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
@@ -34,6 +36,7 @@
 #include "kudu/rpc/constants.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
+#include "kudu/util/mem_tracker.h"
 #include "kudu/util/net/socket.h"
 
 DEFINE_int64(
@@ -60,6 +63,22 @@ static bool dummy = gflags::RegisterFlagValidator(
     &FLAGS_rpc_max_message_size,
     &ValidateMaxMessageSize);
 
+DEFINE_int32(
+    rpc_inbound_buffer_pool_min_bytes,
+    256 * 1024,
+    "Inbound RPC messages at least this large are received into buffers "
+    "reused from a per-reactor pool.");
+TAG_FLAG(rpc_inbound_buffer_pool_min_bytes, advanced);
+TAG_FLAG(rpc_inbound_buffer_pool_min_bytes, runtime);
+
+DEFINE_int32(
+    rpc_inbound_buffer_pool_max_idle_mb,
+    64,
+    "The most memory each reactor keeps in idle pooled receive buffers. 0 "
+    "disables the pooling of receive buffers.");
+TAG_FLAG(rpc_inbound_buffer_pool_max_idle_mb, advanced);
+TAG_FLAG(rpc_inbound_buffer_pool_max_idle_mb, runtime);
+
 namespace kudu {
 namespace rpc {
 
@@ -81,9 +100,83 @@ using strings::Substitute;
 
 TransferCallbacks::~TransferCallbacks() {}
 
-InboundTransfer::InboundTransfer()
-    : total_length_(kMsgLengthPrefixLength), cur_offset_(0) {
-  buf_.resize(kMsgLengthPrefixLength);
+InboundBufferPool::InboundBufferPool(std::shared_ptr<MemTracker> mem_tracker)
+    : mem_tracker_(std::move(mem_tracker)), idle_bytes_(0) {}
+
+InboundBufferPool::~InboundBufferPool() {
+  mem_tracker_->Release(idle_bytes_);
+}
+
+bool InboundBufferPool::ShouldPool(size_t size) {
+  return FLAGS_rpc_inbound_buffer_pool_max_idle_mb > 0 &&
+      size >= static_cast<size_t>(FLAGS_rpc_inbound_buffer_pool_min_bytes);
+}
+
+int InboundBufferPool::SizeClass(size_t size) {
+  int size_class = 0;
+  while ((static_cast<size_t>(1) << size_class) < size) {
+    size_class++;
+  }
+  return size_class;
+}
+
+std::unique_ptr<faststring> InboundBufferPool::Acquire(size_t size) {
+  int size_class = SizeClass(size);
+  std::unique_ptr<faststring> buf;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (size_class < free_buffers_.size() &&
+        !free_buffers_[size_class].empty()) {
+      buf = std::move(free_buffers_[size_class].back());
+      free_buffers_[size_class].pop_back();
+      idle_bytes_ -= buf->capacity();
+    }
+  }
+  if (buf) {
+    mem_tracker_->Release(buf->capacity());
+  } else {
+    // Allocate the whole size class, so the buffer fits any message of it.
+    buf.reset(new faststring(static_cast<size_t>(1) << size_class));
+  }
+  buf->resize(size);
+  return buf;
+}
+
+void InboundBufferPool::Release(std::unique_ptr<faststring> buf) {
+  size_t capacity = buf->capacity();
+  int size_class = SizeClass(capacity);
+  if ((static_cast<size_t>(1) << size_class) != capacity) {
+    // Not one of ours, e.g. grown past its class.
+    return;
+  }
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    int64_t max_idle_bytes =
+        static_cast<int64_t>(FLAGS_rpc_inbound_buffer_pool_max_idle_mb) << 20;
+    if (idle_bytes_ + static_cast<int64_t>(capacity) > max_idle_bytes) {
+      return;
+    }
+    if (size_class >= free_buffers_.size()) {
+      free_buffers_.resize(size_class + 1);
+    }
+    free_buffers_[size_class].emplace_back(std::move(buf));
+    idle_bytes_ += capacity;
+  }
+  mem_tracker_->Consume(capacity);
+}
+
+InboundTransfer::InboundTransfer(std::shared_ptr<InboundBufferPool> buffer_pool)
+    : buf_(&own_buf_),
+      buffer_pool_(std::move(buffer_pool)),
+      total_length_(kMsgLengthPrefixLength),
+      cur_offset_(0) {
+  own_buf_.resize(kMsgLengthPrefixLength);
+}
+
+InboundTransfer::~InboundTransfer() {
+  if (pooled_buf_) {
+    buffer_pool_->Release(std::move(pooled_buf_));
+  }
 }
 
 Status InboundTransfer::ReceiveBuffer(Socket& socket) {
@@ -91,7 +184,7 @@ Status InboundTransfer::ReceiveBuffer(Socket& socket) {
     // receive uint32 length prefix
     int32_t rem = kMsgLengthPrefixLength - cur_offset_;
     int32_t nread;
-    Status status = socket.Recv(&buf_[cur_offset_], rem, &nread);
+    Status status = socket.Recv(&(*buf_)[cur_offset_], rem, &nread);
     RETURN_ON_ERROR_OR_SOCKET_NOT_READY(status);
     if (nread == 0) {
       return Status::OK();
@@ -109,7 +202,8 @@ Status InboundTransfer::ReceiveBuffer(Socket& socket) {
 
     // The length prefix doesn't include its own 4 bytes, so we have to
     // add that back in.
-    total_length_ = NetworkByteOrder::Load32(&buf_[0]) + kMsgLengthPrefixLength;
+    total_length_ =
+        NetworkByteOrder::Load32(&(*buf_)[0]) + kMsgLengthPrefixLength;
     if (total_length_ > FLAGS_rpc_max_message_size) {
       return Status::NetworkError(Substitute(
           "RPC frame had a length of $0, but we only support messages up to $1 bytes "
@@ -121,7 +215,13 @@ Status InboundTransfer::ReceiveBuffer(Socket& socket) {
       return Status::NetworkError(
           Substitute("RPC frame had invalid length of $0", total_length_));
     }
-    buf_.resize(total_length_);
+    if (buffer_pool_ && InboundBufferPool::ShouldPool(total_length_)) {
+      pooled_buf_ = buffer_pool_->Acquire(total_length_);
+      memcpy(pooled_buf_->data(), own_buf_.data(), kMsgLengthPrefixLength);
+      buf_ = pooled_buf_.get();
+    } else {
+      own_buf_.resize(total_length_);
+    }
 
     // Fall through to receive the message body, which is likely to be already
     // available on the socket.
@@ -137,7 +237,7 @@ Status InboundTransfer::ReceiveBuffer(Socket& socket) {
   int32_t rem = std::min(
       total_length_ - cur_offset_,
       static_cast<uint32_t>(std::numeric_limits<int32_t>::max()));
-  Status status = socket.Recv(&buf_[cur_offset_], rem, &nread);
+  Status status = socket.Recv(&(*buf_)[cur_offset_], rem, &nread);
   RETURN_ON_ERROR_OR_SOCKET_NOT_READY(status);
   cur_offset_ += nread;
 
@@ -182,7 +282,10 @@ OutboundTransfer::OutboundTransfer(
       callbacks_(callbacks),
       call_id_(call_id),
       started_(false),
-      aborted_(false) {
+      aborted_(false),
+      zerocopy_(false),
+      last_zerocopy_send_(0),
+      zerocopy_pending_(false) {
   n_payload_slices_ = n_payload_slices;
   CHECK_LE(n_payload_slices_, payload_slices_.size());
   for (int i = 0; i < n_payload_slices; i++) {
@@ -191,7 +294,11 @@ OutboundTransfer::OutboundTransfer(
 }
 
 OutboundTransfer::~OutboundTransfer() {
-  if (!TransferFinished() && !aborted_) {
+  if (zerocopy_pending_) {
+    // The connection is being torn down, so the kernel won't send any more
+    // of the buffers.
+    callbacks_->NotifyTransferFinished();
+  } else if (!TransferFinished() && !aborted_) {
     callbacks_->NotifyTransferAborted(Status::RuntimeError(
         "RPC transfer destroyed before it finished sending"));
   }
@@ -207,24 +314,39 @@ void OutboundTransfer::Abort(const Status& status) {
 Status OutboundTransfer::SendBuffer(Socket& socket) {
   CHECK_LT(cur_slice_idx_, n_payload_slices_);
 
-  started_ = true;
-  int n_iovecs = n_payload_slices_ - cur_slice_idx_;
-  struct iovec iovec[n_iovecs];
-  {
-    int offset_in_slice = cur_offset_in_slice_;
-    for (int i = 0; i < n_iovecs; i++) {
-      Slice& slice = payload_slices_[cur_slice_idx_ + i];
-      iovec[i].iov_base = slice.mutable_data() + offset_in_slice;
-      iovec[i].iov_len = slice.size() - offset_in_slice;
-
-      offset_in_slice = 0;
-    }
-  }
+  struct iovec iovec[TransferLimits::kMaxPayloadSlices];
+  int n_iovecs = AppendIovecs(iovec, TransferLimits::kMaxPayloadSlices);
 
   int64_t written;
   Status status = socket.Writev(iovec, n_iovecs, &written);
   RETURN_ON_ERROR_OR_SOCKET_NOT_READY(status);
 
+  ConsumeWritten(written);
+  return Status::OK();
+}
+
+int OutboundTransfer::AppendIovecs(struct iovec* iov, int max_iovecs) {
+  DCHECK_LT(cur_slice_idx_, n_payload_slices_);
+  int n_iovecs = n_payload_slices_ - cur_slice_idx_;
+  if (n_iovecs > max_iovecs) {
+    return 0;
+  }
+
+  started_ = true;
+  int offset_in_slice = cur_offset_in_slice_;
+  for (int i = 0; i < n_iovecs; i++) {
+    Slice& slice = payload_slices_[cur_slice_idx_ + i];
+    iov[i].iov_base = slice.mutable_data() + offset_in_slice;
+    iov[i].iov_len = slice.size() - offset_in_slice;
+
+    offset_in_slice = 0;
+  }
+  return n_iovecs;
+}
+
+int64_t OutboundTransfer::ConsumeWritten(int64_t written) {
+  DCHECK_LT(cur_slice_idx_, n_payload_slices_);
+
   // Adjust our accounting of current writer position.
   for (int i = cur_slice_idx_; i < n_payload_slices_; i++) {
     Slice& slice = payload_slices_[i];
@@ -244,14 +366,33 @@ Status OutboundTransfer::SendBuffer(Socket& socket) {
   }
 
   if (cur_slice_idx_ == n_payload_slices_) {
-    callbacks_->NotifyTransferFinished();
+    if (zerocopy_) {
+      zerocopy_pending_ = true;
+      callbacks_->NotifyTransferWritten();
+    } else {
+      callbacks_->NotifyTransferFinished();
+    }
     DCHECK_EQ(0, cur_offset_in_slice_);
-  } else {
-    DCHECK_LT(cur_slice_idx_, n_payload_slices_);
-    DCHECK_LT(cur_offset_in_slice_, payload_slices_[cur_slice_idx_].size());
+    return written;
   }
+  DCHECK_LT(cur_offset_in_slice_, payload_slices_[cur_slice_idx_].size());
+  return 0;
+}
 
-  return Status::OK();
+void OutboundTransfer::AddZeroCopySend(uint32_t send_seq) {
+  zerocopy_ = true;
+  last_zerocopy_send_ = send_seq;
+}
+
+bool OutboundTransfer::MaybeCompleteZeroCopy(uint32_t num_completed) {
+  DCHECK(zerocopy_pending_);
+  // Send numbers wrap around.
+  if (static_cast<int32_t>(num_completed - last_zerocopy_send_) <= 0) {
+    return false;
+  }
+  zerocopy_pending_ = false;
+  callbacks_->NotifyTransferFinished();
+  return true;
 }
 
 bool OutboundTransfer::TransferStarted() const {
@@ -21,8 +21,12 @@
 #include <limits.h>
 #include <array>
 #include <cstddef>
+#include <sys/uio.h>
+
 #include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <boost/intrusive/list_hook.hpp>
 #include <gflags/gflags_declare.h>
@@ -31,6 +35,7 @@
 #include "kudu/gutil/macros.h"
 #include "kudu/rpc/constants.h"
 #include "kudu/util/faststring.h"
+#include "kudu/util/locks.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 
@@ -38,6 +43,7 @@ DECLARE_int64(rpc_max_message_size);
 
 namespace kudu {
 
+class MemTracker;
 class Socket;
 
 namespace rpc {
@@ -57,6 +63,47 @@ class TransferLimits {
 
 typedef std::array<Slice, TransferLimits::kMaxPayloadSlices> TransferPayload;
 
+// A pool of receive buffers for large inbound transfers, so that steady
+// replication traffic reuses the same multi-megabyte buffers instead of
+// allocating and freeing one per message.
+//
+// Buffers are kept in power-of-two size classes. A buffer goes back to the
+// pool when its transfer is destroyed, which is usually when the InboundCall
+// owning it is responded to, possibly on another thread. The memory held by
+// the idle buffers is tracked by the pool's MemTracker and capped by
+// --rpc_inbound_buffer_pool_max_idle_mb.
+//
+// This class is thread-safe.
+class InboundBufferPool {
+ public:
+  explicit InboundBufferPool(std::shared_ptr<MemTracker> mem_tracker);
+  ~InboundBufferPool();
+
+  // Returns true if a transfer of 'size' bytes should take its buffer from a
+  // pool.
+  static bool ShouldPool(size_t size);
+
+  // Returns a buffer resized to 'size' bytes, reused if possible.
+  std::unique_ptr<faststring> Acquire(size_t size);
+
+  // Gives 'buf' back to the pool, or frees it if the pool is full.
+  void Release(std::unique_ptr<faststring> buf);
+
+ private:
+  // Returns the size class of buffers with at least 'size' bytes of capacity.
+  static int SizeClass(size_t size);
+
+  const std::shared_ptr<MemTracker> mem_tracker_;
+
+  simple_spinlock lock_;
+
+  // Idle buffers by size class, and their total capacity.
+  std::vector<std::vector<std::unique_ptr<faststring>>> free_buffers_;
+  int64_t idle_bytes_;
+
+  DISALLOW_COPY_AND_ASSIGN(InboundBufferPool);
+};
+
 // This class is used internally by the RPC layer to represent an inbound
 // transfer in progress.
 //
@@ -65,7 +112,11 @@ typedef std::array<Slice, TransferLimits::kMaxPayloadSlices> TransferPayload;
 // and the InboundTransfer object itself is handed off.
 class InboundTransfer {
  public:
-  InboundTransfer();
+  // If 'buffer_pool' is set, a large message is received into a buffer from
+  // it, which goes back to the pool when this transfer is destroyed.
+  explicit InboundTransfer(
+      std::shared_ptr<InboundBufferPool> buffer_pool = nullptr);
+  ~InboundTransfer();
 
   // read from the socket into our buffer
   Status ReceiveBuffer(Socket& socket);
@@ -77,7 +128,7 @@ class InboundTransfer {
   bool TransferFinished() const;
 
   Slice data() const {
-    return Slice(buf_);
+    return Slice(*buf_);
   }
 
   // Return a string indicating the status of this transfer (number of bytes
@@ -87,7 +138,11 @@ class InboundTransfer {
  private:
   Status ProcessInboundHeader();
 
-  faststring buf_;
+  // The buffer being received into: either 'own_buf_' or 'pooled_buf_'.
+  faststring* buf_;
+  faststring own_buf_;
+  std::unique_ptr<faststring> pooled_buf_;
+  const std::shared_ptr<InboundBufferPool> buffer_pool_;
 
   uint32_t total_length_;
   uint32_t cur_offset_;
@@ -141,6 +196,34 @@ class OutboundTransfer : public boost::intrusive::list_base_hook<> {
   // send from our buffers into the sock
   Status SendBuffer(Socket& socket);
 
+  // Fills 'iov' with the not yet sent part of this transfer and marks the
+  // transfer as started, so that a connection can send several queued
+  // transfers with one write. Returns the number of iovecs used, or 0 if
+  // they would not fit in 'max_iovecs'.
+  int AppendIovecs(struct iovec* iov, int max_iovecs);
+
+  // Accounts for 'written' bytes having been sent, starting at this
+  // transfer, and notifies the callbacks if that finishes it. Returns the
+  // number of bytes that went past the end of this transfer.
+  int64_t ConsumeWritten(int64_t written);
+
+  // Records that part of this transfer went out with zero-copy send number
+  // 'send_seq' (see Socket::WritevZeroCopy()). When the last byte is written
+  // the callbacks are then only told so with NotifyTransferWritten(), and
+  // NotifyTransferFinished() waits until the kernel has completed all such
+  // sends, since until then it still reads the buffers.
+  void AddZeroCopySend(uint32_t send_seq);
+
+  // Whether this transfer is finished except for the completion of its
+  // zero-copy sends.
+  bool AwaitingZeroCopy() const {
+    return zerocopy_pending_;
+  }
+
+  // If all of this transfer's zero-copy sends are among the first
+  // 'num_completed' ones, notifies the callbacks and returns true.
+  bool MaybeCompleteZeroCopy(uint32_t num_completed);
+
   // Return true if any bytes have yet been sent.
   bool TransferStarted() const;
 
@@ -193,6 +276,15 @@ class OutboundTransfer : public boost::intrusive::list_base_hook<> {
 
   bool aborted_;
 
+  // Whether any of this transfer was sent with a zero-copy send, and the
+  // number of the last such send.
+  bool zerocopy_;
+  uint32_t last_zerocopy_send_;
+
+  // True once the transfer is finished but waiting for the completion of its
+  // zero-copy sends.
+  bool zerocopy_pending_;
+
   DISALLOW_COPY_AND_ASSIGN(OutboundTransfer);
 };
 
@@ -204,6 +296,11 @@ struct TransferCallbacks {
   // The transfer finished successfully.
   virtual void NotifyTransferFinished() = 0;
 
+  // The last byte of a transfer sent with zero-copy sends was written, but
+  // the kernel may still read its buffers, so they must be kept alive until
+  // NotifyTransferFinished() is called.
+  virtual void NotifyTransferWritten() {}
+
   // The transfer was aborted (e.g because the connection died or an error
   // occurred).
   virtual void NotifyTransferAborted(const Status& status) = 0;
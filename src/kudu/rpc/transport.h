@@ -0,0 +1,92 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <functional>
+#include <memory>
+
+#include "kudu/util/net/sockaddr.h"
+#include "kudu/util/net/socket.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+namespace rpc {
+
+// A transport other than TCP for the connections of a messenger, such as
+// RDMA between the hosts of a region, set with
+// MessengerBuilder::set_transport().
+//
+// The messenger opens a connection through the transport to each remote it
+// handles, and accepts the connections it delivers alongside those of the
+// acceptor pools. A connection is a Socket subclass which overrides the I/O
+// calls, e.g. to write into remote buffers registered with the NIC. Its file
+// descriptor must become readable and writable when the connection does, as
+// a TCP socket's would: the reactors and the negotiation poll it. A
+// completion channel or an eventfd the transport signals does.
+//
+// When the transport fails to open a connection to a remote, or the
+// negotiation over it fails, the messenger falls back to TCP for that remote
+// for --rpc_transport_fallback_secs.
+//
+// Implementations must be thread-safe.
+class Transport {
+ public:
+  // Called with each connection accepted, and the address of its remote.
+  typedef std::function<void(std::unique_ptr<Socket>, const Sockaddr&)>
+      AcceptedCallback;
+
+  virtual ~Transport() = default;
+
+  // For the logs.
+  virtual const char* name() const = 0;
+
+  // Whether to connect to 'remote' through the transport, rather than TCP.
+  virtual bool Handles(const Sockaddr& remote) const = 0;
+
+  // Whether TLS runs over the transport's connections. If not, they are
+  // negotiated without encryption, so that a messenger requiring it uses
+  // TCP instead, unless they are local.
+  virtual bool SupportsTls() const {
+    return false;
+  }
+
+  // Whether the transport's connections stay on this host, so that they are
+  // confidential without TLS.
+  virtual bool IsLocal() const {
+    return false;
+  }
+
+  // Starts connecting to 'remote', setting 'socket' to the non-blocking
+  // connection, which becomes writable once it is established.
+  virtual Status StartConnect(
+      const Sockaddr& remote,
+      std::unique_ptr<Socket>* socket) = 0;
+
+  // Starts accepting connections to 'address', the bound address of an
+  // acceptor pool, passing them to 'callback' until StopListening().
+  virtual Status Listen(
+      const Sockaddr& address,
+      AcceptedCallback callback) = 0;
+
+  // Stops accepting connections to 'address'. Once it returns, the callback
+  // passed to Listen() is no longer called.
+  virtual void StopListening(const Sockaddr& address) = 0;
+};
+
+} // namespace rpc
+} // namespace kudu
@@ -0,0 +1,264 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/rpc/unix_socket_transport.h"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <ostream>
+#include <utility>
+
+#include <gflags/gflags_declare.h>
+#include <glog/logging.h>
+
+#include "kudu/gutil/basictypes.h"
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/errno.h"
+#include "kudu/util/logging.h"
+#include "kudu/util/thread.h"
+
+DECLARE_int32(rpc_acceptor_listen_backlog);
+
+using std::string;
+using std::unique_ptr;
+using strings::Substitute;
+
+namespace kudu {
+namespace rpc {
+
+namespace {
+
+Sockaddr LoopbackAddress(int port) {
+  struct sockaddr_in6 addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin6_family = AF_INET6;
+  addr.sin6_addr = in6addr_loopback;
+  Sockaddr ret(addr);
+  ret.set_port(port);
+  return ret;
+}
+
+Status MakeUnixAddress(const string& path, struct sockaddr_un* addr) {
+  if (path.size() >= sizeof(addr->sun_path)) {
+    return Status::InvalidArgument("Unix socket path too long", path);
+  }
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  memcpy(addr->sun_path, path.c_str(), path.size() + 1);
+  return Status::OK();
+}
+
+// A connected Unix domain socket. It reports loopback addresses, with the
+// port of the server's acceptor pool on the server side of the connection.
+class UnixSocket : public Socket {
+ public:
+  UnixSocket(int fd, Sockaddr local, Sockaddr remote)
+      : Socket(fd), local_(local), remote_(remote) {}
+
+  Status GetSocketAddress(Sockaddr* cur_addr) const override {
+    *cur_addr = local_;
+    return Status::OK();
+  }
+
+  Status GetPeerAddress(Sockaddr* cur_addr) const override {
+    *cur_addr = remote_;
+    return Status::OK();
+  }
+
+  Status EnableZeroCopy() override {
+    return Status::NotSupported("no zero-copy sends over Unix sockets");
+  }
+
+ private:
+  const Sockaddr local_;
+  const Sockaddr remote_;
+};
+
+} // anonymous namespace
+
+UnixSocketTransport::UnixSocketTransport(string socket_dir)
+    : socket_dir_(std::move(socket_dir)) {}
+
+UnixSocketTransport::~UnixSocketTransport() {
+  MutexLock l(lock_);
+  for (auto& entry : listeners_) {
+    Stop(entry.second.get());
+  }
+}
+
+bool UnixSocketTransport::Handles(const Sockaddr& remote) const {
+  if (remote.IsWildcard() || remote.IsAnyLocalAddress()) {
+    return true;
+  }
+  // 127.0.0.0/8, mapped to IPv6.
+  const struct in6_addr& addr = remote.addr().sin6_addr;
+  return IN6_IS_ADDR_V4MAPPED(&addr) && addr.s6_addr[12] == 127;
+}
+
+string UnixSocketTransport::SocketPath(int port) const {
+  return Substitute("$0/kudu-rpc.$1.sock", socket_dir_, port);
+}
+
+Status UnixSocketTransport::StartConnect(
+    const Sockaddr& remote,
+    unique_ptr<Socket>* socket) {
+  struct sockaddr_un addr;
+  RETURN_NOT_OK(MakeUnixAddress(SocketPath(remote.port()), &addr));
+  int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    int err = errno;
+    return Status::NetworkError(
+        "error opening Unix socket", ErrnoToString(err), err);
+  }
+  unique_ptr<Socket> sock(new UnixSocket(fd, LoopbackAddress(0), remote));
+  int ret;
+  RETRY_ON_EINTR(
+      ret,
+      ::connect(
+          fd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(addr)));
+  // Unix sockets connect right away, or fail with EAGAIN when the server's
+  // backlog is full.
+  if (ret < 0) {
+    int err = errno;
+    return Status::NetworkError(
+        Substitute("could not connect to $0", addr.sun_path),
+        ErrnoToString(err),
+        err);
+  }
+  *socket = std::move(sock);
+  return Status::OK();
+}
+
+Status UnixSocketTransport::Listen(
+    const Sockaddr& address,
+    AcceptedCallback callback) {
+  unique_ptr<Listener> listener(new Listener);
+  listener->path = SocketPath(address.port());
+  listener->local = LoopbackAddress(address.port());
+  listener->callback = std::move(callback);
+  struct sockaddr_un addr;
+  RETURN_NOT_OK(MakeUnixAddress(listener->path, &addr));
+
+  MutexLock l(lock_);
+  if (listeners_.count(address.port())) {
+    return Status::AlreadyPresent("already listening", listener->path);
+  }
+  listener->socket.Reset(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  if (listener->socket.GetFd() < 0) {
+    int err = errno;
+    return Status::NetworkError(
+        "error opening Unix socket", ErrnoToString(err), err);
+  }
+  // A socket left behind by a server which didn't shut down cleanly.
+  if (::unlink(listener->path.c_str()) != 0 && errno != ENOENT) {
+    int err = errno;
+    return Status::IOError(
+        Substitute("could not remove $0", listener->path),
+        ErrnoToString(err),
+        err);
+  }
+  if (::bind(
+          listener->socket.GetFd(),
+          reinterpret_cast<const struct sockaddr*>(&addr),
+          sizeof(addr)) != 0) {
+    int err = errno;
+    return Status::NetworkError(
+        Substitute("error binding Unix socket to $0", listener->path),
+        ErrnoToString(err),
+        err);
+  }
+  Status s = listener->socket.Listen(FLAGS_rpc_acceptor_listen_backlog);
+  if (s.ok()) {
+    s = kudu::Thread::Create(
+        "unix socket transport",
+        "acceptor",
+        &UnixSocketTransport::RunAcceptor,
+        this,
+        listener.get(),
+        &listener->thread);
+  }
+  if (!s.ok()) {
+    ignore_result(::unlink(listener->path.c_str()));
+    return s;
+  }
+  listeners_.emplace(address.port(), std::move(listener));
+  return Status::OK();
+}
+
+void UnixSocketTransport::StopListening(const Sockaddr& address) {
+  unique_ptr<Listener> listener;
+  {
+    MutexLock l(lock_);
+    auto it = listeners_.find(address.port());
+    if (it == listeners_.end()) {
+      return;
+    }
+    listener = std::move(it->second);
+    listeners_.erase(it);
+  }
+  Stop(listener.get());
+}
+
+void UnixSocketTransport::Stop(Listener* listener) {
+  listener->closing = true;
+  // Shutting the socket down breaks the acceptor out of accept().
+  WARN_NOT_OK(
+      listener->socket.Shutdown(true, true),
+      Substitute("could not shut down Unix socket $0", listener->path));
+  CHECK_OK(ThreadJoiner(listener->thread.get()).Join());
+  ignore_result(listener->socket.Close());
+  ignore_result(::unlink(listener->path.c_str()));
+}
+
+void UnixSocketTransport::RunAcceptor(Listener* listener) {
+  while (true) {
+    int fd;
+    RETRY_ON_EINTR(
+        fd,
+        ::accept4(
+            listener->socket.GetFd(),
+            nullptr,
+            nullptr,
+            SOCK_NONBLOCK | SOCK_CLOEXEC));
+    if (fd < 0) {
+      int err = errno;
+      if (listener->closing) {
+        break;
+      }
+      KLOG_EVERY_N_SECS(WARNING, 1)
+          << "accept failed on " << listener->path << ": "
+          << ErrnoToString(err) << THROTTLE_MSG;
+      continue;
+    }
+    // The client has no address: a port of its own spreads the connections
+    // over the reactors.
+    const Sockaddr remote = LoopbackAddress(next_remote_port_++);
+    listener->callback(
+        unique_ptr<Socket>(new UnixSocket(fd, listener->local, remote)),
+        remote);
+  }
+  VLOG(1) << "Unix socket acceptor on " << listener->path << " shutting down";
+}
+
+} // namespace rpc
+} // namespace kudu
@@ -0,0 +1,105 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/rpc/transport.h"
+#include "kudu/util/mutex.h"
+#include "kudu/util/net/sockaddr.h"
+#include "kudu/util/net/socket.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+class Thread;
+
+namespace rpc {
+
+// A transport over Unix domain sockets, for the clients on the same host as
+// the server. The server listens on a socket in 'socket_dir' for each of its
+// acceptor pools, named after the pool's port, and a client connects to it
+// for the loopback and wildcard addresses with that port. A client without
+// access to the socket, or to a server which doesn't listen on one, uses TCP.
+//
+// The connections skip the TCP stack, and their peer credentials
+// authenticate the client: the server checks the user the client claims
+// against that of the client process, which makes the connection
+// authenticated even when Kerberos isn't configured. They are confidential
+// without TLS, which they don't support.
+class UnixSocketTransport : public Transport {
+ public:
+  explicit UnixSocketTransport(std::string socket_dir);
+  ~UnixSocketTransport() override;
+
+  const char* name() const override {
+    return "unix socket";
+  }
+
+  bool Handles(const Sockaddr& remote) const override;
+
+  bool IsLocal() const override {
+    return true;
+  }
+
+  Status StartConnect(const Sockaddr& remote, std::unique_ptr<Socket>* socket)
+      override;
+
+  Status Listen(const Sockaddr& address, AcceptedCallback callback) override;
+
+  void StopListening(const Sockaddr& address) override;
+
+  // The path of the socket for the acceptor pool on 'port'.
+  std::string SocketPath(int port) const;
+
+ private:
+  struct Listener {
+    Socket socket;
+    std::string path;
+    // The loopback address with the acceptor pool's port.
+    Sockaddr local;
+    AcceptedCallback callback;
+    scoped_refptr<Thread> thread;
+    std::atomic<bool> closing{false};
+  };
+
+  void RunAcceptor(Listener* listener);
+
+  // Stops 'listener' and removes its socket.
+  static void Stop(Listener* listener);
+
+  const std::string socket_dir_;
+
+  // Numbers the accepted connections, see RunAcceptor().
+  std::atomic<uint16_t> next_remote_port_{1};
+
+  // Protects 'listeners_'.
+  Mutex lock_;
+  std::map<int, std::unique_ptr<Listener>> listeners_;
+
+  DISALLOW_COPY_AND_ASSIGN(UnixSocketTransport);
+};
+
+} // namespace rpc
+} // namespace kudu
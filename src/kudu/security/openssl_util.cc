@@ -24,11 +24,17 @@
 #include <string>
 #include <vector>
 
+#if defined(__aarch64__) && defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
 #include <glog/logging.h>
 #include <openssl/crypto.h>
 #include <openssl/err.h>
 #include <openssl/rand.h>
 
+#include "kudu/gutil/cpu.h"
 #include "kudu/gutil/strings/split.h"
 #include "kudu/gutil/strings/strip.h"
 #include "kudu/gutil/strings/substitute.h"
@@ -324,6 +330,18 @@ const string& DataFormatToString(DataFormat fmt) {
   }
 }
 
+bool HasHardwareAesGcm() {
+#if defined(__x86_64__) || defined(__i386__)
+  static const base::CPU cpu;
+  return cpu.has_aesni() && cpu.has_pclmulqdq();
+#elif defined(__aarch64__) && defined(__linux__)
+  static const unsigned long hwcap = getauxval(AT_HWCAP);
+  return (hwcap & HWCAP_AES) && (hwcap & HWCAP_PMULL);
+#else
+  return false;
+#endif
+}
+
 Status GetPasswordFromShellCommand(const string& cmd, string* password) {
   vector<string> argv = strings::Split(cmd, " ", strings::SkipEmpty());
   if (argv.empty()) {
@@ -100,6 +100,10 @@ std::string GetOpenSSLErrors();
 // See man(3) SSL_get_error for more discussion.
 std::string GetSSLErrorDescription(int error_code);
 
+// Returns true if the CPU has instructions that accelerate AES-GCM: AES-NI and
+// PCLMULQDQ on x86, the AES and PMULL extensions on ARMv8.
+bool HasHardwareAesGcm();
+
 // Runs the shell command 'cmd' which should give a password to a private key
 // file as the output.
 //
@@ -167,6 +171,10 @@ template <>
 struct SslTypeTraits<SSL_CTX> {
   static constexpr auto kFreeFunc = &SSL_CTX_free;
 };
+template <>
+struct SslTypeTraits<SSL_SESSION> {
+  static constexpr auto kFreeFunc = &SSL_SESSION_free;
+};
 
 template <typename SSL_TYPE, typename Traits = SslTypeTraits<SSL_TYPE>>
 c_unique_ptr<SSL_TYPE> ssl_make_unique(SSL_TYPE* d) {
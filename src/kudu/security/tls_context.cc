@@ -33,6 +33,8 @@
 
 #include "kudu/gutil/basictypes.h"
 #include "kudu/gutil/macros.h"
+#include "kudu/gutil/strings/join.h"
+#include "kudu/gutil/strings/split.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/security/ca/cert_management.h"
 #include "kudu/security/cert.h"
@@ -98,6 +100,40 @@ DEFINE_bool(
     false,
     "Whether to perform normal TLS handshake.");
 
+DEFINE_bool(
+    rpc_tls_session_resumption,
+    false,
+    "Whether outbound RPC connections offer to resume the TLS session of an "
+    "earlier connection to the same peer, and servers keep sessions to be "
+    "resumed. Resumption skips the key exchange and the verification of the "
+    "peer's certificate, which makes reconnecting after leader changes or "
+    "restarts much cheaper.");
+TAG_FLAG(rpc_tls_session_resumption, experimental);
+
+DEFINE_int32(
+    rpc_tls_session_cache_size,
+    1024,
+    "Maximum number of TLS sessions kept for resumption, both by servers for "
+    "their clients and by clients for their peers. See "
+    "--rpc_tls_session_resumption.");
+TAG_FLAG(rpc_tls_session_cache_size, advanced);
+
+DEFINE_int32(
+    rpc_tls_session_timeout_s,
+    3600,
+    "Number of seconds a TLS session may be resumed after it was "
+    "negotiated. See --rpc_tls_session_resumption.");
+TAG_FLAG(rpc_tls_session_timeout_s, advanced);
+
+DEFINE_bool(
+    rpc_tls_prefer_hardware_ciphers,
+    false,
+    "Reorder the --rpc_tls_ciphers for the CPU this runs on: AES-GCM suites "
+    "first if the CPU accelerates AES-GCM, ChaCha20-Poly1305 suites first if "
+    "not. Servers also choose among the client's suites in this order, "
+    "rather than in the client's.");
+TAG_FLAG(rpc_tls_prefer_hardware_ciphers, experimental);
+
 namespace kudu {
 namespace security {
 
@@ -171,6 +207,25 @@ TlsContext::TlsContext(std::string tls_ciphers, std::string tls_min_protocol)
   security::InitializeOpenSSL();
 }
 
+string TlsContext::OrderCiphersForCpu(const string& ciphers, bool hw_aes_gcm) {
+  // Suites that only the other kind of CPU prefers come right after the
+  // preferred ones, ahead of anything else in the list.
+  auto rank = [hw_aes_gcm](const string& suite) {
+    bool gcm = suite.find("GCM") != string::npos;
+    bool chacha = suite.find("CHACHA20") != string::npos;
+    if (gcm || chacha) {
+      return gcm == hw_aes_gcm ? 0 : 1;
+    }
+    return 2;
+  };
+  vector<string> suites = strings::Split(ciphers, ":", strings::SkipEmpty());
+  std::stable_sort(
+      suites.begin(), suites.end(), [&](const string& a, const string& b) {
+        return rank(a) < rank(b);
+      });
+  return JoinStrings(suites, ":");
+}
+
 Status TlsContext::Init() {
   SCOPED_OPENSSL_NO_PENDING_ERRORS;
   CHECK(!ctx_);
@@ -216,10 +271,20 @@ Status TlsContext::Init() {
   // confuses our RPC negotiation protocol. See KUDU-2871.
   options |= SSL_OP_NO_TLSv1_3;
 
+  string ciphers = tls_ciphers_;
+  if (FLAGS_rpc_tls_prefer_hardware_ciphers) {
+    bool hw_aes_gcm = HasHardwareAesGcm();
+    ciphers = OrderCiphersForCpu(tls_ciphers_, hw_aes_gcm);
+    options |= SSL_OP_CIPHER_SERVER_PREFERENCE;
+    VLOG(1) << "TLS ciphers in order for a CPU "
+            << (hw_aes_gcm ? "with" : "without")
+            << " AES-GCM acceleration: " << ciphers;
+  }
+
   SSL_CTX_set_options(ctx_.get(), options);
 
   OPENSSL_RET_NOT_OK(
-      SSL_CTX_set_cipher_list(ctx_.get(), tls_ciphers_.c_str()),
+      SSL_CTX_set_cipher_list(ctx_.get(), ciphers.c_str()),
       "failed to set TLS ciphers");
 
   // Enable ECDH curves. For OpenSSL 1.1.0 and up, this is done automatically.
@@ -242,6 +307,20 @@ Status TlsContext::Init() {
 #endif
 #endif
 
+  // Servers verifying client certificates must name the context their
+  // sessions belong to, or OpenSSL fails the handshakes that try to resume
+  // them.
+  static const unsigned char kSessionIdContext[] = "kudu-rpc";
+  OPENSSL_RET_NOT_OK(
+      SSL_CTX_set_session_id_context(
+          ctx_.get(), kSessionIdContext, sizeof(kSessionIdContext) - 1),
+      "failed to set TLS session id context");
+  if (FLAGS_rpc_tls_session_resumption) {
+    SSL_CTX_set_session_cache_mode(ctx_.get(), SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx_.get(), FLAGS_rpc_tls_session_cache_size);
+    SSL_CTX_set_timeout(ctx_.get(), FLAGS_rpc_tls_session_timeout_s);
+  }
+
   // TODO(KUDU-1926): is it possible to disable client-side renegotiation? it
   // seems there have been various CVEs related to this feature that we don't
   // need.
@@ -751,5 +830,43 @@ Status TlsContext::InitiateHandshake(
   return Status::OK();
 }
 
+void TlsContext::ResumeSession(const string& peer, TlsHandshake* handshake)
+    const {
+  if (!FLAGS_rpc_tls_session_resumption) {
+    return;
+  }
+  SCOPED_OPENSSL_NO_PENDING_ERRORS;
+  std::lock_guard<simple_spinlock> l(session_lock_);
+  auto it = client_sessions_.find(peer);
+  if (it == client_sessions_.end()) {
+    return;
+  }
+  // The handshake takes its own reference. If the server no longer knows the
+  // session, the handshake simply negotiates a new one.
+  if (SSL_set_session(handshake->ssl(), it->second.get()) != 1) {
+    ERR_clear_error();
+    client_sessions_.erase(it);
+  }
+}
+
+void TlsContext::CacheSession(const string& peer, TlsHandshake* handshake)
+    const {
+  if (!FLAGS_rpc_tls_session_resumption || !handshake->session_) {
+    return;
+  }
+  c_unique_ptr<SSL_SESSION> session = std::move(handshake->session_);
+  std::lock_guard<simple_spinlock> l(session_lock_);
+  auto it = client_sessions_.find(peer);
+  if (it != client_sessions_.end()) {
+    it->second = std::move(session);
+    return;
+  }
+  if (client_sessions_.size() >=
+      std::max(FLAGS_rpc_tls_session_cache_size, 1)) {
+    client_sessions_.erase(client_sessions_.begin());
+  }
+  client_sessions_.emplace(peer, std::move(session));
+}
+
 } // namespace security
 } // namespace kudu
@@ -20,6 +20,7 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <boost/optional/optional.hpp>
@@ -79,6 +80,14 @@ class TlsContext {
 
   Status Init() WARN_UNUSED_RESULT;
 
+  // Returns the colon-separated cipher list 'ciphers' reordered to put the
+  // AEAD suites that are fastest on this kind of CPU first: AES-GCM if
+  // 'hw_aes_gcm', ChaCha20-Poly1305 otherwise. Keeps the order of the suites
+  // otherwise. See --rpc_tls_prefer_hardware_ciphers.
+  static std::string OrderCiphersForCpu(
+      const std::string& ciphers,
+      bool hw_aes_gcm);
+
   // Returns true if this TlsContext has been configured with a cert and key for
   // use with TLS-encrypted connections.
   bool has_cert() const {
@@ -233,6 +242,17 @@ class TlsContext {
       TlsHandshakeType handshake_type,
       TlsHandshake* handshake) const WARN_UNUSED_RESULT;
 
+  // Offers the session cached for 'peer' by CacheSession(), if any, for
+  // resumption by the client 'handshake'. Must be called after
+  // InitiateHandshake() and before the handshake starts. Has no effect unless
+  // --rpc_tls_session_resumption is set.
+  void ResumeSession(const std::string& peer, TlsHandshake* handshake) const;
+
+  // Takes the session negotiated by the finished client 'handshake' and keeps
+  // it for later connections to 'peer'. Has no effect unless
+  // --rpc_tls_session_resumption is set.
+  void CacheSession(const std::string& peer, TlsHandshake* handshake) const;
+
   // Return the number of certs that have been marked as trusted.
   // Used by tests.
   int trusted_cert_count_for_tests() const {
@@ -270,6 +290,12 @@ class TlsContext {
 
   bool enable_normal_tls_;
 
+  // Client sessions by peer, for resumption. Kept apart from 'lock_' so that
+  // caching never contends with certificate changes.
+  mutable simple_spinlock session_lock_;
+  mutable std::unordered_map<std::string, c_unique_ptr<SSL_SESSION>>
+      client_sessions_;
+
   // alpn protocols in wire format
   std::vector<unsigned char> server_alpns_;
   bool client_alpns_are_set_{false};
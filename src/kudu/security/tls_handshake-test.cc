@@ -34,6 +34,7 @@
 #include "kudu/security/security-test-util.h"
 #include "kudu/security/tls_context.h"
 #include "kudu/util/monotime.h"
+#include "kudu/util/net/socket.h"
 #include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/status.h"
@@ -44,6 +45,7 @@ using std::string;
 using std::vector;
 
 DECLARE_int32(ipki_server_key_size);
+DECLARE_bool(rpc_tls_session_resumption);
 
 namespace kudu {
 namespace security {
@@ -95,9 +97,14 @@ class TestTlsHandshakeBase : public KuduTest {
   // Run a handshake using 'client_tls_' and 'server_tls_'. The client and
   // server verification modes are set to 'client_verify' and 'server_verify'
   // respectively.
+  //
+  // If 'session_peer' is given, the client resumes the session it cached for
+  // that peer, if any, caches the new one, and sets '*session_reused'.
   Status RunHandshake(
       TlsVerificationMode client_verify,
-      TlsVerificationMode server_verify) {
+      TlsVerificationMode server_verify,
+      const string& session_peer = "",
+      bool* session_reused = nullptr) {
     TlsHandshake client, server;
     RETURN_NOT_OK(
         client_tls_.InitiateHandshake(TlsHandshakeType::CLIENT, &client));
@@ -106,6 +113,9 @@ class TestTlsHandshakeBase : public KuduTest {
 
     client.set_verification_mode(client_verify);
     server.set_verification_mode(server_verify);
+    if (!session_peer.empty()) {
+      client_tls_.ResumeSession(session_peer, &client);
+    }
 
     bool client_done = false, server_done = false;
     string to_client;
@@ -133,6 +143,14 @@ class TestTlsHandshakeBase : public KuduTest {
         }
       }
     }
+    if (!session_peer.empty()) {
+      Socket socket;
+      RETURN_NOT_OK(client.FinishNoWrap(socket));
+      RETURN_NOT_OK(server.FinishNoWrap(socket));
+      client_tls_.CacheSession(session_peer, &client);
+      *session_reused = client.session_reused();
+      CHECK_EQ(*session_reused, server.session_reused());
+    }
     return Status::OK();
   }
 
@@ -149,6 +167,14 @@ class TestTlsHandshake : public TestTlsHandshakeBase,
 class TestTlsHandshakeConcurrent : public TestTlsHandshakeBase,
                                    public ::testing::WithParamInterface<int> {};
 
+class TestTlsSessionResumption : public TestTlsHandshakeBase {
+ public:
+  void SetUp() override {
+    FLAGS_rpc_tls_session_resumption = true;
+    TestTlsHandshakeBase::SetUp();
+  }
+};
+
 // Test concurrently running handshakes while changing the certificates on the
 // TLS context. We parameterize across different numbers of threads, because
 // surprisingly, fewer threads seems to trigger issues more easily in some
@@ -232,10 +258,50 @@ TEST_F(TestTlsHandshake, TestHandshakeSequence) {
   ASSERT_EQ(buf2.size(), 0);
 }
 
+// Tests that a client resumes the session it negotiated with a peer on its
+// next connection to that peer, and only to that peer.
+TEST_F(TestTlsSessionResumption, TestResumeSession) {
+  PrivateKey ca_key;
+  Cert ca_cert;
+  ASSERT_OK(GenerateSelfSignedCAForTests(&ca_key, &ca_cert));
+  ASSERT_OK(
+      ConfigureTlsContext(PkiConfig::SIGNED, ca_cert, ca_key, &client_tls_));
+  ASSERT_OK(
+      ConfigureTlsContext(PkiConfig::SIGNED, ca_cert, ca_key, &server_tls_));
+
+  const auto kVerify = TlsVerificationMode::VERIFY_REMOTE_CERT_AND_HOST;
+  bool reused;
+  ASSERT_OK(RunHandshake(kVerify, kVerify, "peer-a", &reused));
+  ASSERT_FALSE(reused);
+  ASSERT_OK(RunHandshake(kVerify, kVerify, "peer-a", &reused));
+  ASSERT_TRUE(reused);
+  ASSERT_OK(RunHandshake(kVerify, kVerify, "peer-b", &reused));
+  ASSERT_FALSE(reused);
+
+  // Without the flag, nothing is offered.
+  FLAGS_rpc_tls_session_resumption = false;
+  ASSERT_OK(RunHandshake(kVerify, kVerify, "peer-a", &reused));
+  ASSERT_FALSE(reused);
+}
+
 // Tests that the TlsContext can transition from self signed cert to signed
 // cert, and that it rejects invalid certs along the way. We are testing this
 // here instead of in a dedicated TlsContext test because it requires completing
 // handshakes to fully validate.
+TEST(TestTlsContext, TestOrderCiphersForCpu) {
+  const string kCiphers =
+      "ECDHE-RSA-AES256-GCM-SHA384:ECDHE-RSA-CHACHA20-POLY1305:"
+      "AES256-SHA:ECDHE-RSA-AES128-GCM-SHA256";
+  EXPECT_EQ(
+      "ECDHE-RSA-AES256-GCM-SHA384:ECDHE-RSA-AES128-GCM-SHA256:"
+      "ECDHE-RSA-CHACHA20-POLY1305:AES256-SHA",
+      TlsContext::OrderCiphersForCpu(kCiphers, /*hw_aes_gcm=*/true));
+  EXPECT_EQ(
+      "ECDHE-RSA-CHACHA20-POLY1305:ECDHE-RSA-AES256-GCM-SHA384:"
+      "ECDHE-RSA-AES128-GCM-SHA256:AES256-SHA",
+      TlsContext::OrderCiphersForCpu(kCiphers, /*hw_aes_gcm=*/false));
+}
+
 TEST_F(TestTlsHandshake, TestTlsContextCertTransition) {
   ASSERT_FALSE(server_tls_.has_cert());
   ASSERT_FALSE(server_tls_.has_signed_cert());
@@ -114,6 +114,7 @@ Status TlsHandshake::SSLHandshake(
 
   RETURN_NOT_OK(GetCerts());
   RETURN_NOT_OK(Verify(**socket));
+  GetSession();
 
   // Get selected ALPN
   const unsigned char* data{nullptr};
@@ -265,6 +266,7 @@ Status TlsHandshake::Finish(unique_ptr<Socket>* socket) {
   SCOPED_OPENSSL_NO_PENDING_ERRORS;
   RETURN_NOT_OK(GetCerts());
   RETURN_NOT_OK(Verify(**socket));
+  GetSession();
 
   int fd = (*socket)->Release();
 
@@ -284,7 +286,27 @@ Status TlsHandshake::Finish(unique_ptr<Socket>* socket) {
 Status TlsHandshake::FinishNoWrap(const Socket& socket) {
   SCOPED_OPENSSL_NO_PENDING_ERRORS;
   RETURN_NOT_OK(GetCerts());
-  return Verify(socket);
+  RETURN_NOT_OK(Verify(socket));
+  GetSession();
+  return Status::OK();
+}
+
+void TlsHandshake::GetSession() {
+  SCOPED_OPENSSL_NO_PENDING_ERRORS;
+  session_reused_ = SSL_session_reused(ssl_.get());
+  SSL_SESSION* session = SSL_get1_session(ssl_.get());
+  if (!session) {
+    return;
+  }
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+  // TLSv1.3 sessions only become resumable once the server sent a ticket
+  // after the handshake.
+  if (!SSL_SESSION_is_resumable(session)) {
+    SSL_SESSION_free(session);
+    return;
+  }
+#endif
+  session_ = ssl_make_unique(session);
 }
 
 Status TlsHandshake::GetLocalCert(Cert* cert) const {
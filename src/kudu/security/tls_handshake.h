@@ -134,6 +134,14 @@ class TlsHandshake {
   // May only be called after 'Finish' or 'FinishNoWrap'.
   Status GetRemoteCert(Cert* cert) const WARN_UNUSED_RESULT;
 
+  // Returns true if the handshake resumed an earlier TLS session rather than
+  // negotiating a new one.
+  //
+  // May only be called after 'Finish', 'FinishNoWrap' or 'SSLHandshake'.
+  bool session_reused() const {
+    return session_reused_;
+  }
+
   // Retrieve the negotiated cipher suite. Only valid to call after the
   // handshake is complete and before 'Finish()'.
   std::string GetCipherSuite() const;
@@ -170,6 +178,9 @@ class TlsHandshake {
   // Populates local_cert_ and remote_cert_.
   Status GetCerts() WARN_UNUSED_RESULT;
 
+  // Populates session_ and session_reused_.
+  void GetSession();
+
   // Verifies that the handshake is valid for the provided socket.
   Status Verify(const Socket& socket) const WARN_UNUSED_RESULT;
 
@@ -179,6 +190,10 @@ class TlsHandshake {
   Cert local_cert_;
   Cert remote_cert_;
   std::string selected_alpn_;
+
+  // The negotiated session if it may be resumed, until a TlsContext caches it.
+  c_unique_ptr<SSL_SESSION> session_;
+  bool session_reused_ = false;
 };
 
 } // namespace security
@@ -38,6 +38,7 @@
 
 #include "kudu/gutil/macros.h"
 #include "kudu/security/tls_context.h"
+#include "kudu/security/tls_socket.h"
 #include "kudu/util/countdown_latch.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/net/sockaddr.h"
@@ -47,6 +48,7 @@
 #include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/status.h"
+#include "kudu/util/stopwatch.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
 
@@ -72,7 +74,13 @@ class TlsSocketTest : public KuduTest {
   }
 
  protected:
-  void ConnectClient(const Sockaddr& addr, unique_ptr<Socket>* sock);
+  void ConnectClient(const Sockaddr& addr, unique_ptr<Socket>* sock) {
+    ConnectClient(&client_tls_, addr, sock);
+  }
+  void ConnectClient(
+      TlsContext* tls,
+      const Sockaddr& addr,
+      unique_ptr<Socket>* sock);
   TlsContext client_tls_;
 };
 
@@ -114,6 +122,7 @@ Status DoNegotiationSide(Socket* sock, TlsHandshake* tls, const char* side) {
 }
 
 void TlsSocketTest::ConnectClient(
+    TlsContext* tls,
     const Sockaddr& addr,
     unique_ptr<Socket>* sock) {
   unique_ptr<Socket> client_sock(new Socket());
@@ -121,7 +130,7 @@ void TlsSocketTest::ConnectClient(
   ASSERT_OK(client_sock->Connect(addr));
 
   TlsHandshake client;
-  ASSERT_OK(client_tls_.InitiateHandshake(TlsHandshakeType::CLIENT, &client));
+  ASSERT_OK(tls->InitiateHandshake(TlsHandshakeType::CLIENT, &client));
   ASSERT_OK(DoNegotiationSide(client_sock.get(), &client, "client"));
   ASSERT_OK(client.Finish(&client_sock));
   *sock = std::move(client_sock);
@@ -372,5 +381,53 @@ TEST_F(TlsSocketTest, TestNonBlockingWritev) {
   ASSERT_OK(client_sock->Close());
 }
 
+// Measures the echo throughput of each of the default cipher suites, for
+// transfers the size of large consensus batches.
+TEST_F(TlsSocketTest, TestCipherThroughput) {
+  const vector<string> kCiphers = {
+      "ECDHE-RSA-AES128-GCM-SHA256",
+      "ECDHE-RSA-AES256-GCM-SHA384",
+      "ECDHE-RSA-CHACHA20-POLY1305",
+  };
+  const int kRounds = AllowSlowTests() ? 20 : 2;
+  Random rng(GetRandomSeed32());
+  unique_ptr<uint8_t[]> buf(new uint8_t[kEchoChunkSize]);
+  unique_ptr<uint8_t[]> rbuf(new uint8_t[kEchoChunkSize]);
+  RandomString(buf.get(), kEchoChunkSize, &rng);
+
+  LOG(INFO) << "CPU accelerates AES-GCM: " << HasHardwareAesGcm();
+  for (const string& cipher : kCiphers) {
+    TlsContext tls(cipher, "TLSv1.2");
+    ASSERT_OK(tls.Init());
+    EchoServer server;
+    NO_FATALS(server.Start());
+    unique_ptr<Socket> sock;
+    NO_FATALS(ConnectClient(&tls, server.listen_addr(), &sock));
+    auto* tls_sock = dynamic_cast<TlsSocket*>(sock.get());
+    ASSERT_NE(nullptr, tls_sock);
+    ASSERT_EQ(cipher, tls_sock->cipher_suite());
+
+    Stopwatch sw;
+    sw.start();
+    for (int i = 0; i < kRounds; i++) {
+      size_t n;
+      ASSERT_OK(sock->BlockingWrite(
+          buf.get(), kEchoChunkSize, &n, MonoTime::Now() + kTimeout));
+      ASSERT_OK(sock->BlockingRecv(
+          rbuf.get(), kEchoChunkSize, &n, MonoTime::Now() + kTimeout));
+    }
+    sw.stop();
+    ASSERT_EQ(kRounds * kEchoChunkSize, tls_sock->bytes_encrypted());
+    ASSERT_EQ(kRounds * kEchoChunkSize, tls_sock->bytes_decrypted());
+    // Both directions go through both ends' encryption and decryption.
+    double mb = 2.0 * kRounds * kEchoChunkSize / (1024 * 1024);
+    LOG(INFO) << cipher << ": " << mb / sw.elapsed().wall_seconds()
+              << " MB/s";
+
+    server.Stop();
+    ASSERT_OK(sock->Close());
+  }
+}
+
 } // namespace security
 } // namespace kudu
@@ -73,6 +73,7 @@ Status TlsSocket::Write(const uint8_t* buf, int32_t amt, int32_t* nwritten) {
         "failed to write to TLS socket", GetSSLErrorDescription(error_code));
   }
   *nwritten = bytes_written;
+  bytes_encrypted_.fetch_add(bytes_written, std::memory_order_relaxed);
   return Status::OK();
 }
 
@@ -220,9 +221,18 @@ Status TlsSocket::Recv(uint8_t* buf, int32_t amt, int32_t* nread) {
     return Status::NetworkError(kErrString, GetSSLErrorDescription(error_code));
   }
   *nread = bytes_read;
+  bytes_decrypted_.fetch_add(bytes_read, std::memory_order_relaxed);
   return Status::OK();
 }
 
+std::string TlsSocket::cipher_suite() const {
+  return SSL_get_cipher_name(ssl_.get());
+}
+
+Status TlsSocket::EnableZeroCopy() {
+  return Status::NotSupported("zero-copy sends are not supported with TLS");
+}
+
 Status TlsSocket::Close() {
   SCOPED_OPENSSL_NO_PENDING_ERRORS;
   errno = 0;
@@ -17,8 +17,10 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
+#include <string>
 
 #include "kudu/gutil/port.h"
 #include "kudu/security/openssl_util.h" // IWYU pragma: keep
@@ -42,11 +44,25 @@ class TlsSocket : public Socket {
   Status Writev(const struct ::iovec* iov, int iov_len, int64_t* nwritten)
       override WARN_UNUSED_RESULT;
 
+  // Zero-copy sends would bypass the encryption.
+  Status EnableZeroCopy() override WARN_UNUSED_RESULT;
+
   Status Recv(uint8_t* buf, int32_t amt, int32_t* nread) override
       WARN_UNUSED_RESULT;
 
   Status Close() override WARN_UNUSED_RESULT;
 
+  // The name of the negotiated cipher suite.
+  std::string cipher_suite() const;
+
+  // The number of plaintext bytes sent through and received from the socket.
+  int64_t bytes_encrypted() const {
+    return bytes_encrypted_.load(std::memory_order_relaxed);
+  }
+  int64_t bytes_decrypted() const {
+    return bytes_decrypted_.load(std::memory_order_relaxed);
+  }
+
  private:
   friend class TlsHandshake;
 
@@ -57,6 +73,9 @@ class TlsSocket : public Socket {
 
   // Socket-local buffer used by Writev().
   faststring buf_;
+
+  std::atomic<int64_t> bytes_encrypted_{0};
+  std::atomic<int64_t> bytes_decrypted_{0};
 };
 
 } // namespace security
@@ -33,12 +33,18 @@
 #include "kudu/security/token_signer.h"
 #include "kudu/security/token_signing_key.h"
 #include "kudu/security/token_verifier.h"
+#include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/status.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
 
 DECLARE_int32(tsk_num_rsa_bits);
+DECLARE_int32(token_verification_cache_size);
+
+METRIC_DECLARE_entity(server);
+METRIC_DECLARE_counter(token_verification_cache_hits);
+METRIC_DECLARE_counter(token_verification_cache_misses);
 
 using std::make_shared;
 using std::string;
@@ -545,6 +551,61 @@ TEST_F(TokenTest, TestEndToEnd_Valid) {
       verifier.VerifyTokenSignature(signed_token, &token));
 }
 
+TEST_F(TokenTest, TestVerificationCache) {
+  FLAGS_token_verification_cache_size = 1;
+  TokenSigner signer(10, 0);
+  {
+    std::unique_ptr<TokenSigningPrivateKey> key;
+    ASSERT_OK(signer.CheckNeedKey(&key));
+    ASSERT_OK(signer.AddKey(std::move(key)));
+  }
+  MetricRegistry registry;
+  scoped_refptr<MetricEntity> entity =
+      METRIC_ENTITY_server.Instantiate(&registry, "test");
+  TokenVerifier verifier;
+  verifier.InitMetrics(entity);
+  ASSERT_OK(verifier.ImportKeys(signer.verifier().ExportKeys()));
+  auto hits = METRIC_token_verification_cache_hits.Instantiate(entity);
+  auto misses = METRIC_token_verification_cache_misses.Instantiate(entity);
+
+  SignedTokenPB signed_token = MakeUnsignedToken(WallTime_Now() + 600);
+  ASSERT_OK(signer.SignToken(&signed_token));
+  TokenPB token;
+  for (int i = 0; i < 3; i++) {
+    ASSERT_EQ(
+        VerificationResult::VALID,
+        verifier.VerifyTokenSignature(signed_token, &token));
+  }
+  ASSERT_EQ(1, misses->value());
+  ASSERT_EQ(2, hits->value());
+
+  // A cached token with a different signature is verified again.
+  SignedTokenPB tampered = signed_token;
+  tampered.set_signature("xyz");
+  ASSERT_EQ(
+      VerificationResult::INVALID_SIGNATURE,
+      verifier.VerifyTokenSignature(tampered, &token));
+
+  // Verifying another token evicts the first one.
+  SignedTokenPB other_token = MakeUnsignedToken(WallTime_Now() + 900);
+  ASSERT_OK(signer.SignToken(&other_token));
+  ASSERT_EQ(
+      VerificationResult::VALID,
+      verifier.VerifyTokenSignature(other_token, &token));
+  ASSERT_EQ(
+      VerificationResult::VALID,
+      verifier.VerifyTokenSignature(signed_token, &token));
+  ASSERT_EQ(4, misses->value());
+
+  // Importing keys empties the cache.
+  ASSERT_OK(verifier.ImportKeys(signer.verifier().ExportKeys()));
+  ASSERT_EQ(
+      VerificationResult::VALID,
+      verifier.VerifyTokenSignature(signed_token, &token));
+  ASSERT_EQ(5, misses->value());
+  ASSERT_EQ(2, hits->value());
+}
+
 // Test all of the possible cases covered by token verification.
 // See VerificationResult.
 TEST_F(TokenTest, TestEndToEnd_InvalidCases) {
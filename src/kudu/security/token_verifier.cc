@@ -25,16 +25,43 @@
 #include <utility>
 #include <vector>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "kudu/gutil/map-util.h"
+#include "kudu/gutil/strings/substitute.h"
 #include "kudu/gutil/walltime.h"
 #include "kudu/security/token.pb.h"
 #include "kudu/security/token_signing_key.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/logging.h"
+#include "kudu/util/metrics.h"
 #include "kudu/util/status.h"
 
+DEFINE_int32(
+    token_verification_cache_size,
+    0,
+    "Number of recently verified authn tokens whose signatures are not "
+    "verified again when presented again. 0 disables the cache.");
+TAG_FLAG(token_verification_cache_size, experimental);
+TAG_FLAG(token_verification_cache_size, runtime);
+
+METRIC_DEFINE_counter(
+    server,
+    token_verification_cache_hits,
+    "Token Verification Cache Hits",
+    kudu::MetricUnit::kRequests,
+    "Number of authn tokens whose signatures were known to be valid from "
+    "previous verifications.");
+METRIC_DEFINE_counter(
+    server,
+    token_verification_cache_misses,
+    "Token Verification Cache Misses",
+    kudu::MetricUnit::kRequests,
+    "Number of authn token signatures verified while the verification cache "
+    "is enabled.");
+
 using std::lock_guard;
 using std::string;
 using std::transform;
@@ -48,6 +75,11 @@ TokenVerifier::TokenVerifier() {}
 
 TokenVerifier::~TokenVerifier() {}
 
+void TokenVerifier::InitMetrics(const scoped_refptr<MetricEntity>& entity) {
+  cache_hits_ = METRIC_token_verification_cache_hits.Instantiate(entity);
+  cache_misses_ = METRIC_token_verification_cache_misses.Instantiate(entity);
+}
+
 int64_t TokenVerifier::GetMaxKnownKeySequenceNumber() const {
   shared_lock<RWMutex> l(lock_);
   if (keys_by_seq_.empty()) {
@@ -85,6 +117,13 @@ Status TokenVerifier::ImportKeys(const vector<TokenSigningPublicKeyPB>& keys) {
   for (auto&& tsk_ptr : tsks) {
     keys_by_seq_.emplace(tsk_ptr->pb().key_seq_num(), std::move(tsk_ptr));
   }
+  // Keys come in on rotation, and may replace known keys. Don't let tokens
+  // verified with a replaced key outlive it.
+  if (!tsks.empty()) {
+    lock_guard<simple_spinlock> cl(cache_lock_);
+    cache_lru_.clear();
+    cache_index_.clear();
+  }
   return Status::OK();
 }
 
@@ -140,14 +179,59 @@ VerificationResult TokenVerifier::VerifyTokenSignature(
     if (tsk->pb().expire_unix_epoch_seconds() < now) {
       return VerificationResult::EXPIRED_SIGNING_KEY;
     }
+    if (FLAGS_token_verification_cache_size <= 0) {
+      if (!tsk->VerifySignature(signed_token)) {
+        return VerificationResult::INVALID_SIGNATURE;
+      }
+      return VerificationResult::VALID;
+    }
+    string cache_key = strings::Substitute(
+        "$0:$1:$2",
+        signed_token.signing_key_seq_num(),
+        signed_token.signature(),
+        signed_token.token_data());
+    if (IsCachedValid(cache_key)) {
+      if (cache_hits_) {
+        cache_hits_->Increment();
+      }
+      return VerificationResult::VALID;
+    }
+    if (cache_misses_) {
+      cache_misses_->Increment();
+    }
     if (!tsk->VerifySignature(signed_token)) {
       return VerificationResult::INVALID_SIGNATURE;
     }
+    CacheValid(std::move(cache_key));
   }
 
   return VerificationResult::VALID;
 }
 
+bool TokenVerifier::IsCachedValid(const string& cache_key) const {
+  lock_guard<simple_spinlock> l(cache_lock_);
+  auto it = cache_index_.find(cache_key);
+  if (it == cache_index_.end()) {
+    return false;
+  }
+  cache_lru_.splice(cache_lru_.begin(), cache_lru_, it->second);
+  return true;
+}
+
+void TokenVerifier::CacheValid(string cache_key) const {
+  lock_guard<simple_spinlock> l(cache_lock_);
+  if (ContainsKey(cache_index_, cache_key)) {
+    return;
+  }
+  cache_lru_.push_front(std::move(cache_key));
+  cache_index_.emplace(cache_lru_.front(), cache_lru_.begin());
+  while (cache_lru_.size() >
+         static_cast<size_t>(FLAGS_token_verification_cache_size)) {
+    cache_index_.erase(cache_lru_.back());
+    cache_lru_.pop_back();
+  }
+}
+
 const char* VerificationResultToString(VerificationResult r) {
   switch (r) {
     case security::VerificationResult::VALID:
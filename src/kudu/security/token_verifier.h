@@ -17,16 +17,23 @@
 #pragma once
 
 #include <cstdint>
+#include <list>
 #include <map>
 #include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/port.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/locks.h"
 #include "kudu/util/rw_mutex.h"
 
 namespace kudu {
 
+class Counter;
+class MetricEntity;
 class Status;
 
 namespace security {
@@ -59,12 +66,22 @@ enum class VerificationResult;
 // slow leak is not worrisome. If this class is adopted for any use cases
 // with frequent rotation, GC of expired tokens will need to be added.
 //
+// Verifying a signature is costly, and clients present the same authn token
+// on every connection they negotiate. The verifier therefore remembers the
+// last --token_verification_cache_size tokens whose signatures it verified.
+// Only the signature check is skipped for those: expiration is checked every
+// time.
+//
 // This class is thread-safe.
 class TokenVerifier {
  public:
   TokenVerifier();
   ~TokenVerifier();
 
+  // Registers the hit and miss counters of the verification cache with
+  // 'entity'. Must be called before the verifier is used, if at all.
+  void InitMetrics(const scoped_refptr<MetricEntity>& entity);
+
   // Return the highest key sequence number known by this instance.
   //
   // If no keys are known, return -1.
@@ -93,10 +110,27 @@ class TokenVerifier {
  private:
   typedef std::map<int64_t, std::unique_ptr<TokenSigningPublicKey>> KeysMap;
 
+  // Whether the signature of 'signed_token' is known to be valid.
+  bool IsCachedValid(const std::string& cache_key) const;
+
+  // Remembers that the signature of the token was found valid.
+  void CacheValid(std::string cache_key) const;
+
   // Lock protecting keys_by_seq_
   mutable RWMutex lock_;
   KeysMap keys_by_seq_;
 
+  // The most recently verified tokens, most recent first, and an index into
+  // that list. Tokens are keyed by their key sequence number, signature and
+  // data. Protected by 'cache_lock_'.
+  mutable simple_spinlock cache_lock_;
+  mutable std::list<std::string> cache_lru_;
+  mutable std::unordered_map<std::string, std::list<std::string>::iterator>
+      cache_index_;
+
+  scoped_refptr<Counter> cache_hits_;
+  scoped_refptr<Counter> cache_misses_;
+
   DISALLOW_COPY_AND_ASSIGN(TokenVerifier);
 };
 
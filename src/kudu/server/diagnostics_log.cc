@@ -23,6 +23,7 @@
 #include <ostream>
 #include <queue>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -30,15 +31,19 @@
 #include <glog/logging.h>
 #include <sparsehash/dense_hash_set>
 
+#include "kudu/gutil/casts.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/strings/escaping.h"
 #include "kudu/gutil/stringprintf.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/gutil/walltime.h"
 #include "kudu/util/array_view.h"
+#include "kudu/util/coding.h"
 #include "kudu/util/condition_variable.h"
 #include "kudu/util/debug-util.h"
 #include "kudu/util/env.h"
+#include "kudu/util/faststring.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/jsonwriter.h"
 #include "kudu/util/logging.h"
@@ -49,6 +54,7 @@
 #include "kudu/util/random_util.h"
 #include "kudu/util/rolling_log.h"
 #include "kudu/util/scoped_cleanup.h"
+#include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 #include "kudu/util/thread.h"
 
@@ -85,6 +91,16 @@ DEFINE_int32(
 TAG_FLAG(diagnostics_log_stack_traces_interval_ms, runtime);
 TAG_FLAG(diagnostics_log_stack_traces_interval_ms, experimental);
 
+DEFINE_int32(
+    diagnostics_log_metrics_keyframe_interval,
+    60,
+    "The metrics are written to the diagnostics log as a full JSON keyframe "
+    "every this many records, and as binary deltas of the metrics which "
+    "changed in between. If this is set to 1 or less, every record is a "
+    "keyframe.");
+TAG_FLAG(diagnostics_log_metrics_keyframe_interval, runtime);
+TAG_FLAG(diagnostics_log_metrics_keyframe_interval, experimental);
+
 namespace kudu {
 namespace server {
 
@@ -115,11 +131,94 @@ class DiagnosticsLog::SymbolSet {
   google::dense_hash_set<void*> set_;
 };
 
+// Encodes the values of the 'metrics_delta' records, see the header. The
+// values of each key are encoded as differences with the previous ones, and
+// left out when they did not change.
+class DiagnosticsLog::MetricsDeltaEncoder {
+ public:
+  // Forgets about the keys and values encoded so far, when a keyframe is
+  // written.
+  void Reset() {
+    ids_.clear();
+    last_values_.clear();
+  }
+
+  // Appends to 'dst' the values of 'metrics' which changed since they were
+  // last encoded.
+  void Encode(
+      const vector<MetricRegistry::EntityMetric>& metrics,
+      faststring* dst) {
+    faststring new_keys;
+    faststring values;
+    uint32_t num_new_keys = 0;
+    uint32_t num_values = 0;
+    vector<MetricValue> metric_values;
+    string key;
+    for (const MetricRegistry::EntityMetric& em : metrics) {
+      metric_values.clear();
+      em.metric->AppendValues(&metric_values);
+      for (const MetricValue& v : metric_values) {
+        const char* entity_type = em.entity->prototype()->name();
+        const char* name = em.metric->prototype()->name();
+        key.assign(entity_type).push_back('\0');
+        key.append(em.entity->id()).push_back('\0');
+        key.append(name).push_back('\0');
+        key.append(v.field);
+        const uint32_t* id = FindOrNull(ids_, key);
+        if (!id) {
+          id = &(ids_[key] = last_values_.size());
+          last_values_.push_back(
+              v.is_double ? MetricValue::Double(v.field, 0)
+                          : MetricValue::Int(v.field, 0));
+          PutLengthPrefixedSlice(&new_keys, entity_type);
+          PutLengthPrefixedSlice(&new_keys, em.entity->id());
+          PutLengthPrefixedSlice(&new_keys, name);
+          PutLengthPrefixedSlice(&new_keys, v.field);
+          new_keys.push_back(v.is_double ? 1 : 0);
+          num_new_keys++;
+        } else if (
+            v.is_double ? v.double_value == last_values_[*id].double_value
+                        : v.int_value == last_values_[*id].int_value) {
+          continue;
+        }
+        MetricValue* last = &last_values_[*id];
+        PutVarint32(&values, *id);
+        if (last->is_double) {
+          PutFixed64(&values, bit_cast<uint64_t>(v.double_value));
+          last->double_value = v.double_value;
+        } else {
+          // Computed unsigned, so that wrapping around is well defined.
+          int64_t diff = static_cast<int64_t>(
+              static_cast<uint64_t>(v.int_value) -
+              static_cast<uint64_t>(last->int_value));
+          PutVarint64(
+              &values,
+              (static_cast<uint64_t>(diff) << 1) ^
+                  static_cast<uint64_t>(diff >> 63));
+          last->int_value = v.int_value;
+        }
+        num_values++;
+      }
+    }
+    PutVarint32(dst, num_new_keys);
+    dst->append(new_keys.data(), new_keys.size());
+    PutVarint32(dst, num_values);
+    dst->append(values.data(), values.size());
+  }
+
+ private:
+  // The number of each key encoded since the last keyframe, and the last
+  // value encoded for it.
+  std::unordered_map<string, uint32_t> ids_;
+  vector<MetricValue> last_values_;
+};
+
 DiagnosticsLog::DiagnosticsLog(string log_dir, MetricRegistry* metric_registry)
     : log_dir_(std::move(log_dir)),
       metric_registry_(metric_registry),
       wake_(&lock_),
       metrics_log_interval_(MonoDelta::FromSeconds(60)),
+      deltas_(new MetricsDeltaEncoder()),
       symbols_(new SymbolSet()) {}
 DiagnosticsLog::~DiagnosticsLog() {
   Stop();
@@ -342,6 +441,48 @@ Status DiagnosticsLog::LogStacks(const string& reason) {
 #endif
 
 Status DiagnosticsLog::LogMetrics() {
+  MicrosecondsInt64 now = GetCurrentTimeMicros();
+  // Each log file must be decodable on its own, so it starts with a keyframe.
+  if (metrics_deltas_until_keyframe_ > 0 &&
+      metrics_keyframe_roll_count_ == log_->roll_count()) {
+    Status s = LogMetricsDelta(now);
+    if (PREDICT_TRUE(s.ok())) {
+      metrics_deltas_until_keyframe_--;
+    } else {
+      // The encoder may be ahead of what was written: start anew.
+      metrics_deltas_until_keyframe_ = 0;
+    }
+    return s;
+  }
+  metrics_keyframe_roll_count_ = log_->roll_count();
+  RETURN_NOT_OK(LogMetricsKeyframe(now));
+  deltas_->Reset();
+  metrics_deltas_until_keyframe_ =
+      FLAGS_diagnostics_log_metrics_keyframe_interval - 1;
+  return Status::OK();
+}
+
+Status DiagnosticsLog::LogMetricsDelta(int64_t now) {
+  int64_t this_log_epoch = Metric::current_epoch();
+  Metric::IncrementEpoch();
+  vector<MetricRegistry::EntityMetric> metrics;
+  metric_registry_->CollectMetrics(metrics_epoch_, &metrics);
+  faststring delta;
+  deltas_->Encode(metrics, &delta);
+  metrics.clear();
+
+  string encoded;
+  strings::Base64Escape(
+      delta.data(), delta.size(), &encoded, /*do_padding=*/false);
+  std::ostringstream buf;
+  buf << "I" << FormatTimestampForLog(now) << " metrics_delta " << now << " "
+      << encoded << "\n";
+  RETURN_NOT_OK(log_->Append(buf.str()));
+  metrics_epoch_ = this_log_epoch + 1;
+  return Status::OK();
+}
+
+Status DiagnosticsLog::LogMetricsKeyframe(int64_t now) {
   MetricJsonOptions opts;
   opts.include_raw_histograms = false;
 
@@ -359,7 +500,6 @@ Status DiagnosticsLog::LogMetrics() {
       FLAGS_diagnostics_thread_refresh_histogram_stats;
 
   std::ostringstream buf;
-  MicrosecondsInt64 now = GetCurrentTimeMicros();
   buf << "I" << FormatTimestampForLog(now) << " metrics " << now << " ";
 
   // Collect the metrics JSON string.
@@ -37,6 +37,28 @@ class Status;
 
 namespace server {
 
+// Writes the metrics, and the stacks, of the server to a rolling log.
+//
+// The metrics are written in two kinds of records:
+//
+//   I0220 17:38:09.950546 metrics 1519177089950546 <JSON>
+//   I0220 17:38:10.950546 metrics_delta 1519177090950546 <base64>
+//
+// A 'metrics' keyframe holds the JSON of all the touched metrics. It starts
+// every log file, and is written again every
+// --diagnostics_log_metrics_keyframe_interval records. The 'metrics_delta'
+// records in between hold the values of the metrics which changed since the
+// previous record, in binary:
+//
+//   - a varint32 number of new keys then, for each one, its entity type,
+//     entity id, metric name and field (see MetricValue) as varint
+//     length-prefixed strings, followed by a byte set to 1 if its values are
+//     doubles. The keys are numbered in the order they are defined, from 0
+//     after each keyframe.
+//   - a varint32 number of values then, for each one, the varint32 number of
+//     its key followed, for integers, by the zigzag-encoded varint64
+//     difference with its value in the previous delta (0 if it is new) or,
+//     for doubles, by the fixed64 bits of the value.
 class DiagnosticsLog {
  public:
   DiagnosticsLog(std::string log_dir, MetricRegistry* metric_registry);
@@ -57,12 +79,15 @@ class DiagnosticsLog {
 #endif
 
  private:
+  class MetricsDeltaEncoder;
   class SymbolSet;
 
   enum class WakeupType { METRICS, STACKS };
 
   void RunThread();
   Status LogMetrics();
+  Status LogMetricsKeyframe(int64_t now);
+  Status LogMetricsDelta(int64_t now);
 #ifdef FB_DO_NOT_REMOVE
   Status LogStacks(const std::string& reason);
 #endif
@@ -90,7 +115,13 @@ class DiagnosticsLog {
 
   int64_t metrics_epoch_ = 0;
 
+  // How many 'metrics_delta' records may still be written before the next
+  // keyframe, and the roll count of the log as of the last keyframe.
+  int metrics_deltas_until_keyframe_ = 0;
+  int metrics_keyframe_roll_count_ = -1;
+
   // Out-of-line this internal data to keep the header smaller.
+  std::unique_ptr<MetricsDeltaEncoder> deltas_;
   std::unique_ptr<SymbolSet> symbols_;
 
   DISALLOW_COPY_AND_ASSIGN(DiagnosticsLog);
@@ -0,0 +1,202 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/server/metrics_pusher.h"
+
+#include <sys/socket.h>
+
+#include <cstdint>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/errno.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/logging.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/net/net_util.h"
+#include "kudu/util/net/sockaddr.h"
+#include "kudu/util/status.h"
+#include "kudu/util/thread.h"
+
+using std::string;
+using std::vector;
+using strings::Substitute;
+
+DEFINE_string(
+    metrics_push_address,
+    "",
+    "The host:port of a collector to push the metrics of the server to, over "
+    "UDP, in the Prometheus text format. Only the metrics changed since the "
+    "previous push are sent. If empty, metrics aren't pushed.");
+TAG_FLAG(metrics_push_address, advanced);
+
+DEFINE_int32(
+    metrics_push_interval_ms,
+    10000,
+    "How often to push the changed metrics to --metrics_push_address, in "
+    "milliseconds.");
+DEFINE_validator(
+    metrics_push_interval_ms,
+    [](const char* /*n*/, int32_t v) { return v > 0; });
+TAG_FLAG(metrics_push_interval_ms, advanced);
+TAG_FLAG(metrics_push_interval_ms, runtime);
+
+DEFINE_int32(
+    metrics_push_full_every,
+    30,
+    "Every this many pushes to --metrics_push_address, all the metrics are "
+    "pushed rather than only the changed ones, so that a collector which lost "
+    "datagrams catches up.");
+DEFINE_validator(
+    metrics_push_full_every,
+    [](const char* /*n*/, int32_t v) { return v > 0; });
+TAG_FLAG(metrics_push_full_every, advanced);
+TAG_FLAG(metrics_push_full_every, runtime);
+
+DEFINE_int32(
+    metrics_push_max_datagram_bytes,
+    1400,
+    "The largest datagram to push metrics to --metrics_push_address with. "
+    "Metrics are split at line boundaries; a single longer line is sent on "
+    "its own.");
+DEFINE_validator(
+    metrics_push_max_datagram_bytes,
+    [](const char* /*n*/, int32_t v) { return v > 0 && v <= 65507; });
+TAG_FLAG(metrics_push_max_datagram_bytes, advanced);
+TAG_FLAG(metrics_push_max_datagram_bytes, runtime);
+
+namespace kudu {
+namespace server {
+
+MetricsPusher::MetricsPusher(const MetricRegistry* metric_registry)
+    : metric_registry_(metric_registry), wake_(&lock_) {}
+
+MetricsPusher::~MetricsPusher() {
+  Stop();
+}
+
+Status MetricsPusher::Start() {
+  HostPort hp;
+  RETURN_NOT_OK_PREPEND(
+      hp.ParseString(FLAGS_metrics_push_address, 0),
+      "invalid --metrics_push_address");
+  vector<Sockaddr> addrs;
+  RETURN_NOT_OK_PREPEND(
+      hp.ResolveAddresses(&addrs),
+      Substitute("unable to resolve $0", FLAGS_metrics_push_address));
+  if (addrs.empty()) {
+    return Status::NetworkError(
+        "no address for --metrics_push_address", FLAGS_metrics_push_address);
+  }
+
+  socket_.Reset(::socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0));
+  if (socket_.GetFd() < 0) {
+    int err = errno;
+    return Status::NetworkError(
+        "error opening socket", ErrnoToString(err), err);
+  }
+  // Connecting a UDP socket only sets where its datagrams go.
+  RETURN_NOT_OK_PREPEND(
+      socket_.Connect(addrs[0]),
+      Substitute("unable to push metrics to $0", addrs[0].ToString()));
+
+  return Thread::Create(
+      "server", "metrics-pusher", &MetricsPusher::RunThread, this, &thread_);
+}
+
+void MetricsPusher::Stop() {
+  if (!thread_) {
+    return;
+  }
+  {
+    MutexLock l(lock_);
+    stop_ = true;
+    wake_.Signal();
+  }
+  thread_->Join();
+  thread_.reset();
+  stop_ = false;
+  WARN_NOT_OK(socket_.Close(), "Unable to close metrics push socket");
+}
+
+void MetricsPusher::RunThread() {
+  MutexLock l(lock_);
+  int64_t num_pushes = 0;
+  while (!stop_) {
+    wake_.WaitFor(MonoDelta::FromMilliseconds(FLAGS_metrics_push_interval_ms));
+    if (stop_) {
+      break;
+    }
+    bool full = num_pushes++ % FLAGS_metrics_push_full_every == 0;
+    Status s = PushMetrics(full);
+    if (!s.ok()) {
+      KLOG_EVERY_N_SECS(WARNING, 60)
+          << "Unable to push metrics: " << s.ToString();
+    }
+  }
+}
+
+Status MetricsPusher::PushMetrics(bool full) {
+  MetricPrometheusOptions opts;
+  opts.only_modified_in_or_after_epoch = full ? 0 : metrics_epoch_;
+  opts.include_untouched_metrics = false;
+  opts.include_metadata = false;
+
+  int64_t this_push_epoch = Metric::current_epoch();
+  Metric::IncrementEpoch();
+  std::ostringstream out;
+  RETURN_NOT_OK(metric_registry_->WriteAsPrometheus(&out, opts));
+  RETURN_NOT_OK(SendLines(out.str()));
+
+  // As in DiagnosticsLog::LogMetrics(), only skip the changes pushed once
+  // they were sent.
+  metrics_epoch_ = this_push_epoch + 1;
+  return Status::OK();
+}
+
+Status MetricsPusher::SendLines(const string& text) {
+  const size_t max_bytes = FLAGS_metrics_push_max_datagram_bytes;
+  size_t start = 0;
+  while (start < text.size()) {
+    // Take as many whole lines as fit, or a single line if it doesn't.
+    size_t end = start;
+    while (end < text.size()) {
+      size_t eol = text.find('\n', end);
+      size_t next = eol == string::npos ? text.size() : eol + 1;
+      if (next - start > max_bytes && end > start) {
+        break;
+      }
+      end = next;
+    }
+    int32_t nwritten;
+    RETURN_NOT_OK(socket_.Write(
+        reinterpret_cast<const uint8_t*>(text.data() + start),
+        end - start,
+        &nwritten));
+    start = end;
+  }
+  return Status::OK();
+}
+
+} // namespace server
+} // namespace kudu
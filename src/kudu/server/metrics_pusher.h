@@ -0,0 +1,84 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/condition_variable.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/mutex.h"
+#include "kudu/util/net/socket.h"
+
+namespace kudu {
+
+class MetricRegistry;
+class Status;
+class Thread;
+
+namespace server {
+
+// Periodically pushes the metrics of a server in the Prometheus text format,
+// over UDP, to a collector at --metrics_push_address.
+//
+// Only the metrics changed since the previous push are sent, and only their
+// samples, without the '# HELP' and '# TYPE' lines. The lines are packed into
+// datagrams of at most --metrics_push_max_datagram_bytes, each line being a
+// self-contained sample, so that a lost datagram only loses what it carried.
+// Every --metrics_push_full_every pushes, all the metrics are sent, for the
+// collector to catch up on what it lost.
+class MetricsPusher {
+ public:
+  explicit MetricsPusher(const MetricRegistry* metric_registry);
+  ~MetricsPusher();
+
+  // Resolves --metrics_push_address and starts pushing.
+  Status Start();
+  void Stop();
+
+ private:
+  void RunThread();
+
+  // Pushes the metrics changed since the previous push, or all of them if
+  // 'full' is true.
+  Status PushMetrics(bool full);
+
+  // Sends 'text', split at line boundaries into datagrams.
+  Status SendLines(const std::string& text);
+
+  const MetricRegistry* metric_registry_;
+
+  Socket socket_;
+
+  scoped_refptr<Thread> thread_;
+
+  Mutex lock_;
+  ConditionVariable wake_;
+  bool stop_ = false;
+
+  // The epoch from which metrics are considered changed since the last
+  // push. Only accessed by the pushing thread.
+  int64_t metrics_epoch_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(MetricsPusher);
+};
+
+} // namespace server
+} // namespace kudu
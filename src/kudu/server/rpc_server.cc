@@ -79,6 +79,16 @@ DEFINE_int32(
     "Number of RPC worker threads to run");
 TAG_FLAG(rpc_num_service_threads, advanced);
 
+DEFINE_int32(
+    rpc_max_service_threads,
+    0,
+    "If greater than --rpc_num_service_threads, the number of RPC worker "
+    "threads each service may grow to while its calls wait in the queue for "
+    "longer than --rpc_service_queue_time_target_us. The added threads exit "
+    "again when idle. If not, services run --rpc_num_service_threads "
+    "threads.");
+TAG_FLAG(rpc_max_service_threads, experimental);
+
 DEFINE_int32(
     rpc_service_queue_length,
     50,
@@ -105,6 +115,7 @@ RpcServerOptions::RpcServerOptions()
       rpc_advertised_addresses(FLAGS_rpc_advertised_addresses),
       num_acceptors_per_address(FLAGS_rpc_num_acceptors_per_address),
       num_service_threads(FLAGS_rpc_num_service_threads),
+      max_service_threads(FLAGS_rpc_max_service_threads),
       default_port(0),
       service_queue_length(FLAGS_rpc_service_queue_length),
       rpc_reuseport(FLAGS_rpc_reuseport) {}
@@ -171,6 +182,7 @@ Status RpcServer::RegisterService(gscoped_ptr<rpc::ServiceIf> service) {
       std::move(service),
       messenger_->metric_entity(),
       options_.service_queue_length);
+  service_pool->set_max_threads(options_.max_service_threads);
   RETURN_NOT_OK(service_pool->Init(options_.num_service_threads));
   auto* service_pool_raw_ptr = service_pool.get();
   service_pool->set_too_busy_hook([this, service_pool_raw_ptr]() {
@@ -19,6 +19,7 @@
 
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <type_traits>
@@ -51,6 +52,7 @@
 #include "kudu/rpc/rpc_context.h"
 #include "kudu/rpc/service_if.h"
 #include "kudu/rpc/service_pool.h"
+#include "kudu/rpc/unix_socket_transport.h"
 #include "kudu/security/init.h"
 #ifdef FB_DO_NOT_REMOVE
 #include "kudu/security/security_flags.h" // @manual
@@ -61,6 +63,7 @@
 #include "kudu/server/generic_service.h" // @manual
 #endif
 #include "kudu/server/glog_metrics.h"
+#include "kudu/server/metrics_pusher.h"
 #include "kudu/server/rpc_server.h"
 #ifdef FB_DO_NOT_REMOVE
 #include "kudu/server/rpcz-path-handler.h" // @manual
@@ -85,6 +88,7 @@
 #include "kudu/util/monotime.h"
 #include "kudu/util/net/net_util.h"
 #include "kudu/util/net/sockaddr.h"
+#include "kudu/util/os-util.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/spinlock_profiling.h"
@@ -212,6 +216,33 @@ DEFINE_string(
     "'TLSv1.2'.");
 TAG_FLAG(rpc_tls_min_protocol, advanced);
 
+DEFINE_string(
+    rpc_reactor_backend,
+    "auto",
+    "The event loop backend of the RPC reactor threads. Must be one of "
+    "'auto', 'epoll' or 'io_uring'. 'io_uring' falls back to 'auto' if "
+    "libev or the kernel lacks support for it.");
+TAG_FLAG(rpc_reactor_backend, experimental);
+
+DEFINE_int32(
+    rpc_reactor_timer_wheel_tick_ms,
+    0,
+    "If positive, the RPC reactor threads keep the timeouts of outbound calls "
+    "and their delayed tasks, like the Raft heartbeat and failure detection "
+    "timers, on a timing wheel of this granularity rather than on a libev "
+    "timer each. Timers may then fire up to this much late. 0 disables it.");
+TAG_FLAG(rpc_reactor_timer_wheel_tick_ms, experimental);
+
+DEFINE_string(
+    rpc_unix_socket_dir,
+    "",
+    "If set, the server also accepts RPC connections over Unix domain sockets "
+    "in this directory, one named kudu-rpc.<port>.sock for each RPC port, "
+    "and connects to the local servers' sockets in it. The clients on the "
+    "same host skip the TCP stack, and are authenticated by their peer "
+    "credentials.");
+TAG_FLAG(rpc_unix_socket_dir, experimental);
+
 DECLARE_string(rpc_certificate_file);
 DECLARE_string(rpc_private_key_file);
 DECLARE_string(rpc_ca_certificate_file);
@@ -226,6 +257,7 @@ DEFINE_int32(
 TAG_FLAG(rpc_default_keepalive_time_ms, advanced);
 
 DECLARE_bool(use_hybrid_clock);
+DECLARE_string(metrics_push_address);
 
 using kudu::security::RpcAuthentication;
 using kudu::security::RpcEncryption;
@@ -403,8 +435,10 @@ ServerBase::ServerBase(
   FsManagerOpts fs_opts;
   fs_opts.metric_entity = metric_entity_;
   fs_opts.parent_mem_tracker = mem_tracker_;
+  fs_opts.metric_registry = metric_registry_.get();
   fs_opts.block_manager_type = options.fs_opts.block_manager_type;
   fs_opts.wal_root = options.fs_opts.wal_root;
+  fs_opts.extra_wal_roots = options.fs_opts.extra_wal_roots;
   fs_opts.data_roots = options.fs_opts.data_roots;
   fs_opts.allow_non_empty_root = options.fs_opts.allow_non_empty_root;
   fs_manager_.reset(new FsManager(options.env, std::move(fs_opts)));
@@ -540,6 +574,7 @@ Status ServerBase::Init() {
       .set_epki_certificate_authority_file(FLAGS_rpc_ca_certificate_file)
       .set_epki_private_password_key_cmd(FLAGS_rpc_private_key_password_cmd)
       .set_keytab_file(FLAGS_keytab_file)
+      .set_reactor_backend(FLAGS_rpc_reactor_backend)
       .enable_inbound_tls();
 
   if (options_.rpc_opts.rpc_reuseport) {
@@ -555,6 +590,18 @@ Status ServerBase::Init() {
   builder.set_send_buf(options_.rpc_opts.send_buffer_size);
   builder.set_receive_buf(options_.rpc_opts.receive_buffer_size);
 
+  vector<int> reactor_cpus;
+  RETURN_NOT_OK(InitThreadPlacement(&reactor_cpus));
+  builder.set_reactor_cpus(std::move(reactor_cpus));
+  if (FLAGS_rpc_reactor_timer_wheel_tick_ms > 0) {
+    builder.set_timer_wheel_tick(
+        MonoDelta::FromMilliseconds(FLAGS_rpc_reactor_timer_wheel_tick_ms));
+  }
+  if (!FLAGS_rpc_unix_socket_dir.empty()) {
+    builder.set_transport(
+        std::make_shared<rpc::UnixSocketTransport>(FLAGS_rpc_unix_socket_dir));
+  }
+
   RETURN_NOT_OK(builder.Build(&messenger_));
   rpc_server_->set_too_busy_hook(std::bind(
       &ServerBase::ServiceQueueOverflowed, this, std::placeholders::_1));
@@ -568,6 +615,7 @@ Status ServerBase::Init() {
 
   RETURN_NOT_OK_PREPEND(
       StartMetricsLogging(), "Could not enable metrics logging");
+  RETURN_NOT_OK_PREPEND(StartMetricsPush(), "Could not enable metrics push");
 
   result_tracker_->StartGCThread();
   RETURN_NOT_OK(StartExcessLogFileDeleterThread());
@@ -611,6 +659,38 @@ Status ServerBase::InitAcls() {
   return Status::OK();
 }
 
+Status ServerBase::InitThreadPlacement(vector<int>* reactor_cpus) {
+  RETURN_NOT_OK_PREPEND(
+      ParseCpuList(options_.reactor_cpus, reactor_cpus),
+      "could not parse --rpc_reactor_cpus flag");
+
+  if (options_.numa_network_interface.empty()) {
+    return Status::OK();
+  }
+  int node;
+  RETURN_NOT_OK_PREPEND(
+      GetNetworkInterfaceNumaNode(options_.numa_network_interface, &node),
+      "could not determine the NUMA node of --server_numa_network_interface");
+  if (node < 0) {
+    LOG(WARNING) << "Network interface " << options_.numa_network_interface
+                 << " is not attached to a NUMA node; not placing threads";
+    return Status::OK();
+  }
+  RETURN_NOT_OK_PREPEND(
+      GetNumaNodeCpus(node, &numa_local_cpus_),
+      Substitute("could not list the CPUs of NUMA node $0", node));
+  LOG(INFO) << "Placing service threads on the CPUs of NUMA node " << node
+            << " (" << options_.numa_network_interface
+            << "): " << CpuListToString(numa_local_cpus_);
+
+  // Service pool threads pick up the category affinity as they start.
+  RETURN_NOT_OK(GlobalChangeThreadAffinity("service pool", numa_local_cpus_));
+  if (reactor_cpus->empty()) {
+    *reactor_cpus = numa_local_cpus_;
+  }
+  return Status::OK();
+}
+
 Status ServerBase::GetStatusPB(ServerStatusPB* status) const {
   // Node instance
   status->mutable_node_instance()->CopyFrom(*instance_pb_);
@@ -734,6 +814,16 @@ Status ServerBase::StartMetricsLogging() {
   return Status::OK();
 }
 
+Status ServerBase::StartMetricsPush() {
+  if (FLAGS_metrics_push_address.empty()) {
+    return Status::OK();
+  }
+  unique_ptr<MetricsPusher> pusher(new MetricsPusher(metric_registry_.get()));
+  RETURN_NOT_OK(pusher->Start());
+  metrics_pusher_ = std::move(pusher);
+  return Status::OK();
+}
+
 Status ServerBase::StartExcessLogFileDeleterThread() {
   // Try synchronously deleting excess log files once at startup to make sure it
   // works, then start a background thread to continue deleting them in the
@@ -834,6 +924,9 @@ void ServerBase::Shutdown() {
   if (diag_log_) {
     diag_log_->Stop();
   }
+  if (metrics_pusher_) {
+    metrics_pusher_->Stop();
+  }
 
   if (excess_log_deleter_thread_) {
     excess_log_deleter_thread_->Join();
@@ -20,6 +20,7 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/gutil/macros.h"
@@ -66,6 +67,7 @@ class TokenVerifier;
 
 namespace server {
 class DiagnosticsLog;
+class MetricsPusher;
 class ServerStatusPB;
 
 // Base class for tablet server and master.
@@ -220,13 +222,23 @@ class ServerBase {
   // The ACL of users who may act as part of the Kudu service.
   security::SimpleAcl service_acl_;
 
+  // The CPUs of the NUMA node of --server_numa_network_interface, or empty
+  // if threads are not placed on a NUMA node.
+  std::vector<int> numa_local_cpus_;
+
  private:
   Status InitAcls();
+
+  // Resolves the thread placement options, confining the service threads to
+  // 'numa_local_cpus_' and choosing the CPUs of the reactors in
+  // 'reactor_cpus'.
+  Status InitThreadPlacement(std::vector<int>* reactor_cpus);
   void GenerateInstanceID();
   Status DumpServerInfo(const std::string& path, const std::string& format)
       const;
   Status StartMetricsLogging();
   void MetricsLoggingThread();
+  Status StartMetricsPush();
 
 #ifdef FB_DO_NOT_REMOVE
   std::string FooterHtml() const;
@@ -242,6 +254,7 @@ class ServerBase {
   ServerBaseOptions options_;
 
   std::unique_ptr<DiagnosticsLog> diag_log_;
+  std::unique_ptr<MetricsPusher> metrics_pusher_;
   scoped_refptr<Thread> excess_log_deleter_thread_;
   CountDownLatch stop_background_threads_latch_;
 
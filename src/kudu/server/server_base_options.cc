@@ -47,6 +47,24 @@ DEFINE_int32(
     "value, then metrics logging will be disabled.");
 TAG_FLAG(metrics_log_interval_ms, advanced);
 
+DEFINE_string(
+    rpc_reactor_cpus,
+    "",
+    "CPUs to pin the RPC reactor threads to, one reactor per CPU in turn, "
+    "in the format of taskset(1), e.g. '0-3,8'. If empty, the reactors are "
+    "pinned to the CPUs of the NUMA node of "
+    "--server_numa_network_interface, if set, and are not pinned otherwise.");
+TAG_FLAG(rpc_reactor_cpus, experimental);
+
+DEFINE_string(
+    server_numa_network_interface,
+    "",
+    "Network interface which carries the server's RPC traffic, e.g. 'eth0'. "
+    "If set, the RPC service threads and the Raft thread pool only run on "
+    "the CPUs of the NUMA node this interface is attached to, keeping them "
+    "close to the memory the NIC delivers into.");
+TAG_FLAG(server_numa_network_interface, experimental);
+
 namespace kudu {
 namespace server {
 
@@ -54,7 +72,9 @@ ServerBaseOptions::ServerBaseOptions()
     : env(Env::Default()),
       dump_info_path(FLAGS_server_dump_info_path),
       dump_info_format(FLAGS_server_dump_info_format),
-      metrics_log_interval_ms(FLAGS_metrics_log_interval_ms) {}
+      metrics_log_interval_ms(FLAGS_metrics_log_interval_ms),
+      reactor_cpus(FLAGS_rpc_reactor_cpus),
+      numa_network_interface(FLAGS_server_numa_network_interface) {}
 
 } // namespace server
 } // namespace kudu
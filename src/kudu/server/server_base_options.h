@@ -52,6 +52,11 @@ struct ServerBaseOptions {
   std::string metrics_log_dir;
   int32_t metrics_log_interval_ms;
 
+  // Thread placement; see --rpc_reactor_cpus and
+  // --server_numa_network_interface.
+  std::string reactor_cpus;
+  std::string numa_network_interface;
+
  protected:
   ServerBaseOptions();
 };
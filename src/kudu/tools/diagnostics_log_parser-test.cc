@@ -25,6 +25,10 @@
 #include <gtest/gtest.h>
 #include <rapidjson/document.h>
 
+#include "kudu/gutil/casts.h"
+#include "kudu/gutil/strings/escaping.h"
+#include "kudu/util/coding.h"
+#include "kudu/util/faststring.h"
 #include "kudu/util/status.h"
 #include "kudu/util/test_macros.h"
 
@@ -71,8 +75,8 @@ TEST(DiagLogParserTest, TestParseLine) {
   }
 
   {
-    // The line parser recognizes "stacks" and "symbols" categories.
-    // "metrics" isn't recognized yet.
+    // The line parser recognizes "stacks", "symbols", "metrics" and
+    // "metrics_delta" categories.
     ParsedLine pl;
     string line =
         "I0220 17:38:09.950546 stacks 1519177089950546 {\"foo\" : \"bar\"}";
@@ -85,7 +89,13 @@ TEST(DiagLogParserTest, TestParseLine) {
 
     line = "I0220 17:38:09.950546 metrics 1519177089950546 {\"foo\" : \"bar\"}";
     ASSERT_OK(pl.Parse(line));
-    ASSERT_EQ(RecordType::kUnknown, pl.type());
+    ASSERT_EQ(RecordType::kMetrics, pl.type());
+
+    // The deltas aren't JSON.
+    line = "I0220 17:38:09.950546 metrics_delta 1519177089950546 AAA";
+    ASSERT_OK(pl.Parse(line));
+    ASSERT_EQ(RecordType::kMetricsDelta, pl.type());
+    ASSERT_EQ("AAA", pl.payload());
 
     line = "I0220 17:38:09.950546 foo 1519177089950546 {\"foo\" : \"bar\"}";
     ASSERT_OK(pl.Parse(line));
@@ -252,5 +262,118 @@ TEST(DiagLogParserTest, TestParseStacks) {
   ASSERT_OK(lp.ParseLine(line));
 }
 
+class TestMetricsLogVisitor : public LogVisitor {
+ public:
+  void VisitSymbol(const string& /*addr*/, const string& /*symbol*/) override {}
+  void VisitStacksRecord(const StacksRecord& /*sr*/) override {}
+  void VisitMetricsRecord(const MetricsRecord& mr) override {
+    records_.push_back(mr);
+  }
+
+  vector<MetricsRecord> records_;
+};
+
+// Returns a 'metrics_delta' line for the binary 'delta'.
+static string MetricsDeltaLine(const faststring& delta) {
+  string encoded;
+  strings::Base64Escape(
+      delta.data(), delta.size(), &encoded, /*do_padding=*/false);
+  return "I0220 17:38:10.950546 metrics_delta 1519177090950546 " + encoded;
+}
+
+TEST(DiagLogParserTest, TestParseMetrics) {
+  TestMetricsLogVisitor lv;
+  LogParser lp(&lv);
+
+  // A keyframe, with a counter, a string gauge and a histogram.
+  string line =
+      "I0220 17:38:09.950546 metrics 1519177089950546 "
+      "[{\"type\":\"server\",\"id\":\"kudu.tabletserver\",\"metrics\":["
+      "{\"name\":\"rpcs\",\"value\":7},"
+      "{\"name\":\"version\",\"value\":\"1.0\"},"
+      "{\"name\":\"latency\",\"total_count\":3,\"min\":1,\"mean\":2.5,"
+      "\"percentile_99\":4,\"max\":5}]}]";
+  ASSERT_OK(lp.ParseLine(line));
+  ASSERT_EQ(1, lv.records_.size());
+  const MetricsRecord& keyframe = lv.records_[0];
+  ASSERT_TRUE(keyframe.keyframe);
+  ASSERT_EQ(1519177089950546, keyframe.timestamp_us);
+  ASSERT_EQ(4, keyframe.values.size());
+  ASSERT_EQ("server", keyframe.values[0].entity_type);
+  ASSERT_EQ("kudu.tabletserver", keyframe.values[0].entity_id);
+  ASSERT_EQ("rpcs", keyframe.values[0].metric_name);
+  ASSERT_EQ("", keyframe.values[0].field);
+  ASSERT_EQ(7, keyframe.values[0].int_value);
+  ASSERT_EQ("latency", keyframe.values[1].metric_name);
+  ASSERT_EQ("total_count", keyframe.values[1].field);
+  ASSERT_EQ(3, keyframe.values[1].int_value);
+  ASSERT_EQ("max", keyframe.values[3].field);
+  ASSERT_EQ(5, keyframe.values[3].int_value);
+
+  // A delta defining a counter and a double gauge.
+  faststring delta;
+  PutVarint32(&delta, 2);
+  for (const char* part : {"server", "kudu.tabletserver", "rpcs", ""}) {
+    PutLengthPrefixedSlice(&delta, part);
+  }
+  delta.push_back(0);
+  for (const char* part : {"server", "kudu.tabletserver", "load", ""}) {
+    PutLengthPrefixedSlice(&delta, part);
+  }
+  delta.push_back(1);
+  PutVarint32(&delta, 2);
+  PutVarint32(&delta, 0);
+  PutVarint64(&delta, 9 << 1);
+  PutVarint32(&delta, 1);
+  PutFixed64(&delta, bit_cast<uint64_t>(0.5));
+  ASSERT_OK(lp.ParseLine(MetricsDeltaLine(delta)));
+  ASSERT_EQ(2, lv.records_.size());
+  ASSERT_FALSE(lv.records_[1].keyframe);
+  ASSERT_EQ(2, lv.records_[1].values.size());
+  ASSERT_EQ("rpcs", lv.records_[1].values[0].metric_name);
+  ASSERT_EQ(9, lv.records_[1].values[0].int_value);
+  ASSERT_TRUE(lv.records_[1].values[1].is_double);
+  ASSERT_EQ(0.5, lv.records_[1].values[1].double_value);
+
+  // The next delta only has the counter, which went down by 2.
+  delta.clear();
+  PutVarint32(&delta, 0);
+  PutVarint32(&delta, 1);
+  PutVarint32(&delta, 0);
+  PutVarint64(&delta, (2 << 1) - 1);
+  ASSERT_OK(lp.ParseLine(MetricsDeltaLine(delta)));
+  ASSERT_EQ(3, lv.records_.size());
+  ASSERT_EQ(1, lv.records_[2].values.size());
+  ASSERT_EQ(7, lv.records_[2].values[0].int_value);
+
+  // A key that was not defined since the last keyframe.
+  delta.clear();
+  PutVarint32(&delta, 0);
+  PutVarint32(&delta, 1);
+  PutVarint32(&delta, 2);
+  PutVarint64(&delta, 0);
+  Status s = lp.ParseLine(MetricsDeltaLine(delta));
+  ASSERT_TRUE(s.IsCorruption()) << s.ToString();
+  ASSERT_STR_CONTAINS(s.ToString(), "unknown metrics key 2");
+
+  // Keys don't survive a keyframe.
+  ASSERT_OK(lp.ParseLine(line));
+  delta.clear();
+  PutVarint32(&delta, 0);
+  PutVarint32(&delta, 1);
+  PutVarint32(&delta, 0);
+  PutVarint64(&delta, 0);
+  s = lp.ParseLine(MetricsDeltaLine(delta));
+  ASSERT_TRUE(s.IsCorruption()) << s.ToString();
+
+  // Truncated deltas are caught.
+  delta.clear();
+  PutVarint32(&delta, 1);
+  PutLengthPrefixedSlice(&delta, "server");
+  s = lp.ParseLine(MetricsDeltaLine(delta));
+  ASSERT_TRUE(s.IsCorruption()) << s.ToString();
+  ASSERT_STR_CONTAINS(s.ToString(), "truncated metrics delta");
+}
+
 } // namespace tools
 } // namespace kudu
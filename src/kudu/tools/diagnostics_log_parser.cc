@@ -19,6 +19,7 @@
 
 #include <array>
 #include <cstdint>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <string>
@@ -28,14 +29,18 @@
 #include <glog/logging.h>
 #include <rapidjson/document.h>
 
+#include "kudu/gutil/casts.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/port.h"
+#include "kudu/gutil/strings/escaping.h"
 #include "kudu/gutil/strings/join.h"
 #include "kudu/gutil/strings/numbers.h"
 #include "kudu/gutil/strings/split.h"
 #include "kudu/gutil/strings/stringpiece.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/coding.h"
 #include "kudu/util/jsonreader.h"
+#include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 
 using std::array;
@@ -56,6 +61,12 @@ const char* RecordTypeToString(RecordType r) {
     case RecordType::kSymbols:
       return "symbols";
       break;
+    case RecordType::kMetrics:
+      return "metrics";
+      break;
+    case RecordType::kMetricsDelta:
+      return "metrics_delta";
+      break;
     case RecordType::kUnknown:
       return "<unknown>";
       break;
@@ -94,6 +105,23 @@ void StackDumpingLogVisitor::VisitStacksRecord(const StacksRecord& sr) {
   }
 }
 
+void MetricsDumpingLogVisitor::VisitMetricsRecord(const MetricsRecord& mr) {
+  for (const auto& v : mr.values) {
+    cout << mr.date_time << " " << v.entity_type << " " << v.entity_id << " "
+         << v.metric_name;
+    if (!v.field.empty()) {
+      cout << "." << v.field;
+    }
+    cout << " ";
+    if (v.is_double) {
+      cout << v.double_value;
+    } else {
+      cout << v.int_value;
+    }
+    cout << endl;
+  }
+}
+
 Status ParsedLine::Parse(string line) {
   // Take ownership of the line to avoid copying substrings.
   line_ = std::move(line);
@@ -110,28 +138,38 @@ Status ParsedLine::Parse(string line) {
       strings::Split(line_, strings::delimiter::Limit(" ", 4));
   fields[0].remove_prefix(1); // Remove the 'I'.
   // Sanity check the microsecond timestamp.
-  // Eventually, it should be used when processing metrics records.
-  int64_t time_us;
-  if (!safe_strto64(fields[3].data(), fields[3].size(), &time_us)) {
+  if (!safe_strto64(fields[3].data(), fields[3].size(), &timestamp_us_)) {
     return Status::InvalidArgument("invalid timestamp", fields[3]);
   }
-  // TODO(todd) JsonReader should be able to parse from a StringPiece
-  // directly instead of making the copy here.
-  json_.emplace(fields[4].ToString());
-  Status s = json_->Init();
-  if (!s.ok()) {
-    json_ = boost::none;
-    return s.CloneAndPrepend("invalid JSON payload");
-  }
-  date_ = fields[0];
-  time_ = fields[1];
+  RecordType type;
   if (fields[2] == "symbols") {
-    type_ = RecordType::kSymbols;
+    type = RecordType::kSymbols;
   } else if (fields[2] == "stacks") {
-    type_ = RecordType::kStacks;
+    type = RecordType::kStacks;
+  } else if (fields[2] == "metrics") {
+    type = RecordType::kMetrics;
+  } else if (fields[2] == "metrics_delta") {
+    type = RecordType::kMetricsDelta;
+  } else {
+    type = RecordType::kUnknown;
+  }
+  json_ = boost::none;
+  payload_.clear();
+  if (type == RecordType::kMetricsDelta) {
+    payload_ = fields[4];
   } else {
-    type_ = RecordType::kUnknown;
+    // TODO(todd) JsonReader should be able to parse from a StringPiece
+    // directly instead of making the copy here.
+    json_.emplace(fields[4].ToString());
+    Status s = json_->Init();
+    if (!s.ok()) {
+      json_ = boost::none;
+      return s.CloneAndPrepend("invalid JSON payload");
+    }
   }
+  date_ = fields[0];
+  time_ = fields[1];
+  type_ = type;
   return Status::OK();
 }
 
@@ -152,6 +190,12 @@ Status LogParser::ParseLine(string line) {
       RETURN_NOT_OK(ParseStacks(pl));
       break;
     }
+    case RecordType::kMetrics:
+      RETURN_NOT_OK(ParseMetrics(pl));
+      break;
+    case RecordType::kMetricsDelta:
+      RETURN_NOT_OK(ParseMetricsDelta(pl));
+      break;
     default:
       break;
   }
@@ -250,5 +294,147 @@ Status LogParser::ParseStacks(const ParsedLine& pl) {
   return Status::OK();
 }
 
+Status LogParser::ParseMetrics(const ParsedLine& pl) {
+  // The deltas which follow a keyframe don't depend on anything before it.
+  metrics_keys_.clear();
+
+  MetricsRecord mr;
+  mr.date_time = pl.date_time();
+  mr.timestamp_us = pl.timestamp_us();
+  mr.keyframe = true;
+
+  const rapidjson::Value& json = *pl.json();
+  if (!json.IsArray()) {
+    return Status::InvalidArgument("expected metrics data to be a JSON array");
+  }
+  for (const rapidjson::Value* entity = json.Begin(); entity != json.End();
+       ++entity) {
+    if (PREDICT_FALSE(
+            !entity->IsObject() || !entity->HasMember("type") ||
+            !(*entity)["type"].IsString() || !entity->HasMember("id") ||
+            !(*entity)["id"].IsString() || !entity->HasMember("metrics") ||
+            !(*entity)["metrics"].IsArray())) {
+      return Status::InvalidArgument(
+          "expected metrics entities to be JSON objects with a type, an id "
+          "and metrics");
+    }
+    const rapidjson::Value& metrics = (*entity)["metrics"];
+    for (const rapidjson::Value* m = metrics.Begin(); m != metrics.End(); ++m) {
+      if (PREDICT_FALSE(
+              !m->IsObject() || !m->HasMember("name") ||
+              !(*m)["name"].IsString())) {
+        return Status::InvalidArgument(
+            "expected metrics to be JSON objects with a name");
+      }
+      MetricsRecord::Value v;
+      v.entity_type = (*entity)["type"].GetString();
+      v.entity_id = (*entity)["id"].GetString();
+      v.metric_name = (*m)["name"].GetString();
+      // Read the fields the deltas have. String gauges have none.
+      static const char* const kFields[] = {
+          "value", "total_count", "percentile_99", "max"};
+      for (const char* field : kFields) {
+        if (!m->HasMember(field)) {
+          continue;
+        }
+        const rapidjson::Value& value = (*m)[field];
+        v.field = strcmp(field, "value") == 0 ? "" : field;
+        v.is_double = value.IsDouble();
+        v.int_value = 0;
+        v.double_value = 0;
+        if (value.IsBool()) {
+          v.int_value = value.GetBool() ? 1 : 0;
+        } else if (value.IsInt64()) {
+          v.int_value = value.GetInt64();
+        } else if (value.IsUint64()) {
+          v.int_value = static_cast<int64_t>(value.GetUint64());
+        } else if (value.IsDouble()) {
+          v.double_value = value.GetDouble();
+        } else {
+          continue;
+        }
+        mr.values.push_back(v);
+      }
+    }
+  }
+  visitor_->VisitMetricsRecord(mr);
+  return Status::OK();
+}
+
+Status LogParser::ParseMetricsDelta(const ParsedLine& pl) {
+  MetricsRecord mr;
+  mr.date_time = pl.date_time();
+  mr.timestamp_us = pl.timestamp_us();
+  mr.keyframe = false;
+
+  string data;
+  if (!strings::Base64Unescape(pl.payload().ToString(), &data)) {
+    return Status::InvalidArgument("invalid base64 metrics delta");
+  }
+  const Status kTruncated = Status::Corruption("truncated metrics delta");
+  Slice input(data);
+  uint32_t num_new_keys;
+  if (!GetVarint32(&input, &num_new_keys)) {
+    return kTruncated;
+  }
+  for (uint32_t i = 0; i < num_new_keys; i++) {
+    Slice parts[4];
+    for (Slice& part : parts) {
+      if (!GetLengthPrefixedSlice(&input, &part)) {
+        return kTruncated;
+      }
+    }
+    if (input.empty()) {
+      return kTruncated;
+    }
+    MetricsRecord::Value key;
+    key.entity_type = parts[0].ToString();
+    key.entity_id = parts[1].ToString();
+    key.metric_name = parts[2].ToString();
+    key.field = parts[3].ToString();
+    key.is_double = input[0] != 0;
+    key.int_value = 0;
+    key.double_value = 0;
+    input.remove_prefix(1);
+    metrics_keys_.emplace_back(std::move(key));
+  }
+
+  uint32_t num_values;
+  if (!GetVarint32(&input, &num_values)) {
+    return kTruncated;
+  }
+  for (uint32_t i = 0; i < num_values; i++) {
+    uint32_t id;
+    if (!GetVarint32(&input, &id)) {
+      return kTruncated;
+    }
+    if (PREDICT_FALSE(id >= metrics_keys_.size())) {
+      return Status::Corruption(Substitute("unknown metrics key $0", id));
+    }
+    MetricsRecord::Value* v = &metrics_keys_[id];
+    if (v->is_double) {
+      if (input.size() < sizeof(uint64_t)) {
+        return kTruncated;
+      }
+      v->double_value = bit_cast<double>(DecodeFixed64(input.data()));
+      input.remove_prefix(sizeof(uint64_t));
+    } else {
+      uint64_t zigzag;
+      if (!GetVarint64(&input, &zigzag)) {
+        return kTruncated;
+      }
+      uint64_t diff = (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+      v->int_value = static_cast<int64_t>(
+          static_cast<uint64_t>(v->int_value) + diff);
+    }
+    mr.values.push_back(*v);
+  }
+  if (!input.empty()) {
+    return Status::Corruption("trailing data in metrics delta");
+  }
+  visitor_->VisitMetricsRecord(mr);
+  return Status::OK();
+}
+
 } // namespace tools
 } // namespace kudu
@@ -17,6 +17,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <iostream>
 #include <string>
 #include <unordered_map>
@@ -34,8 +35,7 @@ namespace kudu {
 namespace tools {
 
 // One of the record types from the log.
-// TODO(KUDU-2353) support metrics records.
-enum class RecordType { kSymbols, kStacks, kUnknown };
+enum class RecordType { kSymbols, kStacks, kMetrics, kMetricsDelta, kUnknown };
 
 const char* RecordTypeToString(RecordType r);
 
@@ -61,6 +61,33 @@ struct StacksRecord {
   std::vector<Group> groups;
 };
 
+// A metrics sample from the log: all the touched metrics for a keyframe, only
+// those which changed since the previous record for a delta. See
+// kudu::server::DiagnosticsLog for the format of the records.
+struct MetricsRecord {
+  struct Value {
+    std::string entity_type;
+    std::string entity_id;
+    std::string metric_name;
+    // Empty for counters and gauges, see kudu::MetricValue.
+    std::string field;
+    bool is_double;
+    int64_t int_value;
+    double double_value;
+  };
+
+  // The time the metrics were collected.
+  std::string date_time;
+  int64_t timestamp_us;
+
+  bool keyframe;
+
+  // The numeric values. Only the total count, 99th percentile and maximum of
+  // the histograms are decoded from a keyframe, which does not record their
+  // total sum.
+  std::vector<Value> values;
+};
+
 // Interface for consuming the parsed records from a diagnostics log.
 class LogVisitor {
  public:
@@ -69,6 +96,7 @@ class LogVisitor {
       const std::string& addr,
       const std::string& symbol) = 0;
   virtual void VisitStacksRecord(const StacksRecord& sr) = 0;
+  virtual void VisitMetricsRecord(const MetricsRecord& /*mr*/) {}
 };
 
 // LogVisitor implementation which dumps the parsed stack records to cout.
@@ -87,9 +115,23 @@ class StackDumpingLogVisitor : public LogVisitor {
   const std::string kUnknownSymbol = "<unknown>";
 };
 
+// LogVisitor implementation which dumps the parsed metrics records to cout,
+// one value per line.
+class MetricsDumpingLogVisitor : public LogVisitor {
+ public:
+  void VisitSymbol(
+      const std::string& /*addr*/,
+      const std::string& /*symbol*/) override {}
+
+  void VisitStacksRecord(const StacksRecord& /*sr*/) override {}
+
+  void VisitMetricsRecord(const MetricsRecord& mr) override;
+};
+
 // A parsed line from the diagnostics log.
 //
-// Each line contains a timestamp, a record type, and some JSON data.
+// Each line contains a timestamp, a record type, and some JSON data, or
+// base64-encoded binary data for the 'metrics_delta' records.
 class ParsedLine {
  public:
   // Parse a line from the diagnostics log.
@@ -104,11 +146,23 @@ class ParsedLine {
     return json_->root();
   }
 
+  // The data of the line, still base64-encoded. Only set for the
+  // 'metrics_delta' records, for which json() is not available.
+  StringPiece payload() const {
+    return payload_;
+  }
+
   std::string date_time() const;
 
+  int64_t timestamp_us() const {
+    return timestamp_us_;
+  }
+
  private:
   std::string line_;
   RecordType type_;
+  int64_t timestamp_us_;
+  StringPiece payload_;
 
   // date_ and time_ point to substrings of line_.
   StringPiece date_;
@@ -142,7 +196,15 @@ class LogParser {
 
   Status ParseStacks(const ParsedLine& lf);
 
+  Status ParseMetrics(const ParsedLine& lf);
+
+  Status ParseMetricsDelta(const ParsedLine& lf);
+
   LogVisitor* visitor_;
+
+  // The keys defined by the 'metrics_delta' records since the last keyframe,
+  // by number, with their last decoded values.
+  std::vector<MetricsRecord::Value> metrics_keys_;
 };
 
 } // namespace tools
@@ -60,6 +60,7 @@
 #include "kudu/tools/tool.pb.h" // IWYU pragma: keep
 #include "kudu/tools/tool_action.h"
 #include "kudu/tserver/tserver_admin.proxy.h" // IWYU pragma: keep
+#include "kudu/util/compression/compression.pb.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/jsonwriter.h"
 #include "kudu/util/memory/arena.h"
@@ -305,6 +306,105 @@ bool MatchesAnyPattern(const vector<string>& patterns, const string& str) {
   return false;
 }
 
+namespace {
+
+enum PrintEntryType { DONT_PRINT, PRINT_PB, PRINT_DECODED, PRINT_ID };
+
+PrintEntryType ParsePrintType() {
+  if (!ParseLeadingBoolValue(FLAGS_print_entries.c_str(), true)) {
+    return DONT_PRINT;
+  }
+  if (ParseLeadingBoolValue(FLAGS_print_entries.c_str(), false) ||
+      FLAGS_print_entries == "decoded") {
+    return PRINT_DECODED;
+  }
+  if (FLAGS_print_entries == "pb") {
+    return PRINT_PB;
+  }
+  if (FLAGS_print_entries == "id") {
+    return PRINT_ID;
+  }
+  LOG(FATAL) << "Unknown value for --print_entries: " << FLAGS_print_entries;
+}
+
+void PrintIdOnly(const LogEntryPB& entry) {
+  switch (entry.type()) {
+    case log::REPLICATE:
+      cout << entry.replicate().id().term() << "."
+           << entry.replicate().id().index() << "@"
+           << entry.replicate().timestamp() << "\t"
+           << "REPLICATE "
+           << consensus::OperationType_Name(entry.replicate().op_type());
+      break;
+    case log::COMMIT:
+      cout << "COMMIT " << entry.commit().commited_op_id().term() << "."
+           << entry.commit().commited_op_id().index();
+      break;
+    default:
+      cout << "UNKNOWN: " << SecureShortDebugString(entry);
+  }
+  cout << endl;
+}
+
+// Kuduraft doesn't know how to decode the payloads of its users, so this
+// prints what the log knows about them on top of the ids.
+void PrintDecoded(const LogEntryPB& entry) {
+  PrintIdOnly(entry);
+  if (entry.type() != log::REPLICATE) {
+    return;
+  }
+  const ReplicateMsg& replicate = entry.replicate();
+  if (replicate.has_write_payload()) {
+    const auto& payload = replicate.write_payload();
+    cout << "\tpayload: " << payload.payload().size() << " bytes, codec "
+         << CompressionType_Name(payload.compression_codec());
+    if (payload.has_uncompressed_size()) {
+      cout << ", " << payload.uncompressed_size() << " bytes uncompressed";
+    }
+    cout << endl;
+  }
+  if (replicate.has_change_config_record()) {
+    cout << "\tconfig change: "
+         << SecureShortDebugString(replicate.change_config_record()) << endl;
+  }
+}
+
+} // anonymous namespace
+
+Status PrintSegment(const scoped_refptr<ReadableLogSegment>& segment) {
+  PrintEntryType print_type = ParsePrintType();
+  if (FLAGS_print_meta) {
+    cout << "Header:\n" << SecureDebugString(segment->header());
+  }
+  if (print_type != DONT_PRINT) {
+    LogEntryReader reader(segment.get());
+    while (true) {
+      unique_ptr<LogEntryPB> entry;
+      Status s = reader.ReadNextEntry(&entry);
+      if (s.IsEndOfFile()) {
+        break;
+      }
+      RETURN_NOT_OK(s);
+
+      if (print_type == PRINT_PB) {
+        if (FLAGS_truncate_data > 0) {
+          pb_util::TruncateFields(entry.get(), FLAGS_truncate_data);
+        }
+        cout << "Entry:\n" << SecureDebugString(*entry);
+      } else if (print_type == PRINT_DECODED) {
+        PrintDecoded(*entry);
+      } else if (print_type == PRINT_ID) {
+        PrintIdOnly(*entry);
+      }
+    }
+  }
+  if (FLAGS_print_meta && segment->HasFooter()) {
+    cout << "Footer:\n" << SecureDebugString(segment->footer());
+  }
+
+  return Status::OK();
+}
+
 /*
 Status PrintServerStatus(const string& address, uint16_t default_port) {
   ServerStatusPB status;
@@ -73,14 +73,6 @@ Status BuildProxy(
     uint16_t default_port,
     std::unique_ptr<ProxyClass>* proxy);
 
-/*
-// Get the current status of the Kudu server running at 'address', storing it
-// in 'status'.
-//
-// If 'address' does not contain a port, 'default_port' is used instead.
-Status GetServerStatus(const std::string& address, uint16_t default_port,
-                       server::ServerStatusPB* status);
-
 // Prints the contents of a WAL segment to stdout.
 //
 // The following gflags affect the output:
@@ -89,6 +81,14 @@ Status GetServerStatus(const std::string& address, uint16_t default_port,
 // - truncate_data: how many bytes to print for each data field.
 Status PrintSegment(const scoped_refptr<log::ReadableLogSegment>& segment);
 
+/*
+// Get the current status of the Kudu server running at 'address', storing it
+// in 'status'.
+//
+// If 'address' does not contain a port, 'default_port' is used instead.
+Status GetServerStatus(const std::string& address, uint16_t default_port,
+                       server::ServerStatusPB* status);
+
 // Print the current status of the Kudu server running at 'address'.
 //
 // If 'address' does not contain a port, 'default_port' is used instead.
@@ -45,38 +45,53 @@ const char* kLogPathArg = "path";
 
 namespace {
 
-Status ParseStacksFromPath(const string& path) {
+Status ParseLogFromPath(const string& path, LogParser* lp) {
   errno = 0;
   ifstream in(path);
   if (!in.is_open()) {
     return Status::IOError(ErrnoToString(errno));
   }
-  StackDumpingLogVisitor dlv;
-  LogParser lp(&dlv);
   string line;
   int line_number = 0;
   while (std::getline(in, line)) {
     line_number++;
     RETURN_NOT_OK_PREPEND(
-        lp.ParseLine(std::move(line)), Substitute("at line $0", line_number));
+        lp->ParseLine(std::move(line)), Substitute("at line $0", line_number));
   }
 
   return Status::OK();
 }
 
-Status ParseStacks(const RunnerContext& context) {
+// Parses the logs at the paths of 'context', in the order they were written,
+// feeding their records to 'visitor'. 'what' names those for errors.
+Status ParseLogs(
+    const RunnerContext& context,
+    const char* what,
+    LogVisitor* visitor) {
   vector<string> paths = context.variadic_args;
   // The file names are such that lexicographic sorting reflects
   // timestamp-based sorting.
   std::sort(paths.begin(), paths.end());
   for (const auto& path : paths) {
+    // Each file starts with a metrics keyframe, so it is parsed on its own.
+    LogParser lp(visitor);
     RETURN_NOT_OK_PREPEND(
-        ParseStacksFromPath(path),
-        Substitute("failed to parse stacks from $0", path));
+        ParseLogFromPath(path, &lp),
+        Substitute("failed to parse $0 from $1", what, path));
   }
   return Status::OK();
 }
 
+Status ParseStacks(const RunnerContext& context) {
+  StackDumpingLogVisitor dlv;
+  return ParseLogs(context, "stacks", &dlv);
+}
+
+Status ParseMetrics(const RunnerContext& context) {
+  MetricsDumpingLogVisitor mlv;
+  return ParseLogs(context, "metrics", &mlv);
+}
+
 } // anonymous namespace
 
 unique_ptr<Mode> BuildDiagnoseMode() {
@@ -87,8 +102,18 @@ unique_ptr<Mode> BuildDiagnoseMode() {
               {kLogPathArg, "path to log file(s) to parse"})
           .Build();
 
+  unique_ptr<Action> parse_metrics =
+      ActionBuilder("parse_metrics", &ParseMetrics)
+          .Description(
+              "Parse the metrics, keyframes and deltas, out of a diagnostics "
+              "log, one value per line")
+          .AddRequiredVariadicParameter(
+              {kLogPathArg, "path to log file(s) to parse"})
+          .Build();
+
   return ModeBuilder("diagnose")
       .Description("Diagnostic tools for Kudu servers and clusters")
+      .AddAction(std::move(parse_metrics))
       .AddAction(std::move(parse_stacks))
       .Build();
 }
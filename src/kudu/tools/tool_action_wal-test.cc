@@ -0,0 +1,191 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/consensus/log-test-base.h"
+#include "kudu/consensus/log_reader.h"
+#include "kudu/consensus/log_util.h"
+#include "kudu/consensus/opid.pb.h"
+#include "kudu/consensus/opid_util.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/strings/util.h"
+#include "kudu/tools/tool_main.h"
+#include "kudu/util/path_util.h"
+#include "kudu/util/test_macros.h"
+
+DECLARE_int64(from_index);
+DECLARE_int64(to_index);
+DECLARE_string(print_entries);
+DECLARE_string(read_mode);
+DECLARE_int32(read_iterations);
+
+namespace kudu {
+namespace tools {
+
+using consensus::MakeOpId;
+using consensus::OpId;
+using std::string;
+using std::vector;
+using strings::Substitute;
+
+// Runs the 'wal' mode actions in-process on a WAL written by LogTestBase.
+class ToolActionWalTest : public log::LogTestBase {
+ protected:
+  enum { kNumSegments = 3, kOpsPerSegment = 10 };
+
+  void SetUp() override {
+    LogTestBase::SetUp();
+    ASSERT_OK(BuildLog());
+    OpId op_id = MakeOpId(1, 1);
+    for (int i = 0; i < kNumSegments; i++) {
+      if (i > 0) {
+        ASSERT_OK(RollLog());
+      }
+      ASSERT_OK(AppendNoOps(&op_id, kOpsPerSegment));
+    }
+    // Closing the log writes the footer of the last segment too.
+    ASSERT_OK(log_->Close());
+    wal_dir_ = fs_manager_->GetTabletWalDir(log::kTestTablet);
+  }
+
+  // Runs 'kudu wal <args>', setting 'out' to what it printed to stdout, and
+  // returns its exit code.
+  int RunWalTool(const vector<string>& args, string* out) {
+    vector<string> argv_strings = {"kudu", "wal"};
+    argv_strings.insert(argv_strings.end(), args.begin(), args.end());
+    vector<char*> argv;
+    for (string& arg : argv_strings) {
+      argv.push_back(&arg[0]);
+    }
+    std::ostringstream captured;
+    std::streambuf* old_buf = std::cout.rdbuf(captured.rdbuf());
+    int ret = RunTool(argv.size(), argv.data(), /*show_help=*/false);
+    std::cout.rdbuf(old_buf);
+    *out = captured.str();
+    return ret;
+  }
+
+  // Returns the paths of the segments in the WAL.
+  vector<string> SegmentPaths() {
+    vector<string> paths;
+    vector<string> children;
+    CHECK_OK(env_->GetChildren(wal_dir_, &children));
+    std::sort(children.begin(), children.end());
+    for (const string& child : children) {
+      if (log::IsLogFileName(child)) {
+        paths.push_back(JoinPathSegments(wal_dir_, child));
+      }
+    }
+    return paths;
+  }
+
+  static int CountOccurrences(const string& haystack, const string& needle) {
+    int count = 0;
+    for (size_t pos = haystack.find(needle); pos != string::npos;
+         pos = haystack.find(needle, pos + needle.size())) {
+      count++;
+    }
+    return count;
+  }
+
+  string wal_dir_;
+};
+
+TEST_F(ToolActionWalTest, TestDump) {
+  const vector<string> paths = SegmentPaths();
+  ASSERT_EQ(kNumSegments, static_cast<int>(paths.size()));
+  FLAGS_print_entries = "id";
+  string out;
+  ASSERT_EQ(0, RunWalTool({"dump", paths[1]}, &out)) << out;
+  ASSERT_STR_CONTAINS(out, "Header:");
+  ASSERT_STR_CONTAINS(out, "Footer:");
+  ASSERT_EQ(kOpsPerSegment, CountOccurrences(out, "REPLICATE NO_OP")) << out;
+  ASSERT_STR_CONTAINS(out, Substitute("1.$0@", kOpsPerSegment + 1));
+
+  ASSERT_EQ(1, RunWalTool({"dump", JoinPathSegments(wal_dir_, "nope")}, &out));
+}
+
+TEST_F(ToolActionWalTest, TestDumpIndex) {
+  const int kNumOps = kNumSegments * kOpsPerSegment;
+  string out;
+  ASSERT_EQ(0, RunWalTool({"dump_index", wal_dir_}, &out)) << out;
+  ASSERT_EQ(kNumOps, CountOccurrences(out, "op_id=")) << out;
+  ASSERT_STR_CONTAINS(out, Substitute("op_id=1.$0 ", kNumOps));
+
+  FLAGS_from_index = 5;
+  FLAGS_to_index = 7;
+  ASSERT_EQ(0, RunWalTool({"dump_index", wal_dir_}, &out)) << out;
+  ASSERT_EQ(3, CountOccurrences(out, "op_id=")) << out;
+  ASSERT_STR_CONTAINS(out, "op_id=1.5 ");
+  ASSERT_STR_CONTAINS(out, "op_id=1.7 ");
+
+  // An open-ended range must start at an op in the index.
+  FLAGS_from_index = kNumOps + 1;
+  FLAGS_to_index = -1;
+  ASSERT_EQ(1, RunWalTool({"dump_index", wal_dir_}, &out));
+}
+
+TEST_F(ToolActionWalTest, TestVerify) {
+  string out;
+  ASSERT_EQ(0, RunWalTool({"verify", wal_dir_}, &out)) << out;
+  ASSERT_EQ(
+      kNumSegments,
+      CountOccurrences(out, Substitute(": OK ($0 entries)", kOpsPerSegment)))
+      << out;
+
+  // Flip a byte in the middle of the second segment, which its checksums
+  // catch. The other segments still verify.
+  const vector<string> paths = SegmentPaths();
+  uint64_t size;
+  ASSERT_OK(env_->GetFileSize(paths[1], &size));
+  ASSERT_OK(log::CorruptLogFile(env_, paths[1], log::FLIP_BYTE, size / 2));
+  ASSERT_EQ(1, RunWalTool({"verify", wal_dir_}, &out)) << out;
+  ASSERT_EQ(kNumSegments - 1, CountOccurrences(out, ": OK (")) << out;
+  ASSERT_STR_CONTAINS(out, paths[1] + ": Corruption");
+
+  ASSERT_EQ(1, RunWalTool({"verify", GetTestPath("no-such-dir")}, &out));
+}
+
+TEST_F(ToolActionWalTest, TestReadBenchmark) {
+  const int kNumOps = kNumSegments * kOpsPerSegment;
+  FLAGS_read_iterations = 2;
+  for (const char* mode : {"scan", "sequential", "indexed"}) {
+    SCOPED_TRACE(mode);
+    FLAGS_read_mode = mode;
+    string out;
+    ASSERT_EQ(0, RunWalTool({"read_benchmark", wal_dir_}, &out)) << out;
+    ASSERT_EQ(
+        FLAGS_read_iterations,
+        CountOccurrences(out, Substitute("Read $0 entries", kNumOps)))
+        << out;
+  }
+
+  FLAGS_read_mode = "backwards";
+  string out;
+  ASSERT_EQ(1, RunWalTool({"read_benchmark", wal_dir_}, &out));
+}
+
+} // namespace tools
+} // namespace kudu
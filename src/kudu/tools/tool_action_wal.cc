@@ -17,28 +17,85 @@
 
 #include "kudu/tools/tool_action.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
 #include <memory>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
+#include <gflags/gflags.h>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/log.pb.h"
+#include "kudu/consensus/log_index.h"
+#include "kudu/consensus/log_reader.h"
 #include "kudu/consensus/log_util.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/stl_util.h"
+#include "kudu/gutil/strings/substitute.h"
 #include "kudu/tools/tool_action_common.h"
 #include "kudu/util/env.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/path_util.h"
 #include "kudu/util/status.h"
+#include "kudu/util/stopwatch.h"
+
+DEFINE_int64(from_index, 1, "The first op index to print");
+DEFINE_int64(
+    to_index,
+    -1,
+    "The last op index to print. A negative value prints up to the last op "
+    "found in the index");
+DEFINE_int32(
+    verify_threads,
+    4,
+    "The number of segments to verify at the same time");
+DEFINE_string(
+    read_mode,
+    "scan",
+    "How to read the WAL:\n"
+    "  scan = read every entry of every segment in order\n"
+    "  sequential = read the ops with a SequentialReplicateReader\n"
+    "  indexed = read the ops with LogReader::ReadReplicatesInRange()");
+DEFINE_int64(
+    read_batch_bytes,
+    1024 * 1024,
+    "The size limit of each read of ops in the 'sequential' and 'indexed' "
+    "read modes");
+DEFINE_int32(read_iterations, 1, "How many times to read the WAL");
 
 namespace kudu {
 namespace tools {
 
+using consensus::ReplicateMsg;
+using log::LogEntryPB;
+using log::LogEntryReader;
+using log::LogIndex;
+using log::LogIndexEntry;
+using log::LogReader;
 using log::ReadableLogSegment;
+using log::SegmentSequence;
+using log::SequentialReplicateReader;
+using std::cout;
+using std::endl;
+using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
 
 namespace {
 
 const char* const kPathArg = "path";
+const char* const kPathsArg = "paths";
+const char* const kWalDirArg = "wal_dir";
+const char* const kWalDirArgDesc = "path to the WAL directory of a replica";
 
 Status Dump(const RunnerContext& context) {
   const string& segment_path = FindOrDie(context.required_args, kPathArg);
@@ -50,6 +107,244 @@ Status Dump(const RunnerContext& context) {
   return Status::OK();
 }
 
+Status DumpIndex(const RunnerContext& context) {
+  const string& wal_dir = FindOrDie(context.required_args, kWalDirArg);
+  scoped_refptr<LogIndex> index(new LogIndex(wal_dir));
+  RETURN_NOT_OK(index->OpenAllChunksOnStartup(Env::Default(), nullptr));
+
+  int64_t num_printed = 0;
+  for (int64_t i = std::max<int64_t>(FLAGS_from_index, 1);
+       FLAGS_to_index < 0 || i <= FLAGS_to_index;
+       i++) {
+    LogIndexEntry entry;
+    Status s = index->GetEntry(i, &entry);
+    if (s.IsNotFound()) {
+      // With an explicit end, print whichever ops of the range are there.
+      if (FLAGS_to_index >= 0) {
+        continue;
+      }
+      // Otherwise the first missing op ends the index.
+      if (num_printed > 0) {
+        break;
+      }
+      return Status::NotFound(Substitute("op $0 is not in the index", i));
+    }
+    RETURN_NOT_OK(s);
+    cout << entry.ToString() << endl;
+    num_printed++;
+  }
+  return Status::OK();
+}
+
+// Returns the log segments in 'paths', which are either segment files or
+// directories holding them.
+Status FindSegmentFiles(const vector<string>& paths, vector<string>* files) {
+  Env* env = Env::Default();
+  for (const string& path : paths) {
+    bool is_dir;
+    RETURN_NOT_OK(env->IsDirectory(path, &is_dir));
+    if (!is_dir) {
+      files->push_back(path);
+      continue;
+    }
+    vector<string> children;
+    RETURN_NOT_OK(env->GetChildren(path, &children));
+    std::sort(children.begin(), children.end());
+    for (const string& child : children) {
+      if (log::IsLogFileName(child)) {
+        files->push_back(JoinPathSegments(path, child));
+      }
+    }
+  }
+  return Status::OK();
+}
+
+// Reads every entry of the segment at 'path', which checks the checksums of
+// all its batches, and sets 'num_entries' to how many it read.
+Status VerifySegment(const string& path, int64_t* num_entries) {
+  *num_entries = 0;
+  scoped_refptr<ReadableLogSegment> segment;
+  RETURN_NOT_OK(ReadableLogSegment::Open(Env::Default(), path, &segment));
+  LogEntryReader reader(segment.get());
+  while (true) {
+    unique_ptr<LogEntryPB> entry;
+    Status s = reader.ReadNextEntry(&entry);
+    if (s.IsEndOfFile()) {
+      break;
+    }
+    RETURN_NOT_OK(s);
+    (*num_entries)++;
+  }
+  if (segment->HasFooter() &&
+      segment->footer().num_entries() != *num_entries) {
+    return Status::Corruption(Substitute(
+        "footer has $0 entries but $1 were read",
+        segment->footer().num_entries(),
+        *num_entries));
+  }
+  return Status::OK();
+}
+
+Status Verify(const RunnerContext& context) {
+  vector<string> files;
+  RETURN_NOT_OK(FindSegmentFiles(context.variadic_args, &files));
+  if (files.empty()) {
+    return Status::InvalidArgument("no WAL segments found");
+  }
+
+  vector<Status> statuses(files.size());
+  vector<int64_t> num_entries(files.size());
+  std::atomic<size_t> next(0);
+  vector<std::thread> threads;
+  int num_threads = std::min<int>(
+      std::max(FLAGS_verify_threads, 1), static_cast<int>(files.size()));
+  for (int i = 0; i < num_threads; i++) {
+    threads.emplace_back([&]() {
+      for (size_t f = next++; f < files.size(); f = next++) {
+        statuses[f] = VerifySegment(files[f], &num_entries[f]);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  int num_bad = 0;
+  for (size_t f = 0; f < files.size(); f++) {
+    if (statuses[f].ok()) {
+      cout << files[f] << ": OK (" << num_entries[f] << " entries)" << endl;
+    } else {
+      cout << files[f] << ": " << statuses[f].ToString() << endl;
+      num_bad++;
+    }
+  }
+  if (num_bad > 0) {
+    return Status::Corruption(Substitute(
+        "$0 of $1 segments failed to verify", num_bad, files.size()));
+  }
+  return Status::OK();
+}
+
+// Reads 'segments' entry by entry, adding the number of entries read and the
+// size of the segments to 'num_ops' and 'num_bytes'.
+Status ScanSegments(
+    const SegmentSequence& segments,
+    int64_t* num_ops,
+    int64_t* num_bytes) {
+  for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+    LogEntryReader reader(segment.get());
+    while (true) {
+      unique_ptr<LogEntryPB> entry;
+      Status s = reader.ReadNextEntry(&entry);
+      if (s.IsEndOfFile()) {
+        break;
+      }
+      RETURN_NOT_OK(s);
+      (*num_ops)++;
+    }
+    *num_bytes += segment->file_size();
+  }
+  return Status::OK();
+}
+
+// Reads the ops from 'first' to 'last' in batches of --read_batch_bytes,
+// through 'reader' or, if 'sequential' is set, a SequentialReplicateReader
+// over it.
+Status ReadOps(
+    const shared_ptr<LogReader>& reader,
+    bool sequential,
+    int64_t first,
+    int64_t last,
+    int64_t* num_ops,
+    int64_t* num_bytes) {
+  unique_ptr<SequentialReplicateReader> sequential_reader;
+  if (sequential) {
+    sequential_reader.reset(new SequentialReplicateReader(reader));
+  }
+  int64_t next = first;
+  while (next <= last) {
+    vector<ReplicateMsg*> replicates;
+    ElementDeleter deleter(&replicates);
+    if (sequential_reader) {
+      RETURN_NOT_OK(sequential_reader->ReadReplicates(
+          next, last, FLAGS_read_batch_bytes, &replicates));
+    }
+    // The sequential reader leaves the ops of the segment being written to,
+    // and any it could not read in order, to the indexed reads.
+    if (replicates.empty()) {
+      RETURN_NOT_OK(reader->ReadReplicatesInRange(
+          next, last, FLAGS_read_batch_bytes, &replicates));
+    }
+    if (replicates.empty()) {
+      return Status::Corruption(Substitute("could not read op $0", next));
+    }
+    for (const ReplicateMsg* replicate : replicates) {
+      *num_bytes += replicate->ByteSizeLong();
+    }
+    *num_ops += replicates.size();
+    next = replicates.back()->id().index() + 1;
+  }
+  return Status::OK();
+}
+
+Status ReadBenchmark(const RunnerContext& context) {
+  const string& wal_dir = FindOrDie(context.required_args, kWalDirArg);
+  const bool scan = FLAGS_read_mode == "scan";
+  const bool sequential = FLAGS_read_mode == "sequential";
+  if (!scan && !sequential && FLAGS_read_mode != "indexed") {
+    return Status::InvalidArgument(
+        "unknown value for --read_mode", FLAGS_read_mode);
+  }
+  Env* env = Env::Default();
+  scoped_refptr<LogIndex> index;
+  if (!scan) {
+    index = new LogIndex(wal_dir);
+    RETURN_NOT_OK(index->OpenAllChunksOnStartup(env, nullptr));
+  }
+  shared_ptr<LogReader> reader;
+  RETURN_NOT_OK(LogReader::Open(env, wal_dir, index, "", nullptr, &reader));
+  SegmentSequence segments;
+  RETURN_NOT_OK(reader->GetSegmentsSnapshot(&segments));
+  if (segments.empty()) {
+    return Status::NotFound("no WAL segments found", wal_dir);
+  }
+
+  int64_t first = reader->GetMinReplicateIndex();
+  int64_t last = -1;
+  for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+    if (segment->HasFooter()) {
+      last = std::max(last, segment->footer().max_replicate_index());
+    }
+  }
+  if (!scan && (first < 0 || last < first)) {
+    return Status::NotFound("no ops found in the segment footers", wal_dir);
+  }
+
+  for (int i = 0; i < FLAGS_read_iterations; i++) {
+    int64_t num_ops = 0;
+    int64_t num_bytes = 0;
+    Stopwatch sw;
+    sw.start();
+    if (scan) {
+      RETURN_NOT_OK(ScanSegments(segments, &num_ops, &num_bytes));
+    } else {
+      RETURN_NOT_OK(
+          ReadOps(reader, sequential, first, last, &num_ops, &num_bytes));
+    }
+    sw.stop();
+    double secs = std::max(sw.elapsed().wall_seconds(), 1e-9);
+    cout << Substitute(
+                "Read $0 entries, $1 bytes in $2 s: $3 entries/s, $4 MB/s",
+                num_ops,
+                num_bytes,
+                secs,
+                num_ops / secs,
+                num_bytes / secs / (1024 * 1024))
+         << endl;
+  }
+  return Status::OK();
+}
+
 } // anonymous namespace
 
 unique_ptr<Mode> BuildWalMode() {
@@ -62,9 +357,37 @@ unique_ptr<Mode> BuildWalMode() {
           .AddOptionalParameter("truncate_data")
           .Build();
 
+  unique_ptr<Action> dump_index =
+      ActionBuilder("dump_index", &DumpIndex)
+          .Description("Dump the log index of a WAL directory")
+          .AddRequiredParameter({kWalDirArg, kWalDirArgDesc})
+          .AddOptionalParameter("from_index")
+          .AddOptionalParameter("to_index")
+          .Build();
+
+  unique_ptr<Action> verify =
+      ActionBuilder("verify", &Verify)
+          .Description("Verify the checksums of WAL files")
+          .AddRequiredVariadicParameter(
+              {kPathsArg, "WAL files, or directories holding them"})
+          .AddOptionalParameter("verify_threads")
+          .Build();
+
+  unique_ptr<Action> read_benchmark =
+      ActionBuilder("read_benchmark", &ReadBenchmark)
+          .Description("Measure how fast the WAL of a replica can be read")
+          .AddRequiredParameter({kWalDirArg, kWalDirArgDesc})
+          .AddOptionalParameter("read_mode")
+          .AddOptionalParameter("read_batch_bytes")
+          .AddOptionalParameter("read_iterations")
+          .Build();
+
   return ModeBuilder("wal")
       .Description("Operate on WAL (write-ahead log) files")
       .AddAction(std::move(dump))
+      .AddAction(std::move(dump_index))
+      .AddAction(std::move(verify))
+      .AddAction(std::move(read_benchmark))
       .Build();
 }
 
@@ -18,6 +18,7 @@
 #include "kudu/tserver/consensus_service.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <cstring>
 #include <functional>
@@ -25,6 +26,7 @@
 #include <numeric>
 #include <optional>
 #include <ostream>
+#include <sstream>
 #include <string>
 #include <type_traits>
 #include <unordered_set>
@@ -40,8 +42,14 @@
 #include "kudu/common/wire_protocol.h"
 #include "kudu/common/wire_protocol.pb.h"
 #include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/consensus_peers.h"
+#include "kudu/consensus/log.h"
+#include "kudu/consensus/log_reader.h"
+#include "kudu/consensus/log_subscriptions.h"
+#include "kudu/consensus/log_util.h"
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/consensus/raft_consensus.h"
+#include "kudu/consensus/ref_counted_replicate.h"
 #include "kudu/consensus/replica_management.pb.h"
 #include "kudu/consensus/time_manager.h"
 #include "kudu/gutil/casts.h"
@@ -62,18 +70,42 @@
 #include "kudu/util/debug/trace_event.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/lock_profiling.h"
 #include "kudu/util/logging.h"
+#include "kudu/util/mem_tracker.h"
 #include "kudu/util/memory/arena.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/process_memory.h"
+#include "kudu/util/sampling_profiler.h"
+#include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 #include "kudu/util/status_callback.h"
 #include "kudu/util/trace.h"
 #include "kudu/util/trace_metrics.h"
 
+DEFINE_int64(
+    wal_copy_max_chunk_bytes,
+    4 * 1024 * 1024,
+    "The most WAL segment data a FetchLogSegment() RPC returns at once. Must "
+    "be below --rpc_max_message_size.");
+TAG_FLAG(wal_copy_max_chunk_bytes, advanced);
+TAG_FLAG(wal_copy_max_chunk_bytes, runtime);
+
+DEFINE_int64(
+    consensus_inbound_memory_limit_mb,
+    0,
+    "The most memory, in megabytes, which the UpdateConsensus() requests "
+    "being handled may take at once, counting their ops once uncompressed. "
+    "Requests beyond it are rejected as if the server were busy, and the "
+    "leader retries them. 0 means no limit.");
+TAG_FLAG(consensus_inbound_memory_limit_mb, advanced);
+DEFINE_validator(
+    consensus_inbound_memory_limit_mb,
+    [](const char* /*flagname*/, int64_t value) { return value >= 0; });
+
 DECLARE_bool(raft_prepare_replacement_before_eviction);
 DECLARE_int32(memory_limit_warn_threshold_percentage);
 
@@ -85,15 +117,24 @@ using kudu::consensus::ConsensusRequestPB;
 using kudu::consensus::ConsensusResponsePB;
 using kudu::consensus::GetLastOpIdRequestPB;
 using kudu::consensus::GetNodeInstanceRequestPB;
+using kudu::consensus::FetchLogSegmentRequestPB;
+using kudu::consensus::FetchLogSegmentResponsePB;
 using kudu::consensus::GetNodeInstanceResponsePB;
 using kudu::consensus::LeaderElectionContextPB;
 using kudu::consensus::LeaderStepDownRequestPB;
 using kudu::consensus::LeaderStepDownResponsePB;
+using kudu::consensus::ListLogSegmentsRequestPB;
+using kudu::consensus::ListLogSegmentsResponsePB;
+using kudu::consensus::LogSubscriptionManager;
+using kudu::consensus::LogSegmentInfoPB;
 using kudu::consensus::OpId;
 using kudu::consensus::RaftConsensus;
+using kudu::consensus::ReplicateRefPtr;
 using kudu::consensus::RunLeaderElectionRequestPB;
 using kudu::consensus::RunLeaderElectionResponsePB;
 using kudu::consensus::ServerErrorPB;
+using kudu::consensus::SubmitOpsRequestPB;
+using kudu::consensus::SubmitOpsResponsePB;
 using kudu::consensus::TimeManager;
 using kudu::consensus::UnsafeChangeConfigRequestPB;
 using kudu::consensus::UnsafeChangeConfigResponsePB;
@@ -119,6 +160,14 @@ METRIC_DEFINE_counter(
     "Number of RPC request that did not have a token "
     "that matches this instance's");
 
+METRIC_DEFINE_counter(
+    server,
+    consensus_inbound_memory_rejections,
+    "Inbound consensus memory rejections",
+    kudu::MetricUnit::kRequests,
+    "Number of UpdateConsensus() requests rejected because the ones being "
+    "handled already took --consensus_inbound_memory_limit_mb");
+
 namespace kudu {
 
 namespace tserver {
@@ -242,24 +291,24 @@ bool GetConsensusOrRespond(
   return true;
 }
 
-template <class ReqType, class RespType>
-bool CheckRaftRpcTokenOrRespond(
+// Returns NotAuthorized if the raft_rpc_token of 'req' does not match the one
+// of 'consensus' and the token is enforced.
+template <class ReqType>
+Status CheckRaftRpcToken(
     const std::string& method_name,
     const ReqType* req,
-    RespType resp,
-    rpc::RpcContext* context,
     const consensus::RaftConsensus& consensus,
     const scoped_refptr<Counter>& mismatch_counter) {
   const auto& ownToken = consensus.GetRaftRpcToken();
   if (!ownToken && !req->has_raft_rpc_token()) {
     // Empty on both, nothing to enforce
-    return true;
+    return Status::OK();
   }
 
   if (ownToken && req->has_raft_rpc_token() &&
       *ownToken == req->raft_rpc_token()) {
     // Tokens match
-    return true;
+    return Status::OK();
   }
 
   mismatch_counter->Increment();
@@ -274,16 +323,28 @@ bool CheckRaftRpcTokenOrRespond(
     KLOG_EVERY_N_SECS(WARNING, 300)
         << method_name
         << ": Token mismatch ignored: " << std::move(error_message);
-    return true;
+    return Status::OK();
   }
 
   KLOG_EVERY_N_SECS(ERROR, 60)
       << method_name << ": Rejecting incoming RPC: " << error_message;
+  return Status::NotAuthorized(std::move(error_message));
+}
+
+template <class ReqType, class RespType>
+bool CheckRaftRpcTokenOrRespond(
+    const std::string& method_name,
+    const ReqType* req,
+    RespType resp,
+    rpc::RpcContext* context,
+    const consensus::RaftConsensus& consensus,
+    const scoped_refptr<Counter>& mismatch_counter) {
+  Status s = CheckRaftRpcToken(method_name, req, consensus, mismatch_counter);
+  if (PREDICT_TRUE(s.ok())) {
+    return true;
+  }
   SetupErrorAndRespond(
-      resp->mutable_error(),
-      Status::NotAuthorized(std::move(error_message)),
-      ServerErrorPB::RING_TOKEN_MISMATCH,
-      context);
+      resp->mutable_error(), s, ServerErrorPB::RING_TOKEN_MISMATCH, context);
   return false;
 }
 
@@ -318,6 +379,75 @@ BindHandleResponse(const ReqType* req, RespType* resp, RpcContext* context) {
       std::placeholders::_1);
 }
 
+// The requests of a ProxyFanoutUpdateConsensus() batch which have yet to
+// respond. The batch is responded to once the last one does.
+class ProxyFanout {
+ public:
+  ProxyFanout(int num_requests, RpcContext* context)
+      : num_pending_(num_requests), context_(context) {}
+
+  // Called once per request of the batch.
+  void RequestDone() {
+    if (num_pending_.fetch_sub(1) == 1) {
+      context_->RespondSuccess();
+    }
+  }
+
+  RpcContext* context() const {
+    return context_;
+  }
+
+ private:
+  std::atomic<int> num_pending_;
+  RpcContext* const context_;
+};
+
+// Responds to one request of a ProxyFanoutUpdateConsensus() batch by filling
+// in its response in the batch. Failures become the response's error, so the
+// other requests of the batch still get through.
+class FanoutProxyResponder : public consensus::ProxyResponder {
+ public:
+  FanoutProxyResponder(
+      shared_ptr<ProxyFanout> fanout,
+      ConsensusResponsePB* response)
+      : fanout_(std::move(fanout)), response_(response) {}
+
+  MonoTime GetClientDeadline() const override {
+    return fanout_->context()->GetClientDeadline();
+  }
+
+  string requestor_string() const override {
+    return fanout_->context()->requestor_string();
+  }
+
+  void RespondSuccess() override {
+    fanout_->RequestDone();
+  }
+
+  void RespondNoCache() override {
+    fanout_->RequestDone();
+  }
+
+  void RespondFailure(const Status& status) override {
+    RespondError(status);
+  }
+
+  void RespondTooBusy(const Status& status) override {
+    RespondError(status);
+  }
+
+ private:
+  void RespondError(const Status& status) {
+    response_->Clear();
+    StatusToPB(status, response_->mutable_error()->mutable_status());
+    response_->mutable_error()->set_code(ServerErrorPB::UNKNOWN_ERROR);
+    fanout_->RequestDone();
+  }
+
+  const shared_ptr<ProxyFanout> fanout_;
+  ConsensusResponsePB* const response_;
+};
+
 } // namespace
 
 template <class ReqType, class RespType>
@@ -343,10 +473,68 @@ ConsensusServiceImpl::ConsensusServiceImpl(
       tablet_manager_(tablet_manager),
       request_rpc_token_mismatches_(
           server->metric_entity()->FindOrCreateCounter(
-              &METRIC_raft_rpc_token_num_request_mismatches)) {}
+              &METRIC_raft_rpc_token_num_request_mismatches)),
+      inbound_memory_rejections_(
+          server->metric_entity()->FindOrCreateCounter(
+              &METRIC_consensus_inbound_memory_rejections)),
+      inbound_mem_tracker_(MemTracker::FindOrCreateGlobalTracker(
+          FLAGS_consensus_inbound_memory_limit_mb > 0
+              ? FLAGS_consensus_inbound_memory_limit_mb * 1024 * 1024
+              : -1,
+          "consensus_inbound")) {
+  // Let the heartbeats skip the service queue (see --rpc_inline_dispatch).
+  auto iter = methods_by_name_.find("UpdateConsensus");
+  if (iter != methods_by_name_.end()) {
+    iter->second->run_inline = [this](const google::protobuf::Message* req) {
+      return IsInlineHeartbeat(static_cast<const ConsensusRequestPB*>(req));
+    };
+  }
+
+  // Keep Raft liveness ahead of bulk and administrative calls in the service
+  // queue (see LifoServiceQueue).
+  for (const char* method :
+       {"UpdateConsensus", "RequestConsensusVote", "RunLeaderElection"}) {
+    iter = methods_by_name_.find(method);
+    if (iter != methods_by_name_.end()) {
+      iter->second->priority = rpc::RPC_PRIORITY_HIGH;
+    }
+  }
+  for (const char* method :
+       {"ChangeConfig",
+        "BulkChangeConfig",
+        "UnsafeChangeConfig",
+        "ChangeProxyTopology",
+        "GetConsensusState",
+        "ListLogSegments",
+        "FetchLogSegment",
+        "StartTabletCopy"}) {
+    iter = methods_by_name_.find(method);
+    if (iter != methods_by_name_.end()) {
+      iter->second->priority = rpc::RPC_PRIORITY_LOW;
+    }
+  }
+}
 
 ConsensusServiceImpl::~ConsensusServiceImpl() {}
 
+bool ConsensusServiceImpl::IsInlineHeartbeat(const ConsensusRequestPB* req) {
+  if (req->ops_size() > 0) {
+    return false;
+  }
+  shared_ptr<RaftConsensus> consensus =
+      tablet_manager_.shared_consensus(req->tablet_id());
+  if (!consensus || consensus->IsProxyRequest(req)) {
+    return false;
+  }
+  // A heartbeat from the leader we already follow, in our current term,
+  // neither persists anything nor waits on the log, unless it has to queue
+  // behind another update or wait for the ops of a pipelined one to be
+  // durable. Those are left to the service threads.
+  return req->caller_term() == consensus->CurrentTerm() &&
+      req->caller_uuid() == consensus->GetLeaderUuid() &&
+      consensus->CanUpdateWithoutWaiting();
+}
+
 bool ConsensusServiceImpl::AuthorizeServiceUser(
     const google::protobuf::Message* /*req*/,
     google::protobuf::Message* /*resp*/,
@@ -355,6 +543,11 @@ bool ConsensusServiceImpl::AuthorizeServiceUser(
       rpc, ServerBase::SUPER_USER | ServerBase::SERVICE_USER);
 }
 
+bool ConsensusServiceImpl::SupportsFeature(uint32_t feature) const {
+  return feature == consensus::CONSENSUS_PAYLOAD_SIDECARS ||
+      feature == consensus::CONSENSUS_COMPRESSED_OPS;
+}
+
 void ConsensusServiceImpl::UpdateConsensus(
     const ConsensusRequestPB* req,
     ConsensusResponsePB* resp,
@@ -386,13 +579,83 @@ void ConsensusServiceImpl::UpdateConsensus(
     return;
   }
 
+  // Like RaftConsensus::Update(), this modifies the request in place. The ops
+  // of requests to apply locally are parsed on an arena, which the ops taken
+  // by RaftConsensus keep alive: the ones left in the request aren't owned by
+  // it, and must be released before responding, which frees the request.
+  // Proxied requests are forwarded asynchronously, so their ops are allocated
+  // as usual.
+  //
+  // The leading ops which this replica already committed are duplicates, and
+  // are dropped before their payloads are copied, or even before they are
+  // parsed if they were compressed.
+  auto* mutable_req = const_cast<consensus::ConsensusRequestPB*>(req);
+  const bool is_proxy_request = consensus->IsProxyRequest(req);
+
+  // The request was received whole, and takes about as much memory again once
+  // restored, or its uncompressed size if its ops were compressed.
+  const int64_t request_bytes = context->GetTransferSize() +
+      std::max<int64_t>(
+          context->GetTransferSize(),
+          req->compressed_ops_uncompressed_size());
+  if (PREDICT_FALSE(!inbound_mem_tracker_->TryConsume(request_bytes))) {
+    inbound_memory_rejections_->Increment();
+    SetupErrorAndRespond(
+        resp->mutable_error(),
+        Status::ServiceUnavailable(Substitute(
+            "UpdateConsensus() requests being handled already take $0 of "
+            "the $1 bytes allowed",
+            inbound_mem_tracker_->consumption(),
+            inbound_mem_tracker_->limit())),
+        ServerErrorPB::UNKNOWN_ERROR,
+        context);
+    return;
+  }
+  SCOPED_CLEANUP({ inbound_mem_tracker_->Release(request_bytes); });
+
+  int64_t committed_index = -1;
+  if (!is_proxy_request && !req->ops().empty()) {
+    boost::optional<OpId> committed =
+        consensus->GetLastOpId(consensus::COMMITTED_OPID);
+    if (committed) {
+      committed_index = committed->index();
+    }
+  }
+  const bool compressed = req->has_compressed_ops_codec();
+  scoped_refptr<consensus::RefCountedArena> ops_arena;
+  Status restore_status = consensus::RestoreCompressedOps(
+      *context,
+      mutable_req,
+      is_proxy_request ? nullptr : &ops_arena,
+      committed_index);
+  if (restore_status.ok()) {
+    if (!compressed && committed_index >= 0) {
+      consensus::SkipCommittedOps(committed_index, mutable_req);
+    }
+    restore_status = consensus::RestorePayloadSidecars(*context, mutable_req);
+  }
+  if (PREDICT_FALSE(!restore_status.ok())) {
+    if (ops_arena) {
+      consensus::ReleaseArenaOps(mutable_req);
+    }
+    SetupErrorAndRespond(
+        resp->mutable_error(),
+        restore_status,
+        ServerErrorPB::UNKNOWN_ERROR,
+        context);
+    return;
+  }
+
   // Fast path for proxy requests.
-  if (consensus->IsProxyRequest(req)) {
+  if (is_proxy_request) {
     consensus->HandleProxyRequest(req, resp, context);
     return;
   }
 
-  Status s = consensus->Update(req, resp);
+  Status s = consensus->Update(req, resp, ops_arena);
+  if (ops_arena) {
+    consensus::ReleaseArenaOps(mutable_req);
+  }
   if (PREDICT_FALSE(!s.ok())) {
     // Clear the response first, since a partially-filled response could
     // result in confusing a caller, or in having missing required fields
@@ -403,9 +666,149 @@ void ConsensusServiceImpl::UpdateConsensus(
         resp->mutable_error(), s, ServerErrorPB::UNKNOWN_ERROR, context);
     return;
   }
+  resp->set_supports_compressed_ops(true);
   context->RespondSuccess();
 }
 
+void ConsensusServiceImpl::MultiRaftUpdateConsensus(
+    const consensus::MultiRaftConsensusRequestPB* req,
+    consensus::MultiRaftConsensusResponsePB* resp,
+    rpc::RpcContext* context) {
+  DVLOG(3) << "Received batch of " << req->consensus_requests_size()
+           << " heartbeats from " << context->requestor_string();
+  resp->mutable_consensus_responses()->Reserve(req->consensus_requests_size());
+  for (const ConsensusRequestPB& request : req->consensus_requests()) {
+    ConsensusResponsePB* response = resp->add_consensus_responses();
+    ServerErrorPB::Code code = ServerErrorPB::UNKNOWN_ERROR;
+    Status s = UpdateBatchedHeartbeat(request, response, &code);
+    if (PREDICT_FALSE(!s.ok())) {
+      StatusToPB(s, response->mutable_error()->mutable_status());
+      response->mutable_error()->set_code(code);
+    }
+  }
+  context->RespondSuccess();
+}
+
+void ConsensusServiceImpl::ProxyFanoutUpdateConsensus(
+    const consensus::MultiRaftConsensusRequestPB* req,
+    consensus::MultiRaftConsensusResponsePB* resp,
+    rpc::RpcContext* context) {
+  DVLOG(3) << "Received batch of " << req->consensus_requests_size()
+           << " proxy requests from " << context->requestor_string();
+  // The requests are forwarded asynchronously, and respond in any order:
+  // their responses must all be in place first.
+  const int num_requests = req->consensus_requests_size();
+  resp->mutable_consensus_responses()->Reserve(num_requests);
+  for (int i = 0; i < num_requests; i++) {
+    resp->add_consensus_responses();
+  }
+
+  // One more pending request for this loop, so that the batch isn't
+  // responded to before every request was dispatched.
+  auto fanout = std::make_shared<ProxyFanout>(num_requests + 1, context);
+  for (int i = 0; i < num_requests; i++) {
+    const ConsensusRequestPB& request = req->consensus_requests(i);
+    ConsensusResponsePB* response = resp->mutable_consensus_responses(i);
+    ServerErrorPB::Code code = ServerErrorPB::UNKNOWN_ERROR;
+    shared_ptr<RaftConsensus> consensus;
+    Status s = PrepareFanoutProxyRequest(request, response, &code, &consensus);
+    if (PREDICT_FALSE(!s.ok())) {
+      StatusToPB(s, response->mutable_error()->mutable_status());
+      response->mutable_error()->set_code(code);
+      fanout->RequestDone();
+      continue;
+    }
+    consensus->HandleProxyRequest(
+        &request,
+        response,
+        std::make_shared<FanoutProxyResponder>(fanout, response));
+  }
+  fanout->RequestDone();
+}
+
+Status ConsensusServiceImpl::PrepareFanoutProxyRequest(
+    const ConsensusRequestPB& req,
+    ConsensusResponsePB* resp,
+    ServerErrorPB::Code* code,
+    shared_ptr<RaftConsensus>* consensus) {
+  *consensus = tablet_manager_.shared_consensus(req.tablet_id());
+  if (!*consensus) {
+    *code = ServerErrorPB::CONSENSUS_NOT_RUNNING;
+    return Status::ServiceUnavailable(
+        "Raft Consensus unavailable", "Tablet replica not initialized");
+  }
+  // The ops of a proxy request are looked up in the local log, so they carry
+  // nothing to restore.
+  if (PREDICT_FALSE(
+          !(*consensus)->IsProxyRequest(&req) ||
+          req.has_compressed_ops_codec())) {
+    *code = ServerErrorPB::INVALID_CLIENT_REQUEST;
+    return Status::InvalidArgument(
+        "Fanned out requests must be uncompressed proxy requests");
+  }
+
+  if (auto ownToken = (*consensus)->GetRaftRpcToken()) {
+    resp->set_raft_rpc_token(*std::move(ownToken));
+  }
+  Status s = CheckRaftRpcToken(
+      "ProxyFanoutUpdateConsensus",
+      &req,
+      **consensus,
+      request_rpc_token_mismatches_);
+  if (PREDICT_FALSE(!s.ok())) {
+    *code = ServerErrorPB::RING_TOKEN_MISMATCH;
+  }
+  return s;
+}
+
+Status ConsensusServiceImpl::UpdateBatchedHeartbeat(
+    const ConsensusRequestPB& req,
+    ConsensusResponsePB* resp,
+    ServerErrorPB::Code* code) {
+  const string& local_uuid = tablet_manager_.NodeInstance().permanent_uuid();
+  if (PREDICT_FALSE(req.has_dest_uuid() && req.dest_uuid() != local_uuid)) {
+    *code = ServerErrorPB::WRONG_SERVER_UUID;
+    return Status::InvalidArgument(Substitute(
+        "MultiRaftUpdateConsensus: Wrong destination UUID requested. "
+        "Local UUID: $0. Requested UUID: $1",
+        local_uuid,
+        req.dest_uuid()));
+  }
+
+  shared_ptr<RaftConsensus> consensus =
+      tablet_manager_.shared_consensus(req.tablet_id());
+  if (!consensus) {
+    *code = ServerErrorPB::CONSENSUS_NOT_RUNNING;
+    return Status::ServiceUnavailable(
+        "Raft Consensus unavailable", "Tablet replica not initialized");
+  }
+  if (PREDICT_FALSE(req.ops_size() > 0 || consensus->IsProxyRequest(&req))) {
+    *code = ServerErrorPB::INVALID_CLIENT_REQUEST;
+    return Status::InvalidArgument(
+        "Batched requests must be heartbeats to the receiver");
+  }
+
+  if (auto ownToken = consensus->GetRaftRpcToken()) {
+    resp->set_raft_rpc_token(*std::move(ownToken));
+  }
+  Status s = CheckRaftRpcToken(
+      "MultiRaftUpdateConsensus",
+      &req,
+      *consensus,
+      request_rpc_token_mismatches_);
+  if (PREDICT_FALSE(!s.ok())) {
+    *code = ServerErrorPB::RING_TOKEN_MISMATCH;
+    return s;
+  }
+
+  s = consensus->Update(&req, resp);
+  if (PREDICT_FALSE(!s.ok())) {
+    // As in UpdateConsensus(), a partially-filled response is not returned.
+    resp->Clear();
+  }
+  return s;
+}
+
 void ConsensusServiceImpl::RequestConsensusVote(
     const VoteRequestPB* req,
     VoteResponsePB* resp,
@@ -705,6 +1108,81 @@ void ConsensusServiceImpl::GetLastOpId(
   context->RespondSuccess();
 }
 
+void ConsensusServiceImpl::ReadIndex(
+    const consensus::ReadIndexRequestPB* req,
+    consensus::ReadIndexResponsePB* resp,
+    rpc::RpcContext* context) {
+  DVLOG(3) << "Received ReadIndex RPC: " << SecureDebugString(*req);
+  if (!CheckUuidMatchOrRespond(
+          tablet_manager_, "ReadIndex", req, resp, context)) {
+    return;
+  }
+
+  shared_ptr<RaftConsensus> consensus;
+  if (!GetConsensusOrRespond(tablet_manager_, req, resp, context, &consensus))
+    return;
+  consensus->GetReadIndexAsync(
+      [resp, context](const Status& s, int64_t read_index) {
+        if (PREDICT_FALSE(!s.ok())) {
+          SetupErrorAndRespond(
+              resp->mutable_error(),
+              s,
+              s.IsIllegalState() ? ServerErrorPB::NOT_THE_LEADER
+                                 : ServerErrorPB::UNKNOWN_ERROR,
+              context);
+          return;
+        }
+        resp->set_read_index(read_index);
+        context->RespondSuccess();
+      });
+}
+
+void ConsensusServiceImpl::SubmitOps(
+    const SubmitOpsRequestPB* req,
+    SubmitOpsResponsePB* resp,
+    RpcContext* context) {
+  DVLOG(3) << "Received SubmitOps RPC with " << req->ops_size() << " ops";
+  if (!CheckUuidMatchOrRespond(
+          tablet_manager_, "SubmitOps", req, resp, context)) {
+    return;
+  }
+
+  shared_ptr<RaftConsensus> consensus;
+  if (!GetConsensusOrRespond(tablet_manager_, req, resp, context, &consensus))
+    return;
+  consensus->SubmitOpsAsync(
+      *req,
+      [consensus, resp, context](const Status& s, const vector<OpId>& ids) {
+        if (PREDICT_TRUE(s.ok())) {
+          for (const OpId& id : ids) {
+            *resp->add_op_ids() = id;
+          }
+          context->RespondSuccess();
+          return;
+        }
+        // Where the client should go instead.
+        consensus::ConsensusStatePB cstate;
+        if (consensus->ConsensusState(&cstate).ok()) {
+          resp->set_term(cstate.current_term());
+          const consensus::RaftConfigPB& config = cstate.has_pending_config()
+              ? cstate.pending_config()
+              : cstate.committed_config();
+          for (const auto& peer : config.peers()) {
+            if (!cstate.leader_uuid().empty() &&
+                peer.permanent_uuid() == cstate.leader_uuid()) {
+              *resp->mutable_leader() = peer;
+            }
+          }
+        }
+        SetupErrorAndRespond(
+            resp->mutable_error(),
+            s,
+            s.IsIllegalState() ? ServerErrorPB::NOT_THE_LEADER
+                               : ServerErrorPB::UNKNOWN_ERROR,
+            context);
+      });
+}
+
 void ConsensusServiceImpl::GetConsensusState(
     const consensus::GetConsensusStateRequestPB* /* req */,
     consensus::GetConsensusStateResponsePB* /* resp */,
@@ -749,5 +1227,395 @@ void ConsensusServiceImpl::GetConsensusState(
   context->RespondSuccess();
 }
 
+void ConsensusServiceImpl::GetHealthSummary(
+    const consensus::GetHealthSummaryRequestPB* req,
+    consensus::GetHealthSummaryResponsePB* resp,
+    rpc::RpcContext* context) {
+  DVLOG(3) << "Received GetHealthSummary RPC: " << SecureDebugString(*req);
+  if (!CheckUuidMatchOrRespond(
+          tablet_manager_, "GetHealthSummary", req, resp, context)) {
+    return;
+  }
+
+  vector<string> tablet_ids(req->tablet_ids().begin(), req->tablet_ids().end());
+  if (tablet_ids.empty()) {
+    tablet_manager_.GetTabletIds(&tablet_ids);
+  }
+  // A tablet manager hosting a single Raft group may not list it.
+  if (tablet_ids.empty() && req->tablet_ids().empty()) {
+    shared_ptr<RaftConsensus> consensus = tablet_manager_.shared_consensus();
+    if (consensus) {
+      tablet_ids.push_back(consensus->tablet_id());
+    }
+  }
+  for (const string& tablet_id : tablet_ids) {
+    shared_ptr<RaftConsensus> consensus =
+        tablet_manager_.shared_consensus(tablet_id);
+    if (!consensus) {
+      continue;
+    }
+    consensus::GetHealthSummaryResponsePB::TabletHealthSummaryPB tablet_info;
+    // Replicas which are not running are left out, like in
+    // GetConsensusState().
+    if (!consensus->GetHealthSummary(tablet_info.mutable_summary()).ok()) {
+      continue;
+    }
+    tablet_info.set_tablet_id(tablet_id);
+    *resp->add_tablets() = std::move(tablet_info);
+  }
+  context->RespondSuccess();
+}
+
+void ConsensusServiceImpl::InstallSnapshot(
+    const consensus::InstallSnapshotRequestPB* req,
+    consensus::InstallSnapshotResponsePB* resp,
+    rpc::RpcContext* context) {
+  // The chunk itself is not worth logging.
+  DVLOG(3) << "Received InstallSnapshot RPC for offset " << req->offset()
+           << " of snapshot " << req->snapshot().id();
+  if (!CheckUuidMatchOrRespond(
+          tablet_manager_, "InstallSnapshot", req, resp, context)) {
+    return;
+  }
+  shared_ptr<RaftConsensus> consensus;
+  if (!GetConsensusOrRespond(tablet_manager_, req, resp, context, &consensus))
+    return;
+  Status s = consensus->InstallSnapshot(req, resp);
+  if (PREDICT_FALSE(!s.ok())) {
+    HandleUnknownError(s, resp, context);
+    return;
+  }
+  context->RespondSuccess();
+}
+
+void ConsensusServiceImpl::ReadLogSubscription(
+    const consensus::ReadLogSubscriptionRequestPB* req,
+    consensus::ReadLogSubscriptionResponsePB* resp,
+    rpc::RpcContext* context) {
+  DVLOG(3) << "Received ReadLogSubscription RPC: " << SecureDebugString(*req);
+  if (!CheckUuidMatchOrRespond(
+          tablet_manager_, "ReadLogSubscription", req, resp, context)) {
+    return;
+  }
+  shared_ptr<RaftConsensus> consensus;
+  if (!GetConsensusOrRespond(tablet_manager_, req, resp, context, &consensus))
+    return;
+  LogSubscriptionManager* subscriptions = consensus->log_subscriptions();
+  if (!subscriptions) {
+    SetupErrorAndRespond(
+        resp->mutable_error(),
+        Status::ServiceUnavailable("Raft consensus is not started"),
+        ServerErrorPB::CONSENSUS_NOT_RUNNING,
+        context);
+    return;
+  }
+  resp->set_responder_uuid(tablet_manager_.NodeInstance().permanent_uuid());
+  if (req->unsubscribe()) {
+    Status s = subscriptions->Unsubscribe(req->subscriber());
+    if (PREDICT_FALSE(!s.ok())) {
+      HandleUnknownError(s, resp, context);
+      return;
+    }
+    context->RespondSuccess();
+    return;
+  }
+
+  // Subscribers over RPC are created by their first read.
+  Status s = subscriptions->Subscribe(req->subscriber(), req->after_index());
+  if (PREDICT_FALSE(!s.ok() && !s.IsAlreadyPresent())) {
+    HandleUnknownError(s, resp, context);
+    return;
+  }
+  vector<ReplicateRefPtr> ops;
+  int64_t committed_index;
+  s = subscriptions->Read(
+      req->subscriber(),
+      req->after_index(),
+      req->max_bytes(),
+      MonoDelta::FromMilliseconds(req->wait_ms()),
+      req->uncompressed(),
+      &ops,
+      &committed_index);
+  if (PREDICT_FALSE(!s.ok())) {
+    HandleUnknownError(s, resp, context);
+    return;
+  }
+  for (const ReplicateRefPtr& op : ops) {
+    resp->add_ops()->CopyFrom(*op->get());
+  }
+  resp->set_committed_index(committed_index);
+  context->RespondSuccess();
+}
+
+// Returns the log of 'consensus', or responds with an error if there is none
+// to copy segments from.
+template <class RespType>
+static scoped_refptr<log::Log> GetLogOrRespond(
+    const RaftConsensus& consensus,
+    RespType* resp,
+    rpc::RpcContext* context) {
+  scoped_refptr<log::Log> log = consensus.log();
+  if (!log || !log->reader()) {
+    SetupErrorAndRespond(
+        resp->mutable_error(),
+        Status::ServiceUnavailable("The log of the tablet is not open"),
+        ServerErrorPB::CONSENSUS_NOT_RUNNING,
+        context);
+    return nullptr;
+  }
+  return log;
+}
+
+void ConsensusServiceImpl::ListLogSegments(
+    const ListLogSegmentsRequestPB* req,
+    ListLogSegmentsResponsePB* resp,
+    rpc::RpcContext* context) {
+  DVLOG(3) << "Received ListLogSegments RPC: " << SecureDebugString(*req);
+  if (!CheckUuidMatchOrRespond(
+          tablet_manager_, "ListLogSegments", req, resp, context)) {
+    return;
+  }
+  shared_ptr<RaftConsensus> consensus;
+  if (!GetConsensusOrRespond(tablet_manager_, req, resp, context, &consensus)) {
+    return;
+  }
+  scoped_refptr<log::Log> log = GetLogOrRespond(*consensus, resp, context);
+  if (!log) {
+    return;
+  }
+
+  log::SegmentSequence segments;
+  Status s = log->reader()->GetSegmentsSnapshot(&segments);
+  if (PREDICT_FALSE(!s.ok())) {
+    HandleUnknownError(s, resp, context);
+    return;
+  }
+  for (const scoped_refptr<log::ReadableLogSegment>& segment : segments) {
+    // The segment being written to is left to replication.
+    if (!segment->HasFooter()) {
+      continue;
+    }
+    LogSegmentInfoPB* info = resp->add_segments();
+    info->set_sequence_number(segment->header().sequence_number());
+    info->set_size_bytes(segment->file_size());
+    if (segment->footer().has_min_replicate_index()) {
+      info->set_min_replicate_index(segment->footer().min_replicate_index());
+      info->set_max_replicate_index(segment->footer().max_replicate_index());
+    }
+  }
+  context->RespondSuccess();
+}
+
+void ConsensusServiceImpl::FetchLogSegment(
+    const FetchLogSegmentRequestPB* req,
+    FetchLogSegmentResponsePB* resp,
+    rpc::RpcContext* context) {
+  DVLOG(3) << "Received FetchLogSegment RPC: " << SecureDebugString(*req);
+  if (!CheckUuidMatchOrRespond(
+          tablet_manager_, "FetchLogSegment", req, resp, context)) {
+    return;
+  }
+  shared_ptr<RaftConsensus> consensus;
+  if (!GetConsensusOrRespond(tablet_manager_, req, resp, context, &consensus)) {
+    return;
+  }
+  scoped_refptr<log::Log> log = GetLogOrRespond(*consensus, resp, context);
+  if (!log) {
+    return;
+  }
+
+  scoped_refptr<log::ReadableLogSegment> segment =
+      log->reader()->GetSegmentBySequenceNumber(req->sequence_number());
+  if (!segment || !segment->HasFooter()) {
+    HandleUnknownError(
+        Status::NotFound(Substitute(
+            "No sealed log segment with sequence number $0",
+            req->sequence_number())),
+        resp,
+        context);
+    return;
+  }
+  const int64_t size = segment->file_size();
+  if (req->offset() < 0 || req->offset() > size) {
+    HandleUnknownError(
+        Status::InvalidArgument(Substitute(
+            "Offset $0 is out of log segment $1 of $2 bytes",
+            req->offset(),
+            req->sequence_number(),
+            size)),
+        resp,
+        context);
+    return;
+  }
+
+  int64_t length =
+      std::min<int64_t>(size - req->offset(), FLAGS_wal_copy_max_chunk_bytes);
+  if (req->has_max_length()) {
+    length = std::min(length, std::max<int64_t>(req->max_length(), 0));
+  }
+  unique_ptr<faststring> data(new faststring());
+  data->resize(length);
+  Status s = segment->readable_file()->Read(
+      req->offset(), Slice(data->data(), length));
+  if (PREDICT_FALSE(!s.ok())) {
+    HandleUnknownError(s, resp, context);
+    return;
+  }
+  resp->set_data_crc32(crc::Crc32c(data->data(), data->size()));
+  resp->set_size_bytes(size);
+
+  int idx;
+  s = context->AddOutboundSidecar(
+      RpcSidecar::FromFaststring(std::move(data)), &idx);
+  if (PREDICT_FALSE(!s.ok())) {
+    HandleUnknownError(s, resp, context);
+    return;
+  }
+  resp->set_data_sidecar_idx(idx);
+  context->RespondSuccess();
+}
+
+template <class RespType>
+static void RespondTabletAdminResult(
+    const Status& s,
+    RespType* resp,
+    RpcContext* context) {
+  if (s.ok()) {
+    context->RespondSuccess();
+    return;
+  }
+  ServerErrorPB::Code code = ServerErrorPB::UNKNOWN_ERROR;
+  if (s.IsNotFound()) {
+    code = ServerErrorPB::TABLET_NOT_FOUND;
+  } else if (s.IsAlreadyPresent()) {
+    code = ServerErrorPB::TABLET_ALREADY_EXISTS;
+  } else if (s.IsInvalidArgument()) {
+    code = ServerErrorPB::INVALID_CLIENT_REQUEST;
+  } else if (s.IsIllegalState()) {
+    code = ServerErrorPB::ALREADY_INPROGRESS;
+  }
+  SetupErrorAndRespond(resp->mutable_error(), s, code, context);
+}
+
+TabletServiceAdminImpl::TabletServiceAdminImpl(
+    ServerBase* server,
+    TabletManagerIf& tablet_manager)
+    : TabletServerAdminServiceIf(
+          server->metric_entity(),
+          server->result_tracker()),
+      server_(server),
+      tablet_manager_(tablet_manager) {}
+
+bool TabletServiceAdminImpl::AuthorizeServiceUser(
+    const google::protobuf::Message* /*req*/,
+    google::protobuf::Message* /*resp*/,
+    rpc::RpcContext* rpc) {
+  return server_->Authorize(
+      rpc, ServerBase::SUPER_USER | ServerBase::SERVICE_USER);
+}
+
+void TabletServiceAdminImpl::CreateTablet(
+    const CreateTabletRequestPB* req,
+    CreateTabletResponsePB* resp,
+    rpc::RpcContext* context) {
+  DVLOG(3) << "Received CreateTablet RPC: " << SecureDebugString(*req);
+  if (!CheckUuidMatchOrRespondGeneric(
+          tablet_manager_, "CreateTablet", req, resp, context)) {
+    return;
+  }
+  Status s = tablet_manager_.CreateTablet(
+      req->tablet_id(), req->has_config() ? &req->config() : nullptr);
+  RespondTabletAdminResult(s, resp, context);
+}
+
+void TabletServiceAdminImpl::DeleteTablet(
+    const DeleteTabletRequestPB* req,
+    DeleteTabletResponsePB* resp,
+    rpc::RpcContext* context) {
+  DVLOG(3) << "Received DeleteTablet RPC: " << SecureDebugString(*req);
+  if (!CheckUuidMatchOrRespondGeneric(
+          tablet_manager_, "DeleteTablet", req, resp, context)) {
+    return;
+  }
+  RespondTabletAdminResult(
+      tablet_manager_.DeleteTablet(req->tablet_id()), resp, context);
+}
+
+void TabletServiceAdminImpl::ListTablets(
+    const ListTabletsRequestPB* req,
+    ListTabletsResponsePB* resp,
+    rpc::RpcContext* context) {
+  if (!CheckUuidMatchOrRespondGeneric(
+          tablet_manager_, "ListTablets", req, resp, context)) {
+    return;
+  }
+  vector<string> tablet_ids;
+  tablet_manager_.GetTabletIds(&tablet_ids);
+  for (string& tablet_id : tablet_ids) {
+    resp->add_tablet_ids(std::move(tablet_id));
+  }
+  context->RespondSuccess();
+}
+
+void TabletServiceAdminImpl::Profile(
+    const ProfileRequestPB* req,
+    ProfileResponsePB* resp,
+    rpc::RpcContext* context) {
+  if (!CheckUuidMatchOrRespondGeneric(
+          tablet_manager_, "Profile", req, resp, context)) {
+    return;
+  }
+  LOG(INFO) << "Collecting " << ProfileRequestPB::ProfileType_Name(req->type())
+            << " profile for " << req->duration_ms() << "ms on behalf of "
+            << context->requestor_string();
+  MonoDelta duration = MonoDelta::FromMilliseconds(req->duration_ms());
+  int64_t dropped_samples = 0;
+  Status s;
+  switch (req->type()) {
+    case ProfileRequestPB::CPU:
+      s = CollectCpuProfile(
+          duration,
+          req->frequency_hz(),
+          resp->mutable_profile(),
+          &dropped_samples);
+      break;
+    case ProfileRequestPB::WAIT:
+      s = CollectWaitProfile(
+          duration,
+          req->include_idle_waits(),
+          resp->mutable_profile(),
+          &dropped_samples);
+      break;
+    case ProfileRequestPB::LOCKS:
+      s = CollectLockProfile(duration, resp->mutable_profile());
+      break;
+  }
+  if (s.ok()) {
+    resp->set_dropped_samples(dropped_samples);
+  } else {
+    resp->clear_profile();
+  }
+  RespondTabletAdminResult(s, resp, context);
+}
+
+void TabletServiceAdminImpl::GetConsensusStatus(
+    const GetConsensusStatusRequestPB* req,
+    GetConsensusStatusResponsePB* resp,
+    rpc::RpcContext* context) {
+  if (!CheckUuidMatchOrRespondGeneric(
+          tablet_manager_, "GetConsensusStatus", req, resp, context)) {
+    return;
+  }
+  shared_ptr<RaftConsensus> consensus;
+  if (!GetConsensusOrRespond(tablet_manager_, req, resp, context, &consensus)) {
+    return;
+  }
+  std::ostringstream html;
+  consensus->DumpStatusHtml(html);
+  resp->set_status_html(html.str());
+  resp->set_peer_health_history_json(consensus->PeerHealthHistoryJson());
+  context->RespondSuccess();
+}
+
 } // namespace tserver
 } // namespace kudu
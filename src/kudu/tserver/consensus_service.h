@@ -18,8 +18,11 @@
 #define KUDU_TSERVER_TABLET_SERVICE_H
 
 #include <cstdint>
+#include <memory>
 #include <string>
 
+#include <gtest/gtest_prod.h>
+
 #include "kudu/consensus/consensus.service.h"
 #include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/gutil/port.h"
@@ -33,6 +36,7 @@ class Message;
 
 namespace kudu {
 
+class MemTracker;
 class Status;
 
 namespace server {
@@ -47,12 +51,25 @@ class ConsensusRequestPB;
 class ConsensusResponsePB;
 class GetConsensusStateRequestPB;
 class GetConsensusStateResponsePB;
+class GetHealthSummaryRequestPB;
+class GetHealthSummaryResponsePB;
 class GetLastOpIdRequestPB;
 class GetLastOpIdResponsePB;
 class GetNodeInstanceRequestPB;
 class GetNodeInstanceResponsePB;
+class InstallSnapshotRequestPB;
+class InstallSnapshotResponsePB;
 class LeaderStepDownRequestPB;
 class LeaderStepDownResponsePB;
+class MultiRaftConsensusRequestPB;
+class MultiRaftConsensusResponsePB;
+class FetchLogSegmentRequestPB;
+class FetchLogSegmentResponsePB;
+class ListLogSegmentsRequestPB;
+class ListLogSegmentsResponsePB;
+class RaftConsensus;
+class ReadLogSubscriptionRequestPB;
+class ReadLogSubscriptionResponsePB;
 class RunLeaderElectionRequestPB;
 class RunLeaderElectionResponsePB;
 class StartTabletCopyRequestPB;
@@ -70,6 +87,14 @@ class RpcContext;
 
 namespace tserver {
 
+class CreateTabletRequestPB;
+class CreateTabletResponsePB;
+class DeleteTabletRequestPB;
+class DeleteTabletResponsePB;
+class GetConsensusStatusRequestPB;
+class GetConsensusStatusResponsePB;
+class ListTabletsRequestPB;
+class ListTabletsResponsePB;
 class TabletManagerIf;
 
 class ConsensusServiceImpl : public consensus::ConsensusServiceIf {
@@ -85,11 +110,23 @@ class ConsensusServiceImpl : public consensus::ConsensusServiceIf {
       google::protobuf::Message* resp,
       rpc::RpcContext* context) override;
 
+  bool SupportsFeature(uint32_t feature) const override;
+
   virtual void UpdateConsensus(
       const consensus::ConsensusRequestPB* req,
       consensus::ConsensusResponsePB* resp,
       rpc::RpcContext* context) override;
 
+  void MultiRaftUpdateConsensus(
+      const consensus::MultiRaftConsensusRequestPB* req,
+      consensus::MultiRaftConsensusResponsePB* resp,
+      rpc::RpcContext* context) override;
+
+  void ProxyFanoutUpdateConsensus(
+      const consensus::MultiRaftConsensusRequestPB* req,
+      consensus::MultiRaftConsensusResponsePB* resp,
+      rpc::RpcContext* context) override;
+
   virtual void RequestConsensusVote(
       const consensus::VoteRequestPB* req,
       consensus::VoteResponsePB* resp,
@@ -135,16 +172,120 @@ class ConsensusServiceImpl : public consensus::ConsensusServiceIf {
       consensus::GetLastOpIdResponsePB* resp,
       rpc::RpcContext* context) override;
 
+  virtual void ReadIndex(
+      const consensus::ReadIndexRequestPB* req,
+      consensus::ReadIndexResponsePB* resp,
+      rpc::RpcContext* context) override;
+
+  virtual void SubmitOps(
+      const consensus::SubmitOpsRequestPB* req,
+      consensus::SubmitOpsResponsePB* resp,
+      rpc::RpcContext* context) override;
+
   virtual void GetConsensusState(
       const consensus::GetConsensusStateRequestPB* req,
       consensus::GetConsensusStateResponsePB* resp,
       rpc::RpcContext* context) override;
 
+  virtual void GetHealthSummary(
+      const consensus::GetHealthSummaryRequestPB* req,
+      consensus::GetHealthSummaryResponsePB* resp,
+      rpc::RpcContext* context) override;
+
+  virtual void InstallSnapshot(
+      const consensus::InstallSnapshotRequestPB* req,
+      consensus::InstallSnapshotResponsePB* resp,
+      rpc::RpcContext* context) override;
+
+  virtual void ReadLogSubscription(
+      const consensus::ReadLogSubscriptionRequestPB* req,
+      consensus::ReadLogSubscriptionResponsePB* resp,
+      rpc::RpcContext* context) override;
+
+  virtual void ListLogSegments(
+      const consensus::ListLogSegmentsRequestPB* req,
+      consensus::ListLogSegmentsResponsePB* resp,
+      rpc::RpcContext* context) override;
+
+  virtual void FetchLogSegment(
+      const consensus::FetchLogSegmentRequestPB* req,
+      consensus::FetchLogSegmentResponsePB* resp,
+      rpc::RpcContext* context) override;
+
  private:
+  FRIEND_TEST(TSTabletManagerTest, TestInlineHeartbeats);
+
+  // Returns true if 'req' is a heartbeat cheap enough to be handled on the
+  // reactor thread which received it.
+  bool IsInlineHeartbeat(const consensus::ConsensusRequestPB* req);
+
+  // Applies one heartbeat of a MultiRaftUpdateConsensus() batch. Unlike
+  // UpdateConsensus(), this returns an error, along with its code in 'code',
+  // instead of failing the RPC.
+  Status UpdateBatchedHeartbeat(
+      const consensus::ConsensusRequestPB& req,
+      consensus::ConsensusResponsePB* resp,
+      consensus::ServerErrorPB::Code* code);
+
+  // Checks one request of a ProxyFanoutUpdateConsensus() batch, and looks up
+  // the Raft group it is addressed to. As UpdateBatchedHeartbeat(), returns
+  // an error along with its code in 'code'.
+  Status PrepareFanoutProxyRequest(
+      const consensus::ConsensusRequestPB& req,
+      consensus::ConsensusResponsePB* resp,
+      consensus::ServerErrorPB::Code* code,
+      std::shared_ptr<consensus::RaftConsensus>* consensus);
+
   server::ServerBase* server_;
   TabletManagerIf& tablet_manager_;
 
   scoped_refptr<Counter> request_rpc_token_mismatches_;
+  scoped_refptr<Counter> inbound_memory_rejections_;
+
+  // Tracks the memory taken by the UpdateConsensus() requests being handled,
+  // up to --consensus_inbound_memory_limit_mb.
+  std::shared_ptr<MemTracker> inbound_mem_tracker_;
+};
+
+class TabletServiceAdminImpl : public TabletServerAdminServiceIf {
+ public:
+  TabletServiceAdminImpl(
+      server::ServerBase* server,
+      TabletManagerIf& tablet_manager);
+
+  bool AuthorizeServiceUser(
+      const google::protobuf::Message* req,
+      google::protobuf::Message* resp,
+      rpc::RpcContext* context) override;
+
+  void CreateTablet(
+      const CreateTabletRequestPB* req,
+      CreateTabletResponsePB* resp,
+      rpc::RpcContext* context) override;
+
+  void DeleteTablet(
+      const DeleteTabletRequestPB* req,
+      DeleteTabletResponsePB* resp,
+      rpc::RpcContext* context) override;
+
+  void ListTablets(
+      const ListTabletsRequestPB* req,
+      ListTabletsResponsePB* resp,
+      rpc::RpcContext* context) override;
+
+  void Profile(
+      const ProfileRequestPB* req,
+      ProfileResponsePB* resp,
+      rpc::RpcContext* context) override;
+
+  void GetConsensusStatus(
+      const GetConsensusStatusRequestPB* req,
+      GetConsensusStatusResponsePB* resp,
+      rpc::RpcContext* context) override;
+
+ private:
+  server::ServerBase* server_;
+  TabletManagerIf& tablet_manager_;
 };
 
 } // namespace tserver
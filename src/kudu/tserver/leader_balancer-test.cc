@@ -0,0 +1,241 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/tserver/leader_balancer.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/common/wire_protocol.pb.h"
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/metadata.pb.h"
+#include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/raft_consensus.h"
+#include "kudu/gutil/casts.h"
+#include "kudu/gutil/map-util.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/tserver/simple_tablet_manager.h"
+#include "kudu/tserver/tablet_server.h"
+#include "kudu/tserver/tablet_server_options.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/oid_generator.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_bool(enable_leader_failure_detection);
+DECLARE_bool(leader_balancer_enabled);
+DECLARE_int32(leader_balancer_max_moves_per_round);
+
+METRIC_DECLARE_counter(leader_balancer_moves);
+METRIC_DECLARE_gauge_int64(leader_balancer_leader_count_skew);
+
+using kudu::consensus::ConsensusRequestPB;
+using kudu::consensus::ConsensusResponsePB;
+using kudu::consensus::RaftConfigPB;
+using kudu::consensus::RaftConsensus;
+using kudu::consensus::RaftPeerPB;
+using std::map;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace tserver {
+
+namespace {
+
+// Hosts a chosen set of Raft groups, rather than all of those of a server.
+class FakeTabletManager : public TabletManagerIf {
+ public:
+  const NodeInstancePB& NodeInstance() const override {
+    return instance_;
+  }
+  shared_ptr<RaftConsensus> shared_consensus(
+      const string& tablet_id) const override {
+    return FindWithDefault(groups_, tablet_id, nullptr);
+  }
+  Status Init(bool /* is_first_run */) override {
+    return Status::OK();
+  }
+  Status Start(bool /* is_first_run */) override {
+    return Status::OK();
+  }
+  bool IsInitialized() const override {
+    return true;
+  }
+  void Shutdown() override {}
+
+  void GetTabletIds(vector<string>* tablet_ids) const override {
+    tablet_ids->clear();
+    for (const auto& entry : groups_) {
+      tablet_ids->push_back(entry.first);
+    }
+  }
+
+  void AddGroup(const string& tablet_id, shared_ptr<RaftConsensus> consensus) {
+    groups_[tablet_id] = std::move(consensus);
+  }
+
+ private:
+  NodeInstancePB instance_;
+  map<string, shared_ptr<RaftConsensus>> groups_;
+};
+
+} // anonymous namespace
+
+// Runs balancing rounds over groups of three voters, the local server and two
+// which do not exist, whose leaders the test picks.
+class LeaderBalancerTest : public KuduTest {
+ protected:
+  void SetUp() override {
+    KuduTest::SetUp();
+    // Only the test decides who leads.
+    FLAGS_enable_leader_failure_detection = false;
+
+    TabletServerOptions opts;
+    opts.fs_opts.wal_root = GetTestPath("ts");
+    opts.fs_opts.data_roots = {GetTestPath("ts")};
+    opts.rpc_opts.rpc_bind_addresses = "127.0.0.1:0";
+    server_.reset(new TabletServer(opts));
+    ASSERT_OK(server_->Init());
+    ASSERT_OK(server_->Start());
+    manager_ = down_cast<TSTabletManager*>(server_->tablet_manager());
+
+    config_ = manager_->shared_consensus()->CommittedConfig();
+    ASSERT_EQ(1, config_.peers_size());
+    local_uuid_ = config_.peers(0).permanent_uuid();
+    for (int i = 1; i <= 2; i++) {
+      RaftPeerPB* peer = config_.add_peers();
+      peer->CopyFrom(config_.peers(0));
+      peer->set_permanent_uuid(Substitute("peer-$0", i));
+      // Nothing listens there: transfers to these peers start, but never
+      // complete.
+      peer->mutable_last_known_addr()->set_port(i);
+    }
+
+    metric_entity_ =
+        METRIC_ENTITY_server.Instantiate(&metric_registry_, "balancer-test");
+    balancer_.reset(new LeaderBalancer(&tablet_manager_, metric_entity_));
+  }
+
+  void TearDown() override {
+    balancer_.reset();
+    if (server_) {
+      server_->Shutdown();
+    }
+    KuduTest::TearDown();
+  }
+
+  // Hosts a new group led by 'leader_uuid', which is the local server or one
+  // of the peers added to the config.
+  void AddGroup(const string& leader_uuid) {
+    const string tablet_id = oid_generator_.Next();
+    ASSERT_OK(manager_->CreateTablet(tablet_id, &config_));
+    shared_ptr<RaftConsensus> consensus = manager_->shared_consensus(tablet_id);
+    ASSERT_TRUE(consensus);
+    if (leader_uuid == local_uuid_) {
+      ASSERT_OK(consensus->EmulateElection());
+    } else {
+      // A heartbeat from the leader of term 1.
+      ConsensusRequestPB req;
+      req.set_caller_uuid(leader_uuid);
+      req.set_caller_term(1);
+      req.mutable_preceding_id()->CopyFrom(consensus::MinimumOpId());
+      req.set_committed_index(0);
+      req.set_all_replicated_index(0);
+      req.set_last_idx_appended_to_leader(0);
+      ConsensusResponsePB resp;
+      ASSERT_OK(consensus->Update(&req, &resp));
+      ASSERT_FALSE(resp.has_error()) << resp.ShortDebugString();
+    }
+    ASSERT_EQ(leader_uuid, consensus->GetLeaderUuid());
+    tablet_manager_.AddGroup(tablet_id, std::move(consensus));
+  }
+
+  int64_t Moves() {
+    return METRIC_leader_balancer_moves.Instantiate(metric_entity_)->value();
+  }
+
+  int64_t LeaderCountSkew() {
+    return METRIC_leader_balancer_leader_count_skew
+        .Instantiate(metric_entity_, 0)
+        ->value();
+  }
+
+  unique_ptr<TabletServer> server_;
+  TSTabletManager* manager_ = nullptr;
+  RaftConfigPB config_;
+  string local_uuid_;
+  ObjectIdGenerator oid_generator_;
+
+  FakeTabletManager tablet_manager_;
+  MetricRegistry metric_registry_;
+  scoped_refptr<MetricEntity> metric_entity_;
+  unique_ptr<LeaderBalancer> balancer_;
+};
+
+TEST_F(LeaderBalancerTest, TestMovesLeadershipOffSkewedServer) {
+  // The local server leads 3 groups, peer-1 leads 1 and peer-2 none.
+  for (int i = 0; i < 3; i++) {
+    NO_FATALS(AddGroup(local_uuid_));
+  }
+  NO_FATALS(AddGroup("peer-1"));
+
+  // Rounds only measure the skew while the balancer is off.
+  FLAGS_leader_balancer_enabled = false;
+  ASSERT_EQ(0, balancer_->RunRound());
+  ASSERT_EQ(3, LeaderCountSkew());
+
+  // The first move goes to the peer leading the fewest groups. Each move of a
+  // round counts as done for the next: after it, no peer leads more than one
+  // group fewer than the local server, so the round stops short of its limit.
+  FLAGS_leader_balancer_enabled = true;
+  FLAGS_leader_balancer_max_moves_per_round = 3;
+  ASSERT_EQ(1, balancer_->RunRound());
+  ASSERT_EQ(1, Moves());
+
+  // The group moved is cooling down, whether or not its transfer has ended
+  // by now, so another one is moved instead.
+  ASSERT_EQ(1, balancer_->RunRound());
+  ASSERT_EQ(2, Moves());
+}
+
+TEST_F(LeaderBalancerTest, TestBalancedServerKeepsLeadership) {
+  // The local server leads one group more than each of its peers, which is
+  // within --leader_balancer_leader_count_threshold.
+  NO_FATALS(AddGroup(local_uuid_));
+  NO_FATALS(AddGroup(local_uuid_));
+  NO_FATALS(AddGroup("peer-1"));
+  NO_FATALS(AddGroup("peer-2"));
+
+  FLAGS_leader_balancer_enabled = true;
+  FLAGS_leader_balancer_max_moves_per_round = 3;
+  ASSERT_EQ(0, balancer_->RunRound());
+  ASSERT_EQ(0, Moves());
+  ASSERT_EQ(1, LeaderCountSkew());
+}
+
+} // namespace tserver
+} // namespace kudu
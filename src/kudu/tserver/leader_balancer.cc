@@ -0,0 +1,420 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#include "kudu/tserver/leader_balancer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <boost/optional/optional.hpp>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/common/wire_protocol.h"
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/metadata.pb.h"
+#include "kudu/consensus/opid.pb.h"
+#include "kudu/consensus/quorum_util.h"
+#include "kudu/consensus/raft_config_index.h"
+#include "kudu/consensus/raft_consensus.h"
+#include "kudu/gutil/map-util.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/tserver/simple_tablet_manager.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/thread.h"
+
+DEFINE_bool(
+    leader_balancer_enabled,
+    false,
+    "Whether this server periodically transfers the leadership of the Raft "
+    "groups it leads to their other voters, so that the servers hosting "
+    "them lead about as many groups and take about as many writes.");
+TAG_FLAG(leader_balancer_enabled, experimental);
+TAG_FLAG(leader_balancer_enabled, runtime);
+
+DEFINE_int32(
+    leader_balancer_interval_ms,
+    60000,
+    "How often the leader balancer looks for leadership to move, in "
+    "milliseconds.");
+TAG_FLAG(leader_balancer_interval_ms, advanced);
+TAG_FLAG(leader_balancer_interval_ms, runtime);
+
+DEFINE_int32(
+    leader_balancer_max_moves_per_round,
+    1,
+    "The maximum number of leadership transfers the leader balancer starts "
+    "in one round.");
+TAG_FLAG(leader_balancer_max_moves_per_round, advanced);
+TAG_FLAG(leader_balancer_max_moves_per_round, runtime);
+
+DEFINE_int32(
+    leader_balancer_group_cooldown_ms,
+    300000,
+    "The minimum time between two leadership transfers of the same Raft "
+    "group by the leader balancer, in milliseconds.");
+TAG_FLAG(leader_balancer_group_cooldown_ms, advanced);
+TAG_FLAG(leader_balancer_group_cooldown_ms, runtime);
+
+DEFINE_int32(
+    leader_balancer_leader_count_threshold,
+    1,
+    "The leader balancer moves leadership to a peer when this server leads "
+    "more than this many groups more than the peer.");
+TAG_FLAG(leader_balancer_leader_count_threshold, advanced);
+TAG_FLAG(leader_balancer_leader_count_threshold, runtime);
+
+DEFINE_double(
+    leader_balancer_write_skew_threshold,
+    100.0,
+    "The leader balancer moves leadership to a peer leading no more groups "
+    "than this server when the groups this server leads commit more than "
+    "this many ops per second more than the peer's. Zero or less disables "
+    "balancing on writes.");
+TAG_FLAG(leader_balancer_write_skew_threshold, advanced);
+TAG_FLAG(leader_balancer_write_skew_threshold, runtime);
+
+DECLARE_bool(enable_flexi_raft);
+DECLARE_bool(raft_priority_elections);
+DECLARE_bool(raft_priority_leader_reclaim);
+
+METRIC_DEFINE_counter(
+    server,
+    leader_balancer_moves,
+    "Leader Balancer Moves",
+    kudu::MetricUnit::kOperations,
+    "Number of leadership transfers started by the leader balancer.");
+METRIC_DEFINE_counter(
+    server,
+    leader_balancer_failed_moves,
+    "Leader Balancer Failed Moves",
+    kudu::MetricUnit::kOperations,
+    "Number of leadership transfers by the leader balancer which could not "
+    "be started.");
+METRIC_DEFINE_gauge_int64(
+    server,
+    leader_balancer_leader_count_skew,
+    "Leader Balancer Leader Count Skew",
+    kudu::MetricUnit::kTablets,
+    "Difference between the largest and the smallest number of groups led "
+    "by a voter of the groups hosted here, as of the last balancing round.");
+METRIC_DEFINE_gauge_int64(
+    server,
+    leader_balancer_write_skew,
+    "Leader Balancer Write Skew",
+    kudu::MetricUnit::kOperations,
+    "Difference between the largest and the smallest number of ops "
+    "committed per second by the groups led by a voter of the groups hosted "
+    "here, as of the last balancing round.");
+
+using kudu::consensus::ElectionContext;
+using kudu::consensus::ElectionReason;
+using kudu::consensus::LeaderStepDownResponsePB;
+using kudu::consensus::RaftConfigIndex;
+using kudu::consensus::RaftConfigPB;
+using kudu::consensus::RaftConsensus;
+using kudu::consensus::RaftPeerPB;
+using std::shared_ptr;
+using std::string;
+using std::unordered_set;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace tserver {
+
+namespace {
+
+// A group led by this server, as seen by a balancing round.
+struct LedGroup {
+  string tablet_id;
+  shared_ptr<RaftConsensus> consensus;
+  RaftConfigPB config;
+  double write_rate;
+};
+
+template <class Value>
+Value MaxMinusMin(const std::map<string, Value>& values) {
+  if (values.empty()) {
+    return Value();
+  }
+  auto minmax = std::minmax_element(
+      values.begin(), values.end(), [](const auto& a, const auto& b) {
+        return a.second < b.second;
+      });
+  return minmax.second->second - minmax.first->second;
+}
+
+} // anonymous namespace
+
+LeaderBalancer::LeaderBalancer(
+    TabletManagerIf* tablet_manager,
+    const scoped_refptr<MetricEntity>& metric_entity)
+    : tablet_manager_(tablet_manager),
+      moves_(METRIC_leader_balancer_moves.Instantiate(metric_entity)),
+      failed_moves_(
+          METRIC_leader_balancer_failed_moves.Instantiate(metric_entity)),
+      leader_count_skew_(METRIC_leader_balancer_leader_count_skew.Instantiate(
+          metric_entity,
+          0)),
+      write_skew_(
+          METRIC_leader_balancer_write_skew.Instantiate(metric_entity, 0)),
+      shutdown_latch_(1) {}
+
+LeaderBalancer::~LeaderBalancer() {
+  Shutdown();
+}
+
+Status LeaderBalancer::Start() {
+  return Thread::Create(
+      "server",
+      "leader-balancer",
+      &LeaderBalancer::RunThread,
+      this,
+      &thread_);
+}
+
+void LeaderBalancer::Shutdown() {
+  shutdown_latch_.CountDown();
+  if (thread_) {
+    thread_->Join();
+    thread_.reset();
+  }
+}
+
+void LeaderBalancer::RunThread() {
+  while (!shutdown_latch_.WaitFor(MonoDelta::FromMilliseconds(
+      std::max(FLAGS_leader_balancer_interval_ms, 1)))) {
+    if (FLAGS_leader_balancer_enabled) {
+      RunRound();
+    }
+  }
+}
+
+int LeaderBalancer::RunRound() {
+  const MonoTime now = MonoTime::Now();
+  vector<string> tablet_ids;
+  tablet_manager_->GetTabletIds(&tablet_ids);
+
+  // The number of groups led by, and the ops per second committed by the
+  // groups led by, each voter of the hosted groups.
+  std::map<string, int> leader_counts;
+  std::map<string, double> write_loads;
+  vector<LedGroup> led;
+  string local_uuid;
+  unordered_set<string> live_ids;
+
+  for (const string& tablet_id : tablet_ids) {
+    shared_ptr<RaftConsensus> consensus =
+        tablet_manager_->shared_consensus(tablet_id);
+    if (!consensus || !consensus->IsRunning()) {
+      continue;
+    }
+    live_ids.insert(tablet_id);
+    local_uuid = consensus->peer_uuid();
+
+    GroupState& state = groups_[tablet_id];
+    double write_rate = 0;
+    boost::optional<consensus::OpId> committed =
+        consensus->GetLastOpId(consensus::COMMITTED_OPID);
+    if (committed) {
+      if (state.last_sample.Initialized() &&
+          state.last_committed_index >= 0 &&
+          committed->index() >= state.last_committed_index) {
+        double elapsed = (now - state.last_sample).ToSeconds();
+        if (elapsed > 0) {
+          write_rate =
+              (committed->index() - state.last_committed_index) / elapsed;
+        }
+      }
+      state.last_committed_index = committed->index();
+      state.last_sample = now;
+    }
+
+    string leader_uuid = consensus->GetLeaderUuid();
+    if (leader_uuid.empty()) {
+      continue;
+    }
+    RaftConfigPB config = consensus->CommittedConfig();
+    for (const RaftPeerPB& peer : config.peers()) {
+      if (peer.member_type() == RaftPeerPB::VOTER) {
+        leader_counts.emplace(peer.permanent_uuid(), 0);
+        write_loads.emplace(peer.permanent_uuid(), 0);
+      }
+    }
+    leader_counts[leader_uuid]++;
+    write_loads[leader_uuid] += write_rate;
+
+    if (leader_uuid == local_uuid &&
+        consensus->role() == RaftPeerPB::LEADER) {
+      led.push_back({tablet_id, std::move(consensus), std::move(config),
+                     write_rate});
+    }
+  }
+
+  // Forget the groups which are no longer hosted.
+  for (auto it = groups_.begin(); it != groups_.end();) {
+    if (!ContainsKey(live_ids, it->first)) {
+      it = groups_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  leader_count_skew_->set_value(MaxMinusMin(leader_counts));
+  write_skew_->set_value(std::llround(MaxMinusMin(write_loads)));
+
+  if (!FLAGS_leader_balancer_enabled || led.empty()) {
+    return 0;
+  }
+
+  const MonoDelta cooldown =
+      MonoDelta::FromMilliseconds(FLAGS_leader_balancer_group_cooldown_ms);
+  const double write_threshold = FLAGS_leader_balancer_write_skew_threshold;
+  // A peer of a lower election priority would hand the leadership back.
+  const bool keep_priority =
+      FLAGS_raft_priority_elections && FLAGS_raft_priority_leader_reclaim;
+  int moves = 0;
+  while (moves < FLAGS_leader_balancer_max_moves_per_round) {
+    // Pick the move which shrinks the leader count gap the most, breaking
+    // ties by how close it brings the two servers' write loads.
+    const int local_count = leader_counts[local_uuid];
+    const double local_load = write_loads[local_uuid];
+    int best_group = -1;
+    string best_target;
+    int best_count_gap = std::numeric_limits<int>::min();
+    double best_load_gap = std::numeric_limits<double>::max();
+
+    for (int i = 0; i < led.size(); i++) {
+      const LedGroup& group = led[i];
+      const GroupState& state = groups_[group.tablet_id];
+      if (state.last_move.Initialized() && now - state.last_move < cooldown) {
+        continue;
+      }
+      bool is_voter;
+      string local_quorum;
+      if (!GetRaftConfigMemberQuorumId(
+              local_uuid, group.config, &is_voter, &local_quorum)) {
+        continue;
+      }
+      const int32_t local_priority = keep_priority
+          ? RaftConfigIndex(group.config).ElectionPriority(local_uuid)
+          : 0;
+      for (const RaftPeerPB& peer : group.config.peers()) {
+        const string& uuid = peer.permanent_uuid();
+        if (uuid == local_uuid || peer.member_type() != RaftPeerPB::VOTER ||
+            (keep_priority &&
+             peer.attrs().election_priority() < local_priority)) {
+          continue;
+        }
+        if (FLAGS_enable_flexi_raft) {
+          string quorum;
+          if (!GetRaftConfigMemberQuorumId(
+                  uuid, group.config, &is_voter, &quorum) ||
+              quorum != local_quorum) {
+            continue;
+          }
+        }
+        int count_gap = local_count - FindOrDie(leader_counts, uuid);
+        double load_gap = local_load - FindOrDie(write_loads, uuid);
+        bool balances_count =
+            count_gap > FLAGS_leader_balancer_leader_count_threshold;
+        // Moving a group which commits less than the gap shrinks the gap,
+        // and moving it to a peer leading fewer groups keeps the leader
+        // counts at least as even.
+        bool balances_writes = write_threshold > 0 && count_gap >= 1 &&
+            load_gap > write_threshold && group.write_rate > 0 &&
+            group.write_rate < load_gap;
+        if (!balances_count && !balances_writes) {
+          continue;
+        }
+        double new_load_gap = std::fabs(load_gap - 2 * group.write_rate);
+        if (count_gap > best_count_gap ||
+            (count_gap == best_count_gap && new_load_gap < best_load_gap)) {
+          best_group = i;
+          best_target = uuid;
+          best_count_gap = count_gap;
+          best_load_gap = new_load_gap;
+        }
+      }
+    }
+    if (best_group < 0) {
+      break;
+    }
+
+    LedGroup group = std::move(led[best_group]);
+    led.erase(led.begin() + best_group);
+    groups_[group.tablet_id].last_move = now;
+
+    LOG(INFO) << Substitute(
+        "T $0 P $1: Leader balancer transferring leadership to $2 "
+        "(leading $3 groups at $4 ops/s vs $5 groups at $6 ops/s, "
+        "group at $7 ops/s)",
+        group.tablet_id,
+        local_uuid,
+        best_target,
+        local_count,
+        local_load,
+        leader_counts[best_target],
+        write_loads[best_target],
+        group.write_rate);
+    LeaderStepDownResponsePB resp;
+    Status s = group.consensus->TransferLeadership(
+        best_target,
+        nullptr,
+        ElectionContext(
+            ElectionReason::EXTERNAL_REQUEST,
+            std::chrono::system_clock::now()),
+        &resp);
+    // A replica which lost the leadership since this round began reports it
+    // in the response.
+    if (s.ok() && resp.has_error()) {
+      s = StatusFromPB(resp.error().status());
+    }
+    if (!s.ok()) {
+      failed_moves_->Increment();
+      LOG(WARNING) << Substitute(
+          "T $0 P $1: Leader balancer could not transfer leadership to $2: "
+          "$3",
+          group.tablet_id,
+          local_uuid,
+          best_target,
+          s.ToString());
+      continue;
+    }
+    moves_->Increment();
+    moves++;
+
+    // Assume the transfer succeeds so the next move of this round accounts
+    // for it. The next round sees the actual leaders.
+    leader_counts[local_uuid]--;
+    leader_counts[best_target]++;
+    write_loads[local_uuid] -= group.write_rate;
+    write_loads[best_target] += group.write_rate;
+  }
+  return moves;
+}
+
+} // namespace tserver
+} // namespace kudu
@@ -0,0 +1,98 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/countdown_latch.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+class Thread;
+
+namespace tserver {
+
+class TabletManagerIf;
+
+// Moves the leadership of the Raft groups hosted by this server to their
+// other voters so that every server leads about as many groups, and takes
+// about as many writes, as its peers.
+//
+// There is no central coordinator: each server looks at the leaders of the
+// groups it hosts, counts the groups led and the ops committed per second
+// by each of their voters, and hands the leadership of the groups it leads
+// to peers with fewer of them. A group is only handed to a voter in the
+// leader's own region (or quorum) when FlexiRaft is enabled, so that the
+// commit rule's quorum does not move. Moves are rate limited per round and
+// per group, and the resulting skew is exported as metrics.
+class LeaderBalancer {
+ public:
+  LeaderBalancer(
+      TabletManagerIf* tablet_manager,
+      const scoped_refptr<MetricEntity>& metric_entity);
+  ~LeaderBalancer();
+
+  // Starts the thread running the balancing rounds.
+  Status Start();
+
+  // Stops the balancing thread and waits for it to exit.
+  void Shutdown();
+
+  // Runs a single balancing round. Returns the number of leadership
+  // transfers started.
+  int RunRound();
+
+ private:
+  // What the balancer remembers of a hosted group between rounds.
+  struct GroupState {
+    // The committed index and when it was sampled, to derive the write rate.
+    int64_t last_committed_index = -1;
+    MonoTime last_sample;
+
+    // When the leadership of the group was last moved by the balancer.
+    MonoTime last_move;
+  };
+
+  void RunThread();
+
+  TabletManagerIf* const tablet_manager_;
+
+  // Only accessed by the balancing thread, or by RunRound() callers while
+  // the thread is not running.
+  std::unordered_map<std::string, GroupState> groups_;
+
+  scoped_refptr<Counter> moves_;
+  scoped_refptr<Counter> failed_moves_;
+  scoped_refptr<AtomicGauge<int64_t>> leader_count_skew_;
+  scoped_refptr<AtomicGauge<int64_t>> write_skew_;
+
+  CountDownLatch shutdown_latch_;
+  scoped_refptr<Thread> thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(LeaderBalancer);
+};
+
+} // namespace tserver
+} // namespace kudu
@@ -0,0 +1,311 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/tserver/simple_tablet_manager.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/none.hpp>
+#include <boost/optional/optional.hpp>
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/metadata.pb.h"
+#include "kudu/consensus/raft_consensus.h"
+#include "kudu/fs/fs_manager.h"
+#include "kudu/gutil/casts.h"
+#include "kudu/tserver/consensus_service.h"
+#include "kudu/tserver/tablet_server.h"
+#include "kudu/tserver/tablet_server_options.h"
+#include "kudu/util/async_util.h"
+#include "kudu/util/env.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/oid_generator.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_int32(num_tablets_to_open_simultaneously);
+
+using kudu::consensus::ConsensusRequestPB;
+using kudu::consensus::ConsensusRound;
+using kudu::consensus::ConsensusRoundHandler;
+using kudu::consensus::RaftConsensus;
+using kudu::consensus::RaftPeerPB;
+using std::map;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace kudu {
+namespace tserver {
+
+namespace {
+
+// Counts the consensus-only rounds of a single Raft group, such as the NO_OP
+// each leader replicates.
+class CountingRoundHandler : public ConsensusRoundHandler {
+ public:
+  Status StartFollowerTransaction(
+      const scoped_refptr<ConsensusRound>& /* round */) override {
+    return Status::OK();
+  }
+
+  Status StartConsensusOnlyRound(
+      const scoped_refptr<ConsensusRound>& /* round */) override {
+    return Status::OK();
+  }
+
+  void FinishConsensusOnlyRound(ConsensusRound* /* round */) override {
+    finished_++;
+  }
+
+  int finished() const {
+    return finished_;
+  }
+
+ private:
+  std::atomic<int> finished_{0};
+};
+
+} // anonymous namespace
+
+class TSTabletManagerTest : public KuduTest {
+ protected:
+  void TearDown() override {
+    if (server_) {
+      server_->Shutdown();
+    }
+    KuduTest::TearDown();
+  }
+
+  // Starts a single-node server on the test directory, which keeps its data
+  // across restarts.
+  void StartServer() {
+    ASSERT_OK(TryStartServer());
+  }
+
+  Status TryStartServer() {
+    TabletServerOptions opts;
+    opts.fs_opts.wal_root = GetTestPath("ts");
+    opts.fs_opts.data_roots = {GetTestPath("ts")};
+    opts.rpc_opts.rpc_bind_addresses = "127.0.0.1:0";
+    opts.round_handler_factory = [this](const string& tablet_id) {
+      return RoundHandler(tablet_id);
+    };
+    server_.reset(new TabletServer(opts));
+    RETURN_NOT_OK(server_->Init());
+    RETURN_NOT_OK(server_->Start());
+    manager_ = down_cast<TSTabletManager*>(server_->tablet_manager());
+    return Status::OK();
+  }
+
+  void StopServer() {
+    server_->Shutdown();
+    server_.reset();
+    manager_ = nullptr;
+    handlers_.clear();
+  }
+
+  void RestartServer() {
+    StopServer();
+    NO_FATALS(StartServer());
+  }
+
+  // The handler of each Raft group, made on demand. The handlers of a server
+  // are dropped once it is shut down.
+  CountingRoundHandler* RoundHandler(const string& tablet_id) {
+    std::lock_guard<simple_spinlock> l(handlers_lock_);
+    unique_ptr<CountingRoundHandler>& handler = handlers_[tablet_id];
+    if (!handler) {
+      handler.reset(new CountingRoundHandler());
+    }
+    return handler.get();
+  }
+
+  vector<string> TabletIds() const {
+    vector<string> ids;
+    manager_->GetTabletIds(&ids);
+    std::sort(ids.begin(), ids.end());
+    return ids;
+  }
+
+  // Waits for the single-node group 'tablet_id' to elect itself and commit
+  // its leader's NO_OP, through its own round handler.
+  void WaitForLeader(const string& tablet_id) {
+    shared_ptr<RaftConsensus> consensus = manager_->shared_consensus(tablet_id);
+    ASSERT_TRUE(consensus);
+    CountingRoundHandler* handler = RoundHandler(tablet_id);
+    ASSERT_EVENTUALLY([&]() {
+      ASSERT_EQ(RaftPeerPB::LEADER, consensus->role());
+      ASSERT_GT(handler->finished(), 0);
+    });
+  }
+
+  unique_ptr<TabletServer> server_;
+  TSTabletManager* manager_ = nullptr;
+
+  simple_spinlock handlers_lock_;
+  map<string, unique_ptr<CountingRoundHandler>> handlers_;
+};
+
+TEST_F(TSTabletManagerTest, TestCreateRestartAndDelete) {
+  NO_FATALS(StartServer());
+  const string& sys_id = TSTabletManager::kSysCatalogTabletId;
+  ASSERT_EQ(vector<string>({sys_id}), TabletIds());
+  NO_FATALS(WaitForLeader(sys_id));
+
+  ObjectIdGenerator oid_generator;
+  vector<string> ids = {oid_generator.Next(), oid_generator.Next()};
+  std::sort(ids.begin(), ids.end());
+  for (const string& id : ids) {
+    ASSERT_OK(manager_->CreateTablet(id, nullptr));
+    NO_FATALS(WaitForLeader(id));
+  }
+  vector<string> expected_ids = {sys_id, ids[0], ids[1]};
+  ASSERT_EQ(expected_ids, TabletIds());
+
+  // The hosted tablets are reloaded from their metadata and WAL, and elect
+  // themselves again, in a higher term.
+  const int64_t term_before = manager_->shared_consensus(ids[0])->CurrentTerm();
+  NO_FATALS(RestartServer());
+  ASSERT_EQ(expected_ids, TabletIds());
+  for (const string& id : ids) {
+    NO_FATALS(WaitForLeader(id));
+  }
+  ASSERT_GT(manager_->shared_consensus(ids[0])->CurrentTerm(), term_before);
+
+  // A deleted tablet is gone, and stays so after a restart.
+  ASSERT_OK(manager_->DeleteTablet(ids[0]));
+  ASSERT_FALSE(manager_->shared_consensus(ids[0]));
+  ASSERT_TRUE(manager_->DeleteTablet(ids[0]).IsNotFound());
+  expected_ids = {sys_id, ids[1]};
+  ASSERT_EQ(expected_ids, TabletIds());
+  NO_FATALS(RestartServer());
+  ASSERT_EQ(expected_ids, TabletIds());
+  NO_FATALS(WaitForLeader(ids[1]));
+
+  // Its id can be used again.
+  ASSERT_OK(manager_->CreateTablet(ids[0], nullptr));
+  NO_FATALS(WaitForLeader(ids[0]));
+}
+
+TEST_F(TSTabletManagerTest, TestParallelOpenAndStart) {
+  NO_FATALS(StartServer());
+  ObjectIdGenerator oid_generator;
+  vector<string> ids;
+  for (int i = 0; i < 8; i++) {
+    ids.push_back(oid_generator.Next());
+    ASSERT_OK(manager_->CreateTablet(ids.back(), nullptr));
+  }
+  for (const string& id : ids) {
+    NO_FATALS(WaitForLeader(id));
+  }
+
+  // More tablets than threads: each thread opens, then starts, several.
+  FLAGS_num_tablets_to_open_simultaneously = 3;
+  NO_FATALS(RestartServer());
+  ASSERT_EQ(ids.size() + 1, TabletIds().size());
+  for (const string& id : ids) {
+    NO_FATALS(WaitForLeader(id));
+  }
+
+  // A tablet which cannot be opened fails the startup, whichever thread
+  // opens it.
+  const string bad_id = ids[5];
+  const string cmeta_path =
+      server_->fs_manager()->GetConsensusMetadataPath(bad_id);
+  NO_FATALS(StopServer());
+  ASSERT_OK(WriteStringToFile(env_, "garbage", cmeta_path));
+  Status s = TryStartServer();
+  ASSERT_FALSE(s.ok());
+  ASSERT_STR_CONTAINS(s.ToString(), bad_id);
+}
+
+TEST_F(TSTabletManagerTest, TestInvalidTabletIds) {
+  NO_FATALS(StartServer());
+  const string id = ObjectIdGenerator().Next();
+  ASSERT_OK(manager_->CreateTablet(id, nullptr));
+  ASSERT_TRUE(manager_->CreateTablet(id, nullptr).IsAlreadyPresent());
+  ASSERT_TRUE(manager_->CreateTablet(TSTabletManager::kSysCatalogTabletId,
+                                     nullptr)
+                  .IsAlreadyPresent());
+  ASSERT_TRUE(manager_->DeleteTablet(TSTabletManager::kSysCatalogTabletId)
+                  .IsInvalidArgument());
+
+  // Ids which are not canonical object ids could be mistaken for the other
+  // files of the consensus metadata directory at startup.
+  string upper_case = id;
+  std::transform(
+      upper_case.begin(), upper_case.end(), upper_case.begin(), ::toupper);
+  for (const string& bad_id :
+       {string(""), string("foo"), id + ".drt", upper_case, id.substr(1)}) {
+    SCOPED_TRACE(bad_id);
+    ASSERT_TRUE(manager_->CreateTablet(bad_id, nullptr).IsInvalidArgument());
+  }
+  ASSERT_EQ(2U, TabletIds().size());
+}
+
+// Tests that a heartbeat is only handled on the reactor thread when it won't
+// wait on another update or on the log.
+TEST_F(TSTabletManagerTest, TestInlineHeartbeats) {
+  NO_FATALS(StartServer());
+  const string& sys_id = TSTabletManager::kSysCatalogTabletId;
+  NO_FATALS(WaitForLeader(sys_id));
+  shared_ptr<RaftConsensus> consensus = manager_->shared_consensus(sys_id);
+  ConsensusServiceImpl service(server_.get(), *manager_);
+
+  // The single replica follows itself.
+  ConsensusRequestPB req;
+  req.set_tablet_id(sys_id);
+  req.set_caller_uuid(consensus->peer_uuid());
+  req.set_caller_term(consensus->CurrentTerm());
+  ASSERT_TRUE(service.IsInlineHeartbeat(&req));
+
+  {
+    std::lock_guard<simple_mutexlock> l(consensus->update_lock_);
+    ASSERT_FALSE(service.IsInlineHeartbeat(&req));
+  }
+  {
+    std::lock_guard<simple_mutexlock> l(consensus->update_lock_);
+    consensus->pipelined_log_append_ = Synchronizer();
+  }
+  ASSERT_FALSE(service.IsInlineHeartbeat(&req));
+  {
+    std::lock_guard<simple_mutexlock> l(consensus->update_lock_);
+    consensus->pipelined_log_append_ = boost::none;
+  }
+  ASSERT_TRUE(service.IsInlineHeartbeat(&req));
+
+  // Neither are requests with ops or from another term.
+  req.set_caller_term(consensus->CurrentTerm() + 1);
+  ASSERT_FALSE(service.IsInlineHeartbeat(&req));
+  req.set_caller_term(consensus->CurrentTerm());
+  req.add_ops();
+  ASSERT_FALSE(service.IsInlineHeartbeat(&req));
+}
+
+} // namespace tserver
+} // namespace kudu
@@ -17,7 +17,9 @@
 
 #include "kudu/tserver/simple_tablet_manager.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <ostream>
@@ -38,11 +40,16 @@
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/consensus_meta.h"
 #include "kudu/consensus/consensus_meta_manager.h"
+#include "kudu/consensus/consensus.proxy.h"
 #include "kudu/consensus/consensus_peers.h"
 #include "kudu/consensus/log.h"
 #include "kudu/consensus/log_anchor_registry.h"
+#include "kudu/consensus/log_gc_op.h"
+#include "kudu/consensus/log_recompression_op.h"
+#include "kudu/consensus/log_segment_copier.h"
 #include "kudu/consensus/log_util.h"
 #include "kudu/consensus/metadata.pb.h"
+#include "kudu/consensus/multi_raft_batcher.h"
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/consensus/opid_util.h"
 #include "kudu/consensus/persistent_vars.h"
@@ -51,6 +58,7 @@
 #include "kudu/consensus/proxy_policy.h"
 #include "kudu/consensus/quorum_util.h"
 #include "kudu/consensus/raft_consensus.h"
+#include "kudu/consensus/shared_log.h"
 #include "kudu/consensus/time_manager.h"
 #include "kudu/fs/data_dirs.h"
 #include "kudu/fs/fs_manager.h"
@@ -60,27 +68,80 @@
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/strings/join.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/sysinfo.h"
 #include "kudu/rpc/result_tracker.h"
+#include "kudu/tserver/leader_balancer.h"
 #include "kudu/tserver/tablet_server.h"
 #include "kudu/tserver/tablet_server_options.h"
 #include "kudu/util/debug/trace_event.h"
 #include "kudu/util/fault_injection.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
+#include "kudu/util/maintenance_manager.h"
+#include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/net/net_util.h"
 #include "kudu/util/net/sockaddr.h"
+#include "kudu/util/oid_generator.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/stopwatch.h"
 #include "kudu/util/threadpool.h"
 #include "kudu/util/trace.h"
 
+DEFINE_bool(
+    tablet_manager_shared_wal,
+    false,
+    "Whether the tablets hosted besides the system tablet keep their "
+    "entries in a WAL which they share, rather than in WALs of their own. "
+    "This saves an fsync per tablet on each group commit. Has no effect if "
+    "the server provides its own log factory.");
+TAG_FLAG(tablet_manager_shared_wal, experimental);
+
+DEFINE_int32(
+    num_tablets_to_open_simultaneously,
+    0,
+    "The number of hosted tablets opened, and then started, at the same time "
+    "during startup. If 0, the number of CPUs is used.");
+TAG_FLAG(num_tablets_to_open_simultaneously, advanced);
+
+DEFINE_bool(
+    tablet_manager_log_gc,
+    false,
+    "Whether the maintenance manager deletes the WAL segments which neither "
+    "the local replica nor its peers need anymore. Off by default, as the "
+    "applications embedding the server usually decide when logs may go. "
+    "Has no effect if the server provides its own log factory.");
+TAG_FLAG(tablet_manager_log_gc, experimental);
+
+METRIC_DEFINE_gauge_int64(
+    server,
+    startup_system_tablet_open_time,
+    "System Tablet Open Time At Startup",
+    kudu::MetricUnit::kMilliseconds,
+    "Time spent at startup loading the consensus state and opening the WAL "
+    "of the system tablet.");
+METRIC_DEFINE_gauge_int64(
+    server,
+    startup_hosted_tablets_open_time,
+    "Hosted Tablets Open Time At Startup",
+    kudu::MetricUnit::kMilliseconds,
+    "Time spent at startup loading the consensus state and opening the WALs "
+    "of the hosted tablets other than the system tablet.");
+METRIC_DEFINE_gauge_int64(
+    server,
+    startup_hosted_tablets_start_time,
+    "Hosted Tablets Start Time At Startup",
+    kudu::MetricUnit::kMilliseconds,
+    "Time spent at startup starting Raft for the hosted tablets other than "
+    "the system tablet.");
+
 DECLARE_bool(enable_flexi_raft);
 
 using std::set;
 using std::shared_ptr;
 using std::string;
+using std::unique_ptr;
 using std::vector;
 using strings::Substitute;
 
@@ -91,10 +152,14 @@ using consensus::ConsensusMetadataCreateMode;
 using consensus::ConsensusMetadataManager;
 using consensus::ConsensusOptions;
 using consensus::ConsensusRound;
+using consensus::ConsensusRoundHandler;
+using consensus::ConsensusServiceProxy;
 using consensus::ConsensusStatePB;
 using consensus::EXCLUDE_HEALTH_REPORT;
 using consensus::ITimeManager;
 using consensus::kMinimumTerm;
+using consensus::LogSegmentCopier;
+using consensus::MultiRaftManager;
 using consensus::OpId;
 using consensus::PeerProxyFactory;
 using consensus::PersistentVars;
@@ -105,14 +170,73 @@ using consensus::RaftPeerPB;
 using consensus::RpcPeerProxyFactory;
 using consensus::TimeManager;
 using consensus::TimeManagerDummy;
+using consensus::kInvalidOpIdIndex;
 using fs::DataDirManager;
 using log::Log;
 using log::LogOptions;
+using log::SharedLogFactory;
 using pb_util::SecureDebugString;
 using pb_util::SecureShortDebugString;
 
 namespace tserver {
 
+namespace {
+
+// Hosted tablets are found again at startup by their consensus metadata file,
+// so their ids must be valid file names which are not mistaken for the other
+// per-tablet files in the consensus metadata directory.
+bool IsCanonicalTabletId(const string& tablet_id) {
+  string canonicalized;
+  return ObjectIdGenerator().Canonicalize(tablet_id, &canonicalized).ok() &&
+      canonicalized == tablet_id;
+}
+
+// Calls 'fn' with each index in [0, 'n'), on up to
+// --num_tablets_to_open_simultaneously threads of a pool named 'pool_name'.
+// Returns the first failure in index order.
+Status ForEachTabletInParallel(
+    const string& pool_name,
+    int n,
+    const std::function<Status(int)>& fn) {
+  int num_threads = FLAGS_num_tablets_to_open_simultaneously > 0
+      ? FLAGS_num_tablets_to_open_simultaneously
+      : base::NumCPUs();
+  num_threads = std::min(num_threads, n);
+  if (num_threads <= 1) {
+    for (int i = 0; i < n; i++) {
+      RETURN_NOT_OK(fn(i));
+    }
+    return Status::OK();
+  }
+
+  vector<Status> statuses(n);
+  gscoped_ptr<ThreadPool> pool;
+  RETURN_NOT_OK(
+      ThreadPoolBuilder(pool_name).set_max_threads(num_threads).Build(&pool));
+  for (int i = 0; i < n; i++) {
+    const std::function<Status(int)>* f = &fn;
+    Status* status = &statuses[i];
+    RETURN_NOT_OK(pool->SubmitFunc([f, i, status]() { *status = (*f)(i); }));
+  }
+  pool->Wait();
+  for (const Status& s : statuses) {
+    RETURN_NOT_OK(s);
+  }
+  return Status::OK();
+}
+
+// Sets the startup time metric 'prototype' of 'entity' to the time elapsed
+// on 'sw'.
+void SetStartupTime(
+    const GaugePrototype<int64_t>& prototype,
+    const scoped_refptr<MetricEntity>& entity,
+    Stopwatch* sw) {
+  sw->stop();
+  prototype.Instantiate(entity, 0)->set_value(sw->elapsed().wall_millis());
+}
+
+} // anonymous namespace
+
 const std::string TSTabletManager::kSysCatalogTabletId(
     "00000000000000000000000000000000");
 
@@ -124,7 +248,11 @@ TSTabletManager::TSTabletManager(TabletServer* server)
       metric_registry_(server->metric_registry()),
       state_(MANAGER_INITIALIZING),
       mark_dirty_clbk_(
-          Bind(&TSTabletManager::MarkTabletDirty, Unretained(this))) {}
+          Bind(&TSTabletManager::MarkTabletDirty, Unretained(this))) {
+  if (FLAGS_tablet_manager_shared_wal && !server->opts().log_factory) {
+    shared_log_factory_ = std::make_shared<SharedLogFactory>();
+  }
+}
 
 TSTabletManager::~TSTabletManager() {
   // Close cannot be called from the destructor any more.
@@ -184,7 +312,18 @@ Status TSTabletManager::Load(FsManager* /* fs_manager */) {
     }
   }
 
-  return SetupRaft();
+  Stopwatch sw;
+  sw.start();
+  RETURN_NOT_OK(SetupRaft());
+  SetStartupTime(
+      METRIC_startup_system_tablet_open_time, server_->metric_entity(), &sw);
+
+  sw.start();
+  RETURN_NOT_OK(LoadHostedTablets());
+  SetStartupTime(
+      METRIC_startup_hosted_tablets_open_time, server_->metric_entity(), &sw);
+  LOG(INFO) << "Opened the hosted tablets in " << sw.elapsed().ToString();
+  return Status::OK();
 }
 
 Status TSTabletManager::CreateNew(FsManager* fs_manager) {
@@ -425,8 +564,10 @@ Status TSTabletManager::Start(bool is_first_run) {
   gscoped_ptr<PeerProxyFactory> peer_proxy_factory;
   scoped_refptr<ITimeManager> time_manager;
 
-  peer_proxy_factory.reset(
-      new RpcPeerProxyFactory(server_->messenger(), server_->metric_entity()));
+  multi_raft_manager_ =
+      std::make_shared<MultiRaftManager>(server_->messenger());
+  peer_proxy_factory.reset(new RpcPeerProxyFactory(
+      server_->messenger(), server_->metric_entity(), multi_raft_manager_));
 
   if (server_->opts().enable_time_manager) {
     // THIS IS OBVIOUSLY NOT CORRECT.
@@ -439,12 +580,6 @@ Status TSTabletManager::Start(bool is_first_run) {
     time_manager.reset(new TimeManagerDummy());
   }
 
-  ConsensusRoundHandler* round_handler = this;
-  // If round handler comes from server options then override it
-  if (server_->opts().round_handler) {
-    round_handler = server_->opts().round_handler;
-  }
-
   // We cannot hold 'lock_' while we call RaftConsensus::Start() because it
   // may invoke TabletReplica::StartFollowerTransaction() during startup,
   // causing a self-deadlock. We take a ref to members protected by 'lock_'
@@ -454,9 +589,11 @@ Status TSTabletManager::Start(bool is_first_run) {
       std::move(peer_proxy_factory),
       log_,
       std::move(time_manager),
-      round_handler,
+      RoundHandler(kSysCatalogTabletId),
       server_->metric_entity(),
       mark_dirty_clbk_));
+  RegisterLogMaintenanceOps(
+      log_, consensus_, server_->metric_entity(), &maintenance_ops_);
 
   for (consensus::ReplicateMsg* replicate :
        bootstrap_info_.orphaned_replicates) {
@@ -467,6 +604,27 @@ Status TSTabletManager::Start(bool is_first_run) {
   RETURN_NOT_OK_PREPEND(
       WaitUntilRunning(), "Failed waiting for the raft to run");
 
+  vector<shared_ptr<HostedTablet>> hosted;
+  {
+    shared_lock<RWMutex> l(lock_);
+    for (const auto& entry : tablet_map_) {
+      hosted.push_back(entry.second);
+    }
+  }
+  Stopwatch sw;
+  sw.start();
+  RETURN_NOT_OK(
+      ForEachTabletInParallel("tablet-start", hosted.size(), [&](int i) {
+        return StartHostedTablet(hosted[i]).CloneAndPrepend(
+            "Unable to start Raft for tablet " + hosted[i]->tablet_id);
+      }));
+  SetStartupTime(
+      METRIC_startup_hosted_tablets_start_time, server_->metric_entity(), &sw);
+
+  leader_balancer_.reset(new LeaderBalancer(this, server_->metric_entity()));
+  RETURN_NOT_OK_PREPEND(
+      leader_balancer_->Start(), "Unable to start the leader balancer");
+
   set_state(MANAGER_RUNNING);
   return Status::OK();
 }
@@ -490,6 +648,7 @@ Status TSTabletManager::SetupRaft() {
   ConsensusOptions options;
   options.tablet_id = kSysCatalogTabletId;
   options.proxy_policy = server_->opts().proxy_policy;
+  options.durability_mode = server_->opts().durability_mode;
   if (server_->opts().topology_config.has_initial_raft_rpc_token()) {
     options.initial_raft_rpc_token =
         server_->opts().topology_config.initial_raft_rpc_token();
@@ -533,6 +692,12 @@ Status TSTabletManager::SetupRaft() {
   scoped_refptr<ConsensusMetadata> cmeta;
   Status s = cmeta_manager_->LoadCMeta(kSysCatalogTabletId, &cmeta);
 
+  if (server_->is_first_run_ &&
+      server_->opts().wal_copy_source.has_permanent_uuid()) {
+    RETURN_NOT_OK_PREPEND(
+        CopyWalFromSource(), "Failed to copy the WAL from the source server");
+  }
+
   // Open the log, while passing in the factory class.
   // Factory could be empty.
   LogOptions log_options;
@@ -577,6 +742,310 @@ Status TSTabletManager::SetupRaft() {
   return s1;
 }
 
+Status TSTabletManager::CopyWalFromSource() {
+  const RaftPeerPB& source = server_->opts().wal_copy_source;
+  HostPort hostport;
+  RETURN_NOT_OK(HostPortFromPB(source.last_known_addr(), &hostport));
+  vector<Sockaddr> addrs;
+  RETURN_NOT_OK(hostport.ResolveAddresses(&addrs));
+  auto proxy = std::make_shared<ConsensusServiceProxy>(
+      server_->messenger(), addrs[0], hostport.host());
+
+  LOG(INFO) << LogPrefix(kSysCatalogTabletId)
+            << "Copying the WAL from " << SecureShortDebugString(source);
+  LogSegmentCopier copier(
+      fs_manager_,
+      kSysCatalogTabletId,
+      source.permanent_uuid(),
+      std::move(proxy));
+  int64_t last_index;
+  return copier.CopyAll(&last_index);
+}
+
+Status TSTabletManager::LoadHostedTablets() {
+  vector<string> children;
+  RETURN_NOT_OK_PREPEND(
+      fs_manager_->ListDir(fs_manager_->GetConsensusMetadataDir(), &children),
+      "Unable to list the consensus metadata directory");
+  vector<string> tablet_ids;
+  for (const string& child : children) {
+    // Skips the system tablet, the routing table and persistent vars files,
+    // and anything else which is not the consensus metadata of a tablet.
+    if (child != kSysCatalogTabletId && IsCanonicalTabletId(child)) {
+      tablet_ids.push_back(child);
+    }
+  }
+
+  // Opening a tablet reads its WAL, so the tablets are opened concurrently.
+  vector<shared_ptr<HostedTablet>> tablets(tablet_ids.size());
+  Status s =
+      ForEachTabletInParallel("tablet-open", tablet_ids.size(), [&](int i) {
+        return OpenHostedTablet(tablet_ids[i], /* recover= */ true, &tablets[i])
+            .CloneAndPrepend("Unable to open tablet " + tablet_ids[i]);
+      });
+
+  // The tablets which were opened are shut down along with the others.
+  std::lock_guard<RWMutex> lock(lock_);
+  for (int i = 0; i < static_cast<int>(tablet_ids.size()); i++) {
+    if (tablets[i]) {
+      InsertOrDie(&tablet_map_, tablet_ids[i], std::move(tablets[i]));
+    }
+  }
+  return s;
+}
+
+Status TSTabletManager::OpenHostedTablet(
+    const string& tablet_id,
+    bool recover,
+    shared_ptr<HostedTablet>* tablet) {
+  auto t = std::make_shared<HostedTablet>();
+  t->tablet_id = tablet_id;
+  t->metric_entity = METRIC_ENTITY_server.Instantiate(
+      metric_registry_, Substitute("kudu.tabletserver.$0", tablet_id));
+  t->metric_entity->SetAttribute("tablet_id", tablet_id);
+
+  if (!persistent_vars_manager_->PersistentVarsFileExists(tablet_id)) {
+    RETURN_NOT_OK_PREPEND(
+        persistent_vars_manager_->CreatePersistentVars(tablet_id),
+        "Unable to create persistent vars file for tablet " + tablet_id);
+  }
+
+  ConsensusOptions options;
+  options.tablet_id = tablet_id;
+  options.proxy_policy = server_->opts().proxy_policy;
+  options.durability_mode = server_->opts().durability_mode;
+  RETURN_NOT_OK(RaftConsensus::Create(
+      std::move(options),
+      local_peer_pb_,
+      cmeta_manager_,
+      persistent_vars_manager_,
+      server_->raft_pool(),
+      &t->consensus));
+  if (server_->opts().disable_noop) {
+    t->consensus->DisableNoOpEntries();
+  }
+
+  LogOptions log_options;
+  log_options.log_factory = server_->opts().log_factory;
+  if (shared_log_factory_) {
+    log_options.log_factory = shared_log_factory_;
+  }
+  RETURN_NOT_OK(Log::Open(
+      log_options, fs_manager_, tablet_id, t->metric_entity, &t->log));
+  if (recover) {
+    t->log->GetRecoveryInfo(&t->bootstrap_info);
+    if (t->bootstrap_info.last_id.term() > t->consensus->CurrentTerm()) {
+      t->consensus->SetCurrentTermBootstrap(t->bootstrap_info.last_id.term());
+    }
+  }
+  *tablet = std::move(t);
+  return Status::OK();
+}
+
+Status TSTabletManager::StartHostedTablet(
+    const shared_ptr<HostedTablet>& tablet) {
+  gscoped_ptr<PeerProxyFactory> peer_proxy_factory(new RpcPeerProxyFactory(
+      server_->messenger(), tablet->metric_entity, multi_raft_manager_));
+  scoped_refptr<ITimeManager> time_manager;
+  if (server_->opts().enable_time_manager) {
+    time_manager.reset(
+        new TimeManager(server_->clock(), Timestamp::kInitialTimestamp));
+  } else {
+    time_manager.reset(new TimeManagerDummy());
+  }
+  Status s = tablet->consensus->Start(
+      tablet->bootstrap_info,
+      std::move(peer_proxy_factory),
+      tablet->log,
+      std::move(time_manager),
+      RoundHandler(tablet->tablet_id),
+      tablet->metric_entity,
+      mark_dirty_clbk_);
+  for (consensus::ReplicateMsg* replicate :
+       tablet->bootstrap_info.orphaned_replicates) {
+    delete replicate;
+  }
+  tablet->bootstrap_info.orphaned_replicates.clear();
+  if (s.ok() && !shared_log_factory_) {
+    RegisterLogMaintenanceOps(
+        tablet->log,
+        tablet->consensus,
+        tablet->metric_entity,
+        &tablet->maintenance_ops);
+  }
+  return s;
+}
+
+ConsensusRoundHandler* TSTabletManager::RoundHandler(const string& tablet_id) {
+  const TabletServerOptions& opts = server_->opts();
+  ConsensusRoundHandler* handler = opts.round_handler_factory
+      ? opts.round_handler_factory(tablet_id)
+      : nullptr;
+  if (!handler) {
+    handler = opts.round_handler;
+  }
+  return handler ? handler : this;
+}
+
+void TSTabletManager::RegisterLogMaintenanceOps(
+    const scoped_refptr<log::Log>& log,
+    const shared_ptr<RaftConsensus>& consensus,
+    const scoped_refptr<MetricEntity>& metric_entity,
+    vector<unique_ptr<MaintenanceOp>>* ops) {
+  MaintenanceManager* manager = server_->maintenance_manager();
+  if (!manager || server_->opts().log_factory) {
+    return;
+  }
+  // Recompression is HIGH_IO_USAGE, so it backs off when the WAL syncs slow
+  // down, see --fs_wal_dir_maintenance_sync_latency_ms.
+  ops->emplace_back(new log::LogRecompressionOp(log, metric_entity));
+  if (FLAGS_tablet_manager_log_gc) {
+    ops->emplace_back(new log::LogGCOp(
+        log,
+        [consensus]() { return consensus->GetRetentionIndexes(); },
+        metric_entity));
+  }
+  for (const auto& op : *ops) {
+    manager->RegisterOp(op.get());
+  }
+}
+
+void TSTabletManager::UnregisterMaintenanceOps(
+    vector<unique_ptr<MaintenanceOp>>* ops) {
+  for (const auto& op : *ops) {
+    op->Unregister();
+  }
+  ops->clear();
+}
+
+shared_ptr<RaftConsensus> TSTabletManager::shared_consensus(
+    const string& tablet_id) const {
+  shared_lock<RWMutex> l(lock_);
+  if (tablet_id.empty() || tablet_id == kSysCatalogTabletId) {
+    return consensus_;
+  }
+  const shared_ptr<HostedTablet>* tablet = FindOrNull(tablet_map_, tablet_id);
+  return tablet ? (*tablet)->consensus : nullptr;
+}
+
+Status TSTabletManager::CreateTablet(
+    const string& tablet_id,
+    const RaftConfigPB* config) {
+  if (!IsCanonicalTabletId(tablet_id)) {
+    return Status::InvalidArgument("Invalid tablet id", tablet_id);
+  }
+  {
+    std::lock_guard<RWMutex> lock(lock_);
+    if (state_ != MANAGER_RUNNING) {
+      return Status::ServiceUnavailable(
+          "Tablet manager is not running",
+          TSTabletManagerStatePB_Name(state_));
+    }
+    if (tablet_id == kSysCatalogTabletId ||
+        ContainsKey(tablet_map_, tablet_id)) {
+      return Status::AlreadyPresent("Tablet is already hosted", tablet_id);
+    }
+    if (!InsertIfNotPresent(&transition_in_progress_, tablet_id)) {
+      return Status::IllegalState(
+          "Tablet is already being created or deleted", tablet_id);
+    }
+  }
+  SCOPED_CLEANUP({
+    std::lock_guard<RWMutex> lock(lock_);
+    transition_in_progress_.erase(tablet_id);
+  });
+
+  RaftConfigPB new_config = config ? *config : consensus_->CommittedConfig();
+  new_config.set_opid_index(kInvalidOpIdIndex);
+  RETURN_NOT_OK(consensus::VerifyRaftConfig(new_config));
+
+  LOG(INFO) << LogPrefix(tablet_id) << "Creating tablet with config "
+            << SecureShortDebugString(new_config);
+  RETURN_NOT_OK_PREPEND(
+      cmeta_manager_->CreateCMeta(tablet_id, new_config, kMinimumTerm),
+      "Unable to persist consensus metadata for tablet " + tablet_id);
+  RETURN_NOT_OK_PREPEND(
+      cmeta_manager_->CreateDRT(tablet_id, new_config, {}),
+      "Unable to create new durable routing table for tablet " + tablet_id);
+
+  shared_ptr<HostedTablet> tablet;
+  Status s = OpenHostedTablet(tablet_id, /* recover= */ false, &tablet);
+  if (s.ok()) {
+    s = StartHostedTablet(tablet);
+    if (s.ok()) {
+      std::lock_guard<RWMutex> lock(lock_);
+      if (state_ == MANAGER_RUNNING) {
+        InsertOrDie(&tablet_map_, tablet_id, std::move(tablet));
+        return Status::OK();
+      }
+      s = Status::ServiceUnavailable("Tablet manager shut down");
+    }
+    UnregisterMaintenanceOps(&tablet->maintenance_ops);
+    tablet->consensus->Shutdown();
+    WARN_NOT_OK(
+        tablet->log->Close(), LogPrefix(tablet_id) + "Error closing Log");
+  }
+  WARN_NOT_OK(
+      DeleteTabletData(tablet_id),
+      LogPrefix(tablet_id) + "Unable to clean up after failed creation");
+  return s.CloneAndPrepend("Unable to start Raft for tablet " + tablet_id);
+}
+
+Status TSTabletManager::DeleteTablet(const string& tablet_id) {
+  if (tablet_id == kSysCatalogTabletId) {
+    return Status::InvalidArgument("The system tablet cannot be deleted");
+  }
+  shared_ptr<HostedTablet> tablet;
+  {
+    std::lock_guard<RWMutex> lock(lock_);
+    if (ContainsKey(transition_in_progress_, tablet_id)) {
+      return Status::IllegalState(
+          "Tablet is already being created or deleted", tablet_id);
+    }
+    if (!FindCopy(tablet_map_, tablet_id, &tablet)) {
+      return Status::NotFound("Tablet is not hosted", tablet_id);
+    }
+    tablet_map_.erase(tablet_id);
+    InsertOrDie(&transition_in_progress_, tablet_id);
+  }
+  SCOPED_CLEANUP({
+    std::lock_guard<RWMutex> lock(lock_);
+    transition_in_progress_.erase(tablet_id);
+  });
+
+  LOG(INFO) << LogPrefix(tablet_id) << "Deleting tablet";
+  UnregisterMaintenanceOps(&tablet->maintenance_ops);
+  tablet->consensus->Shutdown();
+  RETURN_NOT_OK_PREPEND(tablet->log->Close(), "Unable to close the log");
+  return DeleteTabletData(tablet_id);
+}
+
+void TSTabletManager::GetTabletIds(vector<string>* tablet_ids) const {
+  tablet_ids->clear();
+  shared_lock<RWMutex> l(lock_);
+  tablet_ids->reserve(tablet_map_.size() + 1);
+  tablet_ids->push_back(kSysCatalogTabletId);
+  for (const auto& entry : tablet_map_) {
+    tablet_ids->push_back(entry.first);
+  }
+}
+
+Status TSTabletManager::DeleteTabletData(const string& tablet_id) {
+  // The WAL goes first: a tablet with consensus metadata but no WAL is still
+  // loaded at startup and can be deleted again.
+  RETURN_NOT_OK(Log::DeleteOnDiskData(fs_manager_, tablet_id));
+  if (shared_log_factory_) {
+    RETURN_NOT_OK(
+        shared_log_factory_->DeleteOnDiskData(fs_manager_, tablet_id));
+  }
+  RETURN_NOT_OK(persistent_vars_manager_->DeletePersistentVars(tablet_id));
+  Status s = cmeta_manager_->DeleteDRT(tablet_id);
+  if (!s.ok() && !s.IsNotFound()) {
+    return s;
+  }
+  return cmeta_manager_->DeleteCMeta(tablet_id);
+}
+
 void TSTabletManager::Shutdown() {
   {
     std::lock_guard<RWMutex> lock(lock_);
@@ -602,10 +1071,31 @@ void TSTabletManager::Shutdown() {
     }
   }
 
+  if (leader_balancer_) {
+    leader_balancer_->Shutdown();
+  }
+
+  UnregisterMaintenanceOps(&maintenance_ops_);
   if (consensus_)
     consensus_->Shutdown();
 
-  state_ = MANAGER_SHUTDOWN;
+  std::unordered_map<string, shared_ptr<HostedTablet>> hosted;
+  {
+    std::lock_guard<RWMutex> lock(lock_);
+    hosted.swap(tablet_map_);
+  }
+  for (const auto& entry : hosted) {
+    UnregisterMaintenanceOps(&entry.second->maintenance_ops);
+    entry.second->consensus->Shutdown();
+    WARN_NOT_OK(
+        entry.second->log->Close(),
+        LogPrefix(entry.first) + "Error closing Log");
+  }
+  if (shared_log_factory_) {
+    shared_log_factory_->Shutdown();
+  }
+
+  set_state(MANAGER_SHUTDOWN);
 }
 
 const NodeInstancePB& TSTabletManager::NodeInstance() const {
@@ -20,6 +20,7 @@
 #include <cstdint>
 #include <functional>
 #include <map>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -49,6 +50,7 @@ class optional;
 namespace kudu {
 
 class FsManager;
+class MaintenanceOp;
 class NodeInstancePB;
 class ThreadPool;
 class MonoDelta;
@@ -56,10 +58,12 @@ class MonoDelta;
 namespace log {
 
 class Log;
+class SharedLogFactory;
 }
 
 namespace consensus {
 class ConsensusMetadataManager;
+class MultiRaftManager;
 class OpId;
 class PersistentVarsManager;
 struct ElectionResult;
@@ -68,6 +72,7 @@ struct ElectionResult;
 namespace KC = kudu::consensus;
 
 namespace tserver {
+class LeaderBalancer;
 class TabletServer;
 struct TabletServerOptions;
 
@@ -81,6 +86,24 @@ class TabletManagerIf {
   virtual Status Start(bool is_first_run) = 0;
   virtual bool IsInitialized() const = 0;
   virtual void Shutdown() = 0;
+
+  // Hosts a new Raft group 'tablet_id' with the initial config 'config', or
+  // with the system tablet's peers if 'config' is null.
+  virtual Status CreateTablet(
+      const std::string& /* tablet_id */,
+      const consensus::RaftConfigPB* /* config */) {
+    return Status::NotSupported("Hosting more Raft groups is not supported");
+  }
+
+  // Stops hosting the Raft group 'tablet_id' and deletes its on-disk data.
+  virtual Status DeleteTablet(const std::string& /* tablet_id */) {
+    return Status::NotSupported("Hosting more Raft groups is not supported");
+  }
+
+  // Returns the ids of all hosted Raft groups.
+  virtual void GetTabletIds(std::vector<std::string>* tablet_ids) const {
+    tablet_ids->clear();
+  }
 };
 
 // Keeps track of the tablets hosted on the tablet server side.
@@ -132,11 +155,10 @@ class TSTabletManager : public TabletManagerIf,
   virtual Status StartConsensusOnlyRound(
       const scoped_refptr<consensus::ConsensusRound>& round) override;
 
+  // Returns the consensus of Raft group 'tablet_id', or null if it is not
+  // hosted here. An empty id refers to the system tablet.
   std::shared_ptr<consensus::RaftConsensus> shared_consensus(
-      const std::string& = "") const override {
-    shared_lock<RWMutex> l(lock_);
-    return consensus_;
-  }
+      const std::string& tablet_id = "") const override;
 
   consensus::RaftConsensus* consensus() {
     shared_lock<RWMutex> l(lock_);
@@ -146,7 +168,31 @@ class TSTabletManager : public TabletManagerIf,
   // Marks the tablet as dirty so that it's included in the next heartbeat.
   void MarkTabletDirty(const std::string& reason) {}
 
+  // Creates, starts and registers the Raft group 'tablet_id'. The group
+  // shares this server's messenger, Raft thread pool and WAL root with the
+  // system tablet, and gets a metric entity of its own.
+  Status CreateTablet(
+      const std::string& tablet_id,
+      const consensus::RaftConfigPB* config) override;
+
+  // Shuts down the Raft group 'tablet_id' and deletes its WAL and metadata.
+  // The system tablet cannot be deleted.
+  Status DeleteTablet(const std::string& tablet_id) override;
+
+  void GetTabletIds(std::vector<std::string>* tablet_ids) const override;
+
  private:
+  // A Raft group hosted next to the system tablet.
+  struct HostedTablet {
+    std::string tablet_id;
+    scoped_refptr<MetricEntity> metric_entity;
+    scoped_refptr<kudu::log::Log> log;
+    std::shared_ptr<consensus::RaftConsensus> consensus;
+    consensus::ConsensusBootstrapInfo bootstrap_info;
+    // Registered once the consensus is started.
+    std::vector<std::unique_ptr<MaintenanceOp>> maintenance_ops;
+  };
+
   // Standard log prefix, given a tablet id.
   static std::string LogPrefix(
       const std::string& tablet_id,
@@ -176,11 +222,49 @@ class TSTabletManager : public TabletManagerIf,
   // Create either a standalone or distributed config
   Status CreateNew(FsManager* fs_manager);
 
+  // Copies the sealed WAL segments of the tablet from
+  // TabletServerOptions::wal_copy_source into the empty local WAL directory.
+  Status CopyWalFromSource();
+
   // Helper function to create Raft consensus and log
   // Consensus is yet to be started at the end of this
   // call.
   Status SetupRaft();
 
+  // Opens the hosted tablets whose consensus metadata is on disk.
+  Status LoadHostedTablets();
+
+  // Creates the consensus and opens the log of the hosted tablet 'tablet_id',
+  // whose metadata must already exist. Recovers the log if 'recover' is set.
+  Status OpenHostedTablet(
+      const std::string& tablet_id,
+      bool recover,
+      std::shared_ptr<HostedTablet>* tablet);
+
+  // Starts the consensus of an opened hosted tablet.
+  Status StartHostedTablet(const std::shared_ptr<HostedTablet>& tablet);
+
+  // The round handler of the Raft group 'tablet_id', from the server options
+  // if they have one, or this manager otherwise.
+  consensus::ConsensusRoundHandler* RoundHandler(const std::string& tablet_id);
+
+  // Deletes the WAL and consensus metadata of the tablet 'tablet_id'.
+  Status DeleteTabletData(const std::string& tablet_id);
+
+  // Registers the maintenance ops of 'log', whose retention is decided by
+  // 'consensus', with the maintenance manager of the server, and adds them
+  // to 'ops'. Does nothing for the logs made by a log factory, which are
+  // maintained by whoever provided it.
+  void RegisterLogMaintenanceOps(
+      const scoped_refptr<log::Log>& log,
+      const std::shared_ptr<consensus::RaftConsensus>& consensus,
+      const scoped_refptr<MetricEntity>& metric_entity,
+      std::vector<std::unique_ptr<MaintenanceOp>>* ops);
+
+  // Unregisters and destroys 'ops', waiting for those running to finish.
+  static void UnregisterMaintenanceOps(
+      std::vector<std::unique_ptr<MaintenanceOp>>* ops);
+
   // Initializes the RaftPeerPB for the local peer.
   // Guaranteed to include both uuid and last_seen_addr fields.
   // Crashes with an invariant check if the RPC server is not currently in a
@@ -225,6 +309,12 @@ class TSTabletManager : public TabletManagerIf,
 
   TSTabletManagerStatePB state_;
 
+  // Raft groups hosted in addition to the system tablet, keyed by tablet id.
+  std::unordered_map<std::string, std::shared_ptr<HostedTablet>> tablet_map_;
+
+  // Ids of tablets which are being created or deleted.
+  std::unordered_set<std::string> transition_in_progress_;
+
   consensus::ConsensusBootstrapInfo bootstrap_info_;
 
   // Function to mark this TabletReplica's tablet as dirty in the
@@ -236,6 +326,22 @@ class TSTabletManager : public TabletManagerIf,
 
   std::shared_ptr<consensus::RaftConsensus> consensus_;
 
+  // The maintenance ops of the log of the system tablet.
+  std::vector<std::unique_ptr<MaintenanceOp>> maintenance_ops_;
+
+  // Lets the heartbeats of all hosted Raft groups to the same server share
+  // RPCs. Set in Start().
+  std::shared_ptr<consensus::MultiRaftManager> multi_raft_manager_;
+
+  // Keeps the WALs of the hosted tablets in a single shared log, if
+  // --tablet_manager_shared_wal is set and the server has no log factory of
+  // its own.
+  std::shared_ptr<log::SharedLogFactory> shared_log_factory_;
+
+  // Moves the leadership of the hosted groups between their voters when
+  // --leader_balancer_enabled is set. Started in Start().
+  std::unique_ptr<LeaderBalancer> leader_balancer_;
+
   DISALLOW_COPY_AND_ASSIGN(TSTabletManager);
 };
 
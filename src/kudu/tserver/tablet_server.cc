@@ -22,6 +22,7 @@
 #include <type_traits>
 #include <utility>
 
+#include <gflags/gflags_declare.h>
 #include <glog/logging.h>
 
 #ifdef FB_DO_NOT_REMOVE
@@ -30,6 +31,7 @@
 #include "kudu/consensus/consensus.service.h"
 #include "kudu/fs/error_manager.h"
 #include "kudu/fs/fs_manager.h"
+#include "kudu/fs/wal_dirs.h"
 #include "kudu/gutil/bind.h"
 #include "kudu/gutil/bind_helpers.h"
 #include "kudu/gutil/strings/substitute.h"
@@ -44,12 +46,14 @@
 #include "kudu/tserver/simple_tablet_manager.h"
 #ifdef FB_DO_NOT_REMOVE
 #include "kudu/tserver/tserver_path_handlers.h" // @manual
-#include "kudu/util/maintenance_manager.h" // @manual
 #endif
+#include "kudu/util/maintenance_manager.h"
 #include "kudu/util/net/net_util.h"
 #include "kudu/util/status.h"
 #include "kudu/util/thread.h"
 
+DECLARE_int32(maintenance_manager_num_threads);
+
 using kudu::fs::ErrorHandlerType;
 using kudu::rpc::ServiceIf;
 using std::string;
@@ -124,14 +128,23 @@ Status TabletServer::Init() {
   // Initialize FS, rpc_server, rpc messenger and Raft pool
   RETURN_NOT_OK(KuduServer::Init());
 
+  maintenance_manager_.reset(new MaintenanceManager(
+      MaintenanceManager::kDefaultOptions, fs_manager_->uuid()));
+  // Hold back the background work which competes with the WAL for I/O when
+  // the WAL syncs slow down.
+  fs::WalDirManager* wal_dirs = fs_manager_->wal_dir_manager();
+  if (wal_dirs) {
+    maintenance_manager_->set_high_io_budget_func([wal_dirs]() {
+      return wal_dirs->MaintenanceIOBudget(
+          FLAGS_maintenance_manager_num_threads);
+    });
+  }
+
 #ifdef FB_DO_NOT_REMOVE
   if (web_server_) {
     RETURN_NOT_OK(path_handlers_->Register(web_server_.get()));
   }
 
-  maintenance_manager_.reset(new MaintenanceManager(
-      MaintenanceManager::kDefaultOptions, fs_manager_->uuid()));
-
   heartbeater_.reset(new Heartbeater(opts_, this));
   RETURN_NOT_OK_PREPEND(
       scanner_manager_->StartRemovalThread(),
@@ -145,6 +158,9 @@ Status TabletServer::Init() {
   gscoped_ptr<ServiceIf> consensus_service(
       new ConsensusServiceImpl(this, *tablet_manager_));
   RETURN_NOT_OK(RegisterService(std::move(consensus_service)));
+  gscoped_ptr<ServiceIf> tablet_admin_service(
+      new TabletServiceAdminImpl(this, *tablet_manager_));
+  RETURN_NOT_OK(RegisterService(std::move(tablet_admin_service)));
   RETURN_NOT_OK(KuduServer::Start());
 
   // Moving tablet manager initialization to Init phase of
@@ -188,8 +204,8 @@ Status TabletServer::Start() {
   RETURN_NOT_OK(RegisterService(std::move(tablet_copy_service)));
 
   RETURN_NOT_OK(heartbeater_->Start());
-  RETURN_NOT_OK(maintenance_manager_->Start());
 #endif
+  RETURN_NOT_OK(maintenance_manager_->Start());
 
   if (!tablet_manager_->IsInitialized()) {
     return Status::IllegalState("Tablet manager is not initialized");
@@ -210,9 +226,9 @@ void TabletServer::Shutdown() {
     // 1. Stop accepting new RPCs.
     UnregisterAllServices();
 
-#ifdef FB_DO_NOT_REMOVE
     // 2. Shut down the tserver's subsystems.
     maintenance_manager_->Shutdown();
+#ifdef FB_DO_NOT_REMOVE
     WARN_NOT_OK(heartbeater_->Stop(), "Failed to stop TS Heartbeat thread");
     fs_manager_->UnsetErrorNotificationCb(ErrorHandlerType::DISK_ERROR);
     fs_manager_->UnsetErrorNotificationCb(ErrorHandlerType::CFILE_CORRUPTION);
@@ -32,9 +32,7 @@
 
 namespace kudu {
 
-#ifdef FB_DO_NOT_REMOVE
 class MaintenanceManager;
-#endif
 class ThreadPool;
 
 namespace tserver {
@@ -90,6 +88,10 @@ class TabletServer : public kserver::KuduServer {
     return opts_;
   }
 
+  MaintenanceManager* maintenance_manager() {
+    return maintenance_manager_.get();
+  }
+
 #ifdef FB_DO_NOT_REMOVE
   ScannerManager* scanner_manager() {
     return scanner_manager_.get();
@@ -106,11 +108,6 @@ class TabletServer : public kserver::KuduServer {
   bool fail_heartbeats_for_tests() const {
     return base::subtle::NoBarrier_Load(&fail_heartbeats_for_tests_);
   }
-
-  MaintenanceManager* maintenance_manager() {
-    return maintenance_manager_.get();
-  }
-
 #endif
 
   /*
@@ -158,6 +155,9 @@ class TabletServer : public kserver::KuduServer {
   // Manager for tablets which are available on this server.
   std::unique_ptr<TabletManagerIf> tablet_manager_;
 
+  // The maintenance manager for this tablet server
+  std::shared_ptr<MaintenanceManager> maintenance_manager_;
+
 #ifdef FB_DO_NOT_REMOVE
   // Manager for open scanners from clients.
   // This is always non-NULL. It is scoped only to minimize header
@@ -169,9 +169,6 @@ class TabletServer : public kserver::KuduServer {
 
   // Webserver path handlers
   gscoped_ptr<TabletServerPathHandlers> path_handlers_;
-
-  // The maintenance manager for this tablet server
-  std::shared_ptr<MaintenanceManager> maintenance_manager_;
 #endif
 
   DISALLOW_COPY_AND_ASSIGN(TabletServer);
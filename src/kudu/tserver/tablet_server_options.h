@@ -17,9 +17,12 @@
 #ifndef KUDU_TSERVER_TABLET_SERVER_OPTIONS_H
 #define KUDU_TSERVER_TABLET_SERVER_OPTIONS_H
 
+#include <functional>
 #include <memory>
+#include <string>
 #include <vector>
 
+#include "kudu/consensus/durability_mode.h"
 #include "kudu/consensus/leader_election.h"
 #include "kudu/consensus/metadata.pb.h"
 #include "kudu/consensus/proxy_policy.h"
@@ -64,9 +67,21 @@ struct TabletServerOptions : public kudu::server::ServerBaseOptions {
 
   kudu::consensus::ConsensusRoundHandler* round_handler = nullptr;
 
+  // If set, returns the round handler of the Raft group 'tablet_id', the
+  // system tablet or one made with TabletManagerIf::CreateTablet(), so that
+  // each group's rounds go to the state machine of that group. The handler
+  // must outlive the group. A null handler falls back to 'round_handler'.
+  std::function<kudu::consensus::ConsensusRoundHandler*(
+      const std::string& tablet_id)>
+      round_handler_factory;
+
   kudu::consensus::ProxyPolicy proxy_policy =
       kudu::consensus::ProxyPolicy::DURABLE_ROUTING_POLICY;
 
+  // When the ops are acked and committed, see durability_mode.h.
+  kudu::consensus::DurabilityMode durability_mode =
+      kudu::consensus::DurabilityMode::DURABLE;
+
   // Election Decision Callback
   std::function<
       void(const consensus::ElectionResult&, const consensus::ElectionContext&)>
@@ -89,6 +104,12 @@ struct TabletServerOptions : public kudu::server::ServerBaseOptions {
   // a certain opid and term.
   bool log_bootstrap_on_first_run = false;
 
+  // If it has a permanent_uuid, the sealed WAL segments of the tablet are
+  // copied from this server on the first run, before the log is opened, so
+  // that the new instance does not have to be sent all of them through Raft.
+  // See consensus::LogSegmentCopier.
+  KC::RaftPeerPB wal_copy_source;
+
   consensus::TopologyConfigPB topology_config;
 
   // Enables functionality provided by kudu::consensus::TimeManager
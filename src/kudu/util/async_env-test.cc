@@ -0,0 +1,251 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/async_env.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/array_view.h"
+#include "kudu/util/async_util.h"
+#include "kudu/util/countdown_latch.h"
+#include "kudu/util/env.h"
+#include "kudu/util/io_uring.h"
+#include "kudu/util/slice.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+
+namespace {
+
+// A WritableFile whose appends fail, counting the operations that reach it.
+class FailingWritableFile : public WritableFile {
+ public:
+  Status Append(const Slice& data) override {
+    return AppendV(ArrayView<const Slice>(&data, 1));
+  }
+  Status AppendV(ArrayView<const Slice> /* data */) override {
+    num_ops_++;
+    return Status::IOError("injected append failure");
+  }
+  Status PreAllocate(uint64_t /* size */) override {
+    return Status::OK();
+  }
+  Status Close() override {
+    return Status::OK();
+  }
+  Status Flush(FlushMode /* mode */) override {
+    return Status::OK();
+  }
+  Status Sync() override {
+    num_ops_++;
+    return Status::OK();
+  }
+  uint64_t Size() const override {
+    return 0;
+  }
+  const string& filename() const override {
+    return filename_;
+  }
+
+  int num_ops() const {
+    return num_ops_;
+  }
+
+ private:
+  const string filename_ = "failing";
+  std::atomic<int> num_ops_{0};
+};
+
+} // anonymous namespace
+
+class AsyncEnvTest : public KuduTest {
+ public:
+  void SetUp() override {
+    KuduTest::SetUp();
+    ASSERT_OK(AsyncEnv::Create("async-env-test", 4, &async_env_));
+  }
+
+ protected:
+  unique_ptr<AsyncEnv> async_env_;
+};
+
+TEST_F(AsyncEnvTest, TestOrderedWritesAndConcurrentReads) {
+  const int kNumChunks = 64;
+  const string kPath = GetTestPath("file");
+  unique_ptr<WritableFile> writer;
+  ASSERT_OK(env_->NewWritableFile(kPath, &writer));
+
+  // Issue all the appends and a final sync without waiting in between; the
+  // queue must apply them in order.
+  vector<string> chunks;
+  for (int i = 0; i < kNumChunks; i++) {
+    chunks.emplace_back(Substitute("chunk-$0;", 1000 + i));
+  }
+  {
+    unique_ptr<AsyncWriteQueue> queue = async_env_->NewWriteQueue();
+    std::atomic<int> num_failed(0);
+    for (const auto& chunk : chunks) {
+      queue->AppendV(writer.get(), {Slice(chunk)}, [&](const Status& s) {
+        if (!s.ok()) {
+          num_failed++;
+        }
+      });
+    }
+    Synchronizer sync;
+    queue->Sync(writer.get(), sync.AsStdStatusCallback());
+    ASSERT_OK(sync.Wait());
+    queue->Wait();
+    ASSERT_EQ(0, num_failed.load());
+  }
+  ASSERT_OK(writer->Close());
+
+  // Read every chunk back with all the reads in flight at once.
+  unique_ptr<RandomAccessFile> reader;
+  ASSERT_OK(env_->NewRandomAccessFile(kPath, &reader));
+  const size_t kChunkSize = chunks[0].size();
+  vector<unique_ptr<uint8_t[]>> bufs;
+  vector<Status> statuses(kNumChunks);
+  CountDownLatch latch(kNumChunks);
+  for (int i = 0; i < kNumChunks; i++) {
+    bufs.emplace_back(new uint8_t[kChunkSize]);
+    Status* status = &statuses[i];
+    async_env_->ReadV(
+        reader.get(),
+        i * kChunkSize,
+        {Slice(bufs.back().get(), kChunkSize)},
+        [status, &latch](const Status& s) {
+          *status = s;
+          latch.CountDown();
+        });
+  }
+  latch.Wait();
+  for (int i = 0; i < kNumChunks; i++) {
+    ASSERT_OK(statuses[i]);
+    ASSERT_EQ(chunks[i], Slice(bufs[i].get(), kChunkSize).ToString());
+  }
+
+  // A read past the end of the file fails through its callback.
+  uint8_t scratch[16];
+  Synchronizer sync;
+  async_env_->ReadV(
+      reader.get(),
+      kNumChunks * kChunkSize,
+      {Slice(scratch, sizeof(scratch))},
+      sync.AsStdStatusCallback());
+  ASSERT_FALSE(sync.Wait().ok());
+}
+
+TEST_F(AsyncEnvTest, TestWriteFailureIsSticky) {
+  FailingWritableFile file;
+  unique_ptr<AsyncWriteQueue> queue = async_env_->NewWriteQueue();
+  Synchronizer append_sync;
+  Synchronizer sync_sync;
+  queue->AppendV(&file, {Slice("a")}, append_sync.AsStdStatusCallback());
+  queue->Sync(&file, sync_sync.AsStdStatusCallback());
+  Status s = append_sync.Wait();
+  ASSERT_TRUE(s.IsIOError()) << s.ToString();
+
+  // The sync must not claim success for data that was never written, and
+  // must not even reach the file.
+  s = sync_sync.Wait();
+  ASSERT_TRUE(s.IsIOError()) << s.ToString();
+  queue->Wait();
+  ASSERT_EQ(1, file.num_ops());
+}
+
+TEST_F(AsyncEnvTest, TestIoUringReads) {
+  if (!IoUring::IsSupported()) {
+    LOG(INFO) << "io_uring not supported, skipping test";
+    return;
+  }
+  // Fewer reads fit in the ring than are issued, so that some go through the
+  // I/O threads.
+  const int kDepth = 8;
+  const int kNumChunks = 64;
+  unique_ptr<AsyncEnv> uring_env;
+  ASSERT_OK(AsyncEnv::Create("async-env-uring-test", 2, kDepth, &uring_env));
+  ASSERT_TRUE(uring_env->uses_io_uring());
+
+  const string kPath = GetTestPath("file");
+  string contents;
+  for (int i = 0; i < kNumChunks; i++) {
+    contents += Substitute("chunk-$0;", 1000 + i);
+  }
+  ASSERT_OK(WriteStringToFile(env_, contents, kPath));
+  unique_ptr<RandomAccessFile> reader;
+  ASSERT_OK(env_->NewRandomAccessFile(kPath, &reader));
+  ASSERT_GE(reader->fd(), 0);
+
+  // Each chunk is scattered over two buffers.
+  const size_t kChunkSize = contents.size() / kNumChunks;
+  const size_t kHead = 3;
+  vector<unique_ptr<uint8_t[]>> bufs;
+  vector<Status> statuses(kNumChunks);
+  std::atomic<int> num_done(0);
+  for (int i = 0; i < kNumChunks; i++) {
+    bufs.emplace_back(new uint8_t[kChunkSize]);
+    uint8_t* buf = bufs.back().get();
+    Status* status = &statuses[i];
+    uring_env->ReadV(
+        reader.get(),
+        i * kChunkSize,
+        {Slice(buf, kHead), Slice(buf + kHead, kChunkSize - kHead)},
+        [status, &num_done](const Status& s) {
+          *status = s;
+          num_done++;
+        });
+  }
+  // Wait() covers the reads issued through io_uring too.
+  uring_env->Wait();
+  ASSERT_EQ(kNumChunks, num_done.load());
+  for (int i = 0; i < kNumChunks; i++) {
+    ASSERT_OK(statuses[i]);
+    ASSERT_EQ(
+        contents.substr(i * kChunkSize, kChunkSize),
+        Slice(bufs[i].get(), kChunkSize).ToString());
+  }
+
+  // A read running past the end of the file comes back short, and the rest
+  // of it fails as RandomAccessFile::ReadV() does.
+  uint8_t scratch[16];
+  Synchronizer sync;
+  uring_env->ReadV(
+      reader.get(),
+      contents.size() - 4,
+      {Slice(scratch, sizeof(scratch))},
+      sync.AsStdStatusCallback());
+  Status s = sync.Wait();
+  ASSERT_TRUE(s.IsEndOfFile()) << s.ToString();
+  ASSERT_EQ(contents.substr(contents.size() - 4), Slice(scratch, 4).ToString());
+}
+
+} // namespace kudu
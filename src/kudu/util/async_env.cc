@@ -0,0 +1,291 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/async_env.h"
+
+#include <sys/uio.h>
+
+#include <climits>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "kudu/gutil/basictypes.h"
+#include "kudu/util/array_view.h"
+#include "kudu/util/env.h"
+#include "kudu/util/errno.h"
+#include "kudu/util/io_uring.h"
+#include "kudu/util/logging.h"
+#include "kudu/util/thread.h"
+#include "kudu/util/threadpool.h"
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace kudu {
+
+// A read issued through io_uring, which is its tag. Owned by the ring until
+// it is reaped.
+struct AsyncEnv::UringRead {
+  const RandomAccessFile* file;
+  uint64_t offset;
+  vector<Slice> results;
+  vector<struct iovec> iov;
+  size_t length;
+  StdStatusCallback cb;
+};
+
+AsyncEnv::AsyncEnv() : uring_done_(&uring_lock_), uring_reads_in_flight_(0) {}
+
+Status AsyncEnv::Create(
+    const string& name,
+    int max_threads,
+    unique_ptr<AsyncEnv>* async_env) {
+  return Create(name, max_threads, 0, async_env);
+}
+
+Status AsyncEnv::Create(
+    const string& name,
+    int max_threads,
+    int io_uring_depth,
+    unique_ptr<AsyncEnv>* async_env) {
+  DCHECK_GT(max_threads, 0);
+  unique_ptr<AsyncEnv> env(new AsyncEnv());
+  RETURN_NOT_OK(ThreadPoolBuilder(name)
+                    .set_min_threads(0)
+                    .set_max_threads(max_threads)
+                    .Build(&env->pool_));
+  if (io_uring_depth > 0) {
+    Status s = IoUring::Create(io_uring_depth, &env->ring_);
+    if (s.ok()) {
+      s = Thread::Create(
+          "async-env",
+          name + "-reaper",
+          &AsyncEnv::ReapLoop,
+          env.get(),
+          &env->reaper_);
+    }
+    if (PREDICT_FALSE(!s.ok())) {
+      LOG(WARNING) << "Issuing the reads of " << name
+                   << " without io_uring: " << s.ToString();
+      env->ring_.reset();
+    }
+  }
+  *async_env = std::move(env);
+  return Status::OK();
+}
+
+AsyncEnv::~AsyncEnv() {
+  Wait();
+  if (reaper_) {
+    CHECK_OK(ring_->SubmitWakeup());
+    reaper_->Join();
+  }
+  pool_->Wait();
+  pool_->Shutdown();
+}
+
+void AsyncEnv::ReadV(
+    const RandomAccessFile* file,
+    uint64_t offset,
+    vector<Slice> results,
+    StdStatusCallback cb) {
+  if (ring_ && SubmitUringRead(file, offset, &results, &cb)) {
+    return;
+  }
+  Submit([file, offset, results]() mutable {
+    return file->ReadV(offset, ArrayView<Slice>(results));
+  }, std::move(cb));
+}
+
+void AsyncEnv::ReadV(
+    const RWFile* file,
+    uint64_t offset,
+    vector<Slice> results,
+    StdStatusCallback cb) {
+  Submit([file, offset, results]() mutable {
+    return file->ReadV(offset, ArrayView<Slice>(results));
+  }, std::move(cb));
+}
+
+unique_ptr<AsyncWriteQueue> AsyncEnv::NewWriteQueue() {
+  return unique_ptr<AsyncWriteQueue>(new AsyncWriteQueue(
+      pool_->NewToken(ThreadPool::ExecutionMode::SERIAL)));
+}
+
+void AsyncEnv::Wait() {
+  {
+    MutexLock l(uring_lock_);
+    while (uring_reads_in_flight_ > 0) {
+      uring_done_.Wait();
+    }
+  }
+  // The reads finished through the I/O threads were submitted to them before
+  // leaving 'ring_'.
+  pool_->Wait();
+}
+
+void AsyncEnv::Submit(std::function<Status()> op, StdStatusCallback cb) {
+  Status s = pool_->SubmitFunc([op, cb]() { cb(op()); });
+  if (PREDICT_FALSE(!s.ok())) {
+    cb(s.CloneAndPrepend("could not issue asynchronous read"));
+  }
+}
+
+bool AsyncEnv::SubmitUringRead(
+    const RandomAccessFile* file,
+    uint64_t offset,
+    vector<Slice>* results,
+    StdStatusCallback* cb) {
+  const int fd = file->fd();
+  if (fd < 0 || results->size() > IOV_MAX) {
+    return false;
+  }
+  unique_ptr<UringRead> read(new UringRead());
+  read->file = file;
+  read->offset = offset;
+  read->length = 0;
+  for (Slice& result : *results) {
+    read->iov.push_back({result.mutable_data(), result.size()});
+    read->length += result.size();
+  }
+  read->results = std::move(*results);
+  read->cb = std::move(*cb);
+  // Counted first, so that the reaper can't finish the read before.
+  {
+    MutexLock l(uring_lock_);
+    uring_reads_in_flight_++;
+  }
+  Status s = ring_->SubmitReadV(
+      fd,
+      read->iov.data(),
+      read->iov.size(),
+      offset,
+      reinterpret_cast<uint64_t>(read.get()));
+  if (PREDICT_TRUE(s.ok())) {
+    ignore_result(read.release());
+    return true;
+  }
+  if (!s.IsServiceUnavailable()) {
+    KLOG_EVERY_N_SECS(WARNING, 60)
+        << "Could not issue a read of " << file->filename()
+        << " through io_uring: " << s.ToString();
+  }
+  *results = std::move(read->results);
+  *cb = std::move(read->cb);
+  MutexLock l(uring_lock_);
+  if (--uring_reads_in_flight_ == 0) {
+    uring_done_.Broadcast();
+  }
+  return false;
+}
+
+void AsyncEnv::FinishUringRead(uint64_t tag, int result) {
+  unique_ptr<UringRead> read(reinterpret_cast<UringRead*>(tag));
+  if (result < 0) {
+    read->cb(Status::IOError(
+        read->file->filename(), ErrnoToString(-result), -result));
+  } else if (static_cast<size_t>(result) == read->length) {
+    read->cb(Status::OK());
+  } else {
+    // A short read, e.g. at the end of the file. The I/O threads read the
+    // rest, which fails as RandomAccessFile::ReadV() does if there is none.
+    vector<Slice> rest;
+    size_t skip = result;
+    for (Slice& r : read->results) {
+      if (skip >= r.size()) {
+        skip -= r.size();
+        continue;
+      }
+      rest.emplace_back(r.mutable_data() + skip, r.size() - skip);
+      skip = 0;
+    }
+    const RandomAccessFile* file = read->file;
+    const uint64_t rest_offset = read->offset + result;
+    Submit([file, rest_offset, rest]() mutable {
+      return file->ReadV(rest_offset, ArrayView<Slice>(rest));
+    }, std::move(read->cb));
+  }
+  MutexLock l(uring_lock_);
+  if (--uring_reads_in_flight_ == 0) {
+    uring_done_.Broadcast();
+  }
+}
+
+void AsyncEnv::ReapLoop() {
+  bool woken = false;
+  while (!woken) {
+    CHECK_OK(ring_->Reap(
+        [this](uint64_t tag, int result) { FinishUringRead(tag, result); },
+        &woken));
+  }
+}
+
+AsyncWriteQueue::AsyncWriteQueue(unique_ptr<ThreadPoolToken> token)
+    : token_(std::move(token)) {}
+
+AsyncWriteQueue::~AsyncWriteQueue() {
+  token_->Wait();
+}
+
+void AsyncWriteQueue::AppendV(
+    WritableFile* file,
+    vector<Slice> data,
+    StdStatusCallback cb) {
+  Submit([file, data]() {
+    return file->AppendV(ArrayView<const Slice>(data));
+  }, std::move(cb));
+}
+
+void AsyncWriteQueue::WriteV(
+    RWFile* file,
+    uint64_t offset,
+    vector<Slice> data,
+    StdStatusCallback cb) {
+  Submit([file, offset, data]() {
+    return file->WriteV(offset, ArrayView<const Slice>(data));
+  }, std::move(cb));
+}
+
+void AsyncWriteQueue::Sync(WritableFile* file, StdStatusCallback cb) {
+  Submit([file]() { return file->Sync(); }, std::move(cb));
+}
+
+void AsyncWriteQueue::Sync(RWFile* file, StdStatusCallback cb) {
+  Submit([file]() { return file->Sync(); }, std::move(cb));
+}
+
+void AsyncWriteQueue::Wait() {
+  token_->Wait();
+}
+
+void AsyncWriteQueue::Submit(
+    std::function<Status()> op,
+    StdStatusCallback cb) {
+  Status s = token_->SubmitFunc([this, op, cb]() {
+    if (first_error_.ok()) {
+      first_error_ = op();
+    }
+    cb(first_error_);
+  });
+  if (PREDICT_FALSE(!s.ok())) {
+    cb(s.CloneAndPrepend("could not issue asynchronous write"));
+  }
+}
+
+} // namespace kudu
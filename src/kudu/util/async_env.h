@@ -0,0 +1,216 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "kudu/gutil/gscoped_ptr.h"
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/condition_variable.h"
+#include "kudu/util/mutex.h"
+#include "kudu/util/slice.h"
+#include "kudu/util/status.h"
+#include "kudu/util/status_callback.h"
+
+namespace kudu {
+
+class AsyncWriteQueue;
+class IoUring;
+class RWFile;
+class RandomAccessFile;
+class Thread;
+class ThreadPool;
+class ThreadPoolToken;
+class WritableFile;
+
+// Asynchronous counterparts of the synchronous file operations in env.h.
+//
+// Each operation is issued on a shared pool of I/O threads and returns
+// immediately; its result is delivered to a callback, which runs on one of
+// the I/O threads. This lets a single caller keep many I/Os in flight (e.g.
+// when reading the segments needed by a lagging peer) without dedicating a
+// thread of its own to each one. Callers that need a future-like handle can
+// pass a Synchronizer's AsStdStatusCallback() and Wait() on it later.
+//
+// Reads may complete in any order. Writes must be issued through an
+// AsyncWriteQueue, which preserves their order.
+//
+// Optionally, the reads of RandomAccessFiles which have a file descriptor are
+// issued through io_uring instead, so that many of them can be in flight
+// without as many I/O threads. Their callbacks then run on the thread which
+// reaps the completions. The other reads, those in excess of the ring's depth
+// and the remainders of short reads go through the I/O threads.
+//
+// Files, and the memory referenced by the slices passed to any operation,
+// must remain valid until the operation's callback has been invoked.
+//
+// All methods are thread safe.
+class AsyncEnv {
+ public:
+  // Creates a new AsyncEnv backed by up to 'max_threads' I/O threads, which
+  // are named after 'name'.
+  static Status Create(
+      const std::string& name,
+      int max_threads,
+      std::unique_ptr<AsyncEnv>* async_env);
+
+  // Like the above, but also issues up to 'io_uring_depth' reads at once
+  // through io_uring, if it is positive and io_uring is supported.
+  static Status Create(
+      const std::string& name,
+      int max_threads,
+      int io_uring_depth,
+      std::unique_ptr<AsyncEnv>* async_env);
+
+  // Waits for all outstanding operations to complete. All write queues must
+  // have been destroyed first.
+  ~AsyncEnv();
+
+  // Reads from 'file' starting at 'offset' into the buffers described by
+  // 'results', as per RandomAccessFile::ReadV(), and then invokes 'cb'.
+  void ReadV(
+      const RandomAccessFile* file,
+      uint64_t offset,
+      std::vector<Slice> results,
+      StdStatusCallback cb);
+
+  // Like the above, but for an RWFile.
+  void ReadV(
+      const RWFile* file,
+      uint64_t offset,
+      std::vector<Slice> results,
+      StdStatusCallback cb);
+
+  // Creates a new queue for issuing ordered writes.
+  std::unique_ptr<AsyncWriteQueue> NewWriteQueue();
+
+  // Waits until every operation issued so far has completed and had its
+  // callback invoked.
+  void Wait();
+
+  // Whether reads are issued through io_uring.
+  bool uses_io_uring() const {
+    return ring_ != nullptr;
+  }
+
+ private:
+  struct UringRead;
+
+  AsyncEnv();
+
+  // Runs 'op' on an I/O thread and passes its result to 'cb'. If 'op' could
+  // not be submitted, 'cb' is invoked inline with the failure.
+  void Submit(std::function<Status()> op, StdStatusCallback cb);
+
+  // Issues the read of 'results' at 'offset' of 'file' through 'ring_'.
+  // Returns false, leaving 'cb' untouched, if it has to go through the I/O
+  // threads instead.
+  bool SubmitUringRead(
+      const RandomAccessFile* file,
+      uint64_t offset,
+      std::vector<Slice>* results,
+      StdStatusCallback* cb);
+
+  // Completes the read which 'tag' points to, with 'result' as reaped from
+  // 'ring_'.
+  void FinishUringRead(uint64_t tag, int result);
+
+  // Reaps the completions of 'ring_' until the destructor wakes it up. Runs
+  // on 'reaper_'.
+  void ReapLoop();
+
+  gscoped_ptr<ThreadPool> pool_;
+
+  // Set if reads are issued through io_uring.
+  std::unique_ptr<IoUring> ring_;
+  scoped_refptr<Thread> reaper_;
+
+  // The reads submitted to 'ring_' whose callbacks haven't returned yet, and
+  // the condition that Wait() waits on for them to be done. Protected by
+  // 'uring_lock_'.
+  Mutex uring_lock_;
+  ConditionVariable uring_done_;
+  int uring_reads_in_flight_;
+
+  DISALLOW_COPY_AND_ASSIGN(AsyncEnv);
+};
+
+// An ordered stream of asynchronous writes.
+//
+// Operations issued through the same queue run one at a time, in the order
+// in which they were issued, so a Sync() covers every AppendV() issued before
+// it. Once an operation fails, every subsequent operation in the queue fails
+// with the same status without being attempted, so that a Sync() can never
+// report success for data that was not written.
+//
+// Distinct queues run independently of one another. Typically there is one
+// queue per file being written.
+class AsyncWriteQueue {
+ public:
+  // Waits for all outstanding operations in the queue to complete.
+  ~AsyncWriteQueue();
+
+  // Appends 'data' to 'file', as per WritableFile::AppendV(), and then
+  // invokes 'cb'.
+  void AppendV(
+      WritableFile* file,
+      std::vector<Slice> data,
+      StdStatusCallback cb);
+
+  // Writes 'data' to 'file' at 'offset', as per RWFile::WriteV(), and then
+  // invokes 'cb'.
+  void WriteV(
+      RWFile* file,
+      uint64_t offset,
+      std::vector<Slice> data,
+      StdStatusCallback cb);
+
+  // Syncs 'file' to disk, as per WritableFile::Sync(), and then invokes 'cb'.
+  void Sync(WritableFile* file, StdStatusCallback cb);
+
+  // Like the above, but for an RWFile.
+  void Sync(RWFile* file, StdStatusCallback cb);
+
+  // Waits until every operation issued to the queue so far has completed and
+  // had its callback invoked.
+  void Wait();
+
+ private:
+  friend class AsyncEnv;
+
+  explicit AsyncWriteQueue(std::unique_ptr<ThreadPoolToken> token);
+
+  // Runs 'op' after all previously issued operations in the queue, unless
+  // one of them failed, and passes its result to 'cb'.
+  void Submit(std::function<Status()> op, StdStatusCallback cb);
+
+  std::unique_ptr<ThreadPoolToken> token_;
+
+  // The first failure in the queue, if any. Only accessed by the queue's
+  // operations, which never run concurrently.
+  Status first_error_;
+
+  DISALLOW_COPY_AND_ASSIGN(AsyncWriteQueue);
+};
+
+} // namespace kudu
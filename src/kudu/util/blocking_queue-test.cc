@@ -22,16 +22,29 @@
 #include <thread>
 #include <vector>
 
+#include <gflags/gflags.h>
+#include <glog/logging.h>
 #include <gtest/gtest.h>
 
 #include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/util/blocking_queue.h"
 #include "kudu/util/countdown_latch.h"
+#include "kudu/util/mpsc_blocking_queue.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/mutex.h"
 #include "kudu/util/status.h"
+#include "kudu/util/stopwatch.h"
 #include "kudu/util/test_macros.h"
 
+DEFINE_int32(
+    queue_bench_producers,
+    32,
+    "Number of producer threads in the queue benchmarks.");
+DEFINE_int32(
+    queue_bench_puts_per_producer,
+    20000,
+    "Number of elements each producer puts in the queue benchmarks.");
+
 using std::string;
 using std::thread;
 using std::vector;
@@ -250,4 +263,121 @@ TEST(BlockingQueueTest, TestMultipleThreads) {
   test.Run();
 }
 
+TEST(MpscBlockingQueueTest, TestBlockingDrainTo) {
+  MpscBlockingQueue<int32_t> test_queue(3);
+  ASSERT_EQ(test_queue.Put(1), QUEUE_SUCCESS);
+  ASSERT_EQ(test_queue.Put(2), QUEUE_SUCCESS);
+  ASSERT_EQ(test_queue.Put(3), QUEUE_SUCCESS);
+  ASSERT_EQ(test_queue.Put(4), QUEUE_FULL);
+  ASSERT_FALSE(test_queue.empty());
+  vector<int32_t> out;
+  ASSERT_OK(test_queue.BlockingDrainTo(
+      &out, MonoTime::Now() + MonoDelta::FromSeconds(30)));
+  ASSERT_EQ((vector<int32_t>{1, 2, 3}), out);
+  ASSERT_TRUE(test_queue.empty());
+  ASSERT_EQ(0, test_queue.size());
+
+  // Set a deadline in the past and ensure we time out.
+  Status s = test_queue.BlockingDrainTo(
+      &out, MonoTime::Now() - MonoDelta::FromSeconds(1));
+  ASSERT_TRUE(s.IsTimedOut()) << s.ToString();
+
+  // A parked consumer is woken up by the next put.
+  thread producer([&]() {
+    SleepFor(MonoDelta::FromMilliseconds(10));
+    ASSERT_EQ(test_queue.Put(5), QUEUE_SUCCESS);
+  });
+  out.clear();
+  ASSERT_OK(test_queue.BlockingDrainTo(&out));
+  producer.join();
+  ASSERT_EQ((vector<int32_t>{5}), out);
+
+  // Elements put before the shutdown are still drained, then the queue
+  // returns Aborted.
+  ASSERT_EQ(test_queue.Put(6), QUEUE_SUCCESS);
+  test_queue.Shutdown();
+  ASSERT_EQ(test_queue.Put(7), QUEUE_SHUTDOWN);
+  ASSERT_FALSE(test_queue.BlockingPut(7));
+  out.clear();
+  ASSERT_OK(test_queue.BlockingDrainTo(&out));
+  ASSERT_EQ((vector<int32_t>{6}), out);
+  s = test_queue.BlockingDrainTo(&out);
+  ASSERT_TRUE(s.IsAborted()) << s.ToString();
+}
+
+TEST(MpscBlockingQueueTest, TestLogicalSize) {
+  MpscBlockingQueue<string, LengthLogicalSize> test_queue(4);
+  ASSERT_EQ(test_queue.Put("a"), QUEUE_SUCCESS);
+  ASSERT_EQ(test_queue.Put("bcd"), QUEUE_SUCCESS);
+  ASSERT_EQ(4, test_queue.size());
+  ASSERT_EQ(test_queue.Put("e"), QUEUE_FULL);
+
+  // A blocked producer gets in once the consumer makes room.
+  thread producer([&]() { ASSERT_TRUE(test_queue.BlockingPut("e")); });
+  SleepFor(MonoDelta::FromMilliseconds(10));
+  vector<string> out;
+  while (out.size() < 3) {
+    ASSERT_OK(test_queue.BlockingDrainTo(&out));
+  }
+  producer.join();
+  ASSERT_EQ((vector<string>{"a", "bcd", "e"}), out);
+}
+
+namespace {
+
+// Has FLAGS_queue_bench_producers threads put their ids into 'queue' while
+// one thread drains it, checks that each producer's elements come out in
+// order, and returns how long it took.
+template <class Queue>
+MonoDelta RunProducersBenchmark(Queue* queue) {
+  const int num_producers = FLAGS_queue_bench_producers;
+  const int puts = FLAGS_queue_bench_puts_per_producer;
+  CountDownLatch start(1);
+  vector<thread> producers;
+  for (int p = 0; p < num_producers; p++) {
+    producers.emplace_back([&, p]() {
+      start.Wait();
+      for (int i = 0; i < puts; i++) {
+        CHECK(queue->BlockingPut(static_cast<int64_t>(p) * puts + i));
+      }
+    });
+  }
+
+  Stopwatch sw;
+  sw.start();
+  start.CountDown();
+  vector<int64_t> last(num_producers, -1);
+  int64_t drained = 0;
+  vector<int64_t> out;
+  while (drained < static_cast<int64_t>(num_producers) * puts) {
+    out.clear();
+    CHECK_OK(queue->BlockingDrainTo(&out));
+    for (int64_t v : out) {
+      int p = v / puts;
+      CHECK_GT(v % puts, last[p]);
+      last[p] = v % puts;
+    }
+    drained += out.size();
+  }
+  sw.stop();
+  for (auto& t : producers) {
+    t.join();
+  }
+  return MonoDelta::FromNanoseconds(sw.elapsed().wall);
+}
+
+} // anonymous namespace
+
+TEST(MpscBlockingQueueTest, BenchmarkManyProducers) {
+  const int64_t total = static_cast<int64_t>(FLAGS_queue_bench_producers) *
+      FLAGS_queue_bench_puts_per_producer;
+  BlockingQueue<int64_t> blocking_queue(1024);
+  MonoDelta blocking = RunProducersBenchmark(&blocking_queue);
+  MpscBlockingQueue<int64_t> mpsc_queue(1024);
+  MonoDelta mpsc = RunProducersBenchmark(&mpsc_queue);
+  LOG(INFO) << FLAGS_queue_bench_producers << " producers, " << total
+            << " elements: BlockingQueue " << blocking.ToString()
+            << ", MpscBlockingQueue " << mpsc.ToString();
+}
+
 } // namespace kudu
@@ -3,9 +3,11 @@
 // found in the LICENSE file.
 
 #include <cassert>
+#include <atomic>
 #include <cstring>
 #include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <gflags/gflags.h>
@@ -17,11 +19,15 @@
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/util/cache.h"
+#include "kudu/util/clock_cache.h"
 #include "kudu/util/coding.h"
 #include "kudu/util/env.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/mem_tracker.h"
 #include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/random.h"
+#include "kudu/util/random_util.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
@@ -45,8 +51,11 @@ static int DecodeInt(const Slice& k) {
   return DecodeFixed32(k.data());
 }
 
+// The cache implementations under test.
+enum class CacheImpl { DRAM_LRU, NVM_LRU, DRAM_CLOCK };
+
 class CacheTest : public KuduTest,
-                  public ::testing::WithParamInterface<CacheType>,
+                  public ::testing::WithParamInterface<CacheImpl>,
                   public Cache::EvictionCallback {
  public:
   // Implementation of the EvictionCallback interface
@@ -74,12 +83,22 @@ class CacheTest : public KuduTest,
     // assertions on the MemTracker in this test.
     FLAGS_cache_memtracker_approximation_ratio = 0;
 
-    cache_.reset(NewLRUCache(GetParam(), kCacheSize, "cache_test"));
-
-    MemTracker::FindTracker("cache_test-sharded_lru_cache", &mem_tracker_);
+    switch (GetParam()) {
+      case CacheImpl::DRAM_LRU:
+        cache_.reset(NewLRUCache(DRAM_CACHE, kCacheSize, "cache_test"));
+        MemTracker::FindTracker("cache_test-sharded_lru_cache", &mem_tracker_);
+        break;
+      case CacheImpl::NVM_LRU:
+        cache_.reset(NewLRUCache(NVM_CACHE, kCacheSize, "cache_test"));
+        break;
+      case CacheImpl::DRAM_CLOCK:
+        cache_.reset(NewClockCache(kCacheSize, "cache_test"));
+        MemTracker::FindTracker("cache_test-clock_cache", &mem_tracker_);
+        break;
+    }
     // Since nvm cache does not have memtracker due to the use of
     // tcmalloc for this we only check for it in the DRAM case.
-    if (GetParam() == DRAM_CACHE) {
+    if (GetParam() != CacheImpl::NVM_LRU) {
       ASSERT_TRUE(mem_tracker_.get());
     }
 
@@ -117,9 +136,15 @@ class CacheTest : public KuduTest,
 INSTANTIATE_TEST_CASE_P(
     CacheTypes,
     CacheTest,
-    ::testing::Values(DRAM_CACHE, NVM_CACHE));
+    ::testing::Values(
+        CacheImpl::DRAM_LRU,
+        CacheImpl::NVM_LRU,
+        CacheImpl::DRAM_CLOCK));
 #else
-INSTANTIATE_TEST_CASE_P(CacheTypes, CacheTest, ::testing::Values(DRAM_CACHE));
+INSTANTIATE_TEST_CASE_P(
+    CacheTypes,
+    CacheTest,
+    ::testing::Values(CacheImpl::DRAM_LRU, CacheImpl::DRAM_CLOCK));
 #endif // defined(__linux__)
 
 TEST_P(CacheTest, TrackMemory) {
@@ -246,4 +271,42 @@ TEST_P(CacheTest, HeavyEntries) {
   ASSERT_LE(cached_weight, kCacheSize + kCacheSize / 10);
 }
 
+// Concurrent lookups, inserts and erases of overlapping keys never see a
+// value for another key, or one which was already evicted.
+TEST_P(CacheTest, ConcurrentAccess) {
+  const int kNumThreads = 8;
+  const int kNumKeys = 4096;
+  const int kValueSize = kCacheSize / 1024;
+  std::atomic<bool> done(false);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([&]() {
+      Random r(GetRandomSeed32());
+      while (!done) {
+        int key = r.Uniform(kNumKeys);
+        std::string key_str = EncodeInt(key);
+        if (r.OneIn(10)) {
+          cache_->Erase(key_str);
+          continue;
+        }
+        Cache::Handle* h = cache_->Lookup(key_str, Cache::EXPECT_IN_CACHE);
+        if (h == nullptr) {
+          Cache::PendingHandle* ph =
+              CHECK_NOTNULL(cache_->Allocate(key_str, kValueSize));
+          memset(cache_->MutableValue(ph), 0, kValueSize);
+          memcpy(cache_->MutableValue(ph), key_str.data(), key_str.size());
+          h = cache_->Insert(ph, nullptr);
+        }
+        CHECK_EQ(key, DecodeInt(Slice(cache_->Value(h).data(), 4)));
+        cache_->Release(h);
+      }
+    });
+  }
+  SleepFor(MonoDelta::FromSeconds(AllowSlowTests() ? 10 : 1));
+  done = true;
+  for (auto& t : threads) {
+    t.join();
+  }
+}
+
 } // namespace kudu
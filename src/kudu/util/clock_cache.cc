@@ -0,0 +1,841 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// A cache with the same interface and accounting as the sharded LRU cache of
+// cache.cc, but which scales with the number of concurrent readers:
+//
+// - Eviction uses the CLOCK algorithm: entries sit in a FIFO ring, a lookup
+//   only bumps a small usage count, and the eviction hand decrements it and
+//   gives entries which had a non-zero count another chance. So, unlike LRU,
+//   a hit does not need to reorder a shared list under the shard lock, and
+//   an entry hit more often than others outlives them.
+//
+// - The hash table buckets and chains are atomic pointers, which lookups walk
+//   without any lock. Inserts, erases and evictions still serialize on the
+//   shard lock. Entries unlinked from the table may still be walked by
+//   concurrent lookups, so their memory is only freed once every thread
+//   which was walking the table when they were unlinked is done, using
+//   epoch-based reclamation.
+
+#include "kudu/util/clock_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags_declare.h>
+#include <glog/logging.h>
+
+#include "kudu/gutil/bits.h"
+#include "kudu/gutil/gscoped_ptr.h"
+#include "kudu/gutil/hash/city.h"
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/port.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/stl_util.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/sysinfo.h"
+#include "kudu/util/alignment.h"
+#include "kudu/util/cache.h"
+#include "kudu/util/cache_metrics.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/malloc.h"
+#include "kudu/util/mem_tracker.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/slice.h"
+#include "kudu/util/test_util_prod.h"
+
+DECLARE_bool(cache_force_single_shard);
+DECLARE_double(cache_memtracker_approximation_ratio);
+
+using std::atomic;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace kudu {
+
+namespace {
+
+typedef simple_spinlock MutexType;
+
+// Tracks which threads may be reading shared memory without a lock, so that
+// memory they could reach is only freed once they're done with it.
+//
+// Each thread has a record holding the epoch it entered in, or 0 while it's
+// not reading. An object unlinked from shared memory is tagged with the
+// epoch current at that time: threads which entered later can't reach it, so
+// it can be freed once no thread is in that epoch or an earlier one.
+//
+// Records are reused by later threads once their thread exits, and never
+// freed, so there are never more of them than of concurrent threads.
+class EpochManager {
+ public:
+  static EpochManager* Get() {
+    static EpochManager* const manager = new EpochManager();
+    return manager;
+  }
+
+  // Marks the calling thread as reading until Exit(). Not reentrant.
+  void Enter() {
+    Record* r = CurrentRecord();
+    DCHECK_EQ(0, r->epoch.load(std::memory_order_relaxed));
+    r->epoch.store(epoch_.load(std::memory_order_relaxed));
+    // The epoch must be visible to reclaimers before anything is read.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  void Exit() {
+    CurrentRecord()->epoch.store(0, std::memory_order_release);
+  }
+
+  // Returns the tag of an object which was just unlinked.
+  uint64_t Tag() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return epoch_.load();
+  }
+
+  // Returns the epoch which objects must be tagged before to be freed.
+  uint64_t SafeEpoch() {
+    uint64_t safe = epoch_.fetch_add(1) + 1;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (Record* r = records_.load(std::memory_order_acquire); r != nullptr;
+         r = r->next) {
+      uint64_t e = r->epoch.load();
+      if (e != 0) {
+        safe = std::min(safe, e);
+      }
+    }
+    return safe;
+  }
+
+ private:
+  struct Record {
+    atomic<uint64_t> epoch{0};
+    atomic<bool> in_use{true};
+    Record* next = nullptr;
+    // Records are written to by different threads.
+    char padding[CACHELINE_SIZE];
+  };
+
+  // Releases the record of a thread when it exits.
+  struct RecordHolder {
+    Record* record = nullptr;
+    ~RecordHolder() {
+      if (record) {
+        record->epoch.store(0);
+        record->in_use.store(false, std::memory_order_release);
+      }
+    }
+  };
+
+  EpochManager() : epoch_(1), records_(nullptr) {}
+
+  Record* CurrentRecord() {
+    static thread_local RecordHolder holder;
+    if (PREDICT_FALSE(holder.record == nullptr)) {
+      holder.record = AcquireRecord();
+    }
+    return holder.record;
+  }
+
+  Record* AcquireRecord() {
+    for (Record* r = records_.load(std::memory_order_acquire); r != nullptr;
+         r = r->next) {
+      bool in_use = false;
+      if (!r->in_use.load(std::memory_order_relaxed) &&
+          r->in_use.compare_exchange_strong(in_use, true)) {
+        return r;
+      }
+    }
+    Record* r = new Record();
+    Record* head = records_.load(std::memory_order_relaxed);
+    do {
+      r->next = head;
+    } while (!records_.compare_exchange_weak(
+        head, r, std::memory_order_release, std::memory_order_relaxed));
+    return r;
+  }
+
+  atomic<uint64_t> epoch_;
+  atomic<Record*> records_;
+
+  DISALLOW_COPY_AND_ASSIGN(EpochManager);
+};
+
+class EpochGuard {
+ public:
+  EpochGuard() {
+    EpochManager::Get()->Enter();
+  }
+  ~EpochGuard() {
+    EpochManager::Get()->Exit();
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(EpochGuard);
+};
+
+// An entry is a variable length heap-allocated structure, laid out like the
+// LRUHandle of cache.cc.
+struct ClockHandle {
+  Cache::EvictionCallback* eviction_callback;
+  atomic<ClockHandle*> next_hash;
+  // The ring of the shard, protected by its lock. Once the entry is retired,
+  // 'next' links the shard's retired entries instead.
+  ClockHandle* next;
+  ClockHandle* prev;
+  size_t charge;
+  uint32_t key_length;
+  uint32_t val_length;
+  // One ref while the entry is in the table, and one per handle given out.
+  // The entry is freed once this drops to 0, and never revived after that.
+  atomic<int32_t> refs;
+  // Bumped by lookups up to kMaxUsage, decremented by the eviction hand.
+  atomic<uint8_t> usage;
+  uint32_t hash;
+  uint64_t retired_epoch;
+
+  // The storage for the key/value pair itself. The data is stored as:
+  //   [key bytes ...] [padding up to 8-byte boundary] [value bytes ...]
+  uint8_t kv_data[1]; // Beginning of key/value pair
+
+  Slice key() const {
+    return Slice(kv_data, key_length);
+  }
+
+  uint8_t* mutable_val_ptr() {
+    int val_offset = KUDU_ALIGN_UP(key_length, sizeof(void*));
+    return &kv_data[val_offset];
+  }
+
+  const uint8_t* val_ptr() const {
+    return const_cast<ClockHandle*>(this)->mutable_val_ptr();
+  }
+
+  Slice value() const {
+    return Slice(val_ptr(), val_length);
+  }
+};
+
+// The buckets of a shard's hash table. Replaced, not resized, when it grows.
+struct HashTable {
+  explicit HashTable(uint32_t length)
+      : length(length), buckets(new atomic<ClockHandle*>[length]) {
+    for (uint32_t i = 0; i < length; i++) {
+      buckets[i].store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  const uint32_t length;
+  gscoped_array<atomic<ClockHandle*>> buckets;
+  uint64_t retired_epoch = 0;
+};
+
+// A single shard of the sharded cache.
+class ClockCacheShard {
+ public:
+  explicit ClockCacheShard(MemTracker* tracker);
+  ~ClockCacheShard();
+
+  void SetCapacity(size_t capacity) {
+    capacity_ = capacity;
+    max_deferred_consumption_ =
+        capacity * FLAGS_cache_memtracker_approximation_ratio;
+  }
+
+  void SetMetrics(CacheMetrics* metrics) {
+    metrics_ = metrics;
+  }
+
+  Cache::Handle* Insert(
+      ClockHandle* handle,
+      Cache::EvictionCallback* eviction_callback);
+  // Like Cache::Lookup, but with an extra "hash" parameter.
+  Cache::Handle* Lookup(const Slice& key, uint32_t hash, bool caching);
+  void Release(Cache::Handle* handle);
+  void Erase(const Slice& key, uint32_t hash);
+
+ private:
+  // Once the number of retired entries reaches this, those no thread can
+  // reach anymore are freed.
+  static constexpr int kReclaimThreshold = 16;
+
+  // The highest usage count of an entry.
+  static constexpr uint8_t kMaxUsage = 3;
+
+  // Takes a ref on 'e', unless its last one was already dropped.
+  static bool TryRef(ClockHandle* e);
+
+  // Drops a ref on 'e' and returns true if it was the last one.
+  static bool Unref(ClockHandle* e);
+
+  void Ring_Remove(ClockHandle* e);
+  void Ring_Append(ClockHandle* e);
+
+  // The slot which points to the entry matching 'key', or the trailing slot
+  // of its bucket. Requires 'mutex_'.
+  atomic<ClockHandle*>* FindPointerUnlocked(const Slice& key, uint32_t hash);
+
+  // Inserts 'e' in the table, returning the entry it replaces, if any.
+  ClockHandle* TableInsertUnlocked(ClockHandle* e);
+  ClockHandle* TableRemoveUnlocked(const Slice& key, uint32_t hash);
+  void TableResizeUnlocked();
+
+  // Call the user's eviction callback, if it exists, and account for the
+  // entry, whose last ref was dropped, being gone.
+  void NotifyFreed(ClockHandle* e);
+
+  // NotifyFreed(), then retire the entry.
+  void FreeEntry(ClockHandle* e);
+
+  // Frees the retired entries and tables which no lookup can reach anymore.
+  void ReclaimUnlocked();
+
+  // See LRUCache::UpdateMemTracker() in cache.cc.
+  void UpdateMemTracker(int64_t delta);
+
+  // Initialized before use.
+  size_t capacity_;
+
+  // mutex_ protects the following state.
+  MutexType mutex_;
+  size_t usage_;
+
+  // Dummy head of the ring. ring_.next is the next entry the eviction hand
+  // considers, ring_.prev the last inserted or given another chance.
+  ClockHandle ring_;
+  size_t ring_size_;
+
+  // The table, which lookups read without 'mutex_'. 'resizes_' is odd while
+  // entries are moved to a new table, so that lookups which miss because of
+  // that retry.
+  atomic<HashTable*> table_;
+  atomic<uint64_t> resizes_;
+  uint32_t elems_;
+
+  // Entries, and tables, which are waiting for lookups to be done with them.
+  ClockHandle* retired_;
+  int retired_count_;
+  vector<HashTable*> retired_tables_;
+
+  MemTracker* mem_tracker_;
+  atomic<int64_t> deferred_consumption_{0};
+
+  // Initialized based on capacity_ to ensure an upper bound on the error on the
+  // MemTracker consumption.
+  int64_t max_deferred_consumption_;
+
+  CacheMetrics* metrics_;
+};
+
+ClockCacheShard::ClockCacheShard(MemTracker* tracker)
+    : usage_(0),
+      ring_size_(0),
+      table_(new HashTable(16)),
+      resizes_(0),
+      elems_(0),
+      retired_(nullptr),
+      retired_count_(0),
+      mem_tracker_(tracker),
+      metrics_(nullptr) {
+  // Make empty circular linked list
+  ring_.next = &ring_;
+  ring_.prev = &ring_;
+}
+
+ClockCacheShard::~ClockCacheShard() {
+  for (ClockHandle* e = ring_.next; e != &ring_;) {
+    ClockHandle* next = e->next;
+    DCHECK_EQ(e->refs.load(std::memory_order_relaxed), 1)
+        << "caller has an unreleased handle";
+    if (Unref(e)) {
+      NotifyFreed(e);
+      delete[] reinterpret_cast<uint8_t*>(e);
+    }
+    e = next;
+  }
+  // No lookup can be in flight anymore.
+  while (retired_ != nullptr) {
+    ClockHandle* next = retired_->next;
+    delete[] reinterpret_cast<uint8_t*>(retired_);
+    retired_ = next;
+  }
+  STLDeleteElements(&retired_tables_);
+  delete table_.load();
+  mem_tracker_->Consume(deferred_consumption_);
+}
+
+bool ClockCacheShard::TryRef(ClockHandle* e) {
+  int32_t refs = e->refs.load(std::memory_order_relaxed);
+  while (refs > 0) {
+    if (e->refs.compare_exchange_weak(refs, refs + 1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ClockCacheShard::Unref(ClockHandle* e) {
+  DCHECK_GT(e->refs.load(std::memory_order_relaxed), 0);
+  return e->refs.fetch_sub(1) == 1;
+}
+
+void ClockCacheShard::NotifyFreed(ClockHandle* e) {
+  DCHECK_EQ(e->refs.load(std::memory_order_relaxed), 0);
+  if (e->eviction_callback) {
+    e->eviction_callback->EvictedEntry(e->key(), e->value());
+  }
+  UpdateMemTracker(-static_cast<int64_t>(e->charge));
+  if (PREDICT_TRUE(metrics_)) {
+    metrics_->cache_usage->DecrementBy(e->charge);
+    metrics_->evictions->Increment();
+  }
+}
+
+void ClockCacheShard::FreeEntry(ClockHandle* e) {
+  NotifyFreed(e);
+
+  // Lookups which started before 'e' was unlinked may still be reading it.
+  std::lock_guard<MutexType> l(mutex_);
+  e->retired_epoch = EpochManager::Get()->Tag();
+  e->next = retired_;
+  retired_ = e;
+  if (++retired_count_ >= kReclaimThreshold) {
+    ReclaimUnlocked();
+  }
+}
+
+void ClockCacheShard::ReclaimUnlocked() {
+  uint64_t safe_epoch = EpochManager::Get()->SafeEpoch();
+  ClockHandle** ptr = &retired_;
+  while (*ptr != nullptr) {
+    ClockHandle* e = *ptr;
+    if (e->retired_epoch < safe_epoch) {
+      *ptr = e->next;
+      retired_count_--;
+      delete[] reinterpret_cast<uint8_t*>(e);
+    } else {
+      ptr = &e->next;
+    }
+  }
+  auto it = std::remove_if(
+      retired_tables_.begin(),
+      retired_tables_.end(),
+      [safe_epoch](HashTable* t) {
+        if (t->retired_epoch < safe_epoch) {
+          delete t;
+          return true;
+        }
+        return false;
+      });
+  retired_tables_.erase(it, retired_tables_.end());
+}
+
+void ClockCacheShard::UpdateMemTracker(int64_t delta) {
+  int64_t old_deferred = deferred_consumption_.fetch_add(delta);
+  int64_t new_deferred = old_deferred + delta;
+
+  if (new_deferred > max_deferred_consumption_ ||
+      new_deferred < -max_deferred_consumption_) {
+    int64_t to_propagate =
+        deferred_consumption_.exchange(0, std::memory_order_relaxed);
+    mem_tracker_->Consume(to_propagate);
+  }
+}
+
+void ClockCacheShard::Ring_Remove(ClockHandle* e) {
+  e->next->prev = e->prev;
+  e->prev->next = e->next;
+  usage_ -= e->charge;
+  ring_size_--;
+}
+
+void ClockCacheShard::Ring_Append(ClockHandle* e) {
+  // Make "e" the last entry the hand reaches by inserting just before ring_
+  e->next = &ring_;
+  e->prev = ring_.prev;
+  e->prev->next = e;
+  e->next->prev = e;
+  usage_ += e->charge;
+  ring_size_++;
+}
+
+atomic<ClockHandle*>* ClockCacheShard::FindPointerUnlocked(
+    const Slice& key,
+    uint32_t hash) {
+  HashTable* table = table_.load(std::memory_order_relaxed);
+  atomic<ClockHandle*>* ptr = &table->buckets[hash & (table->length - 1)];
+  ClockHandle* e;
+  while ((e = ptr->load(std::memory_order_relaxed)) != nullptr &&
+         (e->hash != hash || key != e->key())) {
+    ptr = &e->next_hash;
+  }
+  return ptr;
+}
+
+ClockHandle* ClockCacheShard::TableInsertUnlocked(ClockHandle* e) {
+  atomic<ClockHandle*>* ptr = FindPointerUnlocked(e->key(), e->hash);
+  ClockHandle* old = ptr->load(std::memory_order_relaxed);
+  e->next_hash.store(
+      old == nullptr ? nullptr : old->next_hash.load(std::memory_order_relaxed),
+      std::memory_order_relaxed);
+  // Publishes 'e', initialized above and in Allocate(), to lookups.
+  ptr->store(e, std::memory_order_release);
+  if (old == nullptr) {
+    ++elems_;
+    if (elems_ > table_.load(std::memory_order_relaxed)->length) {
+      // Since each cache entry is fairly large, we aim for a small
+      // average linked list length (<= 1).
+      TableResizeUnlocked();
+    }
+  }
+  return old;
+}
+
+ClockHandle* ClockCacheShard::TableRemoveUnlocked(
+    const Slice& key,
+    uint32_t hash) {
+  atomic<ClockHandle*>* ptr = FindPointerUnlocked(key, hash);
+  ClockHandle* result = ptr->load(std::memory_order_relaxed);
+  if (result != nullptr) {
+    // Lookups walking 'result' still go on to the rest of the chain.
+    ptr->store(
+        result->next_hash.load(std::memory_order_relaxed),
+        std::memory_order_release);
+    --elems_;
+  }
+  return result;
+}
+
+void ClockCacheShard::TableResizeUnlocked() {
+  uint32_t new_length = 16;
+  while (new_length < elems_ * 1.5) {
+    new_length *= 2;
+  }
+  HashTable* old_table = table_.load(std::memory_order_relaxed);
+  HashTable* new_table = new HashTable(new_length);
+
+  // Moving an entry changes its 'next_hash', which may make concurrent
+  // lookups skip part of a chain: they retry if 'resizes_' changed. Chains
+  // never loop, since moved entries only point to other moved ones.
+  resizes_.fetch_add(1);
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < old_table->length; i++) {
+    ClockHandle* h = old_table->buckets[i].load(std::memory_order_relaxed);
+    while (h != nullptr) {
+      ClockHandle* next = h->next_hash.load(std::memory_order_relaxed);
+      atomic<ClockHandle*>* ptr =
+          &new_table->buckets[h->hash & (new_length - 1)];
+      h->next_hash.store(
+          ptr->load(std::memory_order_relaxed), std::memory_order_release);
+      ptr->store(h, std::memory_order_relaxed);
+      h = next;
+      count++;
+    }
+  }
+  DCHECK_EQ(elems_, count);
+  table_.store(new_table, std::memory_order_release);
+  resizes_.fetch_add(1);
+
+  old_table->retired_epoch = EpochManager::Get()->Tag();
+  retired_tables_.push_back(old_table);
+}
+
+Cache::Handle* ClockCacheShard::Lookup(
+    const Slice& key,
+    uint32_t hash,
+    bool caching) {
+  ClockHandle* found = nullptr;
+  {
+    EpochGuard guard;
+    while (true) {
+      uint64_t resizes = resizes_.load(std::memory_order_acquire);
+      HashTable* table = table_.load(std::memory_order_acquire);
+      for (ClockHandle* e = table->buckets[hash & (table->length - 1)].load(
+               std::memory_order_acquire);
+           e != nullptr;
+           e = e->next_hash.load(std::memory_order_acquire)) {
+        if (e->hash == hash && key == e->key() && TryRef(e)) {
+          found = e;
+          break;
+        }
+      }
+      if (found != nullptr || (resizes % 2 == 0 &&
+                               resizes_.load(std::memory_order_acquire) ==
+                                   resizes)) {
+        break;
+      }
+    }
+  }
+
+  if (found != nullptr) {
+    // Racing bumps may be lost, which is fine for a hint. Hot entries stay at
+    // the maximum, so that lookups of them don't keep writing to it.
+    uint8_t usage = found->usage.load(std::memory_order_relaxed);
+    if (usage < kMaxUsage) {
+      found->usage.store(usage + 1, std::memory_order_relaxed);
+    }
+  }
+
+  if (metrics_) {
+    metrics_->lookups->Increment();
+    bool was_hit = (found != nullptr);
+    if (was_hit) {
+      if (caching) {
+        metrics_->cache_hits_caching->Increment();
+      } else {
+        metrics_->cache_hits->Increment();
+      }
+    } else {
+      if (caching) {
+        metrics_->cache_misses_caching->Increment();
+      } else {
+        metrics_->cache_misses->Increment();
+      }
+    }
+  }
+
+  return reinterpret_cast<Cache::Handle*>(found);
+}
+
+void ClockCacheShard::Release(Cache::Handle* handle) {
+  ClockHandle* e = reinterpret_cast<ClockHandle*>(handle);
+  if (Unref(e)) {
+    FreeEntry(e);
+  }
+}
+
+Cache::Handle* ClockCacheShard::Insert(
+    ClockHandle* e,
+    Cache::EvictionCallback* eviction_callback) {
+  // Set the remaining ClockHandle members which were not already allocated
+  // during Allocate().
+  e->eviction_callback = eviction_callback;
+  e->refs.store(2, std::memory_order_relaxed); // One from the table, one for
+                                               // the returned handle
+  e->usage.store(0, std::memory_order_relaxed);
+  UpdateMemTracker(e->charge);
+  if (PREDICT_TRUE(metrics_)) {
+    metrics_->cache_usage->IncrementBy(e->charge);
+    metrics_->inserts->Increment();
+  }
+
+  ClockHandle* to_remove_head = nullptr;
+  {
+    std::lock_guard<MutexType> l(mutex_);
+
+    Ring_Append(e);
+
+    ClockHandle* old = TableInsertUnlocked(e);
+    if (old != nullptr) {
+      Ring_Remove(old);
+      if (Unref(old)) {
+        old->next = to_remove_head;
+        to_remove_head = old;
+      }
+    }
+
+    // Each entry gets at most kMaxUsage more chances per call, even if
+    // lookups keep bumping them, so that this always ends. Like with LRU, the
+    // new entry itself only goes once it's the last one left.
+    size_t second_chances = ring_size_ * kMaxUsage;
+    while (usage_ > capacity_ && ring_.next != &ring_) {
+      ClockHandle* old = ring_.next;
+      Ring_Remove(old);
+      if (old == e && ring_size_ > 0) {
+        Ring_Append(old);
+        continue;
+      }
+      uint8_t usage = old->usage.load(std::memory_order_relaxed);
+      if (second_chances > 0 && usage > 0) {
+        old->usage.store(usage - 1, std::memory_order_relaxed);
+        Ring_Append(old);
+        second_chances--;
+        continue;
+      }
+      TableRemoveUnlocked(old->key(), old->hash);
+      if (Unref(old)) {
+        old->next = to_remove_head;
+        to_remove_head = old;
+      }
+    }
+  }
+
+  // we free the entries here outside of mutex for
+  // performance reasons
+  while (to_remove_head != nullptr) {
+    ClockHandle* next = to_remove_head->next;
+    FreeEntry(to_remove_head);
+    to_remove_head = next;
+  }
+
+  return reinterpret_cast<Cache::Handle*>(e);
+}
+
+void ClockCacheShard::Erase(const Slice& key, uint32_t hash) {
+  ClockHandle* e;
+  bool last_reference = false;
+  {
+    std::lock_guard<MutexType> l(mutex_);
+    e = TableRemoveUnlocked(key, hash);
+    if (e != nullptr) {
+      Ring_Remove(e);
+      last_reference = Unref(e);
+    }
+  }
+  // mutex not held here
+  // last_reference will only be true if e != NULL
+  if (last_reference) {
+    FreeEntry(e);
+  }
+}
+
+// Determine the number of bits of the hash that should be used to determine
+// the cache shard. This, in turn, determines the number of shards.
+int DetermineShardBits() {
+  int bits = PREDICT_FALSE(FLAGS_cache_force_single_shard)
+      ? 0
+      : Bits::Log2Ceiling(base::NumCPUs());
+  VLOG(1) << "Will use " << (1 << bits) << " shards for CLOCK cache.";
+  return bits;
+}
+
+class ShardedClockCache : public Cache {
+ private:
+  shared_ptr<MemTracker> mem_tracker_;
+  gscoped_ptr<CacheMetrics> metrics_;
+  vector<ClockCacheShard*> shards_;
+
+  // Number of bits of hash used to determine the shard.
+  const int shard_bits_;
+
+  // Protects 'metrics_'. Used only when metrics are set, to ensure
+  // that they are set only once in test environments.
+  MutexType metrics_lock_;
+
+  static inline uint32_t HashSlice(const Slice& s) {
+    return util_hash::CityHash64(
+        reinterpret_cast<const char*>(s.data()), s.size());
+  }
+
+  uint32_t Shard(uint32_t hash) {
+    // Widen to uint64 before shifting, or else on a single CPU,
+    // we would try to shift a uint32_t by 32 bits, which is undefined.
+    return static_cast<uint64_t>(hash) >> (32 - shard_bits_);
+  }
+
+ public:
+  explicit ShardedClockCache(size_t capacity, const string& id)
+      : shard_bits_(DetermineShardBits()) {
+    // A cache is often a singleton, so:
+    // 1. We reuse its MemTracker if one already exists, and
+    // 2. It is directly parented to the root MemTracker.
+    mem_tracker_ = MemTracker::FindOrCreateGlobalTracker(
+        -1, strings::Substitute("$0-clock_cache", id));
+
+    int num_shards = 1 << shard_bits_;
+    const size_t per_shard = (capacity + (num_shards - 1)) / num_shards;
+    for (int s = 0; s < num_shards; s++) {
+      gscoped_ptr<ClockCacheShard> shard(
+          new ClockCacheShard(mem_tracker_.get()));
+      shard->SetCapacity(per_shard);
+      shards_.push_back(shard.release());
+    }
+  }
+
+  virtual ~ShardedClockCache() {
+    STLDeleteElements(&shards_);
+  }
+
+  virtual Handle* Insert(
+      PendingHandle* handle,
+      Cache::EvictionCallback* eviction_callback) override {
+    ClockHandle* h = reinterpret_cast<ClockHandle*>(DCHECK_NOTNULL(handle));
+    return shards_[Shard(h->hash)]->Insert(h, eviction_callback);
+  }
+  virtual Handle* Lookup(const Slice& key, CacheBehavior caching) override {
+    const uint32_t hash = HashSlice(key);
+    return shards_[Shard(hash)]->Lookup(key, hash, caching == EXPECT_IN_CACHE);
+  }
+  virtual void Release(Handle* handle) override {
+    ClockHandle* h = reinterpret_cast<ClockHandle*>(handle);
+    shards_[Shard(h->hash)]->Release(handle);
+  }
+  virtual void Erase(const Slice& key) override {
+    const uint32_t hash = HashSlice(key);
+    shards_[Shard(hash)]->Erase(key, hash);
+  }
+  virtual Slice Value(Handle* handle) override {
+    return reinterpret_cast<ClockHandle*>(handle)->value();
+  }
+  virtual void SetMetrics(const scoped_refptr<MetricEntity>& entity) override {
+    // See ShardedLRUCache::SetMetrics() in cache.cc.
+    std::lock_guard<simple_spinlock> l(metrics_lock_);
+    if (metrics_) {
+      CHECK(IsGTest()) << "Metrics should only be set once per Cache singleton";
+      return;
+    }
+    metrics_.reset(new CacheMetrics(entity));
+    for (ClockCacheShard* cache : shards_) {
+      cache->SetMetrics(metrics_.get());
+    }
+  }
+
+  virtual PendingHandle* Allocate(Slice key, int val_len, int charge) override {
+    int key_len = key.size();
+    DCHECK_GE(key_len, 0);
+    DCHECK_GE(val_len, 0);
+    int key_len_padded = KUDU_ALIGN_UP(key_len, sizeof(void*));
+    uint8_t* buf = new uint8_t
+        [sizeof(ClockHandle) + key_len_padded + val_len // the kv_data VLA data
+         - 1 // (the VLA has a 1-byte placeholder)
+    ];
+    ClockHandle* handle = reinterpret_cast<ClockHandle*>(buf);
+    handle->key_length = key_len;
+    handle->val_length = val_len;
+    handle->charge =
+        (charge == kAutomaticCharge) ? kudu_malloc_usable_size(buf) : charge;
+    handle->hash = HashSlice(key);
+    memcpy(handle->kv_data, key.data(), key_len);
+
+    return reinterpret_cast<PendingHandle*>(handle);
+  }
+
+  virtual void Free(PendingHandle* h) override {
+    uint8_t* data = reinterpret_cast<uint8_t*>(h);
+    delete[] data;
+  }
+
+  virtual uint8_t* MutableValue(PendingHandle* h) override {
+    return reinterpret_cast<ClockHandle*>(h)->mutable_val_ptr();
+  }
+};
+
+} // end anonymous namespace
+
+Cache* NewClockCache(size_t capacity, const string& id) {
+  return new ShardedClockCache(capacity, id);
+}
+
+} // namespace kudu
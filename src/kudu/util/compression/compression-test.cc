@@ -18,6 +18,9 @@
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include <gtest/gtest.h>
@@ -25,6 +28,7 @@
 #include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/util/compression/compression.pb.h"
 #include "kudu/util/compression/compression_codec.h"
+#include "kudu/util/compression/compression_dict_trainer.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
@@ -74,7 +78,7 @@ static void TestCompressionCodec(CompressionType compression) {
 }
 
 TEST_F(TestCompression, TestNoCompressionCodec) {
-  const CompressionCodec* codec;
+  std::shared_ptr<CompressionCodec> codec;
   ASSERT_OK(CompressionCodecManager::GetCodec(NO_COMPRESSION, &codec));
   ASSERT_EQ(nullptr, codec);
 }
@@ -91,4 +95,131 @@ TEST_F(TestCompression, TestZlibCompressionCodec) {
   TestCompressionCodec(ZLIB);
 }
 
+// Compresses and uncompresses with the same codec from several threads at
+// once.
+static void TestConcurrentCompression(CompressionType compression) {
+  const int kNumThreads = 8;
+  const int kNumIterations = 1000;
+  const int kInputSize = 1024;
+
+  std::shared_ptr<CompressionCodec> codec;
+  ASSERT_OK(CompressionCodecManager::GetCodec(compression, &codec));
+  ASSERT_OK(codec->SetDictionary(std::string(256, 'Z')));
+
+  vector<std::thread> threads;
+  vector<Status> statuses(kNumThreads);
+  for (int t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([&, t]() {
+      std::string input(kInputSize, 'a' + t);
+      vector<uint8_t> cbuffer(codec->MaxCompressedLength(kInputSize));
+      vector<uint8_t> ubuffer(kInputSize);
+      for (int i = 0; i < kNumIterations; i++) {
+        size_t compressed;
+        Status s = codec->CompressWithStats(
+            Slice(input), cbuffer.data(), &compressed);
+        if (s.ok()) {
+          s = codec->UncompressWithStats(
+              Slice(cbuffer.data(), compressed), ubuffer.data(), kInputSize);
+        }
+        if (s.ok() && memcmp(input.data(), ubuffer.data(), kInputSize) != 0) {
+          s = Status::Corruption("uncompressed data does not match");
+        }
+        if (!s.ok()) {
+          statuses[t] = s;
+          return;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const Status& s : statuses) {
+    ASSERT_OK(s);
+  }
+}
+
+TEST_F(TestCompression, TestConcurrentZstdCompression) {
+  TestConcurrentCompression(ZSTD);
+}
+
+TEST_F(TestCompression, TestConcurrentZstdDictCompression) {
+  TestConcurrentCompression(ZSTD_DICT);
+}
+
+TEST_F(TestCompression, TestConcurrentLz4DictCompression) {
+  TestConcurrentCompression(LZ4_DICT);
+}
+
+// Changing the dictionary swaps in a new codec rather than changing the one
+// in use, and uncompressing msgs of another type leaves the current codec
+// alone.
+TEST_F(TestCompression, TestCodecManagerSharesImmutableCodecs) {
+  ASSERT_OK(CompressionCodecManager::SetCurrentCodec(ZSTD_DICT));
+  ASSERT_OK(CompressionCodecManager::SetDictionary(std::string(256, 'x')));
+  std::shared_ptr<CompressionCodec> codec =
+      CompressionCodecManager::GetCurrentCodec();
+  ASSERT_EQ(ZSTD_DICT, codec->type());
+
+  ASSERT_OK(CompressionCodecManager::SetDictionary(std::string(256, 'y')));
+  std::shared_ptr<CompressionCodec> new_codec =
+      CompressionCodecManager::GetCurrentCodec();
+  ASSERT_NE(codec.get(), new_codec.get());
+  ASSERT_EQ(std::string(256, 'x'), codec->GetDictionary());
+  ASSERT_EQ(std::string(256, 'y'), new_codec->GetDictionary());
+
+  std::shared_ptr<CompressionCodec> lz4_codec;
+  ASSERT_OK(CompressionCodecManager::GetCodecForType(LZ4_DICT, &lz4_codec));
+  ASSERT_EQ(LZ4_DICT, lz4_codec->type());
+  ASSERT_EQ(std::string(256, 'y'), lz4_codec->GetDictionary());
+  std::shared_ptr<CompressionCodec> same_lz4_codec;
+  ASSERT_OK(
+      CompressionCodecManager::GetCodecForType(LZ4_DICT, &same_lz4_codec));
+  ASSERT_EQ(lz4_codec.get(), same_lz4_codec.get());
+  ASSERT_EQ(new_codec.get(), CompressionCodecManager::GetCurrentCodec().get());
+
+  ASSERT_OK(CompressionCodecManager::SetCurrentCodec(NO_COMPRESSION));
+  ASSERT_OK(CompressionCodecManager::SetDictionary(""));
+  ASSERT_EQ(nullptr, CompressionCodecManager::GetCurrentCodec());
+}
+
+// A dictionary trained on small, repetitive payloads compresses them better
+// than no dictionary.
+TEST_F(TestCompression, TestTrainCompressionDict) {
+  vector<std::string> payloads;
+  for (int i = 0; i < 2000; i++) {
+    payloads.push_back(strings::Substitute(
+        "{\"table\":\"users\",\"op\":\"update\",\"id\":$0,"
+        "\"name\":\"user-$1\",\"status\":\"active\"}",
+        i,
+        i % 37));
+  }
+  vector<Slice> training;
+  vector<Slice> held_out;
+  for (int i = 0; i < payloads.size(); i++) {
+    (i % 4 == 0 ? held_out : training).emplace_back(payloads[i]);
+  }
+
+  std::string dict;
+  ASSERT_OK(TrainCompressionDict(training, 4096, &dict));
+  ASSERT_FALSE(dict.empty());
+  ASSERT_LE(dict.size(), 4096);
+  ASSERT_NE(0, CompressionCodecManager::GetDictionaryID(dict));
+
+  std::shared_ptr<CompressionCodec> plain;
+  ASSERT_OK(CompressionCodecManager::GetCodec(ZSTD, &plain));
+  std::shared_ptr<CompressionCodec> trained;
+  ASSERT_OK(CompressionCodecManager::GetCodec(ZSTD_DICT, &trained));
+  ASSERT_OK(trained->SetDictionary(dict));
+
+  CompressionEvaluation plain_eval;
+  CompressionEvaluation trained_eval;
+  ASSERT_OK(EvaluateCompressionCodec(plain.get(), held_out, &plain_eval));
+  ASSERT_OK(EvaluateCompressionCodec(trained.get(), held_out, &trained_eval));
+  ASSERT_EQ(plain_eval.uncompressed_bytes, trained_eval.uncompressed_bytes);
+  ASSERT_GT(trained_eval.Ratio(), plain_eval.Ratio());
+
+  ASSERT_FALSE(TrainCompressionDict({}, 4096, &dict).ok());
+}
+
 } // namespace kudu
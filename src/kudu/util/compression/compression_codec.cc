@@ -21,7 +21,9 @@
 
 #include "kudu/util/compression/compression_codec.h"
 
+#include <map>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
 #include <vector>
@@ -40,6 +42,7 @@
 #include "kudu/util/faststring.h"
 #include "kudu/util/jsonwriter.h"
 #include "kudu/util/logging.h"
+#include "kudu/util/mutex.h"
 #include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/string_case.h"
 
@@ -276,6 +279,24 @@ class Lz4Codec : public CompressionCodec {
   }
 };
 
+// The LZ4 frame contexts of the calling thread. They are not tied to a
+// dictionary, so all the LZ4_DICT codecs used by a thread share them.
+struct Lz4ThreadContexts {
+  ~Lz4ThreadContexts() {
+    if (compression_ctx) {
+      LZ4F_freeCompressionContext(compression_ctx);
+    }
+    if (decompression_ctx) {
+      LZ4F_freeDecompressionContext(decompression_ctx);
+    }
+  }
+
+  LZ4F_cctx* compression_ctx = nullptr;
+  LZ4F_dctx* decompression_ctx = nullptr;
+};
+
+thread_local Lz4ThreadContexts lz4_thread_contexts;
+
 class Lz4DictCodec : public CompressionCodec {
  public:
   Lz4DictCodec() {
@@ -283,8 +304,6 @@ class Lz4DictCodec : public CompressionCodec {
   }
 
   ~Lz4DictCodec() {
-    LZ4F_freeCompressionContext(compression_ctx_);
-    LZ4F_freeDecompressionContext(decompression_ctx_);
     LZ4F_freeCDict(dict_ctx_);
   }
 
@@ -292,8 +311,10 @@ class Lz4DictCodec : public CompressionCodec {
       const Slice& input,
       uint8_t* compressed,
       size_t* compressed_length) override {
-    if (!compression_ctx_ &&
-        LZ4F_createCompressionContext(&compression_ctx_, LZ4F_VERSION)) {
+    LZ4F_cctx*& compression_ctx = lz4_thread_contexts.compression_ctx;
+    if (!compression_ctx &&
+        LZ4F_createCompressionContext(&compression_ctx, LZ4F_VERSION)) {
+      compression_ctx = nullptr;
       return Status::RuntimeError("Could not create LZ4 compression context");
     }
 
@@ -305,7 +326,7 @@ class Lz4DictCodec : public CompressionCodec {
     prefs.frameInfo.contentSize = input.size();
 
     size_t ret = LZ4F_compressFrame_usingCDict(
-        compression_ctx_,
+        compression_ctx,
         compressed,
         max_comp_size,
         input.data(),
@@ -341,8 +362,10 @@ class Lz4DictCodec : public CompressionCodec {
       const Slice& compressed,
       uint8_t* uncompressed,
       size_t uncompressed_length) override {
-    if (!decompression_ctx_ &&
-        LZ4F_createDecompressionContext(&decompression_ctx_, LZ4F_VERSION)) {
+    LZ4F_dctx*& decompression_ctx = lz4_thread_contexts.decompression_ctx;
+    if (!decompression_ctx &&
+        LZ4F_createDecompressionContext(&decompression_ctx, LZ4F_VERSION)) {
+      decompression_ctx = nullptr;
       return Status::RuntimeError("Could not create LZ4 decompression context");
     }
 
@@ -350,9 +373,9 @@ class Lz4DictCodec : public CompressionCodec {
 
     LZ4F_frameInfo_t frame_info;
     size_t ret = LZ4F_getFrameInfo(
-        decompression_ctx_, &frame_info, compressed.data(), &frame_info_size);
+        decompression_ctx, &frame_info, compressed.data(), &frame_info_size);
     if (LZ4F_isError(ret)) {
-      LZ4F_resetDecompressionContext(decompression_ctx_);
+      LZ4F_resetDecompressionContext(decompression_ctx);
       return Status::Corruption(strings::Substitute(
           "Could not extract LZ4 frame info: $0", LZ4F_getErrorName(ret)));
     }
@@ -362,6 +385,7 @@ class Lz4DictCodec : public CompressionCodec {
         CompressionCodecManager::GetDictionaryID(dict_);
 
     if (expected_dict_id != actual_dict_id) {
+      LZ4F_resetDecompressionContext(decompression_ctx);
       return Status::CompressionDictMismatch("Dictionary ID mismatch");
     }
 
@@ -373,7 +397,7 @@ class Lz4DictCodec : public CompressionCodec {
     const uint8_t* compressed_buf = compressed.data() + frame_info_size;
 
     ret = LZ4F_decompress_usingDict(
-        decompression_ctx_,
+        decompression_ctx,
         uncompressed,
         &uncompressed_length,
         compressed_buf,
@@ -382,7 +406,7 @@ class Lz4DictCodec : public CompressionCodec {
         dict_.size(),
         &opts);
     if (LZ4F_isError(ret)) {
-      LZ4F_resetDecompressionContext(decompression_ctx_);
+      LZ4F_resetDecompressionContext(decompression_ctx);
       return Status::Corruption(strings::Substitute(
           "Unable to decompress the buffer: $0", LZ4F_getErrorName(ret)));
     }
@@ -395,6 +419,7 @@ class Lz4DictCodec : public CompressionCodec {
   }
 
   Status SetDictionary(const std::string& dict) override {
+    LZ4F_freeCDict(dict_ctx_);
     dict_ = dict;
     dict_ctx_ = LZ4F_createCDict(dict_.data(), dict_.size());
     return Status::OK();
@@ -420,9 +445,6 @@ class Lz4DictCodec : public CompressionCodec {
   }
 
  private:
-  LZ4F_cctx* compression_ctx_ = nullptr;
-  LZ4F_dctx* decompression_ctx_ = nullptr;
-
   LZ4F_CDict* dict_ctx_ = nullptr;
   std::string dict_;
 };
@@ -709,9 +731,13 @@ class ZstdDictCodec : public CompressionCodec {
   ZSTD_DDict* decompression_dict_ = nullptr;
 };
 
+Mutex CompressionCodecManager::update_lock_;
+simple_spinlock CompressionCodecManager::lock_;
 std::string CompressionCodecManager::dictionary_;
 std::shared_ptr<CompressionCodec> CompressionCodecManager::codec_;
 int CompressionCodecManager::level_;
+std::map<CompressionType, std::shared_ptr<CompressionCodec>>
+    CompressionCodecManager::other_codecs_;
 
 Status CompressionCodecManager::GetCodec(
     CompressionType type,
@@ -744,42 +770,131 @@ Status CompressionCodecManager::GetCodec(
   return Status::OK();
 }
 
-Status CompressionCodecManager::SetCurrentCodec(CompressionType type) {
-  if (codec_ && type == codec_->type()) {
-    return Status::OK();
-  }
-  std::shared_ptr<CompressionCodec> codec = nullptr;
+Status CompressionCodecManager::MakeCodec(
+    CompressionType type,
+    const std::string& dict,
+    int* level,
+    std::shared_ptr<CompressionCodec>* codec) {
   // codec can be nullptr if type = NO_COMPRESSION
-  RETURN_NOT_OK(GetCodec(type, &codec));
-  if (codec) {
-    RETURN_NOT_OK(codec->SetDictionary(dictionary_));
-    if (!codec->SetCompressionLevel(level_).ok()) {
-      int codec_level = codec->CompressionLevel();
-      LOG(WARNING) << "Could not set compression level to " << level_ << ". "
+  RETURN_NOT_OK(GetCodec(type, codec));
+  if (*codec) {
+    RETURN_NOT_OK((*codec)->SetDictionary(dict));
+    if (!(*codec)->SetCompressionLevel(*level).ok()) {
+      int codec_level = (*codec)->CompressionLevel();
+      LOG(WARNING) << "Could not set compression level to " << *level << ". "
                    << "Using the default compression level " << codec_level
                    << " instead";
-      level_ = codec_level;
+      *level = codec_level;
     }
   }
-  codec_ = codec;
+  return Status::OK();
+}
+
+Status CompressionCodecManager::GetCodecForType(
+    CompressionType type,
+    std::shared_ptr<CompressionCodec>* codec) {
+  if (type == NO_COMPRESSION) {
+    *codec = nullptr;
+    return Status::OK();
+  }
+  std::string dict;
+  int level;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (codec_ && codec_->type() == type) {
+      *codec = codec_;
+      return Status::OK();
+    }
+    auto it = other_codecs_.find(type);
+    if (it != other_codecs_.end()) {
+      *codec = it->second;
+      return Status::OK();
+    }
+  }
+
+  MutexLock update(update_lock_);
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    // Another thread may have set it up while we waited.
+    if (codec_ && codec_->type() == type) {
+      *codec = codec_;
+      return Status::OK();
+    }
+    auto it = other_codecs_.find(type);
+    if (it != other_codecs_.end()) {
+      *codec = it->second;
+      return Status::OK();
+    }
+    dict = dictionary_;
+    level = level_;
+  }
+  // The level is only adjusted for the current codec.
+  std::shared_ptr<CompressionCodec> new_codec;
+  RETURN_NOT_OK(MakeCodec(type, dict, &level, &new_codec));
+  std::lock_guard<simple_spinlock> l(lock_);
+  other_codecs_[type] = new_codec;
+  *codec = std::move(new_codec);
+  return Status::OK();
+}
+
+Status CompressionCodecManager::SetCurrentCodec(CompressionType type) {
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if ((codec_ ? codec_->type() : NO_COMPRESSION) == type) {
+      return Status::OK();
+    }
+  }
+  MutexLock update(update_lock_);
+  std::string dict;
+  int level;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if ((codec_ ? codec_->type() : NO_COMPRESSION) == type) {
+      return Status::OK();
+    }
+    dict = dictionary_;
+    level = level_;
+  }
+  std::shared_ptr<CompressionCodec> codec;
+  RETURN_NOT_OK(MakeCodec(type, dict, &level, &codec));
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    codec_ = codec;
+    level_ = level;
+    other_codecs_.clear();
+  }
   LOG(INFO) << "Set compression codec to: "
-            << GetCodecName(codec_ ? codec_->type() : NO_COMPRESSION);
+            << GetCodecName(codec ? codec->type() : NO_COMPRESSION);
   return Status::OK();
 }
 
 Status CompressionCodecManager::SetDictionary(const std::string& dict) {
-  if (!codec_) {
+  MutexLock update(update_lock_);
+  std::shared_ptr<CompressionCodec> codec;
+  int level;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    codec = codec_;
+    level = level_;
+  }
+  if (codec) {
+    RETURN_NOT_OK(MakeCodec(codec->type(), dict, &level, &codec));
+  }
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    codec_ = codec;
     dictionary_ = dict;
-    return Status::OK();
+    level_ = level;
+    other_codecs_.clear();
+  }
+  if (codec) {
+    LOG(INFO) << "Updating compression dict to id " << GetDictionaryID(dict);
   }
-  RETURN_NOT_OK(codec_->SetDictionary(dict));
-  dictionary_ = dict;
-  LOG(INFO) << "Updating compression dict to id " << GetCurrentDictionaryID();
   return Status::OK();
 }
 
 unsigned int CompressionCodecManager::GetCurrentDictionaryID() {
-  return GetDictionaryID(dictionary_);
+  return GetDictionaryID(GetDictionary());
 }
 
 unsigned int CompressionCodecManager::GetDictionaryID(const std::string& dict) {
@@ -788,12 +903,23 @@ unsigned int CompressionCodecManager::GetDictionaryID(const std::string& dict) {
 }
 
 Status CompressionCodecManager::SetCurrentCompressionLevel(int level) {
-  if (!codec_) {
-    level_ = level;
-    return Status::OK();
+  MutexLock update(update_lock_);
+  std::shared_ptr<CompressionCodec> codec;
+  std::string dict;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    codec = codec_;
+    dict = dictionary_;
   }
-  RETURN_NOT_OK(codec_->SetCompressionLevel(level));
+  if (codec) {
+    RETURN_NOT_OK(GetCodec(codec->type(), &codec));
+    RETURN_NOT_OK(codec->SetDictionary(dict));
+    RETURN_NOT_OK(codec->SetCompressionLevel(level));
+  }
+  std::lock_guard<simple_spinlock> l(lock_);
+  codec_ = codec;
   level_ = level;
+  other_codecs_.clear();
   return Status::OK();
 }
 
@@ -17,8 +17,12 @@
 #ifndef KUDU_CFILE_COMPRESSION_CODEC_H
 #define KUDU_CFILE_COMPRESSION_CODEC_H
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <vector>
@@ -28,11 +32,17 @@
 
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/mutex.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 
 namespace kudu {
 
+// A codec is configured (dictionary, compression level) before it is shared
+// and is left alone afterwards. Compress() and Uncompress() keep their
+// scratch state in per-thread contexts, so any number of threads may use
+// the same codec at once.
 class CompressionCodec {
  public:
   CompressionCodec();
@@ -101,7 +111,8 @@ class CompressionCodec {
   // Returns a JSON which contains stats
   virtual std::string Stats() const;
 
-  // Sets a compression dictionary
+  // Sets a compression dictionary. Not thread safe: only call this on a
+  // codec which is not shared yet.
   virtual Status SetDictionary(const std::string& /*dict*/) {
     LOG(WARNING) << "Dictionary compression is not supported by "
                  << CompressionType_Name(type());
@@ -113,7 +124,7 @@ class CompressionCodec {
     return {};
   }
 
-  // Sets compression level
+  // Sets compression level. Not thread safe, like SetDictionary().
   virtual Status SetCompressionLevel(int level) {
     compression_level_ = level;
     return Status::OK();
@@ -131,14 +142,14 @@ class CompressionCodec {
 
  private:
   // Stats
-  uint64_t total_bytes_before_compression_ = 0;
-  uint64_t total_bytes_after_compression_ = 0;
-  uint64_t total_compressions_ = 0;
-  uint64_t total_bytes_before_decompression_ = 0;
-  uint64_t total_bytes_after_decompression_ = 0;
-  uint64_t total_decompressions_ = 0;
-  uint64_t total_compression_errors_ = 0;
-  uint64_t total_decompression_errors_ = 0;
+  std::atomic<uint64_t> total_bytes_before_compression_{0};
+  std::atomic<uint64_t> total_bytes_after_compression_{0};
+  std::atomic<uint64_t> total_compressions_{0};
+  std::atomic<uint64_t> total_bytes_before_decompression_{0};
+  std::atomic<uint64_t> total_bytes_after_decompression_{0};
+  std::atomic<uint64_t> total_decompressions_{0};
+  std::atomic<uint64_t> total_compression_errors_{0};
+  std::atomic<uint64_t> total_decompression_errors_{0};
 
   DISALLOW_COPY_AND_ASSIGN(CompressionCodec);
 };
@@ -146,10 +157,12 @@ class CompressionCodec {
 /**
  * Manages global compression codec, dictionary and compression level
  *
- * This class is NOT thread safe. In the commit path we rely on taking
- * RaftConsensus::lock_ and PeerConsensusQueue::queue_lock_ while updating
- * codec, dict, level etc. and also compression and decompression using the
- * codec
+ * This class is thread safe. The codecs it hands out are never changed once
+ * published: changing the codec, the dictionary or the level builds a new
+ * codec and swaps it in, while the threads still holding the old one keep
+ * using it. A shared codec is thus fully described by its type, level and
+ * dictionary id, and can be used by peers, proxies and log readers at the
+ * same time.
  */
 class CompressionCodecManager {
  public:
@@ -164,16 +177,26 @@ class CompressionCodecManager {
   }
 
   static std::shared_ptr<CompressionCodec> GetCurrentCodec() {
+    std::lock_guard<simple_spinlock> l(lock_);
     return codec_;
   }
 
+  // Returns a shared codec of type 'type' using the current dictionary and
+  // level, to (un)compress msgs of that type. Unlike SetCurrentCodec() this
+  // leaves the current codec alone. Sets 'codec' to nullptr for
+  // NO_COMPRESSION.
+  static Status GetCodecForType(
+      CompressionType type,
+      std::shared_ptr<CompressionCodec>* codec);
+
   static Status SetCurrentCodec(CompressionType type);
 
   static Status SetCurrentCodec(const std::string& type) {
     return SetCurrentCodec(GetCodecType(type));
   }
 
-  static const std::string& GetDictionary() {
+  static std::string GetDictionary() {
+    std::lock_guard<simple_spinlock> l(lock_);
     return dictionary_;
   }
 
@@ -202,10 +225,30 @@ class CompressionCodecManager {
  private:
   CompressionCodecManager() {}
 
+  // Creates a codec of type 'type' set up with 'dict' and '*level'. If the
+  // codec does not support '*level', it keeps its default level, which is
+  // stored in '*level'.
+  static Status MakeCodec(
+      CompressionType type,
+      const std::string& dict,
+      int* level,
+      std::shared_ptr<CompressionCodec>* codec);
+
+  // Serializes the setters, which build codecs outside of 'lock_'.
+  static Mutex update_lock_;
+
+  // Protects the members below.
+  static simple_spinlock lock_;
+
   static std::shared_ptr<CompressionCodec> codec_;
   static std::string dictionary_;
   static int level_;
 
+  // Codecs of the other types built by GetCodecForType() for the current
+  // dictionary and level. Cleared whenever either changes.
+  static std::map<CompressionType, std::shared_ptr<CompressionCodec>>
+      other_codecs_;
+
   DISALLOW_COPY_AND_ASSIGN(CompressionCodecManager);
 };
 
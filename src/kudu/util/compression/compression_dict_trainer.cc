@@ -0,0 +1,85 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#include "kudu/util/compression/compression_dict_trainer.h"
+
+#include <zdict.h>
+
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/compression/compression_codec.h"
+#include "kudu/util/faststring.h"
+#include "kudu/util/stopwatch.h"
+
+namespace kudu {
+
+using std::string;
+using std::vector;
+
+Status TrainCompressionDict(
+    const vector<Slice>& samples,
+    size_t max_dict_size,
+    string* dict) {
+  if (samples.empty()) {
+    return Status::InvalidArgument("No samples to train a dictionary on");
+  }
+  // ZDICT wants the samples back to back.
+  faststring buffer;
+  vector<size_t> sizes;
+  sizes.reserve(samples.size());
+  for (const Slice& sample : samples) {
+    buffer.append(sample.data(), sample.size());
+    sizes.push_back(sample.size());
+  }
+
+  dict->resize(max_dict_size);
+  size_t ret = ZDICT_trainFromBuffer(
+      &(*dict)[0],
+      dict->size(),
+      buffer.data(),
+      sizes.data(),
+      sizes.size());
+  if (ZDICT_isError(ret)) {
+    dict->clear();
+    return Status::RuntimeError(strings::Substitute(
+        "Unable to train a dictionary on $0 samples: $1",
+        samples.size(),
+        ZDICT_getErrorName(ret)));
+  }
+  dict->resize(ret);
+  return Status::OK();
+}
+
+Status EvaluateCompressionCodec(
+    CompressionCodec* codec,
+    const vector<Slice>& samples,
+    CompressionEvaluation* eval) {
+  faststring buffer;
+  Stopwatch sw;
+  for (const Slice& sample : samples) {
+    buffer.resize(codec->MaxCompressedLength(sample.size()));
+    size_t compressed_length = 0;
+    sw.resume();
+    Status s = codec->Compress(sample, buffer.data(), &compressed_length);
+    sw.stop();
+    RETURN_NOT_OK(s);
+    eval->uncompressed_bytes += sample.size();
+    eval->compressed_bytes += compressed_length;
+  }
+  eval->compress_micros += sw.elapsed().wall / 1000;
+  return Status::OK();
+}
+
+} // namespace kudu
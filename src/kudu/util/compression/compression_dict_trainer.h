@@ -0,0 +1,59 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "kudu/util/slice.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+class CompressionCodec;
+
+// How well a codec compressed a set of payloads.
+struct CompressionEvaluation {
+  int64_t uncompressed_bytes = 0;
+  int64_t compressed_bytes = 0;
+  int64_t compress_micros = 0;
+
+  double Ratio() const {
+    return compressed_bytes > 0
+        ? static_cast<double>(uncompressed_bytes) / compressed_bytes
+        : 0;
+  }
+};
+
+// Trains a dictionary of at most 'max_dict_size' bytes on 'samples', in the
+// ZSTD format which both ZSTD_DICT and LZ4_DICT use. The dictionary gets a
+// random id, so that peers can tell it from the one it replaces.
+Status TrainCompressionDict(
+    const std::vector<Slice>& samples,
+    size_t max_dict_size,
+    std::string* dict);
+
+// Compresses each of 'samples' with 'codec', and adds up the sizes and the
+// time it took in 'eval'.
+Status EvaluateCompressionCodec(
+    CompressionCodec* codec,
+    const std::vector<Slice>& samples,
+    CompressionEvaluation* eval);
+
+} // namespace kudu
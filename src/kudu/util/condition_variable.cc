@@ -13,14 +13,41 @@
 
 #include <glog/logging.h>
 
+#include "kudu/gutil/port.h"
+#include "kudu/gutil/walltime.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/mutex.h"
+#include "kudu/util/spinlock_profiling.h"
 #include "kudu/util/thread_restrictions.h"
 
 namespace kudu {
 
+namespace {
+
+// Reports the time spent blocked in a wait to the synchronization profiler,
+// but only while it is collecting idle waits.
+class ScopedIdleWaitTimer {
+ public:
+  ScopedIdleWaitTimer()
+      : start_micros_(
+            IsIdleWaitProfilingEnabled() ? GetMonoTimeMicros() : -1) {}
+
+  ~ScopedIdleWaitTimer() {
+    if (PREDICT_FALSE(start_micros_ >= 0)) {
+      SubmitBlockingWaitProfileData(
+          GetMonoTimeMicros() - start_micros_, /*idle_wait=*/true);
+    }
+  }
+
+ private:
+  const MicrosecondsInt64 start_micros_;
+};
+
+} // anonymous namespace
+
 ConditionVariable::ConditionVariable(Mutex* user_lock)
-    : user_mutex_(&user_lock->native_handle_)
+    : user_mutex_(&user_lock->native_handle_),
+      mutex_(user_lock)
 #ifdef FB_DO_NOT_REMOVE // #ifndef NDEBUG
       ,
       user_lock_(user_lock)
@@ -53,6 +80,8 @@ void ConditionVariable::Wait() const {
 #ifdef FB_DO_NOT_REMOVE // #ifndef NDEBUG
   user_lock_->CheckHeldAndUnmark();
 #endif
+  mutex_->EndProfiledHold();
+  ScopedIdleWaitTimer wait_timer;
   int rv = pthread_cond_wait(&condition_, user_mutex_);
   DCHECK_EQ(0, rv);
 #ifdef FB_DO_NOT_REMOVE // #ifndef NDEBUG
@@ -73,6 +102,8 @@ bool ConditionVariable::WaitUntil(const MonoTime& until) const {
   user_lock_->CheckHeldAndUnmark();
 #endif
 
+  mutex_->EndProfiledHold();
+  ScopedIdleWaitTimer wait_timer;
 #if defined(__APPLE__)
   // macOS does not provide a way to configure pthread_cond_timedwait() to use
   // monotonic clocks, so we must convert the deadline into a delta and perform
@@ -109,6 +140,8 @@ bool ConditionVariable::WaitFor(const MonoDelta& delta) const {
   user_lock_->CheckHeldAndUnmark();
 #endif
 
+  mutex_->EndProfiledHold();
+  ScopedIdleWaitTimer wait_timer;
 #if defined(__APPLE__)
   struct timespec relative_time;
   delta.ToTimeSpec(&relative_time);
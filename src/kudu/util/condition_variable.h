@@ -105,6 +105,9 @@ class ConditionVariable {
   mutable pthread_cond_t condition_;
   pthread_mutex_t* user_mutex_;
 
+  // Needed to stop timing the hold of a profiled mutex while waiting.
+  Mutex* const mutex_;
+
 #ifdef FB_DO_NOT_REMOVE // #ifndef NDEBUG
   Mutex* user_lock_; // Needed to adjust shadow lock state on wait.
 #endif
@@ -16,11 +16,31 @@
 // under the License.
 #include "kudu/util/crc.h"
 
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#include <arm_acle.h>
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
 #include <crcutil/interface.h>
 
+#include "kudu/gutil/cpu.h"
 #include "kudu/gutil/once.h"
+#include "kudu/gutil/port.h"
 #include "kudu/util/debug/leakcheck_disabler.h"
 
+#if defined(__x86_64__)
+#define KUDU_HW_CRC32C 1
+#define KUDU_HW_CRC32C_TARGET __attribute__((target("sse4.2")))
+#elif defined(__aarch64__) && defined(__linux__)
+#define KUDU_HW_CRC32C 1
+#define KUDU_HW_CRC32C_TARGET __attribute__((target("+crc")))
+#endif
+
 namespace kudu {
 namespace crc {
 
@@ -40,13 +60,181 @@ Crc* GetCrc32cInstance() {
   return crc32c_instance;
 }
 
+#ifdef KUDU_HW_CRC32C
+namespace {
+
+// The CRC32C polynomial, bit-reflected.
+constexpr uint32_t kPoly = 0x82f63b78;
+
+// Sizes of the blocks checksummed as three interleaved streams, so the
+// latency of the crc32 instruction is hidden by the other two streams.
+constexpr size_t kLongBlock = 8192;
+constexpr size_t kShortBlock = 256;
+
+// Tables shifting a CRC by the given number of zero bytes, one per byte of
+// the CRC, used to combine the CRCs of the interleaved streams.
+struct ShiftTable {
+  uint32_t t[4][256];
+};
+ShiftTable long_shift;
+ShiftTable short_shift;
+
+// Returns a * b modulo the CRC32C polynomial, both bit-reflected.
+uint32_t MultModP(uint32_t a, uint32_t b) {
+  uint32_t m = 1U << 31;
+  uint32_t p = 0;
+  for (;;) {
+    if (a & m) {
+      p ^= b;
+      if ((a & (m - 1)) == 0) {
+        break;
+      }
+    }
+    m >>= 1;
+    b = (b & 1) ? (b >> 1) ^ kPoly : b >> 1;
+  }
+  return p;
+}
+
+// Returns x^(8 * len) modulo the CRC32C polynomial, bit-reflected.
+uint32_t XPow8N(size_t len) {
+  uint32_t result = 1U << 31; // x^0
+  uint32_t sq = 1U << 23; // x^8
+  while (len) {
+    if (len & 1) {
+      result = MultModP(sq, result);
+    }
+    sq = MultModP(sq, sq);
+    len >>= 1;
+  }
+  return result;
+}
+
+void InitShiftTable(size_t len, ShiftTable* table) {
+  const uint32_t op = XPow8N(len);
+  for (uint32_t n = 0; n < 256; n++) {
+    for (int i = 0; i < 4; i++) {
+      table->t[i][n] = MultModP(op, n << (8 * i));
+    }
+  }
+}
+
+inline uint32_t Shift(const ShiftTable& table, uint32_t crc) {
+  return table.t[0][crc & 0xff] ^ table.t[1][(crc >> 8) & 0xff] ^
+      table.t[2][(crc >> 16) & 0xff] ^ table.t[3][crc >> 24];
+}
+
+bool DetectHardwareCrc32c() {
+#if defined(__x86_64__)
+  static const base::CPU cpu;
+  return cpu.has_sse42();
+#else
+  return getauxval(AT_HWCAP) & HWCAP_CRC32;
+#endif
+}
+
+GoogleOnceType hw_crc32c_once = GOOGLE_ONCE_INIT;
+bool hw_crc32c_supported = false;
+
+void InitHardwareCrc32c() {
+  hw_crc32c_supported = DetectHardwareCrc32c();
+  if (hw_crc32c_supported) {
+    InitShiftTable(kLongBlock, &long_shift);
+    InitShiftTable(kShortBlock, &short_shift);
+  }
+}
+
+KUDU_HW_CRC32C_TARGET inline uint32_t Crc8(uint32_t crc, uint8_t v) {
+#if defined(__x86_64__)
+  return _mm_crc32_u8(crc, v);
+#else
+  return __crc32cb(crc, v);
+#endif
+}
+
+KUDU_HW_CRC32C_TARGET inline uint64_t Crc64(uint64_t crc, const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+#if defined(__x86_64__)
+  return _mm_crc32_u64(crc, v);
+#else
+  return __crc32cd(static_cast<uint32_t>(crc), v);
+#endif
+}
+
+// Checksums 3 * 'block' bytes at '*p' as three interleaved streams, advancing
+// '*p' and combining the CRCs into the returned one.
+KUDU_HW_CRC32C_TARGET inline uint64_t Crc3Way(
+    uint64_t crc0,
+    const uint8_t** p,
+    size_t block,
+    const ShiftTable& shift) {
+  const uint8_t* next = *p;
+  const uint8_t* end = next + block;
+  uint64_t crc1 = 0;
+  uint64_t crc2 = 0;
+  do {
+    crc0 = Crc64(crc0, next);
+    crc1 = Crc64(crc1, next + block);
+    crc2 = Crc64(crc2, next + 2 * block);
+    next += 8;
+  } while (next < end);
+  crc0 = Shift(shift, static_cast<uint32_t>(crc0)) ^ crc1;
+  crc0 = Shift(shift, static_cast<uint32_t>(crc0)) ^ crc2;
+  *p = next + 2 * block;
+  return crc0;
+}
+
+KUDU_HW_CRC32C_TARGET uint32_t
+HardwareCrc32c(const void* data, size_t length, uint32_t prev_crc32) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  uint64_t crc = ~prev_crc32;
+  while (length > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0) {
+    crc = Crc8(crc, *p++);
+    length--;
+  }
+  while (length >= 3 * kLongBlock) {
+    crc = Crc3Way(crc, &p, kLongBlock, long_shift);
+    length -= 3 * kLongBlock;
+  }
+  while (length >= 3 * kShortBlock) {
+    crc = Crc3Way(crc, &p, kShortBlock, short_shift);
+    length -= 3 * kShortBlock;
+  }
+  while (length >= 8) {
+    crc = Crc64(crc, p);
+    p += 8;
+    length -= 8;
+  }
+  while (length > 0) {
+    crc = Crc8(crc, *p++);
+    length--;
+  }
+  return ~static_cast<uint32_t>(crc);
+}
+
+} // anonymous namespace
+#endif // KUDU_HW_CRC32C
+
+bool HasHardwareCrc32c() {
+#ifdef KUDU_HW_CRC32C
+  GoogleOnceInit(&hw_crc32c_once, &InitHardwareCrc32c);
+  return hw_crc32c_supported;
+#else
+  return false;
+#endif
+}
+
 uint32_t Crc32c(const void* data, size_t length) {
-  uint64_t crc32 = 0;
-  GetCrc32cInstance()->Compute(data, length, &crc32);
-  return static_cast<uint32_t>(crc32); // Only uses lower 32 bits.
+  return Crc32c(data, length, 0);
 }
 
 uint32_t Crc32c(const void* data, size_t length, uint32_t prev_crc32) {
+#ifdef KUDU_HW_CRC32C
+  if (PREDICT_TRUE(HasHardwareCrc32c())) {
+    return HardwareCrc32c(data, length, prev_crc32);
+  }
+#endif
   uint64_t crc_tmp = static_cast<uint64_t>(prev_crc32);
   GetCrc32cInstance()->Compute(data, length, &crc_tmp);
   return static_cast<uint32_t>(crc_tmp); // Only uses lower 32 bits.
@@ -30,6 +30,11 @@ typedef crcutil_interface::CRC Crc;
 // Returns pointer to singleton instance of CRC32C implementation.
 Crc* GetCrc32cInstance();
 
+// Returns whether Crc32c() uses the CRC32C instructions of the CPU (SSE4.2
+// on x86, the CRC extension on ARMv8), checksumming large buffers as three
+// interleaved streams. Otherwise it falls back to crcutil.
+bool HasHardwareCrc32c();
+
 // Helper function to simply calculate a CRC32C of the given data.
 uint32_t Crc32c(const void* data, size_t length);
 
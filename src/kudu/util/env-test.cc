@@ -59,6 +59,7 @@
 #include "kudu/util/array_view.h" // IWYU pragma: keep
 #include "kudu/util/env_util.h"
 #include "kudu/util/faststring.h"
+#include "kudu/util/io_uring.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/path_util.h"
 #include "kudu/util/random.h"
@@ -595,6 +596,88 @@ TEST_F(TestEnv, TestAppendV) {
   }
 }
 
+TEST_F(TestEnv, TestAppendVWithIoUring) {
+  if (!IoUring::IsSupported()) {
+    LOG(INFO) << "io_uring not supported, skipping test";
+    return;
+  }
+  WritableFileOptions opts;
+  opts.use_io_uring = true;
+  ASSERT_NO_FATAL_FAILURE(TestAppendV(2000, 1024, 5, true, false, opts));
+  ASSERT_NO_FATAL_FAILURE(TestAppendV(128, 4096, 5, false, false, opts));
+
+  // A write with a linked sync must land as if written by AppendV().
+  const string kTestPath = GetTestPath("test_io_uring_sync");
+  unique_ptr<WritableFile> file;
+  ASSERT_OK(env_->NewWritableFile(opts, kTestPath, &file));
+  Slice data[2] = {Slice("hello "), Slice("world")};
+  ASSERT_OK(file->AppendVAndSync(data));
+  ASSERT_OK(file->AppendVAndSync(data));
+  ASSERT_EQ(22, file->Size());
+  ASSERT_OK(file->Close());
+  faststring contents;
+  ASSERT_OK(ReadFileToString(env_, kTestPath, &contents));
+  ASSERT_EQ("hello worldhello world", contents.ToString());
+}
+
+TEST_F(TestEnv, TestAppendVWithDirectIo) {
+  WritableFileOptions opts;
+  opts.use_direct_io = true;
+  ASSERT_NO_FATAL_FAILURE(TestAppendV(2000, 1024, 5, true, false, opts));
+  ASSERT_NO_FATAL_FAILURE(TestAppendV(128, 4096, 5, false, true, opts));
+
+  // Unaligned appends, across reopens, must not leave any padding behind.
+  const string kTestPath = GetTestPath("test_direct_io");
+  unique_ptr<WritableFile> file;
+  ASSERT_OK(env_->NewWritableFile(opts, kTestPath, &file));
+  ASSERT_OK(file->Append("hello "));
+  ASSERT_OK(file->Append("world"));
+  ASSERT_OK(file->Close());
+  opts.mode = Env::OPEN_EXISTING;
+  ASSERT_OK(env_->NewWritableFile(opts, kTestPath, &file));
+  ASSERT_EQ(11, file->Size());
+  ASSERT_OK(file->Append("!"));
+  ASSERT_OK(file->Close());
+  faststring contents;
+  ASSERT_OK(ReadFileToString(env_, kTestPath, &contents));
+  ASSERT_EQ("hello world!", contents.ToString());
+
+  // Reusing the file's blocks discards its contents.
+  opts.reuse_existing_blocks = true;
+  ASSERT_OK(env_->NewWritableFile(opts, kTestPath, &file));
+  ASSERT_EQ(0, file->Size());
+  ASSERT_OK(file->Append("bye"));
+  ASSERT_OK(file->Close());
+  ASSERT_OK(ReadFileToString(env_, kTestPath, &contents));
+  ASSERT_EQ("bye", contents.ToString());
+}
+
+TEST_F(TestEnv, TestReuseZeroedBlocks) {
+  const string kTestPath = GetTestPath("test_zeroed");
+  const string kZeros(4096, '\0');
+  unique_ptr<WritableFile> file;
+  ASSERT_OK(env_->NewWritableFile(kTestPath, &file));
+  ASSERT_OK(file->Append(kZeros));
+  ASSERT_OK(file->Close());
+
+  // The zeroed contents are kept in place while the file is being written,
+  // and whatever is left of them is trimmed off on close.
+  WritableFileOptions opts;
+  opts.mode = Env::OPEN_EXISTING;
+  opts.reuse_existing_blocks = true;
+  opts.existing_blocks_zeroed = true;
+  ASSERT_OK(env_->NewWritableFile(opts, kTestPath, &file));
+  ASSERT_EQ(0, file->Size());
+  ASSERT_OK(file->Append("abc"));
+  uint64_t size_on_disk;
+  ASSERT_OK(env_->GetFileSize(kTestPath, &size_on_disk));
+  ASSERT_EQ(kZeros.size(), size_on_disk);
+  ASSERT_OK(file->Close());
+  faststring contents;
+  ASSERT_OK(ReadFileToString(env_, kTestPath, &contents));
+  ASSERT_EQ("abc", contents.ToString());
+}
+
 TEST_F(TestEnv, TestGetExecutablePath) {
   string p;
   ASSERT_OK(Env::Default()->GetExecutablePath(&p));
@@ -8,6 +8,7 @@
 
 #include <glog/logging.h>
 
+#include "kudu/util/array_view.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/slice.h"
 
@@ -23,6 +24,11 @@ RandomAccessFile::~RandomAccessFile() {}
 
 WritableFile::~WritableFile() {}
 
+Status WritableFile::AppendVAndSync(ArrayView<const Slice> data) {
+  RETURN_NOT_OK(AppendV(data));
+  return Sync();
+}
+
 RWFile::~RWFile() {}
 
 FileLock::~FileLock() {}
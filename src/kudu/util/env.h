@@ -460,6 +460,24 @@ class RandomAccessFile {
   // Safe for concurrent use by multiple threads.
   virtual Status ReadV(uint64_t offset, ArrayView<Slice> results) const = 0;
 
+  // Hints that the file is read sequentially from 'offset' on, and that the
+  // 'length' bytes at 'offset' are read next, so that they may be read ahead.
+  // This is only a hint: the default implementation ignores it.
+  //
+  // Safe for concurrent use by multiple threads.
+  virtual Status AdviseSequentialRead(
+      uint64_t /*offset*/,
+      uint64_t /*length*/) const {
+    return Status::OK();
+  }
+
+  // Returns the file descriptor the file is read from, so that reads can be
+  // issued outside of this class (e.g. through io_uring, see AsyncEnv), or -1
+  // if there is none. The default implementation returns -1.
+  virtual int fd() const {
+    return -1;
+  }
+
   // Returns the size of the file
   virtual Status Size(uint64_t* size) const = 0;
 
@@ -479,8 +497,34 @@ struct WritableFileOptions {
   // See CreateMode for details.
   Env::CreateMode mode;
 
+  // Issue writes and syncs through io_uring(7), if supported by the
+  // platform. Falls back to regular I/O otherwise.
+  bool use_io_uring;
+
+  // Bypass the page cache with O_DIRECT, if supported by the platform and
+  // the filesystem. Falls back to buffered I/O otherwise. Takes precedence
+  // over 'use_io_uring'.
+  bool use_direct_io;
+
+  // Only with OPEN_EXISTING: discard the existing contents of the file and
+  // start writing from offset 0, while keeping the file's blocks allocated
+  // where the filesystem allows it (as if they had been preallocated).
+  bool reuse_existing_blocks;
+
+  // Only with 'reuse_existing_blocks': the caller guarantees that the file's
+  // existing contents are all zeros and have been written out, so they are
+  // kept as is instead of being discarded. Unlike discarding, which may leave
+  // the blocks unwritten (and thus due for conversion on their next write),
+  // this keeps appends to the file from doing any extent conversion work.
+  bool existing_blocks_zeroed;
+
   WritableFileOptions()
-      : sync_on_close(false), mode(Env::CREATE_IF_NON_EXISTING_TRUNCATE) {}
+      : sync_on_close(false),
+        mode(Env::CREATE_IF_NON_EXISTING_TRUNCATE),
+        use_io_uring(false),
+        use_direct_io(false),
+        reuse_existing_blocks(false),
+        existing_blocks_zeroed(false) {}
 };
 
 // Options specified when a file is opened for random access.
@@ -529,6 +573,11 @@ class WritableFile {
 
   virtual Status Sync() = 0;
 
+  // Appends 'data' and then syncs the file, as AppendV() followed by Sync()
+  // would. Implementations may be able to issue both with a single system
+  // call.
+  virtual Status AppendVAndSync(ArrayView<const Slice> data);
+
   virtual uint64_t Size() const = 0;
 
   // Returns the filename provided when the WritableFile was constructed.
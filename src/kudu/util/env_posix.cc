@@ -17,6 +17,7 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cstdint>
 #include <cstdio>
@@ -54,6 +55,7 @@
 #include "kudu/util/fault_injection.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/flags.h"
+#include "kudu/util/io_uring.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/malloc.h"
 #include "kudu/util/monotime.h"
@@ -97,6 +99,9 @@ using strings::Substitute;
 #ifndef FALLOC_FL_PUNCH_HOLE
 #define FALLOC_FL_PUNCH_HOLE 0x02 /* de-allocates range */
 #endif
+#ifndef FALLOC_FL_ZERO_RANGE
+#define FALLOC_FL_ZERO_RANGE 0x10 /* zeroes range, keeping blocks */
+#endif
 
 #ifndef __APPLE__
 // These struct and ioctl definitions were copied verbatim from xfsprogs.
@@ -658,6 +663,24 @@ class PosixRandomAccessFile : public RandomAccessFile {
     return DoReadV(fd_, filename_, offset, results);
   }
 
+  virtual Status AdviseSequentialRead(uint64_t offset, uint64_t length)
+      const override {
+#ifndef __APPLE__
+    int err = posix_fadvise(fd_, offset, 0, POSIX_FADV_SEQUENTIAL);
+    if (err == 0) {
+      err = posix_fadvise(fd_, offset, length, POSIX_FADV_WILLNEED);
+    }
+    if (PREDICT_FALSE(err != 0)) {
+      return IOError(filename_, err);
+    }
+#endif
+    return Status::OK();
+  }
+
+  virtual int fd() const override {
+    return fd_;
+  }
+
   virtual Status Size(uint64_t* size) const override {
     MAYBE_RETURN_EIO(filename_, IOError(Env::kInjectedFailureStatusMsg, EIO));
     TRACE_EVENT1("io", "PosixRandomAccessFile::Size", "path", filename_);
@@ -685,16 +708,20 @@ class PosixRandomAccessFile : public RandomAccessFile {
 // order to further improve Sync() performance.
 class PosixWritableFile : public WritableFile {
  public:
+  // If 'ring' is non-null, writes and syncs are issued through it.
   PosixWritableFile(
       string fname,
       int fd,
       uint64_t file_size,
-      bool sync_on_close)
+      uint64_t pre_allocated_size,
+      bool sync_on_close,
+      unique_ptr<IoUring> ring = nullptr)
       : filename_(std::move(fname)),
         fd_(fd),
         sync_on_close_(sync_on_close),
+        ring_(std::move(ring)),
         filesize_(file_size),
-        pre_allocated_size_(0),
+        pre_allocated_size_(pre_allocated_size),
         pending_sync_(false),
         closed_(false) {}
 
@@ -708,6 +735,9 @@ class PosixWritableFile : public WritableFile {
 
   virtual Status AppendV(ArrayView<const Slice> data) override {
     ThreadRestrictions::AssertIOAllowed();
+    if (ring_) {
+      return DoRingWriteV(data, /*sync=*/false);
+    }
     RETURN_NOT_OK(DoWriteV(fd_, filename_, filesize_, data));
     // Calculate the amount of data written
     size_t bytes_written = accumulate(
@@ -720,6 +750,14 @@ class PosixWritableFile : public WritableFile {
     return Status::OK();
   }
 
+  virtual Status AppendVAndSync(ArrayView<const Slice> data) override {
+    ThreadRestrictions::AssertIOAllowed();
+    if (ring_ && !FLAGS_never_fsync) {
+      return DoRingWriteV(data, /*sync=*/true);
+    }
+    return WritableFile::AppendVAndSync(data);
+  }
+
   virtual Status PreAllocate(uint64_t size) override {
     MAYBE_RETURN_EIO(filename_, IOError(Env::kInjectedFailureStatusMsg, EIO));
 
@@ -812,8 +850,294 @@ class PosixWritableFile : public WritableFile {
     ThreadRestrictions::AssertIOAllowed();
     LOG_SLOW_EXECUTION(
         WARNING, 1000, Substitute("sync call for $0", filename_)) {
-      if (pending_sync_) {
-        pending_sync_ = false;
+      if (pending_sync_.exchange(false)) {
+        if (ring_ && !FLAGS_never_fsync) {
+          MAYBE_RETURN_EIO(
+              filename_, IOError(Env::kInjectedFailureStatusMsg, EIO));
+          TRACE_COUNTER_INCREMENT("io_uring_sync", 1);
+          RETURN_NOT_OK_PREPEND(
+              ring_->Sync(fd_, FLAGS_env_use_fsync), filename_);
+        } else {
+          RETURN_NOT_OK(DoSync(fd_, filename_));
+        }
+      }
+    }
+    return Status::OK();
+  }
+
+  virtual uint64_t Size() const override {
+    return filesize_;
+  }
+
+  virtual const string& filename() const override {
+    return filename_;
+  }
+
+ private:
+  // Writes 'data' at the end of the file through 'ring_', linking a sync of
+  // the file to the write if 'sync' is true. Completes short writes (and the
+  // sync that was cancelled as a result) with regular I/O.
+  Status DoRingWriteV(ArrayView<const Slice> data, bool sync) {
+    MAYBE_RETURN_EIO(filename_, IOError(Env::kInjectedFailureStatusMsg, EIO));
+    size_t bytes_req = 0;
+    size_t iov_size = data.size();
+    if (PREDICT_FALSE(iov_size > IOV_MAX)) {
+      RETURN_NOT_OK(DoWriteV(fd_, filename_, filesize_, data));
+      for (const Slice& d : data) {
+        filesize_ += d.size();
+      }
+      pending_sync_ = true;
+      return sync ? Sync() : Status::OK();
+    }
+    struct iovec iov[iov_size];
+    for (size_t i = 0; i < iov_size; i++) {
+      bytes_req += data[i].size();
+      iov[i] = {const_cast<uint8_t*>(data[i].data()), data[i].size()};
+    }
+
+    // Mark the file dirty before writing, so that a concurrent Sync() that
+    // misses this write leaves the flag set for the next one.
+    pending_sync_ = true;
+    size_t written = 0;
+    bool synced = false;
+    TRACE_COUNTER_INCREMENT("io_uring_writev", 1);
+    RETURN_NOT_OK_PREPEND(
+        ring_->WriteV(
+            fd_,
+            iov,
+            iov_size,
+            filesize_,
+            sync,
+            FLAGS_env_use_fsync,
+            &written,
+            &synced),
+        filename_);
+    if (PREDICT_FALSE(written < bytes_req)) {
+      // Drop the part that was written and finish the rest synchronously.
+      vector<Slice> rest;
+      size_t skip = written;
+      for (const Slice& d : data) {
+        if (skip >= d.size()) {
+          skip -= d.size();
+          continue;
+        }
+        rest.emplace_back(d.data() + skip, d.size() - skip);
+        skip = 0;
+      }
+      RETURN_NOT_OK(DoWriteV(
+          fd_, filename_, filesize_ + written, ArrayView<const Slice>(rest)));
+    }
+    filesize_ += bytes_req;
+    if (sync && !synced) {
+      return Sync();
+    }
+    if (synced) {
+      pending_sync_ = false;
+    }
+    return Status::OK();
+  }
+
+  const string filename_;
+  const int fd_;
+  const bool sync_on_close_;
+  const unique_ptr<IoUring> ring_;
+
+  uint64_t filesize_;
+  uint64_t pre_allocated_size_;
+  // Atomic since the WAL may Sync() from a different thread than the one
+  // appending (see --log_pipelined_append).
+  std::atomic<bool> pending_sync_;
+  bool closed_;
+};
+
+// A WritableFile opened with O_DIRECT, so that writes bypass the page cache.
+//
+// Direct I/O requires block-aligned offsets, lengths and memory, so appends
+// are staged into an aligned buffer which always starts at a block boundary of
+// the file. Each append writes out the whole buffer, padded with zeros up to
+// the next block boundary, and then keeps only the trailing partial block,
+// which is rewritten (with the data that follows it) by the next append. The
+// padding beyond Size() is truncated away on Close().
+//
+// Data is on disk once AppendV() returns, but, as with regular files, it's
+// only durable (including the file size metadata) after Sync().
+class PosixDirectWritableFile : public WritableFile {
+ public:
+  static const size_t kAlignment = 4096;
+
+  PosixDirectWritableFile(
+      string fname,
+      int fd,
+      uint64_t file_size,
+      uint64_t pre_allocated_size,
+      bool sync_on_close)
+      : filename_(std::move(fname)),
+        fd_(fd),
+        sync_on_close_(sync_on_close),
+        filesize_(file_size),
+        pre_allocated_size_(pre_allocated_size),
+        written_size_(file_size),
+        buf_(nullptr),
+        buf_capacity_(0),
+        buf_file_offset_(file_size & ~(kAlignment - 1)),
+        pending_sync_(false),
+        closed_(false) {}
+
+  ~PosixDirectWritableFile() {
+    WARN_NOT_OK(Close(), "Failed to close " + filename_);
+    free(buf_);
+  }
+
+  // Loads the partial block at the end of the file, if any, so that the next
+  // append can rewrite it.
+  Status Init() {
+    size_t tail = filesize_ - buf_file_offset_;
+    RETURN_NOT_OK(EnsureCapacity(kAlignment));
+    if (tail > 0) {
+      ssize_t r;
+      RETRY_ON_EINTR(r, pread(fd_, buf_, kAlignment, buf_file_offset_));
+      if (r < 0) {
+        return IOError(filename_, errno);
+      }
+      if (static_cast<size_t>(r) < tail) {
+        return Status::Corruption(
+            Substitute("Short read of last block of $0", filename_));
+      }
+    }
+    return Status::OK();
+  }
+
+  virtual Status Append(const Slice& data) override {
+    return AppendV(ArrayView<const Slice>(&data, 1));
+  }
+
+  virtual Status AppendV(ArrayView<const Slice> data) override {
+    MAYBE_RETURN_EIO(filename_, IOError(Env::kInjectedFailureStatusMsg, EIO));
+    ThreadRestrictions::AssertIOAllowed();
+    size_t tail = filesize_ - buf_file_offset_;
+    size_t total = 0;
+    for (const Slice& d : data) {
+      total += d.size();
+    }
+    size_t len = tail + total;
+    size_t padded = RoundUp(len);
+    RETURN_NOT_OK(EnsureCapacity(padded));
+    uint8_t* dst = buf_ + tail;
+    for (const Slice& d : data) {
+      memcpy(dst, d.data(), d.size());
+      dst += d.size();
+    }
+    memset(buf_ + len, 0, padded - len);
+
+    size_t done = 0;
+    while (done < padded) {
+      ssize_t w;
+      RETRY_ON_EINTR(
+          w,
+          pwrite(fd_, buf_ + done, padded - done, buf_file_offset_ + done));
+      if (PREDICT_FALSE(w < 0)) {
+        return IOError(filename_, errno);
+      }
+      if (PREDICT_FALSE(w % kAlignment != 0)) {
+        return Status::IOError(Substitute(
+            "Unaligned short direct write to $0: $1 bytes", filename_, w));
+      }
+      done += w;
+    }
+    filesize_ += total;
+    written_size_ = std::max(written_size_, buf_file_offset_ + padded);
+    pending_sync_ = true;
+
+    // Keep the last partial block around for the next append.
+    size_t full = len & ~(kAlignment - 1);
+    if (full > 0) {
+      memmove(buf_, buf_ + full, len - full);
+      buf_file_offset_ += full;
+    }
+    return Status::OK();
+  }
+
+  virtual Status PreAllocate(uint64_t size) override {
+    MAYBE_RETURN_EIO(filename_, IOError(Env::kInjectedFailureStatusMsg, EIO));
+    TRACE_EVENT1(
+        "io", "PosixDirectWritableFile::PreAllocate", "path", filename_);
+    ThreadRestrictions::AssertIOAllowed();
+    uint64_t offset = std::max(filesize_, pre_allocated_size_);
+    int ret;
+    RETRY_ON_EINTR(ret, fallocate(fd_, 0, offset, size));
+    if (ret != 0) {
+      if (errno == EOPNOTSUPP) {
+        KLOG_FIRST_N(WARNING, 1)
+            << "The filesystem does not support fallocate().";
+      } else if (errno == ENOSYS) {
+        KLOG_FIRST_N(WARNING, 1)
+            << "The kernel does not implement fallocate().";
+      } else {
+        return IOError(filename_, errno);
+      }
+    }
+    pre_allocated_size_ = offset + size;
+    return Status::OK();
+  }
+
+  virtual Status Close() override {
+    if (closed_) {
+      return Status::OK();
+    }
+    TRACE_EVENT1("io", "PosixDirectWritableFile::Close", "path", filename_);
+    ThreadRestrictions::AssertIOAllowed();
+    MAYBE_RETURN_EIO(filename_, IOError(Env::kInjectedFailureStatusMsg, EIO));
+    Status s;
+
+    // Drop both the unused preallocated space and the padding of the last
+    // block.
+    if (filesize_ < std::max(pre_allocated_size_, written_size_)) {
+      int ret;
+      RETRY_ON_EINTR(ret, ftruncate(fd_, filesize_));
+      if (ret != 0) {
+        s = IOError(filename_, errno);
+      }
+      pending_sync_ = true;
+    }
+
+    if (sync_on_close_) {
+      Status sync_status = Sync();
+      if (!sync_status.ok()) {
+        LOG(ERROR) << "Unable to Sync " << filename_ << ": "
+                   << sync_status.ToString();
+        if (s.ok()) {
+          s = sync_status;
+        }
+      }
+    }
+
+    int ret;
+    RETRY_ON_EINTR(ret, close(fd_));
+    if (ret < 0) {
+      if (s.ok()) {
+        s = IOError(filename_, errno);
+      }
+    }
+
+    closed_ = true;
+    return s;
+  }
+
+  virtual Status Flush(FlushMode mode) override {
+    // Writes never linger in the page cache; only a synchronous flush has
+    // anything left to do.
+    if (mode == FLUSH_SYNC) {
+      return Sync();
+    }
+    return Status::OK();
+  }
+
+  virtual Status Sync() override {
+    TRACE_EVENT1("io", "PosixDirectWritableFile::Sync", "path", filename_);
+    ThreadRestrictions::AssertIOAllowed();
+    LOG_SLOW_EXECUTION(
+        WARNING, 1000, Substitute("sync call for $0", filename_)) {
+      if (pending_sync_.exchange(false)) {
         RETURN_NOT_OK(DoSync(fd_, filename_));
       }
     }
@@ -829,13 +1153,47 @@ class PosixWritableFile : public WritableFile {
   }
 
  private:
+  static size_t RoundUp(size_t n) {
+    return (n + kAlignment - 1) & ~(kAlignment - 1);
+  }
+
+  Status EnsureCapacity(size_t size) {
+    if (size <= buf_capacity_) {
+      return Status::OK();
+    }
+    size_t new_capacity = std::max(RoundUp(size), buf_capacity_ * 2);
+    void* new_buf;
+    int err = posix_memalign(&new_buf, kAlignment, new_capacity);
+    if (err != 0) {
+      return Status::RuntimeError(
+          "Could not allocate aligned buffer", ErrnoToString(err), err);
+    }
+    if (buf_) {
+      memcpy(new_buf, buf_, buf_capacity_);
+      free(buf_);
+    }
+    buf_ = static_cast<uint8_t*>(new_buf);
+    buf_capacity_ = new_capacity;
+    return Status::OK();
+  }
+
   const string filename_;
   const int fd_;
   const bool sync_on_close_;
 
   uint64_t filesize_;
   uint64_t pre_allocated_size_;
-  bool pending_sync_;
+  // The furthest offset ever written, including padding.
+  uint64_t written_size_;
+
+  // Aligned staging buffer. Its first byte corresponds to 'buf_file_offset_'
+  // in the file, and it holds the 'filesize_ - buf_file_offset_' bytes of the
+  // last partial block.
+  uint8_t* buf_;
+  size_t buf_capacity_;
+  uint64_t buf_file_offset_;
+
+  std::atomic<bool> pending_sync_;
   bool closed_;
 };
 
@@ -1904,8 +2262,82 @@ class PosixEnv : public Env {
     if (opts.mode == OPEN_EXISTING) {
       RETURN_NOT_OK(GetFileSize(fname, &file_size));
     }
-    result->reset(
-        new PosixWritableFile(fname, fd, file_size, opts.sync_on_close));
+    uint64_t pre_allocated_size = 0;
+    if (opts.mode == OPEN_EXISTING && opts.reuse_existing_blocks) {
+      if (opts.existing_blocks_zeroed) {
+        pre_allocated_size = file_size;
+      } else {
+        RETURN_NOT_OK(DiscardContentsKeepingBlocks(
+            fname, fd, file_size, &pre_allocated_size));
+      }
+      file_size = 0;
+    }
+
+    if (opts.use_direct_io) {
+#if defined(__linux__)
+      int flags = fcntl(fd, F_GETFL);
+      if (flags >= 0 && fcntl(fd, F_SETFL, flags | O_DIRECT) == 0) {
+        unique_ptr<PosixDirectWritableFile> file(new PosixDirectWritableFile(
+            fname, fd, file_size, pre_allocated_size, opts.sync_on_close));
+        RETURN_NOT_OK(file->Init());
+        *result = std::move(file);
+        return Status::OK();
+      }
+      KLOG_FIRST_N(WARNING, 1)
+          << "Could not enable O_DIRECT for " << fname
+          << ", falling back to buffered I/O: " << ErrnoToString(errno);
+#else
+      KLOG_FIRST_N(WARNING, 1)
+          << "Direct I/O is not supported on this platform";
+#endif
+    }
+
+    unique_ptr<IoUring> ring;
+    if (opts.use_io_uring) {
+      Status s = IoUring::Create(&ring);
+      if (!s.ok()) {
+        KLOG_FIRST_N(WARNING, 1) << "Could not set up io_uring for " << fname
+                                 << ", falling back to regular I/O: "
+                                 << s.ToString();
+      }
+    }
+    result->reset(new PosixWritableFile(
+        fname,
+        fd,
+        file_size,
+        pre_allocated_size,
+        opts.sync_on_close,
+        std::move(ring)));
+    return Status::OK();
+  }
+
+  // Discards the contents of the 'size' bytes long file 'fname' opened as
+  // 'fd', preferably without giving its blocks back to the filesystem, in
+  // which case 'pre_allocated_size' is set to 'size'.
+  Status DiscardContentsKeepingBlocks(
+      const string& fname,
+      int fd,
+      uint64_t size,
+      uint64_t* pre_allocated_size) {
+    ThreadRestrictions::AssertIOAllowed();
+    int ret = -1;
+#if defined(__linux__)
+    if (size > 0) {
+      RETRY_ON_EINTR(
+          ret,
+          fallocate(fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE, 0, size));
+    }
+#endif
+    if (ret == 0) {
+      *pre_allocated_size = size;
+      return Status::OK();
+    }
+    // Either empty or zeroing is not supported: start over from scratch.
+    RETRY_ON_EINTR(ret, ftruncate(fd, 0));
+    if (ret != 0) {
+      return IOError(fname, errno);
+    }
+    *pre_allocated_size = 0;
     return Status::OK();
   }
 
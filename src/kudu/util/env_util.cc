@@ -153,11 +153,20 @@ Status VerifySufficientDiskSpace(
     const std::string& path,
     int64_t requested_bytes,
     int64_t reserved_bytes) {
+  SpaceInfo space_info;
+  RETURN_NOT_OK(env->GetSpaceInfo(path, &space_info));
+  return VerifySufficientDiskSpace(
+      space_info, path, requested_bytes, reserved_bytes);
+}
+
+Status VerifySufficientDiskSpace(
+    const SpaceInfo& space_info,
+    const std::string& path,
+    int64_t requested_bytes,
+    int64_t reserved_bytes) {
   const int64_t kOnePercentReservation = -1;
   DCHECK_GE(requested_bytes, 0);
 
-  SpaceInfo space_info;
-  RETURN_NOT_OK(env->GetSpaceInfo(path, &space_info));
   int64_t available_bytes = space_info.free_bytes;
 
   // Allow overriding these values by tests.
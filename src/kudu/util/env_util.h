@@ -31,6 +31,7 @@ class Env;
 class RandomAccessFile;
 class SequentialFile;
 class WritableFile;
+struct SpaceInfo;
 struct WritableFileOptions;
 
 namespace env_util {
@@ -67,6 +68,15 @@ Status VerifySufficientDiskSpace(
     int64_t requested_bytes,
     int64_t reserved_bytes);
 
+// Like the above, but checks against 'space_info', a previously obtained (e.g.
+// cached) Env::GetSpaceInfo() result for 'path', instead of querying the
+// filesystem.
+Status VerifySufficientDiskSpace(
+    const SpaceInfo& space_info,
+    const std::string& path,
+    int64_t requested_bytes,
+    int64_t reserved_bytes);
+
 // Creates the directory given by 'path', unless it already exists.
 //
 // If 'created' is not NULL, sets it to true if the directory was
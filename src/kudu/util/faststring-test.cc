@@ -19,13 +19,17 @@
 #include <cstring>
 #include <memory>
 
+#include <gflags/gflags_declare.h>
 #include <gtest/gtest.h>
 
 #include "kudu/util/faststring.h"
 #include "kudu/util/random.h"
 #include "kudu/util/random_util.h"
+#include "kudu/util/slab_allocator.h"
 #include "kudu/util/test_util.h"
 
+DECLARE_bool(faststring_use_slab_allocator);
+
 namespace kudu {
 class FaststringTest : public KuduTest {};
 
@@ -63,4 +67,37 @@ TEST_F(FaststringTest, TestShrinkToFit_Random) {
   }
 }
 
+TEST_F(FaststringTest, TestSlabAllocator) {
+  FLAGS_faststring_use_slab_allocator = true;
+  Random r(GetRandomSeed32());
+  const int kMaxSize = 64 * 1024;
+  std::unique_ptr<char[]> random_bytes(new char[kMaxSize]);
+  RandomString(random_bytes.get(), kMaxSize, &r);
+
+  faststring s;
+  s.append(random_bytes.get(), 200);
+  ASSERT_EQ(SlabAllocator::GetAllocationSize(200), s.capacity());
+  for (int i = 0; i < 100; i++) {
+    int new_size = r.Uniform(kMaxSize);
+    s.resize(new_size);
+    memcpy(s.data(), random_bytes.get(), new_size);
+    ASSERT_GE(s.capacity(), new_size);
+    if (i % 2) {
+      s.shrink_to_fit();
+      ASSERT_EQ(
+          new_size <= faststring::kInitialCapacity
+              ? faststring::kInitialCapacity
+              : SlabAllocator::GetAllocationSize(new_size),
+          s.capacity());
+    }
+    ASSERT_EQ(0, memcmp(s.data(), random_bytes.get(), new_size));
+  }
+
+  // Arrays allocated before the flag changes are freed where they came from.
+  FLAGS_faststring_use_slab_allocator = false;
+  s.append(random_bytes.get(), kMaxSize);
+  std::unique_ptr<uint8_t[]> released(s.release());
+  ASSERT_EQ(faststring::kInitialCapacity, s.capacity());
+}
+
 } // namespace kudu
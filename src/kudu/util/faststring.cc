@@ -17,11 +17,39 @@
 
 #include "kudu/util/faststring.h"
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
-#include <memory>
+
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/slab_allocator.h"
+
+DEFINE_bool(faststring_use_slab_allocator, false,
+            "Whether to allocate the buffers of faststrings, such as those of "
+            "RPC transfers, log entry batches and compressed messages, from "
+            "the size-classed slab allocator rather than the heap");
+TAG_FLAG(faststring_use_slab_allocator, experimental);
+TAG_FLAG(faststring_use_slab_allocator, runtime);
 
 namespace kudu {
 
+uint8_t* faststring::AllocateArray(size_t size, size_t* capacity,
+                                   bool* from_slab) {
+  *from_slab = FLAGS_faststring_use_slab_allocator;
+  if (*from_slab) {
+    return SlabAllocator::Get()->Allocate(size, capacity);
+  }
+  *capacity = size;
+  return new uint8_t[size];
+}
+
+void faststring::FreeArray(uint8_t* array, size_t capacity, bool from_slab) {
+  if (from_slab) {
+    SlabAllocator::Get()->Free(array, capacity);
+  } else {
+    delete[] array;
+  }
+}
+
 void faststring::GrowByAtLeast(size_t count) {
   // Not enough space, need to reserve more.
   // Don't reserve exactly enough space for the new string -- that makes it
@@ -37,18 +65,21 @@ void faststring::GrowByAtLeast(size_t count) {
 
 void faststring::GrowArray(size_t newcapacity) {
   DCHECK_GE(newcapacity, capacity_);
-  std::unique_ptr<uint8_t[]> newdata(new uint8_t[newcapacity]);
+  size_t allocated;
+  bool from_slab;
+  uint8_t* newdata = AllocateArray(newcapacity, &allocated, &from_slab);
   if (len_ > 0) {
-    memcpy(&newdata[0], &data_[0], len_);
+    memcpy(newdata, &data_[0], len_);
   }
-  capacity_ = newcapacity;
   if (data_ != initial_data_) {
-    delete[] data_;
+    FreeArray(data_, capacity_, from_slab_);
   } else {
     ASAN_POISON_MEMORY_REGION(initial_data_, arraysize(initial_data_));
   }
 
-  data_ = newdata.release();
+  data_ = newdata;
+  capacity_ = allocated;
+  from_slab_ = from_slab;
   ASAN_POISON_MEMORY_REGION(data_ + len_, capacity_ - len_);
 }
 
@@ -57,15 +88,26 @@ void faststring::ShrinkToFitInternal() {
   if (len_ <= kInitialCapacity) {
     ASAN_UNPOISON_MEMORY_REGION(initial_data_, len_);
     memcpy(initial_data_, &data_[0], len_);
-    delete[] data_;
+    FreeArray(data_, capacity_, from_slab_);
     data_ = initial_data_;
     capacity_ = kInitialCapacity;
+    from_slab_ = false;
   } else {
-    std::unique_ptr<uint8_t[]> newdata(new uint8_t[len_]);
-    memcpy(&newdata[0], &data_[0], len_);
-    delete[] data_;
-    data_ = newdata.release();
-    capacity_ = len_;
+    size_t target = FLAGS_faststring_use_slab_allocator
+        ? SlabAllocator::GetAllocationSize(len_)
+        : len_;
+    if (target >= capacity_) {
+      // The array is already as small as it can be.
+      return;
+    }
+    size_t allocated;
+    bool from_slab;
+    uint8_t* newdata = AllocateArray(len_, &allocated, &from_slab);
+    memcpy(newdata, &data_[0], len_);
+    FreeArray(data_, capacity_, from_slab_);
+    data_ = newdata;
+    capacity_ = allocated;
+    from_slab_ = from_slab;
   }
 }
 
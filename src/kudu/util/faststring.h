@@ -35,14 +35,20 @@ class faststring {
  public:
   enum { kInitialCapacity = 32 };
 
-  faststring() : data_(initial_data_), len_(0), capacity_(kInitialCapacity) {}
+  faststring()
+      : data_(initial_data_),
+        len_(0),
+        capacity_(kInitialCapacity),
+        from_slab_(false) {}
 
   // Construct a string with the given capacity, in bytes.
   explicit faststring(size_t capacity)
-      : data_(initial_data_), len_(0), capacity_(kInitialCapacity) {
+      : data_(initial_data_),
+        len_(0),
+        capacity_(kInitialCapacity),
+        from_slab_(false) {
     if (capacity > capacity_) {
-      data_ = new uint8_t[capacity];
-      capacity_ = capacity;
+      GrowArray(capacity);
     }
     ASAN_POISON_MEMORY_REGION(data_, capacity_);
   }
@@ -50,7 +56,7 @@ class faststring {
   ~faststring() {
     ASAN_UNPOISON_MEMORY_REGION(initial_data_, arraysize(initial_data_));
     if (data_ != initial_data_) {
-      delete[] data_;
+      FreeArray(data_, capacity_, from_slab_);
     }
   }
 
@@ -83,13 +89,18 @@ class faststring {
   // NOTE: the data pointer returned by release() is not necessarily the pointer
   uint8_t* release() WARN_UNUSED_RESULT {
     uint8_t* ret = data_;
-    if (ret == initial_data_) {
+    if (ret == initial_data_ || from_slab_) {
+      // The caller frees the array with delete[].
       ret = new uint8_t[len_];
       memcpy(ret, data_, len_);
+      if (from_slab_) {
+        FreeArray(data_, capacity_, from_slab_);
+      }
     }
     len_ = 0;
     capacity_ = kInitialCapacity;
     data_ = initial_data_;
+    from_slab_ = false;
     ASAN_POISON_MEMORY_REGION(data_, capacity_);
     return ret;
   }
@@ -244,10 +255,22 @@ class faststring {
 
   void ShrinkToFitInternal();
 
+  // Allocates an array of at least 'size' bytes, from the SlabAllocator if
+  // --faststring_use_slab_allocator is set. Sets '*capacity' to the size of
+  // the array, and '*from_slab' to whether it came from the SlabAllocator.
+  static uint8_t* AllocateArray(size_t size, size_t* capacity,
+                                bool* from_slab);
+
+  // Frees an array allocated by AllocateArray().
+  static void FreeArray(uint8_t* array, size_t capacity, bool from_slab);
+
   uint8_t* data_;
   uint8_t initial_data_[kInitialCapacity];
   size_t len_;
   size_t capacity_;
+  // Whether 'data_' came from the SlabAllocator. Kept per string, so that
+  // changing the flag at runtime doesn't free an array to the wrong place.
+  bool from_slab_;
 };
 
 } // namespace kudu
@@ -42,6 +42,7 @@
 #include "kudu/util/countdown_latch.h"
 #include "kudu/util/env.h"
 #include "kudu/util/file_cache-test-util.h"
+#include "kudu/util/hdr_histogram.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
@@ -59,6 +60,10 @@ DEFINE_int32(test_duration_secs, 2, "Number of seconds to run the test");
 
 DECLARE_bool(cache_force_single_shard);
 
+METRIC_DECLARE_counter(file_cache_open_hits);
+METRIC_DECLARE_counter(file_cache_open_misses);
+METRIC_DECLARE_histogram(file_cache_open_latency);
+
 using std::deque;
 using std::shared_ptr;
 using std::string;
@@ -96,12 +101,16 @@ class FileCacheStressTest : public KuduTest {
  public:
   typedef unordered_map<string, unordered_map<string, int>> MetricMap;
 
-  FileCacheStressTest() : rand_(SeedRandom()), running_(1) {
+  FileCacheStressTest()
+      : metric_entity_(METRIC_ENTITY_server.Instantiate(
+            &metric_registry_, "file_cache-stress-test")),
+        rand_(SeedRandom()),
+        running_(1) {
     // Use a single shard. Otherwise, the cache can be a little bit "sloppy"
     // depending on the number of CPUs on the system.
     FLAGS_cache_force_single_shard = true;
     cache_.reset(new FileCache<FileType>(
-        "test", env_, kTestMaxOpenFiles, scoped_refptr<MetricEntity>()));
+        "test", env_, kTestMaxOpenFiles, metric_entity_));
   }
 
   void SetUp() override {
@@ -204,6 +213,24 @@ class FileCacheStressTest : public KuduTest {
     return metrics_;
   }
 
+  // Logs the file cache's own open hit/miss counts and open latencies.
+  void LogCacheMetrics() const {
+    int64_t hits = METRIC_file_cache_open_hits.Instantiate(
+        metric_entity_)->value();
+    int64_t misses = METRIC_file_cache_open_misses.Instantiate(
+        metric_entity_)->value();
+    const HdrHistogram* latency = METRIC_file_cache_open_latency.Instantiate(
+        metric_entity_)->histogram();
+    LOG(INFO) << Substitute(
+        "open hits: $0, open misses: $1, hit ratio: $2", hits, misses,
+        hits + misses > 0 ? static_cast<double>(hits) / (hits + misses) : 0);
+    LOG(INFO) << Substitute(
+        "open latency (us): mean $0, p99 $1, max $2",
+        latency->MeanValue(),
+        latency->ValueAtPercentile(99),
+        latency->MaxValue());
+  }
+
  private:
   enum GetMode { OPEN, DELETE };
 
@@ -294,6 +321,9 @@ class FileCacheStressTest : public KuduTest {
     }
   }
 
+  MetricRegistry metric_registry_;
+  scoped_refptr<MetricEntity> metric_entity_;
+
   unique_ptr<FileCache<FileType>> cache_;
 
   // Used to seed per-thread PRNGs.
@@ -401,6 +431,7 @@ TYPED_TEST(FileCacheStressTest, TestStress) {
     LOG(INFO) << Substitute(
         "$0: $1", action_count_pair.first, action_count_pair.second);
   }
+  this->LogCacheMetrics();
 }
 
 } // namespace kudu
@@ -30,6 +30,7 @@
 #include <gtest/gtest.h>
 
 #include "kudu/gutil/basictypes.h"
+#include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/cache.h"
 #include "kudu/util/debug-util.h"
@@ -45,6 +46,9 @@
 DECLARE_bool(cache_force_single_shard);
 DECLARE_int32(file_cache_expiry_period_ms);
 
+METRIC_DECLARE_counter(file_cache_open_hits);
+METRIC_DECLARE_counter(file_cache_open_misses);
+
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
@@ -337,6 +341,49 @@ TYPED_TEST(FileCacheTest, TestNoRecursiveDeadlock) {
   }
 }
 
+TYPED_TEST(FileCacheTest, TestWarmup) {
+  MetricRegistry registry;
+  scoped_refptr<MetricEntity> entity =
+      METRIC_ENTITY_server.Instantiate(&registry, "test");
+  const int kCacheCapacity = 2;
+  this->cache_.reset(
+      new FileCache<TypeParam>("test", this->env_, kCacheCapacity, entity));
+  ASSERT_OK(this->cache_->Init());
+
+  vector<string> filenames;
+  for (int i = 0; i < 3; i++) {
+    filenames.push_back(this->GetTestPath(Substitute("$0", i)));
+    ASSERT_OK(this->WriteTestFile(filenames.back(), "test data"));
+  }
+  // A missing file is skipped rather than failing the warmup.
+  vector<string> to_warm = {this->GetTestPath("missing")};
+  to_warm.insert(to_warm.end(), filenames.begin(), filenames.end());
+
+  // Only as many files as fit in the cache are warmed up, and the warming
+  // descriptors themselves don't stick around.
+  ASSERT_EQ(kCacheCapacity, this->cache_->Warmup(to_warm));
+  NO_FATALS(this->AssertFdsAndDescriptors(kCacheCapacity, 0));
+  scoped_refptr<Counter> hits = METRIC_file_cache_open_hits.Instantiate(entity);
+  scoped_refptr<Counter> misses =
+      METRIC_file_cache_open_misses.Instantiate(entity);
+  ASSERT_EQ(0, hits->value());
+  ASSERT_EQ(kCacheCapacity, misses->value());
+
+  // Opening a warmed up file reuses its fd.
+  for (int i = 0; i < kCacheCapacity; i++) {
+    shared_ptr<TypeParam> f;
+    ASSERT_OK(this->cache_->OpenExistingFile(filenames[i], &f));
+  }
+  NO_FATALS(this->AssertFdsAndDescriptors(kCacheCapacity, 0));
+  ASSERT_EQ(kCacheCapacity, hits->value());
+  ASSERT_EQ(kCacheCapacity, misses->value());
+
+  // The file that didn't fit must be opened afresh.
+  shared_ptr<TypeParam> f;
+  ASSERT_OK(this->cache_->OpenExistingFile(filenames[kCacheCapacity], &f));
+  ASSERT_EQ(kCacheCapacity + 1, misses->value());
+}
+
 class RandomAccessFileCacheTest : public FileCacheTest<RandomAccessFile> {};
 
 TEST_F(RandomAccessFileCacheTest, TestMemoryFootprintDoesNotCrash) {
@@ -20,6 +20,7 @@
 #include <atomic>
 #include <cstdint>
 #include <cstring>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <ostream>
@@ -53,6 +54,29 @@ DEFINE_int32(
     "Period of time (in ms) between removing expired file cache descriptors");
 TAG_FLAG(file_cache_expiry_period_ms, advanced);
 
+METRIC_DEFINE_counter(
+    server,
+    file_cache_open_hits,
+    "File Cache Open Hits",
+    kudu::MetricUnit::kCacheHits,
+    "Number of file cache descriptor accesses that found the underlying file "
+    "already open");
+METRIC_DEFINE_counter(
+    server,
+    file_cache_open_misses,
+    "File Cache Open Misses",
+    kudu::MetricUnit::kCacheQueries,
+    "Number of file cache descriptor accesses that had to reopen the "
+    "underlying file because it had been evicted or never opened");
+METRIC_DEFINE_histogram(
+    server,
+    file_cache_open_latency,
+    "File Cache Open Latency",
+    kudu::MetricUnit::kMicroseconds,
+    "Time spent opening files on file cache misses",
+    60000000LU,
+    2);
+
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
@@ -100,9 +124,9 @@ class BaseDescriptor {
   ~BaseDescriptor() {
     VLOG(2) << "Out of scope descriptor with file name: " << filename();
 
-    // The (now expired) weak_ptr remains in 'descriptors_', to be removed by
-    // the next call to RunDescriptorExpiry(). Removing it here would risk a
-    // deadlock on recursive acquisition of 'lock_'.
+    // The (now expired) weak_ptr remains in the descriptor map, to be removed
+    // by the next call to RunDescriptorExpiry(). Removing it here would risk a
+    // deadlock on recursive acquisition of the shard lock.
 
     if (deleted()) {
       cache()->Erase(filename());
@@ -165,6 +189,22 @@ class BaseDescriptor {
     }
   }
 
+  // Records a descriptor access that found the file already open.
+  void RecordOpenHit() const {
+    if (file_cache_->open_hits_) {
+      file_cache_->open_hits_->Increment();
+    }
+  }
+
+  // Records a descriptor access that had to reopen the file, which took
+  // 'latency'.
+  void RecordOpenMiss(const MonoDelta& latency) const {
+    if (file_cache_->open_misses_) {
+      file_cache_->open_misses_->Increment();
+      file_cache_->open_latency_->Increment(latency.ToMicroseconds());
+    }
+  }
+
   Cache* cache() const {
     return file_cache_->cache_.get();
   }
@@ -334,6 +374,7 @@ class Descriptor<RWFile> : public RWFile {
     CHECK(!base_.invalidated());
     if (found.opened()) {
       // The file is already open in the cache, return it.
+      base_.RecordOpenHit();
       if (out) {
         *out = std::move(found);
       }
@@ -344,7 +385,9 @@ class Descriptor<RWFile> : public RWFile {
     RWFileOptions opts;
     opts.mode = Env::OPEN_EXISTING;
     unique_ptr<RWFile> f;
+    MonoTime start = MonoTime::Now();
     RETURN_NOT_OK(base_.env()->NewRWFile(opts, base_.filename(), &f));
+    base_.RecordOpenMiss(MonoTime::Now() - start);
 
     // The cache will take ownership of the newly opened file.
     ScopedOpenedDescriptor<RWFile> opened(base_.InsertIntoCache(f.release()));
@@ -382,6 +425,13 @@ class Descriptor<RandomAccessFile> : public RandomAccessFile {
     return opened.file()->ReadV(offset, results);
   }
 
+  Status AdviseSequentialRead(uint64_t offset, uint64_t length)
+      const override {
+    ScopedOpenedDescriptor<RandomAccessFile> opened(&base_);
+    RETURN_NOT_OK(ReopenFileIfNecessary(&opened));
+    return opened.file()->AdviseSequentialRead(offset, length);
+  }
+
   Status Size(uint64_t* size) const override {
     ScopedOpenedDescriptor<RandomAccessFile> opened(&base_);
     RETURN_NOT_OK(ReopenFileIfNecessary(&opened));
@@ -431,6 +481,7 @@ class Descriptor<RandomAccessFile> : public RandomAccessFile {
     CHECK(!base_.invalidated());
     if (found.opened()) {
       // The file is already open in the cache, return it.
+      base_.RecordOpenHit();
       if (out) {
         *out = std::move(found);
       }
@@ -439,7 +490,9 @@ class Descriptor<RandomAccessFile> : public RandomAccessFile {
 
     // The file was evicted, reopen it.
     unique_ptr<RandomAccessFile> f;
+    MonoTime start = MonoTime::Now();
     RETURN_NOT_OK(base_.env()->NewRandomAccessFile(base_.filename(), &f));
+    base_.RecordOpenMiss(MonoTime::Now() - start);
 
     // The cache will take ownership of the newly opened file.
     ScopedOpenedDescriptor<RandomAccessFile> opened(
@@ -468,9 +521,13 @@ FileCache<FileType>::FileCache(
       cache_name_(cache_name),
       eviction_cb_(new EvictionCallback<FileType>()),
       cache_(NewLRUCache(DRAM_CACHE, max_open_files, cache_name)),
+      max_open_files_(max_open_files),
       running_(1) {
   if (entity) {
     cache_->SetMetrics(entity);
+    open_hits_ = METRIC_file_cache_open_hits.Instantiate(entity);
+    open_misses_ = METRIC_file_cache_open_misses.Instantiate(entity);
+    open_latency_ = METRIC_file_cache_open_latency.Instantiate(entity);
   }
   LOG(INFO) << Substitute(
       "Constructed file cache $0 with capacity $1", cache_name, max_open_files);
@@ -498,16 +555,17 @@ template <class FileType>
 Status FileCache<FileType>::OpenExistingFile(
     const string& file_name,
     shared_ptr<FileType>* file) {
+  DescriptorShard* shard = ShardFor(file_name);
   shared_ptr<internal::Descriptor<FileType>> desc;
   {
     // Find an existing descriptor, or create one if none exists.
-    std::lock_guard<simple_spinlock> l(lock_);
-    RETURN_NOT_OK(FindDescriptorUnlocked(file_name, &desc));
+    std::lock_guard<simple_spinlock> l(shard->lock);
+    RETURN_NOT_OK(FindDescriptorUnlocked(shard, file_name, &desc));
     if (desc) {
       VLOG(2) << "Found existing descriptor: " << desc->filename();
     } else {
       desc = std::make_shared<internal::Descriptor<FileType>>(this, file_name);
-      InsertOrDie(&descriptors_, file_name, desc);
+      InsertOrDie(&shard->descriptors, file_name, desc);
       VLOG(2) << "Created new descriptor: " << desc->filename();
     }
   }
@@ -521,10 +579,11 @@ Status FileCache<FileType>::OpenExistingFile(
 
 template <class FileType>
 Status FileCache<FileType>::DeleteFile(const string& file_name) {
+  DescriptorShard* shard = ShardFor(file_name);
   {
-    std::lock_guard<simple_spinlock> l(lock_);
+    std::lock_guard<simple_spinlock> l(shard->lock);
     shared_ptr<internal::Descriptor<FileType>> desc;
-    RETURN_NOT_OK(FindDescriptorUnlocked(file_name, &desc));
+    RETURN_NOT_OK(FindDescriptorUnlocked(shard, file_name, &desc));
 
     if (desc) {
       VLOG(2) << "Marking file for deletion: " << file_name;
@@ -548,17 +607,18 @@ void FileCache<FileType>::Invalidate(const string& file_name) {
   //
   // This ensures that any concurrent OpenExistingFile() during this method wil
   // see the invalidation and issue a CHECK failure.
+  DescriptorShard* shard = ShardFor(file_name);
   shared_ptr<internal::Descriptor<FileType>> desc;
   {
     // Find an existing descriptor, or create one if none exists.
-    std::lock_guard<simple_spinlock> l(lock_);
-    auto it = descriptors_.find(file_name);
-    if (it != descriptors_.end()) {
+    std::lock_guard<simple_spinlock> l(shard->lock);
+    auto it = shard->descriptors.find(file_name);
+    if (it != shard->descriptors.end()) {
       desc = it->second.lock();
     }
     if (!desc) {
       desc = std::make_shared<internal::Descriptor<FileType>>(this, file_name);
-      descriptors_.emplace(file_name, desc);
+      shard->descriptors.emplace(file_name, desc);
     }
 
     desc->base_.MarkInvalidated();
@@ -573,55 +633,94 @@ void FileCache<FileType>::Invalidate(const string& file_name) {
   // the duration of this method, and no other methods erase strong
   // references from the map.
   {
-    std::lock_guard<simple_spinlock> l(lock_);
-    CHECK_EQ(1, descriptors_.erase(file_name));
+    std::lock_guard<simple_spinlock> l(shard->lock);
+    CHECK_EQ(1, shard->descriptors.erase(file_name));
+  }
+}
+
+template <class FileType>
+int FileCache<FileType>::Warmup(const vector<string>& file_names) {
+  int opened = 0;
+  for (const auto& file_name : file_names) {
+    // Opening more files than the cache can hold would only evict the ones
+    // that were just opened.
+    if (opened >= max_open_files_) {
+      break;
+    }
+    shared_ptr<FileType> file;
+    Status s = OpenExistingFile(file_name, &file);
+    if (!s.ok()) {
+      WARN_NOT_OK(s, Substitute("Could not warm up file $0", file_name));
+      continue;
+    }
+    opened++;
   }
+  LOG(INFO) << Substitute(
+      "Warmed up $0 of $1 files in file cache $2",
+      opened,
+      file_names.size(),
+      cache_name_);
+  return opened;
 }
 
 template <class FileType>
 int FileCache<FileType>::NumDescriptorsForTests() const {
-  std::lock_guard<simple_spinlock> l(lock_);
-  return descriptors_.size();
+  int num_descriptors = 0;
+  for (const auto& shard : shards_) {
+    std::lock_guard<simple_spinlock> l(shard.lock);
+    num_descriptors += shard.descriptors.size();
+  }
+  return num_descriptors;
 }
 
 template <class FileType>
 string FileCache<FileType>::ToDebugString() const {
-  std::lock_guard<simple_spinlock> l(lock_);
   string ret;
-  for (const auto& e : descriptors_) {
-    bool strong = false;
-    bool deleted = false;
-    bool opened = false;
-    shared_ptr<internal::Descriptor<FileType>> desc = e.second.lock();
-    if (desc) {
-      strong = true;
-      if (desc->base_.deleted()) {
-        deleted = true;
+  for (const auto& shard : shards_) {
+    std::lock_guard<simple_spinlock> l(shard.lock);
+    for (const auto& e : shard.descriptors) {
+      bool strong = false;
+      bool deleted = false;
+      bool opened = false;
+      shared_ptr<internal::Descriptor<FileType>> desc = e.second.lock();
+      if (desc) {
+        strong = true;
+        if (desc->base_.deleted()) {
+          deleted = true;
+        }
+        internal::ScopedOpenedDescriptor<FileType> o(
+            desc->base_.LookupFromCache());
+        if (o.opened()) {
+          opened = true;
+        }
       }
-      internal::ScopedOpenedDescriptor<FileType> o(
-          desc->base_.LookupFromCache());
-      if (o.opened()) {
-        opened = true;
+      if (strong) {
+        ret += Substitute(
+            "$0 (S$1$2)\n", e.first, deleted ? "D" : "", opened ? "O" : "");
+      } else {
+        ret += Substitute("$0\n", e.first);
       }
     }
-    if (strong) {
-      ret += Substitute(
-          "$0 (S$1$2)\n", e.first, deleted ? "D" : "", opened ? "O" : "");
-    } else {
-      ret += Substitute("$0\n", e.first);
-    }
   }
   return ret;
 }
 
+template <class FileType>
+typename FileCache<FileType>::DescriptorShard* FileCache<FileType>::ShardFor(
+    const string& file_name) {
+  return &shards_[
+      std::hash<string>()(file_name) & (kNumDescriptorShards - 1)];
+}
+
 template <class FileType>
 Status FileCache<FileType>::FindDescriptorUnlocked(
+    DescriptorShard* shard,
     const string& file_name,
     shared_ptr<internal::Descriptor<FileType>>* file) {
-  DCHECK(lock_.is_locked());
+  DCHECK(shard->lock.is_locked());
 
-  auto it = descriptors_.find(file_name);
-  if (it != descriptors_.end()) {
+  auto it = shard->descriptors.find(file_name);
+  if (it != shard->descriptors.end()) {
     // Found the descriptor. Has it expired?
     shared_ptr<internal::Descriptor<FileType>> desc = it->second.lock();
     if (desc) {
@@ -637,7 +736,7 @@ Status FileCache<FileType>::FindDescriptorUnlocked(
       return Status::OK();
     }
     // Descriptor has expired; erase it and pretend we found nothing.
-    descriptors_.erase(it);
+    shard->descriptors.erase(it);
   }
   return Status::OK();
 }
@@ -646,12 +745,15 @@ template <class FileType>
 void FileCache<FileType>::RunDescriptorExpiry() {
   while (!running_.WaitFor(
       MonoDelta::FromMilliseconds(FLAGS_file_cache_expiry_period_ms))) {
-    std::lock_guard<simple_spinlock> l(lock_);
-    for (auto it = descriptors_.begin(); it != descriptors_.end();) {
-      if (it->second.expired()) {
-        it = descriptors_.erase(it);
-      } else {
-        it++;
+    for (auto& shard : shards_) {
+      std::lock_guard<simple_spinlock> l(shard.lock);
+      for (auto it = shard.descriptors.begin();
+           it != shard.descriptors.end();) {
+        if (it->second.expired()) {
+          it = shard.descriptors.erase(it);
+        } else {
+          it++;
+        }
       }
     }
   }
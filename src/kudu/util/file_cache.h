@@ -17,9 +17,11 @@
 
 #pragma once
 
+#include <cstddef>
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include <gtest/gtest_prod.h>
 
@@ -44,6 +46,8 @@ class Descriptor;
 
 } // namespace internal
 
+class Counter;
+class Histogram;
 class MetricEntity;
 class Thread;
 
@@ -67,7 +71,9 @@ class Thread;
 // client if a file with the same name is already opened. To facilitate
 // descriptor sharing, the file cache maintains a by-file-name descriptor map.
 // The values are weak references to the descriptors so that map entries don't
-// affect the descriptor lifecycle.
+// affect the descriptor lifecycle. The map is split into shards by file name,
+// each with its own lock, so that concurrent lookups of different files don't
+// contend with one another.
 //
 // LRU cache
 // ---------
@@ -155,6 +161,17 @@ class FileCache {
   // from multiple threads.
   void Invalidate(const std::string& file_name);
 
+  // Opens each of 'file_names' through the cache and then drops the resulting
+  // descriptors, leaving the opened files in the LRU cache so that the next
+  // OpenExistingFile() of any of them doesn't need to open a new fd.
+  //
+  // Intended to be called at startup with the most recently used files first;
+  // at most as many files as fit in the cache are opened. Failures to open a
+  // file are logged and otherwise ignored.
+  //
+  // Returns the number of files that were successfully opened.
+  int Warmup(const std::vector<std::string>& file_names);
+
   // Returns the number of entries in the descriptor map.
   //
   // Only intended for unit tests.
@@ -169,14 +186,33 @@ class FileCache {
   template <class FileType2>
   FRIEND_TEST(FileCacheTest, TestBasicOperations);
 
-  // Looks up a descriptor by file name.
+  // A subset of the descriptor map, selected by a hash of the file name.
+  struct DescriptorShard {
+    // Protects 'descriptors'.
+    mutable simple_spinlock lock;
+
+    // Maps filenames to descriptors.
+    std::unordered_map<
+        std::string,
+        std::weak_ptr<internal::Descriptor<FileType>>>
+        descriptors;
+  };
+
+  // Number of shards in the descriptor map. Must be a power of two.
+  static const size_t kNumDescriptorShards = 16;
+
+  // Returns the descriptor map shard responsible for 'file_name'.
+  DescriptorShard* ShardFor(const std::string& file_name);
+
+  // Looks up a descriptor by file name in 'shard'.
   //
-  // Must be called with 'lock_' held.
+  // Must be called with 'shard->lock' held.
   Status FindDescriptorUnlocked(
+      DescriptorShard* shard,
       const std::string& file_name,
       std::shared_ptr<internal::Descriptor<FileType>>* file);
 
-  // Periodically removes expired descriptors from 'descriptors_'.
+  // Periodically removes expired descriptors from the descriptor map.
   void RunDescriptorExpiry();
 
   // Interface to the underlying filesystem.
@@ -192,12 +228,18 @@ class FileCache {
   // Underlying cache instance. Caches opened files.
   std::unique_ptr<Cache> cache_;
 
-  // Protects the descriptor map.
-  mutable simple_spinlock lock_;
+  // The sharded descriptor map.
+  DescriptorShard shards_[kNumDescriptorShards];
+
+  // The maximum number of open files, as provided at construction time.
+  const int max_open_files_;
 
-  // Maps filenames to descriptors.
-  std::unordered_map<std::string, std::weak_ptr<internal::Descriptor<FileType>>>
-      descriptors_;
+  // Descriptor accesses that found their file already open (hits) or had to
+  // reopen it (misses), and the time taken by each such reopen. May be null
+  // if the cache was constructed without a metric entity.
+  scoped_refptr<Counter> open_hits_;
+  scoped_refptr<Counter> open_misses_;
+  scoped_refptr<Histogram> open_latency_;
 
   // Calls RunDescriptorExpiry() in a loop until 'running_' isn't set.
   scoped_refptr<Thread> descriptor_expiry_thread_;
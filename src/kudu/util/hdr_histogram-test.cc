@@ -116,4 +116,44 @@ TEST_F(HdrHistogramTest, PercentileAndCopyTest) {
   ASSERT_EQ(hist.TotalSum(), copy.TotalSum());
 }
 
+TEST_F(HdrHistogramTest, PercentileAndMergeTest) {
+  uint64_t specified_max = 10000;
+  HdrHistogram hist1(specified_max, kSigDigits);
+  HdrHistogram hist2(specified_max, kSigDigits);
+  hist1.IncrementBy(10, 80);
+  hist1.IncrementBy(1000, 5);
+  hist1.IncrementBy(100000, 1);
+  hist2.IncrementBy(100, 10);
+  hist2.IncrementBy(10000, 3);
+  hist2.IncrementBy(1000000, 1);
+
+  HdrHistogram merged(specified_max, kSigDigits);
+  merged.MergeFrom(hist1);
+  merged.MergeFrom(hist2);
+  NO_FATALS(validate_percentiles(&merged, specified_max));
+
+  // Merging an empty histogram leaves the min and max alone.
+  merged.MergeFrom(HdrHistogram(specified_max, kSigDigits));
+  NO_FATALS(validate_percentiles(&merged, specified_max));
+}
+
+TEST_F(HdrHistogramTest, ShardedPercentileTest) {
+  uint64_t specified_max = 10000;
+  ShardedHdrHistogram sharded(specified_max, kSigDigits, 4);
+  sharded.IncrementBy(10, 80);
+  sharded.IncrementBy(100, 10);
+  sharded.IncrementBy(1000, 5);
+  sharded.IncrementBy(10000, 3);
+  sharded.IncrementBy(100000, 1);
+  sharded.IncrementBy(1000000, 1);
+  ASSERT_EQ(kExpectedCount, sharded.TotalCount());
+
+  HdrHistogram merged(specified_max, kSigDigits);
+  sharded.MergeTo(&merged);
+  NO_FATALS(validate_percentiles(&merged, specified_max));
+
+  sharded.ResetHistogram();
+  ASSERT_EQ(0, sharded.TotalCount());
+}
+
 } // namespace kudu
@@ -23,6 +23,8 @@
 //   http://creativecommons.org/publicdomain/zero/1.0/
 #include "kudu/util/hdr_histogram.h"
 
+#include <sched.h>
+
 #include <algorithm>
 #include <cmath>
 #include <limits>
@@ -34,6 +36,7 @@
 #include "kudu/gutil/atomicops.h"
 #include "kudu/gutil/bits.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/sysinfo.h"
 #include "kudu/util/status.h"
 
 using base::subtle::Atomic64;
@@ -56,8 +59,6 @@ HdrHistogram::HdrHistogram(
       sub_bucket_half_count_magnitude_(0),
       sub_bucket_half_count_(0),
       sub_bucket_mask_(0),
-      total_count_(0),
-      total_sum_(0),
       min_value_(std::numeric_limits<Atomic64>::max()),
       max_value_(0),
       counts_(nullptr) {
@@ -73,8 +74,6 @@ HdrHistogram::HdrHistogram(const HdrHistogram& other)
       sub_bucket_half_count_magnitude_(0),
       sub_bucket_half_count_(0),
       sub_bucket_mask_(0),
-      total_count_(0),
-      total_sum_(0),
       min_value_(std::numeric_limits<Atomic64>::max()),
       max_value_(0),
       counts_(nullptr) {
@@ -82,7 +81,7 @@ HdrHistogram::HdrHistogram(const HdrHistogram& other)
 
   // Not a consistent snapshot but we try to roughly keep it close.
   // Copy the sum and min first.
-  NoBarrier_Store(&total_sum_, NoBarrier_Load(&other.total_sum_));
+  total_sum_.IncrementBy(other.TotalSum());
   NoBarrier_Store(&min_value_, NoBarrier_Load(&other.min_value_));
 
   uint64_t total_copied_count = 0;
@@ -95,7 +94,7 @@ HdrHistogram::HdrHistogram(const HdrHistogram& other)
   // Copy the max observed value last.
   NoBarrier_Store(&max_value_, NoBarrier_Load(&other.max_value_));
   // We must ensure the total is consistent with the copied counts.
-  NoBarrier_Store(&total_count_, total_copied_count);
+  total_count_.IncrementBy(total_copied_count);
 }
 
 bool HdrHistogram::IsValidHighestTrackableValue(
@@ -159,7 +158,7 @@ void HdrHistogram::Increment(int64_t value) {
 }
 
 void HdrHistogram::IncrementBy(int64_t value, int64_t count) {
-  shared_lock<rw_spinlock> lock(histogram_mutex_);
+  shared_lock<rw_spinlock> lock(histogram_mutex_.get_lock());
   DCHECK_GE(value, 0);
   DCHECK_GE(count, 0);
 
@@ -171,14 +170,18 @@ void HdrHistogram::IncrementBy(int64_t value, int64_t count) {
 
   // Increment bucket, total, and sum.
   NoBarrier_AtomicIncrement(&counts_[counts_index], count);
-  NoBarrier_AtomicIncrement(&total_count_, count);
-  NoBarrier_AtomicIncrement(&total_sum_, value * count);
+  total_count_.IncrementBy(count);
+  total_sum_.IncrementBy(value * count);
+
+  UpdateMinMax(value, value);
+}
 
+void HdrHistogram::UpdateMinMax(int64_t min, int64_t max) {
   // Update min, if needed.
   {
     Atomic64 min_val;
-    while (PREDICT_FALSE(value < (min_val = MinValue()))) {
-      Atomic64 old_val = NoBarrier_CompareAndSwap(&min_value_, min_val, value);
+    while (PREDICT_FALSE(min < (min_val = MinValue()))) {
+      Atomic64 old_val = NoBarrier_CompareAndSwap(&min_value_, min_val, min);
       if (PREDICT_TRUE(old_val == min_val))
         break; // CAS success.
     }
@@ -187,14 +190,37 @@ void HdrHistogram::IncrementBy(int64_t value, int64_t count) {
   // Update max, if needed.
   {
     Atomic64 max_val;
-    while (PREDICT_FALSE(value > (max_val = MaxValue()))) {
-      Atomic64 old_val = NoBarrier_CompareAndSwap(&max_value_, max_val, value);
+    while (PREDICT_FALSE(max > (max_val = MaxValue()))) {
+      Atomic64 old_val = NoBarrier_CompareAndSwap(&max_value_, max_val, max);
       if (PREDICT_TRUE(old_val == max_val))
         break; // CAS success.
     }
   }
 }
 
+void HdrHistogram::MergeFrom(const HdrHistogram& other) {
+  CHECK_EQ(highest_trackable_value_, other.highest_trackable_value_);
+  CHECK_EQ(num_significant_digits_, other.num_significant_digits_);
+  shared_lock<rw_spinlock> lock(histogram_mutex_.get_lock());
+
+  // Same order as the copy constructor.
+  total_sum_.IncrementBy(other.TotalSum());
+  const Atomic64 other_min = NoBarrier_Load(&other.min_value_);
+  uint64_t total_merged_count = 0;
+  for (int i = 0; i < counts_array_length_; i++) {
+    uint64_t count = NoBarrier_Load(&other.counts_[i]);
+    if (count > 0) {
+      NoBarrier_AtomicIncrement(&counts_[i], count);
+      total_merged_count += count;
+    }
+  }
+  if (total_merged_count == 0) {
+    return;
+  }
+  UpdateMinMax(other_min, NoBarrier_Load(&other.max_value_));
+  total_count_.IncrementBy(total_merged_count);
+}
+
 void HdrHistogram::IncrementWithExpectedInterval(
     int64_t value,
     int64_t expected_interval_between_samples) {
@@ -348,14 +374,66 @@ uint64_t HdrHistogram::ValueAtPercentile(double percentile) const {
 }
 
 void HdrHistogram::ResetHistogram() {
-  std::lock_guard<rw_spinlock> lock(histogram_mutex_);
-  total_count_ = 0;
-  total_sum_ = 0;
+  std::lock_guard<percpu_rwlock> lock(histogram_mutex_);
+  total_count_.Reset();
+  total_sum_.Reset();
   min_value_ = std::numeric_limits<Atomic64>::max();
   max_value_ = 0;
   counts_.reset(new Atomic64[counts_array_length_]());
 }
 
+///////////////////////////////////////////////////////////////////////
+// ShardedHdrHistogram
+///////////////////////////////////////////////////////////////////////
+
+ShardedHdrHistogram::ShardedHdrHistogram(
+    uint64_t highest_trackable_value,
+    int num_significant_digits,
+    int num_shards) {
+#if defined(__APPLE__)
+  // There is no way to get the CPU running the thread, see Increment().
+  num_shards = 1;
+#endif
+  num_shards = std::max(1, std::min(num_shards, base::MaxCPUIndex() + 1));
+  shards_.reserve(num_shards);
+  for (int i = 0; i < num_shards; i++) {
+    shards_.emplace_back(
+        new HdrHistogram(highest_trackable_value, num_significant_digits));
+  }
+}
+
+void ShardedHdrHistogram::IncrementBy(int64_t value, int64_t count) {
+#if defined(__APPLE__)
+  int cpu = 0;
+#else
+  int cpu = sched_getcpu();
+  if (PREDICT_FALSE(cpu < 0)) {
+    cpu = 0;
+  }
+#endif
+  shards_[cpu % shards_.size()]->IncrementBy(value, count);
+}
+
+uint64_t ShardedHdrHistogram::TotalCount() const {
+  uint64_t total = 0;
+  for (const auto& shard : shards_) {
+    total += shard->TotalCount();
+  }
+  return total;
+}
+
+void ShardedHdrHistogram::MergeTo(HdrHistogram* out) const {
+  for (const auto& shard : shards_) {
+    out->MergeFrom(*shard);
+  }
+}
+
+void ShardedHdrHistogram::ResetHistogram() {
+  for (const auto& shard : shards_) {
+    shard->ResetHistogram();
+  }
+}
+
 ///////////////////////////////////////////////////////////////////////
 // AbstractHistogramIterator
 ///////////////////////////////////////////////////////////////////////
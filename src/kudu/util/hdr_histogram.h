@@ -50,11 +50,15 @@
 
 #include <stdint.h>
 
+#include <memory>
+#include <vector>
+
 #include "kudu/gutil/atomicops.h"
 #include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/port.h"
 #include "kudu/util/locks.h"
+#include "kudu/util/striped64.h"
 
 namespace kudu {
 
@@ -112,12 +116,12 @@ class HdrHistogram {
 
   // Count of all events recorded.
   uint64_t TotalCount() const {
-    return base::subtle::NoBarrier_Load(&total_count_);
+    return total_count_.Value();
   }
 
   // Sum of all events recorded.
   uint64_t TotalSum() const {
-    return base::subtle::NoBarrier_Load(&total_sum_);
+    return total_sum_.Value();
   }
 
   // Return number of items at index.
@@ -172,6 +176,12 @@ class HdrHistogram {
   // Reset the underlying histogram values.
   void ResetHistogram();
 
+  // Adds the values recorded by 'other', which must have the same highest
+  // trackable value and number of significant digits, to this histogram.
+  // Like the copy constructor, not a consistent snapshot of 'other' if it is
+  // being written to.
+  void MergeFrom(const HdrHistogram& other);
+
   // Get the percentile at a given value
   // TODO: implement
   // double PercentileAtOrBelowValue(uint64_t value) const;
@@ -191,21 +201,29 @@ class HdrHistogram {
   void Init();
   int CountsArrayIndex(int bucket_index, int sub_bucket_index) const;
 
+  // Lowers the minimum to 'min' and raises the maximum to 'max', if needed.
+  void UpdateMinMax(int64_t min, int64_t max);
+
   uint64_t highest_trackable_value_;
   int num_significant_digits_;
   int counts_array_length_;
   int bucket_count_;
   int sub_bucket_count_;
-  rw_spinlock histogram_mutex_;
+  // Held in shared mode by writers and exclusively by ResetHistogram(). Writers
+  // only touch the lock of the CPU they run on, so concurrent increments from
+  // different cores don't bounce a shared cache line.
+  percpu_rwlock histogram_mutex_;
 
   // "Hot" fields in the write path.
   uint8_t sub_bucket_half_count_magnitude_;
   int sub_bucket_half_count_;
   uint32_t sub_bucket_mask_;
 
-  // Also hot.
-  base::subtle::Atomic64 total_count_;
-  base::subtle::Atomic64 total_sum_;
+  // Also hot. The totals are bumped by every increment regardless of the
+  // bucket, so they are striped; counts_ entries are spread across buckets
+  // already.
+  LongAdder total_count_;
+  LongAdder total_sum_;
   base::subtle::Atomic64 min_value_;
   base::subtle::Atomic64 max_value_;
   gscoped_array<base::subtle::Atomic64> counts_;
@@ -214,6 +232,53 @@ class HdrHistogram {
       const HdrHistogram& other); // Disable assignment operator.
 };
 
+// An HdrHistogram split into shards, which threads increment depending on the
+// CPU they run on, so that concurrent increments from different cores don't
+// share the bucket counts, the totals or the min and max. Reading it merges
+// the shards into an HdrHistogram.
+//
+// Each shard costs as much memory as an HdrHistogram, so this is meant for the
+// few histograms that many threads update at once, e.g. RPC handler latencies.
+class ShardedHdrHistogram {
+ public:
+  // 'num_shards' is capped at the number of CPUs. Like HdrHistogram otherwise.
+  ShardedHdrHistogram(
+      uint64_t highest_trackable_value,
+      int num_significant_digits,
+      int num_shards);
+
+  void Increment(int64_t value) {
+    IncrementBy(value, 1);
+  }
+  void IncrementBy(int64_t value, int64_t count);
+
+  uint64_t highest_trackable_value() const {
+    return shards_[0]->highest_trackable_value();
+  }
+  int num_significant_digits() const {
+    return shards_[0]->num_significant_digits();
+  }
+  int num_shards() const {
+    return shards_.size();
+  }
+
+  // Count of all events recorded, in all the shards.
+  uint64_t TotalCount() const;
+
+  // Merges a (non-consistent) snapshot of all the shards into 'out', which
+  // must have the same highest trackable value and number of significant
+  // digits.
+  void MergeTo(HdrHistogram* out) const;
+
+  // Resets all the shards.
+  void ResetHistogram();
+
+ private:
+  std::vector<std::unique_ptr<HdrHistogram>> shards_;
+
+  DISALLOW_COPY_AND_ASSIGN(ShardedHdrHistogram);
+};
+
 // Value returned from iterators.
 struct HistogramIterationValue {
   HistogramIterationValue()
@@ -0,0 +1,480 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/io_uring.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define KUDU_HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef KUDU_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <glog/logging.h>
+
+#include "kudu/gutil/once.h"
+#include "kudu/util/errno.h"
+#include "kudu/util/thread_restrictions.h"
+
+using std::pair;
+using std::unique_ptr;
+using std::vector;
+
+namespace kudu {
+
+namespace {
+
+// Only ever one write and one sync are in flight.
+constexpr unsigned kRingEntries = 4;
+
+// user_data tags of the submitted requests.
+constexpr int kWriteTag = 0;
+constexpr int kSyncTag = 1;
+
+// user_data tag of the wakeups of Reap(), which the reads can't have.
+constexpr uint64_t kWakeupTag = 0;
+
+Status ErrnoStatus(const char* context, int err) {
+  return Status::IOError(context, ErrnoToString(err), err);
+}
+
+#ifdef KUDU_HAVE_IO_URING
+int SysIoUringSetup(unsigned entries, struct io_uring_params* p) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+int SysIoUringEnter(int fd, unsigned to_submit, unsigned min_complete) {
+  return static_cast<int>(syscall(
+      __NR_io_uring_enter,
+      fd,
+      to_submit,
+      min_complete,
+      IORING_ENTER_GETEVENTS,
+      nullptr,
+      0));
+}
+
+GoogleOnceType supported_once = GOOGLE_ONCE_INIT;
+bool supported = false;
+
+void ProbeSupport() {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int fd = SysIoUringSetup(kRingEntries, &p);
+  if (fd < 0) {
+    LOG(INFO) << "io_uring is not available: " << ErrnoToString(errno);
+    return;
+  }
+  close(fd);
+  supported = true;
+}
+#endif
+
+} // anonymous namespace
+
+bool IoUring::IsSupported() {
+#ifdef KUDU_HAVE_IO_URING
+  GoogleOnceInit(&supported_once, &ProbeSupport);
+  return supported;
+#else
+  return false;
+#endif
+}
+
+Status IoUring::Create(unique_ptr<IoUring>* ring) {
+  if (!IsSupported()) {
+    return Status::NotSupported("io_uring is not supported");
+  }
+  unique_ptr<IoUring> r(new IoUring());
+  RETURN_NOT_OK(r->Init(kRingEntries));
+  *ring = std::move(r);
+  return Status::OK();
+}
+
+Status IoUring::Create(int depth, unique_ptr<IoUring>* ring) {
+  DCHECK_GT(depth, 0);
+  if (!IsSupported()) {
+    return Status::NotSupported("io_uring is not supported");
+  }
+  unique_ptr<IoUring> r(new IoUring());
+  // One more entry for the wakeup. The completion ring is at least as large.
+  RETURN_NOT_OK(r->Init(depth + 1));
+  r->depth_ = depth;
+  *ring = std::move(r);
+  return Status::OK();
+}
+
+IoUring::IoUring()
+    : ring_fd_(-1),
+      sq_ring_(nullptr),
+      sq_ring_size_(0),
+      cq_ring_(nullptr),
+      cq_ring_size_(0),
+      sqes_(nullptr),
+      sqes_size_(0),
+      in_flight_(0),
+      depth_(0) {}
+
+IoUring::~IoUring() {
+#ifdef KUDU_HAVE_IO_URING
+  if (sqes_) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (cq_ring_ && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  if (sq_ring_) {
+    munmap(sq_ring_, sq_ring_size_);
+  }
+  if (ring_fd_ >= 0) {
+    close(ring_fd_);
+  }
+#endif
+}
+
+Status IoUring::Init(unsigned entries) {
+#ifdef KUDU_HAVE_IO_URING
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  ring_fd_ = SysIoUringSetup(entries, &p);
+  if (ring_fd_ < 0) {
+    return ErrnoStatus("io_uring_setup", errno);
+  }
+
+  sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    sq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    cq_ring_size_ = sq_ring_size_;
+  }
+  sq_ring_ = mmap(
+      nullptr,
+      sq_ring_size_,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE,
+      ring_fd_,
+      IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    sq_ring_ = nullptr;
+    return ErrnoStatus("mmap of io_uring submission ring", errno);
+  }
+  if (single_mmap) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = mmap(
+        nullptr,
+        cq_ring_size_,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        ring_fd_,
+        IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) {
+      cq_ring_ = nullptr;
+      return ErrnoStatus("mmap of io_uring completion ring", errno);
+    }
+  }
+  sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+  sqes_ = mmap(
+      nullptr,
+      sqes_size_,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE,
+      ring_fd_,
+      IORING_OFF_SQES);
+  if (sqes_ == MAP_FAILED) {
+    sqes_ = nullptr;
+    return ErrnoStatus("mmap of io_uring submission entries", errno);
+  }
+
+  uint8_t* sq = static_cast<uint8_t*>(sq_ring_);
+  sq_head_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+  uint8_t* cq = static_cast<uint8_t*>(cq_ring_);
+  cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+  cqes_ = cq + p.cq_off.cqes;
+  return Status::OK();
+#else
+  return Status::NotSupported("io_uring is not supported");
+#endif
+}
+
+Status IoUring::WriteV(
+    int fd,
+    const struct iovec* iov,
+    int iovcnt,
+    uint64_t offset,
+    bool datasync,
+    bool full_sync,
+    size_t* written,
+    bool* synced) {
+#ifdef KUDU_HAVE_IO_URING
+  ThreadRestrictions::AssertIOAllowed();
+  std::lock_guard<Mutex> l(lock_);
+  auto* sqes = static_cast<struct io_uring_sqe*>(sqes_);
+  unsigned tail = *sq_tail_;
+  unsigned mask = *sq_mask_;
+
+  unsigned idx = tail & mask;
+  struct io_uring_sqe* sqe = &sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_WRITEV;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(iov);
+  sqe->len = iovcnt;
+  sqe->off = offset;
+  sqe->user_data = kWriteTag;
+  if (datasync) {
+    // The sync only runs if the write completes in full.
+    sqe->flags = IOSQE_IO_LINK;
+  }
+  sq_array_[idx] = idx;
+  tail++;
+
+  if (datasync) {
+    idx = tail & mask;
+    sqe = &sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->fsync_flags = full_sync ? 0 : IORING_FSYNC_DATASYNC;
+    sqe->user_data = kSyncTag;
+    sq_array_[idx] = idx;
+    tail++;
+  }
+  __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+  int n = datasync ? 2 : 1;
+  int results[2] = {0, 0};
+  RETURN_NOT_OK(SubmitAndWaitUnlocked(n, n, results));
+
+  if (results[kWriteTag] < 0) {
+    return ErrnoStatus("io_uring writev", -results[kWriteTag]);
+  }
+  *written = results[kWriteTag];
+  *synced = false;
+  if (datasync) {
+    if (results[kSyncTag] == -ECANCELED) {
+      // Short write: the caller has to finish the write and sync itself.
+      return Status::OK();
+    }
+    if (results[kSyncTag] < 0) {
+      return ErrnoStatus("io_uring fsync", -results[kSyncTag]);
+    }
+    *synced = true;
+  }
+  return Status::OK();
+#else
+  return Status::NotSupported("io_uring is not supported");
+#endif
+}
+
+Status IoUring::Sync(int fd, bool full_sync) {
+#ifdef KUDU_HAVE_IO_URING
+  ThreadRestrictions::AssertIOAllowed();
+  std::lock_guard<Mutex> l(lock_);
+  auto* sqes = static_cast<struct io_uring_sqe*>(sqes_);
+  unsigned tail = *sq_tail_;
+  unsigned idx = tail & *sq_mask_;
+  struct io_uring_sqe* sqe = &sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_FSYNC;
+  sqe->fd = fd;
+  sqe->fsync_flags = full_sync ? 0 : IORING_FSYNC_DATASYNC;
+  sqe->user_data = kSyncTag;
+  sq_array_[idx] = idx;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+  int results[2] = {0, 0};
+  RETURN_NOT_OK(SubmitAndWaitUnlocked(1, 1, results));
+  if (results[kSyncTag] < 0) {
+    return ErrnoStatus("io_uring fsync", -results[kSyncTag]);
+  }
+  return Status::OK();
+#else
+  return Status::NotSupported("io_uring is not supported");
+#endif
+}
+
+Status IoUring::SubmitReadV(
+    int fd,
+    const struct iovec* iov,
+    int iovcnt,
+    uint64_t offset,
+    uint64_t tag) {
+  DCHECK_NE(kWakeupTag, tag);
+  // The read may be served from the page cache as it is submitted.
+  ThreadRestrictions::AssertIOAllowed();
+  std::lock_guard<Mutex> l(lock_);
+  if (in_flight_ >= depth_) {
+    return Status::ServiceUnavailable("io_uring is full");
+  }
+#ifdef KUDU_HAVE_IO_URING
+  return SubmitOneUnlocked(IORING_OP_READV, fd, iov, iovcnt, offset, tag);
+#else
+  return Status::NotSupported("io_uring is not supported");
+#endif
+}
+
+Status IoUring::SubmitWakeup() {
+  std::lock_guard<Mutex> l(lock_);
+#ifdef KUDU_HAVE_IO_URING
+  return SubmitOneUnlocked(IORING_OP_NOP, -1, nullptr, 0, 0, kWakeupTag);
+#else
+  return Status::NotSupported("io_uring is not supported");
+#endif
+}
+
+Status IoUring::Reap(
+    const std::function<void(uint64_t tag, int result)>& cb,
+    bool* woken) {
+#ifdef KUDU_HAVE_IO_URING
+  ThreadRestrictions::AssertWaitAllowed();
+  auto* cqes = static_cast<struct io_uring_cqe*>(cqes_);
+  unsigned head = *cq_head_;
+  unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  while (head == tail) {
+    int ret = SysIoUringEnter(ring_fd_, 0, 1);
+    if (ret < 0 && errno != EINTR) {
+      return ErrnoStatus("io_uring_enter", errno);
+    }
+    tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  }
+  // The completions are copied out first, so that the callbacks can't hold
+  // up the submitters.
+  vector<pair<uint64_t, int>> completed;
+  for (; head != tail; head++) {
+    const struct io_uring_cqe& cqe = cqes[head & *cq_mask_];
+    completed.emplace_back(cqe.user_data, cqe.res);
+  }
+  __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  {
+    std::lock_guard<Mutex> l(lock_);
+    in_flight_ -= static_cast<int>(completed.size());
+  }
+
+  *woken = false;
+  for (const auto& c : completed) {
+    if (c.first == kWakeupTag) {
+      *woken = true;
+    } else {
+      cb(c.first, c.second);
+    }
+  }
+  return Status::OK();
+#else
+  return Status::NotSupported("io_uring is not supported");
+#endif
+}
+
+Status IoUring::SubmitOneUnlocked(
+    uint8_t opcode,
+    int fd,
+    const struct iovec* iov,
+    int iovcnt,
+    uint64_t offset,
+    uint64_t tag) {
+#ifdef KUDU_HAVE_IO_URING
+  lock_.AssertAcquired();
+  auto* sqes = static_cast<struct io_uring_sqe*>(sqes_);
+  const unsigned tail = *sq_tail_;
+  const unsigned idx = tail & *sq_mask_;
+  struct io_uring_sqe* sqe = &sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(iov);
+  sqe->len = iovcnt;
+  sqe->off = offset;
+  sqe->user_data = tag;
+  sq_array_[idx] = idx;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+  int ret;
+  do {
+    ret = SysIoUringEnter(ring_fd_, 1, 0);
+  } while (ret < 0 && errno == EINTR &&
+           __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == tail);
+  if (ret < 0 && __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == tail) {
+    // Not consumed by the kernel, so it can be taken back.
+    int err = errno;
+    __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+    return ErrnoStatus("io_uring_enter", err);
+  }
+  in_flight_++;
+  return Status::OK();
+#else
+  return Status::NotSupported("io_uring is not supported");
+#endif
+}
+
+Status IoUring::SubmitAndWaitUnlocked(
+    int to_submit,
+    int to_complete,
+    int* results) {
+#ifdef KUDU_HAVE_IO_URING
+  lock_.AssertAcquired();
+  auto* cqes = static_cast<struct io_uring_cqe*>(cqes_);
+  int completed = 0;
+  while (completed < to_complete) {
+    int ret = SysIoUringEnter(ring_fd_, to_submit, to_complete - completed);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        // Whatever was submitted before the interruption stays submitted.
+        to_submit = static_cast<int>(
+            *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE));
+        continue;
+      }
+      return ErrnoStatus("io_uring_enter", errno);
+    }
+    to_submit -= ret;
+
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      const struct io_uring_cqe& cqe = cqes[head & *cq_mask_];
+      DCHECK_LE(cqe.user_data, kSyncTag);
+      results[cqe.user_data] = cqe.res;
+      completed++;
+      head++;
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+  return Status::OK();
+#else
+  return Status::NotSupported("io_uring is not supported");
+#endif
+}
+
+} // namespace kudu
@@ -0,0 +1,154 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#ifndef KUDU_UTIL_IO_URING_H
+#define KUDU_UTIL_IO_URING_H
+
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/util/mutex.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+// A minimal io_uring(7) instance for issuing file writes and data syncs,
+// talking to the kernel directly through io_uring_setup(2) and
+// io_uring_enter(2) so that no extra library is needed.
+//
+// WriteV() and Sync() submit their requests and wait for their completions
+// before returning, so at most two requests are ever in flight. The point is
+// not queue depth but fewer syscalls: a write and the fdatasync which makes it
+// durable can be issued (linked) with a single io_uring_enter(2).
+//
+// SubmitReadV() and Reap() instead keep up to 'depth' reads in flight, whose
+// completions are reaped by a single thread (see AsyncEnv). A ring is used
+// through either set of methods, never both.
+//
+// This class is thread-safe.
+class IoUring {
+ public:
+  // Returns true if io_uring is supported by the build and the running kernel.
+  static bool IsSupported();
+
+  // Creates a new ring. Returns NotSupported if io_uring is not available.
+  static Status Create(std::unique_ptr<IoUring>* ring);
+
+  // Creates a new ring for up to 'depth' reads in flight.
+  static Status Create(int depth, std::unique_ptr<IoUring>* ring);
+
+  ~IoUring();
+
+  // Writes 'iovcnt' buffers at 'offset' of 'fd'. If 'datasync' is true, an
+  // fdatasync (or an fsync if 'full_sync' is true) of 'fd' is linked to the
+  // write and submitted along with it.
+  //
+  // Sets 'written' to the number of bytes written, which may be short, in
+  // which case the sync was not done and 'synced' is set to false. Returns a
+  // bad Status, with errno-style POSIX codes, if either of the operations
+  // failed.
+  Status WriteV(
+      int fd,
+      const struct iovec* iov,
+      int iovcnt,
+      uint64_t offset,
+      bool datasync,
+      bool full_sync,
+      size_t* written,
+      bool* synced);
+
+  // Syncs the data of 'fd' (the whole file if 'full_sync' is true).
+  Status Sync(int fd, bool full_sync);
+
+  // Submits a read of 'iovcnt' buffers at 'offset' of 'fd' without waiting for
+  // it. Its result is passed to Reap()'s callback along with 'tag', which must
+  // not be 0. 'iov' and the buffers must stay valid until then. Returns
+  // ServiceUnavailable if 'depth' reads are already in flight.
+  Status SubmitReadV(
+      int fd,
+      const struct iovec* iov,
+      int iovcnt,
+      uint64_t offset,
+      uint64_t tag);
+
+  // Makes Reap() return once the reads submitted so far have been reaped, so
+  // that its thread can exit.
+  Status SubmitWakeup();
+
+  // Waits for at least one submitted read, or a wakeup, to complete. Calls
+  // 'cb' with the tag and the result of each completed read: the number of
+  // bytes read, or a negated errno. Sets 'woken' to true if a wakeup
+  // completed. Must not be called by two threads at once.
+  Status Reap(
+      const std::function<void(uint64_t tag, int result)>& cb,
+      bool* woken);
+
+ private:
+  IoUring();
+
+  Status Init(unsigned entries);
+
+  // Queues one request with 'opcode' and submits it. Requires 'lock_' to be
+  // held.
+  Status SubmitOneUnlocked(
+      uint8_t opcode,
+      int fd,
+      const struct iovec* iov,
+      int iovcnt,
+      uint64_t offset,
+      uint64_t tag);
+
+  // Submits 'to_submit' prepared requests and waits until 'to_complete'
+  // completions have been reaped into 'results', indexed by user_data.
+  // Requires 'lock_' to be held.
+  Status SubmitAndWaitUnlocked(int to_submit, int to_complete, int* results);
+
+  int ring_fd_;
+
+  void* sq_ring_;
+  size_t sq_ring_size_;
+  void* cq_ring_;
+  size_t cq_ring_size_;
+  void* sqes_;
+  size_t sqes_size_;
+
+  // Pointers into the shared rings.
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned* sq_mask_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned* cq_mask_;
+  void* cqes_;
+
+  // The number of reads, or wakeups, submitted but not reaped yet, and how
+  // many may be. Protected by 'lock_'.
+  int in_flight_;
+  int depth_;
+
+  Mutex lock_;
+
+  DISALLOW_COPY_AND_ASSIGN(IoUring);
+};
+
+} // namespace kudu
+
+#endif // KUDU_UTIL_IO_URING_H
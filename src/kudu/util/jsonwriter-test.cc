@@ -187,6 +187,52 @@ TEST_F(TestJsonWriter, TestPBNestedMessage) {
       JsonWriter::ToJson(pb, JsonWriter::COMPACT));
 }
 
+// Output is buffered until the outermost object or array ends.
+TEST_F(TestJsonWriter, TestOutputAfterOutermostEnd) {
+  std::ostringstream str;
+  JsonWriter jw(&str, JsonWriter::COMPACT);
+  jw.StartArray();
+  jw.StartObject();
+  jw.String("name");
+  jw.String("foo");
+  jw.EndObject();
+  jw.StartArray();
+  jw.Int64(1);
+  jw.EndArray();
+  jw.EndArray();
+  ASSERT_EQ("[{\"name\":\"foo\"},[1]]", str.str());
+
+  // A second document is appended once it is complete too.
+  jw.StartObject();
+  jw.EndObject();
+  ASSERT_EQ("[{\"name\":\"foo\"},[1]]{}", str.str());
+}
+
+// Writes objects shaped like the counters of /metrics.
+TEST_F(TestJsonWriter, BenchmarkMetricLikeObjects) {
+  int64_t total_len = 0;
+  Stopwatch sw;
+  sw.start();
+  while (sw.elapsed().wall_seconds() < 5) {
+    std::ostringstream str;
+    JsonWriter jw(&str, JsonWriter::COMPACT);
+    jw.StartArray();
+    for (int i = 0; i < 10000; i++) {
+      jw.StartObject();
+      jw.String("name");
+      jw.String("rpc_connections_accepted");
+      jw.String("value");
+      jw.Int64(i);
+      jw.EndObject();
+    }
+    jw.EndArray();
+    total_len += str.str().size();
+  }
+  sw.stop();
+  double mbps = total_len / 1024.0 / 1024.0 / sw.elapsed().user_cpu_seconds();
+  LOG(INFO) << "Throughput: " << mbps << "MB/sec";
+}
+
 void TestJsonWriter::DoBenchmark(const Message& pb) {
   int64_t total_len = 0;
   Stopwatch sw;
@@ -58,6 +58,10 @@ class UTF8StringStreamBuffer {
 
   void Flush();
 
+  size_t buffered_bytes() const {
+    return buf_.size();
+  }
+
  private:
   faststring buf_;
   std::ostringstream* out_;
@@ -112,8 +116,16 @@ class JsonWriterImpl : public JsonWriterIf {
   virtual void EndArray() override;
 
  private:
+  // Flushes the buffered output to the stream once the outermost object or
+  // array is done, so that it is complete when the caller reads the stream,
+  // or when enough is buffered. Going through the ostringstream for every
+  // nested object is a fair share of the cost of large documents.
+  void MaybeFlush();
+
   UTF8StringStreamBuffer stream_;
   T writer_;
+  // Number of objects and arrays started but not ended.
+  int depth_ = 0;
   DISALLOW_COPY_AND_ASSIGN(JsonWriterImpl);
 };
 
@@ -399,20 +411,31 @@ void JsonWriterImpl<T>::String(const string& str) {
 template <class T>
 void JsonWriterImpl<T>::StartObject() {
   writer_.StartObject();
+  depth_++;
 }
 template <class T>
 void JsonWriterImpl<T>::EndObject() {
   writer_.EndObject();
-  stream_.Flush();
+  depth_--;
+  MaybeFlush();
 }
 template <class T>
 void JsonWriterImpl<T>::StartArray() {
   writer_.StartArray();
+  depth_++;
 }
 template <class T>
 void JsonWriterImpl<T>::EndArray() {
   writer_.EndArray();
-  stream_.Flush();
+  depth_--;
+  MaybeFlush();
+}
+template <class T>
+void JsonWriterImpl<T>::MaybeFlush() {
+  static const size_t kMaxBufferedBytes = 64 * 1024;
+  if (depth_ <= 0 || stream_.buffered_bytes() >= kMaxBufferedBytes) {
+    stream_.Flush();
+  }
 }
 
 } // namespace kudu
@@ -0,0 +1,194 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/lock_profiling.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags_declare.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "kudu/gutil/sysinfo.h"
+#include "kudu/util/condition_variable.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/mutex.h"
+#include "kudu/util/rw_mutex.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_bool(lock_profiling_enabled);
+DECLARE_int32(lock_profiling_hold_sample_rate);
+DECLARE_int32(lock_profiling_stack_sample_rate);
+
+using std::string;
+using std::thread;
+using std::vector;
+
+namespace kudu {
+
+class LockProfilingTest : public KuduTest {
+ public:
+  void SetUp() override {
+    KuduTest::SetUp();
+    FLAGS_lock_profiling_hold_sample_rate = 1;
+    FLAGS_lock_profiling_stack_sample_rate = 1;
+  }
+};
+
+static int64_t MicrosToCycles(int64_t micros) {
+  return static_cast<int64_t>(micros * base::CyclesPerSecond() / 1000000);
+}
+
+// Have 'num_threads' threads take 'lock' 'iters' times each, holding it for
+// 'hold_us' every time.
+template <class LockType>
+static void Contend(LockType* lock, int num_threads, int iters, int hold_us) {
+  vector<thread> threads;
+  for (int i = 0; i < num_threads; i++) {
+    threads.emplace_back([=]() {
+      for (int j = 0; j < iters; j++) {
+        std::lock_guard<LockType> l(*lock);
+        SleepFor(MonoDelta::FromMicroseconds(hold_us));
+      }
+    });
+  }
+  for (thread& t : threads) {
+    t.join();
+  }
+}
+
+TEST_F(LockProfilingTest, TestSitesAreSharedByName) {
+  Mutex a("LockProfilingTest::shared");
+  Mutex b("LockProfilingTest::shared");
+  LockSite* site = LockSite::Get("LockProfilingTest::shared");
+  int64_t before = site->GetStats().acquisitions;
+  {
+    MutexLock l(a);
+  }
+  {
+    MutexLock l(b);
+  }
+  ASSERT_EQ(before + 2, site->GetStats().acquisitions);
+}
+
+TEST_F(LockProfilingTest, TestSimpleMutexlockContention) {
+  simple_mutexlock lock("LockProfilingTest::simple_mutexlock");
+  Contend(&lock, 4, 50, 100);
+
+  LockSite::Stats stats =
+      LockSite::Get("LockProfilingTest::simple_mutexlock")->GetStats();
+  ASSERT_EQ(200, stats.acquisitions);
+  ASSERT_GT(stats.contended_acquisitions, 0);
+  ASSERT_GT(stats.wait_cycles, 0);
+  ASSERT_GE(stats.max_wait_cycles, stats.wait_cycles / 200);
+  ASSERT_EQ(200, stats.sampled_holds);
+  ASSERT_GE(stats.hold_cycles, MicrosToCycles(200 * 100));
+  ASSERT_FALSE(LockSite::Get("LockProfilingTest::simple_mutexlock")
+                   ->GetWaitStacks(/*reset=*/false)
+                   .empty());
+}
+
+TEST_F(LockProfilingTest, TestMutexContention) {
+  Mutex lock("LockProfilingTest::Mutex");
+  Contend(&lock, 4, 50, 100);
+  LockSite::Stats stats =
+      LockSite::Get("LockProfilingTest::Mutex")->GetStats();
+  ASSERT_EQ(200, stats.acquisitions);
+  ASSERT_GT(stats.contended_acquisitions, 0);
+  ASSERT_EQ(200, stats.sampled_holds);
+}
+
+// Readers waiting on a writer are accounted for, but only write holds are
+// timed.
+TEST_F(LockProfilingTest, TestRWMutexContention) {
+  RWMutex lock("LockProfilingTest::RWMutex");
+  LockSite* site = LockSite::Get("LockProfilingTest::RWMutex");
+  lock.WriteLock();
+  thread reader([&lock]() {
+    lock.ReadLock();
+    lock.ReadUnlock();
+  });
+  SleepFor(MonoDelta::FromMilliseconds(50));
+  lock.WriteUnlock();
+  reader.join();
+
+  LockSite::Stats stats = site->GetStats();
+  ASSERT_EQ(2, stats.acquisitions);
+  ASSERT_EQ(1, stats.contended_acquisitions);
+  ASSERT_GE(stats.wait_cycles, MicrosToCycles(10 * 1000));
+  ASSERT_EQ(1, stats.sampled_holds);
+}
+
+// The time spent waiting on a condition variable does not count as holding
+// its mutex.
+TEST_F(LockProfilingTest, TestConditionVariableWaitEndsHold) {
+  Mutex lock("LockProfilingTest::cond");
+  ConditionVariable cond(&lock);
+  {
+    MutexLock l(lock);
+    cond.WaitFor(MonoDelta::FromMilliseconds(100));
+  }
+  LockSite::Stats stats = LockSite::Get("LockProfilingTest::cond")->GetStats();
+  ASSERT_EQ(1, stats.sampled_holds);
+  ASSERT_LT(stats.hold_cycles, MicrosToCycles(50 * 1000));
+}
+
+TEST_F(LockProfilingTest, TestDisabled) {
+  FLAGS_lock_profiling_enabled = false;
+  simple_mutexlock lock("LockProfilingTest::disabled");
+  Contend(&lock, 2, 10, 10);
+  ASSERT_EQ(0, LockSite::Get("LockProfilingTest::disabled")
+                   ->GetStats()
+                   .acquisitions);
+}
+
+TEST_F(LockProfilingTest, TestCollectLockProfile) {
+  simple_mutexlock lock("LockProfilingTest::report");
+  std::atomic<bool> done(false);
+  vector<thread> threads;
+  for (int i = 0; i < 2; i++) {
+    threads.emplace_back([&]() {
+      while (!done) {
+        std::lock_guard<simple_mutexlock> l(lock);
+        SleepFor(MonoDelta::FromMicroseconds(200));
+      }
+    });
+  }
+  string report;
+  ASSERT_OK(CollectLockProfile(MonoDelta::FromMilliseconds(300), &report));
+  done = true;
+  for (thread& t : threads) {
+    t.join();
+  }
+  LOG(INFO) << report;
+  ASSERT_STR_CONTAINS(report, "LockProfilingTest::report\n");
+  ASSERT_STR_CONTAINS(report, "  acquisitions: ");
+  ASSERT_STR_CONTAINS(report, "  hold: ");
+  ASSERT_STR_CONTAINS(report, "  wait stack: ");
+
+  ASSERT_TRUE(CollectLockProfile(MonoDelta::FromSeconds(3600), &report)
+                  .IsInvalidArgument());
+}
+
+} // namespace kudu
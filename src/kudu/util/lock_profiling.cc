@@ -0,0 +1,330 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/lock_profiling.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+
+#include <gflags/gflags.h>
+
+#include "kudu/gutil/atomicops.h"
+#include "kudu/gutil/port.h"
+#include "kudu/gutil/stringprintf.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/sysinfo.h"
+#include "kudu/gutil/walltime.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/scoped_cleanup.h"
+
+DEFINE_bool(
+    lock_profiling_enabled,
+    true,
+    "Whether locks constructed with a site name account their acquisitions, "
+    "wait times and hold times. See kudu/util/lock_profiling.h.");
+TAG_FLAG(lock_profiling_enabled, advanced);
+TAG_FLAG(lock_profiling_enabled, runtime);
+
+DEFINE_int32(
+    lock_profiling_hold_sample_rate,
+    64,
+    "How long a named lock is held is measured for one in this many of its "
+    "acquisitions.");
+DEFINE_validator(
+    lock_profiling_hold_sample_rate,
+    [](const char* /*flag_name*/, int32_t value) { return value > 0; });
+TAG_FLAG(lock_profiling_hold_sample_rate, advanced);
+TAG_FLAG(lock_profiling_hold_sample_rate, runtime);
+
+DEFINE_int32(
+    lock_profiling_stack_sample_rate,
+    16,
+    "The stack of one in this many contended acquisitions of a named lock is "
+    "collected for the lock profile.");
+DEFINE_validator(
+    lock_profiling_stack_sample_rate,
+    [](const char* /*flag_name*/, int32_t value) { return value > 0; });
+TAG_FLAG(lock_profiling_stack_sample_rate, advanced);
+TAG_FLAG(lock_profiling_stack_sample_rate, runtime);
+
+DECLARE_int32(profiler_max_duration_secs);
+
+using base::SpinLockHolder;
+using std::string;
+using std::unordered_map;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+
+namespace {
+
+struct SiteRegistry {
+  simple_spinlock lock;
+  unordered_map<string, LockSite*> sites;
+};
+
+SiteRegistry* GetSiteRegistry() {
+  static SiteRegistry* registry = new SiteRegistry();
+  return registry;
+}
+
+// Only one lock profile may be collected at a time, since collecting one
+// resets the sampled stacks and maximum wait times.
+Atomic32 g_lock_profile_running = 0;
+
+double CyclesToMicros(int64_t cycles) {
+  return static_cast<double>(cycles) * 1000000.0 / base::CyclesPerSecond();
+}
+
+string Indent(const string& s, const string& prefix) {
+  string out;
+  size_t start = 0;
+  while (start < s.size()) {
+    size_t end = s.find('\n', start);
+    if (end == string::npos) {
+      end = s.size();
+    }
+    out += prefix;
+    out.append(s, start, end - start);
+    out += "\n";
+    start = end + 1;
+  }
+  return out;
+}
+
+} // anonymous namespace
+
+LockSite* LockSite::Get(const string& name) {
+  SiteRegistry* registry = GetSiteRegistry();
+  std::lock_guard<simple_spinlock> l(registry->lock);
+  LockSite*& site = registry->sites[name];
+  if (site == nullptr) {
+    site = new LockSite(name);
+  }
+  return site;
+}
+
+vector<LockSite*> LockSite::GetAll() {
+  SiteRegistry* registry = GetSiteRegistry();
+  std::lock_guard<simple_spinlock> l(registry->lock);
+  vector<LockSite*> sites;
+  sites.reserve(registry->sites.size());
+  for (const auto& e : registry->sites) {
+    sites.push_back(e.second);
+  }
+  return sites;
+}
+
+LockSite::LockSite(string name)
+    : name_(std::move(name)), max_wait_cycles_(0) {}
+
+int64_t LockSite::Acquired(int64_t wait_cycles) {
+  if (PREDICT_FALSE(!FLAGS_lock_profiling_enabled)) {
+    return 0;
+  }
+  acquisitions_.Increment();
+  if (wait_cycles > 0) {
+    contended_acquisitions_.Increment();
+    wait_cycles_.IncrementBy(wait_cycles);
+    max_wait_cycles_.StoreMax(wait_cycles);
+    static __thread uint32_t contended_count = 0;
+    if (++contended_count % FLAGS_lock_profiling_stack_sample_rate == 0) {
+      SampleWaitStack(wait_cycles);
+    }
+  }
+  static __thread uint32_t acquisition_count = 0;
+  if (++acquisition_count % FLAGS_lock_profiling_hold_sample_rate == 0) {
+    return CycleClock::Now();
+  }
+  return 0;
+}
+
+void LockSite::Released(int64_t hold_start_cycles) {
+  if (PREDICT_TRUE(hold_start_cycles == 0)) {
+    return;
+  }
+  int64_t hold_cycles = CycleClock::Now() - hold_start_cycles;
+  if (hold_cycles > 0) {
+    sampled_holds_.Increment();
+    hold_cycles_.IncrementBy(hold_cycles);
+  }
+}
+
+void LockSite::SampleWaitStack(int64_t wait_cycles) {
+  StackTrace s;
+  // Skip this function and Acquired().
+  s.Collect(2);
+  uint64_t hash = s.HashCode();
+  for (int i = 0; i < kNumLinearProbeAttempts; i++) {
+    StackEntry* e = &stacks_[(hash + i) % kNumStackEntries];
+    if (!e->lock.TryLock()) {
+      continue;
+    }
+    if (e->wait.count == 0) {
+      e->hash = hash;
+      e->wait.stack.CopyFrom(s);
+    } else if (e->hash != hash || !e->wait.stack.Equals(s)) {
+      e->lock.Unlock();
+      continue;
+    }
+    e->wait.count++;
+    e->wait.wait_cycles += wait_cycles;
+    e->lock.Unlock();
+    return;
+  }
+}
+
+LockSite::Stats LockSite::GetStats() const {
+  Stats stats;
+  stats.name = name_;
+  stats.acquisitions = acquisitions_.Value();
+  stats.contended_acquisitions = contended_acquisitions_.Value();
+  stats.wait_cycles = wait_cycles_.Value();
+  stats.max_wait_cycles = max_wait_cycles_.Load();
+  stats.sampled_holds = sampled_holds_.Value();
+  stats.hold_cycles = hold_cycles_.Value();
+  return stats;
+}
+
+vector<LockSite::WaitStack> LockSite::GetWaitStacks(bool reset) {
+  vector<WaitStack> result;
+  for (StackEntry& e : stacks_) {
+    SpinLockHolder l(&e.lock);
+    if (e.wait.count == 0) {
+      continue;
+    }
+    result.push_back(e.wait);
+    if (reset) {
+      e.wait.count = 0;
+      e.wait.wait_cycles = 0;
+    }
+  }
+  std::sort(
+      result.begin(),
+      result.end(),
+      [](const WaitStack& a, const WaitStack& b) {
+        return a.wait_cycles > b.wait_cycles;
+      });
+  return result;
+}
+
+Status CollectLockProfile(MonoDelta duration, string* report) {
+  if (!duration.Initialized() || duration.ToNanoseconds() <= 0) {
+    return Status::InvalidArgument("profile duration must be positive");
+  }
+  if (duration.ToSeconds() > FLAGS_profiler_max_duration_secs) {
+    return Status::InvalidArgument(Substitute(
+        "profile duration of $0 exceeds --profiler_max_duration_secs ($1s)",
+        duration.ToString(),
+        FLAGS_profiler_max_duration_secs));
+  }
+  if (base::subtle::Acquire_CompareAndSwap(&g_lock_profile_running, 0, 1) !=
+      0) {
+    return Status::IllegalState("a lock profile is already being collected");
+  }
+  SCOPED_CLEANUP({ base::subtle::Release_Store(&g_lock_profile_running, 0); });
+
+  unordered_map<LockSite*, LockSite::Stats> before;
+  for (LockSite* site : LockSite::GetAll()) {
+    site->GetWaitStacks(/*reset=*/true);
+    site->max_wait_cycles_.Store(0);
+    before[site] = site->GetStats();
+  }
+  SleepFor(duration);
+
+  // Sites created during the window start from zero.
+  vector<std::pair<LockSite*, LockSite::Stats>> deltas;
+  for (LockSite* site : LockSite::GetAll()) {
+    LockSite::Stats stats = site->GetStats();
+    auto it = before.find(site);
+    if (it != before.end()) {
+      const LockSite::Stats& b = it->second;
+      stats.acquisitions -= b.acquisitions;
+      stats.contended_acquisitions -= b.contended_acquisitions;
+      stats.wait_cycles -= b.wait_cycles;
+      stats.sampled_holds -= b.sampled_holds;
+      stats.hold_cycles -= b.hold_cycles;
+    }
+    if (stats.acquisitions > 0) {
+      deltas.emplace_back(site, std::move(stats));
+    }
+  }
+  std::sort(
+      deltas.begin(),
+      deltas.end(),
+      [](const std::pair<LockSite*, LockSite::Stats>& a,
+         const std::pair<LockSite*, LockSite::Stats>& b) {
+        return a.second.wait_cycles > b.second.wait_cycles;
+      });
+
+  const double window_us = duration.ToMicroseconds();
+  std::ostringstream out;
+  out << Substitute(
+      "Lock profile over $0 (hold times sampled 1/$1, wait stacks sampled "
+      "1/$2)\n",
+      duration.ToString(),
+      FLAGS_lock_profiling_hold_sample_rate,
+      FLAGS_lock_profiling_stack_sample_rate);
+  for (auto& e : deltas) {
+    const LockSite::Stats& s = e.second;
+    double wait_us = CyclesToMicros(s.wait_cycles);
+    out << "\n" << s.name << "\n";
+    out << StringPrintf(
+        "  acquisitions: %" PRId64 " (%" PRId64 " contended, %.1f%%)\n",
+        s.acquisitions,
+        s.contended_acquisitions,
+        100.0 * s.contended_acquisitions / s.acquisitions);
+    out << StringPrintf(
+        "  wait: %.0fus total (%.1f%% of the window), %.1fus avg per "
+        "contended acquisition, %.0fus max\n",
+        wait_us,
+        100.0 * wait_us / window_us,
+        s.contended_acquisitions ? wait_us / s.contended_acquisitions : 0.0,
+        CyclesToMicros(s.max_wait_cycles));
+    if (s.sampled_holds > 0) {
+      double avg_hold_us = CyclesToMicros(s.hold_cycles) / s.sampled_holds;
+      double est_hold_us = avg_hold_us * s.acquisitions;
+      out << StringPrintf(
+          "  hold: %.2fus avg over %" PRId64 " samples, ~%.0fus total "
+          "(%.1f%% of the window)\n",
+          avg_hold_us,
+          s.sampled_holds,
+          est_hold_us,
+          100.0 * est_hold_us / window_us);
+    }
+    vector<LockSite::WaitStack> stacks =
+        e.first->GetWaitStacks(/*reset=*/false);
+    const size_t kMaxStacksPerSite = 5;
+    for (size_t i = 0; i < stacks.size() && i < kMaxStacksPerSite; i++) {
+      out << StringPrintf(
+          "  wait stack: %" PRId64 " samples, %.0fus waited\n",
+          stacks[i].count,
+          CyclesToMicros(stacks[i].wait_cycles));
+      out << Indent(stacks[i].stack.Symbolize(), "    ");
+    }
+  }
+  *report = out.str();
+  return Status::OK();
+}
+
+} // namespace kudu
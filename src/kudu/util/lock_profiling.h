@@ -0,0 +1,136 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/spinlock.h"
+#include "kudu/util/atomic.h"
+#include "kudu/util/debug-util.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/status.h"
+#include "kudu/util/striped64.h"
+
+namespace kudu {
+
+// Contention accounting for named blocking locks.
+//
+// Spinlock contention is only tracked process-wide (see
+// spinlock_profiling.h). To find out which of the big locks limits
+// throughput, Mutex, simple_mutexlock and RWMutex can instead be constructed
+// with a site name, e.g.
+//
+//   mutable simple_mutexlock lock_{"RaftConsensus::lock_"};
+//
+// All locks which share a site name (for instance the lock_ of every replica)
+// accumulate into the same LockSite, which counts acquisitions, contended
+// acquisitions and the time spent waiting, samples how long the lock is held,
+// and keeps the stacks of a sample of the contended waits.
+//
+// Locks constructed without a site name pay nothing beyond a null check.
+class LockSite {
+ public:
+  // Snapshot of the counters of a site. Times are in CPU cycles.
+  struct Stats {
+    std::string name;
+    int64_t acquisitions = 0;
+    int64_t contended_acquisitions = 0;
+    int64_t wait_cycles = 0;
+    int64_t max_wait_cycles = 0;
+    // Hold times are sampled; 'hold_cycles' is the sum over 'sampled_holds'
+    // samples.
+    int64_t sampled_holds = 0;
+    int64_t hold_cycles = 0;
+  };
+
+  // A sampled stack at which threads waited for the lock.
+  struct WaitStack {
+    StackTrace stack;
+    int64_t count = 0;
+    int64_t wait_cycles = 0;
+  };
+
+  // Return the site called 'name', creating it on first use. Sites live
+  // forever, so callers may keep the returned pointer.
+  static LockSite* Get(const std::string& name);
+
+  // Return all sites created so far.
+  static std::vector<LockSite*> GetAll();
+
+  const std::string& name() const {
+    return name_;
+  }
+
+  // Called by an instrumented lock once it has been acquired. 'wait_cycles'
+  // is 0 if the lock was acquired without blocking.
+  //
+  // Returns the cycle count at which the hold started if this hold should be
+  // timed, or 0 otherwise. The caller passes it back to Released().
+  int64_t Acquired(int64_t wait_cycles);
+
+  // Called by an instrumented lock as it is released.
+  void Released(int64_t hold_start_cycles);
+
+  Stats GetStats() const;
+
+  // Return the sampled wait stacks, sorted by descending wait time, and clear
+  // them if 'reset' is true.
+  std::vector<WaitStack> GetWaitStacks(bool reset);
+
+ private:
+  friend Status CollectLockProfile(MonoDelta duration, std::string* report);
+
+  explicit LockSite(std::string name);
+
+  void SampleWaitStack(int64_t wait_cycles);
+
+  const std::string name_;
+
+  LongAdder acquisitions_;
+  LongAdder contended_acquisitions_;
+  LongAdder wait_cycles_;
+  AtomicInt<int64_t> max_wait_cycles_;
+  LongAdder sampled_holds_;
+  LongAdder hold_cycles_;
+
+  // Small table of sampled wait stacks. Slots are claimed with TryLock() so
+  // that sampling never blocks; a sample which finds no slot is dropped.
+  struct StackEntry {
+    base::SpinLock lock;
+    uint64_t hash = 0;
+    WaitStack wait;
+  };
+  enum { kNumStackEntries = 32, kNumLinearProbeAttempts = 4 };
+  StackEntry stacks_[kNumStackEntries];
+
+  DISALLOW_COPY_AND_ASSIGN(LockSite);
+};
+
+// Accumulate lock site statistics for 'duration' and write a report of the
+// sites which saw any acquisitions to '*report', ordered by total wait time.
+// Each site lists acquisitions, contention, wait and estimated hold time,
+// followed by its top symbolized wait stacks.
+//
+// Returns InvalidArgument if the duration exceeds
+// --profiler_max_duration_secs.
+Status CollectLockProfile(MonoDelta duration, std::string* report);
+
+} // namespace kudu
@@ -17,7 +17,11 @@
 
 #include "kudu/util/locks.h"
 
+#include <string>
+
 #include "kudu/gutil/atomicops.h"
+#include "kudu/gutil/walltime.h"
+#include "kudu/util/lock_profiling.h"
 #include "kudu/util/malloc.h"
 
 namespace kudu {
@@ -44,4 +48,26 @@ size_t percpu_rwlock::memory_footprint_including_this() const {
   return kudu_malloc_usable_size(this) + memory_footprint_excluding_this();
 }
 
+simple_mutexlock::simple_mutexlock(const std::string& site_name)
+    : site_(LockSite::Get(site_name)) {}
+
+void simple_mutexlock::LockProfiled() {
+  if (m_.try_lock()) {
+    hold_start_cycles_ = site_->Acquired(0);
+    return;
+  }
+  int64_t start_cycles = CycleClock::Now();
+  m_.lock();
+  hold_start_cycles_ = site_->Acquired(CycleClock::Now() - start_cycles);
+}
+
+void simple_mutexlock::RecordUncontendedAcquire() {
+  hold_start_cycles_ = site_->Acquired(0);
+}
+
+void simple_mutexlock::RecordRelease() {
+  site_->Released(hold_start_cycles_);
+  hold_start_cycles_ = 0;
+}
+
 } // namespace kudu
@@ -22,7 +22,9 @@
 #include <algorithm> // IWYU pragma: keep
 #include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <mutex>
+#include <string>
 
 #include <glog/logging.h>
 
@@ -35,6 +37,8 @@
 
 namespace kudu {
 
+class LockSite;
+
 // Wrapper around the Google SpinLock class to adapt it to the method names
 // expected by Boost.
 class simple_spinlock {
@@ -294,18 +298,33 @@ class simple_mutexlock {
  public:
   simple_mutexlock() {}
 
+  // Account contention on this lock to the LockSite called 'site_name'.
+  // See lock_profiling.h.
+  explicit simple_mutexlock(const std::string& site_name);
+
   void lock() {
-    m_.lock();
+    if (PREDICT_FALSE(site_ != nullptr)) {
+      LockProfiled();
+    } else {
+      m_.lock();
+    }
     is_locked_ = true;
   }
 
   void unlock() {
     is_locked_ = false;
+    if (PREDICT_FALSE(site_ != nullptr)) {
+      RecordRelease();
+    }
     m_.unlock();
   }
 
   bool try_lock() {
-    return m_.try_lock();
+    bool acquired = m_.try_lock();
+    if (acquired && PREDICT_FALSE(site_ != nullptr)) {
+      RecordUncontendedAcquire();
+    }
+    return acquired;
   }
 
   // Return whether the lock is currently held.
@@ -320,10 +339,21 @@ class simple_mutexlock {
   }
 
  private:
+  void LockProfiled();
+  void RecordUncontendedAcquire();
+  void RecordRelease();
+
   std::mutex m_;
 
   std::atomic<bool> is_locked_{false};
 
+  // Set if the lock was constructed with a site name.
+  LockSite* const site_ = nullptr;
+
+  // Cycle count at which the current hold started if it is being timed, or 0.
+  // Protected by 'm_'.
+  int64_t hold_start_cycles_ = 0;
+
   DISALLOW_COPY_AND_ASSIGN(simple_mutexlock);
 };
 
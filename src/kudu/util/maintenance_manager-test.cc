@@ -318,6 +318,40 @@ TEST_F(MaintenanceManagerTest, TestLogRetentionPrioritization) {
   manager_->UnregisterOp(&op2);
 }
 
+// Test that HIGH_IO_USAGE ops are held back while over the I/O budget,
+// unless they are needed to free memory.
+TEST_F(MaintenanceManagerTest, TestHighIOBudget) {
+  manager_->Shutdown();
+  std::atomic<int> budget(0);
+  manager_->set_high_io_budget_func([&]() { return budget.load(); });
+
+  TestMaintenanceOp high_io_op("high_io_op", MaintenanceOp::HIGH_IO_USAGE);
+  high_io_op.set_perf_improvement(10);
+  high_io_op.set_ram_anchored(200);
+  TestMaintenanceOp low_io_op("low_io_op", MaintenanceOp::LOW_IO_USAGE);
+  low_io_op.set_perf_improvement(5);
+  low_io_op.set_ram_anchored(0);
+  manager_->RegisterOp(&high_io_op);
+  manager_->RegisterOp(&low_io_op);
+
+  // Out of budget, the better op has to wait.
+  auto op_and_why = manager_->FindBestOp();
+  ASSERT_EQ(&low_io_op, op_and_why.first);
+
+  // Unless memory is short.
+  indicate_memory_pressure_ = true;
+  op_and_why = manager_->FindBestOp();
+  ASSERT_EQ(&high_io_op, op_and_why.first);
+  indicate_memory_pressure_ = false;
+
+  budget = 1;
+  op_and_why = manager_->FindBestOp();
+  ASSERT_EQ(&high_io_op, op_and_why.first);
+
+  manager_->UnregisterOp(&high_io_op);
+  manager_->UnregisterOp(&low_io_op);
+}
+
 // Test retrieving a list of an op's running instances
 TEST_F(MaintenanceManagerTest, TestRunningInstances) {
   TestMaintenanceOp op("op", MaintenanceOp::HIGH_IO_USAGE);
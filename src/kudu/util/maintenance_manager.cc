@@ -168,6 +168,7 @@ MaintenanceManager::MaintenanceManager(
               ? FLAGS_maintenance_manager_polling_interval_ms
               : options.polling_interval_ms),
       running_ops_(0),
+      running_high_io_ops_(0),
       completed_ops_count_(0),
       rand_(GetRandomSeed32()),
       memory_pressure_func_(&process_memory::UnderMemoryPressure) {
@@ -327,6 +328,9 @@ void MaintenanceManager::RunSchedulerThread() {
       continue;
     }
 
+    if (op->io_usage() == MaintenanceOp::HIGH_IO_USAGE) {
+      running_high_io_ops_++;
+    }
     LOG_AND_TRACE("maintenance", INFO)
         << LogPrefix() << "Scheduling " << op->name() << ": " << note;
     // Run the maintenance operation.
@@ -357,6 +361,9 @@ void MaintenanceManager::RunSchedulerThread() {
 //
 // In the third priority we're at a point where nothing's urgent and there's
 // nothing we can run quickly.
+//
+// HIGH_IO_USAGE ops past the budget of set_high_io_budget_func() are only
+// considered under memory pressure.
 // TODO We currently optimize for freeing log retention but we could consider
 // having some sort of sliding priority between log retention and RAM usage. For
 // example, is an Op that frees 128MB of log retention and 12MB of RAM always
@@ -385,6 +392,9 @@ pair<MaintenanceOp*, string> MaintenanceManager::FindBestOp() {
 
   double best_perf_improvement = 0;
   MaintenanceOp* best_perf_improvement_op = nullptr;
+
+  const bool high_io_allowed = !high_io_budget_func_ ||
+      static_cast<int64_t>(running_high_io_ops_) < high_io_budget_func_();
   for (OpMapTy::value_type& val : ops_) {
     MaintenanceOp* op(val.first);
     MaintenanceOpStats& stats(val.second);
@@ -408,6 +418,11 @@ pair<MaintenanceOp*, string> MaintenanceManager::FindBestOp() {
       most_mem_anchored_op = op;
       most_mem_anchored = stats.ram_anchored();
     }
+    if (op->io_usage() == MaintenanceOp::HIGH_IO_USAGE && !high_io_allowed) {
+      VLOG_AND_TRACE("maintenance", 2)
+          << LogPrefix() << "Op " << op->name() << " is over the I/O budget";
+      continue;
+    }
     // We prioritize ops that can free more logs, but when it's the same we pick
     // the one that also frees up the most memory.
     if (stats.logs_retained_bytes() > 0 &&
@@ -517,6 +532,9 @@ void MaintenanceManager::LaunchOp(MaintenanceOp* op) {
     op->DurationHistogram()->Increment(op_instance.duration.ToMilliseconds());
 
     running_ops_--;
+    if (op->io_usage() == MaintenanceOp::HIGH_IO_USAGE) {
+      running_high_io_ops_--;
+    }
     op->running_--;
     op->cond_->Signal();
     cond_.Signal(); // wake up scheduler
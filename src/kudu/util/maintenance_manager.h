@@ -307,10 +307,22 @@ class MaintenanceManager
     memory_pressure_func_ = std::move(f);
   }
 
+  // Sets the function returning how many HIGH_IO_USAGE ops may run at once,
+  // e.g. from how the foreground I/O is faring, so that background work
+  // backs off when it would slow down the WAL. While that many are running,
+  // the other HIGH_IO_USAGE ops are only scheduled under memory pressure.
+  // LOW_IO_USAGE ops aren't limited. By default, there is no limit but the
+  // number of threads.
+  void set_high_io_budget_func(std::function<int()> f) {
+    std::lock_guard<Mutex> guard(lock_);
+    high_io_budget_func_ = std::move(f);
+  }
+
   static const Options kDefaultOptions;
 
  private:
   FRIEND_TEST(MaintenanceManagerTest, TestLogRetentionPrioritization);
+  FRIEND_TEST(MaintenanceManagerTest, TestHighIOBudget);
   typedef std::map<MaintenanceOp*, MaintenanceOpStats, MaintenanceOpComparator>
       OpMapTy;
 
@@ -340,6 +352,8 @@ class MaintenanceManager
   bool shutdown_;
   int32_t polling_interval_ms_;
   uint64_t running_ops_;
+  // The number of running ops with HIGH_IO_USAGE.
+  uint64_t running_high_io_ops_;
   // Vector used as a circular buffer for recently completed ops. Elements need
   // to be added at the completed_ops_count_ % the vector's size and then the
   // count needs to be incremented.
@@ -351,6 +365,9 @@ class MaintenanceManager
   // pressure. This is indirected for testing purposes.
   std::function<bool(double*)> memory_pressure_func_;
 
+  // See set_high_io_budget_func(). May be null.
+  std::function<int()> high_io_budget_func_;
+
   // Running instances lock.
   //
   // This is separate of lock_ so that worker threads don't need to take the
@@ -16,7 +16,9 @@
 // under the License.
 
 #include <cstdint>
+#include <map>
 #include <ostream>
+#include <sstream>
 #include <string>
 #include <unordered_set>
 #include <vector>
@@ -31,12 +33,15 @@
 #include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/hdr_histogram.h"
+#include "kudu/util/histogram.pb.h"
 #include "kudu/util/jsonreader.h"
 #include "kudu/util/jsonwriter.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/status.h"
+#include "kudu/util/stopwatch.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
 
@@ -199,6 +204,41 @@ TEST_F(MetricsTest, SimpleHistogramTest) {
   // TODO: Test coverage needs to be improved a lot.
 }
 
+// Histogram::WriteAsJson() writes the fields itself; it must match the JSON of
+// the equivalent HistogramSnapshotPB.
+TEST_F(MetricsTest, HistogramJsonMatchesSnapshotPB) {
+  scoped_refptr<Histogram> hist = METRIC_test_hist.Instantiate(entity_);
+  for (bool empty : {true, false}) {
+    if (!empty) {
+      hist->Increment(2);
+      hist->IncrementBy(40, 3);
+      hist->IncrementBy(100000, 2);
+    }
+    for (bool schema : {false, true}) {
+      for (bool raw : {false, true}) {
+        SCOPED_TRACE(Substitute("$0 $1 $2", empty, schema, raw));
+        MetricJsonOptions opts;
+        opts.include_schema_info = schema;
+        opts.include_raw_histograms = raw;
+
+        std::ostringstream expected;
+        {
+          HistogramSnapshotPB snapshot;
+          ASSERT_OK(hist->GetHistogramSnapshotPB(&snapshot, opts));
+          JsonWriter w(&expected, JsonWriter::COMPACT);
+          w.Protobuf(snapshot);
+        }
+        std::ostringstream actual;
+        {
+          JsonWriter w(&actual, JsonWriter::COMPACT);
+          ASSERT_OK(hist->WriteAsJson(&w, opts));
+        }
+        ASSERT_EQ(expected.str(), actual.str());
+      }
+    }
+  }
+}
+
 TEST_F(MetricsTest, JsonPrintTest) {
   scoped_refptr<Counter> test_counter =
       METRIC_test_counter.Instantiate(entity_);
@@ -417,4 +457,167 @@ TEST_F(MetricsTest, TestDontDumpUntouched) {
   ASSERT_STR_CONTAINS(out.str(), "test_gauge");
 }
 
+TEST_F(MetricsTest, TestPrometheusFormat) {
+  scoped_refptr<Counter> counter = METRIC_test_counter.Instantiate(entity_);
+  counter->IncrementBy(3);
+  scoped_refptr<Histogram> hist = METRIC_test_hist.Instantiate(entity_);
+  hist->Increment(2);
+  hist->Increment(4);
+  scoped_refptr<MetricEntity> other =
+      METRIC_ENTITY_test_entity.Instantiate(&registry_, "other \"test\"");
+  METRIC_test_counter.Instantiate(other)->Increment();
+
+  std::ostringstream out;
+  ASSERT_OK(registry_.WriteAsPrometheus(&out, MetricPrometheusOptions()));
+  string text = out.str();
+  // The samples of both entities follow the one TYPE line of the counter.
+  ASSERT_STR_CONTAINS(
+      text,
+      "# HELP kudu_test_counter Description of test counter\n"
+      "# TYPE kudu_test_counter counter\n"
+      "kudu_test_counter{entity_type=\"test_entity\",entity_id=\"my-test\"} "
+      "3\n");
+  ASSERT_STR_CONTAINS(
+      text,
+      "kudu_test_counter{entity_type=\"test_entity\","
+      "entity_id=\"other \\\"test\\\"\"} 1\n");
+  ASSERT_STR_CONTAINS(text, "# TYPE kudu_test_hist summary\n");
+  ASSERT_STR_CONTAINS(
+      text,
+      "kudu_test_hist{entity_type=\"test_entity\",entity_id=\"my-test\","
+      "quantile=\"0.99\"} 4\n");
+  ASSERT_STR_CONTAINS(
+      text,
+      "kudu_test_hist_sum{entity_type=\"test_entity\",entity_id=\"my-test\"} "
+      "6\n");
+  ASSERT_STR_CONTAINS(
+      text,
+      "kudu_test_hist_count{entity_type=\"test_entity\",entity_id=\"my-test\"}"
+      " 2\n");
+
+  MetricPrometheusOptions opts;
+  opts.include_metadata = false;
+  std::ostringstream samples_only;
+  ASSERT_OK(registry_.WriteAsPrometheus(&samples_only, opts));
+  ASSERT_STR_NOT_CONTAINS(samples_only.str(), "#");
+}
+
+TEST_F(MetricsTest, TestPrometheusOnlyChanged) {
+  scoped_refptr<Counter> counter = METRIC_test_counter.Instantiate(entity_);
+  scoped_refptr<AtomicGauge<uint64_t>> gauge =
+      METRIC_test_gauge.Instantiate(entity_, 0);
+  auto GetText = [&](int64_t since_epoch) {
+    MetricPrometheusOptions opts;
+    opts.only_modified_in_or_after_epoch = since_epoch;
+    std::ostringstream out;
+    CHECK_OK(registry_.WriteAsPrometheus(&out, opts));
+    return out.str();
+  };
+
+  Metric::IncrementEpoch();
+  int64_t epoch = Metric::current_epoch();
+  ASSERT_EQ("", GetText(epoch));
+  counter->Increment();
+  string text = GetText(epoch);
+  ASSERT_STR_CONTAINS(text, "kudu_test_counter{");
+  ASSERT_STR_NOT_CONTAINS(text, "kudu_test_gauge{");
+  // Setting a gauge counts as modifying it.
+  gauge->set_value(10);
+  ASSERT_STR_CONTAINS(GetText(epoch), "kudu_test_gauge{");
+}
+
+TEST_F(MetricsTest, TestCollectMetricValues) {
+  scoped_refptr<Counter> counter = METRIC_test_counter.Instantiate(entity_);
+  scoped_refptr<Histogram> hist = METRIC_test_hist.Instantiate(entity_);
+  Metric::IncrementEpoch();
+  int64_t epoch = Metric::current_epoch();
+  vector<MetricRegistry::EntityMetric> metrics;
+  registry_.CollectMetrics(epoch, &metrics);
+  ASSERT_TRUE(metrics.empty());
+
+  counter->IncrementBy(3);
+  hist->Increment(2);
+  hist->Increment(4);
+  registry_.CollectMetrics(epoch, &metrics);
+  ASSERT_EQ(2, metrics.size());
+  vector<MetricValue> values;
+  for (const auto& m : metrics) {
+    ASSERT_EQ(entity_.get(), m.entity.get());
+    m.metric->AppendValues(&values);
+  }
+  ASSERT_EQ(5, values.size());
+  std::map<string, int64_t> by_field;
+  for (const MetricValue& v : values) {
+    ASSERT_FALSE(v.is_double);
+    by_field[v.field] = v.int_value;
+  }
+  ASSERT_EQ(3, by_field[""]);
+  ASSERT_EQ(2, by_field["total_count"]);
+  ASSERT_EQ(6, by_field["total_sum"]);
+  ASSERT_EQ(4, by_field["max"]);
+}
+
+// Compares the cost of exporting 10k metrics as JSON, in the Prometheus
+// format, and in the Prometheus format with only 1% of them changed.
+TEST_F(MetricsTest, BenchmarkExport) {
+  const int kNumEntities = 2500;
+  const int kIterations = AllowSlowTests() ? 20 : 2;
+  vector<scoped_refptr<MetricEntity>> entities;
+  vector<scoped_refptr<Counter>> counters;
+  vector<scoped_refptr<AtomicGauge<uint64_t>>> gauges;
+  vector<scoped_refptr<Histogram>> hists;
+  vector<scoped_refptr<AtomicGauge<uint64_t>>> other_gauges;
+  for (int i = 0; i < kNumEntities; i++) {
+    scoped_refptr<MetricEntity> e = METRIC_ENTITY_test_entity.Instantiate(
+        &registry_, strings::Substitute("entity-$0", i));
+    counters.push_back(METRIC_test_counter.Instantiate(e));
+    gauges.push_back(METRIC_test_gauge.Instantiate(e, i));
+    hists.push_back(METRIC_test_hist.Instantiate(e));
+    hists.back()->Increment(i);
+    other_gauges.push_back(METRIC_counter_as_gauge.Instantiate(e, i));
+    entities.push_back(std::move(e));
+  }
+
+  int64_t bytes = 0;
+  Stopwatch sw;
+  sw.start();
+  for (int i = 0; i < kIterations; i++) {
+    std::ostringstream out;
+    JsonWriter writer(&out, JsonWriter::COMPACT);
+    ASSERT_OK(registry_.WriteAsJson(&writer, {"*"}, MetricJsonOptions()));
+    bytes = out.str().size();
+  }
+  sw.stop();
+  LOG(INFO) << "JSON: " << sw.elapsed().wall_millis() / kIterations
+            << " ms and " << bytes << " bytes per export";
+
+  sw.start();
+  for (int i = 0; i < kIterations; i++) {
+    std::ostringstream out;
+    ASSERT_OK(registry_.WriteAsPrometheus(&out, MetricPrometheusOptions()));
+    bytes = out.str().size();
+  }
+  sw.stop();
+  LOG(INFO) << "Prometheus: " << sw.elapsed().wall_millis() / kIterations
+            << " ms and " << bytes << " bytes per export";
+
+  sw.start();
+  for (int i = 0; i < kIterations; i++) {
+    Metric::IncrementEpoch();
+    int64_t epoch = Metric::current_epoch();
+    for (int j = 0; j < kNumEntities; j += 100) {
+      counters[j]->Increment();
+    }
+    MetricPrometheusOptions opts;
+    opts.only_modified_in_or_after_epoch = epoch;
+    std::ostringstream out;
+    ASSERT_OK(registry_.WriteAsPrometheus(&out, opts));
+    bytes = out.str().size();
+  }
+  sw.stop();
+  LOG(INFO) << "Prometheus, 1% changed: "
+            << sw.elapsed().wall_millis() / kIterations << " ms and " << bytes
+            << " bytes per export";
+}
+
 } // namespace kudu
@@ -16,6 +16,9 @@
 // under the License.
 #include "kudu/util/metrics.h"
 
+#include <algorithm>
+#include <cctype>
+#include <cstring>
 #include <iostream>
 #include <map>
 #include <utility>
@@ -40,6 +43,15 @@ DEFINE_int32(
 TAG_FLAG(metrics_retirement_age_ms, runtime);
 TAG_FLAG(metrics_retirement_age_ms, advanced);
 
+DEFINE_int32(
+    metrics_histogram_shards,
+    8,
+    "Number of per-CPU shards of the histograms that many threads update at "
+    "the same time, e.g. RPC handler latencies. More shards mean less "
+    "contention between cores, at the cost of the memory of one histogram "
+    "per shard. Capped at the number of CPUs. (Advanced option)");
+TAG_FLAG(metrics_histogram_shards, advanced);
+
 // Process/server-wide metrics should go into the 'server' entity.
 // More complex applications will define other entities.
 METRIC_DEFINE_entity(server);
@@ -207,6 +219,74 @@ bool MatchMetricInList(
   return false;
 }
 
+// Prefixes the names of the metrics in the Prometheus format, as a namespace.
+const char* const kPrometheusPrefix = "kudu_";
+
+// Appends the label 'key'="'value'" to the comma-separated 'labels'. Any
+// character not allowed in a label name is replaced with '_'.
+void AppendPrometheusLabel(
+    const string& key,
+    const string& value,
+    string* labels) {
+  if (!labels->empty()) {
+    labels->push_back(',');
+  }
+  for (char c : key) {
+    labels->push_back(isalnum(static_cast<unsigned char>(c)) ? c : '_');
+  }
+  labels->append("=\"");
+  for (char c : value) {
+    switch (c) {
+      case '\\':
+        labels->append("\\\\");
+        break;
+      case '"':
+        labels->append("\\\"");
+        break;
+      case '\n':
+        labels->append("\\n");
+        break;
+      default:
+        labels->push_back(c);
+    }
+  }
+  labels->push_back('"');
+}
+
+// Writes the '# HELP' and '# TYPE' lines of 'prototype'.
+void WritePrometheusMetadata(
+    const MetricPrototype* prototype,
+    const string& name,
+    std::ostream* out) {
+  *out << "# HELP " << name << ' ';
+  for (const char* p = prototype->description(); *p != '\0'; p++) {
+    switch (*p) {
+      case '\\':
+        *out << "\\\\";
+        break;
+      case '\n':
+        *out << "\\n";
+        break;
+      default:
+        *out << *p;
+    }
+  }
+  *out << '\n';
+  *out << "# TYPE " << name << ' ';
+  switch (prototype->type()) {
+    case MetricType::kGauge:
+      *out << "gauge";
+      break;
+    case MetricType::kCounter:
+      *out << "counter";
+      break;
+    case MetricType::kHistogram:
+      *out << "summary";
+      break;
+  }
+  *out << '\n';
+}
+
 } // anonymous namespace
 
 Status MetricEntity::WriteAsJson(
@@ -280,6 +360,43 @@ Status MetricEntity::WriteAsJson(
   return Status::OK();
 }
 
+void MetricEntity::CollectForPrometheus(
+    const MetricPrometheusOptions& opts,
+    string* labels,
+    vector<scoped_refptr<Metric>>* metrics) const {
+  labels->clear();
+  AppendPrometheusLabel("entity_type", prototype_->name(), labels);
+  AppendPrometheusLabel("entity_id", id_, labels);
+
+  if (opts.include_entity_attributes) {
+    std::lock_guard<simple_spinlock> l(lock_);
+    for (const AttributeMap::value_type& val : attributes_) {
+      AppendPrometheusLabel(val.first, val.second, labels);
+    }
+  }
+  CollectMetrics(
+      opts.only_modified_in_or_after_epoch,
+      opts.include_untouched_metrics,
+      metrics);
+}
+
+void MetricEntity::CollectMetrics(
+    int64_t epoch,
+    bool include_untouched,
+    vector<scoped_refptr<Metric>>* metrics) const {
+  std::lock_guard<simple_spinlock> l(lock_);
+  for (const MetricMap::value_type& val : metric_map_) {
+    const scoped_refptr<Metric>& m = val.second;
+    if (!m->ModifiedInOrAfterEpoch(epoch)) {
+      continue;
+    }
+    if (!include_untouched && m->IsUntouched()) {
+      continue;
+    }
+    metrics->push_back(m);
+  }
+}
+
 void MetricEntity::RetireOldMetrics() {
   MonoTime now(MonoTime::Now());
 
@@ -378,6 +495,87 @@ Status MetricRegistry::WriteAsJson(
   return Status::OK();
 }
 
+void MetricRegistry::CollectMetrics(
+    int64_t epoch,
+    vector<EntityMetric>* metrics) const {
+  vector<scoped_refptr<MetricEntity>> entities;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    entities.reserve(entities_.size());
+    for (const auto& e : entities_) {
+      entities.push_back(e.second);
+    }
+  }
+  vector<scoped_refptr<Metric>> entity_metrics;
+  for (const scoped_refptr<MetricEntity>& entity : entities) {
+    entity_metrics.clear();
+    entity->CollectMetrics(epoch, /*include_untouched=*/false, &entity_metrics);
+    for (scoped_refptr<Metric>& m : entity_metrics) {
+      metrics->push_back({entity, std::move(m)});
+    }
+  }
+}
+
+Status MetricRegistry::WriteAsPrometheus(
+    std::ostream* out,
+    const MetricPrometheusOptions& opts) const {
+  vector<scoped_refptr<MetricEntity>> entities;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    entities.reserve(entities_.size());
+    for (const auto& e : entities_) {
+      entities.push_back(e.second);
+    }
+  }
+
+  // Snapshot the selected metrics of every entity, then group them by name:
+  // the samples of a metric must all follow its '# TYPE' line.
+  struct Sample {
+    const Metric* metric;
+    size_t entity_idx;
+  };
+  vector<string> labels(entities.size());
+  vector<scoped_refptr<Metric>> metrics;
+  vector<Sample> samples;
+  for (size_t i = 0; i < entities.size(); i++) {
+    size_t first = metrics.size();
+    entities[i]->CollectForPrometheus(opts, &labels[i], &metrics);
+    for (size_t j = first; j < metrics.size(); j++) {
+      samples.push_back({metrics[j].get(), i});
+    }
+  }
+  std::sort(
+      samples.begin(),
+      samples.end(),
+      [](const Sample& a, const Sample& b) {
+        int cmp = strcmp(
+            a.metric->prototype()->name(), b.metric->prototype()->name());
+        return cmp < 0 || (cmp == 0 && a.entity_idx < b.entity_idx);
+      });
+
+  const MetricPrototype* last_prototype = nullptr;
+  string name;
+  for (const Sample& sample : samples) {
+    const MetricPrototype* prototype = sample.metric->prototype();
+    if (prototype != last_prototype) {
+      name = kPrometheusPrefix;
+      name.append(prototype->name());
+      if (opts.include_metadata) {
+        WritePrometheusMetadata(prototype, name, out);
+      }
+      last_prototype = prototype;
+    }
+    sample.metric->WriteAsPrometheus(out, name, labels[sample.entity_idx]);
+  }
+
+  // As in WriteAsJson(), deref what we just wrote before the retirement scan.
+  samples.clear();
+  metrics.clear();
+  entities.clear();
+  const_cast<MetricRegistry*>(this)->RetireOldMetrics();
+  return Status::OK();
+}
+
 void MetricRegistry::RetireOldMetrics() {
   std::lock_guard<simple_spinlock> l(lock_);
   for (auto it = entities_.begin(); it != entities_.end();) {
@@ -575,6 +773,15 @@ void StringGauge::set_value(const std::string& value) {
   value_ = value;
 }
 
+void Gauge::WriteAsPrometheus(
+    std::ostream* out,
+    const string& name,
+    const string& labels) const {
+  *out << name << '{' << labels << "} ";
+  WriteValue(out);
+  *out << '\n';
+}
+
 void StringGauge::WriteValue(JsonWriter* writer) const {
   writer->String(value());
 }
@@ -618,6 +825,13 @@ Status Counter::WriteAsJson(JsonWriter* writer, const MetricJsonOptions& opts)
   return Status::OK();
 }
 
+void Counter::WriteAsPrometheus(
+    std::ostream* out,
+    const string& name,
+    const string& labels) const {
+  *out << name << '{' << labels << "} " << value() << '\n';
+}
+
 /////////////////////////////////////////////////
 // HistogramPrototype
 /////////////////////////////////////////////////
@@ -625,10 +839,12 @@ Status Counter::WriteAsJson(JsonWriter* writer, const MetricJsonOptions& opts)
 HistogramPrototype::HistogramPrototype(
     const MetricPrototype::CtorArgs& args,
     uint64_t max_trackable_value,
-    int num_sig_digits)
+    int num_sig_digits,
+    bool sharded)
     : MetricPrototype(args),
       max_trackable_value_(max_trackable_value),
-      num_sig_digits_(num_sig_digits) {
+      num_sig_digits_(num_sig_digits),
+      sharded_(sharded) {
   // Better to crash at definition time that at instantiation time.
   CHECK(HdrHistogram::IsValidHighestTrackableValue(max_trackable_value))
       << Substitute(
@@ -653,30 +869,184 @@ scoped_refptr<Histogram> HistogramPrototype::Instantiate(
 
 Histogram::Histogram(const HistogramPrototype* proto)
     : Metric(proto),
-      histogram_(new HdrHistogram(
-          proto->max_trackable_value(),
-          proto->num_sig_digits())) {}
+      histogram_(
+          proto->sharded() ? nullptr
+                           : new HdrHistogram(
+                                 proto->max_trackable_value(),
+                                 proto->num_sig_digits())),
+      sharded_histogram_(
+          proto->sharded() ? new ShardedHdrHistogram(
+                                 proto->max_trackable_value(),
+                                 proto->num_sig_digits(),
+                                 FLAGS_metrics_histogram_shards)
+                           : nullptr) {}
 
 void Histogram::Increment(int64_t value) {
   UpdateModificationEpoch();
-  histogram_->Increment(value);
+  if (sharded_histogram_) {
+    sharded_histogram_->Increment(value);
+  } else {
+    histogram_->Increment(value);
+  }
 }
 
 void Histogram::IncrementBy(int64_t value, int64_t amount) {
   UpdateModificationEpoch();
-  histogram_->IncrementBy(value, amount);
+  if (sharded_histogram_) {
+    sharded_histogram_->IncrementBy(value, amount);
+  } else {
+    histogram_->IncrementBy(value, amount);
+  }
+}
+
+std::unique_ptr<HdrHistogram> Histogram::Snapshot() const {
+  if (!sharded_histogram_) {
+    return std::unique_ptr<HdrHistogram>(new HdrHistogram(*histogram_));
+  }
+  std::unique_ptr<HdrHistogram> snapshot(new HdrHistogram(
+      sharded_histogram_->highest_trackable_value(),
+      sharded_histogram_->num_significant_digits()));
+  sharded_histogram_->MergeTo(snapshot.get());
+  return snapshot;
 }
 
 Status Histogram::WriteAsJson(JsonWriter* writer, const MetricJsonOptions& opts)
     const {
-  HistogramSnapshotPB snapshot;
-  RETURN_NOT_OK(GetHistogramSnapshotPB(&snapshot, opts));
-  writer->Protobuf(snapshot);
-  if (opts.refresh_histogram_metrics)
-    histogram_->ResetHistogram();
+  // Written directly rather than through a HistogramSnapshotPB and
+  // JsonWriter::Protobuf(), whose reflection dominates the cost of rendering
+  // /metrics. The fields are in the order Protobuf() would write them, i.e.
+  // that of their HistogramSnapshotPB field numbers.
+  const auto* proto = down_cast<const HistogramPrototype*>(prototype_);
+  writer->StartObject();
+  if (opts.include_schema_info) {
+    writer->String("type");
+    writer->String(MetricType::Name(prototype_->type()));
+  }
+  writer->String("name");
+  writer->String(prototype_->name());
+  if (opts.include_schema_info) {
+    writer->String("description");
+    writer->String(prototype_->description());
+    writer->String("unit");
+    writer->String(MetricUnit::Name(prototype_->unit()));
+    writer->String("max_trackable_value");
+    writer->Uint64(proto->max_trackable_value());
+    writer->String("num_significant_digits");
+    writer->Int(proto->num_sig_digits());
+  }
+
+  // Same fast path for empty histograms as GetHistogramSnapshotPB().
+  std::unique_ptr<HdrHistogram> snapshot;
+  if (TotalCount() != 0) {
+    snapshot = Snapshot();
+  }
+  writer->String("total_count");
+  writer->Uint64(snapshot ? snapshot->TotalCount() : 0);
+  writer->String("min");
+  writer->Uint64(snapshot ? snapshot->MinValue() : 0);
+  writer->String("mean");
+  writer->Double(snapshot ? snapshot->MeanValue() : 0);
+  static const struct {
+    const char* field;
+    double percentile;
+  } kPercentiles[] = {
+      {"percentile_75", 75},
+      {"percentile_95", 95},
+      {"percentile_99", 99},
+      {"percentile_99_9", 99.9},
+      {"percentile_99_99", 99.99},
+  };
+  for (const auto& p : kPercentiles) {
+    writer->String(p.field);
+    writer->Uint64(snapshot ? snapshot->ValueAtPercentile(p.percentile) : 0);
+  }
+  writer->String("max");
+  writer->Uint64(snapshot ? snapshot->MaxValue() : 0);
+  if (snapshot && opts.include_raw_histograms) {
+    vector<uint64_t> values;
+    vector<uint64_t> counts;
+    RecordedValuesIterator iter(snapshot.get());
+    while (iter.HasNext()) {
+      HistogramIterationValue value;
+      RETURN_NOT_OK(iter.Next(&value));
+      values.push_back(value.value_iterated_to);
+      counts.push_back(value.count_at_value_iterated_to);
+    }
+    if (!values.empty()) {
+      writer->String("values");
+      writer->StartArray();
+      for (uint64_t v : values) {
+        writer->Uint64(v);
+      }
+      writer->EndArray();
+      writer->String("counts");
+      writer->StartArray();
+      for (uint64_t c : counts) {
+        writer->Uint64(c);
+      }
+      writer->EndArray();
+    }
+  }
+  writer->String("total_sum");
+  writer->Uint64(snapshot ? snapshot->TotalSum() : 0);
+  if (opts.include_schema_info) {
+    writer->String("label");
+    writer->String(prototype_->label());
+  }
+  writer->EndObject();
+
+  if (opts.refresh_histogram_metrics) {
+    if (sharded_histogram_) {
+      sharded_histogram_->ResetHistogram();
+    } else {
+      histogram_->ResetHistogram();
+    }
+  }
   return Status::OK();
 }
 
+void Histogram::WriteAsPrometheus(
+    std::ostream* out,
+    const string& name,
+    const string& labels) const {
+  static const struct {
+    const char* label;
+    double percentile;
+  } kQuantiles[] = {
+      {"0.5", 50},
+      {"0.75", 75},
+      {"0.95", 95},
+      {"0.99", 99},
+      {"0.999", 99.9},
+  };
+  std::unique_ptr<HdrHistogram> snapshot_ptr = Snapshot();
+  const HdrHistogram& snapshot = *snapshot_ptr;
+  bool empty = snapshot.TotalCount() == 0;
+  for (const auto& q : kQuantiles) {
+    *out << name << '{' << labels << ",quantile=\"" << q.label << "\"} "
+         << (empty ? 0 : snapshot.ValueAtPercentile(q.percentile)) << '\n';
+  }
+  *out << name << "_sum{" << labels << "} " << snapshot.TotalSum() << '\n';
+  *out << name << "_count{" << labels << "} " << snapshot.TotalCount()
+       << '\n';
+}
+
+void Histogram::AppendValues(vector<MetricValue>* values) const {
+  // Same fast path for empty histograms as WriteAsJson().
+  std::unique_ptr<HdrHistogram> snapshot;
+  if (TotalCount() != 0) {
+    snapshot = Snapshot();
+  }
+  values->push_back(MetricValue::Int(
+      "total_count", snapshot ? snapshot->TotalCount() : 0));
+  values->push_back(
+      MetricValue::Int("total_sum", snapshot ? snapshot->TotalSum() : 0));
+  values->push_back(MetricValue::Int(
+      "percentile_99", snapshot ? snapshot->ValueAtPercentile(99) : 0));
+  values->push_back(
+      MetricValue::Int("max", snapshot ? snapshot->MaxValue() : 0));
+}
+
 Status Histogram::GetHistogramSnapshotPB(
     HistogramSnapshotPB* snapshot_pb,
     const MetricJsonOptions& opts) const {
@@ -686,14 +1056,14 @@ Status Histogram::GetHistogramSnapshotPB(
     snapshot_pb->set_label(prototype_->label());
     snapshot_pb->set_unit(MetricUnit::Name(prototype_->unit()));
     snapshot_pb->set_description(prototype_->description());
-    snapshot_pb->set_max_trackable_value(histogram_->highest_trackable_value());
-    snapshot_pb->set_num_significant_digits(
-        histogram_->num_significant_digits());
+    const auto* proto = down_cast<const HistogramPrototype*>(prototype_);
+    snapshot_pb->set_max_trackable_value(proto->max_trackable_value());
+    snapshot_pb->set_num_significant_digits(proto->num_sig_digits());
   }
   // Fast-path for a reasonably common case of an empty histogram. This occurs
   // when a histogram is tracking some information about a feature not in
   // use, for example.
-  if (histogram_->TotalCount() == 0) {
+  if (TotalCount() == 0) {
     snapshot_pb->set_total_count(0);
     snapshot_pb->set_total_sum(0);
     snapshot_pb->set_min(0);
@@ -705,7 +1075,8 @@ Status Histogram::GetHistogramSnapshotPB(
     snapshot_pb->set_percentile_99_99(0);
     snapshot_pb->set_max(0);
   } else {
-    HdrHistogram snapshot(*histogram_);
+    std::unique_ptr<HdrHistogram> snapshot_ptr = Snapshot();
+    HdrHistogram& snapshot = *snapshot_ptr;
     snapshot_pb->set_total_count(snapshot.TotalCount());
     snapshot_pb->set_total_sum(snapshot.TotalSum());
     snapshot_pb->set_min(snapshot.MinValue());
@@ -731,22 +1102,25 @@ Status Histogram::GetHistogramSnapshotPB(
 }
 
 uint64_t Histogram::CountInBucketForValueForTests(uint64_t value) const {
-  return histogram_->CountInBucketForValue(value);
+  return Snapshot()->CountInBucketForValue(value);
 }
 
 uint64_t Histogram::TotalCount() const {
+  if (sharded_histogram_) {
+    return sharded_histogram_->TotalCount();
+  }
   return histogram_->TotalCount();
 }
 
 uint64_t Histogram::MinValueForTests() const {
-  return histogram_->MinValue();
+  return Snapshot()->MinValue();
 }
 
 uint64_t Histogram::MaxValueForTests() const {
-  return histogram_->MaxValue();
+  return Snapshot()->MaxValue();
 }
 double Histogram::MeanValueForTests() const {
-  return histogram_->MeanValue();
+  return Snapshot()->MeanValue();
 }
 
 ScopedLatencyMetric::ScopedLatencyMetric(Histogram* latency_hist)
@@ -245,12 +245,16 @@
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <ostream>
 #include <limits>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
+#include <glog/logging.h>
 #include <gtest/gtest_prod.h>
 
 #include "kudu/gutil/bind.h"
@@ -318,6 +322,16 @@
       max_val,                                                              \
       num_sig_digits)
 
+// Like METRIC_DEFINE_histogram, for a histogram that many threads update at
+// the same time. See ShardedHdrHistogram.
+#define METRIC_DEFINE_sharded_histogram(                                    \
+    entity, name, label, unit, desc, max_val, num_sig_digits)               \
+  ::kudu::HistogramPrototype METRIC_##name(                                 \
+      ::kudu::MetricPrototype::CtorArgs(#entity, #name, label, unit, desc), \
+      max_val,                                                              \
+      num_sig_digits,                                                       \
+      true)
+
 // The following macros act as forward declarations for entity types and metric
 // prototypes.
 #define METRIC_DECLARE_entity(name) \
@@ -473,6 +487,39 @@ struct MetricJsonOptions {
   bool refresh_histogram_metrics = false;
 };
 
+struct MetricPrometheusOptions {
+  // As in MetricJsonOptions. Function gauges count as always modified.
+  int64_t only_modified_in_or_after_epoch = 0;
+
+  // As in MetricJsonOptions.
+  bool include_untouched_metrics = true;
+
+  // Whether to add the attributes of each entity as labels of its metrics,
+  // besides 'entity_type' and 'entity_id'.
+  bool include_entity_attributes = false;
+
+  // Whether to write the '# HELP' and '# TYPE' lines of each metric. Without
+  // them, every line is a self-contained sample, which can be sent on its
+  // own.
+  bool include_metadata = true;
+};
+
+// A numeric value read from a metric, see Metric::AppendValues().
+struct MetricValue {
+  // Tells apart the values of a histogram, empty for counters and gauges.
+  const char* field;
+  bool is_double;
+  int64_t int_value;
+  double double_value;
+
+  static MetricValue Int(const char* field, int64_t v) {
+    return MetricValue{field, false, v, 0};
+  }
+  static MetricValue Double(const char* field, double v) {
+    return MetricValue{field, true, 0, v};
+  }
+};
+
 class MetricEntityPrototype {
  public:
   explicit MetricEntityPrototype(const char* name);
@@ -538,6 +585,25 @@ class MetricEntity : public RefCountedThreadSafe<MetricEntity> {
       const std::vector<std::string>& requested_metrics,
       const MetricJsonOptions& opts) const;
 
+  // Snapshots the metrics of this entity to be written by
+  // MetricRegistry::WriteAsPrometheus(), with the labels they're written with.
+  // Only the metrics selected by 'opts' are appended to 'metrics'.
+  void CollectForPrometheus(
+      const MetricPrometheusOptions& opts,
+      std::string* labels,
+      std::vector<scoped_refptr<Metric>>* metrics) const;
+
+  // Appends to 'metrics' the metrics of this entity modified in or after
+  // 'epoch', leaving out the untouched ones unless 'include_untouched'.
+  void CollectMetrics(
+      int64_t epoch,
+      bool include_untouched,
+      std::vector<scoped_refptr<Metric>>* metrics) const;
+
+  const MetricEntityPrototype* prototype() const {
+    return prototype_;
+  }
+
   const MetricMap& UnsafeMetricsMapForTests() const {
     return metric_map_;
   }
@@ -621,6 +687,20 @@ class Metric : public RefCountedThreadSafe<Metric> {
   virtual Status WriteAsJson(JsonWriter* writer, const MetricJsonOptions& opts)
       const = 0;
 
+  // Writes the samples of this metric in the Prometheus text format, each
+  // named 'name' plus a suffix if the type requires one, with the
+  // comma-separated 'labels'. Writes nothing for non-numeric metrics.
+  virtual void WriteAsPrometheus(
+      std::ostream* out,
+      const std::string& name,
+      const std::string& labels) const = 0;
+
+  // Appends the numeric values of this metric to 'values', for consumers
+  // which encode them on their own, like the diagnostics log: a single value
+  // with an empty 'field' for counters and gauges, a few for histograms, and
+  // none for non-numeric metrics.
+  virtual void AppendValues(std::vector<MetricValue>* /*values*/) const {}
+
   const MetricPrototype* prototype() const {
     return prototype_;
   }
@@ -714,6 +794,30 @@ class MetricRegistry {
       const std::vector<std::string>& requested_metrics,
       const MetricJsonOptions& opts) const;
 
+  // Writes the metrics in this registry to 'out' in the Prometheus text
+  // exposition format, the metrics of all the entities with the same name
+  // being grouped together.
+  //
+  // The registry and entity locks are only held to snapshot which metrics are
+  // written: the values are read and rendered without them. With
+  // 'opts.only_modified_in_or_after_epoch', only the metrics changed since
+  // are even snapshotted, so an incremental export costs in proportion to what
+  // changed rather than to the number of metrics.
+  Status WriteAsPrometheus(
+      std::ostream* out,
+      const MetricPrometheusOptions& opts) const;
+
+  // A metric snapshotted by CollectMetrics(), with its entity.
+  struct EntityMetric {
+    scoped_refptr<MetricEntity> entity;
+    scoped_refptr<Metric> metric;
+  };
+
+  // Snapshots the touched metrics modified in or after 'epoch', for callers
+  // reading their values with Metric::AppendValues(). As in
+  // WriteAsPrometheus(), the locks are only held while snapshotting.
+  void CollectMetrics(int64_t epoch, std::vector<EntityMetric>* metrics) const;
+
   // For each registered entity, retires orphaned metrics. If an entity has no
   // more metrics and there are no external references, entities are removed as
   // well.
@@ -881,10 +985,17 @@ class Gauge : public Metric {
   virtual ~Gauge() {}
   virtual Status WriteAsJson(JsonWriter* w, const MetricJsonOptions& opts)
       const override;
+  virtual void WriteAsPrometheus(
+      std::ostream* out,
+      const std::string& name,
+      const std::string& labels) const override;
 
  protected:
   virtual void WriteValue(JsonWriter* writer) const = 0;
 
+  // Writes the value of the gauge to 'out', in the Prometheus format.
+  virtual void WriteValue(std::ostream* out) const = 0;
+
  private:
   DISALLOW_COPY_AND_ASSIGN(Gauge);
 };
@@ -901,8 +1012,15 @@ class StringGauge : public Gauge {
     return false;
   }
 
+  // Prometheus has no string values: not written.
+  virtual void WriteAsPrometheus(
+      std::ostream* /*out*/,
+      const std::string& /*name*/,
+      const std::string& /*labels*/) const override {}
+
  protected:
   virtual void WriteValue(JsonWriter* writer) const override;
+  virtual void WriteValue(std::ostream* /*out*/) const override {}
 
  private:
   std::string value_;
@@ -920,6 +1038,7 @@ class AtomicGauge : public Gauge {
     return static_cast<T>(value_.Load(kMemOrderRelease));
   }
   virtual void set_value(const T& value) {
+    UpdateModificationEpoch();
     value_.Store(static_cast<int64_t>(value), kMemOrderNoBarrier);
   }
   void Increment() {
@@ -939,11 +1058,17 @@ class AtomicGauge : public Gauge {
   virtual bool IsUntouched() const override {
     return false;
   }
+  virtual void AppendValues(std::vector<MetricValue>* values) const override {
+    values->push_back(MetricValue::Int("", value_.Load(kMemOrderRelease)));
+  }
 
  protected:
   virtual void WriteValue(JsonWriter* writer) const override {
     writer->Value(value());
   }
+  virtual void WriteValue(std::ostream* out) const override {
+    *out << value();
+  }
   AtomicInt<int64_t> value_;
 
  private:
@@ -1020,6 +1145,9 @@ class FunctionGauge : public Gauge {
   virtual void WriteValue(JsonWriter* writer) const override {
     writer->Value(value());
   }
+  virtual void WriteValue(std::ostream* out) const override {
+    *out << value();
+  }
 
   // Reset this FunctionGauge to return a specific value.
   // This should be used during destruction. If you want a settable
@@ -1061,6 +1189,15 @@ class FunctionGauge : public Gauge {
     return false;
   }
 
+  virtual void AppendValues(std::vector<MetricValue>* values) const override {
+    if constexpr (std::is_floating_point<T>::value) {
+      values->push_back(MetricValue::Double("", value()));
+    } else if constexpr (std::is_integral<T>::value) {
+      values->push_back(
+          MetricValue::Int("", static_cast<int64_t>(value())));
+    }
+  }
+
  private:
   friend class MetricEntity;
 
@@ -1109,11 +1246,19 @@ class Counter : public Metric {
   void IncrementBy(int64_t amount);
   virtual Status WriteAsJson(JsonWriter* w, const MetricJsonOptions& opts)
       const override;
+  virtual void WriteAsPrometheus(
+      std::ostream* out,
+      const std::string& name,
+      const std::string& labels) const override;
 
   virtual bool IsUntouched() const override {
     return value() == 0;
   }
 
+  virtual void AppendValues(std::vector<MetricValue>* values) const override {
+    values->push_back(MetricValue::Int("", value()));
+  }
+
  private:
   FRIEND_TEST(MetricsTest, SimpleCounterTest);
   FRIEND_TEST(MultiThreadedMetricsTest, CounterIncrementTest);
@@ -1130,7 +1275,8 @@ class HistogramPrototype : public MetricPrototype {
   HistogramPrototype(
       const MetricPrototype::CtorArgs& args,
       uint64_t max_trackable_value,
-      int num_sig_digits);
+      int num_sig_digits,
+      bool sharded = false);
   scoped_refptr<Histogram> Instantiate(
       const scoped_refptr<MetricEntity>& entity);
 
@@ -1140,6 +1286,11 @@ class HistogramPrototype : public MetricPrototype {
   int num_sig_digits() const {
     return num_sig_digits_;
   }
+  // Whether instances are backed by a ShardedHdrHistogram, with
+  // --metrics_histogram_shards shards.
+  bool sharded() const {
+    return sharded_;
+  }
   virtual MetricType::Type type() const override {
     return MetricType::kHistogram;
   }
@@ -1147,6 +1298,7 @@ class HistogramPrototype : public MetricPrototype {
  private:
   const uint64_t max_trackable_value_;
   const int num_sig_digits_;
+  const bool sharded_;
   DISALLOW_COPY_AND_ASSIGN(HistogramPrototype);
 };
 
@@ -1167,6 +1319,13 @@ class Histogram : public Metric {
   virtual Status WriteAsJson(JsonWriter* w, const MetricJsonOptions& opts)
       const override;
 
+  // Written as a summary: the p50, p75, p95, p99 and p99.9 quantiles, with
+  // the '_sum' and '_count'.
+  virtual void WriteAsPrometheus(
+      std::ostream* out,
+      const std::string& name,
+      const std::string& labels) const override;
+
   // Returns a snapshot of this histogram including the bucketed values and
   // counts.
   Status GetHistogramSnapshotPB(
@@ -1174,11 +1333,17 @@ class Histogram : public Metric {
       const MetricJsonOptions& opts) const;
 
   // Returns a pointer to the underlying histogram. The implementation of
-  // HdrHistogram is thread safe.
+  // HdrHistogram is thread safe. Not available for sharded histograms, use
+  // Snapshot() instead.
   const HdrHistogram* histogram() const {
+    DCHECK(histogram_) << "sharded histogram " << prototype_->name();
     return histogram_.get();
   }
 
+  // Returns a (non-consistent) copy of the recorded values, merging the shards
+  // of a sharded histogram.
+  std::unique_ptr<HdrHistogram> Snapshot() const;
+
   uint64_t CountInBucketForValueForTests(uint64_t value) const;
   uint64_t MinValueForTests() const;
   uint64_t MaxValueForTests() const;
@@ -1188,12 +1353,17 @@ class Histogram : public Metric {
     return TotalCount() == 0;
   }
 
+  // Appends the 'total_count', 'total_sum', 'percentile_99' and 'max'.
+  virtual void AppendValues(std::vector<MetricValue>* values) const override;
+
  private:
   FRIEND_TEST(MetricsTest, SimpleHistogramTest);
   friend class MetricEntity;
   explicit Histogram(const HistogramPrototype* proto);
 
+  // Exactly one of these is set, depending on HistogramPrototype::sharded().
   const gscoped_ptr<HdrHistogram> histogram_;
+  const gscoped_ptr<ShardedHdrHistogram> sharded_histogram_;
   DISALLOW_COPY_AND_ASSIGN(Histogram);
 };
 
@@ -0,0 +1,79 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/mpsc_blocking_queue.h"
+
+#ifdef __linux__
+#include <syscall.h>
+#else
+#include <sched.h>
+#endif
+
+#include <ctime>
+
+#ifdef __linux__
+#include "kudu/gutil/linux_syscall_support.h"
+#endif
+
+namespace kudu {
+namespace mpsc_internal {
+
+void Park(std::atomic<int32_t>* word, int32_t expected, MonoTime deadline) {
+#ifdef __linux__
+  struct timespec ts;
+  struct timespec* timeout = nullptr;
+  if (deadline.Initialized()) {
+    MonoTime now = MonoTime::Now();
+    if (now >= deadline) {
+      return;
+    }
+    (deadline - now).ToTimeSpec(&ts);
+    timeout = &ts;
+  }
+  sys_futex(
+      reinterpret_cast<int32_t*>(word),
+      FUTEX_WAIT | FUTEX_PRIVATE_FLAG,
+      expected,
+      reinterpret_cast<struct kernel_timespec*>(timeout),
+      nullptr,
+      0 /* ignored */);
+#else
+  // No futex: poll, which is good enough for the platforms only used for
+  // development.
+  while (word->load() == expected &&
+         (!deadline.Initialized() || MonoTime::Now() < deadline)) {
+    sched_yield();
+  }
+#endif
+}
+
+void Unpark(std::atomic<int32_t>* word) {
+#ifdef __linux__
+  sys_futex(
+      reinterpret_cast<int32_t*>(word),
+      FUTEX_WAKE | FUTEX_PRIVATE_FLAG,
+      1, // wake the consumer
+      nullptr,
+      nullptr,
+      0 /* ignored */);
+#else
+  (void)word;
+#endif
+}
+
+} // namespace mpsc_internal
+} // namespace kudu
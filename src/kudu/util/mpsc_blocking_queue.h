@@ -0,0 +1,288 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/port.h"
+#include "kudu/util/blocking_queue.h"
+#include "kudu/util/condition_variable.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/mutex.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+namespace mpsc_internal {
+
+// Blocks the calling thread while '*word' is 'expected', until another thread
+// calls Unpark() on 'word' or 'deadline', if initialized, passes. May return
+// early for no reason, so callers re-check their condition.
+void Park(std::atomic<int32_t>* word, int32_t expected, MonoTime deadline);
+
+// Wakes the thread parked on 'word', if any.
+void Unpark(std::atomic<int32_t>* word);
+
+} // namespace mpsc_internal
+
+// A bounded queue with many producers and a single consumer, which does what
+// BlockingQueue does for the producers without taking any lock: they link
+// their element in with a single atomic exchange, and reserve its logical
+// size, see BlockingQueue's LOGICAL_SIZE, with a compare-and-swap. The
+// consumer only parks, on a futex where available, when the queue is empty,
+// and producers only wake it when it is parked. Producers only fall back to a
+// mutex and condition variable to wait for room when the queue is full.
+//
+// Elements come out in the order their producers linked them in, so puts
+// ordered by the callers, e.g. by a lock of their own, keep that order.
+//
+// BlockingDrainTo() and empty() may only be called by one thread at a time.
+template <typename T, class LOGICAL_SIZE = DefaultLogicalSize>
+class MpscBlockingQueue {
+ public:
+  explicit MpscBlockingQueue(size_t max_size)
+      : head_(new Node()),
+        tail_(head_),
+        consumer_parked_(0),
+        size_(0),
+        max_size_(max_size),
+        active_producers_(0),
+        full_waiters_(0),
+        shutdown_(false),
+        not_full_(&lock_) {}
+
+  // If the queue holds bare pointers, it must be empty on destruction, since
+  // it may have ownership of them.
+  ~MpscBlockingQueue() {
+    DCHECK(head_->next.load() == nullptr || !std::is_pointer<T>::value)
+        << "MpscBlockingQueue holds bare pointers at destruction time";
+    while (head_ != nullptr) {
+      Node* next = head_->next.load();
+      delete head_;
+      head_ = next;
+    }
+  }
+
+  // Same as BlockingQueue::Put().
+  QueueStatus Put(const T& val) {
+    ProducerScope producer(this);
+    if (PREDICT_FALSE(shutdown_.load())) {
+      return QUEUE_SHUTDOWN;
+    }
+    if (!TryReserve(LOGICAL_SIZE::logical_size(val))) {
+      return QUEUE_FULL;
+    }
+    Push(val);
+    return QUEUE_SUCCESS;
+  }
+
+  // Same as BlockingQueue::BlockingPut().
+  bool BlockingPut(const T& val) {
+    ProducerScope producer(this);
+    const size_t size = LOGICAL_SIZE::logical_size(val);
+    while (true) {
+      if (PREDICT_FALSE(shutdown_.load())) {
+        return false;
+      }
+      if (TryReserve(size)) {
+        break;
+      }
+      WaitNotFull();
+    }
+    Push(val);
+    return true;
+  }
+
+  // Same as BlockingQueue::BlockingDrainTo(). Elements which were being put
+  // when the queue was shut down are still returned.
+  Status BlockingDrainTo(std::vector<T>* out, MonoTime deadline = MonoTime()) {
+    while (true) {
+      if (DrainAvailable(out)) {
+        return Status::OK();
+      }
+      if (PREDICT_FALSE(shutdown_.load())) {
+        // Let the producers which got in before the shutdown finish.
+        while (active_producers_.load() > 0) {
+          std::this_thread::yield();
+        }
+        if (DrainAvailable(out)) {
+          return Status::OK();
+        }
+        return Status::Aborted("");
+      }
+      if (deadline.Initialized() && MonoTime::Now() >= deadline) {
+        return Status::TimedOut("");
+      }
+      // Say we are about to park before re-checking, so that a producer
+      // linking an element in from now on wakes us up.
+      consumer_parked_.store(1);
+      if (head_->next.load() == nullptr && !shutdown_.load()) {
+        mpsc_internal::Park(&consumer_parked_, 1, deadline);
+      }
+      consumer_parked_.store(0);
+    }
+  }
+
+  // Shuts the queue down as BlockingQueue::Shutdown() does.
+  void Shutdown() {
+    shutdown_.store(true);
+    {
+      MutexLock l(lock_);
+      not_full_.Broadcast();
+    }
+    WakeConsumer();
+  }
+
+  // Whether there is no element to drain. Elements which are still being put
+  // may not be seen.
+  bool empty() const {
+    return head_->next.load() == nullptr;
+  }
+
+  size_t max_size() const {
+    return max_size_;
+  }
+
+  // The total logical size of the elements in the queue.
+  size_t size() const {
+    return size_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Node {
+    Node() : value(), next(nullptr) {}
+    explicit Node(const T& v) : value(v), next(nullptr) {}
+
+    T value;
+    std::atomic<Node*> next;
+  };
+
+  // Counts a producer in for as long as it is in scope, see
+  // BlockingDrainTo().
+  class ProducerScope {
+   public:
+    explicit ProducerScope(MpscBlockingQueue* queue) : queue_(queue) {
+      queue_->active_producers_.fetch_add(1);
+    }
+    ~ProducerScope() {
+      queue_->active_producers_.fetch_sub(1);
+    }
+
+   private:
+    MpscBlockingQueue* queue_;
+    DISALLOW_COPY_AND_ASSIGN(ProducerScope);
+  };
+
+  // Reserves room for an element of logical size 'size', unless the queue is
+  // already full.
+  bool TryReserve(size_t size) {
+    size_t cur = size_.load();
+    do {
+      if (cur >= max_size_) {
+        return false;
+      }
+    } while (!size_.compare_exchange_weak(cur, cur + size));
+    return true;
+  }
+
+  void Push(const T& val) {
+    Node* node = new Node(val);
+    Node* prev = tail_.exchange(node);
+    prev->next.store(node);
+    if (consumer_parked_.load() != 0) {
+      WakeConsumer();
+    }
+  }
+
+  void WakeConsumer() {
+    if (consumer_parked_.exchange(0) != 0) {
+      mpsc_internal::Unpark(&consumer_parked_);
+    }
+  }
+
+  // Waits until the queue may have room or is shut down.
+  void WaitNotFull() {
+    MutexLock l(lock_);
+    full_waiters_.fetch_add(1);
+    while (!shutdown_.load() && size_.load() >= max_size_) {
+      not_full_.Wait();
+    }
+    full_waiters_.fetch_sub(1);
+  }
+
+  // Moves all the elements linked in so far to 'out'. Returns false if there
+  // were none.
+  bool DrainAvailable(std::vector<T>* out) {
+    size_t drained = 0;
+    bool any = false;
+    Node* next;
+    while ((next = head_->next.load()) != nullptr) {
+      out->push_back(std::move(next->value));
+      drained += LOGICAL_SIZE::logical_size(out->back());
+      delete head_;
+      head_ = next;
+      any = true;
+    }
+    if (!any) {
+      return false;
+    }
+    size_.fetch_sub(drained);
+    if (full_waiters_.load() > 0) {
+      MutexLock l(lock_);
+      not_full_.Broadcast();
+    }
+    return true;
+  }
+
+  // The consumer's end: a node whose value was already drained, followed by
+  // the nodes of the elements to drain. Only accessed by the consumer.
+  Node* head_;
+
+  // The producers' end: the node linked in last.
+  alignas(CACHELINE_SIZE) std::atomic<Node*> tail_;
+
+  // 1 while the consumer is parked or about to be.
+  alignas(CACHELINE_SIZE) std::atomic<int32_t> consumer_parked_;
+
+  alignas(CACHELINE_SIZE) std::atomic<size_t> size_;
+  const size_t max_size_;
+
+  // The number of producers in Put() or BlockingPut(), and of the ones
+  // waiting for room in WaitNotFull().
+  std::atomic<int> active_producers_;
+  std::atomic<int> full_waiters_;
+
+  std::atomic<bool> shutdown_;
+
+  // Only used by producers waiting for room.
+  Mutex lock_;
+  ConditionVariable not_full_;
+
+  DISALLOW_COPY_AND_ASSIGN(MpscBlockingQueue);
+};
+
+} // namespace kudu
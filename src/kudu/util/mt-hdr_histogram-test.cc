@@ -39,6 +39,20 @@ DEFINE_uint64(
     histogram_test_num_increments_per_thread,
     100000LU,
     "Number of times to call Increment() per thread in mt-hdr_histogram test");
+DEFINE_int32(
+    histogram_bench_num_threads,
+    32,
+    "Number of threads to spawn for the mt-hdr_histogram benchmark");
+DEFINE_uint64(
+    histogram_bench_num_increments_per_thread,
+    1000000LU,
+    "Number of times to call Increment() per thread in the mt-hdr_histogram "
+    "benchmark");
+DEFINE_int32(
+    histogram_bench_num_shards,
+    32,
+    "Number of shards of the ShardedHdrHistogram in the mt-hdr_histogram "
+    "benchmark");
 
 using std::vector;
 
@@ -131,4 +145,70 @@ TEST_F(MtHdrHistogramTest, ConcurrentCopyWhileWritingTest) {
   delete[] threads;
 }
 
+// Increment a histogram with latency-like values, spread across the buckets.
+template <class HistogramType>
+static void IncrementHistValues(HistogramType* hist, uint64_t times) {
+  for (uint64_t i = 0; i < times; i++) {
+    hist->Increment(1 + (i * 7919) % 100000);
+  }
+}
+
+template <class HistogramType>
+static MonoDelta
+RunConcurrentIncrements(HistogramType* hist, int num_threads, uint64_t times) {
+  vector<scoped_refptr<kudu::Thread>> threads(num_threads);
+  MonoTime start = MonoTime::Now();
+  for (int i = 0; i < num_threads; i++) {
+    CHECK_OK(kudu::Thread::Create(
+        "test",
+        strings::Substitute("thread-$0", i),
+        IncrementHistValues<HistogramType>,
+        hist,
+        times,
+        &threads[i]));
+  }
+  for (int i = 0; i < num_threads; i++) {
+    CHECK_OK(ThreadJoiner(threads[i].get()).Join());
+  }
+  return MonoTime::Now() - start;
+}
+
+TEST_F(MtHdrHistogramTest, ConcurrentShardedWriteTest) {
+  ShardedHdrHistogram hist(100000LU, 3, 4);
+  RunConcurrentIncrements(&hist, num_threads_, num_times_);
+  ASSERT_EQ(num_threads_ * num_times_, hist.TotalCount());
+
+  HdrHistogram merged(100000LU, 3);
+  hist.MergeTo(&merged);
+  ASSERT_EQ(num_threads_ * num_times_, merged.TotalCount());
+  ASSERT_EQ(1, merged.MinValue());
+  merged.MeanValue(); // Will crash if the merged counts are inconsistent.
+}
+
+// Compares concurrent increments of a plain and a sharded histogram from many
+// threads, e.g. from the handlers of an RPC service.
+TEST_F(MtHdrHistogramTest, BenchmarkConcurrentIncrements) {
+  const int num_threads = FLAGS_histogram_bench_num_threads;
+  const uint64_t times = FLAGS_histogram_bench_num_increments_per_thread;
+  const uint64_t total = num_threads * times;
+
+  HdrHistogram hist(100000LU, 3);
+  MonoDelta plain = RunConcurrentIncrements(&hist, num_threads, times);
+  ASSERT_EQ(total, hist.TotalCount());
+
+  ShardedHdrHistogram sharded(100000LU, 3, FLAGS_histogram_bench_num_shards);
+  MonoDelta sharded_time =
+      RunConcurrentIncrements(&sharded, num_threads, times);
+  ASSERT_EQ(total, sharded.TotalCount());
+
+  LOG(INFO) << strings::Substitute(
+      "$0 threads, $1 increments each: HdrHistogram $2 ns/increment, "
+      "ShardedHdrHistogram ($3 shards) $4 ns/increment",
+      num_threads,
+      times,
+      plain.ToNanoseconds() * num_threads / total,
+      sharded.num_shards(),
+      sharded_time.ToNanoseconds() * num_threads / total);
+}
+
 } // namespace kudu
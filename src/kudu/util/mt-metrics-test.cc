@@ -33,6 +33,7 @@
 #include "kudu/util/debug/leakcheck_disabler.h"
 #include "kudu/util/env.h"
 #include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/status.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
@@ -42,6 +43,16 @@ DEFINE_int32(
     mt_metrics_test_num_threads,
     4,
     "Number of threads to spawn in mt metrics tests");
+DEFINE_int32(
+    mt_metrics_test_max_bench_threads,
+    64,
+    "Largest number of threads used by the increment throughput benchmark. "
+    "The benchmark doubles the thread count from 1 up to this value.");
+DEFINE_int32(
+    mt_metrics_test_bench_increments,
+    100000,
+    "Number of increments each thread performs per benchmark round. "
+    "Multiplied by 10 when slow tests are enabled.");
 
 METRIC_DEFINE_entity(test_entity);
 
@@ -102,6 +113,97 @@ TEST_F(MultiThreadedMetricsTest, CounterIncrementTest) {
   ASSERT_EQ(num_threads * num_increments, counter->value());
 }
 
+METRIC_DEFINE_gauge_uint64(
+    test_entity,
+    test_gauge,
+    "Test Gauge",
+    MetricUnit::kBytes,
+    "Test gauge");
+
+METRIC_DEFINE_histogram(
+    test_entity,
+    test_hist,
+    "Test Histogram",
+    MetricUnit::kMicroseconds,
+    "Test histogram",
+    60000000LU,
+    2);
+
+static void CountWithGauge(
+    scoped_refptr<AtomicGauge<uint64_t>> gauge,
+    int num_increments) {
+  for (int i = 0; i < num_increments; i++) {
+    gauge->Increment();
+  }
+}
+
+static void CountWithHistogram(
+    scoped_refptr<Histogram> hist,
+    int num_increments) {
+  for (int i = 0; i < num_increments; i++) {
+    // Spread the values over a few buckets like a latency histogram would.
+    hist->Increment(100 + (i & 1023));
+  }
+}
+
+// Runs 'f' with 1, 2, 4, ... up to --mt_metrics_test_max_bench_threads
+// threads and logs the aggregate increment throughput for each round.
+static void BenchmarkIncrements(
+    const string& name,
+    const boost::function<void(int)>& f) {
+  int num_increments = FLAGS_mt_metrics_test_bench_increments;
+  if (AllowSlowTests()) {
+    num_increments *= 10;
+  }
+  for (int num_threads = 1;
+       num_threads <= FLAGS_mt_metrics_test_max_bench_threads;
+       num_threads *= 2) {
+    boost::function<void()> thread_func = boost::bind(f, num_increments);
+    MonoTime start = MonoTime::Now();
+    RunWithManyThreads(&thread_func, num_threads);
+    double secs = (MonoTime::Now() - start).ToSeconds();
+    LOG(INFO) << strings::Substitute(
+        "$0: $1 threads: $2 increments/sec",
+        name,
+        num_threads,
+        StringPrintf("%.0f", num_threads * num_increments / secs));
+  }
+}
+
+// Measures how increment throughput scales with the number of threads
+// hammering a single metric. Counters and histograms stripe their hot
+// fields, so their throughput should keep growing with the core count;
+// AtomicGauge is a single atomic and is included as a baseline.
+TEST_F(MultiThreadedMetricsTest, IncrementThroughputBenchmark) {
+  scoped_refptr<MetricEntity> entity =
+      METRIC_ENTITY_test_entity.Instantiate(&registry_, "bench");
+  scoped_refptr<Counter> counter = METRIC_test_counter.Instantiate(entity);
+  scoped_refptr<AtomicGauge<uint64_t>> gauge =
+      METRIC_test_gauge.Instantiate(entity, 0);
+  scoped_refptr<Histogram> hist = METRIC_test_hist.Instantiate(entity);
+
+  BenchmarkIncrements("counter", boost::bind(CountWithCounter, counter, _1));
+  BenchmarkIncrements("gauge", boost::bind(CountWithGauge, gauge, _1));
+  BenchmarkIncrements("histogram", boost::bind(CountWithHistogram, hist, _1));
+
+  // Every round adds num_threads * num_increments, so the totals must match
+  // the sum over all rounds.
+  int64_t total_threads = 0;
+  for (int num_threads = 1;
+       num_threads <= FLAGS_mt_metrics_test_max_bench_threads;
+       num_threads *= 2) {
+    total_threads += num_threads;
+  }
+  int64_t num_increments = FLAGS_mt_metrics_test_bench_increments;
+  if (AllowSlowTests()) {
+    num_increments *= 10;
+  }
+  ASSERT_EQ(total_threads * num_increments, counter->value());
+  uint64_t expected = total_threads * num_increments;
+  ASSERT_EQ(expected, gauge->value());
+  ASSERT_EQ(expected, hist->TotalCount());
+}
+
 // Helper function to register a bunch of counters in a loop.
 void MultiThreadedMetricsTest::RegisterCounters(
     const scoped_refptr<MetricEntity>& metric_entity,
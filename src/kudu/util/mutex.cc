@@ -34,6 +34,8 @@
 #include "kudu/util/debug-util.h"
 #include "kudu/util/env.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/lock_profiling.h"
+#include "kudu/util/spinlock_profiling.h"
 #include "kudu/util/trace.h"
 
 using std::string;
@@ -74,6 +76,10 @@ Mutex::Mutex()
 #endif
 }
 
+Mutex::Mutex(const string& site_name) : Mutex() {
+  site_ = LockSite::Get(site_name);
+}
+
 Mutex::~Mutex() {
   int rv = pthread_mutex_destroy(&native_handle_);
   DCHECK_EQ(0, rv) << ". " << strerror(rv);
@@ -88,6 +94,9 @@ bool Mutex::TryAcquire() {
     CheckUnheldAndMark();
   }
 #endif
+  if (PREDICT_FALSE(site_ != nullptr) && rv == 0) {
+    hold_start_cycles_ = site_->Acquired(0);
+  }
   return rv == 0;
 }
 
@@ -105,6 +114,7 @@ void Mutex::Acquire() {
   // If we weren't able to acquire the mutex immediately, then it's
   // worth gathering timing information about the mutex acquisition.
   MicrosecondsInt64 start_time = GetMonoTimeMicros();
+  int64_t start_cycles = site_ != nullptr ? CycleClock::Now() : 0;
   int rv = pthread_mutex_lock(&native_handle_);
   DCHECK_EQ(0, rv) << ". " << strerror(rv)
 #ifdef FB_DO_NOT_REMOVE // #ifndef NDEBUG
@@ -116,6 +126,10 @@ void Mutex::Acquire() {
   int64_t wait_time = end_time - start_time;
   if (wait_time > 0) {
     TRACE_COUNTER_INCREMENT("mutex_wait_us", wait_time);
+    SubmitBlockingWaitProfileData(wait_time, /*idle_wait=*/false);
+  }
+  if (PREDICT_FALSE(site_ != nullptr)) {
+    hold_start_cycles_ = site_->Acquired(CycleClock::Now() - start_cycles);
   }
 
 #ifdef FB_DO_NOT_REMOVE // #ifndef NDEBUG
@@ -127,10 +141,18 @@ void Mutex::Release() {
 #ifdef FB_DO_NOT_REMOVE // #ifndef NDEBUG
   CheckHeldAndUnmark();
 #endif
+  EndProfiledHold();
   int rv = pthread_mutex_unlock(&native_handle_);
   DCHECK_EQ(0, rv) << ". " << strerror(rv);
 }
 
+void Mutex::EndProfiledHold() {
+  if (PREDICT_FALSE(site_ != nullptr)) {
+    site_->Released(hold_start_cycles_);
+    hold_start_cycles_ = 0;
+  }
+}
+
 #ifdef FB_DO_NOT_REMOVE // #ifndef NDEBUG
 void Mutex::AssertAcquired() const {
   DCHECK_EQ(Env::Default()->gettid(), owning_tid_);
@@ -20,6 +20,7 @@
 #include <pthread.h>
 #include <sys/types.h>
 
+#include <cstdint>
 #include <string>
 
 #include <glog/logging.h>
@@ -29,6 +30,7 @@
 
 namespace kudu {
 
+class LockSite;
 class StackTrace;
 
 // A lock built around pthread_mutex_t. Does not allow recursion.
@@ -40,6 +42,11 @@ class StackTrace;
 class Mutex {
  public:
   Mutex();
+
+  // Account contention on this mutex to the LockSite called 'site_name'.
+  // See lock_profiling.h.
+  explicit Mutex(const std::string& site_name);
+
   ~Mutex();
 
   void Acquire();
@@ -65,8 +72,20 @@ class Mutex {
  private:
   friend class ConditionVariable;
 
+  // Stop timing the current hold, if it is being timed. Called before the
+  // mutex is released without going through Release(), i.e. by
+  // ConditionVariable waits.
+  void EndProfiledHold();
+
   pthread_mutex_t native_handle_;
 
+  // Set if the mutex was constructed with a site name.
+  LockSite* site_ = nullptr;
+
+  // Cycle count at which the current hold started if it is being timed, or 0.
+  // Protected by 'native_handle_'.
+  int64_t hold_start_cycles_ = 0;
+
 #ifdef FB_DO_NOT_REMOVE // #ifndef NDEBUG
   // Members and routines taking care of locks assertions.
   void CheckHeldAndUnmark();
@@ -18,6 +18,9 @@
 #include "kudu/util/net/socket.h"
 
 #include <fcntl.h>
+#if defined(__linux__)
+#include <linux/errqueue.h>
+#endif
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <sys/socket.h>
@@ -318,6 +321,31 @@ Status Socket::GetPeerAddress(Sockaddr* cur_addr) const {
   return Status::OK();
 }
 
+Status Socket::GetPeerUid(uid_t* uid) const {
+  DCHECK_GE(fd_, 0);
+#if defined(__linux__)
+  int domain = 0;
+  socklen_t len = sizeof(domain);
+  if (::getsockopt(fd_, SOL_SOCKET, SO_DOMAIN, &domain, &len) == -1) {
+    int err = errno;
+    return Status::NetworkError(
+        "getsockopt(SO_DOMAIN) error", ErrnoToString(err), err);
+  }
+  if (domain == AF_UNIX) {
+    struct ucred cred;
+    len = sizeof(cred);
+    if (::getsockopt(fd_, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) {
+      int err = errno;
+      return Status::NetworkError(
+          "getsockopt(SO_PEERCRED) error", ErrnoToString(err), err);
+    }
+    *uid = cred.uid;
+    return Status::OK();
+  }
+#endif
+  return Status::NotSupported("no peer credentials on the socket");
+}
+
 bool Socket::IsLoopbackConnection() const {
   Sockaddr local, remote;
   if (!GetSocketAddress(&local).ok())
@@ -487,6 +515,78 @@ Socket::Writev(const struct ::iovec* iov, int iov_len, int64_t* nwritten) {
   return Status::OK();
 }
 
+Status Socket::EnableZeroCopy() {
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+  RETURN_NOT_OK_PREPEND(
+      SetSockOpt(SOL_SOCKET, SO_ZEROCOPY, 1), "failed to set SO_ZEROCOPY");
+  return Status::OK();
+#else
+  return Status::NotSupported("zero-copy sends are not supported");
+#endif
+}
+
+Status Socket::WritevZeroCopy(
+    const struct ::iovec* iov,
+    int iov_len,
+    int64_t* nwritten) {
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+  DCHECK_GT(iov_len, 0);
+  DCHECK_GE(fd_, 0);
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(struct msghdr));
+  msg.msg_iov = const_cast<iovec*>(iov);
+  msg.msg_iovlen = iov_len;
+  ssize_t res;
+  RETRY_ON_EINTR(res, ::sendmsg(fd_, &msg, MSG_NOSIGNAL | MSG_ZEROCOPY));
+  if (PREDICT_FALSE(res < 0)) {
+    int err = errno;
+    return Status::NetworkError(
+        "zero-copy sendmsg error", ErrnoToString(err), err);
+  }
+
+  *nwritten = res;
+  return Status::OK();
+#else
+  return Status::NotSupported("zero-copy sends are not supported");
+#endif
+}
+
+Status Socket::ReadZeroCopyCompletions(uint32_t* num_completed) {
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+  DCHECK_GE(fd_, 0);
+  while (true) {
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(struct msghdr));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t res;
+    RETRY_ON_EINTR(res, ::recvmsg(fd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT));
+    if (res < 0) {
+      int err = errno;
+      if (err == EAGAIN || err == EWOULDBLOCK) {
+        return Status::OK();
+      }
+      return Status::NetworkError(
+          "recvmsg error queue error", ErrnoToString(err), err);
+    }
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != nullptr;
+         cm = CMSG_NXTHDR(&msg, cm)) {
+      const auto* serr =
+          reinterpret_cast<const struct sock_extended_err*>(CMSG_DATA(cm));
+      if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+        continue;
+      }
+      // [ee_info, ee_data] is the range of sends which completed.
+      *num_completed = serr->ee_data + 1;
+    }
+  }
+#else
+  return Status::NotSupported("zero-copy sends are not supported");
+#endif
+}
+
 // Mostly follows writen() from Stevens (2004) or Kerrisk (2010).
 Status Socket::BlockingWrite(
     const uint8_t* buf,
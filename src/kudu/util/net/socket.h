@@ -17,6 +17,8 @@
 #ifndef KUDU_UTIL_NET_SOCKET_H
 #define KUDU_UTIL_NET_SOCKET_H
 
+#include <sys/types.h>
+
 #include <cstddef>
 #include <cstdint>
 
@@ -107,12 +109,17 @@ class Socket {
   Status Listen(int listen_queue_size);
 
   // Call getsockname to get the address of this socket.
-  Status GetSocketAddress(Sockaddr* cur_addr) const;
+  // It is virtual so that sockets of other families can override.
+  virtual Status GetSocketAddress(Sockaddr* cur_addr) const;
 
   // Call getpeername to get the address of the connected peer.
   // It is virtual so that tests can override.
   virtual Status GetPeerAddress(Sockaddr* cur_addr) const;
 
+  // Sets 'uid' to the user of the peer process, as the kernel reports it
+  // for a Unix domain socket. Returns NotSupported for other sockets.
+  Status GetPeerUid(uid_t* uid) const;
+
   // Return true if this socket is determined to be a loopback connection
   // (i.e. the local and remote peer share an IP address).
   //
@@ -145,6 +152,24 @@ class Socket {
   virtual Status
   Writev(const struct ::iovec* iov, int iov_len, int64_t* nwritten);
 
+  // Allows WritevZeroCopy() on this socket. Returns NotSupported if the
+  // platform or the kind of socket can't send without copying.
+  virtual Status EnableZeroCopy();
+
+  // Like Writev(), but sends with MSG_ZEROCOPY: the kernel pins the buffers
+  // instead of copying them, so they must stay alive and unchanged until
+  // ReadZeroCopyCompletions() reports the send as complete. Sends which write
+  // anything are numbered by the kernel, starting from 0.
+  Status WritevZeroCopy(
+      const struct ::iovec* iov,
+      int iov_len,
+      int64_t* nwritten);
+
+  // Reads the pending zero-copy completion notifications, if any. TCP
+  // completes sends in order, so '*num_completed' is set to the number of
+  // the last completed send plus one, or left alone if nothing completed.
+  Status ReadZeroCopyCompletions(uint32_t* num_completed);
+
   // Blocking Write call, returns IOError unless full buffer is sent.
   // Underlying Socket expected to be in blocking mode. Fails if any Write()
   // sends 0 bytes. Returns OK if buflen bytes were sent, otherwise IOError.
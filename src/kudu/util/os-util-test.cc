@@ -20,6 +20,7 @@
 #include <unistd.h>
 
 #include <string>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -27,6 +28,7 @@
 #include "kudu/util/test_macros.h"
 
 using std::string;
+using std::vector;
 
 namespace kudu {
 
@@ -64,4 +66,19 @@ TEST(OsUtilTest, TestSelfNameWithParens) {
   RunTest("a(b(c((d))e)", 111, 222, 333);
 }
 
+TEST(OsUtilTest, TestParseCpuList) {
+  vector<int> cpus;
+  ASSERT_OK(ParseCpuList("0-3,8,10-11\n", &cpus));
+  ASSERT_EQ(vector<int>({0, 1, 2, 3, 8, 10, 11}), cpus);
+  ASSERT_EQ("0-3,8,10-11", CpuListToString(cpus));
+
+  ASSERT_OK(ParseCpuList("", &cpus));
+  ASSERT_TRUE(cpus.empty());
+  ASSERT_EQ("", CpuListToString(cpus));
+
+  ASSERT_TRUE(ParseCpuList("3-1", &cpus).IsInvalidArgument());
+  ASSERT_TRUE(ParseCpuList("a", &cpus).IsInvalidArgument());
+  ASSERT_TRUE(ParseCpuList("1,-2", &cpus).IsInvalidArgument());
+}
+
 } // namespace kudu
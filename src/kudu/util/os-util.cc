@@ -40,11 +40,13 @@
 #include "kudu/gutil/strings/numbers.h"
 #include "kudu/gutil/strings/split.h"
 #include "kudu/gutil/strings/stringpiece.h"
+#include "kudu/gutil/strings/strip.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/gutil/strings/util.h"
 #include "kudu/util/env.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/logging.h"
+#include "kudu/util/status.h"
 
 using std::ifstream;
 using std::istreambuf_iterator;
@@ -133,6 +135,77 @@ Status GetThreadStats(int64_t tid, ThreadStats* stats) {
   return ParseStat(buffer, nullptr, stats); // don't want the name
 }
 
+Status ParseCpuList(const string& cpu_list, vector<int>* cpus) {
+  cpus->clear();
+  vector<StringPiece> ranges =
+      Split(cpu_list, ",", strings::SkipWhitespace());
+  for (StringPiece range : ranges) {
+    StripWhiteSpace(&range);
+    std::pair<StringPiece, StringPiece> bounds = Split(range, "-");
+    int32_t first;
+    int32_t last;
+    if (!safe_strto32(bounds.first.data(), bounds.first.size(), &first) ||
+        first < 0) {
+      return Status::InvalidArgument("invalid CPU list", cpu_list);
+    }
+    last = first;
+    if (!bounds.second.empty() &&
+        (!safe_strto32(bounds.second.data(), bounds.second.size(), &last) ||
+         last < first)) {
+      return Status::InvalidArgument("invalid CPU list", cpu_list);
+    }
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus->push_back(cpu);
+    }
+  }
+  return Status::OK();
+}
+
+string CpuListToString(const vector<int>& cpus) {
+  string ret;
+  for (size_t i = 0; i < cpus.size();) {
+    size_t j = i;
+    while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+      j++;
+    }
+    if (!ret.empty()) {
+      ret.append(",");
+    }
+    if (j == i) {
+      ret.append(std::to_string(cpus[i]));
+    } else {
+      ret.append(Substitute("$0-$1", cpus[i], cpus[j]));
+    }
+    i = j + 1;
+  }
+  return ret;
+}
+
+Status GetNumaNodeCpus(int node, vector<int>* cpus) {
+  faststring buf;
+  RETURN_NOT_OK(ReadFileToString(
+      Env::Default(),
+      Substitute("/sys/devices/system/node/node$0/cpulist", node),
+      &buf));
+  return ParseCpuList(buf.ToString(), cpus);
+}
+
+Status GetNetworkInterfaceNumaNode(const string& interface, int* node) {
+  faststring buf;
+  RETURN_NOT_OK(ReadFileToString(
+      Env::Default(),
+      Substitute("/sys/class/net/$0/device/numa_node", interface),
+      &buf));
+  string value = buf.ToString();
+  StripWhiteSpace(&value);
+  if (!safe_strto32(value, node)) {
+    return Status::Corruption(
+        Substitute("invalid NUMA node of network interface $0", interface),
+        value);
+  }
+  return Status::OK();
+}
+
 void DisableCoreDumps() {
   struct rlimit lim;
   PCHECK(getrlimit(RLIMIT_CORE, &lim) == 0);
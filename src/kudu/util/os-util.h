@@ -26,6 +26,7 @@
 #include <cstdint>
 #include <string>
 #include <type_traits> // IWYU pragma: keep
+#include <vector>
 
 #include "kudu/util/status.h"
 
@@ -58,6 +59,22 @@ ParseStat(const std::string& buffer, std::string* name, ThreadStats* stats);
 // in an unrecognised format, or if the kernel version is not modern enough.
 Status GetThreadStats(int64_t tid, ThreadStats* stats);
 
+// Parses a list of CPUs in the format of taskset(1) and of sysfs, e.g.
+// "0-3,8,10-11", into 'cpus'. An empty list yields no CPUs.
+Status ParseCpuList(const std::string& cpu_list, std::vector<int>* cpus);
+
+// Formats 'cpus' in the format accepted by ParseCpuList().
+std::string CpuListToString(const std::vector<int>& cpus);
+
+// Reads the CPUs of NUMA node 'node' from
+// /sys/devices/system/node/node<node>/cpulist.
+Status GetNumaNodeCpus(int node, std::vector<int>* cpus);
+
+// Reads the NUMA node which the device of network interface 'interface' is
+// attached to from sysfs. Sets 'node' to -1 if the kernel does not know it,
+// e.g. on single-node hosts and for virtual interfaces.
+Status GetNetworkInterfaceNumaNode(const std::string& interface, int* node);
+
 // Disable core dumps for this process.
 //
 // This is useful particularly in tests where we have injected failures and
@@ -517,6 +517,52 @@ TEST_P(TestPBContainerVersions, TestMultipleMessages) {
   ASSERT_OK(pb_reader.Close());
 }
 
+// Records written in batches and read back past the read-ahead buffer size.
+TEST_P(TestPBContainerVersions, TestAppendBatchAndReadAhead) {
+  ProtoContainerTestPB pb;
+  pb.set_name("foo");
+  pb.set_note(string(64 * 1024, 'x'));
+
+  unique_ptr<WritablePBContainerFile> pb_writer;
+  ASSERT_OK(NewPBCWriter(version_, RWFileOptions(), &pb_writer));
+  ASSERT_OK(pb_writer->CreateNew(pb));
+
+  // 64 records of 64KiB, plus a record larger than the read-ahead buffer.
+  const int kNumBatches = 8;
+  const int kBatchSize = 8;
+  vector<ProtoContainerTestPB> batch(kBatchSize, pb);
+  for (int i = 0; i < kNumBatches; i++) {
+    vector<const google::protobuf::Message*> msgs;
+    for (int j = 0; j < kBatchSize; j++) {
+      batch[j].set_value(i * kBatchSize + j);
+      msgs.push_back(&batch[j]);
+    }
+    ASSERT_OK(pb_writer->AppendBatch(msgs));
+  }
+  ASSERT_OK(pb_writer->AppendBatch({}));
+  pb.set_note(string(2 * 1024 * 1024, 'y'));
+  pb.set_value(kNumBatches * kBatchSize);
+  ASSERT_OK(pb_writer->Append(pb));
+  ASSERT_OK(pb_writer->Close());
+
+  unique_ptr<RandomAccessFile> reader;
+  ASSERT_OK(env_->NewRandomAccessFile(path_, &reader));
+  ReadablePBContainerFile pb_reader(std::move(reader));
+  ASSERT_OK(pb_reader.Open());
+  for (int i = 0; i <= kNumBatches * kBatchSize; i++) {
+    SCOPED_TRACE(i);
+    ProtoContainerTestPB read_pb;
+    ASSERT_OK(pb_reader.ReadNextPB(&read_pb));
+    ASSERT_EQ(i, read_pb.value());
+    size_t expected_size =
+        i < kNumBatches * kBatchSize ? 64 * 1024 : 2 * 1024 * 1024;
+    ASSERT_EQ(expected_size, read_pb.note().size());
+  }
+  ProtoContainerTestPB read_pb;
+  ASSERT_TRUE(pb_reader.ReadNextPB(&read_pb).IsEndOfFile());
+  ASSERT_OK(pb_reader.Close());
+}
+
 TEST_P(TestPBContainerVersions, TestInterleavedReadWrite) {
   ProtoContainerTestPB pb;
   pb.set_name("foo");
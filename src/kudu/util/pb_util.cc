@@ -25,6 +25,7 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstring>
 #include <deque>
 #include <initializer_list>
 #include <memory>
@@ -124,6 +125,8 @@ static const uint32_t kPBContainerDefaultVersion = 2;
 static const int kPBContainerChecksumLen = sizeof(uint32_t);
 static const char kPBContainerMagic[] = "kuducntr";
 static const int kPBContainerMagicLen = 8;
+// How much of a container ReadablePBContainerFile reads at once.
+static const uint64_t kPBContainerReadAheadBytes = 1024 * 1024;
 static const int kPBContainerV1HeaderLen =
     kPBContainerMagicLen + sizeof(uint32_t); // Magic number + version.
 static const int kPBContainerV2HeaderLen = kPBContainerV1HeaderLen +
@@ -187,23 +190,109 @@ bool IsSupportedContainerVersion(uint32_t version) {
   return false;
 }
 
+// Wraps the RandomAccessFile of a ReadablePBContainerFile so that records are
+// read out of a buffer refilled kPBContainerReadAheadBytes at a time, rather
+// than with a couple of reads and copies per record.
+class ReadAheadFile {
+ public:
+  ReadAheadFile(
+      RandomAccessFile* file,
+      faststring* buf,
+      uint64_t* buf_offset)
+      : file_(file), buf_(buf), buf_offset_(buf_offset) {}
+
+  const string& filename() const {
+    return file_->filename();
+  }
+  Status Size(uint64_t* size) const {
+    return file_->Size(size);
+  }
+  Status Read(uint64_t offset, Slice result) const {
+    return file_->Read(offset, result);
+  }
+
+  // Points 'result' to the 'length' bytes at 'offset', in the read-ahead
+  // buffer. Refills the buffer from 'offset' on, up to 'file_size', if they
+  // aren't buffered. 'result' is valid until the next call.
+  Status ReadSlice(
+      uint64_t offset,
+      uint64_t length,
+      uint64_t file_size,
+      Slice* result) {
+    DCHECK_LE(offset + length, file_size);
+    if (offset < *buf_offset_ ||
+        offset + length > *buf_offset_ + buf_->size()) {
+      uint64_t to_read = std::min(
+          file_size - offset, std::max(length, kPBContainerReadAheadBytes));
+      buf_->resize(to_read);
+      Status s = file_->Read(offset, Slice(*buf_));
+      if (PREDICT_FALSE(!s.ok())) {
+        buf_->clear();
+        return s;
+      }
+      *buf_offset_ = offset;
+      // The chunk after this one is likely to be read next.
+      WARN_NOT_OK(
+          file_->AdviseSequentialRead(offset + to_read, to_read),
+          "Could not advise sequential read");
+    }
+    *result = Slice(buf_->data() + (offset - *buf_offset_), length);
+    return Status::OK();
+  }
+
+ private:
+  RandomAccessFile* const file_;
+  faststring* const buf_;
+  uint64_t* const buf_offset_;
+};
+
+// Points 'result' to the 'length' bytes at 'offset' of 'reader', read into
+// 'scratch'.
+template <typename ReadableFileType>
+Status ReadDataAt(
+    ReadableFileType* reader,
+    uint64_t offset,
+    uint64_t length,
+    uint64_t /*file_size*/,
+    faststring* scratch,
+    Slice* result) {
+  scratch->resize(length);
+  RETURN_NOT_OK(reader->Read(offset, Slice(*scratch)));
+  *result = Slice(*scratch);
+  return Status::OK();
+}
+
+// Same as above, without copying out of the read-ahead buffer.
+Status ReadDataAt(
+    ReadAheadFile* reader,
+    uint64_t offset,
+    uint64_t length,
+    uint64_t file_size,
+    faststring* /*scratch*/,
+    Slice* result) {
+  return reader->ReadSlice(offset, length, file_size, result);
+}
+
 // Reads exactly 'length' bytes from the container file into 'result',
 // validating that there is sufficient data in the file to read this length
 // before attempting to do so, and validating that it has read that length
-// after performing the read.
+// after performing the read. 'result' may point into 'scratch', or into the
+// read-ahead buffer of a ReadAheadFile.
 //
 // If the file size is less than the requested size of the read, returns
 // Status::Incomplete.
 // If there is an unexpected short read, returns Status::Corruption.
 //
-// NOTE: the data in 'result' may be modified even in the case of a failed read.
+// NOTE: the data in 'scratch' may be modified even in the case of a failed
+// read.
 template <typename ReadableFileType>
 Status ValidateAndReadData(
     ReadableFileType* reader,
     uint64_t file_size,
     uint64_t* offset,
     uint64_t length,
-    faststring* result) {
+    faststring* scratch,
+    Slice* result) {
   // Validate the read length using the file size.
   if (*offset + length > file_size) {
     return Status::Incomplete(
@@ -219,8 +308,8 @@ Status ValidateAndReadData(
   }
 
   // Perform the read.
-  result->resize(length);
-  RETURN_NOT_OK(reader->Read(*offset, Slice(*result)));
+  RETURN_NOT_OK(
+      ReadDataAt(reader, *offset, length, file_size, scratch, result));
   *offset += length;
   return Status::OK();
 }
@@ -328,16 +417,26 @@ Status ReadPBStartingAt(
   uint64_t length_buflen = (version == 1)
       ? sizeof(uint32_t)
       : sizeof(uint32_t) + kPBContainerChecksumLen;
-  faststring length_and_cksum_buf;
+  faststring scratch;
+  Slice length_and_cksum;
   RETURN_NOT_OK_PREPEND(
       ValidateAndReadData(
-          reader, file_size, &tmp_offset, length_buflen, &length_and_cksum_buf),
+          reader,
+          file_size,
+          &tmp_offset,
+          length_buflen,
+          &scratch,
+          &length_and_cksum),
       Substitute(
           "Could not read data length from proto container file $0 "
           "at offset $1",
           reader->filename(),
           *offset));
-  Slice length(length_and_cksum_buf.data(), sizeof(uint32_t));
+  // Copied out, as reading the body may reuse the buffer it points to.
+  uint8_t length_and_cksum_buf[sizeof(uint32_t) + kPBContainerChecksumLen];
+  memcpy(length_and_cksum_buf, length_and_cksum.data(), length_buflen);
+  length_and_cksum = Slice(length_and_cksum_buf, length_buflen);
+  Slice length(length_and_cksum_buf, sizeof(uint32_t));
 
   // Versions >= 2 have an individual checksum for the data length.
   if (version >= 2) {
@@ -346,7 +445,7 @@ Status ReadPBStartingAt(
     // This can happen e.g. on ext4 in the default data=ordered mode, when the
     // filesize metadata is updated but the new data is not persisted.
     // See https://plus.google.com/+KentonVarda/posts/JDwHfAiLGNQ.
-    if (IsAllZeros(length_and_cksum_buf)) {
+    if (IsAllZeros(length_and_cksum)) {
       bool all_zeros;
       RETURN_NOT_OK(
           RestOfFileIsAllZeros(reader, file_size, tmp_offset, &all_zeros));
@@ -356,8 +455,7 @@ Status ReadPBStartingAt(
       }
     }
     Slice length_checksum(
-        length_and_cksum_buf.data() + sizeof(uint32_t),
-        kPBContainerChecksumLen);
+        length_and_cksum_buf + sizeof(uint32_t), kPBContainerChecksumLen);
     RETURN_NOT_OK_PREPEND(
         ParseAndCompareChecksum(length_checksum.data(), {length}),
         CHECKSUM_ERR_MSG(
@@ -369,22 +467,23 @@ Status ReadPBStartingAt(
 
   // Read body and checksum into buffer for checksum & parsing.
   uint64_t data_and_cksum_buflen = data_length + kPBContainerChecksumLen;
-  faststring body_and_cksum_buf;
+  Slice body_and_cksum;
   RETURN_NOT_OK_PREPEND(
       ValidateAndReadData(
           reader,
           file_size,
           &tmp_offset,
           data_and_cksum_buflen,
-          &body_and_cksum_buf),
+          &scratch,
+          &body_and_cksum),
       Substitute(
           "Could not read PB message data from proto container file $0 "
           "at offset $1",
           reader->filename(),
           tmp_offset));
-  Slice body(body_and_cksum_buf.data(), data_length);
+  Slice body(body_and_cksum.data(), data_length);
   Slice record_checksum(
-      body_and_cksum_buf.data() + data_length, kPBContainerChecksumLen);
+      body_and_cksum.data() + data_length, kPBContainerChecksumLen);
 
   // Version 1 has a single checksum for length, body.
   // Version 2+ has individual checksums for length and body, respectively.
@@ -471,10 +570,16 @@ Status ParsePBFileHeader(
   // additional 4 bytes required by a V2+ header (vs V1) is still less than the
   // minimum number of bytes required for a V1 format data record.
   uint64_t tmp_offset = *offset;
-  faststring header;
+  faststring scratch;
+  Slice header;
   RETURN_NOT_OK_PREPEND(
       ValidateAndReadData(
-          reader, file_size, &tmp_offset, kPBContainerV2HeaderLen, &header),
+          reader,
+          file_size,
+          &tmp_offset,
+          kPBContainerV2HeaderLen,
+          &scratch,
+          &header),
       Substitute(
           "Could not read header for proto container file $0",
           reader->filename()));
@@ -834,6 +939,22 @@ Status WritablePBContainerFile::Append(const Message& msg) {
   return Status::OK();
 }
 
+Status WritablePBContainerFile::AppendBatch(
+    const vector<const Message*>& msgs) {
+  DCHECK_EQ(FileState::OPEN, state_);
+
+  faststring buf;
+  for (const Message* msg : msgs) {
+    RETURN_NOT_OK_PREPEND(
+        AppendMsgToBuffer(*msg, &buf), "Failed to prepare buffer for writing");
+  }
+  if (buf.size() > 0) {
+    RETURN_NOT_OK_PREPEND(AppendBytes(buf), "Failed to append data to file");
+  }
+
+  return Status::OK();
+}
+
 Status WritablePBContainerFile::Flush() {
   DCHECK_EQ(FileState::OPEN, state_);
 
@@ -967,6 +1088,7 @@ ReadablePBContainerFile::ReadablePBContainerFile(
     : state_(FileState::NOT_INITIALIZED),
       version_(kPBContainerInvalidVersion),
       offset_(0),
+      read_ahead_offset_(0),
       reader_(std::move(reader)) {}
 
 ReadablePBContainerFile::~ReadablePBContainerFile() {
@@ -975,11 +1097,12 @@ ReadablePBContainerFile::~ReadablePBContainerFile() {
 
 Status ReadablePBContainerFile::Open() {
   DCHECK_EQ(FileState::NOT_INITIALIZED, state_);
-  RETURN_NOT_OK(ParsePBFileHeader(
-      reader_.get(), &cached_file_size_, &offset_, &version_));
+  ReadAheadFile reader(reader_.get(), &read_ahead_buf_, &read_ahead_offset_);
+  RETURN_NOT_OK(
+      ParsePBFileHeader(&reader, &cached_file_size_, &offset_, &version_));
   ContainerSupHeaderPB sup_header;
   RETURN_NOT_OK(ReadSupplementalHeader(
-      reader_.get(), version_, &cached_file_size_, &offset_, &sup_header));
+      &reader, version_, &cached_file_size_, &offset_, &sup_header));
   protos_.reset(sup_header.release_protos());
   pb_type_ = sup_header.pb_type();
   state_ = FileState::OPEN;
@@ -988,7 +1111,14 @@ Status ReadablePBContainerFile::Open() {
 
 Status ReadablePBContainerFile::ReadNextPB(Message* msg) {
   DCHECK_EQ(FileState::OPEN, state_);
-  return ReadFullPB(reader_.get(), version_, &cached_file_size_, &offset_, msg);
+  ReadAheadFile reader(reader_.get(), &read_ahead_buf_, &read_ahead_offset_);
+  Status s = ReadFullPB(&reader, version_, &cached_file_size_, &offset_, msg);
+  if (PREDICT_FALSE(!s.ok())) {
+    // The file may be truncated at offset() and then appended to, which would
+    // make the buffered bytes past offset() stale.
+    read_ahead_buf_.clear();
+  }
+  return s;
 }
 
 Status ReadablePBContainerFile::GetPrototype(const Message** prototype) {
@@ -1114,6 +1244,8 @@ Status ReadablePBContainerFile::Dump(
 Status ReadablePBContainerFile::Close() {
   state_ = FileState::CLOSED;
   reader_.reset();
+  read_ahead_buf_.clear();
+  read_ahead_buf_.shrink_to_fit();
   return Status::OK();
 }
 
@@ -25,6 +25,7 @@
 #include <iosfwd>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <boost/optional/optional.hpp>
 #include <google/protobuf/message.h>
@@ -32,6 +33,7 @@
 
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/util/debug/trace_event_impl.h"
+#include "kudu/util/faststring.h"
 #include "kudu/util/mutex.h"
 
 namespace google {
@@ -52,7 +54,6 @@ class SequentialFile;
 class Slice;
 class Status;
 class RWFile;
-class faststring;
 
 namespace pb_util {
 
@@ -311,6 +312,11 @@ class WritablePBContainerFile {
   // must be called prior to calling Append(), i.e. the file must be open.
   Status Append(const google::protobuf::Message& msg);
 
+  // Like Append(), for several messages, written with a single write so that
+  // they may be made durable by a single Sync().
+  Status AppendBatch(
+      const std::vector<const google::protobuf::Message*>& msgs);
+
   // Asynchronously flushes all dirty container data to the filesystem.
   // The file must be open.
   Status Flush();
@@ -457,6 +463,12 @@ class ReadablePBContainerFile {
   // read.
   boost::optional<uint64_t> cached_file_size_;
 
+  // Records are parsed out of this buffer, which holds the bytes of the file
+  // starting at 'read_ahead_offset_'. Dropped when ReadNextPB() fails, since
+  // that's when the file may be truncated and rewritten.
+  faststring read_ahead_buf_;
+  uint64_t read_ahead_offset_;
+
   // The fully-qualified PB type name of the messages in the container.
   std::string pb_type_;
 
@@ -25,7 +25,10 @@
 #include <glog/logging.h>
 
 #include "kudu/gutil/map-util.h"
+#include "kudu/gutil/port.h"
+#include "kudu/gutil/walltime.h"
 #include "kudu/util/env.h"
+#include "kudu/util/lock_profiling.h"
 
 using std::lock_guard;
 
@@ -56,6 +59,11 @@ RWMutex::RWMutex(Priority prio)
   Init(prio);
 }
 
+RWMutex::RWMutex(const std::string& site_name, Priority prio)
+    : RWMutex(prio) {
+  site_ = LockSite::Get(site_name);
+}
+
 void RWMutex::Init(Priority prio) {
 #ifdef __linux__
   // Adapt from priority to the pthread type.
@@ -92,6 +100,19 @@ RWMutex::~RWMutex() {
 
 void RWMutex::ReadLock() {
   CheckLockState(LockState::NEITHER);
+  if (PREDICT_FALSE(site_ != nullptr)) {
+    int rv = pthread_rwlock_tryrdlock(&native_handle_);
+    if (rv == EBUSY) {
+      int64_t start_cycles = CycleClock::Now();
+      rv = pthread_rwlock_rdlock(&native_handle_);
+      site_->Acquired(CycleClock::Now() - start_cycles);
+    } else {
+      site_->Acquired(0);
+    }
+    DCHECK_EQ(0, rv) << strerror(rv);
+    MarkForReading();
+    return;
+  }
   int rv = pthread_rwlock_rdlock(&native_handle_);
   DCHECK_EQ(0, rv) << strerror(rv);
   MarkForReading();
@@ -110,12 +131,28 @@ bool RWMutex::TryReadLock() {
     return false;
   }
   DCHECK_EQ(0, rv) << strerror(rv);
+  if (PREDICT_FALSE(site_ != nullptr)) {
+    site_->Acquired(0);
+  }
   MarkForReading();
   return true;
 }
 
 void RWMutex::WriteLock() {
   CheckLockState(LockState::NEITHER);
+  if (PREDICT_FALSE(site_ != nullptr)) {
+    int rv = pthread_rwlock_trywrlock(&native_handle_);
+    int64_t wait_cycles = 0;
+    if (rv == EBUSY) {
+      int64_t start_cycles = CycleClock::Now();
+      rv = pthread_rwlock_wrlock(&native_handle_);
+      wait_cycles = CycleClock::Now() - start_cycles;
+    }
+    DCHECK_EQ(0, rv) << strerror(rv);
+    hold_start_cycles_ = site_->Acquired(wait_cycles);
+    MarkForWriting();
+    return;
+  }
   int rv = pthread_rwlock_wrlock(&native_handle_);
   DCHECK_EQ(0, rv) << strerror(rv);
   MarkForWriting();
@@ -124,6 +161,10 @@ void RWMutex::WriteLock() {
 void RWMutex::WriteUnlock() {
   CheckLockState(LockState::WRITER);
   UnmarkForWriting();
+  if (PREDICT_FALSE(site_ != nullptr)) {
+    site_->Released(hold_start_cycles_);
+    hold_start_cycles_ = 0;
+  }
   unlock_rwlock(&native_handle_);
 }
 
@@ -134,6 +175,9 @@ bool RWMutex::TryWriteLock() {
     return false;
   }
   DCHECK_EQ(0, rv) << strerror(rv);
+  if (PREDICT_FALSE(site_ != nullptr)) {
+    hold_start_cycles_ = site_->Acquired(0);
+  }
   MarkForWriting();
   return true;
 }
@@ -20,6 +20,8 @@
 #include <pthread.h>
 #include <sys/types.h>
 
+#include <cstdint>
+#include <string>
 #include <unordered_set>
 
 #include "kudu/gutil/macros.h"
@@ -53,6 +55,13 @@ class RWMutex {
   // underlying platform may not support custom priorities.
   explicit RWMutex(Priority prio);
 
+  // Create an RWMutex which accounts its contention to the LockSite called
+  // 'site_name'. Waits are recorded for readers and writers; hold times only
+  // for writers. See lock_profiling.h.
+  explicit RWMutex(
+      const std::string& site_name,
+      Priority prio = Priority::PREFER_READING);
+
   ~RWMutex();
 
   void ReadLock();
@@ -117,6 +126,13 @@ class RWMutex {
 
   pthread_rwlock_t native_handle_;
 
+  // Set if the lock was constructed with a site name.
+  LockSite* site_ = nullptr;
+
+  // Cycle count at which the current write hold started if it is being
+  // timed, or 0. Protected by holding the lock for writing.
+  int64_t hold_start_cycles_ = 0;
+
 #ifdef FB_DO_NOT_REMOVE // #ifndef NDEBUG
   // Protects reader_tids_ and writer_tid_.
   mutable simple_spinlock tid_lock_;
@@ -26,11 +26,17 @@
 #include "kudu/gutil/atomicops.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/port.h"
+#include "kudu/gutil/walltime.h"
 #ifdef RW_SEMAPHORE_TRACK_HOLDER
 #include "kudu/util/debug-util.h"
 #endif
 #include "kudu/util/thread.h"
 
+namespace gutil {
+// Defined in util/spinlock_profiling.cc, see gutil/synchronization_profiling.h.
+void SubmitSpinLockProfileData(const void* contendedlock, int64 wait_cycles);
+} // namespace gutil
+
 namespace kudu {
 
 // Read-Write semaphore. 32bit uint that contains the number of readers.
@@ -67,6 +73,7 @@ class rw_semaphore {
 
   void lock_shared() {
     int loop_count = 0;
+    int64 wait_start = 0;
     Atomic32 cur_state = base::subtle::NoBarrier_Load(&state_);
     while (true) {
       Atomic32 expected = cur_state & kNumReadersMask; // I expect no write lock
@@ -75,9 +82,17 @@ class rw_semaphore {
           &state_, expected, try_new_state);
       if (cur_state == expected)
         break;
+      // Only waiting for a writer counts as contention, not racing with
+      // other readers.
+      if ((cur_state & kWriteFlag) && wait_start == 0) {
+        wait_start = CycleClock::Now();
+      }
       // Either was already locked by someone else, or CAS failed.
       boost::detail::yield(loop_count++);
     }
+    if (PREDICT_FALSE(wait_start != 0)) {
+      ReportContention(wait_start);
+    }
   }
 
   void unlock_shared() {
@@ -126,6 +141,7 @@ class rw_semaphore {
 
   void lock() {
     int loop_count = 0;
+    int64 wait_start = 0;
     Atomic32 cur_state = base::subtle::NoBarrier_Load(&state_);
     while (true) {
       Atomic32 expected =
@@ -138,11 +154,22 @@ class rw_semaphore {
           &state_, expected, try_new_state);
       if (cur_state == expected)
         break;
+      if ((cur_state & kWriteFlag) && wait_start == 0) {
+        wait_start = CycleClock::Now();
+      }
       // Either was already locked by someone else, or CAS failed.
       boost::detail::yield(loop_count++);
     }
 
+    if (cur_state & kNumReadersMask) {
+      if (wait_start == 0) {
+        wait_start = CycleClock::Now();
+      }
+    }
     WaitPendingReaders();
+    if (PREDICT_FALSE(wait_start != 0)) {
+      ReportContention(wait_start);
+    }
 
 #ifdef FB_DO_NOT_REMOVE // #ifndef NDEBUG
     writer_tid_ = Thread::CurrentThreadId();
@@ -193,6 +220,13 @@ class rw_semaphore {
   void ResetLockHolderStack() {}
 #endif
 
+  // Reports the time spent waiting for the lock since 'wait_start' to the
+  // spinlock contention profiler, like base::SpinLock does, so that it shows
+  // up in the spinlock_contention_time metric and in contention profiles.
+  void ReportContention(int64 wait_start) {
+    gutil::SubmitSpinLockProfileData(this, CycleClock::Now() - wait_start);
+  }
+
   void WaitPendingReaders() {
     int loop_count = 0;
     while ((base::subtle::Acquire_Load(&state_) & kNumReadersMask) > 0) {
@@ -0,0 +1,169 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/sampling_profiler.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "kudu/util/condition_variable.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/mutex.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+using std::string;
+using std::thread;
+using std::vector;
+
+namespace kudu {
+
+class SamplingProfilerTest : public KuduTest {};
+
+// Decode the legacy CPU profile in 'profile' and return the total number of
+// samples it contains.
+static int64_t CountCpuSamples(const string& profile) {
+  const uintptr_t* words = reinterpret_cast<const uintptr_t*>(profile.data());
+  size_t num_words = profile.size() / sizeof(uintptr_t);
+  CHECK_GE(num_words, 8);
+  CHECK_EQ(0, words[0]);
+  CHECK_EQ(3, words[1]);
+  CHECK_EQ(0, words[2]);
+  CHECK_EQ(0, words[4]);
+
+  int64_t total = 0;
+  size_t i = 5;
+  while (i + 2 < num_words) {
+    uintptr_t count = words[i];
+    uintptr_t depth = words[i + 1];
+    if (count == 0) {
+      // The trailer.
+      CHECK_EQ(1, depth);
+      CHECK_EQ(0, words[i + 2]);
+      return total;
+    }
+    total += count;
+    i += 2 + depth;
+  }
+  LOG(FATAL) << "profile has no trailer";
+  return -1;
+}
+
+TEST_F(SamplingProfilerTest, TestCpuProfile) {
+  std::atomic<bool> done(false);
+  thread spinner([&done]() {
+    volatile uint64_t x = 0;
+    while (!done) {
+      x++;
+    }
+  });
+
+  string profile;
+  int64_t dropped = 0;
+  ASSERT_OK(CollectCpuProfile(
+      MonoDelta::FromMilliseconds(500), 1000, &profile, &dropped));
+  done = true;
+  spinner.join();
+
+  // A thread spinning for half a second at 1000Hz should yield a good number
+  // of samples even on a loaded machine.
+  ASSERT_GT(CountCpuSamples(profile) + dropped, 10);
+#if defined(__linux__)
+  ASSERT_STR_CONTAINS(profile, "[stack]");
+#endif
+}
+
+TEST_F(SamplingProfilerTest, TestInvalidArguments) {
+  string profile;
+  ASSERT_TRUE(CollectCpuProfile(MonoDelta::FromSeconds(1), 0, &profile)
+                  .IsInvalidArgument());
+  ASSERT_TRUE(CollectCpuProfile(MonoDelta::FromSeconds(1), 100000, &profile)
+                  .IsInvalidArgument());
+  ASSERT_TRUE(CollectCpuProfile(MonoDelta::FromSeconds(0), 100, &profile)
+                  .IsInvalidArgument());
+  ASSERT_TRUE(CollectWaitProfile(MonoDelta::FromSeconds(3600), false, &profile)
+                  .IsInvalidArgument());
+}
+
+// Only one CPU profile can be collected at a time.
+TEST_F(SamplingProfilerTest, TestConcurrentCpuProfiles) {
+  Status first;
+  thread t([&first]() {
+    string profile;
+    first = CollectCpuProfile(MonoDelta::FromSeconds(1), 100, &profile);
+  });
+  SleepFor(MonoDelta::FromMilliseconds(200));
+  string profile;
+  Status second = CollectCpuProfile(MonoDelta::FromSeconds(1), 100, &profile);
+  t.join();
+  ASSERT_OK(first);
+  ASSERT_TRUE(second.IsIllegalState()) << second.ToString();
+}
+
+TEST_F(SamplingProfilerTest, TestWaitProfile) {
+  Mutex lock;
+  std::atomic<bool> done(false);
+  vector<thread> threads;
+  for (int i = 0; i < 2; i++) {
+    threads.emplace_back([&lock, &done]() {
+      while (!done) {
+        MutexLock l(lock);
+        SleepFor(MonoDelta::FromMilliseconds(5));
+      }
+    });
+  }
+
+  string profile;
+  ASSERT_OK(CollectWaitProfile(
+      MonoDelta::FromMilliseconds(500), false, &profile));
+  done = true;
+  for (thread& t : threads) {
+    t.join();
+  }
+  ASSERT_STR_CONTAINS(profile, "--- contention:\n");
+  ASSERT_STR_CONTAINS(profile, "cycles/second = ");
+  ASSERT_STR_CONTAINS(profile, " @ ");
+}
+
+TEST_F(SamplingProfilerTest, TestWaitProfileWithIdleWaits) {
+  Mutex lock;
+  ConditionVariable cond(&lock);
+  std::atomic<bool> done(false);
+  thread waiter([&]() {
+    MutexLock l(lock);
+    while (!done) {
+      cond.WaitFor(MonoDelta::FromMilliseconds(10));
+    }
+  });
+
+  string profile;
+  ASSERT_OK(CollectWaitProfile(
+      MonoDelta::FromMilliseconds(300), true, &profile));
+  done = true;
+  waiter.join();
+  ASSERT_STR_CONTAINS(profile, " @ ");
+}
+
+} // namespace kudu
@@ -0,0 +1,352 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/sampling_profiler.h"
+
+#include <signal.h>
+#include <sys/time.h>
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/gutil/atomicops.h"
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/port.h"
+#include "kudu/gutil/spinlock.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/sysinfo.h"
+#include "kudu/util/atomic.h"
+#include "kudu/util/debug-util.h"
+#include "kudu/util/env.h"
+#include "kudu/util/errno.h"
+#include "kudu/util/faststring.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/scoped_cleanup.h"
+#include "kudu/util/spinlock_profiling.h"
+
+DEFINE_int32(
+    profiler_max_duration_secs,
+    300,
+    "Longest CPU or wait profile, in seconds, that the server will collect "
+    "in response to a single request.");
+DEFINE_validator(
+    profiler_max_duration_secs,
+    [](const char* /*flag_name*/, int32_t value) { return value > 0; });
+TAG_FLAG(profiler_max_duration_secs, advanced);
+TAG_FLAG(profiler_max_duration_secs, runtime);
+
+using base::SpinLock;
+using base::SpinLockHolder;
+using std::string;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+
+namespace {
+
+const int kMaxFrequencyHz = 1000;
+
+// How often the collecting thread drains the sample tables while a profile is
+// running, so that long profiles don't overflow them.
+const int64_t kFlushIntervalMs = 100;
+
+// Fixed-size table of CPU samples filled in from the SIGPROF handler.
+//
+// Like the contention table in spinlock_profiling.cc, every slot has its own
+// lock, and a handler which can't claim a slot within a few probes drops its
+// sample rather than wait. This keeps Add() async-signal-safe.
+class CpuSamples {
+ public:
+  CpuSamples() : dropped_samples_(0) {}
+
+  void Add(const StackTrace& s);
+
+  // Append the collected samples to 'words' as legacy CPU profile records and
+  // reset their counts.
+  void Flush(vector<uintptr_t>* words);
+
+  int64_t TakeDroppedSamples() {
+    return dropped_samples_.Exchange(0);
+  }
+
+ private:
+  struct Entry {
+    Entry() : count(0), hash(0) {}
+
+    // Protects all other fields.
+    SpinLock lock;
+
+    // If 0, the entry is unclaimed and the other fields are not valid.
+    int64_t count;
+    uint64_t hash;
+    StackTrace trace;
+  };
+
+  enum { kNumEntries = 2048, kNumLinearProbeAttempts = 4 };
+  Entry entries_[kNumEntries];
+
+  AtomicInt<int64_t> dropped_samples_;
+
+  DISALLOW_COPY_AND_ASSIGN(CpuSamples);
+};
+
+void CpuSamples::Add(const StackTrace& s) {
+  uint64_t hash = s.HashCode();
+  for (int i = 0; i < kNumLinearProbeAttempts; i++) {
+    Entry* e = &entries_[(hash + i) % kNumEntries];
+    if (!e->lock.TryLock()) {
+      continue;
+    }
+    if (e->count == 0) {
+      e->hash = hash;
+      e->trace.CopyFrom(s);
+    } else if (e->hash != hash || !e->trace.Equals(s)) {
+      e->lock.Unlock();
+      continue;
+    }
+    e->count++;
+    e->lock.Unlock();
+    return;
+  }
+  dropped_samples_.Increment();
+}
+
+void CpuSamples::Flush(vector<uintptr_t>* words) {
+  for (Entry& e : entries_) {
+    SpinLockHolder l(&e.lock);
+    if (e.count == 0) {
+      continue;
+    }
+    words->push_back(e.count);
+    words->push_back(e.trace.num_frames());
+    for (int i = 0; i < e.trace.num_frames(); i++) {
+      words->push_back(reinterpret_cast<uintptr_t>(e.trace.frame(i)));
+    }
+    e.count = 0;
+  }
+}
+
+// Set while samples should be recorded. The SIGPROF handler stays installed
+// once a CPU profile has run, so that a signal which was already in flight
+// when the timer was disarmed is dropped instead of killing the process.
+Atomic32 g_cpu_profiling_enabled = 0;
+
+// Ensure only one profile of each kind is being collected at a time.
+Atomic32 g_cpu_profile_running = 0;
+Atomic32 g_wait_profile_running = 0;
+
+// Allocated on the first CPU profile and never freed, since the handler may
+// still be running on another thread after profiling is disabled.
+CpuSamples* g_cpu_samples = nullptr;
+
+void HandleProfSignal(int /*signum*/, siginfo_t* /*info*/, void* /*ucontext*/) {
+  if (!base::subtle::Acquire_Load(&g_cpu_profiling_enabled)) {
+    return;
+  }
+  // Signal handlers may be invoked at any point, so it's important to preserve
+  // errno.
+  int save_errno = errno;
+  StackTrace stack;
+  stack.Collect(/*skip_frames=*/1);
+  g_cpu_samples->Add(stack);
+  errno = save_errno;
+}
+
+// Install HandleProfSignal() unless it (or any other handler) already is.
+// Must be called by the thread holding 'g_cpu_profile_running'.
+Status InstallProfSignalHandler() {
+  struct sigaction old_act;
+  if (sigaction(SIGPROF, nullptr, &old_act) != 0) {
+    int err = errno;
+    return Status::RuntimeError("sigaction failed", ErrnoToString(err), err);
+  }
+  if ((old_act.sa_flags & SA_SIGINFO) &&
+      old_act.sa_sigaction == &HandleProfSignal) {
+    return Status::OK();
+  }
+  if (old_act.sa_handler != SIG_DFL && old_act.sa_handler != SIG_IGN) {
+    return Status::IllegalState(
+        "SIGPROF handler is already in use by another profiler");
+  }
+
+  if (g_cpu_samples == nullptr) {
+    g_cpu_samples = new CpuSamples();
+  }
+  struct sigaction act;
+  memset(&act, 0, sizeof(act));
+  act.sa_sigaction = &HandleProfSignal;
+  act.sa_flags = SA_SIGINFO | SA_RESTART;
+  if (sigaction(SIGPROF, &act, nullptr) != 0) {
+    int err = errno;
+    return Status::RuntimeError("sigaction failed", ErrnoToString(err), err);
+  }
+  return Status::OK();
+}
+
+Status SetProfTimer(int64_t period_us) {
+  struct itimerval timer;
+  timer.it_interval.tv_sec = period_us / 1000000;
+  timer.it_interval.tv_usec = period_us % 1000000;
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    int err = errno;
+    return Status::RuntimeError("setitimer failed", ErrnoToString(err), err);
+  }
+  return Status::OK();
+}
+
+Status ValidateDuration(MonoDelta duration) {
+  if (!duration.Initialized() || duration.ToNanoseconds() <= 0) {
+    return Status::InvalidArgument("profile duration must be positive");
+  }
+  if (duration.ToSeconds() > FLAGS_profiler_max_duration_secs) {
+    return Status::InvalidArgument(Substitute(
+        "profile duration of $0 exceeds --profiler_max_duration_secs ($1s)",
+        duration.ToString(),
+        FLAGS_profiler_max_duration_secs));
+  }
+  return Status::OK();
+}
+
+// Sleep until 'deadline', calling 'flush' every kFlushIntervalMs.
+template <class F>
+void SleepAndFlushUntil(const MonoTime& deadline, const F& flush) {
+  const MonoDelta interval = MonoDelta::FromMilliseconds(kFlushIntervalMs);
+  for (MonoTime now = MonoTime::Now(); now < deadline; now = MonoTime::Now()) {
+    MonoDelta remaining = deadline - now;
+    SleepFor(remaining.LessThan(interval) ? remaining : interval);
+    flush();
+  }
+}
+
+// pprof needs the address space layout to symbolize legacy profiles.
+void AppendMemoryMappings(string* profile) {
+#if defined(__linux__)
+  faststring maps;
+  Status s = ReadFileToString(Env::Default(), "/proc/self/maps", &maps);
+  if (s.ok()) {
+    profile->append(maps.ToString());
+  } else {
+    LOG(WARNING) << "Unable to read memory mappings for profile: "
+                 << s.ToString();
+  }
+#endif
+}
+
+} // anonymous namespace
+
+Status CollectCpuProfile(
+    MonoDelta duration,
+    int frequency_hz,
+    string* profile,
+    int64_t* dropped_samples) {
+  if (frequency_hz <= 0 || frequency_hz > kMaxFrequencyHz) {
+    return Status::InvalidArgument(Substitute(
+        "sampling frequency must be between 1 and $0 Hz", kMaxFrequencyHz));
+  }
+  RETURN_NOT_OK(ValidateDuration(duration));
+  if (base::subtle::Acquire_CompareAndSwap(&g_cpu_profile_running, 0, 1) !=
+      0) {
+    return Status::IllegalState("a CPU profile is already being collected");
+  }
+  SCOPED_CLEANUP({ base::subtle::Release_Store(&g_cpu_profile_running, 0); });
+  RETURN_NOT_OK(InstallProfSignalHandler());
+
+  // Header of the legacy CPU profile format: header count, header words,
+  // format version, sampling period and padding.
+  const int64_t period_us = 1000000 / frequency_hz;
+  vector<uintptr_t> words = {0, 3, 0, static_cast<uintptr_t>(period_us), 0};
+
+  // Discard samples which raced with the end of a previous profile.
+  {
+    vector<uintptr_t> stale;
+    g_cpu_samples->Flush(&stale);
+    g_cpu_samples->TakeDroppedSamples();
+  }
+
+  base::subtle::Release_Store(&g_cpu_profiling_enabled, 1);
+  Status s = SetProfTimer(period_us);
+  if (s.ok()) {
+    SleepAndFlushUntil(MonoTime::Now() + duration, [&words]() {
+      g_cpu_samples->Flush(&words);
+    });
+    s = SetProfTimer(0);
+  }
+  base::subtle::Release_Store(&g_cpu_profiling_enabled, 0);
+  RETURN_NOT_OK(s);
+  g_cpu_samples->Flush(&words);
+
+  // Trailer: a record with a count of 0 and a single zero PC.
+  words.push_back(0);
+  words.push_back(1);
+  words.push_back(0);
+  profile->assign(
+      reinterpret_cast<const char*>(words.data()),
+      words.size() * sizeof(uintptr_t));
+  AppendMemoryMappings(profile);
+  if (dropped_samples) {
+    *dropped_samples = g_cpu_samples->TakeDroppedSamples();
+  }
+  return Status::OK();
+}
+
+Status CollectWaitProfile(
+    MonoDelta duration,
+    bool include_idle_waits,
+    string* profile,
+    int64_t* dropped_samples) {
+  RETURN_NOT_OK(ValidateDuration(duration));
+  if (base::subtle::Acquire_CompareAndSwap(&g_wait_profile_running, 0, 1) !=
+      0) {
+    return Status::IllegalState("a wait profile is already being collected");
+  }
+  SCOPED_CLEANUP({ base::subtle::Release_Store(&g_wait_profile_running, 0); });
+
+  std::ostringstream out;
+  out << "--- contention:\n";
+  out << "sampling period = 1\n";
+  out << "cycles/second = " << base::CyclesPerSecond() << "\n";
+
+  int64_t dropped = 0;
+  StartSynchronizationProfiling(include_idle_waits);
+  // Drop samples left over from an earlier profile.
+  {
+    std::ostringstream stale;
+    int64_t stale_dropped = 0;
+    FlushSynchronizationProfile(&stale, &stale_dropped);
+  }
+  SleepAndFlushUntil(MonoTime::Now() + duration, [&out, &dropped]() {
+    FlushSynchronizationProfile(&out, &dropped);
+  });
+  StopSynchronizationProfiling(include_idle_waits);
+  FlushSynchronizationProfile(&out, &dropped);
+
+  *profile = out.str();
+  AppendMemoryMappings(profile);
+  if (dropped_samples) {
+    *dropped_samples = dropped;
+  }
+  return Status::OK();
+}
+
+} // namespace kudu
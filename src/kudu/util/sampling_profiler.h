@@ -0,0 +1,62 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "kudu/util/monotime.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+// On-demand sampling profilers that are cheap enough to run against a
+// production server. Both produce output which 'pprof' reads directly; only
+// one profile of each kind may be collected at a time.
+
+// Collect a CPU profile of the whole process for 'duration'.
+//
+// A SIGPROF interval timer fires 'frequency_hz' times per second of consumed
+// CPU time and the interrupted thread records its stack into a fixed-size
+// table, so the overhead is bounded by the sampling rate regardless of load.
+// On success, '*profile' holds the samples in the legacy gperftools binary CPU
+// profile format followed by the process' memory mappings, and
+// '*dropped_samples' (if not null) is set to the number of samples which did
+// not fit in the table.
+//
+// Returns IllegalState if a CPU profile is already being collected, or if
+// another SIGPROF handler is installed in the process.
+Status CollectCpuProfile(
+    MonoDelta duration,
+    int frequency_hz,
+    std::string* profile,
+    int64_t* dropped_samples = nullptr);
+
+// Collect an off-CPU profile for 'duration': the stacks at which threads
+// blocked on spinlocks and Mutexes, weighted by the time spent waiting. If
+// 'include_idle_waits' is true, ConditionVariable waits are included as well.
+//
+// On success, '*profile' holds the samples in the pprof contention profile
+// format. See StartSynchronizationProfiling() in spinlock_profiling.h.
+Status CollectWaitProfile(
+    MonoDelta duration,
+    bool include_idle_waits,
+    std::string* profile,
+    int64_t* dropped_samples = nullptr);
+
+} // namespace kudu
@@ -0,0 +1,187 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/slab_allocator.h"
+
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/util/mem_tracker.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_int32(slab_allocator_central_cache_mb);
+DECLARE_int32(slab_allocator_thread_cache_kb);
+DECLARE_string(slab_allocator_huge_pages);
+
+using std::thread;
+using std::vector;
+
+namespace kudu {
+
+class SlabAllocatorTest : public KuduTest {};
+
+TEST_F(SlabAllocatorTest, TestSizeClasses) {
+  ASSERT_EQ(64, SlabAllocator::GetAllocationSize(1));
+  ASSERT_EQ(64, SlabAllocator::GetAllocationSize(64));
+  ASSERT_EQ(96, SlabAllocator::GetAllocationSize(65));
+  ASSERT_EQ(128, SlabAllocator::GetAllocationSize(97));
+  ASSERT_EQ(256, SlabAllocator::GetAllocationSize(200));
+  ASSERT_EQ(6 * 1024 * 1024, SlabAllocator::GetAllocationSize(5 * 1024 * 1024));
+  ASSERT_EQ(8 * 1024 * 1024, SlabAllocator::GetAllocationSize(8 * 1024 * 1024));
+  // Too big for any class.
+  ASSERT_EQ(8 * 1024 * 1024 + 1,
+            SlabAllocator::GetAllocationSize(8 * 1024 * 1024 + 1));
+
+  // No class wastes more than a third of its buffer.
+  for (size_t size = 1; size < 8 * 1024 * 1024; size = size * 5 / 4 + 1) {
+    size_t alloc = SlabAllocator::GetAllocationSize(size);
+    ASSERT_GE(alloc, size);
+    ASSERT_LE(alloc - size, alloc / 3 + 64) << size;
+  }
+}
+
+TEST_F(SlabAllocatorTest, TestReuse) {
+  SlabAllocator* allocator = SlabAllocator::Get();
+  size_t capacity;
+  uint8_t* buf = allocator->Allocate(200, &capacity);
+  ASSERT_EQ(256, capacity);
+  memset(buf, 0xff, capacity);
+  allocator->Free(buf, capacity);
+
+  // The buffer is reused from this thread's cache, for any size of its class.
+  size_t capacity2;
+  uint8_t* buf2 = allocator->Allocate(250, &capacity2);
+  ASSERT_EQ(buf, buf2);
+  ASSERT_EQ(capacity, capacity2);
+  allocator->Free(buf2, capacity2);
+
+  // Buffers too big for the thread cache go to the central cache.
+  FLAGS_slab_allocator_thread_cache_kb = 0;
+  int64_t consumption = allocator->mem_tracker()->consumption();
+  int64_t central = allocator->central_cached_bytes();
+  buf = allocator->Allocate(1024 * 1024, &capacity);
+  ASSERT_GE(allocator->mem_tracker()->consumption(), consumption);
+  allocator->Free(buf, capacity);
+  ASSERT_EQ(central + capacity, allocator->central_cached_bytes());
+
+  // ... from where another thread can take them.
+  thread t([&]() {
+    buf2 = allocator->Allocate(1024 * 1024, &capacity2);
+  });
+  t.join();
+  ASSERT_EQ(buf, buf2);
+  ASSERT_EQ(central, allocator->central_cached_bytes());
+
+  // Buffers that fit in no cache go back to the heap.
+  FLAGS_slab_allocator_central_cache_mb = 0;
+  consumption = allocator->mem_tracker()->consumption();
+  allocator->Free(buf2, capacity2);
+  ASSERT_EQ(consumption - capacity2, allocator->mem_tracker()->consumption());
+}
+
+// Large buffers are backed by huge pages where the kernel allows it, and by
+// regular pages otherwise.
+TEST_F(SlabAllocatorTest, TestHugePages) {
+  SlabAllocator* allocator = SlabAllocator::Get();
+  FLAGS_slab_allocator_thread_cache_kb = 0;
+  FLAGS_slab_allocator_central_cache_mb = 0;
+  MemTracker* huge_page_tracker = allocator->huge_page_tracker_.get();
+  ASSERT_EQ(0, huge_page_tracker->consumption());
+
+  for (const char* mode : {"transparent", "explicit"}) {
+    SCOPED_TRACE(mode);
+    FLAGS_slab_allocator_huge_pages = mode;
+    int64_t fallbacks = allocator->huge_page_fallbacks();
+    size_t capacity;
+    uint8_t* buf = allocator->Allocate(3 * 1024 * 1024, &capacity);
+    ASSERT_EQ(3 * 1024 * 1024, capacity);
+    memset(buf, 0xff, capacity);
+    if (huge_page_tracker->consumption() > 0) {
+      // Rounded up to whole huge pages.
+      ASSERT_EQ(4 * 1024 * 1024, huge_page_tracker->consumption());
+      ASSERT_EQ(0, reinterpret_cast<uintptr_t>(buf) % (2 * 1024 * 1024));
+    } else {
+      LOG(INFO) << "No huge pages available in " << mode << " mode";
+      ASSERT_GT(allocator->huge_page_fallbacks(), fallbacks);
+    }
+    allocator->Free(buf, capacity);
+    ASSERT_EQ(0, huge_page_tracker->consumption());
+  }
+
+  // Small buffers never are.
+  size_t capacity;
+  uint8_t* buf = allocator->Allocate(1024, &capacity);
+  ASSERT_EQ(0, huge_page_tracker->consumption());
+  allocator->Free(buf, capacity);
+}
+
+// Allocates and frees from many threads, with buffers freed by other threads
+// than the allocating ones.
+TEST_F(SlabAllocatorTest, TestConcurrentAllocations) {
+  const int kNumThreads = 8;
+  const int kNumBuffers = AllowSlowTests() ? 100000 : 10000;
+  SlabAllocator* allocator = SlabAllocator::Get();
+  FLAGS_slab_allocator_thread_cache_kb = 64;
+  FLAGS_slab_allocator_central_cache_mb = 1;
+
+  struct Buffer {
+    uint8_t* data;
+    size_t capacity;
+  };
+  vector<vector<Buffer>> buffers(kNumThreads);
+  vector<thread> threads;
+  for (int i = 0; i < kNumThreads; i++) {
+    threads.emplace_back([&, i]() {
+      for (int j = 0; j < kNumBuffers; j++) {
+        size_t size = 1 + (j * 7919) % (256 * 1024);
+        Buffer b;
+        b.data = allocator->Allocate(size, &b.capacity);
+        memset(b.data, i, b.capacity);
+        buffers[i].push_back(b);
+        if (buffers[i].size() > 16) {
+          allocator->Free(buffers[i].front().data, buffers[i].front().capacity);
+          buffers[i].erase(buffers[i].begin());
+        }
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  threads.clear();
+  for (int i = 0; i < kNumThreads; i++) {
+    threads.emplace_back([&, i]() {
+      for (const auto& b : buffers[(i + 1) % kNumThreads]) {
+        for (size_t k = 0; k < b.capacity; k++) {
+          CHECK_EQ((i + 1) % kNumThreads, b.data[k]);
+        }
+        allocator->Free(b.data, b.capacity);
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  ASSERT_LE(allocator->central_cached_bytes(), 1024 * 1024);
+}
+
+} // namespace kudu
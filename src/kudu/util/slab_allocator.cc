@@ -0,0 +1,381 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/slab_allocator.h"
+
+#include <sys/mman.h>
+
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/gutil/bits.h"
+#include "kudu/gutil/dynamic_annotations.h"
+#include "kudu/gutil/port.h"
+#include "kudu/util/alignment.h"
+#include "kudu/util/errno.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/logging.h"
+#include "kudu/util/mem_tracker.h"
+
+DEFINE_int32(slab_allocator_thread_cache_kb, 1024,
+             "Number of kilobytes of freed buffers that each thread keeps "
+             "for reuse by the slab allocator");
+TAG_FLAG(slab_allocator_thread_cache_kb, advanced);
+TAG_FLAG(slab_allocator_thread_cache_kb, runtime);
+
+DEFINE_int32(slab_allocator_central_cache_mb, 64,
+             "Number of megabytes of freed buffers that the slab allocator "
+             "keeps for reuse by any thread, once the freeing thread's own "
+             "cache is full");
+TAG_FLAG(slab_allocator_central_cache_mb, advanced);
+TAG_FLAG(slab_allocator_central_cache_mb, runtime);
+
+DEFINE_string(slab_allocator_huge_pages, "none",
+              "Whether the buffers of the slab allocator of at least a huge "
+              "page (2MB), such as those of large batches of ops in the log "
+              "cache and the WAL, are backed by huge pages. One of 'none', "
+              "'transparent' (madvise(MADV_HUGEPAGE), which needs transparent "
+              "huge pages enabled in 'madvise' or 'always' mode) or 'explicit' "
+              "(MAP_HUGETLB, which needs pages reserved through "
+              "/proc/sys/vm/nr_hugepages). Explicit huge pages fall back to "
+              "transparent ones, and those to regular pages, when the kernel "
+              "has none to give. Buffers are rounded up to whole huge pages.");
+TAG_FLAG(slab_allocator_huge_pages, experimental);
+DEFINE_validator(slab_allocator_huge_pages,
+                 [](const char* /*flagname*/, const std::string& value) {
+                   return value == "none" || value == "transparent" ||
+                       value == "explicit";
+                 });
+
+using std::atomic;
+
+namespace kudu {
+
+namespace {
+
+// The smallest and biggest size classes are 2^kMinClassBits and
+// 2^kMaxClassBits bytes.
+const int kMinClassBits = 6;
+const int kMaxClassBits = 23;
+const int kNumClasses = 2 * (kMaxClassBits - kMinClassBits) + 1;
+
+const size_t kHugePageSize = 2 * 1024 * 1024;
+
+// Cached buffers are linked through their first bytes.
+void SetNext(uint8_t* buf, uint8_t* next) {
+  ASAN_UNPOISON_MEMORY_REGION(buf, sizeof(next));
+  memcpy(buf, &next, sizeof(next));
+}
+
+uint8_t* GetNext(const uint8_t* buf) {
+  uint8_t* next;
+  memcpy(&next, buf, sizeof(next));
+  return next;
+}
+
+} // anonymous namespace
+
+struct SlabAllocator::ThreadCache {
+  uint8_t* heads[kNumClasses] = {};
+  size_t bytes = 0;
+};
+
+struct SlabAllocator::CentralCache {
+  simple_spinlock lock;
+  uint8_t* head = nullptr;
+  // The caches of different classes are locked by different threads.
+  char padding[CACHELINE_SIZE];
+};
+
+// Releases the cache of a thread when it exits.
+struct SlabAllocator::ThreadCacheReleaser {
+  ~ThreadCacheReleaser();
+};
+
+thread_local SlabAllocator::ThreadCache* SlabAllocator::tls_cache_ = nullptr;
+thread_local bool SlabAllocator::tls_exited_ = false;
+
+SlabAllocator* SlabAllocator::Get() {
+  // Never destroyed: threads may free buffers during shutdown.
+  static SlabAllocator* allocator = new SlabAllocator();
+  return allocator;
+}
+
+SlabAllocator::SlabAllocator()
+    : mem_tracker_(MemTracker::FindOrCreateGlobalTracker(-1, "slab_allocator")),
+      central_(new CentralCache[kNumClasses]),
+      central_bytes_(0),
+      huge_page_tracker_(
+          MemTracker::CreateTracker(-1, "huge_pages", mem_tracker_)),
+      huge_page_fallbacks_(0) {}
+
+void* SlabAllocator::AllocateArenaBlock(size_t size) {
+  size_t capacity;
+  return Get()->Allocate(size, &capacity);
+}
+
+void SlabAllocator::FreeArenaBlock(void* block, size_t size) {
+  Get()->Free(static_cast<uint8_t*>(block), GetAllocationSize(size));
+}
+
+int SlabAllocator::SizeClass(size_t size) {
+  if (size <= (1ULL << kMinClassBits)) {
+    return 0;
+  }
+  if (size > (1ULL << kMaxClassBits)) {
+    return -1;
+  }
+  // 2^k < size <= 2^(k+1): round up to either 1.5 * 2^k or 2^(k+1).
+  int k = Bits::Log2Floor64(size - 1);
+  if (size <= (3ULL << (k - 1))) {
+    return 2 * (k - kMinClassBits) + 1;
+  }
+  return 2 * (k + 1 - kMinClassBits);
+}
+
+size_t SlabAllocator::ClassSize(int size_class) {
+  DCHECK_GE(size_class, 0);
+  DCHECK_LT(size_class, kNumClasses);
+  int bits = kMinClassBits + size_class / 2;
+  return (size_class % 2) ? (3ULL << (bits - 1)) : (1ULL << bits);
+}
+
+size_t SlabAllocator::GetAllocationSize(size_t size) {
+  int size_class = SizeClass(size);
+  return size_class < 0 ? size : ClassSize(size_class);
+}
+
+uint8_t* SlabAllocator::Allocate(size_t size, size_t* capacity) {
+  int size_class = SizeClass(size);
+  if (PREDICT_FALSE(size_class < 0)) {
+    *capacity = size;
+    return AllocateFromHeap(size);
+  }
+  *capacity = ClassSize(size_class);
+
+  uint8_t* buf = nullptr;
+  ThreadCache* tc = CurrentThreadCache();
+  if (tc != nullptr && tc->heads[size_class] != nullptr) {
+    buf = tc->heads[size_class];
+    tc->heads[size_class] = GetNext(buf);
+    tc->bytes -= *capacity;
+  } else {
+    buf = PopCentral(size_class);
+  }
+  if (buf == nullptr) {
+    return AllocateFromHeap(*capacity);
+  }
+  // The previous owner of the buffer may have poisoned parts of it.
+  ASAN_UNPOISON_MEMORY_REGION(buf, *capacity);
+  return buf;
+}
+
+void SlabAllocator::Free(uint8_t* buf, size_t capacity) {
+  int size_class = SizeClass(capacity);
+  if (PREDICT_FALSE(size_class < 0)) {
+    FreeToHeap(buf, capacity);
+    return;
+  }
+  DCHECK_EQ(capacity, ClassSize(size_class));
+
+  ThreadCache* tc = CurrentThreadCache();
+  if (tc != nullptr &&
+      tc->bytes + capacity <=
+          static_cast<size_t>(FLAGS_slab_allocator_thread_cache_kb) * 1024) {
+    SetNext(buf, tc->heads[size_class]);
+    tc->heads[size_class] = buf;
+    tc->bytes += capacity;
+    return;
+  }
+  if (!PushCentral(size_class, buf)) {
+    FreeToHeap(buf, capacity);
+  }
+}
+
+SlabAllocator::ThreadCache* SlabAllocator::CurrentThreadCache() {
+  if (PREDICT_TRUE(tls_cache_ != nullptr)) {
+    return tls_cache_;
+  }
+  if (tls_exited_) {
+    return nullptr;
+  }
+  // Registers the release of the cache at thread exit.
+  static thread_local ThreadCacheReleaser releaser;
+  (void)releaser;
+  tls_cache_ = new ThreadCache();
+  return tls_cache_;
+}
+
+SlabAllocator::ThreadCacheReleaser::~ThreadCacheReleaser() {
+  ThreadCache* tc = tls_cache_;
+  tls_cache_ = nullptr;
+  tls_exited_ = true;
+  if (tc != nullptr) {
+    SlabAllocator::Get()->ReleaseThreadCache(tc);
+  }
+}
+
+void SlabAllocator::ReleaseThreadCache(ThreadCache* tc) {
+  for (int c = 0; c < kNumClasses; c++) {
+    uint8_t* buf = tc->heads[c];
+    while (buf != nullptr) {
+      uint8_t* next = GetNext(buf);
+      if (!PushCentral(c, buf)) {
+        FreeToHeap(buf, ClassSize(c));
+      }
+      buf = next;
+    }
+  }
+  delete tc;
+}
+
+bool SlabAllocator::PushCentral(int size_class, uint8_t* buf) {
+  const int64_t size = ClassSize(size_class);
+  const int64_t limit =
+      static_cast<int64_t>(FLAGS_slab_allocator_central_cache_mb) * 1024 * 1024;
+  CentralCache* cc = &central_[size_class];
+  std::lock_guard<simple_spinlock> l(cc->lock);
+  if (central_bytes_.load(std::memory_order_relaxed) + size > limit) {
+    return false;
+  }
+  central_bytes_.fetch_add(size, std::memory_order_relaxed);
+  SetNext(buf, cc->head);
+  cc->head = buf;
+  return true;
+}
+
+uint8_t* SlabAllocator::PopCentral(int size_class) {
+  CentralCache* cc = &central_[size_class];
+  std::lock_guard<simple_spinlock> l(cc->lock);
+  uint8_t* buf = cc->head;
+  if (buf != nullptr) {
+    cc->head = GetNext(buf);
+    central_bytes_.fetch_sub(ClassSize(size_class), std::memory_order_relaxed);
+  }
+  return buf;
+}
+
+SlabAllocator::HugePages SlabAllocator::GetHugePagesMode() {
+  // The flag isn't changed at runtime, other than by tests.
+  const std::string& mode = FLAGS_slab_allocator_huge_pages;
+  if (mode == "explicit") {
+    return HugePages::EXPLICIT;
+  }
+  if (mode == "transparent") {
+    return HugePages::TRANSPARENT;
+  }
+  return HugePages::NONE;
+}
+
+uint8_t* SlabAllocator::AllocateFromHeap(size_t size) {
+  if (size >= kHugePageSize && GetHugePagesMode() != HugePages::NONE) {
+    uint8_t* buf = MapHugePages(size);
+    if (buf != nullptr) {
+      return buf;
+    }
+  }
+  mem_tracker_->Consume(size);
+  return new uint8_t[size];
+}
+
+void SlabAllocator::FreeToHeap(uint8_t* buf, size_t size) {
+  if (size >= kHugePageSize && MaybeUnmapHugePages(buf)) {
+    return;
+  }
+  delete[] buf;
+  mem_tracker_->Release(size);
+}
+
+uint8_t* SlabAllocator::MapHugePages(size_t size) {
+  const size_t mapped = KUDU_ALIGN_UP(size, kHugePageSize);
+  void* addr = MAP_FAILED;
+#if defined(__linux__)
+  if (GetHugePagesMode() == HugePages::EXPLICIT) {
+    addr = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (addr == MAP_FAILED) {
+      int err = errno;
+      huge_page_fallbacks_.fetch_add(1, std::memory_order_relaxed);
+      KLOG_EVERY_N_SECS(WARNING, 60)
+          << "Unable to map " << mapped << " bytes of explicit huge pages, "
+          << "falling back to transparent huge pages: " << ErrnoToString(err)
+          << THROTTLE_MSG;
+    }
+  }
+  if (addr == MAP_FAILED) {
+    // Transparent huge pages only back whole aligned huge pages, so map an
+    // extra one and trim the mapping to the alignment.
+    void* raw = mmap(nullptr, mapped + kHugePageSize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw != MAP_FAILED) {
+      uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+      uintptr_t aligned = KUDU_ALIGN_UP(start, kHugePageSize);
+      if (aligned > start) {
+        munmap(raw, aligned - start);
+      }
+      size_t tail = kHugePageSize - (aligned - start);
+      if (tail > 0) {
+        munmap(reinterpret_cast<void*>(aligned + mapped), tail);
+      }
+      addr = reinterpret_cast<void*>(aligned);
+      if (madvise(addr, mapped, MADV_HUGEPAGE) != 0) {
+        int err = errno;
+        munmap(addr, mapped);
+        addr = MAP_FAILED;
+        huge_page_fallbacks_.fetch_add(1, std::memory_order_relaxed);
+        KLOG_EVERY_N_SECS(WARNING, 60)
+            << "Unable to use transparent huge pages, falling back to "
+            << "regular pages: " << ErrnoToString(err) << THROTTLE_MSG;
+      }
+    }
+  }
+#endif
+  if (addr == MAP_FAILED) {
+    return nullptr;
+  }
+  {
+    std::lock_guard<simple_spinlock> l(huge_buffers_lock_);
+    huge_buffers_.emplace(static_cast<uint8_t*>(addr), mapped);
+  }
+  huge_page_tracker_->Consume(mapped);
+  return static_cast<uint8_t*>(addr);
+}
+
+bool SlabAllocator::MaybeUnmapHugePages(uint8_t* buf) {
+  size_t mapped;
+  {
+    std::lock_guard<simple_spinlock> l(huge_buffers_lock_);
+    auto it = huge_buffers_.find(buf);
+    if (it == huge_buffers_.end()) {
+      return false;
+    }
+    mapped = it->second;
+    huge_buffers_.erase(it);
+  }
+  ASAN_UNPOISON_MEMORY_REGION(buf, mapped);
+  PCHECK(munmap(buf, mapped) == 0);
+  huge_page_tracker_->Release(mapped);
+  return true;
+}
+
+} // namespace kudu
@@ -0,0 +1,164 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+
+#include <gtest/gtest_prod.h>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/util/locks.h"
+
+namespace kudu {
+
+class MemTracker;
+
+// An allocator of byte buffers that recycles freed buffers by size class,
+// used for message buffers whose sizes range from a couple hundred bytes
+// (heartbeats) to several megabytes (batches of ops).
+//
+// Requested sizes are rounded up to a size class: the powers of two from
+// 64 bytes to 8MB, and the midpoints 1.5 times each of them, so at most a
+// third of a buffer is wasted. Buffers larger than the biggest class are
+// allocated from the heap directly.
+//
+// A freed buffer goes to a cache local to the freeing thread if it has room
+// (--slab_allocator_thread_cache_kb), else to a cache shared by all threads
+// (--slab_allocator_central_cache_mb), else back to the heap. Allocations
+// take from the same caches in the same order. Reusing buffers of a handful
+// of sizes, instead of growing a new heap block at every doubling, keeps the
+// heap from fragmenting.
+//
+// Buffers of at least a huge page (2MB), such as those of large batches of ops,
+// may be backed by huge pages (--slab_allocator_huge_pages), which saves TLB
+// misses when walking them, e.g. to checksum or compress them. Should the
+// kernel have none to give, they fall back to regular pages.
+//
+// All memory held by the allocator, whether in use or cached, is accounted
+// for by the "slab_allocator" MemTracker, and that of the buffers backed by
+// huge pages by its "huge_pages" child.
+//
+// This class is thread-safe.
+class SlabAllocator {
+ public:
+  static SlabAllocator* Get();
+
+  // Returns a buffer of at least 'size' bytes, and sets '*capacity' to its
+  // actual size. The buffer must be freed with Free(buf, *capacity).
+  uint8_t* Allocate(size_t size, size_t* capacity);
+
+  // Returns 'buf', of size 'capacity' as set by Allocate(), to the allocator.
+  void Free(uint8_t* buf, size_t capacity);
+
+  // Returns the number of bytes held for reuse by the central cache.
+  int64_t central_cached_bytes() const {
+    return central_bytes_.load(std::memory_order_relaxed);
+  }
+
+  // Returns the size that a request for 'size' bytes is rounded up to.
+  static size_t GetAllocationSize(size_t size);
+
+  MemTracker* mem_tracker() const {
+    return mem_tracker_.get();
+  }
+
+  // Returns the number of buffers which were to be backed by huge pages, but
+  // had to fall back to smaller pages.
+  int64_t huge_page_fallbacks() const {
+    return huge_page_fallbacks_.load(std::memory_order_relaxed);
+  }
+
+  // Block allocation functions for google::protobuf::ArenaOptions, so that
+  // the blocks of an arena come from the allocator.
+  static void* AllocateArenaBlock(size_t size);
+  static void FreeArenaBlock(void* block, size_t size);
+
+ private:
+  FRIEND_TEST(SlabAllocatorTest, TestHugePages);
+
+  struct ThreadCache;
+  struct ThreadCacheReleaser;
+  struct CentralCache;
+
+  SlabAllocator();
+
+  // Returns the size class of a buffer of 'size' bytes, or -1 if it is too
+  // large for any class.
+  static int SizeClass(size_t size);
+
+  // Returns the buffer size of 'size_class'.
+  static size_t ClassSize(int size_class);
+
+  // Returns the cache of the calling thread, or nullptr if the thread is
+  // exiting.
+  ThreadCache* CurrentThreadCache();
+
+  // Moves the buffers of an exiting thread's cache to the central cache, or
+  // frees them.
+  void ReleaseThreadCache(ThreadCache* tc);
+
+  // Pushes 'buf' onto the central cache if it has room, returning false if
+  // not.
+  bool PushCentral(int size_class, uint8_t* buf);
+
+  // Pops a buffer of 'size_class' from the central cache, or returns nullptr.
+  uint8_t* PopCentral(int size_class);
+
+  uint8_t* AllocateFromHeap(size_t size);
+  void FreeToHeap(uint8_t* buf, size_t size);
+
+  // Maps a buffer of 'size' bytes backed by huge pages, as set by
+  // --slab_allocator_huge_pages, falling back from explicit to transparent
+  // huge pages. Returns nullptr if neither is available.
+  uint8_t* MapHugePages(size_t size);
+
+  // Unmaps 'buf' and returns true if it was mapped by MapHugePages().
+  bool MaybeUnmapHugePages(uint8_t* buf);
+
+  enum class HugePages { NONE, TRANSPARENT, EXPLICIT };
+
+  // Returns the mode set by --slab_allocator_huge_pages.
+  static HugePages GetHugePagesMode();
+
+  // Plain thread-locals, so that they stay valid while the thread-locals
+  // with destructors are destroyed: a faststring may be freed after its
+  // thread's cache is released.
+  static thread_local ThreadCache* tls_cache_;
+  static thread_local bool tls_exited_;
+
+  std::shared_ptr<MemTracker> mem_tracker_;
+  std::unique_ptr<CentralCache[]> central_;
+  std::atomic<int64_t> central_bytes_;
+
+  std::shared_ptr<MemTracker> huge_page_tracker_;
+  std::atomic<int64_t> huge_page_fallbacks_;
+
+  // The buffers mapped by MapHugePages(), and the sizes of their mappings.
+  // Only buffers of a huge page or more are looked up here, which are few and
+  // far between compared to the others.
+  simple_spinlock huge_buffers_lock_;
+  std::unordered_map<uint8_t*, size_t> huge_buffers_;
+
+  DISALLOW_COPY_AND_ASSIGN(SlabAllocator);
+};
+
+} // namespace kudu
@@ -58,4 +58,23 @@ TEST(SliceTest, TestSliceMap) {
   }
 }
 
+TEST(SliceTest, TestFindFirstNonZeroByte) {
+  // Cover the vectorized, word and byte at a time paths, at every alignment
+  // of the non-zero byte.
+  const size_t kLen = 100;
+  uint8_t buf[kLen + 1] = {0};
+  for (size_t start = 0; start < 16; start++) {
+    for (size_t len = 0; start + len <= kLen; len++) {
+      Slice s(buf + start, len);
+      ASSERT_EQ(len, FindFirstNonZeroByte(s));
+      ASSERT_EQ(IsAllZeros(s), FindFirstNonZeroByte(s) == s.size());
+      for (size_t i = 0; i < len; i++) {
+        buf[start + i] = 0x80;
+        ASSERT_EQ(i, FindFirstNonZeroByte(s)) << start << " " << len;
+        buf[start + i] = 0;
+      }
+    }
+  }
+}
+
 } // namespace kudu
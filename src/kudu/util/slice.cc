@@ -18,6 +18,9 @@
 #include "kudu/util/slice.h"
 
 #include <cctype>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/stringprintf.h"
@@ -101,4 +104,35 @@ bool IsAllZeros(const Slice& s) {
   return true;
 }
 
+size_t FindFirstNonZeroByte(const Slice& s) {
+  const uint8_t* const start = s.data();
+  const uint8_t* p = start;
+  const uint8_t* const end = start + s.size();
+
+#ifdef __SSE2__
+  // Compare 16 bytes at a time against zero: a bit of the mask is clear for
+  // each non-zero byte.
+  const __m128i zero = _mm_setzero_si128();
+  while (end - p >= 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, zero));
+    if (mask != 0xffff) {
+      return (p - start) + __builtin_ctz(~mask);
+    }
+    p += 16;
+  }
+#endif
+
+  while (end - p >= 8) {
+    if (UNALIGNED_LOAD64(p) != 0) {
+      break;
+    }
+    p += 8;
+  }
+  while (p < end && *p == '\0') {
+    p++;
+  }
+  return p - start;
+}
+
 } // namespace kudu
@@ -308,6 +308,13 @@ ATTRIBUTE_NO_SANITIZE_THREAD
 #endif
 bool IsAllZeros(const Slice& s);
 
+// Returns the offset of the first non-zero byte of 's', or s.size() if 's' is
+// all zeros. Same TSAN exemption as IsAllZeros().
+#ifdef KUDU_HEADERS_NO_STUBS
+ATTRIBUTE_NO_SANITIZE_THREAD
+#endif
+size_t FindFirstNonZeroByte(const Slice& s);
+
 /// @brief STL map whose keys are Slices.
 ///
 /// An example of usage:
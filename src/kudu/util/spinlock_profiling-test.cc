@@ -18,6 +18,7 @@
 #include <cstdint>
 #include <ostream>
 #include <string>
+#include <thread>
 
 #include <glog/logging.h>
 #include <gtest/gtest.h>
@@ -25,6 +26,8 @@
 #include "kudu/gutil/integral_types.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/spinlock.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/spinlock_profiling.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
@@ -79,4 +82,49 @@ TEST_F(SpinLockProfilingTest, TestStackCollection) {
   ASSERT_EQ(0, dropped);
 }
 
+// Mutex waits are recorded whenever synchronization profiling is on, while
+// ConditionVariable waits are only recorded when idle waits were requested.
+TEST_F(SpinLockProfilingTest, TestBlockingWaitCollection) {
+  StartSynchronizationProfiling();
+  ASSERT_FALSE(IsIdleWaitProfilingEnabled());
+  SubmitBlockingWaitProfileData(1000, /*idle_wait=*/false);
+  SubmitBlockingWaitProfileData(1000, /*idle_wait=*/true);
+  StopSynchronizationProfiling();
+  std::ostringstream str;
+  int64_t dropped = 0;
+  FlushSynchronizationProfile(&str, &dropped);
+  std::string s = str.str();
+  ASSERT_STR_CONTAINS(s, " 1 @ ");
+  ASSERT_STR_NOT_CONTAINS(s, " 2 @ ");
+
+  StartSynchronizationProfiling(/*include_idle_waits=*/true);
+  ASSERT_TRUE(IsIdleWaitProfilingEnabled());
+  for (int i = 0; i < 2; i++) {
+    SubmitBlockingWaitProfileData(1000, /*idle_wait=*/true);
+  }
+  StopSynchronizationProfiling(/*include_idle_waits=*/true);
+  ASSERT_FALSE(IsIdleWaitProfilingEnabled());
+  str.str("");
+  FlushSynchronizationProfile(&str, &dropped);
+  ASSERT_STR_CONTAINS(str.str(), " 2 @ ");
+  ASSERT_EQ(0, dropped);
+}
+
+// Waiting on an rw_spinlock must be accounted for just like waiting on a
+// base::SpinLock.
+TEST_F(SpinLockProfilingTest, TestRwSpinlockContention) {
+  InitSpinLockContentionProfiling();
+  uint64_t before = GetSpinLockContentionMicros();
+  rw_spinlock lock;
+  lock.lock();
+  std::thread reader([&]() {
+    lock.lock_shared();
+    lock.unlock_shared();
+  });
+  SleepFor(MonoDelta::FromMilliseconds(10));
+  lock.unlock();
+  reader.join();
+  ASSERT_GT(GetSpinLockContentionMicros(), before);
+}
+
 } // namespace kudu
@@ -141,6 +141,7 @@ class ContentionStacks {
 };
 
 Atomic32 g_profiling_enabled = 0;
+Atomic32 g_idle_wait_profiling_enabled = 0;
 ContentionStacks* g_contention_stacks = nullptr;
 
 void ContentionStacks::AddStack(const StackTrace& s, int64_t cycles) {
@@ -294,17 +295,53 @@ uint64_t GetSpinLockContentionMicros() {
   return implicit_cast<int64_t>(micros);
 }
 
-void StartSynchronizationProfiling() {
+void StartSynchronizationProfiling(bool include_idle_waits) {
   InitSpinLockContentionProfiling();
   base::subtle::Barrier_AtomicIncrement(&g_profiling_enabled, 1);
+  if (include_idle_waits) {
+    base::subtle::Barrier_AtomicIncrement(&g_idle_wait_profiling_enabled, 1);
+  }
+}
+
+void SubmitBlockingWaitProfileData(int64_t wait_micros, bool idle_wait) {
+  Atomic32* enabled =
+      idle_wait ? &g_idle_wait_profiling_enabled : &g_profiling_enabled;
+  if (PREDICT_TRUE(!base::subtle::Acquire_Load(enabled)) || wait_micros <= 0) {
+    return;
+  }
+
+  static __thread bool in_func = false;
+  if (in_func)
+    return; // non-re-entrant
+  in_func = true;
+
+  // The contention profile is expressed in cycles, like the spinlock samples
+  // it shares the buffer with.
+  StackTrace stack;
+  stack.Collect();
+  int64_t wait_cycles = static_cast<int64_t>(
+      wait_micros * (base::CyclesPerSecond() / kMicrosPerSecond));
+  DCHECK_NOTNULL(g_contention_stacks)->AddStack(stack, wait_cycles);
+
+  in_func = false;
+}
+
+bool IsIdleWaitProfilingEnabled() {
+  return base::subtle::NoBarrier_Load(&g_idle_wait_profiling_enabled) > 0;
 }
 
 void FlushSynchronizationProfile(std::ostringstream* out, int64_t* drop_count) {
   CHECK_NOTNULL(g_contention_stacks)->Flush(out, drop_count);
 }
 
-void StopSynchronizationProfiling() {
+void StopSynchronizationProfiling(bool include_idle_waits) {
   InitSpinLockContentionProfiling();
+  if (include_idle_waits) {
+    CHECK_GE(
+        base::subtle::Barrier_AtomicIncrement(
+            &g_idle_wait_profiling_enabled, -1),
+        0);
+  }
   CHECK_GE(base::subtle::Barrier_AtomicIncrement(&g_profiling_enabled, -1), 0);
 }
 
@@ -45,10 +45,24 @@ void RegisterSpinLockContentionMetrics(
 
 // Enable process-wide synchronization profiling.
 //
-// While profiling is enabled, spinlock contention will be recorded in a buffer.
-// The caller should periodically call FlushSynchronizationProfile() to empty
-// the buffer, or else profiles may be dropped.
-void StartSynchronizationProfiling();
+// While profiling is enabled, spinlock and Mutex contention will be recorded in
+// a buffer. The caller should periodically call FlushSynchronizationProfile()
+// to empty the buffer, or else profiles may be dropped.
+//
+// If 'include_idle_waits' is true, time spent blocked in ConditionVariable
+// waits is recorded as well. Most of those waits are threads idling until work
+// arrives, so they are only useful when looking for where a thread is stuck.
+void StartSynchronizationProfiling(bool include_idle_waits = false);
+
+// Record that the calling thread was blocked for 'wait_micros' in a Mutex
+// acquisition or, if 'idle_wait' is true, in a ConditionVariable wait. Does
+// nothing unless synchronization profiling (including idle waits, for the
+// latter) is enabled.
+void SubmitBlockingWaitProfileData(int64_t wait_micros, bool idle_wait);
+
+// Return true if ConditionVariable waits are currently being profiled.
+// Allows callers to skip timing waits in the common case.
+bool IsIdleWaitProfilingEnabled();
 
 // Flush the current buffer of contention profile samples to the given stream.
 //
@@ -66,8 +80,9 @@ void StartSynchronizationProfiling();
 // respect to the returned samples.
 void FlushSynchronizationProfile(std::ostringstream* out, int64_t* drop_count);
 
-// Stop collecting contention profiles.
-void StopSynchronizationProfiling();
+// Stop collecting contention profiles. 'include_idle_waits' must match the
+// value passed to the corresponding StartSynchronizationProfiling() call.
+void StopSynchronizationProfiling(bool include_idle_waits = false);
 
 } // namespace kudu
 #endif /* KUDU_UTIL_SPINLOCK_PROFILING_H */
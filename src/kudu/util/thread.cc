@@ -20,6 +20,7 @@
 #include "kudu/util/thread.h"
 
 #if defined(__linux__)
+#include <sched.h>
 #include <sys/capability.h>
 #include <sys/prctl.h>
 #endif // defined(__linux__)
@@ -169,6 +170,48 @@ static shared_ptr<ThreadMgr> thread_manager;
 // Controls the single (lazy) initialization of thread_manager.
 static GoogleOnceType once = GOOGLE_ONCE_INIT;
 
+static int set_system_thread_affinity(pid_t tid, const vector<int>& cpus) {
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (cpus.empty()) {
+    int num_cpus = static_cast<int>(sysconf(_SC_NPROCESSORS_CONF));
+    for (int cpu = 0; cpu < num_cpus && cpu < CPU_SETSIZE; cpu++) {
+      CPU_SET(cpu, &set);
+    }
+  } else {
+    for (int cpu : cpus) {
+      if (cpu >= CPU_SETSIZE) {
+        return EINVAL;
+      }
+      CPU_SET(cpu, &set);
+    }
+  }
+  return sched_setaffinity(tid, sizeof(set), &set) == 0 ? 0 : errno;
+#else
+  return ENOTSUP;
+#endif
+}
+
+static string get_system_thread_affinity(pid_t tid) {
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(tid, sizeof(set), &set) != 0) {
+    return "";
+  }
+  vector<int> cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &set)) {
+      cpus.push_back(cpu);
+    }
+  }
+  return CpuListToString(cpus);
+#else
+  return "";
+#endif
+}
+
 // A singleton class that tracks all live threads, and groups them together for
 // easy auditing. Used only by Thread.
 class ThreadMgr {
@@ -204,10 +247,17 @@ class ThreadMgr {
 
   void SetToDefaultPriority(Thread* thread);
 
+  Status ChangeThreadAffinity(string category, vector<int> cpus);
+
+  void SetToDefaultAffinity(Thread* thread);
+
  private:
   // Default thread priority for each category
   map<string, int> category2priority_;
 
+  // Default CPU affinity for each category
+  map<string, vector<int>> category2affinity_;
+
   // A ThreadCategory is a set of threads that are logically related.
   // TODO: unordered_map is incompatible with pthread_t, but would be more
   // efficient here.
@@ -370,7 +420,9 @@ void ThreadMgr::PrintThreadCategoryRows(
     (*output) << "<tr><td>" << thread.second.name() << "</td><td>"
               << (static_cast<double>(stats.user_ns) / 1e9) << "</td><td>"
               << (static_cast<double>(stats.kernel_ns) / 1e9) << "</td><td>"
-              << (static_cast<double>(stats.iowait_ns) / 1e9) << "</td></tr>";
+              << (static_cast<double>(stats.iowait_ns) / 1e9) << "</td><td>"
+              << get_system_thread_affinity(thread.second.thread_id())
+              << "</td></tr>";
   }
 }
 
@@ -405,7 +457,7 @@ void ThreadMgr::ThreadPathHandler(
     (*output)
         << "<thead><tr><th>Thread name</th><th>Cumulative User CPU(s)</th>"
         << "<th>Cumulative Kernel CPU(s)</th>"
-        << "<th>Cumulative IO-wait(s)</th></tr></thead>";
+        << "<th>Cumulative IO-wait(s)</th><th>CPU affinity</th></tr></thead>";
     (*output) << "<tbody>\n";
 
     for (const ThreadCategory* category : categories_to_print) {
@@ -635,6 +687,7 @@ void* Thread::SuperviseThread(void* arg) {
   thread_manager->SetThreadName(name, t->tid_);
   thread_manager->AddThread(pthread_self(), name, t->category(), t->tid_);
   thread_manager->SetToDefaultPriority(t);
+  thread_manager->SetToDefaultAffinity(t);
 
   // FinishThread() is guaranteed to run (even if functor_ throws an
   // exception) because pthread_cleanup_push() creates a scoped object
@@ -714,6 +767,8 @@ Status ThreadMgr::ShowThreadStatus(vector<ThreadDescriptor>* threads) {
     for (auto thread_info : category) {
       int pri = get_system_thread_priority(thread_info.second.thread_id());
       thread_info.second.setPriority(pri);
+      thread_info.second.setCpuAffinity(
+          get_system_thread_affinity(thread_info.second.thread_id()));
       threads->push_back(thread_info.second);
     }
   }
@@ -747,6 +802,42 @@ void ThreadMgr::SetToDefaultPriority(Thread* thread) {
   }
 }
 
+Status ThreadMgr::ChangeThreadAffinity(string category, vector<int> cpus) {
+  MutexLock l(lock_);
+  if (thread_categories_.count(category)) {
+    for (auto const& thread_info : thread_categories_[category]) {
+      RETURN_NOT_OK(SetThreadAffinity(thread_info.second.thread_id(), cpus));
+    }
+  }
+  // Change the default for particular pool
+  category2affinity_[category] = std::move(cpus);
+  return Status::OK();
+}
+
+void ThreadMgr::SetToDefaultAffinity(Thread* thread) {
+  MutexLock l(lock_);
+  auto it = category2affinity_.find(thread->category());
+  if (it != category2affinity_.end()) {
+    WARN_NOT_OK(
+        SetThreadAffinity(thread->tid(), it->second),
+        "Could not set CPU affinity of thread " + thread->name());
+  }
+}
+
+Status SetThreadAffinity(int64_t tid, const vector<int>& cpus) {
+  int ret = set_system_thread_affinity(tid, cpus);
+  if (ret != 0) {
+    return Status::RuntimeError(
+        "Can not change thread CPU affinity", strerror(ret), ret);
+  }
+  return Status::OK();
+}
+
+Status GlobalChangeThreadAffinity(string category, vector<int> cpus) {
+  return thread_manager->ChangeThreadAffinity(
+      std::move(category), std::move(cpus));
+}
+
 Status GlobalShowThreadStatus(vector<ThreadDescriptor>* threads) {
   return thread_manager->ShowThreadStatus(threads);
 }
@@ -31,6 +31,7 @@
 #include <cstdint>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <boost/bind.hpp> // IWYU pragma: keep
 #include <boost/function.hpp> // IWYU pragma: keep
@@ -468,6 +469,13 @@ class ThreadDescriptor {
   void setPriority(int p) {
     priority_ = p;
   }
+  // The CPUs the thread may run on, in the format of CpuListToString().
+  const std::string& cpu_affinity() const {
+    return cpu_affinity_;
+  }
+  void setCpuAffinity(std::string cpus) {
+    cpu_affinity_ = std::move(cpus);
+  }
 
  private:
   // Thread name
@@ -481,6 +489,9 @@ class ThreadDescriptor {
 
   // Thread priority in NICE value
   int priority_;
+
+  // CPUs the thread may run on
+  std::string cpu_affinity_;
 };
 
 // Show the status of all kudu threads, see ThreadDescriptor for what detailed
@@ -498,6 +509,18 @@ Status GlobalShowThreadStatus(std::vector<ThreadDescriptor>* threads);
 // @param priority thread priority based on nice. Should be -20 to 19
 // @return Status:OK if succeed
 Status GlobalChangeThreadPriority(std::string category, int priority);
+
+// Restrict the thread with OS pid 'tid' to run on 'cpus' only. An empty set
+// lets it run on all CPUs again.
+Status SetThreadAffinity(int64_t tid, const std::vector<int>& cpus);
+
+// Change the CPU affinity of a particular category, like
+// GlobalChangeThreadPriority() does for priorities. See SetThreadAffinity().
+//
+// @param category In the other words, thread pool name
+// @param cpus CPUs the threads of 'category' may run on
+// @return Status:OK if succeed
+Status GlobalChangeThreadAffinity(std::string category, std::vector<int> cpus);
 } // namespace kudu
 
 #endif /* KUDU_UTIL_THREAD_H */
@@ -52,6 +52,7 @@
 #include "kudu/util/random.h"
 #include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/status.h"
+#include "kudu/util/stopwatch.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
 #include "kudu/util/threadpool.h"
@@ -482,6 +483,97 @@ TEST_F(ThreadPoolTest, TestMetrics) {
   ASSERT_EQ(6, all_metrics[0].run_time_us_histogram->TotalCount());
 }
 
+// Test that high priority tasks are dispatched before the normal ones queued
+// by other tokens.
+TEST_F(ThreadPoolTest, TestHighPriorityTasks) {
+  ASSERT_OK(RebuildPoolWithMinMax(1, 1));
+  unique_ptr<ThreadPoolToken> t1 =
+      pool_->NewToken(ThreadPool::ExecutionMode::SERIAL);
+  unique_ptr<ThreadPoolToken> t2 =
+      pool_->NewToken(ThreadPool::ExecutionMode::SERIAL);
+  unique_ptr<ThreadPoolToken> t3 =
+      pool_->NewToken(ThreadPool::ExecutionMode::CONCURRENT);
+
+  // Keep the only worker busy until all the tasks are queued.
+  CountDownLatch started(1);
+  CountDownLatch latch(1);
+  simple_spinlock lock;
+  string order;
+  ASSERT_OK(t1->SubmitFunc([&started, &latch]() {
+    started.CountDown();
+    latch.Wait();
+  }));
+  started.Wait();
+  ASSERT_OK(t1->SubmitFunc([&]() {
+    std::lock_guard<simple_spinlock> l(lock);
+    order += "a";
+  }));
+  ASSERT_OK(t2->SubmitFunc([&]() {
+    std::lock_guard<simple_spinlock> l(lock);
+    order += "b";
+  }));
+  ASSERT_OK(t3->SubmitFunc(
+      [&]() {
+        std::lock_guard<simple_spinlock> l(lock);
+        order += "C";
+      },
+      ThreadPool::Priority::HIGH));
+  ASSERT_OK(t2->SubmitFunc(
+      [&]() {
+        std::lock_guard<simple_spinlock> l(lock);
+        order += "B";
+      },
+      ThreadPool::Priority::HIGH));
+  latch.CountDown();
+  pool_->Wait();
+
+  // The high priority tasks jump ahead of the other tokens' tasks, but those
+  // of a SERIAL token still run in submission order.
+  ASSERT_EQ("CbBa", order);
+}
+
+// Test that with a fairness quantum, a token with long tasks doesn't get a
+// turn for each of them while a token with short tasks is waiting.
+TEST_F(ThreadPoolTest, TestFairnessQuantum) {
+  ASSERT_OK(RebuildPoolWithBuilder(
+      ThreadPoolBuilder(kDefaultPoolName)
+          .set_min_threads(1)
+          .set_max_threads(1)
+          .set_fairness_quantum(MonoDelta::FromMilliseconds(1))));
+  unique_ptr<ThreadPoolToken> slow =
+      pool_->NewToken(ThreadPool::ExecutionMode::SERIAL);
+  unique_ptr<ThreadPoolToken> fast =
+      pool_->NewToken(ThreadPool::ExecutionMode::SERIAL);
+
+  // Keep the only worker busy until all the tasks are queued.
+  CountDownLatch started(1);
+  CountDownLatch latch(1);
+  ASSERT_OK(pool_->SubmitFunc([&started, &latch]() {
+    started.CountDown();
+    latch.Wait();
+  }));
+  started.Wait();
+  simple_spinlock lock;
+  string order;
+  for (int i = 0; i < 5; i++) {
+    ASSERT_OK(slow->SubmitFunc([&]() {
+      SleepFor(MonoDelta::FromMilliseconds(10));
+      std::lock_guard<simple_spinlock> l(lock);
+      order += "s";
+    }));
+    ASSERT_OK(fast->SubmitFunc([&]() {
+      std::lock_guard<simple_spinlock> l(lock);
+      order += "f";
+    }));
+  }
+  latch.CountDown();
+  pool_->Wait();
+
+  // After its first task, the slow token is in debt until the fast one is
+  // done.
+  ASSERT_EQ("sfffffssss", order);
+}
+
 // Test that a thread pool will crash if asked to run its own blocking
 // functions in a pool thread.
 //
@@ -537,6 +629,101 @@ TEST_F(ThreadPoolTest, TestSlowDestructor) {
   ASSERT_LT((MonoTime::Now() - start).ToSeconds(), 5);
 }
 
+// Test that a work stealing pool runs tokenless tasks, including those that
+// workers submit to themselves, alongside the tasks of its tokens.
+TEST_F(ThreadPoolTest, TestWorkStealing) {
+  ASSERT_OK(RebuildPoolWithBuilder(ThreadPoolBuilder(kDefaultPoolName)
+                                       .set_max_threads(4)
+                                       .set_work_stealing(true)));
+  ASSERT_EQ(4, pool_->num_threads());
+
+  const int kNumTasks = 1000;
+  atomic<int> counter(0);
+  ThreadPool* pool = pool_.get();
+  for (int i = 0; i < kNumTasks; i++) {
+    ASSERT_OK(pool_->SubmitFunc([pool, &counter]() {
+      counter++;
+      CHECK_OK(pool->SubmitFunc([&counter]() { counter++; }));
+    }));
+  }
+  unique_ptr<ThreadPoolToken> t =
+      pool_->NewToken(ThreadPool::ExecutionMode::SERIAL);
+  string result;
+  for (char c = 'a'; c < 'f'; c++) {
+    ASSERT_OK(t->SubmitFunc([&result, c]() { result += c; }));
+  }
+  pool_->Wait();
+  ASSERT_EQ(2 * kNumTasks, counter);
+  ASSERT_EQ("abcde", result);
+
+  // Tasks still queued at shutdown are dropped, and no more are accepted.
+  CountDownLatch started(4);
+  CountDownLatch latch(1);
+  for (int i = 0; i < 4; i++) {
+    ASSERT_OK(pool_->SubmitFunc([&started, &latch]() {
+      started.CountDown();
+      latch.Wait();
+    }));
+  }
+  started.Wait();
+  for (int i = 0; i < kNumTasks; i++) {
+    ASSERT_OK(pool_->SubmitFunc([&counter]() { counter++; }));
+  }
+  thread shutdown([&]() { pool_->Shutdown(); });
+  AssertEventually([&]() {
+    ASSERT_TRUE(pool_->SubmitFunc([]() {}).IsServiceUnavailable());
+  });
+  NO_PENDING_FATALS();
+  latch.CountDown();
+  shutdown.join();
+  ASSERT_EQ(2 * kNumTasks, counter);
+  t.reset();
+}
+
+// Compares the throughput of short tokenless tasks in the default and the
+// work stealing pools, with the number of submitting threads as parameter.
+class ThreadPoolSubmittersTest : public ThreadPoolTest,
+                                 public testing::WithParamInterface<int> {};
+
+INSTANTIATE_TEST_CASE_P(
+    Submitters,
+    ThreadPoolSubmittersTest,
+    ::testing::Values(1, 2, 4, 8, 16, 32, 64));
+
+TEST_P(ThreadPoolSubmittersTest, TestSubmitThroughput) {
+  const int kNumSubmitters = GetParam();
+  const int kNumTasks = AllowSlowTests() ? 1000000 : 50000;
+  const int kTasksPerSubmitter = kNumTasks / kNumSubmitters;
+
+  for (bool work_stealing : {false, true}) {
+    ASSERT_OK(RebuildPoolWithBuilder(ThreadPoolBuilder(kDefaultPoolName)
+                                         .set_max_threads(8)
+                                         .set_work_stealing(work_stealing)));
+    atomic<int> counter(0);
+    LOG_TIMING(
+        INFO,
+        Substitute(
+            "running $0 tasks from $1 submitters with work stealing $2",
+            kTasksPerSubmitter * kNumSubmitters,
+            kNumSubmitters,
+            work_stealing ? "on" : "off")) {
+      vector<thread> submitters;
+      for (int i = 0; i < kNumSubmitters; i++) {
+        submitters.emplace_back([&]() {
+          for (int j = 0; j < kTasksPerSubmitter; j++) {
+            CHECK_OK(pool_->SubmitFunc([&counter]() { counter++; }));
+          }
+        });
+      }
+      for (auto& submitter : submitters) {
+        submitter.join();
+      }
+      pool_->Wait();
+    }
+    ASSERT_EQ(kTasksPerSubmitter * kNumSubmitters, counter);
+  }
+}
+
 // For test cases that should run with both kinds of tokens.
 class ThreadPoolTestTokenTypes
     : public ThreadPoolTest,
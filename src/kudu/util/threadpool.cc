@@ -17,13 +17,16 @@
 
 #include "kudu/util/threadpool.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <deque>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <boost/function.hpp> // IWYU pragma: keep
 #include <glog/logging.h>
@@ -46,8 +49,22 @@ using std::deque;
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
+using std::vector;
 using strings::Substitute;
 
+namespace {
+
+// The work stealing pool whose worker is the current thread, if any, and the
+// worker's index in it.
+__thread const ThreadPool* tls_worker_pool = nullptr;
+__thread int tls_worker_idx = -1;
+
+// The most tokenless tasks a worker of a work stealing pool runs before
+// turning to the token tasks.
+const int kWorkerQueueBatchSize = 64;
+
+} // anonymous namespace
+
 ////////////////////////////////////////////////////////
 // FunctionRunnable
 ////////////////////////////////////////////////////////
@@ -90,7 +107,8 @@ ThreadPoolBuilder::ThreadPoolBuilder(string name)
       min_threads_(0),
       max_threads_(base::NumCPUs()),
       max_queue_size_(std::numeric_limits<int>::max()),
-      idle_timeout_(MonoDelta::FromMilliseconds(500)) {}
+      idle_timeout_(MonoDelta::FromMilliseconds(500)),
+      work_stealing_(false) {}
 
 ThreadPoolBuilder& ThreadPoolBuilder::set_trace_metric_prefix(
     const string& prefix) {
@@ -126,6 +144,22 @@ ThreadPoolBuilder& ThreadPoolBuilder::set_metrics(ThreadPoolMetrics metrics) {
   return *this;
 }
 
+ThreadPoolBuilder& ThreadPoolBuilder::set_cpu_affinity(vector<int> cpus) {
+  cpu_affinity_ = std::move(cpus);
+  return *this;
+}
+
+ThreadPoolBuilder& ThreadPoolBuilder::set_fairness_quantum(
+    const MonoDelta& quantum) {
+  fairness_quantum_ = quantum;
+  return *this;
+}
+
+ThreadPoolBuilder& ThreadPoolBuilder::set_work_stealing(bool work_stealing) {
+  work_stealing_ = work_stealing;
+  return *this;
+}
+
 Status ThreadPoolBuilder::Build(gscoped_ptr<ThreadPool>* pool) const {
   pool->reset(new ThreadPool(*this));
   RETURN_NOT_OK((*pool)->Init());
@@ -144,6 +178,8 @@ ThreadPoolToken::ThreadPoolToken(
       metrics_(std::move(metrics)),
       pool_(pool),
       state_(State::IDLE),
+      num_high_priority_entries_(0),
+      deficit_us_(0),
       not_running_cond_(&pool->lock_),
       active_threads_(0) {}
 
@@ -156,12 +192,16 @@ Status ThreadPoolToken::SubmitClosure(Closure c) {
   return Submit(std::make_shared<ClosureRunnable>(std::move(c)));
 }
 
-Status ThreadPoolToken::SubmitFunc(boost::function<void()> f) {
-  return Submit(std::make_shared<FunctionRunnable>(std::move(f)));
+Status ThreadPoolToken::SubmitFunc(
+    boost::function<void()> f,
+    ThreadPool::Priority priority) {
+  return Submit(std::make_shared<FunctionRunnable>(std::move(f)), priority);
 }
 
-Status ThreadPoolToken::Submit(shared_ptr<Runnable> r) {
-  return pool_->DoSubmit(std::move(r), this);
+Status ThreadPoolToken::Submit(
+    shared_ptr<Runnable> r,
+    ThreadPool::Priority priority) {
+  return pool_->DoSubmit(std::move(r), this, priority);
 }
 
 void ThreadPoolToken::Shutdown() {
@@ -174,6 +214,7 @@ void ThreadPoolToken::Shutdown() {
   // also prevents lock inversions.
   std::deque<ThreadPool::Task> to_release = std::move(entries_);
   pool_->total_queued_tasks_ -= to_release.size();
+  num_high_priority_entries_ = 0;
 
   switch (state()) {
     case State::IDLE:
@@ -190,11 +231,13 @@ void ThreadPoolToken::Shutdown() {
       // Plus doing it this way (rather than switching to QUIESCING and waiting
       // for a worker thread to process the queue entry) helps retain state
       // transition symmetry with ThreadPool::Shutdown.
-      for (auto it = pool_->queue_.begin(); it != pool_->queue_.end();) {
-        if (*it == this) {
-          it = pool_->queue_.erase(it);
-        } else {
-          it++;
+      for (auto* queue : {&pool_->queue_, &pool_->high_priority_queue_}) {
+        for (auto it = queue->begin(); it != queue->end();) {
+          if (*it == this) {
+            it = queue->erase(it);
+          } else {
+            it++;
+          }
         }
       }
 
@@ -286,6 +329,8 @@ void ThreadPoolToken::Transition(State new_state) {
   switch (new_state) {
     case State::IDLE:
     case State::QUIESCED:
+      // A token doesn't keep the credit it didn't use, but keeps its debt.
+      deficit_us_ = std::min<int64_t>(deficit_us_, 0);
       not_running_cond_.Broadcast();
       break;
     default:
@@ -323,6 +368,12 @@ ThreadPool::ThreadPool(const ThreadPoolBuilder& builder)
       max_threads_(builder.max_threads_),
       max_queue_size_(builder.max_queue_size_),
       idle_timeout_(builder.idle_timeout_),
+      cpu_affinity_(builder.cpu_affinity_),
+      fairness_quantum_us_(
+          builder.fairness_quantum_.Initialized()
+              ? builder.fairness_quantum_.ToMicroseconds()
+              : 0),
+      work_stealing_(builder.work_stealing_),
       pool_status_(Status::Uninitialized("The pool was not initialized.")),
       idle_cond_(&lock_),
       no_threads_cond_(&lock_),
@@ -330,6 +381,11 @@ ThreadPool::ThreadPool(const ThreadPoolBuilder& builder)
       num_threads_pending_start_(0),
       active_threads_(0),
       total_queued_tasks_(0),
+      num_worker_queue_tasks_(0),
+      num_worker_queue_tasks_outstanding_(0),
+      next_worker_queue_(0),
+      next_worker_idx_(0),
+      num_idle_threads_(0),
       tokenless_(NewToken(ExecutionMode::CONCURRENT)),
       metrics_(builder.metrics_) {
   string prefix = !builder.trace_metric_prefix_.empty()
@@ -340,6 +396,12 @@ ThreadPool::ThreadPool(const ThreadPoolBuilder& builder)
       TraceMetrics::InternName(prefix + ".queue_time_us");
   run_wall_time_trace_metric_name_ =
       TraceMetrics::InternName(prefix + ".run_wall_time_us");
+
+  if (work_stealing_) {
+    for (int i = 0; i < max_threads_; i++) {
+      worker_queues_.emplace_back(new WorkerQueue());
+    }
+  }
 }
 
 ThreadPool::~ThreadPool() {
@@ -356,8 +418,14 @@ Status ThreadPool::Init() {
     return Status::NotSupported("The thread pool is already initialized");
   }
   pool_status_ = Status::OK();
-  num_threads_pending_start_ = min_threads_;
-  for (int i = 0; i < min_threads_; i++) {
+  for (auto& q : worker_queues_) {
+    std::lock_guard<simple_spinlock> l(q->lock);
+    q->closed = false;
+  }
+  // A work stealing pool runs with all of its workers, as each owns a queue.
+  const int num_threads = work_stealing_ ? max_threads_ : min_threads_;
+  num_threads_pending_start_ = num_threads;
+  for (int i = 0; i < num_threads; i++) {
     Status status = CreateThread();
     if (!status.ok()) {
       Shutdown();
@@ -382,11 +450,28 @@ void ThreadPool::Shutdown() {
   // wanting to access the ThreadPool. The task's destructors may acquire
   // locks, etc, so this also prevents lock inversions.
   queue_.clear();
+  high_priority_queue_.clear();
   std::deque<std::deque<Task>> to_release;
+  int64_t num_dropped = 0;
+  for (auto& q : worker_queues_) {
+    std::lock_guard<simple_spinlock> l(q->lock);
+    q->closed = true;
+    if (!q->tasks.empty()) {
+      num_dropped += q->tasks.size();
+      num_worker_queue_tasks_ -= q->tasks.size();
+      to_release.emplace_back(std::move(q->tasks));
+    }
+  }
+  if (num_dropped > 0 &&
+      num_worker_queue_tasks_outstanding_.fetch_sub(num_dropped) ==
+          num_dropped) {
+    idle_cond_.Broadcast();
+  }
   for (auto* t : tokens_) {
     if (!t->entries_.empty()) {
       to_release.emplace_back(std::move(t->entries_));
     }
+    t->num_high_priority_entries_ = 0;
     switch (t->state()) {
       case ThreadPoolToken::State::IDLE:
         // The token is idle; we can quiesce it immediately.
@@ -411,8 +496,7 @@ void ThreadPool::Shutdown() {
   // while others will exit after they finish executing an outstanding task.
   total_queued_tasks_ = 0;
   while (!idle_threads_.empty()) {
-    idle_threads_.front().not_empty.Signal();
-    idle_threads_.pop_front();
+    WakeIdleThreadUnlocked();
   }
   while (num_threads_ + num_threads_pending_start_ > 0) {
     no_threads_cond_.Wait();
@@ -467,13 +551,20 @@ Status ThreadPool::SubmitFunc(boost::function<void()> f) {
 }
 
 Status ThreadPool::Submit(shared_ptr<Runnable> r) {
-  return DoSubmit(std::move(r), tokenless_.get());
+  return DoSubmit(std::move(r), tokenless_.get(), Priority::NORMAL);
 }
 
-Status ThreadPool::DoSubmit(shared_ptr<Runnable> r, ThreadPoolToken* token) {
+Status ThreadPool::DoSubmit(
+    shared_ptr<Runnable> r,
+    ThreadPoolToken* token,
+    Priority priority) {
   DCHECK(token);
   MonoTime submit_time = MonoTime::Now();
 
+  if (work_stealing_ && token == tokenless_.get()) {
+    return SubmitToWorkerQueue(std::move(r), submit_time);
+  }
+
   MutexLock guard(lock_);
   if (PREDICT_FALSE(!pool_status_.ok())) {
     return pool_status_;
@@ -516,7 +607,8 @@ Status ThreadPool::DoSubmit(shared_ptr<Runnable> r, ThreadPoolToken* token) {
       token->IsActive() && token->mode() == ExecutionMode::SERIAL ? 0 : 1;
   int inactive_threads =
       num_threads_ + num_threads_pending_start_ - active_threads_;
-  int additional_threads = static_cast<int>(queue_.size()) +
+  int additional_threads =
+      static_cast<int>(queue_.size() + high_priority_queue_.size()) +
       threads_from_this_submit - inactive_threads;
   bool need_a_thread = false;
   if (additional_threads > 0 &&
@@ -534,16 +626,27 @@ Status ThreadPool::DoSubmit(shared_ptr<Runnable> r, ThreadPoolToken* token) {
     task.trace->AddRef();
   }
   task.submit_time = submit_time;
+  task.priority = priority;
 
-  // Add the task to the token's queue.
+  // Add the task to the token's queue. The tasks of a CONCURRENT token may run
+  // in any order, so its high priority tasks go ahead of the others.
   ThreadPoolToken::State state = token->state();
   DCHECK(
       state == ThreadPoolToken::State::IDLE ||
       state == ThreadPoolToken::State::RUNNING);
-  token->entries_.emplace_back(std::move(task));
+  const int token_length_at_submit = token->entries_.size();
+  const bool high_priority = priority == Priority::HIGH;
+  if (high_priority && token->mode() == ExecutionMode::CONCURRENT) {
+    token->entries_.insert(
+        token->entries_.begin() + token->num_high_priority_entries_,
+        std::move(task));
+    token->num_high_priority_entries_++;
+  } else {
+    token->entries_.emplace_back(std::move(task));
+  }
   if (state == ThreadPoolToken::State::IDLE ||
       token->mode() == ExecutionMode::CONCURRENT) {
-    queue_.emplace_back(token);
+    (high_priority ? high_priority_queue_ : queue_).emplace_back(token);
     if (state == ThreadPoolToken::State::IDLE) {
       token->Transition(ThreadPoolToken::State::RUNNING);
     }
@@ -557,17 +660,14 @@ Status ThreadPool::DoSubmit(shared_ptr<Runnable> r, ThreadPoolToken* token) {
   // If there are no idle threads, the new task remains on the queue and is
   // processed by an active thread (or a thread we're about to create) at some
   // point in the future.
-  if (!idle_threads_.empty()) {
-    idle_threads_.front().not_empty.Signal();
-    idle_threads_.pop_front();
-  }
+  WakeIdleThreadUnlocked();
   guard.Unlock();
 
   if (metrics_.queue_length_histogram) {
     metrics_.queue_length_histogram->Increment(length_at_submit);
   }
   if (token->metrics_.queue_length_histogram) {
-    token->metrics_.queue_length_histogram->Increment(length_at_submit);
+    token->metrics_.queue_length_histogram->Increment(token_length_at_submit);
   }
 
   if (need_a_thread) {
@@ -589,10 +689,117 @@ Status ThreadPool::DoSubmit(shared_ptr<Runnable> r, ThreadPoolToken* token) {
   return Status::OK();
 }
 
+Status ThreadPool::SubmitToWorkerQueue(
+    shared_ptr<Runnable> r,
+    const MonoTime& submit_time) {
+  // Like DoSubmit(), allow for as many tasks as there are threads to run them
+  // on top of the 'max_queue_size_' queued ones.
+  int64_t outstanding = num_worker_queue_tasks_outstanding_++;
+  if (PREDICT_FALSE(
+          outstanding >=
+          static_cast<int64_t>(max_threads_) + max_queue_size_)) {
+    FinishWorkerQueueTask();
+    return Status::ServiceUnavailable(Substitute(
+        "Thread pool is at capacity ($0/$1 tasks running or queued)",
+        outstanding,
+        static_cast<int64_t>(max_threads_) + max_queue_size_));
+  }
+
+  Task task;
+  task.runnable = std::move(r);
+  task.trace = Trace::CurrentTrace();
+  if (task.trace) {
+    task.trace->AddRef();
+  }
+  task.submit_time = submit_time;
+  task.priority = Priority::NORMAL;
+
+  // Workers queue the tasks they submit to themselves, which keeps a task's
+  // follow-up tasks on the same thread unless another worker runs dry.
+  int idx = tls_worker_pool == this
+      ? tls_worker_idx
+      : next_worker_queue_++ % worker_queues_.size();
+  WorkerQueue* q = worker_queues_[idx].get();
+  int64_t length_at_submit = 0;
+  {
+    std::lock_guard<simple_spinlock> l(q->lock);
+    if (PREDICT_TRUE(!q->closed)) {
+      q->tasks.emplace_back(std::move(task));
+      // Counted under the queue's lock so that the count never drops below
+      // the number of queued tasks.
+      length_at_submit = num_worker_queue_tasks_++;
+    }
+  }
+  if (PREDICT_FALSE(task.runnable != nullptr)) {
+    // The queue is closed, so the pool isn't running or has been shut down.
+    if (task.trace) {
+      task.trace->Release();
+    }
+    task.runnable.reset();
+    FinishWorkerQueueTask();
+    return Status::ServiceUnavailable("The pool has been shut down.");
+  }
+
+  // A worker going idle registers itself before checking for queued tasks,
+  // and we queued ours before checking for idle workers, so either it sees
+  // our task or we see it.
+  if (num_idle_threads_ > 0) {
+    MutexLock guard(lock_);
+    WakeIdleThreadUnlocked();
+  }
+
+  if (metrics_.queue_length_histogram) {
+    metrics_.queue_length_histogram->Increment(length_at_submit);
+  }
+  return Status::OK();
+}
+
+bool ThreadPool::PopWorkerQueueTask(int worker_idx, Task* task) {
+  const int num_queues = worker_queues_.size();
+  for (int i = 0; i < num_queues; i++) {
+    WorkerQueue* q = worker_queues_[(worker_idx + i) % num_queues].get();
+    std::lock_guard<simple_spinlock> l(q->lock);
+    if (!q->tasks.empty()) {
+      *task = std::move(q->tasks.front());
+      q->tasks.pop_front();
+      num_worker_queue_tasks_--;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::RunWorkerQueueTasks(int worker_idx) {
+  for (int i = 0; i < kWorkerQueueBatchSize; i++) {
+    Task task;
+    if (!PopWorkerQueueTask(worker_idx, &task)) {
+      return;
+    }
+    RunTask(&task, tokenless_.get());
+    FinishWorkerQueueTask();
+  }
+}
+
+void ThreadPool::FinishWorkerQueueTask() {
+  if (--num_worker_queue_tasks_outstanding_ == 0) {
+    MutexLock guard(lock_);
+    idle_cond_.Broadcast();
+  }
+}
+
+void ThreadPool::WakeIdleThreadUnlocked() {
+  if (!idle_threads_.empty()) {
+    idle_threads_.front().not_empty.Signal();
+    idle_threads_.pop_front();
+    num_idle_threads_--;
+  }
+}
+
 void ThreadPool::Wait() {
   MutexLock unique_lock(lock_);
   CheckNotPoolThreadUnlocked();
-  while (total_queued_tasks_ > 0 || active_threads_ > 0) {
+  while (total_queued_tasks_ > 0 || active_threads_ > 0 ||
+         num_worker_queue_tasks_outstanding_ > 0) {
     idle_cond_.Wait();
   }
 }
@@ -600,7 +807,8 @@ void ThreadPool::Wait() {
 bool ThreadPool::WaitUntil(const MonoTime& until) {
   MutexLock unique_lock(lock_);
   CheckNotPoolThreadUnlocked();
-  while (total_queued_tasks_ > 0 || active_threads_ > 0) {
+  while (total_queued_tasks_ > 0 || active_threads_ > 0 ||
+         num_worker_queue_tasks_outstanding_ > 0) {
     if (!idle_cond_.WaitUntil(until)) {
       return false;
     }
@@ -613,14 +821,26 @@ bool ThreadPool::WaitFor(const MonoDelta& delta) {
 }
 
 void ThreadPool::DispatchThread() {
+  if (!cpu_affinity_.empty()) {
+    WARN_NOT_OK(
+        SetThreadAffinity(Thread::CurrentThreadId(), cpu_affinity_),
+        Substitute("Could not set CPU affinity of $0 thread", name_));
+  }
   MutexLock unique_lock(lock_);
   InsertOrDie(&threads_, Thread::current_thread());
   DCHECK_GT(num_threads_pending_start_, 0);
   num_threads_++;
   num_threads_pending_start_--;
   // If we are one of the first 'min_threads_' to start, we must be
-  // a "permanent" thread.
-  bool permanent = num_threads_ <= min_threads_;
+  // a "permanent" thread. The workers of a work stealing pool all are.
+  bool permanent = work_stealing_ || num_threads_ <= min_threads_;
+  int worker_idx = -1;
+  if (work_stealing_) {
+    worker_idx = next_worker_idx_++;
+    DCHECK_LT(worker_idx, worker_queues_.size());
+    tls_worker_pool = this;
+    tls_worker_idx = worker_idx;
+  }
 
   // Owned by this worker thread and added/removed from idle_threads_ as needed.
   IdleThread me(&lock_);
@@ -632,20 +852,36 @@ void ThreadPool::DispatchThread() {
       break;
     }
 
-    if (queue_.empty()) {
+    if (work_stealing_ && num_worker_queue_tasks_ > 0) {
+      unique_lock.Unlock();
+      RunWorkerQueueTasks(worker_idx);
+      unique_lock.Lock();
+      if (!pool_status_.ok()) {
+        continue;
+      }
+    }
+
+    if (QueuesEmptyUnlocked()) {
       // There's no work to do, let's go idle.
       //
       // Note: if FIFO behavior is desired, it's as simple as changing this to
       // push_back().
       idle_threads_.push_front(me);
+      num_idle_threads_++;
       SCOPED_CLEANUP({
         // For some wake ups (i.e. Shutdown or DoSubmit) this thread is
         // guaranteed to be unlinked after being awakened. In others (i.e.
         // spurious wake-up or Wait timeout), it'll still be linked.
         if (me.is_linked()) {
           idle_threads_.erase(idle_threads_.iterator_to(me));
+          num_idle_threads_--;
         }
       });
+      // Tokenless tasks of a work stealing pool are queued without lock_, so
+      // check for them after going idle; see SubmitToWorkerQueue().
+      if (work_stealing_ && num_worker_queue_tasks_ > 0) {
+        continue;
+      }
       if (permanent) {
         me.not_empty.Wait();
       } else {
@@ -657,7 +893,7 @@ void ThreadPool::DispatchThread() {
           // another thread may actually grab the internal mutex protecting the
           // state, signal, and release again before we get the mutex. So, we'll
           // recheck the empty queue case regardless.
-          if (queue_.empty()) {
+          if (QueuesEmptyUnlocked()) {
             VLOG(3) << "Releasing worker thread from pool " << name_
                     << " after " << idle_timeout_.ToMilliseconds()
                     << "ms of idle time.";
@@ -669,59 +905,24 @@ void ThreadPool::DispatchThread() {
     }
 
     // Get the next token and task to execute.
-    ThreadPoolToken* token = queue_.front();
-    queue_.pop_front();
+    ThreadPoolToken* token = DequeueTokenUnlocked();
     DCHECK_EQ(ThreadPoolToken::State::RUNNING, token->state());
     DCHECK(!token->entries_.empty());
     Task task = std::move(token->entries_.front());
     token->entries_.pop_front();
+    if (token->num_high_priority_entries_ > 0) {
+      token->num_high_priority_entries_--;
+    }
     token->active_threads_++;
     --total_queued_tasks_;
     ++active_threads_;
 
     unique_lock.Unlock();
-
-    // Release the reference which was held by the queued item.
-    ADOPT_TRACE(task.trace);
-    if (task.trace) {
-      task.trace->Release();
-    }
-
-    // Update metrics
-    MonoTime now(MonoTime::Now());
-    int64_t queue_time_us = (now - task.submit_time).ToMicroseconds();
-    TRACE_COUNTER_INCREMENT(queue_time_trace_metric_name_, queue_time_us);
-    if (metrics_.queue_time_us_histogram) {
-      metrics_.queue_time_us_histogram->Increment(queue_time_us);
-    }
-    if (token->metrics_.queue_time_us_histogram) {
-      token->metrics_.queue_time_us_histogram->Increment(queue_time_us);
-    }
-
-    // Execute the task
-    {
-      MicrosecondsInt64 start_wall_us = GetMonoTimeMicros();
-
-      task.runnable->Run();
-
-      int64_t wall_us = GetMonoTimeMicros() - start_wall_us;
-
-      if (metrics_.run_time_us_histogram) {
-        metrics_.run_time_us_histogram->Increment(wall_us);
-      }
-      if (token->metrics_.run_time_us_histogram) {
-        token->metrics_.run_time_us_histogram->Increment(wall_us);
-      }
-      TRACE_COUNTER_INCREMENT(run_wall_time_trace_metric_name_, wall_us);
-    }
-    // Destruct the task while we do not hold the lock.
-    //
-    // The task's destructor may be expensive if it has a lot of bound
-    // objects, and we don't want to block submission of the threadpool.
-    // In the worst case, the destructor might even try to do something
-    // with this threadpool, and produce a deadlock.
-    task.runnable.reset();
+    int64_t wall_us = RunTask(&task, token);
     unique_lock.Lock();
+    if (fairness_quantum_us_ > 0) {
+      token->deficit_us_ -= wall_us;
+    }
 
     // Possible states:
     // 1. The token was shut down while we ran its task. Transition to QUIESCED.
@@ -738,7 +939,11 @@ void ThreadPool::DispatchThread() {
       } else if (token->entries_.empty()) {
         token->Transition(ThreadPoolToken::State::IDLE);
       } else if (token->mode() == ExecutionMode::SERIAL) {
-        queue_.emplace_back(token);
+        if (token->entries_.front().priority == Priority::HIGH) {
+          high_priority_queue_.emplace_back(token);
+        } else {
+          queue_.emplace_back(token);
+        }
       }
     }
     if (--active_threads_ == 0) {
@@ -753,16 +958,95 @@ void ThreadPool::DispatchThread() {
 
   CHECK_EQ(threads_.erase(Thread::current_thread()), 1);
   num_threads_--;
+  tls_worker_pool = nullptr;
+  tls_worker_idx = -1;
   if (num_threads_ + num_threads_pending_start_ == 0) {
     no_threads_cond_.Broadcast();
 
     // Sanity check: if we're the last thread exiting, the queue ought to be
     // empty. Otherwise it will never get processed.
-    CHECK(queue_.empty());
+    CHECK(QueuesEmptyUnlocked());
     DCHECK_EQ(0, total_queued_tasks_);
   }
 }
 
+int64_t ThreadPool::RunTask(Task* task, ThreadPoolToken* token) {
+  // Release the reference which was held by the queued item.
+  ADOPT_TRACE(task->trace);
+  if (task->trace) {
+    task->trace->Release();
+  }
+
+  // Update metrics
+  MonoTime now(MonoTime::Now());
+  int64_t queue_time_us = (now - task->submit_time).ToMicroseconds();
+  TRACE_COUNTER_INCREMENT(queue_time_trace_metric_name_, queue_time_us);
+  if (metrics_.queue_time_us_histogram) {
+    metrics_.queue_time_us_histogram->Increment(queue_time_us);
+  }
+  if (token->metrics_.queue_time_us_histogram) {
+    token->metrics_.queue_time_us_histogram->Increment(queue_time_us);
+  }
+
+  // Execute the task
+  int64_t wall_us;
+  {
+    MicrosecondsInt64 start_wall_us = GetMonoTimeMicros();
+
+    task->runnable->Run();
+
+    wall_us = GetMonoTimeMicros() - start_wall_us;
+
+    if (metrics_.run_time_us_histogram) {
+      metrics_.run_time_us_histogram->Increment(wall_us);
+    }
+    if (token->metrics_.run_time_us_histogram) {
+      token->metrics_.run_time_us_histogram->Increment(wall_us);
+    }
+    TRACE_COUNTER_INCREMENT(run_wall_time_trace_metric_name_, wall_us);
+  }
+  // Destruct the task while we do not hold the lock.
+  //
+  // The task's destructor may be expensive if it has a lot of bound
+  // objects, and we don't want to block submission of the threadpool.
+  // In the worst case, the destructor might even try to do something
+  // with this threadpool, and produce a deadlock.
+  task->runnable.reset();
+  return wall_us;
+}
+
+ThreadPoolToken* ThreadPool::DequeueTokenUnlocked() {
+  DCHECK(!QueuesEmptyUnlocked());
+  ThreadPoolToken* token;
+  if (!high_priority_queue_.empty()) {
+    token = high_priority_queue_.front();
+    high_priority_queue_.pop_front();
+    return token;
+  }
+  token = queue_.front();
+  queue_.pop_front();
+  if (fairness_quantum_us_ == 0) {
+    return token;
+  }
+  // Deficit round-robin: each turn earns the token a quantum of run time, and
+  // a token which is still in debt after that goes to the back of the queue.
+  // Every turn adds credit, so this terminates even if all the tokens are in
+  // debt.
+  while (true) {
+    if (queue_.empty()) {
+      // No other token is waiting, so there is nobody to be fair to.
+      token->deficit_us_ = std::max<int64_t>(token->deficit_us_, 0);
+    }
+    token->deficit_us_ += fairness_quantum_us_;
+    if (token->deficit_us_ > 0) {
+      return token;
+    }
+    queue_.emplace_back(token);
+    token = queue_.front();
+    queue_.pop_front();
+  }
+}
+
 Status ThreadPool::CreateThread() {
   return kudu::Thread::Create(
       "thread pool",
@@ -17,11 +17,13 @@
 #ifndef KUDU_UTIL_THREAD_POOL_H
 #define KUDU_UTIL_THREAD_POOL_H
 
+#include <atomic>
 #include <deque>
 #include <iosfwd>
 #include <memory>
 #include <string>
 #include <unordered_set>
+#include <vector>
 
 #include <boost/intrusive/list.hpp>
 #include <boost/intrusive/list_hook.hpp>
@@ -33,6 +35,7 @@
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/util/condition_variable.h"
+#include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/mutex.h"
@@ -59,7 +62,9 @@ class Runnable {
 // Interesting thread pool metrics. Can be applied to the entire pool (see
 // ThreadPoolBuilder) or to individual tokens.
 struct ThreadPoolMetrics {
-  // Measures the queue length seen by tasks when they enter the queue.
+  // Measures the queue length seen by tasks when they enter the queue: the
+  // number of tasks queued in the pool for the pool's metrics, and the number
+  // of tasks queued to the token for a token's metrics.
   scoped_refptr<Histogram> queue_length_histogram;
 
   // Measures the amount of time that tasks spend waiting in a queue.
@@ -114,6 +119,26 @@ struct ThreadPoolMetrics {
 // metrics: Histograms, counters, etc. to update on various threadpool events.
 //    Default: not set.
 //
+// cpu_affinity: CPUs the pool's threads may run on, e.g. those of the NUMA
+//    node the pool's work comes from.
+//    Default: not set (all CPUs).
+//
+// fairness_quantum: When set, tokens are scheduled by deficit round-robin on
+//    the run time of their tasks rather than one task per turn: on each turn
+//    a token earns this much run time, and a token whose tasks ran for longer
+//    than it earned skips turns until it is back in credit. This keeps a few
+//    tokens with long tasks from monopolizing the pool.
+//    Default: not set.
+//
+// work_stealing: When set, tasks submitted without a token skip the shared
+//    queue and its lock: each worker thread has its own queue of them, a task
+//    submitted by a worker goes to that worker's queue (and by any other
+//    thread to the queues in turn), and a worker whose queue is empty takes
+//    tasks from the others. Tasks submitted via tokens are scheduled as
+//    usual. The pool starts max_threads threads up front and keeps them, so
+//    min_threads and idle_timeout are ignored.
+//    Default: false.
+//
 class ThreadPoolBuilder {
  public:
   explicit ThreadPoolBuilder(std::string name);
@@ -126,6 +151,9 @@ class ThreadPoolBuilder {
   ThreadPoolBuilder& set_max_queue_size(int max_queue_size);
   ThreadPoolBuilder& set_idle_timeout(const MonoDelta& idle_timeout);
   ThreadPoolBuilder& set_metrics(ThreadPoolMetrics metrics);
+  ThreadPoolBuilder& set_cpu_affinity(std::vector<int> cpus);
+  ThreadPoolBuilder& set_fairness_quantum(const MonoDelta& quantum);
+  ThreadPoolBuilder& set_work_stealing(bool work_stealing);
 
   // Instantiate a new ThreadPool with the existing builder arguments.
   Status Build(gscoped_ptr<ThreadPool>* pool) const;
@@ -139,6 +167,9 @@ class ThreadPoolBuilder {
   int max_queue_size_;
   MonoDelta idle_timeout_;
   ThreadPoolMetrics metrics_;
+  std::vector<int> cpu_affinity_;
+  MonoDelta fairness_quantum_;
+  bool work_stealing_;
 
   DISALLOW_COPY_AND_ASSIGN(ThreadPoolBuilder);
 };
@@ -164,6 +195,17 @@ class ThreadPoolBuilder {
 // from starving one another. However, tokenless (and CONCURRENT token-based)
 // tasks can starve SERIAL token-based tasks.
 //
+// Tasks submitted via a token with Priority::HIGH are dispatched before all
+// the tasks of normal priority, e.g. so that the heartbeats of a Raft group
+// aren't held up by the work of busier groups sharing the pool. The tasks of a
+// SERIAL token still run in submission order, so a high priority task only
+// jumps ahead of the tasks of other tokens.
+//
+// A pool built with work stealing (see ThreadPoolBuilder) runs its tokenless
+// tasks from per-worker queues instead, in roughly FIFO order. Workers turn to
+// the token tasks between batches of tokenless tasks, so neither kind starves
+// the other for long.
+//
 // Usage Example:
 //    static void Func(int n) { ... }
 //    class Task : public Runnable { ... }
@@ -210,6 +252,12 @@ class ThreadPool {
   // Returns true if the pool reached the idle state, false otherwise.
   bool WaitFor(const MonoDelta& delta);
 
+  // The priority of a task submitted via a token.
+  enum class Priority {
+    NORMAL,
+    HIGH,
+  };
+
   // Allocates a new token for use in token-based task submission. All tokens
   // must be destroyed before their ThreadPool is destroyed.
   //
@@ -251,6 +299,8 @@ class ThreadPool {
 
     // Time at which the entry was submitted to the pool.
     MonoTime submit_time;
+
+    Priority priority;
   };
 
   // Creates a new thread pool using a builder.
@@ -259,9 +309,49 @@ class ThreadPool {
   // Initializes the thread pool by starting the minimum number of threads.
   Status Init();
 
+  // A worker thread's queue of tokenless tasks in a work stealing pool.
+  struct WorkerQueue {
+    simple_spinlock lock;
+
+    // Set when the pool is not accepting tasks: before Init() and after
+    // Shutdown().
+    //
+    // Protected by 'lock'.
+    bool closed = true;
+
+    // Protected by 'lock'.
+    std::deque<Task> tasks;
+  };
+
   // Dispatcher responsible for dequeueing and executing the tasks
   void DispatchThread();
 
+  // Runs 'task' on behalf of 'token' and returns its run time. Must be called
+  // without holding any lock.
+  int64_t RunTask(Task* task, ThreadPoolToken* token);
+
+  // Submits a tokenless task to the worker queues of a work stealing pool.
+  Status SubmitToWorkerQueue(
+      std::shared_ptr<Runnable> r,
+      const MonoTime& submit_time);
+
+  // Pops the next tokenless task into 'task', looking at the queue of worker
+  // 'worker_idx' first and then stealing from the other workers. Returns false
+  // if every worker queue is empty.
+  bool PopWorkerQueueTask(int worker_idx, Task* task);
+
+  // Runs tokenless tasks from the worker queues until they are all empty or
+  // a batch of them has run, so that token tasks get a turn.
+  void RunWorkerQueueTasks(int worker_idx);
+
+  // Accounts for a tokenless task of a work stealing pool that has finished
+  // running or was dropped, waking the waiters of Wait() if it was the last.
+  void FinishWorkerQueueTask();
+
+  // Signals the thread at the front of 'idle_threads_', if any, and removes
+  // it from the list.
+  void WakeIdleThreadUnlocked();
+
   // Create new thread.
   //
   // REQUIRES: caller has incremented 'num_threads_pending_start_' ahead of this
@@ -272,7 +362,20 @@ class ThreadPool {
   void CheckNotPoolThreadUnlocked();
 
   // Submits a task to be run via token.
-  Status DoSubmit(std::shared_ptr<Runnable> r, ThreadPoolToken* token);
+  Status DoSubmit(
+      std::shared_ptr<Runnable> r,
+      ThreadPoolToken* token,
+      Priority priority);
+
+  // Returns true if no token has a task ready to run.
+  bool QueuesEmptyUnlocked() const {
+    return queue_.empty() && high_priority_queue_.empty();
+  }
+
+  // Dequeues the token whose task should run next.
+  //
+  // REQUIRES: !QueuesEmptyUnlocked().
+  ThreadPoolToken* DequeueTokenUnlocked();
 
   // Releases token 't' and invalidates it.
   void ReleaseToken(ThreadPoolToken* t);
@@ -282,6 +385,14 @@ class ThreadPool {
   const int max_threads_;
   const int max_queue_size_;
   const MonoDelta idle_timeout_;
+  const std::vector<int> cpu_affinity_;
+
+  // The run time a token earns on each turn, or 0 to give tokens one task
+  // per turn.
+  const int64_t fairness_quantum_us_;
+
+  // Whether tokenless tasks go through 'worker_queues_'.
+  const bool work_stealing_;
 
   // Overall status of the pool. Set to an error when the pool is shut down.
   //
@@ -335,12 +446,41 @@ class ThreadPool {
   // Protected by lock_.
   std::deque<ThreadPoolToken*> queue_;
 
+  // Like 'queue_', but for the tokens whose next task has Priority::HIGH.
+  // Served before 'queue_'.
+  //
+  // Protected by lock_.
+  std::deque<ThreadPoolToken*> high_priority_queue_;
+
   // Pointers to all running threads. Raw pointers are safe because a Thread
   // may only go out of scope after being removed from threads_.
   //
   // Protected by lock_.
   std::unordered_set<Thread*> threads_;
 
+  // One queue of tokenless tasks per worker thread, if work stealing is used.
+  // The vector is immutable after construction.
+  std::vector<std::unique_ptr<WorkerQueue>> worker_queues_;
+
+  // Number of tokenless tasks in 'worker_queues_'.
+  std::atomic<int64_t> num_worker_queue_tasks_;
+
+  // Number of tokenless tasks in 'worker_queues_' or running.
+  std::atomic<int64_t> num_worker_queue_tasks_outstanding_;
+
+  // Round-robin cursor into 'worker_queues_' for submissions from threads
+  // that aren't workers of this pool.
+  std::atomic<uint32_t> next_worker_queue_;
+
+  // Index of the next worker thread to start, when work stealing is used.
+  //
+  // Protected by lock_.
+  int next_worker_idx_;
+
+  // Number of threads in 'idle_threads_'. Updated under lock_, but read
+  // without it to skip waking threads when none are idle.
+  std::atomic<int> num_idle_threads_;
+
   // List of all threads currently waiting for work.
   //
   // A thread is added to the front of the list when it goes idle and is
@@ -390,10 +530,16 @@ class ThreadPoolToken {
   Status SubmitClosure(Closure c) WARN_UNUSED_RESULT;
 
   // Submits a function bound using boost::bind(&FuncName, args...).
-  Status SubmitFunc(boost::function<void()> f) WARN_UNUSED_RESULT;
+  Status SubmitFunc(
+      boost::function<void()> f,
+      ThreadPool::Priority priority = ThreadPool::Priority::NORMAL)
+      WARN_UNUSED_RESULT;
 
   // Submits a Runnable class.
-  Status Submit(std::shared_ptr<Runnable> r) WARN_UNUSED_RESULT;
+  Status Submit(
+      std::shared_ptr<Runnable> r,
+      ThreadPool::Priority priority = ThreadPool::Priority::NORMAL)
+      WARN_UNUSED_RESULT;
 
   // Marks the token as unusable for future submissions. Any queued tasks not
   // yet running are destroyed. If tasks are in flight, Shutdown() will wait
@@ -494,6 +640,16 @@ class ThreadPoolToken {
   // Queued client tasks.
   std::deque<ThreadPool::Task> entries_;
 
+  // Number of Priority::HIGH tasks at the front of 'entries_'. Only used by
+  // CONCURRENT tokens, which queue their high priority tasks ahead of the
+  // others.
+  int num_high_priority_entries_;
+
+  // The run time the token may still use before skipping turns, when the pool
+  // is configured with a fairness quantum. Negative when its tasks ran
+  // for longer than it earned.
+  int64_t deficit_us_;
+
   // Condition variable for "token is idle". Waiters wake up when the token
   // transitions to IDLE or QUIESCED.
   ConditionVariable not_running_cond_;
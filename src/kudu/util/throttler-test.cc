@@ -72,4 +72,42 @@ TEST_F(ThrottlerTest, TestBurst) {
   ASSERT_FALSE(t0.Take(now, 1, 1));
 }
 
+TEST_F(ThrottlerTest, TestMaxTokens) {
+  MonoTime now = MonoTime::Now();
+  // The buckets are refilled by a tenth of the rates every 100ms, rounded
+  // down, so they hold less than a second's worth of rates which aren't
+  // multiples of 10.
+  Throttler t0(now, 15, 500005, 10);
+  ASSERT_EQ(10, t0.max_op_tokens());
+  ASSERT_EQ(500000, t0.max_byte_tokens());
+  now += MonoDelta::FromMilliseconds(2000);
+  ASSERT_FALSE(t0.Take(now, 15, 1));
+  ASSERT_FALSE(t0.Take(now, 1, 500005));
+  ASSERT_TRUE(t0.Take(now, t0.max_op_tokens(), t0.max_byte_tokens()));
+
+  // Rates below 10 aren't throttled at all.
+  Throttler t1(now, 5, 0, 10);
+  ASSERT_EQ(0, t1.max_op_tokens());
+  ASSERT_EQ(0, t1.max_byte_tokens());
+  ASSERT_TRUE(t1.Take(now, 100, 100));
+}
+
+TEST_F(ThrottlerTest, TestRefund) {
+  MonoTime now = MonoTime::Now();
+  Throttler t0(now, 1000, 1000 * 1000, 1);
+  now += MonoDelta::FromMilliseconds(2000);
+  ASSERT_TRUE(t0.Take(now, 100, 1));
+  ASSERT_FALSE(t0.Take(now, 1, 1));
+  t0.Refund(40, 1);
+  for (int i = 0; i < 40; i++) {
+    ASSERT_TRUE(t0.Take(now, 1, 1));
+  }
+  ASSERT_FALSE(t0.Take(now, 1, 1));
+
+  // Refunds don't fill the buckets past their burst rate.
+  t0.Refund(1000, 1000 * 1000);
+  ASSERT_TRUE(t0.Take(now, 100, 1));
+  ASSERT_FALSE(t0.Take(now, 1, 1));
+}
+
 } // namespace kudu
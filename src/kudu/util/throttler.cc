@@ -57,6 +57,16 @@ bool Throttler::Take(MonoTime now, uint64_t op, uint64_t byte) {
   return false;
 }
 
+void Throttler::Refund(uint64_t op, uint64_t byte) {
+  std::lock_guard<simple_spinlock> lock(lock_);
+  if (op_refill_ > 0) {
+    op_token_ = std::min(op_token_ + op, op_token_max_);
+  }
+  if (byte_refill_ > 0) {
+    byte_token_ = std::min(byte_token_ + byte, byte_token_max_);
+  }
+}
+
 void Throttler::Refill(MonoTime now) {
   int64_t d = (now - next_refill_).ToMicroseconds();
   if (d < 0) {
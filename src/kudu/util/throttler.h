@@ -46,6 +46,19 @@ class Throttler {
   // throttled.
   bool Take(MonoTime now, uint64_t op, uint64_t byte);
 
+  // Gives back tokens taken by Take(), e.g. when the operation group was not
+  // run after all. The buckets still hold no more than their burst rate.
+  void Refund(uint64_t op, uint64_t byte);
+
+  // The most operation and byte tokens the buckets hold, i.e. the most an
+  // operation group can take at once. 0 if that kind is not throttled.
+  uint64_t max_op_tokens() const {
+    return op_token_max_;
+  }
+  uint64_t max_byte_tokens() const {
+    return byte_token_max_;
+  }
+
  private:
   void Refill(MonoTime now);
 
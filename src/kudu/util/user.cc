@@ -37,9 +37,8 @@
 using std::string;
 
 namespace kudu {
-namespace {
 
-Status DoGetLoggedInUser(string* user_name) {
+Status GetUserName(uid_t uid, string* user_name) {
   DCHECK(user_name != nullptr);
 
   struct passwd pwd;
@@ -55,11 +54,10 @@ Status DoGetLoggedInUser(string* user_name) {
     return Status::RuntimeError("malloc failed", ErrnoToString(errno), errno);
   }
 
-  int ret = getpwuid_r(getuid(), &pwd, buf.get(), bufsize, &result);
+  int ret = getpwuid_r(uid, &pwd, buf.get(), bufsize, &result);
   if (result == nullptr) {
     if (ret == 0) {
-      return Status::NotFound(
-          "Current logged-in user not found! This is an unexpected error.");
+      return Status::NotFound("user not found", std::to_string(uid));
     } else {
       // Errno in ret
       return Status::RuntimeError(
@@ -70,15 +68,17 @@ Status DoGetLoggedInUser(string* user_name) {
   return Status::OK();
 }
 
-} // anonymous namespace
-
 Status GetLoggedInUser(string* user_name) {
   static std::once_flag once;
   static string* once_user_name;
   static Status* once_status;
   std::call_once(once, []() {
     string u;
-    Status s = DoGetLoggedInUser(&u);
+    Status s = GetUserName(getuid(), &u);
+    if (s.IsNotFound()) {
+      s = Status::NotFound(
+          "Current logged-in user not found! This is an unexpected error.");
+    }
     debug::ScopedLeakCheckDisabler ignore_leaks;
     once_status = new Status(std::move(s));
     once_user_name = new string(std::move(u));
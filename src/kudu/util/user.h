@@ -17,6 +17,8 @@
 #ifndef KUDU_UTIL_USER_H
 #define KUDU_UTIL_USER_H
 
+#include <sys/types.h>
+
 #include <string>
 
 #include "kudu/util/status.h"
@@ -27,6 +29,9 @@ namespace kudu {
 // user name is written to user_name.
 Status GetLoggedInUser(std::string* user_name);
 
+// Get the name of the user 'uid' with getpwuid_r().
+Status GetUserName(uid_t uid, std::string* user_name);
+
 } // namespace kudu
 
 #endif // KUDU_UTIL_USER_H